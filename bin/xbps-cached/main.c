@@ -0,0 +1,996 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * xbps-cached: a caching HTTP server for remote repositories.
+ *
+ * Every object requested by a client is fetched from the upstream
+ * repository once, with xbps_fetch_file_dest(), and stored in the cache
+ * directory with the same path; concurrent requests for an object being
+ * fetched wait for it rather than fetching it again.
+ *
+ * Binary packages, their signatures and deltas are named by their pkgver
+ * and never change, so they are served from the cache forever; they are
+ * only fetched if the repository index lists that pkgver. Repository
+ * indexes are revalidated with a conditional request if they were checked
+ * more than ttl seconds ago, and served stale if upstream is unreachable.
+ * Clients verify the repository index and package signatures themselves,
+ * so the cache doesn't need the repository keys.
+ */
+#define _DEFAULT_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xbps.h>
+#include "queue.h"
+
+#define MAXLISTEN	8
+#define MAXLINE		8192
+#define MAXHEADERS	100
+#define IDLE_TIMEOUT	60
+#define MAXOBJECTS	4096
+
+/* An object requested by clients, fetched or being fetched */
+struct object {
+	struct object *next;
+	TAILQ_ENTRY(object) lru;
+	char *path;
+	xbps_dictionary_t idx;	/* index of a *-repodata, loaded on demand */
+	time_t checked;		/* last fetch or validation from upstream */
+	unsigned int refs;	/* requests using it */
+	bool fetching;
+	bool unlinked;
+	int rv;
+};
+
+#define OBJHSIZE	1024
+#define OBJHMASK	(OBJHSIZE - 1)
+
+/*
+ * Objects are kept in a hash table capped to MAXOBJECTS entries, the
+ * least recently used ones not in use by a request are evicted first.
+ */
+static struct object *objects[OBJHSIZE];
+static TAILQ_HEAD(, object) obj_lru = TAILQ_HEAD_INITIALIZER(obj_lru);
+static unsigned int nobjects;
+static pthread_mutex_t obj_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t obj_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t conn_mtx = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int nconns, maxconns = 64;
+
+static struct xbps_handle xh;
+static const char *upstream, *cachedir;
+static time_t ttl = 60;
+
+struct request {
+	char *path;
+	bool head;
+	bool close;
+	bool range;
+	off_t start;
+	off_t end;		/* -1 until the end, start is a suffix */
+	char *ims;		/* If-Modified-Since */
+	char *inm;		/* If-None-Match */
+};
+
+static void __attribute__((noreturn))
+usage(bool fail)
+{
+	fprintf(stdout,
+	    "Usage: xbps-cached [OPTIONS] <upstream> <cachedir>\n\n"
+	    "OPTIONS\n"
+	    " -C --config <dir>          Path to confdir (xbps.d)\n"
+	    " -d --debug                 Debug mode shown to stderr\n"
+	    " -h --help                  Show usage\n"
+	    " -j --max-conns <n>         Maximum number of client connections (64)\n"
+	    " -l --listen <addr>         Address to listen on (all)\n"
+	    " -p --port <port>           Port to listen on (8080)\n"
+	    " -t --ttl <secs>            Revalidate repository indexes after secs (60)\n"
+	    " -v --verbose               Log requests to stdout\n"
+	    " -V --version               Show XBPS version\n");
+	exit(fail ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static unsigned int
+objhash(const char *path)
+{
+	unsigned int hv = 0xA1B5F342;
+
+	for (; *path; path++)
+		hv = (hv << 5) ^ (hv >> 23) ^ (unsigned char)*path;
+
+	return hv & OBJHMASK;
+}
+
+static void
+object_free(struct object *obj)
+{
+	if (obj->idx)
+		xbps_object_release(obj->idx);
+	free(obj->path);
+	free(obj);
+}
+
+/*
+ * Removes obj from the table, it's freed once the last request using it
+ * drops its reference. Must be called with obj_mtx held.
+ */
+static void
+object_unlink(struct object *obj)
+{
+	struct object **op;
+
+	for (op = &objects[objhash(obj->path)]; *op != obj; op = &(*op)->next)
+		;
+	*op = obj->next;
+	TAILQ_REMOVE(&obj_lru, obj, lru);
+	nobjects--;
+	obj->unlinked = true;
+	if (obj->refs == 0)
+		object_free(obj);
+}
+
+/*
+ * Returns the object for path with a reference held, to be dropped with
+ * object_put(). Must be called with obj_mtx held.
+ */
+static struct object *
+object_get(const char *path)
+{
+	struct object *obj, *tmp;
+	unsigned int hv = objhash(path);
+
+	for (obj = objects[hv]; obj; obj = obj->next) {
+		if (strcmp(obj->path, path) == 0) {
+			TAILQ_REMOVE(&obj_lru, obj, lru);
+			TAILQ_INSERT_TAIL(&obj_lru, obj, lru);
+			obj->refs++;
+			return obj;
+		}
+	}
+	for (obj = TAILQ_FIRST(&obj_lru); obj && nobjects >= MAXOBJECTS;
+	    obj = tmp) {
+		tmp = TAILQ_NEXT(obj, lru);
+		if (obj->refs == 0)
+			object_unlink(obj);
+	}
+	obj = calloc(1, sizeof(*obj));
+	assert(obj);
+	obj->path = strdup(path);
+	assert(obj->path);
+	obj->refs = 1;
+	obj->next = objects[hv];
+	objects[hv] = obj;
+	TAILQ_INSERT_TAIL(&obj_lru, obj, lru);
+	nobjects++;
+
+	return obj;
+}
+
+/* must be called with obj_mtx held */
+static void
+object_put(struct object *obj)
+{
+	if (--obj->refs == 0 && obj->unlinked)
+		object_free(obj);
+}
+
+static bool
+has_suffix(const char *str, const char *suffix)
+{
+	size_t len = strlen(str), slen = strlen(suffix);
+
+	return len > slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+/*
+ * Returns 1 for objects that never change, 2 for repository indexes and
+ * 0 for anything else, which is not served.
+ */
+static int
+object_type(const char *path)
+{
+	if (has_suffix(path, ".xbps") || has_suffix(path, ".xbps.sig") ||
+	    has_suffix(path, ".xdlt"))
+		return 1;
+	else if (has_suffix(path, "-repodata"))
+		return 2;
+
+	return 0;
+}
+
+/*
+ * Fetches the object in path from upstream into file. Returns -1 if it
+ * can't be served, 0 if the cached copy is kept and 1 if it was fetched.
+ */
+static int
+object_fetch(const char *path, const char *file)
+{
+	struct stat st;
+	char *dir, *uri;
+	const char *errstr;
+	int rv;
+
+	dir = strdup(file);
+	assert(dir);
+	if (xbps_mkpath(dirname(dir), 0755) == -1 && errno != EEXIST) {
+		xbps_error_printf("xbps-cached: failed to create %s: %s\n",
+		    dir, strerror(errno));
+	}
+	free(dir);
+
+	uri = xbps_xasprintf("%s%s", upstream, path);
+	xbps_dbg_printf(&xh, "fetching %s\n", uri);
+	if ((rv = xbps_fetch_file_dest(&xh, uri, file, NULL)) == -1) {
+		errstr = xbps_fetch_error_string();
+		if (stat(file, &st) == 0)
+			rv = 0;
+		xbps_error_printf("xbps-cached: failed to fetch %s%s: %s\n",
+		    uri, rv == 0 ? " (serving cached copy)" : "",
+		    errstr ? errstr : strerror(errno));
+	}
+	free(uri);
+
+	return rv;
+}
+
+/*
+ * Makes sure the object in path is in the cache directory, fetching or
+ * revalidating it from upstream. Returns 0 if it can be served.
+ *
+ * If idxp is set the object is a repository index, and a reference to
+ * its index dictionary is returned in idxp.
+ */
+static int
+object_cache(const char *path, bool volatile_obj, xbps_dictionary_t *idxp)
+{
+	struct object *obj;
+	struct stat st;
+	xbps_dictionary_t idx = NULL;
+	char *file;
+	time_t now;
+	bool fresh, coalesced = false;
+	int rv = 0;
+
+	file = xbps_xasprintf("%s%s", cachedir, path);
+
+	pthread_mutex_lock(&obj_mtx);
+	obj = object_get(path);
+	/* coalesce with the request already fetching it */
+	while (obj->fetching) {
+		coalesced = true;
+		pthread_cond_wait(&obj_cond, &obj_mtx);
+	}
+	if (coalesced &&
+	    (obj->rv != 0 || idxp == NULL || obj->idx != NULL)) {
+		rv = obj->rv;
+		goto out;
+	}
+	now = time(NULL);
+	fresh = stat(file, &st) == 0 &&
+	    (!volatile_obj || now - obj->checked < ttl);
+	if (fresh && (idxp == NULL || obj->idx != NULL))
+		goto out;
+	obj->fetching = true;
+	pthread_mutex_unlock(&obj_mtx);
+
+	if (!fresh)
+		rv = object_fetch(path, file);
+	/* only this request changes obj->idx while fetching is set */
+	if (idxp && (rv == 1 || (rv == 0 && obj->idx == NULL))) {
+		if ((idx = xbps_archive_fetch_plist(file, XBPS_REPOIDX)) == NULL)
+			xbps_error_printf("xbps-cached: failed to read "
+			    "index %s\n", path);
+	}
+
+	pthread_mutex_lock(&obj_mtx);
+	obj->fetching = false;
+	if (idx || rv == 1) {
+		if (obj->idx)
+			xbps_object_release(obj->idx);
+		obj->idx = idx;
+	}
+	obj->rv = rv = rv == -1 ? ENOENT : 0;
+	/* don't retry a failed validation on every request either */
+	if (!fresh)
+		obj->checked = now;
+	pthread_cond_broadcast(&obj_cond);
+	/* failed objects aren't kept, waiters still hold a reference */
+	if (rv != 0)
+		object_unlink(obj);
+out:
+	if (idxp && rv == 0 && obj->idx) {
+		xbps_object_retain(obj->idx);
+		*idxp = obj->idx;
+	}
+	object_put(obj);
+	pthread_mutex_unlock(&obj_mtx);
+	free(file);
+
+	return rv;
+}
+
+/*
+ * Returns true if the index in path lists pkgver for arch.
+ */
+static bool
+index_lists(const char *path, const char *pkgver, const char *arch)
+{
+	xbps_dictionary_t idx = NULL, pkgd;
+	char pkgname[XBPS_NAME_SIZE];
+	const char *s;
+	bool found = false;
+
+	if (!xbps_pkg_name_buf(pkgname, sizeof(pkgname), pkgver) ||
+	    object_cache(path, true, &idx) != 0 || idx == NULL)
+		return false;
+
+	if ((pkgd = xbps_dictionary_get(idx, pkgname)) != NULL &&
+	    xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &s) &&
+	    strcmp(s, pkgver) == 0 &&
+	    xbps_dictionary_get_cstring_nocopy(pkgd, "architecture", &s) &&
+	    strcmp(s, arch) == 0)
+		found = true;
+
+	xbps_object_release(idx);
+	return found;
+}
+
+/*
+ * Checks that the binary package, signature or delta in path, named
+ * "<pkgver>.<arch>" plus a suffix, is listed by the repository index in
+ * the same directory. noarch packages are looked up in the indexes of
+ * that directory in the cache.
+ */
+static bool
+object_listed(const char *path)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	char *pkgver, *arch, *p, *idxpath;
+	const char *base = strrchr(path, '/') + 1;
+	int dirlen = (int)(base - path);
+	size_t len;
+	bool found = false;
+
+	pkgver = strdup(base);
+	assert(pkgver);
+	/* strip .xbps, .xbps.sig or .xdlt */
+	len = strlen(pkgver) - (has_suffix(pkgver, ".sig") ? 9 : 5);
+	pkgver[len] = '\0';
+	if ((arch = strrchr(pkgver, '.')) == NULL) {
+		free(pkgver);
+		return false;
+	}
+	*arch++ = '\0';
+
+	if (strcmp(arch, "noarch") != 0) {
+		idxpath = xbps_xasprintf("%.*s%s-repodata", dirlen, path, arch);
+		found = index_lists(idxpath, pkgver, arch);
+		free(idxpath);
+		free(pkgver);
+		return found;
+	}
+	p = xbps_xasprintf("%s%.*s", cachedir, dirlen, path);
+	dirp = opendir(p);
+	free(p);
+	while (dirp && !found && (dp = readdir(dirp)) != NULL) {
+		if (!has_suffix(dp->d_name, "-repodata"))
+			continue;
+		idxpath = xbps_xasprintf("%.*s%s", dirlen, path, dp->d_name);
+		found = index_lists(idxpath, pkgver, arch);
+		free(idxpath);
+	}
+	if (dirp)
+		closedir(dirp);
+	free(pkgver);
+
+	return found;
+}
+
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t wr;
+
+	while (len > 0) {
+		if ((wr = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += wr;
+		len -= (size_t)wr;
+	}
+	return 0;
+}
+
+static int
+send_file(int fd, int ffd, off_t off, off_t len)
+{
+#ifdef __linux__
+	ssize_t wr;
+
+	while (len > 0) {
+		wr = sendfile(fd, ffd, &off, len > SSIZE_MAX ? SSIZE_MAX : (size_t)len);
+		if (wr == -1 && errno == EINTR)
+			continue;
+		else if (wr <= 0)
+			return -1;
+		len -= wr;
+	}
+#else
+	char buf[64 * 1024];
+	ssize_t rd;
+
+	while (len > 0) {
+		rd = pread(ffd, buf, len > (off_t)sizeof(buf) ? sizeof(buf) : (size_t)len, off);
+		if (rd == -1 && errno == EINTR)
+			continue;
+		else if (rd <= 0 || write_all(fd, buf, (size_t)rd) == -1)
+			return -1;
+		off += rd;
+		len -= rd;
+	}
+#endif
+	return 0;
+}
+
+static void
+http_date(time_t t, char *buf, size_t len)
+{
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static int
+reply_error(int fd, struct request *req, int code, const char *reason)
+{
+	char buf[512];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\n"
+	    "Content-Type: text/plain\r\n"
+	    "Content-Length: %zu\r\n"
+	    "%s\r\n", code, reason, strlen(reason) + 5,
+	    req->close ? "Connection: close\r\n" : "");
+	/* no body for HEAD */
+	if (!req->head)
+		len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+		    "%d %s\n", code, reason);
+	if (xh.flags & XBPS_FLAG_VERBOSE)
+		printf("%s %s %d\n", req->head ? "HEAD" : "GET",
+		    req->path ? req->path : "-", code);
+
+	return write_all(fd, buf, (size_t)len);
+}
+
+static int
+reply_object(int fd, struct request *req)
+{
+	struct stat st;
+	char *file, buf[1024], etag[64], lastmod[64], range[128] = "";
+	off_t start = 0, len;
+	int ffd, code = 200, rv, n;
+
+	file = xbps_xasprintf("%s%s", cachedir, req->path);
+	ffd = open(file, O_RDONLY|O_CLOEXEC);
+	free(file);
+	if (ffd == -1 || fstat(ffd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		if (ffd != -1)
+			(void)close(ffd);
+		return reply_error(fd, req, 404, "Not Found");
+	}
+	snprintf(etag, sizeof(etag), "\"%jx-%jx\"",
+	    (uintmax_t)st.st_size, (uintmax_t)st.st_mtime);
+	http_date(st.st_mtime, lastmod, sizeof(lastmod));
+
+	if ((req->inm && strcmp(req->inm, etag) == 0) ||
+	    (req->inm == NULL && req->ims && strcmp(req->ims, lastmod) == 0)) {
+		code = 304;
+		len = 0;
+	} else if (req->range) {
+		if (req->end == -1 && req->start < 0) {
+			/* suffix range */
+			start = st.st_size + req->start;
+			if (start < 0)
+				start = 0;
+		} else {
+			start = req->start;
+		}
+		if (start >= st.st_size) {
+			(void)close(ffd);
+			n = snprintf(buf, sizeof(buf), "HTTP/1.1 416 Range Not "
+			    "Satisfiable\r\nContent-Range: bytes */%jd\r\n"
+			    "Content-Length: 0\r\n%s\r\n", (intmax_t)st.st_size,
+			    req->close ? "Connection: close\r\n" : "");
+			if (xh.flags & XBPS_FLAG_VERBOSE)
+				printf("GET %s 416\n", req->path);
+			return write_all(fd, buf, (size_t)n);
+		}
+		if (req->end == -1 || req->end >= st.st_size)
+			len = st.st_size - start;
+		else
+			len = req->end - start + 1;
+		code = 206;
+		snprintf(range, sizeof(range), "Content-Range: bytes "
+		    "%jd-%jd/%jd\r\n", (intmax_t)start,
+		    (intmax_t)(start + len - 1), (intmax_t)st.st_size);
+	} else {
+		len = st.st_size;
+	}
+	n = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\n"
+	    "Content-Type: application/octet-stream\r\n"
+	    "Content-Length: %jd\r\n"
+	    "Last-Modified: %s\r\n"
+	    "ETag: %s\r\n"
+	    "Accept-Ranges: bytes\r\n"
+	    "%s%s\r\n", code,
+	    code == 200 ? "OK" : code == 206 ? "Partial Content" :
+	    "Not Modified", (intmax_t)len, lastmod, etag, range,
+	    req->close ? "Connection: close\r\n" : "");
+	if (xh.flags & XBPS_FLAG_VERBOSE)
+		printf("%s %s %d\n", req->head ? "HEAD" : "GET", req->path, code);
+
+	rv = write_all(fd, buf, (size_t)n);
+	if (rv == 0 && code != 304 && !req->head)
+		rv = send_file(fd, ffd, start, len);
+	(void)close(ffd);
+
+	return rv;
+}
+
+/*
+ * Decodes the path of the request target in place and checks it's a
+ * relative path that can be mapped to upstream and the cache directory.
+ */
+static bool
+parse_path(char *path)
+{
+	char *s, *d, *p;
+	int c;
+
+	if (*path != '/')
+		return false;
+	if ((p = strchr(path, '?')) != NULL)
+		*p = '\0';
+
+	for (s = d = path; *s; s++, d++) {
+		if (*s == '%' && isxdigit((unsigned char)s[1]) &&
+		    isxdigit((unsigned char)s[2])) {
+			sscanf(s + 1, "%2x", &c);
+			*d = (char)c;
+			s += 2;
+		} else {
+			*d = *s;
+		}
+		if (*d == '\0' || *d == '\\' || iscntrl((unsigned char)*d))
+			return false;
+	}
+	*d = '\0';
+
+	/* reject . and .. components */
+	for (p = path; p; p = strchr(p + 1, '/')) {
+		if (strncmp(p, "/./", 3) == 0 || strcmp(p, "/.") == 0 ||
+		    strncmp(p, "/../", 4) == 0 || strcmp(p, "/..") == 0)
+			return false;
+	}
+	return true;
+}
+
+static bool
+parse_range(struct request *req, const char *value)
+{
+	char *end;
+
+	if (strncmp(value, "bytes=", 6) != 0 || strchr(value, ','))
+		return false;
+	value += 6;
+	if (*value == '-') {
+		req->start = -(off_t)strtoll(value + 1, &end, 10);
+		req->end = -1;
+		return *end == '\0' && req->start < 0;
+	}
+	req->start = (off_t)strtoll(value, &end, 10);
+	if (*end++ != '-' || req->start < 0)
+		return false;
+	if (*end == '\0') {
+		req->end = -1;
+		return true;
+	}
+	req->end = (off_t)strtoll(end, &end, 10);
+
+	return *end == '\0' && req->end >= req->start;
+}
+
+static char *
+header_value(char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (strncasecmp(line, name, len) != 0 || line[len] != ':')
+		return NULL;
+	for (line += len + 1; *line == ' ' || *line == '\t'; line++)
+		;
+	return line;
+}
+
+static bool
+read_line(FILE *in, char *line, size_t len, bool *toolong)
+{
+	size_t n;
+
+	if (fgets(line, (int)len, in) == NULL)
+		return false;
+	n = strlen(line);
+	if (n == 0 || line[n - 1] != '\n') {
+		*toolong = true;
+		return false;
+	}
+	line[--n] = '\0';
+	if (n > 0 && line[n - 1] == '\r')
+		line[--n] = '\0';
+
+	return true;
+}
+
+/*
+ * Reads and replies to a request from the client, returns 0 if the
+ * connection can be kept alive for the next one.
+ */
+static int
+serve_request(int fd, FILE *in)
+{
+	struct request req;
+	char line[MAXLINE], *method, *target, *version, *value, *p;
+	bool toolong = false;
+	int type, nhdrs = 0, rv = -1;
+	bool get;
+
+	memset(&req, 0, sizeof(req));
+
+	/* skip empty lines before the request line */
+	do {
+		if (!read_line(in, line, sizeof(line), &toolong)) {
+			if (toolong) {
+				req.close = true;
+				reply_error(fd, &req, 414, "URI Too Long");
+			}
+			return -1;
+		}
+	} while (line[0] == '\0');
+
+	method = strtok_r(line, " ", &p);
+	target = strtok_r(NULL, " ", &p);
+	version = strtok_r(NULL, " ", &p);
+	if (method == NULL || target == NULL || version == NULL ||
+	    strncmp(version, "HTTP/1.", 7) != 0) {
+		req.close = true;
+		reply_error(fd, &req, 400, "Bad Request");
+		return -1;
+	}
+	if (strcmp(version, "HTTP/1.0") == 0)
+		req.close = true;
+	/* line is reused for the headers */
+	req.head = strcmp(method, "HEAD") == 0;
+	get = strcmp(method, "GET") == 0;
+	req.path = strdup(target);
+	assert(req.path);
+
+	while (read_line(in, line, sizeof(line), &toolong) && line[0]) {
+		if (++nhdrs > MAXHEADERS) {
+			toolong = true;
+			break;
+		}
+		if ((value = header_value(line, "Connection")) != NULL) {
+			if (strcasecmp(value, "close") == 0)
+				req.close = true;
+			else if (strcasecmp(value, "keep-alive") == 0)
+				req.close = false;
+		} else if ((value = header_value(line, "Range")) != NULL) {
+			req.range = parse_range(&req, value);
+		} else if ((value = header_value(line, "If-Modified-Since"))) {
+			free(req.ims);
+			req.ims = strdup(value);
+			assert(req.ims);
+		} else if ((value = header_value(line, "If-None-Match"))) {
+			free(req.inm);
+			req.inm = strdup(value);
+			assert(req.inm);
+		}
+	}
+	if (toolong || line[0] != '\0') {
+		req.close = true;
+		reply_error(fd, &req, 431, "Request Header Fields Too Large");
+		goto out;
+	}
+	if (!req.head && !get) {
+		req.close = true;
+		reply_error(fd, &req, 405, "Method Not Allowed");
+		goto out;
+	}
+	if (!parse_path(req.path)) {
+		reply_error(fd, &req, 400, "Bad Request");
+	} else if ((type = object_type(req.path)) == 0 ||
+	    (type == 1 && !object_listed(req.path))) {
+		reply_error(fd, &req, 404, "Not Found");
+	} else if (object_cache(req.path, type == 2, NULL) != 0) {
+		reply_error(fd, &req, 502, "Bad Gateway");
+	} else if (reply_object(fd, &req) == -1) {
+		req.close = true;
+	}
+	rv = req.close ? -1 : 0;
+out:
+	free(req.path);
+	free(req.ims);
+	free(req.inm);
+
+	return rv;
+}
+
+static void *
+serve_connection(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	FILE *in;
+
+	if ((in = fdopen(fd, "r")) != NULL) {
+		while (serve_request(fd, in) == 0)
+			;
+		fclose(in);
+	} else {
+		(void)close(fd);
+	}
+	pthread_mutex_lock(&conn_mtx);
+	nconns--;
+	pthread_mutex_unlock(&conn_mtx);
+
+	return NULL;
+}
+
+static void
+accept_connection(int sfd)
+{
+	struct request req;
+	struct timeval tv = { IDLE_TIMEOUT, 0 };
+	pthread_attr_t attr;
+	pthread_t thd;
+	int fd;
+	bool busy;
+
+	if ((fd = accept(sfd, NULL, NULL)) == -1)
+		return;
+
+	(void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	pthread_mutex_lock(&conn_mtx);
+	if (!(busy = nconns >= maxconns))
+		nconns++;
+	pthread_mutex_unlock(&conn_mtx);
+
+	if (!busy) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thd, &attr, serve_connection,
+		    (void *)(intptr_t)fd) == 0) {
+			pthread_attr_destroy(&attr);
+			return;
+		}
+		pthread_attr_destroy(&attr);
+		pthread_mutex_lock(&conn_mtx);
+		nconns--;
+		pthread_mutex_unlock(&conn_mtx);
+	}
+	memset(&req, 0, sizeof(req));
+	req.close = true;
+	reply_error(fd, &req, 503, "Service Unavailable");
+	(void)close(fd);
+}
+
+static int
+listen_sockets(const char *addr, const char *port, struct pollfd *pfd)
+{
+	struct addrinfo hints, *res, *ai;
+	int fd, on = 1, n = 0, rv;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if ((rv = getaddrinfo(addr, port, &hints, &res)) != 0) {
+		xbps_error_printf("xbps-cached: %s: %s\n",
+		    addr ? addr : port, gai_strerror(rv));
+		return 0;
+	}
+	for (ai = res; ai && n < MAXLISTEN; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1)
+			continue;
+		(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef IPV6_V6ONLY
+		if (ai->ai_family == AF_INET6)
+			(void)setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on,
+			    sizeof(on));
+#endif
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 ||
+		    listen(fd, SOMAXCONN) == -1) {
+			xbps_error_printf("xbps-cached: cannot listen on "
+			    "port %s: %s\n", port, strerror(errno));
+			(void)close(fd);
+			continue;
+		}
+		pfd[n].fd = fd;
+		pfd[n++].events = POLLIN;
+	}
+	freeaddrinfo(res);
+
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *shortopts = "C:dhj:l:p:t:vV";
+	const struct option longopts[] = {
+		{ "config", required_argument, NULL, 'C' },
+		{ "debug", no_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ "max-conns", required_argument, NULL, 'j' },
+		{ "listen", required_argument, NULL, 'l' },
+		{ "port", required_argument, NULL, 'p' },
+		{ "ttl", required_argument, NULL, 't' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "version", no_argument, NULL, 'V' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct pollfd pfd[MAXLISTEN];
+	const char *confdir = NULL, *addr = NULL, *port = "8080";
+	char *up;
+	size_t len;
+	int c, i, n, rv, flags = 0;
+
+	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
+		switch (c) {
+		case 'C':
+			confdir = optarg;
+			break;
+		case 'd':
+			flags |= XBPS_FLAG_DEBUG;
+			break;
+		case 'h':
+			usage(false);
+			/* NOTREACHED */
+		case 'j':
+			maxconns = (unsigned int)strtoul(optarg, NULL, 10);
+			if (maxconns == 0)
+				usage(true);
+			break;
+		case 'l':
+			addr = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 't':
+			ttl = (time_t)strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			flags |= XBPS_FLAG_VERBOSE;
+			break;
+		case 'V':
+			printf("%s\n", XBPS_RELVER);
+			exit(EXIT_SUCCESS);
+		case '?':
+		default:
+			usage(true);
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2)
+		usage(true);
+
+	/* strip trailing slashes, paths requested start with one */
+	up = strdup(argv[0]);
+	assert(up);
+	for (len = strlen(up); len > 0 && up[len - 1] == '/'; len--)
+		up[len - 1] = '\0';
+	upstream = up;
+	if (!xbps_repository_is_remote(upstream)) {
+		xbps_error_printf("xbps-cached: %s is not a remote "
+		    "repository\n", upstream);
+		exit(EXIT_FAILURE);
+	}
+	cachedir = argv[1];
+	if (xbps_mkpath(cachedir, 0755) == -1 && errno != EEXIST) {
+		xbps_error_printf("xbps-cached: failed to create %s: %s\n",
+		    cachedir, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&xh, 0, sizeof(xh));
+	xh.flags = flags;
+	if (confdir)
+		xbps_strlcpy(xh.confdir, confdir, sizeof(xh.confdir));
+	if ((rv = xbps_init(&xh)) != 0) {
+		xbps_error_printf("xbps-cached: failed to initialize "
+		    "libxbps: %s\n", strerror(rv));
+		exit(EXIT_FAILURE);
+	}
+	if ((n = listen_sockets(addr, port, pfd)) == 0)
+		exit(EXIT_FAILURE);
+
+	(void)signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	xbps_dbg_printf(&xh, "caching %s in %s\n", upstream, cachedir);
+
+	for (;;) {
+		if (poll(pfd, (nfds_t)n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			xbps_error_printf("xbps-cached: poll: %s\n",
+			    strerror(errno));
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (pfd[i].revents & POLLIN)
+				accept_connection(pfd[i].fd);
+		}
+	}
+	xbps_end(&xh);
+	exit(EXIT_FAILURE);
+}
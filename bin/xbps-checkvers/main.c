@@ -27,6 +27,7 @@
 
 #include <getopt.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -35,7 +36,10 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <xbps.h>
 
@@ -58,10 +62,25 @@ do {									\
 #define _dprintf(...)
 #endif
 
+/*
+ * Everything allocated while processing a template comes from an arena
+ * that is reset before processing the next one.
+ */
+#define ARENA_CHUNK	(64 * 1024)
+
+typedef struct _arena_chunk_t {
+	struct _arena_chunk_t *next;
+	size_t size, used;
+	char data[];
+} arena_chunk_t;
+
+typedef struct _arena_t {
+	arena_chunk_t *head, *cur;
+} arena_t;
+
 typedef struct str_ptr_t {
 	char *s;
 	size_t len;
-	int vmalloc;
 } string;
 
 typedef struct _map_item_t {
@@ -69,9 +88,15 @@ typedef struct _map_item_t {
 	size_t i;
 } map_item_t;
 
+/*
+ * Variables are kept in an open addressing hash table with linear
+ * probing, items[].i is the slot of the item.  Keys are not NUL
+ * terminated, they point into the template.
+ */
 typedef struct _map_t {
 	size_t size, len;
 	map_item_t *items;
+	arena_t *arena;
 } map_t;
 
 typedef struct _rcv_t {
@@ -79,9 +104,16 @@ typedef struct _rcv_t {
 	char *input, *ptr, *xbps_conf, *rootdir, *distdir, *pkgdir;
 	uint8_t have_vars;
 	size_t len;
+	void *map;
+	size_t maplen;
+	arena_t arena;
 	map_t *env;
-	struct xbps_handle xhp;
+	struct xbps_handle *xhp;
 	xbps_dictionary_t pkgd;
+	FILE *out;
+	char *cachefile;
+	xbps_dictionary_t cache, newcache;
+	bool ran_cmd;
 	bool show_missing;
 	bool manual;
 	bool installed;
@@ -90,78 +122,192 @@ typedef struct _rcv_t {
 typedef int (*rcv_check_func)(rcv_t *);
 typedef int (*rcv_proc_func)(rcv_t *, const char *, rcv_check_func);
 
+/*
+ * The templates in srcpkgs are processed by a pool of threads, each
+ * with its own copy of rcv_t.  The output of each template is buffered
+ * and printed in the order of the sorted template names.
+ */
+typedef struct _rcv_tmpl_t {
+	char *name;
+	char *buf;
+	size_t len;
+	bool done;
+} rcv_tmpl_t;
+
+typedef struct _rcv_dir_t {
+	rcv_t *rcv;
+	rcv_proc_func process;
+	rcv_tmpl_t *tmpls;
+	size_t n, next, printed;
+	int ret;
+	pthread_mutex_t mtx;
+} rcv_dir_t;
+
+/* serializes the repository and pkgdb lookups */
+static pthread_mutex_t rcv_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns len zeroed bytes from the arena.
+ */
+static void *
+arena_alloc(arena_t *arena, size_t len)
+{
+	arena_chunk_t *c;
+	size_t size;
+	char *p;
+
+	len = (len + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	for (c = arena->cur; c != NULL; c = c->next) {
+		if (c->size - c->used >= len)
+			break;
+	}
+	if (c == NULL) {
+		size = len > ARENA_CHUNK ? len : ARENA_CHUNK;
+		c = malloc(sizeof(*c) + size);
+		assert(c);
+		c->size = size;
+		c->used = 0;
+		if (arena->cur != NULL) {
+			c->next = arena->cur->next;
+			arena->cur->next = c;
+		} else {
+			c->next = arena->head;
+			arena->head = c;
+		}
+	}
+	arena->cur = c;
+	p = c->data + c->used;
+	c->used += len;
+	memset(p, 0, len);
+	return p;
+}
+
+static void
+arena_reset(arena_t *arena)
+{
+	arena_chunk_t *c;
+
+	for (c = arena->head; c != NULL; c = c->next)
+		c->used = 0;
+	arena->cur = arena->head;
+}
+
+static void
+arena_free(arena_t *arena)
+{
+	arena_chunk_t *c;
+
+	while ((c = arena->head) != NULL) {
+		arena->head = c->next;
+		free(c);
+	}
+	arena->cur = NULL;
+}
+
 static map_item_t
 map_new_item(void)
 {
-	return (map_item_t){ .k = { NULL, 0, 0 }, .v = { NULL, 0, 0 }, .i = 0 };
+	return (map_item_t){ .k = { NULL, 0 }, .v = { NULL, 0 }, .i = 0 };
 }
 
 static map_t *
-map_create(void)
+map_create(arena_t *arena)
 {
-	size_t i = 0;
-	map_t *map = malloc(sizeof(map_t));
-	if (map == NULL)
-		return NULL;
+	map_t *map = arena_alloc(arena, sizeof(map_t));
 
+	map->arena = arena;
 	map->size = 16;
 	map->len = 0;
-	map->items = calloc(map->size, sizeof(map_item_t));
-	assert(map->items);
-	for (; i < map->size; i++) {
-		map->items[i] = map_new_item();
-	}
+	map->items = arena_alloc(arena, map->size * sizeof(map_item_t));
 	return map;
 }
 
+static size_t
+map_hash(const char *k, size_t n)
+{
+	size_t i, hv = 2166136261U;
+
+	for (i = 0; i < n; i++)
+		hv = (hv ^ (unsigned char)k[i]) * 16777619U;
+	return hv;
+}
+
+/*
+ * Returns the slot of the key k of length n, or the empty slot where
+ * it would be added.
+ */
+static size_t
+map_slot(map_t *map, const char *k, size_t n)
+{
+	size_t i, mask = map->size - 1;
+	map_item_t *item;
+
+	for (i = map_hash(k, n) & mask;; i = (i + 1) & mask) {
+		item = &map->items[i];
+		if (item->k.len == 0)
+			return i;
+		if (item->k.len == n && memcmp(item->k.s, k, n) == 0)
+			return i;
+	}
+}
+
 static map_item_t
 map_find_n(map_t *map, const char *k, size_t n)
 {
-	size_t i = 0;
-	map_item_t item;
+	size_t i = map_slot(map, k, n);
 
-	for (i = 0; i < map->len; i++) {
-		item = map->items[i];
-		if (item.k.len != 0)
-			if ((strncmp(k, item.k.s, n) == 0))
-				break;
-	}
-	if (map->len == i)
+	if (map->items[i].k.len == 0)
 		return map_new_item();
 
-	return item;
+	return map->items[i];
 }
 
+static void
+map_grow(map_t *map)
+{
+	map_item_t *items = map->items;
+	size_t i, j, size = map->size;
+
+	map->size *= 2;
+	map->items = arena_alloc(map->arena, map->size * sizeof(map_item_t));
+	for (i = 0; i < size; i++) {
+		if (items[i].k.len == 0)
+			continue;
+		j = map_slot(map, items[i].k.s, items[i].k.len);
+		map->items[j] = items[i];
+		map->items[j].i = j;
+	}
+}
+
+/*
+ * Sets the value of k, a redefinition replaces the value of the
+ * existing item.
+ */
 static map_item_t
 map_add_n(map_t *map, const char *k, size_t kn, const char *v, size_t vn)
 {
+	map_item_t *item;
 	size_t i;
-	map_item_t item;
 
 	assert(k);
 	assert(v);
-
-	if (++map->len > map->size) {
-		map->size += 16;
-		map->items = realloc(map->items,
-			sizeof(map_item_t)*(map->size));
-		assert(map->items);
-		for (i = map->size - 10; i < map->size; i++) {
-			map->items[i] = map_new_item();
+	assert(kn > 0);
+
+	i = map_slot(map, k, kn);
+	if (map->items[i].k.len == 0) {
+		/* keep the load factor under 3/4 */
+		if ((map->len + 1) * 4 > map->size * 3) {
+			map_grow(map);
+			i = map_slot(map, k, kn);
 		}
+		map->len++;
+		item = &map->items[i];
+		item->k = (string){ (char *)__UNCONST(k), kn };
+		item->i = i;
 	}
-	item = map_find_n(map, k, kn);
-	if (item.k.len == 0) {
-		item = map_new_item();
-		item.k = (string){ (char *)__UNCONST(k), kn, 0 };
-		item.i = map->len - 1;
-	}
-	if (item.v.vmalloc == 1)
-		free(item.v.s);
-
-	item.v = (string){ (char *)__UNCONST(v), vn, 0 };
-	map->items[item.i] = item;
-	return map->items[item.i];
+	item = &map->items[i];
+	item->v = (string){ (char *)__UNCONST(v), vn };
+	return *item;
 }
 
 static map_item_t
@@ -170,22 +316,6 @@ map_find(map_t *map, const char *k)
 	return map_find_n(map, k, strlen(k));
 }
 
-static void
-map_destroy(map_t *map)
-{
-	size_t i = 0;
-	while (i < map->len) {
-		if (map->items[i].v.vmalloc == 1) {
-			if (map->items[i].v.s != NULL) {
-				free(map->items[i].v.s);
-			}
-		}
-		i++;
-	}
-	free(map->items);
-	free(map);
-}
-
 static int
 show_usage(const char *prog)
 {
@@ -193,6 +323,8 @@ show_usage(const char *prog)
 "Usage: %s [OPTIONS] [FILES...]\n\n"
 " Options:\n"
 "  -h,--help			Show this helpful help-message for help.\n"
+"  -c,--cache=FILE		Cache the template versions in FILE, only\n"
+"				changed templates are parsed again.\n"
 "  -C,--config=DIRECTORY 	Set path to xbps.d\n"
 "  -D,--distdir=DIRECTORY	Set (or override) the path to void-packages\n"
 "				(defaults to ~/void-packages).\n"
@@ -214,29 +346,24 @@ rcv_init(rcv_t *rcv, const char *prog)
 	rcv->prog = prog;
 	rcv->have_vars = 0;
 	rcv->ptr = rcv->input = NULL;
+	rcv->out = stdout;
 	if (rcv->xbps_conf != NULL) {
-		xbps_strlcpy(rcv->xhp.confdir, rcv->xbps_conf, sizeof(rcv->xhp.confdir));
+		xbps_strlcpy(rcv->xhp->confdir, rcv->xbps_conf, sizeof(rcv->xhp->confdir));
 	}
 	if (rcv->rootdir != NULL) {
-		xbps_strlcpy(rcv->xhp.rootdir, rcv->rootdir, sizeof(rcv->xhp.rootdir));
+		xbps_strlcpy(rcv->xhp->rootdir, rcv->rootdir, sizeof(rcv->xhp->rootdir));
 	}
-	if (xbps_init(&rcv->xhp) != 0)
+	if (xbps_init(rcv->xhp) != 0)
 		abort();
 }
 
 static void
 rcv_end(rcv_t *rcv)
 {
-	if (rcv->input != NULL) {
-		free(rcv->input);
-		rcv->input = NULL;
-	}
-	if (rcv->env != NULL) {
-		map_destroy(rcv->env);
-		rcv->env = NULL;
-	}
+	arena_free(&rcv->arena);
+	rcv->env = NULL;
 
-	xbps_end(&rcv->xhp);
+	xbps_end(rcv->xhp);
 
 	if (rcv->xbps_conf != NULL)
 		free(rcv->xbps_conf);
@@ -244,63 +371,68 @@ rcv_end(rcv_t *rcv)
 		free(rcv->distdir);
 	if (rcv->pkgdir != NULL)
 		free(rcv->pkgdir);
+	if (rcv->cachefile != NULL)
+		free(rcv->cachefile);
+	if (rcv->cache != NULL)
+		xbps_object_release(rcv->cache);
+	if (rcv->newcache != NULL)
+		xbps_object_release(rcv->newcache);
 }
 
 static bool
 rcv_load_file(rcv_t *rcv, const char *fname)
 {
-	FILE *file;
-	long offset;
+	size_t pgmask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+	void *map;
+	size_t maplen;
+
 	rcv->fname = fname;
 
-	if ((file = fopen(rcv->fname, "r")) == NULL) {
+	if (!xbps_mmap_file(rcv->fname, &map, &maplen, &rcv->len)) {
 		if (!rcv->manual) {
 			fprintf(stderr, "FileError: can't open '%s': %s\n",
 				rcv->fname, strerror(errno));
 		}
 		return false;
 	}
-
-	fseek(file, 0, SEEK_END);
-	offset = ftell(file);
-	fseek(file, 0, SEEK_SET);
-
-	if (offset == -1) {
-		fclose(file);
-		return false;
-	}
-	rcv->len = (size_t)offset;
-
-	if (rcv->input != NULL)
-		free(rcv->input);
-
-	if ((rcv->input = calloc(rcv->len + 1, sizeof(char))) == NULL) {
-		fprintf(stderr, "MemError: can't allocate memory: %s\n",
-			strerror(errno));
-		fclose(file);
-		return false;
+	/*
+	 * Files of a whole number of pages are NUL terminated by a guard
+	 * page past EOF, which can't be read: copy them.
+	 */
+	if ((rcv->len & pgmask) == 0) {
+		rcv->input = arena_alloc(&rcv->arena, rcv->len + 1);
+		memcpy(rcv->input, map, rcv->len);
+		(void)munmap(map, maplen);
+	} else {
+		rcv->input = map;
+		rcv->map = map;
+		rcv->maplen = maplen;
 	}
-
-	(void)fread(rcv->input, sizeof(char), rcv->len, file);
-	rcv->input[rcv->len] = '\0';
-	fclose(file);
 	rcv->ptr = rcv->input;
 
 	return true;
 }
 
+static void
+rcv_unload_file(rcv_t *rcv)
+{
+	if (rcv->map != NULL) {
+		(void)munmap(rcv->map, rcv->maplen);
+		rcv->map = NULL;
+	}
+	rcv->ptr = rcv->input = NULL;
+}
+
 static char *
 rcv_refs(rcv_t *rcv, const char *s, size_t len)
 {
 	map_item_t item;
 	size_t i = 0, j = 0, k = 0, count = len*3;
-	char *ref = calloc(count, sizeof(char));
-	char *buf = calloc(count, sizeof(char));
+	char *ref = arena_alloc(&rcv->arena, count);
+	char *buf = arena_alloc(&rcv->arena, count);
 
 	assert(rcv);
 	assert(s);
-	assert(ref);
-	assert(buf);
 
 	while (i < len) {
 		if (s[i] == '$' && s[i+1] != '(') {
@@ -309,7 +441,8 @@ rcv_refs(rcv_t *rcv, const char *s, size_t len)
 			if (s[i] == '{') {
 				i++;
 			}
-			while (isalpha(s[i]) || s[i] == '_') {
+			while (isalpha((unsigned char)s[i]) || s[i] == '_' ||
+			    (j > 0 && isdigit((unsigned char)s[i]))) {
 				ref[j++] = s[i++];
 			}
 			if (s[i] == '}') {
@@ -317,7 +450,7 @@ rcv_refs(rcv_t *rcv, const char *s, size_t len)
 			}
 			ref[j++] = '\0';
 			item = map_find(rcv->env, ref);
-			if ((strncmp(ref, item.k.s, strlen(ref)) == 0)) {
+			if (item.k.len != 0) {
 				buf = strcat(buf, item.v.s);
 				k += item.v.len;
 			} else {
@@ -330,7 +463,6 @@ rcv_refs(rcv_t *rcv, const char *s, size_t len)
 		}
 	}
 	buf[k] = '\0';
-	free(ref);
 	return buf;
 }
 
@@ -340,13 +472,8 @@ rcv_cmd(rcv_t *rcv, const char *s, size_t len)
 	int c, rv = 0;
 	FILE *stream;
 	size_t i = 0, j = 0, k = 0, count = len*3;
-	char *cmd = calloc(count, sizeof(char));
-	char *buf = calloc(count, sizeof(char));
-
-	assert(cmd);
-	assert(buf);
-
-	(void)rcv;
+	char *cmd = arena_alloc(&rcv->arena, count);
+	char *buf = arena_alloc(&rcv->arena, count);
 
 	while (i < len) {
 		if (s[i] == '$' && s[i+1] != '{') {
@@ -362,6 +489,7 @@ rcv_cmd(rcv_t *rcv, const char *s, size_t len)
 				i++;
 			}
 			cmd[j++] = '\0';
+			rcv->ran_cmd = true;
 			if ((stream = popen(cmd, "r")) == NULL)
 				goto error;
 			while ((c = fgetc(stream)) != EOF && c != '\n') {
@@ -388,8 +516,6 @@ error:
 		}
 	}
 	buf[k] = '\0';
-	free(cmd);
-	free(__UNCONST(s));
 	return buf;
 }
 
@@ -449,7 +575,7 @@ rcv_get_pkgver(rcv_t *rcv)
 				vlen--;
 			}
 		}
-		if (vlen == 0) {
+		if (vlen == 0 || klen == 0) {
 			goto nextline;
 		}
 		_item = map_add_n(rcv->env, k, klen, v, vlen);
@@ -460,14 +586,11 @@ rcv_get_pkgver(rcv_t *rcv)
 			assert(item->v.s);
 			item->v.s = rcv_refs(rcv, item->v.s, item->v.len);
 			item->v.len = strlen(item->v.s);
-			item->v.vmalloc = 1;
 			item->v.s = rcv_cmd(rcv, item->v.s, item->v.len);
 			item->v.len = strlen(item->v.s);
-		} else {
-			item->v.vmalloc = 0;
 		}
-		if (rcv->xhp.flags & XBPS_FLAG_DEBUG) {
-			printf("%s: %.*s %.*s\n", rcv->fname,
+		if (rcv->xhp->flags & XBPS_FLAG_DEBUG) {
+			fprintf(rcv->out, "%s: %.*s %.*s\n", rcv->fname,
 			    (int)item->k.len, item->k.s,
 			    (int)item->v.len, item->v.s);
 		}
@@ -489,22 +612,99 @@ nextline:
 	}
 }
 
+/*
+ * With --cache the variables of each template are stored along with its
+ * hash, keyed by the template path.  Templates that didn't change are
+ * not parsed again, unless their variables were set by running shell
+ * commands.  Entries of templates that no longer exist are dropped.
+ */
+static const char *cache_vars[] = { "pkgname", "version", "revision", "reverts" };
+
+static bool
+rcv_cache_get(rcv_t *rcv, const char *fname, const char *hash)
+{
+	xbps_dictionary_t d;
+	const char *h, *v;
+	char *p;
+	size_t i, len;
+
+	d = xbps_dictionary_get(rcv->cache, fname);
+	if (!xbps_dictionary_get_cstring_nocopy(d, "sha256", &h) ||
+	    strcmp(h, hash))
+		return false;
+
+	for (i = 0; i < sizeof(cache_vars) / sizeof(cache_vars[0]); i++) {
+		if (!xbps_dictionary_get_cstring_nocopy(d, cache_vars[i], &v))
+			continue;
+		len = strlen(v);
+		p = arena_alloc(&rcv->arena, len + 1);
+		memcpy(p, v, len);
+		map_add_n(rcv->env, cache_vars[i], strlen(cache_vars[i]), p, len);
+	}
+	rcv->have_vars = GOT_PKGNAME_VAR|GOT_VERSION_VAR|GOT_REVISION_VAR;
+
+	pthread_mutex_lock(&rcv_lock);
+	xbps_dictionary_set(rcv->newcache, fname, d);
+	pthread_mutex_unlock(&rcv_lock);
+	return true;
+}
+
+static void
+rcv_cache_set(rcv_t *rcv, const char *fname, const char *hash)
+{
+	xbps_dictionary_t d;
+	map_item_t item;
+	char *v;
+	size_t i;
+
+	if (rcv->ran_cmd || (rcv->have_vars & (GOT_PKGNAME_VAR|GOT_VERSION_VAR|
+	    GOT_REVISION_VAR)) != (GOT_PKGNAME_VAR|GOT_VERSION_VAR|GOT_REVISION_VAR))
+		return;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	xbps_dictionary_set_cstring(d, "sha256", hash);
+	for (i = 0; i < sizeof(cache_vars) / sizeof(cache_vars[0]); i++) {
+		item = map_find(rcv->env, cache_vars[i]);
+		if (item.k.len == 0)
+			continue;
+		v = arena_alloc(&rcv->arena, item.v.len + 1);
+		memcpy(v, item.v.s, item.v.len);
+		xbps_dictionary_set_cstring(d, cache_vars[i], v);
+	}
+	pthread_mutex_lock(&rcv_lock);
+	xbps_dictionary_set(rcv->newcache, fname, d);
+	pthread_mutex_unlock(&rcv_lock);
+	xbps_object_release(d);
+}
+
 static int
 rcv_process_file(rcv_t *rcv, const char *fname, rcv_check_func check)
 {
-	rcv->env = map_create();
-	if (rcv->env == NULL) {
+	char *hash = NULL;
+
+	arena_reset(&rcv->arena);
+	rcv->env = map_create(&rcv->arena);
+	if (rcv->newcache != NULL && (hash = xbps_file_hash(fname)) != NULL &&
+	    rcv_cache_get(rcv, fname, hash)) {
+		rcv->fname = fname;
+		check(rcv);
+		free(hash);
 		rcv->env = NULL;
-		return EXIT_FAILURE;
+		return 0;
 	}
 	if (!rcv_load_file(rcv, fname)) {
-		map_destroy(rcv->env);
+		free(hash);
 		rcv->env = NULL;
 		return EXIT_FAILURE;
 	}
+	rcv->ran_cmd = false;
 	rcv_get_pkgver(rcv);
+	if (hash != NULL)
+		rcv_cache_set(rcv, fname, hash);
 	check(rcv);
-	map_destroy(rcv->env);
+	rcv_unload_file(rcv);
+	free(hash);
 	rcv->env = NULL;
 
 	return 0;
@@ -594,10 +794,11 @@ rcv_check_version(rcv_t *rcv)
 	assert(revision.v.s);
 
 	srcver = strncpy(srcver, pkgname.v.s, pkgname.v.len);
+	pthread_mutex_lock(&rcv_lock);
 	if (rcv->installed)
-		rcv->pkgd = xbps_pkgdb_get_pkg(&rcv->xhp, srcver);
+		rcv->pkgd = xbps_pkgdb_get_pkg(rcv->xhp, srcver);
 	else
-		rcv->pkgd = xbps_rpool_get_pkg(&rcv->xhp, srcver);
+		rcv->pkgd = xbps_rpool_get_pkg(rcv->xhp, srcver);
 
 	srcver = strncat(srcver, "-", 1);
 	srcver = strncat(srcver, version.v.s, version.v.len);
@@ -608,30 +809,91 @@ rcv_check_version(rcv_t *rcv)
 
 
 	if (repover == NULL && (rcv->show_missing || rcv->manual )) {
-		printf("pkgname: %.*s repover: ? srcpkgver: %s\n",
+		fprintf(rcv->out, "pkgname: %.*s repover: ? srcpkgver: %s\n",
 			(int)pkgname.v.len, pkgname.v.s, srcver+pkgname.v.len+1);
 	}
 	if (repover != NULL && rcv->show_missing == false) {
 		if (xbps_cmpver(repover+pkgname.v.len+1,
 		    srcver+pkgname.v.len+1) < 0 ||
 		    check_reverts(repover+pkgname.v.len+1, reverts)) {
-			printf("pkgname: %.*s repover: %s srcpkgver: %s\n",
+			fprintf(rcv->out, "pkgname: %.*s repover: %s srcpkgver: %s\n",
 				(int)pkgname.v.len, pkgname.v.s,
 				repover+pkgname.v.len+1,
 				srcver+pkgname.v.len+1);
 		}
 	}
+	pthread_mutex_unlock(&rcv_lock);
 	return 0;
 }
 
+static int
+rcv_tmpl_cmp(const void *a, const void *b)
+{
+	return strcmp(((const rcv_tmpl_t *)a)->name,
+	    ((const rcv_tmpl_t *)b)->name);
+}
+
+static void *
+rcv_process_thread(void *arg)
+{
+	rcv_dir_t *rd = arg;
+	rcv_tmpl_t *tmpl;
+	rcv_t rcv = *rd->rcv;
+	char filename[BUFSIZ];
+	int ret;
+
+	rcv.input = rcv.ptr = NULL;
+	memset(&rcv.arena, 0, sizeof(rcv.arena));
+	for (;;) {
+		pthread_mutex_lock(&rd->mtx);
+		if (rd->next == rd->n) {
+			pthread_mutex_unlock(&rd->mtx);
+			break;
+		}
+		tmpl = &rd->tmpls[rd->next++];
+		pthread_mutex_unlock(&rd->mtx);
+
+		rcv.have_vars = 0;
+		rcv.pkgd = NULL;
+		rcv.out = open_memstream(&tmpl->buf, &tmpl->len);
+		assert(rcv.out);
+		snprintf(filename, sizeof(filename), "%s/template", tmpl->name);
+		ret = rd->process(&rcv, filename, rcv_check_version);
+		fclose(rcv.out);
+
+		/*
+		 * Print the output of all templates processed so far, in
+		 * order.
+		 */
+		pthread_mutex_lock(&rd->mtx);
+		rd->ret = ret;
+		tmpl->done = true;
+		while (rd->printed < rd->n && rd->tmpls[rd->printed].done) {
+			tmpl = &rd->tmpls[rd->printed++];
+			fwrite(tmpl->buf, 1, tmpl->len, stdout);
+			free(tmpl->buf);
+			free(tmpl->name);
+		}
+		pthread_mutex_unlock(&rd->mtx);
+	}
+	arena_free(&rcv.arena);
+	return NULL;
+}
+
 static int
 rcv_process_dir(rcv_t *rcv, const char *path, rcv_proc_func process)
 {
 	DIR *dir = NULL;
-	struct dirent entry, *result;
+	struct dirent *result;
 	struct stat st;
-	char filename[BUFSIZ];
-	int i, ret = 0, errors = 0;
+	rcv_dir_t rd;
+	pthread_t *thds;
+	size_t size = 0;
+	int i, nthreads, errors = 0;
+
+	memset(&rd, 0, sizeof(rd));
+	rd.rcv = rcv;
+	rd.process = process;
 
 	dir = opendir(path);
 error:
@@ -646,13 +908,14 @@ error:
 		goto error;
 	}
 	for (;;) {
-		i = readdir_r(dir, &entry, &result);
-		if (i > 0) {
-			errors = errno;
-			goto error;
-		}
-		if (result == NULL)
+		errno = 0;
+		if ((result = readdir(dir)) == NULL) {
+			if (errno) {
+				errors = errno;
+				goto error;
+			}
 			break;
+		}
 		if ((strcmp(result->d_name, ".") == 0) ||
 		    (strcmp(result->d_name, "..") == 0))
 			continue;
@@ -663,8 +926,15 @@ error:
 		if (S_ISLNK(st.st_mode) != 0)
 			continue;
 
-		snprintf(filename, sizeof(filename), "%s/template", result->d_name);
-		ret = process(rcv, filename, rcv_check_version);
+		if (rd.n == size) {
+			size += 1024;
+			rd.tmpls = realloc(rd.tmpls, size * sizeof(*rd.tmpls));
+			assert(rd.tmpls);
+		}
+		memset(&rd.tmpls[rd.n], 0, sizeof(*rd.tmpls));
+		rd.tmpls[rd.n].name = strdup(result->d_name);
+		assert(rd.tmpls[rd.n].name);
+		rd.n++;
 	}
 
 	if ((closedir(dir)) == -1) {
@@ -672,7 +942,28 @@ error:
 		dir = NULL;
 		goto error;
 	}
-	return ret;
+	qsort(rd.tmpls, rd.n, sizeof(*rd.tmpls), rcv_tmpl_cmp);
+
+	nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1)
+		nthreads = 1;
+	thds = calloc(nthreads, sizeof(*thds));
+	assert(thds);
+	pthread_mutex_init(&rd.mtx, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&thds[i], NULL, rcv_process_thread, &rd) != 0)
+			break;
+	}
+	/* process whatever is left if threads couldn't be created */
+	if (i == 0)
+		rcv_process_thread(&rd);
+	while (i-- > 0)
+		pthread_join(thds[i], NULL);
+	pthread_mutex_destroy(&rd.mtx);
+	free(thds);
+	free(rd.tmpls);
+
+	return rd.ret;
 }
 
 int
@@ -680,10 +971,13 @@ main(int argc, char **argv)
 {
 	int i, c;
 	rcv_t rcv;
+	struct xbps_handle xh;
 	char *distdir = NULL;
-	const char *prog = argv[0], *sopts = "hC:D:diR:r:sV", *tmpl;
+	const char *prog = argv[0], *sopts = "hc:C:D:diR:r:sV", *tmpl;
+	char cwd[PATH_MAX];
 	const struct option lopts[] = {
 		{ "help", no_argument, NULL, 'h' },
+		{ "cache", required_argument, NULL, 'c' },
 		{ "config", required_argument, NULL, 'C' },
 		{ "distdir", required_argument, NULL, 'D' },
 		{ "debug", no_argument, NULL, 'd' },
@@ -696,11 +990,19 @@ main(int argc, char **argv)
 	};
 
 	memset(&rcv, 0, sizeof(rcv_t));
+	memset(&xh, 0, sizeof(xh));
+	rcv.xhp = &xh;
 
 	while ((c = getopt_long(argc, argv, sopts, lopts, NULL)) != -1) {
 		switch (c) {
 		case 'h':
 			return show_usage(prog);
+		case 'c':
+			if (optarg[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+				rcv.cachefile = xbps_xasprintf("%s/%s", cwd, optarg);
+			else
+				rcv.cachefile = strdup(optarg);
+			break;
 		case 'C':
 			rcv.xbps_conf = strdup(optarg);
 			break;
@@ -708,16 +1010,16 @@ main(int argc, char **argv)
 			rcv_set_distdir(&rcv, optarg);
 			break;
 		case 'd':
-			rcv.xhp.flags |= XBPS_FLAG_DEBUG;
+			rcv.xhp->flags |= XBPS_FLAG_DEBUG;
 			break;
 		case 'i':
 			rcv.installed = true;
 			break;
 		case 'R':
-			if (rcv.xhp.repositories == NULL)
-				rcv.xhp.repositories = xbps_array_create();
+			if (rcv.xhp->repositories == NULL)
+				rcv.xhp->repositories = xbps_array_create();
 
-			xbps_array_add_cstring_nocopy(rcv.xhp.repositories, optarg);
+			xbps_array_add_cstring_nocopy(rcv.xhp->repositories, optarg);
 			break;
 		case 'r':
 			rcv.rootdir = strdup(optarg);
@@ -744,6 +1046,11 @@ main(int argc, char **argv)
 	argv += optind;
 
 	rcv_init(&rcv, prog);
+	if (rcv.cachefile != NULL) {
+		rcv.cache = xbps_dictionary_internalize_from_file(rcv.cachefile);
+		rcv.newcache = xbps_dictionary_create();
+		assert(rcv.newcache);
+	}
 	rcv.manual = false;
 	rcv_process_dir(&rcv, rcv.pkgdir, rcv_process_file);
 	rcv.manual = true;
@@ -759,6 +1066,10 @@ main(int argc, char **argv)
 			rcv_process_file(&rcv, tmpl, rcv_check_version);
 		}
 	}
+	if (rcv.cachefile != NULL &&
+	    !xbps_dictionary_externalize_to_file(rcv.newcache, rcv.cachefile))
+		fprintf(stderr, "Error: failed to write cache '%s': %s\n",
+			rcv.cachefile, strerror(errno));
 	rcv_end(&rcv);
 	exit(EXIT_SUCCESS);
 }
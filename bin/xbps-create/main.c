@@ -41,6 +41,10 @@
 #include <libgen.h>
 #include <locale.h>
 #include <dirent.h>
+#include <pthread.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include <xbps.h>
 #include "queue.h"
@@ -51,6 +55,10 @@
 
 #define _PROGNAME	"xbps-create"
 
+#ifndef __arraycount
+# define __arraycount(a) (sizeof(a) / sizeof(*(a)))
+#endif
+
 /* libarchive 2.x compat */
 #if ARCHIVE_VERSION_NUMBER >= 3000000
 # define archive_write_finish(x) 	archive_write_free(x)
@@ -58,23 +66,34 @@
 
 struct xentry {
 	TAILQ_ENTRY(xentry) entries;
-	uint64_t mtime;
+	uint64_t mtime, size;
 	char *file, *type, *target, *hash;
 	ino_t inode;
+	bool mutable;
 };
 
 static TAILQ_HEAD(xentry_head, xentry) xentry_list =
     TAILQ_HEAD_INITIALIZER(xentry_list);
 
+/*
+ * Stored packages are uncompressed and the data of regular files of at
+ * least STORED_MINSIZE bytes is aligned to STORED_ALIGN in the archive,
+ * so that it can be cloned into place by filesystems with reflinks.
+ */
+#define STORED_ALIGN	4096
+#define STORED_MINSIZE	(4 * STORED_ALIGN)
+
 static uint64_t instsize;
-static xbps_dictionary_t pkg_propsd, pkg_filesd, all_filesd;
+static xbps_dictionary_t pkg_propsd, pkg_filesd, all_filesd, instpkgd;
 static const char *destdir;
+static bool stored;
 
 static void __attribute__((noreturn))
 usage(void)
 {
 	fprintf(stdout,
-	"Usage: %s [OPTIONS] -A <arch> -n <pkgver> -s \"<desc>\" destdir\n\n"
+	"Usage: %s [OPTIONS] -A <arch> -n <pkgver> -s \"<desc>\" destdir\n"
+	"       %s [OPTIONS] -i <pkgname>\n\n"
 	"OPTIONS\n"
 	" -A --architecture   Package architecture (e.g: noarch, i686, etc).\n"
 	" -B --built-with     Package builder string (e.g: xbps-src-30).\n"
@@ -87,6 +106,9 @@ usage(void)
 	"                     e.g '/etc/foo.conf /etc/foo-blah.conf').\n"
 	" -H --homepage       Homepage.\n"
 	" -h --help           Show help.\n"
+	" -i --installed      Create the package from the installed package\n"
+	"                     pkgname, with its metadata in pkgdb. The other\n"
+	"                     metadata options override it.\n"
 	" -l --license        License.\n"
 	" -M --mutable-files  Mutable files list (blank separated list,\n"
 	"                     e.g: '/usr/lib/foo /usr/bin/blah').\n"
@@ -108,16 +130,24 @@ usage(void)
 	"                     This expects a blank separated list of <name>:<symlink>:<target>, e.g\n"
 	"                     'vi:/usr/bin/vi:/usr/bin/vim foo:/usr/bin/foo:/usr/bin/blah'.\n"
 	" --build-options     A string with the used build options.\n"
-	" --compression       Compression format: none, gzip, bzip2, xz (default).\n"
+	" --compression       Compression format: none, stored, gzip, bzip2, xz (default),\n"
+	"                     zstd.\n"
+	" --compression-threads Number of threads to compress with xz or zstd, by default\n"
+	"                     the number of online processors (at least 2).\n"
+	" --rootdir           Root directory of the installed package for -i\n"
+	"                     (default /).\n"
 	" --shlib-provides    List of provided shared libraries (blank separated list,\n"
 	"                     e.g 'libfoo.so.1 libblah.so.2').\n"
 	" --shlib-requires    List of required shared libraries (blank separated list,\n"
-	"                     e.g 'libfoo.so.1 libblah.so.2').\n\n"
+	"                     e.g 'libfoo.so.1 libblah.so.2').\n"
+	" --triggers          List of triggers to execute once per transaction\n"
+	"                     (blank separated list, e.g 'gtk-icon-cache mimedb').\n\n"
 	"NOTE:\n"
 	" At least three flags are required: architecture, pkgver and desc.\n\n"
 	"EXAMPLE:\n"
-	" $ %s -A noarch -n foo-1.0_1 -s \"foo pkg\" destdir\n",
-	_PROGNAME, _PROGNAME);
+	" $ %s -A noarch -n foo-1.0_1 -s \"foo pkg\" destdir\n"
+	" $ %s -i foo\n",
+	_PROGNAME, _PROGNAME, _PROGNAME, _PROGNAME);
 	exit(EXIT_FAILURE);
 }
 
@@ -135,6 +165,111 @@ die(const char *fmt, ...)
 	exit(EXIT_FAILURE);
 }
 
+#ifdef HAVE_ZSTD
+/*
+ * zstd packages are compressed by libzstd workers in long distance mode,
+ * with a window of up to 128MiB which all decoders accept by default; it's
+ * no larger than the package contents, decoders allocate all of it. As with
+ * xz the output doesn't depend on the number of workers.
+ */
+#define ZSTD_LEVEL		19
+#define ZSTD_WINDOWLOG_MIN	20
+#define ZSTD_WINDOWLOG_MAX	27
+#define ZSTD_JOBSIZE	(32 * 1024 * 1024)
+
+struct zstd_writer {
+	ZSTD_CCtx *cctx;
+	int fd;
+	void *out;
+	size_t outsize;
+};
+
+static void
+zstd_compress(struct zstd_writer *zw, ZSTD_inBuffer *in, ZSTD_EndDirective mode)
+{
+	ZSTD_outBuffer out;
+	size_t rv;
+	ssize_t wr;
+
+	do {
+		out.dst = zw->out;
+		out.size = zw->outsize;
+		out.pos = 0;
+		rv = ZSTD_compressStream2(zw->cctx, &out, in, mode);
+		if (ZSTD_isError(rv)) {
+			errno = 0;
+			die("zstd compression failed: %s", ZSTD_getErrorName(rv));
+		}
+		for (size_t off = 0; off < out.pos; off += (size_t)wr) {
+			if ((wr = write(zw->fd, (char *)out.dst + off,
+			    out.pos - off)) == -1) {
+				if (errno == EINTR) {
+					wr = 0;
+					continue;
+				}
+				die("failed to write binary package:");
+			}
+		}
+	} while (mode == ZSTD_e_end ? rv != 0 : in->pos < in->size);
+}
+
+static ssize_t
+zstd_write_cb(struct archive *ar UNUSED, void *arg, const void *buf, size_t len)
+{
+	ZSTD_inBuffer in = { buf, len, 0 };
+
+	zstd_compress(arg, &in, ZSTD_e_continue);
+	return (ssize_t)len;
+}
+
+static int
+zstd_close_cb(struct archive *ar UNUSED, void *arg)
+{
+	struct zstd_writer *zw = arg;
+	ZSTD_inBuffer in = { NULL, 0, 0 };
+
+	zstd_compress(zw, &in, ZSTD_e_end);
+	ZSTD_freeCCtx(zw->cctx);
+	free(zw->out);
+	free(zw);
+	return ARCHIVE_OK;
+}
+
+static void
+zstd_open(struct archive *ar, int fd, long nthreads)
+{
+	struct zstd_writer *zw;
+	struct stat st;
+	int wlog = ZSTD_WINDOWLOG_MIN;
+
+	zw = malloc(sizeof(*zw));
+	assert(zw);
+	zw->fd = fd;
+	zw->outsize = ZSTD_CStreamOutSize();
+	zw->out = malloc(zw->outsize);
+	zw->cctx = ZSTD_createCCtx();
+	assert(zw->out && zw->cctx);
+
+	ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+	ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_enableLongDistanceMatching, 1);
+	while (wlog < ZSTD_WINDOWLOG_MAX && (1ULL << wlog) < instsize)
+		wlog++;
+	ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_windowLog, wlog);
+	ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_checksumFlag, 1);
+	/* fails if libzstd was built without threads */
+	if (!ZSTD_isError(ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_nbWorkers,
+	    nthreads > 1 ? (int)nthreads : 1)))
+		ZSTD_CCtx_setParameter(zw->cctx, ZSTD_c_jobSize, ZSTD_JOBSIZE);
+
+	/* as archive_write_open_fd(3) does for regular files */
+	if (fstat(fd, &st) == 0)
+		archive_write_set_skip_file(ar, st.st_dev, st.st_ino);
+	archive_write_set_bytes_in_last_block(ar, 1);
+	if (archive_write_open(ar, zw, NULL, zstd_write_cb, zstd_close_cb) != 0)
+		die("Failed to open binary package for writing:");
+}
+#endif
+
 static void
 process_array(const char *key, const char *val)
 {
@@ -301,8 +436,73 @@ entry_is_conf_file(const char *file)
 	return false;
 }
 
+/*
+ * Open addressing hash set of the (device, inode) pairs of the regular
+ * files with more than one link, to find hardlinks in constant time.
+ */
+struct inode_ent {
+	dev_t dev;
+	ino_t ino;
+	bool used;
+};
+
+static struct inode_ent *inodes;
+static size_t inodes_size, inodes_count;
+
+static size_t
+inode_hash(dev_t dev, ino_t ino)
+{
+	uint64_t h = (uint64_t)ino * 0x9E3779B97F4A7C15ULL;
+
+	return (size_t)(h ^ (h >> 32) ^ (uint64_t)dev);
+}
+
+static struct inode_ent *
+inode_lookup(struct inode_ent *tbl, size_t size, dev_t dev, ino_t ino)
+{
+	size_t i = inode_hash(dev, ino) & (size - 1);
+
+	while (tbl[i].used && (tbl[i].dev != dev || tbl[i].ino != ino))
+		i = (i + 1) & (size - 1);
+
+	return &tbl[i];
+}
+
+/*
+ * Returns true if the inode was already seen, otherwise records it.
+ */
+static bool
+inode_seen(dev_t dev, ino_t ino)
+{
+	struct inode_ent *ent, *tbl;
+	size_t size;
+
+	if ((inodes_count + 1) * 2 > inodes_size) {
+		size = inodes_size ? inodes_size * 2 : 64;
+		tbl = calloc(size, sizeof(*tbl));
+		assert(tbl);
+		for (size_t i = 0; i < inodes_size; i++) {
+			if (inodes[i].used)
+				*inode_lookup(tbl, size, inodes[i].dev,
+				    inodes[i].ino) = inodes[i];
+		}
+		free(inodes);
+		inodes = tbl;
+		inodes_size = size;
+	}
+	ent = inode_lookup(inodes, inodes_size, dev, ino);
+	if (ent->used)
+		return true;
+
+	ent->dev = dev;
+	ent->ino = ino;
+	ent->used = true;
+	inodes_count++;
+	return false;
+}
+
 static int
-ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED)
+ftw_cb(const char *fpath, const struct stat *sb)
 {
 	struct xentry *xe = NULL;
 	xbps_dictionary_t fileinfo = NULL;
@@ -412,45 +612,13 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 		assert(xbps_dictionary_get(fileinfo, "target"));
 		free(buf);
 	} else if (S_ISREG(sb->st_mode)) {
-		struct xentry *xep;
-		bool hlink = false;
-		xbps_object_iterator_t iter;
-		xbps_object_t obj;
-		xbps_dictionary_t linkinfo;
-		uint64_t inode = 0;
 		/*
-		 * Regular files. First find out if it's a hardlink:
-		 * 	- st_nlink > 1
-		 * and then search for a stored file matching its inode.
+		 * Regular files. Files with more than one link whose inode
+		 * was already seen are hardlinks, they don't add to the
+		 * installed size.
 		 */
-		TAILQ_FOREACH(xep, &xentry_list, entries) {
-			if (sb->st_nlink > 1 && xep->inode == sb->st_ino) {
-				/* matched */
-				printf("%"PRIu64" %"PRIu64"\n", xep->inode, sb->st_ino);
-				hlink = true;
-				break;
-			}
-		}
-
-		iter = xbps_dictionary_iterator(all_filesd);
-		assert(iter);
-		while ((obj = xbps_object_iterator_next(iter))) {
-			if (sb->st_nlink <= 1)
-				continue;
-			linkinfo = xbps_dictionary_get_keysym(all_filesd, obj);
-			xbps_dictionary_get_uint64(linkinfo, "inode", &inode);
-			if (inode == sb->st_ino) {
-				/* matched */
-				printf("%"PRIu64" %"PRIu64"\n", inode, sb->st_ino);
-				break;
-			}
-		}
-		if (!hlink != (inode != sb->st_ino))
-			die("Inconsistent results from xbps_dictionary_t and linked list!\n");
-
-		if (inode != sb->st_ino)
+		if (sb->st_nlink <= 1 || !inode_seen(sb->st_dev, sb->st_ino))
 			instsize += sb->st_size;
-		xbps_object_iterator_release(iter);
 
 		/*
 		 * Find out if it's a configuration file or not
@@ -465,15 +633,10 @@ ftw_cb(const char *fpath, const struct stat *sb, const struct dirent *dir UNUSED
 		}
 
 		assert(xe->type);
-		if ((p = xbps_file_hash(fpath)) == NULL)
-			die("failed to process hash for %s:", fpath);
-		xbps_dictionary_set_cstring(fileinfo, "sha256", p);
-		free(p);
-		if ((xe->hash = xbps_file_hash(fpath)) == NULL)
-			die("failed to process hash for %s:", fpath);
-
+		/* hashed by hash_xentries() once the tree has been walked */
 		xbps_dictionary_set_uint64(fileinfo, "inode", sb->st_ino);
 		xe->inode = sb->st_ino;
+		xe->size = (uint64_t)sb->st_size;
 		/* store modification time for regular files and links */
 		xbps_dictionary_set_uint64(fileinfo, "mtime", sb->st_mtime);
 		xe->mtime = (uint64_t)sb->st_mtime;
@@ -491,45 +654,202 @@ out:
 	return 0;
 }
 
+/*
+ * The destdir is read by a pool of threads: the entries of a directory
+ * are stat(2)ed with fstatat(2) relative to its descriptor, and its
+ * subdirectories are queued to be read by any thread. Then
+ * the tree is walked in a single thread in a fixed order: entries of a
+ * directory in reverse alphabetical order, directories after their
+ * contents.
+ */
+struct walk_ent {
+	char *name;
+	struct stat st;
+	struct walk_node *node;
+};
+
+struct walk_node {
+	char *path;
+	int fd;
+	struct walk_ent *ents;
+	size_t nents;
+	int error;
+};
+
+struct walk_queue {
+	struct walk_node **nodes;
+	size_t head, count, busy;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
 static int
-walk_dir(const char *path,
-		int (*fn) (const char *, const struct stat *sb, const struct dirent *dir))
+walk_ent_cmp(const void *a, const void *b)
 {
-	int rv, i;
-	struct dirent **list;
-	char tmp_path[PATH_MAX] = { 0 };
-	struct stat sb;
-
-	rv = scandir(path, &list, NULL, alphasort);
-	for (i = rv - 1; i >= 0; i--) {
-		if (strcmp(list[i]->d_name, ".") == 0 || strcmp(list[i]->d_name, "..") == 0)
+	const struct walk_ent *ea = a, *eb = b;
+
+	/* same order as alphasort(3) */
+	return strcoll(ea->name, eb->name);
+}
+
+static void
+walk_read(struct walk_node *node)
+{
+	struct walk_ent *ent;
+	struct dirent *dp;
+	DIR *dirp;
+
+	/* opened here, there could be too many queued directories */
+	node->fd = open(node->path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+	if (node->fd == -1) {
+		node->error = errno;
+		return;
+	}
+	if ((dirp = fdopendir(node->fd)) == NULL) {
+		node->error = errno;
+		(void)close(node->fd);
+		return;
+	}
+	while ((dp = readdir(dirp)) != NULL) {
+		if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
 			continue;
-		if (strlen(path) + strlen(list[i]->d_name) + 1 >= PATH_MAX - 1) {
-			errno = ENAMETOOLONG;
-			rv = -1;
+		node->ents = realloc(node->ents,
+		    (node->nents + 1) * sizeof(*node->ents));
+		assert(node->ents);
+		ent = &node->ents[node->nents];
+		memset(ent, 0, sizeof(*ent));
+		if (fstatat(node->fd, dp->d_name, &ent->st,
+		    AT_SYMLINK_NOFOLLOW) == -1) {
+			node->error = errno;
 			break;
 		}
-		strncpy(tmp_path, path, PATH_MAX - 1);
-		strncat(tmp_path, "/", PATH_MAX - 1 - strlen(tmp_path));
-		strncat(tmp_path, list[i]->d_name, PATH_MAX - 1 - strlen(tmp_path));
-		if (lstat(tmp_path, &sb) < 0) {
+		ent->name = strdup(dp->d_name);
+		assert(ent->name);
+		node->nents++;
+		if (!S_ISDIR(ent->st.st_mode))
+			continue;
+
+		ent->node = calloc(1, sizeof(*ent->node));
+		assert(ent->node);
+		ent->node->path = xbps_xasprintf("%s/%s", node->path, ent->name);
+	}
+	(void)closedir(dirp);
+	if (node->nents > 1)
+		qsort(node->ents, node->nents, sizeof(*node->ents), walk_ent_cmp);
+}
+
+static void *
+walk_worker(void *arg)
+{
+	struct walk_queue *q = arg;
+	struct walk_node *node;
+
+	pthread_mutex_lock(&q->lock);
+	for (;;) {
+		while (q->head == q->count && q->busy > 0)
+			pthread_cond_wait(&q->cond, &q->lock);
+		if (q->head == q->count)
 			break;
-		}
+		node = q->nodes[q->head++];
+		q->busy++;
+		pthread_mutex_unlock(&q->lock);
 
-		if (S_ISDIR(sb.st_mode)) {
-			if (walk_dir(tmp_path, fn) < 0) {
-				rv = -1;
-				break;
-			}
+		walk_read(node);
+
+		pthread_mutex_lock(&q->lock);
+		for (size_t i = 0; i < node->nents; i++) {
+			if (node->ents[i].node == NULL)
+				continue;
+			q->nodes = realloc(q->nodes,
+			    (q->count + 1) * sizeof(*q->nodes));
+			assert(q->nodes);
+			q->nodes[q->count++] = node->ents[i].node;
 		}
+		q->busy--;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
 
-		rv = fn(tmp_path, &sb, list[i]);
-		if (rv != 0) {
+static int
+walk_tree(struct walk_node *node,
+		int (*fn) (const char *, const struct stat *sb))
+{
+	struct walk_ent *ent;
+	char *path;
+	int rv = 0;
+
+	if (node->error) {
+		errno = node->error;
+		return -1;
+	}
+	for (size_t i = node->nents; i-- > 0;) {
+		ent = &node->ents[i];
+		if (ent->node && walk_tree(ent->node, fn) < 0)
+			return -1;
+		path = xbps_xasprintf("%s/%s", node->path, ent->name);
+		rv = fn(path, &ent->st);
+		free(path);
+		if (rv != 0)
 			break;
-		}
+	}
+	return rv;
+}
+
+static void
+walk_free(struct walk_node *node)
+{
+	for (size_t i = 0; i < node->nents; i++) {
+		if (node->ents[i].node)
+			walk_free(node->ents[i].node);
+		free(node->ents[i].name);
+	}
+	free(node->ents);
+	free(node->path);
+	free(node);
+}
 
+static int
+walk_dir(const char *path, long nthreads,
+		int (*fn) (const char *, const struct stat *sb))
+{
+	struct walk_queue q;
+	struct walk_node *root;
+	pthread_t *thds;
+	long i;
+	int rv;
+
+	root = calloc(1, sizeof(*root));
+	assert(root);
+	root->path = strdup(path);
+	assert(root->path);
+
+	memset(&q, 0, sizeof(q));
+	q.nodes = malloc(sizeof(*q.nodes));
+	assert(q.nodes);
+	q.nodes[q.count++] = root;
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+	if (nthreads < 2) {
+		walk_worker(&q);
+	} else {
+		thds = calloc(nthreads, sizeof(*thds));
+		assert(thds);
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&thds[i], NULL, walk_worker, &q) != 0)
+				die("cannot create walker thread:");
+		}
+		for (i = 0; i < nthreads; i++)
+			pthread_join(thds[i], NULL);
+		free(thds);
 	}
-	free(list);
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.lock);
+	free(q.nodes);
+
+	rv = walk_tree(root, fn);
+	walk_free(root);
 	return rv;
 }
 
@@ -557,7 +877,9 @@ process_xentry(const char *key, const char *mutable_files)
 		/*
 		 * Find out if this file is mutable.
 		 */
-		if (mutable_files) {
+		if (xe->mutable) {
+			xbps_dictionary_set_bool(d, "mutable", true);
+		} else if (mutable_files) {
 			if ((strchr(mutable_files, ' ') == NULL) &&
 			    (strcmp(mutable_files, p) == 0))
 				xbps_dictionary_set_bool(d, "mutable", true);
@@ -586,6 +908,8 @@ process_xentry(const char *key, const char *mutable_files)
 			xbps_dictionary_set_cstring(d, "sha256", xe->hash);
 		if (xe->mtime)
 			xbps_dictionary_set_uint64(d, "mtime", xe->mtime);
+		if (xe->hash)
+			xbps_dictionary_set_uint64(d, "size", xe->size);
 
 		xbps_array_add(a, d);
 		xbps_object_release(d);
@@ -596,12 +920,86 @@ process_xentry(const char *key, const char *mutable_files)
 	xbps_object_release(a);
 }
 
+/*
+ * The sha256 hashes of regular files are computed by a pool of threads
+ * pulling entries from a shared index, so that hashing big packages
+ * scales with the number of processors. The data is read again from the
+ * page cache when it's written to the archive; files.plist precedes the
+ * files in the archive, the hashes must be known before.
+ */
+struct hash_queue {
+	struct xentry **ents;
+	size_t nents, next;
+	pthread_mutex_t lock;
+};
+
+static void *
+hash_worker(void *arg)
+{
+	struct hash_queue *q = arg;
+	struct xentry *xe;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		xe = q->next < q->nents ? q->ents[q->next++] : NULL;
+		pthread_mutex_unlock(&q->lock);
+		if (xe == NULL)
+			break;
+		if ((xe->hash = xbps_file_hash(xe->file)) == NULL)
+			die("failed to process hash for %s:", xe->file);
+	}
+	return NULL;
+}
+
 static void
-process_destdir(const char *mutable_files)
+hash_xentries(long nthreads)
 {
-	if (walk_dir(".", ftw_cb) < 0)
+	struct hash_queue q;
+	struct xentry *xe;
+	pthread_t *thds;
+	long i;
+
+	memset(&q, 0, sizeof(q));
+	TAILQ_FOREACH(xe, &xentry_list, entries) {
+		if (strcmp(xe->type, "files") && strcmp(xe->type, "conf_files"))
+			continue;
+		if (xe->hash != NULL)
+			continue;
+		q.ents = realloc(q.ents, (q.nents + 1) * sizeof(*q.ents));
+		assert(q.ents);
+		q.ents[q.nents++] = xe;
+	}
+	if (q.nents == 0)
+		return;
+
+	pthread_mutex_init(&q.lock, NULL);
+	if (nthreads > (long)q.nents)
+		nthreads = (long)q.nents;
+	if (nthreads < 2) {
+		hash_worker(&q);
+	} else {
+		thds = calloc(nthreads, sizeof(*thds));
+		assert(thds);
+		for (i = 0; i < nthreads; i++) {
+			if (pthread_create(&thds[i], NULL, hash_worker, &q) != 0)
+				die("cannot create hashing thread:");
+		}
+		for (i = 0; i < nthreads; i++)
+			pthread_join(thds[i], NULL);
+		free(thds);
+	}
+	pthread_mutex_destroy(&q.lock);
+	free(q.ents);
+}
+
+static void
+process_destdir(const char *mutable_files, long nthreads)
+{
+	if (walk_dir(".", nthreads, ftw_cb) < 0)
 		die("failed to process destdir files (nftw):");
 
+	hash_xentries(nthreads);
+
 	/* Process regular files */
 	process_xentry("files", mutable_files);
 
@@ -615,6 +1013,186 @@ process_destdir(const char *mutable_files)
 	process_xentry("dirs", NULL);
 }
 
+/*
+ * Packages created from an installed package (-i) take their entries
+ * from its files plist, and the files from rootdir. The hashes recorded
+ * in pkgdb are reused if the size and mtime of the file match, only the
+ * files modified since they were unpacked are hashed again; then every
+ * file is read once, to write it to the archive.
+ */
+static void
+installed_xentry(xbps_dictionary_t obj, const char *key)
+{
+	struct xentry *xe;
+	struct stat st;
+	const char *file, *target = NULL, *sha256 = NULL;
+	uint64_t size = 0, mtime = 0;
+
+	if (!xbps_dictionary_get_cstring_nocopy(obj, "file", &file))
+		return;
+
+	xe = calloc(1, sizeof(*xe));
+	assert(xe);
+	xe->file = xbps_xasprintf(".%s", file);
+	xe->type = strdup(key);
+	assert(xe->type);
+	xbps_dictionary_get_bool(obj, "mutable", &xe->mutable);
+	if (xbps_dictionary_get_cstring_nocopy(obj, "target", &target)) {
+		xe->target = strdup(target);
+		assert(xe->target);
+	}
+	if (strcmp(key, "dirs") == 0)
+		goto out;
+
+	if (lstat(xe->file, &st) == -1)
+		die("cannot add %s to package:", file);
+	if (strcmp(key, "links") == 0) {
+		if (!S_ISLNK(st.st_mode))
+			die("%s is not a symlink anymore", file);
+		xe->mtime = (uint64_t)st.st_mtime;
+		goto out;
+	}
+	if (!S_ISREG(st.st_mode))
+		die("%s is not a regular file anymore", file);
+	if (st.st_nlink <= 1 || !inode_seen(st.st_dev, st.st_ino))
+		instsize += st.st_size;
+	xe->inode = st.st_ino;
+	xe->size = (uint64_t)st.st_size;
+	xe->mtime = (uint64_t)st.st_mtime;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "sha256", &sha256);
+	xbps_dictionary_get_uint64(obj, "mtime", &mtime);
+	if (!xbps_dictionary_get_uint64(obj, "size", &size))
+		size = xe->size;
+	if (sha256 && mtime == xe->mtime && size == xe->size) {
+		xe->hash = strdup(sha256);
+		assert(xe->hash);
+	}
+out:
+	/* process_xentry() walks the list backwards */
+	TAILQ_INSERT_HEAD(&xentry_list, xe, entries);
+}
+
+static void
+process_installed(struct xbps_handle *xhp, const char *pkgname, long nthreads)
+{
+	static const char *keys[] = { "files", "conf_files", "links", "dirs" };
+	xbps_dictionary_t filesd;
+	xbps_array_t array;
+
+	if ((filesd = xbps_pkgdb_get_pkg_files(xhp, pkgname)) == NULL)
+		die("cannot find the files of %s", pkgname);
+
+	for (unsigned int i = 0; i < __arraycount(keys); i++) {
+		array = xbps_dictionary_get(filesd, keys[i]);
+		for (unsigned int x = 0; x < xbps_array_count(array); x++)
+			installed_xentry(xbps_array_get(array, x), keys[i]);
+	}
+	xbps_object_release(filesd);
+
+	hash_xentries(nthreads);
+
+	for (unsigned int i = 0; i < __arraycount(keys); i++)
+		process_xentry(keys[i], NULL);
+}
+
+/*
+ * The properties of the installed package, without the objects added
+ * when it was indexed and installed.
+ */
+static xbps_dictionary_t
+installed_props(struct xbps_handle *xhp, const char *pkgname)
+{
+	static const char *keys[] = {
+		"automatic-install", "build-date", "delta-base",
+		"delta-sha256", "delta-size", "filename-sha256",
+		"filename-size", "hold", "install-date", "install-script",
+		"installed_size", "metafile-sha256", "remove-script",
+		"repolock", "repository", "state"
+	};
+	xbps_dictionary_t pkgd, propsd;
+	pkg_state_t state = 0;
+
+	if ((pkgd = xbps_pkgdb_get_pkg(xhp, pkgname)) == NULL)
+		die("package %s is not installed", pkgname);
+	if (xbps_pkg_state_dictionary(pkgd, &state) != 0 ||
+	    state != XBPS_PKG_STATE_INSTALLED)
+		die("package %s is not fully installed", pkgname);
+
+	propsd = xbps_dictionary_copy_mutable(pkgd);
+	assert(propsd);
+	for (unsigned int i = 0; i < __arraycount(keys); i++)
+		xbps_dictionary_remove(propsd, keys[i]);
+
+	instpkgd = pkgd;
+	return propsd;
+}
+
+static void
+append_script(struct archive *ar, const char *key, const char *fname)
+{
+	xbps_data_t data;
+
+	data = xbps_dictionary_get(instpkgd, key);
+	if (xbps_data_size(data) == 0)
+		return;
+	if (xbps_archive_append_buf(ar, xbps_data_data_nocopy(data),
+	    xbps_data_size(data), fname, 0755, "root", "root") != 0)
+		die("cannot write %s to archive:", fname);
+}
+
+/*
+ * Returns the size of the headers written for entry, by writing them
+ * to a scratch archive in the same format.
+ */
+static int64_t
+header_size(struct archive *ar, struct archive_entry *entry)
+{
+	static char buf[65536];
+	struct archive *sar;
+	int64_t size;
+	size_t used;
+
+	sar = archive_write_new();
+	assert(sar);
+	archive_write_set_format(sar, archive_format(ar));
+	if (archive_write_open_memory(sar, buf, sizeof(buf), &used) != 0 ||
+	    archive_write_header(sar, entry) != 0)
+		die("cannot write %s to archive: %s",
+		    archive_entry_pathname(entry), archive_error_string(sar));
+	size = archive_filter_bytes(sar, 0);
+	/* the entry data was never written, it fails to close */
+	archive_write_free(sar);
+
+	return size;
+}
+
+/*
+ * Pads the archive with directory entries, ignored when unpacking, until
+ * the data of entry starts at a multiple of STORED_ALIGN.
+ */
+static void
+align_entry(struct archive *ar, struct archive_entry *entry)
+{
+	struct archive_entry *pad;
+	int64_t hsize;
+
+	hsize = header_size(ar, entry);
+	while ((archive_filter_bytes(ar, 0) + hsize) % STORED_ALIGN) {
+		pad = archive_entry_new();
+		assert(pad);
+		archive_entry_set_pathname(pad, "./");
+		archive_entry_set_filetype(pad, AE_IFDIR);
+		archive_entry_set_perm(pad, 0755);
+		archive_entry_set_uname(pad, "root");
+		archive_entry_set_gname(pad, "root");
+		if (archive_write_header(ar, pad))
+			die("cannot write padding to archive: %s",
+			    archive_error_string(ar));
+		archive_entry_free(pad);
+	}
+}
+
 static void
 write_entry(struct archive *ar, struct archive_entry *entry)
 {
@@ -626,6 +1204,10 @@ write_entry(struct archive *ar, struct archive_entry *entry)
 	if (archive_entry_pathname(entry) == NULL)
 		return;
 
+	if (stored && archive_entry_filetype(entry) == AE_IFREG &&
+	    archive_entry_size(entry) >= STORED_MINSIZE)
+		align_entry(ar, entry);
+
 	if (archive_write_header(ar, entry)) {
 		die("cannot write %s to archive: %s",
 		    archive_entry_pathname(entry),
@@ -720,6 +1302,10 @@ process_archive(struct archive *ar,
 	char *xml;
 
 	/* Add INSTALL/REMOVE metadata scripts first */
+	if (instpkgd != NULL) {
+		append_script(ar, "install-script", "./INSTALL");
+		append_script(ar, "remove-script", "./REMOVE");
+	}
 	TAILQ_FOREACH(xe, &xentry_list, entries) {
 		process_entry_file(ar, resolver, xe, "./INSTALL");
 		process_entry_file(ar, resolver, xe, "./REMOVE");
@@ -762,7 +1348,7 @@ process_archive(struct archive *ar,
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "A:B:C:c:D:F:G:H:hl:M:m:n:P:pqr:R:S:s:t:V";
+	const char *shortopts = "A:B:C:c:D:F:G:H:hi:l:M:m:n:P:pqr:R:S:s:t:V";
 	const struct option longopts[] = {
 		{ "architecture", required_argument, NULL, 'A' },
 		{ "built-with", required_argument, NULL, 'B' },
@@ -772,6 +1358,7 @@ main(int argc, char **argv)
 		{ "config-files", required_argument, NULL, 'F' },
 		{ "homepage", required_argument, NULL, 'H' },
 		{ "help", no_argument, NULL, 'h' },
+		{ "installed", required_argument, NULL, 'i' },
 		{ "license", required_argument, NULL, 'l' },
 		{ "mutable-files", required_argument, NULL, 'M' },
 		{ "maintainer", required_argument, NULL, 'm' },
@@ -790,9 +1377,13 @@ main(int argc, char **argv)
 		{ "build-options", required_argument, NULL, '2' },
 		{ "compression", required_argument, NULL, '3' },
 		{ "alternatives", required_argument, NULL, '4' },
+		{ "compression-threads", required_argument, NULL, '5' },
+		{ "triggers", required_argument, NULL, '6' },
 		{ "changelog", required_argument, NULL, 'c'},
+		{ "rootdir", required_argument, NULL, '7' },
 		{ NULL, 0, NULL, 0 }
 	};
+	struct xbps_handle xh;
 	struct archive *ar;
 	struct archive_entry *entry, *sparse_entry;
 	struct archive_entry_linkresolver *resolver;
@@ -801,10 +1392,12 @@ main(int argc, char **argv)
 	const char *provides, *pkgver, *replaces, *reverts, *desc, *ldesc;
 	const char *arch, *config_files, *mutable_files, *version, *changelog;
 	const char *buildopts, *shlib_provides, *shlib_requires, *alternatives;
-	const char *compression, *tags = NULL, *srcrevs = NULL;
-	char *pkgname, *binpkg, *tname, *p, cwd[PATH_MAX-1];
+	const char *compression, *tags = NULL, *srcrevs = NULL, *triggers = NULL;
+	const char *installed = NULL, *rootdir = NULL;
+	char *pkgname, *binpkg, *tname, *p, cwd[PATH_MAX-1], threads[32];
 	bool quiet = false, preserve = false;
 	int c, pkg_fd;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
 	mode_t myumask;
 
 	arch = conflicts = deps = homepage = license = maint = compression = NULL;
@@ -844,6 +1437,9 @@ main(int argc, char **argv)
 		case 'H':
 			homepage = optarg;
 			break;
+		case 'i':
+			installed = optarg;
+			break;
 		case 'l':
 			license = optarg;
 			break;
@@ -898,18 +1494,50 @@ main(int argc, char **argv)
 		case '4':
 			alternatives = optarg;
 			break;
+		case '5':
+			nthreads = strtol(optarg, NULL, 10);
+			break;
+		case '6':
+			triggers = optarg;
+			break;
+		case '7':
+			rootdir = optarg;
+			break;
 		case '?':
 		default:
 			usage();
 		}
 	}
-	if (argc == optind)
+	if ((installed == NULL) == (argc == optind))
 		usage();
 
-	destdir = argv[optind];
-
 	setlocale(LC_ALL, "");
 
+	if (installed) {
+		int rv;
+
+		memset(&xh, 0, sizeof(xh));
+		if (rootdir)
+			xbps_strlcpy(xh.rootdir, rootdir, sizeof(xh.rootdir));
+		if ((rv = xbps_init(&xh)) != 0)
+			die("failed to initialize libxbps: %s", strerror(rv));
+		pkg_propsd = installed_props(&xh, installed);
+		if (pkgver == NULL)
+			xbps_dictionary_get_cstring_nocopy(instpkgd,
+			    "pkgver", &pkgver);
+		if (desc == NULL)
+			xbps_dictionary_get_cstring_nocopy(instpkgd,
+			    "short_desc", &desc);
+		if (arch == NULL)
+			xbps_dictionary_get_cstring_nocopy(instpkgd,
+			    "architecture", &arch);
+		destdir = xh.rootdir;
+	} else {
+		destdir = argv[optind];
+		pkg_propsd = xbps_dictionary_create();
+		assert(pkg_propsd);
+	}
+
 	if (pkgver == NULL)
 		die("pkgver not set!");
 	else if (desc == NULL)
@@ -930,12 +1558,6 @@ main(int argc, char **argv)
 		die("failed to stat() destdir `%s':", destdir);
 	if (!S_ISDIR(st.st_mode))
 		die("destdir `%s' is not a directory!", destdir);
-	/*
-	 * Process XBPS_PKGPROPS metadata file.
-	 */
-	pkg_propsd = xbps_dictionary_create();
-	assert(pkg_propsd);
-
 	/* Required properties */
 	xbps_dictionary_set_cstring_nocopy(pkg_propsd, "architecture", arch);
 	xbps_dictionary_set_cstring_nocopy(pkg_propsd, "pkgname", pkgname);
@@ -983,6 +1605,7 @@ main(int argc, char **argv)
 	process_array("reverts", reverts);
 	process_array("shlib-provides", shlib_provides);
 	process_array("shlib-requires", shlib_requires);
+	process_array("triggers", triggers);
 	process_dict_of_arrays("alternatives", alternatives);
 
 	/* save cwd */
@@ -993,9 +1616,6 @@ main(int argc, char **argv)
 	if (chdir(destdir) == -1)
 		die("cannot chdir() to destdir %s:", destdir);
 
-	/* Optional INSTALL/REMOVE messages */
-	process_file("INSTALL.msg", "install-msg");
-	process_file("REMOVE.msg", "remove-msg");
 	/*
 	 * Process XBPS_PKGFILES metadata file.
 	 */
@@ -1003,7 +1623,14 @@ main(int argc, char **argv)
 	assert(pkg_filesd);
 	all_filesd = xbps_dictionary_create();
 	assert(all_filesd);
-	process_destdir(mutable_files);
+	if (installed) {
+		process_installed(&xh, installed, nthreads);
+	} else {
+		/* Optional INSTALL/REMOVE messages */
+		process_file("INSTALL.msg", "install-msg");
+		process_file("REMOVE.msg", "remove-msg");
+		process_destdir(mutable_files, nthreads);
+	}
 
 	/* Back to original cwd after file tree walk processing */
 	if (chdir(p) == -1)
@@ -1027,14 +1654,29 @@ main(int argc, char **argv)
 	 */
 	if (compression == NULL || strcmp(compression, "xz") == 0) {
 		archive_write_add_filter_xz(ar);
+		/*
+		 * The multi-threaded encoder splits the stream in independent
+		 * blocks that can be decompressed in parallel, its output
+		 * doesn't depend on the number of threads (if more than 1).
+		 */
+		if (nthreads < 2)
+			nthreads = 2;
+		snprintf(threads, sizeof(threads), "%ld", nthreads);
+		archive_write_set_filter_option(ar, "xz", "threads", threads);
 	} else if (strcmp(compression, "gzip") == 0) {
 		archive_write_add_filter_gzip(ar);
 		archive_write_set_options(ar, "compression-level=9");
 	} else if (strcmp(compression, "bzip2") == 0) {
 		archive_write_add_filter_bzip2(ar);
 		archive_write_set_options(ar, "compression-level=9");
+	} else if (strcmp(compression, "zstd") == 0) {
+#ifndef HAVE_ZSTD
+		die("zstd compression is not supported");
+#endif
 	} else if (strcmp(compression, "none") == 0) {
 		/* empty */
+	} else if (strcmp(compression, "stored") == 0) {
+		stored = true;
 	} else {
 		die("unknown compression format %s");
 	}
@@ -1045,8 +1687,13 @@ main(int argc, char **argv)
 	archive_entry_linkresolver_set_strategy(resolver,
 	    archive_format(ar));
 
-	if (archive_write_open_fd(ar, pkg_fd) != 0)
+	if (compression && strcmp(compression, "zstd") == 0) {
+#ifdef HAVE_ZSTD
+		zstd_open(ar, pkg_fd, nthreads);
+#endif
+	} else if (archive_write_open_fd(ar, pkg_fd) != 0) {
 		die("Failed to open %s fd for writing:", tname);
+	}
 
 	process_archive(ar, resolver, pkgver, quiet);
 	/* Process hardlinks */
@@ -88,6 +88,30 @@ struct pkgdep {
 	xbps_array_t provides;
 };
 
+/*
+ * Dependency graph of all packages, built in one pass: every node
+ * is a pkgver indexed by its position in pkgvers, every edge goes
+ * from a package to the package resolving one of its run_depends.
+ * The dependency patterns are resolved once and shared by all
+ * packages requiring them.
+ */
+struct graph {
+	struct xbps_handle *xhp;
+	xbps_dictionary_t nodes;
+	xbps_dictionary_t resolved;
+	xbps_array_t pkgvers;
+	unsigned int *edges;
+	unsigned int nedges;
+	unsigned int edgesz;
+	bool repomode;
+};
+
+enum graph_format {
+	FORMAT_DOT,
+	FORMAT_EDGES,
+	FORMAT_JSON
+};
+
 static xbps_dictionary_t confd;
 static SLIST_HEAD(pkgdep_head, pkgdep) pkgdep_list =
     SLIST_HEAD_INITIALIZER(pkgdep_list);
@@ -118,6 +142,8 @@ usage(void)
 	" -C --config <dir>        Path to confdir (xbps.d)\n"
 	" -c --graph-config <file> Path to the graph configuration file\n"
 	" -d --debug               Debug mode shown to stderr\n"
+	" -F --format <fmt>        Output format for -a: dot (default), edges\n"
+	"                          or json\n"
 	" -h --help                Print help usage\n"
 	" -M --memory-sync         Remote repository data is fetched and stored\n"
 	"                          in memory, ignoring on-disk repodata archives.\n"
@@ -125,6 +151,7 @@ usage(void)
 	" -R --repository          Enable repository mode. This mode explicitly\n"
 	"                          looks for packages in repositories.\n"
 	"MODE\n"
+	" -a --all                 Generate a dependency graph of all packages\n"
 	" -g --gen-config          Generate a configuration file\n"
 	" -f --fulldeptree         Generate a dependency graph\n"
 	" -m --metadata            Generate a metadata graph (default mode)\n\n");
@@ -498,14 +525,312 @@ create_dot_graph(struct xbps_handle *xhp,
 	fclose(f);
 }
 
+static unsigned int
+graph_node(struct graph *g, const char *pkgver)
+{
+	unsigned int idx;
+
+	if (xbps_dictionary_get_uint32(g->nodes, pkgver, &idx))
+		return idx;
+
+	idx = xbps_array_count(g->pkgvers);
+	xbps_array_add_cstring(g->pkgvers, pkgver);
+	xbps_dictionary_set_uint32(g->nodes, pkgver, idx);
+	return idx;
+}
+
+static void
+graph_edge(struct graph *g, unsigned int from, unsigned int to)
+{
+	if (g->nedges == g->edgesz) {
+		g->edgesz = g->edgesz ? g->edgesz * 2 : 1024;
+		g->edges = realloc(g->edges, g->edgesz * 2 * sizeof(*g->edges));
+		if (g->edges == NULL)
+			die("%s alloc edges", __func__);
+	}
+	g->edges[g->nedges * 2] = from;
+	g->edges[g->nedges * 2 + 1] = to;
+	g->nedges++;
+}
+
+static const char *
+graph_resolve(struct graph *g, const char *pattern)
+{
+	xbps_dictionary_t pkgd;
+	const char *pkgver = NULL;
+
+	if (xbps_dictionary_get_cstring_nocopy(g->resolved, pattern, &pkgver))
+		return *pkgver ? pkgver : NULL;
+
+	if (g->repomode) {
+		if ((pkgd = xbps_rpool_get_pkg(g->xhp, pattern)) == NULL)
+			pkgd = xbps_rpool_get_virtualpkg(g->xhp, pattern);
+	} else {
+		if ((pkgd = xbps_pkgdb_get_pkg(g->xhp, pattern)) == NULL)
+			pkgd = xbps_pkgdb_get_virtualpkg(g->xhp, pattern);
+	}
+	if (pkgd)
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+
+	xbps_dictionary_set_cstring(g->resolved, pattern, pkgver ? pkgver : "");
+	return pkgver;
+}
+
+static void
+graph_add_pkg(struct graph *g, xbps_dictionary_t pkgd)
+{
+	xbps_array_t rdeps, provides;
+	const char *pkgver;
+	unsigned int idx;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	rdeps = xbps_dictionary_get(pkgd, "run_depends");
+	provides = xbps_dictionary_get(pkgd, "provides");
+	idx = graph_node(g, pkgver);
+
+	for (unsigned int i = 0; i < xbps_array_count(rdeps); i++) {
+		const char *pattern, *deppkgver;
+		char *depname;
+		bool self;
+
+		xbps_array_get_cstring_nocopy(rdeps, i, &pattern);
+		if (provides) {
+			if (((depname = xbps_pkgpattern_name(pattern)) == NULL) &&
+			    ((depname = xbps_pkg_name(pattern)) == NULL))
+				continue;
+			self = xbps_match_pkgname_in_array(provides, depname);
+			free(depname);
+			if (self)
+				continue;
+		}
+		if ((deppkgver = graph_resolve(g, pattern)) == NULL) {
+			xbps_dbg_printf(g->xhp, "%s: cannot find `%s' "
+			    "dependency\n", pkgver, pattern);
+			continue;
+		}
+		graph_edge(g, idx, graph_node(g, deppkgver));
+	}
+}
+
+static int
+cmpstringp(const void *p1, const void *p2)
+{
+	return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+static int
+graph_pkgdb_cb(struct xbps_handle *xhp UNUSED, xbps_object_t obj UNUSED,
+		const char *key, void *arg, bool *done UNUSED)
+{
+	xbps_array_add_cstring_nocopy(arg, key);
+	return 0;
+}
+
+static int
+graph_repo_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
+{
+	xbps_array_t allkeys;
+	xbps_dictionary_t idx;
+
+	if ((idx = xbps_repo_get_index(repo)) == NULL)
+		return 0;
+
+	allkeys = xbps_dictionary_all_keys(idx);
+	for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+		xbps_object_t keysym = xbps_array_get(allkeys, i);
+
+		xbps_dictionary_set_bool(arg,
+		    xbps_dictionary_keysym_cstring_nocopy(keysym), true);
+	}
+	xbps_object_release(allkeys);
+	return 0;
+}
+
+/*
+ * Nodes are numbered by pkgname, so that they are stable and the
+ * edges are grouped by package; in repository mode the pkgnames of
+ * all repositories are resolved like any other dependency.
+ */
+static void
+graph_build(struct graph *g)
+{
+	xbps_array_t pkgnames, pkgds;
+	const char **names;
+	unsigned int n;
+	int rv;
+
+	pkgnames = xbps_array_create();
+	assert(pkgnames);
+	if (g->repomode) {
+		xbps_dictionary_t d;
+		xbps_array_t allkeys;
+
+		d = xbps_dictionary_create_hashed(0);
+		assert(d);
+		if ((rv = xbps_rpool_foreach(g->xhp, graph_repo_cb, d)) != 0 &&
+		    rv != ENOTSUP)
+			die("failed to process repositories");
+		allkeys = xbps_dictionary_all_keys(d);
+		for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+			xbps_array_add_cstring(pkgnames,
+			    xbps_dictionary_keysym_cstring_nocopy(
+			    xbps_array_get(allkeys, i)));
+		}
+		xbps_object_release(allkeys);
+		xbps_object_release(d);
+	} else {
+		if ((rv = xbps_pkgdb_foreach_cb(g->xhp, graph_pkgdb_cb,
+		    pkgnames)) != 0) {
+			errno = rv;
+			die("failed to process pkgdb");
+		}
+	}
+	n = xbps_array_count(pkgnames);
+	if ((names = calloc(n + 1, sizeof(*names))) == NULL)
+		die("%s alloc names", __func__);
+	for (unsigned int i = 0; i < n; i++)
+		xbps_array_get_cstring_nocopy(pkgnames, i, &names[i]);
+	qsort(names, n, sizeof(*names), cmpstringp);
+
+	pkgds = xbps_array_create();
+	assert(pkgds);
+	for (unsigned int i = 0; i < n; i++) {
+		xbps_dictionary_t pkgd;
+		const char *pkgver;
+
+		if (g->repomode)
+			pkgd = xbps_rpool_get_pkg(g->xhp, names[i]);
+		else
+			pkgd = xbps_pkgdb_get_pkg(g->xhp, names[i]);
+		if (pkgd == NULL)
+			continue;
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		graph_node(g, pkgver);
+		xbps_array_add(pkgds, pkgd);
+	}
+	/* edges are added in node order */
+	for (unsigned int i = 0; i < xbps_array_count(pkgds); i++)
+		graph_add_pkg(g, xbps_array_get(pkgds, i));
+
+	xbps_object_release(pkgds);
+	free(names);
+	xbps_object_release(pkgnames);
+}
+
+static void
+print_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void
+create_all_graph(struct xbps_handle *xhp, FILE *f, bool repomode,
+		enum graph_format format)
+{
+	struct graph g;
+	const char *pkgver;
+	unsigned int npkgs;
+
+	memset(&g, 0, sizeof(g));
+	g.xhp = xhp;
+	g.repomode = repomode;
+	g.nodes = xbps_dictionary_create_hashed(0);
+	g.resolved = xbps_dictionary_create_hashed(0);
+	g.pkgvers = xbps_array_create();
+	assert(g.nodes);
+	assert(g.resolved);
+	assert(g.pkgvers);
+
+	graph_build(&g);
+	npkgs = xbps_array_count(g.pkgvers);
+
+	switch (format) {
+	case FORMAT_DOT:
+		fprintf(f, "/* Graph created by xbps-graph %s */\n\n",
+		    XBPS_RELVER);
+		fprintf(f, "digraph pkg_dictionary {\n");
+		fprintf(f, "	graph [");
+		write_conf_property_on_stream(f, "graph");
+		fprintf(f, ",label=\"[XBPS] full dependency graph [%s]\"];\n",
+		    repomode ? "repo" : "pkgdb");
+		fprintf(f, "	edge [");
+		write_conf_property_on_stream(f, "edge");
+		fprintf(f, "];\n");
+		fprintf(f, "	node [");
+		write_conf_property_on_stream(f, "node");
+		fprintf(f, "];\n");
+		for (unsigned int i = 0; i < npkgs; i++) {
+			xbps_array_get_cstring_nocopy(g.pkgvers, i, &pkgver);
+			fprintf(f, "\t%u [label=\"%s\"", i, pkgver);
+			if (repomode && xbps_pkgdb_get_pkg(xhp, pkgver))
+				fprintf(f, ",style=\"filled\",fillcolor=\"yellowgreen\"");
+			fprintf(f, "]\n");
+		}
+		for (unsigned int i = 0; i < g.nedges; i++)
+			fprintf(f, "\t%u -> %u;\n", g.edges[i * 2], g.edges[i * 2 + 1]);
+		fprintf(f, "}\n");
+		break;
+	case FORMAT_EDGES:
+		/*
+		 * One edge per line, packages without dependencies
+		 * are printed alone.
+		 */
+		for (unsigned int i = 0, e = 0; i < npkgs; i++) {
+			const char *deppkgver;
+			bool deps = false;
+
+			xbps_array_get_cstring_nocopy(g.pkgvers, i, &pkgver);
+			for (; e < g.nedges && g.edges[e * 2] == i; e++) {
+				xbps_array_get_cstring_nocopy(g.pkgvers,
+				    g.edges[e * 2 + 1], &deppkgver);
+				fprintf(f, "%s %s\n", pkgver, deppkgver);
+				deps = true;
+			}
+			if (!deps)
+				fprintf(f, "%s\n", pkgver);
+		}
+		break;
+	case FORMAT_JSON:
+		fprintf(f, "{\"nodes\":[");
+		for (unsigned int i = 0; i < npkgs; i++) {
+			xbps_array_get_cstring_nocopy(g.pkgvers, i, &pkgver);
+			if (i)
+				fputc(',', f);
+			print_json_string(f, pkgver);
+		}
+		fprintf(f, "],\"edges\":[");
+		for (unsigned int i = 0; i < g.nedges; i++) {
+			fprintf(f, "%s[%u,%u]", i ? "," : "",
+			    g.edges[i * 2], g.edges[i * 2 + 1]);
+		}
+		fprintf(f, "]}\n");
+		break;
+	}
+	fflush(f);
+	fclose(f);
+
+	free(g.edges);
+	xbps_object_release(g.pkgvers);
+	xbps_object_release(g.resolved);
+	xbps_object_release(g.nodes);
+}
+
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "C:c:dfghMmRr:V";
+	const char *shortopts = "aC:c:dF:fghMmRr:V";
 	const struct option longopts[] = {
+		{ "all", no_argument, NULL, 'a' },
 		{ "config", required_argument, NULL, 'C' },
 		{ "graph-config", required_argument, NULL, 'c' },
 		{ "debug", no_argument, NULL, 'd' },
+		{ "format", required_argument, NULL, 'F' },
 		{ "fulldeptree", no_argument, NULL, 'f' },
 		{ "gen-config", no_argument, NULL, 'g' },
 		{ "help", no_argument, NULL, 'h' },
@@ -520,14 +845,19 @@ main(int argc, char **argv)
 	struct xbps_handle xh;
 	FILE *f = NULL;
 	const char *pkg, *confdir, *conf_file, *rootdir;
+	enum graph_format format = FORMAT_DOT;
 	int c, rv, flags = 0;
-	bool opmode, repomode, fulldepgraph, metadata;
+	bool opmode, repomode, fulldepgraph, metadata, all;
 
 	pkg = confdir = conf_file = rootdir = NULL;
-	opmode = repomode = fulldepgraph = metadata = false;
+	opmode = repomode = fulldepgraph = metadata = all = false;
 
 	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
 		switch (c) {
+		case 'a':
+			/* generate a dependency graph of all packages */
+			opmode = all = true;
+			break;
 		case 'C':
 			/* xbps.d confdir */
 			confdir = optarg;
@@ -539,6 +869,16 @@ main(int argc, char **argv)
 		case 'd':
 			flags |= XBPS_FLAG_DEBUG;
 			break;
+		case 'F':
+			if (strcmp(optarg, "dot") == 0)
+				format = FORMAT_DOT;
+			else if (strcmp(optarg, "edges") == 0)
+				format = FORMAT_EDGES;
+			else if (strcmp(optarg, "json") == 0)
+				format = FORMAT_JSON;
+			else
+				usage();
+			break;
 		case 'f':
 			/* generate a full dependency graph */
 			opmode = fulldepgraph = true;
@@ -573,7 +913,7 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (!argc && !opmode) {
+	if (!argc && !all) {
 		usage();
 	} else if (!opmode) {
 		/* metadata mode by default */
@@ -605,6 +945,14 @@ main(int argc, char **argv)
 
 		confd = create_defconf();
 	}
+	if (all) {
+		if ((f = fdopen(STDOUT_FILENO, "w")) == NULL)
+			die("cannot open stdout");
+
+		create_all_graph(&xh, f, repomode, format);
+		xbps_end(&xh);
+		exit(EXIT_SUCCESS);
+	}
 	/*
 	 * Internalize the plist file of the target installed package.
 	 */
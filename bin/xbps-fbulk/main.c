@@ -35,8 +35,8 @@
  * This is a derived version of DragonFly's BSD "fastbulk", adapted for xbps
  * by Juan RP <xtraeme@voidlinux.eu>.
  *
- * This program iterates all srcpkgs directories, runs './xbps-src show-build-deps',
- * and builds a dependency tree on the fly.
+ * This program iterates all srcpkgs directories, runs './xbps-src show-build-deps'
+ * for many packages at once, and builds a dependency tree on the fly.
  *
  * As the dependency tree is being built, terminal dependencies are built
  * and packaged on the fly.
@@ -44,6 +44,21 @@
  * As these builds complete additional dependencies may be satisfied and be
  * added to the build order. Ultimately the entire tree is built.
  *
+ * Packages ready to be built are started by priority, packages on the
+ * longest chain of dependent builds (weighted by the time they took in
+ * previous runs) go first.
+ *
+ * Builds are admitted while they fit in the CPU budget (-j), the memory
+ * budget (-m) and the load average limit (-L), using the CPU and memory
+ * usage of the packages in previous runs.
+ *
+ * Builds can also run on other hosts (-H) through ssh(1), sharing the
+ * void-packages directory at the same path, this process keeps the
+ * dependency tree and decides what is built where.
+ *
+ * Packages whose template version is already in the repositories set
+ * with -R are not built, nor are their dependencies collected.
+ *
  * Only one attempt is made to build any given package, no matter how many
  * other packages depend on it.
  */
@@ -62,38 +77,84 @@
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include <xbps.h>
 
 struct item;
 
+struct host {
+	char *name;		/* ssh destination, NULL for this host */
+	unsigned int ncpu;	/* CPU budget */
+	unsigned int cpu;	/* expected CPU usage of running builds */
+	uint64_t mem;		/* expected memory usage of running builds */
+	int nrunning;
+};
+
 struct depn {
 	struct depn *dnext;
 	struct item *item;
 };
 
 struct item {
-	enum { XWAITING, XDEPFAIL, XBUILD, XRUN, XDONE, XBROKEN } status;
+	enum { XWAITING, XDEPFAIL, XBUILD, XRUN, XDONE, XBROKEN, XUPTODATE } status;
 	struct item *hnext;	/* ItemHash next */
-	struct item *bnext;	/* BuildList/RunList next */
+	struct item *bnext;	/* RunList next */
+	struct item *snext;	/* ScanList/ScanRunList next */
 	struct depn *dbase;	/* packages depending on us */
 	char *pkgn;		/* package name */
 	char *emsg;		/* error message */
 	int dcount;		/* build completion for our dependencies */
 	int xcode;		/* exit code from build */
 	pid_t pid;		/* running build */
+	pid_t spid;		/* running show-build-deps */
+	int sfd;		/* show-build-deps output */
+	char *sbuf;		/* show-build-deps partial line */
+	size_t slen;
+	char *shash;		/* template hash, if it can be cached */
+	xbps_array_t sdeps;	/* build dependencies found by the scan */
+	uint64_t dur;		/* expected build time */
+	uint64_t prio;		/* critical path from us, in seconds */
+	unsigned int pgen;	/* PrioGen of prio */
+	unsigned int border;	/* BuildHeap insertion order */
+	time_t stime;		/* build start time */
+	unsigned int cpu;	/* expected CPU usage, in percent */
+	uint64_t mem;		/* expected memory usage, in KB */
+	struct host *host;	/* host running the build */
 };
 
 #define ITHSIZE	1024
 #define ITHMASK	(ITHSIZE - 1)
 
 static struct item *ItemHash[ITHSIZE];
-static struct item *BuildList;
-static struct item **BuildListP = &BuildList;
+static struct item **BuildHeap;
+static size_t NBuildHeap, BuildHeapSize;
+static unsigned int BuildOrder;
+static unsigned int PrioGen = 1;
+static bool GraphDirty;
 static struct item *RunList;
+static struct item *ScanList;
+static struct item **ScanListP = &ScanList;
+static struct item *ScanRunList;
+static xbps_dictionary_t DepsCache;
+static xbps_dictionary_t Times;
+static uint64_t AvgTime = 1;
+static xbps_dictionary_t Usage;
+static struct host *Hosts;
+static int NHosts;
+static struct xbps_handle XH;
+static struct xbps_repo **Repos;
+static int NRepos;
 
 int NParallel = 1;
+uint64_t MemLimit;
+double LoadLimit;
+int NScanJobs;
+int NScanning;
 int VerboseOpt;
 int NRunning;
 char *LogDir;
@@ -144,6 +205,8 @@ addItem(const char *pkgn)
 	item->status = XWAITING;
 	item->hnext = *itemp;
 	item->pkgn = strdup(pkgn);
+	if (!xbps_dictionary_get_uint64(Times, pkgn, &item->dur))
+		item->dur = AvgTime;
 	*itemp = item;
 
 	return item;
@@ -152,15 +215,128 @@ addItem(const char *pkgn)
 static void __attribute__((noreturn))
 usage(const char *progname)
 {
-	fprintf(stderr, "%s [-a targetarch] [-h] [-j parallel] [-l logdir] [-V]"
+	fprintf(stderr, "%s [-a targetarch] [-h] [-H host[:ncpu]] [-j parallel]"
+	    " [-l logdir] [-L load] [-m memory] [-R repo] [-s scanjobs] [-V] "
 	    "/path/to/void-packages [pkg pkgN]\n", progname);
 	exit(EXIT_FAILURE);
 }
 
 /*
- * Add the item to the build request list.  This routine is called
+ * The priority of an item is its expected build time plus the highest
+ * priority of the packages depending on it, that is the time it takes
+ * to build the longest chain of packages waiting for it.  Packages that
+ * won't be built anymore don't count.
+ *
+ * Priorities are memoized for the current PrioGen, which is bumped when
+ * the dependency graph changes.  Dependency loops are cut at the first
+ * item found twice.
+ */
+static uint64_t
+itemPrio(struct item *item)
+{
+	struct depn *depn;
+	struct item *xitem;
+	uint64_t prio, best = 0;
+
+	if (item->pgen == PrioGen)
+		return item->prio;
+
+	item->pgen = PrioGen;
+	item->prio = item->dur;
+	for (depn = item->dbase; depn; depn = depn->dnext) {
+		xitem = depn->item;
+		if (xitem->status == XDONE || xitem->status == XDEPFAIL ||
+		    xitem->status == XBROKEN)
+			continue;
+		if ((prio = itemPrio(xitem)) > best)
+			best = prio;
+	}
+	item->prio = item->dur + best;
+	return item->prio;
+}
+
+/*
+ * BuildHeap is a binary max-heap of the items ready to be built, ordered
+ * by priority and then by the order they were added.
+ */
+static bool
+heapBefore(const struct item *a, const struct item *b)
+{
+	if (a->prio != b->prio)
+		return a->prio > b->prio;
+	return a->border < b->border;
+}
+
+static void
+heapUp(size_t i)
+{
+	struct item *item = BuildHeap[i];
+
+	while (i > 0 && heapBefore(item, BuildHeap[(i - 1) / 2])) {
+		BuildHeap[i] = BuildHeap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	BuildHeap[i] = item;
+}
+
+static void
+heapDown(size_t i)
+{
+	struct item *item = BuildHeap[i];
+	size_t c;
+
+	while ((c = 2 * i + 1) < NBuildHeap) {
+		if (c + 1 < NBuildHeap && heapBefore(BuildHeap[c + 1], BuildHeap[c]))
+			c++;
+		if (!heapBefore(BuildHeap[c], item))
+			break;
+		BuildHeap[i] = BuildHeap[c];
+		i = c;
+	}
+	BuildHeap[i] = item;
+}
+
+/*
+ * Returns the item with the highest priority from BuildHeap, first
+ * recomputing all priorities if the dependency graph has changed.
+ */
+static struct item *
+topBuild(void)
+{
+	size_t i;
+
+	if (NBuildHeap == 0)
+		return NULL;
+
+	if (GraphDirty) {
+		GraphDirty = false;
+		PrioGen++;
+		for (i = 0; i < NBuildHeap; i++)
+			itemPrio(BuildHeap[i]);
+		for (i = NBuildHeap / 2; i-- > 0;)
+			heapDown(i);
+	}
+	return BuildHeap[0];
+}
+
+/*
+ * Removes the item returned by topBuild() from BuildHeap.
+ */
+static void
+popBuild(void)
+{
+	assert(NBuildHeap > 0);
+
+	if (--NBuildHeap > 0) {
+		BuildHeap[0] = BuildHeap[NBuildHeap];
+		heapDown(0);
+	}
+}
+
+/*
+ * Add the item to the build request heap.  This routine is called
  * after all build dependencies have been satisfied for the item.
- * runBuilds() will pick items off of BuildList to keep the parallel
+ * runBuilds() will pick items off of BuildHeap to keep the parallel
  * build pipeline full.
  */
 static void
@@ -169,9 +345,20 @@ addBuild(struct item *item)
 	assert(item);
 
 	printf("BuildOrder %s\n", item->pkgn);
-	*BuildListP = item;
-	BuildListP = &item->bnext;
 	item->status = XBUILD;
+	item->border = BuildOrder++;
+
+	if (NBuildHeap == BuildHeapSize) {
+		BuildHeapSize = BuildHeapSize ? BuildHeapSize * 2 : 64;
+		BuildHeap = realloc(BuildHeap, BuildHeapSize * sizeof(*BuildHeap));
+		assert(BuildHeap);
+	}
+	BuildHeap[NBuildHeap++] = item;
+	/* otherwise popBuild() reorders the whole heap */
+	if (!GraphDirty) {
+		itemPrio(item);
+		heapUp(NBuildHeap - 1);
+	}
 }
 
 /*
@@ -221,8 +408,12 @@ processCompletion(struct item *item)
 	}
 
 	printf("Finish %-3d %s\n", item->xcode, item->pkgn);
-	assert(item->status == XRUN || item->status == XBROKEN || item->status == XDEPFAIL);
+	assert(item->status == XRUN || item->status == XBROKEN ||
+	    item->status == XDEPFAIL || item->status == XUPTODATE);
 	item->status = XDONE;
+	/* the packages depending on us won't be built */
+	if (item->xcode)
+		GraphDirty = true;
 
 	for (depn = item->dbase; depn; depn = depn->dnext) {
 		xitem = depn->item;
@@ -266,6 +457,34 @@ processCompletion(struct item *item)
 	}
 }
 
+/*
+ * Record the build time and resource usage of a successful build.  The
+ * CPU usage is the CPU time over the elapsed time, the memory usage is
+ * the peak RSS of the largest process of the build (ru_maxrss includes
+ * the waited-for descendants).
+ */
+static void
+recordUsage(struct item *item, const struct rusage *ru)
+{
+	xbps_dictionary_t d;
+	uint64_t elapsed, cputime;
+
+	elapsed = (uint64_t)(time(NULL) - item->stime) + 1;
+	cputime = (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000 +
+	    (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1000;
+	xbps_dictionary_set_uint64(Times, item->pkgn, elapsed);
+	/* only the usage of ssh(1) is known for remote builds */
+	if (item->host->name != NULL)
+		return;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	xbps_dictionary_set_uint32(d, "cpu", cputime / 10 / elapsed);
+	xbps_dictionary_set_uint64(d, "maxrss", (uint64_t)ru->ru_maxrss);
+	xbps_dictionary_set(Usage, item->pkgn, d);
+	xbps_object_release(d);
+}
+
 /*
  * Wait for a running build to finish and process its completion.
  * Return the build or NULL if no builds are pending.
@@ -278,18 +497,20 @@ waitRunning(int flags)
 {
 	struct item *item;
 	struct item **itemp;
+	struct rusage ru;
 	pid_t pid;
 	int status;
 
 	if (RunList == NULL)
 		return NULL;
 
-	while ((pid = wait3(&status, flags, NULL)) < 0 && flags == 0)
+	while ((pid = wait3(&status, flags, &ru)) < 0 && flags == 0)
 		;
 
 	/*
-	 * NOTE! The pid may be associated with one of our popen()'s
-	 *	 so just ignore it if we cannot find it.
+	 * NOTE! The pid may be associated with one of our show-build-deps
+	 *	 scans, forget it so that finishScan() doesn't wait for
+	 *	 a pid that might have been reused, and wait again.
 	 */
 	if (pid > 0) {
 		status = WEXITSTATUS(status);
@@ -304,7 +525,19 @@ waitRunning(int flags)
 			item->bnext = NULL;
 			item->xcode = status;
 			--NRunning;
+			item->host->cpu -= item->cpu;
+			item->host->mem -= item->mem;
+			item->host->nrunning--;
+			if (status == 0)
+				recordUsage(item, &ru);
 			processCompletion(item);
+		} else {
+			for (item = ScanRunList; item; item = item->snext) {
+				if (item->spid == pid) {
+					item->spid = -1;
+					return waitRunning(flags);
+				}
+			}
 		}
 	} else {
 		item = NULL;
@@ -312,6 +545,63 @@ waitRunning(int flags)
 	return item;
 }
 
+/*
+ * Returns the host with the most free CPU where item can be started now,
+ * or NULL.  A build is always started on a host if nothing else is
+ * running there.  The load average limit only applies to this host.
+ */
+static struct host *
+admitBuild(struct item *item)
+{
+	struct host *host, *best = NULL;
+	double load;
+	int i;
+
+	for (i = 0; i < NHosts; i++) {
+		host = &Hosts[i];
+		if (host->ncpu == 0)
+			continue;
+		if (host->nrunning > 0) {
+			if (host->cpu + item->cpu > host->ncpu * 100)
+				continue;
+			if (MemLimit && host->mem + item->mem > MemLimit)
+				continue;
+			if (host->name == NULL && LoadLimit > 0 &&
+			    getloadavg(&load, 1) == 1 && load >= LoadLimit)
+				continue;
+		}
+		if (best == NULL ||
+		    (int64_t)host->ncpu * 100 - host->cpu >
+		    (int64_t)best->ncpu * 100 - best->cpu)
+			best = host;
+	}
+	return best;
+}
+
+/*
+ * Returns a single-quoted copy of str for sh(1).
+ */
+static char *
+shellQuote(const char *str)
+{
+	char *buf, *p;
+
+	buf = p = malloc(strlen(str) * 4 + 3);
+	assert(buf);
+	*p++ = '\'';
+	for (; *str; str++) {
+		if (*str == '\'') {
+			memcpy(p, "'\\''", 4);
+			p += 4;
+		} else {
+			*p++ = *str;
+		}
+	}
+	*p++ = '\'';
+	*p = '\0';
+	return buf;
+}
+
 /*
  * Start new builds from the build list and handle build completions,
  * which can potentialy add new items to the build list.
@@ -325,20 +615,24 @@ static void
 runBuilds(const char *bpath)
 {
 	struct item *item;
-	char *logpath;
+	struct host *host;
+	char *logpath, *qpath, *qarch, *qpkgn, *cmd;
 	FILE *fp;
 	int fd;
 
 	assert(bpath);
 	/*
-	 * Try to maintain up to NParallel builds
+	 * Start builds by priority while they fit in the budgets, the
+	 * highest priority build is never skipped for a smaller one.
 	 */
-	while (NRunning < NParallel && BuildList) {
-		item = BuildList;
-		if ((BuildList = item->bnext) == NULL)
-			BuildListP = &BuildList;
-
+	while ((item = topBuild()) != NULL && (host = admitBuild(item)) != NULL) {
+		popBuild();
+		item->host = host;
 		printf("BuildStart %s\n", item->pkgn);
+		if (VerboseOpt)
+			printf("%s: priority %" PRIu64 " cpu %u%% mem %" PRIu64
+			    "KB host %s\n", item->pkgn, item->prio, item->cpu,
+			    item->mem, host->name ? host->name : "local");
 
 		/*
 		 * When [re]running a build remove any bad log from prior
@@ -350,6 +644,7 @@ runBuilds(const char *bpath)
 
 		logpath = xbps_xasprintf("%s/run/%s", LogDir, item->pkgn);
 		item->status = XRUN;
+		item->stime = time(NULL);
 
 		item->pid = fork();
 		if (item->pid == 0) {
@@ -372,7 +667,17 @@ runBuilds(const char *bpath)
 				close(fd);
 			}
 			/* build the current pkg! */
-			if (TargetArch != NULL)
+			if (host->name != NULL) {
+				qpath = shellQuote(bpath);
+				qarch = TargetArch ? shellQuote(TargetArch) : NULL;
+				qpkgn = shellQuote(item->pkgn);
+				cmd = xbps_xasprintf("cd %s && ./xbps-src %s%s "
+				    "-E -N -t pkg %s", qpath,
+				    qarch ? "-a " : "",
+				    qarch ? qarch : "", qpkgn);
+				execlp("ssh", "ssh", "-o", "BatchMode=yes",
+				    host->name, cmd, NULL);
+			} else if (TargetArch != NULL)
 				execl("./xbps-src", "./xbps-src", "-a", TargetArch,
 					"-E", "-N", "-t", "pkg", item->pkgn, NULL);
 			else
@@ -398,6 +703,9 @@ runBuilds(const char *bpath)
 			item->bnext = RunList;
 			RunList = item;
 			++NRunning;
+			host->cpu += item->cpu;
+			host->mem += item->mem;
+			host->nrunning++;
 		}
 		free(logpath);
 	}
@@ -432,6 +740,7 @@ addDepn(struct item *item, struct item *xitem)
 	depn->item = item;
 	depn->dnext = xitem->dbase;
 	xitem->dbase = depn;
+	GraphDirty = true;
 	if (xitem->status == XDONE) {
 		if (xitem->xcode) {
 			assert(item->status == XWAITING ||
@@ -450,76 +759,269 @@ addDepn(struct item *item, struct item *xitem)
 }
 
 /*
- * Recursively execute './xbps-src show-build-deps' to calculate all required
- * dependencies.
+ * Dependencies are discovered by running up to NScanJobs
+ * './xbps-src show-build-deps' at the same time, their output is
+ * processed as it arrives.  Packages found as dependencies are added
+ * to the ItemHash right away and queued on ScanList to be scanned.
+ *
+ * The dcount of an item is bumped while it's queued or being scanned,
+ * so that it's not processed for completion before all its
+ * dependencies have been added.  This would normally not occur but it
+ * can if a pkg has a broken dependency loop.
  */
 static struct item *
-ordered_depends(const char *bpath, const char *pkgn)
+addScan(const char *pkgn)
 {
-	struct item *item, *xitem;
-	char buf[1024];
-	FILE *fp;
-	char *cmd;
+	struct item *item;
 
-	assert(bpath);
 	assert(pkgn);
 
 	item = addItem(pkgn);
-	/*
-	 * Retrieve and process dependencies recursively.  Note that
-	 * addDepn() can modify item's status.
-	 *
-	 * Guard the recursion by bumping dcount to prevent the item
-	 * from being processed for completion while we are still adding
-	 * its dependencies.  This would normally not occur but it can
-	 * if a pkg has a broken dependency loop.
-	 */
+	item->sfd = -1;
 	++item->dcount;
+	*ScanListP = item;
+	ScanListP = &item->snext;
+
+	return item;
+}
 
+/*
+ * Process a line of 'show-build-deps' output for item.
+ */
+static void
+scanLine(struct item *item, const char *buf)
+{
+	struct item *xitem;
+
+	if (item->status == XBROKEN) {
+		/* ignore everything after an error */
+		return;
+	} else if (strncmp(buf, "=> ERROR", 8) == 0) {
+		/* ignore pkgs returning errors */
+		item->emsg = xbps_xasprintf("%s\n", buf);
+		item->status = XBROKEN;
+		item->xcode = EXIT_FAILURE;
+		return;
+	} else if (strncmp(buf, "=>", 2) == 0 || *buf == '\0') {
+		/* ignore xbps-src msgs */
+		return;
+	}
 	if (VerboseOpt)
-		printf("%s: collecting build dependencies...\n", pkgn);
-
-	if (TargetArch != NULL)
-		cmd = xbps_xasprintf("%s/xbps-src -a %s show-build-deps %s 2>&1", bpath, TargetArch, pkgn);
-	else
-		cmd = xbps_xasprintf("%s/xbps-src show-build-deps %s 2>&1", bpath, pkgn);
-
-	fp = popen(cmd, "r");
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
-		size_t len;
-
-		if (strncmp(buf, "=> ERROR", 8) == 0) {
-			/* ignore pkgs returning errors */
-			item->emsg = strdup(buf);
-			item->status = XBROKEN;
-			item->xcode = EXIT_FAILURE;
-			break;
-		} else if (strncmp(buf, "=>", 2) == 0) {
-			/* ignore xbps-src msgs */
-			continue;
+		printf("%s: depends on %s\n", item->pkgn, buf);
+
+	if (item->sdeps != NULL)
+		xbps_array_add_cstring(item->sdeps, buf);
+
+	xitem = lookupItem(buf);
+	if (xitem == NULL)
+		xitem = addScan(buf);
+	addDepn(item, xitem);
+}
+
+/*
+ * The build dependencies found by the scans are cached in
+ * LogDir/deps-<arch>.plist, keyed by the pkgname with the sha256
+ * hash of its template.  Packages whose template did not change
+ * since a previous run with the same LogDir are not scanned again.
+ * Scans that returned an error are never cached.
+ */
+static char *
+cachePath(const char *name)
+{
+	return xbps_xasprintf("%s/%s-%s.plist", LogDir, name,
+	    TargetArch ? TargetArch : "native");
+}
+
+static xbps_dictionary_t
+loadCache(const char *name)
+{
+	xbps_dictionary_t d;
+	char *path;
+
+	path = cachePath(name);
+	d = xbps_dictionary_internalize_from_file(path);
+	if (d == NULL)
+		d = xbps_dictionary_create();
+	assert(d);
+	free(path);
+	return d;
+}
+
+static void
+storeCache(xbps_dictionary_t d, const char *name)
+{
+	char *path;
+
+	path = cachePath(name);
+	if (!xbps_dictionary_externalize_to_file(d, path))
+		fprintf(stderr, "WARNING: failed to store %s: %s\n",
+		    path, strerror(errno));
+	free(path);
+}
+
+/*
+ * The build times of the packages built successfully are stored in
+ * LogDir/times-<arch>.plist, in seconds.  Packages that were never
+ * built are expected to take the average time.
+ */
+static void
+loadTimes(void)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	uint64_t sum = 0, n = 0;
+
+	Times = loadCache("times");
+	iter = xbps_dictionary_iterator(Times);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
+		sum += xbps_number_unsigned_integer_value(
+		    xbps_dictionary_get_keysym(Times, obj));
+		n++;
+	}
+	xbps_object_iterator_release(iter);
+	if (n > 0 && sum / n > 0)
+		AvgTime = sum / n;
+
+	Usage = loadCache("usage");
+}
+
+/*
+ * Sets the expected resource usage of item from its previous builds in
+ * LogDir/usage-<arch>.plist.  Packages that were never built count as
+ * one CPU, or a quarter of it if the template says it's noarch, and no
+ * memory.
+ *
+ * The memory usage is the peak RSS times the number of CPUs used, as
+ * parallel builds run that many compiler processes at once.  Builds
+ * count as at least a quarter of a CPU, so -j4 runs up to 16 small
+ * builds at once.
+ */
+static void
+itemWeights(const char *bpath, struct item *item)
+{
+	xbps_dictionary_t d;
+	uint64_t rss;
+	char *path, *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+
+	d = xbps_dictionary_get(Usage, item->pkgn);
+	if (xbps_dictionary_get_uint32(d, "cpu", &item->cpu) &&
+	    xbps_dictionary_get_uint64(d, "maxrss", &rss)) {
+		item->mem = rss * (item->cpu > 100 ? item->cpu : 100) / 100;
+	} else {
+		item->cpu = 100;
+		path = xbps_xasprintf("%s/srcpkgs/%s/template", bpath, item->pkgn);
+		if ((fp = fopen(path, "r")) != NULL) {
+			while (getline(&line, &len, fp) != -1) {
+				if (strncmp(line, "archs=noarch", 12) == 0 ||
+				    strncmp(line, "archs=\"noarch\"", 14) == 0) {
+					item->cpu = 25;
+					break;
+				}
+			}
+			free(line);
+			fclose(fp);
 		}
-		len = strlen(buf);
-		if (len && buf[len-1] == '\n')
-			buf[--len] = 0;
+		free(path);
+	}
+	if (item->cpu < 25)
+		item->cpu = 25;
+}
 
-		if (VerboseOpt)
-			printf("%s: depends on %s\n", pkgn, buf);
+static void
+cacheScan(struct item *item)
+{
+	xbps_dictionary_t d;
+
+	if (item->shash != NULL && item->status != XBROKEN) {
+		d = xbps_dictionary_create();
+		assert(d);
+		xbps_dictionary_set_cstring(d, "sha256", item->shash);
+		xbps_dictionary_set(d, "depends", item->sdeps);
+		xbps_dictionary_set(DepsCache, item->pkgn, d);
+		xbps_object_release(d);
+	} else if (item->shash != NULL) {
+		xbps_dictionary_remove(DepsCache, item->pkgn);
+	}
+	free(item->shash);
+	item->shash = NULL;
+	if (item->sdeps != NULL)
+		xbps_object_release(item->sdeps);
+	item->sdeps = NULL;
+}
 
-		xitem = lookupItem(buf);
-		if (xitem == NULL)
-			xitem = ordered_depends(bpath, buf);
-		addDepn(item, xitem);
+/*
+ * Returns true if the build dependencies of item were found in the
+ * cache, otherwise prepares item to cache its scan.
+ */
+static bool
+cachedScan(const char *bpath, struct item *item)
+{
+	xbps_dictionary_t d;
+	xbps_array_t deps;
+	const char *hash, *dep;
+	char *path;
+
+	path = xbps_xasprintf("%s/srcpkgs/%s/template", bpath, item->pkgn);
+	item->shash = xbps_file_hash(path);
+	free(path);
+	if (item->shash == NULL)
+		return false;
+
+	d = xbps_dictionary_get(DepsCache, item->pkgn);
+	if (!xbps_dictionary_get_cstring_nocopy(d, "sha256", &hash) ||
+	    strcmp(hash, item->shash)) {
+		item->sdeps = xbps_array_create();
+		assert(item->sdeps);
+		return false;
 	}
-	pclose(fp);
-	free(cmd);
-	--item->dcount;
+	if (VerboseOpt)
+		printf("%s: using cached build dependencies\n", item->pkgn);
+
+	/* the entry doesn't change, don't store it again */
+	free(item->shash);
+	item->shash = NULL;
+	deps = xbps_dictionary_get(d, "depends");
+	for (unsigned int i = 0; i < xbps_array_count(deps); i++) {
+		xbps_array_get_cstring_nocopy(deps, i, &dep);
+		scanLine(item, dep);
+	}
+	return true;
+}
 
-	/*
-	 * If the item has no dependencies left either add it to the
-	 * build list or do completion processing (i.e. if some of the
-	 * dependencies failed).
-	 */
-	if (item->dcount == 0) {
+/*
+ * The scan of item is over, if it has no dependencies left either
+ * add it to the build list or do completion processing (i.e. if some
+ * of the dependencies failed).
+ */
+static void
+finishScan(struct item *item)
+{
+	struct item **itemp;
+
+	if (item->sfd != -1) {
+		(void)close(item->sfd);
+		item->sfd = -1;
+		/* unless it was reaped by waitRunning() */
+		if (item->spid > 0)
+			(void)waitpid(item->spid, NULL, 0);
+		for (itemp = &ScanRunList; *itemp; itemp = &(*itemp)->snext) {
+			if (*itemp == item) {
+				*itemp = item->snext;
+				break;
+			}
+		}
+		item->snext = NULL;
+		--NScanning;
+	}
+	free(item->sbuf);
+	item->sbuf = NULL;
+	item->slen = 0;
+	cacheScan(item);
+
+	if (--item->dcount == 0) {
 		switch (item->status) {
 		case XWAITING:
 			addBuild(item);
@@ -537,8 +1039,252 @@ ordered_depends(const char *bpath, const char *pkgn)
 		if (VerboseOpt)
 			printf("Deferred package: %s\n", item->pkgn);
 	}
-	runBuilds(bpath);
-	return item;
+}
+
+/*
+ * Returns the pkgver built by the template of pkgn, as xbps-checkvers(1)
+ * would, or NULL if it's not known without running the template, i.e.
+ * pkgname, version or revision are not set once to a plain value.
+ */
+static char *
+templatePkgver(const char *bpath, const char *pkgn)
+{
+	const char *vars[] = { "pkgname=", "version=", "revision=" };
+	char *vals[3] = { NULL, NULL, NULL };
+	char *path, *line = NULL, *v, *p, *pkgver = NULL;
+	bool valid = true;
+	size_t len = 0, vlen;
+	FILE *fp;
+	int i;
+
+	path = xbps_xasprintf("%s/srcpkgs/%s/template", bpath, pkgn);
+	fp = fopen(path, "r");
+	free(path);
+	if (fp == NULL)
+		return NULL;
+
+	while (valid && getline(&line, &len, fp) != -1) {
+		for (i = 0; i < 3; i++) {
+			if (strncmp(line, vars[i], strlen(vars[i])))
+				continue;
+			v = line + strlen(vars[i]);
+			v[strcspn(v, "#\n")] = '\0';
+			vlen = strlen(v);
+			while (vlen > 0 && (v[vlen-1] == ' ' || v[vlen-1] == '\t'))
+				v[--vlen] = '\0';
+			if (vlen >= 2 && (*v == '"' || *v == '\'') && v[vlen-1] == *v) {
+				v[vlen-1] = '\0';
+				v++;
+			}
+			for (p = v; *p; p++) {
+				if (strchr("$`\"'\\ \t", *p) != NULL)
+					break;
+			}
+			if (*v == '\0' || *p != '\0' || vals[i] != NULL)
+				valid = false;
+			else
+				vals[i] = strdup(v);
+			break;
+		}
+	}
+	free(line);
+	fclose(fp);
+
+	if (valid && vals[0] && vals[1] && vals[2])
+		pkgver = xbps_xasprintf("%s-%s_%s", vals[0], vals[1], vals[2]);
+	for (i = 0; i < 3; i++)
+		free(vals[i]);
+
+	return pkgver;
+}
+
+/*
+ * Returns true if the pkgver built by the template of item is already
+ * in one of the repositories.
+ */
+static bool
+upToDate(const char *bpath, struct item *item)
+{
+	xbps_dictionary_t pkgd;
+	const char *repover;
+	char *pkgver;
+	bool found = false;
+	int i;
+
+	if (NRepos == 0)
+		return false;
+	if ((pkgver = templatePkgver(bpath, item->pkgn)) == NULL)
+		return false;
+
+	for (i = 0; i < NRepos && !found; i++) {
+		pkgd = xbps_repo_get_pkg(Repos[i], pkgver);
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &repover) &&
+		    strcmp(repover, pkgver) == 0)
+			found = true;
+	}
+	if (found)
+		printf("UpToDate %s\n", pkgver);
+	free(pkgver);
+
+	return found;
+}
+
+static void
+startScan(const char *bpath, struct item *item)
+{
+	char *cmd;
+	int fd, pfd[2];
+
+	if (upToDate(bpath, item)) {
+		/* drop the hold from addScan(), there are no dependencies */
+		assert(item->dcount == 1);
+		item->dcount = 0;
+		item->status = XUPTODATE;
+		processCompletion(item);
+		return;
+	}
+	itemWeights(bpath, item);
+	if (cachedScan(bpath, item)) {
+		finishScan(item);
+		return;
+	}
+	if (VerboseOpt)
+		printf("%s: collecting build dependencies...\n", item->pkgn);
+
+	if (pipe(pfd) == -1) {
+		item->emsg = xbps_xasprintf("=> ERROR: %s: cannot create "
+		    "pipe: %s\n", item->pkgn, strerror(errno));
+		item->status = XBROKEN;
+		item->xcode = EXIT_FAILURE;
+		finishScan(item);
+		return;
+	}
+	cmd = xbps_xasprintf("%s/xbps-src", bpath);
+	item->spid = fork();
+	if (item->spid == 0) {
+		/*
+		 * Child process - stdout and stderr to the pipe.
+		 */
+		(void)close(pfd[0]);
+		dup2(pfd[1], 1);
+		dup2(pfd[1], 2);
+		if (pfd[1] != 1 && pfd[1] != 2)
+			close(pfd[1]);
+		fd = open("/dev/null", O_RDWR);
+		if (fd != 0) {
+			dup2(fd, 0);
+			close(fd);
+		}
+		if (TargetArch != NULL)
+			execl(cmd, cmd, "-a", TargetArch,
+			    "show-build-deps", item->pkgn, NULL);
+		else
+			execl(cmd, cmd, "show-build-deps", item->pkgn, NULL);
+
+		_exit(99);
+	}
+	free(cmd);
+	(void)close(pfd[1]);
+	if (item->spid < 0) {
+		(void)close(pfd[0]);
+		item->emsg = xbps_xasprintf("=> ERROR: %s: unable to fork "
+		    "xbps-src\n", item->pkgn);
+		item->status = XBROKEN;
+		item->xcode = EXIT_FAILURE;
+		finishScan(item);
+		return;
+	}
+	item->sfd = pfd[0];
+	item->snext = ScanRunList;
+	ScanRunList = item;
+	++NScanning;
+}
+
+/*
+ * Read the available output of the scan of item, returns false once
+ * it's finished.
+ */
+static bool
+readScan(struct item *item)
+{
+	char buf[4096], *line, *nl;
+	ssize_t len;
+
+	if ((len = read(item->sfd, buf, sizeof(buf))) < 0 && errno == EINTR)
+		return true;
+	if (len <= 0) {
+		if (item->slen) {
+			item->sbuf[item->slen] = '\0';
+			scanLine(item, item->sbuf);
+		}
+		finishScan(item);
+		return false;
+	}
+	item->sbuf = realloc(item->sbuf, item->slen + len + 1);
+	assert(item->sbuf);
+	memcpy(item->sbuf + item->slen, buf, len);
+	item->slen += len;
+	item->sbuf[item->slen] = '\0';
+
+	line = item->sbuf;
+	while ((nl = strchr(line, '\n')) != NULL) {
+		*nl = '\0';
+		scanLine(item, line);
+		line = nl + 1;
+	}
+	item->slen -= line - item->sbuf;
+	memmove(item->sbuf, line, item->slen);
+
+	return true;
+}
+
+/*
+ * Run the queued dependency scans, keeping the build pipeline full
+ * with the packages whose dependencies are known to be satisfied.
+ */
+static void
+runScans(const char *bpath)
+{
+	struct pollfd *pfds = NULL;
+	struct item **items = NULL, *item;
+	int i, n;
+
+	assert(bpath);
+
+	for (;;) {
+		while (NScanning < NScanJobs && ScanList) {
+			item = ScanList;
+			if ((ScanList = item->snext) == NULL)
+				ScanListP = &ScanList;
+			item->snext = NULL;
+			startScan(bpath, item);
+		}
+		runBuilds(bpath);
+		if (ScanRunList == NULL)
+			break;
+
+		pfds = realloc(pfds, NScanning * sizeof(*pfds));
+		items = realloc(items, NScanning * sizeof(*items));
+		assert(pfds);
+		assert(items);
+		n = 0;
+		for (item = ScanRunList; item; item = item->snext) {
+			pfds[n].fd = item->sfd;
+			pfds[n].events = POLLIN;
+			pfds[n].revents = 0;
+			items[n++] = item;
+		}
+		/* wake up now and then to reap completed builds */
+		if (poll(pfds, n, 1000) <= 0)
+			continue;
+		for (i = 0; i < n; i++) {
+			if (pfds[i].revents)
+				while (readScan(items[i]) && poll(&pfds[i], 1, 0) > 0)
+					;
+		}
+	}
+	free(pfds);
+	free(items);
 }
 
 int
@@ -547,19 +1293,37 @@ main(int argc, char **argv)
 	DIR *dir;
 	struct dirent *den;
 	struct stat st;
-	const char *progname = argv[0];
-	char *bpath, *rpath, *minit, *tmp, cwd[PATH_MAX-1];
+	const char *progname = argv[0], **repourls = NULL;
+	char *bpath, *rpath, *minit, *tmp, *p, cwd[PATH_MAX-1];
 	size_t blen;
 	int ch;
 	const struct option longopts[] = {
 		{ NULL, 0, NULL, 0 }
 	};
 
-	while ((ch = getopt_long(argc, argv, "a:hj:l:vV", longopts, NULL)) != -1) {
+	NScanJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	MemLimit = (uint64_t)sysconf(_SC_PHYS_PAGES) * (sysconf(_SC_PAGESIZE) / 1024);
+	Hosts = calloc(1, sizeof(*Hosts));
+	assert(Hosts);
+	NHosts = 1;
+	while ((ch = getopt_long(argc, argv, "a:hH:j:l:L:m:R:s:vV", longopts, NULL)) != -1) {
 		switch (ch) {
 		case 'a':
 			TargetArch = optarg;
 			break;
+		case 'H':
+			Hosts = realloc(Hosts, (NHosts + 1) * sizeof(*Hosts));
+			assert(Hosts);
+			memset(&Hosts[NHosts], 0, sizeof(*Hosts));
+			Hosts[NHosts].name = strdup(optarg);
+			assert(Hosts[NHosts].name);
+			Hosts[NHosts].ncpu = 1;
+			if ((p = strrchr(Hosts[NHosts].name, ':')) != NULL) {
+				*p++ = '\0';
+				Hosts[NHosts].ncpu = strtoul(p, NULL, 0);
+			}
+			NHosts++;
+			break;
 		case 'j':
 			NParallel = strtol(optarg, NULL, 0);
 			break;
@@ -569,6 +1333,20 @@ main(int argc, char **argv)
 		case 'l':
 			LogDir = optarg;
 			break;
+		case 'L':
+			LoadLimit = strtod(optarg, NULL);
+			break;
+		case 'm':
+			MemLimit = strtoull(optarg, NULL, 0) * 1024;
+			break;
+		case 'R':
+			repourls = realloc(repourls, (NRepos + 1) * sizeof(*repourls));
+			assert(repourls);
+			repourls[NRepos++] = optarg;
+			break;
+		case 's':
+			NScanJobs = strtol(optarg, NULL, 0);
+			break;
 		case 'V':
 			printf("%s\n", XBPS_RELVER);
 			exit(EXIT_SUCCESS);
@@ -585,6 +1363,12 @@ main(int argc, char **argv)
 		usage(progname);
 		/* NOT REACHED */
 	}
+	if (NScanJobs < 1)
+		NScanJobs = 1;
+	/* -j0 only builds on the other hosts */
+	if (NParallel < 0 || (NParallel == 0 && NHosts == 1))
+		NParallel = 1;
+	Hosts[0].ncpu = NParallel;
 
 	if ((bpath = realpath(argv[0], NULL)) == NULL)
 		exit(EXIT_FAILURE);
@@ -652,6 +1436,32 @@ main(int argc, char **argv)
 	}
 	free(tmp);
 
+	DepsCache = loadCache("deps");
+	loadTimes();
+
+	/*
+	 * Open the repositories to check for packages that are up to date.
+	 */
+	if (NRepos > 0) {
+		if ((ch = xbps_init(&XH)) != 0) {
+			fprintf(stderr, "ERROR: failed to initialize libxbps: %s\n",
+			    strerror(ch));
+			exit(EXIT_FAILURE);
+		}
+		if (TargetArch != NULL)
+			XH.target_arch = TargetArch;
+		Repos = calloc(NRepos, sizeof(*Repos));
+		assert(Repos);
+		for (int i = 0; i < NRepos; i++) {
+			if ((Repos[i] = xbps_repo_open(&XH, repourls[i])) == NULL) {
+				fprintf(stderr, "ERROR: cannot open repository "
+				    "%s: %s\n", repourls[i], strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		free(repourls);
+	}
+
 	/*
 	 * Process all directories in void-packages/srcpkgs, excluding symlinks
 	 * (subpackages).
@@ -690,20 +1500,29 @@ main(int argc, char **argv)
 
 			if (lookupItem(den->d_name) == NULL &&
 			    stat(xpath, &st) == 0)
-				ordered_depends(bpath, den->d_name);
+				addScan(den->d_name);
 
 			free(xpath);
 		}
 		(void)closedir(dir);
 	}
+	runScans(bpath);
+	storeCache(DepsCache, "deps");
 	/*
 	 * Wait for all current builds to finish running, keep the pipeline
-	 * full until both the BuildList and RunList have been exhausted.
+	 * full until both the BuildHeap and RunList have been exhausted.
 	 */
 	free(rpath);
 	runBuilds(bpath);
-	while (waitRunning(0) != NULL)
+	while (RunList != NULL || NBuildHeap > 0) {
+		/* check the load average now and then */
+		if (waitRunning(LoadLimit > 0 ? WNOHANG : 0) == NULL &&
+		    LoadLimit > 0)
+			sleep(1);
 		runBuilds(bpath);
+	}
+	storeCache(Times, "times");
+	storeCache(Usage, "usage");
 
 	exit(EXIT_SUCCESS);
 }
@@ -27,11 +27,23 @@
 #define _XBPS_INSTALL_DEFS_H_
 
 #include <sys/time.h>
+#include <stdio.h>
 #include <xbps.h>
 
-struct xferstat {
+struct xferfile {
+	char *name;
 	struct timeval start;
+	off_t size;
+	off_t offset;
+	off_t dloaded;
+};
+
+struct xferstat {
+	struct xferfile *files;
+	unsigned int nfiles;
 	struct timeval last;
+	struct timeval mlast;
+	FILE *progress;
 };
 
 struct transaction {
@@ -48,8 +60,9 @@ struct transaction {
 /* from transaction.c */
 int	install_new_pkg(struct xbps_handle *, const char *, bool);
 int	update_pkg(struct xbps_handle *, const char *);
-int	dist_upgrade(struct xbps_handle *, int, bool, bool);
-int	exec_transaction(struct xbps_handle *, int, bool, bool);
+int	dist_upgrade(struct xbps_handle *, int, bool, bool, const char *);
+int	exec_transaction(struct xbps_handle *, int, bool, bool, const char *);
+int	apply_plan(struct xbps_handle *, const char *, int, bool, bool);
 
 /* from question.c */
 bool	yesno(const char *, ...);
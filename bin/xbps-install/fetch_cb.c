@@ -34,11 +34,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <xbps.h>
 #include "defs.h"
@@ -58,24 +62,39 @@ get_time(struct timeval *tvp)
 #endif
 }
 
+static double
+elapsed(const struct timeval *from, const struct timeval *to)
+{
+	return (to->tv_sec + (to->tv_usec / 1.e6)) -
+	    (from->tv_sec + (from->tv_usec / 1.e6));
+}
+
+/*
+ * Returns true if at least msecs have passed since *last and
+ * updates it.
+ */
+static bool
+stat_due(struct timeval *last, const struct timeval *now, long msecs)
+{
+	if (last->tv_sec && elapsed(last, now) * 1000 < msecs)
+		return false;
+	*last = *now;
+	return true;
+}
+
 /*
  * Compute and display ETA
  */
 static const char *
-stat_eta(const struct xbps_fetch_cb_data *xfpd, void *cbdata)
+stat_eta(double delta, off_t received, off_t expected)
 {
-	struct xferstat *xfer = cbdata;
 	static char str[25];
-	long elapsed, eta;
-	off_t received, expected;
+	long eta;
 
-	if (xfpd->file_size == -1)
+	if (expected < 0 || received <= 0)
 		return "unknown";
 
-	elapsed = xfer->last.tv_sec - xfer->start.tv_sec;
-	received = xfpd->file_dloaded - xfpd->file_offset;
-	expected = xfpd->file_size - xfpd->file_dloaded;
-	eta = (long)((double)elapsed * expected / received);
+	eta = (long)(delta * expected / received);
 	if (eta > 3600)
 		snprintf(str, sizeof str, "%02ldh%02ldm",
 		    eta / 3600, (eta % 3600) / 60);
@@ -101,85 +120,188 @@ compare_double(const double a, const double b)
  * Compute and display transfer rate
  */
 static const char *
-stat_bps(const struct xbps_fetch_cb_data *xfpd, void *cbdata)
+stat_bps(double delta, off_t received)
 {
-	struct xferstat *xfer = cbdata;
 	static char str[16];
 	char size[8];
-	double delta, bps;
+	double bps;
 
-	delta = (xfer->last.tv_sec + (xfer->last.tv_usec / 1.e6))
-	    - (xfer->start.tv_sec + (xfer->start.tv_usec / 1.e6));
 	if (compare_double(delta, 0.0001)) {
 		snprintf(str, sizeof str, "-- stalled --");
 	} else {
-		bps = ((double)(xfpd->file_dloaded-xfpd->file_offset)/delta);
+		bps = ((double)received / delta);
 		(void)xbps_humanize_number(size, (int64_t)bps);
 		snprintf(str, sizeof str, "%s/s", size);
 	}
 	return str;
 }
 
+static struct xferfile *
+xfer_get(struct xferstat *xfer, const char *name, bool add)
+{
+	struct xferfile *xf;
+
+	for (unsigned int i = 0; i < xfer->nfiles; i++) {
+		if (strcmp(xfer->files[i].name, name) == 0)
+			return &xfer->files[i];
+	}
+	if (!add)
+		return NULL;
+
+	xfer->files = realloc(xfer->files,
+	    (xfer->nfiles + 1) * sizeof(*xfer->files));
+	assert(xfer->files);
+	xf = &xfer->files[xfer->nfiles++];
+	memset(xf, 0, sizeof(*xf));
+	xf->name = strdup(name);
+	assert(xf->name);
+	return xf;
+}
+
+static void
+xfer_del(struct xferstat *xfer, struct xferfile *xf)
+{
+	unsigned int i = xf - xfer->files;
+
+	free(xf->name);
+	memmove(&xfer->files[i], &xfer->files[i + 1],
+	    (xfer->nfiles - i - 1) * sizeof(*xfer->files));
+	xfer->nfiles--;
+}
+
+static void
+stat_line(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void
+stat_line(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (v_tty) {
+		vfprintf(stderr, fmt, ap);
+		fprintf(stderr, "\033[K\r");
+	} else {
+		vprintf(fmt, ap);
+		printf("\n");
+		fflush(stdout);
+	}
+	va_end(ap);
+}
+
 /*
- * Update the stats display
+ * Update the stats display: a line for the only active transfer, or
+ * a single line with the totals of all transfers running in parallel.
  */
 static void
-stat_display(const struct xbps_fetch_cb_data *xfpd, void *cbdata)
+stat_display(struct xferstat *xfer, const struct timeval *now)
 {
-	struct xferstat *xfer = cbdata;
-	struct timeval now;
+	struct xferfile *xf;
 	char totsize[8];
-	int percentage;
+	off_t size = 0, dloaded = 0, received = 0;
+	double delta = 0;
+	int percentage = 0;
 
-	get_time(&now);
-	if (now.tv_sec <= xfer->last.tv_sec)
-		return;
-	xfer->last = now;
-
-	if (xfpd->file_size == -1) {
-		percentage = 0;
+	for (unsigned int i = 0; i < xfer->nfiles; i++) {
+		xf = &xfer->files[i];
+		if (size != -1)
+			size = xf->size == -1 ? -1 : size + xf->size;
+		dloaded += xf->dloaded;
+		received += xf->dloaded - xf->offset;
+		if (elapsed(&xf->start, now) > delta)
+			delta = elapsed(&xf->start, now);
+	}
+	if (size == -1) {
 		snprintf(totsize, 3, "0B");
 	} else {
-		percentage = (int)((double)(100.0 *
-		    (double)xfpd->file_dloaded) / (double)xfpd->file_size);
-		(void)xbps_humanize_number(totsize, (int64_t)xfpd->file_size);
+		if (size > 0)
+			percentage = (int)((double)(100.0 *
+			    (double)dloaded) / (double)size);
+		(void)xbps_humanize_number(totsize, (int64_t)size);
 	}
-	if (v_tty)
-		fprintf(stderr, "%s: [%s %d%%] %s ETA: %s\033[K\r",
-		    xfpd->file_name, totsize, percentage,
-		    stat_bps(xfpd, xfer), stat_eta(xfpd, xfer));
-	else {
-		printf("%s: [%s %d%%] %s ETA: %s\n",
-		    xfpd->file_name, totsize, percentage,
-		    stat_bps(xfpd, xfer), stat_eta(xfpd, xfer));
-		fflush(stdout);
+	if (xfer->nfiles == 1) {
+		stat_line("%s: [%s %d%%] %s ETA: %s", xfer->files[0].name,
+		    totsize, percentage, stat_bps(delta, received),
+		    stat_eta(delta, received, size == -1 ? -1 : size - dloaded));
+	} else {
+		stat_line("[%u downloads] [%s %d%%] %s ETA: %s", xfer->nfiles,
+		    totsize, percentage, stat_bps(delta, received),
+		    stat_eta(delta, received, size == -1 ? -1 : size - dloaded));
 	}
 }
 
+/*
+ * Machine readable progress, one tab separated event per line:
+ *	start <file> <size>
+ *	progress <file> <downloaded> <size>
+ *	end <file> <downloaded>
+ */
+static void
+stat_stream(struct xferstat *xfer, const char *event, struct xferfile *xf)
+{
+	if (xf == NULL) {
+		for (unsigned int i = 0; i < xfer->nfiles; i++)
+			stat_stream(xfer, event, &xfer->files[i]);
+		return;
+	}
+	if (strcmp(event, "end") == 0)
+		fprintf(xfer->progress, "%s\t%s\t%jd\n", event, xf->name,
+		    (intmax_t)xf->dloaded);
+	else if (strcmp(event, "start") == 0)
+		fprintf(xfer->progress, "%s\t%s\t%jd\n", event, xf->name,
+		    (intmax_t)xf->size);
+	else
+		fprintf(xfer->progress, "%s\t%s\t%jd\t%jd\n", event, xf->name,
+		    (intmax_t)xf->dloaded, (intmax_t)xf->size);
+	fflush(xfer->progress);
+}
+
 void
 fetch_file_progress_cb(const struct xbps_fetch_cb_data *xfpd, void *cbdata)
 {
 	struct xferstat *xfer = cbdata;
+	struct xferfile *xf;
+	struct timeval now;
 	char size[8];
 
+	xf = xfer_get(xfer, xfpd->file_name, xfpd->cb_start);
+	if (xf == NULL)
+		return;
+
+	xf->size = xfpd->file_size;
+	xf->offset = xfpd->file_offset;
+	xf->dloaded = xfpd->file_dloaded;
+
+	get_time(&now);
 	if (xfpd->cb_start) {
 		/* start transfer stats */
 		v_tty = isatty(STDOUT_FILENO);
-		get_time(&xfer->start);
-		xfer->last.tv_sec = xfer->last.tv_usec = 0;
+		xf->start = now;
+		if (xfer->progress)
+			stat_stream(xfer, "start", xf);
 	} else if (xfpd->cb_update) {
-		/* update transfer stats */
-		stat_display(xfpd, xfer);
+		/* update transfer stats, at most 10 times per second */
+		if (xfer->progress && stat_due(&xfer->mlast, &now, 100))
+			stat_stream(xfer, "progress", NULL);
+		if (stat_due(&xfer->last, &now, v_tty ? 100 : 1000))
+			stat_display(xfer, &now);
 	} else if (xfpd->cb_end) {
 		/* end transfer stats */
 		(void)xbps_humanize_number(size, (int64_t)xfpd->file_dloaded);
 		if (v_tty)
 			fprintf(stderr, "%s: %s [avg rate: %s]\033[K\n",
-			    xfpd->file_name, size, stat_bps(xfpd, xfer));
+			    xfpd->file_name, size,
+			    stat_bps(elapsed(&xf->start, &now),
+			    xf->dloaded - xf->offset));
 		else {
 			printf("%s: %s [avg rate: %s]\n",
-			    xfpd->file_name, size, stat_bps(xfpd, xfer));
+			    xfpd->file_name, size,
+			    stat_bps(elapsed(&xf->start, &now),
+			    xf->dloaded - xf->offset));
 			fflush(stdout);
 		}
+		if (xfer->progress)
+			stat_stream(xfer, "end", xf);
+		xfer_del(xfer, xf);
 	}
 }
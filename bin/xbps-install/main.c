@@ -56,6 +56,16 @@ usage(bool fail)
 	    " -M --memory-sync         Remote repository data is fetched and stored\n"
 	    "                          in memory, ignoring on-disk repodata archives.\n"
 	    " -n --dry-run             Dry-run mode\n"
+	    " --apply-plan <file>      Apply a transaction written by --export-plan\n"
+	    "                          if the installed packages still match\n"
+	    " --export-plan <file>     Resolve the transaction and write it to file\n"
+	    "                          instead of running it\n"
+	    " --prefetch               Sync and download the updates into cachedir,\n"
+	    "                          verified, without installing them\n"
+	    " --progress-fd <fd>       Write machine readable download progress\n"
+	    "                          to file descriptor fd\n"
+	    " --stats                  Show the time spent in every transaction phase\n"
+	    "                          and unpack statistics\n"
 	    " -R,--repository=<url>    Add repository to the top of the list.\n"
 	    "                          This option can be specified multiple times.\n"
 	    " -r --rootdir <dir>       Full path to rootdir\n"
@@ -79,6 +89,23 @@ unpack_progress_cb(const struct xbps_unpack_cb_data *xpd, void *cbdata UNUSED)
 	    xpd->entry_size);
 }
 
+static void
+print_stats(const struct xbps_stats *st)
+{
+	static const char *phases[XBPS_PHASE_MAX] = {
+		"resolve", "revdeps", "shlibs", "conflicts",
+		"download", "verify", "unpack", "configure"
+	};
+	char size[8];
+
+	printf("\n[*] Transaction statistics\n");
+	for (int i = 0; i < XBPS_PHASE_MAX; i++)
+		printf("%-10s %10.3fs\n", phases[i], st->phase_time[i] / 1e9);
+	(void)xbps_humanize_number(size, (int64_t)st->unpack.bytes);
+	printf("%u packages unpacked, %" PRIu64 " files (%s) in %.3fs\n",
+	    st->unpack_pkgs, st->unpack.files, size, st->unpack.time / 1e9);
+}
+
 static int
 repo_import_key_cb(struct xbps_repo *repo, void *arg UNUSED, bool *done UNUSED)
 {
@@ -113,20 +140,26 @@ main(int argc, char **argv)
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "yes", no_argument, NULL, 'y' },
+		{ "progress-fd", required_argument, NULL, 0 },
+		{ "stats", no_argument, NULL, 1 },
+		{ "prefetch", no_argument, NULL, 2 },
+		{ "export-plan", required_argument, NULL, 3 },
+		{ "apply-plan", required_argument, NULL, 4 },
 		{ NULL, 0, NULL, 0 }
 	};
 	struct xbps_handle xh;
 	struct xferstat xfer;
-	const char *rootdir, *cachedir, *confdir;
+	const char *rootdir, *cachedir, *confdir, *export_plan, *apply;
 	int i, c, flags, rv, fflag = 0;
-	bool syncf, yes, reinstall, drun, update;
+	bool syncf, yes, reinstall, drun, update, stats;
 	int maxcols;
 
-	rootdir = cachedir = confdir = NULL;
+	rootdir = cachedir = confdir = export_plan = apply = NULL;
 	flags = rv = 0;
-	syncf = yes = reinstall = drun = update = false;
+	syncf = yes = reinstall = drun = update = stats = false;
 
 	memset(&xh, 0, sizeof(xh));
+	memset(&xfer, 0, sizeof(xfer));
 
 	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
 		switch (c) {
@@ -184,19 +217,45 @@ main(int argc, char **argv)
 		case 'y':
 			yes = true;
 			break;
+		case 0:
+			/* --progress-fd */
+			xfer.progress = fdopen((int)strtol(optarg, NULL, 10), "w");
+			if (xfer.progress == NULL) {
+				xbps_error_printf("invalid progress fd %s: %s\n",
+				    optarg, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 1:
+			stats = true;
+			break;
+		case 2:
+			/* --prefetch */
+			flags |= XBPS_FLAG_DOWNLOAD_ONLY;
+			syncf = update = yes = true;
+			break;
+		case 3:
+			export_plan = optarg;
+			break;
+		case 4:
+			apply = optarg;
+			break;
 		case '?':
 		default:
 			usage(true);
 			/* NOTREACHED */
 		}
 	}
-	if ((!update && !syncf) && (argc == optind))
+	if ((!update && !syncf && !apply) && (argc == optind))
+		usage(true);
+	if (apply && (update || export_plan || (argc != optind)))
 		usage(true);
 
 	/*
 	 * Initialize libxbps.
 	 */
 	xh.state_cb = state_cb;
+	xh.state_cb_data = &stats;
 	xh.fetch_cb = fetch_file_progress_cb;
 	xh.fetch_cb_data = &xfer;
 	if (rootdir)
@@ -226,7 +285,7 @@ main(int argc, char **argv)
 			exit(rv);
 	}
 
-	if (syncf && !update && (argc == optind))
+	if (syncf && !update && !apply && (argc == optind))
 		exit(EXIT_SUCCESS);
 
 	if (!drun && (rv = xbps_pkgdb_lock(&xh)) != 0) {
@@ -234,9 +293,12 @@ main(int argc, char **argv)
 		exit(rv);
 	}
 
-	if (update && (argc == optind)) {
+	if (apply) {
+		/* Apply a transaction resolved elsewhere */
+		rv = apply_plan(&xh, apply, maxcols, yes, drun);
+	} else if (update && (argc == optind)) {
 		/* Update all installed packages */
-		rv = dist_upgrade(&xh, maxcols, yes, drun);
+		rv = dist_upgrade(&xh, maxcols, yes, drun, export_plan);
 	} else if (update) {
 		/* Update target packages */
 		int npkgs = argc - optind;
@@ -249,7 +311,7 @@ main(int argc, char **argv)
 				exit(rv);
 			}
 		}
-		rv = exec_transaction(&xh, maxcols, yes, drun);
+		rv = exec_transaction(&xh, maxcols, yes, drun, export_plan);
 	} else if (!update) {
 		/* Install target packages */
 		int npkgs = argc - optind;
@@ -262,8 +324,10 @@ main(int argc, char **argv)
 				exit(rv);
 			}
 		}
-		rv = exec_transaction(&xh, maxcols, yes, drun);
+		rv = exec_transaction(&xh, maxcols, yes, drun, export_plan);
 	}
+	if (stats)
+		print_stats(&xh.stats);
 
 	xbps_end(&xh);
 	exit(rv);
@@ -32,13 +32,13 @@
 #include "defs.h"
 
 int
-state_cb(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
+state_cb(const struct xbps_state_cb_data *xscd, void *cbdata)
 {
 	xbps_dictionary_t pkgd;
 	const char *instver, *newver;
-	char *pkgname;
+	char *pkgname, size[8];
 	int rv = 0;
-	bool slog = false;
+	bool slog = false, *stats = cbdata;
 
 	if ((xscd->xhp->flags & XBPS_FLAG_DISABLE_SYSLOG) == 0) {
 		slog = true;
@@ -62,6 +62,9 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 	case XBPS_STATE_PKGDB:
 		printf("[*] pkgdb upgrade in progress, please wait...\n");
 		break;
+	case XBPS_STATE_TRANS_REVDEPS:
+		xbps_dbg_printf(xscd->xhp, "%s\n", xscd->desc);
+		break;
 	case XBPS_STATE_REPOSYNC:
 		printf("[*] Updating `%s' ...\n", xscd->arg);
 		break;
@@ -83,11 +86,23 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 		printf("%s: configuring ...\n", xscd->arg);
 		break;
 	case XBPS_STATE_CONFIGURE_DONE:
+	case XBPS_STATE_TRIGGER_DONE:
 		/* empty */
 		break;
+	case XBPS_STATE_TRIGGER:
+		printf("%s: running trigger ...\n", xscd->arg);
+		break;
 	case XBPS_STATE_UNPACK:
 		printf("%s: unpacking ...\n", xscd->arg);
 		break;
+	case XBPS_STATE_UNPACK_DONE:
+		if (stats == NULL || !*stats)
+			break;
+		(void)xbps_humanize_number(size, (int64_t)xscd->unpack->bytes);
+		printf("%s: unpacked %" PRIu64 " files (%s) in %.3fs\n",
+		    xscd->arg, xscd->unpack->files, size,
+		    xscd->unpack->time / 1e9);
+		break;
 	case XBPS_STATE_INSTALL:
 	case XBPS_STATE_DOWNLOAD:
 		/* empty */
@@ -167,6 +182,7 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 	case XBPS_STATE_DOWNLOAD_FAIL:
 	case XBPS_STATE_REPOSYNC_FAIL:
 	case XBPS_STATE_CONFIG_FILE_FAIL:
+	case XBPS_STATE_TRIGGER_FAIL:
 		xbps_error_printf("%s\n", xscd->desc);
 		if (slog) {
 			syslog(LOG_ERR, "%s", xscd->desc);
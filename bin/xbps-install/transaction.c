@@ -219,7 +219,8 @@ show_transaction_sizes(struct transaction *trans, int cols)
 }
 
 int
-dist_upgrade(struct xbps_handle *xhp, int cols, bool yes, bool drun)
+dist_upgrade(struct xbps_handle *xhp, int cols, bool yes, bool drun,
+		const char *plan)
 {
 	int rv = 0;
 
@@ -240,7 +241,7 @@ dist_upgrade(struct xbps_handle *xhp, int cols, bool yes, bool drun)
 		}
 	}
 
-	return exec_transaction(xhp, cols, yes, drun);
+	return exec_transaction(xhp, cols, yes, drun, plan);
 }
 
 int
@@ -291,65 +292,67 @@ update_pkg(struct xbps_handle *xhp, const char *pkgname)
 	return rv;
 }
 
-int
-exec_transaction(struct xbps_handle *xhp, int maxcols, bool yes, bool drun)
+static int
+prepare_error(struct xbps_handle *xhp, int rv)
 {
 	xbps_array_t array;
-	struct transaction *trans;
 	uint64_t fsize = 0, isize = 0;
 	char freesize[8], instsize[8];
+
+	if (rv == ENODEV) {
+		array = xbps_dictionary_get(xhp->transd, "missing_deps");
+		if (xbps_array_count(array)) {
+			/* missing dependencies */
+			print_array(array);
+			fprintf(stderr, "Transaction aborted due to unresolved dependencies.\n");
+		}
+	} else if (rv == ENOEXEC) {
+		array = xbps_dictionary_get(xhp->transd, "missing_shlibs");
+		if (xbps_array_count(array)) {
+			/* missing shlibs */
+			print_array(array);
+			fprintf(stderr, "Transaction aborted due to unresolved shlibs.\n");
+		}
+	} else if (rv == EAGAIN) {
+		/* conflicts */
+		array = xbps_dictionary_get(xhp->transd, "conflicts");
+		print_array(array);
+		fprintf(stderr, "Transaction aborted due to conflicting packages.\n");
+	} else if (rv == ENOSPC) {
+		/* not enough free space */
+		xbps_dictionary_get_uint64(xhp->transd,
+		    "total-installed-size", &isize);
+		if (xbps_humanize_number(instsize, (int64_t)isize) == -1) {
+			xbps_error_printf("humanize_number2 returns "
+				"%s\n", strerror(errno));
+			return -1;
+		}
+		xbps_dictionary_get_uint64(xhp->transd,
+		    "disk-free-size", &fsize);
+		if (xbps_humanize_number(freesize, (int64_t)fsize) == -1) {
+			xbps_error_printf("humanize_number2 returns "
+				"%s\n", strerror(errno));
+			return -1;
+		}
+		fprintf(stderr, "Transaction aborted due to insufficient disk "
+		    "space (need %s, got %s free).\n", instsize, freesize);
+	} else {
+		xbps_dbg_printf(xhp, "Empty transaction dictionary: %s\n",
+		    strerror(errno));
+	}
+	return rv;
+}
+
+static int
+run_transaction(struct xbps_handle *xhp, int maxcols, bool yes, bool drun)
+{
+	struct transaction *trans;
 	int rv = 0;
 
 	trans = calloc(1, sizeof(*trans));
 	if (trans == NULL)
 		return ENOMEM;
 
-	if ((rv = xbps_transaction_prepare(xhp)) != 0) {
-		if (rv == ENODEV) {
-			array = xbps_dictionary_get(xhp->transd, "missing_deps");
-			if (xbps_array_count(array)) {
-				/* missing dependencies */
-				print_array(array);
-				fprintf(stderr, "Transaction aborted due to unresolved dependencies.\n");
-			}
-		} else if (rv == ENOEXEC) {
-			array = xbps_dictionary_get(xhp->transd, "missing_shlibs");
-			if (xbps_array_count(array)) {
-				/* missing shlibs */
-				print_array(array);
-				fprintf(stderr, "Transaction aborted due to unresolved shlibs.\n");
-			}
-		} else if (rv == EAGAIN) {
-			/* conflicts */
-			array = xbps_dictionary_get(xhp->transd, "conflicts");
-			print_array(array);
-			fprintf(stderr, "Transaction aborted due to conflicting packages.\n");
-		} else if (rv == ENOSPC) {
-			/* not enough free space */
-			xbps_dictionary_get_uint64(xhp->transd,
-			    "total-installed-size", &isize);
-			if (xbps_humanize_number(instsize, (int64_t)isize) == -1) {
-				xbps_error_printf("humanize_number2 returns "
-					"%s\n", strerror(errno));
-				rv = -1;
-				goto out;
-			}
-			xbps_dictionary_get_uint64(xhp->transd,
-			    "disk-free-size", &fsize);
-			if (xbps_humanize_number(freesize, (int64_t)fsize) == -1) {
-				xbps_error_printf("humanize_number2 returns "
-					"%s\n", strerror(errno));
-				rv = -1;
-				goto out;
-			}
-			fprintf(stderr, "Transaction aborted due to insufficient disk "
-			    "space (need %s, got %s free).\n", instsize, freesize);
-		} else {
-			xbps_dbg_printf(xhp, "Empty transaction dictionary: %s\n",
-			    strerror(errno));
-		}
-		goto out;
-	}
 #ifdef FULL_DEBUG
 	xbps_dbg_printf(xhp, "Dictionary before transaction happens:\n");
 	xbps_dbg_printf_append(xhp, "%s",
@@ -368,6 +371,10 @@ exec_transaction(struct xbps_handle *xhp, int maxcols, bool yes, bool drun)
 		show_actions(trans->iter);
 		goto out;
 	}
+	/*
+	 * Connect to the mirrors while the transaction is shown.
+	 */
+	xbps_transaction_warmup(xhp);
 	/*
 	 * Show download/installed size for the transaction.
 	 */
@@ -393,7 +400,52 @@ exec_transaction(struct xbps_handle *xhp, int maxcols, bool yes, bool drun)
 out:
 	if (trans->iter)
 		xbps_object_iterator_release(trans->iter);
-	if (trans)
-		free(trans);
+	free(trans);
 	return rv;
 }
+
+int
+exec_transaction(struct xbps_handle *xhp, int maxcols, bool yes, bool drun,
+		const char *plan)
+{
+	int rv;
+
+	if ((rv = xbps_transaction_prepare(xhp)) != 0)
+		return prepare_error(xhp, rv);
+	/*
+	 * Write the resolved transaction to be applied with --apply-plan.
+	 */
+	if (plan != NULL) {
+		if ((rv = xbps_transaction_export(xhp, plan)) != 0) {
+			fprintf(stderr, "Failed to write transaction plan "
+			    "`%s': %s\n", plan, strerror(rv));
+			return rv;
+		}
+		printf("Transaction plan written to `%s' (%u packages).\n",
+		    plan, xbps_array_count(
+		    xbps_dictionary_get(xhp->transd, "packages")));
+		return 0;
+	}
+	return run_transaction(xhp, maxcols, yes, drun);
+}
+
+int
+apply_plan(struct xbps_handle *xhp, const char *plan, int maxcols, bool yes,
+		bool drun)
+{
+	int rv;
+
+	if ((rv = xbps_transaction_import(xhp, plan)) != 0) {
+		if (rv == ESTALE) {
+			fprintf(stderr, "Transaction plan `%s' was resolved "
+			    "against different installed packages.\n", plan);
+			return rv;
+		} else if (rv != ENOSPC) {
+			fprintf(stderr, "Failed to read transaction plan "
+			    "`%s': %s\n", plan, strerror(rv));
+			return rv;
+		}
+		return prepare_error(xhp, rv);
+	}
+	return run_transaction(xhp, maxcols, yes, drun);
+}
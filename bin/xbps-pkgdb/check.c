@@ -31,10 +31,169 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <xbps.h>
 #include "defs.h"
 
+/*
+ * Files of all packages are hashed in chunks of HASH_CHUNK files pulled
+ * from a shared queue, so a single huge package does not keep one thread
+ * busy while the others have nothing left to do.
+ */
+#define HASH_CHUNK	16
+
+struct check_pkg {
+	xbps_dictionary_t pkgd;
+	xbps_dictionary_t filesd;
+	char *pkgname;
+	int rv;
+	unsigned int first;
+	time_t since;
+};
+
+struct check_queue {
+	struct xbps_handle *xhp;
+	xbps_dictionary_t *files;
+	time_t *since;
+	int *hashes;
+	unsigned int nfiles;
+	unsigned int next;
+	pthread_mutex_t lock;
+};
+
+static int
+check_pkg_metadata(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		const char *pkgname, xbps_dictionary_t *filesdp)
+{
+	xbps_dictionary_t filesd;
+	const char *sha256;
+	char *buf;
+	int rv;
+
+	*filesdp = NULL;
+	/*
+	 * Check pkg files metadata signature.
+	 */
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "metafile-sha256", &sha256))
+		return 0;
+
+	buf = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, pkgname);
+	assert(buf);
+	if (access(buf, F_OK) == -1 && errno == ENOENT &&
+	    (filesd = xbps_pkgdb_get_pkg_files(xhp, pkgname)) != NULL) {
+		/* consolidated, verified when it was stored */
+		free(buf);
+		*filesdp = filesd;
+		return 0;
+	}
+	filesd = xbps_plist_dictionary_from_file(xhp, buf);
+	if (filesd == NULL) {
+		fprintf(stderr, "%s: cannot read %s, ignoring...\n",
+		    pkgname, buf);
+		free(buf);
+		return -1;
+	}
+	rv = xbps_file_hash_check_handle(xhp, buf, sha256);
+	free(buf);
+	if (rv == ENOENT) {
+		xbps_dictionary_remove(pkgd, "metafile-sha256");
+		fprintf(stderr, "%s: unexistent metafile, "
+		    "updating pkgdb.\n", pkgname);
+	} else if (rv == ERANGE) {
+		xbps_object_release(filesd);
+		fprintf(stderr, "%s: metadata file has been "
+		    "modified!\n", pkgname);
+		return 1;
+	}
+	*filesdp = filesd;
+	return 0;
+}
+
+static int
+check_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		const char *pkgname, xbps_dictionary_t filesd,
+		const int *hashes)
+{
+	int errors = 0;
+
+#define RUN_PKG_CHECK(x, name, arg)				\
+do {								\
+	if (check_pkg_##name(x, pkgname, arg) != 0) { 		\
+		errors++;					\
+	}							\
+} while (0)
+
+	/* Execute pkg checks */
+	if (check_pkg_files_hashed(xhp, pkgname, filesd, hashes) != 0)
+		errors++;
+	RUN_PKG_CHECK(xhp, symlinks, filesd);
+	RUN_PKG_CHECK(xhp, rundeps, pkgd);
+	RUN_PKG_CHECK(xhp, unneeded, pkgd);
+
+#undef RUN_PKG_CHECK
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void *
+hash_worker(void *arg)
+{
+	struct check_queue *q = arg;
+	unsigned int i, end;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		i = q->next;
+		q->next += HASH_CHUNK;
+		pthread_mutex_unlock(&q->lock);
+		if (i >= q->nfiles)
+			break;
+		end = MIN(i + HASH_CHUNK, q->nfiles);
+		for (; i < end; i++)
+			q->hashes[i] = check_pkg_file_hash(q->xhp,
+			    q->files[i], q->since[i]);
+	}
+	return NULL;
+}
+
+static int
+hash_files(struct check_queue *q)
+{
+	pthread_t *thds;
+	int maxthreads;
+
+	pthread_mutex_init(&q->lock, NULL);
+	maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (maxthreads <= 1 || q->nfiles <= HASH_CHUNK) {
+		hash_worker(q);
+		pthread_mutex_destroy(&q->lock);
+		return 0;
+	}
+	if ((unsigned int)maxthreads > q->nfiles / HASH_CHUNK)
+		maxthreads = q->nfiles / HASH_CHUNK;
+
+	thds = calloc(maxthreads, sizeof(*thds));
+	if (thds == NULL) {
+		pthread_mutex_destroy(&q->lock);
+		return errno;
+	}
+	for (int i = 0; i < maxthreads; i++) {
+		if (pthread_create(&thds[i], NULL, hash_worker, q) != 0) {
+			maxthreads = i;
+			break;
+		}
+	}
+	/* if no thread could be started, do it ourselves */
+	if (maxthreads == 0)
+		hash_worker(q);
+	for (int i = 0; i < maxthreads; i++)
+		pthread_join(thds[i], NULL);
+	pthread_mutex_destroy(&q->lock);
+	free(thds);
+	return 0;
+}
+
 static int
 pkgdb_cb(struct xbps_handle *xhp UNUSED,
 		xbps_object_t obj,
@@ -42,28 +201,99 @@ pkgdb_cb(struct xbps_handle *xhp UNUSED,
 		void *arg,
 		bool *done UNUSED)
 {
-	const char *pkgver;
-	char *pkgname;
-	int rv, *errors = (int *)arg;
-
-	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
-	if (xhp->flags & XBPS_FLAG_VERBOSE)
-		printf("Checking %s ...\n", pkgver);
-
-	pkgname = xbps_pkg_name(pkgver);
-	assert(pkgname);
-	if ((rv = check_pkg_integrity(xhp, obj, pkgname)) != 0)
-		*errors += 1;
+	xbps_array_t pkgs = arg;
 
-	free(pkgname);
+	xbps_array_add(pkgs, obj);
 	return 0;
 }
 
 int
 check_pkg_integrity_all(struct xbps_handle *xhp)
 {
-	int errors = 0;
-	xbps_pkgdb_foreach_cb_multi(xhp, pkgdb_cb, &errors);
+	struct check_queue q;
+	struct check_pkg *cp;
+	xbps_array_t pkgs, files;
+	const char *pkgver;
+	unsigned int npkgs, n;
+	int rv, errors = 0;
+
+	pkgs = xbps_array_create();
+	assert(pkgs);
+	if ((rv = xbps_pkgdb_foreach_cb(xhp, pkgdb_cb, pkgs)) != 0) {
+		xbps_object_release(pkgs);
+		return rv;
+	}
+	npkgs = xbps_array_count(pkgs);
+	cp = calloc(npkgs ? npkgs : 1, sizeof(*cp));
+	assert(cp);
+
+	/*
+	 * Read and verify pkg metadata first, and collect the files
+	 * to hash from all packages into a single queue.
+	 */
+	memset(&q, 0, sizeof(q));
+	q.xhp = xhp;
+	for (unsigned int i = 0; i < npkgs; i++) {
+		cp[i].pkgd = xbps_array_get(pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(cp[i].pkgd, "pkgver", &pkgver);
+		cp[i].pkgname = xbps_pkg_name(pkgver);
+		assert(cp[i].pkgname);
+		cp[i].rv = check_pkg_metadata(xhp, cp[i].pkgd,
+		    cp[i].pkgname, &cp[i].filesd);
+		cp[i].since = check_pkg_files_since(xhp, cp[i].pkgname);
+		cp[i].first = q.nfiles;
+		files = xbps_dictionary_get(cp[i].filesd, "files");
+		q.nfiles += xbps_array_count(files);
+	}
+	q.files = calloc(q.nfiles ? q.nfiles : 1, sizeof(*q.files));
+	q.since = calloc(q.nfiles ? q.nfiles : 1, sizeof(*q.since));
+	q.hashes = calloc(q.nfiles ? q.nfiles : 1, sizeof(*q.hashes));
+	assert(q.files);
+	assert(q.since);
+	assert(q.hashes);
+	for (unsigned int i = 0; i < npkgs; i++) {
+		files = xbps_dictionary_get(cp[i].filesd, "files");
+		n = xbps_array_count(files);
+		for (unsigned int j = 0; j < n; j++) {
+			q.files[cp[i].first + j] = xbps_array_get(files, j);
+			q.since[cp[i].first + j] = cp[i].since;
+		}
+	}
+	if ((rv = hash_files(&q)) != 0) {
+		xbps_error_printf("failed to hash files: %s\n", strerror(rv));
+		errors++;
+		npkgs = 0;
+	}
+
+	/*
+	 * Report results and run the remaining checks in pkgdb order.
+	 */
+	for (unsigned int i = 0; i < npkgs; i++) {
+		if (xhp->flags & XBPS_FLAG_VERBOSE) {
+			xbps_dictionary_get_cstring_nocopy(cp[i].pkgd,
+			    "pkgver", &pkgver);
+			printf("Checking %s ...\n", pkgver);
+		}
+		if (cp[i].rv != 0) {
+			errors++;
+			continue;
+		}
+		if (check_pkg(xhp, cp[i].pkgd, cp[i].pkgname,
+		    cp[i].filesd, q.hashes + cp[i].first) != 0)
+			errors++;
+	}
+
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		if (cp[i].filesd)
+			xbps_object_release(cp[i].filesd);
+		free(cp[i].pkgname);
+	}
+	free(q.files);
+	free(q.since);
+	free(q.hashes);
+	free(cp);
+	xbps_object_release(pkgs);
+
 	return errors ? -1 : 0;
 }
 
@@ -73,11 +303,7 @@ check_pkg_integrity(struct xbps_handle *xhp,
 		    const char *pkgname)
 {
 	xbps_dictionary_t opkgd, filesd = NULL;
-	const char *sha256;
-	char *buf;
-	int rv = 0, errors = 0;
-
-	filesd = opkgd = NULL;
+	int rv;
 
 	/* find real pkg by name */
 	opkgd = pkgd;
@@ -88,51 +314,13 @@ check_pkg_integrity(struct xbps_handle *xhp,
 			return 0;
 		}
 	}
-	/*
-	 * Check pkg files metadata signature.
-	 */
-	if (xbps_dictionary_get_cstring_nocopy(opkgd, "metafile-sha256", &sha256)) {
-		buf = xbps_xasprintf("%s/.%s-files.plist",
-		    xhp->metadir, pkgname);
-		assert(buf);
-		filesd = xbps_plist_dictionary_from_file(xhp, buf);
-		if (filesd == NULL) {
-			fprintf(stderr, "%s: cannot read %s, ignoring...\n",
-			    pkgname, buf);
-			free(buf);
-			return -1;
-		}
-		rv = xbps_file_hash_check(buf, sha256);
-		free(buf);
-		if (rv == ENOENT) {
-			xbps_dictionary_remove(opkgd, "metafile-sha256");
-			fprintf(stderr, "%s: unexistent metafile, "
-			    "updating pkgdb.\n", pkgname);
-		} else if (rv == ERANGE) {
-			xbps_object_release(filesd);
-			fprintf(stderr, "%s: metadata file has been "
-			    "modified!\n", pkgname);
-			return 1;
-		}
-	}
-
-#define RUN_PKG_CHECK(x, name, arg)				\
-do {								\
-	if ((rv = check_pkg_##name(x, pkgname, arg)) != 0) { 	\
-		errors++;					\
-	}							\
-} while (0)
+	if ((rv = check_pkg_metadata(xhp, opkgd, pkgname, &filesd)) != 0)
+		return rv;
 
-	/* Execute pkg checks */
-	RUN_PKG_CHECK(xhp, files, filesd);
-	RUN_PKG_CHECK(xhp, symlinks, filesd);
-	RUN_PKG_CHECK(xhp, rundeps, opkgd);
-	RUN_PKG_CHECK(xhp, unneeded, opkgd);
+	rv = check_pkg(xhp, opkgd, pkgname, filesd, NULL);
 
 	if (filesd)
 		xbps_object_release(filesd);
 
-#undef RUN_PKG_CHECK
-
-	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+	return rv;
 }
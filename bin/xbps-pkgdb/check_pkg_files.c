@@ -29,7 +29,9 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 
 #include <xbps.h>
 #include "defs.h"
@@ -75,63 +77,172 @@ check_file_mtime(xbps_dictionary_t d, const char *pkg, const char *path)
 	return false;
 }
 
+/*
+ * In stat-only mode files are only hashed if their size, mtime or ctime
+ * differ from the values recorded at install time, plus a random sample
+ * of `sample_pct' percent of the remaining files.
+ */
+static bool stat_only;
+static unsigned int sample_pct;
+static uint32_t sample_seed;
+
+void
+check_pkg_files_stat_only(unsigned int sample)
+{
+	stat_only = true;
+	sample_pct = sample > 100 ? 100 : sample;
+	sample_seed = (uint32_t)time(NULL) ^ (uint32_t)getpid();
+}
+
+time_t
+check_pkg_files_since(struct xbps_handle *xhp, const char *pkgname)
+{
+	struct stat st;
+	char *buf;
+	int rv;
+
+	if (!stat_only)
+		return 0;
+	/*
+	 * The files metadata plist is written right after the files
+	 * have been put in place, files with a newer ctime have been
+	 * touched after the package was installed.
+	 */
+	buf = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, pkgname);
+	rv = stat(buf, &st);
+	free(buf);
+	return rv == 0 ? st.st_mtime : 0;
+}
+
+static bool
+file_sampled(const char *file)
+{
+	uint32_t h = 2166136261U ^ sample_seed;
+
+	if (sample_pct == 0)
+		return false;
+	for (const char *p = file; *p; p++) {
+		h ^= (unsigned char)*p;
+		h *= 16777619U;
+	}
+	return h % 100 < sample_pct;
+}
+
+static bool
+file_unchanged(xbps_dictionary_t obj, const char *path, time_t since)
+{
+	struct stat st;
+	uint64_t mtime, size;
+
+	if (!xbps_dictionary_get_uint64(obj, "mtime", &mtime))
+		return false;
+	if (stat(path, &st) == -1)
+		return false;
+	if ((uint64_t)st.st_mtime != mtime)
+		return false;
+	if (xbps_dictionary_get_uint64(obj, "size", &size) &&
+	    (uint64_t)st.st_size != size)
+		return false;
+	if (since && st.st_ctime > since)
+		return false;
+	return true;
+}
+
+int
+check_pkg_file_hash(struct xbps_handle *xhp, xbps_dictionary_t obj,
+		time_t since)
+{
+	const char *file, *sha256, *digest;
+	char *path;
+	int rv;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
+	xbps_dictionary_get_cstring_nocopy(obj, "sha256", &sha256);
+	path = xbps_xasprintf("%s/%s", xhp->rootdir, file);
+	/*
+	 * Files with fs-verity enabled at unpack time are checked against
+	 * the digest measured by the kernel, the data is not read.
+	 */
+	if (xbps_dictionary_get_cstring_nocopy(obj, "verity-sha256", &digest)) {
+		rv = xbps_file_verity_check(path, digest);
+		if (rv == 0 || rv == ERANGE || rv == ENOENT) {
+			free(path);
+			return rv;
+		}
+	}
+	if (stat_only && file_unchanged(obj, path, since) &&
+	    !file_sampled(file)) {
+		free(path);
+		return 0;
+	}
+	rv = xbps_file_hash_check_handle(xhp, path, sha256);
+	free(path);
+	return rv;
+}
+
 int
 check_pkg_files(struct xbps_handle *xhp, const char *pkgname, void *arg)
+{
+	return check_pkg_files_hashed(xhp, pkgname, arg, NULL);
+}
+
+/*
+ * Same as check_pkg_files() but with the results of check_pkg_file_hash()
+ * for every object in the "files" array already computed in `hashes'
+ * (if not NULL), which is what check_pkg_integrity_all() does to
+ * spread hashing across threads.
+ */
+int
+check_pkg_files_hashed(struct xbps_handle *xhp, const char *pkgname,
+		xbps_dictionary_t pkg_filesd, const int *hashes)
 {
 	xbps_array_t array;
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
-	xbps_dictionary_t pkg_filesd = arg;
-	const char *file, *sha256;
+	const char *file;
 	char *path;
 	bool mutable, test_broken = false;
+	time_t since = 0;
 	int rv = 0, errors = 0;
 
-	array = xbps_dictionary_get(pkg_filesd, "files");
-	if (array != NULL && xbps_array_count(array) > 0) {
-		iter = xbps_array_iter_from_dict(pkg_filesd, "files");
-		if (iter == NULL)
-			return -1;
+	if (hashes == NULL)
+		since = check_pkg_files_since(xhp, pkgname);
 
-		while ((obj = xbps_object_iterator_next(iter))) {
-			xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
+	array = xbps_dictionary_get(pkg_filesd, "files");
+	for (unsigned int i = 0; i < xbps_array_count(array); i++) {
+		obj = xbps_array_get(array, i);
+		xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
+		if (hashes != NULL)
+			rv = hashes[i];
+		else
+			rv = check_pkg_file_hash(xhp, obj, since);
+		switch (rv) {
+		case 0:
 			path = xbps_xasprintf("%s/%s", xhp->rootdir, file);
-                        xbps_dictionary_get_cstring_nocopy(obj,
-                            "sha256", &sha256);
-			rv = xbps_file_hash_check(path, sha256);
-			switch (rv) {
-			case 0:
-				if (check_file_mtime(obj, pkgname, path)) {
-					test_broken = true;
-				}
-				free(path);
-				break;
-			case ENOENT:
-				xbps_error_printf("%s: unexistent file %s.\n",
-				    pkgname, file);
-				free(path);
+			if (check_file_mtime(obj, pkgname, path)) {
 				test_broken = true;
-				break;
-			case ERANGE:
-				mutable = false;
-				xbps_dictionary_get_bool(obj,
-				    "mutable", &mutable);
-				if (!mutable) {
-					xbps_error_printf("%s: hash mismatch "
-					    "for %s.\n", pkgname, file);
-					test_broken = true;
-				}
-				free(path);
-				break;
-			default:
-				xbps_error_printf(
-				    "%s: can't check `%s' (%s)\n",
-				    pkgname, file, strerror(rv));
-				free(path);
-				break;
 			}
-                }
-                xbps_object_iterator_release(iter);
+			free(path);
+			break;
+		case ENOENT:
+			xbps_error_printf("%s: unexistent file %s.\n",
+			    pkgname, file);
+			test_broken = true;
+			break;
+		case ERANGE:
+			mutable = false;
+			xbps_dictionary_get_bool(obj, "mutable", &mutable);
+			if (!mutable) {
+				xbps_error_printf("%s: hash mismatch "
+				    "for %s.\n", pkgname, file);
+				test_broken = true;
+			}
+			break;
+		default:
+			xbps_error_printf("%s: can't check `%s' (%s)\n",
+			    pkgname, file, strerror(rv));
+			break;
+		}
 	}
 	if (test_broken) {
 		xbps_error_printf("%s: files check FAILED.\n", pkgname);
@@ -41,6 +41,13 @@ CHECK_PKG_DECL(files);
 CHECK_PKG_DECL(rundeps);
 CHECK_PKG_DECL(symlinks);
 
+/* from check_pkg_files.c */
+void	check_pkg_files_stat_only(unsigned int);
+time_t	check_pkg_files_since(struct xbps_handle *, const char *);
+int	check_pkg_file_hash(struct xbps_handle *, xbps_dictionary_t, time_t);
+int	check_pkg_files_hashed(struct xbps_handle *, const char *,
+		xbps_dictionary_t, const int *);
+
 /* from convert.c */
 void	convert_pkgdb_format(struct xbps_handle *);
 
@@ -42,11 +42,23 @@ usage(bool fail)
 	    "OPTIONS\n"
 	    " -a --all                               Process all packages\n"
 	    " -C --config <dir>                      Path to confdir (xbps.d)\n"
+	    "    --consolidate                       Store the files plists of all\n"
+	    "                                        packages in the files index\n"
 	    " -d --debug                             Debug mode shown to stderr\n"
+	    "    --export-files                      Write the files plists stored in\n"
+	    "                                        the files index back to metadir\n"
+	    " -f --fast                              Only hash files whose size, mtime or\n"
+	    "                                        ctime changed since installation\n"
 	    " -h --help                              Print usage help\n"
+	    "    --hash                              Print the hash of all installed\n"
+	    "                                        packages\n"
+	    "    --hash-buckets                      Print the hash of every bucket of\n"
+	    "                                        installed packages\n"
 	    " -m --mode <auto|manual|hold|unhold|repolock|repounlock>\n"
 	    "                                        Change PKGNAME to this mode\n"
 	    " -r --rootdir <dir>                     Full path to rootdir\n"
+	    " -s --sample <percent>                  With -f, also hash this percentage\n"
+	    "                                        of unchanged files\n"
 	    " -u --update                            Update pkgdb to the latest format\n"
 	    " -v --verbose                           Verbose messages\n"
 	    " -V --version                           Show XBPS version\n");
@@ -80,26 +92,61 @@ change_pkg_mode(struct xbps_handle *xhp, const char *pkgname, const char *mode)
 	return 0;
 }
 
+static int
+print_pkgdb_hash(struct xbps_handle *xhp, bool buckets)
+{
+	char *hash;
+
+	if (!buckets) {
+		if ((hash = xbps_pkgdb_hash(xhp, -1)) == NULL)
+			goto fail;
+		printf("%s\n", hash);
+		free(hash);
+		return 0;
+	}
+	for (int i = 0; i < XBPS_PKGDB_HASH_BUCKETS; i++) {
+		if ((hash = xbps_pkgdb_hash(xhp, i)) == NULL)
+			goto fail;
+		/* empty buckets are not printed */
+		if (strspn(hash, "0") != strlen(hash))
+			printf("%02x %s\n", i, hash);
+		free(hash);
+	}
+	return 0;
+fail:
+	fprintf(stderr, "xbps-pkgdb: failed to hash pkgdb: %s\n",
+	    strerror(errno));
+	return errno;
+}
+
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "aC:dhm:r:uVv";
+	const char *shortopts = "aC:dfhm:r:s:uVv";
 	const struct option longopts[] = {
 		{ "all", no_argument, NULL, 'a' },
 		{ "config", required_argument, NULL, 'C' },
 		{ "debug", no_argument, NULL, 'd' },
+		{ "fast", no_argument, NULL, 'f' },
 		{ "help", no_argument, NULL, 'h' },
 		{ "mode", required_argument, NULL, 'm' },
 		{ "rootdir", required_argument, NULL, 'r' },
+		{ "sample", required_argument, NULL, 's' },
 		{ "update", no_argument, NULL, 'u' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "version", no_argument, NULL, 'V' },
+		{ "consolidate", no_argument, NULL, 1 },
+		{ "export-files", no_argument, NULL, 2 },
+		{ "hash", no_argument, NULL, 3 },
+		{ "hash-buckets", no_argument, NULL, 4 },
 		{ NULL, 0, NULL, 0 }
 	};
 	struct xbps_handle xh;
 	const char *confdir = NULL, *rootdir = NULL, *instmode = NULL;
+	unsigned int sample = 0;
 	int c, i, rv, flags = 0;
-	bool update_format = false, all = false;
+	bool update_format = false, all = false, fast = false;
+	bool consolidate = false, export = false, hash = false, buckets = false;
 
 	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
 		switch (c) {
@@ -112,6 +159,9 @@ main(int argc, char **argv)
 		case 'd':
 			flags |= XBPS_FLAG_DEBUG;
 			break;
+		case 'f':
+			fast = true;
+			break;
 		case 'h':
 			usage(false);
 			/* NOTREACHED */
@@ -121,6 +171,9 @@ main(int argc, char **argv)
 		case 'r':
 			rootdir = optarg;
 			break;
+		case 's':
+			sample = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
 		case 'u':
 			update_format = true;
 			break;
@@ -130,14 +183,31 @@ main(int argc, char **argv)
 		case 'V':
 			printf("%s\n", XBPS_RELVER);
 			exit(EXIT_SUCCESS);
+		case 1:
+			consolidate = true;
+			break;
+		case 2:
+			export = true;
+			break;
+		case 3:
+			hash = true;
+			break;
+		case 4:
+			buckets = true;
+			break;
 		case '?':
 		default:
 			usage(true);
 			/* NOTREACHED */
 		}
 	}
-	if (!update_format && !all && (argc == optind))
+	if (consolidate && export)
+		usage(true);
+	if (!update_format && !all && !consolidate && !export && !hash &&
+	    !buckets && (argc == optind))
 		usage(true);
+	if (fast)
+		check_pkg_files_stat_only(sample);
 
 	memset(&xh, 0, sizeof(xh));
 	if (rootdir)
@@ -152,6 +222,13 @@ main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (hash || buckets) {
+		/* read-only, pkgdb is not locked */
+		rv = print_pkgdb_hash(&xh, buckets);
+		xbps_end(&xh);
+		exit(rv ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
 	if ((rv = xbps_pkgdb_lock(&xh)) != 0) {
 		fprintf(stderr, "failed to lock pkgdb: %s\n", strerror(rv));
 		exit(EXIT_FAILURE);
@@ -159,6 +236,12 @@ main(int argc, char **argv)
 	if (update_format) {
 		/* nothing to do; xbps_pkgdb_lock() runs the conversion for us */
 		goto out;
+	} else if (consolidate || export) {
+		rv = xbps_pkgdb_files_consolidate(&xh, consolidate);
+		if (rv != 0)
+			fprintf(stderr, "xbps-pkgdb: failed to %s the files "
+			    "index: %s\n", consolidate ? "consolidate" :
+			    "export", strerror(rv));
 	} else if (instmode) {
 		if (argc == optind) {
 			fprintf(stderr,
@@ -34,9 +34,38 @@
 #define __UNCONST(a)    ((void *)(unsigned long)(const void *)(a))
 #endif
 
+#ifndef __arraycount
+#define __arraycount(x) (sizeof(x) / sizeof(*x))
+#endif
+
+/* options of a query, from the command line or a request */
+struct query {
+	const char *rootdir, *cachedir, *confdir;
+	const char *repos[32];
+	unsigned int nrepos;
+	int flags;
+	const char *serve, *connect;
+	bool batch;
+	const char *pkg, *props, *catfile;
+	bool list_pkgs, list_repos, orphans, own, list_repolock;
+	bool list_manual, list_hold, show_prop, show_files, show_deps;
+	bool show_rdeps, show, pkg_search, regex, repo_mode, opmode;
+	bool fulldeptree, list_bucket;
+};
+
+/* from main.c */
+int	parse_query(int, char **, struct query *, bool);
+int	init_handle(struct xbps_handle *, const struct query *);
+int	run_query(struct xbps_handle *, const struct query *);
+
+/* from serve.c */
+int	query_serve(struct query *, const char *);
+int	query_connect(const char *, int, char **);
+int	query_batch(struct query *);
+
 /* from show-deps.c */
 int	show_pkg_deps(struct xbps_handle *, const char *, bool, bool);
-int	show_pkg_revdeps(struct xbps_handle *, const char *, bool);
+int	show_pkg_revdeps(struct xbps_handle *, const char *, bool, bool);
 
 /* from show-info-files.c */
 void	show_pkg_info(xbps_dictionary_t);
@@ -61,6 +90,7 @@ int	list_pkgs_in_dict(struct xbps_handle *, xbps_object_t, const char *, void *,
 int	list_manual_pkgs(struct xbps_handle *, xbps_object_t, const char *, void *, bool *);
 int	list_hold_pkgs(struct xbps_handle *, xbps_object_t, const char *, void *, bool *);
 int	list_repolock_pkgs(struct xbps_handle *, xbps_object_t, const char *, void *, bool *);
+int	list_bucket_pkgs(struct xbps_handle *, const char *);
 int	list_orphans(struct xbps_handle *);
 int	list_pkgs_pkgdb(struct xbps_handle *);
 
@@ -140,6 +140,40 @@ list_repolock_pkgs(struct xbps_handle *xhp UNUSED,
 	return 0;
 }
 
+static int
+list_bucket_cb(struct xbps_handle *xhp UNUSED,
+		xbps_object_t obj,
+		const char *key,
+		void *arg,
+		bool *loop_done UNUSED)
+{
+	unsigned int *bucket = arg;
+	const char *pkgver = NULL, *state = "";
+
+	if (!xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver) ||
+	    xbps_pkgdb_hash_bucket(key) != *bucket)
+		return 0;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "state", &state);
+	printf("%s %s\n", pkgver, state);
+
+	return 0;
+}
+
+int
+list_bucket_pkgs(struct xbps_handle *xhp, const char *arg)
+{
+	unsigned int bucket;
+	char *end;
+
+	bucket = (unsigned int)strtoul(arg, &end, 16);
+	if (*arg == '\0' || *end != '\0' || bucket >= XBPS_PKGDB_HASH_BUCKETS) {
+		xbps_error_printf("invalid pkgdb hash bucket: %s\n", arg);
+		return EINVAL;
+	}
+	return xbps_pkgdb_foreach_cb(xhp, list_bucket_cb, &bucket);
+}
+
 int
 list_orphans(struct xbps_handle *xhp)
 {
@@ -173,13 +207,17 @@ list_pkgs_pkgdb(struct xbps_handle *xhp)
 static int
 repo_list_uri_cb(struct xbps_repo *repo, void *arg UNUSED, bool *done UNUSED)
 {
-	const char *signedby = NULL;
+	xbps_dictionary_t idx;
+	const char *signedby = NULL, *sigtype = "rsa";
 	uint16_t pubkeysize = 0;
 
+	idx = xbps_repo_get_index(repo);
 	printf("%5zd %s",
-	    repo->idx ? (ssize_t)xbps_dictionary_count(repo->idx) : -1,
+	    idx ? (ssize_t)xbps_dictionary_count(idx) : -1,
 	    repo->uri);
-	printf(" (RSA %s)\n", repo->is_signed ? "signed" : "unsigned");
+	xbps_dictionary_get_cstring_nocopy(repo->idxmeta, "signature-type", &sigtype);
+	printf(" (%s %s)\n", strcmp(sigtype, "ed25519") ? "RSA" : "Ed25519",
+	    repo->is_signed ? "signed" : "unsigned");
 	if (repo->xhp->flags & XBPS_FLAG_VERBOSE) {
 		xbps_data_t pubkey;
 		char *hexfp = NULL;
@@ -213,26 +251,38 @@ repo_list(struct xbps_handle *xhp)
 	return 0;
 }
 
-struct fflongest {
-	xbps_dictionary_t d;
-	unsigned int len;
-};
+static void *
+_find_longest_pkgver_init(void *arg UNUSED)
+{
+	return calloc(1, sizeof(unsigned int));
+}
 
 static int
 _find_longest_pkgver_cb(struct xbps_handle *xhp UNUSED,
 			xbps_object_t obj,
 			const char *key UNUSED,
-			void *arg,
+			void *acc,
 			bool *loop_done UNUSED)
 {
-	struct fflongest *ffl = arg;
+	unsigned int *lenp = acc;
 	const char *pkgver;
 	unsigned int len;
 
 	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
 	len = strlen(pkgver);
-	if (ffl->len == 0 || len > ffl->len)
-		ffl->len = len;
+	if (len > *lenp)
+		*lenp = len;
+
+	return 0;
+}
+
+static int
+_find_longest_pkgver_merge(void *arg, void *acc)
+{
+	unsigned int *lenp = arg, *len = acc;
+
+	if (*len > *lenp)
+		*lenp = *len;
 
 	return 0;
 }
@@ -240,22 +290,24 @@ _find_longest_pkgver_cb(struct xbps_handle *xhp UNUSED,
 unsigned int
 find_longest_pkgver(struct xbps_handle *xhp, xbps_object_t o)
 {
-	struct fflongest ffl;
-
-	ffl.d = o;
-	ffl.len = 0;
+	unsigned int len = 0;
+	struct xbps_reduce ops = {
+		.init = _find_longest_pkgver_init,
+		.fn = _find_longest_pkgver_cb,
+		.merge = _find_longest_pkgver_merge,
+		.fini = free,
+		.arg = &len
+	};
 
 	if (xbps_object_type(o) == XBPS_TYPE_DICTIONARY) {
 		xbps_array_t array;
 
 		array = xbps_dictionary_all_keys(o);
-		(void)xbps_array_foreach_cb_multi(xhp, array, o,
-		    _find_longest_pkgver_cb, &ffl);
+		(void)xbps_array_foreach_reduce(xhp, array, o, &ops);
 		xbps_object_release(array);
 	} else {
-		(void)xbps_pkgdb_foreach_cb_multi(xhp,
-		    _find_longest_pkgver_cb, &ffl);
+		(void)xbps_pkgdb_foreach_reduce(xhp, &ops);
 	}
 
-	return ffl.len;
+	return len;
 }
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <assert.h>
 
 #include <xbps.h>
 #include "defs.h"
@@ -52,7 +53,8 @@ usage(bool fail)
 	    "                          to the top of the list. This option can be\n"
 	    "                          specified multiple times.\n"
 	    "    --regex               Use Extended Regular Expressions to match\n"
-	    "    --fulldeptree         Full dependency tree for -x/--deps\n"
+	    "    --fulldeptree         Full dependency tree for -x/--deps and\n"
+	    "                          -X/--revdeps\n"
 	    " -r --rootdir <dir>       Full path to rootdir\n"
 	    " -V --version             Show XBPS version\n"
 	    " -v --verbose             Verbose messages\n"
@@ -61,6 +63,8 @@ usage(bool fail)
 	    " -L --list-repos          List registered repositories\n"
 	    " -H --list-hold-pkgs      List packages on hold state\n"
 	    "    --list-repolock-pkgs  List repolocked packages\n"
+	    "    --hash-bucket=N       List installed packages in the pkgdb hash\n"
+	    "                          bucket N (hexadecimal)\n"
 	    " -m --list-manual-pkgs    List packages installed explicitly\n"
 	    " -O --list-orphans        List package orphans\n"
 	    " -o --ownedby FILE        Search for package files by matching STRING or REGEX\n"
@@ -69,13 +73,17 @@ usage(bool fail)
 	    "    --cat=FILE PKG        Print FILE from PKG binpkg to stdout\n"
 	    " -f --files PKG           Show package files for PKG\n"
 	    " -x --deps PKG            Show dependencies for PKG\n"
-	    " -X --revdeps PKG         Show reverse dependencies for PKG\n");
+	    " -X --revdeps PKG         Show reverse dependencies for PKG\n"
+	    "    --serve=<socket>      Answer queries on a UNIX socket with a\n"
+	    "                          long-lived handle\n"
+	    "    --connect=<socket>    Send the query to a --serve server\n"
+	    "    --batch               Answer queries read from stdin, one per line\n");
 
 	exit(fail ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
 int
-main(int argc, char **argv)
+parse_query(int argc, char **argv, struct query *q, bool request)
 {
 	const char *shortopts = "C:c:df:hHiLlMmOo:p:Rr:s:S:VvX:x:";
 	const struct option longopts[] = {
@@ -105,115 +113,142 @@ main(int argc, char **argv)
 		{ "regex", no_argument, NULL, 0 },
 		{ "fulldeptree", no_argument, NULL, 1 },
 		{ "cat", required_argument, NULL, 2 },
+		{ "serve", required_argument, NULL, 4 },
+		{ "connect", required_argument, NULL, 5 },
+		{ "batch", no_argument, NULL, 6 },
+		{ "hash-bucket", required_argument, NULL, 7 },
 		{ NULL, 0, NULL, 0 },
 	};
-	struct xbps_handle xh;
-	const char *pkg, *rootdir, *cachedir, *confdir, *props, *catfile;
-	int c, flags, rv;
-	bool list_pkgs, list_repos, orphans, own, list_repolock;
-	bool list_manual, list_hold, show_prop, show_files, show_deps, show_rdeps;
-	bool show, pkg_search, regex, repo_mode, opmode, fulldeptree;
-
-	rootdir = cachedir = confdir = props = pkg = catfile = NULL;
-	flags = rv = c = 0;
-	list_pkgs = list_repos = list_hold = orphans = pkg_search = own = false;
-	list_manual = list_repolock = show_prop = show_files = false;
-	regex = show = show_deps = show_rdeps = fulldeptree = false;
-	repo_mode = opmode = false;
+	int c;
 
-	memset(&xh, 0, sizeof(xh));
+	/* reset getopt(3) state, requests are parsed once per line */
+	optind = 0;
 
 	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
+		/*
+		 * Options that change the handle or terminate the process
+		 * are only accepted when starting the server.
+		 */
+		if (request && ((c > 0 && strchr("CcdhiMrVv", c)) ||
+		    c == 4 || c == 5 || c == 6 || (c == 'R' && optarg))) {
+			if (c == 4 || c == 5 || c == 6)
+				xbps_error_printf("--serve, --connect and "
+				    "--batch are not allowed in requests\n");
+			else
+				xbps_error_printf("option -%c is not allowed "
+				    "in requests\n", c);
+			return EINVAL;
+		}
 		switch (c) {
 		case 'C':
-			confdir = optarg;
+			q->confdir = optarg;
 			break;
 		case 'c':
-			cachedir = optarg;
+			q->cachedir = optarg;
 			break;
 		case 'd':
-			flags |= XBPS_FLAG_DEBUG;
+			q->flags |= XBPS_FLAG_DEBUG;
 			break;
 		case 'f':
-			pkg = optarg;
-			show_files = opmode = true;
+			q->pkg = optarg;
+			q->show_files = q->opmode = true;
 			break;
 		case 'H':
-			list_hold = opmode = true;
+			q->list_hold = q->opmode = true;
 			break;
 		case 'h':
 			usage(false);
 			/* NOTREACHED */
 		case 'i':
-			flags |= XBPS_FLAG_IGNORE_CONF_REPOS;
+			q->flags |= XBPS_FLAG_IGNORE_CONF_REPOS;
 			break;
 		case 'L':
-			list_repos = opmode = true;
+			q->list_repos = q->opmode = true;
 			break;
 		case 'l':
-			list_pkgs = opmode = true;
+			q->list_pkgs = q->opmode = true;
 			break;
 		case 'M':
-			flags |= XBPS_FLAG_REPOS_MEMSYNC;
+			q->flags |= XBPS_FLAG_REPOS_MEMSYNC;
 			break;
 		case 'm':
-			list_manual = opmode = true;
+			q->list_manual = q->opmode = true;
 			break;
 		case 'O':
-			orphans = opmode = true;
+			q->orphans = q->opmode = true;
 			break;
 		case 'o':
-			pkg = optarg;
-			own = opmode = true;
+			q->pkg = optarg;
+			q->own = q->opmode = true;
 			break;
 		case 'p':
-			props = optarg;
-			show_prop = true;
+			q->props = optarg;
+			q->show_prop = true;
 			break;
 		case 'R':
 			if (optarg != NULL) {
-				xbps_repo_store(&xh, optarg);
-			}
-			repo_mode = true;
+				if (q->nrepos == __arraycount(q->repos)) {
+					xbps_error_printf("too many repositories\n");
+					return EINVAL;
+				}
+				q->repos[q->nrepos++] = optarg;
+			} else {
+				}
+			q->repo_mode = true;
 			break;
 		case 'r':
-			rootdir = optarg;
+			q->rootdir = optarg;
 			break;
 		case 'S':
-			pkg = optarg;
-			show = opmode = true;
+			q->pkg = optarg;
+			q->show = q->opmode = true;
 			break;
 		case 's':
-			pkg = optarg;
-			pkg_search = opmode = true;
+			q->pkg = optarg;
+			q->pkg_search = q->opmode = true;
 			break;
 		case 'v':
-			flags |= XBPS_FLAG_VERBOSE;
+			q->flags |= XBPS_FLAG_VERBOSE;
 			break;
 		case 'V':
 			printf("%s\n", XBPS_RELVER);
 			exit(EXIT_SUCCESS);
 		case 'x':
-			pkg = optarg;
-			show_deps = opmode = true;
+			q->pkg = optarg;
+			q->show_deps = q->opmode = true;
 			break;
 		case 'X':
-			pkg = optarg;
-			show_rdeps = opmode = true;
+			q->pkg = optarg;
+			q->show_rdeps = q->opmode = true;
 			break;
 		case 0:
-			regex = true;
+			q->regex = true;
 			break;
 		case 1:
-			fulldeptree = true;
+			q->fulldeptree = true;
 			break;
 		case 2:
-			catfile = optarg;
+			q->catfile = optarg;
 			break;
 		case 3:
-			list_repolock = opmode = true;
+			q->list_repolock = q->opmode = true;
+			break;
+		case 4:
+			q->serve = optarg;
+			break;
+		case 5:
+			q->connect = optarg;
+			break;
+		case 6:
+			q->batch = true;
+			break;
+		case 7:
+			q->pkg = optarg;
+			q->list_bucket = q->opmode = true;
 			break;
 		case '?':
+			if (request)
+				return EINVAL;
 			usage(true);
 			/* NOTREACHED */
 		}
@@ -221,94 +256,157 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (!argc && !opmode) {
+	if (q->serve || q->batch) {
+		/* modes and arguments are read from requests */
+		if (q->opmode || argc)
+			usage(true);
+		return 0;
+	}
+	if (!argc && !q->opmode) {
+		if (request)
+			return EINVAL;
 		usage(true);
-	} else if (!opmode) {
+	} else if (!q->opmode) {
 		/* show mode by default */
-		show = opmode = true;
-		pkg = *(argv++);
+		q->show = q->opmode = true;
+		q->pkg = *(argv++);
 		argc--;
 	}
 	if (argc) {
 		/* trailing parameters */
+		if (request)
+			return EINVAL;
 		usage(true);
 	}
-	/*
-	 * Initialize libxbps.
-	 */
-	if (rootdir)
-		xbps_strlcpy(xh.rootdir, rootdir, sizeof(xh.rootdir));
-	if (cachedir)
-		xbps_strlcpy(xh.cachedir, cachedir, sizeof(xh.cachedir));
-	if (confdir)
-		xbps_strlcpy(xh.confdir, confdir, sizeof(xh.confdir));
+	return 0;
+}
+
+int
+init_handle(struct xbps_handle *xhp, const struct query *q)
+{
+	int rv;
+
+	memset(xhp, 0, sizeof(*xhp));
 
-	xh.flags = flags;
+	for (unsigned int i = 0; i < q->nrepos; i++)
+		xbps_repo_store(xhp, q->repos[i]);
+	if (q->rootdir)
+		xbps_strlcpy(xhp->rootdir, q->rootdir, sizeof(xhp->rootdir));
+	if (q->cachedir)
+		xbps_strlcpy(xhp->cachedir, q->cachedir, sizeof(xhp->cachedir));
+	if (q->confdir)
+		xbps_strlcpy(xhp->confdir, q->confdir, sizeof(xhp->confdir));
 
-	if ((rv = xbps_init(&xh)) != 0) {
+	xhp->flags = q->flags;
+
+	if ((rv = xbps_init(xhp)) != 0) {
 		xbps_error_printf("Failed to initialize libxbps: %s\n",
 		    strerror(rv));
-		exit(EXIT_FAILURE);
 	}
+	return rv;
+}
 
-	if (list_repos) {
+int
+run_query(struct xbps_handle *xhp, const struct query *q)
+{
+	int rv = 0;
+
+	if (q->list_repos) {
 		/* list repositories */
-		rv = repo_list(&xh);
+		rv = repo_list(xhp);
 
-	} else if (list_hold) {
+	} else if (q->list_hold) {
 		/* list on hold pkgs */
-		rv = xbps_pkgdb_foreach_cb(&xh, list_hold_pkgs, NULL);
+		rv = xbps_pkgdb_foreach_cb(xhp, list_hold_pkgs, NULL);
 
-	} else if (list_repolock) {
+	} else if (q->list_repolock) {
 		/* list repolocked packages */
-		rv = xbps_pkgdb_foreach_cb(&xh, list_repolock_pkgs, NULL);
+		rv = xbps_pkgdb_foreach_cb(xhp, list_repolock_pkgs, NULL);
+
+	} else if (q->list_bucket) {
+		/* list pkgs in a pkgdb hash bucket */
+		rv = list_bucket_pkgs(xhp, q->pkg);
 
-	} else if (list_manual) {
+	} else if (q->list_manual) {
 		/* list manual pkgs */
-		rv = xbps_pkgdb_foreach_cb(&xh, list_manual_pkgs, NULL);
+		rv = xbps_pkgdb_foreach_cb(xhp, list_manual_pkgs, NULL);
 
-	} else if (list_pkgs) {
+	} else if (q->list_pkgs) {
 		/* list available pkgs */
-		rv = list_pkgs_pkgdb(&xh);
+		rv = list_pkgs_pkgdb(xhp);
 
-	} else if (orphans) {
+	} else if (q->orphans) {
 		/* list pkg orphans */
-		rv = list_orphans(&xh);
+		rv = list_orphans(xhp);
 
-	} else if (own) {
+	} else if (q->own) {
 		/* ownedby mode */
-		rv = ownedby(&xh, pkg, repo_mode, regex);
+		rv = ownedby(xhp, q->pkg, q->repo_mode, q->regex);
 
-	} else if (pkg_search) {
+	} else if (q->pkg_search) {
 		/* search mode */
-		rv = search(&xh, repo_mode, pkg, props, regex);
+		rv = search(xhp, q->repo_mode, q->pkg, q->props, q->regex);
 
-	} else if (catfile) {
+	} else if (q->catfile) {
 		/* repo cat file mode */
-		rv =  repo_cat_file(&xh, pkg, catfile);
+		rv =  repo_cat_file(xhp, q->pkg, q->catfile);
 
-	} else if (show || show_prop) {
+	} else if (q->show || q->show_prop) {
 		/* show mode */
-		if (repo_mode)
-			rv = repo_show_pkg_info(&xh, pkg, props);
+		if (q->repo_mode)
+			rv = repo_show_pkg_info(xhp, q->pkg, q->props);
 		else
-			rv = show_pkg_info_from_metadir(&xh, pkg, props);
+			rv = show_pkg_info_from_metadir(xhp, q->pkg, q->props);
 
-	} else if (show_files) {
+	} else if (q->show_files) {
 		/* show-files mode */
-		if (repo_mode)
-			rv =  repo_show_pkg_files(&xh, pkg);
+		if (q->repo_mode)
+			rv =  repo_show_pkg_files(xhp, q->pkg);
 		else
-			rv = show_pkg_files_from_metadir(&xh, pkg);
+			rv = show_pkg_files_from_metadir(xhp, q->pkg);
 
-	} else if (show_deps) {
+	} else if (q->show_deps) {
 		/* show-deps mode */
-		rv = show_pkg_deps(&xh, pkg, repo_mode, fulldeptree);
+		rv = show_pkg_deps(xhp, q->pkg, q->repo_mode, q->fulldeptree);
 
-	} else if (show_rdeps) {
+	} else if (q->show_rdeps) {
 		/* show-rdeps mode */
-		rv = show_pkg_revdeps(&xh, pkg, repo_mode);
+		rv = show_pkg_revdeps(xhp, q->pkg, q->repo_mode, q->fulldeptree);
 	}
+	return rv;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct xbps_handle xh;
+	struct query q;
+	char **args;
+	int rv;
+
+	/* getopt_long(3) permutes argv, keep it for --connect */
+	args = calloc(argc + 1, sizeof(char *));
+	assert(args);
+	memcpy(args, argv, argc * sizeof(char *));
+
+	memset(&q, 0, sizeof(q));
+	parse_query(argc, argv, &q, false);
+
+	if (q.connect)
+		exit(query_connect(q.connect, argc, args));
+	if (q.serve)
+		exit(query_serve(&q, q.serve));
+	if (q.batch)
+		exit(query_batch(&q));
+
+	free(args);
+	/*
+	 * Initialize libxbps.
+	 */
+	if (init_handle(&xh, &q) != 0)
+		exit(EXIT_FAILURE);
+
+	rv = run_query(&xh, &q);
 
 	xbps_end(&xh);
 	exit(rv);
@@ -39,11 +39,81 @@
 struct ffdata {
 	bool rematch;
 	const char *pat, *repouri;
+	struct xbps_substr *literal;
 	regex_t regex;
 	xbps_array_t allkeys;
 	xbps_dictionary_t filesd;
 };
 
+static const char *
+file_type(const char *keyname)
+{
+	if (strcmp(keyname, "files") == 0)
+		return "regular file";
+	else if (strcmp(keyname, "links") == 0)
+		return "link";
+	else if (strcmp(keyname, "conf_files") == 0)
+		return "configuration file";
+
+	return NULL;
+}
+
+static void
+match_file(struct ffdata *ffd, const char *pkgver, const char *filestr,
+		const char *tgt, const char *typestr)
+{
+	if (ffd->rematch) {
+		if (regexec(&ffd->regex, filestr, 0, 0, 0) != 0)
+			return;
+	} else {
+		if (ffd->literal != NULL &&
+		    xbps_substr_find(ffd->literal, filestr) == NULL)
+			return;
+		if ((fnmatch(ffd->pat, filestr, FNM_PERIOD)) != 0)
+			return;
+	}
+	printf("%s: %s%s%s (%s)\n",
+		pkgver, filestr,
+		tgt ? " -> " : "",
+		tgt ? tgt : "",
+		typestr);
+}
+
+/*
+ * Returns the longest run of characters between the wildcards of the
+ * pattern, that every matching path contains: paths without it are
+ * skipped before calling fnmatch(3). Patterns with brackets or escapes
+ * aren't split.
+ */
+static struct xbps_substr *
+pattern_literal(const char *pat)
+{
+	struct xbps_substr *literal;
+	const char *p, *start, *best = NULL;
+	size_t len = 0;
+	char *buf;
+
+	if (strpbrk(pat, "[\\") != NULL)
+		return NULL;
+	for (p = start = pat;; p++) {
+		if (*p != '\0' && *p != '*' && *p != '?')
+			continue;
+		if ((size_t)(p - start) > len) {
+			best = start;
+			len = (size_t)(p - start);
+		}
+		if (*p == '\0')
+			break;
+		start = p + 1;
+	}
+	if (len == 0 || (buf = strndup(best, len)) == NULL)
+		return NULL;
+	literal = xbps_substr_new(buf, false);
+	free(buf);
+
+	return literal;
+}
+
 static void
 match_files_by_pattern(xbps_dictionary_t pkg_filesd,
 		       xbps_dictionary_keysym_t key,
@@ -51,17 +121,10 @@ match_files_by_pattern(xbps_dictionary_t pkg_filesd,
 		       const char *pkgver)
 {
 	xbps_array_t array;
-	const char *keyname, *typestr;
-
-	keyname = xbps_dictionary_keysym_cstring_nocopy(key);
+	const char *typestr;
 
-	if (strcmp(keyname, "files") == 0)
-		typestr = "regular file";
-	else if (strcmp(keyname, "links") == 0)
-		typestr = "link";
-	else if (strcmp(keyname, "conf_files") == 0)
-		typestr = "configuration file";
-	else
+	typestr = file_type(xbps_dictionary_keysym_cstring_nocopy(key));
+	if (typestr == NULL)
 		return;
 
 	array = xbps_dictionary_get_keysym(pkg_filesd, key);
@@ -74,26 +137,26 @@ match_files_by_pattern(xbps_dictionary_t pkg_filesd,
 		if (filestr == NULL)
 			continue;
 		xbps_dictionary_get_cstring_nocopy(obj, "target", &tgt);
-		if (ffd->rematch) {
-			if (regexec(&ffd->regex, filestr, 0, 0, 0) == 0) {
-				printf("%s: %s%s%s (%s)\n",
-					pkgver, filestr,
-					tgt ? " -> " : "",
-					tgt ? tgt : "",
-					typestr);
-			}
-		} else {
-			if ((fnmatch(ffd->pat, filestr, FNM_PERIOD)) == 0) {
-				printf("%s: %s%s%s (%s)\n",
-					pkgver, filestr,
-					tgt ? " -> " : "",
-					tgt ? tgt : "",
-					typestr);
-			}
-		}
+		match_file(ffd, pkgver, filestr, tgt, typestr);
 	}
 }
 
+static int
+ownedby_files_cb(struct xbps_handle *xhp UNUSED,
+		const char *pkgver,
+		const char *file,
+		const char *target,
+		const char *key,
+		void *arg)
+{
+	const char *typestr;
+
+	if ((typestr = file_type(key)) != NULL)
+		match_file(arg, pkgver, file, target, typestr);
+
+	return 0;
+}
+
 static int
 ownedby_pkgdb_cb(struct xbps_handle *xhp,
 		xbps_object_t obj,
@@ -162,16 +225,55 @@ repo_match_cb(struct xbps_handle *xhp,
 	return 0;
 }
 
+/*
+ * Matches the files of the packages in the files index of the repository,
+ * those missing from it are read from their binary packages.
+ */
+static int
+repo_files_match(struct xbps_repo *repo, xbps_dictionary_t files,
+		xbps_array_t allkeys, xbps_dictionary_t idx, struct ffdata *ffd)
+{
+	xbps_array_t files_keys;
+	int rv = 0;
+
+	for (unsigned int i = 0; i < xbps_array_count(allkeys) && rv == 0; i++) {
+		xbps_dictionary_t pkgd, filesd;
+		const char *pkgver = NULL;
+
+		pkgd = xbps_dictionary_get_keysym(idx, xbps_array_get(allkeys, i));
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		if (pkgver == NULL)
+			continue;
+		if ((filesd = xbps_dictionary_get(files, pkgver)) == NULL) {
+			rv = repo_match_cb(repo->xhp, pkgd, NULL, ffd, NULL);
+			continue;
+		}
+		files_keys = xbps_dictionary_all_keys(filesd);
+		for (unsigned int x = 0; x < xbps_array_count(files_keys); x++) {
+			match_files_by_pattern(filesd,
+			    xbps_array_get(files_keys, x), ffd, pkgver);
+		}
+		xbps_object_release(files_keys);
+	}
+	return rv;
+}
+
 static int
 repo_ownedby_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
 {
 	xbps_array_t allkeys;
+	xbps_dictionary_t idx, files;
 	struct ffdata *ffd = arg;
 	int rv;
 
 	ffd->repouri = repo->uri;
-	allkeys = xbps_dictionary_all_keys(repo->idx);
-	rv = xbps_array_foreach_cb_multi(repo->xhp, allkeys, repo->idx, repo_match_cb, ffd);
+	idx = xbps_repo_get_index(repo);
+	allkeys = xbps_dictionary_all_keys(idx);
+	if ((files = xbps_repo_get_files(repo)) != NULL)
+		rv = repo_files_match(repo, files, allkeys, idx, ffd);
+	else
+		rv = xbps_array_foreach_cb_multi(repo->xhp, allkeys, idx,
+		    repo_match_cb, ffd);
 	xbps_object_release(allkeys);
 
 	return rv;
@@ -185,19 +287,33 @@ ownedby(struct xbps_handle *xhp, const char *pat, bool repo, bool regex)
 
 	ffd.rematch = false;
 	ffd.pat = pat;
+	ffd.literal = NULL;
 
 	if (regex) {
 		ffd.rematch = true;
 		if (regcomp(&ffd.regex, ffd.pat, REG_EXTENDED|REG_NOSUB|REG_ICASE) != 0)
 			return EINVAL;
+	} else {
+		ffd.literal = pattern_literal(pat);
 	}
-	if (repo)
+	if (repo) {
 		rv = xbps_rpool_foreach(xhp, repo_ownedby_cb, &ffd);
-	else
-		rv = xbps_pkgdb_foreach_cb(xhp, ownedby_pkgdb_cb, &ffd);
+	} else {
+		/*
+		 * Use the files index of pkgdb if it's up to date,
+		 * looking up the path directly if it's not a pattern.
+		 */
+		rv = xbps_pkgdb_files_foreach(xhp,
+		    (regex || strpbrk(pat, "*?[\\")) ? NULL : pat,
+		    ownedby_files_cb, &ffd);
+		if (rv == ENOENT)
+			rv = xbps_pkgdb_foreach_cb(xhp, ownedby_pkgdb_cb, &ffd);
+	}
 
 	if (regex)
 		regfree(&ffd.regex);
+	else
+		xbps_substr_free(ffd.literal);
 
 	return rv;
 }
@@ -23,12 +23,6 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#ifdef HAVE_STRCASESTR
-# define _GNU_SOURCE    /* for strcasestr(3) */
-#endif
-
-#include "compat.h"
-
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -39,6 +33,7 @@
 #include <fnmatch.h>
 #include <assert.h>
 #include <regex.h>
+#include <unistd.h>
 
 #include <xbps.h>
 #include "defs.h"
@@ -48,9 +43,30 @@ struct search_data {
 	regex_t regexp;
 	int maxcols;
 	const char *pat, *prop, *repourl;
+	struct xbps_substr *substr;
 	xbps_array_t results;
+	xbps_array_t lines;
 };
 
+/*
+ * Repositories are searched concurrently in slices of their index, every
+ * slice has its own buffers that are merged in order of the repositories.
+ */
+struct search_slice {
+	struct search_data sd;
+	xbps_array_t pkgs;
+	xbps_dictionary_t idx;
+	unsigned int start, end;
+};
+
+struct search_slices {
+	struct search_data *sd;
+	struct search_slice *slices;
+	unsigned int nslices, size;
+};
+
+#define SEARCH_SLICE_MIN	512
+
 static void
 print_results(struct xbps_handle *xhp, struct search_data *sd)
 {
@@ -93,6 +109,29 @@ print_results(struct xbps_handle *xhp, struct search_data *sd)
 	}
 }
 
+static void
+print_prop(struct search_data *sd, const char *pkgver, const char *str)
+{
+	char *line;
+
+	if (sd->repo_mode)
+		line = xbps_xasprintf("%s: %s (%s)", pkgver, str, sd->repourl);
+	else
+		line = xbps_xasprintf("%s: %s", pkgver, str);
+	xbps_array_add_cstring(sd->lines, line);
+	free(line);
+}
+
+static void
+add_result(struct search_data *sd, const char *pkgver, const char *desc)
+{
+	xbps_object_t objs[2];
+
+	objs[0] = xbps_string_create_cstring_nocopy(pkgver);
+	objs[1] = xbps_string_create_cstring_nocopy(desc);
+	xbps_array_add_objects_and_rel(sd->results, objs, 2);
+}
+
 static int
 search_array_cb(struct xbps_handle *xhp UNUSED,
 		xbps_object_t obj,
@@ -118,20 +157,17 @@ search_array_cb(struct xbps_handle *xhp UNUSED,
 		if (sd->regex) {
 			if ((regexec(&sd->regexp, pkgver, 0, 0, 0) == 0) ||
 			    (regexec(&sd->regexp, desc, 0, 0, 0) == 0)) {
-				xbps_array_add_cstring_nocopy(sd->results, pkgver);
-				xbps_array_add_cstring_nocopy(sd->results, desc);
+				add_result(sd, pkgver, desc);
 			}
 			return 0;
 		}
 		if (vpkgfound) {
-			xbps_array_add_cstring_nocopy(sd->results, pkgver);
-			xbps_array_add_cstring_nocopy(sd->results, desc);
+			add_result(sd, pkgver, desc);
 		} else {
-			if ((strcasestr(pkgver, sd->pat)) ||
-			    (strcasestr(desc, sd->pat)) ||
+			if ((xbps_substr_find(sd->substr, pkgver)) ||
+			    (xbps_substr_find(sd->substr, desc)) ||
 			    (xbps_pkgpattern_match(pkgver, sd->pat))) {
-				xbps_array_add_cstring_nocopy(sd->results, pkgver);
-				xbps_array_add_cstring_nocopy(sd->results, desc);
+				add_result(sd, pkgver, desc);
 			}
 		}
 		return 0;
@@ -143,19 +179,11 @@ search_array_cb(struct xbps_handle *xhp UNUSED,
 		for (unsigned int i = 0; i < xbps_array_count(obj2); i++) {
 			xbps_array_get_cstring_nocopy(obj2, i, &str);
 			if (sd->regex) {
-				if (regexec(&sd->regexp, str, 0, 0, 0) == 0) {
-					if (sd->repo_mode)
-						printf("%s: %s (%s)\n", pkgver, str, sd->repourl);
-					else
-						printf("%s: %s\n", pkgver, str);
-				}
+				if (regexec(&sd->regexp, str, 0, 0, 0) == 0)
+					print_prop(sd, pkgver, str);
 			} else {
-				if (strcasestr(str, sd->pat)) {
-					if (sd->repo_mode)
-						printf("%s: %s (%s)\n", pkgver, str, sd->repourl);
-					else
-						printf("%s: %s\n", pkgver, str);
-				}
+				if (xbps_substr_find(sd->substr, str))
+					print_prop(sd, pkgver, str);
 			}
 		}
 	} else if (xbps_object_type(obj2) == XBPS_TYPE_NUMBER) {
@@ -166,85 +194,184 @@ search_array_cb(struct xbps_handle *xhp UNUSED,
 			exit(EXIT_FAILURE);
 
 		if (sd->regex) {
-			if (regexec(&sd->regexp, size, 0, 0, 0) == 0) {
-				if (sd->repo_mode)
-					printf("%s: %s (%s)\n", pkgver, size, sd->repourl);
-				else
-					printf("%s: %s\n", pkgver, size);
-			}
+			if (regexec(&sd->regexp, size, 0, 0, 0) == 0)
+				print_prop(sd, pkgver, size);
 		} else {
-			if (strcasestr(size, sd->pat)) {
-				if (sd->repo_mode)
-					printf("%s: %s (%s)\n", pkgver, size, sd->repourl);
-				else
-					printf("%s: %s\n", pkgver, size);
-			}
+			if (xbps_substr_find(sd->substr, size))
+				print_prop(sd, pkgver, size);
 		}
 	} else if (xbps_object_type(obj2) == XBPS_TYPE_BOOL) {
 		/* property is a bool */
-		if (sd->repo_mode)
-			printf("%s: true (%s)\n", pkgver, sd->repourl);
-		else
-			printf("%s: true\n", pkgver);
-
+		print_prop(sd, pkgver, "true");
 	} else if (xbps_object_type(obj2) == XBPS_TYPE_STRING) {
 		/* property is a string */
 		str = xbps_string_cstring_nocopy(obj2);
 		if (sd->regex) {
-			if (regexec(&sd->regexp, str, 0, 0, 0) == 0) {
-				if (sd->repo_mode)
-					printf("%s: %s (%s)\n", pkgver, str, sd->repourl);
-				else
-					printf("%s: %s\n", pkgver, str);
-			}
+			if (regexec(&sd->regexp, str, 0, 0, 0) == 0)
+				print_prop(sd, pkgver, str);
 		} else {
-			if (strcasestr(str, sd->pat)) {
-				if (sd->repo_mode)
-					printf("%s: %s (%s)\n", pkgver, str, sd->repourl);
-				else
-					printf("%s: %s\n", pkgver, str);
-			}
+			if (xbps_substr_find(sd->substr, str))
+				print_prop(sd, pkgver, str);
 		}
 	}
 	return 0;
 }
 
+static void
+slice_add(struct search_slices *ss, struct xbps_repo *repo, xbps_array_t pkgs,
+		xbps_dictionary_t idx, unsigned int start, unsigned int end)
+{
+	struct search_slice *slice;
+
+	if (ss->nslices == ss->size) {
+		ss->size = ss->size ? ss->size * 2 : 16;
+		ss->slices = realloc(ss->slices, ss->size * sizeof(*ss->slices));
+		assert(ss->slices);
+	}
+	slice = &ss->slices[ss->nslices++];
+	slice->sd = *ss->sd;
+	slice->sd.repourl = repo->uri;
+	slice->sd.results = xbps_array_create();
+	slice->sd.lines = xbps_array_create();
+	assert(slice->sd.results && slice->sd.lines);
+	xbps_object_retain(pkgs);
+	slice->pkgs = pkgs;
+	slice->idx = idx;
+	slice->start = start;
+	slice->end = end;
+}
+
+/*
+ * Splits the packages to match of every repository in slices, they're
+ * matched concurrently once all repositories are read.
+ */
 static int
 search_repo_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
 {
-	xbps_array_t allkeys;
-	struct search_data *sd = arg;
-	int rv;
+	struct search_slices *ss = arg;
+	struct search_data *sd = ss->sd;
+	xbps_array_t allkeys, pkgs;
+	xbps_dictionary_t idx;
+	unsigned int count, size;
+	long ncpus;
 
-	if (repo->idx == NULL)
+	/*
+	 * Substring searches only match the candidates found in the
+	 * trigram index of the repository, if it has one; patterns
+	 * are matched against every package.
+	 */
+	if (!sd->regex && sd->prop == NULL &&
+	    strpbrk(sd->pat, "<>=*?[") == NULL &&
+	    (pkgs = xbps_repo_search_candidates(repo, sd->pat)) != NULL) {
+		slice_add(ss, repo, pkgs, NULL, 0, xbps_array_count(pkgs));
+		xbps_object_release(pkgs);
+		return 0;
+	}
+	if ((idx = xbps_repo_get_index(repo)) == NULL)
 		return 0;
 
-	sd->repourl = repo->uri;
-	allkeys = xbps_dictionary_all_keys(repo->idx);
-	rv = xbps_array_foreach_cb(repo->xhp, allkeys, repo->idx, search_array_cb, sd);
+	allkeys = xbps_dictionary_all_keys(idx);
+	count = xbps_array_count(allkeys);
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size = ncpus > 1 ? count / (unsigned int)ncpus + 1 : count;
+	if (size < SEARCH_SLICE_MIN)
+		size = SEARCH_SLICE_MIN;
+	for (unsigned int i = 0; i < count; i += size)
+		slice_add(ss, repo, allkeys, idx, i, i + size < count ? i + size : count);
 	xbps_object_release(allkeys);
-	return rv;
+	return 0;
+}
+
+static int
+search_slice_cb(struct xbps_handle *xhp,
+		xbps_object_t obj,
+		const char *key UNUSED,
+		void *arg,
+		bool *done UNUSED)
+{
+	struct search_slices *ss = arg;
+	struct search_slice *slice;
+	xbps_object_t pkgd;
+
+	slice = &ss->slices[xbps_number_unsigned_integer_value(obj)];
+	for (unsigned int i = slice->start; i < slice->end; i++) {
+		pkgd = xbps_array_get(slice->pkgs, i);
+		if (slice->idx != NULL)
+			pkgd = xbps_dictionary_get_keysym(slice->idx, pkgd);
+		(void)search_array_cb(xhp, pkgd, NULL, &slice->sd, NULL);
+	}
+	return 0;
+}
+
+static void
+search_merge(struct search_data *sd, struct search_data *ssd)
+{
+	xbps_object_t obj;
+
+	for (unsigned int i = 0; i < xbps_array_count(ssd->results); i++) {
+		obj = xbps_array_get(ssd->results, i);
+		xbps_array_add(sd->results, obj);
+	}
+	for (unsigned int i = 0; i < xbps_array_count(ssd->lines); i++) {
+		obj = xbps_array_get(ssd->lines, i);
+		xbps_array_add(sd->lines, obj);
+	}
+}
+
+static int
+search_repos(struct xbps_handle *xhp, struct search_data *sd)
+{
+	struct search_slices ss;
+	xbps_array_t work;
+	int rv;
+
+	memset(&ss, 0, sizeof(ss));
+	ss.sd = sd;
+	if ((rv = xbps_rpool_foreach(xhp, search_repo_cb, &ss)) != 0)
+		return rv;
+
+	work = xbps_array_create();
+	assert(work);
+	for (unsigned int i = 0; i < ss.nslices; i++)
+		xbps_array_add_uint64(work, i);
+	(void)xbps_array_foreach_cb_multi(xhp, work, NULL, search_slice_cb, &ss);
+	xbps_object_release(work);
+
+	/* in order of the repositories */
+	for (unsigned int i = 0; i < ss.nslices; i++) {
+		search_merge(sd, &ss.slices[i].sd);
+		xbps_object_release(ss.slices[i].sd.results);
+		xbps_object_release(ss.slices[i].sd.lines);
+		xbps_object_release(ss.slices[i].pkgs);
+	}
+	free(ss.slices);
+	return 0;
 }
 
 int
 search(struct xbps_handle *xhp, bool repo_mode, const char *pat, const char *prop, bool regex)
 {
 	struct search_data sd;
+	const char *line;
 	int rv;
 
 	sd.regex = regex;
+	sd.substr = NULL;
 	if (regex) {
 		if (regcomp(&sd.regexp, pat, REG_EXTENDED|REG_NOSUB|REG_ICASE) != 0)
 			return errno;
+	} else if ((sd.substr = xbps_substr_new(pat, true)) == NULL) {
+		return ENOMEM;
 	}
 	sd.repo_mode = repo_mode;
 	sd.pat = pat;
 	sd.prop = prop;
 	sd.maxcols = get_maxcols();
 	sd.results = xbps_array_create();
+	sd.lines = xbps_array_create();
 
 	if (repo_mode) {
-		rv = xbps_rpool_foreach(xhp, search_repo_cb, &sd);
+		rv = search_repos(xhp, &sd);
 		if (rv != 0 && rv != ENOTSUP) {
 			fprintf(stderr, "Failed to initialize rpool: %s\n",
 			    strerror(rv));
@@ -258,12 +385,18 @@ search(struct xbps_handle *xhp, bool repo_mode, const char *pat, const char *pro
 			return rv;
 		}
 	}
-	if (!prop && xbps_array_count(sd.results)) {
-		print_results(xhp, &sd);
-		xbps_object_release(sd.results);
+	for (unsigned int i = 0; i < xbps_array_count(sd.lines); i++) {
+		xbps_array_get_cstring_nocopy(sd.lines, i, &line);
+		printf("%s\n", line);
 	}
+	if (!prop && xbps_array_count(sd.results))
+		print_results(xhp, &sd);
+	xbps_object_release(sd.results);
+	xbps_object_release(sd.lines);
 	if (regex)
 		regfree(&sd.regexp);
+	else
+		xbps_substr_free(sd.substr);
 
 	return rv;
 }
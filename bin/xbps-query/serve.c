@@ -0,0 +1,452 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <xbps.h>
+#include "defs.h"
+
+/*
+ * Query server: a single handle is initialized and kept warm (pkgdb,
+ * virtual packages, reverse dependencies and the repository pool),
+ * clients send one query per line with the same options and arguments
+ * accepted on the command line, separated by blanks; a backslash
+ * escapes the next character. The output of every query (stdout and
+ * stderr) is followed by a NUL byte, its exit status and a newline.
+ *
+ * The handle is reinitialized when pkgdb or any repodata archive
+ * in the pool changes.
+ *
+ * The batch mode answers the queries read from stdin with the same
+ * handle and framing, stderr is not redirected.
+ */
+#define QUERY_MAXARGS	64
+
+struct server {
+	struct xbps_handle xh;
+	struct query *q;
+	struct stat pkgdb_st[2];
+	int stdout_fd, stderr_fd;
+	bool ready, watch;
+};
+
+static volatile sig_atomic_t quit;
+
+static void
+sighandler(int sig UNUSED)
+{
+	quit = 1;
+}
+
+static void
+stamp_file(struct xbps_handle *xhp, const char *name, struct stat *st)
+{
+	char *path;
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, name);
+	if (stat(path, st) == -1)
+		memset(st, 0, sizeof(*st));
+	free(path);
+}
+
+static bool
+stamp_changed(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev != b->st_dev || a->st_ino != b->st_ino ||
+	    a->st_size != b->st_size ||
+	    a->st_mtim.tv_sec != b->st_mtim.tv_sec ||
+	    a->st_mtim.tv_nsec != b->st_mtim.tv_nsec;
+}
+
+static int
+warm_repo(struct xbps_repo *repo UNUSED, void *arg UNUSED, bool *done UNUSED)
+{
+	return 0;
+}
+
+static void
+server_release(struct server *srv)
+{
+	struct xbps_handle *xhp = &srv->xh;
+
+	if (!srv->ready)
+		return;
+
+	xbps_rpool_release(xhp);
+	xbps_end(xhp);
+	/* objects xbps_end() leaves behind to the process exit */
+	if (xhp->pkgdb_revdeps)
+		xbps_object_release(xhp->pkgdb_revdeps);
+	if (xhp->vpkgd)
+		xbps_object_release(xhp->vpkgd);
+	if (xhp->vpkgd_conf)
+		xbps_object_release(xhp->vpkgd_conf);
+	if (xhp->preserved_files)
+		xbps_object_release(xhp->preserved_files);
+	if (xhp->altlinks)
+		xbps_object_release(xhp->altlinks);
+	free(xhp->pkgdb_plist);
+	srv->ready = false;
+}
+
+static int
+server_load(struct server *srv)
+{
+	struct xbps_handle *xhp = &srv->xh;
+	int rv;
+
+	if ((rv = init_handle(xhp, srv->q)) != 0)
+		return rv;
+
+	srv->ready = true;
+	/*
+	 * Stamp pkgdb before reading it, a concurrent transaction
+	 * is then picked up by the next request.
+	 */
+	stamp_file(xhp, XBPS_PKGDB, &srv->pkgdb_st[0]);
+	stamp_file(xhp, XBPS_PKGDB_JOURNAL, &srv->pkgdb_st[1]);
+
+	(void)xbps_pkgdb_get_pkg_revdeps(xhp, "xbps");
+	(void)xbps_rpool_foreach(xhp, warm_repo, NULL);
+
+	return 0;
+}
+
+static bool
+server_changed(struct server *srv)
+{
+	struct xbps_handle *xhp = &srv->xh;
+	struct stat st;
+
+	stamp_file(xhp, XBPS_PKGDB, &st);
+	if (stamp_changed(&st, &srv->pkgdb_st[0]))
+		return true;
+	stamp_file(xhp, XBPS_PKGDB_JOURNAL, &st);
+	if (stamp_changed(&st, &srv->pkgdb_st[1]))
+		return true;
+
+	return xbps_rpool_changed(xhp);
+}
+
+static int
+split_args(char *line, char **argv)
+{
+	char *s, *d;
+	int argc = 1;
+
+	argv[0] = __UNCONST("xbps-query");
+
+	s = d = line;
+	for (;;) {
+		while (*s == ' ' || *s == '\t' || *s == '\n')
+			s++;
+		if (*s == '\0')
+			break;
+		if (argc == QUERY_MAXARGS)
+			return -1;
+		argv[argc++] = d;
+		while (*s && *s != ' ' && *s != '\t' && *s != '\n') {
+			if (*s == '\\' && s[1] != '\0')
+				s++;
+			*d++ = *s++;
+		}
+		if (*s != '\0')
+			s++;
+		*d++ = '\0';
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+static int
+serve_request(struct server *srv, int fd, char *line)
+{
+	struct query req;
+	char *argv[QUERY_MAXARGS + 1];
+	int argc, rv;
+
+	if (srv->ready && srv->watch && server_changed(srv)) {
+		xbps_dbg_printf(&srv->xh, "[serve] reloading handle\n");
+		server_release(srv);
+	}
+	if (!srv->ready && (rv = server_load(srv)) != 0)
+		return rv;
+
+	if ((argc = split_args(line, argv)) == -1)
+		return E2BIG;
+
+	fflush(stdout);
+	fflush(stderr);
+	if (fd != STDOUT_FILENO &&
+	    (dup2(fd, STDOUT_FILENO) == -1 || dup2(fd, STDERR_FILENO) == -1))
+		return errno;
+
+	memset(&req, 0, sizeof(req));
+	if ((rv = parse_query(argc, argv, &req, true)) == 0)
+		rv = run_query(&srv->xh, &req);
+
+	fflush(stdout);
+	fflush(stderr);
+	if (fd != STDOUT_FILENO) {
+		dup2(srv->stdout_fd, STDOUT_FILENO);
+		dup2(srv->stderr_fd, STDERR_FILENO);
+	}
+
+	return rv;
+}
+
+static int
+serve_stream(struct server *srv, FILE *fp, int fd)
+{
+	char *line = NULL, trailer[16];
+	size_t linesz = 0;
+	ssize_t len;
+	int rv = 0;
+
+	while (!quit && getline(&line, &linesz, fp) != -1) {
+		rv = serve_request(srv, fd, line);
+		/* the NUL byte cannot be part of the query output */
+		len = snprintf(trailer, sizeof(trailer), "%c%d\n", '\0', rv);
+		if (write(fd, trailer, len) != len) {
+			rv = errno;
+			break;
+		}
+		rv = 0;
+	}
+	free(line);
+	return rv;
+}
+
+static void
+serve_client(struct server *srv, int fd)
+{
+	FILE *fp;
+
+	if ((fp = fdopen(fd, "r")) == NULL) {
+		close(fd);
+		return;
+	}
+	(void)serve_stream(srv, fp, fd);
+	fclose(fp);
+}
+
+int
+query_serve(struct query *q, const char *sockpath)
+{
+	struct server srv;
+	struct sockaddr_un sun;
+	struct sigaction sa;
+	mode_t mask;
+	int sfd, cfd, rv;
+
+	memset(&srv, 0, sizeof(srv));
+	srv.q = q;
+	srv.watch = true;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(sun.sun_path)) {
+		xbps_error_printf("socket path `%s' is too long\n", sockpath);
+		return EXIT_FAILURE;
+	}
+	xbps_strlcpy(sun.sun_path, sockpath, sizeof(sun.sun_path));
+
+	if ((rv = server_load(&srv)) != 0)
+		return EXIT_FAILURE;
+
+	if ((srv.stdout_fd = dup(STDOUT_FILENO)) == -1 ||
+	    (srv.stderr_fd = dup(STDERR_FILENO)) == -1 ||
+	    (sfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1) {
+		xbps_error_printf("failed to create socket: %s\n",
+		    strerror(errno));
+		return EXIT_FAILURE;
+	}
+	(void)unlink(sockpath);
+	/* only the owner of the server can connect to it */
+	mask = umask(0077);
+	rv = bind(sfd, (struct sockaddr *)&sun, sizeof(sun));
+	(void)umask(mask);
+	if (rv == -1 || listen(sfd, SOMAXCONN) == -1) {
+		xbps_error_printf("failed to listen on `%s': %s\n",
+		    sockpath, strerror(errno));
+		close(sfd);
+		return EXIT_FAILURE;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+	/* no SA_RESTART: accept(2) and read(2) return on termination */
+	sa.sa_handler = sighandler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	xbps_dbg_printf(&srv.xh, "[serve] listening on %s\n", sockpath);
+
+	/* clients are served in order, queries share a single handle */
+	while (!quit) {
+		if ((cfd = accept(sfd, NULL, NULL)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			xbps_error_printf("accept failed: %s\n",
+			    strerror(errno));
+			break;
+		}
+		serve_client(&srv, cfd);
+	}
+
+	close(sfd);
+	(void)unlink(sockpath);
+	server_release(&srv);
+
+	return quit ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int
+query_batch(struct query *q)
+{
+	struct server srv;
+	int rv;
+
+	memset(&srv, 0, sizeof(srv));
+	srv.q = q;
+
+	if (server_load(&srv) != 0)
+		return EXIT_FAILURE;
+
+	rv = serve_stream(&srv, stdin, STDOUT_FILENO);
+	server_release(&srv);
+
+	return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int
+query_connect(const char *sockpath, int argc, char **argv)
+{
+	struct sockaddr_un sun;
+	char buf[BUFSIZ], status[16], *line = NULL, *end;
+	size_t len = 0, slen = 0, n;
+	ssize_t r;
+	long l;
+	int fd, i;
+	bool trailer = false;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(sun.sun_path)) {
+		xbps_error_printf("socket path `%s' is too long\n", sockpath);
+		return EXIT_FAILURE;
+	}
+	xbps_strlcpy(sun.sun_path, sockpath, sizeof(sun.sun_path));
+
+	/*
+	 * Forward the command line except --connect, escaping
+	 * blanks and backslashes.
+	 */
+	for (i = 1; i < argc; i++) {
+		const char *p;
+
+		if (strcmp(argv[i], "--connect") == 0) {
+			i++;
+			continue;
+		} else if (strncmp(argv[i], "--connect=", 10) == 0) {
+			continue;
+		}
+		line = realloc(line, len + strlen(argv[i]) * 2 + 2);
+		assert(line);
+		if (len)
+			line[len++] = ' ';
+		for (p = argv[i]; *p; p++) {
+			if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\\')
+				line[len++] = '\\';
+			line[len++] = *p;
+		}
+	}
+	line = realloc(line, len + 1);
+	assert(line);
+	line[len++] = '\n';
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1 ||
+	    connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		xbps_error_printf("failed to connect to `%s': %s\n",
+		    sockpath, strerror(errno));
+		free(line);
+		return EXIT_FAILURE;
+	}
+	if (write(fd, line, len) != (ssize_t)len) {
+		xbps_error_printf("failed to send query: %s\n",
+		    strerror(errno));
+		free(line);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	free(line);
+
+	/* copy the output until the NUL byte, then read the exit status */
+	while ((r = read(fd, buf, sizeof(buf))) > 0) {
+		for (n = 0; n < (size_t)r; n++) {
+			if (trailer) {
+				if (buf[n] == '\n')
+					goto status;
+				if (slen == sizeof(status) - 1)
+					goto invalid;
+				status[slen++] = buf[n];
+			} else if (buf[n] == '\0') {
+				fwrite(buf, 1, n, stdout);
+				trailer = true;
+			}
+		}
+		if (!trailer)
+			fwrite(buf, 1, r, stdout);
+	}
+	xbps_error_printf("connection to `%s' closed\n", sockpath);
+	close(fd);
+	return EXIT_FAILURE;
+
+status:
+	status[slen] = '\0';
+	errno = 0;
+	l = strtol(status, &end, 10);
+	if (slen > 0 && *end == '\0' && errno == 0 &&
+	    l >= INT_MIN && l <= INT_MAX) {
+		close(fd);
+		return (int)l;
+	}
+invalid:
+	xbps_error_printf("invalid exit status from `%s'\n", sockpath);
+	close(fd);
+	return EXIT_FAILURE;
+}
@@ -68,16 +68,22 @@ show_pkg_deps(struct xbps_handle *xhp, const char *pkgname, bool repomode, bool
 }
 
 int
-show_pkg_revdeps(struct xbps_handle *xhp, const char *pkg, bool repomode)
+show_pkg_revdeps(struct xbps_handle *xhp, const char *pkg, bool repomode,
+		bool full)
 {
 	xbps_array_t revdeps;
 	const char *pkgdep;
 
-	if (repomode)
+	if (full) {
+		if (repomode)
+			revdeps = xbps_rpool_get_pkg_fullrevdeptree(xhp, pkg);
+		else
+			revdeps = xbps_pkgdb_get_pkg_fullrevdeptree(xhp, pkg);
+	} else if (repomode) {
 		revdeps = xbps_rpool_get_pkg_revdeps(xhp, pkg);
-	else
+	} else {
 		revdeps = xbps_pkgdb_get_pkg_revdeps(xhp, pkg);
-
+	}
 	if (revdeps == NULL)
 		return ENOENT;
 
@@ -85,6 +91,8 @@ show_pkg_revdeps(struct xbps_handle *xhp, const char *pkg, bool repomode)
 		xbps_array_get_cstring_nocopy(revdeps, i, &pkgdep);
 		printf("%s\n", pkgdep);
 	}
-	xbps_object_release(revdeps);
+	/* the pkgdb array belongs to the revdeps table */
+	if (repomode || full)
+		xbps_object_release(revdeps);
 	return 0;
 }
@@ -264,17 +264,35 @@ show_pkg_info_from_metadir(struct xbps_handle *xhp,
 	return 0;
 }
 
+static int
+show_pkg_file_cb(struct xbps_handle *xhp UNUSED, const char *pkgver UNUSED,
+		const char *file, const char *target, const char *type UNUSED,
+		void *arg UNUSED)
+{
+	if (target != NULL)
+		printf("%s -> %s\n", file, target);
+	else
+		printf("%s\n", file);
+
+	return 0;
+}
+
 int
 show_pkg_files_from_metadir(struct xbps_handle *xhp, const char *pkg)
 {
 	xbps_dictionary_t d;
 	int rv = 0;
 
+	/* the files index is enough, if it's up to date */
+	if (xbps_pkgdb_pkg_files_foreach(xhp, pkg, show_pkg_file_cb, NULL) == 0)
+		return 0;
+
 	d = xbps_pkgdb_get_pkg_files(xhp, pkg);
 	if (d == NULL)
 		return ENOENT;
 
 	rv = show_pkg_files(d);
+	xbps_object_release(d);
 
 	return rv;
 }
@@ -322,9 +340,24 @@ repo_cat_file(struct xbps_handle *xhp, const char *pkg, const char *file)
 int
 repo_show_pkg_files(struct xbps_handle *xhp, const char *pkg)
 {
-	xbps_dictionary_t pkgd;
+	xbps_dictionary_t pkgd, files;
+	struct xbps_repo *repo;
+	const char *repourl = NULL, *pkgver = NULL;
 	int rv;
 
+	/*
+	 * Look up the files of the package in the files index of its
+	 * repository, if any, rather than in its binary package.
+	 */
+	if (((pkgd = xbps_rpool_get_pkg(xhp, pkg)) ||
+	    (pkgd = xbps_rpool_get_virtualpkg(xhp, pkg))) &&
+	    xbps_dictionary_get_cstring_nocopy(pkgd, "repository", &repourl) &&
+	    xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) &&
+	    (repo = xbps_rpool_get_repo(repourl)) &&
+	    (files = xbps_repo_get_files(repo)) &&
+	    (pkgd = xbps_dictionary_get(files, pkgver)))
+		return show_pkg_files(pkgd);
+
 	pkgd = xbps_rpool_get_pkg_plist(xhp, pkg, "/files.plist");
 	if (pkgd == NULL) {
                 if (errno != ENOTSUP && errno != ENOENT) {
@@ -45,6 +45,7 @@ usage(bool fail)
 	    " -f --force          Force reconfiguration\n"
 	    " -h --help           Print usage help\n"
 	    " -i --ignore PKG     Ignore PKG with -a/--all\n"
+	    " -j --jobs N         Configure up to N packages in parallel with -a/--all\n"
 	    " -r --rootdir <dir>  Full path to rootdir\n"
 	    " -v --verbose        Verbose messages\n"
 	    " -V --version        Show XBPS version\n");
@@ -74,8 +75,14 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbd UNUSED)
 			syslog(LOG_NOTICE,
 			    "%s: configured successfully.", xscd->arg);
 		break;
+	case XBPS_STATE_TRIGGER:
+		printf("%s: running trigger ...\n", xscd->arg);
+		if (slog)
+			syslog(LOG_NOTICE, "%s: running trigger ...", xscd->arg);
+		break;
 	/* errors */
 	case XBPS_STATE_CONFIGURE_FAIL:
+	case XBPS_STATE_TRIGGER_FAIL:
 		xbps_error_printf("%s\n", xscd->desc);
 		if (slog)
 			syslog(LOG_ERR, "%s", xscd->desc);
@@ -90,7 +97,7 @@ state_cb(const struct xbps_state_cb_data *xscd, void *cbd UNUSED)
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "aC:dfhi:r:Vv";
+	const char *shortopts = "aC:dfhi:j:r:Vv";
 	const struct option longopts[] = {
 		{ "all", no_argument, NULL, 'a' },
 		{ "config", required_argument, NULL, 'C' },
@@ -98,6 +105,7 @@ main(int argc, char **argv)
 		{ "force", no_argument, NULL, 'f' },
 		{ "help", no_argument, NULL, 'h' },
 		{ "ignore", required_argument, NULL, 'i' },
+		{ "jobs", required_argument, NULL, 'j' },
 		{ "rootdir", required_argument, NULL, 'r' },
 		{ "verbose", no_argument, NULL, 'v' },
 		{ "version", no_argument, NULL, 'V' },
@@ -106,6 +114,7 @@ main(int argc, char **argv)
 	struct xbps_handle xh;
 	const char *confdir = NULL, *rootdir = NULL;
 	int c, i, rv, flags = 0;
+	unsigned int jobs = 1;
 	bool all = false;
 	xbps_array_t ignpkgs = NULL;
 
@@ -132,6 +141,11 @@ main(int argc, char **argv)
 
 			xbps_array_add_cstring_nocopy(ignpkgs, optarg);
 			break;
+		case 'j':
+			jobs = (unsigned int)strtoul(optarg, NULL, 10);
+			if (jobs == 0)
+				usage(true);
+			break;
 		case 'r':
 			rootdir = optarg;
 			break;
@@ -171,7 +185,7 @@ main(int argc, char **argv)
 	}
 
 	if (all) {
-		rv = xbps_configure_packages(&xh, ignpkgs);
+		rv = xbps_configure_packages_jobs(&xh, ignpkgs, jobs);
 	} else {
 		for (i = optind; i < argc; i++) {
 			rv = xbps_configure_pkg(&xh, argv[i], true, false);
@@ -23,6 +23,7 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -32,25 +33,99 @@
 #include <assert.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include <xbps.h>
 #include "defs.h"
 
+/*
+ * The binary packages of all repositories are indexed once by their
+ * file name (<pkgver>.<arch>.xbps), the first repository wins as in
+ * xbps_rpool_get_pkg(). Every file in cachedir is then looked up in
+ * the index, files of known packages whose size or hash don't match
+ * are removed too. The kept packages are recorded with their last use
+ * time before they are read to check the hash.
+ */
+struct lru_entry {
+	const char *binpkg;
+	off_t size;
+	time_t used;
+};
+
+struct cleaner {
+	xbps_dictionary_t binpkgs;
+	struct lru_entry *kept;
+	unsigned int nkept;
+	unsigned int keptsz;
+	pthread_mutex_t lock;
+	bool drun;
+};
+
+static int
+index_repo_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
+{
+	struct cleaner *cl = arg;
+	xbps_dictionary_t idx;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	if ((idx = xbps_repo_get_index(repo)) == NULL)
+		return 0;
+
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_dictionary_t pkgd;
+		const char *pkgver, *arch;
+		char *binpkg;
+
+		pkgd = xbps_dictionary_get_keysym(idx, obj);
+		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) ||
+		    !xbps_dictionary_get_cstring_nocopy(pkgd, "architecture", &arch))
+			continue;
+		binpkg = xbps_xasprintf("%s.%s.xbps", pkgver, arch);
+		if (xbps_dictionary_get(cl->binpkgs, binpkg) == NULL)
+			xbps_dictionary_set(cl->binpkgs, binpkg, pkgd);
+		free(binpkg);
+	}
+	xbps_object_iterator_release(iter);
+	return 0;
+}
+
+static void
+remove_binpkg(const char *binpkg, const char *reason, bool drun)
+{
+	char *binpkgsig;
+
+	binpkgsig = xbps_xasprintf("%s.sig", binpkg);
+	if (!drun && unlink(binpkg) == -1) {
+		fprintf(stderr, "Failed to remove `%s': %s\n",
+		    binpkg, strerror(errno));
+	} else {
+		printf("Removed %s from cachedir (%s)\n", binpkg, reason);
+	}
+	if (!drun && unlink(binpkgsig) == -1) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "Failed to remove `%s': %s\n",
+			    binpkgsig, strerror(errno));
+		}
+	}
+	free(binpkgsig);
+}
+
 static int
 cleaner_cb(struct xbps_handle *xhp, xbps_object_t obj,
 		const char *key UNUSED, void *arg,
 		bool *done UNUSED)
 {
+	struct cleaner *cl = arg;
+	struct stat st;
 	xbps_dictionary_t repo_pkgd;
 	const char *binpkg, *rsha256;
-	char *binpkgsig, *pkgver, *arch;
-	bool drun = false;
+	char *arch;
+	uint64_t rsize;
 
-	/* Extract drun (dry-run) flag from arg*/
-	if (arg != NULL)
-		drun = *(bool*)arg;
-
-	/* Internalize props.plist dictionary from binary pkg */
 	binpkg = xbps_string_cstring_nocopy(obj);
 	arch = xbps_binpkg_arch(binpkg);
 	assert(arch);
@@ -63,41 +138,69 @@ cleaner_cb(struct xbps_handle *xhp, xbps_object_t obj,
 	free(arch);
 	/*
 	 * Remove binary pkg if it's not registered in any repository
-	 * or if hash doesn't match.
+	 * or if its size or hash don't match.
 	 */
-	pkgver = xbps_binpkg_pkgver(binpkg);
-	assert(pkgver);
-	repo_pkgd = xbps_rpool_get_pkg(xhp, pkgver);
-	free(pkgver);
-	if (repo_pkgd) {
-		xbps_dictionary_get_cstring_nocopy(repo_pkgd,
-		    "filename-sha256", &rsha256);
-		if (xbps_file_hash_check(binpkg, rsha256) == 0) {
-			/* hash matched */
-			return 0;
-		}
-	}
-	binpkgsig = xbps_xasprintf("%s.sig", binpkg);
-	if (!drun && unlink(binpkg) == -1) {
-		fprintf(stderr, "Failed to remove `%s': %s\n",
-		    binpkg, strerror(errno));
-	} else {
-		printf("Removed %s from cachedir (obsolete)\n", binpkg);
+	repo_pkgd = xbps_dictionary_get(cl->binpkgs, binpkg);
+	if (repo_pkgd == NULL || stat(binpkg, &st) == -1 ||
+	    (xbps_dictionary_get_uint64(repo_pkgd, "filename-size", &rsize) &&
+	    rsize != (uint64_t)st.st_size) ||
+	    !xbps_dictionary_get_cstring_nocopy(repo_pkgd,
+	    "filename-sha256", &rsha256) ||
+	    xbps_file_hash_check_handle(xhp, binpkg, rsha256) != 0) {
+		remove_binpkg(binpkg, "obsolete", cl->drun);
+		return 0;
 	}
-	if (!drun && unlink(binpkgsig) == -1) {
-		if (errno != ENOENT) {
-			fprintf(stderr, "Failed to remove `%s': %s\n",
-			    binpkgsig, strerror(errno));
-		}
+	/* hash matched */
+	pthread_mutex_lock(&cl->lock);
+	if (cl->nkept == cl->keptsz) {
+		cl->keptsz = cl->keptsz ? cl->keptsz * 2 : 256;
+		cl->kept = realloc(cl->kept, cl->keptsz * sizeof(*cl->kept));
+		assert(cl->kept);
 	}
-	free(binpkgsig);
+	cl->kept[cl->nkept].binpkg = binpkg;
+	cl->kept[cl->nkept].size = st.st_size;
+	cl->kept[cl->nkept].used = st.st_atime > st.st_mtime ?
+	    st.st_atime : st.st_mtime;
+	cl->nkept++;
+	pthread_mutex_unlock(&cl->lock);
 
 	return 0;
 }
 
+static int
+lru_cmp(const void *a, const void *b)
+{
+	const struct lru_entry *ea = a, *eb = b;
+
+	if (ea->used != eb->used)
+		return ea->used < eb->used ? -1 : 1;
+	return strcmp(ea->binpkg, eb->binpkg);
+}
+
+/*
+ * Removes the least recently used binary packages (by access time, or
+ * modification time if it's newer) until the cachedir fits in budget.
+ */
+static void
+evict_lru(struct cleaner *cl, uint64_t budget)
+{
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < cl->nkept; i++)
+		total += (uint64_t)cl->kept[i].size;
+
+	qsort(cl->kept, cl->nkept, sizeof(*cl->kept), lru_cmp);
+	for (unsigned int i = 0; i < cl->nkept && total > budget; i++) {
+		remove_binpkg(cl->kept[i].binpkg, "least recently used",
+		    cl->drun);
+		total -= (uint64_t)cl->kept[i].size;
+	}
+}
+
 int
-clean_cachedir(struct xbps_handle *xhp, bool drun)
+clean_cachedir(struct xbps_handle *xhp, bool drun, uint64_t budget)
 {
+	struct cleaner cl;
 	xbps_array_t array = NULL;
 	DIR *dirp;
 	struct dirent *dp;
@@ -127,9 +230,27 @@ clean_cachedir(struct xbps_handle *xhp, bool drun)
 	}
 	(void)closedir(dirp);
 
-	if (xbps_array_count(array)) {
-		rv = xbps_array_foreach_cb_multi(xhp, array, NULL, cleaner_cb, (void*)&drun);
+	if (xbps_array_count(array) == 0) {
 		xbps_object_release(array);
+		return 0;
 	}
+	memset(&cl, 0, sizeof(cl));
+	cl.drun = drun;
+	cl.binpkgs = xbps_dictionary_create_hashed(0);
+	assert(cl.binpkgs);
+	pthread_mutex_init(&cl.lock, NULL);
+
+	if ((rv = xbps_rpool_foreach(xhp, index_repo_cb, &cl)) == 0 ||
+	    rv == ENOTSUP) {
+		rv = xbps_array_foreach_cb_multi(xhp, array, NULL,
+		    cleaner_cb, &cl);
+		if (rv == 0 && budget)
+			evict_lru(&cl, budget);
+	}
+	pthread_mutex_destroy(&cl.lock);
+	free(cl.kept);
+	xbps_object_release(cl.binpkgs);
+	xbps_object_release(array);
+
 	return rv;
 }
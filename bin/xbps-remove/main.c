@@ -45,6 +45,9 @@ usage(bool fail)
 	fprintf(stdout,
 	    "Usage: xbps-remove [OPTIONS] [PKGNAME...]\n\n"
 	    "OPTIONS\n"
+	    " -B --cache-budget <size> With -O, also remove the least recently used\n"
+	    "                          packages until cachedir fits in size bytes\n"
+	    "                          (K, M, G and T suffixes are accepted)\n"
 	    " -C --config <dir>        Path to confdir (xbps.d)\n"
 	    " -c --cachedir <dir>      Path to cachedir\n"
 	    " -d --debug               Debug mode shown to stderr\n"
@@ -63,6 +66,36 @@ usage(bool fail)
 	exit(fail ? EXIT_FAILURE : EXIT_SUCCESS);
 }
 
+static uint64_t
+parse_size(const char *str)
+{
+	unsigned long long size;
+	char *end;
+
+	errno = 0;
+	size = strtoull(str, &end, 10);
+	if (errno || end == str)
+		return 0;
+	switch (*end) {
+	case 'T': case 't':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'G': case 'g':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'M': case 'm':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'K': case 'k':
+		size *= 1024;
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		return 0;
+	return size;
+}
+
 static int
 state_cb_rm(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 {
@@ -78,6 +111,12 @@ state_cb_rm(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 	case XBPS_STATE_REMOVE:
 		printf("Removing `%s' ...\n", xscd->arg);
 		break;
+	case XBPS_STATE_TRANS_REVDEPS:
+		xbps_dbg_printf(xscd->xhp, "%s\n", xscd->desc);
+		break;
+	case XBPS_STATE_TRIGGER:
+		printf("Running trigger `%s' ...\n", xscd->arg);
+		break;
 	/* success */
 	case XBPS_STATE_REMOVE_FILE:
 	case XBPS_STATE_REMOVE_FILE_OBSOLETE:
@@ -100,6 +139,7 @@ state_cb_rm(const struct xbps_state_cb_data *xscd, void *cbdata UNUSED)
 		break;
 	/* errors */
 	case XBPS_STATE_REMOVE_FAIL:
+	case XBPS_STATE_TRIGGER_FAIL:
 		xbps_error_printf("%s\n", xscd->desc);
 		if (slog) {
 			syslog(LOG_ERR, "%s", xscd->desc);
@@ -158,8 +198,9 @@ remove_pkg(struct xbps_handle *xhp, const char *pkgname, bool recursive)
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "C:c:dFfhnOoRr:vVy";
+	const char *shortopts = "B:C:c:dFfhnOoRr:vVy";
 	const struct option longopts[] = {
+		{ "cache-budget", required_argument, NULL, 'B' },
 		{ "config", required_argument, NULL, 'C' },
 		{ "cachedir", required_argument, NULL, 'c' },
 		{ "debug", no_argument, NULL, 'd' },
@@ -178,6 +219,7 @@ main(int argc, char **argv)
 	};
 	struct xbps_handle xh;
 	const char *rootdir, *cachedir, *confdir;
+	uint64_t budget = 0;
 	int c, flags, rv;
 	bool yes, drun, recursive, clean_cache, orphans;
 	int maxcols;
@@ -188,6 +230,10 @@ main(int argc, char **argv)
 
 	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
 		switch (c) {
+		case 'B':
+			if ((budget = parse_size(optarg)) == 0)
+				usage(true);
+			break;
 		case 'C':
 			confdir = optarg;
 			break;
@@ -262,7 +308,7 @@ main(int argc, char **argv)
 	maxcols = get_maxcols();
 
 	if (clean_cache) {
-		rv = clean_cachedir(&xh, drun);
+		rv = clean_cachedir(&xh, drun, budget);
 		if (!orphans || rv)
 			exit(rv);;
 	}
@@ -292,7 +338,7 @@ main(int argc, char **argv)
 		}
 	}
 	if (orphans || (argc > optind)) {
-		rv = exec_transaction(&xh, maxcols, yes, drun);
+		rv = exec_transaction(&xh, maxcols, yes, drun, NULL);
 	}
 	xbps_end(&xh);
 	exit(rv);
@@ -64,24 +64,35 @@
 #define __UNCONST(a)    ((void *)(unsigned long)(const void *)(a))
 #endif
 
+#ifndef __arraycount
+# define __arraycount(a) (sizeof(a) / sizeof(*(a)))
+#endif
+
 #define _XBPS_RINDEX		"xbps-rindex"
 
 /* From index-add.c */
-int	index_add(struct xbps_handle *, int, int, char **, bool);
+int	index_add(struct xbps_handle *, int, int, char **, bool, bool, bool,
+		bool, bool, const char *);
 
 /* From index-clean.c */
-int	index_clean(struct xbps_handle *, const char *, bool);
+int	index_clean(struct xbps_handle *, const char *, bool, const char *);
+int	index_clean_archs(struct xbps_handle *, const char *, bool,
+		const char *);
 
 /* From remove-obsoletes.c */
-int	remove_obsoletes(struct xbps_handle *, const char *);
+int	remove_obsoletes(struct xbps_handle *, const char *, bool);
 
 /* From sign.c */
 int	sign_repo(struct xbps_handle *, const char *, const char *,
-		const char *);
+		const char *, const char *);
 int	sign_pkgs(struct xbps_handle *, int, int, char **, const char *, bool);
 
 /* From repoflush.c */
 bool	repodata_flush(struct xbps_handle *, const char *, const char *,
-		xbps_dictionary_t, xbps_dictionary_t);
+		xbps_dictionary_t, xbps_dictionary_t, xbps_dictionary_t,
+		const char *);
+bool	repofiles_flush(struct xbps_handle *, const char *, xbps_dictionary_t,
+		xbps_dictionary_t, xbps_dictionary_t, const char *);
+void	repodata_archs(const char *, xbps_dictionary_t);
 
 #endif /* !_XBPS_RINDEX_DEFS_H_ */
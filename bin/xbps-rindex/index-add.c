@@ -27,12 +27,15 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
 #include <libgen.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <xbps.h>
 #include "defs.h"
@@ -54,19 +57,448 @@ set_build_date(const xbps_dictionary_t pkgd, time_t timestamp)
 	return 0;
 }
 
+/*
+ * Adds additional objects for repository ops:
+ * 	- filename-size
+ * 	- filename-sha256
+ * 	- build-date
+ */
+static int
+set_binpkg_file(const xbps_dictionary_t binpkgd, const char *pkg)
+{
+	struct stat st;
+	char *sha256;
+
+	if ((sha256 = xbps_file_hash(pkg)) == NULL)
+		return EINVAL;
+	if (!xbps_dictionary_set_cstring(binpkgd, "filename-sha256", sha256)) {
+		free(sha256);
+		return EINVAL;
+	}
+	free(sha256);
+	if (stat(pkg, &st) == -1)
+		return EINVAL;
+	if (!xbps_dictionary_set_uint64(binpkgd, "filename-size", (uint64_t)st.st_size))
+		return EINVAL;
+	if (set_build_date(binpkgd, st.st_mtime) < 0)
+		return EINVAL;
+	return 0;
+}
+
+/*
+ * The index of an architecture of the repository. The add mode updates
+ * the index of the target architecture, or the indexes of all archs in
+ * the repository with --all-archs; each one has a copy of the handle
+ * with its target_arch.
+ */
+struct IndexArch {
+	struct xbps_handle xh;
+	struct xbps_repo *repo, *stage;
+	xbps_dictionary_t idx, idxmeta, idxstage, idxshlibs, idxfiles;
+	xbps_dictionary_t spooled;
+	char *queuefile, *spooldir, *rlockfname;
+	int rlockfd;
+};
+
+struct IndexAddCbInfo {
+	struct IndexArch *archs;
+	unsigned int narchs;
+	bool force;
+};
+
+/*
+ * Returns true if pkgver is registered in the index or stage of the
+ * arch with the same or a greater version.
+ */
+static bool
+index_arch_has_pkg(struct IndexArch *ia, xbps_dictionary_t binpkgd,
+		const char *pkgver)
+{
+	xbps_dictionary_t curpkgd;
+	const char *opkgver = NULL;
+	char *pkgname;
+
+	if ((pkgname = xbps_pkg_name(pkgver)) == NULL)
+		return false;
+	curpkgd = xbps_dictionary_get(ia->idxstage, pkgname);
+	if (curpkgd == NULL)
+		curpkgd = xbps_dictionary_get(ia->idx, pkgname);
+	free(pkgname);
+
+	return curpkgd != NULL &&
+	    xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &opkgver) &&
+	    xbps_cmpver(pkgver, opkgver) <= 0 &&
+	    !xbps_pkg_reverts(binpkgd, opkgver);
+}
+
+/*
+ * Reads the metadata of a binary package and hashes it. Run by multiple
+ * threads before the packages are added to the indexes in order, it
+ * doesn't hash packages that are already registered with the same or a
+ * greater version in all indexes of their arch.
+ */
+static int
+index_read_cb(struct xbps_handle *xhp UNUSED,
+		xbps_object_t obj,
+		const char *key UNUSED,
+		void *arg,
+		bool *done UNUSED)
+{
+	struct IndexAddCbInfo *info = arg;
+	xbps_dictionary_t binpkgd;
+	const char *pkg, *arch = NULL, *pkgver = NULL;
+	bool needed = false;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "file", &pkg);
+	binpkgd = xbps_archive_fetch_plist(pkg, "/props.plist");
+	if (binpkgd == NULL)
+		return 0;
+	xbps_dictionary_set(obj, "props", binpkgd);
+	xbps_object_release(binpkgd);
+
+	xbps_dictionary_get_cstring_nocopy(binpkgd, "architecture", &arch);
+	xbps_dictionary_get_cstring_nocopy(binpkgd, "pkgver", &pkgver);
+	if (pkgver == NULL)
+		return 0;
+	for (unsigned int i = 0; i < info->narchs && !needed; i++) {
+		struct IndexArch *ia = &info->archs[i];
+
+		if (!xbps_pkg_arch_match(&ia->xh, arch, NULL))
+			continue;
+		if (info->force || !index_arch_has_pkg(ia, binpkgd, pkgver))
+			needed = true;
+	}
+	if (needed && set_binpkg_file(binpkgd, pkg) == 0)
+		xbps_dictionary_set_bool(obj, "hashed", true);
+	return 0;
+}
+
+/*
+ * Creates a delta to rebuild binary package \a pkg from the previous
+ * version registered in the index, if its binary package is still
+ * available in \a repodir and the delta is smaller than \a pkg.
+ */
+static int
+add_delta(xbps_dictionary_t binpkgd, xbps_dictionary_t curpkgd,
+	const char *repodir, const char *pkg, off_t pkgsize)
+{
+	struct stat st;
+	const char *pkgver, *arch, *opkgver, *oarch;
+	char *oldfile, *deltafile, *sha256;
+	int rv = 0;
+
+	xbps_dictionary_get_cstring_nocopy(binpkgd, "pkgver", &pkgver);
+	xbps_dictionary_get_cstring_nocopy(binpkgd, "architecture", &arch);
+	xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &opkgver);
+	xbps_dictionary_get_cstring_nocopy(curpkgd, "architecture", &oarch);
+
+	deltafile = xbps_xasprintf("%s/%s.%s.xdlt", repodir, pkgver, arch);
+	(void)unlink(deltafile);
+	if (strcmp(pkgver, opkgver) == 0) {
+		free(deltafile);
+		return 0;
+	}
+	oldfile = xbps_xasprintf("%s/%s.%s.xbps", repodir, opkgver, oarch);
+	if (access(oldfile, R_OK) == -1)
+		goto out;
+
+	if ((rv = xbps_delta_create(oldfile, pkg, deltafile)) != 0) {
+		fprintf(stderr, "index: failed to create delta for `%s': %s\n",
+		    pkgver, strerror(rv));
+		goto out;
+	}
+	if (stat(deltafile, &st) == -1 || st.st_size >= pkgsize) {
+		(void)unlink(deltafile);
+		goto out;
+	}
+	if ((sha256 = xbps_file_hash(deltafile)) == NULL) {
+		rv = errno;
+		(void)unlink(deltafile);
+		goto out;
+	}
+	xbps_dictionary_set_cstring(binpkgd, "delta-base", opkgver);
+	xbps_dictionary_set_cstring(binpkgd, "delta-sha256", sha256);
+	xbps_dictionary_set_uint64(binpkgd, "delta-size", (uint64_t)st.st_size);
+	free(sha256);
+	printf("index: created delta for `%s' from `%s' (%jd bytes).\n",
+	    pkgver, opkgver, (intmax_t)st.st_size);
+out:
+	free(oldfile);
+	free(deltafile);
+
+	return rv;
+}
+
+/*
+ * Adds the delta of a binary package, whose metadata is \a pkgd, to the
+ * dictionary of its index. noarch packages are in the index of every
+ * arch, their delta from the same base is only created once.
+ */
+static int
+index_delta(xbps_dictionary_t pkgd, xbps_dictionary_t binpkgd,
+	xbps_dictionary_t curpkgd, const char *repodir, const char *pkg,
+	off_t pkgsize)
+{
+	const char *keys[] = { "delta-base", "delta-sha256", "delta-size" };
+	const char *opkgver = NULL, *checked = NULL;
+	xbps_object_t obj;
+	int rv;
+
+	xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &opkgver);
+	if (opkgver &&
+	    xbps_dictionary_get_cstring_nocopy(pkgd, "delta-checked", &checked) &&
+	    strcmp(opkgver, checked) == 0) {
+		for (unsigned int i = 0; i < __arraycount(keys); i++) {
+			if ((obj = xbps_dictionary_get(pkgd, keys[i])))
+				xbps_dictionary_set(binpkgd, keys[i], obj);
+		}
+		return 0;
+	}
+	if ((rv = add_delta(binpkgd, curpkgd, repodir, pkg, pkgsize)) != 0)
+		return rv;
+	if (opkgver == NULL)
+		return 0;
+	xbps_dictionary_set_cstring(pkgd, "delta-checked", opkgver);
+	for (unsigned int i = 0; i < __arraycount(keys); i++) {
+		if ((obj = xbps_dictionary_get(binpkgd, keys[i])))
+			xbps_dictionary_set(pkgd, keys[i], obj);
+	}
+	return 0;
+}
+
+/*
+ * Appends the binary packages to the queue of the repository, they are
+ * registered by the next add mode run without reading its index now.
+ */
+static int
+index_queue(const char *queuefile, int args, int argmax, char **argv)
+{
+	FILE *fp;
+	char path[PATH_MAX];
+	int rv = 0;
+
+	if ((fp = fopen(queuefile, "a")) == NULL) {
+		rv = errno;
+		fprintf(stderr, "index: cannot open queue %s: %s\n",
+		    queuefile, strerror(rv));
+		return rv;
+	}
+	for (int i = args; i < argmax; i++) {
+		if (realpath(argv[i], path) == NULL) {
+			rv = errno;
+			fprintf(stderr, "index: cannot queue `%s': %s\n",
+			    argv[i], strerror(rv));
+			break;
+		}
+		fprintf(fp, "%s\n", path);
+		printf("index: queued `%s'.\n", argv[i]);
+	}
+	if (fclose(fp) != 0 && rv == 0) {
+		rv = errno;
+		fprintf(stderr, "index: cannot write queue %s: %s\n",
+		    queuefile, strerror(rv));
+	}
+	return rv;
+}
+
+/*
+ * Adds the binary packages in the queue of the repository to pkgs.
+ */
+static void
+index_queue_read(const char *queuefile, xbps_array_t pkgs)
+{
+	xbps_dictionary_t pkgd;
+	FILE *fp;
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+
+	if ((fp = fopen(queuefile, "r")) == NULL)
+		return;
+
+	while ((len = getline(&line, &linesz, fp)) != -1) {
+		if (len > 0 && line[len-1] == '\n')
+			line[--len] = '\0';
+		if (len == 0)
+			continue;
+		pkgd = xbps_dictionary_create();
+		assert(pkgd);
+		xbps_dictionary_set_cstring(pkgd, "file", line);
+		xbps_array_add(pkgs, pkgd);
+		xbps_object_release(pkgd);
+	}
+	free(line);
+	fclose(fp);
+}
+
+/*
+ * Concurrent add mode runs are committed at once: a run that finds the
+ * repository locked spools its packages in <arch>-repodata.spool and
+ * waits for the lock, the run holding it registers the spooled packages
+ * with its own and removes their entries before writing the repodata.
+ * If its entry is still there once the waiter gets the lock (the holder
+ * failed, or didn't add packages), the waiter registers them itself.
+ */
+static int
+index_spool(struct IndexArch *ia, const char *repodir, int args, int argmax,
+	char **argv, bool *done)
+{
+	struct stat st;
+	char *tmpfile, *spoolfile;
+	int rv = 0;
+
+	*done = false;
+	if (mkdir(ia->spooldir, 0755) == -1 && errno != EEXIST) {
+		rv = errno;
+		fprintf(stderr, "index: cannot create spool %s: %s\n",
+		    ia->spooldir, strerror(rv));
+		return rv;
+	}
+	tmpfile = xbps_xasprintf("%s/.%ld", ia->spooldir, (long)getpid());
+	spoolfile = xbps_xasprintf("%s/%ld", ia->spooldir, (long)getpid());
+	(void)unlink(tmpfile);
+	if ((rv = index_queue(tmpfile, args, argmax, argv)) == 0 &&
+	    rename(tmpfile, spoolfile) == -1) {
+		rv = errno;
+		fprintf(stderr, "index: cannot spool %s: %s\n",
+		    spoolfile, strerror(rv));
+	}
+	if (rv != 0) {
+		(void)unlink(tmpfile);
+		goto out;
+	}
+	while (!xbps_repo_trylock(&ia->xh, repodir, &ia->rlockfd,
+	    &ia->rlockfname)) {
+		if (errno != EEXIST) {
+			rv = errno;
+			fprintf(stderr, "xbps-rindex: cannot lock repository "
+			    "%s: %s\n", repodir, strerror(rv));
+			goto out;
+		}
+		sleep(1);
+	}
+	if (stat(spoolfile, &st) == -1 && errno == ENOENT) {
+		printf("index: registered by a concurrent xbps-rindex run.\n");
+		*done = true;
+	} else {
+		(void)unlink(spoolfile);
+	}
+out:
+	free(tmpfile);
+	free(spoolfile);
+	return rv;
+}
+
+/*
+ * Adds the packages spooled by concurrent runs to pkgs, the entries
+ * read are removed once the repodata is written.
+ */
+static void
+index_spool_read(struct IndexArch *ia, xbps_array_t pkgs)
+{
+	struct dirent *dp;
+	DIR *dirp;
+	char *path;
+
+	if ((dirp = opendir(ia->spooldir)) == NULL)
+		return;
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_name[0] == '.' ||
+		    xbps_dictionary_get(ia->spooled, dp->d_name) != NULL)
+			continue;
+		path = xbps_xasprintf("%s/%s", ia->spooldir, dp->d_name);
+		index_queue_read(path, pkgs);
+		free(path);
+		xbps_dictionary_set_bool(ia->spooled, dp->d_name, true);
+	}
+	closedir(dirp);
+}
+
+static void
+index_spool_remove(struct IndexArch *ia)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	char *path;
+
+	if ((iter = xbps_dictionary_iterator(ia->spooled)) == NULL)
+		return;
+	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
+		path = xbps_xasprintf("%s/%s", ia->spooldir,
+		    xbps_dictionary_keysym_cstring_nocopy(obj));
+		(void)unlink(path);
+		free(path);
+	}
+	xbps_object_iterator_release(iter);
+}
+
+/*
+ * Returns true if shlib is provided by a package of the index that
+ * is not replaced by the stage.
+ */
+static bool
+shlib_provided(xbps_dictionary_t stage, xbps_dictionary_t provides,
+	const char *shlib)
+{
+	xbps_array_t pkgs;
+	const char *pkgname;
+
+	pkgs = xbps_dictionary_get(provides, shlib);
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_get_cstring_nocopy(pkgs, i, &pkgname);
+		if (xbps_dictionary_get(stage, pkgname) == NULL)
+			return true;
+	}
+	return false;
+}
+
+static void
+shlib_users(xbps_dictionary_t stage, xbps_array_t pkgs, bool staged,
+	xbps_array_t *users)
+{
+	const char *pkgname;
+
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_get_cstring_nocopy(pkgs, i, &pkgname);
+		if (!staged && xbps_dictionary_get(stage, pkgname))
+			continue;
+		if (*users == NULL) {
+			*users = xbps_array_create();
+			assert(*users);
+		}
+		xbps_array_add_cstring(*users, pkgname);
+	}
+}
+
+/*
+ * Merges the stage into the index, unless the staged packages stop
+ * providing sonames still required by other packages: the stage is
+ * kept in the stagedata file then. The providers and users of the
+ * sonames are looked up in the shared libraries tables of the index
+ * and stage, the table of the index is updated with the merge.
+ */
 static bool
 repodata_commit(struct xbps_handle *xhp, const char *repodir,
-	xbps_dictionary_t idx, xbps_dictionary_t meta, xbps_dictionary_t stage) {
+	xbps_dictionary_t idx, xbps_dictionary_t meta, xbps_dictionary_t shlibs,
+	xbps_dictionary_t stage, const char *compression) {
 	xbps_object_iterator_t iter;
 	xbps_object_t keysym;
 	int rv;
-	xbps_dictionary_t oldshlibs, usedshlibs;
+	xbps_dictionary_t oldshlibs, usedshlibs, stageshlibs;
+	xbps_dictionary_t provides, requires, sprovides, srequires;
 
 	if (xbps_dictionary_count(stage) == 0) {
 		// Nothing to do.
 		return true;
 	}
 
+	provides = xbps_dictionary_get(shlibs, "shlib-provides");
+	requires = xbps_dictionary_get(shlibs, "shlib-requires");
+	stageshlibs = xbps_repo_index_shlibs(stage);
+	assert(stageshlibs);
+	sprovides = xbps_dictionary_get(stageshlibs, "shlib-provides");
+	srequires = xbps_dictionary_get(stageshlibs, "shlib-requires");
+
 	/*
 	 * Find old shlibs-provides
 	 */
@@ -89,73 +521,29 @@ repodata_commit(struct xbps_handle *xhp, const char *repodir,
 	xbps_object_iterator_release(iter);
 
 	/*
-	 * throw away all unused shlibs
+	 * Find the users of the old shlibs that are neither provided by
+	 * the stage nor by the packages of the index it doesn't replace.
 	 */
-	iter = xbps_dictionary_iterator(idx);
+	iter = xbps_dictionary_iterator(oldshlibs);
 	while ((keysym = xbps_object_iterator_next(iter))) {
-		const char *pkgname = xbps_dictionary_keysym_cstring_nocopy(keysym);
-		xbps_dictionary_t pkg = xbps_dictionary_get(stage, pkgname);
-		xbps_array_t pkgshlibs;
-		if (!pkg)
-			pkg = xbps_dictionary_get_keysym(idx, keysym);
-		pkgshlibs = xbps_dictionary_get(pkg, "shlib-requires");
-
-		for (unsigned int i = 0; i < xbps_array_count(pkgshlibs); i++) {
-			const char *shlib = NULL;
-			xbps_array_t users;
-			xbps_array_get_cstring_nocopy(pkgshlibs, i, &shlib);
-			if (!xbps_dictionary_get(oldshlibs, shlib))
-				continue;
-			users = xbps_dictionary_get(usedshlibs, shlib);
-			if (!users) {
-				users = xbps_array_create();
-				xbps_dictionary_set(usedshlibs, shlib, users);
-			}
-			xbps_array_add_cstring(users, pkgname);
-		}
-	}
-	xbps_object_iterator_release(iter);
+		const char *shlib = xbps_dictionary_keysym_cstring_nocopy(keysym);
+		xbps_array_t users = NULL;
 
-	/*
-	 * purge all packages that are fullfilled by the index and
-	 * not in the stage.
-	 */
-	iter = xbps_dictionary_iterator(idx);
-	while ((keysym = xbps_object_iterator_next(iter))) {
-		xbps_dictionary_t pkg = xbps_dictionary_get_keysym(idx, keysym);
-		xbps_array_t pkgshlibs;
-
-
-		if (xbps_dictionary_get(stage,
-					xbps_dictionary_keysym_cstring_nocopy(keysym))) {
+		if (xbps_dictionary_get(sprovides, shlib) ||
+		    shlib_provided(stage, provides, shlib))
 			continue;
-		}
-
-		pkgshlibs = xbps_dictionary_get(pkg, "shlib-provides");
-		for (unsigned int i = 0; i < xbps_array_count(pkgshlibs); i++) {
-			const char *shlib;
-			xbps_array_get_cstring_nocopy(pkgshlibs, i, &shlib);
-			xbps_dictionary_remove(usedshlibs, shlib);
-		}
-	}
-	xbps_object_iterator_release(iter);
 
-	/*
-	 * purge all packages that are fullfilled by the stage
-	 */
-	iter = xbps_dictionary_iterator(stage);
-	while ((keysym = xbps_object_iterator_next(iter))) {
-		xbps_dictionary_t pkg = xbps_dictionary_get_keysym(stage, keysym);
-		xbps_array_t pkgshlibs;
-
-		pkgshlibs = xbps_dictionary_get(pkg, "shlib-provides");
-		for (unsigned int i = 0; i < xbps_array_count(pkgshlibs); i++) {
-			const char *shlib;
-			xbps_array_get_cstring_nocopy(pkgshlibs, i, &shlib);
-			xbps_dictionary_remove(usedshlibs, shlib);
+		shlib_users(stage, xbps_dictionary_get(requires, shlib),
+		    false, &users);
+		shlib_users(stage, xbps_dictionary_get(srequires, shlib),
+		    true, &users);
+		if (users) {
+			xbps_dictionary_set(usedshlibs, shlib, users);
+			xbps_object_release(users);
 		}
 	}
 	xbps_object_iterator_release(iter);
+	xbps_object_release(stageshlibs);
 
 	if (xbps_dictionary_count(usedshlibs) != 0) {
 		printf("Inconsistent shlibs:\n");
@@ -187,7 +575,8 @@ repodata_commit(struct xbps_handle *xhp, const char *repodir,
 			printf("stage: added `%s' (%s)\n", pkgver, arch);
 		}
 		xbps_object_iterator_release(iter);
-		rv = repodata_flush(xhp, repodir, "stagedata", stage, NULL);
+		rv = repodata_flush(xhp, repodir, "stagedata", stage, NULL,
+		    NULL, compression);
 	}
 	else {
 		char *stagefile;
@@ -199,91 +588,163 @@ repodata_commit(struct xbps_handle *xhp, const char *repodir,
 			xbps_dictionary_get_cstring_nocopy(pkg, "pkgver", &pkgver);
 			xbps_dictionary_get_cstring_nocopy(pkg, "architecture", &arch);
 			printf("index: added `%s' (%s).\n", pkgver, arch);
+			xbps_repo_index_shlibs_update(shlibs,
+			    xbps_dictionary_get(idx, pkgname), pkg);
 			xbps_dictionary_set(idx, pkgname, pkg);
 		}
 		xbps_object_iterator_release(iter);
 		stagefile = xbps_repo_path_with_name(xhp, repodir, "stagedata");
 		unlink(stagefile);
 		free(stagefile);
-		rv = repodata_flush(xhp, repodir, "repodata", idx, meta);
+		rv = repodata_flush(xhp, repodir, "repodata", idx, meta,
+		    shlibs, compression);
 	}
 	xbps_object_release(usedshlibs);
 	xbps_object_release(oldshlibs);
 	return rv;
 }
 
-int
-index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force)
+/*
+ * Locks the index of the arch; with trylock EBUSY is returned if it's
+ * locked by another process.
+ */
+static int
+index_arch_open(struct xbps_handle *xhp, struct IndexArch *ia,
+	const char *arch, const char *repodir, bool trylock)
 {
-	xbps_dictionary_t idx, idxmeta, idxstage, binpkgd, curpkgd;
-	struct xbps_repo *repo = NULL, *stage = NULL;
-	struct stat st;
-	char *tmprepodir = NULL, *repodir = NULL, *rlockfname = NULL;
-	int rv = 0, ret = 0, rlockfd = -1;
+	char *repofile;
 
-	assert(argv);
-	/*
-	 * Read the repository data or create index dictionaries otherwise.
-	 */
-	if ((tmprepodir = strdup(argv[args])) == NULL)
-		return ENOMEM;
+	ia->xh = *xhp;
+	if (arch)
+		ia->xh.target_arch = arch;
+	ia->rlockfd = -1;
+	repofile = xbps_repo_path(&ia->xh, repodir);
+	ia->queuefile = xbps_xasprintf("%s.queue", repofile);
+	ia->spooldir = xbps_xasprintf("%s.spool", repofile);
+	free(repofile);
+	ia->spooled = xbps_dictionary_create();
+	assert(ia->spooled);
 
-	repodir = dirname(tmprepodir);
-	if (!xbps_repo_lock(xhp, repodir, &rlockfd, &rlockfname)) {
-		fprintf(stderr, "xbps-rindex: cannot lock repository "
-		    "%s: %s\n", repodir, strerror(errno));
-		rv = -1;
-		goto earlyout;
+	if (trylock) {
+		if (xbps_repo_trylock(&ia->xh, repodir, &ia->rlockfd,
+		    &ia->rlockfname))
+			return 0;
+		if (errno == EEXIST)
+			return EBUSY;
+	} else if (xbps_repo_lock(&ia->xh, repodir, &ia->rlockfd,
+	    &ia->rlockfname)) {
+		return 0;
 	}
-	repo = xbps_repo_public_open(xhp, repodir);
-	if (repo == NULL && errno != ENOENT) {
+	fprintf(stderr, "xbps-rindex: cannot lock repository "
+	    "%s: %s\n", repodir, strerror(errno));
+	return -1;
+}
+
+static int
+index_arch_read(struct IndexArch *ia, const char *repodir, bool files)
+{
+	xbps_dictionary_t filesd;
+
+	ia->repo = xbps_repo_public_open(&ia->xh, repodir);
+	if (ia->repo == NULL && errno != ENOENT) {
 		fprintf(stderr, "xbps-rindex: cannot open/lock repository "
 		    "%s: %s\n", repodir, strerror(errno));
-		rv = -1;
-		goto earlyout;
+		return -1;
 	}
-	if (repo) {
-		idx = xbps_dictionary_copy_mutable(repo->idx);
-		idxmeta = xbps_dictionary_copy_mutable(repo->idxmeta);
+	if (ia->repo) {
+		ia->idx = xbps_dictionary_copy_mutable(xbps_repo_get_index(ia->repo));
+		ia->idxmeta = xbps_dictionary_copy_mutable(ia->repo->idxmeta);
 	} else {
-		idx = xbps_dictionary_create();
-		idxmeta = NULL;
+		ia->idx = xbps_dictionary_create_hashed(0);
+		ia->idxmeta = NULL;
 	}
-	stage = xbps_repo_stage_open(xhp, repodir);
-	if (stage == NULL && errno != ENOENT) {
+	/* repositories written by older versions have no shlibs table */
+	if (ia->repo && (ia->idxshlibs = xbps_repo_get_shlibs(ia->repo)))
+		xbps_object_retain(ia->idxshlibs);
+	else
+		ia->idxshlibs = xbps_repo_index_shlibs(ia->idx);
+	assert(ia->idxshlibs);
+	/* the files index is kept updated once generated with --files */
+	if (ia->repo && (filesd = xbps_repo_get_files(ia->repo)))
+		ia->idxfiles = xbps_dictionary_copy_mutable(filesd);
+	else if (files)
+		ia->idxfiles = xbps_dictionary_create_hashed(0);
+	ia->stage = xbps_repo_stage_open(&ia->xh, repodir);
+	if (ia->stage == NULL && errno != ENOENT) {
 		fprintf(stderr, "xbps-rindex: cannot open/lock stage repository "
 		    "%s: %s\n", repodir, strerror(errno));
-		rv = -1;
-		goto earlyout;
+		return -1;
 	}
-	if (stage) {
-		idxstage = xbps_dictionary_copy_mutable(stage->idx);
+	if (ia->stage) {
+		ia->idxstage = xbps_dictionary_copy_mutable(ia->stage->idx);
 	}
 	else {
-		idxstage = xbps_dictionary_create();
+		ia->idxstage = xbps_dictionary_create_hashed(0);
 	}
-	/*
-	 * Process all packages specified in argv.
-	 */
-	for (int i = args; i < argmax; i++) {
-		const char *arch = NULL, *pkg = argv[i];
-		char *sha256 = NULL, *pkgver = NULL, *pkgname = NULL;
+	return 0;
+}
 
-		assert(pkg);
+static void
+index_arch_close(struct IndexArch *ia)
+{
+	if (ia->idx)
+		xbps_object_release(ia->idx);
+	if (ia->idxstage)
+		xbps_object_release(ia->idxstage);
+	if (ia->idxmeta)
+		xbps_object_release(ia->idxmeta);
+	if (ia->idxshlibs)
+		xbps_object_release(ia->idxshlibs);
+	if (ia->idxfiles)
+		xbps_object_release(ia->idxfiles);
+	if (ia->repo)
+		xbps_repo_close(ia->repo);
+	if (ia->stage)
+		xbps_repo_close(ia->stage);
+	if (ia->spooled)
+		xbps_object_release(ia->spooled);
+	if (ia->rlockfd != -1)
+		xbps_repo_unlock(ia->rlockfd, ia->rlockfname);
+	free(ia->queuefile);
+	free(ia->spooldir);
+}
+
+/*
+ * Adds the packages read in pkgs to the stage index of the arch, in order.
+ * With --all-archs the packages of other archs are silently ignored, they
+ * are added to their own index.
+ */
+static int
+index_arch_add(struct IndexArch *ia, const char *repodir, xbps_array_t pkgs,
+	bool force, bool delta, bool all_archs)
+{
+	struct xbps_handle *xhp = &ia->xh;
+	xbps_dictionary_t props, binpkgd, curpkgd, pkgd;
+	uint64_t pkgsize;
+	int rv = 0, ret = 0;
+
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		const char *arch = NULL, *pkg = NULL;
+		char *pkgver = NULL, *pkgname = NULL;
+		bool hashed = false;
+
+		pkgd = xbps_array_get(pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "file", &pkg);
+		xbps_dictionary_get_bool(pkgd, "hashed", &hashed);
 		/*
-		 * Read metadata props plist dictionary from binary package.
+		 * Metadata props plist dictionary from binary package.
 		 */
-		binpkgd = xbps_archive_fetch_plist(pkg, "/props.plist");
-		if (binpkgd == NULL) {
+		props = xbps_dictionary_get(pkgd, "props");
+		if (props == NULL) {
 			fprintf(stderr, "index: failed to read %s metadata for "
 			    "`%s', skipping!\n", XBPS_PKGPROPS, pkg);
 			continue;
 		}
-		xbps_dictionary_get_cstring_nocopy(binpkgd, "architecture", &arch);
-		xbps_dictionary_get_cstring(binpkgd, "pkgver", &pkgver);
+		xbps_dictionary_get_cstring_nocopy(props, "architecture", &arch);
+		xbps_dictionary_get_cstring(props, "pkgver", &pkgver);
 		if (!xbps_pkg_arch_match(xhp, arch, NULL)) {
-			fprintf(stderr, "index: ignoring %s, unmatched arch (%s)\n", pkgver, arch);
-			xbps_object_release(binpkgd);
+			if (!all_archs)
+				fprintf(stderr, "index: ignoring %s, unmatched arch (%s)\n", pkgver, arch);
 			free(pkgver);
 			continue;
 		}
@@ -295,16 +756,15 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 		 * than current registered package, update the index; otherwise
 		 * pass to the next one.
 		 */
-		curpkgd = xbps_dictionary_get(idxstage, pkgname);
+		curpkgd = xbps_dictionary_get(ia->idxstage, pkgname);
 		if (curpkgd == NULL)
-			curpkgd = xbps_dictionary_get(idx, pkgname);
+			curpkgd = xbps_dictionary_get(ia->idx, pkgname);
 		if (curpkgd == NULL) {
 			if (errno && errno != ENOENT) {
 				rv = errno;
-				xbps_object_release(binpkgd);
 				free(pkgver);
 				free(pkgname);
-				goto out;
+				return rv;
 			}
 		} else if (!force) {
 			char *opkgver = NULL, *oarch = NULL;
@@ -318,7 +778,7 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 			 * If the considered package reverts the package in the index,
 			 * consider the current package as the newer one.
 			 */
-			if (ret < 0 && xbps_pkg_reverts(binpkgd, opkgver)) {
+			if (ret < 0 && xbps_pkg_reverts(props, opkgver)) {
 				ret = 1;
 			/*
 			 * If package in the index reverts considered package, consider the
@@ -331,7 +791,6 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 			if (ret <= 0) {
 				/* Same version or index version greater */
 				fprintf(stderr, "index: skipping `%s' (%s), already registered.\n", pkgver, arch);
-				xbps_object_release(binpkgd);
 				free(opkgver);
 				free(oarch);
 				free(pkgver);
@@ -341,47 +800,25 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 			free(opkgver);
 			free(oarch);
 		}
-		/*
-		 * Add additional objects for repository ops:
-		 * 	- filename-size
-		 * 	- filename-sha256
-		 */
-		if ((sha256 = xbps_file_hash(pkg)) == NULL) {
-			xbps_object_release(binpkgd);
-			free(pkgver);
-			free(pkgname);
-			rv = EINVAL;
-			goto out;
-		}
-		if (!xbps_dictionary_set_cstring(binpkgd, "filename-sha256", sha256)) {
-			xbps_object_release(binpkgd);
-			free(sha256);
-			free(pkgver);
-			free(pkgname);
-			rv = EINVAL;
-			goto out;
-		}
-		free(sha256);
-		if (stat(pkg, &st) == -1) {
-			xbps_object_release(binpkgd);
-			free(pkgver);
-			free(pkgname);
-			rv = EINVAL;
-			goto out;
-		}
-		if (!xbps_dictionary_set_uint64(binpkgd, "filename-size", (uint64_t)st.st_size)) {
-			xbps_object_release(binpkgd);
-			free(pkgver);
-			free(pkgname);
-			rv = EINVAL;
-			goto out;
+		if (!hashed) {
+			if ((rv = set_binpkg_file(props, pkg)) != 0) {
+				free(pkgver);
+				free(pkgname);
+				return rv;
+			}
+			xbps_dictionary_set_bool(pkgd, "hashed", true);
 		}
-		if (set_build_date(binpkgd, st.st_mtime) < 0) {
+		/* noarch packages are shared by the indexes of all archs */
+		binpkgd = xbps_dictionary_copy_mutable(props);
+		assert(binpkgd);
+		pkgsize = 0;
+		xbps_dictionary_get_uint64(binpkgd, "filename-size", &pkgsize);
+		if (delta && curpkgd &&
+		    index_delta(pkgd, binpkgd, curpkgd, repodir, pkg, (off_t)pkgsize) != 0) {
 			xbps_object_release(binpkgd);
 			free(pkgver);
 			free(pkgname);
-			rv = EINVAL;
-			goto out;
+			return EINVAL;
 		}
 		/* Remove unneeded objects */
 		xbps_dictionary_remove(binpkgd, "pkgname");
@@ -391,43 +828,275 @@ index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force
 		/*
 		 * Add new pkg dictionary into the stage index
 		 */
-		if (!xbps_dictionary_set(idxstage, pkgname, binpkgd)) {
+		if (!xbps_dictionary_set(ia->idxstage, pkgname, binpkgd)) {
 			xbps_object_release(binpkgd);
 			free(pkgname);
 			free(pkgver);
-			rv = EINVAL;
-			goto out;
+			return EINVAL;
 		}
 		xbps_object_release(binpkgd);
+		/* the files of a rebuilt package are read again */
+		if (ia->idxfiles)
+			xbps_dictionary_remove(ia->idxfiles, pkgver);
 		free(pkgname);
 		free(pkgver);
 	}
-	/*
-	 * Generate repository data files.
-	 */
-	if (!repodata_commit(xhp, repodir, idx, idxmeta, idxstage)) {
+	return rv;
+}
+
+struct IndexCommitCbInfo {
+	struct IndexArch *archs;
+	const char *repodir;
+	const char *compression;
+	bool all_archs;
+	pthread_mutex_t lock;
+	int rv;
+};
+
+/*
+ * Generates the repository data files of an arch, by multiple threads
+ * with --all-archs.
+ */
+static int
+index_commit_cb(struct xbps_handle *xhp UNUSED,
+		xbps_object_t obj,
+		const char *key UNUSED,
+		void *arg,
+		bool *done UNUSED)
+{
+	struct IndexCommitCbInfo *info = arg;
+	struct IndexArch *ia;
+	const char *arch;
+
+	ia = &info->archs[xbps_number_unsigned_integer_value(obj)];
+	if (!repodata_commit(&ia->xh, info->repodir, ia->idx, ia->idxmeta,
+	    ia->idxshlibs, ia->idxstage, info->compression)) {
 		fprintf(stderr, "%s: failed to write repodata: %s\n",
 				_XBPS_RINDEX, strerror(errno));
-		goto out;
+		pthread_mutex_lock(&info->lock);
+		info->rv = -1;
+		pthread_mutex_unlock(&info->lock);
+		return 0;
 	}
-	printf("index: %u packages registered.\n", xbps_dictionary_count(idx));
+	if (ia->idxfiles && !repofiles_flush(&ia->xh, info->repodir,
+	    ia->idxfiles, ia->idx, ia->idxstage, info->compression)) {
+		fprintf(stderr, "%s: failed to write files index: %s\n",
+				_XBPS_RINDEX, strerror(errno));
+		pthread_mutex_lock(&info->lock);
+		info->rv = -1;
+		pthread_mutex_unlock(&info->lock);
+		return 0;
+	}
+	(void)unlink(ia->queuefile);
+	index_spool_remove(ia);
+	if (info->all_archs) {
+		arch = ia->xh.target_arch ? ia->xh.target_arch : ia->xh.native_arch;
+		printf("index: %u packages registered (%s).\n",
+		    xbps_dictionary_count(ia->idx), arch);
+	} else {
+		printf("index: %u packages registered.\n",
+		    xbps_dictionary_count(ia->idx));
+	}
+	return 0;
+}
 
-out:
-	xbps_object_release(idx);
-	xbps_object_release(idxstage);
-	if (idxmeta)
-		xbps_object_release(idxmeta);
+static int
+arch_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/*
+ * Returns the sorted archs indexed by the add mode: the target arch, or
+ * with --all-archs those of the repository indexes and queues, and of
+ * the binary packages (their filenames end in "<arch>.xbps").
+ */
+static const char **
+index_archs(const char *repodir, int args, int argmax, char **argv,
+	bool all_archs, unsigned int *narchs)
+{
+	xbps_dictionary_t set;
+	xbps_array_t keys;
+	const char **archs;
+	char *arch;
+
+	if (!all_archs) {
+		archs = calloc(1, sizeof(char *));
+		assert(archs);
+		*narchs = 1;
+		return archs;
+	}
+	set = xbps_dictionary_create();
+	assert(set);
+	repodata_archs(repodir, set);
+	for (int i = args; i < argmax; i++) {
+		if ((arch = xbps_binpkg_arch(argv[i])) == NULL)
+			continue;
+		if (strcmp(arch, "noarch"))
+			xbps_dictionary_set_bool(set, arch, true);
+		free(arch);
+	}
+	keys = xbps_dictionary_all_keys(set);
+	*narchs = xbps_array_count(keys);
+	archs = calloc(*narchs ? *narchs : 1, sizeof(char *));
+	assert(archs);
+	for (unsigned int i = 0; i < *narchs; i++) {
+		archs[i] = strdup(xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(keys, i)));
+		assert(archs[i]);
+	}
+	xbps_object_release(keys);
+	xbps_object_release(set);
+	/* only noarch packages in a new repository */
+	if (*narchs == 0)
+		*narchs = 1;
+	else
+		qsort(archs, *narchs, sizeof(char *), arch_cmp);
+
+	return archs;
+}
+
+int
+index_add(struct xbps_handle *xhp, int args, int argmax, char **argv, bool force,
+	bool delta, bool queue, bool all_archs, bool files, const char *compression)
+{
+	xbps_dictionary_t pkgd;
+	xbps_array_t pkgs = NULL, spooled = NULL, commits;
+	struct IndexArch *archs;
+	struct IndexAddCbInfo info;
+	struct IndexCommitCbInfo cinfo;
+	struct stat st;
+	const char **archnames;
+	char *tmprepodir = NULL, *repodir = NULL;
+	unsigned int narchs;
+	int rv = 0;
+	bool spool, done;
 
-earlyout:
-	if (repo)
-		xbps_repo_close(repo);
-	if (stage)
-		xbps_repo_close(stage);
+	assert(argv);
+	/*
+	 * Read the repository data or create index dictionaries otherwise.
+	 */
+	if ((tmprepodir = strdup(argv[args])) == NULL)
+		return ENOMEM;
 
-	xbps_repo_unlock(rlockfd, rlockfname);
+	/* a repository alone only registers its queued packages */
+	if (args + 1 == argmax && stat(argv[args], &st) == 0 &&
+	    S_ISDIR(st.st_mode)) {
+		repodir = tmprepodir;
+		args++;
+	} else {
+		repodir = dirname(tmprepodir);
+	}
+	/* packages are queued for the target arch */
+	archnames = index_archs(repodir, args, argmax, argv,
+	    all_archs && !queue, &narchs);
+	archs = calloc(narchs, sizeof(*archs));
+	assert(archs);
+	/*
+	 * Lock all indexes, in order. If the index of the target arch is
+	 * locked the packages are spooled for the run holding the lock.
+	 */
+	spool = !queue && !all_archs && args < argmax;
+	for (unsigned int i = 0; i < narchs; i++) {
+		rv = index_arch_open(xhp, &archs[i], archnames[i], repodir,
+		    spool);
+		if (rv == EBUSY) {
+			rv = index_spool(&archs[i], repodir, args, argmax,
+			    argv, &done);
+			if (rv == 0 && done) {
+				narchs = i + 1;
+				goto out;
+			}
+		}
+		if (rv != 0) {
+			narchs = i + 1;
+			goto out;
+		}
+	}
+	if (queue) {
+		rv = index_queue(archs[0].queuefile, args, argmax, argv);
+		goto out;
+	}
+	for (unsigned int i = 0; i < narchs; i++) {
+		if ((rv = index_arch_read(&archs[i], repodir, files)) != 0)
+			goto out;
+	}
+	/*
+	 * Read and hash all queued packages and the ones specified in argv
+	 * in parallel, once for all archs.
+	 */
+	pkgs = xbps_array_create();
+	assert(pkgs);
+	for (unsigned int i = 0; i < narchs; i++) {
+		index_queue_read(archs[i].queuefile, pkgs);
+		index_spool_read(&archs[i], pkgs);
+	}
+	for (int i = args; i < argmax; i++) {
+		assert(argv[i]);
+		pkgd = xbps_dictionary_create();
+		assert(pkgd);
+		xbps_dictionary_set_cstring_nocopy(pkgd, "file", argv[i]);
+		xbps_array_add(pkgs, pkgd);
+		xbps_object_release(pkgd);
+	}
+	info.archs = archs;
+	info.narchs = narchs;
+	info.force = force;
+	(void)xbps_array_foreach_cb_multi(xhp, pkgs, NULL, index_read_cb, &info);
+	/*
+	 * Process all packages, in order.
+	 */
+	for (unsigned int i = 0; i < narchs; i++) {
+		if ((rv = index_arch_add(&archs[i], repodir, pkgs, force,
+		    delta, all_archs)) != 0)
+			goto out;
+	}
+	/*
+	 * Register the packages spooled in the meantime too.
+	 */
+	spooled = xbps_array_create();
+	assert(spooled);
+	for (unsigned int i = 0; i < narchs; i++)
+		index_spool_read(&archs[i], spooled);
+	if (xbps_array_count(spooled)) {
+		(void)xbps_array_foreach_cb_multi(xhp, spooled, NULL,
+		    index_read_cb, &info);
+		for (unsigned int i = 0; i < narchs; i++) {
+			if ((rv = index_arch_add(&archs[i], repodir, spooled,
+			    force, delta, all_archs)) != 0)
+				goto out;
+		}
+	}
+	/*
+	 * Generate repository data files, of all archs concurrently.
+	 */
+	commits = xbps_array_create();
+	assert(commits);
+	for (unsigned int i = 0; i < narchs; i++)
+		xbps_array_add_uint64(commits, i);
+	cinfo.archs = archs;
+	cinfo.repodir = repodir;
+	cinfo.compression = compression;
+	cinfo.all_archs = all_archs;
+	cinfo.rv = 0;
+	pthread_mutex_init(&cinfo.lock, NULL);
+	(void)xbps_array_foreach_cb_multi(xhp, commits, NULL, index_commit_cb, &cinfo);
+	pthread_mutex_destroy(&cinfo.lock);
+	xbps_object_release(commits);
+	rv = cinfo.rv;
 
-	if (tmprepodir)
-		free(tmprepodir);
+out:
+	if (pkgs)
+		xbps_object_release(pkgs);
+	if (spooled)
+		xbps_object_release(spooled);
+	for (unsigned int i = 0; i < narchs; i++)
+		index_arch_close(&archs[i]);
+	free(archs);
+	for (unsigned int i = 0; i < narchs; i++)
+		free(__UNCONST(archnames[i]));
+	free(archnames);
+	free(tmprepodir);
 
 	return rv;
 }
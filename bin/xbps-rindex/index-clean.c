@@ -32,7 +32,6 @@
 #include <dirent.h>
 #include <libgen.h>
 #include <assert.h>
-#include <pthread.h>
 #include <fcntl.h>
 
 #include <xbps.h>
@@ -43,7 +42,155 @@ static xbps_dictionary_t dest;
 struct CleanerCbInfo {
 	const char *repourl;
 	bool hashcheck;
+	xbps_dictionary_t hashes;
+	xbps_dictionary_t newhashes;
+	unsigned int hashed;
+	unsigned int skipped;
 };
+
+/*
+ * Results of a slice of the index, merged in index order so that
+ * removed packages are always reported in the same order.
+ */
+struct CleanerAcc {
+	struct CleanerCbInfo *info;
+	xbps_array_t removed;
+	xbps_dictionary_t newhashes;
+	unsigned int hashed;
+	unsigned int skipped;
+};
+
+/*
+ * The size, mtime and inode of binary packages that matched their hash in
+ * the last clean are recorded in <arch>-repodata.hashes, they aren't
+ * hashed again until any of them changes.
+ */
+static xbps_dictionary_t
+hashes_entry(const struct stat *st, const char *sha256)
+{
+	xbps_dictionary_t d;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	xbps_dictionary_set_uint64(d, "size", (uint64_t)st->st_size);
+	xbps_dictionary_set_uint64(d, "mtime", (uint64_t)st->st_mtim.tv_sec);
+	xbps_dictionary_set_uint64(d, "mtime-nsec", (uint64_t)st->st_mtim.tv_nsec);
+	xbps_dictionary_set_uint64(d, "inode", (uint64_t)st->st_ino);
+	xbps_dictionary_set_cstring(d, "sha256", sha256);
+	return d;
+}
+
+static bool
+hashes_match(xbps_dictionary_t d, const struct stat *st, const char *sha256)
+{
+	const char *dsha256 = NULL;
+	uint64_t size = 0, mtime = 0, mtimensec = 0, ino = 0;
+
+	if (d == NULL)
+		return false;
+
+	xbps_dictionary_get_uint64(d, "size", &size);
+	xbps_dictionary_get_uint64(d, "mtime", &mtime);
+	xbps_dictionary_get_uint64(d, "mtime-nsec", &mtimensec);
+	xbps_dictionary_get_uint64(d, "inode", &ino);
+	xbps_dictionary_get_cstring_nocopy(d, "sha256", &dsha256);
+
+	return size == (uint64_t)st->st_size &&
+	    mtime == (uint64_t)st->st_mtim.tv_sec &&
+	    mtimensec == (uint64_t)st->st_mtim.tv_nsec &&
+	    ino == (uint64_t)st->st_ino &&
+	    dsha256 != NULL && strcmp(dsha256, sha256) == 0;
+}
+
+/*
+ * Returns 0 if the binary package matches its hash in the index.
+ */
+static int
+hash_check(struct xbps_handle *xhp, struct CleanerAcc *acc, const char *filen,
+		const char *sha256)
+{
+	xbps_dictionary_t d;
+	struct stat st;
+	const char *key;
+	bool skip;
+
+	if (stat(filen, &st) == -1)
+		return errno;
+
+	key = strrchr(filen, '/') + 1;
+	d = xbps_dictionary_get(acc->info->hashes, key);
+	if (!(skip = hashes_match(d, &st, sha256))) {
+		if (xbps_file_hash_check_handle(xhp, filen, sha256) != 0)
+			return ERANGE;
+		d = hashes_entry(&st, sha256);
+	} else {
+		xbps_object_retain(d);
+	}
+	xbps_dictionary_set(acc->newhashes, key, d);
+	if (skip)
+		acc->skipped++;
+	else
+		acc->hashed++;
+	xbps_object_release(d);
+
+	return 0;
+}
+
+static void *
+idx_cleaner_init(void *arg)
+{
+	struct CleanerAcc *acc;
+
+	if ((acc = calloc(1, sizeof(*acc))) == NULL)
+		return NULL;
+	acc->info = arg;
+	acc->removed = xbps_array_create();
+	acc->newhashes = xbps_dictionary_create();
+	assert(acc->removed);
+	assert(acc->newhashes);
+	return acc;
+}
+
+static int
+idx_cleaner_merge(void *arg, void *accp)
+{
+	struct CleanerCbInfo *info = arg;
+	struct CleanerAcc *acc = accp;
+	xbps_object_iterator_t iter;
+	xbps_object_t keysym;
+	const char *pkgver;
+	char *pkgname;
+
+	for (unsigned int i = 0; i < xbps_array_count(acc->removed); i++) {
+		xbps_array_get_cstring_nocopy(acc->removed, i, &pkgver);
+		pkgname = xbps_pkg_name(pkgver);
+		assert(pkgname);
+		xbps_dictionary_remove(dest, pkgname);
+		free(pkgname);
+		printf("index: removed pkg %s\n", pkgver);
+	}
+	iter = xbps_dictionary_iterator(acc->newhashes);
+	assert(iter);
+	while ((keysym = xbps_object_iterator_next(iter)) != NULL) {
+		xbps_dictionary_set_keysym(info->newhashes, keysym,
+		    xbps_dictionary_get_keysym(acc->newhashes, keysym));
+	}
+	xbps_object_iterator_release(iter);
+	info->hashed += acc->hashed;
+	info->skipped += acc->skipped;
+	return 0;
+}
+
+static void
+idx_cleaner_fini(void *accp)
+{
+	struct CleanerAcc *acc = accp;
+
+	xbps_object_release(acc->removed);
+	xbps_object_release(acc->newhashes);
+	free(acc);
+}
+
 static int
 idx_cleaner_cb(struct xbps_handle *xhp,
 		xbps_object_t obj,
@@ -51,9 +198,10 @@ idx_cleaner_cb(struct xbps_handle *xhp,
 		void *arg,
 		bool *done UNUSED)
 {
-	struct CleanerCbInfo *info = arg;
+	struct CleanerAcc *acc = arg;
+	struct CleanerCbInfo *info = acc->info;
 	const char *arch, *pkgver, *sha256;
-	char *filen, *pkgname;
+	char *filen;
 
 	xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
 	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
@@ -66,48 +214,66 @@ idx_cleaner_cb(struct xbps_handle *xhp,
 		 * File cannot be read, might be permissions,
 		 * broken or simply unexistent; either way, remove it.
 		 */
-		pkgname = xbps_pkg_name(pkgver);
-		if (pkgname == NULL)
-			goto out;
-		xbps_dictionary_remove(dest, pkgname);
-		free(pkgname);
-		printf("index: removed pkg %s\n", pkgver);
+		xbps_array_add_cstring_nocopy(acc->removed, pkgver);
 	} else if (info->hashcheck) {
 		/*
 		 * File can be read; check its hash.
 		 */
 		xbps_dictionary_get_cstring_nocopy(obj,
 				"filename-sha256", &sha256);
-		if (xbps_file_hash_check(filen, sha256) != 0) {
-			pkgname = xbps_pkg_name(pkgver);
-			if (pkgname == NULL)
-				goto out;
-			xbps_dictionary_remove(dest, pkgname);
-			free(pkgname);
-			printf("index: removed pkg %s\n", pkgver);
-		}
+		if (hash_check(xhp, acc, filen, sha256) != 0)
+			xbps_array_add_cstring_nocopy(acc->removed, pkgver);
 	}
-out:
 	free(filen);
 	return 0;
 }
 
 static int
 cleanup_repo(struct xbps_handle *xhp, const char *repodir, struct xbps_repo *repo,
-		const char *reponame, bool hashcheck) {
+		const char *reponame, bool hashcheck, xbps_dictionary_t hashes,
+		xbps_dictionary_t newhashes, xbps_dictionary_t *idxp,
+		const char *compression) {
 	int rv = 0;
 	xbps_array_t allkeys;
+	xbps_dictionary_t shlibs = NULL;
 	struct CleanerCbInfo info = {
 		.hashcheck = hashcheck,
-		.repourl = repodir
+		.repourl = repodir,
+		.hashes = hashes,
+		.newhashes = newhashes,
+	};
+	struct xbps_reduce ops = {
+		.init = idx_cleaner_init,
+		.fn = idx_cleaner_cb,
+		.merge = idx_cleaner_merge,
+		.fini = idx_cleaner_fini,
+		.arg = &info
 	};
 	/*
 	 * First pass: find out obsolete entries on index and index-files.
 	 */
-	dest = xbps_dictionary_copy_mutable(repo->idx);
+	dest = *idxp = xbps_dictionary_copy_mutable(repo->idx);
 	allkeys = xbps_dictionary_all_keys(dest);
-	(void)xbps_array_foreach_cb_multi(xhp, allkeys, repo->idx, idx_cleaner_cb, &info);
+	(void)xbps_array_foreach_reduce(xhp, allkeys, repo->idx, &ops);
+	/*
+	 * Drop the removed packages from the shared libraries table
+	 * of the index, it's generated again if the index has none.
+	 */
+	if (strcmp("repodata", reponame) == 0 &&
+	    (shlibs = xbps_repo_get_shlibs(repo)) != NULL) {
+		for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+			const char *pkgname = xbps_dictionary_keysym_cstring_nocopy(
+			    xbps_array_get(allkeys, i));
+
+			if (xbps_dictionary_get(dest, pkgname) == NULL)
+				xbps_repo_index_shlibs_update(shlibs,
+				    xbps_dictionary_get(repo->idx, pkgname), NULL);
+		}
+	}
 	xbps_object_release(allkeys);
+	if (hashcheck)
+		printf("index: %u packages hashed, %u unchanged skipped.\n",
+		    info.hashed, info.skipped);
 
 	if(strcmp("stagedata", reponame) == 0 && xbps_dictionary_count(dest) == 0) {
 		char *stagefile = xbps_repo_path_with_name(xhp, repodir, "stagedata");
@@ -115,7 +281,8 @@ cleanup_repo(struct xbps_handle *xhp, const char *repodir, struct xbps_repo *rep
 		free(stagefile);
 	}
 	if (!xbps_dictionary_equals(dest, repo->idx)) {
-		if (!repodata_flush(xhp, repodir, reponame, dest, repo->idxmeta)) {
+		if (!repodata_flush(xhp, repodir, reponame, dest, repo->idxmeta,
+		    shlibs, compression)) {
 			rv = errno;
 			fprintf(stderr, "failed to write repodata: %s\n",
 			    strerror(errno));
@@ -134,10 +301,13 @@ cleanup_repo(struct xbps_handle *xhp, const char *repodir, struct xbps_repo *rep
  * binary package cannot be read (unavailable, not enough perms, etc).
  */
 int
-index_clean(struct xbps_handle *xhp, const char *repodir, const bool hashcheck)
+index_clean(struct xbps_handle *xhp, const char *repodir, const bool hashcheck,
+		const char *compression)
 {
 	struct xbps_repo *repo, *stage;
-	char *rlockfname = NULL;
+	xbps_dictionary_t hashes = NULL, newhashes = NULL, filesd;
+	xbps_dictionary_t idx = NULL, stageidx = NULL, files;
+	char *rlockfname = NULL, *repofile, *hashesfile = NULL;
 	int rv = 0, rlockfd = -1;
 
 	if (!xbps_repo_lock(xhp, repodir, &rlockfd, &rlockfname)) {
@@ -159,20 +329,56 @@ index_clean(struct xbps_handle *xhp, const char *repodir, const bool hashcheck)
 		return rv;
 	}
 	stage = xbps_repo_stage_open(xhp, repodir);
-	if (repo->idx == NULL || (stage && stage->idx == NULL)) {
+	if (xbps_repo_get_index(repo) == NULL || (stage && stage->idx == NULL)) {
 		fprintf(stderr, "%s: incomplete repository data file!\n", _XBPS_RINDEX);
 		rv = EINVAL;
 		goto out;
 	}
 	printf("Cleaning `%s' index, please wait...\n", repodir);
 
-	if((rv = cleanup_repo(xhp, repodir, repo, "repodata", hashcheck)))
+	if (hashcheck) {
+		repofile = xbps_repo_path(xhp, repodir);
+		hashesfile = xbps_xasprintf("%s.hashes", repofile);
+		free(repofile);
+		hashes = xbps_dictionary_internalize_from_file(hashesfile);
+		newhashes = xbps_dictionary_create();
+		assert(newhashes);
+	}
+	if((rv = cleanup_repo(xhp, repodir, repo, "repodata", hashcheck,
+	    hashes, newhashes, &idx, compression)))
 		goto out;
 	if(stage) {
-		cleanup_repo(xhp, repodir, stage, "stagedata", hashcheck);
+		cleanup_repo(xhp, repodir, stage, "stagedata", hashcheck,
+		    hashes, newhashes, &stageidx, compression);
+	}
+	/* Drop the removed packages from the files index, if any */
+	if ((filesd = xbps_repo_get_files(repo)) != NULL) {
+		files = xbps_dictionary_copy_mutable(filesd);
+		assert(files);
+		if (!repofiles_flush(xhp, repodir, files, idx, stageidx,
+		    compression)) {
+			rv = errno;
+			fprintf(stderr, "%s: failed to write files index: %s\n",
+			    _XBPS_RINDEX, strerror(rv));
+		}
+		xbps_object_release(files);
+	}
+	if (hashcheck &&
+	    !xbps_dictionary_externalize_to_file(newhashes, hashesfile)) {
+		fprintf(stderr, "%s: failed to write %s: %s\n",
+		    _XBPS_RINDEX, hashesfile, strerror(errno));
 	}
 
 out:
+	if (idx)
+		xbps_object_release(idx);
+	if (stageidx)
+		xbps_object_release(stageidx);
+	if (hashes)
+		xbps_object_release(hashes);
+	if (newhashes)
+		xbps_object_release(newhashes);
+	free(hashesfile);
 	xbps_repo_close(repo);
 	if(stage)
 		xbps_repo_close(stage);
@@ -180,3 +386,34 @@ out:
 
 	return rv;
 }
+
+/*
+ * Cleans the indexes of all architectures of the repository in a
+ * single run.
+ */
+int
+index_clean_archs(struct xbps_handle *xhp, const char *repodir,
+		const bool hashcheck, const char *compression)
+{
+	struct xbps_handle xh;
+	xbps_dictionary_t archs;
+	xbps_array_t keys;
+	int rv = 0;
+
+	archs = xbps_dictionary_create();
+	assert(archs);
+	repodata_archs(repodir, archs);
+	keys = xbps_dictionary_all_keys(archs);
+	for (unsigned int i = 0; i < xbps_array_count(keys); i++) {
+		xh = *xhp;
+		xh.target_arch = xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(keys, i));
+		printf("index: cleaning %s\n", xh.target_arch);
+		if ((rv = index_clean(&xh, repodir, hashcheck, compression)) != 0)
+			break;
+	}
+	xbps_object_release(keys);
+	xbps_object_release(archs);
+
+	return rv;
+}
@@ -40,13 +40,25 @@ usage(bool fail)
 	    " -d --debug                        Debug mode shown to stderr\n"
 	    " -f --force                        Force mode to overwrite entry in add mode\n"
 	    " -h --help                         Show help usage\n"
+	    " -n --dry-run                      Dry-run mode, only show what obsolete\n"
+	    "                                   packages would be removed\n"
 	    " -v --verbose                      Verbose messages\n"
 	    " -V --version                      Show XBPS version\n"
 	    " -C --hashcheck                    Consider file hashes for cleaning up packages\n"
+	    "    --all-archs                    Update the indexes of all architectures\n"
+	    "                                   of the repository in add and clean modes\n"
+	    "    --compression <fmt>            Compression format for the repository index:\n"
+	    "                                   none, gzip (default), bzip2, xz or zstd\n"
+	    "    --delta                        Create deltas from previous versions in add mode\n"
+	    "    --files                        Generate the files index of the repository\n"
+	    "                                   in add mode\n"
 	    "    --privkey <key>                Path to the private key for signing\n"
+	    "    --queue                        Queue package(s) to be registered by the\n"
+	    "                                   next add mode run\n"
 	    "    --signedby <string>            Signature details, i.e \"name <email>\"\n\n"
 	    "MODE\n"
 	    " -a --add <repodir/pkg> ...        Add package(s) to repository index\n"
+	    " -a --add <repodir>                Add queued package(s) to repository index\n"
 	    " -c --clean <repodir>              Clean repository index\n"
 	    " -r --remove-obsoletes <repodir>   Removes obsolete packages from repository\n"
 	    " -s --sign <repodir>               Initialize repository metadata signature\n"
@@ -57,13 +69,14 @@ usage(bool fail)
 int
 main(int argc, char **argv)
 {
-	const char *shortopts = "acdfhrsCSVv";
+	const char *shortopts = "acdfhnrsCSVv";
 	struct option longopts[] = {
 		{ "add", no_argument, NULL, 'a' },
 		{ "clean", no_argument, NULL, 'c' },
 		{ "debug", no_argument, NULL, 'd' },
 		{ "force", no_argument, NULL, 'f' },
 		{ "help", no_argument, NULL, 'h' },
+		{ "dry-run", no_argument, NULL, 'n' },
 		{ "remove-obsoletes", no_argument, NULL, 'r' },
 		{ "version", no_argument, NULL, 'V' },
 		{ "verbose", no_argument, NULL, 'v' },
@@ -72,16 +85,21 @@ main(int argc, char **argv)
 		{ "sign", no_argument, NULL, 's'},
 		{ "sign-pkg", no_argument, NULL, 'S'},
 		{ "hashcheck", no_argument, NULL, 'C' },
+		{ "delta", no_argument, NULL, 2 },
+		{ "compression", required_argument, NULL, 3 },
+		{ "queue", no_argument, NULL, 4 },
+		{ "all-archs", no_argument, NULL, 5 },
+		{ "files", no_argument, NULL, 6 },
 		{ NULL, 0, NULL, 0 }
 	};
 	struct xbps_handle xh;
-	const char *privkey = NULL, *signedby = NULL;
+	const char *privkey = NULL, *signedby = NULL, *compression = NULL;
 	int rv, c, flags = 0;
 	bool add_mode, clean_mode, rm_mode, sign_mode, sign_pkg_mode, force,
-			 hashcheck;
+			 hashcheck, delta, queue, dryrun, all_archs, files;
 
 	add_mode = clean_mode = rm_mode = sign_mode = sign_pkg_mode = force =
-		hashcheck = false;
+		hashcheck = delta = queue = dryrun = all_archs = files = false;
 
 	while ((c = getopt_long(argc, argv, shortopts, longopts, NULL)) != -1) {
 		switch (c) {
@@ -91,6 +109,21 @@ main(int argc, char **argv)
 		case 1:
 			signedby = optarg;
 			break;
+		case 2:
+			delta = true;
+			break;
+		case 3:
+			compression = optarg;
+			break;
+		case 4:
+			queue = true;
+			break;
+		case 5:
+			all_archs = true;
+			break;
+		case 6:
+			files = true;
+			break;
 		case 'a':
 			add_mode = true;
 			break;
@@ -106,6 +139,9 @@ main(int argc, char **argv)
 		case 'h':
 			usage(false);
 			/* NOTREACHED */
+		case 'n':
+			dryrun = true;
+			break;
 		case 'r':
 			rm_mode = true;
 			break;
@@ -139,6 +175,13 @@ main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (compression && strcmp(compression, "none") &&
+	    strcmp(compression, "gzip") && strcmp(compression, "bzip2") &&
+	    strcmp(compression, "xz") && strcmp(compression, "zstd")) {
+		fprintf(stderr, "Invalid compression format: %s\n", compression);
+		exit(EXIT_FAILURE);
+	}
+
 	/* initialize libxbps */
 	memset(&xh, 0, sizeof(xh));
 	xh.flags = flags;
@@ -149,13 +192,17 @@ main(int argc, char **argv)
 	}
 
 	if (add_mode)
-		rv = index_add(&xh, optind, argc, argv, force);
+		rv = index_add(&xh, optind, argc, argv, force, delta, queue,
+		    all_archs, files, compression);
+	else if (clean_mode && all_archs)
+		rv = index_clean_archs(&xh, argv[optind], hashcheck, compression);
 	else if (clean_mode)
-		rv = index_clean(&xh, argv[optind], hashcheck);
+		rv = index_clean(&xh, argv[optind], hashcheck, compression);
 	else if (rm_mode)
-		rv = remove_obsoletes(&xh, argv[optind]);
+		rv = remove_obsoletes(&xh, argv[optind], dryrun);
 	else if (sign_mode)
-		rv = sign_repo(&xh, argv[optind], privkey, signedby);
+		rv = sign_repo(&xh, argv[optind], privkey, signedby,
+		    compression);
 	else if (sign_pkg_mode)
 		rv = sign_pkgs(&xh, optind, argc, argv, privkey, force);
 
@@ -23,6 +23,7 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _DEFAULT_SOURCE	/* for DT_* dirent types */
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -30,92 +31,152 @@
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
-#include <libgen.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 #include <assert.h>
 
 #include <xbps.h>
 #include "defs.h"
 
+/*
+ * Sorted table of the binary package and delta filenames registered
+ * in the repository index and stage, the files of the repository
+ * directory that are not found in it are obsolete.
+ */
+struct live_files {
+	char **names;
+	size_t count, size;
+};
+
+static int
+name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+live_files_add(struct live_files *lf, const char *pkgver, const char *arch,
+		const char *ext)
+{
+	if (lf->count == lf->size) {
+		lf->size = lf->size ? lf->size * 2 : 256;
+		lf->names = realloc(lf->names, lf->size * sizeof(char *));
+		assert(lf->names);
+	}
+	lf->names[lf->count++] = xbps_xasprintf("%s.%s.%s", pkgver, arch, ext);
+}
+
+static void
+live_files_add_index(struct live_files *lf, xbps_dictionary_t idx)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t keysym;
+	xbps_dictionary_t pkgd;
+	const char *pkgver, *arch;
+
+	if (idx == NULL)
+		return;
+
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
+	while ((keysym = xbps_object_iterator_next(iter))) {
+		pkgd = xbps_dictionary_get_keysym(idx, keysym);
+		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) ||
+		    !xbps_dictionary_get_cstring_nocopy(pkgd, "architecture", &arch))
+			continue;
+		live_files_add(lf, pkgver, arch, "xbps");
+		/* deltas are kept while the registered pkg uses them */
+		if (xbps_dictionary_get(pkgd, "delta-base"))
+			live_files_add(lf, pkgver, arch, "xdlt");
+	}
+	xbps_object_iterator_release(iter);
+}
+
+static bool
+live_files_match(struct live_files *lf, const char *name)
+{
+	return bsearch(&name, lf->names, lf->count, sizeof(char *),
+	    name_cmp) != NULL;
+}
+
+static void
+live_files_free(struct live_files *lf)
+{
+	for (size_t i = 0; i < lf->count; i++)
+		free(lf->names[i]);
+	free(lf->names);
+}
+
+/*
+ * Returns true if the architecture of the "<pkgver>.<arch>.<ext>"
+ * filename matches the target architecture. Packages of other archs
+ * are registered in their own repository index and must be ignored.
+ */
+static bool
+binpkg_arch_match(struct xbps_handle *xhp, const char *name, const char *ext)
+{
+	char arch[64];
+	const char *p;
+	size_t len;
+
+	for (p = ext - 1; p > name && *p != '.'; p--)
+		;
+	if (p == name)
+		return false;
+	len = ext - p - 1;
+	if (len == 0 || len >= sizeof(arch))
+		return false;
+	memcpy(arch, p + 1, len);
+	arch[len] = '\0';
+
+	return xbps_pkg_arch_match(xhp, arch, NULL);
+}
+
 static int
-remove_pkg(const char *repodir, const char *file)
+remove_pkg(int dfd, const char *file, bool dryrun, uint64_t *bytes)
 {
-	char *filepath, *sigpath;
+	struct stat st;
+	char sigfile[PATH_MAX];
 	int rv = 0;
 
-	filepath = xbps_xasprintf("%s/%s", repodir, file);
-	sigpath = xbps_xasprintf("%s.sig", filepath);
-	if (remove(filepath) == -1) {
+	snprintf(sigfile, sizeof(sigfile), "%s.sig", file);
+	if (fstatat(dfd, file, &st, AT_SYMLINK_NOFOLLOW) == 0)
+		*bytes += st.st_size;
+	if (fstatat(dfd, sigfile, &st, AT_SYMLINK_NOFOLLOW) == 0)
+		*bytes += st.st_size;
+	if (dryrun)
+		return 0;
+
+	if (unlinkat(dfd, file, 0) == -1) {
 		if (errno != ENOENT) {
 			rv = errno;
 			fprintf(stderr, "xbps-rindex: failed to remove "
 			    "package `%s': %s\n", file, strerror(rv));
 		}
 	}
-	if (remove(sigpath) == -1) {
+	if (unlinkat(dfd, sigfile, 0) == -1) {
 		if (errno != ENOENT) {
 			rv = errno;
 			fprintf(stderr, "xbps-rindex: failed to remove "
-			    "package signature `%s': %s\n", sigpath, strerror(rv));
+			    "package signature `%s': %s\n", sigfile, strerror(rv));
 		}
 	}
-	free(sigpath);
-	free(filepath);
 
 	return rv;
 }
 
-static int
-cleaner_cb(struct xbps_handle *xhp, xbps_object_t obj, const char *key UNUSED, void *arg, bool *done UNUSED)
-{
-	struct xbps_repo *repo = ((struct xbps_repo **)arg)[0], *stage = ((struct xbps_repo **)arg)[1];
-	const char *binpkg;
-	char *pkgver, *arch = NULL;
-	int rv;
-
-	binpkg = xbps_string_cstring_nocopy(obj);
-	if (access(binpkg, R_OK) == -1) {
-		if (errno == ENOENT) {
-			if ((rv = remove_pkg(repo->uri, binpkg)) != 0)
-				return 0;
-
-			printf("Removed broken package `%s'.\n", binpkg);
-		}
-	}
-	arch = xbps_binpkg_arch(binpkg);
-	assert(arch);
-	/* ignore pkgs from other archs */
-	if (!xbps_pkg_arch_match(xhp, arch, NULL)) {
-		free(arch);
-		return 0;
-	}
-	free(arch);
-
-	pkgver = xbps_binpkg_pkgver(binpkg);
-	assert(pkgver);
-	if (xhp->flags & XBPS_FLAG_VERBOSE)
-		printf("checking %s (%s)\n", pkgver, binpkg);
-	/*
-	 * If binpkg is not registered in index, remove binpkg.
-	 */
-	if (!xbps_repo_get_pkg(repo, pkgver) && !(stage && xbps_repo_get_pkg(stage, pkgver))) {
-		if ((rv = remove_pkg(repo->uri, binpkg)) != 0) {
-			free(pkgver);
-			return 0;
-		}
-		printf("Removed obsolete package `%s'.\n", binpkg);
-	}
-	free(pkgver);
-	return 0;
-}
-
 int
-remove_obsoletes(struct xbps_handle *xhp, const char *repodir)
+remove_obsoletes(struct xbps_handle *xhp, const char *repodir, bool dryrun)
 {
-	xbps_array_t array = NULL;
-	struct xbps_repo *repos[2], *repo, *stage;
+	struct live_files lf = { NULL, 0, 0 };
+	struct xbps_repo *repo, *stage;
 	DIR *dirp;
 	struct dirent *dp;
-	char *ext;
+	char *ext, size[8];
+	uint64_t bytes = 0;
+	unsigned int removed = 0;
+	bool broken;
 	int rv = 0;
 
 	repo = xbps_repo_public_open(xhp, repodir);
@@ -128,41 +189,63 @@ remove_obsoletes(struct xbps_handle *xhp, const char *repodir)
 		return 0;
 	}
 	stage = xbps_repo_stage_open(xhp, repodir);
-	if (chdir(repodir) == -1) {
-		fprintf(stderr, "xbps-rindex: cannot chdir to %s: %s\n",
-		    repodir, strerror(errno));
-		free(repo);
-		if(stage)
-			free(stage);
-		return errno;
-	}
+	/*
+	 * Build the table of live filenames once, so that every file
+	 * of the directory is checked with a lookup.
+	 */
+	live_files_add_index(&lf, xbps_repo_get_index(repo));
+	if (stage)
+		live_files_add_index(&lf, xbps_repo_get_index(stage));
+	qsort(lf.names, lf.count, sizeof(char *), name_cmp);
+	xbps_repo_close(repo);
+	if (stage)
+		xbps_repo_close(stage);
+
 	if ((dirp = opendir(repodir)) == NULL) {
+		rv = errno;
 		fprintf(stderr, "xbps-rindex: failed to open %s: %s\n",
-		    repodir, strerror(errno));
-		free(repo);
-		return errno;
+		    repodir, strerror(rv));
+		live_files_free(&lf);
+		return rv;
 	}
 	while ((dp = readdir(dirp))) {
-		if (strcmp(dp->d_name, "..") == 0)
-			continue;
 		if ((ext = strrchr(dp->d_name, '.')) == NULL)
 			continue;
-		if (strcmp(ext, ".xbps"))
+		if (strcmp(ext, ".xbps") && strcmp(ext, ".xdlt"))
+			continue;
+		/* dangling symlinks are broken packages */
+		broken = false;
+		if ((dp->d_type == DT_LNK || dp->d_type == DT_UNKNOWN) &&
+		    faccessat(dirfd(dirp), dp->d_name, R_OK, 0) == -1 &&
+		    errno == ENOENT)
+			broken = true;
+		if (!broken) {
+			/* ignore pkgs from other archs */
+			if (!binpkg_arch_match(xhp, dp->d_name, ext))
+				continue;
+			if (xhp->flags & XBPS_FLAG_VERBOSE)
+				printf("checking %s\n", dp->d_name);
+			if (live_files_match(&lf, dp->d_name))
+				continue;
+		}
+		if (remove_pkg(dirfd(dirp), dp->d_name, dryrun, &bytes) != 0)
 			continue;
-		if (array == NULL)
-			array = xbps_array_create();
 
-		xbps_array_add_cstring(array, dp->d_name);
+		removed++;
+		printf("%s %s package `%s'.\n",
+		    dryrun ? "Would remove" : "Removed",
+		    broken ? "broken" : "obsolete", dp->d_name);
 	}
 	(void)closedir(dirp);
+	live_files_free(&lf);
 
-	repos[0] = repo;
-	repos[1] = stage;
-	rv = xbps_array_foreach_cb_multi(xhp, array, NULL, cleaner_cb, repos);
-	xbps_repo_close(repo);
-	if(stage)
-		xbps_repo_close(stage);
-	xbps_object_release(array);
+	if (removed) {
+		(void)xbps_humanize_number(size, (int64_t)bytes);
+		printf("%s %u package%s, %s %s.\n",
+		    dryrun ? "Would remove" : "Removed", removed,
+		    removed == 1 ? "" : "s", size,
+		    dryrun ? "would be reclaimed" : "reclaimed");
+	}
 
 	return rv;
 }
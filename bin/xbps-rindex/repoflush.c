@@ -33,45 +33,165 @@
 #include <libgen.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <pthread.h>
+
+#include <openssl/sha.h>
 
 #include <xbps.h>
 #include "defs.h"
 
-bool
-repodata_flush(struct xbps_handle *xhp, const char *repodir,
-	const char *reponame, xbps_dictionary_t idx, xbps_dictionary_t meta)
+/* the indexes of all archs may be written concurrently */
+static pthread_mutex_t umask_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static ssize_t
+count_cb(void *arg, const void *buf UNUSED, size_t len)
+{
+	*(size_t *)arg += len;
+	return (ssize_t)len;
+}
+
+static ssize_t
+write_cb(void *arg, const void *buf, size_t len)
+{
+	return archive_write_data(arg, buf, len);
+}
+
+/*
+ * Appends the XML plist of \a dict to the archive, without building
+ * the whole document in memory: it's externalized twice through a
+ * fixed size buffer, first to know its size for the entry header.
+ */
+static int
+archive_append_dict(struct archive *ar, xbps_dictionary_t dict,
+	const char *fname)
+{
+	struct archive_entry *entry;
+	size_t size = 0;
+	int rv = 0;
+
+	if (!xbps_dictionary_externalize_stream(dict, count_cb, &size))
+		return EINVAL;
+
+	entry = archive_entry_new();
+	assert(entry);
+	archive_entry_set_filetype(entry, AE_IFREG);
+	archive_entry_set_perm(entry, 0644);
+	archive_entry_set_uname(entry, "root");
+	archive_entry_set_gname(entry, "root");
+	archive_entry_set_pathname(entry, fname);
+	archive_entry_set_size(entry, size);
+
+	if (archive_write_header(ar, entry) != ARCHIVE_OK) {
+		rv = archive_errno(ar);
+	} else if (!xbps_dictionary_externalize_stream(dict, write_cb, ar)) {
+		rv = archive_errno(ar) ? archive_errno(ar) : EIO;
+	} else {
+		archive_write_finish_entry(ar);
+	}
+	archive_entry_free(entry);
+
+	return rv;
+}
+
+/*
+ * Appends the plist of \a dict to the archive as \a fname.
+ */
+static int
+archive_append_plist(struct xbps_handle *xhp, struct archive *ar,
+	xbps_dictionary_t dict, const char *fname)
+{
+	char *buf;
+	size_t buflen;
+	int rv;
+
+	if (!(xhp->flags & XBPS_FLAG_BINARY_PLISTS))
+		return archive_append_dict(ar, dict, fname);
+
+	buf = xbps_dictionary_externalize_binary(dict, &buflen);
+	assert(buf);
+	rv = xbps_archive_append_buf(ar, buf, buflen, fname, 0644,
+	    "root", "root");
+	free(buf);
+
+	return rv;
+}
+
+/*
+ * Creates the archive written to a tempfile of \a repofile, renamed
+ * by repo_archive_commit().
+ */
+static struct archive *
+repo_archive_create(const char *repofile, char **tname, int *repofd,
+	const char *compression)
 {
 	struct archive *ar;
-	char *repofile, *tname, *buf;
-	int rv, repofd = -1;
 	mode_t mask;
 
 	/* Create a tempfile for our repository archive */
-	repofile = xbps_repo_path_with_name(xhp, repodir, reponame);
-	tname = xbps_xasprintf("%s.XXXXXXXXXX", repofile);
+	*tname = xbps_xasprintf("%s.XXXXXXXXXX", repofile);
+	pthread_mutex_lock(&umask_mtx);
 	mask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
-	if ((repofd = mkstemp(tname)) == -1)
-		return false;
-
+	*repofd = mkstemp(*tname);
 	umask(mask);
+	pthread_mutex_unlock(&umask_mtx);
+	if (*repofd == -1) {
+		free(*tname);
+		*tname = NULL;
+		return NULL;
+	}
+
 	/* Create and write our repository archive */
 	ar = archive_write_new();
 	assert(ar);
-	archive_write_set_compression_gzip(ar);
+	/*
+	 * gzip by default, older xbps versions can't read anything else;
+	 * otherwise "none" is the only format left.
+	 */
+	if (compression == NULL || strcmp(compression, "gzip") == 0) {
+		archive_write_set_compression_gzip(ar);
+		archive_write_set_options(ar, "compression-level=9");
+	} else if (strcmp(compression, "bzip2") == 0) {
+		archive_write_set_compression_bzip2(ar);
+		archive_write_set_options(ar, "compression-level=9");
+	} else if (strcmp(compression, "xz") == 0) {
+		archive_write_set_compression_xz(ar);
+	} else if (strcmp(compression, "zstd") == 0) {
+		archive_write_add_filter_zstd(ar);
+		archive_write_set_options(ar, "compression-level=19");
+	}
 	archive_write_set_format_pax_restricted(ar);
-	archive_write_set_options(ar, "compression-level=9");
-	archive_write_open_fd(ar, repofd);
+	archive_write_open_fd(ar, *repofd);
 
-	/* XBPS_REPOIDX */
-	buf = xbps_dictionary_externalize(idx);
-	assert(buf);
-	rv = xbps_archive_append_buf(ar, buf, strlen(buf),
-	    XBPS_REPOIDX, 0644, "root", "root");
-	free(buf);
-	if (rv != 0)
-		return false;
+	return ar;
+}
+
+static void
+repo_archive_commit(struct archive *ar, int repofd, const char *tname,
+	const char *repofile)
+{
+	/* Write data to tempfile and rename */
+	archive_write_finish(ar);
+#ifdef HAVE_FDATASYNC
+	fdatasync(repofd);
+#else
+	fsync(repofd);
+#endif
+	/* not in assert(3), it must be done with NDEBUG too */
+	(void)fchmod(repofd, 0664);
+	close(repofd);
+	rename(tname, repofile);
+}
+
+/*
+ * Appends the index metadata to the archive, a fake entry if the
+ * repository isn't signed.
+ */
+static int
+archive_append_meta(struct archive *ar, xbps_dictionary_t meta)
+{
+	char *buf;
+	int rv;
 
-	/* XBPS_REPOIDX_META */
 	if (meta == NULL) {
 		/* fake entry */
 		buf = strdup("DEADBEEF");
@@ -81,21 +201,460 @@ repodata_flush(struct xbps_handle *xhp, const char *repodir,
 	rv = xbps_archive_append_buf(ar, buf, strlen(buf),
 	    XBPS_REPOIDX_META, 0644, "root", "root");
 	free(buf);
+
+	return rv;
+}
+
+/*
+ * The index is also written split in shards, <arch>-shards.d/<xx> where
+ * xx is the first byte of the SHA256 of the pkgname, and listed with
+ * the SHA256 of their index plist in the <arch>-shards manifest, along
+ * with the index metadata. Remote repositories are synchronized by
+ * fetching the manifest and the shards that changed, a new package
+ * only rewrites its shard.
+ */
+static void
+shard_name(const char *pkgname, char *name, size_t len)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+
+	SHA256((const unsigned char *)pkgname, strlen(pkgname), digest);
+	snprintf(name, len, "%02x", digest[0]);
+}
+
+static ssize_t
+hash_cb(void *arg, const void *buf, size_t len)
+{
+	SHA256_Update(arg, buf, len);
+	return (ssize_t)len;
+}
+
+/*
+ * Returns the SHA256 of the plist of \a dict as it's stored by
+ * archive_append_plist().
+ */
+static bool
+shard_hash(struct xbps_handle *xhp, xbps_dictionary_t dict, char *hash)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256_CTX ctx;
+	char *buf;
+	size_t buflen;
+
+	SHA256_Init(&ctx);
+	if (xhp->flags & XBPS_FLAG_BINARY_PLISTS) {
+		buf = xbps_dictionary_externalize_binary(dict, &buflen);
+		assert(buf);
+		SHA256_Update(&ctx, buf, buflen);
+		free(buf);
+	} else if (!xbps_dictionary_externalize_stream(dict, hash_cb, &ctx)) {
+		return false;
+	}
+	SHA256_Final(digest, &ctx);
+	for (unsigned int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		sprintf(hash + i * 2, "%02x", digest[i]);
+
+	return true;
+}
+
+/*
+ * Splits the index by shard name.
+ */
+static xbps_dictionary_t
+shards_split(xbps_dictionary_t idx)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	xbps_dictionary_t parts, part;
+	const char *pkgname;
+	char name[3];
+
+	parts = xbps_dictionary_create();
+	assert(parts);
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		pkgname = xbps_dictionary_keysym_cstring_nocopy(obj);
+		shard_name(pkgname, name, sizeof(name));
+		if ((part = xbps_dictionary_get(parts, name)) == NULL) {
+			part = xbps_dictionary_create();
+			assert(part);
+			xbps_dictionary_set(parts, name, part);
+			xbps_object_release(part);
+		}
+		xbps_dictionary_set(part, pkgname,
+		    xbps_dictionary_get_keysym(idx, obj));
+	}
+	xbps_object_iterator_release(iter);
+
+	return parts;
+}
+
+/*
+ * Writes the shards whose index changed and the manifest. A shard is
+ * kept if its hash matches the previous manifest and it's not newer,
+ * i.e it wasn't written by an interrupted flush.
+ */
+static int
+shards_flush(struct xbps_handle *xhp, const char *repodir,
+	xbps_dictionary_t idx, xbps_dictionary_t meta, const char *compression)
+{
+	struct archive *ar;
+	struct stat st;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	xbps_dictionary_t parts, part, shards, oldshards = NULL;
+	const char *name, *oldhash;
+	char hash[SHA256_DIGEST_LENGTH * 2 + 1];
+	char *manifest, *shardsdir, *shardfile, *tname;
+	time_t mtime = 0;
+	int rv = 0, fd = -1;
+
+	manifest = xbps_repo_path_with_name(xhp, repodir, "shards");
+	shardsdir = xbps_xasprintf("%s.d", manifest);
+	if (xbps_mkpath(shardsdir, 0755) == -1 && errno != EEXIST) {
+		rv = errno;
+		goto out;
+	}
+	if (stat(manifest, &st) == 0) {
+		mtime = st.st_mtime;
+		oldshards = xbps_archive_fetch_plist(manifest,
+		    XBPS_REPOIDX_SHARDS);
+	}
+
+	parts = shards_split(idx);
+	shards = xbps_dictionary_create();
+	assert(shards);
+	iter = xbps_dictionary_iterator(parts);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		name = xbps_dictionary_keysym_cstring_nocopy(obj);
+		part = xbps_dictionary_get_keysym(parts, obj);
+		if (!shard_hash(xhp, part, hash)) {
+			rv = EINVAL;
+			break;
+		}
+		xbps_dictionary_set_cstring(shards, name, hash);
+		shardfile = xbps_xasprintf("%s/%s", shardsdir, name);
+		if (xbps_dictionary_get_cstring_nocopy(oldshards, name,
+		    &oldhash) && strcmp(oldhash, hash) == 0 &&
+		    stat(shardfile, &st) == 0 && st.st_mtime <= mtime) {
+			free(shardfile);
+			continue;
+		}
+		ar = repo_archive_create(shardfile, &tname, &fd, compression);
+		if (ar == NULL) {
+			rv = errno;
+			free(shardfile);
+			break;
+		}
+		rv = archive_append_plist(xhp, ar, part, XBPS_REPOIDX);
+		repo_archive_commit(ar, fd, tname, shardfile);
+		free(shardfile);
+		free(tname);
+		if (rv != 0)
+			break;
+	}
+	xbps_object_iterator_release(iter);
+	xbps_object_release(parts);
+	if (rv != 0) {
+		xbps_object_release(shards);
+		goto out;
+	}
+
+	/* remove the shards left empty */
+	if (oldshards != NULL) {
+		iter = xbps_dictionary_iterator(oldshards);
+		assert(iter);
+		while ((obj = xbps_object_iterator_next(iter))) {
+			name = xbps_dictionary_keysym_cstring_nocopy(obj);
+			if (xbps_dictionary_get(shards, name))
+				continue;
+			shardfile = xbps_xasprintf("%s/%s", shardsdir, name);
+			(void)unlink(shardfile);
+			free(shardfile);
+		}
+		xbps_object_iterator_release(iter);
+	}
+
+	/* the manifest is written last */
+	ar = repo_archive_create(manifest, &tname, &fd, compression);
+	if (ar == NULL) {
+		rv = errno;
+	} else {
+		if ((rv = archive_append_plist(xhp, ar, shards,
+		    XBPS_REPOIDX_SHARDS)) == 0)
+			rv = archive_append_meta(ar, meta);
+		repo_archive_commit(ar, fd, tname, manifest);
+		free(tname);
+	}
+	xbps_object_release(shards);
+out:
+	if (oldshards != NULL)
+		xbps_object_release(oldshards);
+	free(shardsdir);
+	free(manifest);
+
+	return rv;
+}
+
+bool
+repodata_flush(struct xbps_handle *xhp, const char *repodir,
+	const char *reponame, xbps_dictionary_t idx, xbps_dictionary_t meta,
+	xbps_dictionary_t shlibs, const char *compression)
+{
+	struct archive *ar;
+	xbps_dictionary_t revdeps, table = NULL;
+	char *repofile, *tname;
+	int rv, repofd = -1;
+
+	repofile = xbps_repo_path_with_name(xhp, repodir, reponame);
+	ar = repo_archive_create(repofile, &tname, &repofd, compression);
+	if (ar == NULL) {
+		free(repofile);
+		return false;
+	}
+
+	/* XBPS_REPOIDX */
+	if ((rv = archive_append_plist(xhp, ar, idx, XBPS_REPOIDX)) != 0)
+		return false;
+
+	/* XBPS_REPOIDX_META */
+	if ((rv = archive_append_meta(ar, meta)) != 0)
+		return false;
+
+	/* XBPS_REPOIDX_REVDEPS */
+	revdeps = xbps_repo_index_revdeps(idx);
+	assert(revdeps);
+	rv = archive_append_plist(xhp, ar, revdeps, XBPS_REPOIDX_REVDEPS);
+	xbps_object_release(revdeps);
 	if (rv != 0)
 		return false;
 
-	/* Write data to tempfile and rename */
-	archive_write_finish(ar);
-#ifdef HAVE_FDATASYNC
-	fdatasync(repofd);
-#else
-	fsync(repofd);
-#endif
-	assert(fchmod(repofd, 0664) != -1);
-	close(repofd);
-	rename(tname, repofile);
+	/* XBPS_REPOIDX_SHLIBS, built from the index if not kept updated */
+	if (shlibs == NULL) {
+		table = xbps_repo_index_shlibs(idx);
+		assert(table);
+		shlibs = table;
+	}
+	rv = archive_append_plist(xhp, ar, shlibs, XBPS_REPOIDX_SHLIBS);
+	if (table)
+		xbps_object_release(table);
+	if (rv != 0)
+		return false;
+
+	repo_archive_commit(ar, repofd, tname, repofile);
+	/* Binary index map for fast lookups */
+	if (strcmp(reponame, "repodata") == 0 &&
+	    (rv = xbps_repo_write_idxmap(xhp, repofile, idx, meta)) != 0) {
+		fprintf(stderr, "%s: failed to write index map: %s\n",
+		    _XBPS_RINDEX, strerror(rv));
+	}
+	/* Shards for remote clients to fetch only what changed */
+	if (strcmp(reponame, "repodata") == 0 &&
+	    (rv = shards_flush(xhp, repodir, idx, meta, compression)) != 0) {
+		fprintf(stderr, "%s: failed to write index shards: %s\n",
+		    _XBPS_RINDEX, strerror(rv));
+	}
 	free(repofile);
 	free(tname);
 
 	return true;
 }
+
+/*
+ * Returns the files of binary package \a pkgver for the files index:
+ * the "conf_files", "files" and "links" arrays of its files.plist, with
+ * the path and target of every entry.
+ */
+static xbps_dictionary_t
+repofiles_pkg(const char *repodir, const char *pkgver, const char *arch)
+{
+	const char *keys[] = { "conf_files", "files", "links" };
+	xbps_dictionary_t filesd, d;
+	char *binpkg;
+
+	binpkg = xbps_xasprintf("%s/%s.%s.xbps", repodir, pkgver, arch);
+	filesd = xbps_archive_fetch_plist(binpkg, "/files.plist");
+	free(binpkg);
+	if (filesd == NULL)
+		return NULL;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	for (unsigned int i = 0; i < __arraycount(keys); i++) {
+		xbps_array_t array, files = NULL;
+
+		array = xbps_dictionary_get(filesd, keys[i]);
+		for (unsigned int x = 0; x < xbps_array_count(array); x++) {
+			xbps_dictionary_t obj = xbps_array_get(array, x), f;
+			const char *file = NULL, *tgt = NULL;
+
+			if (!xbps_dictionary_get_cstring_nocopy(obj, "file", &file))
+				continue;
+			if (files == NULL) {
+				files = xbps_array_create();
+				assert(files);
+			}
+			f = xbps_dictionary_create();
+			assert(f);
+			xbps_dictionary_set_cstring(f, "file", file);
+			if (xbps_dictionary_get_cstring_nocopy(obj, "target", &tgt))
+				xbps_dictionary_set_cstring(f, "target", tgt);
+			xbps_array_add(files, f);
+			xbps_object_release(f);
+		}
+		if (files) {
+			xbps_dictionary_set(d, keys[i], files);
+			xbps_object_release(files);
+		}
+	}
+	xbps_object_release(filesd);
+
+	return d;
+}
+
+static bool
+repofiles_registered(xbps_dictionary_t idx, const char *pkgver)
+{
+	xbps_dictionary_t pkgd;
+	const char *curpkgver;
+	char *pkgname;
+
+	if ((pkgname = xbps_pkg_name(pkgver)) == NULL)
+		return false;
+	pkgd = xbps_dictionary_get(idx, pkgname);
+	free(pkgname);
+
+	return xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &curpkgver) &&
+	    strcmp(pkgver, curpkgver) == 0;
+}
+
+static bool
+repofiles_add(xbps_dictionary_t files, const char *repodir,
+	xbps_dictionary_t idx)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	bool changed = false;
+
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_dictionary_t pkgd, d;
+		const char *pkgver = NULL, *arch = NULL;
+
+		pkgd = xbps_dictionary_get_keysym(idx, obj);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "architecture", &arch);
+		if (pkgver == NULL || arch == NULL ||
+		    xbps_dictionary_get(files, pkgver))
+			continue;
+		if ((d = repofiles_pkg(repodir, pkgver, arch)) == NULL) {
+			fprintf(stderr, "index: failed to read files of `%s', "
+			    "skipping!\n", pkgver);
+			continue;
+		}
+		xbps_dictionary_set(files, pkgver, d);
+		xbps_object_release(d);
+		changed = true;
+	}
+	xbps_object_iterator_release(iter);
+
+	return changed;
+}
+
+/*
+ * Updates the files index of the repository, the files of the packages
+ * in \a idx and \a stage keyed by their pkgver, and writes it to the
+ * <arch>-files archive if it changed: the files of new packages are read
+ * from their binary packages in \a repodir, and those of packages no
+ * longer registered are dropped.
+ */
+bool
+repofiles_flush(struct xbps_handle *xhp, const char *repodir,
+	xbps_dictionary_t files, xbps_dictionary_t idx, xbps_dictionary_t stage,
+	const char *compression)
+{
+	struct archive *ar;
+	xbps_array_t allkeys;
+	char *repofile, *tname;
+	int rv, repofd = -1;
+	bool changed;
+
+	repofile = xbps_repo_path_with_name(xhp, repodir, "files");
+	changed = access(repofile, F_OK) == -1;
+
+	allkeys = xbps_dictionary_all_keys(files);
+	for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+		const char *pkgver = xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(allkeys, i));
+
+		if (repofiles_registered(idx, pkgver) ||
+		    repofiles_registered(stage, pkgver))
+			continue;
+		xbps_dictionary_remove(files, pkgver);
+		changed = true;
+	}
+	xbps_object_release(allkeys);
+	if (repofiles_add(files, repodir, idx))
+		changed = true;
+	if (stage && repofiles_add(files, repodir, stage))
+		changed = true;
+	if (!changed) {
+		free(repofile);
+		return true;
+	}
+
+	ar = repo_archive_create(repofile, &tname, &repofd, compression);
+	if (ar == NULL) {
+		free(repofile);
+		return false;
+	}
+	if ((rv = archive_append_plist(xhp, ar, files, XBPS_REPOIDX_FILES)) == 0) {
+		repo_archive_commit(ar, repofd, tname, repofile);
+	} else {
+		archive_write_finish(ar);
+		close(repofd);
+		(void)unlink(tname);
+		errno = rv;
+	}
+	free(repofile);
+	free(tname);
+
+	return rv == 0;
+}
+
+/*
+ * Adds to \a archs the architectures of the repository in \a repodir,
+ * those with an index or a queue of packages.
+ */
+void
+repodata_archs(const char *repodir, xbps_dictionary_t archs)
+{
+	const char *suffixes[] = { "-repodata", "-repodata.queue",
+	    "-repodata.spool" };
+	DIR *dirp;
+	struct dirent *dp;
+	size_t len, slen;
+	char *arch;
+
+	if ((dirp = opendir(repodir)) == NULL)
+		return;
+
+	while ((dp = readdir(dirp))) {
+		len = strlen(dp->d_name);
+		for (unsigned int i = 0; i < __arraycount(suffixes); i++) {
+			slen = strlen(suffixes[i]);
+			if (len <= slen ||
+			    strcmp(dp->d_name + len - slen, suffixes[i]))
+				continue;
+			arch = strndup(dp->d_name, len - slen);
+			assert(arch);
+			xbps_dictionary_set_bool(archs, arch, true);
+			free(arch);
+			break;
+		}
+	}
+	(void)closedir(dirp);
+}
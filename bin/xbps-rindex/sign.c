@@ -23,52 +23,69 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <openssl/err.h>
 #include <openssl/sha.h>
 #include <openssl/rsa.h>
 #include <openssl/ssl.h>
 #include <openssl/pem.h>
+#include <openssl/evp.h>
 
 #include "defs.h"
 
-static RSA *
-load_rsa_privkey(const char *path)
+static EVP_PKEY *
+load_privkey(const char *path)
 {
 	FILE *fp;
-	RSA *rsa = NULL;
+	EVP_PKEY *pkey = NULL;
 	const char *p;
 	char *passphrase = NULL;
 
 	if ((fp = fopen(path, "r")) == 0)
 		return NULL;
 
-	if ((rsa = RSA_new()) == NULL) {
-		fclose(fp);
-		return NULL;
-	}
-
 	p = getenv("XBPS_PASSPHRASE");
 	if (p) {
 		passphrase = strdup(p);
 	}
-	rsa = PEM_read_RSAPrivateKey(fp, 0, NULL, passphrase);
+	pkey = PEM_read_PrivateKey(fp, NULL, NULL, passphrase);
 	if (passphrase) {
 		free(passphrase);
 		passphrase = NULL;
 	}
 	fclose(fp);
-	return rsa;
+	return pkey;
+}
+
+/*
+ * Returns the signature scheme of the key, as declared by the
+ * "signature-type" object of the repository metadata.
+ */
+static const char *
+privkey_type(EVP_PKEY *pkey)
+{
+	switch (EVP_PKEY_base_id(pkey)) {
+	case EVP_PKEY_RSA:
+		return "rsa";
+#ifdef EVP_PKEY_ED25519
+	case EVP_PKEY_ED25519:
+		return "ed25519";
+#endif
+	default:
+		return NULL;
+	}
 }
 
 static char *
-pubkey_from_privkey(RSA *rsa)
+pubkey_from_privkey(EVP_PKEY *pkey)
 {
 	BIO *bp;
 	char *buf = NULL;
@@ -77,7 +94,7 @@ pubkey_from_privkey(RSA *rsa)
 	bp = BIO_new(BIO_s_mem());
 	assert(bp);
 
-	if (!PEM_write_bio_RSA_PUBKEY(bp, rsa)) {
+	if (!PEM_write_bio_PUBKEY(bp, pkey)) {
 		fprintf(stderr, "error writing public key: %s\n",
 		    ERR_error_string(ERR_get_error(), NULL));
 		BIO_free(bp);
@@ -94,35 +111,84 @@ pubkey_from_privkey(RSA *rsa)
 }
 
 static bool
-rsa_sign_file(RSA *rsa, const char *file,
+rsa_sign_hash(EVP_PKEY *pkey, unsigned char *sha256,
+	 unsigned char *sigret, unsigned int *siglen)
+{
+	RSA *rsa;
+	int rv;
+
+	if ((rsa = EVP_PKEY_get1_RSA(pkey)) == NULL)
+		return false;
+
+	rv = RSA_sign(NID_sha1, sha256, SHA256_DIGEST_LENGTH,
+	    sigret, siglen, rsa);
+	RSA_free(rsa);
+
+	return rv ? true : false;
+}
+
+#ifdef EVP_PKEY_ED25519
+/*
+ * Ed25519 signs the SHA256 digest of the file, as RSA does, so that
+ * the file doesn't need to be kept in memory.
+ */
+static bool
+ed25519_sign_hash(EVP_PKEY *pkey, unsigned char *sha256,
+	 unsigned char *sigret, unsigned int *siglen)
+{
+	EVP_MD_CTX *mdctx;
+	size_t len = EVP_PKEY_size(pkey);
+	bool rv = false;
+
+	if ((mdctx = EVP_MD_CTX_new()) == NULL)
+		return false;
+
+	if (EVP_DigestSignInit(mdctx, NULL, NULL, NULL, pkey) == 1 &&
+	    EVP_DigestSign(mdctx, sigret, &len, sha256,
+	    SHA256_DIGEST_LENGTH) == 1) {
+		*siglen = len;
+		rv = true;
+	}
+	EVP_MD_CTX_free(mdctx);
+
+	return rv;
+}
+#endif
+
+static bool
+sign_file(EVP_PKEY *pkey, const char *file,
 	 unsigned char **sigret, unsigned int *siglen)
 {
 	unsigned char *sha256;
+	bool rv;
 
 	sha256 = xbps_file_hash_raw(file);
 	if(!sha256)
 		return false;
 
-	if ((*sigret = calloc(1, RSA_size(rsa) + 1)) == NULL) {
+	if ((*sigret = calloc(1, EVP_PKEY_size(pkey) + 1)) == NULL) {
 		free(sha256);
 		return false;
 	}
 
-	if (!RSA_sign(NID_sha1, sha256, SHA256_DIGEST_LENGTH,
-				*sigret, siglen, rsa)) {
-		free(sha256);
-		free(*sigret);
-		return false;
-	}
+#ifdef EVP_PKEY_ED25519
+	if (EVP_PKEY_base_id(pkey) == EVP_PKEY_ED25519)
+		rv = ed25519_sign_hash(pkey, sha256, *sigret, siglen);
+	else
+#endif
+		rv = rsa_sign_hash(pkey, sha256, *sigret, siglen);
 
 	free(sha256);
-	return true;
+	if (!rv)
+		free(*sigret);
+
+	return rv;
 }
 
-static RSA *
-load_rsa_key(const char *privkey)
+static EVP_PKEY *
+load_key(const char *privkey)
 {
-	RSA *rsa = NULL;
+	EVP_PKEY *pkey = NULL;
 	char *defprivkey;
 
 	/*
@@ -133,33 +199,61 @@ load_rsa_key(const char *privkey)
 	else
 		defprivkey = strdup(privkey);
 
-	if ((rsa = load_rsa_privkey(defprivkey)) == NULL) {
-		fprintf(stderr, "%s: failed to read the RSA privkey\n", _XBPS_RINDEX);
+	if ((pkey = load_privkey(defprivkey)) == NULL) {
+		fprintf(stderr, "%s: failed to read the privkey\n", _XBPS_RINDEX);
+		exit(EXIT_FAILURE);
+	}
+	if (privkey_type(pkey) == NULL) {
+		fprintf(stderr, "%s: unsupported privkey type, only RSA and "
+		    "Ed25519 keys can be used\n", _XBPS_RINDEX);
 		exit(EXIT_FAILURE);
 	}
 	free(defprivkey);
 	defprivkey = NULL;
 
-	return rsa;
+	return pkey;
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static pthread_mutex_t *ssl_locks;
+
+static void
+ssl_locking_cb(int mode, int n, const char *file UNUSED, int line UNUSED)
+{
+	if (mode & CRYPTO_LOCK)
+		pthread_mutex_lock(&ssl_locks[n]);
+	else
+		pthread_mutex_unlock(&ssl_locks[n]);
 }
+#endif
 
 static void
 ssl_init(void)
 {
 	SSL_load_error_strings();
 	SSL_library_init();
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	/* the key is shared by the signing threads */
+	if (CRYPTO_get_locking_callback() == NULL) {
+		ssl_locks = calloc(CRYPTO_num_locks(), sizeof(*ssl_locks));
+		assert(ssl_locks);
+		for (int i = 0; i < CRYPTO_num_locks(); i++)
+			pthread_mutex_init(&ssl_locks[i], NULL);
+		CRYPTO_set_locking_callback(ssl_locking_cb);
+	}
+#endif
 }
 
 int
 sign_repo(struct xbps_handle *xhp, const char *repodir,
-	const char *privkey, const char *signedby)
+	const char *privkey, const char *signedby, const char *compression)
 {
 	struct xbps_repo *repo = NULL;
 	xbps_dictionary_t meta = NULL;
 	xbps_data_t data = NULL, rpubkey = NULL;
-	RSA *rsa = NULL;
+	EVP_PKEY *pkey = NULL;
 	uint16_t rpubkeysize, pubkeysize;
-	const char *rsignedby = NULL;
+	const char *rsignedby = NULL, *rsigtype = NULL, *sigtype;
 	char *buf = NULL, *rlockfname = NULL;
 	int rlockfd = -1, rv = 0;
 	bool flush_failed = false, flush = false;
@@ -179,7 +273,7 @@ sign_repo(struct xbps_handle *xhp, const char *repodir,
 		    _XBPS_RINDEX, strerror(errno));
 		goto out;
 	}
-	if (xbps_dictionary_count(repo->idx) == 0) {
+	if (xbps_dictionary_count(xbps_repo_get_index(repo)) == 0) {
 		fprintf(stderr, "%s: invalid repository, existing!\n", _XBPS_RINDEX);
 		rv = EINVAL;
 		goto out;
@@ -187,12 +281,13 @@ sign_repo(struct xbps_handle *xhp, const char *repodir,
 
 	ssl_init();
 
-	rsa = load_rsa_key(privkey);
+	pkey = load_key(privkey);
+	sigtype = privkey_type(pkey);
 	/*
 	 * Check if repository index-meta contains changes compared to its
 	 * current state.
 	 */
-	if ((buf = pubkey_from_privkey(rsa)) == NULL) {
+	if ((buf = pubkey_from_privkey(pkey)) == NULL) {
 		rv = EINVAL;
 		goto out;
 	}
@@ -205,7 +300,11 @@ sign_repo(struct xbps_handle *xhp, const char *repodir,
 
 	free(buf);
 
-	pubkeysize = RSA_size(rsa) * 8;
+	/* Ed25519 public keys are 32 bytes */
+	if (strcmp(sigtype, "ed25519") == 0)
+		pubkeysize = 256;
+	else
+		pubkeysize = EVP_PKEY_bits(pkey);
 	xbps_dictionary_get_uint16(repo->idxmeta, "public-key-size", &rpubkeysize);
 	if (rpubkeysize != pubkeysize)
 		flush = true;
@@ -214,13 +313,17 @@ sign_repo(struct xbps_handle *xhp, const char *repodir,
 	if (rsignedby == NULL || strcmp(rsignedby, signedby))
 		flush = true;
 
+	xbps_dictionary_get_cstring_nocopy(repo->idxmeta, "signature-type", &rsigtype);
+	if (rsigtype == NULL || strcmp(rsigtype, sigtype))
+		flush = true;
+
 	if (!flush)
 		goto out;
 
 	xbps_dictionary_set(meta, "public-key", data);
 	xbps_dictionary_set_uint16(meta, "public-key-size", pubkeysize);
 	xbps_dictionary_set_cstring_nocopy(meta, "signature-by", signedby);
-	xbps_dictionary_set_cstring_nocopy(meta, "signature-type", "rsa");
+	xbps_dictionary_set_cstring_nocopy(meta, "signature-type", sigtype);
 	xbps_object_release(data);
 	data = NULL;
 
@@ -231,7 +334,8 @@ sign_repo(struct xbps_handle *xhp, const char *repodir,
 		    _XBPS_RINDEX, strerror(errno));
 		goto out;
 	}
-	flush_failed = repodata_flush(xhp, repodir, "repodata", repo->idx, meta);
+	flush_failed = repodata_flush(xhp, repodir, "repodata", repo->idx, meta,
+	    xbps_repo_get_shlibs(repo), compression);
 	xbps_repo_unlock(rlockfd, rlockfname);
 	if (!flush_failed) {
 		fprintf(stderr, "failed to write repodata: %s\n", strerror(errno));
@@ -242,9 +346,9 @@ sign_repo(struct xbps_handle *xhp, const char *repodir,
 	    xbps_dictionary_count(repo->idx) == 1 ? "" : "s");
 
 out:
-	if (rsa) {
-		RSA_free(rsa);
-		rsa = NULL;
+	if (pkey) {
+		EVP_PKEY_free(pkey);
+		pkey = NULL;
 	}
 	if (repo)
 		xbps_repo_close(repo);
@@ -253,9 +357,9 @@ out:
 }
 
 static int
-sign_pkg(struct xbps_handle *xhp, const char *binpkg, const char *privkey, bool force)
+sign_pkg(struct xbps_handle *xhp, const char *binpkg, EVP_PKEY *pkey, bool force)
 {
-	RSA *rsa = NULL;
+	struct stat st, sigst;
 	unsigned char *sig = NULL;
 	unsigned int siglen = 0;
 	char *sigfile = NULL;
@@ -263,20 +367,21 @@ sign_pkg(struct xbps_handle *xhp, const char *binpkg, const char *privkey, bool
 
 	sigfile = xbps_xasprintf("%s.sig", binpkg);
 	/*
-	 * Skip pkg if file signature exists
+	 * Skip pkg if its file signature is newer and has the size of the
+	 * signatures made with this key.
 	 */
-	if (!force && ((sigfile_fd = access(sigfile, R_OK)) == 0)) {
+	if (!force && stat(sigfile, &sigst) == 0 && stat(binpkg, &st) == 0 &&
+	    sigst.st_mtime >= st.st_mtime &&
+	    sigst.st_size == (off_t)EVP_PKEY_size(pkey)) {
 		if (xhp->flags & XBPS_FLAG_VERBOSE)
 			fprintf(stderr, "skipping %s, file signature found.\n", binpkg);
 
-		sigfile_fd = -1;
 		goto out;
 	}
 	/*
 	 * Generate pkg file signature.
 	 */
-	rsa = load_rsa_key(privkey);
-	if (!rsa_sign_file(rsa, binpkg, &sig, &siglen)) {
+	if (!sign_file(pkey, binpkg, &sig, &siglen)) {
 		fprintf(stderr, "failed to sign %s: %s\n", binpkg, strerror(errno));
 		rv = EINVAL;
 		goto out;
@@ -284,11 +389,7 @@ sign_pkg(struct xbps_handle *xhp, const char *binpkg, const char *privkey, bool
 	/*
 	 * Write pkg file signature.
 	 */
-	if (force)
-		sigfile_fd = open(sigfile, O_WRONLY|O_TRUNC, 0644);
-	else
-		sigfile_fd = creat(sigfile, 0644);
-
+	sigfile_fd = open(sigfile, O_WRONLY|O_CREAT|O_TRUNC, 0644);
 	if (sigfile_fd == -1) {
 		fprintf(stderr, "failed to create %s: %s\n", sigfile, strerror(errno));
 		rv = EINVAL;
@@ -305,10 +406,6 @@ sign_pkg(struct xbps_handle *xhp, const char *binpkg, const char *privkey, bool
 	printf("signed successfully %s\n", binpkg);
 
 out:
-	if (rsa) {
-		RSA_free(rsa);
-		rsa = NULL;
-	}
 	if (sigfile)
 		free(sigfile);
 	if (sigfile_fd != -1)
@@ -317,20 +414,66 @@ out:
 	return rv;
 }
 
+struct SignCbInfo {
+	EVP_PKEY *pkey;
+	bool force;
+	pthread_mutex_t lock;
+	int rv;
+};
+
+static int
+sign_pkg_cb(struct xbps_handle *xhp,
+		xbps_object_t obj,
+		const char *key UNUSED,
+		void *arg,
+		bool *done UNUSED)
+{
+	struct SignCbInfo *info = arg;
+	int rv;
+
+	/* stop after the first failure */
+	pthread_mutex_lock(&info->lock);
+	rv = info->rv;
+	pthread_mutex_unlock(&info->lock);
+	if (rv != 0)
+		return rv;
+
+	rv = sign_pkg(xhp, xbps_string_cstring_nocopy(obj), info->pkey,
+	    info->force);
+	if (rv != 0) {
+		pthread_mutex_lock(&info->lock);
+		if (info->rv == 0)
+			info->rv = rv;
+		pthread_mutex_unlock(&info->lock);
+	}
+	return rv;
+}
+
 int
 sign_pkgs(struct xbps_handle *xhp, int args, int argmax, char **argv,
 		const char *privkey, bool force)
 {
+	struct SignCbInfo info = {
+		.force = force,
+		.lock = PTHREAD_MUTEX_INITIALIZER
+	};
+	xbps_array_t pkgs;
+
 	ssl_init();
+	info.pkey = load_key(privkey);
 	/*
-	 * Process all packages specified in argv.
+	 * Sign all packages specified in argv, by one thread per
+	 * online processor.
 	 */
-	for (int i = args; i < argmax; i++) {
-		int rv;
-		const char *binpkg = argv[i];
-		rv = sign_pkg(xhp, binpkg, privkey, force);
-		if (rv != 0)
-			return rv;
-	}
-	return 0;
+	pkgs = xbps_array_create();
+	assert(pkgs);
+	for (int i = args; i < argmax; i++)
+		xbps_array_add_cstring_nocopy(pkgs, argv[i]);
+
+	(void)xbps_array_foreach_cb_multi(xhp, pkgs, NULL, sign_pkg_cb, &info);
+
+	xbps_object_release(pkgs);
+	EVP_PKEY_free(info.pkey);
+
+	return info.rv;
 }
@@ -29,7 +29,10 @@
  *
  * 	- This uses IPC/PID/UTS namespaces, nothing more.
  * 	- Disables namespace features if running inside containers.
- * 	- Supports overlayfs on a temporary directory or a tmpfs mount.
+ * 	- Supports overlayfs on a temporary directory, a tmpfs mount or
+ * 	  a btrfs subvolume, with additional read-only lower layers.
+ * 	- Supports read-only snapshots of <dir> as overlayfs lowerdir,
+ * 	  keyed by the set of installed packages.
  */
 #define _GNU_SOURCE
 #define _XOPEN_SOURCE 700
@@ -37,6 +40,9 @@
 #include <sys/prctl.h>
 #include <sys/fsuid.h>
 #include <sys/mount.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -52,6 +58,9 @@
 #include <ftw.h>
 #include <signal.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <linux/btrfs.h>
+#include <linux/fs.h>
 
 #include <xbps.h>
 #include "queue.h"
@@ -79,18 +88,23 @@ struct bindmnt {
 };
 
 static char *tmpdir;
-static bool overlayfs_on_tmpfs;
+static bool overlayfs_on_tmpfs, overlayfs_on_subvol;
 static SIMPLEQ_HEAD(bindmnt_head, bindmnt) bindmnt_queue =
     SIMPLEQ_HEAD_INITIALIZER(bindmnt_queue);
 
 static void __attribute__((noreturn))
 usage(const char *p)
 {
-	printf("Usage: %s [-b src:dest] [-O -t -o <opts>] <dir> <cmd> [<cmdargs>]\n\n"
+	printf("Usage: %s [-b src:dest] [-O -t -s -o <opts> -l <lowerdir> -S <snapdir>] <dir> <cmd> [<cmdargs>]\n\n"
 	    "-b src:dest Bind mounts <src> into <dir>/<dest> (may be specified multiple times)\n"
 	    "-O          Creates a tempdir and mounts <dir> read-only via overlayfs\n"
 	    "-t          Creates tempdir and mounts it on tmpfs (for use with -O)\n"
-	    "-o opts     Options to be passed to the tmpfs mount (for use with -t)\n", p);
+	    "-s          Creates tempdir as a btrfs subvolume (for use with -O)\n"
+	    "-o opts     Options to be passed to the tmpfs mount (for use with -t)\n"
+	    "-l lowerdir Stacks <lowerdir> read-only over <dir> (for use with -O, may be\n"
+	    "            specified multiple times)\n"
+	    "-S snapdir  Uses a snapshot of <dir> in <snapdir> keyed by its installed\n"
+	    "            packages as lowerdir (for use with -O)\n", p);
 	exit(EXIT_FAILURE);
 }
 
@@ -129,12 +143,58 @@ ftw_cb(const char *fpath, const struct stat *sb UNUSED, int type,
 	return 0;
 }
 
+/*
+ * Runs a btrfs subvolume ioctl on the parent directory of path.
+ */
+static int
+subvol_ioctl(const char *path, unsigned long req)
+{
+	struct btrfs_ioctl_vol_args args;
+	char *dir, *name;
+	int fd, rv, saveerrno;
+
+	dir = strdup(path);
+	assert(dir);
+	name = strrchr(dir, '/');
+	assert(name);
+	*name++ = '\0';
+
+	if ((fd = open(*dir ? dir : "/", O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1) {
+		free(dir);
+		return -1;
+	}
+	memset(&args, 0, sizeof(args));
+	xbps_strlcpy(args.name, name, sizeof(args.name));
+	rv = ioctl(fd, req, &args);
+	saveerrno = errno;
+	close(fd);
+	free(dir);
+	errno = saveerrno;
+
+	return rv;
+}
+
 static void
 cleanup_overlayfs(void)
 {
 	if (tmpdir == NULL)
 		return;
 
+	if (overlayfs_on_subvol) {
+		/*
+		 * Deleting the subvolume drops the whole upperdir at once,
+		 * root privileges were kept in the saved set-user-ID.
+		 */
+		uid_t ruid = getuid();
+
+		if (seteuid(0) == 0) {
+			if (subvol_ioctl(tmpdir, BTRFS_IOC_SNAP_DESTROY) == 0)
+				return;
+			fprintf(stderr, "Failed to delete subvolume %s: %s\n",
+			    tmpdir, strerror(errno));
+			(void)seteuid(ruid);
+		}
+	}
 	if (!overlayfs_on_tmpfs) {
 		/* recursively remove the temporary dir */
 		if (nftw(tmpdir, ftw_cb, 20, FTW_MOUNT|FTW_PHYS|FTW_DEPTH) != 0) {
@@ -186,6 +246,39 @@ add_bindmount(char *bm)
 	SIMPLEQ_INSERT_TAIL(&bindmnt_queue, bmnt, entries);
 }
 
+/*
+ * Lower layers are stacked in command line order, the last one
+ * is the topmost; overlayfs expects the topmost layer first.
+ */
+static void
+add_lowerdir(char **lowerdirs, const char *dir)
+{
+	char *p, cwd[PATH_MAX-1];
+
+	if (strchr(dir, ':') || strchr(dir, ',')) {
+		errno = EINVAL;
+		die("invalid lower directory: %s", dir);
+	}
+	if (dir[0] != '/') {
+		if (getcwd(cwd, sizeof(cwd)) == NULL)
+			die("getcwd");
+		p = *lowerdirs ? xbps_xasprintf("%s/%s:%s", cwd, dir, *lowerdirs) :
+		    xbps_xasprintf("%s/%s", cwd, dir);
+	} else {
+		p = *lowerdirs ? xbps_xasprintf("%s:%s", dir, *lowerdirs) :
+		    strdup(dir);
+		assert(p);
+	}
+	free(*lowerdirs);
+	*lowerdirs = p;
+}
+
+static int
+cmpstringp(const void *p1, const void *p2)
+{
+	return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
 static int
 fsuid_chdir(uid_t uid, const char *path)
 {
@@ -213,8 +306,315 @@ bindmount(uid_t ruid, const char *chrootdir, const char *dir, const char *dest)
 		die("Failed to bind mount %s at %s", dir, mountdir);
 }
 
+/*
+ * Snapshots of <dir> are stored as <snapdir>/<key>, where key is the
+ * FNV-1a hash of the sorted pkgvers registered in its pkgdb. They are
+ * created once, as read-only btrfs snapshots if <dir> is a subvolume
+ * or as reflinked (or copied) trees otherwise, and renamed into place
+ * so that concurrent users only see complete snapshots. <dir> can be
+ * updated while the snapshots are used as lowerdir by other chroots.
+ */
 static char *
-setup_overlayfs(const char *chrootdir, uid_t ruid, gid_t rgid, bool tmpfs, const char *tmpfs_opts)
+pkgvers_list(const char *rootdir)
+{
+	xbps_dictionary_t pkgdb;
+	xbps_array_t allkeys;
+	const char **pkgvers;
+	char *path, *list = NULL;
+	size_t len = 0;
+	unsigned int n = 0;
+
+	path = xbps_xasprintf("%s/%s/%s", rootdir, XBPS_META_PATH, XBPS_PKGDB);
+	pkgdb = xbps_dictionary_internalize_from_zfile(path);
+	free(path);
+	if (pkgdb == NULL)
+		return NULL;
+
+	allkeys = xbps_dictionary_all_keys(pkgdb);
+	pkgvers = calloc(xbps_array_count(allkeys) + 1, sizeof(*pkgvers));
+	assert(pkgvers);
+	for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+		xbps_dictionary_t pkgd;
+
+		pkgd = xbps_dictionary_get_keysym(pkgdb, xbps_array_get(allkeys, i));
+		if (xbps_object_type(pkgd) != XBPS_TYPE_DICTIONARY ||
+		    !xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgvers[n]))
+			continue;
+		len += strlen(pkgvers[n++]) + 1;
+	}
+	qsort(pkgvers, n, sizeof(*pkgvers), cmpstringp);
+	if (n) {
+		list = malloc(len + 1);
+		assert(list);
+		list[0] = '\0';
+		for (unsigned int i = 0; i < n; i++) {
+			strcat(list, pkgvers[i]);
+			strcat(list, "\n");
+		}
+	}
+	free(pkgvers);
+	xbps_object_release(allkeys);
+	xbps_object_release(pkgdb);
+	if (list == NULL)
+		errno = ENOENT;
+
+	return list;
+}
+
+static int
+copy_fd(int sfd, int dfd)
+{
+	char buf[64 * 1024];
+	ssize_t rd, wr;
+	char *p;
+
+	if (ioctl(dfd, FICLONE, sfd) == 0)
+		return 0;
+
+	while ((rd = read(sfd, buf, sizeof(buf))) != 0) {
+		if (rd == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (p = buf; rd > 0; p += wr, rd -= wr) {
+			if ((wr = write(dfd, p, (size_t)rd)) == -1) {
+				if (errno == EINTR) {
+					wr = 0;
+					continue;
+				}
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static const char *snap_src, *snap_dst;
+
+static int
+snap_ftw_cb(const char *fpath, const struct stat *sb, int type,
+		struct FTW *ftwbuf UNUSED)
+{
+	struct timespec ts[2];
+	char *dpath, lnk[PATH_MAX];
+	ssize_t len;
+	int sfd, dfd, rv = 0;
+
+	dpath = xbps_xasprintf("%s%s", snap_dst, fpath + strlen(snap_src));
+	ts[0] = sb->st_atim;
+	ts[1] = sb->st_mtim;
+
+	switch (type) {
+	case FTW_D:
+		if (strcmp(fpath, snap_src) && mkdir(dpath, 0700) == -1)
+			rv = -1;
+		break;
+	case FTW_SL:
+		if ((len = readlink(fpath, lnk, sizeof(lnk) - 1)) == -1) {
+			rv = -1;
+			break;
+		}
+		lnk[len] = '\0';
+		if (symlink(lnk, dpath) == -1 ||
+		    utimensat(AT_FDCWD, dpath, ts, AT_SYMLINK_NOFOLLOW) == -1)
+			rv = -1;
+		break;
+	case FTW_F:
+		if (S_ISFIFO(sb->st_mode)) {
+			if (mkfifo(dpath, sb->st_mode & 07777) == -1)
+				rv = -1;
+			break;
+		} else if (!S_ISREG(sb->st_mode)) {
+			/* devices and sockets are not needed in chroots */
+			break;
+		}
+		if ((sfd = open(fpath, O_RDONLY|O_CLOEXEC)) == -1) {
+			rv = -1;
+			break;
+		}
+		if ((dfd = open(dpath, O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0600)) == -1) {
+			(void)close(sfd);
+			rv = -1;
+			break;
+		}
+		if (copy_fd(sfd, dfd) == -1 ||
+		    fchmod(dfd, sb->st_mode & 07777) == -1 ||
+		    futimens(dfd, ts) == -1)
+			rv = -1;
+		(void)close(sfd);
+		(void)close(dfd);
+		break;
+	default:
+		errno = EACCES;
+		rv = -1;
+		break;
+	}
+	if (rv == -1)
+		fprintf(stderr, "Failed to copy %s: %s\n", fpath, strerror(errno));
+	free(dpath);
+	return rv;
+}
+
+static int
+snap_mode_cb(const char *fpath, const struct stat *sb, int type,
+		struct FTW *ftwbuf UNUSED)
+{
+	struct timespec ts[2];
+	char *dpath;
+	int rv = 0;
+
+	if (type != FTW_D && type != FTW_DP)
+		return 0;
+
+	/* directories are completed after their contents */
+	dpath = xbps_xasprintf("%s%s", snap_dst, fpath + strlen(snap_src));
+	ts[0] = sb->st_atim;
+	ts[1] = sb->st_mtim;
+	if (chmod(dpath, sb->st_mode & 07777) == -1 ||
+	    utimensat(AT_FDCWD, dpath, ts, 0) == -1) {
+		fprintf(stderr, "Failed to copy %s: %s\n", fpath, strerror(errno));
+		rv = -1;
+	}
+	free(dpath);
+	return rv;
+}
+
+static int
+snapshot_subvol(const char *src, const char *dst)
+{
+	struct btrfs_ioctl_vol_args_v2 args;
+	char *dir, *name;
+	int fd, sfd, rv, saveerrno;
+
+	if ((sfd = open(src, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1)
+		return -1;
+
+	dir = strdup(dst);
+	assert(dir);
+	name = strrchr(dir, '/');
+	assert(name);
+	*name++ = '\0';
+	if ((fd = open(*dir ? dir : "/", O_RDONLY|O_DIRECTORY|O_CLOEXEC)) == -1) {
+		saveerrno = errno;
+		(void)close(sfd);
+		free(dir);
+		errno = saveerrno;
+		return -1;
+	}
+	memset(&args, 0, sizeof(args));
+	args.fd = sfd;
+	args.flags = BTRFS_SUBVOL_RDONLY;
+	xbps_strlcpy(args.name, name, sizeof(args.name));
+	rv = ioctl(fd, BTRFS_IOC_SNAP_CREATE_V2, &args);
+	saveerrno = errno;
+	(void)close(fd);
+	(void)close(sfd);
+	free(dir);
+	errno = saveerrno;
+
+	return rv;
+}
+
+/*
+ * Runs without privileges in a child process: the snapshot only
+ * contains what the invoking user can read.
+ */
+static void __attribute__((noreturn))
+create_snapshot(const char *chrootdir, const char *snapdir, const char *snap)
+{
+	char *tmp;
+
+	if (xbps_mkpath(snapdir, 0755) == -1 && errno != EEXIST)
+		die("failed to create snapdir %s", snapdir);
+
+	tmp = xbps_xasprintf("%s/.snap.XXXXXXXXXX", snapdir);
+	if (mkdtemp(tmp) == NULL)
+		die("failed to create directory in %s", snapdir);
+
+	if (rmdir(tmp) == -1)
+		die("failed to remove %s", tmp);
+	if (snapshot_subvol(chrootdir, tmp) == -1) {
+		/* not a btrfs subvolume, copy the tree */
+		if (mkdir(tmp, 0700) == -1)
+			die("failed to create directory %s", tmp);
+		snap_src = chrootdir;
+		snap_dst = tmp;
+		if (nftw(chrootdir, snap_ftw_cb, 20, FTW_MOUNT|FTW_PHYS) != 0 ||
+		    nftw(chrootdir, snap_mode_cb, 20, FTW_MOUNT|FTW_PHYS|FTW_DEPTH) != 0) {
+			(void)nftw(tmp, ftw_cb, 20, FTW_MOUNT|FTW_PHYS|FTW_DEPTH);
+			die("failed to create snapshot of %s", chrootdir);
+		}
+	}
+	if (rename(tmp, snap) == -1) {
+		if (errno != EEXIST && errno != ENOTEMPTY)
+			die("failed to rename snapshot to %s", snap);
+		/* a concurrent run created the same snapshot */
+		(void)nftw(tmp, ftw_cb, 20, FTW_MOUNT|FTW_PHYS|FTW_DEPTH);
+		(void)rmdir(tmp);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+static char *
+setup_snapshot(const char *chrootdir, const char *snapdir, uid_t ruid,
+		gid_t rgid)
+{
+	struct stat st;
+	char *list, *snaplist, *snap;
+	uint64_t key = 0xcbf29ce484222325ULL;
+	pid_t child;
+	int status;
+
+	(void)setfsuid(ruid);
+	list = pkgvers_list(chrootdir);
+	(void)setfsuid(0);
+	if (list == NULL)
+		die("cannot read the pkgdb of %s", chrootdir);
+
+	for (const char *p = list; *p; p++) {
+		key ^= (unsigned char)*p;
+		key *= 0x100000001b3ULL;
+	}
+	snap = xbps_xasprintf("%s/%016" PRIx64, snapdir, key);
+
+	(void)setfsuid(ruid);
+	if (stat(snap, &st) == -1) {
+		(void)setfsuid(0);
+		if (errno != ENOENT)
+			die("cannot access snapshot %s", snap);
+		if ((child = fork()) == -1)
+			die("fork");
+		if (child == 0) {
+			if (setgid(rgid) == -1)
+				die("setgid child");
+			if (setuid(ruid) == -1)
+				die("setuid child");
+			create_snapshot(chrootdir, snapdir, snap);
+		}
+		while (waitpid(child, &status, 0) < 0) {
+			if (errno != EINTR)
+				die("waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			exit(EXIT_FAILURE);
+		(void)setfsuid(ruid);
+	}
+	snaplist = pkgvers_list(snap);
+	(void)setfsuid(0);
+	if (snaplist == NULL || strcmp(list, snaplist)) {
+		errno = EEXIST;
+		die("snapshot %s does not match %s", snap, chrootdir);
+	}
+	free(snaplist);
+	free(list);
+
+	return snap;
+}
+
+static char *
+setup_overlayfs(const char *chrootdir, const char *lowerdirs, uid_t ruid,
+		gid_t rgid, bool tmpfs, const char *tmpfs_opts)
 {
 	char *upperdir, *workdir, *newchrootdir, *mopts;
 	const void *opts = NULL;
@@ -242,8 +642,9 @@ setup_overlayfs(const char *chrootdir, uid_t ruid, gid_t rgid, bool tmpfs, const
 	if (mkdir(newchrootdir, 0755) == -1)
 		die("failed to create newchrootdir (%s)", newchrootdir);
 
-	mopts = xbps_xasprintf("upperdir=%s,lowerdir=%s,workdir=%s",
-		upperdir, chrootdir, workdir);
+	mopts = xbps_xasprintf("upperdir=%s,lowerdir=%s%s%s,workdir=%s",
+		upperdir, lowerdirs ? lowerdirs : "", lowerdirs ? ":" : "",
+		chrootdir, workdir);
 
 	opts = mopts;
 	if (mount(chrootdir, newchrootdir, "overlay", 0, opts) == -1)
@@ -269,8 +670,8 @@ main(int argc, char **argv)
 	struct sigaction sa;
 	uid_t ruid, euid, suid;
 	gid_t rgid, egid, sgid;
-	const char *chrootdir, *tmpfs_opts, *cmd, *argv0;
-	char **cmdargs, *b, mountdir[PATH_MAX-1];
+	const char *chrootdir, *lowerdir, *snapdir, *tmpfs_opts, *cmd, *argv0;
+	char **cmdargs, *b, *lowerdirs = NULL, mountdir[PATH_MAX-1];
 	int c, clone_flags, container_flags, child_status = 0;
 	pid_t child;
 	bool overlayfs = false;
@@ -278,10 +679,10 @@ main(int argc, char **argv)
 		{ NULL, 0, NULL, 0 }
 	};
 
-	tmpfs_opts = chrootdir = cmd = NULL;
+	tmpfs_opts = chrootdir = snapdir = cmd = NULL;
 	argv0 = argv[0];
 
-	while ((c = getopt_long(argc, argv, "Oto:b:V", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "Otso:b:l:S:V", longopts, NULL)) != -1) {
 		switch (c) {
 		case 'O':
 			overlayfs = true;
@@ -289,6 +690,17 @@ main(int argc, char **argv)
 		case 't':
 			overlayfs_on_tmpfs = true;
 			break;
+		case 's':
+			overlayfs_on_subvol = true;
+			break;
+		case 'l':
+			if (optarg == NULL || *optarg == '\0')
+				break;
+			add_lowerdir(&lowerdirs, optarg);
+			break;
+		case 'S':
+			snapdir = optarg;
+			break;
 		case 'o':
 			tmpfs_opts = optarg;
 			break;
@@ -310,6 +722,10 @@ main(int argc, char **argv)
 
 	if (argc < 2)
 		usage(argv0);
+	if ((lowerdirs || snapdir || overlayfs_on_subvol) && !overlayfs)
+		usage(argv0);
+	if (overlayfs_on_tmpfs && overlayfs_on_subvol)
+		usage(argv0);
 
 	chrootdir = argv[0];
 	cmd = argv[1];
@@ -336,10 +752,23 @@ main(int argc, char **argv)
 	if (rgid == 0)
 		rgid = ruid;
 
+	lowerdir = chrootdir;
+	if (snapdir)
+		lowerdir = setup_snapshot(chrootdir, snapdir, ruid, rgid);
+
 	if (overlayfs) {
 		b = xbps_xasprintf("%s.XXXXXXXXXX", chrootdir);
 		if ((tmpdir = mkdtemp(b)) == NULL)
 			die("failed to create tmpdir directory");
+		if (overlayfs_on_subvol) {
+			/* replace the unique tmpdir with a subvolume */
+			if (rmdir(tmpdir) == -1)
+				die("failed to remove tmpdir %s", tmpdir);
+			if (subvol_ioctl(tmpdir, BTRFS_IOC_SUBVOL_CREATE) == -1) {
+				tmpdir = NULL;
+				die("failed to create subvolume %s", b);
+			}
+		}
 		if (chown(tmpdir, ruid, rgid) == -1)
 			die("chown tmpdir %s", tmpdir);
 	}
@@ -381,8 +810,8 @@ main(int argc, char **argv)
 
 		/* setup our overlayfs if set */
 		if (overlayfs)
-			chrootdir = setup_overlayfs(chrootdir, ruid, rgid,
-			    overlayfs_on_tmpfs, tmpfs_opts);
+			chrootdir = setup_overlayfs(lowerdir, lowerdirs, ruid,
+			    rgid, overlayfs_on_tmpfs, tmpfs_opts);
 
 		/* mount /proc */
 		snprintf(mountdir, sizeof(mountdir), "%s/proc", chrootdir);
@@ -425,8 +854,13 @@ main(int argc, char **argv)
 	/* Switch back to the gid/uid of invoking process also in the parent */
 	if (setgid(rgid) == -1)
 		die("setgid child");
-	if (setuid(ruid) == -1)
+	if (overlayfs_on_subvol) {
+		/* keep root as saved set-user-ID to delete the subvolume */
+		if (setresuid(ruid, ruid, euid) == -1)
+			die("setresuid child");
+	} else if (setuid(ruid) == -1) {
 		die("setuid child");
+	}
 
 	/* Wait until the child terminates */
 	while (waitpid(child, &child_status, 0) < 0) {
@@ -33,6 +33,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include <xbps.h>
 #include "../xbps-install/defs.h"
@@ -64,6 +66,9 @@ usage(void)
 	"    real-version\t<pkgname>\n"
 	"\n"
 	"  Options shared by all actions:\n"
+	"    -b\t\tBatch mode: reads actions with their arguments from\n"
+	"      \t\tstdin, one per line, and terminates the output of each\n"
+	"      \t\tone with a line with `#' and its exit status.\n"
 	"    -C\t\tPath to xbps.conf file.\n"
 	"    -d\t\tDebugging messages to stderr.\n"
 	"    -r\t\t<rootdir>\n"
@@ -79,7 +84,8 @@ usage(void)
 	"    $ xbps-uhelper getpkgrevision foo-2.0_1\n"
 	"    $ xbps-uhelper getpkgversion foo-2.0_1\n"
 	"    $ xbps-uhelper pkgmatch foo-1.0_1 'foo>=1.0'\n"
-	"    $ xbps-uhelper version pkgname\n");
+	"    $ xbps-uhelper version pkgname\n"
+	"    $ printf 'getpkgname foo-2.0_1\\n' | xbps-uhelper -b\n");
 
 	exit(EXIT_FAILURE);
 }
@@ -98,203 +104,190 @@ fname(char *url) {
 	return filename + 1;
 }
 
-int
-main(int argc, char **argv)
-{
-	xbps_dictionary_t dict;
-	struct xbps_handle xh;
-	struct xferstat xfer;
-	const char *version, *rootdir = NULL, *confdir = NULL;
-	char *pkgname, *hash, *filename;
-	int flags = 0, c, rv = 0;
-	const struct option longopts[] = {
-		{ NULL, 0, NULL, 0 }
-	};
-
-	while ((c = getopt_long(argc, argv, "C:dr:V", longopts, NULL)) != -1) {
-		switch (c) {
-		case 'C':
-			confdir = optarg;
-			break;
-		case 'r':
-			/* To specify the root directory */
-			rootdir = optarg;
-			break;
-		case 'd':
-			flags |= XBPS_FLAG_DEBUG;
-			break;
-		case 'V':
-			printf("%s\n", XBPS_RELVER);
-			exit(EXIT_SUCCESS);
-		case '?':
-		default:
-			usage();
-		}
-	}
+/* returned by action() if its arguments are invalid */
+#define USAGE	INT_MIN
 
-	argc -= optind;
-	argv += optind;
+static bool
+read_pkgdb(const char *act)
+{
+	return strcmp(act, "version") == 0 ||
+	    strcmp(act, "real-version") == 0;
+}
 
-	if (argc < 1)
-		usage();
+static bool
+need_init(const char *act)
+{
+	return read_pkgdb(act) ||
+	    strcmp(act, "arch") == 0 ||
+	    strcmp(act, "getsystemdir") == 0 ||
+	    strcmp(act, "fetch") == 0;
+}
 
-	memset(&xh, 0, sizeof(xh));
+static int
+init_handle(struct xbps_handle *xhp, struct xferstat *xfer, int flags,
+		const char *rootdir, const char *confdir)
+{
+	int rv;
+
+	memset(xhp, 0, sizeof(*xhp));
+	memset(xfer, 0, sizeof(*xfer));
+	xhp->flags = flags;
+	xhp->fetch_cb = fetch_file_progress_cb;
+	xhp->fetch_cb_data = xfer;
+	if (rootdir)
+		xbps_strlcpy(xhp->rootdir, rootdir, sizeof(xhp->rootdir));
+	if (confdir)
+		xbps_strlcpy(xhp->confdir, confdir, sizeof(xhp->confdir));
+	if ((rv = xbps_init(xhp)) != 0)
+		xbps_error_printf("xbps-uhelper: failed to "
+		    "initialize libxbps: %s.\n", strerror(rv));
+	return rv;
+}
 
-	if ((strcmp(argv[0], "version") == 0) ||
-	    (strcmp(argv[0], "real-version") == 0) ||
-	    (strcmp(argv[0], "arch") == 0) ||
-	    (strcmp(argv[0], "getsystemdir") == 0) ||
-	    (strcmp(argv[0], "fetch") == 0)) {
-		/*
-		* Initialize libxbps.
-		*/
-		xh.flags = flags;
-		xh.fetch_cb = fetch_file_progress_cb;
-		xh.fetch_cb_data = &xfer;
-		if (rootdir)
-			xbps_strlcpy(xh.rootdir, rootdir, sizeof(xh.rootdir));
-		if (confdir)
-			xbps_strlcpy(xh.confdir, confdir, sizeof(xh.confdir));
-		if ((rv = xbps_init(&xh)) != 0) {
-			xbps_error_printf("xbps-uhelper: failed to "
-			    "initialize libxbps: %s.\n", strerror(rv));
-			exit(EXIT_FAILURE);
-		}
-	}
+/*
+ * Runs an action and returns its exit status, or USAGE.
+ */
+static int
+action(struct xbps_handle *xhp, int argc, char **argv)
+{
+	xbps_dictionary_t dict;
+	const char *version;
+	char *pkgname, *hash, *filename;
+	int rv = 0;
 
 	if (strcmp(argv[0], "version") == 0) {
 		/* Prints version of an installed package */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
-		if ((((dict = xbps_pkgdb_get_pkg(&xh, argv[1])) == NULL)) &&
-		    (((dict = xbps_pkgdb_get_virtualpkg(&xh, argv[1])) == NULL)))
-			exit(EXIT_FAILURE);
+		if ((((dict = xbps_pkgdb_get_pkg(xhp, argv[1])) == NULL)) &&
+		    (((dict = xbps_pkgdb_get_virtualpkg(xhp, argv[1])) == NULL)))
+			return EXIT_FAILURE;
 
 		xbps_dictionary_get_cstring_nocopy(dict, "pkgver", &version);
 		printf("%s\n", xbps_pkg_version(version));
 	} else if (strcmp(argv[0], "real-version") == 0) {
 		/* Prints version of an installed real package, not virtual */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
-		if ((dict = xbps_pkgdb_get_pkg(&xh, argv[1])) == NULL)
-			exit(EXIT_FAILURE);
+		if ((dict = xbps_pkgdb_get_pkg(xhp, argv[1])) == NULL)
+			return EXIT_FAILURE;
 
 		xbps_dictionary_get_cstring_nocopy(dict, "pkgver", &version);
 		printf("%s\n", xbps_pkg_version(version));
 	} else if (strcmp(argv[0], "getpkgversion") == 0) {
 		/* Returns the version of a pkg string */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		version = xbps_pkg_version(argv[1]);
 		if (version == NULL) {
 			fprintf(stderr,
 			    "Invalid string, expected <string>-<version>_<revision>\n");
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 		}
 		printf("%s\n", version);
 	} else if (strcmp(argv[0], "getpkgname") == 0) {
 		/* Returns the name of a pkg string */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		pkgname = xbps_pkg_name(argv[1]);
 		if (pkgname == NULL) {
 			fprintf(stderr,
 			    "Invalid string, expected <string>-<version>_<revision>\n");
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 		}
 		printf("%s\n", pkgname);
 		free(pkgname);
 	} else if (strcmp(argv[0], "getpkgrevision") == 0) {
 		/* Returns the revision of a pkg string */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		version = xbps_pkg_revision(argv[1]);
 		if (version == NULL)
-			exit(EXIT_SUCCESS);
+			return EXIT_SUCCESS;
 
 		printf("%s\n", version);
 	} else if (strcmp(argv[0], "getpkgdepname") == 0) {
 		/* Returns the pkgname of a dependency */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		pkgname = xbps_pkgpattern_name(argv[1]);
 		if (pkgname == NULL)
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 
 		printf("%s\n", pkgname);
 		free(pkgname);
 	} else if (strcmp(argv[0], "getpkgdepversion") == 0) {
 		/* returns the version of a package pattern dependency */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		version = xbps_pkgpattern_version(argv[1]);
 		if (version == NULL)
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 
 		printf("%s\n", version);
 	} else if (strcmp(argv[0], "binpkgver") == 0) {
 		/* Returns the pkgver of a binpkg string */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		version = xbps_binpkg_pkgver(argv[1]);
 		if (version == NULL) {
 			fprintf(stderr,
 			    "Invalid string, expected <pkgname>-<version>_<revision>.<arch>.xbps\n");
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 		}
 		printf("%s\n", version);
 	} else if (strcmp(argv[0], "binpkgarch") == 0) {
 		/* Returns the arch of a binpkg string */
 		if (argc != 2)
-			usage();
+			return USAGE;
 
 		version = xbps_binpkg_arch(argv[1]);
 		if (version == NULL) {
 			fprintf(stderr,
 			    "Invalid string, expected <pkgname>-<version>_<revision>.<arch>.xbps\n");
-			exit(EXIT_FAILURE);
+			return EXIT_FAILURE;
 		}
 		printf("%s\n", version);
 	} else if (strcmp(argv[0], "pkgmatch") == 0) {
 		/* Matches a pkg with a pattern */
 		if (argc != 3)
-			usage();
+			return USAGE;
 
-		exit(xbps_pkgpattern_match(argv[1], argv[2]));
+		return xbps_pkgpattern_match(argv[1], argv[2]);
 	} else if (strcmp(argv[0], "cmpver") == 0) {
 		/* Compare two version strings, installed vs required */
 		if (argc != 3)
-			usage();
+			return USAGE;
 
-		exit(xbps_cmpver(argv[1], argv[2]));
+		return xbps_cmpver(argv[1], argv[2]);
 	} else if (strcmp(argv[0], "arch") == 0) {
 		/* returns the xbps native arch */
 		if (argc != 1)
-			usage();
+			return USAGE;
 
-		if (xh.native_arch[0] && xh.target_arch && strcmp(xh.native_arch, xh.target_arch)) {
-			printf("%s\n", xh.target_arch);
+		if (xhp->native_arch[0] && xhp->target_arch && strcmp(xhp->native_arch, xhp->target_arch)) {
+			printf("%s\n", xhp->target_arch);
 		} else {
-			printf("%s\n", xh.native_arch);
+			printf("%s\n", xhp->native_arch);
 		}
 	} else if (strcmp(argv[0], "getsystemdir") == 0) {
 		/* returns the xbps system directory (<sharedir>/xbps.d) */
 		if (argc != 1)
-			usage();
+			return USAGE;
 
 		printf("%s\n", XBPS_SYSDEFCONF_PATH);
 	} else if (strcmp(argv[0], "digest") == 0) {
 		/* Prints SHA256 hashes for specified files */
 		if (argc < 2)
-			usage();
+			return USAGE;
 
 		for (int i = 1; i < argc; i++) {
 			hash = xbps_file_hash(argv[i]);
@@ -302,18 +295,19 @@ main(int argc, char **argv)
 				fprintf(stderr,
 				    "E: couldn't get hash for %s (%s)\n",
 				    argv[i], strerror(errno));
-				exit(EXIT_FAILURE);
+				return EXIT_FAILURE;
 			}
 			printf("%s\n", hash);
+			free(hash);
 		}
 	} else if (strcmp(argv[0], "fetch") == 0) {
 		/* Fetch a file from specified URL */
 		if (argc < 2)
-			usage();
+			return USAGE;
 
 		for (int i = 1; i < argc; i++) {
 			filename = fname(argv[i]);
-			rv = xbps_fetch_file_dest(&xh, argv[i], filename, "v");
+			rv = xbps_fetch_file_dest(xhp, argv[i], filename, "v");
 
 			if (rv == -1) {
 				fprintf(stderr, "%s: %s\n", argv[i],
@@ -325,8 +319,161 @@ main(int argc, char **argv)
 				rv = 0;
 		}
 	} else {
+		return USAGE;
+	}
+
+	return rv ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Returns true if the pkgdb plist or its journal changed since
+ * the last call.
+ */
+static bool
+pkgdb_changed(struct xbps_handle *xhp)
+{
+	static struct stat ost[2];
+	const char *files[2] = { XBPS_PKGDB, XBPS_PKGDB_JOURNAL };
+	struct stat st;
+	bool changed = false;
+	char path[PATH_MAX];
+
+	for (int i = 0; i < 2; i++) {
+		snprintf(path, sizeof(path), "%s/%s", xhp->metadir, files[i]);
+		if (stat(path, &st) == -1)
+			memset(&st, 0, sizeof(st));
+		if (st.st_ino != ost[i].st_ino || st.st_size != ost[i].st_size ||
+		    st.st_mtim.tv_sec != ost[i].st_mtim.tv_sec ||
+		    st.st_mtim.tv_nsec != ost[i].st_mtim.tv_nsec)
+			changed = true;
+		ost[i] = st;
+	}
+	return changed;
+}
+
+/*
+ * Batch mode: every line read from stdin is an action and its arguments
+ * separated by blanks, the output of every action is followed by a line
+ * with its exit status after `#' and flushed. This lets callers run
+ * xbps-uhelper as a coprocess and avoid starting it (and initializing
+ * libxbps) for every action. The handle is initialized again when an
+ * action reading the pkgdb finds it changed.
+ */
+static int
+batch(int flags, const char *rootdir, const char *confdir)
+{
+	struct xbps_handle xh;
+	struct xferstat xfer;
+	char *line = NULL, *p, **args = NULL;
+	size_t linesz = 0, argsz = 0;
+	int argc, rv;
+	bool init = false;
+
+	while (getline(&line, &linesz, stdin) != -1) {
+		argc = 0;
+		for (p = strtok(line, " \t\n"); p; p = strtok(NULL, " \t\n")) {
+			if ((size_t)argc + 1 >= argsz) {
+				argsz = argsz ? argsz * 2 : 8;
+				args = realloc(args, argsz * sizeof(*args));
+				assert(args);
+			}
+			args[argc++] = p;
+		}
+		if (argc == 0)
+			continue;
+		args[argc] = NULL;
+
+		rv = 0;
+		if (need_init(args[0])) {
+			if (init && read_pkgdb(args[0]) &&
+			    pkgdb_changed(&xh)) {
+				xbps_end(&xh);
+				init = false;
+			}
+			if (!init) {
+				rv = init_handle(&xh, &xfer, flags,
+				    rootdir, confdir);
+				if (rv == 0) {
+					init = true;
+					(void)pkgdb_changed(&xh);
+				}
+			}
+		}
+		if (rv != 0) {
+			rv = EXIT_FAILURE;
+		} else if ((rv = action(&xh, argc, args)) == USAGE) {
+			fprintf(stderr, "xbps-uhelper: invalid action or "
+			    "arguments: %s\n", args[0]);
+			rv = EXIT_FAILURE;
+		}
+		printf("#%d\n", rv & 0xff);
+		fflush(stdout);
+	}
+	if (init)
+		xbps_end(&xh);
+	free(args);
+	free(line);
+
+	return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct xbps_handle xh;
+	struct xferstat xfer;
+	const char *rootdir = NULL, *confdir = NULL;
+	int flags = 0, c, rv = 0;
+	bool batchf = false;
+	const struct option longopts[] = {
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "bC:dr:V", longopts, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			batchf = true;
+			break;
+		case 'C':
+			confdir = optarg;
+			break;
+		case 'r':
+			/* To specify the root directory */
+			rootdir = optarg;
+			break;
+		case 'd':
+			flags |= XBPS_FLAG_DEBUG;
+			break;
+		case 'V':
+			printf("%s\n", XBPS_RELVER);
+			exit(EXIT_SUCCESS);
+		case '?':
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (batchf) {
+		if (argc != 0)
+			usage();
+		exit(batch(flags, rootdir, confdir));
+	}
+	if (argc < 1)
 		usage();
+
+	memset(&xh, 0, sizeof(xh));
+	if (need_init(argv[0])) {
+		/*
+		* Initialize libxbps.
+		*/
+		if (init_handle(&xh, &xfer, flags, rootdir, confdir) != 0)
+			exit(EXIT_FAILURE);
 	}
+	if ((rv = action(&xh, argc, argv)) == USAGE)
+		usage();
 
-	exit(rv ? EXIT_FAILURE : EXIT_SUCCESS);
+	exit(rv);
 }
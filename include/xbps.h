@@ -0,0 +1,3448 @@
+/*-
+ * Copyright (c) 2008-2016 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#ifndef _XBPS_H_
+#define _XBPS_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <xbps/xbps_array.h>
+#include <xbps/xbps_bool.h>
+#include <xbps/xbps_data.h>
+#include <xbps/xbps_dictionary.h>
+#include <xbps/xbps_number.h>
+#include <xbps/xbps_string.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#define XBPS_MAXPATH	512
+
+/**
+ * @def XBPS_NAME_SIZE
+ * Size of the buffers used for package names, including the NUL
+ * character; see xbps_pkg_name_buf().
+ */
+#define XBPS_NAME_SIZE	64
+
+/**
+ * @file include/xbps.h
+ * @brief XBPS Library API header
+ *
+ * This header documents the full API for the XBPS Library.
+ */
+#define XBPS_API_VERSION	"20180730"
+
+#ifndef XBPS_VERSION
+ #define XBPS_VERSION		"UNSET"
+#endif
+#ifndef XBPS_GIT
+ #define XBPS_GIT		"UNSET"
+#endif
+/**
+ * @def XBPS_RELVER
+ * Current library release date.
+ */
+#define XBPS_RELVER		"XBPS: " XBPS_VERSION \
+				" API: " XBPS_API_VERSION \
+				" GIT: " XBPS_GIT
+
+/**
+ * @def XBPS_SYSCONF_PATH
+ * Default configuration PATH to find XBPS_CONF_PLIST.
+ */
+#define XBPS_SYSDIR            "/xbps.d"
+#ifndef XBPS_SYSCONF_PATH
+# define XBPS_SYSCONF_PATH      "/etc" XBPS_SYSDIR
+#endif
+#ifndef XBPS_SYSDEFCONF_PATH
+# define XBPS_SYSDEFCONF_PATH	"/usr/share" XBPS_SYSDIR
+#endif
+
+/** 
+ * @def XBPS_META_PATH
+ * Default root PATH to store metadata info.
+ */
+#ifndef XBPS_META_PATH
+#define XBPS_META_PATH		"var/db/xbps"
+#endif
+
+/**
+ * @def XBPS_TRIGGERS_PATH
+ * Default PATH relative to rootdir where triggers are executed from.
+ */
+#define XBPS_TRIGGERS_PATH	"usr/libexec/xbps-triggers"
+
+/** 
+ * @def XBPS_CACHE_PATH
+ * Default cache PATH to store downloaded binpkgs.
+ */
+#define XBPS_CACHE_PATH		"var/cache/xbps"
+
+/**
+ * @def XBPS_PKGDB
+ * Filename for the package database.
+ */
+#define XBPS_PKGDB		"pkgdb-0.38.plist"
+
+/**
+ * @def XBPS_PKGDB_JOURNAL
+ * Filename for the journal of changes to the package database.
+ */
+#define XBPS_PKGDB_JOURNAL	"pkgdb-0.38.journal"
+
+/**
+ * @def XBPS_PKGDB_REVDEPS
+ * Filename for the index of reverse dependencies of installed packages.
+ */
+#define XBPS_PKGDB_REVDEPS	"pkgdb-0.38.revdeps"
+
+/**
+ * @def XBPS_PKGDB_FILES
+ * Filename for the index of files owned by installed packages; if
+ * consolidated it also stores the files plists of the packages.
+ */
+#define XBPS_PKGDB_FILES	"pkgdb-0.38.files"
+
+/**
+ * @def XBPS_PKGDB_HASH_BUCKETS
+ * Number of buckets of the package database hash.
+ */
+#define XBPS_PKGDB_HASH_BUCKETS	256
+
+/**
+ * @def XBPS_MIRRORS_CACHE
+ * Filename for the cached ranking of repository mirrors.
+ */
+#define XBPS_MIRRORS_CACHE	"mirrors.plist"
+
+/**
+ * @def XBPS_MIRRORS_TTL
+ * Time (in seconds) the ranking of repository mirrors is cached for.
+ */
+#define XBPS_MIRRORS_TTL	(24 * 60 * 60)
+
+/**
+ * @def XBPS_PKGPROPS
+ * Filename for package metadata property list.
+ */
+#define XBPS_PKGPROPS		"props.plist"
+
+/**
+ * @def XBPS_PKGFILES
+ * Filename for package metadata files property list.
+ */
+#define XBPS_PKGFILES		"files.plist"
+
+/** 
+ * @def XBPS_REPOIDX
+ * Filename for the repository index property list.
+ */
+#define XBPS_REPOIDX		"index.plist"
+
+/**
+ * @def XBPS_REPOIDX_META
+ * Filename for the repository index metadata property list.
+ */
+#define XBPS_REPOIDX_META 	"index-meta.plist"
+
+/**
+ * @def XBPS_REPOIDX_REVDEPS
+ * Filename for the repository reverse dependencies property list.
+ */
+#define XBPS_REPOIDX_REVDEPS 	"index-revdeps.plist"
+
+/**
+ * @def XBPS_REPOIDX_SHLIBS
+ * Filename for the repository shared libraries property list.
+ */
+#define XBPS_REPOIDX_SHLIBS 	"index-shlibs.plist"
+
+/**
+ * @def XBPS_REPOIDX_SHARDS
+ * Filename for the property list of the repository index shards,
+ * stored in the <arch>-shards manifest.
+ */
+#define XBPS_REPOIDX_SHARDS 	"index-shards.plist"
+
+/**
+ * @def XBPS_REPOIDX_FILES
+ * Filename for the property list of the repository files index,
+ * stored in the optional <arch>-files archive.
+ */
+#define XBPS_REPOIDX_FILES 	"index-files.plist"
+
+/**
+ * @def XBPS_FLAG_VERBOSE
+ * Verbose flag that can be used in the function callbacks to alter
+ * its behaviour. Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_VERBOSE		0x00000001
+
+/**
+ * @def XBPS_FLAG_FORCE_CONFIGURE
+ * Force flag used in xbps_configure_pkg(), if set the package(s)
+ * will be reconfigured even if its state is XBPS_PKG_STATE_INSTALLED.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_FORCE_CONFIGURE	0x00000002
+
+/**
+ * @def XBPS_FLAG_FORCE_REMOVE_FILES
+ * Force flag used in xbps_remove_pkg_files(), if set the package
+ * files will be removed even if its SHA256 hash don't match.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_FORCE_REMOVE_FILES	0x00000004
+
+/**
+ * @def XBPS_FLAG_INSTALL_AUTO
+ * Enabled automatic install mode for a package and all dependencies
+ * installed direct and indirectly.
+ */
+#define XBPS_FLAG_INSTALL_AUTO		0x00000010
+
+/**
+ * @def XBPS_FLAG_DEBUG
+ * Enable debug mode to output debugging printfs to stdout/stderr.
+ */
+#define XBPS_FLAG_DEBUG 		0x00000020
+
+/**
+ * @def XBPS_FLAG_FORCE_UNPACK
+ * Force flag used in xbps_unpack_binary_pkg(). If set its package
+ * files will be unpacked overwritting the current ones.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_FORCE_UNPACK 		0x00000040
+
+/**
+ * @def XBPS_FLAG_DISABLE_SYSLOG
+ * Disable syslog logging, enabled by default.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_DISABLE_SYSLOG 	0x00000080
+
+/**
+ * @def XBPS_FLAG_BESTMATCH
+ * Enable pkg best matching when resolving packages.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_BESTMATCH 		0x00000100
+
+/**
+ * @def XBPS_FLAG_IGNORE_CONF_REPOS
+ * Ignore repos defined in configuration files.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_IGNORE_CONF_REPOS 	0x00000200
+
+/**
+ * @def XBPS_FLAG_REPOS_MEMSYNC
+ * Fetch and store repodata in memory, ignoring on-disk metadata.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_REPOS_MEMSYNC 	0x00000400
+
+/**
+ * @def XBPS_FLAG_FORCE_REMOVE_REVDEPS
+ * Continue with transaction even if there are broken reverse
+ * dependencies, due to unresolved shared libraries or dependencies.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_FORCE_REMOVE_REVDEPS 	0x00000800
+
+/**
+ * @def XBPS_FLAG_UNPACK_ONLY
+ * Do not configure packages in the transaction, just unpack them.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_UNPACK_ONLY 		0x00001000
+
+/**
+ * @def XBPS_FLAG_PIPELINE_COMMIT
+ * Download and verify binary packages in background while the transaction
+ * is being run, every package is unpacked as soon as it has been verified.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_PIPELINE_COMMIT 	0x00002000
+
+/**
+ * @def XBPS_FLAG_BINARY_PLISTS
+ * Write the pkgdb, the files metadata of installed packages and the
+ * repository indexes in the compact binary plist format rather than XML;
+ * both formats are always accepted when reading.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_BINARY_PLISTS 	0x00004000
+
+/**
+ * @def XBPS_FLAG_UNPACK_SYNC
+ * Write the files of binary packages to temporary names, flush them to
+ * disk at once and rename them into place before the package is
+ * registered.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_UNPACK_SYNC 		0x00008000
+
+/**
+ * @def XBPS_FLAG_UNPACK_IO_URING
+ * Write small files of binary packages in batches through io_uring(7),
+ * if supported by the kernel.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_UNPACK_IO_URING 	0x00010000
+
+/**
+ * @def XBPS_FLAG_VERIFY_CACHE
+ * Record the binary packages whose RSA signature was verified in
+ * metadir, they are not verified again while they are unchanged.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_VERIFY_CACHE 		0x00020000
+
+/**
+ * @def XBPS_FLAG_REPOS_FILES
+ * Fetch the files index of remote repositories (<arch>-files) while
+ * synchronizing them, if they provide one.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_REPOS_FILES 		0x00040000
+
+/**
+ * @def XBPS_FLAG_UNPACK_VERITY
+ * Enable fs-verity on the regular files of binary packages once they
+ * are unpacked, recording their digest in the package files metadata.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_UNPACK_VERITY 	0x00080000
+
+/**
+ * @def XBPS_FLAG_DOWNLOAD_ONLY
+ * xbps_transaction_commit() only downloads and verifies the binary
+ * packages into cachedir. Their verification is recorded in metadir,
+ * a later transaction doesn't verify them again while they are
+ * unchanged, even without XBPS_FLAG_VERIFY_CACHE.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_DOWNLOAD_ONLY 	0x00100000
+
+/**
+ * @def XBPS_FLAG_RELEASE_REPODATA
+ * xbps_transaction_commit() releases the indexes of the repository pool
+ * before downloading and unpacking, keeping only the package dictionaries
+ * of the transaction and the public keys to verify them.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_RELEASE_REPODATA 	0x00200000
+
+/**
+ * @def XBPS_FLAG_LOW_CACHE
+ * Files hashed by libxbps with this handle, see
+ * xbps_file_hash_check_handle(), and binary packages unpacked from cachedir
+ * are dropped from the page cache once read, except the pages that
+ * were already cached, to keep the working set of other processes.
+ * Must be set through the xbps_handle::flags member.
+ */
+#define XBPS_FLAG_LOW_CACHE 		0x00400000
+
+/**
+ * @def XBPS_FETCH_CACHECONN
+ * Default (global) limit of cached connections used in libfetch.
+ */
+#define XBPS_FETCH_CACHECONN            32
+
+/**
+ * @def XBPS_FETCH_CACHECONN_HOST
+ * Default (per host) limit of cached connections used in libfetch.
+ */
+#define XBPS_FETCH_CACHECONN_HOST       16
+
+/**
+ * @def XBPS_FETCH_TIMEOUT
+ * Default timeout limit (in seconds) to wait for stalled connections.
+ */
+#define XBPS_FETCH_TIMEOUT		30
+
+/**
+ * @def XBPS_FETCH_BUFSIZE
+ * Default size (in bytes) of the buffer used to write downloaded files.
+ */
+#define XBPS_FETCH_BUFSIZE		(128 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup initend */ 
+/*@{*/
+
+/**
+ * @enum xbps_state_t
+ *
+ * Integer representing the xbps callback returned state. Possible values:
+ *
+ * - XBPS_STATE_UKKNOWN: state hasn't been prepared or unknown error.
+ * - XBPS_STATE_TRANS_DOWNLOAD: transaction is downloading binary packages.
+ * - XBPS_STATE_TRANS_VERIFY: transaction is verifying binary package integrity.
+ * - XBPS_STATE_TRANS_RUN: transaction is performing operations:
+ * install, update, remove and replace.
+ * - XBPS_STATE_TRANS_CONFIGURE: transaction is configuring all
+ * unpacked packages.
+ * - XBPS_STATE_TRANS_FAIL: transaction has failed.
+ * - XBPS_STATE_DOWNLOAD: a binary package is being downloaded.
+ * - XBPS_STATE_VERIFY: a binary package is being verified.
+ * - XBPS_STATE_REMOVE: a package is being removed.
+ * - XBPS_STATE_REMOVE_DONE: a package has been removed successfully.
+ * - XBPS_STATE_REMOVE_FILE: a package file is being removed.
+ * - XBPS_STATE_REMOVE_OBSOLETE: an obsolete package file is being removed.
+ * - XBPS_STATE_REPLACE: a package is being replaced.
+ * - XBPS_STATE_INSTALL: a package is being installed.
+ * - XBPS_STATE_INSTALL_DONE: a package has been installed successfully.
+ * - XBPS_STATE_UPDATE: a package is being updated.
+ * - XBPS_STATE_UPDATE_DONE: a package has been updated successfully.
+ * - XBPS_STATE_UNPACK: a package is being unpacked.
+ * - XBPS_STATE_CONFIGURE: a package is being configured.
+ * - XBPS_STATE_CONFIGURE_DONE: a package has been configured successfully.
+ * - XBPS_STATE_CONFIG_FILE: a package configuration file is being processed.
+ * - XBPS_STATE_REPOSYNC: a remote repository's package index is being
+ * synchronized.
+ * - XBPS_STATE_VERIFY_FAIL: binary package integrity has failed.
+ * - XBPS_STATE_DOWNLOAD_FAIL: binary package download has failed.
+ * - XBPS_STATE_REMOVE_FAIL: a package removal has failed.
+ * - XBPS_STATE_REMOVE_FILE_FAIL: a package file removal has failed.
+ * - XBPS_STATE_REMOVE_FILE_HASH_FAIL: a package file removal due to
+ * its hash has failed.
+ * - XBPS_STATE_REMOVE_FILE_OBSOLETE_FAIL: an obsolete package file
+ * removal has failed.
+ * - XBPS_STATE_CONFIGURE_FAIL: package configure has failed.
+ * - XBPS_STATE_CONFIG_FILE_FAIL: package configuration file operation
+ * has failed.
+ * - XBPS_STATE_UPDATE_FAIL: package update has failed.
+ * - XBPS_STATE_UNPACK_FAIL: package unpack has failed.
+ * - XBPS_STATE_REPOSYNC_FAIL: syncing remote repositories has failed.
+ * - XBPS_STATE_REPO_KEY_IMPORT: repository is signed and needs to import pubkey.
+ * - XBPS_STATE_INVALID_DEP: package has an invalid dependency.
+ * - XBPS_STATE_SHOW_INSTALL_MSG: package must show a post-install message.
+ * - XBPS_STATE_SHOW_REMOVE_MSG: package must show a pre-remove message.
+ * - XBPS_STATE_ALTGROUP_ADDED: package has registered an alternative group.
+ * - XBPS_STATE_ALTGROUP_REMOVED: package has unregistered an alternative group.
+ * - XBPS_STATE_ALTGROUP_SWITCHED: alternative group has been switched.
+ * - XBPS_STATE_ALTGROUP_LINK_ADDED: link added by an alternative group.
+ * - XBPS_STATE_ALTGROUP_LINK_REMOVED: link removed by an alternative group.
+ * - XBPS_STATE_UNPACK_FILE_PRESERVED: package unpack preserved a file.
+ * - XBPS_STATE_PKGDB: pkgdb upgrade in progress.
+ * - XBPS_STATE_PKGDB_DONE: pkgdb has been upgraded successfully.
+ * - XBPS_STATE_TRANS_REVDEPS: reverse dependencies of the packages in
+ * transaction have been checked, with the time spent in its description.
+ * - XBPS_STATE_TRIGGER: a trigger is being executed.
+ * - XBPS_STATE_TRIGGER_DONE: a trigger has been executed successfully.
+ * - XBPS_STATE_TRIGGER_FAIL: a trigger has failed.
+ * - XBPS_STATE_UNPACK_DONE: a package has been unpacked, its statistics
+ * are set in the \a unpack member of struct xbps_state_cb_data.
+ */
+typedef enum xbps_state {
+	XBPS_STATE_UNKNOWN = 0,
+	XBPS_STATE_TRANS_DOWNLOAD,
+	XBPS_STATE_TRANS_VERIFY,
+	XBPS_STATE_TRANS_RUN,
+	XBPS_STATE_TRANS_CONFIGURE,
+	XBPS_STATE_TRANS_FAIL,
+	XBPS_STATE_DOWNLOAD,
+	XBPS_STATE_VERIFY,
+	XBPS_STATE_REMOVE,
+	XBPS_STATE_REMOVE_DONE,
+	XBPS_STATE_REMOVE_FILE,
+	XBPS_STATE_REMOVE_FILE_OBSOLETE,
+	XBPS_STATE_PURGE,
+	XBPS_STATE_PURGE_DONE,
+	XBPS_STATE_REPLACE,
+	XBPS_STATE_INSTALL,
+	XBPS_STATE_INSTALL_DONE,
+	XBPS_STATE_UPDATE,
+	XBPS_STATE_UPDATE_DONE,
+	XBPS_STATE_UNPACK,
+	XBPS_STATE_CONFIGURE,
+	XBPS_STATE_CONFIG_FILE,
+	XBPS_STATE_REPOSYNC,
+	XBPS_STATE_VERIFY_FAIL,
+	XBPS_STATE_DOWNLOAD_FAIL,
+	XBPS_STATE_REMOVE_FAIL,
+	XBPS_STATE_REMOVE_FILE_FAIL,
+	XBPS_STATE_REMOVE_FILE_HASH_FAIL,
+	XBPS_STATE_REMOVE_FILE_OBSOLETE_FAIL,
+	XBPS_STATE_PURGE_FAIL,
+	XBPS_STATE_CONFIGURE_FAIL,
+	XBPS_STATE_CONFIG_FILE_FAIL,
+	XBPS_STATE_UPDATE_FAIL,
+	XBPS_STATE_UNPACK_FAIL,
+	XBPS_STATE_REPOSYNC_FAIL,
+	XBPS_STATE_CONFIGURE_DONE,
+	XBPS_STATE_REPO_KEY_IMPORT,
+	XBPS_STATE_INVALID_DEP,
+	XBPS_STATE_SHOW_INSTALL_MSG,
+	XBPS_STATE_SHOW_REMOVE_MSG,
+	XBPS_STATE_UNPACK_FILE_PRESERVED,
+	XBPS_STATE_PKGDB,
+	XBPS_STATE_PKGDB_DONE,
+	XBPS_STATE_TRANS_ADDPKG,
+	XBPS_STATE_ALTGROUP_ADDED,
+	XBPS_STATE_ALTGROUP_REMOVED,
+	XBPS_STATE_ALTGROUP_SWITCHED,
+	XBPS_STATE_ALTGROUP_LINK_ADDED,
+	XBPS_STATE_ALTGROUP_LINK_REMOVED,
+	XBPS_STATE_TRANS_REVDEPS,
+	XBPS_STATE_TRIGGER,
+	XBPS_STATE_TRIGGER_DONE,
+	XBPS_STATE_TRIGGER_FAIL,
+	XBPS_STATE_UNPACK_DONE
+} xbps_state_t;
+
+/**
+ * @enum xbps_phase_t
+ *
+ * Transaction phases timed in struct xbps_stats:
+ *
+ * - XBPS_PHASE_RESOLVE: dependencies are resolved by
+ * xbps_transaction_prepare().
+ * - XBPS_PHASE_REVDEPS: reverse dependencies are checked.
+ * - XBPS_PHASE_SHLIBS: shared libraries are checked.
+ * - XBPS_PHASE_CONFLICTS: conflicts are checked.
+ * - XBPS_PHASE_DOWNLOAD: binary packages are downloaded by
+ * xbps_transaction_commit(). When downloads run in background this is
+ * the time spent waiting for them.
+ * - XBPS_PHASE_VERIFY: binary packages are verified.
+ * - XBPS_PHASE_UNPACK: packages are removed and unpacked.
+ * - XBPS_PHASE_CONFIGURE: packages are configured and triggers run.
+ */
+typedef enum xbps_phase {
+	XBPS_PHASE_RESOLVE = 0,
+	XBPS_PHASE_REVDEPS,
+	XBPS_PHASE_SHLIBS,
+	XBPS_PHASE_CONFLICTS,
+	XBPS_PHASE_DOWNLOAD,
+	XBPS_PHASE_VERIFY,
+	XBPS_PHASE_UNPACK,
+	XBPS_PHASE_CONFIGURE,
+	XBPS_PHASE_MAX
+} xbps_phase_t;
+
+/**
+ * @struct xbps_unpack_stats xbps.h "xbps.h"
+ * @brief Statistics of unpacked binary packages.
+ */
+struct xbps_unpack_stats {
+	/**
+	 * @var bytes
+	 *
+	 * Size of the extracted files.
+	 */
+	uint64_t bytes;
+	/**
+	 * @var files
+	 *
+	 * Number of extracted files.
+	 */
+	uint64_t files;
+	/**
+	 * @var time
+	 *
+	 * Nanoseconds spent unpacking.
+	 */
+	uint64_t time;
+};
+
+/**
+ * @struct xbps_stats xbps.h "xbps.h"
+ * @brief Statistics of the current transaction.
+ *
+ * Reset by xbps_transaction_prepare() and updated as the transaction
+ * goes on, all members are read-only.
+ */
+struct xbps_stats {
+	/**
+	 * @var phase_time
+	 *
+	 * Nanoseconds spent in every phase, indexed by xbps_phase_t.
+	 */
+	uint64_t phase_time[XBPS_PHASE_MAX];
+	/**
+	 * @var unpack
+	 *
+	 * Totals of all unpacked packages.
+	 */
+	struct xbps_unpack_stats unpack;
+	/**
+	 * @var unpack_pkgs
+	 *
+	 * Number of unpacked packages.
+	 */
+	unsigned int unpack_pkgs;
+};
+
+/**
+ * @enum xbps_counter_t
+ *
+ * Operations counted by libxbps in its hot paths, see xbps_counter():
+ *
+ * - XBPS_COUNTER_PLISTS: plists internalized.
+ * - XBPS_COUNTER_PLIST_BYTES: bytes of the internalized plists.
+ * - XBPS_COUNTER_CMPVER: calls to xbps_cmpver().
+ * - XBPS_COUNTER_PKGPATTERN_MATCH: package patterns matched, by
+ * xbps_pkgpattern_match() or compiled.
+ * - XBPS_COUNTER_RPOOL_LOOKUPS: packages looked up in the repository pool.
+ * - XBPS_COUNTER_RPOOL_HITS: lookups in the repository pool that found
+ * a package.
+ * - XBPS_COUNTER_RPOOL_MISSES: lookups in the repository pool that
+ * didn't find a package.
+ * - XBPS_COUNTER_HASH_BYTES: bytes hashed with SHA256.
+ * - XBPS_COUNTER_FETCH_BYTES: bytes fetched from remote repositories.
+ * - XBPS_COUNTER_UNPACK_FILES: files extracted from binary packages.
+ * - XBPS_COUNTER_FSYNCS: fsync(2), fdatasync(2) and syncfs(2) calls.
+ */
+typedef enum xbps_counter {
+	XBPS_COUNTER_PLISTS = 0,
+	XBPS_COUNTER_PLIST_BYTES,
+	XBPS_COUNTER_CMPVER,
+	XBPS_COUNTER_PKGPATTERN_MATCH,
+	XBPS_COUNTER_RPOOL_LOOKUPS,
+	XBPS_COUNTER_RPOOL_HITS,
+	XBPS_COUNTER_RPOOL_MISSES,
+	XBPS_COUNTER_HASH_BYTES,
+	XBPS_COUNTER_FETCH_BYTES,
+	XBPS_COUNTER_UNPACK_FILES,
+	XBPS_COUNTER_FSYNCS,
+	XBPS_COUNTER_MAX
+} xbps_counter_t;
+
+/**
+ * @struct xbps_state_cb_data xbps.h "xbps.h"
+ * @brief Structure to be passed as argument to the state function callback.
+ * All members are read-only and set internally by libxbps.
+ */
+struct xbps_state_cb_data {
+	/**
+	 * @var xhp
+	 *
+	 * Pointer to our struct xbps_handle passed to xbps_init().
+	 */
+	struct xbps_handle *xhp;
+	/**
+	 * @var desc
+	 *
+	 * Current state string description.
+	 */
+	const char *desc;
+	/**
+	 * @var arg
+	 *
+	 * State string argument. String set on this
+	 * variable may change depending on \a state.
+	 */
+	const char *arg;
+	/**
+	 * @var err
+	 *
+	 * Current state error value (set internally, read-only).
+	 */
+	int err;
+	/**
+	 * @var state
+	 *
+	 * Current state.
+	 */
+	xbps_state_t state;
+	/**
+	 * @var timestamp
+	 *
+	 * Time of the state, in nanoseconds of a monotonic clock.
+	 */
+	uint64_t timestamp;
+	/**
+	 * @var stats
+	 *
+	 * Statistics of the current transaction.
+	 */
+	const struct xbps_stats *stats;
+	/**
+	 * @var unpack
+	 *
+	 * Statistics of the unpacked package with XBPS_STATE_UNPACK_DONE,
+	 * NULL otherwise.
+	 */
+	const struct xbps_unpack_stats *unpack;
+};
+
+/**
+ * @struct xbps_fetch_cb_data xbps.h "xbps.h"
+ * @brief Structure to be passed to the fetch function callback.
+ *
+ * This structure is passed as argument to the fetch progress function
+ * callback and its members will be updated when there's any progress.
+ * All members marked as read-only in this struct are set internally by
+ * xbps_unpack_binary_pkg() and shouldn't be modified in the passed
+ * function callback.
+ */
+struct xbps_fetch_cb_data {
+	/**
+	 * @var xhp
+	 *
+	 * Pointer to our struct xbps_handle passed to xbps_init().
+	 */
+	struct xbps_handle *xhp;
+	/**
+	 * @var file_size
+	 *
+	 * Filename size for the file to be fetched.
+	 */
+	off_t file_size;
+	/**
+	 * @var file_offset
+	 *
+	 * Current offset for the filename being fetched.
+	 */
+	off_t file_offset;
+	/**
+	 * @var file_dloaded
+	 *
+	 * Bytes downloaded for the file being fetched.
+	 */
+	off_t file_dloaded;
+	/**
+	 * @var file_name
+	 *
+	 * File name being fetched.
+	 */
+	const char *file_name;
+	/**
+	 * @var cb_start
+	 *
+	 * If true the function callback should be prepared to start
+	 * the transfer progress.
+	 */
+	bool cb_start;
+	/**
+	 * @var cb_update
+	 *
+	 * If true the function callback should be prepared to
+	 * update the transfer progress.
+	 */
+	bool cb_update;
+	/**
+	 * @var cb_end
+	 *
+	 * If true the function callback should be prepated to
+	 * end the transfer progress.
+	 */
+	bool cb_end;
+};
+
+/**
+ * @struct xbps_unpack_cb_data xbps.h "xbps.h"
+ * @brief Structure to be passed to the unpack function callback.
+ *
+ * This structure is passed as argument to the unpack progress function
+ * callback and its members will be updated when there's any progress.
+ * All members in this struct are set internally by libxbps
+ * and should be used in read-only mode in the supplied function
+ * callback.
+ */
+struct xbps_unpack_cb_data {
+	/**
+	 * @var xhp
+	 *
+	 * Pointer to our struct xbps_handle passed to xbps_init().
+	 */
+	struct xbps_handle *xhp;
+	/**
+	 * @var pkgver
+	 *
+	 * Package name/version string of package being unpacked.
+	 */
+	const char *pkgver;
+	/**
+	 * @var entry
+	 *
+	 * Entry pathname string.
+	 */
+	const char *entry;
+	/**
+	 * @var entry_size
+	 *
+	 * Entry file size.
+	 */
+	int64_t entry_size;
+	/**
+	 * @var entry_extract_count
+	 *
+	 * Total number of extracted entries.
+	 */
+	ssize_t entry_extract_count;
+	/**
+	 * @var entry_total_count
+	 *
+	 * Total number of entries in package.
+	 */
+	ssize_t entry_total_count;
+	/**
+	 * @var entry_is_conf
+	 *
+	 * If true "entry" is a configuration file.
+	 */
+	bool entry_is_conf;
+	/**
+	 * @var entry_sha256
+	 *
+	 * SHA256 hash of the extracted data if "entry" is a regular file,
+	 * computed while it was written to disk. NULL otherwise.
+	 */
+	const char *entry_sha256;
+};
+
+struct xbps_handle;
+
+/**
+ * @struct xbps_reduce xbps.h "xbps.h"
+ * @brief Callbacks of xbps_array_foreach_reduce().
+ */
+struct xbps_reduce {
+	/**
+	 * @var init
+	 *
+	 * Returns a new accumulator for a slice of the array, NULL
+	 * on error.
+	 */
+	void *(*init)(void *arg);
+	/**
+	 * @var fn
+	 *
+	 * Called per object with the accumulator of its slice, concurrently
+	 * with other slices.
+	 */
+	int (*fn)(struct xbps_handle *xhp, xbps_object_t obj, const char *key,
+	    void *acc, bool *done);
+	/**
+	 * @var merge
+	 *
+	 * Merges an accumulator into \a arg, one at a time and in array
+	 * order.
+	 */
+	int (*merge)(void *arg, void *acc);
+	/**
+	 * @var fini
+	 *
+	 * Frees an accumulator after it was merged or discarded (optional).
+	 */
+	void (*fini)(void *acc);
+	/**
+	 * @var arg
+	 *
+	 * Argument passed to \a init and \a merge.
+	 */
+	void *arg;
+};
+
+struct xbps_pool;
+struct xbps_mirror_rank;
+
+/**
+ * @struct xbps_handle xbps.h "xbps.h"
+ * @brief Generic XBPS structure handler for initialization.
+ *
+ * This structure sets some global properties for libxbps, to set some
+ * function callbacks and data to the fetch, transaction and unpack functions,
+ * the root and cache directory, flags, etc.
+ */
+struct xbps_handle {
+	/**
+	 * @private
+	 */
+	xbps_array_t preserved_files;
+	/**
+	 * @var repositories
+	 *
+	 * Proplib array of strings with repositories, overriding the list
+	 * in the configuration file.
+	 */
+	xbps_array_t repositories;
+	/**
+	 * @private
+	 */
+	xbps_dictionary_t pkgdb_revdeps;
+	bool pkgdb_revdeps_stale;
+	xbps_dictionary_t pkgdb_shlibs;
+	xbps_dictionary_t vpkgd;
+	xbps_dictionary_t vpkgd_conf;
+	xbps_dictionary_t pkgdb_deptree;
+	xbps_dictionary_t rpool_deptree;
+	struct xbps_depgraph *pkgdb_depgraph;
+	struct xbps_depgraph *rpool_depgraph;
+	xbps_dictionary_t altlinks;
+	struct xbps_rpool *rpool;
+	struct xbps_pkgdb_hash *pkgdb_hash;
+	struct xbps_commit *commit;
+	/**
+	 * @var pkgdb
+	 *
+	 * Proplib dictionary with the master package database
+	 * stored in XBPS_META_PATH/XBPS_PKGDB.
+	 */
+	xbps_dictionary_t pkgdb;
+	/**
+	 * @var transd
+	 *
+	 * Proplib dictionary with transaction objects, required by
+	 * xbps_transaction_commit().
+	 */
+	xbps_dictionary_t transd;
+	/**
+	 * Pointer to the supplifed function callback to be used
+	 * in the XBPS possible states.
+	 */
+	int (*state_cb)(const struct xbps_state_cb_data *, void *);
+	/**
+	 * @var state_cb_data
+	 *
+	 * Pointer to user supplied data to be passed as argument to
+	 * the \a xbps_state_cb function callback.
+	 */
+	void *state_cb_data;
+	/**
+	 * Pointer to the supplied function callback to be used in
+	 * xbps_unpack_binary_pkg().
+	 */
+	void (*unpack_cb)(const struct xbps_unpack_cb_data *, void *);
+	/**
+	 * @var unpack_cb_data
+	 *
+	 * Pointer to user supplied data to be passed as argument to
+	 * the \a xbps_unpack_cb function callback.
+	 */
+	void *unpack_cb_data;
+	/**
+	 * Pointer to the supplied function callback to be used in
+	 * xbps_fetch_file().
+	 */
+	void (*fetch_cb)(const struct xbps_fetch_cb_data *, void *);
+	/**
+	 * @var fetch_cb_data
+	 *
+	 * Pointer to user supplied data to be passed as argument to
+	 * the \a xbps_fetch_cb function callback.
+	 */
+	void *fetch_cb_data;
+	/**
+	 * @var pkgdb_plist;
+	 *
+	 * Absolute pathname to the pkgdb plist file.
+	 */
+	char *pkgdb_plist;
+	/**
+	 * @var target_arch
+	 *
+	 * Target architecture, as set by XBPS_TARGET_ARCH from environment.
+	 */
+	const char *target_arch;
+	/**
+	 * @var confdir
+	 *
+	 * Full path to the xbps configuration directory.
+	 */
+	char confdir[XBPS_MAXPATH+sizeof(XBPS_SYSCONF_PATH)];
+	/**
+	 * @var rootdir
+	 *
+	 * Root directory for all operations in XBPS.
+	 * If unset,  defaults to '/'.
+	 */
+	char rootdir[XBPS_MAXPATH];
+	/**
+	 * @var cachedir
+	 *
+	 * Cache directory to store downloaded binary packages.
+	 * If unset, defaults to \a XBPS_CACHE_PATH (relative to rootdir).
+	 */
+	char cachedir[XBPS_MAXPATH+sizeof(XBPS_CACHE_PATH)];
+	/**
+	 * @var sharedcachedir
+	 *
+	 * Cache directory shared by many root directories, where binary
+	 * packages from remote repositories are stored by their SHA256
+	 * hash. It is not relative to rootdir; if unset, it is not used.
+	 */
+	char sharedcachedir[XBPS_MAXPATH];
+	/**
+	 * @var metadir
+	 *
+	 * Metadata directory for all operations in XBPS.
+	 * If unset, defaults to \a XBPS_CACHE_PATH (relative to rootdir).
+	 */
+	char metadir[XBPS_MAXPATH+sizeof(XBPS_META_PATH)];
+	/**
+	 * @var native_arch
+	 *
+	 * Machine architecture, defaults to uname(2)::machine
+	 * if XBPS_ARCH is not set from environment.
+	 */
+	char native_arch[64];
+	/**
+	 * @var flags
+	 *
+	 * Flags to be set globally by ORing them, possible values:
+	 *  - XBPS_FLAG_VERBOSE
+	 *  - XBPS_FLAG_FORCE_CONFIGURE
+	 *  - XBPS_FLAG_FORCE_REMOVE_FILES
+	 *  - XBPS_FLAG_DEBUG
+	 *  - XBPS_FLAG_INSTALL_AUTO
+	 *  - XBPS_FLAG_DISABLE_SYSLOG
+	 */
+	int flags;
+	/**
+	 * @var fetch_jobs
+	 *
+	 * Maximum number of concurrent transfers while synchronizing
+	 * remote repositories and downloading binary packages, set with
+	 * the \a fetch_jobs option in the configuration file. 0 or 1
+	 * processes them one after another.
+	 */
+	unsigned int fetch_jobs;
+	/**
+	 * @var fetch_bufsize
+	 *
+	 * Size of the buffer used to write downloaded files, set with
+	 * the \a fetch_bufsize option in the configuration file.
+	 * XBPS_FETCH_BUFSIZE is used if it's 0.
+	 */
+	size_t fetch_bufsize;
+	/**
+	 * @var fetch_segments
+	 *
+	 * Maximum number of concurrent requests for byte ranges of
+	 * large files fetched from HTTP servers, set with the
+	 * \a fetch_segments option in the configuration file. 0 or 1
+	 * fetches them in a single request.
+	 */
+	unsigned int fetch_segments;
+	/**
+	 * @var unpack_jobs
+	 *
+	 * Maximum number of binary packages unpacked concurrently in
+	 * a transaction, set with the \a unpack_jobs option in the
+	 * configuration file. Only new packages without INSTALL scripts
+	 * nor alternatives that don't share files are unpacked at once,
+	 * 0 or 1 unpacks them one after another.
+	 */
+	unsigned int unpack_jobs;
+	/**
+	 * @var unpack_readahead
+	 *
+	 * Number of binary packages after the one being unpacked that
+	 * the kernel is asked to read ahead in a transaction, set with
+	 * the \a unpack_readahead option in the configuration file.
+	 * 0 disables it.
+	 */
+	unsigned int unpack_readahead;
+	/**
+	 * @var worker_threads
+	 *
+	 * Number of threads used by parallel operations, the calling
+	 * thread included, set with the \a worker_threads option in the
+	 * configuration file. If 0 the CPUs available to the process
+	 * are used, bounded by the CPU quota of its cgroup.
+	 */
+	unsigned int worker_threads;
+	/**
+	 * @var mirrors
+	 *
+	 * Proplib dictionary with the mirrors of remote repositories,
+	 * declared with additional URLs in the \a repository option.
+	 * Every repository is a key to the array of its mirrors, the
+	 * repository itself being the first one.
+	 */
+	xbps_dictionary_t mirrors;
+	/**
+	 * @var stats
+	 *
+	 * Statistics of the current transaction, also passed to the
+	 * state callback.
+	 */
+	struct xbps_stats stats;
+	/**
+	 * @private
+	 *
+	 * Worker threads shared by parallel operations, started on
+	 * first use and stopped by xbps_end().
+	 */
+	struct xbps_pool *pool;
+	/**
+	 * @private
+	 *
+	 * Values of the counters when xbps_init() was called.
+	 */
+	uint64_t counters[XBPS_COUNTER_MAX];
+	/**
+	 * @private
+	 *
+	 * pkgdb journal, open while pkgdb is locked: its length and the
+	 * length after which pkgdb is flushed.
+	 */
+	int journal_fd;
+	off_t journal_len;
+	off_t journal_max;
+	/**
+	 * @private
+	 *
+	 * Rankings of the mirrors of the repositories in \a mirrors,
+	 * freed by xbps_end().
+	 */
+	struct xbps_mirror_rank *mirror_ranks;
+	/**
+	 * @private
+	 *
+	 * Signatures verified, read from and written to metadir by
+	 * xbps_end() if modified.
+	 */
+	xbps_dictionary_t verify_cache;
+	bool verify_cache_dirty;
+	/**
+	 * @private
+	 *
+	 * Packages whose files plist was written since the files index
+	 * was stored.
+	 */
+	xbps_dictionary_t pkgdb_files_changed;
+};
+
+void xbps_dbg_printf(struct xbps_handle *, const char *, ...) __attribute__ ((format (printf, 2, 3)));
+void xbps_dbg_printf_append(struct xbps_handle *, const char *, ...)__attribute__ ((format (printf, 2, 3)));
+void xbps_error_printf(const char *, ...)__attribute__ ((format (printf, 1, 2)));
+void xbps_warn_printf(const char *, ...)__attribute__ ((format (printf, 1, 2)));
+
+/**
+ * Initialize the XBPS library with the following steps:
+ *
+ *   - Set function callbacks for fetching and unpacking.
+ *   - Set default cache connections for libfetch.
+ *   - Parse configuration file.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @note It's assumed that \a xhp is a valid pointer.
+ *
+ * @return 0 on success, an errno value otherwise.
+ */
+int xbps_init(struct xbps_handle *xhp);
+
+/**
+ * Releases all resources used by libxbps.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ */
+void xbps_end(struct xbps_handle *xhp);
+
+/**
+ * Reports the memory used by the proplib objects cached by libxbps:
+ * the pkgdb and its tables, the transaction dictionary, the package
+ * files cache and the indexes of every repository opened in the pool.
+ * xbps_end() prints this report with XBPS_FLAG_DEBUG.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] fn Function called for every object, with its name, the
+ * URI of its repository (NULL if it's not a repository index) and the
+ * number of objects and bytes by type reachable from it.
+ * A non-zero value stops the report.
+ * @param[in] arg Argument passed to \a fn.
+ *
+ * @return 0 on success, or the value returned by \a fn.
+ */
+int xbps_memstat_foreach(struct xbps_handle *xhp,
+		int (*fn)(const char *, const char *,
+			const struct xbps_memstat *, void *),
+		void *arg);
+
+/**
+ * Returns the number of operations counted by \a counter since
+ * xbps_init() was called with \a xhp. The counters are shared by all
+ * handles and threads of the process, xbps_end() prints them with
+ * XBPS_FLAG_DEBUG.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] counter The counter, see xbps_counter_t.
+ *
+ * @return The value of the counter, 0 if \a counter is not valid.
+ */
+uint64_t xbps_counter(struct xbps_handle *xhp, xbps_counter_t counter);
+
+/**
+ * Returns the name of a counter, as printed by xbps_end().
+ *
+ * @param[in] counter The counter, see xbps_counter_t.
+ *
+ * @return The name of the counter, NULL if \a counter is not valid.
+ */
+const char *xbps_counter_name(xbps_counter_t counter);
+
+/*@}*/
+
+/** @addtogroup configure */
+/*@{*/
+
+/**
+ * Configure (or force reconfiguration of) a package.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] pkgname Package name to configure.
+ * @param[in] check_state Set it to true to check that package is
+ * in unpacked state.
+ * @param[in] update Set it to true if this package is being updated.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_configure_pkg(struct xbps_handle *xhp, const char *pkgname,
+		bool check_state, bool update);
+
+/**
+ * Configure (or force reconfiguration of) all packages.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] ignpkgs Proplib array of strings with pkgname or pkgvers to ignore.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_configure_packages(struct xbps_handle *xhp, xbps_array_t ignpkgs);
+
+/**
+ * Like xbps_configure_packages() but runs the INSTALL scripts of up to
+ * \a maxjobs packages at the same time. A package is configured only
+ * after the packages it depends on; the output of every script is
+ * captured and shown along with the state callbacks one package at a time.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] ignpkgs Proplib array of strings with pkgname or pkgvers to ignore.
+ * @param[in] maxjobs Number of scripts to run in parallel, 0 or 1 is
+ * the same as xbps_configure_packages().
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_configure_packages_jobs(struct xbps_handle *xhp,
+		xbps_array_t ignpkgs, unsigned int maxjobs);
+
+/*@}*/
+
+/** @addtogroup download */
+/*@{*/
+
+/**
+ * Download a file from a remote URL to current working directory.
+ * 
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] uri Remote URI string.
+ * @param[in] flags Flags passed to libfetch's fetchXget().
+ * 
+ * @return -1 on error, 0 if not downloaded (because local/remote size/mtime
+ * do not match) and 1 if downloaded successfully.
+ **/
+int xbps_fetch_file(struct xbps_handle *xhp, const char *uri,
+		    const char *flags);
+
+/**
+ * Download a file from a remote URL to current working directory,
+ * and writing file to \a filename.
+ * 
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] uri Remote URI string.
+ * @param[in] filename Local filename to safe the file
+ * @param[in] flags Flags passed to libfetch's fetchXget().
+ * 
+ * @return -1 on error, 0 if not downloaded (because local/remote size/mtime
+ * do not match) and 1 if downloaded successfully.
+ **/
+int xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri,
+		    const char *filename, const char *flags);
+
+/**
+ * Returns last error string reported by xbps_fetch_file().
+ *
+ * @return A string with the appropiate error message.
+ */
+const char *xbps_fetch_error_string(void);
+
+/*@}*/
+
+/**
+ * @ingroup pkg_orphans
+ *
+ * Finds all package orphans currently installed.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] orphans Proplib array of strings with package names of
+ * packages that should be treated as they were already removed (optional).
+ *
+ * @return A proplib array of dictionaries with all orphans found,
+ * on error NULL is returned and errno is set appropiately.
+ */
+xbps_array_t xbps_find_pkg_orphans(struct xbps_handle *xhp, xbps_array_t orphans);
+
+/**
+ * @ingroup pkg_obsoletes
+ *
+ * Finds obsolete files by comparing installed files dictionary with
+ * a new files dictionary.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] instd Installed package metadata dictionary.
+ * @param[in] newd New package metadata dictionary.
+ *
+ * @return A proplib array of strings with a sorted list of obsolete files.
+ */
+xbps_array_t xbps_find_pkg_obsoletes(struct xbps_handle *xhp,
+				     xbps_dictionary_t instd,
+				     xbps_dictionary_t newd);
+
+/** @addtogroup pkgdb */
+/*@{*/
+
+/**
+ * Locks the pkgdb to allow a write transaction.
+ *
+ * This routine should be called before a write transaction is the target:
+ * install, remove or update.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_pkgdb_lock(struct xbps_handle *);
+
+/**
+ * Unlocks the pkgdb after a write transaction.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ */
+void xbps_pkgdb_unlock(struct xbps_handle *);
+
+/**
+ * Executes a function callback per a package dictionary registered
+ * in the package database (pkgdb) plist.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] fn Function callback to run for any pkg dictionary.
+ * @param[in] arg Argument to be passed to the function callback.
+ *
+ * @return 0 on success (all objects were processed), otherwise
+ * the value returned by the function callback.
+ */
+int xbps_pkgdb_foreach_cb(struct xbps_handle *xhp,
+	int (*fn)(struct xbps_handle *, xbps_object_t, const char *, void *, bool *),
+	void *arg);
+
+/**
+ * Executes a function callback per a package dictionary registered
+ * in the package database (pkgdb) plist.
+ *
+ * This is a multithreaded implementation spawning a thread per core. Each
+ * thread processes a fraction of total objects in the pkgdb dictionary.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] fn Function callback to run for any pkg dictionary.
+ * @param[in] arg Argument to be passed to the function callback.
+ *
+ * @return 0 on success (all objects were processed), otherwise
+ * the value returned by the function callback.
+ */
+int xbps_pkgdb_foreach_cb_multi(struct xbps_handle *xhp,
+	int (*fn)(struct xbps_handle *, xbps_object_t, const char *, void *, bool *),
+	void *arg);
+
+/**
+ * Reduces the package dictionaries registered in the package database
+ * (pkgdb) in parallel with the callbacks in \a ops.
+ * See xbps_array_foreach_reduce().
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] ops The callbacks to run.
+ *
+ * @return 0 on success, otherwise the first error in pkgdb order.
+ */
+int xbps_pkgdb_foreach_reduce(struct xbps_handle *xhp,
+	const struct xbps_reduce *ops);
+
+/**
+ * Returns a package dictionary from the package database (pkgdb),
+ * matching pkgname or pkgver object in \a pkg.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package name or name-version to match.
+ *
+ * @return The matching proplib package dictionary, NULL otherwise.
+ */
+xbps_dictionary_t xbps_pkgdb_get_pkg(struct xbps_handle *xhp,
+				     const char *pkg);
+
+/**
+ * Returns a package dictionary from the package database (pkgdb),
+ * matching virtual pkgname or pkgver object in \a pkg.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package name or name-version to match.
+ *
+ * @return The matching proplib package dictionary, NULL otherwise.
+ */
+xbps_dictionary_t xbps_pkgdb_get_virtualpkg(struct xbps_handle *xhp,
+					    const char *pkg);
+
+/**
+ * Returns the package dictionary with all files for \a pkg.
+ *
+ * The dictionaries are cached while their files plist doesn't change,
+ * the returned dictionary is immutable and shared; it must be released
+ * with xbps_object_release(). If the package has no files plist in
+ * metadir, it's read from the consolidated files index, if any.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ *
+ * @return The matching package dictionary, NULL otherwise.
+ */
+xbps_dictionary_t xbps_pkgdb_get_pkg_files(struct xbps_handle *xhp,
+					   const char *pkg);
+
+/**
+ * Executes a function callback for the files owned by installed
+ * packages, as recorded in the files index (XBPS_PKGDB_FILES).
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] path If set, only the entries matching this exact path
+ * are processed; otherwise all entries are.
+ * @param[in] fn Function callback to execute for every entry, with
+ * its pkgver, file path, link target (NULL if none) and the key of
+ * the files array it belongs to ("conf_files", "files" or "links").
+ * A non zero return value stops the iteration.
+ * @param[in] arg Argument passed to \a fn.
+ *
+ * @return 0 on success, ENOENT if there's no files index up to date
+ * with pkgdb, or the value returned by \a fn.
+ */
+int xbps_pkgdb_files_foreach(struct xbps_handle *xhp, const char *path,
+	int (*fn)(struct xbps_handle *, const char *, const char *,
+	const char *, const char *, void *), void *arg);
+
+/**
+ * Executes a function callback for the files owned by the installed
+ * package \a pkg, as recorded in the files index (XBPS_PKGDB_FILES),
+ * in the order of its files plist: "conf_files", "files" and "links".
+ * No proplib objects are created.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ * @param[in] fn Function callback, as in xbps_pkgdb_files_foreach().
+ * @param[in] arg Argument passed to \a fn.
+ *
+ * @return 0 on success, ENOENT if the package is not installed, has no
+ * files or the files index is not up to date for it, or the value
+ * returned by \a fn.
+ */
+int xbps_pkgdb_pkg_files_foreach(struct xbps_handle *xhp, const char *pkg,
+	int (*fn)(struct xbps_handle *, const char *, const char *,
+	const char *, const char *, void *), void *arg);
+
+/**
+ * Consolidates the package metadata in metadir: the files plists of
+ * all installed packages are stored in the files index
+ * (XBPS_PKGDB_FILES) and removed from metadir; the files plists
+ * written later are stored when pkgdb is flushed. Packages whose files
+ * plist doesn't match its "metafile-sha256" object are not stored.
+ *
+ * If \a consolidate is false, the stored files plists are written back
+ * to metadir and the files index doesn't store them anymore.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] consolidate True to consolidate, false to undo it.
+ *
+ * @return 0 on success, an errno value otherwise.
+ */
+int xbps_pkgdb_files_consolidate(struct xbps_handle *xhp, bool consolidate);
+
+/**
+ * Returns a hash of the name, version and state of all installed
+ * packages that doesn't depend on their order, to compare the
+ * package sets of several systems.
+ *
+ * Packages are spread by name over XBPS_PKGDB_HASH_BUCKETS buckets,
+ * every one has its own hash and the hash of pkgdb is computed from
+ * them: the buckets that differ tell which packages to compare. The
+ * hashes are computed once and updated as packages are registered,
+ * removed or change their state.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] bucket The bucket to return, or -1 for the hash of pkgdb.
+ *
+ * @return A malloc(3)ed string with the SHA256 hash, NULL otherwise and
+ * errno is set appropiately.
+ */
+char *xbps_pkgdb_hash(struct xbps_handle *xhp, int bucket);
+
+/**
+ * Returns the bucket of the package database hash of \a pkgname.
+ *
+ * @param[in] pkgname The package name.
+ *
+ * @return A bucket number lower than XBPS_PKGDB_HASH_BUCKETS.
+ */
+unsigned int xbps_pkgdb_hash_bucket(const char *pkgname);
+
+/**
+ * Returns a proplib array of strings with reverse dependencies
+ * for \a pkg. The array is generated dynamically based on the list
+ * of packages currently installed.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ *
+ * @return A proplib array of strings with reverse dependencies for \a pkg,
+ * NULL otherwise.
+ */
+xbps_array_t xbps_pkgdb_get_pkg_revdeps(struct xbps_handle *xhp,
+					const char *pkg);
+
+/**
+ * Returns a proplib array of strings with a proper sorted list
+ * of packages of a full dependency graph for \a pkg.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ *
+ * @return A proplib array of strings with the full dependency graph for \a pkg,
+ * NULL otherwise.
+ */
+xbps_array_t xbps_pkgdb_get_pkg_fulldeptree(struct xbps_handle *xhp,
+					const char *pkg);
+
+/**
+ * Returns a proplib array of strings with all installed packages that
+ * depend on \a pkg directly or through other packages, the direct
+ * reverse dependencies first.
+ *
+ * The dependency graph of pkgdb is built on the first call and kept
+ * until a package is registered or removed, every call then takes
+ * time proportional to the number of packages found.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ *
+ * @return A proplib array of strings that must be released with
+ * xbps_object_release(), NULL otherwise and errno is set appropiately.
+ */
+xbps_array_t xbps_pkgdb_get_pkg_fullrevdeptree(struct xbps_handle *xhp,
+					const char *pkg);
+
+/**
+ * Updates the package database (pkgdb) with new contents from the
+ * cached memory copy to disk.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] flush If true the pkgdb plist contents in memory will
+ * be flushed atomically to storage.
+ * @param[in] update If true and the pkgdb is loaded, the copy in memory
+ * is written to disk if it was modified since it was last read or written,
+ * and is kept as the current copy. Otherwise the pkgdb plist stored on disk
+ * is read again.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_pkgdb_update(struct xbps_handle *xhp, bool flush, bool update);
+
+/**
+ * Creates a temporary file and executes it in rootdir.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] blob The buffer pointer where the data is stored.
+ * @param[in] blobsiz The size of the buffer data.
+ * @param[in] pkgver The package name/version associated.
+ * @param[in] action The action to execute on the temporary file.
+ * @param[in] update Set to true if package is being updated.
+ *
+ * @return 0 on success, or an errno value otherwise.
+ */
+int xbps_pkg_exec_buffer(struct xbps_handle *xhp,
+			 const void *blob,
+			 const size_t blobsiz,
+			 const char *pkgver,
+			 const char *action,
+			 bool update);
+
+/**
+ * Creates a temporary file and executes it in rootdir.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] d Package dictionary where the script data is stored.
+ * @param[in] script Key associated with the script in dictionary.
+ * @param[in] action The action to execute on the temporary file.
+ * @param[in] update Set to true if package is being updated.
+ *
+ * @return 0 on success, or an errno value otherwise.
+ */
+int xbps_pkg_exec_script(struct xbps_handle *xhp,
+			 xbps_dictionary_t d,
+			 const char *script,
+			 const char *action,
+			 bool update);
+
+/*@}*/
+
+/** @addtogroup alternatives */
+/*@{*/
+
+/**
+ * Sets all alternatives provided by this \a pkg, or only those
+ * set by a \a group.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package name to match.
+ * @param[in] group Alternatives group to match.
+ *
+ * @return 0 on success, or an errno value otherwise.
+ */
+int xbps_alternatives_set(struct xbps_handle *xhp, const char *pkg, const char *group);
+
+/**
+ * Registers all alternative groups provided by a package.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkgd Package dictionary as stored in the transaction dictionary.
+ *
+ * @return 0 on success, or an errno value otherwise.
+ */
+int xbps_alternatives_register(struct xbps_handle *xhp, xbps_dictionary_t pkgd);
+
+/**
+ * Unregisters all alternative groups provided by a package.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkgd Package dictionary as stored in the transaction dictionary.
+ *
+ * @return 0 on success, or an errno value otherwise.
+ */
+int xbps_alternatives_unregister(struct xbps_handle *xhp, xbps_dictionary_t pkgd);
+
+/*@}*/
+
+/** @addtogroup plist */
+/*@{*/
+
+/**
+ * Executes a function callback (\a fn) per object in the proplib array \a array.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] array The proplib array to traverse.
+ * @param[in] dict The dictionary associated with the array.
+ * @param[in] fn Function callback to run for any pkg dictionary.
+ * @param[in] arg Argument to be passed to the function callback.
+ *
+ * @return 0 on success (all objects were processed), otherwise
+ * the value returned by the function callback.
+ */
+int xbps_array_foreach_cb(struct xbps_handle *xhp,
+		xbps_array_t array,
+		xbps_dictionary_t dict,
+		int (*fn)(struct xbps_handle *, xbps_object_t obj, const char *, void *arg, bool *done),
+		void *arg);
+
+/**
+ * Executes a function callback (\a fn) per object in the proplib array \a array.
+ * This is a multithreaded implementation spawning a thread per core. Each
+ * thread processes a fraction of total objects in the array.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] array The proplib array to traverse.
+ * @param[in] dict The dictionary associated with the array.
+ * @param[in] fn Function callback to run for any pkg dictionary.
+ * @param[in] arg Argument to be passed to the function callback.
+ *
+ * @return 0 on success (all objects were processed), otherwise
+ * the value returned by the function callback.
+ */
+int xbps_array_foreach_cb_multi(struct xbps_handle *xhp,
+		xbps_array_t array,
+		xbps_dictionary_t dict,
+		int (*fn)(struct xbps_handle *, xbps_object_t obj, const char *, void *arg, bool *done),
+		void *arg);
+
+/**
+ * Reduces the objects in the proplib array \a array in parallel, without
+ * sharing state between threads.
+ *
+ * The array is split in slices processed by the worker threads, and
+ * every slice has its own accumulator returned by \a ops->init. The
+ * \a ops->fn callback is called per object with the accumulator of its
+ * slice, and \a ops->merge merges every accumulator into \a ops->arg.
+ * Merges are never run concurrently and follow the array order, so the
+ * result does not depend on the number of threads.
+ *
+ * If \a ops->fn returns an error or sets its \a done argument, or
+ * \a ops->merge returns an error, no more slices are started and the
+ * accumulators after that slice are not merged.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] array The proplib array to traverse.
+ * @param[in] dict The dictionary associated with the array.
+ * @param[in] ops The callbacks to run.
+ *
+ * @return 0 on success (all objects were processed), otherwise the
+ * first error in array order returned by \a ops->fn or \a ops->merge,
+ * or ENOMEM.
+ */
+int xbps_array_foreach_reduce(struct xbps_handle *xhp,
+		xbps_array_t array,
+		xbps_dictionary_t dict,
+		const struct xbps_reduce *ops);
+
+/**
+ * Match a virtual package name or pattern by looking at proplib array
+ * of strings.
+ *
+ * @param[in] array Proplib array of strings.
+ * @param[in] str Virtual package name or package pattern to match.
+ *
+ * @return True if \a str matches a virtual package in \a array, false
+ * otherwise.
+ */
+bool xbps_match_virtual_pkg_in_array(xbps_array_t array, const char *str);
+
+/**
+ * Match a virtual package name or pattern by looking at package's
+ * dictionary "provides" array object.
+ *
+ * @param[in] pkgd Package dictionary.
+ * @param[in] str Virtual package name or package pattern to match.
+ *
+ * @return True if \a str matches a virtual package in \a pkgd, false
+ * otherwise.
+ */
+bool xbps_match_virtual_pkg_in_dict(xbps_dictionary_t pkgd, const char *str);
+
+/**
+ * Match any virtual package from array \a provides in they array \a rundeps
+ * with dependencies.
+ *
+ * @param[in] rundeps Proplib array with dependencies as strings, i.e foo>=2.0.
+ * @param[in] provides Proplib array of strings with virtual pkgdeps, i.e
+ * foo-1.0 blah-2.0.
+ *
+ * @return True if \a any virtualpkg has been matched, false otherwise.
+ */
+bool xbps_match_any_virtualpkg_in_rundeps(xbps_array_t rundeps,
+					  xbps_array_t provides);
+
+/**
+ * Match a package name in the specified array of strings.
+ *
+ * @param[in] array The proplib array to search on.
+ * @param[in] pkgname The package name to match.
+ *
+ * @return true on success, false otherwise and errno is set appropiately.
+ */
+bool xbps_match_pkgname_in_array(xbps_array_t array, const char *pkgname);
+
+/**
+ * Match a package name/version in the specified array of strings with pkgnames.
+ *
+ * @param[in] array The proplib array to search on.
+ * @param[in] pkgname The package name/version to match.
+ *
+ * @return true on success, false otherwise and errno is set appropiately.
+ */
+bool xbps_match_pkgver_in_array(xbps_array_t array, const char *pkgver);
+
+/**
+ * Match a package pattern in the specified array of strings.
+ *
+ * @param[in] array The proplib array to search on.
+ * @param[in] pattern The package pattern to match, i.e `foo>=0' or `foo<1'.
+ *
+ * @return true on success, false otherwise and errno is set appropiately.
+ */
+bool xbps_match_pkgpattern_in_array(xbps_array_t array, const char *pattern);
+
+/**
+ * Match a package dependency against any package pattern in the specified
+ * array of strings.
+ *
+ * @param[in] array The proplib array to search on.
+ * @param[in] pkgver The package name-version to match, i.e `foo-1.0_1'.
+ *
+ * @return true on success, false otherwise and errno is set appropiately.
+ */
+bool xbps_match_pkgdep_in_array(xbps_array_t array, const char *pkgver);
+
+/**
+ * Match a string (exact match) in the specified array of strings.
+ *
+ * @param[in] array The proplib array to search on.
+ * @param[in] val The string to be matched.
+ *
+ * @return true on success, false otherwise and errno is set appropiately.
+ */
+bool xbps_match_string_in_array(xbps_array_t array, const char *val);
+
+/**
+ * Returns a proplib object iterator associated with an array, contained
+ * in a proplib dictionary matching the specified key.
+ *
+ * @param[in] dict Proplib dictionary where to look for the array.
+ * @param[in] key Key associated with the array.
+ *
+ * @return A proplib object iterator on success, NULL otherwise and
+ * errno is set appropiately.
+ */
+xbps_object_iterator_t xbps_array_iter_from_dict(xbps_dictionary_t dict,
+						 const char *key);
+
+/*@}*/
+
+/** @addtogroup transaction */
+/*@{*/
+
+/**
+ * Finds a package by name or by pattern and enqueues it into
+ * the transaction dictionary for future use. The first repository
+ * matching \a pkg wins.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pkg Package name, package/version or package pattern to match, i.e
+ * `foo', `foo-1.0_1' or `foo>=1.2'.
+ * @param[in] reinstall If true, package will be queued (if \a str matches)
+ * even if package is already installed.
+ *
+ * @return 0 on success, otherwise an errno value.
+ * @retval EEXIST Package is already installed (reinstall wasn't enabled).
+ * @retval ENOENT Package not matched in repository pool.
+ * @retval ENOTSUP No repositories are available.
+ * @retval ENXIO Package depends on invalid dependencies.
+ * @retval EINVAL Any other error ocurred in the process.
+ */
+int xbps_transaction_install_pkg(struct xbps_handle *xhp,
+				 const char *pkg,
+				 bool reinstall);
+
+/**
+ * Marks a package as "going to be updated" in the transaction dictionary.
+ * All repositories in the pool will be used, and newest version
+ * available will be enqueued if it's greater than current installed
+ * version.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pkgname The package name to update.
+ *
+ * @return 0 on success, otherwise an errno value.
+ * @retval EEXIST Package is already up-to-date.
+ * @retval ENOENT Package not matched in repository pool.
+ * @retval ENOTSUP No repositories are available.
+ * @retval ENXIO Package depends on invalid dependencies.
+ * @retval EINVAL Any other error ocurred in the process.
+ */
+int xbps_transaction_update_pkg(struct xbps_handle *xhp, const char *pkgname);
+
+/**
+ * Finds newer versions for all installed packages by looking at the
+ * repository pool. If a newer version exists, package will be enqueued
+ * into the transaction dictionary.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ *
+ * @return 0 on success, otherwise an errno value.
+ * @retval EEXIST All installed package are already up-to-date.
+ */
+int xbps_transaction_update_packages(struct xbps_handle *xhp);
+
+/**
+ * Removes a package currently installed. The package dictionary will
+ * be added into the transaction dictionary.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pkgname Package name to be removed.
+ * @param[in] recursive If true, all packages that are currently depending
+ * on the package to be removed, and if they are orphans, will be added.
+ *
+ * @retval 0 success.
+ * @retval ENOENT Package is not installed.
+ * @retval EEXIST Package has reverse dependencies.
+ * @retval EINVAL
+ * @retval ENXIO A problem ocurred in the process.
+ */
+int xbps_transaction_remove_pkg(struct xbps_handle *xhp,
+				const char *pkgname,
+				bool recursive);
+
+/**
+ * Finds all package orphans currently installed and adds them into
+ * the transaction dictionary.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ *
+ * @retval 0 success.
+ * @retval ENOENT No package orphans were found.
+ * @retval ENXIO
+ * @retval EINVAL A problem ocurred in the process.
+ */
+int xbps_transaction_autoremove_pkgs(struct xbps_handle *xhp);
+
+/**
+ * Returns the transaction dictionary, as shown above in the image.
+ * Before returning the package list is sorted in the correct order
+ * and total installed/download size for the transaction is computed.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ *
+ * @retval 0 success.
+ * @retval ENXIO if transaction dictionary and missing deps array were not created,
+ *  due to xbps_transaction_install_pkg() or xbps_transaction_update_pkg() not
+ *  previously called.
+ * @retval ENODEV if there are missing dependencies in transaction ("missing_deps"
+ *  array of strings object in xhp->transd dictionary).
+ * @retval ENOEXEC if there are unresolved shared libraries in transaction ("missing_shlibs"
+ *  array of strings object in xhp->transd dictionary).
+ * @retval EAGAIN if there are package conflicts in transaction ("conflicts"
+ *  array of strings object in xhp->transd dictionary).
+ * @retval ENOSPC Not enough free space on target rootdir to continue with the
+ *  transaction.
+ * @retval EINVAL There was an error sorting packages or computing the transaction
+ * sizes.
+ */
+int xbps_transaction_prepare(struct xbps_handle *xhp);
+
+/**
+ * Writes the packages array of a transaction prepared with
+ * xbps_transaction_prepare() to \a file, along with a hash of the pkgdb
+ * state it was resolved against, so that it can be applied with
+ * xbps_transaction_import() on other systems with the same packages
+ * installed.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] file Path to the file to write.
+ *
+ * @retval 0 success.
+ * @retval ENXIO if the transaction has not been prepared.
+ * @return Otherwise an errno value.
+ */
+int xbps_transaction_export(struct xbps_handle *xhp, const char *file);
+
+/**
+ * Sets up the transaction dictionary from a transaction written by
+ * xbps_transaction_export(), without resolving it again. It can be
+ * committed with xbps_transaction_commit() as if it had been returned
+ * by xbps_transaction_prepare().
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] file Path to the file to read.
+ *
+ * @retval 0 success.
+ * @retval ESTALE if the installed packages, their state, automatic-install,
+ *  hold or repolock objects, or the architecture don't match the ones the
+ *  transaction was resolved against.
+ * @retval ENOSPC Not enough free space on target rootdir to continue with the
+ *  transaction.
+ * @retval EINVAL if \a file is not a valid transaction.
+ * @return Otherwise an errno value.
+ */
+int xbps_transaction_import(struct xbps_handle *xhp, const char *file);
+
+/**
+ * Opens connections in background to the mirrors that the binary
+ * packages of a prepared transaction will be downloaded from, so that
+ * xbps_transaction_commit() doesn't have to wait for them to be set up.
+ * Meant to be called before asking to confirm the transaction; the
+ * connections are waited for by xbps_transaction_commit() and
+ * xbps_end().
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ */
+void xbps_transaction_warmup(struct xbps_handle *xhp);
+
+/**
+ * Commit a transaction. The transaction dictionary in xhp->transd contains all
+ * steps to be executed in the transaction, as prepared by
+ * xbps_transaction_prepare().
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_transaction_commit(struct xbps_handle *xhp);
+
+/**
+ * @enum xbps_commit_event_type_t
+ *
+ * Type of the events of a transaction committed in background.
+ *
+ * - XBPS_COMMIT_EVENT_STATE: the state callback would have been called.
+ * - XBPS_COMMIT_EVENT_FETCH: the fetch callback would have been called.
+ * - XBPS_COMMIT_EVENT_DONE: the commit has finished, this is the last event.
+ */
+typedef enum xbps_commit_event_type {
+	XBPS_COMMIT_EVENT_STATE = 0,
+	XBPS_COMMIT_EVENT_FETCH,
+	XBPS_COMMIT_EVENT_DONE
+} xbps_commit_event_type_t;
+
+/**
+ * @struct xbps_commit_event xbps.h "xbps.h"
+ * @brief Event of a transaction committed in background.
+ *
+ * A copy of the data passed to the state and fetch callbacks, returned
+ * by xbps_commit_event(). The event and its strings are a single block
+ * that must be released with free(3).
+ */
+struct xbps_commit_event {
+	/**
+	 * @var type
+	 *
+	 * Type of the event.
+	 */
+	xbps_commit_event_type_t type;
+	/**
+	 * @var state
+	 *
+	 * State of XBPS_COMMIT_EVENT_STATE events.
+	 */
+	xbps_state_t state;
+	/**
+	 * @var err
+	 *
+	 * Error of XBPS_COMMIT_EVENT_STATE events, the return value of
+	 * xbps_transaction_commit() with XBPS_COMMIT_EVENT_DONE.
+	 */
+	int err;
+	/**
+	 * @var timestamp
+	 *
+	 * Time of the event, in nanoseconds of a monotonic clock.
+	 */
+	uint64_t timestamp;
+	/**
+	 * @var desc
+	 *
+	 * Description of XBPS_COMMIT_EVENT_STATE events, if any.
+	 */
+	const char *desc;
+	/**
+	 * @var arg
+	 *
+	 * Argument of XBPS_COMMIT_EVENT_STATE events, if any.
+	 */
+	const char *arg;
+	/**
+	 * @var stats
+	 *
+	 * Statistics of the transaction at the time of the event, set with
+	 * XBPS_COMMIT_EVENT_STATE and XBPS_COMMIT_EVENT_DONE.
+	 */
+	struct xbps_stats stats;
+	/**
+	 * @var unpack
+	 *
+	 * Statistics of the unpacked package with XBPS_STATE_UNPACK_DONE.
+	 */
+	struct xbps_unpack_stats unpack;
+	/**
+	 * @var file_name
+	 *
+	 * Name of the file being fetched with XBPS_COMMIT_EVENT_FETCH.
+	 */
+	const char *file_name;
+	/**
+	 * @var file_size
+	 *
+	 * Size of the file being fetched.
+	 */
+	off_t file_size;
+	/**
+	 * @var file_offset
+	 *
+	 * Current offset of the file being fetched.
+	 */
+	off_t file_offset;
+	/**
+	 * @var file_dloaded
+	 *
+	 * Bytes downloaded of the file being fetched. Consecutive updates
+	 * of the same file not read yet are merged into one event.
+	 */
+	off_t file_dloaded;
+	/**
+	 * @var cb_start
+	 *
+	 * The fetch of the file has started.
+	 */
+	bool cb_start;
+	/**
+	 * @var cb_update
+	 *
+	 * The fetch of the file has made progress.
+	 */
+	bool cb_update;
+	/**
+	 * @var cb_end
+	 *
+	 * The fetch of the file has finished.
+	 */
+	bool cb_end;
+};
+
+/**
+ * Commits a transaction in a thread of its own, as xbps_transaction_commit()
+ * does. The state and fetch callbacks of \a xhp are replaced with ones
+ * queueing their data as events, read with xbps_commit_event() when the
+ * file descriptor returned by xbps_commit_fd() is readable. The unpack
+ * callback, if set, is still called in the thread of the commit.
+ *
+ * Nothing can be asked to the client while committing in background, the
+ * repository keys must be imported beforehand. The handle must not be used
+ * until the commit has been finished with xbps_commit_finish().
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @return A pointer to the commit, NULL otherwise and errno is set
+ * appropiately.
+ */
+struct xbps_commit *xbps_transaction_commit_start(struct xbps_handle *xhp);
+
+/**
+ * Returns the file descriptor of a commit started with
+ * xbps_transaction_commit_start(), to be polled for reading: it is
+ * readable while there are events to be read with xbps_commit_event().
+ *
+ * @param[in] commit Pointer to the commit.
+ * @return The file descriptor, owned by the commit.
+ */
+int xbps_commit_fd(struct xbps_commit *commit);
+
+/**
+ * Returns the next event of a commit started with
+ * xbps_transaction_commit_start(), without blocking. The last event is
+ * XBPS_COMMIT_EVENT_DONE.
+ *
+ * @param[in] commit Pointer to the commit.
+ * @return The event to be released with free(3), NULL if there are no
+ * events at the moment.
+ */
+struct xbps_commit_event *xbps_commit_event(struct xbps_commit *commit);
+
+/**
+ * Asks a commit started with xbps_transaction_commit_start() to stop as
+ * soon as possible: the package being downloaded, unpacked or configured
+ * is finished, no more packages are processed and the commit returns
+ * ECANCELED. The packages that were unpacked and not configured can be
+ * configured later with xbps_configure_pkg().
+ *
+ * @param[in] commit Pointer to the commit.
+ */
+void xbps_commit_cancel(struct xbps_commit *commit);
+
+/**
+ * Waits until a commit started with xbps_transaction_commit_start()
+ * has finished and releases it with its pending events, the callbacks
+ * of the handle are restored.
+ *
+ * @param[in] commit Pointer to the commit.
+ * @return 0 on success, otherwise an errno value as returned by
+ * xbps_transaction_commit().
+ */
+int xbps_commit_finish(struct xbps_commit *commit);
+
+/*@}*/
+
+/** @addtogroup plist_fetch */
+/*@{*/
+
+/**
+ * Returns a buffer of a file stored in an archive locally or
+ * remotely as specified in the url \a url.
+ *
+ * @param[in] url Full URL to binary package file (local or remote path).
+ * @param[in] fname File name to match.
+ *
+ * @return A malloc(3)ed buffer with the contents of \a fname, NULL otherwise
+ * and errno is set appropiately.
+ */
+char *xbps_archive_fetch_file(const char *url, const char *fname);
+
+/**
+ * Returns a file stored in an archive locally or
+ * remotely as specified in the url \a url and stores it into the
+ * file descriptor \a fd.
+ *
+ * @param[in] url Full URL to binary package file (local or remote path).
+ * @param[in] fname File name to match.
+ * @param[in] fd An open file descriptor to put the file into.
+ *
+ * @return 0 on success, an errno value otherwise.
+ */
+int xbps_archive_fetch_file_into_fd(const char *url, const char *fname, int fd);
+
+/**
+ * Internalizes a plist file in an archive stored locally or
+ * remotely as specified in the url \a url.
+ *
+ * @param[in] url Full URL to binary package file (local or remote path).
+ * @param[in] p Proplist file name to internalize as a dictionary.
+ *
+ * @return An internalized proplib dictionary, otherwise NULL and
+ * errno is set appropiately.
+ */
+xbps_dictionary_t xbps_archive_fetch_plist(const char *url, const char *p);
+
+/*@}*/
+
+/** @addtogroup repopool */
+/*@{*/
+
+struct xbps_repo_idxmap;
+
+/**
+ * @struct xbps_repo xbps.h "xbps.h"
+ * @brief Repository structure
+ *
+ * Repository object structure registered in a private simple queue.
+ * The structure contains repository data: uri and dictionaries associated.
+ */
+struct xbps_repo {
+	/**
+	 * @private
+	 */
+	struct {
+	        struct xbps_repo *sqe_next;  /* next element */
+	} entries;
+	struct archive *ar;
+	/**
+	 * @var xhp
+	 *
+	 * Pointer to our xbps_handle struct passed to xbps_rpool_foreach.
+	 */
+	struct xbps_handle *xhp;
+	/**
+	 * @var idx
+	 *
+	 * Proplib dictionary associated with the repository index,
+	 * use xbps_repo_get_index() to access it.
+	 */
+	xbps_dictionary_t idx;
+	/**
+	 * @var idxmeta
+	 *
+	 * Proplib dictionary associated with the repository index-meta.
+	 */
+	xbps_dictionary_t idxmeta;
+	/**
+	 * @var uri
+	 * 
+	 * URI string associated with repository.
+	 */
+	const char *uri;
+	/**
+	 * @private
+	 */
+	int fd;
+	/**
+	 * var is_remote
+	 *
+	 * True if repository is remote, false if it's a local repository.
+	 */
+	bool is_remote;
+	/**
+	 * var is_signed
+	 *
+	 * True if this repository has been signed, false otherwise.
+	 */
+	bool is_signed;
+	/**
+	 * @private
+	 *
+	 * Memory mapped binary index or lazily scanned index plist;
+	 * \a idx is NULL until xbps_repo_get_index() is called.
+	 */
+	struct xbps_repo_idxmap *idxmap;
+	/**
+	 * @private
+	 *
+	 * Reverse dependencies table of the index, read from the
+	 * repodata archive on the first xbps_repo_get_pkg_revdeps() call.
+	 */
+	xbps_dictionary_t idxrevdeps;
+	bool idxrevdeps_read;
+	/**
+	 * @private
+	 *
+	 * Shared libraries table of the index, read from the repodata
+	 * archive on the first xbps_repo_get_shlibs() call.
+	 */
+	xbps_dictionary_t idxshlibs;
+	bool idxshlibs_read;
+	/**
+	 * @private
+	 *
+	 * Files index of the repository, read from the <arch>-files
+	 * archive on the first xbps_repo_get_files() call.
+	 */
+	xbps_dictionary_t idxfiles;
+	bool idxfiles_read;
+};
+
+void xbps_rpool_release(struct xbps_handle *xhp);
+
+/**
+ * Checks if the repodata archive of any repository opened in the pool
+ * has been replaced or modified since it was opened, i.e after
+ * xbps-install(1) -S or xbps-rindex(1) -a. Repositories synced in
+ * memory and repositories that could not be opened are not checked.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ *
+ * @return true if the pool is out of date and should be released
+ * with xbps_rpool_release(), false otherwise.
+ */
+bool xbps_rpool_changed(struct xbps_handle *xhp);
+
+/**
+ * Synchronizes repository data for all remote repositories
+ * as specified in the configuration file or if \a uri argument is
+ * set, just sync for that repository.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to match for sync (optional).
+ *
+ * @return 0 on success, ENOTSUP if no repositories were found in
+ * the configuration file.
+ */
+int xbps_rpool_sync(struct xbps_handle *xhp, const char *uri);
+
+/**
+ * Iterates over the repository pool and executes the \a fn function
+ * callback passing in the void * \a arg argument to it. The bool pointer
+ * argument can be used in the callbacks to stop immediately the loop if
+ * set to true, otherwise it will only be stopped if it returns a
+ * non-zero value.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] fn Function callback to execute for every repository registered in
+ * the pool.
+ * @param[in] arg Opaque data passed in to the \a fn function callback for
+ * client data.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_rpool_foreach(struct xbps_handle *xhp,
+	       int (*fn)(struct xbps_repo *, void *, bool *),
+	       void *arg);
+
+/**
+ * Returns a pointer to a struct xbps_repo matching \a url. Every handle
+ * has its own pool, the pools of all handles are searched from the most
+ * recently created one.
+ *
+ * @param[in] url Repository url to match.
+ * @return The matched xbps_repo pointer, NULL otherwise.
+ */
+struct xbps_repo *xbps_rpool_get_repo(const char *url);
+
+/**
+ * Finds a package dictionary in the repository pool by specifying a
+ * package pattern or a package name. This function does not take into
+ * account virtual packages, just matches real packages.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pkg Package pattern, exact pkg or pkg name.
+ *
+ * @return The package dictionary if found, NULL otherwise.
+ * @note When returned dictionary is no longer needed, you must release it
+ * with xbps_object_release(3).
+ */
+xbps_dictionary_t xbps_rpool_get_pkg(struct xbps_handle *xhp, const char *pkg);
+
+/**
+ * Finds a package dictionary in repository pool by specifying a
+ * virtual package pattern or a package name.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pkg Virtual package pattern or name to match.
+ *
+ * @return The package dictionary if found, NULL otherwise.
+ * @note When returned dictionary is no longer needed, you must release it
+ * with xbps_object_release(3).
+ */
+xbps_dictionary_t xbps_rpool_get_virtualpkg(struct xbps_handle *xhp,
+					    const char *pkg);
+
+/**
+ * Returns a proplib array of strings with reverse dependencies of all
+ * registered repositories matching the expression \a pkg.
+ *
+ * @param[in] xhp Pointer to the xbps_handle structure.
+ * @param[in] pkg Package expression to match in this repository index.
+ *
+ * @return The array of strings on success, NULL otherwise and errno is
+ * set appropiately.
+ */
+xbps_array_t xbps_rpool_get_pkg_revdeps(struct xbps_handle *xhp, const char *pkg);
+
+/**
+ * Returns a proplib array of strings with a proper sorted list
+ * of packages of a full dependency graph for \a pkg.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ *
+ * @return A proplib array of strings with the full dependency graph for \a pkg,
+ * NULL otherwise.
+ */
+xbps_array_t xbps_rpool_get_pkg_fulldeptree(struct xbps_handle *xhp, const char *pkg);
+
+/**
+ * Returns a proplib array of strings with all packages in registered
+ * repositories that depend on \a pkg directly or through other packages,
+ * the direct reverse dependencies first.
+ *
+ * The dependency graph of the repository pool is built on the first call
+ * and kept until the pool is released.
+ *
+ * @param[in] xhp The pointer to the xbps_handle struct.
+ * @param[in] pkg Package expression to match.
+ *
+ * @return A proplib array of strings that must be released with
+ * xbps_object_release(), NULL otherwise and errno is set appropiately.
+ */
+xbps_array_t xbps_rpool_get_pkg_fullrevdeptree(struct xbps_handle *xhp, const char *pkg);
+
+/**
+ * Iterate over the the repository pool and search for a metadata plist
+ * file in a binary package matching `pattern'. If a package is matched
+ * the plist file \a plistf will be internalized into a proplib dictionary.
+ *
+ * When \a pattern is a pkgname, the newest package available in repositories
+ * will be used. Otherwise the first repository matching \a pattern.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pattern Package name or package pattern to match, i.e `foo>=1.0'.
+ * @param[in] plistf Plist file name to match, i.e XBPS_PKGPROPS or XBPS_PKGFILES.
+ *
+ * @return An internalized proplib dictionary of \a plistf, otherwise NULL
+ * and errno is set appropiately.
+ *
+ * @note if NULL is returned and errno is ENOENT, that means that
+ * binary package file has been found but the plist file could not
+ * be found.
+ */
+xbps_dictionary_t xbps_rpool_get_pkg_plist(struct xbps_handle *xhp,
+					   const char *pattern,
+					   const char *plistf);
+
+/*@}*/
+
+/** @addtogroup repo */
+/*@{*/
+
+/**
+ * Stores repository \a url into the repository pool.
+ * Additional URLs separated by blanks are stored as equivalent mirrors
+ * of the first one, which identifies the repository.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to store.
+ *
+ * @return True on success, false otherwise.
+ */
+bool xbps_repo_store(struct xbps_handle *xhp, const char *url);
+
+/**
+ * Creates a lock for a local repository to obtain exclusive access (write).
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to match.
+ * @param[out] lockfd Lock file descriptor assigned.
+ * @param[out] lockfname Lock filename assigned.
+ *
+ * @return True on success and lockfd/lockfname are assigned appropiately.
+ * otherwise false and lockfd/lockfname aren't set.
+ */
+bool xbps_repo_lock(struct xbps_handle *xhp, const char *uri, int *lockfd, char **lockfname);
+
+/**
+ * Like xbps_repo_lock(), but returns immediately if the repository
+ * is already locked.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to match.
+ * @param[out] lockfd Lock file descriptor assigned.
+ * @param[out] lockfname Lock filename assigned.
+ *
+ * @return True on success and lockfd/lockfname are assigned appropiately.
+ * otherwise false and errno is set, to EEXIST if the repository is locked.
+ */
+bool xbps_repo_trylock(struct xbps_handle *xhp, const char *uri, int *lockfd, char **lockfname);
+
+/**
+ * Unlocks a local repository and removes its lock file.
+ *
+ * @param[in] lockfd Lock file descriptor.
+ * @param[in] lockfname Lock filename.
+ */
+void xbps_repo_unlock(int lockfd, char *lockfname);
+
+/**
+ * Opens a repository and returns a xbps_repo object.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to match.
+ *
+ * @return The matching repository object, NULL otherwise.
+ */
+struct xbps_repo *xbps_repo_open(struct xbps_handle *xhp, const char *url);
+
+/**
+ * Opens a staging repository and returns a xbps_repo object.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to match.
+ *
+ * @return The matching repository object, NULL otherwise.
+ */
+struct xbps_repo *xbps_repo_stage_open(struct xbps_handle *xhp, const char *url);
+
+/**
+ * Opens a repository and returns a xbps_repo object.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] uri Repository URI to match.
+ *
+ * @return The matching repository object, NULL otherwise.
+ */
+struct xbps_repo *xbps_repo_public_open(struct xbps_handle *xhp, const char *url);
+
+/**
+ * Closes a repository object and releases resources.
+ *
+ * @param[in] repo The repository object to close.
+ */
+void xbps_repo_close(struct xbps_repo *repo);
+
+/**
+ *
+ * Returns a heap-allocated string with the repository local path.
+ *
+ * @param[in] xhp The xbps_handle object.
+ * @param[in] url The repository URL to match.
+ *
+ * @return A heap allocated string that must be free(3)d when it's unneeded.
+ */
+char *xbps_repo_path(struct xbps_handle *xhp, const char *url);
+
+/**
+ *
+ * Returns a heap-allocated string with the repository local path.
+ *
+ * @param[in] xhp The xbps_handle object.
+ * @param[in] url The repository URL to match.
+ * @param[in] name The repository name (stagedata, repodata or files)
+ *
+ * @return A heap allocated string that must be free(3)d when it's unneeded.
+ */
+char *xbps_repo_path_with_name(struct xbps_handle *xhp, const char *url, const char *name);
+
+/**
+ * Returns the full index dictionary of repository \a repo.
+ * Repositories are opened lazily or from a binary index map (see
+ * xbps_repo_write_idxmap()) and only materialize it on the first call.
+ *
+ * @param[in] repo Pointer to an xbps_repo structure.
+ *
+ * @return The index dictionary on success, NULL otherwise.
+ */
+xbps_dictionary_t xbps_repo_get_index(struct xbps_repo *repo);
+
+/**
+ * Writes a binary index map next to the repository archive
+ * \a repofile, a sorted table of package names and offsets that
+ * can be mmap(2)ed to look up packages without internalizing the
+ * whole index plist. The map records the size and mtime of
+ * \a repofile and is ignored once they don't match.
+ *
+ * @param[in] xhp The xbps_handle object.
+ * @param[in] repofile Path to the <arch>-repodata archive.
+ * @param[in] idx The repository index dictionary.
+ * @param[in] meta The repository index-meta dictionary (optional).
+ *
+ * @return 0 on success, an errno value otherwise.
+ */
+int xbps_repo_write_idxmap(struct xbps_handle *xhp, const char *repofile,
+		xbps_dictionary_t idx, xbps_dictionary_t meta);
+
+/**
+ * Returns the packages of repository \a repo that may contain \a pat,
+ * case insensitively, in their pkgver, short_desc or virtual packages,
+ * as found in the trigram index of its binary index map. The result is
+ * a superset of the matching packages, which must still be matched.
+ *
+ * @param[in] repo Pointer to an xbps_repo structure.
+ * @param[in] pat The substring to search for.
+ *
+ * @return An array of package dictionaries that must be released
+ * with xbps_object_release(), or NULL if the repository has no up to
+ * date index map or \a pat is shorter than 3 characters.
+ */
+xbps_array_t xbps_repo_search_candidates(struct xbps_repo *repo,
+		const char *pat);
+
+/**
+ * Returns the reverse dependencies table of the repository index
+ * \a idx, stored in the repodata archive as XBPS_REPOIDX_REVDEPS.
+ * The table maps the names matched by the \a run_depends patterns
+ * of all packages to arrays of the names of the packages that have
+ * them; patterns that can match any name are stored at the empty key.
+ * xbps_repo_get_pkg_revdeps() only has to check the packages listed
+ * in it instead of the whole index.
+ *
+ * @param[in] idx The repository index dictionary.
+ *
+ * @return The table dictionary on success, NULL otherwise.
+ */
+xbps_dictionary_t xbps_repo_index_revdeps(xbps_dictionary_t idx);
+
+/**
+ * Returns the shared libraries table of the repository index \a idx,
+ * stored in the repodata archive as XBPS_REPOIDX_SHLIBS. The table has
+ * the \a shlib-provides and \a shlib-requires dictionaries, mapping
+ * every soname to an array of the names of the packages that provide
+ * or require it.
+ *
+ * @param[in] idx The repository index dictionary.
+ *
+ * @return The table dictionary on success, NULL otherwise.
+ */
+xbps_dictionary_t xbps_repo_index_shlibs(xbps_dictionary_t idx);
+
+/**
+ * Updates the shared libraries table \a table returned by
+ * xbps_repo_index_shlibs() when the package dictionary \a opkgd
+ * is replaced by \a pkgd in the index.
+ *
+ * @param[in] table The shared libraries table.
+ * @param[in] opkgd The package dictionary removed from the index (optional).
+ * @param[in] pkgd The package dictionary added to the index (optional).
+ */
+void xbps_repo_index_shlibs_update(xbps_dictionary_t table,
+		xbps_dictionary_t opkgd, xbps_dictionary_t pkgd);
+
+/**
+ * Returns the shared libraries table of the repository, as generated
+ * by xbps_repo_index_shlibs(), so that the providers and users of a
+ * soname can be found without iterating over the whole index.
+ * The table is read from the repodata archive on the first call and is
+ * owned by \a repo.
+ *
+ * @param[in] repo Pointer to the xbps_repo structure.
+ *
+ * @return The table dictionary, or NULL if the repository has none
+ * (written by an older xbps-rindex).
+ */
+xbps_dictionary_t xbps_repo_get_shlibs(struct xbps_repo *repo);
+
+/**
+ * Returns the files index of the repository, generated by
+ * xbps-rindex(1) with --files: a dictionary with the files of every
+ * package keyed by its pkgver, with the "conf_files", "files" and
+ * "links" arrays of its files.plist. For remote repositories it's
+ * fetched while synchronizing if XBPS_FLAG_REPOS_FILES is set.
+ * The index is read on the first call and is owned by \a repo.
+ *
+ * @param[in] repo Pointer to the xbps_repo structure.
+ *
+ * @return The files index dictionary, or NULL if the repository
+ * has none.
+ */
+xbps_dictionary_t xbps_repo_get_files(struct xbps_repo *repo);
+
+/**
+ * Creates a binary delta \a deltafile to rebuild the binary package
+ * \a newfile from \a oldfile with xbps_delta_apply().
+ *
+ * @param[in] oldfile Path to the base binary package.
+ * @param[in] newfile Path to the target binary package.
+ * @param[in] deltafile Path to the delta file to be created.
+ *
+ * @return 0 on success, an errno value otherwise.
+ */
+int xbps_delta_create(const char *oldfile, const char *newfile,
+		const char *deltafile);
+
+/**
+ * Rebuilds the binary package \a newfile from its base \a oldfile
+ * and the delta \a deltafile created by xbps_delta_create().
+ * The base and the rebuilt file are checked against the SHA256 hashes
+ * stored in the delta.
+ *
+ * @param[in] oldfile Path to the base binary package.
+ * @param[in] deltafile Path to the delta file.
+ * @param[in] newfile Path to the binary package to be created.
+ *
+ * @return 0 on success, ERANGE if a hash doesn't match, EINVAL if
+ * the delta is malformed or another errno value otherwise.
+ */
+int xbps_delta_apply(const char *oldfile, const char *deltafile,
+		const char *newfile);
+
+/**
+ * Remotely fetch repository data and keep it in memory.
+ *
+ * @param[in] repo A struct xbps_repo pointer to be filled in.
+ * @param[in] url Full url to the target remote repository data archive.
+ *
+ * @return True on success, false otherwise and errno is set appropiately.
+ */
+bool xbps_repo_fetch_remote(struct xbps_repo *repo, const char *url);
+
+/**
+ * Returns a pkg dictionary from a repository \a repo matching
+ * the expression \a pkg.
+ *
+ * @param[in] repo Pointer to an xbps_repo structure.
+ * @param[in] pkg Package expression to match in this repository index.
+ *
+ * @return The pkg dictionary on success, NULL otherwise.
+ */
+xbps_dictionary_t xbps_repo_get_pkg(struct xbps_repo *repo, const char *pkg);
+
+/**
+ * Returns a pkg dictionary from a repository \a repo matching
+ * the expression \a pkg. On match the first package matching the virtual
+ * package expression will be returned.
+ *
+ * @param[in] repo Pointer to an xbps_repo structure.
+ * @param[in] pkg Package expression to match in this repository index.
+ *
+ * @return The pkg dictionary on success, NULL otherwise.
+ */
+xbps_dictionary_t xbps_repo_get_virtualpkg(struct xbps_repo *repo,
+					     const char *pkg);
+
+/**
+ * Returns a pkg dictionary of the matching \a plist file from a binary package,
+ * by looking at its package dictionary (\a pkgd) returned by a repository or rpool.
+ *
+ * @param[in] xhp Pointer to the xbps_handle struct.
+ * @param[in] pkgd Package dictionary returned by xbps_{repo,rpool}_get_xxxpkg().
+ * @param[in] plist Plist filename to internalize from matching binary package.
+ *
+ * @return The pkg dictionary on success, NULL otherwise.
+ */
+xbps_dictionary_t xbps_repo_get_pkg_plist(struct xbps_handle *xhp,
+					xbps_dictionary_t pkgd,
+					const char *plist);
+
+/**
+ * Returns a proplib array of strings with reverse dependencies from
+ * repository \a repo matching the expression \a pkg.
+ *
+ * @param[in] repo Pointer to an xbps_repo structure.
+ * @param[in] pkg Package expression to match in this repository index.
+ *
+ * @return The array of strings on success, NULL otherwise and errno is
+ * set appropiately.
+ */
+xbps_array_t xbps_repo_get_pkg_revdeps(struct xbps_repo *repo, const char *pkg);
+
+/**
+ * Imports the RSA or Ed25519 public key of target repository, as declared
+ * by the "signature-type" object of its metadata. The repository must be
+ * signed properly for this to work.
+ *
+ * @param[in] repo Pointer to the target xbps_repo structure.
+ *
+ * @return 0 on success, an errno value otherwise.
+ */
+int xbps_repo_key_import(struct xbps_repo *repo);
+
+
+/*@}*/
+
+/** @addtogroup archive_util */
+/*@{*/
+
+/**
+ * Appends a file to the \a ar archive by using a memory buffer \a buf of
+ * size \a sizelen.
+ *
+ * @param[in] ar The archive object.
+ * @param[in] buf The memory buffer to be used as file data.
+ * @param[in] buflen The size of the memory buffer.
+ * @param[in] fname The filename to be used for the entry.
+ * @param[in] mode The mode to be used in the entry.
+ * @param[in] uname The user name to be used in the entry.
+ * @param[in] gname The group name to be used in the entry.
+ *
+ * @return 0 on success, or any negative or errno value otherwise.
+ */
+int xbps_archive_append_buf(struct archive *ar, const void *buf,
+		const size_t buflen, const char *fname, const mode_t mode,
+		const char *uname, const char *gname);
+
+/*@}*/
+
+/** @addtogroup pkgstates */
+/*@{*/
+
+/**
+ * @enum pkg_state_t
+ *
+ * Integer representing a state on which a package may be. Possible
+ * values for this are:
+ *
+ * - XBPS_PKG_STATE_UNPACKED: Package has been unpacked correctly
+ * but has not been configured due to unknown reasons.
+ * - XBPS_PKG_STATE_INSTALLED: Package has been installed successfully.
+ * - XBPS_PKG_STATE_BROKEN: not yet used.
+ * - XBPS_PKG_STATE_HALF_REMOVED: Package has been removed but not
+ * completely: the purge action in REMOVE script wasn't executed, pkg
+ * metadata directory still exists and is registered in package database.
+ * - XBPS_PKG_STATE_NOT_INSTALLED: Package going to be installed in
+ * a transaction dictionary but that has not been yet unpacked.
+ */
+typedef enum pkg_state {
+	XBPS_PKG_STATE_UNPACKED = 1,
+	XBPS_PKG_STATE_INSTALLED,
+	XBPS_PKG_STATE_BROKEN,
+	XBPS_PKG_STATE_HALF_REMOVED,
+	XBPS_PKG_STATE_NOT_INSTALLED,
+} pkg_state_t;
+
+/**
+ * Gets package state from package \a pkgname, and sets its state
+ * into \a state.
+ * 
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] pkgname Package name.
+ * @param[out] state Package state returned.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_pkg_state_installed(struct xbps_handle *xhp,
+			     const char *pkgname,
+			     pkg_state_t *state);
+
+/**
+ * Gets package state from a package dictionary \a dict, and sets its
+ * state into \a state.
+ *
+ * @param[in] dict Package dictionary.
+ * @param[out] state Package state returned.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_pkg_state_dictionary(xbps_dictionary_t dict, pkg_state_t *state);
+
+/**
+ * Sets package state \a state in package \a pkgname.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] pkgver Package name/version to match.
+ * @param[in] state Package state to be set.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_set_pkg_state_installed(struct xbps_handle *xhp,
+				 const char *pkgver,
+				 pkg_state_t state);
+
+/**
+ * Sets package state \a state in package dictionary \a dict.
+ *
+ * @param[in] dict Package dictionary.
+ * @param[in] state Package state to be set.
+ *
+ * @return 0 on success, otherwise an errno value.
+ */
+int xbps_set_pkg_state_dictionary(xbps_dictionary_t dict, pkg_state_t state);
+
+/*@}*/
+
+/** @addtogroup util */
+/*@{*/
+
+/**
+ * Removes a string object matching \a pkgname in
+ * the \a array array of strings.
+ *
+ * @param[in] array Proplib array of strings.
+ * @param[in] pkgname pkgname string object to remove.
+ *
+ * @return true on success, false otherwise.
+ */
+bool xbps_remove_pkgname_from_array(xbps_array_t array, const char *pkgname);
+
+/**
+ * Removes a string object matching \a str in the
+ * \a array array of strings.
+ *
+ * @param[in] array Proplib array of strings.
+ * @param[in] str string object to remove.
+ *
+ * @return true on success, false otherwise.
+ */
+bool xbps_remove_string_from_array(xbps_array_t array, const char *str);
+
+/**
+ * Creates a directory (and required components if necessary).
+ *
+ * @param[in] path Path for final directory.
+ * @param[in] mode Mode for final directory (0755 if not specified).
+ *
+ * @return 0 on success, -1 on error and errno set appropiately.
+ */
+int xbps_mkpath(const char *path, mode_t mode);
+
+/**
+ * Returns a string by concatenating its variable argument list
+ * as specified by the format string \a fmt.
+ *
+ * @param[in] fmt Format string, see printf(3).
+ * @return A pointer to a malloc(3)ed string, NULL otherwise and errno
+ * is set appropiately. The pointer should be free(3)d when it's
+ * no longer needed.
+ */
+char *xbps_xasprintf(const char *fmt, ...)__attribute__ ((format (printf, 1, 2)));
+
+/**
+ * Creates a memory mapped object from file \a file into \a mmf
+ * with size \a mmflen, and file size to \a filelen;
+ *
+ * @param[in] file Path to a file.
+ * @param[out] mmf Memory mapped object.
+ * @param[out] mmflen Length of memory mapped object.
+ * @param[out] filelen File size length.
+ *
+ * @return True on success, false otherwise and errno
+ * is set appropiately. The mmaped object should be munmap()ed when it's
+ * not longer needed.
+ */
+bool xbps_mmap_file(const char *file, void **mmf, size_t *mmflen, size_t *filelen);
+
+/**
+ * Returns a string with the sha256 hash for the file specified
+ * by \a file.
+ *
+ * @param[in] file Path to a file.
+ * @return A pointer to a malloc(3)ed string, NULL otherwise and errno
+ * is set appropiately. The pointer should be free(3)d when it's no
+ * longer needed.
+ */
+char *xbps_file_hash(const char *file);
+
+/**
+ * Returns a raw byte buffer with the sha256 hash for the file specified
+ * by \a file.
+ *
+ * @param[in] file Path to a file.
+ * @return A pointer to a malloc(3)ed buffer, NULL otherwise and errno
+ * is set appropiately. The pointer should be free(3)d when it's no
+ * longer needed.
+ */
+unsigned char *xbps_file_hash_raw(const char *file);
+
+/**
+ * Compares the sha256 hash of the file \a file with the sha256
+ * string specified by \a sha256.
+ *
+ * @param[in] file Path to a file.
+ * @param[in] sha256 SHA256 hash to compare.
+ *
+ * @return 0 if \a file and \a sha256 have the same hash, ERANGE
+ * if it differs, or any other errno value on error.
+ */
+int xbps_file_hash_check(const char *file, const char *sha256);
+
+/**
+ * Like xbps_file_hash_check(), but if XBPS_FLAG_LOW_CACHE is set in
+ * \a xhp the pages of \a file that weren't cached are dropped from the
+ * page cache once hashed.
+ *
+ * @param[in] xhp Pointer to an xbps_handle struct.
+ * @param[in] file Path to a file.
+ * @param[in] sha256 SHA256 hash to compare.
+ *
+ * @return 0 if \a file and \a sha256 have the same hash, ERANGE
+ * if it differs, or any other errno value on error.
+ */
+int xbps_file_hash_check_handle(struct xbps_handle *xhp, const char *file,
+		const char *sha256);
+
+/**
+ * Returns a string with the fs-verity SHA256 digest of the file
+ * specified by \a file, as measured by the kernel.
+ *
+ * @param[in] file Path to a file.
+ * @return A pointer to a malloc(3)ed string, NULL otherwise and errno
+ * is set appropiately: ENODATA if fs-verity is not enabled on \a file,
+ * ENOTTY or EOPNOTSUPP if the filesystem does not support it, ENOTSUP if
+ * xbps was built without fs-verity support. The pointer should be
+ * free(3)d when it's no longer needed.
+ */
+char *xbps_file_verity(const char *file);
+
+/**
+ * Compares the fs-verity digest of the file \a file with the string
+ * specified by \a digest, without reading its data.
+ *
+ * @param[in] file Path to a file.
+ * @param[in] digest fs-verity SHA256 digest to compare.
+ *
+ * @return 0 if \a file has the digest \a digest, ERANGE if it differs,
+ * or any other errno value on error (see xbps_file_verity()).
+ */
+int xbps_file_verity_check(const char *file, const char *digest);
+
+/**
+ * Verifies the signature of \a fname with the public-key associated
+ * in \a repo, with the RSA or Ed25519 scheme declared by the repository
+ * metadata.
+ *
+ * @param[in] repo Repository to use with the public key associated.
+ * @param[in] fname The filename to verify, the signature file must have a .sig
+ * extension, i.e `<fname>.sig`.
+ *
+ * @return True if the signature is valid, false otherwise.
+ */
+bool xbps_verify_file_signature(struct xbps_repo *repo, const char *fname);
+
+/**
+ * Checks if a package is currently installed in pkgdb by matching \a pkg.
+ * To be installed, the pkg must be in "installed" or "unpacked" state.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] pkg Package name, version pattern or exact pkg to match.
+ *
+ * @return -1 on error (errno set appropiately), 0 if \a pkg
+ * didn't match installed package, 1 if \a pkg pattern fully
+ * matched installed package.
+ */
+int xbps_pkg_is_installed(struct xbps_handle *xhp, const char *pkg);
+
+/**
+ * Returns true if binary package exists in cachedir or in a local repository,
+ * false otherwise.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] pkgd Package dictionary returned by rpool.
+ *
+ * @return true if exists, false otherwise.
+ */
+bool xbps_binpkg_exists(struct xbps_handle *xhp, xbps_dictionary_t pkgd);
+
+/**
+ * Checks if the URI specified by \a uri is remote or local.
+ *
+ * @param[in] uri URI string.
+ * 
+ * @return true if URI is remote, false if local.
+ */
+bool xbps_repository_is_remote(const char *uri);
+
+/*
+ * Returns an allocated string with the full path to the binary package
+ * matching \a pkgd.
+ *
+ * The \a pkgd dictionary must contain the following objects:
+ *  - architecture (string)
+ *  - pkgver (string)
+ *  - repository (string)
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] pkgd The package dictionary to match.
+ *
+ * @return A malloc(3)ed buffer with the full path, NULL otherwise.
+ * The buffer should be free(3)d when it's no longer needed.
+ */
+char *xbps_repository_pkg_path(struct xbps_handle *xhp, xbps_dictionary_t pkgd);
+
+/**
+ * Gets the name of a package string. Package strings are composed
+ * by a @<pkgname@>/@<version@> pair and separated by the <em>minus</em>
+ * sign, i.e <b>foo-2.0</b>.
+ *
+ * @param[in] pkg Package string.
+ *
+ * @return A pointer to a malloc(3)d string, NULL otherwise and
+ * errno is set appropiately. The pointer should be free(3)d when it's
+ * no longer needed.
+ */
+char *xbps_pkg_name(const char *pkg);
+
+/**
+ * Gets the length of the name of a package string without copying it,
+ * the name is the first \a len bytes of \a pkg.
+ * The same rules in xbps_pkg_name() apply here.
+ *
+ * @param[in] pkg Package string.
+ *
+ * @return The length of the package name, 0 if \a pkg is not a
+ * package string.
+ */
+size_t xbps_pkg_name_len(const char *pkg);
+
+/**
+ * Copies the name of a package string into the buffer \a dst.
+ * The same rules in xbps_pkg_name() apply here.
+ *
+ * @param[out] dst Buffer to store the package name, XBPS_NAME_SIZE
+ * is large enough for any sane package name.
+ * @param[in] len Size of \a dst.
+ * @param[in] pkg Package string.
+ *
+ * @return true on success, false if \a pkg is not a package string
+ * or errno is set to ENAMETOOLONG if the name does not fit in \a dst.
+ */
+bool xbps_pkg_name_buf(char *dst, size_t len, const char *pkg);
+
+/**
+ * Gets a the package name of a package pattern string specified by
+ * the \a pattern argument.
+ *
+ * @param[in] pattern A package pattern. Package patterns are composed
+ * by looking at <b>'><='</b> to split components, i.e <b>foo>=2.0</b>,
+ * <b>blah<1.0</b>, <b>blob==2.0</b>, etc.
+ *
+ * @return A pointer to a malloc(3)ed string with the package name,
+ * NULL otherwise and errno is set appropiately. The pointer should be
+ * free(3)d when it's no longer needed.
+ */
+char *xbps_pkgpattern_name(const char *pattern);
+
+/**
+ * Gets the length of the package name of a package pattern string
+ * without copying it, the name is the first \a len bytes of \a pattern.
+ * The same rules in xbps_pkgpattern_name() apply here.
+ *
+ * @param[in] pattern A package pattern.
+ *
+ * @return The length of the package name, 0 if \a pattern is not a
+ * package pattern.
+ */
+size_t xbps_pkgpattern_name_len(const char *pattern);
+
+/**
+ * Copies the package name of a package pattern string into the
+ * buffer \a dst. The same rules in xbps_pkgpattern_name() apply here.
+ *
+ * @param[out] dst Buffer to store the package name.
+ * @param[in] len Size of \a dst.
+ * @param[in] pattern A package pattern.
+ *
+ * @return true on success, false if \a pattern is not a package pattern
+ * or errno is set to ENAMETOOLONG if the name does not fit in \a dst.
+ */
+bool xbps_pkgpattern_name_buf(char *dst, size_t len, const char *pattern);
+
+/**
+ * Gets the package version in a package string, i.e <b>foo-2.0</b>.
+ * 
+ * @param[in] pkg Package string.
+ *
+ * @return A string with the version string, NULL if it couldn't
+ * find the version component.
+ */
+const char *xbps_pkg_version(const char *pkg);
+
+/**
+ * Gets the pkgname/version componentn of a binary package string,
+ * i.e <b>foo-2.0_1.<arch>.xbps</b>.
+ *
+ * @param[in] pkg Package string.
+ *
+ * @return A pointer to a malloc(ed) string with the pkgver component,
+ * NULL if it couldn't find the version component. The pointer should
+ * be free(3)d when it's no longer needed.
+ */
+char *xbps_binpkg_pkgver(const char *pkg);
+
+/**
+ * Gets the architecture component of a binary package string,
+ * i.e <b><pkgver>.<arch>.xbps</b>.
+ *
+ * @param[in] pkg Package string.
+ *
+ * @return A pointer to a malloc(ed) string with the architecture component,
+ * NULL if it couldn't find the version component. The pointer should
+ * be free(3)d when it's no longer needed.
+ */
+char *xbps_binpkg_arch(const char *pkg);
+
+/**
+ * Gets the package version of a package pattern string specified by
+ * the \a pattern argument.
+ *
+ * @param[in] pattern A package pattern. The same rules in
+ * xbps_get_pkgpattern_name() apply here.
+ *
+ * @return A string with the pattern version, NULL otherwise and
+ * errno is set appropiately.
+ */
+const char *xbps_pkgpattern_version(const char *pattern);
+
+/**
+ * Package pattern matching.
+ *
+ * @param[in] pkgver Package name/version, i.e `foo-1.0'.
+ * @param[in] pattern Package pattern to match against \a pkgver.
+ * There are 3 strategies for version matching:
+ *  - simple compare: pattern equals to pkgver.
+ *  - shell wildcards: see fnmatch(3).
+ *  - relational dewey matching: '>' '<' '>=' '<='.
+ *
+ * @return 1 if \a pkgver is matched against \a pattern, 0 if no match.
+ */
+int xbps_pkgpattern_match(const char *pkgver, const char *pattern);
+
+/**
+ * @struct xbps_pattern xbps.h "xbps.h"
+ * @brief Opaque structure of a package pattern parsed by
+ * xbps_pattern_compile().
+ */
+struct xbps_pattern;
+
+/**
+ * Parses a package pattern once, to match it against many packages
+ * with xbps_pattern_match_compiled().
+ *
+ * @param[in] pattern Package pattern, as accepted by
+ * xbps_pkgpattern_match().
+ *
+ * @return A pointer to the compiled pattern, to be released with
+ * xbps_pattern_free(), or NULL on error (errno is set appropiately).
+ */
+struct xbps_pattern *xbps_pattern_compile(const char *pattern);
+
+/**
+ * Package pattern matching with a compiled pattern, same as
+ * xbps_pkgpattern_match().
+ *
+ * @param[in] pattern Package pattern returned by xbps_pattern_compile().
+ * @param[in] pkgver Package name/version, i.e `foo-1.0'.
+ *
+ * @return 1 if \a pkgver is matched against \a pattern, 0 if no match.
+ */
+int xbps_pattern_match_compiled(const struct xbps_pattern *pattern,
+		const char *pkgver);
+
+/**
+ * Returns the package name of a package pattern or package name/version,
+ * as parsed by xbps_pattern_compile().
+ *
+ * @param[in] pattern Package pattern returned by xbps_pattern_compile().
+ *
+ * @return The package name owned by \a pattern, or NULL if it has
+ * none (i.e a package name without version).
+ */
+const char *xbps_pattern_pkgname(const struct xbps_pattern *pattern);
+
+/**
+ * Releases a package pattern returned by xbps_pattern_compile().
+ *
+ * @param[in] pattern Package pattern to release, may be NULL.
+ */
+void xbps_pattern_free(struct xbps_pattern *pattern);
+
+/**
+ * Gets the package version revision in a package string.
+ *
+ * @param[in] pkg Package string, i.e <b>foo-2.0_1</b>.
+ *
+ * @return A string with the revision number, NULL if it couldn't
+ * find the revision component.
+ */
+const char *xbps_pkg_revision(const char *pkg);
+
+/**
+ * Checks if a package has run dependencies.
+ *
+ * @param[in] dict Package dictionary.
+ *
+ * @return True if package has run dependencies, false otherwise.
+ */
+bool xbps_pkg_has_rundeps(xbps_dictionary_t dict);
+
+/**
+ * Returns true if provided string is valid for target architecture.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] orig Architecture to match.
+ * @param[in] target If not NULL, \a orig will be matched against it
+ * rather than returned value of uname(2).
+ *
+ * @return True on match, false otherwise.
+ */
+bool xbps_pkg_arch_match(struct xbps_handle *xhp,
+			 const char *orig,
+			 const char *target);
+
+/**
+ * Converts the 64 bits signed number specified in \a bytes to
+ * a human parsable string buffer pointed to \a buf.
+ *
+ * @param[out] buf Buffer to store the resulting string. At least
+ * it should have space for 6 chars.
+ * @param[in] bytes 64 bits signed number to convert.
+ *
+ * @return A negative number is returned on error, 0 otherwise.
+ */
+int xbps_humanize_number(char *buf, int64_t bytes);
+size_t xbps_strlcat(char *dest, const char *src, size_t siz);
+size_t xbps_strlcpy(char *dest, const char *src, size_t siz);
+/**
+ * Tests if pkgver is reverted by pkg
+ *
+ * The package version is defined by:
+ * ${NAME}-{${VERSION}_${REVISION}.
+ *
+ * the name part is ignored.
+ *
+ * @param[in] pkg a package which is a candidate to revert pkgver.
+ * @param[in] pkgver a package version string
+ *
+ * @return true if pkg reverts pkgver, false otherwise.
+ */
+bool xbps_pkg_reverts(xbps_dictionary_t pkg, const char *pkgver);
+
+/**
+ * Compares package version strings.
+ *
+ * The package version is defined by:
+ * ${VERSION}[_${REVISION}].
+ *
+ * @param[in] pkg1 a package version string.
+ * @param[in] pkg2 a package version string.
+ *
+ * @return -1, 0 or 1 depending if pkg1 is less than, equal to or
+ * greater than pkg2.
+ */
+int xbps_cmpver(const char *pkg1, const char *pkg2);
+
+/**
+ * Converts a RSA or Ed25519 public key in PEM format to a hex (OpenSSH MD5)
+ * fingerprint.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] pubkey The public-key in PEM format as xbps_data_t.
+ *
+ * @return The OpenSSH fingerprint in hexadecimal.
+ * The returned buffer must be free(3)d when necessary.
+ */
+char *xbps_pubkey2fp(struct xbps_handle *xhp, xbps_data_t pubkey);
+
+/**
+ * Returns a buffer with a sanitized path from \a src.
+ * This removes multiple slashes.
+ *
+ * @param[in] src path component.
+ *
+ * @return The sanitized path in a buffer.
+ * The returned buffer must be free(3)d when it's no longer necessary.
+ */
+char *xbps_sanitize_path(const char *src);
+
+/**
+ * Returns a sanitized target file of \a path without the rootdir component.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] path path component.
+ * @param[in] target The stored target file of a symlink.
+ *
+ * @return The sanitized path in a buffer.
+ * The returned buffer must be free(3)d when it's no longer necessary.
+ */
+char *xbps_symlink_target(struct xbps_handle *xhp, const char *path,
+		const char *target);
+
+/**
+ * Internalizes a plist file declared in \f and returns a proplib array.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] fname The file path.
+ *
+ * @return The internalized proplib array, NULL otherwise.
+ */
+xbps_array_t
+xbps_plist_array_from_file(struct xbps_handle *xhp, const char *fname);
+
+/**
+ * Internalizes a plist file declared in \f and returns a proplib dictionary.
+ *
+ * @param[in] xhp The pointer to an xbps_handle struct.
+ * @param[in] fname The file path.
+ *
+ * @return The internalized proplib array, NULL otherwise.
+ */
+xbps_dictionary_t
+xbps_plist_dictionary_from_file(struct xbps_handle *xhp, const char *fname);
+
+/**
+ * @struct xbps_substr xbps.h "xbps.h"
+ * @brief Opaque structure of a compiled substring to search for.
+ */
+struct xbps_substr;
+
+/**
+ * Compiles \a needle to be searched with xbps_substr_find() in many
+ * strings. The result can be shared by multiple threads.
+ *
+ * @param[in] needle The substring to search for.
+ * @param[in] icase If true, the case of ASCII letters is ignored, as
+ * strcasestr(3) does in the C locale.
+ *
+ * @return A pointer to be released with xbps_substr_free(), NULL
+ * on error.
+ */
+struct xbps_substr *xbps_substr_new(const char *needle, bool icase);
+
+/**
+ * Finds the first occurrence of the substring compiled in \a ss in
+ * the string \a s.
+ *
+ * @param[in] ss The compiled substring, returned by xbps_substr_new().
+ * @param[in] s The string to search in.
+ *
+ * @return A pointer to the first occurrence in \a s, NULL if not found.
+ */
+const char *xbps_substr_find(const struct xbps_substr *ss, const char *s);
+
+/**
+ * Releases a compiled substring returned by xbps_substr_new().
+ *
+ * @param[in] ss The compiled substring.
+ */
+void xbps_substr_free(struct xbps_substr *ss);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !_XBPS_H_ */
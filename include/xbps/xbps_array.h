@@ -49,6 +49,7 @@ xbps_array_t	xbps_array_copy_mutable(xbps_array_t);
 
 unsigned int	xbps_array_capacity(xbps_array_t);
 unsigned int	xbps_array_count(xbps_array_t);
+uint32_t	xbps_array_version(xbps_array_t);
 bool		xbps_array_ensure_capacity(xbps_array_t, unsigned int);
 
 void		xbps_array_make_immutable(xbps_array_t);
@@ -143,6 +144,8 @@ bool		xbps_array_set_cstring_nocopy(xbps_array_t,
 						   unsigned int,
 						   const char *);
 bool		xbps_array_add_and_rel(xbps_array_t, xbps_object_t);
+bool		xbps_array_add_objects_and_rel(xbps_array_t, xbps_object_t *,
+					       unsigned int);
 
 #ifdef __cplusplus
 }
@@ -33,6 +33,7 @@
 #define	_XBPS_DICTIONARY_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <xbps/xbps_object.h>
 #include <xbps/xbps_array.h>
 
@@ -45,6 +46,7 @@ extern "C" {
 
 xbps_dictionary_t xbps_dictionary_create(void);
 xbps_dictionary_t xbps_dictionary_create_with_capacity(unsigned int);
+xbps_dictionary_t xbps_dictionary_create_hashed(unsigned int);
 
 xbps_dictionary_t xbps_dictionary_copy(xbps_dictionary_t);
 xbps_dictionary_t xbps_dictionary_copy_mutable(xbps_dictionary_t);
@@ -54,6 +56,7 @@ bool		xbps_dictionary_ensure_capacity(xbps_dictionary_t,
 						unsigned int);
 
 void		xbps_dictionary_make_immutable(xbps_dictionary_t);
+bool		xbps_dictionary_make_hashed(xbps_dictionary_t);
 
 xbps_object_iterator_t xbps_dictionary_iterator(xbps_dictionary_t);
 xbps_array_t	xbps_dictionary_all_keys(xbps_dictionary_t);
@@ -83,6 +86,15 @@ bool		xbps_dictionary_externalize_to_zfile(xbps_dictionary_t,
 xbps_dictionary_t xbps_dictionary_internalize_from_file(const char *);
 xbps_dictionary_t xbps_dictionary_internalize_from_zfile(const char *);
 
+void *		xbps_dictionary_externalize_binary(xbps_dictionary_t, size_t *);
+bool		xbps_dictionary_externalize_binary_to_file(xbps_dictionary_t,
+							   const char *);
+xbps_dictionary_t xbps_dictionary_internalize_buffer(const void *, size_t);
+xbps_dictionary_t xbps_dictionary_internalize_stream(
+		    ssize_t (*)(void *, void *, size_t), void *);
+bool		xbps_dictionary_externalize_stream(xbps_dictionary_t,
+		    ssize_t (*)(void *, const void *, size_t), void *);
+
 const char *	xbps_dictionary_keysym_cstring_nocopy(xbps_dictionary_keysym_t);
 
 bool		xbps_dictionary_keysym_equals(xbps_dictionary_keysym_t,
@@ -62,10 +62,43 @@ bool		xbps_object_equals_with_error(xbps_object_t, xbps_object_t, bool *);
 
 typedef struct _prop_object_iterator *xbps_object_iterator_t;
 
+typedef enum {
+	XBPS_MEMSTAT_BOOL,
+	XBPS_MEMSTAT_NUMBER,
+	XBPS_MEMSTAT_STRING,
+	XBPS_MEMSTAT_DATA,
+	XBPS_MEMSTAT_ARRAY,
+	XBPS_MEMSTAT_DICTIONARY,
+	XBPS_MEMSTAT_DICT_KEYSYM,
+	XBPS_MEMSTAT_NTYPES
+} xbps_memstat_type_t;
+
+struct xbps_memstat {
+	uint64_t	objects[XBPS_MEMSTAT_NTYPES];
+	uint64_t	bytes[XBPS_MEMSTAT_NTYPES];
+};
+
+struct xbps_object_stats {
+	uint64_t	internalized;
+	uint64_t	internalized_bytes;
+	uint64_t	syncs;
+};
+
 xbps_object_t	xbps_object_iterator_next(xbps_object_iterator_t);
 void		xbps_object_iterator_reset(xbps_object_iterator_t);
 void		xbps_object_iterator_release(xbps_object_iterator_t);
 
+void		xbps_object_arena_begin(void);
+void		xbps_object_arena_end(void);
+void		xbps_object_arena_intern(void);
+void		xbps_object_pool_trim(void);
+
+void		xbps_object_memstat(xbps_object_t, struct xbps_memstat *);
+void		xbps_object_stats(struct xbps_object_stats *);
+
+bool		xbps_object_modified(xbps_object_t);
+void		xbps_object_clear_modified(xbps_object_t);
+
 #ifdef __cplusplus
 }
 #endif
@@ -95,6 +95,38 @@
 #define __arraycount(x) (sizeof(x) / sizeof(*x))
 #endif
 
+/*
+ * Dependency graph of all packages in pkgdb or in the rpool, built once
+ * by xbps_get_depgraph() and dropped with the full dependency trees.
+ * Packages are numbered densely in the order they are found, the
+ * dependencies of package i are deps[dfirst[i]] to deps[dfirst[i + 1]]
+ * and its dependents revdeps[first[i]] to revdeps[first[i + 1]].
+ */
+struct xbps_depgraph {
+	xbps_dictionary_t ids;
+	xbps_array_t pkgvers;
+	xbps_array_t pkgds;
+	unsigned int n;
+	unsigned int *first;
+	unsigned int *revdeps;
+	unsigned int *dfirst;
+	unsigned int *deps;
+};
+
+/*
+ * Packed copy of the arrays of strings stored with the keys matched by
+ * the resolver (run_depends, provides, conflicts and shlib-*), built
+ * when they are internalized: string i starts at strs + offs[i] and is
+ * offs[i + 1] - offs[i] - 1 bytes long, namelen[i] is its
+ * xbps_pkg_name_len(). Valid until the array is modified.
+ */
+struct xbps_array_packed {
+	unsigned int count;
+	const uint32_t *offs;
+	const uint32_t *namelen;
+	const char *strs;
+};
+
 /**
  * @private
  */
@@ -102,6 +134,23 @@ int HIDDEN dewey_match(const char *, const char *);
 int HIDDEN xbps_pkgdb_init(struct xbps_handle *);
 void HIDDEN xbps_pkgdb_release(struct xbps_handle *);
 int HIDDEN xbps_pkgdb_conversion(struct xbps_handle *);
+int HIDDEN xbps_pkgdb_journal(struct xbps_handle *, const char *);
+int HIDDEN xbps_pkgdb_journal_open(struct xbps_handle *);
+int HIDDEN xbps_pkgdb_journal_replay(struct xbps_handle *);
+int HIDDEN xbps_pkgdb_journal_reset(struct xbps_handle *);
+void HIDDEN xbps_pkgdb_journal_close(struct xbps_handle *);
+void HIDDEN xbps_pkgdb_revdeps_update(struct xbps_handle *, xbps_dictionary_t,
+		xbps_dictionary_t);
+xbps_dictionary_t HIDDEN xbps_pkgdb_get_shlibs(struct xbps_handle *);
+void HIDDEN xbps_pkgdb_shlibs_update(struct xbps_handle *, xbps_dictionary_t,
+		xbps_dictionary_t);
+void HIDDEN xbps_pkgdb_files_update(struct xbps_handle *, const char *);
+void HIDDEN xbps_pkgdb_files_store(struct xbps_handle *);
+void HIDDEN xbps_pkgdb_files_release(struct xbps_handle *);
+void HIDDEN xbps_pkgdb_hash_update(struct xbps_handle *, const char *);
+void HIDDEN xbps_pkgdb_hash_release(struct xbps_handle *);
+xbps_dictionary_t HIDDEN xbps_pkgdb_files_plist(struct xbps_handle *,
+		const char *, size_t *);
 int HIDDEN xbps_array_replace_dict_by_name(xbps_array_t, xbps_dictionary_t,
 		const char *);
 int HIDDEN xbps_array_replace_dict_by_pattern(xbps_array_t, xbps_dictionary_t,
@@ -112,21 +161,31 @@ bool HIDDEN xbps_remove_pkg_from_array_by_pkgver(xbps_array_t, const char *);
 void HIDDEN xbps_fetch_set_cache_connection(int, int);
 void HIDDEN xbps_fetch_unset_cache_connection(void);
 int HIDDEN xbps_cb_message(struct xbps_handle *, xbps_dictionary_t, const char *);
-int HIDDEN xbps_entry_is_a_conf_file(xbps_dictionary_t, const char *);
-int HIDDEN xbps_entry_install_conf_file(struct xbps_handle *, xbps_dictionary_t,
-		xbps_dictionary_t, struct archive_entry *, const char *,
+int HIDDEN xbps_entry_install_conf_file(struct xbps_handle *, const char *,
+		const char *, bool, struct archive_entry *, const char *,
 		const char *);
-int HIDDEN xbps_repository_find_deps(struct xbps_handle *, xbps_array_t,
-		xbps_dictionary_t);
+struct xbps_deps_cache HIDDEN *xbps_deps_cache_create(void);
+void HIDDEN xbps_deps_cache_release(struct xbps_handle *,
+		struct xbps_deps_cache *);
+int HIDDEN xbps_repository_find_deps(struct xbps_handle *,
+		struct xbps_deps_cache *, xbps_array_t, xbps_dictionary_t);
 xbps_dictionary_t HIDDEN xbps_find_virtualpkg_in_conf(struct xbps_handle *,
 		xbps_dictionary_t, const char *);
 xbps_dictionary_t HIDDEN xbps_find_pkg_in_dict(xbps_dictionary_t, const char *);
+xbps_dictionary_t HIDDEN xbps_find_pkg_in_dict_pattern(xbps_dictionary_t,
+		const struct xbps_pattern *);
 xbps_dictionary_t HIDDEN xbps_find_virtualpkg_in_dict(struct xbps_handle *,
 		xbps_dictionary_t, const char *);
 xbps_dictionary_t HIDDEN xbps_find_pkg_in_array(xbps_array_t, const char *,
 		const char *);
 xbps_dictionary_t HIDDEN xbps_find_virtualpkg_in_array(struct xbps_handle *,
 		xbps_array_t, const char *, const char *);
+char HIDDEN *xbps_pkg_index_key(const char *);
+bool HIDDEN xbps_pkgd_set_pkgname(xbps_dictionary_t);
+bool HIDDEN xbps_pkgd_match_pkgname(xbps_dictionary_t, const char *);
+const char HIDDEN *xbps_pkgname_get(char *, size_t, const char *, char **);
+const char HIDDEN *xbps_pattern_string(const struct xbps_pattern *);
+void HIDDEN xbps_pkg_index_release(void);
 void HIDDEN xbps_transaction_revdeps(struct xbps_handle *, xbps_array_t);
 bool HIDDEN xbps_transaction_shlibs(struct xbps_handle *, xbps_array_t,
 		xbps_array_t);
@@ -135,25 +194,135 @@ int HIDDEN xbps_transaction_store(struct xbps_handle *, xbps_array_t,
 		xbps_dictionary_t, const char *, bool);
 char HIDDEN *xbps_get_remote_repo_string(const char *);
 int HIDDEN xbps_repo_sync(struct xbps_handle *, const char *);
-int HIDDEN xbps_file_hash_check_dictionary(struct xbps_handle *,
-		xbps_dictionary_t, const char *, const char *);
+void HIDDEN xbps_repo_mirror_store(struct xbps_handle *, const char *,
+		const char *);
+unsigned int HIDDEN xbps_repo_mirrors(struct xbps_handle *, const char *,
+		unsigned int *);
+const char HIDDEN *xbps_repo_mirror(struct xbps_handle *, const char *,
+		unsigned int);
+void HIDDEN xbps_repo_mirrors_release(struct xbps_handle *);
+void HIDDEN xbps_verify_cache_release(struct xbps_handle *);
+void HIDDEN xbps_crypto_init(void);
+bool HIDDEN xbps_shared_cache_get(struct xbps_handle *, xbps_dictionary_t,
+		const char *);
+void HIDDEN xbps_shared_cache_put(struct xbps_handle *, xbps_dictionary_t,
+		const char *);
+void HIDDEN xbps_shared_cache_remove(struct xbps_handle *, xbps_dictionary_t);
+int HIDDEN xbps_fetch_file_in(struct xbps_handle *, const char *,
+		const char *, const char *);
+int HIDDEN xbps_fetch_file_in_etag(struct xbps_handle *, const char *,
+		const char *, const char *);
+unsigned int HIDDEN xbps_fetch_files_in(struct xbps_handle *, const char **,
+		unsigned int, const char *, const char *);
+void HIDDEN xbps_fetch_warmup(struct xbps_handle *, const char **,
+		unsigned int);
+void HIDDEN xbps_fetch_warmup_wait(void);
+void HIDDEN xbps_digest2string(const uint8_t *, char *, size_t);
+char HIDDEN *xbps_file_verity_enable(const char *);
+char HIDDEN *xbps_binpkg_delta_base(struct xbps_handle *, xbps_dictionary_t);
 int HIDDEN xbps_file_exec(struct xbps_handle *, const char *, ...);
+int HIDDEN xbps_file_execv(struct xbps_handle *, const char **);
+pid_t HIDDEN xbps_file_spawn(struct xbps_handle *, int, const char *, ...);
+int HIDDEN xbps_file_exec_status(int);
+pid_t HIDDEN xbps_pkg_spawn_script(struct xbps_handle *, xbps_dictionary_t,
+		const char *, const char *, bool, int, char **);
 void HIDDEN xbps_set_cb_fetch(struct xbps_handle *, off_t, off_t, off_t,
 		const char *, bool, bool, bool);
+void HIDDEN xbps_set_cb_unpack(struct xbps_handle *,
+		const struct xbps_unpack_cb_data *);
 int HIDDEN xbps_set_cb_state(struct xbps_handle *, xbps_state_t, int,
 		const char *, const char *, ...);
+void HIDDEN xbps_set_cb_unpack_done(struct xbps_handle *, const char *,
+		const struct xbps_unpack_stats *);
+uint64_t HIDDEN xbps_monotime(void);
+uint64_t HIDDEN xbps_stats_phase(struct xbps_handle *, xbps_phase_t, uint64_t);
+void HIDDEN xbps_trace_open(void);
+unsigned char HIDDEN *xbps_file_hash_raw_handle(struct xbps_handle *,
+		const char *);
+void HIDDEN xbps_trace_close(void);
+uint64_t HIDDEN xbps_trace_begin(void);
+void HIDDEN xbps_trace_end(uint64_t, const char *, const char *, const char *);
+void HIDDEN xbps_trace_end_child(uint64_t, pid_t, const char *, const char *,
+		const char *);
 int HIDDEN xbps_unpack_binary_pkg(struct xbps_handle *, xbps_dictionary_t);
+int HIDDEN xbps_unpack_binary_pkgs(struct xbps_handle *, xbps_array_t,
+		unsigned int, unsigned int *);
+xbps_dictionary_t HIDDEN xbps_binpkg_get_files(struct xbps_handle *,
+		xbps_dictionary_t, bool *);
 int HIDDEN xbps_transaction_package_replace(struct xbps_handle *, xbps_array_t);
 int HIDDEN xbps_remove_pkg(struct xbps_handle *, const char *, bool);
 int HIDDEN xbps_register_pkg(struct xbps_handle *, xbps_dictionary_t);
 void HIDDEN xbps_transaction_conflicts(struct xbps_handle *, xbps_array_t);
-char HIDDEN *xbps_archive_get_file(struct archive *, struct archive_entry *);
+char HIDDEN *xbps_archive_get_file(struct archive *, struct archive_entry *,
+		size_t *);
 xbps_dictionary_t HIDDEN xbps_archive_get_dictionary(struct archive *,
 		struct archive_entry *);
+int HIDDEN xbps_archive_read_open_fd(struct archive *, int, size_t);
+struct xbps_uring HIDDEN *xbps_uring_new(struct xbps_handle *);
+bool HIDDEN xbps_uring_can_write(struct xbps_uring *, struct archive_entry *,
+		uid_t);
+int HIDDEN xbps_uring_add(struct xbps_uring *, struct archive *,
+		struct archive_entry *, void *, size_t);
+int HIDDEN xbps_uring_flush(struct xbps_uring *, struct archive *);
+void HIDDEN xbps_uring_free(struct xbps_uring *);
 const char HIDDEN *vpkg_user_conf(struct xbps_handle *, const char *, bool);
 xbps_array_t HIDDEN xbps_get_pkg_fulldeptree(struct xbps_handle *,
 		const char *, bool);
+void HIDDEN xbps_fulldeptree_release(struct xbps_handle *, bool);
+xbps_array_t HIDDEN xbps_get_pkg_fullrevdeptree(struct xbps_handle *,
+		const char *, bool);
+struct xbps_depgraph HIDDEN *xbps_get_depgraph(struct xbps_handle *, bool);
+bool HIDDEN xbps_commit_cancelled(struct xbps_handle *);
+bool HIDDEN xbps_array_packed(xbps_array_t, struct xbps_array_packed *);
+void HIDDEN xbps_alternatives_defer(struct xbps_handle *);
+int HIDDEN xbps_alternatives_flush(struct xbps_handle *);
+void HIDDEN xbps_triggers_add(xbps_dictionary_t, xbps_dictionary_t);
+int HIDDEN xbps_triggers_run(struct xbps_handle *, xbps_dictionary_t);
 struct xbps_repo HIDDEN *xbps_regget_repo(struct xbps_handle *,
 		const char *);
+bool HIDDEN xbps_repo_idxmap_open(struct xbps_repo *, const char *);
+bool HIDDEN xbps_repo_idxmap_open_lazy(struct xbps_repo *, char *);
+xbps_dictionary_t HIDDEN xbps_repo_idxmap_internalize(struct xbps_repo *);
+void HIDDEN xbps_repo_idxmap_close(struct xbps_repo *);
+void HIDDEN xbps_repo_release_index(struct xbps_repo *);
+int HIDDEN xbps_repo_idxmap_update(struct xbps_handle *, const char *);
+bool HIDDEN xbps_repo_idxmap_attach(struct xbps_repo *, const char *,
+		const struct stat *);
+void HIDDEN xbps_repo_idxmap_share(struct xbps_repo *, const char *,
+		const struct stat *);
+xbps_dictionary_t HIDDEN xbps_repo_idxmap_get_pkg(struct xbps_repo *,
+		const char *);
+xbps_dictionary_t HIDDEN xbps_repo_idxmap_get_virtualpkg(struct xbps_repo *,
+		const char *);
+char HIDDEN *xbps_repo_file(struct xbps_handle *, const char *, const char *);
+xbps_dictionary_t HIDDEN xbps_repo_get_pkg_pattern(struct xbps_repo *,
+		const struct xbps_pattern *);
+xbps_dictionary_t HIDDEN xbps_rpool_get_pkg_pattern(struct xbps_handle *,
+		const struct xbps_pattern *);
+bool HIDDEN xbps_rpool_concurrent(struct xbps_handle *);
+struct xbps_repo HIDDEN *xbps_rpool_repo(struct xbps_handle *, const char *);
+void HIDDEN xbps_rpool_trim(struct xbps_handle *, xbps_array_t);
+void HIDDEN xbps_repo_idxmap_map_vpkgs(struct xbps_repo *, xbps_dictionary_t);
+void HIDDEN xbps_repo_map_vpkgs(struct xbps_repo *, xbps_dictionary_t);
+void HIDDEN xbps_repo_map_vpkg(struct xbps_repo *, xbps_dictionary_t,
+		const char *, const char *);
+void HIDDEN xbps_repo_idxmap_memstat(struct xbps_repo *,
+		struct xbps_memstat *);
+void HIDDEN xbps_pkgdb_files_memstat(struct xbps_memstat *);
+int HIDDEN xbps_rpool_memstat(struct xbps_handle *, int (*)(const char *,
+		const char *, const struct xbps_memstat *, void *), void *);
+void HIDDEN xbps_memstat_print(struct xbps_handle *);
+/* the counters of xbps_counter(), updated without ordering */
+extern uint64_t xbps_counters[XBPS_COUNTER_MAX] HIDDEN;
+#define xbps_counter_add(c, n) \
+	((void)__atomic_fetch_add(&xbps_counters[(c)], (uint64_t)(n), \
+	    __ATOMIC_RELAXED))
+#define xbps_counter_inc(c)	xbps_counter_add(c, 1)
+void HIDDEN xbps_counters_init(struct xbps_handle *);
+void HIDDEN xbps_counters_print(struct xbps_handle *);
+unsigned int HIDDEN xbps_pool_size(struct xbps_handle *);
+void HIDDEN xbps_pool_run(struct xbps_handle *, void *(*)(void *), void *,
+		unsigned int);
+void HIDDEN xbps_pool_release(struct xbps_handle *);
 
 #endif /* !_XBPS_API_IMPL_H_ */
@@ -23,16 +23,27 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_LZMA_MT
+#include <lzma.h>
+#endif
 
 #include "xbps_api_impl.h"
 
+/*
+ * Reads the current archive entry into a NUL-terminated buffer,
+ * its length (without the NUL) is returned in lenp if set.
+ */
 char HIDDEN *
-xbps_archive_get_file(struct archive *ar, struct archive_entry *entry)
+xbps_archive_get_file(struct archive *ar, struct archive_entry *entry,
+		size_t *lenp)
 {
 	size_t buflen;
 	ssize_t nbytes = -1;
@@ -52,24 +63,253 @@ xbps_archive_get_file(struct archive *ar, struct archive_entry *entry)
 		return NULL;
 	}
 	buf[buflen] = '\0';
+	if (lenp != NULL)
+		*lenp = buflen;
 	return buf;
 }
 
+static ssize_t
+archive_read_cb(void *arg, void *buf, size_t len)
+{
+	return archive_read_data(arg, buf, len);
+}
+
+/*
+ * The entry is internalized while it's being read, without a copy of
+ * the whole plist.
+ */
 xbps_dictionary_t HIDDEN
 xbps_archive_get_dictionary(struct archive *ar, struct archive_entry *entry)
 {
-	xbps_dictionary_t d = NULL;
-	char *buf;
+	xbps_dictionary_t d;
+	uint64_t start;
 
-	if ((buf = xbps_archive_get_file(ar, entry)) == NULL)
-		return NULL;
+	assert(ar != NULL);
+
+	start = xbps_trace_begin();
+	d = xbps_dictionary_internalize_stream(archive_read_cb, ar);
+	xbps_trace_end(start, "plist", "internalize",
+	    archive_entry_pathname(entry));
 
-	/* If blob is already a dictionary we are done */
-	d = xbps_dictionary_internalize(buf);
-	free(buf);
 	return d;
 }
 
+#ifdef HAVE_LZMA_MT
+/*
+ * xz streams written by the multi-threaded encoder (xbps-create) are split
+ * in blocks whose sizes are stored in their headers, liblzma decodes them
+ * in parallel ahead of the reader; other streams are decoded by a single
+ * thread as libarchive would do.
+ */
+#define XZ_INBUFSIZ	(256 * 1024)
+#define XZ_OUTBUFSIZ	(1024 * 1024)
+
+struct xz_reader {
+	lzma_stream strm;
+	int fd;
+	const uint8_t *map;
+	size_t maplen;
+	bool eof, done;
+	uint8_t inbuf[XZ_INBUFSIZ];
+	uint8_t outbuf[XZ_OUTBUFSIZ];
+};
+
+static ssize_t
+xz_read_cb(struct archive *ar, void *arg, const void **buf)
+{
+	struct xz_reader *xz = arg;
+	lzma_ret ret;
+	ssize_t rd;
+
+	xz->strm.next_out = xz->outbuf;
+	xz->strm.avail_out = sizeof(xz->outbuf);
+	*buf = xz->outbuf;
+
+	while (!xz->done && xz->strm.avail_out > 0) {
+		if (xz->strm.avail_in == 0 && !xz->eof && xz->map != NULL) {
+			/* the whole mapped stream is decoded in place */
+			xz->strm.next_in = xz->map;
+			xz->strm.avail_in = xz->maplen;
+			xz->eof = true;
+		} else if (xz->strm.avail_in == 0 && !xz->eof) {
+			rd = read(xz->fd, xz->inbuf, sizeof(xz->inbuf));
+			if (rd == -1) {
+				if (errno == EINTR)
+					continue;
+				archive_set_error(ar, errno, "xz: read error");
+				return -1;
+			}
+			xz->strm.next_in = xz->inbuf;
+			xz->strm.avail_in = (size_t)rd;
+			xz->eof = rd == 0;
+		}
+		ret = lzma_code(&xz->strm, xz->eof ? LZMA_FINISH : LZMA_RUN);
+		if (ret == LZMA_STREAM_END) {
+			xz->done = true;
+			break;
+		}
+		if (ret != LZMA_OK) {
+			archive_set_error(ar, ret == LZMA_MEM_ERROR ? ENOMEM : EINVAL,
+			    "xz: %s", ret == LZMA_MEM_ERROR ? "out of memory" :
+			    "truncated or corrupted stream");
+			return -1;
+		}
+	}
+	return (ssize_t)(sizeof(xz->outbuf) - xz->strm.avail_out);
+}
+
+static int
+xz_close_cb(struct archive *ar UNUSED, void *arg)
+{
+	struct xz_reader *xz = arg;
+
+	lzma_end(&xz->strm);
+	if (xz->map != NULL)
+		(void)munmap(__UNCONST(xz->map), xz->maplen);
+	free(xz);
+
+	return ARCHIVE_OK;
+}
+
+static struct xz_reader *
+xz_reader_new(int fd, const uint8_t *map, size_t maplen)
+{
+	struct xz_reader *xz;
+	lzma_mt mt;
+	uint32_t ncpus;
+
+	if ((xz = malloc(sizeof(*xz))) == NULL)
+		return NULL;
+
+	memset(&xz->strm, 0, sizeof(xz->strm));
+	xz->fd = fd;
+	xz->map = map;
+	xz->maplen = maplen;
+	xz->eof = xz->done = false;
+
+	memset(&mt, 0, sizeof(mt));
+	mt.flags = LZMA_CONCATENATED;
+	ncpus = lzma_cputhreads();
+	mt.threads = ncpus ? ncpus : 1;
+	/* same defaults as xz(1), single-threaded beyond a quarter of RAM */
+	mt.memlimit_threading = lzma_physmem() / 4;
+	mt.memlimit_stop = UINT64_MAX;
+	if (lzma_stream_decoder_mt(&xz->strm, &mt) != LZMA_OK) {
+		free(xz);
+		return NULL;
+	}
+	return xz;
+}
+#endif
+
+/*
+ * Regular files are mapped and handed to libarchive as a single block,
+ * as archive_read_open_memory(3) does, instead of being copied in
+ * blocksize chunks with read(2).
+ */
+struct mmap_reader {
+	uint8_t *map;
+	size_t len, off;
+};
+
+static ssize_t
+mmap_read_cb(struct archive *ar UNUSED, void *arg, const void **buf)
+{
+	struct mmap_reader *mr = arg;
+	size_t len = mr->len - mr->off;
+
+	*buf = mr->map + mr->off;
+	mr->off = mr->len;
+
+	return (ssize_t)len;
+}
+
+static int64_t
+mmap_skip_cb(struct archive *ar UNUSED, void *arg, int64_t request)
+{
+	struct mmap_reader *mr = arg;
+
+	if (request < 0)
+		return 0;
+	if ((uint64_t)request > mr->len - mr->off)
+		request = (int64_t)(mr->len - mr->off);
+	mr->off += (size_t)request;
+
+	return request;
+}
+
+static int
+mmap_close_cb(struct archive *ar UNUSED, void *arg)
+{
+	struct mmap_reader *mr = arg;
+
+	(void)munmap(mr->map, mr->len);
+	free(mr);
+
+	return ARCHIVE_OK;
+}
+
+static uint8_t *
+mmap_fd(int fd, size_t *lenp)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size == 0 || (uint64_t)st.st_size > SIZE_MAX)
+		return NULL;
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	(void)posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+	*lenp = (size_t)st.st_size;
+
+	return map;
+}
+
+/*
+ * Like archive_read_open_fd(3), but the file is mapped if possible, and
+ * xz streams are decompressed with multiple threads if supported.
+ */
+int HIDDEN
+xbps_archive_read_open_fd(struct archive *ar, int fd, size_t blocksize)
+{
+	struct mmap_reader *mr;
+	uint8_t *map;
+	size_t len = 0;
+#ifdef HAVE_LZMA_MT
+	static const uint8_t magic[] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+	struct xz_reader *xz;
+	uint8_t buf[sizeof(magic)];
+#endif
+
+	map = mmap_fd(fd, &len);
+#ifdef HAVE_LZMA_MT
+	if (map != NULL) {
+		if (len >= sizeof(magic) &&
+		    memcmp(map, magic, sizeof(magic)) == 0 &&
+		    (xz = xz_reader_new(fd, map, len)) != NULL)
+			return archive_read_open(ar, xz, NULL, xz_read_cb,
+			    xz_close_cb);
+	} else if (pread(fd, buf, sizeof(buf), 0) == (ssize_t)sizeof(buf) &&
+	    memcmp(buf, magic, sizeof(magic)) == 0 &&
+	    (xz = xz_reader_new(fd, NULL, 0)) != NULL) {
+		return archive_read_open(ar, xz, NULL, xz_read_cb, xz_close_cb);
+	}
+#endif
+	if (map != NULL) {
+		if ((mr = malloc(sizeof(*mr))) != NULL) {
+			mr->map = map;
+			mr->len = len;
+			mr->off = 0;
+			return archive_read_open2(ar, mr, NULL, mmap_read_cb,
+			    mmap_skip_cb, mmap_close_cb);
+		}
+		(void)munmap(map, len);
+	}
+	return archive_read_open_fd(ar, fd, blocksize);
+}
+
 int
 xbps_archive_append_buf(struct archive *ar, const void *buf, const size_t buflen,
 	const char *fname, const mode_t mode, const char *uname, const char *gname)
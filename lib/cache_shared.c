@@ -0,0 +1,224 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include <openssl/sha.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Binary packages fetched from remote repositories can be shared by many
+ * root directories through xhp->sharedcachedir, storing every package
+ * by its content as <sharedcachedir>/<aa>/<sha256>.xbps, where sha256 is
+ * its "filename-sha256" in repodata and aa its first two characters.
+ *
+ * Packages are published once their hash was checked, with link(2) or
+ * a copy renamed into place, so that the shared cache only contains
+ * complete packages matching their names and can be used concurrently.
+ * Packages found in it are hardlinked into the cachedir of the root
+ * directory, or reflinked or copied if it's on another filesystem; they
+ * are verified there as every other package.
+ */
+static char *
+shared_cache_path(struct xbps_handle *xhp, xbps_dictionary_t obj)
+{
+	const char *sha256;
+
+	if (xhp->sharedcachedir[0] == '\0')
+		return NULL;
+	if (!xbps_dictionary_get_cstring_nocopy(obj, "filename-sha256", &sha256) ||
+	    strlen(sha256) != SHA256_DIGEST_LENGTH * 2)
+		return NULL;
+
+	return xbps_xasprintf("%s/%.2s/%s.xbps", xhp->sharedcachedir,
+	    sha256, sha256);
+}
+
+static int
+copy_fd(int sfd, int dfd)
+{
+	char buf[64 * 1024];
+	ssize_t rd, wr;
+	char *p;
+
+#ifdef FICLONE
+	if (ioctl(dfd, FICLONE, sfd) == 0)
+		return 0;
+#endif
+	while ((rd = read(sfd, buf, sizeof(buf))) != 0) {
+		if (rd == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (p = buf; rd > 0; p += wr, rd -= wr) {
+			if ((wr = write(dfd, p, (size_t)rd)) == -1) {
+				if (errno == EINTR) {
+					wr = 0;
+					continue;
+				}
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Links or copies src into dst atomically, dst is replaced if replace
+ * is set.
+ */
+static int
+shared_cache_link(const char *src, const char *dst, bool replace)
+{
+	char *tmp;
+	int sfd, dfd, rv = 0;
+
+	if (!replace && link(src, dst) == 0)
+		return 0;
+	else if (!replace && errno == EEXIST)
+		return 0;
+
+	tmp = xbps_xasprintf("%s.XXXXXX", dst);
+	if ((sfd = open(src, O_RDONLY|O_CLOEXEC)) == -1) {
+		free(tmp);
+		return -1;
+	}
+	if ((dfd = mkstemp(tmp)) == -1) {
+		(void)close(sfd);
+		free(tmp);
+		return -1;
+	}
+	xbps_counter_inc(XBPS_COUNTER_FSYNCS);
+	if (copy_fd(sfd, dfd) == -1 || fchmod(dfd, 0644) == -1 ||
+	    fsync(dfd) == -1 || rename(tmp, dst) == -1) {
+		rv = -1;
+		(void)unlink(tmp);
+	}
+	(void)close(sfd);
+	(void)close(dfd);
+	free(tmp);
+
+	return rv;
+}
+
+bool HIDDEN
+xbps_shared_cache_get(struct xbps_handle *xhp, xbps_dictionary_t obj,
+		const char *binfile)
+{
+	const char *pkgver;
+	char *path;
+	bool found = false;
+
+	if ((path = shared_cache_path(xhp, obj)) == NULL)
+		return false;
+
+	if (access(path, R_OK) == 0) {
+		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		/* a hardlink is fine as packages are never modified */
+		if (link(path, binfile) == 0 ||
+		    shared_cache_link(path, binfile, true) == 0) {
+			xbps_dbg_printf(xhp, "%s: using %s from the shared "
+			    "cache\n", pkgver, path);
+			found = true;
+		} else {
+			xbps_dbg_printf(xhp, "%s: failed to link %s into "
+			    "cachedir: %s\n", pkgver, path, strerror(errno));
+		}
+	}
+	free(path);
+
+	return found;
+}
+
+void HIDDEN
+xbps_shared_cache_put(struct xbps_handle *xhp, xbps_dictionary_t obj,
+		const char *binfile)
+{
+	const char *pkgver, *sha256;
+	char *path, *dir;
+	int fd, rv;
+
+	if ((path = shared_cache_path(xhp, obj)) == NULL)
+		return;
+	if (access(path, F_OK) == 0) {
+		free(path);
+		return;
+	}
+	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+	xbps_dictionary_get_cstring_nocopy(obj, "filename-sha256", &sha256);
+	/*
+	 * The package must have been verified, but not necessarily
+	 * against its hash; the shared cache is keyed by it.
+	 */
+	if ((rv = xbps_file_hash_check_handle(xhp, binfile, sha256)) != 0) {
+		xbps_dbg_printf(xhp, "%s: not adding to the shared cache, "
+		    "SHA256 mismatch: %s\n", pkgver, strerror(rv));
+		free(path);
+		return;
+	}
+	/* it must be on disk before it's visible to other roots */
+	if ((fd = open(binfile, O_RDONLY|O_CLOEXEC)) != -1) {
+		xbps_counter_inc(XBPS_COUNTER_FSYNCS);
+		(void)fsync(fd);
+		(void)close(fd);
+	}
+	dir = xbps_xasprintf("%s/%.2s", xhp->sharedcachedir, sha256);
+	if ((xbps_mkpath(dir, 0755) == -1 && errno != EEXIST) ||
+	    shared_cache_link(binfile, path, false) == -1) {
+		xbps_dbg_printf(xhp, "%s: failed to add %s to the shared "
+		    "cache: %s\n", pkgver, path, strerror(errno));
+	} else {
+		xbps_dbg_printf(xhp, "%s: added %s to the shared cache\n",
+		    pkgver, path);
+	}
+	free(dir);
+	free(path);
+}
+
+void HIDDEN
+xbps_shared_cache_remove(struct xbps_handle *xhp, xbps_dictionary_t obj)
+{
+	char *path;
+
+	if ((path = shared_cache_path(xhp, obj)) == NULL)
+		return;
+	if (unlink(path) == 0)
+		xbps_dbg_printf(xhp, "removed %s from the shared cache\n", path);
+	free(path);
+}
@@ -33,6 +33,8 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "xbps_api_impl.h"
 
@@ -40,6 +42,37 @@
 #pragma clang diagnostic ignored "-Wformat-nonliteral"
 #endif
 
+/*
+ * Callbacks may be run from multiple threads (i.e concurrent fetches),
+ * serialize them so that clients don't need to care.
+ */
+static pthread_mutex_t cb_mtx;
+static pthread_once_t cb_mtx_once = PTHREAD_ONCE_INIT;
+
+static void
+cb_mtx_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&cb_mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void
+cb_lock(void)
+{
+	(void)pthread_once(&cb_mtx_once, cb_mtx_init);
+	pthread_mutex_lock(&cb_mtx);
+}
+
+static void
+cb_unlock(void)
+{
+	pthread_mutex_unlock(&cb_mtx);
+}
+
 void HIDDEN
 xbps_set_cb_fetch(struct xbps_handle *xhp,
 		  off_t file_size,
@@ -63,7 +96,85 @@ xbps_set_cb_fetch(struct xbps_handle *xhp,
 	xfcd.cb_start = cb_start;
 	xfcd.cb_update = cb_update;
 	xfcd.cb_end = cb_end;
+	cb_lock();
 	(*xhp->fetch_cb)(&xfcd, xhp->fetch_cb_data);
+	cb_unlock();
+}
+
+void HIDDEN
+xbps_set_cb_unpack(struct xbps_handle *xhp,
+		   const struct xbps_unpack_cb_data *xucd)
+{
+	if (xhp->unpack_cb == NULL)
+		return;
+
+	cb_lock();
+	(*xhp->unpack_cb)(xucd, xhp->unpack_cb_data);
+	cb_unlock();
+}
+
+uint64_t HIDDEN
+xbps_monotime(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Accounts the time since \a start to \a phase, returns the current
+ * time to start the next one.
+ */
+uint64_t HIDDEN
+xbps_stats_phase(struct xbps_handle *xhp, xbps_phase_t phase, uint64_t start)
+{
+	uint64_t now = xbps_monotime();
+
+	xhp->stats.phase_time[phase] += now - start;
+	return now;
+}
+
+static int
+run_cb_state(struct xbps_handle *xhp, struct xbps_state_cb_data *xscd)
+{
+	int rv;
+
+	xscd->xhp = xhp;
+	xscd->timestamp = xbps_monotime();
+	xscd->stats = &xhp->stats;
+	cb_lock();
+	rv = (*xhp->state_cb)(xscd, xhp->state_cb_data);
+	cb_unlock();
+
+	return rv;
+}
+
+/*
+ * Packages may be unpacked concurrently, the totals are updated
+ * with the callbacks lock held.
+ */
+void HIDDEN
+xbps_set_cb_unpack_done(struct xbps_handle *xhp, const char *pkgver,
+		const struct xbps_unpack_stats *us)
+{
+	struct xbps_state_cb_data xscd;
+
+	cb_lock();
+	xhp->stats.unpack.bytes += us->bytes;
+	xhp->stats.unpack.files += us->files;
+	xhp->stats.unpack.time += us->time;
+	xhp->stats.unpack_pkgs++;
+	cb_unlock();
+
+	if (xhp->state_cb == NULL)
+		return;
+
+	memset(&xscd, 0, sizeof(xscd));
+	xscd.state = XBPS_STATE_UNPACK_DONE;
+	xscd.arg = pkgver;
+	xscd.unpack = us;
+	(void)run_cb_state(xhp, &xscd);
 }
 
 int HIDDEN
@@ -82,7 +193,7 @@ xbps_set_cb_state(struct xbps_handle *xhp,
 	if (xhp->state_cb == NULL)
 		return 0;
 
-	xscd.xhp = xhp;
+	memset(&xscd, 0, sizeof(xscd));
 	xscd.state = state;
 	xscd.err = err;
 	xscd.arg = arg;
@@ -95,7 +206,7 @@ xbps_set_cb_state(struct xbps_handle *xhp,
 		else
 			xscd.desc = buf;
 	}
-	retval = (*xhp->state_cb)(&xscd, xhp->state_cb_data);
+	retval = run_cb_state(xhp, &xscd);
 	if (buf != NULL)
 		free(buf);
 
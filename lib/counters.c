@@ -0,0 +1,119 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Counters of the operations done in hot paths, always compiled in:
+ * they are global and updated with relaxed atomics, so that counting
+ * costs about as much as an increment. The plists internalized and the
+ * files synced by proplib are counted there.
+ */
+uint64_t HIDDEN xbps_counters[XBPS_COUNTER_MAX];
+
+static const char *const counter_names[XBPS_COUNTER_MAX] = {
+	[XBPS_COUNTER_PLISTS] = "plists",
+	[XBPS_COUNTER_PLIST_BYTES] = "plist_bytes",
+	[XBPS_COUNTER_CMPVER] = "cmpver",
+	[XBPS_COUNTER_PKGPATTERN_MATCH] = "pkgpattern_match",
+	[XBPS_COUNTER_RPOOL_LOOKUPS] = "rpool_lookups",
+	[XBPS_COUNTER_RPOOL_HITS] = "rpool_hits",
+	[XBPS_COUNTER_RPOOL_MISSES] = "rpool_misses",
+	[XBPS_COUNTER_HASH_BYTES] = "hash_bytes",
+	[XBPS_COUNTER_FETCH_BYTES] = "fetch_bytes",
+	[XBPS_COUNTER_UNPACK_FILES] = "unpack_files",
+	[XBPS_COUNTER_FSYNCS] = "fsyncs",
+};
+
+static uint64_t
+counter_value(xbps_counter_t counter)
+{
+	struct xbps_object_stats os;
+	uint64_t v;
+
+	v = __atomic_load_n(&xbps_counters[counter], __ATOMIC_RELAXED);
+	switch (counter) {
+	case XBPS_COUNTER_PLISTS:
+	case XBPS_COUNTER_PLIST_BYTES:
+	case XBPS_COUNTER_FSYNCS:
+		xbps_object_stats(&os);
+		if (counter == XBPS_COUNTER_PLISTS)
+			v += os.internalized;
+		else if (counter == XBPS_COUNTER_PLIST_BYTES)
+			v += os.internalized_bytes;
+		else
+			v += os.syncs;
+		break;
+	default:
+		break;
+	}
+	return v;
+}
+
+void HIDDEN
+xbps_counters_init(struct xbps_handle *xhp)
+{
+	for (int i = 0; i < XBPS_COUNTER_MAX; i++)
+		xhp->counters[i] = counter_value(i);
+}
+
+uint64_t
+xbps_counter(struct xbps_handle *xhp, xbps_counter_t counter)
+{
+	assert(xhp);
+
+	if ((unsigned int)counter >= XBPS_COUNTER_MAX)
+		return 0;
+
+	return counter_value(counter) - xhp->counters[counter];
+}
+
+const char *
+xbps_counter_name(xbps_counter_t counter)
+{
+	if ((unsigned int)counter >= XBPS_COUNTER_MAX)
+		return NULL;
+
+	return counter_names[counter];
+}
+
+/*
+ * Prints the counters since xbps_init(), one per line.
+ */
+void HIDDEN
+xbps_counters_print(struct xbps_handle *xhp)
+{
+	for (int i = 0; i < XBPS_COUNTER_MAX; i++) {
+		xbps_dbg_printf(xhp, "[counters] %s: %" PRIu64 "\n",
+		    counter_names[i], xbps_counter(xhp, i));
+	}
+}
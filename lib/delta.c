@@ -0,0 +1,496 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Binary delta between two binary packages, stored as
+ * "<pkgver>.<arch>.xdlt" next to the target package:
+ *
+ * 	struct delta_hdr
+ * 	'C' <offset> <length>	copy <length> bytes of the base at <offset>
+ * 	'A' <length> <data>	append <length> literal bytes
+ * 	...
+ *
+ * Integers are stored as 64 bit little-endian values. The hashes of the
+ * base and target files are recorded, a delta is only applied to the
+ * base it was made from and the result must match the target.
+ *
+ * Deltas are created by matching rsync(1) like rolling checksums of
+ * the target against the fixed size blocks of the base.
+ */
+#define DELTA_MAGIC	"XBPSDLT1"
+#define DELTA_BLKSIZ	512
+
+struct delta_hdr {
+	char magic[8];
+	uint8_t oldsize[8];
+	uint8_t newsize[8];
+	uint8_t oldsha256[SHA256_DIGEST_LENGTH];
+	uint8_t newsha256[SHA256_DIGEST_LENGTH];
+};
+
+struct delta_blk {
+	uint32_t sum;
+	uint32_t blk;	/* block index + 1, 0 if unused */
+};
+
+struct delta_out {
+	FILE *f;
+	uint64_t off;	/* pending copy */
+	uint64_t len;
+};
+
+static void
+put64(uint8_t *p, uint64_t v)
+{
+	for (uint8_t i = 0; i < 8; i++)
+		p[i] = (v >> (i * 8)) & 0xff;
+}
+
+static uint64_t
+get64(const uint8_t *p)
+{
+	uint64_t v = 0;
+
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+static uint32_t
+blk_sum(const uint8_t *p, uint32_t *ap, uint32_t *bp)
+{
+	uint32_t a = 0, b = 0;
+
+	for (uint32_t i = 0; i < DELTA_BLKSIZ; i++) {
+		a += p[i];
+		b += (DELTA_BLKSIZ - i) * p[i];
+	}
+	*ap = a & 0xffff;
+	*bp = b & 0xffff;
+
+	return *ap | (*bp << 16);
+}
+
+static bool
+flush_copy(struct delta_out *out)
+{
+	uint8_t buf[17];
+
+	if (out->len == 0)
+		return true;
+
+	buf[0] = 'C';
+	put64(buf + 1, out->off);
+	put64(buf + 9, out->len);
+	out->len = 0;
+
+	return fwrite(buf, 1, sizeof(buf), out->f) == sizeof(buf);
+}
+
+static bool
+emit_copy(struct delta_out *out, uint64_t off, uint64_t len)
+{
+	if (out->len && out->off + out->len == off) {
+		out->len += len;
+		return true;
+	}
+	if (!flush_copy(out))
+		return false;
+
+	out->off = off;
+	out->len = len;
+	return true;
+}
+
+static bool
+emit_data(struct delta_out *out, const uint8_t *data, uint64_t len)
+{
+	uint8_t buf[9];
+
+	if (len == 0)
+		return true;
+	if (!flush_copy(out))
+		return false;
+
+	buf[0] = 'A';
+	put64(buf + 1, len);
+	if (fwrite(buf, 1, sizeof(buf), out->f) != sizeof(buf))
+		return false;
+
+	return fwrite(data, 1, len, out->f) == len;
+}
+
+static bool
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
+
+static int
+delta_generate(struct delta_out *out, const uint8_t *old, size_t oldsize,
+		const uint8_t *new, size_t newsize)
+{
+	struct delta_blk *tab;
+	size_t nblks, tabsize = 16, mask, pos = 0, lit = 0;
+	uint32_t a = 0, b = 0, sum = 0;
+
+	nblks = oldsize / DELTA_BLKSIZ;
+	if (nblks >= UINT32_MAX)
+		nblks = 0;
+	while (tabsize < nblks * 2)
+		tabsize <<= 1;
+	mask = tabsize - 1;
+
+	tab = calloc(tabsize, sizeof(*tab));
+	if (tab == NULL)
+		return ENOMEM;
+	/*
+	 * Index all blocks of the base, the first one wins.
+	 */
+	for (size_t i = 0; i < nblks; i++) {
+		size_t h;
+
+		sum = blk_sum(old + i * DELTA_BLKSIZ, &a, &b);
+		for (h = sum & mask; tab[h].blk; h = (h + 1) & mask) {
+			if (tab[h].sum == sum)
+				break;
+		}
+		if (tab[h].blk == 0) {
+			tab[h].sum = sum;
+			tab[h].blk = (uint32_t)i + 1;
+		}
+	}
+
+	if (nblks && newsize >= DELTA_BLKSIZ)
+		sum = blk_sum(new, &a, &b);
+
+	while (nblks && pos + DELTA_BLKSIZ <= newsize) {
+		size_t h, oldoff = 0, len = 0;
+
+		for (h = sum & mask; tab[h].blk; h = (h + 1) & mask) {
+			if (tab[h].sum != sum)
+				continue;
+			oldoff = (size_t)(tab[h].blk - 1) * DELTA_BLKSIZ;
+			if (memcmp(old + oldoff, new + pos, DELTA_BLKSIZ) == 0)
+				len = DELTA_BLKSIZ;
+			break;
+		}
+		if (len == 0) {
+			if (pos + DELTA_BLKSIZ < newsize) {
+				a = (a - new[pos] + new[pos + DELTA_BLKSIZ]) & 0xffff;
+				b = (b - DELTA_BLKSIZ * new[pos] + a) & 0xffff;
+				sum = a | (b << 16);
+			}
+			pos++;
+			continue;
+		}
+		/*
+		 * Extend the match in both directions.
+		 */
+		while (pos + len < newsize && oldoff + len < oldsize &&
+		    new[pos + len] == old[oldoff + len])
+			len++;
+		while (pos > lit && oldoff > 0 && new[pos - 1] == old[oldoff - 1]) {
+			pos--;
+			oldoff--;
+			len++;
+		}
+		if (!emit_data(out, new + lit, pos - lit) ||
+		    !emit_copy(out, oldoff, len)) {
+			free(tab);
+			return errno ? errno : EIO;
+		}
+		pos += len;
+		lit = pos;
+		if (pos + DELTA_BLKSIZ <= newsize)
+			sum = blk_sum(new + pos, &a, &b);
+	}
+	free(tab);
+
+	if (!emit_data(out, new + lit, newsize - lit) || !flush_copy(out))
+		return errno ? errno : EIO;
+
+	return 0;
+}
+
+char HIDDEN *
+xbps_binpkg_delta_base(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
+{
+	xbps_dictionary_t pkgd;
+	const char *pkgver, *arch, *base, *ipkgver;
+	char *pkgname, *basefile;
+
+	if (!xbps_dictionary_get_cstring_nocopy(pkg_repod, "delta-base", &base))
+		return NULL;
+	xbps_dictionary_get_cstring_nocopy(pkg_repod, "pkgver", &pkgver);
+	xbps_dictionary_get_cstring_nocopy(pkg_repod, "architecture", &arch);
+
+	pkgname = xbps_pkg_name(pkgver);
+	assert(pkgname);
+	pkgd = xbps_pkgdb_get_pkg(xhp, pkgname);
+	free(pkgname);
+	if (pkgd == NULL ||
+	    !xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &ipkgver) ||
+	    strcmp(ipkgver, base))
+		return NULL;
+
+	basefile = xbps_xasprintf("%s/%s.%s.xbps", xhp->cachedir, base, arch);
+	if (access(basefile, R_OK) == -1) {
+		free(basefile);
+		return NULL;
+	}
+	return basefile;
+}
+
+int
+xbps_delta_create(const char *oldfile, const char *newfile,
+		const char *deltafile)
+{
+	struct delta_hdr hdr;
+	struct delta_out out;
+	void *old = NULL, *new = NULL;
+	size_t oldmaplen, oldsize, newmaplen, newsize;
+	char *tmpfile = NULL;
+	int fd = -1, rv = 0;
+
+	assert(oldfile);
+	assert(newfile);
+	assert(deltafile);
+
+	memset(&out, 0, sizeof(out));
+	if (!xbps_mmap_file(oldfile, &old, &oldmaplen, &oldsize))
+		return errno;
+	if (!xbps_mmap_file(newfile, &new, &newmaplen, &newsize)) {
+		rv = errno;
+		goto out;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DELTA_MAGIC, sizeof(hdr.magic));
+	put64(hdr.oldsize, oldsize);
+	put64(hdr.newsize, newsize);
+	SHA256(old, oldsize, hdr.oldsha256);
+	SHA256(new, newsize, hdr.newsha256);
+
+	tmpfile = xbps_xasprintf("%s.XXXXXX", deltafile);
+	if ((fd = mkstemp(tmpfile)) == -1 ||
+	    (out.f = fdopen(fd, "w")) == NULL) {
+		rv = errno;
+		goto out;
+	}
+	fd = -1;
+	if (fwrite(&hdr, 1, sizeof(hdr), out.f) != sizeof(hdr)) {
+		rv = errno;
+		goto out;
+	}
+	if ((rv = delta_generate(&out, old, oldsize, new, newsize)) != 0)
+		goto out;
+
+	if (fchmod(fileno(out.f), 0644) == -1 || fflush(out.f) == EOF) {
+		rv = errno;
+		goto out;
+	}
+	if (rename(tmpfile, deltafile) == -1) {
+		rv = errno;
+		goto out;
+	}
+	free(tmpfile);
+	tmpfile = NULL;
+
+out:
+	if (out.f != NULL)
+		(void)fclose(out.f);
+	if (fd != -1)
+		(void)close(fd);
+	if (tmpfile != NULL) {
+		(void)unlink(tmpfile);
+		free(tmpfile);
+	}
+	if (new != NULL)
+		(void)munmap(new, newmaplen);
+	(void)munmap(old, oldmaplen);
+
+	return rv;
+}
+
+int
+xbps_delta_apply(const char *oldfile, const char *deltafile,
+		const char *newfile)
+{
+	const struct delta_hdr *hdr;
+	const uint8_t *p, *end;
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	void *old = NULL, *delta = NULL;
+	SHA256_CTX ctx;
+	size_t oldmaplen, oldsize, deltamaplen, deltasize;
+	uint64_t newsize, written = 0;
+	char *tmpfile = NULL;
+	int fd = -1, rv = 0;
+
+	assert(oldfile);
+	assert(deltafile);
+	assert(newfile);
+
+	if (!xbps_mmap_file(deltafile, &delta, &deltamaplen, &deltasize))
+		return errno;
+	hdr = delta;
+	if (deltasize < sizeof(*hdr) ||
+	    memcmp(hdr->magic, DELTA_MAGIC, sizeof(hdr->magic))) {
+		rv = EINVAL;
+		goto out;
+	}
+	if (!xbps_mmap_file(oldfile, &old, &oldmaplen, &oldsize)) {
+		rv = errno;
+		goto out;
+	}
+	/*
+	 * Make sure the delta was made from this base.
+	 */
+	SHA256(old, oldsize, digest);
+	if (get64(hdr->oldsize) != oldsize ||
+	    memcmp(digest, hdr->oldsha256, sizeof(digest))) {
+		rv = ERANGE;
+		goto out;
+	}
+	newsize = get64(hdr->newsize);
+
+	tmpfile = xbps_xasprintf("%s.XXXXXX", newfile);
+	if ((fd = mkstemp(tmpfile)) == -1) {
+		rv = errno;
+		goto out;
+	}
+	SHA256_Init(&ctx);
+	p = (const uint8_t *)delta + sizeof(*hdr);
+	end = (const uint8_t *)delta + deltasize;
+	while (p < end) {
+		const uint8_t *data;
+		uint64_t off = 0, len;
+		uint8_t op = *p++;
+
+		if (op == 'C') {
+			if (end - p < 16) {
+				rv = EINVAL;
+				goto out;
+			}
+			off = get64(p);
+			len = get64(p + 8);
+			p += 16;
+			if (off > oldsize || len > oldsize - off) {
+				rv = EINVAL;
+				goto out;
+			}
+			data = (const uint8_t *)old + off;
+		} else if (op == 'A') {
+			if (end - p < 8) {
+				rv = EINVAL;
+				goto out;
+			}
+			len = get64(p);
+			p += 8;
+			if (len > (uint64_t)(end - p)) {
+				rv = EINVAL;
+				goto out;
+			}
+			data = p;
+			p += len;
+		} else {
+			rv = EINVAL;
+			goto out;
+		}
+		if (len > newsize - written) {
+			rv = EINVAL;
+			goto out;
+		}
+		SHA256_Update(&ctx, data, len);
+		if (!write_all(fd, data, len)) {
+			rv = errno;
+			goto out;
+		}
+		written += len;
+	}
+	SHA256_Final(digest, &ctx);
+	xbps_counter_add(XBPS_COUNTER_HASH_BYTES, written);
+	if (written != newsize ||
+	    memcmp(digest, hdr->newsha256, sizeof(digest))) {
+		rv = ERANGE;
+		goto out;
+	}
+	if (fchmod(fd, 0644) == -1) {
+		rv = errno;
+		goto out;
+	}
+	rv = close(fd);
+	fd = -1;
+	if (rv == -1) {
+		rv = errno;
+		goto out;
+	}
+	if (rename(tmpfile, newfile) == -1) {
+		rv = errno;
+		goto out;
+	}
+	free(tmpfile);
+	tmpfile = NULL;
+
+out:
+	if (fd != -1)
+		(void)close(fd);
+	if (tmpfile != NULL) {
+		(void)unlink(tmpfile);
+		free(tmpfile);
+	}
+	if (old != NULL)
+		(void)munmap(old, oldmaplen);
+	(void)munmap(delta, deltamaplen);
+
+	return rv;
+}
@@ -30,6 +30,10 @@
  * $FreeBSD: src/usr.bin/fetch/fetch.c,v 1.84.2.1 2009/08/03 08:13:06 kensmith Exp $
  */
 
+#ifdef HAVE_FALLOCATE
+# define _GNU_SOURCE	/* for fallocate(2) */
+#endif
+
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -37,10 +41,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <libgen.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 #include "fetch.h"
@@ -81,6 +88,59 @@ xbps_fetch_unset_cache_connection(void)
 	fetchConnectionCacheClose();
 }
 
+/*
+ * Connections to the servers of a list of URLs are opened in background,
+ * a thread each, and left in the libfetch connection cache for the
+ * requests that follow. Failures are ignored, the requests report them.
+ */
+static pthread_t *warmup_thds;
+static unsigned int warmup_nthds;
+
+static void *
+warmup_thread(void *arg)
+{
+	struct url *url = arg;
+
+	(void)fetchConnectHTTP(url, NULL);
+	fetchFreeURL(url);
+	return NULL;
+}
+
+void HIDDEN
+xbps_fetch_warmup(struct xbps_handle *xhp, const char **uris, unsigned int n)
+{
+	struct url *url;
+
+	xbps_fetch_warmup_wait();
+	if (n == 0 || (warmup_thds = calloc(n, sizeof(*warmup_thds))) == NULL)
+		return;
+
+	for (unsigned int i = 0; i < n; i++) {
+		if ((url = fetchParseURL(uris[i])) == NULL)
+			continue;
+		if ((strcasecmp(url->scheme, SCHEME_HTTP) != 0 &&
+		    strcasecmp(url->scheme, SCHEME_HTTPS) != 0) ||
+		    pthread_create(&warmup_thds[warmup_nthds], NULL,
+		    warmup_thread, url) != 0) {
+			fetchFreeURL(url);
+			continue;
+		}
+		warmup_nthds++;
+	}
+	xbps_dbg_printf(xhp, "[fetch] opening %u connections in background\n",
+	    warmup_nthds);
+}
+
+void HIDDEN
+xbps_fetch_warmup_wait(void)
+{
+	for (unsigned int i = 0; i < warmup_nthds; i++)
+		pthread_join(warmup_thds[i], NULL);
+	free(warmup_thds);
+	warmup_thds = NULL;
+	warmup_nthds = 0;
+}
+
 const char *
 xbps_fetch_error_string(void)
 {
@@ -90,74 +150,442 @@ xbps_fetch_error_string(void)
 	return fetchLastErrString;
 }
 
-int
-xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filename, const char *flags)
+/*
+ * Downloaded data is read in chunks of FETCH_READSIZE and written once
+ * the buffer (xhp->fetch_bufsize) is full; the progress callback is
+ * called for the first chunk, at most every FETCH_PROGRESS_MS and when
+ * the transfer ends.
+ */
+#define FETCH_READSIZE		(16 * 1024)
+#define FETCH_BUFSIZE_MIN	4096
+#define FETCH_PROGRESS_MS	100
+
+static bool
+write_all(int fd, const char *buf, size_t len)
 {
-	struct stat st, st_tmpfile, *stp;
-	struct url *url = NULL;
-	struct url_stat url_st;
-	struct fetchIO *fio = NULL;
-	struct timespec ts[2];
-	off_t bytes_dload = 0;
-	ssize_t bytes_read = 0, bytes_written = 0;
-	char buf[4096], *tempfile = NULL;
-	char fetch_flags[8];
-	int fd = -1, rv = 0;
-	bool refetch = false, restart = false;
+	ssize_t n;
 
-	assert(xhp);
-	assert(uri);
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
 
-	/* Extern vars declared in libfetch */
-	fetchLastErrCode = 0;
+static bool
+pwrite_all(int fd, const char *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = pwrite(fd, buf, len, off)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= (size_t)n;
+		off += n;
+	}
+	return true;
+}
+
+static bool
+progress_due(struct timespec *last)
+{
+	struct timespec now;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	if ((now.tv_sec - last->tv_sec) * 1000 +
+	    (now.tv_nsec - last->tv_nsec) / 1000000 < FETCH_PROGRESS_MS)
+		return false;
 
-	if (!filename || (url = fetchParseURL(uri)) == NULL)
+	*last = now;
+	return true;
+}
+
+/*
+ * A file to be fetched from \a url into \a filename, \a cbname is the
+ * file name passed to the fetch callback.
+ */
+struct fetch_file {
+	struct url *url;
+	struct stat st;
+	struct stat st_tmpfile;
+	struct stat *stp;
+	char *filename;
+	char *tempfile;
+	const char *cbname;
+	char flags[8];
+	bool restart;
+	bool segmented;
+};
+
+/*
+ * Large files are fetched with up to xhp->fetch_segments concurrent
+ * requests for byte ranges of at least FETCH_SEGMENT_MIN bytes, written
+ * in place into the temporary file.  The first range is read from the
+ * reply to the GET request for the whole file.  The start and the bytes
+ * stored of every segment are recorded in the segments file (.part.seg),
+ * so that an interrupted transfer is resumed after the data stored
+ * in order.
+ */
+#define FETCH_SEGMENT_MIN	(16 * 1024 * 1024)
+
+struct fetch_segments {
+	struct xbps_handle *xhp;
+	struct url *url;
+	const char *flags;
+	size_t bufsize;
+	int fd;
+	int sfd;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	unsigned int running;
+	off_t done;
+};
+
+struct fetch_segment {
+	struct fetch_segments *fs;
+	struct fetchIO *fio;
+	pthread_t thd;
+	unsigned int idx;
+	off_t start;
+	off_t len;
+	off_t done;
+	bool thd_started;
+};
+
+static void
+fetch_segment_record(struct fetch_segment *seg)
+{
+	off_t rec[2] = { seg->start, seg->done };
+
+	if (seg->fs->sfd != -1)
+		(void)pwrite(seg->fs->sfd, rec, sizeof(rec),
+		    (off_t)(seg->idx * sizeof(rec)));
+}
+
+/*
+ * Truncates the temporary file of an interrupted segmented transfer
+ * to the data stored in order, as recorded in its segments file.
+ */
+static void
+fetch_segments_recover(const char *tempfile)
+{
+	off_t rec[2], end = -1;
+	char *segfile;
+	int fd;
+
+	segfile = xbps_xasprintf("%s.seg", tempfile);
+	if ((fd = open(segfile, O_RDONLY|O_CLOEXEC)) == -1) {
+		free(segfile);
+		return;
+	}
+	while (read(fd, rec, sizeof(rec)) == (ssize_t)sizeof(rec)) {
+		/* the previous segment is incomplete */
+		if (end != -1 && rec[0] != end)
+			break;
+		end = rec[0] + rec[1];
+	}
+	(void)close(fd);
+	if (end != -1)
+		(void)truncate(tempfile, end);
+	(void)unlink(segfile);
+	free(segfile);
+}
+
+/*
+ * Checks whether the transfer of \a uri into \a filename has to be
+ * resumed or refetched, setting up the request for it.
+ */
+static int
+fetch_file_init(struct fetch_file *ff, const char *uri, const char *filename,
+		const char *cbname, const char *flags)
+{
+	bool refetch = false;
+
+	assert(uri);
+
+	memset(ff, 0, sizeof(*ff));
+	if (!filename || (ff->url = fetchParseURL(uri)) == NULL)
 		return -1;
 
-	memset(&fetch_flags, 0, sizeof(fetch_flags));
 	if (flags != NULL)
-		xbps_strlcpy(fetch_flags, flags, 7);
+		xbps_strlcpy(ff->flags, flags, 7);
 
-	tempfile = xbps_xasprintf("%s.part", filename);
+	ff->filename = strdup(filename);
+	assert(ff->filename);
+	ff->tempfile = xbps_xasprintf("%s.part", filename);
+	ff->cbname = cbname;
 	/*
 	 * Check if we have to resume a transfer.
 	 */
-	memset(&st_tmpfile, 0, sizeof(st_tmpfile));
-	if (stat(tempfile, &st_tmpfile) == 0) {
-		if (st_tmpfile.st_size > 0)
-			restart = true;
+	fetch_segments_recover(ff->tempfile);
+	if (stat(ff->tempfile, &ff->st_tmpfile) == 0) {
+		if (ff->st_tmpfile.st_size > 0)
+			ff->restart = true;
 	} else {
-		if (errno != ENOENT) {
-			rv = -1;
-			goto fetch_file_out;
-		}
+		if (errno != ENOENT)
+			return -1;
+		memset(&ff->st_tmpfile, 0, sizeof(ff->st_tmpfile));
 	}
 	/*
 	 * Check if we have to refetch a transfer.
 	 */
-	memset(&st, 0, sizeof(st));
-	if (stat(filename, &st) == 0) {
+	if (stat(filename, &ff->st) == 0) {
 		refetch = true;
-		url->last_modified = st.st_mtime;
-		xbps_strlcat(fetch_flags, "i", sizeof(fetch_flags));
+		ff->url->last_modified = ff->st.st_mtime;
+		xbps_strlcat(ff->flags, "i", sizeof(ff->flags));
 	} else {
-		if (errno != ENOENT) {
-			rv = -1;
-			goto fetch_file_out;
-		}
+		if (errno != ENOENT)
+			return -1;
+		memset(&ff->st, 0, sizeof(ff->st));
 	}
-	if (refetch && !restart) {
+	if (refetch && !ff->restart) {
 		/* fetch the whole file, filename available */
-		stp = &st;
+		ff->stp = &ff->st;
 	} else {
 		/* resume transfer, partial file found */
-		stp = &st_tmpfile;
-		url->offset = stp->st_size;
+		ff->stp = &ff->st_tmpfile;
+		ff->url->offset = ff->stp->st_size;
+	}
+	return 0;
+}
+
+static void
+fetch_file_free(struct fetch_file *ff)
+{
+	if (ff->url != NULL)
+		fetchFreeURL(ff->url);
+	free(ff->filename);
+	free(ff->tempfile);
+}
+
+static unsigned int
+fetch_nsegments(struct xbps_handle *xhp, struct fetch_file *ff, off_t size)
+{
+	struct url *url = ff->url;
+	off_t nsegs;
+
+	if (!ff->segmented || xhp->fetch_segments < 2 || size == -1)
+		return 0;
+	if (strcmp(url->scheme, SCHEME_HTTP) != 0 &&
+	    strcmp(url->scheme, SCHEME_HTTPS) != 0)
+		return 0;
+
+	nsegs = (size - url->offset) / FETCH_SEGMENT_MIN;
+	if (nsegs > xhp->fetch_segments)
+		nsegs = xhp->fetch_segments;
+
+	return nsegs < 2 ? 0 : (unsigned int)nsegs;
+}
+
+static void *
+fetch_segment_thread(void *arg)
+{
+	struct fetch_segment *seg = arg;
+	struct fetch_segments *fs = seg->fs;
+	struct url *url = NULL;
+	struct url_stat url_st;
+	struct fetchIO *fio = seg->fio;
+	ssize_t bytes_read;
+	size_t len = 0, rlen;
+	char *buf;
+
+	if ((buf = malloc(fs->bufsize)) == NULL)
+		goto out;
+	if (fio == NULL) {
+		if ((url = fetchCopyURL(fs->url)) == NULL)
+			goto out;
+		url->offset = seg->start;
+		url->length = (size_t)seg->len;
+		memset(&url_st, 0, sizeof(url_st));
+		if ((fio = fetchXGet(url, &url_st, fs->flags)) == NULL) {
+			xbps_dbg_printf(fs->xhp, "failed to fetch range at "
+			    "%zd: %s\n", (ssize_t)seg->start,
+			    fetchLastErrString);
+			goto out;
+		}
+		/* the server might not support ranges */
+		if (url->offset != seg->start ||
+		    (off_t)url->length != seg->len) {
+			xbps_dbg_printf(fs->xhp, "range at %zd not "
+			    "satisfied\n", (ssize_t)seg->start);
+			goto out;
+		}
+	}
+	for (;;) {
+		rlen = MIN(fs->bufsize - len, FETCH_READSIZE);
+		if ((off_t)rlen > seg->len - seg->done - (off_t)len)
+			rlen = (size_t)(seg->len - seg->done - (off_t)len);
+		if (rlen == 0)
+			bytes_read = 0;
+		else if ((bytes_read = fetchIO_read(fio, buf + len, rlen)) > 0) {
+			len += (size_t)bytes_read;
+			xbps_counter_add(XBPS_COUNTER_FETCH_BYTES, bytes_read);
+		}
+
+		if (len == fs->bufsize || (bytes_read <= 0 && len > 0)) {
+			if (!pwrite_all(fs->fd, buf, len,
+			    seg->start + seg->done)) {
+				xbps_dbg_printf(fs->xhp, "failed to write "
+				    "range at %zd: %s\n",
+				    (ssize_t)seg->start, strerror(errno));
+				break;
+			}
+			pthread_mutex_lock(&fs->mtx);
+			seg->done += (off_t)len;
+			fs->done += (off_t)len;
+			pthread_mutex_unlock(&fs->mtx);
+			fetch_segment_record(seg);
+			len = 0;
+		}
+		if (bytes_read <= 0)
+			break;
+	}
+out:
+	if (fio != NULL)
+		fetchIO_close(fio);
+	if (url != NULL)
+		fetchFreeURL(url);
+	free(buf);
+
+	pthread_mutex_lock(&fs->mtx);
+	fs->running--;
+	pthread_cond_signal(&fs->cond);
+	pthread_mutex_unlock(&fs->mtx);
+
+	return NULL;
+}
+
+/*
+ * Fetches the rest of the file of \a size bytes for \a ff, from its
+ * offset, in \a nsegs segments into \a fd and closes \a fio.
+ * Returns the number of bytes stored in order from the offset, which
+ * is less than the rest of the file if a segment couldn't be fetched.
+ */
+static off_t
+fetch_file_segments(struct xbps_handle *xhp, struct fetch_file *ff,
+		struct fetchIO *fio, int fd, off_t size, size_t bufsize,
+		unsigned int nsegs)
+{
+	struct fetch_segments fs;
+	struct fetch_segment *segs;
+	struct timespec ts;
+	off_t offset = ff->url->offset, seglen, done = 0, dload;
+	char *segfile;
+
+	segs = calloc(nsegs, sizeof(*segs));
+	assert(segs);
+	segfile = xbps_xasprintf("%s.seg", ff->tempfile);
+
+	memset(&fs, 0, sizeof(fs));
+	fs.xhp = xhp;
+	fs.url = ff->url;
+	fs.flags = ff->flags;
+	fs.bufsize = bufsize;
+	fs.fd = fd;
+	fs.sfd = open(segfile, O_WRONLY|O_CREAT|O_CLOEXEC|O_TRUNC, 0644);
+	fs.running = nsegs;
+	pthread_mutex_init(&fs.mtx, NULL);
+	pthread_cond_init(&fs.cond, NULL);
+
+	xbps_dbg_printf(xhp, "fetching %s in %u segments\n",
+	    ff->cbname, nsegs);
+
+	seglen = (size - offset) / nsegs;
+	for (unsigned int i = 0; i < nsegs; i++) {
+		segs[i].fs = &fs;
+		segs[i].idx = i;
+		segs[i].start = offset + i * seglen;
+		segs[i].len = seglen;
+		fetch_segment_record(&segs[i]);
+	}
+	segs[nsegs - 1].len = size - segs[nsegs - 1].start;
+	segs[0].fio = fio;
+
+	for (unsigned int i = 0; i < nsegs; i++) {
+		if (pthread_create(&segs[i].thd, NULL,
+		    fetch_segment_thread, &segs[i]) == 0) {
+			segs[i].thd_started = true;
+			continue;
+		}
+		if (segs[i].fio != NULL)
+			fetchIO_close(segs[i].fio);
+		pthread_mutex_lock(&fs.mtx);
+		fs.running--;
+		pthread_mutex_unlock(&fs.mtx);
 	}
 	/*
-	 * Issue a GET request.
+	 * Report the progress of all segments until they are done.
 	 */
-	fio = fetchXGet(url, &url_st, fetch_flags);
+	pthread_mutex_lock(&fs.mtx);
+	while (fs.running > 0) {
+		(void)clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += FETCH_PROGRESS_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		(void)pthread_cond_timedwait(&fs.cond, &fs.mtx, &ts);
+		dload = fs.done;
+		pthread_mutex_unlock(&fs.mtx);
+		if (dload > 0)
+			xbps_set_cb_fetch(xhp, size, offset, offset + dload,
+			    ff->cbname, false, true, false);
+		pthread_mutex_lock(&fs.mtx);
+	}
+	pthread_mutex_unlock(&fs.mtx);
+
+	for (unsigned int i = 0; i < nsegs; i++) {
+		if (segs[i].thd_started)
+			pthread_join(segs[i].thd, NULL);
+	}
+	for (unsigned int i = 0; i < nsegs; i++) {
+		done += segs[i].done;
+		if (segs[i].done != segs[i].len)
+			break;
+	}
+	/* the caller truncates the file to the data stored in order */
+	if (fs.sfd != -1) {
+		(void)close(fs.sfd);
+		(void)unlink(segfile);
+	}
+	free(segfile);
+	pthread_mutex_destroy(&fs.mtx);
+	pthread_cond_destroy(&fs.cond);
+	free(segs);
+
+	return done;
+}
+
+/*
+ * Stores the file read from \a fio, the result of the GET request
+ * for \a ff, and closes it.
+ */
+static int
+fetch_file_get(struct xbps_handle *xhp, struct fetch_file *ff,
+		struct fetchIO *fio, struct url_stat *urlstp)
+{
+	struct url *url = ff->url;
+	struct url_stat url_st = *urlstp;
+	struct stat *stp = ff->stp;
+	struct timespec ts[2], last = { 0, 0 };
+	const char *filename = ff->filename, *tempfile = ff->tempfile;
+	const char *cbname = ff->cbname;
+	off_t bytes_dload = 0;
+	ssize_t bytes_read = 0;
+	size_t bufsize, len = 0;
+	char *buf = NULL;
+	unsigned int nsegs;
+	int fd = -1, rv = 0;
+	bool restart = ff->restart;
 
 	/* debug stuff */
 	xbps_dbg_printf(xhp, "st.st_size: %zd\n", (ssize_t)stp->st_size);
@@ -201,43 +629,102 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 	xbps_dbg_printf(xhp, "url->last_modified: %s\n",
 	    print_time(&url->last_modified));
 	/*
-	 * If restarting, open the file for appending otherwise create it.
+	 * If restarting, open the file to write from the offset the server
+	 * replied with, otherwise create it.  Not appending to it lets
+	 * segments be written in place.
 	 */
 	if (restart)
-		fd = open(tempfile, O_WRONLY|O_APPEND|O_CLOEXEC);
+		fd = open(tempfile, O_WRONLY|O_CLOEXEC);
 	else
 		fd = open(tempfile, O_WRONLY|O_CREAT|O_CLOEXEC|O_TRUNC, 0644);
 
-	if (fd == -1) {
+	if (fd == -1 || lseek(fd, url->offset, SEEK_SET) == -1) {
+		rv = -1;
+		goto fetch_file_out;
+	}
+	bufsize = xhp->fetch_bufsize;
+	if (bufsize < FETCH_BUFSIZE_MIN)
+		bufsize = XBPS_FETCH_BUFSIZE;
+	if ((buf = malloc(bufsize)) == NULL) {
 		rv = -1;
 		goto fetch_file_out;
 	}
+#ifdef HAVE_FALLOCATE
+	/*
+	 * Reserve the space for the rest of the file, without changing
+	 * its size so that an interrupted transfer can be resumed.
+	 */
+	if (url_st.size > url->offset)
+		(void)fallocate(fd, FALLOC_FL_KEEP_SIZE, url->offset,
+		    url_st.size - url->offset);
+#endif
 	/*
 	 * Initialize data for the fetch progress function callback
 	 * and let the user know that the transfer is going to start
 	 * immediately.
 	 */
 	xbps_set_cb_fetch(xhp, url_st.size, url->offset, url->offset,
-	    filename, true, false, false);
+	    cbname, true, false, false);
 	/*
-	 * Start fetching requested file.
+	 * Fetch large files in segments; if any of them failed, resume
+	 * the transfer after the data stored in order.
 	 */
-	while ((bytes_read = fetchIO_read(fio, buf, sizeof(buf))) > 0) {
-		bytes_written = write(fd, buf, (size_t)bytes_read);
-		if (bytes_written != bytes_read) {
-			xbps_dbg_printf(xhp,
-			    "Couldn't write to %s!\n", tempfile);
+	if ((nsegs = fetch_nsegments(xhp, ff, url_st.size)) > 0) {
+		bytes_dload = fetch_file_segments(xhp, ff, fio, fd,
+		    url_st.size, bufsize, nsegs);
+		fio = NULL;
+		if (url->offset + bytes_dload == url_st.size)
+			goto fetch_file_done;
+
+		url->offset += bytes_dload;
+		url->length = 0;
+		bytes_dload = 0;
+		xbps_dbg_printf(xhp, "resuming %s at %zd\n", filename,
+		    (ssize_t)url->offset);
+		if ((fio = fetchXGet(url, &url_st, ff->flags)) == NULL ||
+		    ftruncate(fd, url->offset) == -1 ||
+		    lseek(fd, url->offset, SEEK_SET) == -1) {
+			if (fio == NULL)
+				errno = EIO;
 			rv = -1;
 			goto fetch_file_out;
 		}
-		bytes_dload += bytes_read;
+	}
+	/*
+	 * Start fetching requested file.
+	 */
+	for (;;) {
+		bytes_read = fetchIO_read(fio, buf + len,
+		    MIN(bufsize - len, FETCH_READSIZE));
+		if (bytes_read > 0) {
+			len += (size_t)bytes_read;
+			bytes_dload += bytes_read;
+			xbps_counter_add(XBPS_COUNTER_FETCH_BYTES, bytes_read);
+		}
+		/*
+		 * Write what has been read when the buffer is full or the
+		 * transfer ended, also on errors to resume it later.
+		 */
+		if (len == bufsize || (bytes_read <= 0 && len > 0)) {
+			if (!write_all(fd, buf, len)) {
+				xbps_dbg_printf(xhp,
+				    "Couldn't write to %s!\n", tempfile);
+				rv = -1;
+				goto fetch_file_out;
+			}
+			len = 0;
+		}
 		/*
 		 * Let the fetch progress callback know that
 		 * we are sucking more bytes from it.
 		 */
-		xbps_set_cb_fetch(xhp, url_st.size, url->offset,
-		    url->offset + bytes_dload,
-		    filename, false, true, false);
+		if ((bytes_read == 0 && bytes_dload > 0) ||
+		    (bytes_read > 0 && progress_due(&last)))
+			xbps_set_cb_fetch(xhp, url_st.size, url->offset,
+			    url->offset + bytes_dload,
+			    cbname, false, true, false);
+		if (bytes_read <= 0)
+			break;
 	}
 	if (bytes_read == -1) {
 		xbps_dbg_printf(xhp, "IO error while fetching %s: %s\n",
@@ -252,12 +739,13 @@ xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filen
 		goto fetch_file_out;
 	}
 
+fetch_file_done:
 	/*
 	 * Let the fetch progress callback know that the file
 	 * has been fetched.
 	 */
 	xbps_set_cb_fetch(xhp, url_st.size, url->offset, bytes_dload,
-	    filename, false, false, true);
+	    cbname, false, false, true);
 
 	/*
 	 * Update mtime in local file to match remote file if transfer
@@ -288,14 +776,226 @@ fetch_file_out:
 		fetchIO_close(fio);
 	if (fd != -1)
 		(void)close(fd);
-	if (url != NULL)
-		fetchFreeURL(url);
 
-	free(tempfile);
+	free(buf);
+
+	return rv;
+}
+
+/*
+ * The entity tag of a file is kept in a file of the same name plus
+ * ".etag", to fetch it with If-None-Match.
+ */
+static void
+fetch_file_etag_read(struct fetch_file *ff)
+{
+	char *etagfile;
+	ssize_t len;
+	int fd;
+
+	/* without the file there's nothing to compare with */
+	if (ff->st.st_nlink == 0)
+		return;
+
+	etagfile = xbps_xasprintf("%s.etag", ff->filename);
+	if ((fd = open(etagfile, O_RDONLY|O_CLOEXEC)) != -1) {
+		len = read(fd, ff->url->etag, URL_ETAGLEN);
+		while (len > 0 && ff->url->etag[len - 1] == '\n')
+			len--;
+		ff->url->etag[len > 0 ? len : 0] = '\0';
+		(void)close(fd);
+	}
+	free(etagfile);
+}
+
+static void
+fetch_file_etag_write(struct xbps_handle *xhp, struct fetch_file *ff,
+		const char *etag)
+{
+	char *etagfile;
+	int fd;
+
+	etagfile = xbps_xasprintf("%s.etag", ff->filename);
+	if (*etag == '\0') {
+		(void)unlink(etagfile);
+	} else if ((fd = open(etagfile,
+	    O_WRONLY|O_CREAT|O_CLOEXEC|O_TRUNC, 0644)) != -1) {
+		if (!write_all(fd, etag, strlen(etag)) ||
+		    !write_all(fd, "\n", 1)) {
+			xbps_dbg_printf(xhp, "Couldn't write to %s!\n",
+			    etagfile);
+			(void)close(fd);
+			(void)unlink(etagfile);
+		} else {
+			(void)close(fd);
+		}
+	}
+	free(etagfile);
+}
+
+/*
+ * Fetches \a uri into \a filename, \a cbname is the file name passed
+ * to the fetch callback.  If \a etag is set, the entity tag of the file
+ * is kept to fetch it conditionally.
+ */
+static int
+fetch_file(struct xbps_handle *xhp, const char *uri, const char *filename,
+		const char *cbname, const char *flags, bool etag)
+{
+	struct fetch_file ff;
+	struct url_stat url_st;
+	struct fetchIO *fio;
+	uint64_t start;
+	int rv = -1;
+
+	assert(xhp);
+
+	/* Extern vars declared in libfetch */
+	fetchLastErrCode = 0;
+	start = xbps_trace_begin();
+
+	if (fetch_file_init(&ff, uri, filename, cbname, flags) == 0) {
+		ff.segmented = true;
+		if (etag)
+			fetch_file_etag_read(&ff);
+		/*
+		 * Issue a GET request.
+		 */
+		memset(&url_st, 0, sizeof(url_st));
+		fio = fetchXGet(ff.url, &url_st, ff.flags);
+		rv = fetch_file_get(xhp, &ff, fio, &url_st);
+		if (etag && rv == 1)
+			fetch_file_etag_write(xhp, &ff, url_st.etag);
+	}
+	fetch_file_free(&ff);
+	xbps_trace_end(start, "fetch", "fetch", uri);
+
+	return rv;
+}
+
+/*
+ * Fetches the \a n files in \a uris into \a dir, the GET requests for
+ * files on the same server are pipelined over a single connection.
+ * Returns the number of files that couldn't be fetched.
+ */
+unsigned int HIDDEN
+xbps_fetch_files_in(struct xbps_handle *xhp, const char **uris,
+		unsigned int n, const char *dir, const char *flags)
+{
+	struct fetch_file *ff;
+	struct url_stat url_st;
+	struct url **urls;
+	struct fetchIO *fio;
+	fetchPipeline *p;
+	const char *filename;
+	char *path;
+	uint64_t start;
+	unsigned int nfiles = 0, failed = 0;
+
+	assert(xhp);
+
+	if (n == 0)
+		return 0;
+
+	ff = calloc(n, sizeof(*ff));
+	urls = calloc(n, sizeof(*urls));
+	assert(ff && urls);
+
+	for (unsigned int i = 0; i < n; i++) {
+		if ((filename = strrchr(uris[i], '/')) == NULL) {
+			failed++;
+			continue;
+		}
+		filename++;
+		path = xbps_xasprintf("%s/%s", dir, filename);
+		if (fetch_file_init(&ff[nfiles], uris[i], path, filename,
+		    flags) == -1) {
+			xbps_dbg_printf(xhp, "failed to fetch %s: %s\n",
+			    uris[i], strerror(errno));
+			fetch_file_free(&ff[nfiles]);
+			failed++;
+		} else {
+			urls[nfiles] = ff[nfiles].url;
+			nfiles++;
+		}
+		free(path);
+	}
+
+	p = fetchPipelineHTTP(urls, nfiles, flags);
+	for (unsigned int i = 0; i < nfiles; i++) {
+		fetchLastErrCode = 0;
+		start = xbps_trace_begin();
+		memset(&url_st, 0, sizeof(url_st));
+		if (p != NULL)
+			fio = fetchPipelineNext(p, &url_st);
+		else
+			fio = fetchXGet(ff[i].url, &url_st, ff[i].flags);
+		if (fetch_file_get(xhp, &ff[i], fio, &url_st) == -1) {
+			xbps_dbg_printf(xhp, "failed to fetch %s: %s\n",
+			    ff[i].filename, xbps_fetch_error_string() ?
+			    xbps_fetch_error_string() : strerror(errno));
+			failed++;
+		}
+		xbps_trace_end(start, "fetch", "fetch", ff[i].filename);
+		fetch_file_free(&ff[i]);
+	}
+	fetchPipelineClose(p);
+
+	free(urls);
+	free(ff);
+
+	return failed;
+}
+
+int
+xbps_fetch_file_dest(struct xbps_handle *xhp, const char *uri, const char *filename, const char *flags)
+{
+	return fetch_file(xhp, uri, filename, filename, flags, false);
+}
+
+static int
+fetch_file_in(struct xbps_handle *xhp, const char *uri, const char *dir,
+		const char *flags, bool etag)
+{
+	const char *filename;
+	char *path;
+	int rv;
+
+	if ((filename = strrchr(uri, '/')) == NULL)
+		return -1;
+
+	filename++;
+	path = xbps_xasprintf("%s/%s", dir, filename);
+	rv = fetch_file(xhp, uri, path, filename, flags, etag);
+	free(path);
 
 	return rv;
 }
 
+/*
+ * Like xbps_fetch_file() but stores the file in \a dir rather than in
+ * the current working directory, so that it can be used concurrently.
+ */
+int HIDDEN
+xbps_fetch_file_in(struct xbps_handle *xhp, const char *uri, const char *dir,
+		const char *flags)
+{
+	return fetch_file_in(xhp, uri, dir, flags, false);
+}
+
+/*
+ * Like xbps_fetch_file_in() but keeps the entity tag sent by the server
+ * in a file next to it, so that the next time it's requested with
+ * If-None-Match and only fetched if it changed.  This doesn't depend
+ * on the server preserving its Last-Modified time.
+ */
+int HIDDEN
+xbps_fetch_file_in_etag(struct xbps_handle *xhp, const char *uri,
+		const char *dir, const char *flags)
+{
+	return fetch_file_in(xhp, uri, dir, flags, true);
+}
+
 int
 xbps_fetch_file(struct xbps_handle *xhp, const char *uri, const char *flags)
 {
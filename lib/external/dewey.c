@@ -35,14 +35,10 @@
 #undef _BSD_SOURCE
 #include <strings.h>
 #include <ctype.h>
+#include <fnmatch.h>
 
 #include "xbps_api_impl.h"
 
-#define PKG_PATTERN_MAX 1024
-
-#ifndef MIN
-#define MIN(a,b)	(((a) < (b)) ? (a) : (b))
-#endif
 #ifndef MAX
 #define MAX(a,b)	(((a) > (b)) ? (a) : (b))
 #endif
@@ -65,12 +61,15 @@ enum {
         Patch = 1
 };
 
+#define ARR_INLINE	16
+
 /* this struct defines a version number */
 typedef struct arr_t {
 	unsigned	c;              /* # of version numbers */
 	unsigned	size;           /* size of array */
 	int	       *v;              /* array of decimal numbers */
 	int		revision;       /* any "_" suffix */
+	int		inl[ARR_INLINE]; /* v unless it's larger */
 } arr_t;
 
 /* this struct describes a test */
@@ -119,8 +118,24 @@ dewey_mktest(int *op, const char *test)
 	return -1;
 }
 
+/* grow the array of version numbers, out of the inline one */
+static void
+growversion(arr_t *ap)
+{
+	if (ap->v == ap->inl) {
+		ap->v = malloc(ap->size * 2 * sizeof(int));
+		assert(ap->v != NULL);
+		memcpy(ap->v, ap->inl, ap->size * sizeof(int));
+	} else {
+		ap->v = realloc(ap->v, ap->size * 2 * sizeof(int));
+		assert(ap->v != NULL);
+	}
+	ap->size *= 2;
+}
+
 /*
- * make a component of a version number.
+ * decode a component of a version number into v, returns the number
+ * of values stored (up to 2) and advances *nump past it.
  * '.' encodes as Dot which is '0'
  * 'pl' encodes as 'patch level', or 'Dot', which is 0.
  * 'alpha' encodes as 'alpha version', or Alpha, which is -3.
@@ -129,68 +144,74 @@ dewey_mktest(int *op, const char *test)
  * '_' encodes as 'xbps revision', which is used after all other tests
  */
 static int
-mkcomponent(arr_t *ap, const char *num)
+nextcomponent(const char **nump, int v[2], int *revision)
 {
 	static const char       alphas[] = "abcdefghijklmnopqrstuvwxyz";
 	const test_t	       *modp;
+	const char             *num = *nump;
 	int                 n;
-	const char             *cp;
-
-	if (ap->c == ap->size) {
-		if (ap->size == 0) {
-			ap->size = 62;
-			ap->v = malloc(ap->size * sizeof(int));
-			assert(ap->v != NULL);
-		} else {
-			ap->size *= 2;
-			ap->v = realloc(ap->v, ap->size * sizeof(int));
-			assert(ap->v != NULL);
-		}
-	}
+
 	if (isdigit((unsigned char)*num)) {
-		for (cp = num, n = 0 ; isdigit((unsigned char)*num) ; num++) {
+		for (n = 0 ; isdigit((unsigned char)*num) ; num++) {
 			n = (n * 10) + (*num - '0');
 		}
-		ap->v[ap->c++] = n;
-		return (int)(num - cp);
+		*nump = num;
+		v[0] = n;
+		return 1;
 	}
 	for (modp = modifiers ; modp->s ; modp++) {
 		if (strncasecmp(num, modp->s, modp->len) == 0) {
-			ap->v[ap->c++] = modp->t;
-			return modp->len;
+			*nump = num + modp->len;
+			v[0] = modp->t;
+			return 1;
 		}
 	}
-	if (strncasecmp(num, "_", 1) == 0) {
-		for (cp = num, num += 1, n = 0 ; isdigit((unsigned char)*num) ; num++) {
+	if (*num == '_') {
+		for (num += 1, n = 0 ; isdigit((unsigned char)*num) ; num++) {
 			n = (n * 10) + (*num - '0');
 		}
-		ap->revision = n;
-		return (int)(num - cp);
+		*nump = num;
+		*revision = n;
+		return 0;
 	}
+	*nump = num + 1;
 	if (isalpha((unsigned char)*num)) {
-		ap->v[ap->c++] = Dot;
-		cp = strchr(alphas, tolower((unsigned char)*num));
-		if (ap->c == ap->size) {
-			ap->size *= 2;
-			ap->v = realloc(ap->v, ap->size * sizeof(int));
-			assert(ap->v != NULL);
-		}
-		ap->v[ap->c++] = (int)(cp - alphas) + 1;
-		return 1;
+		v[0] = Dot;
+		v[1] = (int)(strchr(alphas, tolower((unsigned char)*num)) - alphas) + 1;
+		return 2;
 	}
-	return 1;
+	return 0;
 }
 
-/* make a version number string into an array of comparable ints */
+/* make a component of a version number, see nextcomponent() */
 static int
-mkversion(arr_t *ap, const char *num)
+mkcomponent(arr_t *ap, const char *num)
+{
+	const char *cp = num;
+	int v[2], n;
+
+	n = nextcomponent(&num, v, &ap->revision);
+	for (int i = 0; i < n; i++) {
+		if (ap->c == ap->size)
+			growversion(ap);
+		ap->v[ap->c++] = v[i];
+	}
+	return (int)(num - cp);
+}
+
+/*
+ * make a version number string into an array of comparable ints,
+ * up to end if it's set.
+ */
+static int
+mkversion(arr_t *ap, const char *num, const char *end)
 {
 	ap->c = 0;
-	ap->size = 0;
-	ap->v = NULL;
+	ap->size = ARR_INLINE;
+	ap->v = ap->inl;
 	ap->revision = 0;
 
-	while (*num) {
+	while (*num && (end == NULL || num < end)) {
 		num += mkcomponent(ap, num);
 	}
 	return 1;
@@ -199,12 +220,35 @@ mkversion(arr_t *ap, const char *num)
 static void
 freeversion(arr_t *ap)
 {
-	free(ap->v);
+	if (ap->v != ap->inl)
+		free(ap->v);
 	ap->v = NULL;
 	ap->c = 0;
 	ap->size = 0;
 }
 
+/* iterates over the values of a version number, without storing them */
+typedef struct version_iter_t {
+	const char     *num;
+	int		v[2];           /* decoded values of the component */
+	int		n;              /* # of them in v */
+	int		i;              /* next one to return */
+	int		revision;       /* any "_" suffix */
+} version_iter_t;
+
+static bool
+nextversion(version_iter_t *it, int *v)
+{
+	while (it->i == it->n) {
+		if (*it->num == '\0')
+			return false;
+		it->n = nextcomponent(&it->num, it->v, &it->revision);
+		it->i = 0;
+	}
+	*v = it->v[it->i++];
+	return true;
+}
+
 #define DIGIT(v, c, n) (((n) < (c)) ? v[n] : 0)
 
 /* compare the result against the test we were expecting */
@@ -231,7 +275,7 @@ result(int cmp, int tst)
 
 /* do the test on the 2 vectors */
 static int
-vtest(arr_t *lhs, int tst, arr_t *rhs)
+vtest(const arr_t *lhs, int tst, const arr_t *rhs)
 {
 	int cmp;
 	unsigned int c, i;
@@ -244,28 +288,6 @@ vtest(arr_t *lhs, int tst, arr_t *rhs)
 	return result(lhs->revision - rhs->revision, tst);
 }
 
-/*
- * Compare two dewey decimal numbers.
- */
-static int
-dewey_cmp(const char *lhs, int op, const char *rhs)
-{
-	arr_t	right;
-	arr_t	left;
-	int retval;
-
-	if (!mkversion(&left, lhs))
-		return 0;
-	if (!mkversion(&right, rhs)) {
-		freeversion(&left);
-		return 0;
-	}
-        retval = vtest(&left, op, &right);
-	freeversion(&left);
-	freeversion(&right);
-	return retval;
-}
-
 /*
  * Returns -1, 0 or 1 depending on if the version components of
  * pkg1 is less than, equal to or greater than pkg2. No comparison
@@ -274,70 +296,220 @@ dewey_cmp(const char *lhs, int op, const char *rhs)
 int
 xbps_cmpver(const char *pkg1, const char *pkg2)
 {
-	if (dewey_cmp(pkg1, DEWEY_LT, pkg2))
-		return -1;
-	else if (dewey_cmp(pkg1, DEWEY_GT, pkg2))
-		return 1;
-	else
-		return 0;
+	version_iter_t left = { .num = pkg1 };
+	version_iter_t right = { .num = pkg2 };
+	int lv, rv, cmp;
+	bool lmore, rmore;
+
+	xbps_counter_inc(XBPS_COUNTER_CMPVER);
+
+	/*
+	 * Compare the components as they are decoded, the first one
+	 * that differs decides; the revisions are only known once
+	 * both strings have been decoded entirely.
+	 */
+	for (;;) {
+		lmore = nextversion(&left, &lv);
+		rmore = nextversion(&right, &rv);
+		if (!lmore && !rmore)
+			break;
+		if ((cmp = (lmore ? lv : 0) - (rmore ? rv : 0)) != 0)
+			return cmp < 0 ? -1 : 1;
+	}
+	cmp = left.revision - right.revision;
+	return cmp < 0 ? -1 : cmp > 0;
 }
 
 /*
- * Perform dewey match on "pkg" against "pattern".
- * Return 1 on match, 0 on non-match, -1 on error.
+ * A package pattern with the name and version limits of relational dewey
+ * patterns parsed, so that matching it only parses the version of pkg.
  */
-int HIDDEN
-dewey_match(const char *pattern, const char *pkg)
+enum {
+	PATTERN_EXACT,
+	PATTERN_GLOB,
+	PATTERN_DEWEY,
+	PATTERN_INVALID
+};
+
+struct xbps_pattern {
+	char		*str;		/* owned copy of pattern */
+	char		*pkgname;	/* owned pkgname of pattern or pkgver */
+	const char	*pattern;
+	int		type;
+	size_t		namelen;	/* length of name before operators */
+	int		op;		/* lower limit test */
+	int		op2;		/* upper limit test */
+	bool		upper;
+	arr_t		lower;
+	arr_t		upperv;
+};
+
+static void
+pattern_init(struct xbps_pattern *p, const char *pattern)
 {
-	const char *version;
-	const char *sep, *sep2;
-	int op, op2;
+	const char *sep, *sep2 = NULL;
 	int n;
 
-	/* compare names */
-	if ((version=strrchr(pkg, '-')) == NULL) {
-		return 0;
+	memset(p, 0, sizeof(*p));
+	p->pattern = pattern;
+
+	if ((sep = strpbrk(pattern, "<>")) == NULL) {
+		p->type = strpbrk(pattern, "*?[]") ? PATTERN_GLOB : PATTERN_EXACT;
+		return;
 	}
-	if ((sep = strpbrk(pattern, "<>")) == NULL)
-		return -1;
-	/* compare name lengths */
-	if ((sep-pattern != version-pkg) ||
-	    strncmp(pkg, pattern, (size_t)(version-pkg)) != 0)
-		return 0;
-	version++;
-	
+	p->type = PATTERN_INVALID;
+	p->namelen = (size_t)(sep - pattern);
+
 	/* extract comparison operator */
-        if ((n = dewey_mktest(&op, sep)) < 0) {
-		return 0;
-        }
+	if ((n = dewey_mktest(&p->op, sep)) < 0)
+		return;
 	/* skip operator */
 	sep += n;
 
 	/* if greater than, look for less than */
-	sep2 = NULL;
-	if (op == DEWEY_GT || op == DEWEY_GE) {
+	if (p->op == DEWEY_GT || p->op == DEWEY_GE) {
 		if ((sep2 = strchr(sep, '<')) != NULL) {
-			if ((n = dewey_mktest(&op2, sep2)) < 0) {
-				return 0;
-			}
-			/* compare upper limit */
-			if (!dewey_cmp(version, op2, sep2+n))
-				return 0;
+			if ((n = dewey_mktest(&p->op2, sep2)) < 0)
+				return;
+			mkversion(&p->upperv, sep2 + n, NULL);
+			p->upper = true;
 		}
 	}
+	/* pattern / lower limit */
+	mkversion(&p->lower, sep, sep2);
+	p->type = PATTERN_DEWEY;
+}
 
-	/* compare only pattern / lower limit */
-	if (sep2) {
-		char ver[PKG_PATTERN_MAX];
+static void
+pattern_release(struct xbps_pattern *p)
+{
+	freeversion(&p->lower);
+	freeversion(&p->upperv);
+}
 
-		xbps_strlcpy(ver, sep, MIN((ssize_t)sizeof(ver), sep2-sep+1));
-		if (dewey_cmp(version, op, ver))
-			return 1;
-	} else {
-		if (dewey_cmp(version, op, sep))
-			return 1;
+static int
+pattern_dewey_match(const struct xbps_pattern *p, const char *pkg)
+{
+	const char *version;
+	arr_t	v;
+	int retval;
+
+	if (p->type != PATTERN_DEWEY)
+		return 0;
+
+	/* compare names */
+	if ((version = strrchr(pkg, '-')) == NULL)
+		return 0;
+	/* compare name lengths */
+	if (p->namelen != (size_t)(version-pkg) ||
+	    strncmp(pkg, p->pattern, p->namelen) != 0)
+		return 0;
+	version++;
+
+	mkversion(&v, version, NULL);
+	/* compare upper limit, then pattern / lower limit */
+	retval = (!p->upper || vtest(&v, p->op2, &p->upperv)) &&
+	    vtest(&v, p->op, &p->lower);
+	freeversion(&v);
+
+	return retval;
+}
+
+struct xbps_pattern *
+xbps_pattern_compile(const char *pattern)
+{
+	struct xbps_pattern *p;
+	char *str, *pkgname = NULL;
+	size_t n;
+
+	assert(pattern);
+
+	if ((n = xbps_pkgpattern_name_len(pattern)) == 0)
+		n = xbps_pkg_name_len(pattern);
+	if (n > 0 && (pkgname = strndup(pattern, n)) == NULL)
+		return NULL;
+	if ((p = malloc(sizeof(*p))) == NULL) {
+		free(pkgname);
+		return NULL;
 	}
+	if ((str = strdup(pattern)) == NULL) {
+		free(pkgname);
+		free(p);
+		return NULL;
+	}
+	pattern_init(p, str);
+	p->str = str;
+	p->pkgname = pkgname;
 
-	return 0;
+	return p;
 }
 
+const char *
+xbps_pattern_pkgname(const struct xbps_pattern *p)
+{
+	assert(p);
+	return p->pkgname;
+}
+
+const char HIDDEN *
+xbps_pattern_string(const struct xbps_pattern *p)
+{
+	assert(p);
+	return p->pattern;
+}
+
+int
+xbps_pattern_match_compiled(const struct xbps_pattern *p, const char *pkgver)
+{
+	assert(p);
+	assert(pkgver);
+
+	xbps_counter_inc(XBPS_COUNTER_PKGPATTERN_MATCH);
+
+	/* simple match on "pkg" against "pattern" */
+	if (strcmp(p->pattern, pkgver) == 0)
+		return 1;
+
+	switch (p->type) {
+	case PATTERN_DEWEY:
+		/* perform relational dewey match on version number */
+		return pattern_dewey_match(p, pkgver);
+	case PATTERN_GLOB:
+		/* glob match */
+		return fnmatch(p->pattern, pkgver, FNM_PERIOD) == 0;
+	default:
+		return 0;
+	}
+}
+
+void
+xbps_pattern_free(struct xbps_pattern *p)
+{
+	if (p == NULL)
+		return;
+
+	pattern_release(p);
+	free(p->pkgname);
+	free(p->str);
+	free(p);
+}
+
+/*
+ * Perform dewey match on "pkg" against "pattern".
+ * Return 1 on match, 0 on non-match, -1 on error.
+ */
+int HIDDEN
+dewey_match(const char *pattern, const char *pkg)
+{
+	struct xbps_pattern p;
+	int retval;
+
+	if (strpbrk(pattern, "<>") == NULL)
+		return -1;
+
+	pattern_init(&p, pattern);
+	retval = pattern_dewey_match(&p, pkg);
+	pattern_release(&p);
+
+	return retval;
+}
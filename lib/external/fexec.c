@@ -42,6 +42,31 @@
 #undef _BSD_SOURCE
 #include "xbps_api_impl.h"
 
+static void __attribute__((noreturn))
+child_exec(struct xbps_handle *xhp, const char *file, const char **argv)
+{
+	/*
+	 * If rootdir != / and uid==0 and bin/sh exists,
+	 * change root directory and exec command.
+	 */
+	if (strcmp(xhp->rootdir, "/")) {
+		if ((geteuid() == 0) && (access("bin/sh", X_OK) == 0)) {
+			if (chroot(xhp->rootdir) == -1) {
+				xbps_dbg_printf(xhp, "%s: chroot() "
+				    "failed: %s\n", *argv, strerror(errno));
+				_exit(errno);
+			}
+			if (chdir("/") == -1) {
+				xbps_dbg_printf(xhp, "%s: chdir() "
+				    "failed: %s\n", *argv, strerror(errno));
+				_exit(errno);
+			}
+		}
+	}
+	(void)execv(file, __UNCONST(argv));
+	_exit(errno);
+}
+
 static int
 pfcexec(struct xbps_handle *xhp, const char *file, const char **argv)
 {
@@ -51,26 +76,7 @@ pfcexec(struct xbps_handle *xhp, const char *file, const char **argv)
 	child = vfork();
 	switch (child) {
 	case 0:
-		/*
-		 * If rootdir != / and uid==0 and bin/sh exists,
-		 * change root directory and exec command.
-		 */
-		if (strcmp(xhp->rootdir, "/")) {
-			if ((geteuid() == 0) && (access("bin/sh", X_OK) == 0)) {
-				if (chroot(xhp->rootdir) == -1) {
-					xbps_dbg_printf(xhp, "%s: chroot() "
-					    "failed: %s\n", *argv, strerror(errno));
-					_exit(errno);
-				}
-				if (chdir("/") == -1) {
-					xbps_dbg_printf(xhp, "%s: chdir() "
-					    "failed: %s\n", *argv, strerror(errno));
-					_exit(errno);
-				}
-			}
-		}
-		(void)execv(file, __UNCONST(argv));
-		_exit(errno);
+		child_exec(xhp, file, argv);
 		/* NOTREACHED */
 	case -1:
 		return -1;
@@ -81,23 +87,36 @@ pfcexec(struct xbps_handle *xhp, const char *file, const char **argv)
 			return -1;
 	}
 
-	if (!WIFEXITED(status))
-		return -1;
+	return xbps_file_exec_status(status);
+}
 
-	return WEXITSTATUS(status);
+static pid_t
+pfcspawn(struct xbps_handle *xhp, int outfd, const char *file,
+		const char **argv)
+{
+	pid_t child;
+
+	child = fork();
+	if (child == 0) {
+		if (dup2(outfd, STDOUT_FILENO) == -1 ||
+		    dup2(outfd, STDERR_FILENO) == -1)
+			_exit(errno);
+		child_exec(xhp, file, argv);
+		/* NOTREACHED */
+	}
+	return child;
 }
 
-static int
-vfcexec(struct xbps_handle *xhp, const char *arg, va_list ap)
+static const char **
+vfcargv(const char *arg, va_list ap)
 {
 	const char **argv;
 	size_t argv_size, argc;
-	int retval;
 
 	argv_size = 16;
 	if ((argv = malloc(argv_size * sizeof(*argv))) == NULL) {
 		errno = ENOMEM;
-		return -1;
+		return NULL;
 	}
 
 	argv[0] = arg;
@@ -109,7 +128,7 @@ vfcexec(struct xbps_handle *xhp, const char *arg, va_list ap)
 			argv = realloc(argv, argv_size * sizeof(*argv));
 			if (argv == NULL) {
 				errno = ENOMEM;
-				return -1;
+				return NULL;
 			}
 		}
 
@@ -118,21 +137,64 @@ vfcexec(struct xbps_handle *xhp, const char *arg, va_list ap)
 
 	} while (arg != NULL);
 
-	retval = pfcexec(xhp, argv[0], argv);
-	free(argv);
+	return argv;
+}
 
-	return retval;
+int HIDDEN
+xbps_file_exec_status(int status)
+{
+	if (!WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
 }
 
 int HIDDEN
 xbps_file_exec(struct xbps_handle *xhp, const char *arg, ...)
 {
 	va_list	ap;
+	const char **argv;
 	int	result;
 
 	va_start(ap, arg);
-	result = vfcexec(xhp, arg, ap);
+	argv = vfcargv(arg, ap);
 	va_end(ap);
+	if (argv == NULL)
+		return -1;
+
+	result = pfcexec(xhp, argv[0], argv);
+	free(argv);
 
 	return result;
 }
+
+int HIDDEN
+xbps_file_execv(struct xbps_handle *xhp, const char **argv)
+{
+	return pfcexec(xhp, argv[0], argv);
+}
+
+/*
+ * Like xbps_file_exec() but doesn't wait for the command, its stdout
+ * and stderr are redirected to outfd. Returns the pid of the child or
+ * -1 on error, the exit status must be collected by the caller and can
+ * be converted with xbps_file_exec_status().
+ */
+pid_t HIDDEN
+xbps_file_spawn(struct xbps_handle *xhp, int outfd, const char *arg, ...)
+{
+	va_list	ap;
+	const char **argv;
+	pid_t	child;
+
+	va_start(ap, arg);
+	argv = vfcargv(arg, ap);
+	va_end(ap);
+	if (argv == NULL)
+		return -1;
+
+	child = pfcspawn(xhp, outfd, argv[0], argv);
+	free(argv);
+
+	return child;
+}
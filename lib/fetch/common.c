@@ -42,15 +42,18 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #if defined(HAVE_INTTYPES_H) || defined(NETBSD)
 #include <inttypes.h>
 #endif
 #include <netdb.h>
+#include <poll.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <strings.h>
 
@@ -417,6 +420,365 @@ fetch_socks5(conn_t *conn, struct url *url, struct url *socks, int verbose)
 	return 0;
 }
 
+/*
+ * The addresses of a host are looked up once every FETCH_DNS_TTL
+ * seconds and kept per host, port and address family, for up to
+ * FETCH_DNS_CACHE_MAX hosts.  Addresses of both families are
+ * interleaved, and the one of the last successful connection
+ * is tried first.
+ */
+#define FETCH_DNS_TTL		60
+#define FETCH_DNS_CACHE_MAX	32
+
+struct fetch_addr {
+	int			 family;
+	int			 socktype;
+	int			 protocol;
+	socklen_t		 addrlen;
+	struct sockaddr_storage	 addr;
+};
+
+struct dns_entry {
+	char			*host;
+	int			 port;
+	int			 af;
+	time_t			 expires;
+	struct fetch_addr	*addrs;
+	size_t			 naddrs;
+	struct dns_entry	*next;
+};
+
+static pthread_mutex_t dns_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct dns_entry *dns_cache;
+
+static void
+dns_entry_free(struct dns_entry *e)
+{
+	free(e->host);
+	free(e->addrs);
+	free(e);
+}
+
+/*
+ * Unlink the entry of host from the cache, the lock must be held.
+ */
+static struct dns_entry *
+dns_cache_unlink(const char *host, int port, int af)
+{
+	struct dns_entry *e, **ep;
+
+	for (ep = &dns_cache; (e = *ep) != NULL; ep = &e->next) {
+		if (e->port == port && e->af == af &&
+		    strcmp(e->host, host) == 0) {
+			*ep = e->next;
+			return (e);
+		}
+	}
+	return (NULL);
+}
+
+static struct fetch_addr *
+fetch_addrs_copy(const struct fetch_addr *addrs, size_t naddrs)
+{
+	struct fetch_addr *copy;
+
+	if ((copy = calloc(naddrs, sizeof(*copy))) == NULL)
+		return (NULL);
+	memcpy(copy, addrs, naddrs * sizeof(*copy));
+	return (copy);
+}
+
+/*
+ * Look up the addresses of host, the list returned in *addrs must be
+ * freed by the caller.  Returns 0 or a getaddrinfo() error.
+ */
+static int
+fetch_resolve(const char *host, int port, int af,
+    struct fetch_addr **addrs, size_t *naddrs)
+{
+	struct dns_entry *e, *last;
+	struct addrinfo hints, *ai, *ai0, *cur[2];
+	struct fetch_addr *a;
+	char pbuf[10];
+	size_t n, i;
+	time_t now = time(NULL);
+	int error, first, k;
+
+	pthread_mutex_lock(&dns_mtx);
+	for (e = dns_cache; e != NULL; e = e->next) {
+		if (e->port == port && e->af == af &&
+		    strcmp(e->host, host) == 0 && e->expires > now) {
+			*naddrs = e->naddrs;
+			*addrs = fetch_addrs_copy(e->addrs, e->naddrs);
+			pthread_mutex_unlock(&dns_mtx);
+			return (*addrs == NULL ? EAI_MEMORY : 0);
+		}
+	}
+	pthread_mutex_unlock(&dns_mtx);
+
+	snprintf(pbuf, sizeof(pbuf), "%d", port);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = af;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = 0;
+	if ((error = getaddrinfo(host, pbuf, &hints, &ai0)) != 0)
+		return (error);
+
+	for (n = 0, ai = ai0; ai; ai = ai->ai_next) {
+		if (ai->ai_addrlen <= sizeof(a->addr))
+			n++;
+	}
+	if (n == 0 || (a = calloc(n, sizeof(*a))) == NULL) {
+		freeaddrinfo(ai0);
+		return (n == 0 ? EAI_NONAME : EAI_MEMORY);
+	}
+	/*
+	 * Interleave the addresses of both families, starting with the
+	 * family of the first one returned (RFC 8305).
+	 */
+	first = ai0->ai_family;
+	cur[0] = cur[1] = ai0;
+	for (i = 0, k = 0; i < n; k = !k) {
+		while (cur[k] != NULL &&
+		    (cur[k]->ai_addrlen > sizeof(a->addr) ||
+		    (cur[k]->ai_family == first) != (k == 0)))
+			cur[k] = cur[k]->ai_next;
+		if (cur[k] == NULL)
+			continue;
+		a[i].family = cur[k]->ai_family;
+		a[i].socktype = cur[k]->ai_socktype;
+		a[i].protocol = cur[k]->ai_protocol;
+		a[i].addrlen = cur[k]->ai_addrlen;
+		memcpy(&a[i].addr, cur[k]->ai_addr, cur[k]->ai_addrlen);
+		cur[k] = cur[k]->ai_next;
+		i++;
+	}
+	freeaddrinfo(ai0);
+
+	*addrs = a;
+	*naddrs = n;
+
+	if ((e = calloc(1, sizeof(*e))) == NULL)
+		return (0);
+	if ((e->host = strdup(host)) == NULL ||
+	    (e->addrs = fetch_addrs_copy(a, n)) == NULL) {
+		dns_entry_free(e);
+		return (0);
+	}
+	e->port = port;
+	e->af = af;
+	e->naddrs = n;
+	e->expires = now + FETCH_DNS_TTL;
+
+	pthread_mutex_lock(&dns_mtx);
+	if ((last = dns_cache_unlink(host, port, af)) != NULL)
+		dns_entry_free(last);
+	e->next = dns_cache;
+	dns_cache = e;
+	/* drop the least recently resolved host */
+	for (i = 0, last = NULL; e != NULL; e = e->next) {
+		if (++i == FETCH_DNS_CACHE_MAX)
+			last = e;
+	}
+	if (last != NULL && (e = last->next) != NULL) {
+		last->next = NULL;
+		dns_entry_free(e);
+	}
+	pthread_mutex_unlock(&dns_mtx);
+
+	return (0);
+}
+
+/*
+ * Try the address a of host first from now on, or forget the addresses
+ * of host if a is NULL.
+ */
+static void
+fetch_resolve_update(const char *host, int port, int af,
+    const struct fetch_addr *a)
+{
+	struct dns_entry *e;
+	struct fetch_addr tmp;
+
+	pthread_mutex_lock(&dns_mtx);
+	if ((e = dns_cache_unlink(host, port, af)) == NULL) {
+		pthread_mutex_unlock(&dns_mtx);
+		return;
+	}
+	if (a == NULL) {
+		pthread_mutex_unlock(&dns_mtx);
+		dns_entry_free(e);
+		return;
+	}
+	for (size_t i = 1; i < e->naddrs; i++) {
+		if (e->addrs[i].addrlen == a->addrlen &&
+		    memcmp(&e->addrs[i].addr, &a->addr, a->addrlen) == 0) {
+			tmp = e->addrs[i];
+			memmove(&e->addrs[1], &e->addrs[0],
+			    i * sizeof(*e->addrs));
+			e->addrs[0] = tmp;
+			break;
+		}
+	}
+	e->next = dns_cache;
+	dns_cache = e;
+	pthread_mutex_unlock(&dns_mtx);
+}
+
+/*
+ * Free the cached addresses.
+ */
+static void
+fetch_resolve_release(void)
+{
+	struct dns_entry *e;
+
+	pthread_mutex_lock(&dns_mtx);
+	while ((e = dns_cache) != NULL) {
+		dns_cache = e->next;
+		dns_entry_free(e);
+	}
+	pthread_mutex_unlock(&dns_mtx);
+}
+
+/*
+ * Connection attempts to the addresses of a host are started in order,
+ * the next one FETCH_CONNECT_DELAY milliseconds after the previous one
+ * or as soon as it fails, and the first one to be established is used
+ * (RFC 8305).  The whole connect is bounded by fetchTimeout, if set.
+ */
+#define FETCH_CONNECT_DELAY	250
+
+static int
+fetch_connect_attempt(const struct fetch_addr *a, const char *bindaddr)
+{
+	int sd, flags;
+
+	if ((sd = socket(a->family, a->socktype, a->protocol)) == -1)
+		return (-1);
+	if (bindaddr != NULL && *bindaddr != '\0' &&
+	    fetch_bind(sd, a->family, bindaddr) != 0) {
+		fetch_info("failed to bind to '%s'", bindaddr);
+		close(sd);
+		return (-1);
+	}
+	if ((flags = fcntl(sd, F_GETFL)) == -1 ||
+	    fcntl(sd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		close(sd);
+		return (-1);
+	}
+	if (connect(sd, (const struct sockaddr *)&a->addr, a->addrlen) == -1 &&
+	    errno != EINPROGRESS) {
+		close(sd);
+		return (-1);
+	}
+	return (sd);
+}
+
+/*
+ * Returns the connected socket and sets *winner to the address it is
+ * connected to, or -1 with errno set.
+ */
+static int
+fetch_connect_addrs(const struct fetch_addr *addrs, size_t naddrs,
+    const char *bindaddr, size_t *winner)
+{
+	struct pollfd *pfd;
+	struct timeval now, deadline;
+	size_t *idx, next = 0, npending = 0;
+	socklen_t len;
+	int sd = -1, timeout, flags, r, err = ETIMEDOUT, start = 1;
+
+	pfd = calloc(naddrs, sizeof(*pfd));
+	idx = calloc(naddrs, sizeof(*idx));
+	if (pfd == NULL || idx == NULL) {
+		free(pfd);
+		free(idx);
+		return (-1);
+	}
+	if (fetchTimeout) {
+		gettimeofday(&deadline, NULL);
+		deadline.tv_sec += fetchTimeout;
+	}
+	while (sd == -1) {
+		if (start && next < naddrs) {
+			if ((r = fetch_connect_attempt(&addrs[next],
+			    bindaddr)) == -1) {
+				err = errno;
+				next++;
+				continue;
+			}
+			pfd[npending].fd = r;
+			pfd[npending].events = POLLOUT;
+			idx[npending++] = next++;
+			start = 0;
+		}
+		if (npending == 0)
+			break;
+
+		timeout = next < naddrs ? FETCH_CONNECT_DELAY : -1;
+		if (fetchTimeout) {
+			gettimeofday(&now, NULL);
+			r = (int)((deadline.tv_sec - now.tv_sec) * 1000 +
+			    (deadline.tv_usec - now.tv_usec) / 1000);
+			if (r <= 0) {
+				err = ETIMEDOUT;
+				break;
+			}
+			if (timeout == -1 || r < timeout)
+				timeout = r;
+		}
+		if ((r = poll(pfd, npending, timeout)) == -1) {
+			if (errno == EINTR)
+				continue;
+			err = errno;
+			break;
+		} else if (r == 0) {
+			/* start the next attempt */
+			start = 1;
+			continue;
+		}
+		for (size_t i = 0; i < npending; i++) {
+			if (pfd[i].revents == 0)
+				continue;
+			len = sizeof(r);
+			if (getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR,
+			    &r, &len) == -1)
+				r = errno;
+			if (r == 0) {
+				sd = pfd[i].fd;
+				*winner = idx[i];
+				break;
+			}
+			/* failed, the next attempt starts now */
+			err = r;
+			close(pfd[i].fd);
+			pfd[i] = pfd[npending - 1];
+			idx[i] = idx[npending - 1];
+			npending--;
+			i--;
+			start = 1;
+		}
+	}
+	for (size_t i = 0; i < npending; i++) {
+		if (pfd[i].fd != sd)
+			close(pfd[i].fd);
+	}
+	free(pfd);
+	free(idx);
+
+	if (sd == -1) {
+		errno = err;
+		return (-1);
+	}
+	if ((flags = fcntl(sd, F_GETFL)) == -1 ||
+	    fcntl(sd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+		close(sd);
+		return (-1);
+	}
+	return (sd);
+}
+
 /*
  * Establish a TCP connection to the specified port on the specified host.
  */
@@ -424,10 +786,10 @@ conn_t *
 fetch_connect(struct url *url, int af, int verbose)
 {
 	conn_t *conn;
-	char pbuf[10];
 	struct url *socks_url, *connurl;
+	struct fetch_addr *addrs;
 	const char *bindaddr, *socks_proxy;
-	struct addrinfo hints, *res, *res0;
+	size_t naddrs, winner = 0;
 	int sd, error;
 
 	socks_url = NULL;
@@ -451,12 +813,8 @@ fetch_connect(struct url *url, int af, int verbose)
 		fetch_info("looking up %s", connurl->host);
 
 	/* look up host name and set up socket address structure */
-	snprintf(pbuf, sizeof(pbuf), "%d", connurl->port);
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = af;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = 0;
-	if ((error = getaddrinfo(connurl->host, pbuf, &hints, &res0)) != 0) {
+	if ((error = fetch_resolve(connurl->host, connurl->port, af,
+	    &addrs, &naddrs)) != 0) {
 		netdb_seterr(error);
 		return (NULL);
 	}
@@ -466,25 +824,18 @@ fetch_connect(struct url *url, int af, int verbose)
 		fetch_info("connecting to %s:%d", connurl->host, connurl->port);
 
 	/* try to connect */
-	for (sd = -1, res = res0; res; sd = -1, res = res->ai_next) {
-		if ((sd = socket(res->ai_family, res->ai_socktype,
-			 res->ai_protocol)) == -1)
-			continue;
-		if (bindaddr != NULL && *bindaddr != '\0' &&
-		    fetch_bind(sd, res->ai_family, bindaddr) != 0) {
-			fetch_info("failed to bind to '%s'", bindaddr);
-			close(sd);
-			continue;
-		}
-		if (connect(sd, res->ai_addr, res->ai_addrlen) == 0)
-			break;
-		close(sd);
-	}
-	freeaddrinfo(res0);
+	sd = fetch_connect_addrs(addrs, naddrs, bindaddr, &winner);
 	if (sd == -1) {
+		/* look it up again the next time */
+		fetch_resolve_update(connurl->host, connurl->port, af, NULL);
+		free(addrs);
 		fetch_syserr();
 		return (NULL);
 	}
+	if (winner > 0)
+		fetch_resolve_update(connurl->host, connurl->port, af,
+		    &addrs[winner]);
+	free(addrs);
 
 	if ((conn = fetch_reopen(sd)) == NULL) {
 		fetch_syserr();
@@ -506,6 +857,10 @@ fetch_connect(struct url *url, int af, int verbose)
 	return (conn);
 }
 
+#ifdef WITH_SSL
+static void fetch_ssl_release(void);
+#endif
+
 static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
 static conn_t *connection_cache;
 static int cache_global_limit = 0;
@@ -542,6 +897,10 @@ fetchConnectionCacheClose(void)
 		connection_cache = conn->next_cached;
 		(*conn->cache_close)(conn);
 	}
+	fetch_resolve_release();
+#ifdef WITH_SSL
+	fetch_ssl_release();
+#endif
 }
 
 /*
@@ -985,7 +1344,7 @@ fetch_ssl_setup_transport_layer(SSL_CTX *ctx, int verbose)
 {
 	long ssl_ctx_options;
 
-	ssl_ctx_options = SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_TICKET;
+	ssl_ctx_options = SSL_OP_ALL | SSL_OP_NO_SSLv2;
 	if (getenv("SSL_ALLOW_SSL3") == NULL)
 		ssl_ctx_options |= SSL_OP_NO_SSLv3;
 	if (getenv("SSL_NO_TLS1") != NULL)
@@ -1111,12 +1470,188 @@ fetch_ssl_cb_verify_crt(int verified, X509_STORE_CTX *ctx)
 
 static pthread_once_t ssl_init_once = PTHREAD_ONCE_INIT;
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static pthread_mutex_t *ssl_locks;
+
+static void
+ssl_locking_cb(int mode, int n, const char *file, int line)
+{
+	(void)file;
+	(void)line;
+
+	if (mode & CRYPTO_LOCK)
+		pthread_mutex_lock(&ssl_locks[n]);
+	else
+		pthread_mutex_unlock(&ssl_locks[n]);
+}
+
+static void
+ssl_threadid_cb(CRYPTO_THREADID *id)
+{
+	CRYPTO_THREADID_set_numeric(id, (unsigned long)pthread_self());
+}
+#endif
+
 static void
 ssl_init(void)
 {
 	/* Init the SSL library and context */
 	SSL_load_error_strings();
 	SSL_library_init();
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	/* connections may be set up by many threads at once */
+	if (CRYPTO_get_locking_callback() == NULL) {
+		ssl_locks = calloc(CRYPTO_num_locks(), sizeof(*ssl_locks));
+		if (ssl_locks == NULL)
+			return;
+		for (int i = 0; i < CRYPTO_num_locks(); i++)
+			pthread_mutex_init(&ssl_locks[i], NULL);
+		(void)CRYPTO_THREADID_set_callback(ssl_threadid_cb);
+		CRYPTO_set_locking_callback(ssl_locking_cb);
+	}
+#endif
+}
+
+/*
+ * All connections share a single SSL context, set up and with the CA
+ * store loaded on the first one.  The last session established with
+ * every server (host and port) is kept, up to SSL_SESSION_CACHE_MAX
+ * servers, to resume the next connection to it.
+ */
+#define SSL_SESSION_CACHE_MAX	32
+
+struct ssl_session {
+	char			*key;
+	SSL_SESSION		*sess;
+	struct ssl_session	*next;
+};
+
+static pthread_mutex_t ssl_mtx = PTHREAD_MUTEX_INITIALIZER;
+static SSL_CTX *ssl_ctx;
+static struct ssl_session *ssl_sessions;
+
+/*
+ * Called by OpenSSL whenever a session is established, also for the
+ * session tickets sent after a TLSv1.3 handshake.
+ */
+static int
+fetch_ssl_new_session(SSL *ssl, SSL_SESSION *sess)
+{
+	struct ssl_session *s, **sp, *last = NULL;
+	const char *key;
+	int n = 0;
+
+	if ((key = SSL_get_app_data(ssl)) == NULL)
+		return (0);
+
+	pthread_mutex_lock(&ssl_mtx);
+	for (sp = &ssl_sessions; (s = *sp) != NULL; sp = &s->next) {
+		if (strcmp(s->key, key) == 0) {
+			*sp = s->next;
+			break;
+		}
+	}
+	if (s == NULL && (s = calloc(1, sizeof(*s))) != NULL &&
+	    (s->key = strdup(key)) == NULL) {
+		free(s);
+		s = NULL;
+	}
+	if (s == NULL) {
+		pthread_mutex_unlock(&ssl_mtx);
+		return (0);
+	}
+	if (s->sess != NULL)
+		SSL_SESSION_free(s->sess);
+	s->sess = sess;
+	s->next = ssl_sessions;
+	ssl_sessions = s;
+
+	/* drop the least recently established session */
+	for (s = ssl_sessions; s != NULL; s = s->next) {
+		if (++n == SSL_SESSION_CACHE_MAX)
+			last = s;
+	}
+	if (last != NULL && (s = last->next) != NULL) {
+		last->next = NULL;
+		SSL_SESSION_free(s->sess);
+		free(s->key);
+		free(s);
+	}
+	pthread_mutex_unlock(&ssl_mtx);
+
+	/* the reference to sess is kept */
+	return (1);
+}
+
+static void
+fetch_ssl_resume(SSL *ssl, const char *key)
+{
+	struct ssl_session *s;
+
+	pthread_mutex_lock(&ssl_mtx);
+	for (s = ssl_sessions; s != NULL; s = s->next) {
+		if (strcmp(s->key, key) == 0) {
+			SSL_set_session(ssl, s->sess);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ssl_mtx);
+}
+
+static SSL_CTX *
+fetch_ssl_ctx(int verbose)
+{
+	SSL_CTX *ctx;
+
+	pthread_mutex_lock(&ssl_mtx);
+	if ((ctx = ssl_ctx) != NULL) {
+		pthread_mutex_unlock(&ssl_mtx);
+		return (ctx);
+	}
+	if ((ctx = SSL_CTX_new(SSLv23_client_method())) == NULL) {
+		fprintf(stderr, "failed to create SSL context\n");
+		ERR_print_errors_fp(stderr);
+		pthread_mutex_unlock(&ssl_mtx);
+		return (NULL);
+	}
+	SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+	SSL_CTX_set_session_cache_mode(ctx,
+	    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, fetch_ssl_new_session);
+
+	fetch_ssl_setup_transport_layer(ctx, verbose);
+	if (!fetch_ssl_setup_peer_verification(ctx, verbose) ||
+	    !fetch_ssl_setup_client_certificate(ctx, verbose)) {
+		SSL_CTX_free(ctx);
+		ctx = NULL;
+	}
+	ssl_ctx = ctx;
+	pthread_mutex_unlock(&ssl_mtx);
+
+	return (ctx);
+}
+
+/*
+ * Free the shared SSL context and the kept sessions, no connection
+ * must be using them.
+ */
+static void
+fetch_ssl_release(void)
+{
+	struct ssl_session *s;
+
+	pthread_mutex_lock(&ssl_mtx);
+	while ((s = ssl_sessions) != NULL) {
+		ssl_sessions = s->next;
+		SSL_SESSION_free(s->sess);
+		free(s->key);
+		free(s);
+	}
+	if (ssl_ctx != NULL) {
+		SSL_CTX_free(ssl_ctx);
+		ssl_ctx = NULL;
+	}
+	pthread_mutex_unlock(&ssl_mtx);
 }
 #endif
 
@@ -1126,34 +1661,44 @@ ssl_init(void)
  */
 int
 fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
+{
+	return (fetch_ssl_alpn(conn, URL, verbose, NULL));
+}
+
+/*
+ * Enable SSL on a connection, offering the protocols in alpn (in ALPN
+ * wire format, NULL for none) during the handshake.
+ */
+int
+fetch_ssl_alpn(conn_t *conn, const struct url *URL, int verbose,
+    const char *alpn)
 {
 
 #ifdef WITH_SSL
+	SSL_CTX *ctx;
+	size_t keylen;
 	int ret;
 	X509_NAME *name;
 	char *str;
 
 	(void)pthread_once(&ssl_init_once, ssl_init);
 
-	conn->ssl_ctx = SSL_CTX_new(SSLv23_client_method());
-	if (conn->ssl_ctx == NULL) {
-		fprintf(stderr, "failed to create SSL context\n");
-		ERR_print_errors_fp(stderr);
-		return -1;
-	}
-	SSL_CTX_set_mode(conn->ssl_ctx, SSL_MODE_AUTO_RETRY);
-
-	fetch_ssl_setup_transport_layer(conn->ssl_ctx, verbose);
-	if (!fetch_ssl_setup_peer_verification(conn->ssl_ctx, verbose))
-		return (-1);
-	if (!fetch_ssl_setup_client_certificate(conn->ssl_ctx, verbose))
+	if ((ctx = fetch_ssl_ctx(verbose)) == NULL)
 		return (-1);
 
-	conn->ssl = SSL_new(conn->ssl_ctx);
+	conn->ssl = SSL_new(ctx);
 	if (conn->ssl == NULL) {
 		fprintf(stderr, "SSL context creation failed\n");
 		return (-1);
 	}
+	keylen = strlen(URL->host) + 8;
+	if ((conn->ssl_key = malloc(keylen)) == NULL) {
+		fetch_syserr();
+		return (-1);
+	}
+	snprintf(conn->ssl_key, keylen, "%s:%d", URL->host, URL->port);
+	SSL_set_app_data(conn->ssl, conn->ssl_key);
+	fetch_ssl_resume(conn->ssl, conn->ssl_key);
 	SSL_set_connect_state(conn->ssl);
 	if (!SSL_set_fd(conn->ssl, conn->sd)) {
 		fprintf(stderr, "SSL_set_fd failed\n");
@@ -1166,6 +1711,14 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 		    URL->host);
 		return (-1);
 	}
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	if (alpn != NULL && SSL_set_alpn_protos(conn->ssl,
+	    (const unsigned char *)alpn, strlen(alpn)) != 0) {
+		fprintf(stderr, "TLS ALPN extension failed for host %s\n",
+		    URL->host);
+		return (-1);
+	}
 #endif
 	if ((ret = SSL_connect(conn->ssl)) <= 0){
 		fprintf(stderr, "SSL_connect returned %d\n", SSL_get_error(conn->ssl, ret));
@@ -1191,8 +1744,10 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 	}
 
 	if (verbose) {
-		fetch_info("%s connection established using %s",
-		    SSL_get_version(conn->ssl), SSL_get_cipher(conn->ssl));
+		fetch_info("%s connection %s using %s",
+		    SSL_get_version(conn->ssl),
+		    SSL_session_reused(conn->ssl) ? "resumed" : "established",
+		    SSL_get_cipher(conn->ssl));
 		conn->ssl_cert = SSL_get_peer_certificate(conn->ssl);
 		name = X509_get_subject_name(conn->ssl_cert);
 		str = X509_NAME_oneline(name, 0, 0);
@@ -1208,6 +1763,7 @@ fetch_ssl(conn_t *conn, const struct url *URL, int verbose)
 #else
 	(void)conn;
 	(void)verbose;
+	(void)alpn;
 	fprintf(stderr, "SSL support disabled\n");
 	return (-1);
 #endif
@@ -1452,10 +2008,8 @@ fetch_close(conn_t *conn)
 		SSL_free(conn->ssl);
 		conn->ssl = NULL;
 	}
-	if (conn->ssl_ctx) {
-		SSL_CTX_free(conn->ssl_ctx);
-		conn->ssl_ctx = NULL;
-	}
+	free(conn->ssl_key);
+	conn->ssl_key = NULL;
 	if (conn->ssl_cert) {
 		X509_free(conn->ssl_cert);
 		conn->ssl_cert = NULL;
@@ -96,7 +96,7 @@ struct fetchconn {
 	int		 err;		/* last protocol reply code */
 #ifdef WITH_SSL
 	SSL		*ssl;		/* SSL handle */
-	SSL_CTX		*ssl_ctx;	/* SSL context */
+	char		*ssl_key;	/* host:port of the SSL session */
 	X509		*ssl_cert;	/* server certificate */
 #endif
 
@@ -130,6 +130,7 @@ conn_t		*fetch_reopen(int);
 int		fetch_ssl_cb_verify_crt(int, X509_STORE_CTX*);
 #endif
 int		 fetch_ssl(conn_t *, const struct url *, int);
+int		 fetch_ssl_alpn(conn_t *, const struct url *, int, const char *);
 ssize_t		 fetch_read(conn_t *, char *, size_t);
 int		 fetch_getln(conn_t *);
 ssize_t		 fetch_write(conn_t *, const void *, size_t);
@@ -40,8 +40,10 @@
 #define URL_SCHEMELEN 16
 #define URL_USERLEN 256
 #define URL_PWDLEN 256
+#define URL_ETAGLEN 255
 
 typedef struct fetchIO fetchIO;
+typedef struct fetchPipeline fetchPipeline;
 
 struct url {
 	char		 scheme[URL_SCHEMELEN + 1];
@@ -53,12 +55,14 @@ struct url {
 	off_t		 offset;
 	size_t		 length;
 	time_t		 last_modified;
+	char		 etag[URL_ETAGLEN + 1];
 };
 
 struct url_stat {
 	off_t		 size;
 	time_t		 atime;
 	time_t		 mtime;
+	char		 etag[URL_ETAGLEN + 1];
 };
 
 struct url_list {
@@ -119,6 +123,10 @@ fetchIO		*fetchPutHTTP(struct url *, const char *);
 int		 fetchStatHTTP(struct url *, struct url_stat *, const char *);
 int		 fetchListHTTP(struct url_list *, struct url *, const char *,
 		    const char *);
+int		 fetchConnectHTTP(struct url *, const char *);
+fetchPipeline	*fetchPipelineHTTP(struct url **, size_t, const char *);
+fetchIO		*fetchPipelineNext(fetchPipeline *, struct url_stat *);
+void		 fetchPipelineClose(fetchPipeline *);
 
 /* FTP-specific functions */
 fetchIO		*fetchXGetFTP(struct url *, struct url_stat *, const char *);
@@ -165,10 +173,10 @@ void		 fetchConnectionCacheClose(void);
 typedef int (*auth_t)(struct url *);
 extern auth_t		 fetchAuthMethod;
 
-/* Last error code */
-extern int		 fetchLastErrCode;
+/* Last error code, per thread */
+extern __thread int	 fetchLastErrCode;
 #define MAXERRSTRING 256
-extern char		 fetchLastErrString[MAXERRSTRING];
+extern __thread char	 fetchLastErrString[MAXERRSTRING];
 
 /* I/O timeout */
 extern int		 fetchTimeout;
@@ -188,6 +188,7 @@ fetch_stat_file(int fd, struct url_stat *us)
 
 	us->size = -1;
 	us->atime = us->mtime = 0;
+	us->etag[0] = '\0';
 	if (fstat(fd, &sb) == -1) {
 		fetch_syserr();
 		return (-1);
@@ -464,6 +464,7 @@ ftp_stat(conn_t *conn, const char *file, struct url_stat *us)
 
 	us->size = -1;
 	us->atime = us->mtime = 0;
+	us->etag[0] = '\0';
 
 	filename = ftp_filename(file, &filenamelen, &type, 0);
 
@@ -86,6 +86,11 @@
 
 #include <arpa/inet.h>
 
+#ifdef HAVE_NGHTTP2
+#include <pthread.h>
+#include <nghttp2/nghttp2.h>
+#endif
+
 #include "fetch.h"
 #include "common.h"
 #include "httperr.h"
@@ -118,6 +123,23 @@
 
 static int http_cmd(conn_t *, const char *, ...) LIBFETCH_PRINTFLIKE(2, 3);
 
+/* Requests sent ahead of the replies being read on a pipeline */
+#define HTTP_PIPELINE_DEPTH	8
+
+struct fetchPipeline {
+	struct url	**urls;		/* requested URLs */
+	size_t		 nurls;		/* number of URLs */
+	size_t		 next;		/* next reply to be read */
+	size_t		 sent;		/* requests sent on conn */
+	conn_t		*conn;		/* pipelined connection */
+	struct url	*curl;		/* URL conn was opened for */
+	struct url	*purl;		/* proxy URL */
+	char		*flags;		/* fetch flags */
+	int		 persistent;	/* conn is known to be persistent */
+	int		 busy;		/* a reply body is being read */
+	struct http2	*h2;		/* HTTP/2 session instead of conn */
+};
+
 /*****************************************************************************
  * I/O functions for decoding chunked streams
  */
@@ -135,6 +157,7 @@ struct httpio
 	int		 error;		/* error flag */
 	size_t		 chunksize;	/* remaining size of current chunk */
 	off_t		 contentlength;	/* remaining size of the content */
+	struct fetchPipeline *pipeline;	/* pipeline owning conn */
 };
 
 /*
@@ -298,6 +321,20 @@ http_writefn(void *v, const void *buf, size_t len)
 	return (fetch_write(io->conn, buf, len));
 }
 
+/*
+ * Whether the whole reply body has been read, so that the connection
+ * can be reused for the next request.
+ */
+static int
+http_body_done(struct httpio *io)
+{
+	if (io->error)
+		return (0);
+	if (io->chunked)
+		return (io->eof);
+	return (io->contentlength == 0);
+}
+
 /*
  * Close function
  */
@@ -306,7 +343,14 @@ http_closefn(void *v)
 {
 	struct httpio *io = (struct httpio *)v;
 
-	if (io->keep_alive) {
+	if (io->pipeline) {
+		/* the connection stays with the pipeline if it's usable */
+		io->pipeline->busy = 0;
+		if (!io->keep_alive || !http_body_done(io)) {
+			fetch_close(io->conn);
+			io->pipeline->conn = NULL;
+		}
+	} else if (io->keep_alive && http_body_done(io)) {
 		int val;
 
 		val = 0;
@@ -330,7 +374,8 @@ http_closefn(void *v)
  * Wrap a file descriptor up
  */
 static fetchIO *
-http_funopen(conn_t *conn, int chunked, int keep_alive, off_t clength)
+http_funopen(conn_t *conn, int chunked, int keep_alive, off_t clength,
+    struct fetchPipeline *pipeline)
 {
 	struct httpio *io;
 	fetchIO *f;
@@ -343,6 +388,7 @@ http_funopen(conn_t *conn, int chunked, int keep_alive, off_t clength)
 	io->chunked = chunked;
 	io->contentlength = clength;
 	io->keep_alive = keep_alive;
+	io->pipeline = pipeline;
 	f = fetchIO_unopen(io, http_readfn, http_writefn, http_closefn);
 	if (f == NULL) {
 		fetch_syserr();
@@ -366,6 +412,7 @@ typedef enum {
 	hdr_connection,
 	hdr_content_length,
 	hdr_content_range,
+	hdr_etag,
 	hdr_last_modified,
 	hdr_location,
 	hdr_transfer_encoding,
@@ -380,6 +427,7 @@ static struct {
 	{ hdr_connection,		"Connection" },
 	{ hdr_content_length,		"Content-Length" },
 	{ hdr_content_range,		"Content-Range" },
+	{ hdr_etag,			"ETag" },
 	{ hdr_last_modified,		"Last-Modified" },
 	{ hdr_location,			"Location" },
 	{ hdr_transfer_encoding,	"Transfer-Encoding" },
@@ -421,10 +469,11 @@ http_cmd(conn_t *conn, const char *fmt, ...)
 }
 
 /*
- * Get and parse status line
+ * Get and parse status line, the connection is persistent by default
+ * if the server speaks HTTP/1.1.
  */
 static int
-http_get_reply(conn_t *conn)
+http_get_reply(conn_t *conn, int *keep_alive)
 {
 	char *p;
 
@@ -442,9 +491,13 @@ http_get_reply(conn_t *conn)
 	if (strncmp(conn->buf, "HTTP", 4) != 0)
 		return (HTTP_PROTOCOL_ERROR);
 	p = conn->buf + 4;
+	if (keep_alive != NULL)
+		*keep_alive = 0;
 	if (*p == '/') {
 		if (p[1] != '1' || p[2] != '.' || (p[3] != '0' && p[3] != '1'))
 			return (HTTP_PROTOCOL_ERROR);
+		if (keep_alive != NULL)
+			*keep_alive = (p[3] == '1');
 		p += 4;
 	}
 	if (*p != ' ' ||
@@ -528,6 +581,19 @@ http_parse_mtime(const char *p, time_t *mtime)
 	return (0);
 }
 
+/*
+ * Parse a connection header
+ */
+static void
+http_parse_connection(const char *p, int *keep_alive)
+{
+	/* XXX too weak? */
+	if (strcasecmp(p, "close") == 0)
+		*keep_alive = 0;
+	else if (strcasecmp(p, "keep-alive") == 0)
+		*keep_alive = 1;
+}
+
 /*
  * Parse a content-length header
  */
@@ -544,6 +610,20 @@ http_parse_length(const char *p, off_t *length)
 	return (0);
 }
 
+/*
+ * Parse an ETag header, an entity tag that doesn't fit is ignored
+ */
+static void
+http_parse_etag(const char *p, char *etag)
+{
+	size_t len = strlen(p);
+
+	if (len > URL_ETAGLEN)
+		len = 0;
+	memcpy(etag, p, len);
+	etag[len] = '\0';
+}
+
 /*
  * Parse a content-range header
  */
@@ -714,7 +794,9 @@ send_proxy_headers(conn_t *conn, struct url *purl)
 }
 
 /*
- * Connect to the correct HTTP server or proxy.
+ * Connect to the correct HTTP server or proxy, *cached is set if the
+ * connection comes from the cache.  A new one is opened if cached is
+ * NULL.
  */
 static conn_t *
 http_connect(struct url *URL, struct url *purl, const char *flags, int *cached)
@@ -742,7 +824,7 @@ http_connect(struct url *URL, struct url *purl, const char *flags, int *cached)
 
 	curl = (purl != NULL) ? purl : URL;
 
-	if ((conn = fetch_cache_get(curl, af)) != NULL) {
+	if (cached != NULL && (conn = fetch_cache_get(curl, af)) != NULL) {
 		*cached = 1;
 		return (conn);
 	}
@@ -758,11 +840,11 @@ http_connect(struct url *URL, struct url *purl, const char *flags, int *cached)
 
 		http_cmd(conn, "\r\n");
 
-		if (http_get_reply(conn) != HTTP_OK) {
+		if (http_get_reply(conn, NULL) != HTTP_OK) {
 			fetch_close(conn);
 			return (NULL);
 		}
-		http_get_reply(conn);
+		http_get_reply(conn, NULL);
 	}
 	if (strcasecmp(URL->scheme, SCHEME_HTTPS) == 0 &&
 	    fetch_ssl(conn, URL, verbose) == -1) {
@@ -809,19 +891,163 @@ http_get_proxy(struct url * url, const char *flags)
 }
 
 static void
-set_if_modified_since(conn_t *conn, time_t last_modified)
+http_format_date(time_t t, char *buf, size_t len)
 {
 	static const char weekdays[] = "SunMonTueWedThuFriSat";
 	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 	struct tm tm;
-	char buf[80];
-	gmtime_r(&last_modified, &tm);
-	snprintf(buf, sizeof(buf), "%.3s, %02d %.3s %4ld %02d:%02d:%02d GMT",
+	gmtime_r(&t, &tm);
+	snprintf(buf, len, "%.3s, %02d %.3s %4ld %02d:%02d:%02d GMT",
 	    weekdays + tm.tm_wday * 3, tm.tm_mday, months + tm.tm_mon * 3,
 	    (long)(tm.tm_year + 1900), tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+static void
+set_if_modified_since(conn_t *conn, time_t last_modified)
+{
+	char buf[80];
+
+	http_format_date(last_modified, buf, sizeof(buf));
 	http_cmd(conn, "If-Modified-Since: %s\r\n", buf);
 }
 
+/*
+ * Format the value of the Host header for url into hbuf.
+ */
+static const char *
+http_host(struct url *url, char *hbuf, size_t len)
+{
+	const char *host = url->host;
+
+#ifdef INET6
+	if (strchr(url->host, ':')) {
+		snprintf(hbuf, len, "[%s]", url->host);
+		host = hbuf;
+	}
+#endif
+	if (url->port != fetch_default_port(url->scheme)) {
+		if (host != hbuf) {
+			strcpy(hbuf, host);
+			host = hbuf;
+		}
+		snprintf(hbuf + strlen(hbuf),
+		    len - strlen(hbuf), ":%d", url->port);
+	}
+	return (host);
+}
+
+/*
+ * Send the headers common to all requests, up to the end of the request.
+ */
+static void
+http_send_headers(conn_t *conn, struct url *url, const char *host)
+{
+	const char *p;
+
+	if ((p = getenv("HTTP_REFERER")) != NULL && *p != '\0') {
+		if (strcasecmp(p, "auto") == 0)
+			http_cmd(conn, "Referer: %s://%s%s\r\n",
+			    url->scheme, host, url->doc);
+		else
+			http_cmd(conn, "Referer: %s\r\n", p);
+	}
+	if ((p = getenv("HTTP_USER_AGENT")) != NULL) {
+		/* no User-Agent if defined but empty */
+		if (*p != '\0')
+			http_cmd(conn, "User-Agent: %s\r\n", p);
+	} else {
+		/* default User-Agent */
+		http_cmd(conn, "User-Agent: %s\r\n", _LIBFETCH_VER);
+	}
+
+	/*
+	 * Some servers returns 406 (Not Acceptable) if the Accept field is not
+	 * provided by the user agent, such example is http://alioth.debian.org.
+	 */
+	http_cmd(conn, "Accept: */*\r\n");
+
+	if (*url->etag)
+		http_cmd(conn, "If-None-Match: %s\r\n", url->etag);
+
+	if (url->length > 0)
+		http_cmd(conn, "Range: bytes=%lld-%lld\r\n",
+		    (long long)url->offset,
+		    (long long)(url->offset + (off_t)url->length - 1));
+	else if (url->offset > 0)
+		http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
+
+	http_cmd(conn, "\r\n");
+}
+
+/*
+ * Force the queued requests to be dispatched.  Normally, one
+ * would do this with shutdown(2) but squid proxies can be
+ * configured to disallow such half-closed connections.  To
+ * be compatible with such configurations, fiddle with socket
+ * options to force the pending data to be written.
+ */
+static void
+http_dispatch(conn_t *conn)
+{
+	int val;
+
+#ifdef TCP_NOPUSH
+	val = 0;
+	setsockopt(conn->sd, IPPROTO_TCP, TCP_NOPUSH, &val,
+		   sizeof(val));
+#endif
+	val = 1;
+	setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &val,
+		   sizeof(val));
+}
+
+/*
+ * Check the lengths of a reply for inconsistencies, fill in the stats
+ * and report back the real offset and size in URL.
+ */
+static int
+http_set_length(struct url *URL, struct url_stat *us, off_t offset,
+    off_t *clengthp, off_t length, off_t size, time_t mtime)
+{
+	off_t clength = *clengthp;
+
+	if (clength != -1 && length != -1 && clength != length) {
+		http_seterr(HTTP_PROTOCOL_ERROR);
+		return (-1);
+	}
+	if (clength == -1)
+		clength = length;
+	if (clength != -1)
+		length = offset + clength;
+
+	/* a bounded range ends before the document does */
+	if (length != -1 && size != -1 && length != size &&
+	    (URL->length == 0 || length > size)) {
+		http_seterr(HTTP_PROTOCOL_ERROR);
+		return (-1);
+	}
+	if (size == -1)
+		size = length;
+
+	/* fill in stats */
+	if (us) {
+		us->size = size;
+		us->atime = us->mtime = mtime;
+	}
+
+	/* too far? */
+	if (URL->offset > 0 && offset > URL->offset) {
+		http_seterr(HTTP_PROTOCOL_ERROR);
+		return (-1);
+	}
+
+	/* report back real offset and size */
+	URL->offset = offset;
+	URL->length = clength;
+	*clengthp = clength;
+	return (0);
+}
+
 
 /*****************************************************************************
  * Core
@@ -841,13 +1067,15 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	struct url *url, *new;
 	int chunked, direct, if_modified_since, need_auth, noredirect;
 	int keep_alive, verbose, cached;
-	int e, i, n, val;
+	int e, i, n;
 	off_t offset, clength, length, size;
 	time_t mtime;
 	const char *p;
 	fetchIO *f;
 	hdr_t h;
-	char hbuf[URL_HOSTLEN + 7], *host;
+	char hbuf[URL_HOSTLEN + 7];
+	char etag[URL_ETAGLEN + 1];
+	const char *host;
 
 	direct = CHECK_FLAG('d');
 	noredirect = CHECK_FLAG('A');
@@ -878,6 +1106,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		size = -1;
 		mtime = 0;
 		cached = 0;
+		etag[0] = '\0';
 
 		/* check port */
 		if (!url->port)
@@ -898,21 +1127,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		if ((conn = http_connect(url, purl, flags, &cached)) == NULL)
 			goto ouch;
 
-		host = url->host;
-#ifdef INET6
-		if (strchr(url->host, ':')) {
-			snprintf(hbuf, sizeof(hbuf), "[%s]", url->host);
-			host = hbuf;
-		}
-#endif
-		if (url->port != fetch_default_port(url->scheme)) {
-			if (host != hbuf) {
-				strcpy(hbuf, host);
-				host = hbuf;
-			}
-			snprintf(hbuf + strlen(hbuf),
-			    sizeof(hbuf) - strlen(hbuf), ":%d", url->port);
-		}
+		host = http_host(url, hbuf, sizeof(hbuf));
 
 		/* send request */
 		if (verbose)
@@ -950,51 +1165,11 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 		}
 
 		/* other headers */
-		if ((p = getenv("HTTP_REFERER")) != NULL && *p != '\0') {
-			if (strcasecmp(p, "auto") == 0)
-				http_cmd(conn, "Referer: %s://%s%s\r\n",
-				    url->scheme, host, url->doc);
-			else
-				http_cmd(conn, "Referer: %s\r\n", p);
-		}
-		if ((p = getenv("HTTP_USER_AGENT")) != NULL) {
-			/* no User-Agent if defined but empty */
-			if (*p != '\0')
-				http_cmd(conn, "User-Agent: %s\r\n", p);
-		} else {
-			/* default User-Agent */
-			http_cmd(conn, "User-Agent: %s\r\n", _LIBFETCH_VER);
-		}
-
-		/*
-		 * Some servers returns 406 (Not Acceptable) if the Accept field is not
-		 * provided by the user agent, such example is http://alioth.debian.org.
-		 */
-		http_cmd(conn, "Accept: */*\r\n");
-
-		if (url->offset > 0)
-			http_cmd(conn, "Range: bytes=%lld-\r\n", (long long)url->offset);
-
-		http_cmd(conn, "\r\n");
-
-		/*
-		 * Force the queued request to be dispatched.  Normally, one
-		 * would do this with shutdown(2) but squid proxies can be
-		 * configured to disallow such half-closed connections.  To
-		 * be compatible with such configurations, fiddle with socket
-		 * options to force the pending data to be written.
-		 */
-#ifdef TCP_NOPUSH
-		val = 0;
-		setsockopt(conn->sd, IPPROTO_TCP, TCP_NOPUSH, &val,
-			   sizeof(val));
-#endif
-		val = 1;
-		setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &val,
-			   sizeof(val));
+		http_send_headers(conn, url, host);
+		http_dispatch(conn);
 
 		/* get reply */
-		switch (http_get_reply(conn)) {
+		switch (http_get_reply(conn, &keep_alive)) {
 		case HTTP_OK:
 		case HTTP_PARTIAL:
 		case HTTP_NOT_MODIFIED:
@@ -1062,8 +1237,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 				http_seterr(HTTP_PROTOCOL_ERROR);
 				goto ouch;
 			case hdr_connection:
-				/* XXX too weak? */
-				keep_alive = (strcasecmp(p, "keep-alive") == 0);
+				http_parse_connection(p, &keep_alive);
 				break;
 			case hdr_content_length:
 				http_parse_length(p, &clength);
@@ -1071,6 +1245,9 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 			case hdr_content_range:
 				http_parse_range(p, &offset, &length, &size);
 				break;
+			case hdr_etag:
+				http_parse_etag(p, etag);
+				break;
 			case hdr_last_modified:
 				http_parse_mtime(p, &mtime);
 				break;
@@ -1097,6 +1274,8 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 				}
 				new->offset = url->offset;
 				new->length = url->length;
+				new->last_modified = url->last_modified;
+				memcpy(new->etag, url->etag, sizeof(new->etag));
 				break;
 			case hdr_transfer_encoding:
 				/* XXX weak test*/
@@ -1168,37 +1347,10 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	}
 
 	/* check for inconsistencies */
-	if (clength != -1 && length != -1 && clength != length) {
-		http_seterr(HTTP_PROTOCOL_ERROR);
-		goto ouch;
-	}
-	if (clength == -1)
-		clength = length;
-	if (clength != -1)
-		length = offset + clength;
-
-	if (length != -1 && size != -1 && length != size) {
-		http_seterr(HTTP_PROTOCOL_ERROR);
-		goto ouch;
-	}
-	if (size == -1)
-		size = length;
-
-	/* fill in stats */
-	if (us) {
-		us->size = size;
-		us->atime = us->mtime = mtime;
-	}
-
-	/* too far? */
-	if (URL->offset > 0 && offset > URL->offset) {
-		http_seterr(HTTP_PROTOCOL_ERROR);
+	if (http_set_length(URL, us, offset, &clength, length, size, mtime) == -1)
 		goto ouch;
-	}
-
-	/* report back real offset and size */
-	URL->offset = offset;
-	URL->length = clength;
+	if (us)
+		memcpy(us->etag, etag, sizeof(us->etag));
 
 	if (clength == -1 && !chunked && conn->err != HTTP_NOT_MODIFIED)
 		keep_alive = 0;
@@ -1213,7 +1365,7 @@ http_request(struct url *URL, const char *op, struct url_stat *us,
 	}
 
 	/* wrap it up in a fetchIO */
-	if ((f = http_funopen(conn, chunked, keep_alive, clength)) == NULL) {
+	if ((f = http_funopen(conn, chunked, keep_alive, clength, NULL)) == NULL) {
 		fetch_syserr();
 		goto ouch;
 	}
@@ -1249,16 +1401,980 @@ ouch:
 
 
 /*****************************************************************************
- * Entry points
+ * Request pipelining
  */
 
 /*
- * Retrieve and stat a file by HTTP
+ * The replies to GET requests for many documents are read in order,
+ * with up to HTTP_PIPELINE_DEPTH requests sent ahead on a connection
+ * to the same server once it's known to be persistent.  Every URL is
+ * requested with If-Modified-Since if its last_modified is set, with
+ * If-None-Match if it has an etag and with Range if it has an offset or
+ * a length.  Anything that can't be done on a pipeline
+ * (other schemes, redirects, authorization, broken connections) falls
+ * back to a regular request.
  */
-fetchIO *
-fetchXGetHTTP(struct url *URL, struct url_stat *us, const char *flags)
+static int
+http_same_server(const struct url *a, const struct url *b)
 {
-	return (http_request(URL, "GET", us, http_get_proxy(URL, flags), flags));
+	return (a->port == b->port &&
+	    strcmp(a->scheme, b->scheme) == 0 &&
+	    strcmp(a->host, b->host) == 0 &&
+	    strcmp(a->user, b->user) == 0 &&
+	    strcmp(a->pwd, b->pwd) == 0);
+}
+
+#ifdef HAVE_NGHTTP2
+/*
+ * A pipeline to a HTTPS server that selects h2 with ALPN sends all its
+ * requests for that server at once, as concurrent streams of a single
+ * connection.  The replies are still read in order: a stream only
+ * buffers up to HTTP2_STREAM_WINDOW bytes of its body until it's the
+ * one being read, which gets a window of HTTP2_READ_WINDOW bytes.
+ * Servers that don't select h2 are remembered, their requests are
+ * pipelined over HTTP/1.1 from then on.  fetchConnectHTTP() finds out
+ * ahead and keeps the h2 connection for the next pipeline.
+ */
+#define HTTP2_STREAM_WINDOW	(64 * 1024)
+#define HTTP2_READ_WINDOW	(4 * 1024 * 1024)
+#define HTTP2_CONN_WINDOW	(16 * 1024 * 1024)
+#define HTTP2_SERVERS		16
+
+struct http2stream {
+	struct fetchPipeline *p;
+	int32_t		 id;		/* stream id, 0 if not submitted */
+	int		 status;	/* reply status code */
+	int		 headers;	/* final headers received */
+	int		 closed;	/* stream closed by the server */
+	int		 done;		/* reply closed by the caller */
+	uint32_t	 error;		/* stream error code */
+	off_t		 offset, clength, length, size;
+	time_t		 mtime;
+	char		 etag[URL_ETAGLEN + 1];
+	char		*buf;		/* body received but not read */
+	size_t		 bufpos, buflen, bufsize;
+};
+
+struct http2 {
+	nghttp2_session	*session;
+	conn_t		*conn;
+	struct http2stream *streams;	/* one per URL of the pipeline */
+	int		 error;		/* the connection failed */
+};
+
+/* What is known about the last HTTP2_SERVERS servers */
+struct http2server {
+	char		 key[URL_HOSTLEN + 7];	/* host:port */
+	int		 noh2;		/* h2 isn't selected */
+	int		 probing;	/* being connected to ahead */
+	conn_t		*conn;		/* h2 connection opened ahead */
+};
+
+static pthread_mutex_t http2_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct http2server http2_servers[HTTP2_SERVERS];
+static size_t http2_nservers;
+
+/*
+ * Look up the server of url, adding it if add is set.  http2_mtx must
+ * be held.
+ */
+static struct http2server *
+http2_server(const struct url *url, int add)
+{
+	struct http2server *s;
+	char key[URL_HOSTLEN + 7];
+	size_t i, n;
+
+	snprintf(key, sizeof(key), "%s:%d", url->host, url->port);
+	n = http2_nservers < HTTP2_SERVERS ? http2_nservers : HTTP2_SERVERS;
+	for (i = 0; i < n; i++) {
+		if (strcmp(http2_servers[i].key, key) == 0)
+			return (&http2_servers[i]);
+	}
+	if (!add)
+		return (NULL);
+	s = &http2_servers[http2_nservers++ % HTTP2_SERVERS];
+	if (s->conn != NULL)
+		fetch_close(s->conn);
+	memset(s, 0, sizeof(*s));
+	strcpy(s->key, key);
+	return (s);
+}
+
+static ssize_t
+http2_send_cb(nghttp2_session *session, const uint8_t *data, size_t len,
+    int flags, void *arg)
+{
+	struct http2 *h2 = arg;
+
+	(void)session;
+	(void)flags;
+	if (fetch_write(h2->conn, data, len) != (ssize_t)len)
+		return (NGHTTP2_ERR_CALLBACK_FAILURE);
+	return ((ssize_t)len);
+}
+
+static int
+http2_header_cb(nghttp2_session *session, const nghttp2_frame *frame,
+    const uint8_t *name, size_t namelen, const uint8_t *value,
+    size_t valuelen, uint8_t flags, void *arg)
+{
+	struct http2stream *s;
+	const char *n = (const char *)name, *v = (const char *)value;
+
+	(void)namelen;
+	(void)valuelen;
+	(void)flags;
+	(void)arg;
+	if (frame->hd.type != NGHTTP2_HEADERS ||
+	    (s = nghttp2_session_get_stream_user_data(session,
+	    frame->hd.stream_id)) == NULL || s->headers)
+		return (0);
+
+	/* header names are lowercase, values NUL terminated */
+	if (strcmp(n, ":status") == 0)
+		s->status = atoi(v);
+	else if (strcmp(n, "content-length") == 0)
+		http_parse_length(v, &s->clength);
+	else if (strcmp(n, "content-range") == 0)
+		http_parse_range(v, &s->offset, &s->length, &s->size);
+	else if (strcmp(n, "etag") == 0)
+		http_parse_etag(v, s->etag);
+	else if (strcmp(n, "last-modified") == 0)
+		http_parse_mtime(v, &s->mtime);
+	return (0);
+}
+
+static int
+http2_frame_cb(nghttp2_session *session, const nghttp2_frame *frame,
+    void *arg)
+{
+	struct http2stream *s;
+
+	(void)arg;
+	if (frame->hd.type != NGHTTP2_HEADERS ||
+	    (s = nghttp2_session_get_stream_user_data(session,
+	    frame->hd.stream_id)) == NULL)
+		return (0);
+	/* informational replies are followed by the final one */
+	if (s->status >= 100 && s->status < 200)
+		s->status = 0;
+	else
+		s->headers = 1;
+	return (0);
+}
+
+static int
+http2_data_cb(nghttp2_session *session, uint8_t flags, int32_t id,
+    const uint8_t *data, size_t len, void *arg)
+{
+	struct http2stream *s;
+	char *buf;
+	size_t size;
+
+	(void)flags;
+	(void)arg;
+	if ((s = nghttp2_session_get_stream_user_data(session, id)) == NULL)
+		return (0);
+	if (s->done) {
+		/* nobody reads it, give the window back */
+		nghttp2_session_consume(session, id, len);
+		return (0);
+	}
+	if (s->bufpos > 0) {
+		memmove(s->buf, s->buf + s->bufpos, s->buflen - s->bufpos);
+		s->buflen -= s->bufpos;
+		s->bufpos = 0;
+	}
+	if (s->buflen + len > s->bufsize) {
+		size = s->buflen + len;
+		if (size < HTTP2_STREAM_WINDOW)
+			size = HTTP2_STREAM_WINDOW;
+		if ((buf = realloc(s->buf, size)) == NULL)
+			return (NGHTTP2_ERR_CALLBACK_FAILURE);
+		s->buf = buf;
+		s->bufsize = size;
+	}
+	memcpy(s->buf + s->buflen, data, len);
+	s->buflen += len;
+	return (0);
+}
+
+static int
+http2_close_cb(nghttp2_session *session, int32_t id, uint32_t error,
+    void *arg)
+{
+	struct http2stream *s;
+
+	(void)arg;
+	if ((s = nghttp2_session_get_stream_user_data(session, id)) != NULL) {
+		s->closed = 1;
+		s->error = error;
+	}
+	return (0);
+}
+
+/*
+ * Send the pending frames, then wait for frames from the server and
+ * process them.
+ */
+static int
+http2_io(struct http2 *h2)
+{
+	char buf[16 * 1024];
+	ssize_t len;
+
+	if (h2->error)
+		return (-1);
+	if (nghttp2_session_send(h2->session) != 0 ||
+	    !nghttp2_session_want_read(h2->session) ||
+	    (len = fetch_read(h2->conn, buf, sizeof(buf))) <= 0 ||
+	    nghttp2_session_mem_recv(h2->session, (const uint8_t *)buf,
+	    (size_t)len) != len ||
+	    nghttp2_session_send(h2->session) != 0) {
+		h2->error = 1;
+		return (-1);
+	}
+	return (0);
+}
+
+static void
+http2_drop(struct fetchPipeline *p)
+{
+	struct http2 *h2 = p->h2;
+
+	if (h2 == NULL)
+		return;
+	if (!h2->error &&
+	    nghttp2_session_terminate_session(h2->session,
+	    NGHTTP2_NO_ERROR) == 0)
+		(void)nghttp2_session_send(h2->session);
+	nghttp2_session_del(h2->session);
+	fetch_close(h2->conn);
+	for (size_t i = 0; i < p->nurls; i++)
+		free(h2->streams[i].buf);
+	free(h2->streams);
+	free(h2);
+	p->h2 = NULL;
+}
+
+/*
+ * Connect to the server of url offering h2, NULL if the server doesn't
+ * select it: then it's remembered and *cached is set, the connection
+ * being left in the cache for HTTP/1.1.
+ */
+static conn_t *
+http2_alpn(struct url *url, const char *flags, int *cached)
+{
+	static const char alpn[] = "\x02h2\x08http/1.1";
+	const unsigned char *proto = NULL;
+	unsigned int protolen = 0;
+	conn_t *conn;
+	int af, verbose, val = 1;
+
+	*cached = 0;
+#ifdef INET6
+	af = AF_UNSPEC;
+#else
+	af = AF_INET;
+#endif
+	verbose = CHECK_FLAG('v');
+	if (CHECK_FLAG('4'))
+		af = AF_INET;
+#ifdef INET6
+	else if (CHECK_FLAG('6'))
+		af = AF_INET6;
+#endif
+
+	if ((conn = fetch_connect(url, af, verbose)) == NULL)
+		return (NULL);
+	if (fetch_ssl_alpn(conn, url, verbose, alpn) == -1) {
+		/* http_connect() retries and reports the error */
+		fetch_close(conn);
+		return (NULL);
+	}
+	SSL_get0_alpn_selected(conn->ssl, &proto, &protolen);
+	if (protolen != 2 || memcmp(proto, "h2", 2) != 0) {
+		pthread_mutex_lock(&http2_mtx);
+		http2_server(url, 1)->noh2 = 1;
+		pthread_mutex_unlock(&http2_mtx);
+		fetch_cache_put(conn, fetch_close);
+		*cached = 1;
+		return (NULL);
+	}
+	setsockopt(conn->sd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+	return (conn);
+}
+
+/*
+ * Connect to the server of url ahead of a pipeline, finding out whether
+ * it selects h2 if that isn't known yet.  Returns 0 if the connection
+ * went to the cache for HTTP/1.1.
+ */
+static int
+http2_connect_ahead(struct url *url, const char *flags)
+{
+	struct http2server *s;
+	conn_t *conn;
+	int cached;
+
+	if (*url->user || *url->pwd)
+		return (-1);
+	pthread_mutex_lock(&http2_mtx);
+	s = http2_server(url, 1);
+	if (s->noh2 || s->probing || s->conn != NULL) {
+		pthread_mutex_unlock(&http2_mtx);
+		return (-1);
+	}
+	s->probing = 1;
+	pthread_mutex_unlock(&http2_mtx);
+
+	conn = http2_alpn(url, flags, &cached);
+
+	pthread_mutex_lock(&http2_mtx);
+	if ((s = http2_server(url, 0)) != NULL) {
+		s->probing = 0;
+		if (conn != NULL && s->conn == NULL) {
+			s->conn = conn;
+			conn = NULL;
+		}
+	}
+	pthread_mutex_unlock(&http2_mtx);
+	if (conn != NULL)
+		fetch_close(conn);
+	return (cached ? 0 : -1);
+}
+
+/*
+ * Set up an h2 session for the pipeline on the connection opened ahead
+ * or on a new one.
+ */
+static int
+http2_connect(struct fetchPipeline *p, struct url *url)
+{
+	nghttp2_session_callbacks *cbs;
+	nghttp2_option *opt;
+	nghttp2_settings_entry iv[] = {
+		{ NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+		{ NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_STREAM_WINDOW },
+	};
+	struct http2server *s;
+	struct http2 *h2;
+	conn_t *conn = NULL;
+	int cached, rv;
+
+	if (*url->user || *url->pwd)
+		return (-1);
+	pthread_mutex_lock(&http2_mtx);
+	if ((s = http2_server(url, 0)) != NULL) {
+		if (s->noh2) {
+			pthread_mutex_unlock(&http2_mtx);
+			return (-1);
+		}
+		conn = s->conn;
+		s->conn = NULL;
+	}
+	pthread_mutex_unlock(&http2_mtx);
+	if (conn == NULL &&
+	    (conn = http2_alpn(url, p->flags, &cached)) == NULL)
+		return (-1);
+
+	if ((h2 = calloc(1, sizeof(*h2))) == NULL ||
+	    (h2->streams = calloc(p->nurls, sizeof(*h2->streams))) == NULL) {
+		free(h2);
+		fetch_close(conn);
+		fetch_syserr();
+		return (-1);
+	}
+	h2->conn = conn;
+	if (nghttp2_session_callbacks_new(&cbs) != 0) {
+		free(h2->streams);
+		free(h2);
+		fetch_close(conn);
+		return (-1);
+	}
+	nghttp2_session_callbacks_set_send_callback(cbs, http2_send_cb);
+	nghttp2_session_callbacks_set_on_header_callback(cbs, http2_header_cb);
+	nghttp2_session_callbacks_set_on_frame_recv_callback(cbs,
+	    http2_frame_cb);
+	nghttp2_session_callbacks_set_on_data_chunk_recv_callback(cbs,
+	    http2_data_cb);
+	nghttp2_session_callbacks_set_on_stream_close_callback(cbs,
+	    http2_close_cb);
+	rv = -1;
+	if (nghttp2_option_new(&opt) == 0) {
+		/* the window is given back as the body is read */
+		nghttp2_option_set_no_auto_window_update(opt, 1);
+		rv = nghttp2_session_client_new2(&h2->session, cbs, h2, opt);
+		nghttp2_option_del(opt);
+	}
+	nghttp2_session_callbacks_del(cbs);
+	if (rv != 0) {
+		free(h2->streams);
+		free(h2);
+		fetch_close(conn);
+		return (-1);
+	}
+	p->h2 = h2;
+	if (nghttp2_submit_settings(h2->session, NGHTTP2_FLAG_NONE, iv,
+	    sizeof(iv) / sizeof(iv[0])) != 0 ||
+	    nghttp2_session_set_local_window_size(h2->session,
+	    NGHTTP2_FLAG_NONE, 0, HTTP2_CONN_WINDOW) != 0) {
+		http2_drop(p);
+		return (-1);
+	}
+	return (0);
+}
+
+#define HTTP2_NV(n, v) {						\
+	(uint8_t *)(uintptr_t)(n), (uint8_t *)(uintptr_t)(v),		\
+	strlen(n), strlen(v), NGHTTP2_NV_FLAG_NONE }
+
+/*
+ * Submit the requests for all the following URLs on the same server.
+ */
+static void
+http2_send(struct fetchPipeline *p)
+{
+	struct http2 *h2 = p->h2;
+	struct http2stream *s;
+	struct url *url;
+	nghttp2_nv nva[10];
+	const char *host, *ua, *ref;
+	char hbuf[URL_HOSTLEN + 7], date[80], range[64];
+	char rbuf[URL_HOSTLEN + 1024];
+	size_t n;
+
+	for (; p->sent < p->nurls; p->sent++) {
+		url = p->urls[p->sent];
+		if (!http_same_server(url, p->curl))
+			break;
+
+		host = http_host(url, hbuf, sizeof(hbuf));
+		n = 0;
+		nva[n++] = (nghttp2_nv)HTTP2_NV(":method", "GET");
+		nva[n++] = (nghttp2_nv)HTTP2_NV(":scheme", SCHEME_HTTPS);
+		nva[n++] = (nghttp2_nv)HTTP2_NV(":authority", host);
+		nva[n++] = (nghttp2_nv)HTTP2_NV(":path", url->doc);
+		if ((ref = getenv("HTTP_REFERER")) != NULL && *ref != '\0') {
+			if (strcasecmp(ref, "auto") == 0) {
+				snprintf(rbuf, sizeof(rbuf), "%s://%s%s",
+				    url->scheme, host, url->doc);
+				ref = rbuf;
+			}
+			nva[n++] = (nghttp2_nv)HTTP2_NV("referer", ref);
+		}
+		/* no User-Agent if defined but empty */
+		if ((ua = getenv("HTTP_USER_AGENT")) == NULL)
+			ua = _LIBFETCH_VER;
+		if (*ua != '\0')
+			nva[n++] = (nghttp2_nv)HTTP2_NV("user-agent", ua);
+		nva[n++] = (nghttp2_nv)HTTP2_NV("accept", "*/*");
+		if (url->last_modified > 0) {
+			http_format_date(url->last_modified, date,
+			    sizeof(date));
+			nva[n++] = (nghttp2_nv)HTTP2_NV("if-modified-since",
+			    date);
+		}
+		if (*url->etag)
+			nva[n++] = (nghttp2_nv)HTTP2_NV("if-none-match",
+			    url->etag);
+		if (url->length > 0) {
+			snprintf(range, sizeof(range), "bytes=%lld-%lld",
+			    (long long)url->offset,
+			    (long long)(url->offset + (off_t)url->length - 1));
+			nva[n++] = (nghttp2_nv)HTTP2_NV("range", range);
+		}
+
+		s = &h2->streams[p->sent];
+		s->p = p;
+		s->offset = 0;
+		s->clength = s->length = s->size = -1;
+		s->id = nghttp2_submit_request(h2->session, NULL, nva, n,
+		    NULL, s);
+		if (s->id < 0) {
+			/* out of streams, the rest goes without h2 */
+			s->id = 0;
+			break;
+		}
+	}
+}
+
+#undef HTTP2_NV
+
+static ssize_t
+http2_readfn(void *v, void *buf, size_t len)
+{
+	struct http2stream *s = v;
+	struct http2 *h2 = s->p->h2;
+
+	while (s->bufpos == s->buflen) {
+		if (s->closed)
+			return (s->error == NGHTTP2_NO_ERROR ? 0 : -1);
+		if (http2_io(h2) == -1)
+			return (-1);
+	}
+	if (len > s->buflen - s->bufpos)
+		len = s->buflen - s->bufpos;
+	memcpy(buf, s->buf + s->bufpos, len);
+	s->bufpos += len;
+	nghttp2_session_consume(h2->session, s->id, len);
+	return ((ssize_t)len);
+}
+
+static ssize_t
+http2_writefn(void *v, const void *buf, size_t len)
+{
+	(void)v;
+	(void)buf;
+	(void)len;
+	errno = EBADF;
+	return (-1);
+}
+
+/*
+ * Stop reading a reply, the rest of its body is discarded.
+ */
+static void
+http2_closefn(void *v)
+{
+	struct http2stream *s = v;
+	struct http2 *h2 = s->p->h2;
+
+	s->p->busy = 0;
+	s->done = 1;
+	if (!s->closed)
+		nghttp2_submit_rst_stream(h2->session, NGHTTP2_FLAG_NONE,
+		    s->id, NGHTTP2_CANCEL);
+	if (s->buflen > s->bufpos)
+		nghttp2_session_consume(h2->session, s->id,
+		    s->buflen - s->bufpos);
+	free(s->buf);
+	s->buf = NULL;
+	s->bufpos = s->buflen = s->bufsize = 0;
+}
+
+/*
+ * Read the reply to the request for URL from its stream, *retry is set
+ * if it has to be requested again without the pipeline.
+ */
+static fetchIO *
+http2_reply(struct fetchPipeline *p, struct url *URL, struct url_stat *us,
+    int *retry)
+{
+	struct http2 *h2 = p->h2;
+	struct http2stream *s = &h2->streams[p->next];
+	fetchIO *f;
+
+	*retry = 1;
+	if (s->id == 0)
+		return (NULL);
+	/* the stream being read isn't held back by its window */
+	if (!s->closed)
+		(void)nghttp2_session_set_local_window_size(h2->session,
+		    NGHTTP2_FLAG_NONE, s->id, HTTP2_READ_WINDOW);
+	while (!s->headers && !s->closed) {
+		if (http2_io(h2) == -1)
+			break;
+	}
+	/* refused streams and broken connections */
+	if (!s->headers) {
+		http2_closefn(s);
+		return (NULL);
+	}
+	switch (s->status) {
+	case HTTP_OK:
+	case HTTP_PARTIAL:
+	case HTTP_NOT_MODIFIED:
+		break;
+	case HTTP_NEED_AUTH:
+	case HTTP_NEED_PROXY_AUTH:
+	case HTTP_BAD_RANGE:
+		http2_closefn(s);
+		return (NULL);
+	default:
+		/* redirects */
+		if (!HTTP_ERROR(s->status)) {
+			http2_closefn(s);
+			return (NULL);
+		}
+		break;
+	}
+
+	/* the reply is final from here on */
+	*retry = 0;
+	if (s->status != HTTP_OK && s->status != HTTP_PARTIAL) {
+		http2_closefn(s);
+		http_seterr(s->status);
+		return (NULL);
+	}
+	if (http_set_length(URL, us, s->offset, &s->clength, s->length,
+	    s->size, s->mtime) == -1) {
+		http2_closefn(s);
+		return (NULL);
+	}
+	if (us)
+		memcpy(us->etag, s->etag, sizeof(us->etag));
+	if ((f = fetchIO_unopen(s, http2_readfn, http2_writefn,
+	    http2_closefn)) == NULL) {
+		http2_closefn(s);
+		fetch_syserr();
+		return (NULL);
+	}
+	p->busy = 1;
+	return (f);
+}
+#endif
+
+/*
+ * Release the pipelined connection, it's kept in the connection cache
+ * if reuse is set and there are no replies pending.
+ */
+static void
+http_pipeline_drop(struct fetchPipeline *p, int reuse)
+{
+#ifdef HAVE_NGHTTP2
+	http2_drop(p);
+#endif
+	if (p->conn != NULL) {
+		if (reuse && p->sent == p->next && !p->busy)
+			fetch_cache_put(p->conn, fetch_close);
+		else
+			fetch_close(p->conn);
+		p->conn = NULL;
+	}
+	if (p->curl != NULL) {
+		fetchFreeURL(p->curl);
+		p->curl = NULL;
+	}
+	if (p->purl != NULL) {
+		fetchFreeURL(p->purl);
+		p->purl = NULL;
+	}
+}
+
+/*
+ * Send requests for the following URLs on the same server, up to
+ * the one at position max.
+ */
+static void
+http_pipeline_send(struct fetchPipeline *p, size_t max)
+{
+	struct url *url;
+	const char *host;
+	char hbuf[URL_HOSTLEN + 7];
+	size_t sent = p->sent;
+
+	for (; p->sent < p->nurls && p->sent < max; p->sent++) {
+		url = p->urls[p->sent];
+		if (!http_same_server(url, p->curl))
+			break;
+
+		host = http_host(url, hbuf, sizeof(hbuf));
+		if (p->purl && strcasecmp(url->scheme, SCHEME_HTTPS) != 0) {
+			http_cmd(p->conn, "GET %s://%s%s HTTP/1.1\r\n",
+			    url->scheme, host, url->doc);
+		} else {
+			http_cmd(p->conn, "GET %s HTTP/1.1\r\n", url->doc);
+		}
+		if (url->last_modified > 0)
+			set_if_modified_since(p->conn, url->last_modified);
+		http_cmd(p->conn, "Host: %s\r\n", host);
+		if (strcasecmp(url->scheme, SCHEME_HTTPS) != 0)
+			send_proxy_headers(p->conn, p->purl);
+		if (*url->user || *url->pwd)
+			http_basic_auth(p->conn, "Authorization",
+			    url->user, url->pwd);
+		http_send_headers(p->conn, url, host);
+	}
+	if (p->sent != sent)
+		http_dispatch(p->conn);
+}
+
+/*
+ * Connect to the server of url for the request at position p->next.
+ */
+static int
+http_pipeline_open(struct fetchPipeline *p, struct url *url)
+{
+	const char *flags = p->flags;
+	int cached = 0;
+
+	/* the previous connection might have been closed by a reply */
+	http_pipeline_drop(p, 0);
+	p->purl = http_get_proxy(url, flags);
+#ifdef HAVE_NGHTTP2
+	if (p->purl == NULL && strcasecmp(url->scheme, SCHEME_HTTPS) == 0 &&
+	    http2_connect(p, url) == 0) {
+		if ((p->curl = fetchCopyURL(url)) == NULL) {
+			http_pipeline_drop(p, 0);
+			return (-1);
+		}
+		p->sent = p->next;
+		return (0);
+	}
+#endif
+	if ((p->conn = http_connect(url, p->purl, flags, &cached)) == NULL) {
+		http_pipeline_drop(p, 0);
+		return (-1);
+	}
+	if ((p->curl = fetchCopyURL(url)) == NULL) {
+		http_pipeline_drop(p, 0);
+		return (-1);
+	}
+	p->sent = p->next;
+	/* cached connections were persistent */
+	p->persistent = cached;
+	return (0);
+}
+
+/*
+ * Read the reply to the request for URL, *retry is set if it has to be
+ * requested again without the pipeline.
+ */
+static fetchIO *
+http_pipeline_reply(struct fetchPipeline *p, struct url *URL,
+    struct url_stat *us, int *retry)
+{
+	conn_t *conn = p->conn;
+	int chunked = 0, keep_alive, err;
+	off_t offset = 0, clength = -1, length = -1, size = -1;
+	time_t mtime = 0;
+	const char *v;
+	char etag[URL_ETAGLEN + 1] = "";
+	fetchIO *f;
+	hdr_t h;
+
+	*retry = 1;
+	switch (http_get_reply(conn, &keep_alive)) {
+	case HTTP_OK:
+	case HTTP_PARTIAL:
+	case HTTP_NOT_MODIFIED:
+		break;
+	case HTTP_NEED_AUTH:
+	case HTTP_NEED_PROXY_AUTH:
+	case HTTP_BAD_RANGE:
+		return (NULL);
+	default:
+		/* redirects and broken connections */
+		if (!HTTP_ERROR(conn->err))
+			return (NULL);
+		break;
+	}
+
+	do {
+		switch ((h = http_next_header(conn, &v))) {
+		case hdr_syserror:
+		case hdr_error:
+			return (NULL);
+		case hdr_connection:
+			http_parse_connection(v, &keep_alive);
+			break;
+		case hdr_content_length:
+			http_parse_length(v, &clength);
+			break;
+		case hdr_content_range:
+			http_parse_range(v, &offset, &length, &size);
+			break;
+		case hdr_etag:
+			http_parse_etag(v, etag);
+			break;
+		case hdr_last_modified:
+			http_parse_mtime(v, &mtime);
+			break;
+		case hdr_transfer_encoding:
+			/* XXX weak test*/
+			chunked = (strcasecmp(v, "chunked") == 0);
+			break;
+		default:
+			break;
+		}
+	} while (h > hdr_end);
+
+	/* the reply is final from here on */
+	*retry = 0;
+	err = conn->err;
+	if (clength == -1 && !chunked && err != HTTP_NOT_MODIFIED)
+		keep_alive = 0;
+	if (keep_alive) {
+		/* the server has shown the connection is persistent */
+		p->persistent = 1;
+		http_pipeline_send(p, p->next + HTTP_PIPELINE_DEPTH);
+	}
+
+	if (err == HTTP_NOT_MODIFIED) {
+		if (!keep_alive)
+			http_pipeline_drop(p, 0);
+		http_seterr(HTTP_NOT_MODIFIED);
+		return (NULL);
+	}
+	if (!HTTP_ERROR(err) &&
+	    http_set_length(URL, us, offset, &clength, length, size, mtime) == -1) {
+		http_pipeline_drop(p, 0);
+		return (NULL);
+	}
+	if (us)
+		memcpy(us->etag, etag, sizeof(us->etag));
+	if ((f = http_funopen(conn, chunked, keep_alive, clength, p)) == NULL) {
+		http_pipeline_drop(p, 0);
+		fetch_syserr();
+		return (NULL);
+	}
+	p->busy = 1;
+
+	if (HTTP_ERROR(err)) {
+		/* skip the error message for the next reply */
+		if (keep_alive) {
+			char buf[512];
+			do {
+			} while (fetchIO_read(f, buf, sizeof(buf)) > 0);
+		}
+		fetchIO_close(f);
+		http_seterr(err);
+		return (NULL);
+	}
+	return (f);
+}
+
+/*
+ * Start a pipeline for the nurls URLs in urls, which must stay valid
+ * until the pipeline is closed.
+ */
+fetchPipeline *
+fetchPipelineHTTP(struct url **urls, size_t nurls, const char *flags)
+{
+	struct fetchPipeline *p;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL) {
+		fetch_syserr();
+		return (NULL);
+	}
+	if (asprintf(&p->flags, "%si", flags ? flags : "") == -1) {
+		free(p);
+		fetch_syserr();
+		return (NULL);
+	}
+	p->urls = urls;
+	p->nurls = nurls;
+	for (size_t i = 0; i < nurls; i++) {
+		if (!urls[i]->port)
+			urls[i]->port = fetch_default_port(urls[i]->scheme);
+	}
+	return (p);
+}
+
+/*
+ * Retrieve the next URL of the pipeline, the result of the previous
+ * one must have been closed.
+ */
+fetchIO *
+fetchPipelineNext(fetchPipeline *p, struct url_stat *us)
+{
+	struct url *url;
+	fetchIO *f;
+	int retry;
+
+	if (p->next >= p->nurls) {
+		errno = ENOENT;
+		fetch_syserr();
+		return (NULL);
+	}
+	url = p->urls[p->next];
+	if (strcasecmp(url->scheme, SCHEME_HTTP) != 0 &&
+	    strcasecmp(url->scheme, SCHEME_HTTPS) != 0) {
+		p->next++;
+		return (fetchXGet(url, us, p->flags));
+	}
+	/* moving on to another server */
+	if ((p->conn != NULL || p->h2 != NULL) && p->sent == p->next &&
+	    !http_same_server(url, p->curl))
+		http_pipeline_drop(p, 1);
+	if (p->conn == NULL && p->h2 == NULL &&
+	    http_pipeline_open(p, url) == -1) {
+		p->next++;
+		return (NULL);
+	}
+#ifdef HAVE_NGHTTP2
+	if (p->h2 != NULL) {
+		/* all the requests to the server are sent at once */
+		http2_send(p);
+		f = http2_reply(p, url, us, &retry);
+		p->next++;
+		if (f != NULL || !retry)
+			return (f);
+		return (http_request(url, "GET", us, NULL, p->flags));
+	}
+#endif
+	/* only one request until the connection is known to be persistent */
+	if (p->persistent)
+		http_pipeline_send(p, p->next + HTTP_PIPELINE_DEPTH);
+	else
+		http_pipeline_send(p, p->next + 1);
+
+	f = http_pipeline_reply(p, url, us, &retry);
+	p->next++;
+	if (f != NULL || !retry)
+		return (f);
+
+	http_pipeline_drop(p, 0);
+	return (http_request(url, "GET", us, http_get_proxy(url, p->flags),
+	    p->flags));
+}
+
+/*
+ * Close a pipeline, its connection is cached if it can be reused.
+ */
+void
+fetchPipelineClose(fetchPipeline *p)
+{
+	if (p == NULL)
+		return;
+
+	http_pipeline_drop(p, 1);
+	free(p->flags);
+	free(p);
+}
+
+
+/*****************************************************************************
+ * Entry points
+ */
+
+/*
+ * Retrieve and stat a file by HTTP
+ */
+fetchIO *
+fetchXGetHTTP(struct url *URL, struct url_stat *us, const char *flags)
+{
+	return (http_request(URL, "GET", us, http_get_proxy(URL, flags), flags));
+}
+
+/*
+ * Connect to the server of URL, or to its proxy, ahead of the requests
+ * for it: the connection is left in the connection cache.  A HTTPS
+ * server that selects h2 also gets a connection for the next pipeline.
+ */
+int
+fetchConnectHTTP(struct url *URL, const char *flags)
+{
+	struct url *purl;
+	conn_t *conn;
+
+	if (!URL->port)
+		URL->port = fetch_default_port(URL->scheme);
+	purl = http_get_proxy(URL, flags);
+#ifdef HAVE_NGHTTP2
+	if (purl == NULL && strcasecmp(URL->scheme, SCHEME_HTTPS) == 0 &&
+	    http2_connect_ahead(URL, flags) == 0)
+		return (0);
+#endif
+	conn = http_connect(URL, purl, flags, NULL);
+	if (purl)
+		fetchFreeURL(purl);
+	if (conn == NULL)
+		return (-1);
+	fetch_cache_put(conn, fetch_close);
+	return (0);
 }
 
 /*
@@ -26,6 +26,7 @@
 
 #include <sys/utsname.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #ifdef __FreeBSD__
 #define _WITH_GETLINE   /* getline() */
 #endif
@@ -39,6 +40,8 @@
 #include <ctype.h>
 #include <glob.h>
 #include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "xbps_api_impl.h"
 
@@ -47,6 +50,8 @@
 #endif
 
 static int parse_file(struct xbps_handle *, const char *, const char *, bool);
+static void set_option(struct xbps_handle *, const char *, size_t,
+		const char *, char *);
 
 /**
  * @file lib/initend.c
@@ -141,6 +146,278 @@ store_repo(struct xbps_handle *xhp, const char *repo)
 	return xbps_repo_store(xhp, repo);
 }
 
+/*
+ * Configuration snapshot.
+ *
+ * If XBPS_CONF_CACHE is set in the environment, the options read from
+ * all configuration files are recorded in order, together with the
+ * mtime and size of every file and directory that was read, into that
+ * file. Later calls to xbps_init() replay the options from the snapshot
+ * while none of its inputs changed, with a single read instead of
+ * reading and parsing every configuration file.
+ *
+ * Options are replayed with set_option(), so the values that depend on
+ * the state of the system (preserved file globs, relative repositories)
+ * are still evaluated on every run.
+ *
+ * The snapshot is a header line followed by records terminated by '\n',
+ * a type character and fields separated by '\0':
+ *
+ * 	'D' <confdir> <sysconfdir>
+ * 	'S' <stamp> <path>		an input file or directory
+ * 	'C' <dir>			chdir(2) done by an include
+ * 	'O' <path> <line> <key> <value>	an option
+ */
+#define CONFCACHE_HEADER	"xbps-conf " XBPS_RELVER "\n"
+
+struct confrec {
+	char type;
+	char *f[4];
+};
+
+/* snapshot being recorded while parsing */
+static char *confcache;
+static size_t confcache_len, confcache_size;
+
+static void
+confcache_stamp(const char *path, char *buf, size_t len)
+{
+	struct stat st;
+
+	if (stat(path, &st) == -1) {
+		xbps_strlcpy(buf, "-", len);
+		return;
+	}
+	snprintf(buf, len, "%jd.%ld:%jd", (intmax_t)st.st_mtim.tv_sec,
+	    st.st_mtim.tv_nsec, (intmax_t)st.st_size);
+}
+
+static void
+confcache_add(char type, ...)
+{
+	va_list ap;
+	const char *field;
+	size_t len;
+	bool first = true;
+
+	if (confcache == NULL)
+		return;
+
+	va_start(ap, type);
+	while ((field = va_arg(ap, const char *)) != NULL) {
+		len = strlen(field);
+		if (confcache_len + len + 3 > confcache_size) {
+			confcache_size = (confcache_len + len + 3) * 2;
+			confcache = realloc(confcache, confcache_size);
+			assert(confcache);
+		}
+		if (first)
+			confcache[confcache_len++] = type;
+		else
+			confcache[confcache_len++] = '\0';
+		memcpy(confcache + confcache_len, field, len);
+		confcache_len += len;
+		first = false;
+	}
+	va_end(ap);
+	confcache[confcache_len++] = '\n';
+}
+
+static void
+confcache_input(const char *path)
+{
+	char stamp[64];
+
+	if (confcache == NULL)
+		return;
+
+	confcache_stamp(path, stamp, sizeof(stamp));
+	confcache_add('S', stamp, path, NULL);
+}
+
+static void
+confcache_option(const char *path, size_t line, const char *k, const char *v)
+{
+	char buf[32];
+
+	if (confcache == NULL)
+		return;
+
+	snprintf(buf, sizeof(buf), "%zu", line);
+	confcache_add('O', path, buf, k, v, NULL);
+}
+
+static void
+confcache_include(const char *cfcwd, const char *pattern)
+{
+	char buf[PATH_MAX], *dir;
+
+	if (confcache == NULL)
+		return;
+
+	confcache_add('C', cfcwd, NULL);
+
+	/* files added to or removed from the included directory */
+	if (pattern[0] == '/')
+		xbps_strlcpy(buf, pattern, sizeof(buf));
+	else
+		snprintf(buf, sizeof(buf), "%s/%s", cfcwd, pattern);
+	dir = dirname(buf);
+	if (strpbrk(dir, "*?[")) {
+		/* can't tell which directories are matched */
+		free(confcache);
+		confcache = NULL;
+		return;
+	}
+	confcache_input(dir);
+}
+
+/*
+ * Splits the record at *p into its fields, returns false if it's
+ * incomplete.
+ */
+static bool
+confcache_next(char **p, char *end, struct confrec *rec)
+{
+	char *nl, *f;
+	unsigned int n = 0;
+
+	if ((nl = memchr(*p, '\n', (size_t)(end - *p))) == NULL)
+		return false;
+	*nl = '\0';
+
+	memset(rec, 0, sizeof(*rec));
+	rec->type = **p;
+	for (f = *p + 1; n < __arraycount(rec->f) && f <= nl; f += strlen(f) + 1)
+		rec->f[n++] = f;
+	*p = nl + 1;
+
+	return rec->type != '\0';
+}
+
+static bool
+confcache_load(struct xbps_handle *xhp, const char *file,
+		const char *confdir, const char *sysconfdir)
+{
+	struct stat st;
+	struct confrec *recs = NULL, *r;
+	char stamp[64], *buf, *p, *end;
+	size_t nrecs = 0, line;
+	ssize_t n;
+	int fd;
+	bool valid = true;
+
+	if ((fd = open(file, O_RDONLY|O_CLOEXEC)) == -1)
+		return false;
+	if (fstat(fd, &st) == -1 ||
+	    st.st_size < (off_t)strlen(CONFCACHE_HEADER)) {
+		close(fd);
+		return false;
+	}
+	buf = malloc((size_t)st.st_size + 1);
+	assert(buf);
+	n = read(fd, buf, (size_t)st.st_size);
+	close(fd);
+	if (n != st.st_size ||
+	    strncmp(buf, CONFCACHE_HEADER, strlen(CONFCACHE_HEADER))) {
+		free(buf);
+		return false;
+	}
+	end = buf + n;
+	*end = '\0';
+
+	/* a newline is counted for every record */
+	for (p = buf; (p = memchr(p, '\n', (size_t)(end - p))); p++)
+		nrecs++;
+	recs = calloc(nrecs, sizeof(*recs));
+	assert(recs);
+	p = buf + strlen(CONFCACHE_HEADER);
+	for (nrecs = 0; valid && p < end; nrecs++)
+		valid = confcache_next(&p, end, &recs[nrecs]);
+
+	/* check that the snapshot is up to date */
+	if (valid && (nrecs == 0 || recs[0].type != 'D' ||
+	    recs[0].f[1] == NULL || strcmp(recs[0].f[0], confdir) ||
+	    strcmp(recs[0].f[1], sysconfdir)))
+		valid = false;
+	for (size_t i = 1; valid && i < nrecs; i++) {
+		r = &recs[i];
+		if (r->type != 'S')
+			continue;
+		if (r->f[1] == NULL) {
+			valid = false;
+			break;
+		}
+		confcache_stamp(r->f[1], stamp, sizeof(stamp));
+		if (strcmp(r->f[0], stamp)) {
+			xbps_dbg_printf(xhp, "%s: %s has changed\n", file, r->f[1]);
+			valid = false;
+		}
+	}
+	if (!valid) {
+		free(recs);
+		free(buf);
+		return false;
+	}
+
+	xbps_dbg_printf(xhp, "Using configuration snapshot: %s\n", file);
+	for (size_t i = 1; i < nrecs; i++) {
+		r = &recs[i];
+		if (r->type == 'C' && r->f[0]) {
+			if (chdir(r->f[0]) == -1)
+				xbps_dbg_printf(xhp, "cannot chdir to %s: %s\n",
+				    r->f[0], strerror(errno));
+		} else if (r->type == 'O' && r->f[3]) {
+			line = (size_t)strtoul(r->f[1], NULL, 10);
+			set_option(xhp, r->f[0], line, r->f[2], r->f[3]);
+		}
+	}
+	free(recs);
+	free(buf);
+
+	return true;
+}
+
+static void
+confcache_begin(const char *confdir, const char *sysconfdir)
+{
+	confcache_size = 4096;
+	confcache = malloc(confcache_size);
+	assert(confcache);
+	confcache_len = strlen(CONFCACHE_HEADER);
+	memcpy(confcache, CONFCACHE_HEADER, confcache_len);
+	confcache_add('D', confdir, sysconfdir, NULL);
+}
+
+static void
+confcache_end(struct xbps_handle *xhp, const char *file, bool store)
+{
+	char *tmp;
+	int fd = -1;
+
+	if (confcache == NULL)
+		return;
+
+	if (store) {
+		/* replace the snapshot atomically */
+		tmp = xbps_xasprintf("%s.XXXXXX", file);
+		if ((fd = mkstemp(tmp)) == -1 ||
+		    fchmod(fd, 0644) == -1 ||
+		    write(fd, confcache, confcache_len) != (ssize_t)confcache_len ||
+		    rename(tmp, file) == -1) {
+			xbps_dbg_printf(xhp, "cannot write configuration "
+			    "snapshot %s: %s\n", file, strerror(errno));
+			if (fd != -1)
+				unlink(tmp);
+		}
+		if (fd != -1)
+			close(fd);
+		free(tmp);
+	}
+	free(confcache);
+	confcache = NULL;
+}
+
 static bool
 parse_option(char *buf, char **k, char **v)
 {
@@ -149,20 +426,37 @@ parse_option(char *buf, char **k, char **v)
 	const char *keys[] = {
 		"rootdir",
 		"cachedir",
+		"sharedcachedir",
 		"syslog",
 		"repository",
 		"virtualpkg",
 		"include",
 		"preserve",
 		"bestmatching",
-		"architecture"
+		"architecture",
+		"fetch_jobs",
+		"fetch_bufsize",
+		"fetch_segments",
+		"pipeline_commit",
+		"binary_plists",
+		"unpack_jobs",
+		"unpack_readahead",
+		"unpack_sync",
+		"unpack_io_uring",
+		"verify_cache",
+		"release_repodata",
+		"low_cache_impact",
+		"repository_files",
+		"unpack_verity",
+		"worker_threads"
 	};
 	bool found = false;
 
 	for (unsigned int i = 0; i < __arraycount(keys); i++) {
 		key = __UNCONST(keys[i]);
 		klen = strlen(key);
-		if (strncmp(buf, key, klen) == 0) {
+		/* "repository" is a prefix of "repository_files" */
+		if (strncmp(buf, key, klen) == 0 && buf[klen] == '=') {
 			found = true;
 			break;
 		}
@@ -189,6 +483,150 @@ parse_option(char *buf, char **k, char **v)
 	return true;
 }
 
+static void
+set_option(struct xbps_handle *xhp, const char *path, size_t nlines,
+	const char *k, char *v)
+{
+	if (strcmp(k, "rootdir") == 0) {
+		xbps_dbg_printf(xhp, "%s: rootdir set to %s\n",
+		    path, v);
+		snprintf(xhp->rootdir, sizeof(xhp->rootdir), "%s", v);
+	} else if (strcmp(k, "cachedir") == 0) {
+		xbps_dbg_printf(xhp, "%s: cachedir set to %s\n",
+		    path, v);
+		snprintf(xhp->cachedir, sizeof(xhp->cachedir), "%s", v);
+	} else if (strcmp(k, "sharedcachedir") == 0) {
+		xbps_dbg_printf(xhp, "%s: sharedcachedir set to %s\n",
+		    path, v);
+		snprintf(xhp->sharedcachedir,
+		    sizeof(xhp->sharedcachedir), "%s", v);
+	} else if (strcmp(k, "architecture") == 0) {
+		xbps_dbg_printf(xhp, "%s: native architecture set to %s\n",
+		    path, v);
+		snprintf(xhp->native_arch, sizeof(xhp->native_arch), "%s", v);
+	} else if (strcmp(k, "syslog") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags &= ~XBPS_FLAG_DISABLE_SYSLOG;
+			xbps_dbg_printf(xhp, "%s: syslog enabled\n", path);
+		} else {
+			xhp->flags |= XBPS_FLAG_DISABLE_SYSLOG;
+			xbps_dbg_printf(xhp, "%s: syslog disabled\n", path);
+		}
+	} else if (strcmp(k, "repository") == 0) {
+		if (store_repo(xhp, v))
+			xbps_dbg_printf(xhp, "%s: added repository %s\n", path, v);
+	} else if (strcmp(k, "virtualpkg") == 0) {
+		store_vars(xhp, &xhp->vpkgd, k, path, nlines, v);
+	} else if (strcmp(k, "preserve") == 0) {
+		store_preserved_file(xhp, v);
+	} else if (strcmp(k, "bestmatching") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_BESTMATCH;
+			xbps_dbg_printf(xhp, "%s: pkg best matching enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_BESTMATCH;
+			xbps_dbg_printf(xhp, "%s: pkg best matching disabled\n", path);
+		}
+		xbps_dbg_printf(xhp, "%s: enabling pkg best matching\n", path);
+	} else if (strcmp(k, "fetch_jobs") == 0) {
+		xhp->fetch_jobs = (unsigned int)strtoul(v, NULL, 10);
+		xbps_dbg_printf(xhp, "%s: fetch_jobs set to %u\n",
+		    path, xhp->fetch_jobs);
+	} else if (strcmp(k, "fetch_bufsize") == 0) {
+		xhp->fetch_bufsize = (size_t)strtoul(v, NULL, 10);
+		xbps_dbg_printf(xhp, "%s: fetch_bufsize set to %zu\n",
+		    path, xhp->fetch_bufsize);
+	} else if (strcmp(k, "fetch_segments") == 0) {
+		xhp->fetch_segments = (unsigned int)strtoul(v, NULL, 10);
+		xbps_dbg_printf(xhp, "%s: fetch_segments set to %u\n",
+		    path, xhp->fetch_segments);
+	} else if (strcmp(k, "unpack_jobs") == 0) {
+		xhp->unpack_jobs = (unsigned int)strtoul(v, NULL, 10);
+		xbps_dbg_printf(xhp, "%s: unpack_jobs set to %u\n",
+		    path, xhp->unpack_jobs);
+	} else if (strcmp(k, "unpack_readahead") == 0) {
+		xhp->unpack_readahead = (unsigned int)strtoul(v, NULL, 10);
+		xbps_dbg_printf(xhp, "%s: unpack_readahead set to %u\n",
+		    path, xhp->unpack_readahead);
+	} else if (strcmp(k, "worker_threads") == 0) {
+		xhp->worker_threads = (unsigned int)strtoul(v, NULL, 10);
+		xbps_dbg_printf(xhp, "%s: worker_threads set to %u\n",
+		    path, xhp->worker_threads);
+	} else if (strcmp(k, "pipeline_commit") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_PIPELINE_COMMIT;
+			xbps_dbg_printf(xhp, "%s: pipelined commit enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_PIPELINE_COMMIT;
+			xbps_dbg_printf(xhp, "%s: pipelined commit disabled\n", path);
+		}
+	} else if (strcmp(k, "binary_plists") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_BINARY_PLISTS;
+			xbps_dbg_printf(xhp, "%s: binary plists enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_BINARY_PLISTS;
+			xbps_dbg_printf(xhp, "%s: binary plists disabled\n", path);
+		}
+	} else if (strcmp(k, "unpack_sync") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_UNPACK_SYNC;
+			xbps_dbg_printf(xhp, "%s: synchronous unpack enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_UNPACK_SYNC;
+			xbps_dbg_printf(xhp, "%s: synchronous unpack disabled\n", path);
+		}
+	} else if (strcmp(k, "unpack_io_uring") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_UNPACK_IO_URING;
+			xbps_dbg_printf(xhp, "%s: io_uring unpack enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_UNPACK_IO_URING;
+			xbps_dbg_printf(xhp, "%s: io_uring unpack disabled\n", path);
+		}
+	} else if (strcmp(k, "verify_cache") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_VERIFY_CACHE;
+			xbps_dbg_printf(xhp, "%s: verify cache enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_VERIFY_CACHE;
+			xbps_dbg_printf(xhp, "%s: verify cache disabled\n", path);
+		}
+	} else if (strcmp(k, "release_repodata") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_RELEASE_REPODATA;
+			xbps_dbg_printf(xhp, "%s: release repodata enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_RELEASE_REPODATA;
+			xbps_dbg_printf(xhp, "%s: release repodata disabled\n", path);
+		}
+	} else if (strcmp(k, "low_cache_impact") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_LOW_CACHE;
+			xbps_dbg_printf(xhp, "%s: low cache impact enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_LOW_CACHE;
+			xbps_dbg_printf(xhp, "%s: low cache impact disabled\n", path);
+		}
+	} else if (strcmp(k, "repository_files") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_REPOS_FILES;
+			xbps_dbg_printf(xhp, "%s: repository files index enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_REPOS_FILES;
+			xbps_dbg_printf(xhp, "%s: repository files index disabled\n", path);
+		}
+	} else if (strcmp(k, "unpack_verity") == 0) {
+		if (strcasecmp(v, "true") == 0) {
+			xhp->flags |= XBPS_FLAG_UNPACK_VERITY;
+			xbps_dbg_printf(xhp, "%s: fs-verity unpack enabled\n", path);
+		} else {
+			xhp->flags &= ~XBPS_FLAG_UNPACK_VERITY;
+			xbps_dbg_printf(xhp, "%s: fs-verity unpack disabled\n", path);
+		}
+	}
+}
+
 static int
 parse_files_glob(struct xbps_handle *xhp, const char *cwd, const char *path, bool nested)
 {
@@ -220,6 +658,7 @@ parse_file(struct xbps_handle *xhp, const char *cwd, const char *path, bool nest
 		xbps_dbg_printf(xhp, "cannot read configuration file %s: %s\n", path, strerror(rv));
 		return rv;
 	}
+	confcache_input(path);
 
 	xbps_dbg_printf(xhp, "Parsing configuration file: %s\n", path);
 
@@ -239,43 +678,9 @@ parse_file(struct xbps_handle *xhp, const char *cwd, const char *path, bool nest
 			    "line %zu\n", path, nlines);
 			continue;
 		}
-		if (strcmp(k, "rootdir") == 0) {
-			xbps_dbg_printf(xhp, "%s: rootdir set to %s\n",
-			    path, v);
-			snprintf(xhp->rootdir, sizeof(xhp->rootdir), "%s", v);
-		} else if (strcmp(k, "cachedir") == 0) {
-			xbps_dbg_printf(xhp, "%s: cachedir set to %s\n",
-			    path, v);
-			snprintf(xhp->cachedir, sizeof(xhp->cachedir), "%s", v);
-		} else if (strcmp(k, "architecture") == 0) {
-			xbps_dbg_printf(xhp, "%s: native architecture set to %s\n",
-			    path, v);
-			snprintf(xhp->native_arch, sizeof(xhp->native_arch), "%s", v);
-		} else if (strcmp(k, "syslog") == 0) {
-			if (strcasecmp(v, "true") == 0) {
-				xhp->flags &= ~XBPS_FLAG_DISABLE_SYSLOG;
-				xbps_dbg_printf(xhp, "%s: syslog enabled\n", path);
-			} else {
-				xhp->flags |= XBPS_FLAG_DISABLE_SYSLOG;
-				xbps_dbg_printf(xhp, "%s: syslog disabled\n", path);
-			}
-		} else if (strcmp(k, "repository") == 0) {
-			if (store_repo(xhp, v))
-				xbps_dbg_printf(xhp, "%s: added repository %s\n", path, v);
-		} else if (strcmp(k, "virtualpkg") == 0) {
-			store_vars(xhp, &xhp->vpkgd, k, path, nlines, v);
-		} else if (strcmp(k, "preserve") == 0) {
-			store_preserved_file(xhp, v);
-		} else if (strcmp(k, "bestmatching") == 0) {
-			if (strcasecmp(v, "true") == 0) {
-				xhp->flags |= XBPS_FLAG_BESTMATCH;
-				xbps_dbg_printf(xhp, "%s: pkg best matching enabled\n", path);
-			} else {
-				xhp->flags &= ~XBPS_FLAG_BESTMATCH;
-				xbps_dbg_printf(xhp, "%s: pkg best matching disabled\n", path);
-			}
-			xbps_dbg_printf(xhp, "%s: enabling pkg best matching\n", path);
-		}
+		confcache_option(path, nlines, k, v);
+		set_option(xhp, path, nlines, k, v);
+
 		/* Avoid double-nested parsing, only allow it once */
 		if (nested)
 			continue;
@@ -291,6 +696,7 @@ parse_file(struct xbps_handle *xhp, const char *cwd, const char *path, bool nest
 			xbps_dbg_printf(xhp, "cannot chdir to %s: %s\n", cfcwd, strerror(rv));
 			return rv;
 		}
+		confcache_include(cfcwd, v);
 		if ((rv = parse_files_glob(xhp, cwd, v, true)) != 0)
 			break;
 
@@ -310,6 +716,8 @@ parse_dir(struct xbps_handle *xhp, const char *cwd, const char *confdir, const c
 
 	if (confdir == NULL)
 		goto stage2;
+
+	confcache_input(confdir);
 	/*
 	 * Read all configuration files stored in the system
 	 * foo.d directory.
@@ -350,6 +758,8 @@ stage2:
 	if (sysconfdir == NULL)
 		return rv;
 
+	confcache_input(sysconfdir);
+
 	/*
 	 * Read all configuration files stored in the configuration foo.d directory.
 	 */
@@ -398,11 +808,20 @@ xbps_init(struct xbps_handle *xhp)
 {
 	struct utsname un;
 	char cwd[PATH_MAX-1], sysconfdir[XBPS_MAXPATH+sizeof(XBPS_SYSDEFCONF_PATH)], *buf;
-	const char *repodir, *native_arch;
+	const char *repodir, *native_arch, *confcachefile;
 	int rv;
 
 	assert(xhp != NULL);
 
+	xbps_trace_open();
+	xbps_counters_init(xhp);
+	xhp->journal_fd = -1;
+	xhp->pkgdb_revdeps_stale = false;
+	xhp->mirror_ranks = NULL;
+	xhp->verify_cache = NULL;
+	xhp->verify_cache_dirty = false;
+	xhp->pkgdb_files_changed = NULL;
+
 	/* get cwd */
 	if (getcwd(cwd, sizeof(cwd)) == NULL)
 		return ENOTSUP;
@@ -445,9 +864,19 @@ xbps_init(struct xbps_handle *xhp)
 
 	xbps_fetch_set_cache_connection(XBPS_FETCH_CACHECONN, XBPS_FETCH_CACHECONN_HOST);
 
-	/* process xbps.d */
-	if ((rv = parse_dir(xhp, cwd, xhp->confdir, sysconfdir)) != 0)
-		return rv;
+	/* process xbps.d, or replay its configuration snapshot */
+	confcachefile = getenv("XBPS_CONF_CACHE");
+	if (confcachefile != NULL && *confcachefile == '\0')
+		confcachefile = NULL;
+	if (confcachefile == NULL ||
+	    !confcache_load(xhp, confcachefile, xhp->confdir, sysconfdir)) {
+		if (confcachefile != NULL)
+			confcache_begin(xhp->confdir, sysconfdir);
+		rv = parse_dir(xhp, cwd, xhp->confdir, sysconfdir);
+		confcache_end(xhp, confcachefile, rv == 0);
+		if (rv != 0)
+			return rv;
+	}
 
 	/* Set cachedir */
 	if (xhp->cachedir[0] == '\0') {
@@ -474,13 +903,36 @@ xbps_init(struct xbps_handle *xhp)
 		free(buf);
 	}
 
+	if ((buf = getenv("XBPS_LOW_CACHE_IMPACT")) != NULL && *buf != '\0') {
+		if (strcmp(buf, "0") == 0 || strcasecmp(buf, "false") == 0)
+			xhp->flags &= ~XBPS_FLAG_LOW_CACHE;
+		else
+			xhp->flags |= XBPS_FLAG_LOW_CACHE;
+	}
+
 	xbps_dbg_printf(xhp, "rootdir=%s\n", xhp->rootdir);
 	xbps_dbg_printf(xhp, "metadir=%s\n", xhp->metadir);
 	xbps_dbg_printf(xhp, "cachedir=%s\n", xhp->cachedir);
+	xbps_dbg_printf(xhp, "sharedcachedir=%s\n", xhp->sharedcachedir);
 	xbps_dbg_printf(xhp, "confdir=%s\n", xhp->confdir);
 	xbps_dbg_printf(xhp, "sysconfdir=%s\n", sysconfdir);
 	xbps_dbg_printf(xhp, "syslog=%s\n", xhp->flags & XBPS_FLAG_DISABLE_SYSLOG ? "false" : "true");
 	xbps_dbg_printf(xhp, "bestmatching=%s\n", xhp->flags & XBPS_FLAG_BESTMATCH ? "true" : "false");
+	xbps_dbg_printf(xhp, "fetch_jobs=%u\n", xhp->fetch_jobs);
+	xbps_dbg_printf(xhp, "fetch_bufsize=%zu\n", xhp->fetch_bufsize);
+	xbps_dbg_printf(xhp, "fetch_segments=%u\n", xhp->fetch_segments);
+	xbps_dbg_printf(xhp, "unpack_jobs=%u\n", xhp->unpack_jobs);
+	xbps_dbg_printf(xhp, "unpack_readahead=%u\n", xhp->unpack_readahead);
+	xbps_dbg_printf(xhp, "worker_threads=%u\n", xhp->worker_threads);
+	xbps_dbg_printf(xhp, "pipeline_commit=%s\n", xhp->flags & XBPS_FLAG_PIPELINE_COMMIT ? "true" : "false");
+	xbps_dbg_printf(xhp, "binary_plists=%s\n", xhp->flags & XBPS_FLAG_BINARY_PLISTS ? "true" : "false");
+	xbps_dbg_printf(xhp, "unpack_sync=%s\n", xhp->flags & XBPS_FLAG_UNPACK_SYNC ? "true" : "false");
+	xbps_dbg_printf(xhp, "unpack_io_uring=%s\n", xhp->flags & XBPS_FLAG_UNPACK_IO_URING ? "true" : "false");
+	xbps_dbg_printf(xhp, "verify_cache=%s\n", xhp->flags & XBPS_FLAG_VERIFY_CACHE ? "true" : "false");
+	xbps_dbg_printf(xhp, "release_repodata=%s\n", xhp->flags & XBPS_FLAG_RELEASE_REPODATA ? "true" : "false");
+	xbps_dbg_printf(xhp, "low_cache_impact=%s\n", xhp->flags & XBPS_FLAG_LOW_CACHE ? "true" : "false");
+	xbps_dbg_printf(xhp, "repository_files=%s\n", xhp->flags & XBPS_FLAG_REPOS_FILES ? "true" : "false");
+	xbps_dbg_printf(xhp, "unpack_verity=%s\n", xhp->flags & XBPS_FLAG_UNPACK_VERITY ? "true" : "false");
 	xbps_dbg_printf(xhp, "Architecture: %s\n", xhp->native_arch);
 	xbps_dbg_printf(xhp, "Target Architecture: %s\n", xhp->target_arch);
 
@@ -503,7 +955,19 @@ xbps_end(struct xbps_handle *xhp)
 {
 	assert(xhp);
 
+	if (xhp->flags & XBPS_FLAG_DEBUG)
+		xbps_memstat_print(xhp);
+	xbps_fetch_warmup_wait();
 	xbps_pkgdb_release(xhp);
+	xbps_pkgdb_files_release(xhp);
+	xbps_pkg_index_release();
+	xbps_repo_mirrors_release(xhp);
+	xbps_verify_cache_release(xhp);
+	xbps_pool_release(xhp);
+	if (xhp->flags & XBPS_FLAG_DEBUG)
+		xbps_counters_print(xhp);
+	xbps_object_pool_trim();
+	xbps_trace_close();
 }
 
 static void
@@ -0,0 +1,128 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "xbps_api_impl.h"
+
+int
+xbps_memstat_foreach(struct xbps_handle *xhp,
+		int (*fn)(const char *, const char *,
+			const struct xbps_memstat *, void *),
+		void *arg)
+{
+	struct xbps_memstat ms;
+	const struct {
+		const char *name;
+		xbps_object_t obj;
+	} objs[] = {
+		{ "pkgdb", xhp->pkgdb },
+		{ "pkgdb_revdeps", xhp->pkgdb_revdeps },
+		{ "pkgdb_shlibs", xhp->pkgdb_shlibs },
+		{ "pkgdb_deptree", xhp->pkgdb_deptree },
+		{ "rpool_deptree", xhp->rpool_deptree },
+		{ "vpkgd", xhp->vpkgd },
+		{ "vpkgd_conf", xhp->vpkgd_conf },
+		{ "altlinks", xhp->altlinks },
+		{ "transd", xhp->transd },
+	};
+	int rv;
+
+	assert(fn != NULL);
+
+	for (size_t i = 0; i < __arraycount(objs); i++) {
+		if (objs[i].obj == NULL)
+			continue;
+		memset(&ms, 0, sizeof(ms));
+		xbps_object_memstat(objs[i].obj, &ms);
+		if ((rv = (*fn)(objs[i].name, NULL, &ms, arg)) != 0)
+			return rv;
+	}
+	memset(&ms, 0, sizeof(ms));
+	xbps_pkgdb_files_memstat(&ms);
+	if ((rv = (*fn)("pkgdb_files", NULL, &ms, arg)) != 0)
+		return rv;
+
+	return xbps_rpool_memstat(xhp, fn, arg);
+}
+
+struct memstat_print {
+	struct xbps_handle *xhp;
+	uint64_t objects;
+	uint64_t bytes;
+};
+
+static int
+memstat_print_cb(const char *name, const char *uri,
+		const struct xbps_memstat *ms, void *arg)
+{
+	static const char *types[XBPS_MEMSTAT_NTYPES] = {
+		"bool", "number", "string", "data", "array", "dict", "keysym"
+	};
+	struct memstat_print *mp = arg;
+	char buf[256];
+	uint64_t objects = 0, bytes = 0;
+	size_t len = 0;
+
+	buf[0] = '\0';
+	for (int i = 0; i < XBPS_MEMSTAT_NTYPES; i++) {
+		objects += ms->objects[i];
+		bytes += ms->bytes[i];
+		if (ms->objects[i] == 0 || len >= sizeof(buf))
+			continue;
+		len += snprintf(buf + len, sizeof(buf) - len,
+		    "%s%s %" PRIu64 "/%" PRIu64, len ? ", " : "",
+		    types[i], ms->objects[i], ms->bytes[i]);
+	}
+	if (objects == 0)
+		return 0;
+	mp->objects += objects;
+	mp->bytes += bytes;
+	xbps_dbg_printf(mp->xhp, "[memstat] %s%s%s: %" PRIu64 " bytes in %"
+	    PRIu64 " objects%s%s%s\n", uri ? uri : "", uri ? " " : "", name,
+	    bytes, objects, len ? " (" : "", buf, len ? ")" : "");
+
+	return 0;
+}
+
+/*
+ * Prints the report of xbps_memstat_foreach(), every line has the
+ * objects and bytes by type as "type objects/bytes".
+ */
+void HIDDEN
+xbps_memstat_print(struct xbps_handle *xhp)
+{
+	struct memstat_print mp = { .xhp = xhp };
+
+	(void)xbps_memstat_foreach(xhp, memstat_print_cb, &mp);
+	xbps_dbg_printf(xhp, "[memstat] total: %" PRIu64 " bytes in %" PRIu64
+	    " objects\n", mp.bytes, mp.objects);
+}
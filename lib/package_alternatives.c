@@ -23,6 +23,7 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -106,6 +107,113 @@ relpath(char *from, char *to)
 	return rel;
 }
 
+/*
+ * While a transaction runs, the symlinks to create or remove are recorded
+ * in xhp->altlinks, keyed by the normalized link path relative to rootdir,
+ * with the target as value or an empty string to remove it. Groups that
+ * are switched many times in a transaction only change the recorded
+ * target; xbps_alternatives_flush() then applies the final state once,
+ * leaving alone the symlinks that already point to their target.
+ */
+void HIDDEN
+xbps_alternatives_defer(struct xbps_handle *xhp)
+{
+	if (xhp->altlinks == NULL) {
+		xhp->altlinks = xbps_dictionary_create_hashed(0);
+		assert(xhp->altlinks);
+	}
+}
+
+static void
+altlink_set(struct xbps_handle *xhp, const char *lnk, const char *target)
+{
+	char *key;
+
+	key = strdup(lnk);
+	assert(key);
+	normpath(key);
+	xbps_dictionary_set_cstring(xhp->altlinks, key, target);
+	free(key);
+}
+
+static int
+altlink_create(struct xbps_handle *xhp, const char *lnk, const char *target)
+{
+	char *linkpath, *p, *dir, buf[PATH_MAX];
+	ssize_t len;
+	int rv = 0;
+
+	linkpath = xbps_xasprintf("%s/%s", xhp->rootdir, lnk);
+	len = readlink(linkpath, buf, sizeof(buf) - 1);
+	if (len >= 0) {
+		buf[len] = '\0';
+		if (strcmp(buf, target) == 0) {
+			/* already in place */
+			free(linkpath);
+			return 0;
+		}
+	}
+
+	/* create link directory, necessary for dangling symlinks */
+	p = strdup(linkpath);
+	assert(p);
+	dir = dirname(p);
+	if (strcmp(dir, ".") && xbps_mkpath(dir, 0755) && errno != EEXIST) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "failed to create symlink dir '%s': %s\n",
+		    dir, strerror(errno));
+		goto out;
+	}
+	unlink(linkpath);
+	if (symlink(target, linkpath) != 0) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "failed to create alt symlink '%s': %s\n",
+		    linkpath, strerror(errno));
+	}
+out:
+	free(p);
+	free(linkpath);
+	return rv;
+}
+
+int HIDDEN
+xbps_alternatives_flush(struct xbps_handle *xhp)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	xbps_dictionary_t altlinks;
+	struct stat st;
+	int rv = 0;
+
+	if ((altlinks = xhp->altlinks) == NULL)
+		return 0;
+
+	xhp->altlinks = NULL;
+	iter = xbps_dictionary_iterator(altlinks);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		const char *lnk, *target;
+		char *linkpath;
+
+		lnk = xbps_dictionary_keysym_cstring_nocopy(obj);
+		xbps_dictionary_get_cstring_nocopy(altlinks, lnk, &target);
+		if (*target) {
+			if ((rv = altlink_create(xhp, lnk, target)) != 0)
+				break;
+			continue;
+		}
+		/* don't remove files that replaced the symlink meanwhile */
+		linkpath = xbps_xasprintf("%s/%s", xhp->rootdir, lnk);
+		if (lstat(linkpath, &st) == 0 && S_ISLNK(st.st_mode))
+			unlink(linkpath);
+		free(linkpath);
+	}
+	xbps_object_iterator_release(iter);
+	xbps_object_release(altlinks);
+
+	return rv;
+}
+
 static int
 remove_symlinks(struct xbps_handle *xhp, xbps_array_t a, const char *grname)
 {
@@ -126,14 +234,23 @@ remove_symlinks(struct xbps_handle *xhp, xbps_array_t a, const char *grname)
 			tgt_dup = strdup(tgt);
 			assert(tgt_dup);
 			tgt_dir = dirname(tgt_dup);
-			lnk = xbps_xasprintf("%s%s/%s", xhp->rootdir, tgt_dir, l);
+			lnk = xbps_xasprintf("%s/%s", tgt_dir, l);
 			free(tgt_dup);
 		} else {
-			lnk = xbps_xasprintf("%s%s", xhp->rootdir, l);
+			lnk = strdup(l);
+			assert(lnk);
 		}
 		xbps_set_cb_state(xhp, XBPS_STATE_ALTGROUP_LINK_REMOVED, 0, NULL,
 		    "Removing '%s' alternatives group symlink: %s", grname, l);
-		unlink(lnk);
+		if (xhp->altlinks) {
+			altlink_set(xhp, lnk, "");
+		} else {
+			char *linkpath;
+
+			linkpath = xbps_xasprintf("%s%s", xhp->rootdir, lnk);
+			unlink(linkpath);
+			free(linkpath);
+		}
 		free(lnk);
 		free(l);
 	}
@@ -203,6 +320,13 @@ create_symlinks(struct xbps_handle *xhp, xbps_array_t a, const char *grname)
 			target = p;
 		}
 
+		if (xhp->altlinks) {
+			altlink_set(xhp, linkpath + strlen(xhp->rootdir), target);
+			free(alternative);
+			free(target);
+			free(linkpath);
+			continue;
+		}
 		unlink(linkpath);
 		if ((rv = symlink(target, linkpath)) != 0) {
 			xbps_dbg_printf(xhp,
@@ -298,6 +422,9 @@ xbps_alternatives_set(struct xbps_handle *xhp, const char *pkgname,
 			break;
 	}
 	xbps_object_release(allkeys);
+	if (rv == 0)
+		rv = xbps_pkgdb_journal(xhp, "_XBPS_ALTERNATIVES_");
+
 	return rv;
 }
 
@@ -377,6 +504,8 @@ xbps_alternatives_unregister(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
 	}
 	xbps_object_release(allkeys);
 	free(pkgname);
+	if (rv == 0)
+		rv = xbps_pkgdb_journal(xhp, "_XBPS_ALTERNATIVES_");
 
 	return rv;
 }
@@ -449,6 +578,8 @@ xbps_alternatives_register(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
 	}
 	xbps_object_release(allkeys);
 	free(pkgname);
+	if (rv == 0)
+		rv = xbps_pkgdb_journal(xhp, "_XBPS_ALTERNATIVES_");
 
 	return rv;
 }
@@ -30,54 +30,30 @@
 
 #include "xbps_api_impl.h"
 
-/*
- * Returns true if entry is a configuration file, false otherwise.
- */
-int HIDDEN
-xbps_entry_is_a_conf_file(xbps_dictionary_t filesd,
-			  const char *entry_pname)
-{
-	xbps_array_t array;
-	xbps_dictionary_t d;
-	const char *cffile;
-
-	array = xbps_dictionary_get(filesd, "conf_files");
-	if (xbps_array_count(array) == 0)
-		return false;
-
-	for (unsigned int i = 0; i < xbps_array_count(array); i++) {
-		d = xbps_array_get(array, i);
-		xbps_dictionary_get_cstring_nocopy(d, "file", &cffile);
-		if (strcmp(cffile, entry_pname) == 0)
-			return true;
-	}
-	return false;
-}
-
 /*
  * Returns 1 if entry should be installed, 0 if don't or -1 on error.
+ * The hashes of the file in the new package and in the installed one
+ * (NULL if it wasn't one of its configuration files) are passed by
+ * the caller, \a installed is false if the package isn't installed.
  */
 int HIDDEN
 xbps_entry_install_conf_file(struct xbps_handle *xhp,
-			     xbps_dictionary_t binpkg_filesd,
-			     xbps_dictionary_t pkg_filesd,
+			     const char *sha256_new,
+			     const char *sha256_orig,
+			     bool installed,
 			     struct archive_entry *entry,
 			     const char *entry_pname,
 			     const char *pkgver)
 {
-	xbps_object_t obj, obj2;
-	xbps_object_iterator_t iter, iter2;
-	const char *version = NULL, *cffile, *sha256_new = NULL;
-	char buf[PATH_MAX], *sha256_cur = NULL, *sha256_orig = NULL;
+	const char *version = NULL, *cffile;
+	char buf[PATH_MAX], *sha256_cur = NULL;
 	int rv = 0;
 
-	assert(xbps_object_type(binpkg_filesd) == XBPS_TYPE_DICTIONARY);
 	assert(entry);
 	assert(entry_pname);
 	assert(pkgver);
 
-	iter = xbps_array_iter_from_dict(binpkg_filesd, "conf_files");
-	if (iter == NULL)
+	if (sha256_new == NULL)
 		return -1;
 
 	/*
@@ -87,7 +63,7 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 	xbps_dbg_printf(xhp, "%s: processing conf_file %s\n",
 	    pkgver, entry_pname);
 
-	if (pkg_filesd == NULL) {
+	if (!installed) {
 		/*
 		 * File exists on disk but it's not managed by the same package.
 		 * Install it as file.new-<version>.
@@ -104,20 +80,6 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 		rv = 1;
 		goto out;
 	}
-
-	iter2 = xbps_array_iter_from_dict(pkg_filesd, "conf_files");
-	if (iter2 != NULL) {
-		while ((obj2 = xbps_object_iterator_next(iter2))) {
-			xbps_dictionary_get_cstring_nocopy(obj2,
-			    "file", &cffile);
-			snprintf(buf, sizeof(buf), ".%s", cffile);
-			if (strcmp(entry_pname, buf) == 0) {
-				xbps_dictionary_get_cstring(obj2, "sha256", &sha256_orig);
-				break;
-			}
-		}
-		xbps_object_iterator_release(iter2);
-	}
 	/*
 	 * First case: original hash not found, install new file.
 	 */
@@ -131,111 +93,89 @@ xbps_entry_install_conf_file(struct xbps_handle *xhp,
 	/*
 	 * Compare original, installed and new hash for current file.
 	 */
-	while ((obj = xbps_object_iterator_next(iter))) {
-		xbps_dictionary_get_cstring_nocopy(obj, "file", &cffile);
-		snprintf(buf, sizeof(buf), ".%s", cffile);
-		if (strcmp(entry_pname, buf)) {
-			continue;
-		}
-		sha256_cur = xbps_file_hash(buf);
-		xbps_dictionary_get_cstring_nocopy(obj, "sha256", &sha256_new);
-		if (sha256_cur == NULL) {
-			if (errno == ENOENT) {
-				/*
-				 * File not installed, install new one.
-				 */
-				xbps_dbg_printf(xhp, "%s: conf_file %s not "
-				    "installed\n", pkgver, entry_pname);
-				rv = 1;
-				break;
-			} else {
-				rv = -1;
-				break;
-			}
-		}
-		/*
-		 * Orig = X, Curr = X, New = X
-		 *
-		 * Keep file as is (no changes).
-		 */
-		if ((strcmp(sha256_orig, sha256_cur) == 0) &&
-		    (strcmp(sha256_orig, sha256_new) == 0) &&
-		    (strcmp(sha256_cur, sha256_new) == 0)) {
-			xbps_dbg_printf(xhp, "%s: conf_file %s orig = X, "
-			    "cur = X, new = X\n", pkgver, entry_pname);
-			rv = 0;
-			break;
-		/*
-		 * Orig = X, Curr = X, New = Y
-		 *
-		 * Install new file (installed file hasn't been modified).
-		 */
-		} else if ((strcmp(sha256_orig, sha256_cur) == 0) &&
-			   (strcmp(sha256_orig, sha256_new)) &&
-			   (strcmp(sha256_cur, sha256_new))) {
-			xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
-			    0, pkgver,
-			    "Updating configuration file `%s' provided "
-			    "by `%s'.", cffile, pkgver);
-			rv = 1;
-			break;
-		/*
-		 * Orig = X, Curr = Y, New = X
-		 *
-		 * Keep installed file as is because it has been modified,
-		 * but new package doesn't contain new changes compared
-		 * to the original version.
-		 */
-		} else if ((strcmp(sha256_orig, sha256_new) == 0) &&
-			   (strcmp(sha256_cur, sha256_new)) &&
-			   (strcmp(sha256_orig, sha256_cur))) {
-			xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
-			    0, pkgver,
-			    "Keeping modified configuration file `%s'.",
-			    cffile);
-			rv = 0;
-			break;
-		/*
-		 * Orig = X, Curr = Y, New = Y
-		 *
-		 * Keep file as is because changes made are compatible
-		 * with new version.
-		 */
-		} else if ((strcmp(sha256_cur, sha256_new) == 0) &&
-			   (strcmp(sha256_orig, sha256_new)) &&
-			   (strcmp(sha256_orig, sha256_cur))) {
-			xbps_dbg_printf(xhp, "%s: conf_file %s orig = X, "
-			    "cur = Y, new = Y\n", pkgver, entry_pname);
-			rv = 0;
-			break;
-		/*
-		 * Orig = X, Curr = Y, New = Z
-		 *
-		 * Install new file as <file>.new-<version>
-		 */
-		} else  if ((strcmp(sha256_orig, sha256_cur)) &&
-			    (strcmp(sha256_cur, sha256_new)) &&
-			    (strcmp(sha256_orig, sha256_new))) {
-			version = xbps_pkg_version(pkgver);
-			assert(version);
-			snprintf(buf, sizeof(buf), ".%s.new-%s", cffile, version);
-			xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
-			    0, pkgver, "File `%s' exists, installing configuration file to `%s'.", cffile, buf);
-			archive_entry_copy_pathname(entry, buf);
+	cffile = entry_pname + 1;
+	sha256_cur = xbps_file_hash(entry_pname);
+	if (sha256_cur == NULL) {
+		if (errno == ENOENT) {
+			/*
+			 * File not installed, install new one.
+			 */
+			xbps_dbg_printf(xhp, "%s: conf_file %s not "
+			    "installed\n", pkgver, entry_pname);
 			rv = 1;
-			break;
+		} else {
+			rv = -1;
 		}
-		free(sha256_cur);
-		sha256_cur = NULL;
+	/*
+	 * Orig = X, Curr = X, New = X
+	 *
+	 * Keep file as is (no changes).
+	 */
+	} else if ((strcmp(sha256_orig, sha256_cur) == 0) &&
+	    (strcmp(sha256_orig, sha256_new) == 0) &&
+	    (strcmp(sha256_cur, sha256_new) == 0)) {
+		xbps_dbg_printf(xhp, "%s: conf_file %s orig = X, "
+		    "cur = X, new = X\n", pkgver, entry_pname);
+		rv = 0;
+	/*
+	 * Orig = X, Curr = X, New = Y
+	 *
+	 * Install new file (installed file hasn't been modified).
+	 */
+	} else if ((strcmp(sha256_orig, sha256_cur) == 0) &&
+		   (strcmp(sha256_orig, sha256_new)) &&
+		   (strcmp(sha256_cur, sha256_new))) {
+		xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
+		    0, pkgver,
+		    "Updating configuration file `%s' provided "
+		    "by `%s'.", cffile, pkgver);
+		rv = 1;
+	/*
+	 * Orig = X, Curr = Y, New = X
+	 *
+	 * Keep installed file as is because it has been modified,
+	 * but new package doesn't contain new changes compared
+	 * to the original version.
+	 */
+	} else if ((strcmp(sha256_orig, sha256_new) == 0) &&
+		   (strcmp(sha256_cur, sha256_new)) &&
+		   (strcmp(sha256_orig, sha256_cur))) {
+		xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
+		    0, pkgver,
+		    "Keeping modified configuration file `%s'.",
+		    cffile);
+		rv = 0;
+	/*
+	 * Orig = X, Curr = Y, New = Y
+	 *
+	 * Keep file as is because changes made are compatible
+	 * with new version.
+	 */
+	} else if ((strcmp(sha256_cur, sha256_new) == 0) &&
+		   (strcmp(sha256_orig, sha256_new)) &&
+		   (strcmp(sha256_orig, sha256_cur))) {
+		xbps_dbg_printf(xhp, "%s: conf_file %s orig = X, "
+		    "cur = Y, new = Y\n", pkgver, entry_pname);
+		rv = 0;
+	/*
+	 * Orig = X, Curr = Y, New = Z
+	 *
+	 * Install new file as <file>.new-<version>
+	 */
+	} else  if ((strcmp(sha256_orig, sha256_cur)) &&
+		    (strcmp(sha256_cur, sha256_new)) &&
+		    (strcmp(sha256_orig, sha256_new))) {
+		version = xbps_pkg_version(pkgver);
+		assert(version);
+		snprintf(buf, sizeof(buf), ".%s.new-%s", cffile, version);
+		xbps_set_cb_state(xhp, XBPS_STATE_CONFIG_FILE,
+		    0, pkgver, "File `%s' exists, installing configuration file to `%s'.", cffile, buf);
+		archive_entry_copy_pathname(entry, buf);
+		rv = 1;
 	}
 
 out:
-	if (sha256_orig)
-		free(sha256_orig);
-	if (sha256_cur)
-		free(sha256_cur);
-
-	xbps_object_iterator_release(iter);
+	free(sha256_cur);
 
 	xbps_dbg_printf(xhp, "%s: conf_file %s returned %d\n",
 	    pkgver, entry_pname, rv);
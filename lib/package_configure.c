@@ -23,12 +23,18 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/wait.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "xbps_api_impl.h"
+
+static int configure_get_pkg(struct xbps_handle *, const char *, bool,
+		xbps_dictionary_t *);
+
 /**
  * @file lib/package_configure.c
  * @brief Package configuration routines
@@ -40,6 +46,9 @@
  *  - Its state will be changed to XBPS_PKG_STATE_INSTALLED if previous step
  *    ran successful.
  *
+ * When configuring all packages, the triggers of the configured packages
+ * are executed once at the end.
+ *
  * @note
  * If the \a XBPS_FLAG_FORCE_CONFIGURE is set through xbps_init() in the flags
   member, the package (or packages) will be reconfigured even if its
@@ -48,7 +57,7 @@
 int
 xbps_configure_packages(struct xbps_handle *xhp, xbps_array_t ignpkgs)
 {
-	xbps_dictionary_t pkgd;
+	xbps_dictionary_t pkgd, triggers;
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
 	const char *pkgver;
@@ -57,6 +66,8 @@ xbps_configure_packages(struct xbps_handle *xhp, xbps_array_t ignpkgs)
 	if ((rv = xbps_pkgdb_init(xhp)) != 0)
 		return rv;
 
+	triggers = xbps_dictionary_create();
+	assert(triggers);
 	iter = xbps_dictionary_iterator(xhp->pkgdb);
 	assert(iter);
 	while ((obj = xbps_object_iterator_next(iter))) {
@@ -71,6 +82,8 @@ xbps_configure_packages(struct xbps_handle *xhp, xbps_array_t ignpkgs)
 				continue;
 			}
 		}
+		if (configure_get_pkg(xhp, pkgver, true, &pkgd) == 0 && pkgd)
+			xbps_triggers_add(triggers, pkgd);
 		rv = xbps_configure_pkg(xhp, pkgver, true, false);
 		if (rv != 0) {
 			xbps_dbg_printf(xhp, "%s: failed to configure %s: %s\n",
@@ -80,22 +93,27 @@ xbps_configure_packages(struct xbps_handle *xhp, xbps_array_t ignpkgs)
 	}
 	xbps_object_iterator_release(iter);
 
+	if (rv == 0)
+		rv = xbps_triggers_run(xhp, triggers);
+	xbps_object_release(triggers);
+
 	return rv;
 }
 
-int
-xbps_configure_pkg(struct xbps_handle *xhp,
-		   const char *pkgver,
-		   bool check_state,
-		   bool update)
+/*
+ * Returns in pkgdp the pkgdb dictionary of pkgver if it has to be
+ * configured, NULL if it's already configured.
+ */
+static int
+configure_get_pkg(struct xbps_handle *xhp, const char *pkgver,
+		bool check_state, xbps_dictionary_t *pkgdp)
 {
 	xbps_dictionary_t pkgd;
 	char *pkgname;
-	int rv = 0;
+	int rv;
 	pkg_state_t state = 0;
-	mode_t myumask;
 
-	assert(pkgver != NULL);
+	*pkgdp = NULL;
 
 	if ((pkgname = xbps_pkg_name(pkgver)) == NULL) {
 		xbps_dbg_printf(xhp, "[configure] cannot guess "
@@ -130,18 +148,25 @@ xbps_configure_pkg(struct xbps_handle *xhp,
 			return EINVAL;
 		}
 	}
+	*pkgdp = pkgd;
+	return 0;
+}
 
-	myumask = umask(022);
-
-	xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE, 0, pkgver, NULL);
+/*
+ * Completes the configuration of pkgver once its post ACTION has been
+ * executed with result rv.
+ */
+static int
+configure_finish(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
+		const char *pkgver, int rv)
+{
+	char *pkgname;
 
-	rv = xbps_pkg_exec_script(xhp, pkgd, "install-script", "post", update);
 	if (rv != 0) {
 		xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE_FAIL,
 		    errno, pkgver,
 		    "%s: [configure] INSTALL script failed to execute "
 		    "the post ACTION: %s", pkgver, strerror(rv));
-		umask(myumask);
 		return rv;
 	}
 	rv = xbps_set_pkg_state_dictionary(pkgd, XBPS_PKG_STATE_INSTALLED);
@@ -149,13 +174,360 @@ xbps_configure_pkg(struct xbps_handle *xhp,
 		xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE_FAIL, rv,
 		    pkgver, "%s: [configure] failed to set state to installed: %s",
 		    pkgver, strerror(rv));
-		umask(myumask);
 		return rv;
 	}
+	pkgname = xbps_pkg_name(pkgver);
+	rv = xbps_pkgdb_journal(xhp, pkgname ? pkgname : pkgver);
+	free(pkgname);
 	if (rv == 0)
 		xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE_DONE, 0, pkgver, NULL);
 
-	umask(myumask);
 	/* show install-msg if exists */
 	return xbps_cb_message(xhp, pkgd, "install-msg");
 }
+
+int
+xbps_configure_pkg(struct xbps_handle *xhp,
+		   const char *pkgver,
+		   bool check_state,
+		   bool update)
+{
+	xbps_dictionary_t pkgd;
+	int rv;
+	mode_t myumask;
+
+	assert(pkgver != NULL);
+
+	rv = configure_get_pkg(xhp, pkgver, check_state, &pkgd);
+	if (rv != 0 || pkgd == NULL)
+		return rv;
+
+	myumask = umask(022);
+
+	xbps_set_cb_state(xhp, XBPS_STATE_CONFIGURE, 0, pkgver, NULL);
+
+	rv = xbps_pkg_exec_script(xhp, pkgd, "install-script", "post", update);
+	rv = configure_finish(xhp, pkgd, pkgver, rv);
+
+	umask(myumask);
+	return rv;
+}
+
+/*
+ * Parallel configuration: every package to configure is a job, a job
+ * becomes runnable once the jobs of its run dependencies have finished.
+ * The output of each script is captured into a temporary file and
+ * replayed, along with the state callbacks, in the order the jobs were
+ * started, so that it doesn't get interleaved.
+ */
+enum job_state {
+	JOB_PENDING,
+	JOB_READY,
+	JOB_RUNNING,
+	JOB_DONE
+};
+
+struct cfg_job {
+	xbps_dictionary_t pkgd;
+	const char *pkgver;
+	unsigned int *rdeps;
+	unsigned int nrdeps;
+	unsigned int ndeps;
+	enum job_state state;
+	pid_t pid;
+	FILE *out;
+	char *fpath;
+	uint64_t start;
+	int rv;
+};
+
+struct cfg_sched {
+	struct xbps_handle *xhp;
+	struct cfg_job *jobs;
+	unsigned int njobs;
+	unsigned int *queue;
+	unsigned int qhead, qtail;
+	unsigned int *order;
+	unsigned int nstarted;
+	unsigned int nreplayed;
+	unsigned int running;
+	bool failed;
+	int rv;
+};
+
+static void
+sched_ready(struct cfg_sched *sc, unsigned int i)
+{
+	sc->jobs[i].state = JOB_READY;
+	sc->queue[sc->qtail++] = i;
+}
+
+static void
+sched_done(struct cfg_sched *sc, unsigned int i, int rv)
+{
+	struct cfg_job *job = &sc->jobs[i];
+
+	job->state = JOB_DONE;
+	job->rv = rv;
+	if (rv != 0) {
+		sc->failed = true;
+		return;
+	}
+
+	for (unsigned int j = 0; j < job->nrdeps; j++) {
+		struct cfg_job *rdep = &sc->jobs[job->rdeps[j]];
+
+		if (--rdep->ndeps == 0 && rdep->state == JOB_PENDING)
+			sched_ready(sc, job->rdeps[j]);
+	}
+}
+
+static void
+sched_start(struct cfg_sched *sc, unsigned int i)
+{
+	struct cfg_job *job = &sc->jobs[i];
+
+	sc->order[sc->nstarted++] = i;
+	job->state = JOB_RUNNING;
+
+	if ((job->out = tmpfile()) == NULL) {
+		sched_done(sc, i, errno);
+		return;
+	}
+	job->start = xbps_trace_begin();
+	job->pid = xbps_pkg_spawn_script(sc->xhp, job->pkgd, "install-script",
+	    "post", false, fileno(job->out), &job->fpath);
+	if (job->pid == -1)
+		sched_done(sc, i, errno);
+	else if (job->pid == 0)
+		sched_done(sc, i, 0);
+	else
+		sc->running++;
+}
+
+static void
+sched_replay(struct cfg_sched *sc)
+{
+	char buf[BUFSIZ];
+	size_t len;
+
+	while (sc->nreplayed < sc->nstarted) {
+		struct cfg_job *job = &sc->jobs[sc->order[sc->nreplayed]];
+		int rv;
+
+		if (job->state != JOB_DONE)
+			break;
+		sc->nreplayed++;
+
+		xbps_set_cb_state(sc->xhp, XBPS_STATE_CONFIGURE, 0,
+		    job->pkgver, NULL);
+		if (job->out) {
+			fflush(stdout);
+			rewind(job->out);
+			while ((len = fread(buf, 1, sizeof(buf), job->out)) > 0)
+				fwrite(buf, 1, len, stdout);
+			fflush(stdout);
+			fclose(job->out);
+			job->out = NULL;
+		}
+		rv = configure_finish(sc->xhp, job->pkgd, job->pkgver, job->rv);
+		if (rv != 0) {
+			xbps_dbg_printf(sc->xhp, "%s: failed to configure "
+			    "%s: %s\n", __func__, job->pkgver, strerror(rv));
+			if (sc->rv == 0)
+				sc->rv = rv;
+		}
+	}
+}
+
+static void
+sched_wait(struct cfg_sched *sc)
+{
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, 0)) == -1) {
+		if (errno != EINTR) {
+			/* lost our children, don't wait forever */
+			for (unsigned int i = 0; i < sc->njobs; i++) {
+				if (sc->jobs[i].state == JOB_RUNNING &&
+				    sc->jobs[i].pid > 0) {
+					sc->running--;
+					sched_done(sc, i, errno);
+				}
+			}
+			return;
+		}
+	}
+	for (unsigned int i = 0; i < sc->njobs; i++) {
+		struct cfg_job *job = &sc->jobs[i];
+
+		if (job->state != JOB_RUNNING || job->pid != pid)
+			continue;
+
+		sc->running--;
+		xbps_trace_end_child(job->start, pid, "script", "post",
+		    job->pkgver);
+		if (job->fpath) {
+			remove(job->fpath);
+			free(job->fpath);
+			job->fpath = NULL;
+		}
+		sched_done(sc, i, xbps_file_exec_status(status));
+		break;
+	}
+}
+
+static int
+sched_add_deps(struct cfg_sched *sc, xbps_dictionary_t jobidx)
+{
+	for (unsigned int i = 0; i < sc->njobs; i++) {
+		xbps_array_t rundeps;
+
+		rundeps = xbps_dictionary_get(sc->jobs[i].pkgd, "run_depends");
+		for (unsigned int j = 0; j < xbps_array_count(rundeps); j++) {
+			xbps_dictionary_t deppkgd;
+			struct cfg_job *dep;
+			const char *deppattern, *deppkgver;
+			char *depname;
+			uint32_t idx;
+			bool found;
+
+			xbps_array_get_cstring_nocopy(rundeps, j, &deppattern);
+			if (((deppkgd = xbps_pkgdb_get_pkg(sc->xhp, deppattern)) == NULL) &&
+			    ((deppkgd = xbps_pkgdb_get_virtualpkg(sc->xhp, deppattern)) == NULL))
+				continue;
+			if (!xbps_dictionary_get_cstring_nocopy(deppkgd,
+			    "pkgver", &deppkgver))
+				continue;
+			if ((depname = xbps_pkg_name(deppkgver)) == NULL)
+				continue;
+			found = xbps_dictionary_get_uint32(jobidx, depname, &idx);
+			free(depname);
+			if (!found || idx == i)
+				continue;
+
+			dep = &sc->jobs[idx];
+			dep->rdeps = realloc(dep->rdeps,
+			    (dep->nrdeps + 1) * sizeof(*dep->rdeps));
+			if (dep->rdeps == NULL)
+				return ENOMEM;
+			dep->rdeps[dep->nrdeps++] = i;
+			sc->jobs[i].ndeps++;
+		}
+	}
+	return 0;
+}
+
+int
+xbps_configure_packages_jobs(struct xbps_handle *xhp, xbps_array_t ignpkgs,
+		unsigned int maxjobs)
+{
+	struct cfg_sched sc;
+	xbps_dictionary_t pkgd, jobidx, triggers;
+	xbps_object_t obj;
+	xbps_object_iterator_t iter;
+	const char *pkgver;
+	mode_t myumask;
+	int rv;
+
+	if (maxjobs <= 1)
+		return xbps_configure_packages(xhp, ignpkgs);
+
+	if ((rv = xbps_pkgdb_init(xhp)) != 0)
+		return rv;
+
+	memset(&sc, 0, sizeof(sc));
+	sc.xhp = xhp;
+	sc.jobs = calloc(xbps_dictionary_count(xhp->pkgdb) + 1,
+	    sizeof(*sc.jobs));
+	jobidx = xbps_dictionary_create_hashed(0);
+	triggers = xbps_dictionary_create();
+	assert(sc.jobs);
+	assert(jobidx);
+	assert(triggers);
+
+	iter = xbps_dictionary_iterator(xhp->pkgdb);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		pkgd = xbps_dictionary_get_keysym(xhp->pkgdb, obj);
+		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+			continue;
+		if (xbps_array_count(ignpkgs)) {
+			if ((xbps_match_string_in_array(ignpkgs, pkgver)) ||
+			    (xbps_match_pkgver_in_array(ignpkgs, pkgver))) {
+				xbps_dbg_printf(xhp, "%s: ignoring pkg %s\n",
+				    __func__, pkgver);
+				continue;
+			}
+		}
+		if ((rv = configure_get_pkg(xhp, pkgver, true, &pkgd)) != 0) {
+			xbps_dbg_printf(xhp, "%s: failed to configure %s: %s\n",
+			    __func__, pkgver, strerror(rv));
+			break;
+		}
+		if (pkgd == NULL)
+			continue;
+		xbps_dictionary_set_uint32(jobidx,
+		    xbps_dictionary_keysym_cstring_nocopy(obj), sc.njobs);
+		xbps_triggers_add(triggers, pkgd);
+		sc.jobs[sc.njobs].pkgd = pkgd;
+		sc.jobs[sc.njobs].pkgver = pkgver;
+		sc.njobs++;
+	}
+	xbps_object_iterator_release(iter);
+
+	if (rv == 0)
+		rv = sched_add_deps(&sc, jobidx);
+	xbps_object_release(jobidx);
+	if (rv != 0)
+		goto out;
+
+	sc.queue = calloc(sc.njobs + 1, sizeof(*sc.queue));
+	sc.order = calloc(sc.njobs + 1, sizeof(*sc.order));
+	assert(sc.queue);
+	assert(sc.order);
+	for (unsigned int i = 0; i < sc.njobs; i++) {
+		if (sc.jobs[i].ndeps == 0)
+			sched_ready(&sc, i);
+	}
+
+	myumask = umask(022);
+	for (;;) {
+		while (!sc.failed && sc.running < maxjobs &&
+		    sc.qhead < sc.qtail)
+			sched_start(&sc, sc.queue[sc.qhead++]);
+
+		sched_replay(&sc);
+		if (sc.running > 0) {
+			sched_wait(&sc);
+			continue;
+		}
+		if (sc.failed || sc.nstarted == sc.njobs)
+			break;
+		/*
+		 * Nothing is running nor ready but there are pending jobs:
+		 * there's a dependency cycle, break it at the first one.
+		 */
+		for (unsigned int i = 0; i < sc.njobs; i++) {
+			if (sc.jobs[i].state == JOB_PENDING) {
+				sched_ready(&sc, i);
+				break;
+			}
+		}
+	}
+	umask(myumask);
+	rv = sc.rv;
+	if (rv == 0)
+		rv = xbps_triggers_run(xhp, triggers);
+
+out:
+	xbps_object_release(triggers);
+	for (unsigned int i = 0; i < sc.njobs; i++)
+		free(sc.jobs[i].rdeps);
+	free(sc.jobs);
+	free(sc.queue);
+	free(sc.order);
+
+	return rv;
+}
@@ -70,12 +70,44 @@ merge_filelist(xbps_dictionary_t d)
 	return result;
 }
 
+/*
+ * Returns a dictionary with the path of every file, link, configuration
+ * file and directory of d as keys, so that they can be looked up without
+ * walking the whole list.
+ */
+static xbps_dictionary_t
+filelist_by_path(xbps_dictionary_t d)
+{
+	static const char *keys[] = { "files", "links", "conf_files", "dirs" };
+	xbps_dictionary_t result, filed;
+	xbps_array_t a;
+	unsigned int count = 0;
+	const char *file;
+
+	for (uint8_t i = 0; i < __arraycount(keys); i++)
+		count += xbps_array_count(xbps_dictionary_get(d, keys[i]));
+
+	result = xbps_dictionary_create_hashed(count);
+	assert(result);
+
+	for (uint8_t i = 0; i < __arraycount(keys); i++) {
+		a = xbps_dictionary_get(d, keys[i]);
+		for (unsigned int x = 0; x < xbps_array_count(a); x++) {
+			filed = xbps_array_get(a, x);
+			if (xbps_dictionary_get_cstring_nocopy(filed, "file", &file))
+				xbps_dictionary_set(result, file, filed);
+		}
+	}
+	return result;
+}
+
 xbps_array_t
 xbps_find_pkg_obsoletes(struct xbps_handle *xhp,
 			xbps_dictionary_t instd,
 			xbps_dictionary_t newd)
 {
-	xbps_array_t instfiles, newfiles, obsoletes;
+	xbps_array_t instfiles, obsoletes;
+	xbps_dictionary_t newfiles;
 	/* These are symlinks in Void and must not be removed */
 	const char *basesymlinks[] = {
 		"./bin",
@@ -102,14 +134,16 @@ xbps_find_pkg_obsoletes(struct xbps_handle *xhp,
 		xbps_object_release(instfiles);
 		return obsoletes;
 	}
-	newfiles = merge_filelist(newd);
+	newfiles = filelist_by_path(newd);
 
 	/*
-	 * Iterate over files list from installed package.
+	 * Iterate over files list from installed package, cheaper checks
+	 * first: only files not in the new package that weren't modified
+	 * since they were unpacked are hashed.
 	 */
 	for (unsigned int i = 0; i < xbps_array_count(instfiles); i++) {
-		xbps_object_t obj, obj2;
-		xbps_string_t oldstr, newstr;
+		xbps_object_t obj;
+		xbps_string_t oldstr;
 		struct stat st;
 		uint64_t mtime = 0;
 		const char *oldhash;
@@ -124,37 +158,14 @@ xbps_find_pkg_obsoletes(struct xbps_handle *xhp,
 		oldstr = xbps_dictionary_get(obj, "file");
 		if (oldstr == NULL)
 			continue;
-
-		snprintf(file, sizeof(file), ".%s", xbps_string_cstring_nocopy(oldstr));
-
-		if (xbps_dictionary_get_cstring_nocopy(obj, "sha256", &oldhash)) {
-			rv = xbps_file_hash_check(file, oldhash);
-			if (rv == ENOENT || rv == ERANGE) {
-				/*
-				  Skip unexistent and files that do not
-				 * match the hash.
-				 */
-				continue;
-			}
-		}
 		/*
-		 * Check if current file is available in new pkg filelist.
+		 * Skip files with same path in new pkg filelist.
 		 */
-		for (unsigned int x = 0; x < xbps_array_count(newfiles); x++) {
-			obj2 = xbps_array_get(newfiles, x);
-			newstr = xbps_dictionary_get(obj2, "file");
-			assert(newstr);
-			/*
-			 * Skip files with same path.
-			 */
-			if (xbps_string_equals(oldstr, newstr)) {
-				found = true;
-				break;
-			}
-		}
-		if (found) {
+		if (xbps_dictionary_get(newfiles,
+		    xbps_string_cstring_nocopy(oldstr)) != NULL)
 			continue;
-		}
+
+		snprintf(file, sizeof(file), ".%s", xbps_string_cstring_nocopy(oldstr));
 		/*
 		 * Make sure to not remove any symlink of root directory.
 		 */
@@ -170,7 +181,7 @@ xbps_find_pkg_obsoletes(struct xbps_handle *xhp,
 			continue;
 		}
 		/*
-		 * Finally check if file mtime on disk matched what
+		 * Check if file mtime on disk matched what
 		 * the installed pkg has stored.
 		 */
 		if (xbps_dictionary_get_uint64(obj, "mtime", &mtime)) {
@@ -183,7 +194,21 @@ xbps_find_pkg_obsoletes(struct xbps_handle *xhp,
 				continue;
 
 			xbps_dbg_printf(xhp,
-			    "[obsoletes] %s: matched mtime, adding obsolete.\n", file);
+			    "[obsoletes] %s: matched mtime.\n", file);
+		}
+		/*
+		 * Finally check that its hash matches what the installed
+		 * pkg has stored.
+		 */
+		if (xbps_dictionary_get_cstring_nocopy(obj, "sha256", &oldhash)) {
+			rv = xbps_file_hash_check_handle(xhp, file, oldhash);
+			if (rv == ENOENT || rv == ERANGE) {
+				/*
+				 * Skip unexistent and files that do not
+				 * match the hash.
+				 */
+				continue;
+			}
 		}
 		/*
 		 * Obsolete found, add onto the array.
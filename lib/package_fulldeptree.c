@@ -31,23 +31,63 @@
 
 #include "xbps_api_impl.h"
 
-struct pkgdep {
-	SLIST_ENTRY(pkgdep) pkgdep_entries;
-	const char *pkg;
-	xbps_array_t rdeps;
+static void depgraph_release(struct xbps_handle *, bool);
+
+/*
+ * The full dependency tree of a package is collected depth first, every
+ * dependency in the order it is found and before its own dependencies.
+ * The tree of every package requested is memoized in the handle by pkgver,
+ * and spliced into the trees of its dependents when they are collected
+ * later. The tree returned to callers is then sorted so that every package
+ * follows its dependencies.
+ *
+ * The pkgdb trees are dropped when a package is registered or removed,
+ * and the rpool trees when the repository pool is released; so are the
+ * dependency graphs used for the reverse dependency trees and orphans.
+ */
+struct deptree {
+	struct xbps_handle *xhp;
+	xbps_dictionary_t memo;
+	xbps_dictionary_t seen;
+	xbps_array_t tree;
+	bool rpool;
 };
 
-static SLIST_HEAD(pkgdep_head, pkgdep) pkgdep_list =
-    SLIST_HEAD_INITIALIZER(pkgdep_list);
+static xbps_dictionary_t
+deptree_get_pkg(struct deptree *dt, const char *pkg)
+{
+	xbps_dictionary_t pkgd;
+
+	if (dt->rpool) {
+		if ((pkgd = xbps_rpool_get_pkg(dt->xhp, pkg)) == NULL)
+			pkgd = xbps_rpool_get_virtualpkg(dt->xhp, pkg);
+	} else {
+		if ((pkgd = xbps_pkgdb_get_pkg(dt->xhp, pkg)) == NULL)
+			pkgd = xbps_pkgdb_get_virtualpkg(dt->xhp, pkg);
+	}
+	return pkgd;
+}
 
-static xbps_dictionary_t pkgdep_pvmap;
+static bool
+deptree_add(struct deptree *dt, const char *pkgver)
+{
+	if (xbps_dictionary_get(dt->seen, pkgver))
+		return false;
+	xbps_dictionary_set_bool(dt->seen, pkgver, true);
+	xbps_array_add_cstring_nocopy(dt->tree, pkgver);
+	return true;
+}
 
+/*
+ * Adds the dependencies of pkgd not seen yet to the tree. Packages
+ * reached again through a dependency cycle are already seen.
+ */
 static int
-collect_rdeps(struct xbps_handle *xhp, xbps_dictionary_t pkgd, bool rpool)
+collect_deptree(struct deptree *dt, xbps_dictionary_t pkgd)
 {
-	xbps_array_t rdeps, currdeps, provides = NULL;
-	struct pkgdep *pd;
+	xbps_array_t rdeps, provides, curtree;
 	const char *pkgver;
+	int rv;
 
 	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
 	assert(pkgver);
@@ -58,145 +98,504 @@ collect_rdeps(struct xbps_handle *xhp, xbps_dictionary_t pkgd, bool rpool)
 		xbps_dictionary_t curpkgd;
 		const char *curdep, *curpkgver;
 		char *curdepname;
-		bool virtual = false, found = false;
 
 		xbps_array_get_cstring_nocopy(rdeps, i, &curdep);
-		if (rpool) {
-			if ((curpkgd = xbps_rpool_get_pkg(xhp, curdep)) == NULL) {
-				curpkgd = xbps_rpool_get_virtualpkg(xhp, curdep);
-				virtual = true;
-			}
-		} else {
-			if ((curpkgd = xbps_pkgdb_get_pkg(xhp, curdep)) == NULL) {
-				curpkgd = xbps_pkgdb_get_virtualpkg(xhp, curdep);
-				virtual = true;
-			}
-		}
-		if (curpkgd == NULL) {
-			xbps_dbg_printf(xhp, "%s: cannot find `%s' dependency\n",
-			    __func__, curdep);
+		if ((curpkgd = deptree_get_pkg(dt, curdep)) == NULL) {
+			xbps_dbg_printf(dt->xhp, "%s: cannot find `%s' "
+			    "dependency\n", __func__, curdep);
 			return ENOENT;
 		}
 		if (((curdepname = xbps_pkgpattern_name(curdep)) == NULL) &&
 		    ((curdepname = xbps_pkg_name(curdep)) == NULL))
 			return EINVAL;
-
-		xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &curpkgver);
-		currdeps = xbps_dictionary_get(curpkgd, "run_depends");
-
 		if (provides && xbps_match_pkgname_in_array(provides, curdepname)) {
-			xbps_dbg_printf(xhp, "%s: ignoring dependency %s "
+			xbps_dbg_printf(dt->xhp, "%s: ignoring dependency %s "
 			    "already in provides\n", pkgver, curdep);
 			free(curdepname);
 			continue;
 		}
-		if (virtual) {
-			xbps_dictionary_set_cstring_nocopy(pkgdep_pvmap, curdepname, pkgver);
-		}
 		free(curdepname);
-		/* uniquify dependencies, sorting will be done later */
-		SLIST_FOREACH(pd, &pkgdep_list, pkgdep_entries) {
-			if (strcmp(pd->pkg, curpkgver) == 0) {
-				found = true;
-				break;
-			}
-		}
-		if (!found) {
-			pd = malloc(sizeof(*pd));
-			assert(pd);
-			pd->pkg = curpkgver;
-			pd->rdeps = xbps_array_copy(currdeps);
-			SLIST_INSERT_HEAD(&pkgdep_list, pd, pkgdep_entries);
-		}
-		if (xbps_array_count(currdeps)) {
-			int rv;
 
-			if ((rv = collect_rdeps(xhp, curpkgd, rpool)) != 0)
-				return rv;
+		xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &curpkgver);
+		if (!deptree_add(dt, curpkgver))
+			continue;
+		if ((curtree = xbps_dictionary_get(dt->memo, curpkgver))) {
+			for (unsigned int x = 0; x < xbps_array_count(curtree); x++) {
+				const char *s;
+
+				xbps_array_get_cstring_nocopy(curtree, x, &s);
+				deptree_add(dt, s);
+			}
+			continue;
 		}
+		if ((rv = collect_deptree(dt, curpkgd)) != 0)
+			return rv;
 	}
 	return 0;
 }
 
-static xbps_array_t
-sortfulldeptree(void)
+/*
+ * Max-heap of tree indexes, the ready package found last goes first.
+ */
+static void
+heap_push(unsigned int *heap, unsigned int *n, unsigned int v)
 {
-	struct pkgdep *pd;
-	xbps_array_t result;
-	unsigned int ndeps = 0;
+	unsigned int i = (*n)++, p;
 
-	result = xbps_array_create();
-	assert(result);
+	while (i > 0 && heap[p = (i - 1) / 2] < v) {
+		heap[i] = heap[p];
+		i = p;
+	}
+	heap[i] = v;
+}
 
-	SLIST_FOREACH(pd, &pkgdep_list, pkgdep_entries) {
-		if (!pd->rdeps) {
-			xbps_array_add_cstring_nocopy(result, pd->pkg);
-			SLIST_REMOVE(&pkgdep_list, pd, pkgdep, pkgdep_entries);
-		}
-		ndeps++;
+static unsigned int
+heap_pop(unsigned int *heap, unsigned int *n)
+{
+	unsigned int top = heap[0], v = heap[--(*n)], i = 0, c;
+
+	while ((c = 2 * i + 1) < *n) {
+		if (c + 1 < *n && heap[c + 1] > heap[c])
+			c++;
+		if (heap[c] <= v)
+			break;
+		heap[i] = heap[c];
+		i = c;
 	}
-	while (xbps_array_count(result) < ndeps) {
-		bool found = false;
+	heap[i] = v;
+	return top;
+}
 
-		SLIST_FOREACH(pd, &pkgdep_list, pkgdep_entries) {
-			unsigned int i = 0, mdeps = 0, rdeps = 0;
+/*
+ * Sorts the tree so that every package follows its dependencies in the
+ * tree. Packages without dependencies go first, then the package found
+ * last whose dependencies were all added; dependencies resolved by
+ * virtual packages or in a cycle don't impose any order.
+ */
+static xbps_array_t
+sort_deptree(struct deptree *dt, xbps_array_t tree)
+{
+	xbps_array_t result;
+	xbps_dictionary_t idx;
+	unsigned int n, nedges = 0, nheap = 0;
+	unsigned int *pending, *first, *edges, *heap;
+	bool *done;
 
-			rdeps = xbps_array_count(pd->rdeps);
-			for (i = 0; i < rdeps; i++) {
-				const char *pkgdep;
-				char *pkgname;
+	n = xbps_array_count(tree);
+	result = xbps_array_create_with_capacity(n);
+	idx = xbps_dictionary_create_hashed(n);
+	pending = calloc(n + 1, sizeof(*pending));
+	first = calloc(n + 2, sizeof(*first));
+	heap = calloc(n + 1, sizeof(*heap));
+	done = calloc(n + 1, sizeof(*done));
+	assert(result);
+	assert(idx);
+	assert(pending && first && heap && done);
+
+	for (unsigned int i = 0; i < n; i++) {
+		const char *pkgver;
 
-				xbps_array_get_cstring_nocopy(pd->rdeps, i, &pkgdep);
-				if (((pkgname = xbps_pkgpattern_name(pkgdep)) == NULL) &&
-				    ((pkgname = xbps_pkg_name(pkgdep)) == NULL))
-					return NULL;
+		xbps_array_get_cstring_nocopy(tree, i, &pkgver);
+		xbps_dictionary_set_uint32(idx, pkgver, i);
+	}
+	/*
+	 * Two passes over the dependencies: count the dependents of every
+	 * package, then store them.
+	 */
+	edges = NULL;
+	for (unsigned int pass = 0; pass < 2; pass++) {
+		for (unsigned int i = 0; i < n; i++) {
+			xbps_dictionary_t pkgd, curpkgd;
+			xbps_array_t rdeps, provides;
+			const char *pkgver, *curdep, *curpkgver;
+			char *curdepname;
+			uint32_t j;
 
-				if (xbps_match_pkgname_in_array(result, pkgname)) {
-					mdeps++;
-					free(pkgname);
+			xbps_array_get_cstring_nocopy(tree, i, &pkgver);
+			pkgd = deptree_get_pkg(dt, pkgver);
+			rdeps = xbps_dictionary_get(pkgd, "run_depends");
+			provides = xbps_dictionary_get(pkgd, "provides");
+			for (unsigned int x = 0; x < xbps_array_count(rdeps); x++) {
+				xbps_array_get_cstring_nocopy(rdeps, x, &curdep);
+				curpkgd = dt->rpool ?
+				    xbps_rpool_get_pkg(dt->xhp, curdep) :
+				    xbps_pkgdb_get_pkg(dt->xhp, curdep);
+				if (curpkgd == NULL)
 					continue;
+				if (provides) {
+					if (((curdepname = xbps_pkgpattern_name(curdep)) == NULL) &&
+					    ((curdepname = xbps_pkg_name(curdep)) == NULL))
+						continue;
+					if (xbps_match_pkgname_in_array(provides, curdepname)) {
+						free(curdepname);
+						continue;
+					}
+					free(curdepname);
 				}
-				if (xbps_dictionary_get(pkgdep_pvmap, pkgname)) {
-					mdeps++;
-					free(pkgname);
+				xbps_dictionary_get_cstring_nocopy(curpkgd,
+				    "pkgver", &curpkgver);
+				if (!xbps_dictionary_get_uint32(idx, curpkgver, &j) ||
+				    j == i)
 					continue;
+				if (pass == 0) {
+					pending[i]++;
+					first[j + 1]++;
+					nedges++;
+				} else {
+					edges[first[j]++] = i;
 				}
-				free(pkgname);
-			}
-			if (mdeps == rdeps) {
-				found = true;
-				break;
 			}
 		}
-		if (found && !xbps_match_string_in_array(result, pd->pkg)) {
-			xbps_array_add_cstring_nocopy(result, pd->pkg);
-			SLIST_REMOVE(&pkgdep_list, pd, pkgdep, pkgdep_entries);
-			free(pd);
+		if (pass == 0) {
+			for (unsigned int j = 0; j < n; j++)
+				first[j + 1] += first[j];
+			edges = calloc(nedges + 1, sizeof(*edges));
+			assert(edges);
+		} else {
+			/* first[j] was moved to the start of j + 1 */
+			for (unsigned int j = n; j > 0; j--)
+				first[j] = first[j - 1];
+			first[0] = 0;
+		}
+	}
+	/*
+	 * Packages without run_depends first, in reverse order.
+	 */
+	for (unsigned int i = n; i-- > 0;) {
+		const char *pkgver;
+
+		xbps_array_get_cstring_nocopy(tree, i, &pkgver);
+		if (xbps_dictionary_get(deptree_get_pkg(dt, pkgver),
+		    "run_depends") != NULL)
+			continue;
+		xbps_array_add_cstring_nocopy(result, pkgver);
+		done[i] = true;
+		for (unsigned int e = first[i]; e < first[i + 1]; e++)
+			pending[edges[e]]--;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		if (!done[i] && pending[i] == 0)
+			heap_push(heap, &nheap, i);
+	}
+	while (xbps_array_count(result) < n) {
+		const char *pkgver;
+		unsigned int i;
+
+		if (nheap == 0) {
+			/* a cycle, break it with the package found last */
+			for (i = n; i-- > 0 && done[i];)
+				;
+		} else {
+			i = heap_pop(heap, &nheap);
+			if (done[i])
+				continue;
+		}
+		xbps_array_get_cstring_nocopy(tree, i, &pkgver);
+		xbps_array_add_cstring_nocopy(result, pkgver);
+		done[i] = true;
+		for (unsigned int e = first[i]; e < first[i + 1]; e++) {
+			if (--pending[edges[e]] == 0 && !done[edges[e]])
+				heap_push(heap, &nheap, edges[e]);
 		}
 	}
+	xbps_object_release(idx);
+	free(pending);
+	free(first);
+	free(edges);
+	free(heap);
+	free(done);
+
 	return result;
 }
 
+void HIDDEN
+xbps_fulldeptree_release(struct xbps_handle *xhp, bool rpool)
+{
+	xbps_dictionary_t *memo;
+
+	memo = rpool ? &xhp->rpool_deptree : &xhp->pkgdb_deptree;
+	if (*memo) {
+		xbps_object_release(*memo);
+		*memo = NULL;
+	}
+	depgraph_release(xhp, rpool);
+}
+
 xbps_array_t HIDDEN
 xbps_get_pkg_fulldeptree(struct xbps_handle *xhp, const char *pkg, bool rpool)
 {
+	struct deptree dt;
 	xbps_dictionary_t pkgd;
+	xbps_array_t tree;
+	const char *pkgver;
 	int rv;
 
+	dt.xhp = xhp;
+	dt.rpool = rpool;
+	if ((pkgd = deptree_get_pkg(&dt, pkg)) == NULL)
+		return NULL;
+
 	if (rpool) {
-		if (((pkgd = xbps_rpool_get_pkg(xhp, pkg)) == NULL) &&
-		    ((pkgd = xbps_rpool_get_virtualpkg(xhp, pkg)) == NULL))
-			return NULL;
+		if (xhp->rpool_deptree == NULL)
+			xhp->rpool_deptree = xbps_dictionary_create_hashed(0);
+		dt.memo = xhp->rpool_deptree;
 	} else {
-		if (((pkgd = xbps_pkgdb_get_pkg(xhp, pkg)) == NULL) &&
-		    ((pkgd = xbps_pkgdb_get_virtualpkg(xhp, pkg)) == NULL))
+		if (xhp->pkgdb_deptree == NULL)
+			xhp->pkgdb_deptree = xbps_dictionary_create_hashed(0);
+		dt.memo = xhp->pkgdb_deptree;
+	}
+	assert(dt.memo);
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+
+	if ((tree = xbps_dictionary_get(dt.memo, pkgver)) == NULL) {
+		dt.tree = xbps_array_create();
+		dt.seen = xbps_dictionary_create_hashed(0);
+		assert(dt.tree);
+		assert(dt.seen);
+		/* never part of its own tree, even if it's in a cycle */
+		xbps_dictionary_set_bool(dt.seen, pkgver, true);
+		rv = collect_deptree(&dt, pkgd);
+		xbps_object_release(dt.seen);
+		if (rv != 0) {
+			xbps_object_release(dt.tree);
+			errno = rv;
 			return NULL;
+		}
+		xbps_dictionary_set(dt.memo, pkgver, dt.tree);
+		xbps_object_release(dt.tree);
+		tree = dt.tree;
+	}
+	/* the memoized tree is shared, callers get their own sorted copy */
+	return sort_deptree(&dt, tree);
+}
+
+struct depgraph_build {
+	struct deptree dt;
+	struct xbps_depgraph *g;
+};
+
+static unsigned int
+depgraph_id(struct depgraph_build *gb, xbps_dictionary_t pkgd)
+{
+	const char *pkgver;
+	uint32_t id;
+
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+		return UINT32_MAX;
+	if (xbps_dictionary_get_uint32(gb->g->ids, pkgver, &id))
+		return id;
+
+	id = gb->g->n++;
+	xbps_dictionary_set_uint32(gb->g->ids, pkgver, id);
+	xbps_array_add_cstring(gb->g->pkgvers, pkgver);
+	xbps_array_add(gb->g->pkgds, pkgd);
+	return id;
+}
+
+static int
+depgraph_repo_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
+{
+	struct depgraph_build *gb = arg;
+	xbps_dictionary_t idx;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	if ((idx = xbps_repo_get_index(repo)) == NULL)
+		return 0;
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)))
+		(void)depgraph_id(gb, xbps_dictionary_get_keysym(idx, obj));
+	xbps_object_iterator_release(iter);
+	return 0;
+}
+
+/*
+ * Resolves the dependencies of every package like the dependency trees
+ * do, packages only reached through a dependency are numbered as found.
+ * The edges are collected as (dependency, dependent) pairs in the order
+ * of the dependents, which is the deps array, and sorted by dependency
+ * into the revdeps array.
+ */
+static struct xbps_depgraph *
+depgraph_build(struct xbps_handle *xhp, bool rpool)
+{
+	struct depgraph_build gb;
+	struct xbps_depgraph *g;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	unsigned int *edges = NULL, nedges = 0, maxedges = 0;
+
+	g = calloc(1, sizeof(*g));
+	assert(g);
+	g->ids = xbps_dictionary_create_hashed(0);
+	g->pkgvers = xbps_array_create();
+	g->pkgds = xbps_array_create();
+	assert(g->ids);
+	assert(g->pkgvers);
+	assert(g->pkgds);
+
+	gb.dt.xhp = xhp;
+	gb.dt.rpool = rpool;
+	gb.g = g;
+
+	if (rpool) {
+		(void)xbps_rpool_foreach(xhp, depgraph_repo_cb, &gb);
+	} else if (xbps_pkgdb_init(xhp) == 0) {
+		iter = xbps_dictionary_iterator(xhp->pkgdb);
+		assert(iter);
+		while ((obj = xbps_object_iterator_next(iter)))
+			(void)depgraph_id(&gb, xbps_dictionary_get_keysym(xhp->pkgdb, obj));
+		xbps_object_iterator_release(iter);
+	}
+
+	for (unsigned int i = 0; i < g->n; i++) {
+		xbps_dictionary_t pkgd = xbps_array_get(g->pkgds, i);
+		xbps_array_t rdeps, provides;
+
+		rdeps = xbps_dictionary_get(pkgd, "run_depends");
+		provides = xbps_dictionary_get(pkgd, "provides");
+		for (unsigned int x = 0; x < xbps_array_count(rdeps); x++) {
+			xbps_dictionary_t curpkgd;
+			const char *curdep;
+			char *curdepname;
+			unsigned int j;
+
+			xbps_array_get_cstring_nocopy(rdeps, x, &curdep);
+			if ((curpkgd = deptree_get_pkg(&gb.dt, curdep)) == NULL)
+				continue;
+			if (provides) {
+				if (((curdepname = xbps_pkgpattern_name(curdep)) == NULL) &&
+				    ((curdepname = xbps_pkg_name(curdep)) == NULL))
+					continue;
+				if (xbps_match_pkgname_in_array(provides, curdepname)) {
+					free(curdepname);
+					continue;
+				}
+				free(curdepname);
+			}
+			if ((j = depgraph_id(&gb, curpkgd)) == UINT32_MAX || j == i)
+				continue;
+			if (nedges == maxedges) {
+				maxedges = maxedges ? maxedges * 2 : 1024;
+				edges = realloc(edges, maxedges * 2 * sizeof(*edges));
+				assert(edges);
+			}
+			edges[nedges * 2] = j;
+			edges[nedges * 2 + 1] = i;
+			nedges++;
+		}
 	}
-	if (pkgdep_pvmap == NULL)
-		pkgdep_pvmap = xbps_dictionary_create();
 
-	if ((rv = collect_rdeps(xhp, pkgd, rpool)) != 0)
+	g->first = calloc(g->n + 2, sizeof(*g->first));
+	g->revdeps = calloc(nedges + 1, sizeof(*g->revdeps));
+	g->dfirst = calloc(g->n + 1, sizeof(*g->dfirst));
+	g->deps = calloc(nedges + 1, sizeof(*g->deps));
+	assert(g->first && g->revdeps && g->dfirst && g->deps);
+	for (unsigned int e = 0; e < nedges; e++) {
+		g->dfirst[edges[e * 2 + 1] + 1]++;
+		g->deps[e] = edges[e * 2];
+	}
+	for (unsigned int i = 0; i < g->n; i++)
+		g->dfirst[i + 1] += g->dfirst[i];
+	for (unsigned int e = 0; e < nedges; e++)
+		g->first[edges[e * 2] + 2]++;
+	for (unsigned int i = 0; i < g->n; i++)
+		g->first[i + 2] += g->first[i + 1];
+	for (unsigned int e = 0; e < nedges; e++)
+		g->revdeps[g->first[edges[e * 2] + 1]++] = edges[e * 2 + 1];
+	free(edges);
+
+	xbps_dbg_printf(xhp, "[deptree] %s graph: %u packages, %u dependencies\n",
+	    rpool ? "rpool" : "pkgdb", g->n, nedges);
+	return g;
+}
+
+static void
+depgraph_release(struct xbps_handle *xhp, bool rpool)
+{
+	struct xbps_depgraph **g;
+
+	g = rpool ? &xhp->rpool_depgraph : &xhp->pkgdb_depgraph;
+	if (*g == NULL)
+		return;
+
+	xbps_object_release((*g)->ids);
+	xbps_object_release((*g)->pkgvers);
+	xbps_object_release((*g)->pkgds);
+	free((*g)->first);
+	free((*g)->revdeps);
+	free((*g)->dfirst);
+	free((*g)->deps);
+	free(*g);
+	*g = NULL;
+}
+
+struct xbps_depgraph HIDDEN *
+xbps_get_depgraph(struct xbps_handle *xhp, bool rpool)
+{
+	struct xbps_depgraph **g;
+
+	g = rpool ? &xhp->rpool_depgraph : &xhp->pkgdb_depgraph;
+	if (*g == NULL)
+		*g = depgraph_build(xhp, rpool);
+	return *g;
+}
+
+/*
+ * The reverse dependency tree is the set of packages reached from pkg
+ * through the dependents of every package: the reached packages are
+ * marked in a bitset, and the ones added last are expanded next. The
+ * packages are returned in the order they are reached, the direct
+ * reverse dependencies first.
+ */
+xbps_array_t HIDDEN
+xbps_get_pkg_fullrevdeptree(struct xbps_handle *xhp, const char *pkg, bool rpool)
+{
+	struct deptree dt;
+	struct xbps_depgraph *g;
+	xbps_dictionary_t pkgd;
+	xbps_array_t result;
+	const char *pkgver;
+	uint64_t *seen;
+	unsigned int *queue, head = 0, tail = 0;
+	uint32_t id;
+
+	dt.xhp = xhp;
+	dt.rpool = rpool;
+	if ((pkgd = deptree_get_pkg(&dt, pkg)) == NULL)
 		return NULL;
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+
+	g = xbps_get_depgraph(xhp, rpool);
+	if (!xbps_dictionary_get_uint32(g->ids, pkgver, &id)) {
+		errno = ENOENT;
+		return NULL;
+	}
 
-	return sortfulldeptree();
+	seen = calloc((g->n + 63) / 64, sizeof(*seen));
+	queue = malloc(g->n * sizeof(*queue));
+	result = xbps_array_create();
+	assert(seen && queue && result);
+
+	/* never part of its own tree, even if it's in a cycle */
+	seen[id / 64] |= UINT64_C(1) << (id % 64);
+	queue[tail++] = id;
+	while (head < tail) {
+		unsigned int i = queue[head++];
+
+		for (unsigned int e = g->first[i]; e < g->first[i + 1]; e++) {
+			unsigned int j = g->revdeps[e];
+
+			if (seen[j / 64] & (UINT64_C(1) << (j % 64)))
+				continue;
+			seen[j / 64] |= UINT64_C(1) << (j % 64);
+			queue[tail++] = j;
+			xbps_array_add(result, xbps_array_get(g->pkgvers, j));
+		}
+	}
+	free(seen);
+	free(queue);
+
+	return result;
 }
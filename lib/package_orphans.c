@@ -59,91 +59,298 @@
  * dictionary.
  */
 
-xbps_array_t
-xbps_find_pkg_orphans(struct xbps_handle *xhp, xbps_array_t orphans_user UNUSED)
+/*
+ * Orphans are found with a single mark and sweep over the dependency
+ * graph of pkgdb, which is built once and kept in the handle. Candidates
+ * are the packages installed automatically (or those reached from the
+ * packages requested by the client), and every candidate with a
+ * dependent that is not a candidate is marked as needed, and so are its
+ * dependencies; the candidates left are orphans, also those only
+ * depending on each other in a cycle. Only the packages reached from the
+ * packages requested by the client are visited.
+ */
+#define ORPHAN_USER	0x01	/* requested by the client */
+#define ORPHAN_CAND	0x02	/* may be an orphan */
+#define ORPHAN_LIVE	0x04	/* needed by another package */
+#define ORPHAN_DONE	0x08	/* added to the result */
+#define ORPHAN_WALK	0x10	/* height being computed */
+
+struct orphan_dep {
+	unsigned int height;
+	unsigned int edge;
+};
+
+struct orphans {
+	struct xbps_depgraph *g;
+	unsigned char *state;
+	unsigned int *pending;
+	unsigned int *order;
+	unsigned int norder;
+	unsigned int *height;	/* longest path to a leaf plus one */
+	unsigned int *walk;
+	unsigned int *edge;
+	struct orphan_dep *ready;
+	xbps_array_t array;
+};
+
+static bool
+is_automatic(struct orphans *o, unsigned int i)
 {
-	xbps_array_t rdeps, reqby, array = NULL;
-	xbps_dictionary_t pkgd, deppkgd;
-	xbps_object_t obj;
-	xbps_object_iterator_t iter;
-	const char *curpkgver, *deppkgver, *reqbydep;
 	bool automatic = false;
-	unsigned int i, cnt, reqbycnt;
+
+	xbps_dictionary_get_bool(xbps_array_get(o->g->pkgds, i),
+	    "automatic-install", &automatic);
+	return automatic;
+}
+
+static bool
+is_orphan(struct orphans *o, unsigned int i)
+{
+	return (o->state[i] & ORPHAN_USER) ||
+	    (o->state[i] & (ORPHAN_CAND|ORPHAN_LIVE)) == ORPHAN_CAND;
+}
+
+/*
+ * Marks with flag the dependencies of the packages in the stack, and
+ * theirs: as candidates those installed automatically, as needed the
+ * candidates. The packages requested by the client are never crossed,
+ * they are removed anyway. The packages marked are appended to vis.
+ */
+static void
+orphans_mark(struct orphans *o, unsigned int *stack, unsigned int n,
+		unsigned char flag, unsigned int *vis, unsigned int *nvis)
+{
+	struct xbps_depgraph *g = o->g;
+
+	while (n > 0) {
+		unsigned int i = stack[--n];
+
+		for (unsigned int e = g->dfirst[i]; e < g->dfirst[i + 1]; e++) {
+			unsigned int j = g->deps[e];
+
+			if (o->state[j] & (flag|ORPHAN_USER))
+				continue;
+			if (flag == ORPHAN_CAND ? !is_automatic(o, j) :
+			    (o->state[j] & ORPHAN_CAND) == 0)
+				continue;
+			o->state[j] |= flag;
+			stack[n++] = j;
+			if (vis)
+				vis[(*nvis)++] = j;
+		}
+	}
+}
+
+/*
+ * Returns the length of the longest dependency chain of package i,
+ * computed depth first for its dependencies too; dependencies reached
+ * again through a cycle don't count.
+ */
+static unsigned int
+orphans_height(struct orphans *o, unsigned int i)
+{
+	struct xbps_depgraph *g = o->g;
+	unsigned int n = 0;
+
+	if (o->height[i] == 0) {
+		o->state[i] |= ORPHAN_WALK;
+		o->walk[n] = i;
+		o->edge[n++] = g->dfirst[i];
+	}
+	while (n > 0) {
+		unsigned int u = o->walk[n - 1], h = 0;
+
+		if (o->edge[n - 1] < g->dfirst[u + 1]) {
+			unsigned int j = g->deps[o->edge[n - 1]++];
+
+			if (o->height[j] || (o->state[j] & ORPHAN_WALK))
+				continue;
+			o->state[j] |= ORPHAN_WALK;
+			o->walk[n] = j;
+			o->edge[n++] = g->dfirst[j];
+			continue;
+		}
+		for (unsigned int e = g->dfirst[u]; e < g->dfirst[u + 1]; e++) {
+			if (o->height[g->deps[e]] > h)
+				h = o->height[g->deps[e]];
+		}
+		o->height[u] = h + 1;
+		o->state[u] &= ~ORPHAN_WALK;
+		n--;
+	}
+	return o->height[i];
+}
+
+static int
+orphan_dep_cmp(const void *a, const void *b)
+{
+	const struct orphan_dep *da = a, *db = b;
+
+	if (da->height != db->height)
+		return da->height < db->height ? -1 : 1;
+	return da->edge < db->edge ? 1 : -1;
+}
+
+static void
+orphans_add(struct orphans *o, unsigned int i)
+{
+	struct xbps_depgraph *g = o->g;
+
+	o->state[i] |= ORPHAN_DONE;
+	o->order[o->norder++] = i;
+	xbps_array_add(o->array, xbps_array_get(g->pkgds, i));
+	for (unsigned int e = g->dfirst[i]; e < g->dfirst[i + 1]; e++)
+		o->pending[g->deps[e]]--;
+}
+
+xbps_array_t
+xbps_find_pkg_orphans(struct xbps_handle *xhp, xbps_array_t orphans_user)
+{
+	struct orphans o;
+	struct xbps_depgraph *g;
+	unsigned int *stack, *vis, n, nvis = 0;
+	const char *curpkgver;
 
 	if (xbps_pkgdb_init(xhp) != 0)
 		return NULL;
-	if ((array = xbps_array_create()) == NULL)
+	if ((o.array = xbps_array_create()) == NULL)
 		return NULL;
 
+	o.g = g = xbps_get_depgraph(xhp, false);
+	o.norder = 0;
+	o.state = calloc(g->n + 1, sizeof(*o.state));
+	o.pending = calloc(g->n + 1, sizeof(*o.pending));
+	o.order = calloc(g->n + 1, sizeof(*o.order));
+	o.height = calloc(g->n + 1, sizeof(*o.height));
+	o.walk = calloc(g->n + 1, sizeof(*o.walk));
+	o.edge = calloc(g->n + 1, sizeof(*o.edge));
+	o.ready = calloc(g->n + 1, sizeof(*o.ready));
+	stack = calloc(g->n + 1, sizeof(*stack));
+	vis = calloc(g->n + 1, sizeof(*vis));
+	assert(o.state && o.pending && o.order && o.height && o.walk &&
+	    o.edge && o.ready && stack && vis);
+
 	/*
-	 * Add all packages specified by the client.
+	 * Candidates: the automatic packages reached from the packages
+	 * specified by the client, or all of them. Only the packages
+	 * visited here are looked at later.
 	 */
-	for (i = 0; i < xbps_array_count(orphans_user); i++) {
+	for (unsigned int i = 0; i < xbps_array_count(orphans_user); i++) {
+		xbps_dictionary_t pkgd;
+		uint32_t j;
+
 		xbps_array_get_cstring_nocopy(orphans_user, i, &curpkgver);
-		pkgd = xbps_pkgdb_get_pkg(xhp, curpkgver);
-		if (pkgd == NULL)
+		if ((pkgd = xbps_pkgdb_get_pkg(xhp, curpkgver)) == NULL)
 			continue;
-		xbps_array_add(array, pkgd);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &curpkgver);
+		if (!xbps_dictionary_get_uint32(g->ids, curpkgver, &j) ||
+		    (o.state[j] & ORPHAN_USER))
+			continue;
+		o.state[j] |= ORPHAN_USER;
+		vis[nvis++] = j;
+	}
+	if (orphans_user) {
+		memcpy(stack, vis, nvis * sizeof(*stack));
+		orphans_mark(&o, stack, nvis, ORPHAN_CAND, vis, &nvis);
+	} else {
+		for (unsigned int i = 0; i < g->n; i++) {
+			if (is_automatic(&o, i))
+				o.state[i] |= ORPHAN_CAND;
+			vis[nvis++] = i;
+		}
 	}
-	if (orphans_user)
-		goto add_orphans;
-
-	iter = xbps_dictionary_iterator(xhp->pkgdb);
-	assert(iter);
 	/*
-	 * First pass: track pkgs that were installed manually and
-	 * without reverse dependencies.
+	 * Mark: the candidates with a dependent that is not a candidate,
+	 * and the candidates they depend on.
 	 */
-	while ((obj = xbps_object_iterator_next(iter))) {
-		pkgd = xbps_dictionary_get_keysym(xhp->pkgdb, obj);
-		/*
-		 * Skip packages that were not installed automatically.
-		 */
-		automatic = false;
-		xbps_dictionary_get_bool(pkgd, "automatic-install", &automatic);
-		if (!automatic)
-			continue;
+	n = 0;
+	for (unsigned int v = 0; v < nvis; v++) {
+		unsigned int i = vis[v];
 
-		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &curpkgver);
-		reqby = xbps_pkgdb_get_pkg_revdeps(xhp, curpkgver);
-		if (xbps_array_count(reqby) == 0) {
-			/*
-			 * Add packages with empty revdeps.
-			 */
-			xbps_array_add(array, pkgd);
+		if ((o.state[i] & ORPHAN_CAND) == 0)
 			continue;
+		for (unsigned int e = g->first[i]; e < g->first[i + 1]; e++) {
+			if ((o.state[g->revdeps[e]] & (ORPHAN_USER|ORPHAN_CAND)) == 0) {
+				o.state[i] |= ORPHAN_LIVE;
+				stack[n++] = i;
+				break;
+			}
 		}
 	}
-	xbps_object_iterator_release(iter);
+	orphans_mark(&o, stack, n, ORPHAN_LIVE, NULL, NULL);
 
-add_orphans:
-	for (i = 0; i < xbps_array_count(array); i++) {
-		pkgd = xbps_array_get(array, i);
-		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &curpkgver);
-		rdeps = xbps_pkgdb_get_pkg_fulldeptree(xhp, curpkgver);
-		for (unsigned int x = 0; x < xbps_array_count(rdeps); x++) {
-			cnt = 0;
-			xbps_array_get_cstring_nocopy(rdeps, x, &deppkgver);
-			if (xbps_find_pkg_in_array(array, deppkgver, NULL))
-				continue;
-			deppkgd = xbps_pkgdb_get_pkg(xhp, deppkgver);
-			automatic = false;
-			xbps_dictionary_get_bool(deppkgd, "automatic-install", &automatic);
-			if (!automatic)
-				continue;
-			reqby = xbps_pkgdb_get_pkg_revdeps(xhp, deppkgver);
-			if (reqby == NULL)
-				continue;
-			reqbycnt = xbps_array_count(reqby);
-			for (unsigned int j = 0; j < reqbycnt; j++) {
-				xbps_array_get_cstring_nocopy(reqby, j, &reqbydep);
-				if (xbps_find_pkg_in_array(array, reqbydep, NULL))
-					cnt++;
+	/*
+	 * Sweep: the candidates left are orphans. An orphan is returned
+	 * once all orphans depending on it were returned, after the first
+	 * of them that was returned; the dependencies of an orphan with
+	 * the shortest dependency chains go first, like in its full
+	 * dependency tree.
+	 */
+	for (unsigned int v = 0; v < nvis; v++) {
+		unsigned int i = vis[v];
+
+		if (!is_orphan(&o, i))
+			continue;
+		for (unsigned int e = g->dfirst[i]; e < g->dfirst[i + 1]; e++)
+			o.pending[g->deps[e]]++;
+	}
+	n = 0;
+	for (unsigned int v = 0; v < nvis; v++) {
+		if (o.state[vis[v]] & ORPHAN_USER)
+			stack[n++] = vis[v];
+	}
+	for (unsigned int v = 0; v < nvis; v++) {
+		unsigned int i = vis[v];
+
+		if (!(o.state[i] & ORPHAN_USER) && is_orphan(&o, i) &&
+		    o.pending[i] == 0)
+			stack[n++] = i;
+	}
+	for (unsigned int x = 0; x < n; x++)
+		orphans_add(&o, stack[x]);
+	for (unsigned int x = 0, next = 0; x < o.norder; x++) {
+		unsigned int i = o.order[x];
+
+		n = 0;
+		for (unsigned int e = g->dfirst[i]; e < g->dfirst[i + 1]; e++) {
+			unsigned int j = g->deps[e];
+
+			if (is_orphan(&o, j) && !(o.state[j] & ORPHAN_DONE) &&
+			    o.pending[j] == 0) {
+				o.ready[n].height = orphans_height(&o, j);
+				o.ready[n++].edge = e;
+			}
+		}
+		qsort(o.ready, n, sizeof(*o.ready), orphan_dep_cmp);
+		for (unsigned int r = 0; r < n; r++) {
+			unsigned int j = g->deps[o.ready[r].edge];
+
+			/* the same dependency may be declared twice */
+			if (!(o.state[j] & ORPHAN_DONE))
+				orphans_add(&o, j);
+		}
+		if (x + 1 < o.norder)
+			continue;
+		/* orphans depending on each other in a cycle */
+		for (; next < nvis; next++) {
+			unsigned int v = vis[next];
+
+			if (is_orphan(&o, v) && !(o.state[v] & ORPHAN_DONE)) {
+				orphans_add(&o, v);
+				break;
 			}
-			if (cnt == reqbycnt)
-				xbps_array_add(array, deppkgd);
 		}
 	}
 
-	return array;
+	free(o.state);
+	free(o.pending);
+	free(o.order);
+	free(o.height);
+	free(o.walk);
+	free(o.edge);
+	free(o.ready);
+	free(stack);
+	free(vis);
+
+	return o.array;
 }
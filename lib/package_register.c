@@ -113,10 +113,18 @@ xbps_register_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkgrd)
 		if (!xbps_array_count(replaces))
 			xbps_dictionary_remove(pkgd, "replaces");
 	}
+	xbps_pkgdb_revdeps_update(xhp,
+	    xbps_dictionary_get(xhp->pkgdb, pkgname), pkgd);
+	xbps_pkgdb_shlibs_update(xhp,
+	    xbps_dictionary_get(xhp->pkgdb, pkgname), pkgd);
+	xbps_pkgdb_files_update(xhp, pkgname);
+	xbps_fulldeptree_release(xhp, false);
 	if (!xbps_dictionary_set(xhp->pkgdb, pkgname, pkgd)) {
 		xbps_dbg_printf(xhp,
 		    "%s: failed to set pkgd for %s\n", __func__, pkgver);
 	}
+	xbps_pkgdb_hash_update(xhp, pkgname);
+	rv = xbps_pkgdb_journal(xhp, pkgname);
 out:
 	xbps_object_release(pkgd);
 	if (pkgname)
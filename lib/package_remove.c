@@ -32,6 +32,8 @@
 #include <libgen.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/param.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
@@ -93,162 +95,294 @@ check_remove_pkg_files(struct xbps_handle *xhp,
 	return fail;
 }
 
+/* These are symlinks in Void and must not be removed */
+static const char *basesymlinks[] = {
+	"/bin",
+	"/sbin",
+	"/usr/sbin",
+	"/lib",
+	"/lib32",
+	"/lib64",
+	"/usr/lib32",
+	"/usr/lib64",
+	"/var/run",
+};
+
+/*
+ * Objects of a files list are removed grouped by their parent directory,
+ * with unlinkat(2) relative to it. Lists of at least RM_PARALLEL_MIN
+ * objects are checked and removed by up to RM_JOBS_MAX threads of the
+ * worker pool, each taking a directory at a time.
+ */
+#define RM_PARALLEL_MIN	2048
+#define RM_JOBS_MAX	8
+
+struct rm_entry {
+	xbps_dictionary_t obj;
+	const char *file;
+	size_t dirlen;
+};
+
+struct rm_data {
+	struct xbps_handle *xhp;
+	const char *key, *curobj, *pkgver;
+	struct rm_entry *entries;
+	unsigned int nentries, next;
+	pthread_mutex_t mtx;
+	int rv;
+};
+
+static int
+rm_entry_cmp(const void *a, const void *b)
+{
+	const struct rm_entry *ea = a, *eb = b;
+	int r;
+
+	if ((r = strncmp(ea->file, eb->file, MIN(ea->dirlen, eb->dirlen))) != 0)
+		return r;
+	if (ea->dirlen != eb->dirlen)
+		return ea->dirlen < eb->dirlen ? -1 : 1;
+	return strcmp(ea->file + ea->dirlen, eb->file + eb->dirlen);
+}
+
+/*
+ * Removes a file, link or directory relative to dirfd, the same way
+ * remove(3) does; path is used if dirfd is not valid.
+ */
+static int
+remove_at(int dirfd, const char *name, const char *path)
+{
+	if (dirfd == -1)
+		return remove(path);
+	if (unlinkat(dirfd, name, 0) == 0)
+		return 0;
+	if (errno != EISDIR && errno != EPERM)
+		return -1;
+	return unlinkat(dirfd, name, AT_REMOVEDIR);
+}
+
+static int
+remove_pkg_file(struct rm_data *rd, struct rm_entry *e, int dirfd,
+		bool basedir)
+{
+	struct xbps_handle *xhp = rd->xhp;
+	const char *pkgver = rd->pkgver, *curobj = rd->curobj;
+	const char *file = e->file, *sha256;
+	char path[PATH_MAX];
+	int rv;
+
+	snprintf(path, sizeof(path), "%s/%s", xhp->rootdir, file);
+
+	if ((strcmp(rd->key, "files") == 0) ||
+	    (strcmp(rd->key, "conf_files") == 0)) {
+		/*
+		 * Check SHA256 hash in regular files and
+		 * configuration files.
+		 */
+		xbps_dictionary_get_cstring_nocopy(e->obj,
+		    "sha256", &sha256);
+		rv = xbps_file_hash_check_handle(xhp, path, sha256);
+		if (rv == ENOENT) {
+			/* missing file, ignore it */
+			xbps_set_cb_state(xhp,
+			    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
+			    rv, pkgver,
+			    "%s: failed to check hash for %s `%s': %s",
+			    pkgver, curobj, file, strerror(rv));
+			return 0;
+		} else if (rv == ERANGE) {
+			if ((xhp->flags &
+			    XBPS_FLAG_FORCE_REMOVE_FILES) == 0) {
+				xbps_set_cb_state(xhp,
+				    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
+				    0, pkgver,
+				    "%s: %s `%s' SHA256 mismatch, "
+				    "preserving file", pkgver,
+				    curobj, file);
+				return 0;
+			} else {
+				xbps_set_cb_state(xhp,
+				    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
+				    0, pkgver,
+				    "%s: %s `%s' SHA256 mismatch, "
+				    "forcing removal", pkgver,
+				    curobj, file);
+			}
+		} else if (rv != 0) {
+			xbps_set_cb_state(xhp,
+			    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
+			    rv, pkgver,
+			    "%s: [remove] failed to check hash for "
+			    "%s `%s': %s", pkgver, curobj, file,
+			    strerror(rv));
+			return rv;
+		}
+	}
+	/*
+	 * Make sure to not remove any symlink of root directory, only
+	 * objects in /, /usr and /var can be one.
+	 */
+	for (uint8_t i = 0; basedir && i < __arraycount(basesymlinks); i++) {
+		if (strcmp(file, basesymlinks[i]) == 0) {
+			xbps_dbg_printf(xhp, "[remove] %s ignoring "
+			    "%s removal\n", pkgver, file);
+			return 0;
+		}
+	}
+	if (strcmp(rd->key, "links") == 0) {
+		const char *target = NULL;
+		char *lnk;
+
+		xbps_dictionary_get_cstring_nocopy(e->obj, "target", &target);
+		assert(target);
+		lnk = xbps_symlink_target(xhp, path, target);
+		if (lnk == NULL) {
+			xbps_dbg_printf(xhp, "[remove] %s "
+			    "symlink_target: %s\n", path, strerror(errno));
+			return 0;
+		}
+		if (strcmp(lnk, target)) {
+			xbps_dbg_printf(xhp, "[remove] %s symlink "
+			    "modified (stored %s current %s)\n", path,
+			    target, lnk);
+			if ((xhp->flags & XBPS_FLAG_FORCE_REMOVE_FILES) == 0) {
+				free(lnk);
+				return 0;
+			}
+		}
+		free(lnk);
+	}
+	/*
+	 * Remove the object if possible.
+	 */
+	if (remove_at(dirfd, file + e->dirlen + 1, path) == -1) {
+		xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE_FAIL,
+		    errno, pkgver,
+		    "%s: failed to remove %s `%s': %s", pkgver,
+		    curobj, file, strerror(errno));
+	} else {
+		/* success */
+		xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE,
+		    0, pkgver, "Removed %s `%s'", curobj, file);
+	}
+	return 0;
+}
+
+static void *
+remove_pkg_files_thread(void *arg)
+{
+	struct rm_data *rd = arg;
+	struct rm_entry *e;
+	char dir[PATH_MAX];
+	unsigned int start, end;
+	int dirfd, rv;
+	bool basedir;
+
+	for (;;) {
+		/* take the next directory */
+		pthread_mutex_lock(&rd->mtx);
+		if (rd->rv != 0 || rd->next >= rd->nentries) {
+			pthread_mutex_unlock(&rd->mtx);
+			break;
+		}
+		start = end = rd->next;
+		e = &rd->entries[start];
+		while (end < rd->nentries && rd->entries[end].dirlen == e->dirlen &&
+		    strncmp(rd->entries[end].file, e->file, e->dirlen) == 0)
+			end++;
+		rd->next = end;
+		pthread_mutex_unlock(&rd->mtx);
+
+		snprintf(dir, sizeof(dir), "%s/%.*s", rd->xhp->rootdir,
+		    (int)e->dirlen, e->file);
+		dirfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		basedir = e->dirlen == 0 ||
+		    (e->dirlen == 4 && (strncmp(e->file, "/usr", 4) == 0 ||
+		    strncmp(e->file, "/var", 4) == 0));
+		for (rv = 0; start < end && rv == 0; start++)
+			rv = remove_pkg_file(rd, &rd->entries[start], dirfd, basedir);
+		if (dirfd != -1)
+			(void)close(dirfd);
+		if (rv != 0) {
+			pthread_mutex_lock(&rd->mtx);
+			if (rd->rv == 0)
+				rd->rv = rv;
+			pthread_mutex_unlock(&rd->mtx);
+			break;
+		}
+	}
+	return NULL;
+}
+
 static int
 remove_pkg_files(struct xbps_handle *xhp,
 		 xbps_dictionary_t dict,
 		 const char *key,
 		 const char *pkgver)
 {
+	struct rm_data rd;
 	xbps_array_t array;
-	xbps_object_iterator_t iter;
 	xbps_object_t obj;
-	const char *curobj = NULL;
-	/* These are symlinks in Void and must not be removed */
-	const char *basesymlinks[] = {
-		"/bin",
-		"/sbin",
-		"/usr/sbin",
-		"/lib",
-		"/lib32",
-		"/lib64",
-		"/usr/lib32",
-		"/usr/lib64",
-		"/var/run",
-	};
-	int rv = 0;
+	unsigned int cnt, njobs = 1;
+	const char *file, *p;
 
 	assert(xbps_object_type(dict) == XBPS_TYPE_DICTIONARY);
 	assert(key != NULL);
 
 	array = xbps_dictionary_get(dict, key);
-	if (xbps_array_count(array) == 0)
+	if ((cnt = xbps_array_count(array)) == 0)
 		return 0;
 
-	iter = xbps_array_iter_from_dict(dict, key);
-	if (iter == NULL)
-		return ENOMEM;
+	memset(&rd, 0, sizeof(rd));
+	rd.xhp = xhp;
+	rd.key = key;
+	rd.pkgver = pkgver;
 
 	if (strcmp(key, "files") == 0)
-		curobj = "file";
+		rd.curobj = "file";
 	else if (strcmp(key, "conf_files") == 0)
-		curobj = "configuration file";
+		rd.curobj = "configuration file";
 	else if (strcmp(key, "links") == 0)
-		curobj = "link";
+		rd.curobj = "link";
 	else if (strcmp(key, "dirs") == 0)
-		curobj = "directory";
-
-	xbps_object_iterator_reset(iter);
-
-	while ((obj = xbps_object_iterator_next(iter))) {
-		const char *file, *sha256;
-		char path[PATH_MAX];
-		bool found;
+		rd.curobj = "directory";
 
-		xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
-		snprintf(path, sizeof(path), "%s/%s", xhp->rootdir, file);
-
-		if ((strcmp(key, "files") == 0) ||
-		    (strcmp(key, "conf_files") == 0)) {
-			/*
-			 * Check SHA256 hash in regular files and
-			 * configuration files.
-			 */
-			xbps_dictionary_get_cstring_nocopy(obj,
-			    "sha256", &sha256);
-			rv = xbps_file_hash_check(path, sha256);
-			if (rv == ENOENT) {
-				/* missing file, ignore it */
-				xbps_set_cb_state(xhp,
-				    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
-				    rv, pkgver,
-				    "%s: failed to check hash for %s `%s': %s",
-				    pkgver, curobj, file, strerror(rv));
-				rv = 0;
-				continue;
-			} else if (rv == ERANGE) {
-				rv = 0;
-				if ((xhp->flags &
-				    XBPS_FLAG_FORCE_REMOVE_FILES) == 0) {
-					xbps_set_cb_state(xhp,
-					    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
-					    0, pkgver,
-					    "%s: %s `%s' SHA256 mismatch, "
-					    "preserving file", pkgver,
-					    curobj, file);
-					continue;
-				} else {
-					xbps_set_cb_state(xhp,
-					    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
-					    0, pkgver,
-					    "%s: %s `%s' SHA256 mismatch, "
-					    "forcing removal", pkgver,
-					    curobj, file);
-				}
-			} else if (rv != 0 && rv != ERANGE) {
-				xbps_set_cb_state(xhp,
-				    XBPS_STATE_REMOVE_FILE_HASH_FAIL,
-				    rv, pkgver,
-				    "%s: [remove] failed to check hash for "
-				    "%s `%s': %s", pkgver, curobj, file,
-				    strerror(rv));
-				break;
-			}
-		}
-		/*
-		 * Make sure to not remove any symlink of root directory.
-		 */
-		found = false;
-		for (uint8_t i = 0; i < __arraycount(basesymlinks); i++) {
-			if (strcmp(file, basesymlinks[i]) == 0) {
-				found = true;
-				xbps_dbg_printf(xhp, "[remove] %s ignoring "
-				    "%s removal\n", pkgver, file);
-				break;
-			}
-		}
-		if (found) {
+	rd.entries = calloc(cnt, sizeof(*rd.entries));
+	assert(rd.entries);
+	for (unsigned int i = 0; i < cnt; i++) {
+		obj = xbps_array_get(array, i);
+		if (!xbps_dictionary_get_cstring_nocopy(obj, "file", &file))
 			continue;
+		if ((p = strrchr(file, '/')) == NULL)
+			continue;
+		rd.entries[rd.nentries].obj = obj;
+		rd.entries[rd.nentries].file = file;
+		rd.entries[rd.nentries].dirlen = (size_t)(p - file);
+		rd.nentries++;
+	}
+	/*
+	 * Directories are removed in order, the others by parent
+	 * directory.
+	 */
+	if (strcmp(key, "dirs") != 0) {
+		qsort(rd.entries, rd.nentries, sizeof(*rd.entries), rm_entry_cmp);
+		if (rd.nentries >= RM_PARALLEL_MIN)
+			njobs = MIN(xbps_pool_size(rd.xhp), RM_JOBS_MAX);
+	} else {
+		for (unsigned int i = 0; i < rd.nentries && rd.rv == 0; i++) {
+			rd.rv = remove_pkg_file(&rd, &rd.entries[i], -1,
+			    rd.entries[i].dirlen <= 4);
 		}
-		if (strcmp(key, "links") == 0) {
-			const char *target = NULL;
-			char *lnk;
-
-			xbps_dictionary_get_cstring_nocopy(obj, "target", &target);
-			assert(target);
-			lnk = xbps_symlink_target(xhp, path, target);
-			if (lnk == NULL) {
-				xbps_dbg_printf(xhp, "[remove] %s "
-				    "symlink_target: %s\n", path, strerror(errno));
-				continue;
-			}
-			if (strcmp(lnk, target)) {
-				xbps_dbg_printf(xhp, "[remove] %s symlink "
-				    "modified (stored %s current %s)\n", path,
-				    target, lnk);
-				if ((xhp->flags & XBPS_FLAG_FORCE_REMOVE_FILES) == 0) {
-					free(lnk);
-					continue;
-				}
-			}
-			free(lnk);
-		}
-		/*
-		 * Remove the object if possible.
-		 */
-		if (remove(path) == -1) {
-			xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE_FAIL,
-			    errno, pkgver,
-			    "%s: failed to remove %s `%s': %s", pkgver,
-			    curobj, file, strerror(errno));
-		} else {
-			/* success */
-			xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_FILE,
-			    0, pkgver, "Removed %s `%s'", curobj, file);
-		}
+		free(rd.entries);
+		return rd.rv;
 	}
-	xbps_object_iterator_release(iter);
 
-	return rv;
+	pthread_mutex_init(&rd.mtx, NULL);
+	xbps_pool_run(rd.xhp, remove_pkg_files_thread, &rd, njobs);
+	pthread_mutex_destroy(&rd.mtx);
+	free(rd.entries);
+
+	return rd.rv;
 }
 
 int HIDDEN
@@ -293,9 +427,9 @@ xbps_remove_pkg(struct xbps_handle *xhp, const char *pkgver, bool update)
 		goto out;
 	}
 
-	/* internalize pkg files dictionary from metadir */
+	/* pkg files dictionary from metadir or the files index */
 	snprintf(metafile, sizeof(metafile), "%s/.%s-files.plist", xhp->metadir, pkgname);
-	pkgfilesd = xbps_plist_dictionary_from_file(xhp, metafile);
+	pkgfilesd = xbps_pkgdb_get_pkg_files(xhp, pkgver);
 	if (pkgfilesd == NULL)
 		xbps_dbg_printf(xhp, "WARNING: metaplist for %s "
 		    "doesn't exist!\n", pkgver);
@@ -410,7 +544,15 @@ purge:
 	/*
 	 * Unregister package from pkgdb.
 	 */
+	xbps_pkgdb_revdeps_update(xhp,
+	    xbps_dictionary_get(xhp->pkgdb, pkgname), NULL);
+	xbps_pkgdb_shlibs_update(xhp,
+	    xbps_dictionary_get(xhp->pkgdb, pkgname), NULL);
+	xbps_pkgdb_files_update(xhp, pkgname);
+	xbps_fulldeptree_release(xhp, false);
 	xbps_dictionary_remove(xhp->pkgdb, pkgname);
+	xbps_pkgdb_hash_update(xhp, pkgname);
+	rv = xbps_pkgdb_journal(xhp, pkgname);
 	xbps_dbg_printf(xhp, "[remove] unregister %s returned %d\n", pkgver, rv);
 	xbps_set_cb_state(xhp, XBPS_STATE_REMOVE_DONE, 0, pkgver, NULL);
 out:
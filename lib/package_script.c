@@ -23,36 +23,83 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef HAVE_MEMFD_CREATE
+# define _GNU_SOURCE	/* for memfd_create(2) */
+# include <sys/mman.h>
+#endif
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "xbps_api_impl.h"
 
-int
-xbps_pkg_exec_buffer(struct xbps_handle *xhp,
-		     const void *blob,
-		     const size_t blobsiz,
-		     const char *pkgver,
-		     const char *action,
-		     bool update)
+/*
+ * Writes the script into an anonymous memory file, the shell reads it
+ * from /proc/self/fd/N. Must be called with rootdir as cwd; returns -1
+ * if /proc isn't available where the script is executed (chroots),
+ * the caller falls back to a temporary file.
+ */
+static int
+script_memfd(struct xbps_handle *xhp, const void *blob, const size_t blobsiz,
+		char **fpathp)
+{
+#ifdef HAVE_MEMFD_CREATE
+	const char *procfd = "/proc/self/fd";
+	int fd;
+
+	/* see pfcexec() in external/fexec.c */
+	if (strcmp(xhp->rootdir, "/") && geteuid() == 0 &&
+	    access("bin/sh", X_OK) == 0)
+		procfd = "proc/self/fd";
+	if (access(procfd, X_OK) == -1)
+		return -1;
+
+	if ((fd = memfd_create("xbps-script", 0)) == -1) {
+		xbps_dbg_printf(xhp, "%s: memfd_create %s\n",
+		    __func__, strerror(errno));
+		return -1;
+	}
+	if (write(fd, blob, blobsiz) != (ssize_t)blobsiz) {
+		close(fd);
+		return -1;
+	}
+	*fpathp = xbps_xasprintf("/proc/self/fd/%d", fd);
+	return fd;
+#else
+	(void)xhp;
+	(void)blob;
+	(void)blobsiz;
+	(void)fpathp;
+	return -1;
+#endif
+}
+
+/*
+ * Creates the script to execute in fpathp, returning in memfdp the
+ * memory file descriptor holding it or -1 if it's a temporary file that
+ * must be removed afterwards.
+ */
+static int
+script_create(struct xbps_handle *xhp, const void *blob, const size_t blobsiz,
+		char **fpathp, int *memfdp)
 {
 	ssize_t ret;
-	const char *tmpdir, *version;
-	char *pkgname, *fpath;
-	int fd, rv;
+	const char *tmpdir;
+	char *fpath;
+	int fd, rv = 0;
 
-	assert(blob);
-	assert(pkgver);
-	assert(action);
+	*memfdp = -1;
+	*fpathp = NULL;
 
-	if (xhp->target_arch) {
-		xbps_dbg_printf(xhp, "%s: not executing %s "
-		    "install/remove action.\n", pkgver, action);
+	/* change cwd to rootdir to exec the script */
+	if (chdir(xhp->rootdir) == -1)
+		return errno;
+
+	if ((*memfdp = script_memfd(xhp, blob, blobsiz, fpathp)) != -1)
 		return 0;
-	}
 
 	if (strcmp(xhp->rootdir, "/") == 0) {
 		tmpdir = getenv("TMPDIR");
@@ -64,12 +111,6 @@ xbps_pkg_exec_buffer(struct xbps_handle *xhp,
 		fpath = strdup(".xbps-script-XXXXXX");
 	}
 
-	/* change cwd to rootdir to exec the script */
-	if (chdir(xhp->rootdir) == -1) {
-		rv = errno;
-		goto out;
-	}
-
 	/* Create temp file to run script */
 	if ((fd = mkstemp(fpath)) == -1) {
 		rv = errno;
@@ -87,30 +128,120 @@ xbps_pkg_exec_buffer(struct xbps_handle *xhp,
 		goto out;
 	}
 	fchmod(fd, 0750);
-#ifdef HAVE_FDATASYNC
-	fdatasync(fd);
-#else
-	fsync(fd);
-#endif
 	close(fd);
 
+out:
+	if (rv != 0) {
+		remove(fpath);
+		free(fpath);
+		fpath = NULL;
+	}
+	*fpathp = fpath;
+	return rv;
+}
+
+int
+xbps_pkg_exec_buffer(struct xbps_handle *xhp,
+		     const void *blob,
+		     const size_t blobsiz,
+		     const char *pkgver,
+		     const char *action,
+		     bool update)
+{
+	const char *version;
+	char *pkgname, *fpath;
+	uint64_t start;
+	int memfd, rv;
+
+	assert(blob);
+	assert(pkgver);
+	assert(action);
+
+	if (xhp->target_arch) {
+		xbps_dbg_printf(xhp, "%s: not executing %s "
+		    "install/remove action.\n", pkgver, action);
+		return 0;
+	}
+
+	if ((rv = script_create(xhp, blob, blobsiz, &fpath, &memfd)) != 0)
+		return rv;
+
 	/* exec script */
 	pkgname = xbps_pkg_name(pkgver);
 	assert(pkgname);
 	version = xbps_pkg_version(pkgver);
 	assert(version);
 
+	start = xbps_trace_begin();
 	rv = xbps_file_exec(xhp, "/bin/sh", fpath, action, pkgname, version,
 			    update ? "yes" : "no",
 			    "no", xhp->native_arch, NULL);
+	xbps_trace_end(start, "script", action, pkgver);
 	free(pkgname);
 
-out:
-	remove(fpath);
+	if (memfd != -1)
+		close(memfd);
+	else
+		remove(fpath);
 	free(fpath);
 	return rv;
 }
 
+/*
+ * Starts the script action without waiting for it, its output goes
+ * to outfd. Returns the pid of the script, 0 if there's nothing to run
+ * or -1 on error (errno is set). The script file returned in fpathp,
+ * if any, must be removed by the caller once the script has finished.
+ */
+pid_t HIDDEN
+xbps_pkg_spawn_script(struct xbps_handle *xhp,
+		      xbps_dictionary_t d,
+		      const char *script,
+		      const char *action,
+		      bool update,
+		      int outfd,
+		      char **fpathp)
+{
+	xbps_data_t data;
+	void *buf;
+	const char *pkgver, *version;
+	char *pkgname;
+	pid_t pid;
+	int memfd, rv;
+
+	*fpathp = NULL;
+	data = xbps_dictionary_get(d, script);
+	if (data == NULL || xhp->target_arch)
+		return 0;
+
+	xbps_dictionary_get_cstring_nocopy(d, "pkgver", &pkgver);
+
+	buf = xbps_data_data(data);
+	rv = script_create(xhp, buf, xbps_data_size(data), fpathp, &memfd);
+	free(buf);
+	if (rv != 0) {
+		errno = rv;
+		return -1;
+	}
+
+	pkgname = xbps_pkg_name(pkgver);
+	assert(pkgname);
+	version = xbps_pkg_version(pkgver);
+	assert(version);
+
+	pid = xbps_file_spawn(xhp, outfd, "/bin/sh", *fpathp, action, pkgname,
+	    version, update ? "yes" : "no", "no", xhp->native_arch, NULL);
+	free(pkgname);
+
+	if (memfd != -1) {
+		/* the child has its own copy, don't leak it to others */
+		close(memfd);
+		free(*fpathp);
+		*fpathp = NULL;
+	}
+	return pid;
+}
+
 int
 xbps_pkg_exec_script(struct xbps_handle *xhp,
 		     xbps_dictionary_t d,
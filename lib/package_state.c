@@ -165,6 +165,8 @@ xbps_set_pkg_state_installed(struct xbps_handle *xhp,
 			free(pkgname);
 			return EINVAL;
 		}
+		xbps_pkgdb_hash_update(xhp, pkgname);
+		rv = xbps_pkgdb_journal(xhp, pkgname);
 		free(pkgname);
 		xbps_object_release(pkgd);
 	} else {
@@ -177,6 +179,8 @@ xbps_set_pkg_state_installed(struct xbps_handle *xhp,
 			free(pkgname);
 			return EINVAL;
 		}
+		xbps_pkgdb_hash_update(xhp, pkgname);
+		rv = xbps_pkgdb_journal(xhp, pkgname);
 		free(pkgname);
 	}
 
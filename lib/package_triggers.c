@@ -0,0 +1,145 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Packages declare in the "triggers" array of their props.plist the names
+ * of system wide actions (updating icon caches, the linker cache, font
+ * caches...) that must be performed after they are installed, updated or
+ * removed. Instead of running them from every INSTALL/REMOVE script, the
+ * triggers of all packages in a transaction are collected and each one is
+ * executed once at the end, from XBPS_TRIGGERS_PATH in rootdir, with the
+ * "post" argument followed by the pkgvers that requested it.
+ */
+static bool
+trigger_name_valid(const char *name)
+{
+	return *name != '\0' && *name != '.' && strchr(name, '/') == NULL;
+}
+
+void HIDDEN
+xbps_triggers_add(xbps_dictionary_t triggers, xbps_dictionary_t pkgd)
+{
+	xbps_array_t pkgtrig, pkgvers;
+	const char *pkgver = NULL, *name;
+
+	pkgtrig = xbps_dictionary_get(pkgd, "triggers");
+	if (xbps_array_count(pkgtrig) == 0)
+		return;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	for (unsigned int i = 0; i < xbps_array_count(pkgtrig); i++) {
+		if (!xbps_array_get_cstring_nocopy(pkgtrig, i, &name) ||
+		    !trigger_name_valid(name))
+			continue;
+
+		pkgvers = xbps_dictionary_get(triggers, name);
+		if (pkgvers == NULL) {
+			pkgvers = xbps_array_create();
+			assert(pkgvers);
+			xbps_dictionary_set(triggers, name, pkgvers);
+			xbps_object_release(pkgvers);
+		}
+		if (pkgver && !xbps_match_string_in_array(pkgvers, pkgver))
+			xbps_array_add_cstring_nocopy(pkgvers, pkgver);
+	}
+}
+
+static int
+trigger_run(struct xbps_handle *xhp, const char *name, xbps_array_t pkgvers)
+{
+	const char **argv;
+	char *path;
+	unsigned int n = 0;
+	int rv;
+
+	/* relative to rootdir, which is also the cwd of the chroot */
+	path = xbps_xasprintf("%s/%s", XBPS_TRIGGERS_PATH, name);
+	if (chdir(xhp->rootdir) == -1 || access(path, X_OK) == -1) {
+		xbps_dbg_printf(xhp, "[trigger] %s: %s, skipping\n",
+		    name, strerror(errno));
+		free(path);
+		return 0;
+	}
+
+	argv = calloc(xbps_array_count(pkgvers) + 3, sizeof(*argv));
+	assert(argv);
+	argv[n++] = path;
+	argv[n++] = "post";
+	for (unsigned int i = 0; i < xbps_array_count(pkgvers); i++)
+		xbps_array_get_cstring_nocopy(pkgvers, i, &argv[n++]);
+
+	xbps_set_cb_state(xhp, XBPS_STATE_TRIGGER, 0, name, NULL);
+	rv = xbps_file_execv(xhp, argv);
+	if (rv != 0) {
+		xbps_set_cb_state(xhp, XBPS_STATE_TRIGGER_FAIL, rv, name,
+		    "%s: [trigger] failed to execute the post ACTION: %s",
+		    name, strerror(rv));
+	} else {
+		xbps_set_cb_state(xhp, XBPS_STATE_TRIGGER_DONE, 0, name, NULL);
+	}
+	free(argv);
+	free(path);
+
+	return rv;
+}
+
+int HIDDEN
+xbps_triggers_run(struct xbps_handle *xhp, xbps_dictionary_t triggers)
+{
+	xbps_object_t obj;
+	xbps_object_iterator_t iter;
+	int rv, rv2 = 0;
+
+	if (xbps_dictionary_count(triggers) == 0)
+		return 0;
+
+	if (xhp->target_arch) {
+		xbps_dbg_printf(xhp, "[trigger] not executing triggers "
+		    "for target arch\n");
+		return 0;
+	}
+
+	iter = xbps_dictionary_iterator(triggers);
+	assert(iter);
+	/* every trigger is executed, the first error is returned */
+	while ((obj = xbps_object_iterator_next(iter))) {
+		rv = trigger_run(xhp, xbps_dictionary_keysym_cstring_nocopy(obj),
+		    xbps_dictionary_get_keysym(triggers, obj));
+		if (rv != 0 && rv2 == 0)
+			rv2 = rv;
+	}
+	xbps_object_iterator_release(iter);
+
+	return rv2;
+}
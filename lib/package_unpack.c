@@ -23,6 +23,11 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#if defined(HAVE_SYNCFS) || defined(HAVE_COPY_FILE_RANGE)
+# define _GNU_SOURCE	/* for syncfs(2) and copy_file_range(2) */
+#endif
+
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -32,9 +37,22 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#include <openssl/sha.h>
 
 #include "xbps_api_impl.h"
 
+/*
+ * archive_write_disk_new() reads the umask by changing it, packages
+ * unpacked concurrently must not do it at the same time.
+ */
+static pthread_mutex_t ext_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static int
 set_extract_flags(uid_t euid)
 {
@@ -48,22 +66,529 @@ set_extract_flags(uid_t euid)
 	return flags;
 }
 
+/*
+ * The preserved files are expanded when the configuration is read, they
+ * are matched by path with a hashed set built once per package.
+ */
+static xbps_dictionary_t
+preserved_files_set(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t set;
+	const char *file;
+
+	if (xbps_array_count(xhp->preserved_files) == 0)
+		return NULL;
+
+	set = xbps_dictionary_create_hashed(
+	    xbps_array_count(xhp->preserved_files));
+	assert(set);
+	for (unsigned int i = 0; i < xbps_array_count(xhp->preserved_files); i++) {
+		xbps_array_get_cstring_nocopy(xhp->preserved_files, i, &file);
+		xbps_dictionary_set_bool(set, file, true);
+	}
+	return set;
+}
+
 static bool
-match_preserved_file(struct xbps_handle *xhp, const char *entry)
+match_preserved_file(xbps_dictionary_t preserved, const char *entry)
 {
-	char *file;
+	const char *file;
 
-	if (xhp->preserved_files == NULL)
+	if (preserved == NULL)
 		return false;
 
 	if (entry[0] == '.' && entry[1] != '\0') {
 		file = strchr(entry, '.') + 1;
 		assert(file);
 	} else {
-		file = __UNCONST(entry);
+		file = entry;
+	}
+
+	return xbps_dictionary_get(preserved, file) != NULL;
+}
+
+/*
+ * Table of the regular and configuration files of a files.plist sorted
+ * by path, used for the lookups of the extract loop. If the strings are
+ * copied, the table doesn't refer to the files.plist and it can be
+ * released.
+ */
+struct file_ent {
+	const char *file;
+	const char *sha256;
+	xbps_dictionary_t obj;
+	uint64_t mtime;
+	bool conf;
+};
+
+struct files_table {
+	struct file_ent *ents;
+	unsigned int count;
+	char *strs;
+};
+
+static int
+file_ent_cmp(const void *a, const void *b)
+{
+	const struct file_ent *ea = a, *eb = b;
+
+	return strcmp(ea->file, eb->file);
+}
+
+static void
+files_table_init(struct files_table *ft, xbps_dictionary_t filesd, bool copy)
+{
+	static const char *keys[] = { "files", "conf_files" };
+	struct file_ent *e;
+	xbps_array_t array;
+	xbps_object_t obj;
+	const char *file, *sha256;
+	size_t len = 0;
+	unsigned int cnt = 0;
+	char *p = NULL;
+
+	memset(ft, 0, sizeof(*ft));
+	for (uint8_t i = 0; i < __arraycount(keys); i++) {
+		array = xbps_dictionary_get(filesd, keys[i]);
+		cnt += xbps_array_count(array);
+		for (unsigned int x = 0; copy && x < xbps_array_count(array); x++) {
+			obj = xbps_array_get(array, x);
+			if (xbps_dictionary_get_cstring_nocopy(obj, "file", &file))
+				len += strlen(file) + 1;
+			if (xbps_dictionary_get_cstring_nocopy(obj, "sha256", &sha256))
+				len += strlen(sha256) + 1;
+		}
+	}
+	if (cnt == 0)
+		return;
+
+	ft->ents = calloc(cnt, sizeof(*ft->ents));
+	assert(ft->ents);
+	if (copy) {
+		p = ft->strs = malloc(len);
+		assert(ft->strs);
+	}
+	for (uint8_t i = 0; i < __arraycount(keys); i++) {
+		array = xbps_dictionary_get(filesd, keys[i]);
+		for (unsigned int x = 0; x < xbps_array_count(array); x++) {
+			obj = xbps_array_get(array, x);
+			if (!xbps_dictionary_get_cstring_nocopy(obj, "file", &file))
+				continue;
+			e = &ft->ents[ft->count++];
+			e->file = file;
+			e->sha256 = NULL;
+			xbps_dictionary_get_cstring_nocopy(obj, "sha256", &e->sha256);
+			xbps_dictionary_get_uint64(obj, "mtime", &e->mtime);
+			e->conf = i == 1;
+			if (!copy) {
+				e->obj = obj;
+				continue;
+			}
+			e->file = strcpy(p, file);
+			p += strlen(p) + 1;
+			if (e->sha256 != NULL) {
+				e->sha256 = strcpy(p, e->sha256);
+				p += strlen(p) + 1;
+			}
+		}
+	}
+	qsort(ft->ents, ft->count, sizeof(*ft->ents), file_ent_cmp);
+}
+
+static struct file_ent *
+files_table_get(struct files_table *ft, const char *file)
+{
+	struct file_ent key;
+
+	if (ft->count == 0)
+		return NULL;
+
+	key.file = file;
+	return bsearch(&key, ft->ents, ft->count, sizeof(*ft->ents),
+	    file_ent_cmp);
+}
+
+static void
+files_table_free(struct files_table *ft)
+{
+	free(ft->ents);
+	free(ft->strs);
+	memset(ft, 0, sizeof(*ft));
+}
+
+/*
+ * Writes current archive entry to disk, the same way archive_read_extract()
+ * does. If \a sha256 is set the data is hashed while it's written.
+ */
+static int
+extract_entry(struct archive *ar, struct archive *ext,
+		struct archive_entry *entry, char *sha256)
+{
+	static const unsigned char zeros[4096];
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256_CTX ctx;
+	const void *buf;
+	size_t size;
+	int64_t offset, pos = 0;
+	int r;
+
+	if (archive_write_header(ext, entry) != ARCHIVE_OK)
+		return archive_errno(ext) ? archive_errno(ext) : EINVAL;
+
+	SHA256_Init(&ctx);
+	for (;;) {
+		r = archive_read_data_block(ar, &buf, &size, &offset);
+		if (r == ARCHIVE_EOF)
+			break;
+		if (r != ARCHIVE_OK)
+			return archive_errno(ar) ? archive_errno(ar) : EINVAL;
+		if (sha256) {
+			/* holes of sparse files are read as zeros */
+			while (pos < offset) {
+				size_t n = sizeof(zeros);
+				if ((int64_t)n > offset - pos)
+					n = (size_t)(offset - pos);
+				SHA256_Update(&ctx, zeros, n);
+				pos += n;
+			}
+			SHA256_Update(&ctx, buf, size);
+			pos = offset + (int64_t)size;
+		}
+		if (archive_write_data_block(ext, buf, size, offset) != ARCHIVE_OK)
+			return archive_errno(ext) ? archive_errno(ext) : EINVAL;
 	}
+	if (archive_write_finish_entry(ext) != ARCHIVE_OK)
+		return archive_errno(ext) ? archive_errno(ext) : EINVAL;
 
-	return xbps_match_string_in_array(xhp->preserved_files, file);
+	if (sha256) {
+		while (pos < archive_entry_size(entry)) {
+			size_t n = sizeof(zeros);
+			if ((int64_t)n > archive_entry_size(entry) - pos)
+				n = (size_t)(archive_entry_size(entry) - pos);
+			SHA256_Update(&ctx, zeros, n);
+			pos += n;
+		}
+		SHA256_Final(digest, &ctx);
+		xbps_counter_add(XBPS_COUNTER_HASH_BYTES, pos);
+		xbps_digest2string(digest, sha256, SHA256_DIGEST_LENGTH);
+	}
+	return 0;
+}
+
+/*
+ * Reads the data of current archive entry into a buffer, hashing it, to
+ * be written through io_uring.
+ */
+static int
+read_entry(struct archive *ar, struct archive_entry *entry, void **bufp,
+		size_t *lenp, char *sha256)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256_CTX ctx;
+	size_t len;
+	void *buf = NULL;
+
+	len = (size_t)archive_entry_size(entry);
+	if (len > 0) {
+		buf = malloc(len);
+		assert(buf);
+		if (archive_read_data(ar, buf, len) != (ssize_t)len) {
+			free(buf);
+			return archive_errno(ar) ? archive_errno(ar) : EINVAL;
+		}
+	}
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, buf, len);
+	SHA256_Final(digest, &ctx);
+	xbps_counter_add(XBPS_COUNTER_HASH_BYTES, len);
+	xbps_digest2string(digest, sha256, SHA256_DIGEST_LENGTH);
+
+	*bufp = buf;
+	*lenp = len;
+	return 0;
+}
+
+/*
+ * Copies len bytes at offset off of sfd to the start of dfd, cloning the
+ * extents if the filesystem supports it and the data is aligned to its
+ * block size, and copying them in the kernel otherwise.
+ */
+static int
+copy_range(int sfd, off_t off, int dfd, off_t len)
+{
+	char buf[65536];
+	off_t done = 0;
+	ssize_t rd, wr;
+#ifdef FICLONERANGE
+	struct file_clone_range fcr;
+	struct stat st;
+
+	if (fstat(dfd, &st) == 0 && st.st_blksize > 0 &&
+	    off % st.st_blksize == 0 && len >= st.st_blksize) {
+		fcr.src_fd = sfd;
+		fcr.src_offset = (uint64_t)off;
+		fcr.src_length = (uint64_t)(len - len % st.st_blksize);
+		fcr.dest_offset = 0;
+		if (ioctl(dfd, FICLONERANGE, &fcr) == 0)
+			done = (off_t)fcr.src_length;
+	}
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+	while (done < len) {
+		loff_t in = off + done, out = done;
+
+		rd = copy_file_range(sfd, &in, dfd, &out, (size_t)(len - done), 0);
+		if (rd == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOSYS || errno == EXDEV ||
+			    errno == EINVAL || errno == EOPNOTSUPP)
+				break;
+			return errno;
+		} else if (rd == 0) {
+			return EIO;
+		}
+		done += rd;
+	}
+#endif
+	while (done < len) {
+		rd = pread(sfd, buf, MIN(sizeof(buf), (size_t)(len - done)),
+		    off + done);
+		if (rd == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		} else if (rd == 0) {
+			return EIO;
+		}
+		for (ssize_t i = 0; i < rd; i += wr) {
+			wr = pwrite(dfd, buf + i, (size_t)(rd - i), done + i);
+			if (wr == -1) {
+				if (errno == EINTR) {
+					wr = 0;
+					continue;
+				}
+				return errno;
+			}
+		}
+		done += rd;
+	}
+	return 0;
+}
+
+/*
+ * Writes current archive entry to disk copying its data straight from the
+ * uncompressed package opened at pkg_fd, rather than through libarchive.
+ * The file is created empty by archive_write_disk(3) with its metadata.
+ */
+static int
+clone_entry(struct archive *ar, struct archive *ext,
+		struct archive_entry *entry, int pkg_fd)
+{
+	struct timespec ts[2];
+	int64_t size, off;
+	mode_t mode;
+	int fd, rv;
+
+	off = archive_filter_bytes(ar, 0);
+	size = archive_entry_size(entry);
+	mode = archive_entry_perm(entry);
+
+	archive_entry_set_size(entry, 0);
+	rv = archive_write_header(ext, entry);
+	archive_entry_set_size(entry, size);
+	if (rv != ARCHIVE_OK)
+		return archive_errno(ext) ? archive_errno(ext) : EINVAL;
+	if (archive_write_finish_entry(ext) != ARCHIVE_OK)
+		return archive_errno(ext) ? archive_errno(ext) : EINVAL;
+
+	fd = open(archive_entry_pathname(entry), O_WRONLY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd == -1)
+		return errno;
+	if ((rv = copy_range(pkg_fd, (off_t)off, fd, (off_t)size)) != 0) {
+		(void)close(fd);
+		return rv;
+	}
+	/* writing clears the setuid/setgid bits, restore them and mtime */
+	if ((mode & (S_ISUID|S_ISGID)) && fchmod(fd, mode) == -1) {
+		rv = errno;
+		(void)close(fd);
+		return rv;
+	}
+	ts[0].tv_sec = archive_entry_atime(entry);
+	ts[0].tv_nsec = archive_entry_atime_nsec(entry);
+	ts[1].tv_sec = archive_entry_mtime(entry);
+	ts[1].tv_nsec = archive_entry_mtime_nsec(entry);
+	if (futimens(fd, ts) == -1) {
+		rv = errno;
+		(void)close(fd);
+		return rv;
+	}
+	(void)close(fd);
+
+	if (archive_read_data_skip(ar) != ARCHIVE_OK)
+		return archive_errno(ar) ? archive_errno(ar) : EINVAL;
+
+	return 0;
+}
+
+/*
+ * With XBPS_FLAG_UNPACK_SYNC regular files are written next to their
+ * path as ".<name>.xbps-new", recorded in the staged dictionary mapping
+ * the temporary path to the final one. Once the whole package has been
+ * written they're flushed to disk at once and renamed into place, so
+ * that a crash can't leave truncated files in the rootdir nor files
+ * registered in the pkgdb whose data isn't on disk.
+ */
+static char *
+staged_path(const char *path)
+{
+	const char *base;
+
+	if ((base = strrchr(path, '/')) == NULL)
+		return xbps_xasprintf(".%s.xbps-new", path);
+
+	return xbps_xasprintf("%.*s/.%s.xbps-new", (int)(base - path),
+	    path, base + 1);
+}
+
+static int
+staged_sync(xbps_dictionary_t staged)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	const char *tmp;
+	int fd, rv = 0;
+#ifdef HAVE_SYNCFS
+	struct stat st;
+	dev_t *devs = NULL;
+	size_t i, ndevs = 0;
+	char *dir;
+#endif
+
+	iter = xbps_dictionary_iterator(staged);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
+		tmp = xbps_dictionary_keysym_cstring_nocopy(obj);
+#ifdef HAVE_SYNCFS
+		/*
+		 * A single syncfs(2) per filesystem flushes all files
+		 * written to it.
+		 */
+		if (lstat(tmp, &st) == -1) {
+			rv = errno;
+			break;
+		}
+		for (i = 0; i < ndevs; i++) {
+			if (devs[i] == st.st_dev)
+				break;
+		}
+		if (i < ndevs)
+			continue;
+		devs = realloc(devs, (ndevs + 1) * sizeof(*devs));
+		assert(devs);
+		devs[ndevs++] = st.st_dev;
+		/* the file itself might not be readable */
+		dir = strdup(tmp);
+		assert(dir);
+		fd = open(dirname(dir), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		free(dir);
+		if (fd == -1) {
+			rv = errno;
+			break;
+		}
+		xbps_counter_inc(XBPS_COUNTER_FSYNCS);
+		if (syncfs(fd) == -1)
+			rv = errno;
+#else
+		if ((fd = open(tmp, O_RDONLY|O_NOFOLLOW|O_CLOEXEC)) == -1) {
+			rv = errno;
+			break;
+		}
+		xbps_counter_inc(XBPS_COUNTER_FSYNCS);
+#ifdef HAVE_FDATASYNC
+		if (fdatasync(fd) == -1)
+#else
+		if (fsync(fd) == -1)
+#endif
+			rv = errno;
+#endif
+		(void)close(fd);
+		if (rv != 0)
+			break;
+	}
+	xbps_object_iterator_release(iter);
+#ifdef HAVE_SYNCFS
+	free(devs);
+#endif
+	return rv;
+}
+
+static int
+staged_rename(xbps_dictionary_t staged, bool unlink_only)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	const char *tmp, *file;
+	int rv = 0;
+
+	iter = xbps_dictionary_iterator(staged);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
+		tmp = xbps_dictionary_keysym_cstring_nocopy(obj);
+		if (unlink_only) {
+			(void)unlink(tmp);
+			continue;
+		}
+		file = xbps_string_cstring_nocopy(
+		    xbps_dictionary_get_keysym(staged, obj));
+		if (rename(tmp, file) == -1 && rv == 0)
+			rv = errno;
+	}
+	xbps_object_iterator_release(iter);
+	return rv;
+}
+
+/*
+ * With XBPS_FLAG_UNPACK_VERITY fs-verity is enabled on the regular files
+ * once they are in place, and their digest is recorded in the files.plist
+ * as "verity-sha256" so that xbps-pkgdb(1) doesn't need to read them.
+ * Verity files are read-only, mutable and preserved files are skipped.
+ * Failures are not fatal, the filesystem might not support it.
+ */
+static void
+unpack_verity(struct xbps_handle *xhp, const char *pkgver,
+		xbps_dictionary_t filesd, xbps_dictionary_t preserved)
+{
+	xbps_array_t array;
+	xbps_dictionary_t obj;
+	const char *file;
+	char *path, *digest;
+	int rv;
+
+	array = xbps_dictionary_get(filesd, "files");
+	for (unsigned int i = 0; i < xbps_array_count(array); i++) {
+		obj = xbps_array_get(array, i);
+		if (xbps_dictionary_get(obj, "mutable"))
+			continue;
+		xbps_dictionary_get_cstring_nocopy(obj, "file", &file);
+		if (match_preserved_file(preserved, file))
+			continue;
+		path = xbps_xasprintf("%s/%s", xhp->rootdir, file);
+		digest = xbps_file_verity_enable(path);
+		rv = errno;
+		free(path);
+		if (digest == NULL) {
+			xbps_dbg_printf(xhp, "%s: failed to enable fs-verity "
+			    "on %s: %s\n", pkgver, file, strerror(rv));
+			/* not supported by the filesystem */
+			if (rv == ENOTTY || rv == EOPNOTSUPP || rv == ENOTSUP)
+				break;
+			continue;
+		}
+		xbps_dictionary_set_cstring(obj, "verity-sha256", digest);
+		free(digest);
+	}
 }
 
 static int
@@ -71,28 +596,39 @@ unpack_archive(struct xbps_handle *xhp,
 	       xbps_dictionary_t pkg_repod,
 	       const char *pkgver,
 	       const char *fname,
-	       struct archive *ar)
+	       struct archive *ar,
+	       int pkg_fd,
+	       struct xbps_unpack_stats *us)
 {
 	xbps_dictionary_t binpkg_propsd, binpkg_filesd, pkg_filesd;
+	xbps_dictionary_t preserved = NULL, binobj, staged = NULL;
 	xbps_array_t array, obsoletes;
 	xbps_object_t obj;
 	xbps_data_t data;
 	const struct stat *entry_statp;
-	void *instbuf = NULL, *rembuf = NULL;
+	void *instbuf = NULL, *rembuf = NULL, *ubuf = NULL;
 	struct stat st;
 	struct xbps_unpack_cb_data xucd;
+	struct archive *ext = NULL;
 	struct archive_entry *entry;
-	size_t  instbufsiz = 0, rembufsiz = 0;
+	struct xbps_uring *uring = NULL;
+	struct files_table binfiles, instfiles;
+	struct file_ent *binent, *instent;
+	size_t  instbufsiz = 0, rembufsiz = 0, ulen = 0;
 	ssize_t entry_size;
+	uint64_t estart;
 	const char *file, *entry_pname, *transact, *binpkg_pkgver;
-	char *pkgname, *buf;
+	const char *sha256_new;
+	char *pkgname, *buf, *tmpfile, tarmagic[5], sha256[SHA256_DIGEST_LENGTH * 2 + 1];
 	int ar_rv, rv, error, entry_type, flags;
-	bool preserve, update, file_exists;
-	bool skip_extract, force, xucd_stats;
+	bool preserve, update, file_exists, hash, clone, obsoletes_check;
+	bool skip_extract, force, xucd_stats, installed = false;
 	uid_t euid;
 
 	binpkg_propsd = binpkg_filesd = pkg_filesd = NULL;
-	force = preserve = update = file_exists = false;
+	memset(&binfiles, 0, sizeof(binfiles));
+	memset(&instfiles, 0, sizeof(instfiles));
+	force = preserve = update = file_exists = obsoletes_check = false;
 	xucd_stats = false;
 	ar_rv = rv = error = entry_type = flags = 0;
 
@@ -206,9 +742,20 @@ unpack_archive(struct xbps_handle *xhp,
 	}
 
 	/*
-	 * Internalize current pkg metadata files plist.
+	 * Files of the binpkg and the ones currently installed, by path.
+	 * Only a copy of the paths and hashes of the installed package are
+	 * kept while unpacking, its files.plist is internalized again to
+	 * find obsolete files.
 	 */
-	pkg_filesd = xbps_pkgdb_get_pkg_files(xhp, pkgname);
+	files_table_init(&binfiles, binpkg_filesd, false);
+	if ((pkg_filesd = xbps_pkgdb_get_pkg_files(xhp, pkgname)) != NULL) {
+		files_table_init(&instfiles, pkg_filesd, true);
+		installed = true;
+		obsoletes_check = xbps_dictionary_count(pkg_filesd) > 0;
+		xbps_object_release(pkg_filesd);
+		pkg_filesd = NULL;
+	}
+	preserved = preserved_files_set(xhp);
 
 	/* Add pkg install/remove scripts data objects into our dictionary */
 	if (instbuf != NULL) {
@@ -238,6 +785,31 @@ unpack_archive(struct xbps_handle *xhp,
 	/*
 	 * Unpack all files on archive now.
 	 */
+	pthread_mutex_lock(&ext_mtx);
+	ext = archive_write_disk_new();
+	pthread_mutex_unlock(&ext_mtx);
+	assert(ext);
+	archive_write_disk_set_options(ext, flags);
+	archive_write_disk_set_standard_lookup(ext);
+
+	if (xhp->flags & XBPS_FLAG_UNPACK_SYNC) {
+		staged = xbps_dictionary_create();
+		assert(staged);
+	}
+	/*
+	 * The data of uncompressed packages is copied straight from the
+	 * package file, regular files are cloned on filesystems with
+	 * reflinks. The package might be decompressed before libarchive
+	 * reads it, the file itself must be a tar archive.
+	 */
+	clone = pkg_fd != -1 && archive_filter_count(ar) == 1 &&
+	    archive_filter_code(ar, 0) == ARCHIVE_FILTER_NONE &&
+	    (archive_format(ar) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_TAR &&
+	    pread(pkg_fd, tarmagic, sizeof(tarmagic), 257) == sizeof(tarmagic) &&
+	    memcmp(tarmagic, "ustar", sizeof(tarmagic)) == 0;
+	if (xhp->flags & XBPS_FLAG_UNPACK_IO_URING)
+		uring = xbps_uring_new(xhp);
+
 	for (;;) {
 		ar_rv = archive_read_next_header(ar, &entry);
 		if (ar_rv == ARCHIVE_EOF || ar_rv == ARCHIVE_FATAL)
@@ -249,6 +821,8 @@ unpack_archive(struct xbps_handle *xhp,
 		entry_size = archive_entry_size(entry);
 		entry_type = archive_entry_filetype(entry);
 		entry_statp = archive_entry_stat(entry);
+		binobj = NULL;
+		binent = NULL;
 		/*
 		 * Ignore directories from archive.
 		 */
@@ -265,6 +839,7 @@ unpack_archive(struct xbps_handle *xhp,
 			xucd.entry = entry_pname;
 			xucd.entry_size = entry_size;
 			xucd.entry_is_conf = false;
+			xucd.entry_sha256 = NULL;
 			/*
 			 * Compute total entries in progress data, if set.
 			 * total_entries = files + conf_files + links.
@@ -294,7 +869,7 @@ unpack_archive(struct xbps_handle *xhp,
 		 * Check if the file to be extracted must be preserved, if true,
 		 * pass to the next file.
 		 */
-		if (file_exists && match_preserved_file(xhp, entry_pname)) {
+		if (file_exists && match_preserved_file(preserved, entry_pname)) {
 			archive_read_data_skip(ar);
 			xbps_dbg_printf(xhp, "[unpack] `%s' exists on disk "
 			    "and must be preserved, skipping.\n", entry_pname);
@@ -311,9 +886,13 @@ unpack_archive(struct xbps_handle *xhp,
 		    ((entry_statp->st_mode & S_IFMT) != (st.st_mode & S_IFMT)))
 			(void)remove(entry_pname);
 
-		if (!force && (entry_type == AE_IFREG)) {
+		if (entry_type == AE_IFREG) {
 			buf = strchr(entry_pname, '.') + 1;
 			assert(buf != NULL);
+			if ((binent = files_table_get(&binfiles, buf)) != NULL)
+				binobj = binent->obj;
+		}
+		if (!force && (entry_type == AE_IFREG)) {
 			if (file_exists && S_ISREG(st.st_mode)) {
 				/*
 				 * Handle configuration files. Check if current
@@ -322,13 +901,17 @@ unpack_archive(struct xbps_handle *xhp,
 				 * "conf_files" array on its XBPS_PKGPROPS
 				 * dictionary.
 				 */
-				if (xbps_entry_is_a_conf_file(binpkg_filesd, buf)) {
+				if (binent != NULL && binent->conf) {
 					if (xhp->unpack_cb != NULL)
 						xucd.entry_is_conf = true;
 
+					instent = files_table_get(&instfiles, buf);
 					rv = xbps_entry_install_conf_file(xhp,
-					    binpkg_filesd, pkg_filesd, entry,
-					    entry_pname, pkgver);
+					    binent->sha256,
+					    instent && instent->conf ?
+					    instent->sha256 : NULL,
+					    installed, entry, entry_pname,
+					    pkgver);
 					if (rv == -1) {
 						/* error */
 						goto out;
@@ -340,8 +923,32 @@ unpack_archive(struct xbps_handle *xhp,
 					}
 					rv = 0;
 				} else {
-					rv = xbps_file_hash_check_dictionary(
-					    xhp, binpkg_filesd, "files", buf);
+					/*
+					 * If the installed file wasn't modified
+					 * since it was unpacked, its hash is the
+					 * one stored in its files.plist.
+					 * Otherwise it's only hashed if its size
+					 * matches the new file.
+					 */
+					instent = files_table_get(&instfiles, buf);
+					sha256_new = binent ? binent->sha256 : NULL;
+					if (sha256_new == NULL) {
+						rv = 1;
+					} else if (instent && instent->sha256 &&
+					    instent->mtime == (uint64_t)st.st_mtime) {
+						rv = strcmp(sha256_new, instent->sha256) ? 1 : 0;
+					} else if (st.st_size != entry_size) {
+						rv = 1;
+					} else {
+						rv = xbps_file_hash_check(entry_pname,
+						    sha256_new);
+						if (rv == ERANGE || rv == ENOENT)
+							rv = 1;
+						else if (rv != 0) {
+							errno = rv;
+							rv = -1;
+						}
+					}
 					if (rv == -1) {
 						/* error */
 						xbps_dbg_printf(xhp,
@@ -414,7 +1021,8 @@ unpack_archive(struct xbps_handle *xhp,
 		 * in binpkg and apply mtime if true.
 		 */
 		if (!force && file_exists && skip_extract &&
-		    (archive_entry_mtime_nsec(entry) != st.st_mtime)) {
+		    ((archive_entry_mtime(entry) != st.st_mtime) ||
+		    (archive_entry_mtime_nsec(entry) != st.st_mtim.tv_nsec))) {
 			struct timespec ts[2];
 
 			ts[0].tv_sec = archive_entry_atime(entry);
@@ -446,23 +1054,84 @@ unpack_archive(struct xbps_handle *xhp,
 		 */
 		entry_pname = archive_entry_pathname(entry);
 		/*
-		 * Extract entry from archive.
+		 * Extract entry from archive, regular files are hashed
+		 * while they are written.
 		 */
-		if (archive_read_extract(ar, entry, flags) != 0) {
-			error = archive_errno(ar);
+		hash = entry_type == AE_IFREG && !archive_entry_hardlink(entry);
+		if (staged != NULL && hash &&
+		    !(file_exists && S_ISDIR(st.st_mode))) {
+			/* directories are replaced in place, as they must be empty */
+			tmpfile = staged_path(entry_pname);
+			xbps_dictionary_set_cstring(staged, tmpfile, entry_pname);
+			xbps_dictionary_get_cstring_nocopy(staged, tmpfile,
+			    &entry_pname);
+			archive_entry_set_pathname(entry, tmpfile);
+			free(tmpfile);
+		} else if (staged != NULL && archive_entry_hardlink(entry)) {
+			/* hardlinks to a staged file link to its temporary path */
+			tmpfile = staged_path(archive_entry_hardlink(entry));
+			if (xbps_dictionary_get(staged, tmpfile) != NULL)
+				archive_entry_set_hardlink(entry, tmpfile);
+			free(tmpfile);
+		}
+		/* the target of a hardlink must be written first */
+		if (uring != NULL && archive_entry_hardlink(entry) != NULL &&
+		    (error = xbps_uring_flush(uring, ext)) != 0)
+			break;
+		/*
+		 * The package was verified, cloned files have the hash of
+		 * its files.plist.
+		 */
+		estart = xbps_trace_begin();
+		sha256_new = NULL;
+		if (clone && hash && entry_size > 0 &&
+		    archive_entry_sparse_count(entry) == 0 &&
+		    (euid == 0 || (archive_entry_perm(entry) & S_IWUSR)) &&
+		    xbps_dictionary_get_cstring_nocopy(binobj, "sha256", &sha256_new) &&
+		    strlen(sha256_new) == sizeof(sha256) - 1) {
+			memcpy(sha256, sha256_new, sizeof(sha256));
+			error = clone_entry(ar, ext, entry, pkg_fd);
+		} else if (uring != NULL && hash && !file_exists &&
+		    xbps_uring_can_write(uring, entry, euid)) {
+			if ((error = read_entry(ar, entry, &ubuf, &ulen, sha256)) == 0)
+				error = xbps_uring_add(uring, ext, entry, ubuf, ulen);
+		} else {
+			error = extract_entry(ar, ext, entry,
+			    hash ? sha256 : NULL);
+		}
+		if (error != 0) {
 			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
 			    error, pkgver,
 			    "%s: [unpack] failed to extract file `%s': %s",
 			    pkgver, entry_pname, strerror(error));
 			break;
-		} else {
-			if (xhp->unpack_cb != NULL) {
-				xucd.entry = entry_pname;
-				xucd.entry_extract_count++;
-				(*xhp->unpack_cb)(&xucd, xhp->unpack_cb_data);
-			}
+		}
+		xbps_trace_end(estart, "unpack", "entry", entry_pname);
+		us->files++;
+		xbps_counter_inc(XBPS_COUNTER_UNPACK_FILES);
+		if (entry_size > 0)
+			us->bytes += (uint64_t)entry_size;
+		/*
+		 * Record the hash of the data that was actually unpacked.
+		 */
+		sha256_new = NULL;
+		if (hash && binobj &&
+		    xbps_dictionary_get_cstring_nocopy(binobj, "sha256", &sha256_new) &&
+		    strcmp(sha256_new, sha256)) {
+			xbps_dbg_printf(xhp, "%s: %s: SHA256 mismatch "
+			    "files.plist: %s unpacked: %s\n", pkgver,
+			    entry_pname, sha256_new, sha256);
+			xbps_dictionary_set_cstring(binobj, "sha256", sha256);
+		}
+		if (xhp->unpack_cb != NULL) {
+			xucd.entry = entry_pname;
+			xucd.entry_sha256 = hash ? sha256 : NULL;
+			xucd.entry_extract_count++;
+			xbps_set_cb_unpack(xhp, &xucd);
 		}
 	}
+	if (uring != NULL && !error && ar_rv != ARCHIVE_FATAL)
+		error = xbps_uring_flush(uring, ext);
 	/*
 	 * If there was any error extracting files from archive, error out.
 	 */
@@ -475,14 +1144,44 @@ unpack_archive(struct xbps_handle *xhp,
 		    pkgver, strerror(rv));
 		goto out;
 	}
+	/*
+	 * Flush staged files to disk and rename them into place.
+	 */
+	if (staged != NULL && xbps_dictionary_count(staged)) {
+		if ((rv = staged_sync(staged)) != 0) {
+			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
+			    "%s: [unpack] failed to sync files: %s",
+			    pkgver, strerror(rv));
+			goto out;
+		}
+		if ((rv = staged_rename(staged, false)) != 0) {
+			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
+			    "%s: [unpack] failed to rename files into place: %s",
+			    pkgver, strerror(rv));
+			goto out;
+		}
+	}
+	if (xhp->flags & XBPS_FLAG_UNPACK_VERITY)
+		unpack_verity(xhp, pkgver, binpkg_filesd, preserved);
+	/*
+	 * Internalize the installed files.plist again before it's replaced.
+	 */
+	if (obsoletes_check && !preserve)
+		pkg_filesd = xbps_pkgdb_get_pkg_files(xhp, pkgname);
 	/*
 	 * Externalize binpkg files.plist to disk, if not empty.
 	 */
 	if (xbps_dictionary_count(binpkg_filesd)) {
 		mode_t prev_umask;
+		bool ok;
+
 		prev_umask = umask(022);
 		buf = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, pkgname);
-		if (!xbps_dictionary_externalize_to_file(binpkg_filesd, buf)) {
+		if (xhp->flags & XBPS_FLAG_BINARY_PLISTS)
+			ok = xbps_dictionary_externalize_binary_to_file(binpkg_filesd, buf);
+		else
+			ok = xbps_dictionary_externalize_to_file(binpkg_filesd, buf);
+		if (!ok) {
 			rv = errno;
 			umask(prev_umask);
 			free(buf);
@@ -528,7 +1227,6 @@ unpack_archive(struct xbps_handle *xhp,
 		xbps_object_release(obj);
 	}
 	/* XXX: cant free obsoletes here, need to copy values before */
-	xbps_object_release(pkg_filesd);
 out:
 	/*
 	 * If unpacked pkg has no files, remove its files metadata plist.
@@ -542,6 +1240,21 @@ out:
 		xbps_object_release(binpkg_propsd);
 	if (xbps_object_type(binpkg_filesd) == XBPS_TYPE_DICTIONARY)
 		xbps_object_release(binpkg_filesd);
+	xbps_uring_free(uring);
+	if (staged != NULL) {
+		/* remove what's left of a failed unpack */
+		if (rv != 0)
+			(void)staged_rename(staged, true);
+		xbps_object_release(staged);
+	}
+	if (pkg_filesd != NULL)
+		xbps_object_release(pkg_filesd);
+	if (preserved != NULL)
+		xbps_object_release(preserved);
+	files_table_free(&binfiles);
+	files_table_free(&instfiles);
+	if (ext != NULL)
+		archive_write_finish(ext);
 	if (pkgname != NULL)
 		free(pkgname);
 	if (instbuf != NULL)
@@ -552,44 +1265,28 @@ out:
 	return rv;
 }
 
-int HIDDEN
-xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
+static struct archive *
+open_binpkg(struct xbps_handle *xhp, const char *pkgver, const char *bpkg,
+		int *pkg_fdp, int *rvp)
 {
-	struct archive *ar = NULL;
+	struct archive *ar;
 	struct stat st;
-	const char *pkgver;
-	char *bpkg = NULL;
-	int pkg_fd = -1, rv = 0;
-	mode_t myumask;
-
-	assert(xbps_object_type(pkg_repod) == XBPS_TYPE_DICTIONARY);
-
-	xbps_dictionary_get_cstring_nocopy(pkg_repod, "pkgver", &pkgver);
-	xbps_set_cb_state(xhp, XBPS_STATE_UNPACK, 0, pkgver, NULL);
-
-	bpkg = xbps_repository_pkg_path(xhp, pkg_repod);
-	if (bpkg == NULL) {
-		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
-		    errno, pkgver,
-		    "%s: [unpack] cannot determine binary package "
-		    "file for `%s': %s", pkgver, bpkg, strerror(errno));
-		return errno;
-	}
+	int pkg_fd, rv = 0;
 
 	if ((ar = archive_read_new()) == NULL) {
-		free(bpkg);
-		return ENOMEM;
+		*rvp = ENOMEM;
+		return NULL;
 	}
 	/*
-	 * Enable support for tar format and gzip/bzip2/lzma compression methods.
+	 * Enable support for tar format and gzip/bzip2/lzma/zstd compression
+	 * methods.
 	 */
 	archive_read_support_compression_gzip(ar);
 	archive_read_support_compression_bzip2(ar);
 	archive_read_support_compression_xz(ar);
+	archive_read_support_filter_zstd(ar);
 	archive_read_support_format_tar(ar);
 
-	myumask = umask(022);
-
 	pkg_fd = open(bpkg, O_RDONLY|O_CLOEXEC);
 	if (pkg_fd == -1) {
 		rv = errno;
@@ -607,7 +1304,7 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		    pkgver, bpkg, strerror(rv));
 		goto out;
 	}
-	if (archive_read_open_fd(ar, pkg_fd, st.st_blksize) == ARCHIVE_FATAL) {
+	if (xbps_archive_read_open_fd(ar, pkg_fd, st.st_blksize) == ARCHIVE_FATAL) {
 		rv = archive_errno(ar);
 		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
 		    rv, pkgver,
@@ -615,6 +1312,49 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		    pkgver, bpkg, strerror(rv));
 		goto out;
 	}
+out:
+	if (rv != 0) {
+		if (pkg_fd != -1)
+			close(pkg_fd);
+		archive_read_finish(ar);
+		*rvp = rv;
+		return NULL;
+	}
+	*pkg_fdp = pkg_fd;
+	return ar;
+}
+
+/*
+ * Unpacks the binary package and sets its state to unpacked, the umask
+ * must have been set to 022 by the caller.
+ */
+static int
+unpack_binpkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
+{
+	struct xbps_unpack_stats us;
+	struct archive *ar = NULL;
+	const char *pkgver;
+	char *bpkg = NULL;
+	uint64_t start, tstart;
+	int pkg_fd = -1, rv = 0;
+
+	memset(&us, 0, sizeof(us));
+	start = xbps_monotime();
+	tstart = xbps_trace_begin();
+	xbps_dictionary_get_cstring_nocopy(pkg_repod, "pkgver", &pkgver);
+	xbps_set_cb_state(xhp, XBPS_STATE_UNPACK, 0, pkgver, NULL);
+
+	bpkg = xbps_repository_pkg_path(xhp, pkg_repod);
+	if (bpkg == NULL) {
+		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
+		    errno, pkgver,
+		    "%s: [unpack] cannot determine binary package "
+		    "file for `%s': %s", pkgver, bpkg, strerror(errno));
+		return errno;
+	}
+
+	if ((ar = open_binpkg(xhp, pkgver, bpkg, &pkg_fd, &rv)) == NULL)
+		goto out;
 	/*
 	 * Externalize pkg files dictionary to metadir.
 	 */
@@ -623,15 +1363,17 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		if (rv != ENOENT)
 			goto out;
 
-		if (xbps_mkpath(xhp->metadir, 0755) == -1) {
+		if (xbps_mkpath(xhp->metadir, 0755) == -1 && errno != EEXIST) {
 			rv = errno;
 			goto out;
 		}
+		rv = 0;
 	}
 	/*
 	 * Extract archive files.
 	 */
-	if ((rv = unpack_archive(xhp, pkg_repod, pkgver, bpkg, ar)) != 0) {
+	if ((rv = unpack_archive(xhp, pkg_repod, pkgver, bpkg, ar, pkg_fd,
+	    &us)) != 0) {
 		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL, rv, pkgver,
 		    "%s: [unpack] failed to unpack files from archive: %s",
 		    pkgver, strerror(rv));
@@ -646,25 +1388,182 @@ xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 		    rv, pkgver,
 		    "%s: [unpack] failed to set state to unpacked: %s",
 		    pkgver, strerror(rv));
+		goto out;
 	}
-	/* register alternatives */
-	if ((rv = xbps_alternatives_register(xhp, pkg_repod)) != 0) {
-		xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
-		    rv, pkgver,
-		    "%s: [unpack] failed to register alternatives: %s",
-		    pkgver, strerror(rv));
-	}
+	us.time = xbps_monotime() - start;
+	xbps_set_cb_unpack_done(xhp, pkgver, &us);
 
 out:
-	if (pkg_fd != -1)
+	if (pkg_fd != -1) {
+		if (xhp->flags & XBPS_FLAG_LOW_CACHE)
+			(void)posix_fadvise(pkg_fd, 0, 0, POSIX_FADV_DONTNEED);
 		close(pkg_fd);
+	}
 	if (ar)
 		archive_read_finish(ar);
 	if (bpkg)
 		free(bpkg);
+	xbps_trace_end(tstart, "unpack", "package", pkgver);
+
+	return rv;
+}
 
+int HIDDEN
+xbps_unpack_binary_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
+{
+	const char *pkgver;
+	int rv;
+	mode_t myumask;
+
+	assert(xbps_object_type(pkg_repod) == XBPS_TYPE_DICTIONARY);
+
+	myumask = umask(022);
+	if ((rv = unpack_binpkg(xhp, pkg_repod)) == 0) {
+		/* register alternatives */
+		if ((rv = xbps_alternatives_register(xhp, pkg_repod)) != 0) {
+			xbps_dictionary_get_cstring_nocopy(pkg_repod,
+			    "pkgver", &pkgver);
+			xbps_set_cb_state(xhp, XBPS_STATE_UNPACK_FAIL,
+			    rv, pkgver,
+			    "%s: [unpack] failed to register alternatives: %s",
+			    pkgver, strerror(rv));
+		}
+	}
 	/* restore */
 	umask(myumask);
 
 	return rv;
 }
+
+/*
+ * Returns the files.plist dictionary of the binary package, and sets
+ * \a install_script if it has an INSTALL script; the metadata files are
+ * at the start of the archive, nothing else is read.
+ */
+xbps_dictionary_t HIDDEN
+xbps_binpkg_get_files(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod,
+		bool *install_script)
+{
+	xbps_dictionary_t filesd = NULL;
+	struct archive *ar;
+	struct archive_entry *entry;
+	const char *pkgver, *entry_pname;
+	char *bpkg;
+	int pkg_fd = -1, rv = 0;
+
+	*install_script = false;
+	xbps_dictionary_get_cstring_nocopy(pkg_repod, "pkgver", &pkgver);
+	if ((bpkg = xbps_repository_pkg_path(xhp, pkg_repod)) == NULL)
+		return NULL;
+	if ((ar = open_binpkg(xhp, pkgver, bpkg, &pkg_fd, &rv)) == NULL) {
+		free(bpkg);
+		return NULL;
+	}
+	for (uint8_t i = 0; i < 4; i++) {
+		if (archive_read_next_header(ar, &entry) != ARCHIVE_OK)
+			break;
+		entry_pname = archive_entry_pathname(entry);
+		if (strcmp("./INSTALL", entry_pname) == 0) {
+			*install_script = true;
+		} else if (strcmp("./files.plist", entry_pname) == 0) {
+			filesd = xbps_archive_get_dictionary(ar, entry);
+			break;
+		}
+		archive_read_data_skip(ar);
+	}
+	close(pkg_fd);
+	archive_read_finish(ar);
+	free(bpkg);
+
+	return filesd;
+}
+
+/*
+ * Binary packages unpacked concurrently by xbps_unpack_binary_pkgs(),
+ * every thread picks up the next package in transaction order.
+ */
+struct unpack_data {
+	struct xbps_handle *xhp;
+	xbps_array_t pkgs;
+	int *rv;
+	unsigned int next;
+	bool failed;
+	pthread_mutex_t mtx;
+};
+
+static void *
+unpack_thread(void *arg)
+{
+	struct unpack_data *ud = arg;
+	xbps_dictionary_t obj;
+	const char *pkgver;
+	unsigned int i;
+	int rv;
+
+	for (;;) {
+		pthread_mutex_lock(&ud->mtx);
+		/* stop picking up packages after the first error */
+		if (ud->failed || ud->next >= xbps_array_count(ud->pkgs)) {
+			pthread_mutex_unlock(&ud->mtx);
+			break;
+		}
+		i = ud->next++;
+		pthread_mutex_unlock(&ud->mtx);
+
+		obj = xbps_array_get(ud->pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		xbps_set_cb_state(ud->xhp, XBPS_STATE_INSTALL, 0, pkgver, NULL);
+		rv = unpack_binpkg(ud->xhp, obj);
+
+		pthread_mutex_lock(&ud->mtx);
+		ud->rv[i] = rv;
+		if (rv != 0)
+			ud->failed = true;
+		pthread_mutex_unlock(&ud->mtx);
+	}
+	return NULL;
+}
+
+/*
+ * Unpacks the packages in \a pkgs with up to \a njobs threads, they
+ * must be new packages that don't share any file, without INSTALL scripts
+ * nor alternatives. Returns the error of the first failed package in
+ * order, and sets \a nunpacked to the number of packages unpacked before
+ * it; the other packages may have been unpacked too.
+ */
+int HIDDEN
+xbps_unpack_binary_pkgs(struct xbps_handle *xhp, xbps_array_t pkgs,
+		unsigned int njobs, unsigned int *nunpacked)
+{
+	struct unpack_data ud;
+	unsigned int i, npkgs;
+	int rv = 0;
+	mode_t myumask;
+
+	memset(&ud, 0, sizeof(ud));
+	ud.xhp = xhp;
+	ud.pkgs = pkgs;
+	npkgs = xbps_array_count(pkgs);
+	ud.rv = calloc(npkgs, sizeof(*ud.rv));
+	assert(ud.rv);
+	pthread_mutex_init(&ud.mtx, NULL);
+
+	myumask = umask(022);
+	if (njobs > npkgs)
+		njobs = npkgs;
+	xbps_pool_run(xhp, unpack_thread, &ud, njobs);
+	umask(myumask);
+
+	for (i = 0; i < ud.next; i++) {
+		if ((rv = ud.rv[i]) != 0)
+			break;
+	}
+	*nunpacked = i;
+	if (rv == 0 && i < npkgs)
+		rv = ECANCELED;
+
+	pthread_mutex_destroy(&ud.mtx);
+	free(ud.rv);
+
+	return rv;
+}
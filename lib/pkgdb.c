@@ -31,6 +31,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
@@ -57,7 +58,20 @@
  * data type is specified on its edge, i.e array, bool, integer, string,
  * dictionary.
  */
-static int pkgdb_fd;
+static int pkgdb_fd = -1;
+
+static void revdeps_store(struct xbps_handle *);
+static void pkgfiles_release(void);
+
+static bool
+pkgdb_externalize(struct xbps_handle *xhp)
+{
+	if (xhp->flags & XBPS_FLAG_BINARY_PLISTS)
+		return xbps_dictionary_externalize_binary_to_file(xhp->pkgdb,
+		    xhp->pkgdb_plist);
+
+	return xbps_dictionary_externalize_to_file(xhp->pkgdb, xhp->pkgdb_plist);
+}
 
 int
 xbps_pkgdb_lock(struct xbps_handle *xhp)
@@ -83,13 +97,14 @@ xbps_pkgdb_lock(struct xbps_handle *xhp)
 			}
 		}
 		/* if pkgdb is unexistent, create it with an empty dictionary */
-		xhp->pkgdb = xbps_dictionary_create();
-		if (!xbps_dictionary_externalize_to_file(xhp->pkgdb, xhp->pkgdb_plist)) {
+		xhp->pkgdb = xbps_dictionary_create_hashed(0);
+		if (!pkgdb_externalize(xhp)) {
 			rv = errno;
 			xbps_dbg_printf(xhp, "[pkgdb] failed to create pkgdb "
 			    "%s: %s\n", xhp->pkgdb_plist, strerror(rv));
 			return rv;
 		}
+		xbps_object_clear_modified(xhp->pkgdb);
 	}
 
 	prev_umask = umask(022);
@@ -108,12 +123,14 @@ xbps_pkgdb_lock(struct xbps_handle *xhp)
 		xbps_dbg_printf(xhp, "[pkgdb] cannot lock pkgdb: %s\n", strerror(rv));
 		return rv;
 	}
-	return 0;
+	return xbps_pkgdb_journal_open(xhp);
 }
 
 void
 xbps_pkgdb_unlock(struct xbps_handle *xhp)
 {
+	xbps_pkgdb_journal_close(xhp);
+
 	if (pkgdb_fd != -1) {
 		if (lockf(pkgdb_fd, F_ULOCK, 0) == -1)
 			xbps_dbg_printf(xhp, "[pkgdb] failed to unlock pkgdb: %s\n", strerror(errno));
@@ -134,7 +151,7 @@ pkgdb_map_vpkgs(struct xbps_handle *xhp)
 		return 0;
 
 	if (xhp->vpkgd == NULL) {
-		xhp->vpkgd = xbps_dictionary_create();
+		xhp->vpkgd = xbps_dictionary_create_hashed(0);
 		assert(xhp->vpkgd);
 	}
 	/*
@@ -215,7 +232,6 @@ xbps_pkgdb_init(struct xbps_handle *xhp)
 int
 xbps_pkgdb_update(struct xbps_handle *xhp, bool flush, bool update)
 {
-	xbps_dictionary_t pkgdb_storage;
 	mode_t prev_umask;
 	static int cached_rv;
 	int rv = 0;
@@ -224,39 +240,52 @@ xbps_pkgdb_update(struct xbps_handle *xhp, bool flush, bool update)
 		return cached_rv;
 
 	if (xhp->pkgdb && update) {
-		pkgdb_storage = xbps_dictionary_internalize_from_file(xhp->pkgdb_plist);
-		if (pkgdb_storage == NULL ||
-		    !xbps_dictionary_equals(xhp->pkgdb, pkgdb_storage)) {
-			/* flush dictionary to storage */
+		/*
+		 * Flush dictionary to storage if it was modified since
+		 * it was read or last written; the copy in memory is
+		 * the same as the one in storage after that.
+		 */
+		if (xbps_object_modified(xhp->pkgdb)) {
 			prev_umask = umask(022);
-			if (!xbps_dictionary_externalize_to_file(xhp->pkgdb, xhp->pkgdb_plist)) {
+			if (!pkgdb_externalize(xhp)) {
 				umask(prev_umask);
 				return errno;
 			}
 			umask(prev_umask);
+			xbps_object_clear_modified(xhp->pkgdb);
+			xbps_dbg_printf(xhp, "[pkgdb] flushed to storage.\n");
 		}
-		if (pkgdb_storage)
-			xbps_object_release(pkgdb_storage);
-
-		xbps_object_release(xhp->pkgdb);
-		xhp->pkgdb = NULL;
 		cached_rv = 0;
+		revdeps_store(xhp);
+		if (pkgdb_fd != -1)
+			xbps_pkgdb_files_store(xhp);
+		/* journaled changes are in storage now */
+		return xbps_pkgdb_journal_reset(xhp);
 	}
 	if (!update)
 		return rv;
 
 	/* update copy in memory */
-	if ((xhp->pkgdb = xbps_dictionary_internalize_from_file(xhp->pkgdb_plist)) == NULL) {
+	xbps_pkgdb_hash_release(xhp);
+	xbps_object_arena_begin();
+	xhp->pkgdb = xbps_dictionary_internalize_from_file(xhp->pkgdb_plist);
+	xbps_object_arena_end();
+	if (xhp->pkgdb == NULL) {
 		rv = errno;
 		if (!rv)
 			rv = EINVAL;
 
 		if (rv == ENOENT)
-			xhp->pkgdb = xbps_dictionary_create();
+			xhp->pkgdb = xbps_dictionary_create_hashed(0);
 		else
 			xbps_error_printf("cannot access to pkgdb: %s\n", strerror(rv));
 
 		cached_rv = rv = errno;
+	} else {
+		xbps_dictionary_make_hashed(xhp->pkgdb);
+		xbps_object_clear_modified(xhp->pkgdb);
+		/* changes that were not flushed by the last writer */
+		(void)xbps_pkgdb_journal_replay(xhp);
 	}
 
 	return rv;
@@ -272,6 +301,13 @@ xbps_pkgdb_release(struct xbps_handle *xhp)
 
 	xbps_pkgdb_unlock(xhp);
 	xbps_object_release(xhp->pkgdb);
+	if (xhp->pkgdb_shlibs) {
+		xbps_object_release(xhp->pkgdb_shlibs);
+		xhp->pkgdb_shlibs = NULL;
+	}
+	xbps_fulldeptree_release(xhp, false);
+	xbps_pkgdb_hash_release(xhp);
+	pkgfiles_release();
 	xbps_dbg_printf(xhp, "[pkgdb] released ok.\n");
 }
 
@@ -306,11 +342,31 @@ xbps_pkgdb_foreach_cb_multi(struct xbps_handle *xhp,
 
 	allkeys = xbps_dictionary_all_keys(xhp->pkgdb);
 	assert(allkeys);
+	/* the threads only read it, let them skip its lock */
+	xbps_array_make_immutable(allkeys);
 	rv = xbps_array_foreach_cb_multi(xhp, allkeys, xhp->pkgdb, fn, arg);
 	xbps_object_release(allkeys);
 	return rv;
 }
 
+int
+xbps_pkgdb_foreach_reduce(struct xbps_handle *xhp,
+		const struct xbps_reduce *ops)
+{
+	xbps_array_t allkeys;
+	int rv;
+
+	if ((rv = xbps_pkgdb_init(xhp)) != 0)
+		return rv;
+
+	allkeys = xbps_dictionary_all_keys(xhp->pkgdb);
+	assert(allkeys);
+	xbps_array_make_immutable(allkeys);
+	rv = xbps_array_foreach_reduce(xhp, allkeys, xhp->pkgdb, ops);
+	xbps_object_release(allkeys);
+	return rv;
+}
+
 xbps_dictionary_t
 xbps_pkgdb_get_pkg(struct xbps_handle *xhp, const char *pkg)
 {
@@ -329,62 +385,305 @@ xbps_pkgdb_get_virtualpkg(struct xbps_handle *xhp, const char *vpkg)
 	return xbps_find_virtualpkg_in_dict(xhp, xhp->pkgdb, vpkg);
 }
 
+/*
+ * The reverse dependencies of installed packages are stored in
+ * XBPS_PKGDB_REVDEPS, along with the pkgver of every package and the
+ * virtual packages they were computed from; it's only used if those
+ * still match pkgdb. Once loaded the index is kept up to date by
+ * xbps_register_pkg() and xbps_remove_pkg(), and stored again by the
+ * pkgdb writer when pkgdb is flushed; not once the virtual packages
+ * changed (xhp->pkgdb_revdeps_stale), until it's generated again.
+ */
+static const char *
+revdeps_pkgname(struct xbps_handle *xhp, xbps_dictionary_t vpkgs,
+		const char *pkgdep, char *buf, char **curpkgname)
+{
+	const char *pkgname, *vpkgname = NULL;
+
+	pkgname = xbps_pkgname_get(buf, XBPS_NAME_SIZE, pkgdep, curpkgname);
+	assert(pkgname);
+	if (vpkgs)
+		xbps_dictionary_get_cstring_nocopy(vpkgs, pkgname, &vpkgname);
+	else
+		vpkgname = vpkg_user_conf(xhp, pkgname, false);
+
+	return vpkgname ? vpkgname : pkgname;
+}
+
 static void
-generate_full_revdeps_tree(struct xbps_handle *xhp)
+revdeps_add(struct xbps_handle *xhp, xbps_dictionary_t vpkgs,
+		xbps_dictionary_t pkgd)
 {
-	xbps_object_t obj;
-	xbps_object_iterator_t iter;
+	xbps_array_t rundeps;
+	const char *pkgver;
 
-	if (xhp->pkgdb_revdeps)
+	rundeps = xbps_dictionary_get(pkgd, "run_depends");
+	if (!xbps_array_count(rundeps))
 		return;
 
-	xhp->pkgdb_revdeps = xbps_dictionary_create();
-	assert(xhp->pkgdb_revdeps);
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	for (unsigned int i = 0; i < xbps_array_count(rundeps); i++) {
+		xbps_array_t pkg;
+		const char *pkgdep, *vpkgname;
+		char buf[XBPS_NAME_SIZE], *curpkgname;
+		bool alloc = false;
+
+		xbps_array_get_cstring_nocopy(rundeps, i, &pkgdep);
+		vpkgname = revdeps_pkgname(xhp, vpkgs, pkgdep, buf, &curpkgname);
+
+		pkg = xbps_dictionary_get(xhp->pkgdb_revdeps, vpkgname);
+		if (pkg == NULL) {
+			alloc = true;
+			pkg = xbps_array_create();
+		}
+		if (!xbps_match_string_in_array(pkg, pkgver)) {
+			xbps_array_add_cstring(pkg, pkgver);
+			xbps_dictionary_set(xhp->pkgdb_revdeps, vpkgname, pkg);
+		}
+		free(curpkgname);
+		if (alloc)
+			xbps_object_release(pkg);
+	}
+}
 
+static void
+revdeps_del(struct xbps_handle *xhp, xbps_dictionary_t pkgd)
+{
+	xbps_array_t rundeps;
+	const char *pkgver;
+
+	rundeps = xbps_dictionary_get(pkgd, "run_depends");
+	if (!xbps_array_count(rundeps))
+		return;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	for (unsigned int i = 0; i < xbps_array_count(rundeps); i++) {
+		xbps_array_t pkg;
+		const char *pkgdep, *vpkgname;
+		char buf[XBPS_NAME_SIZE], *curpkgname;
+
+		xbps_array_get_cstring_nocopy(rundeps, i, &pkgdep);
+		vpkgname = revdeps_pkgname(xhp, NULL, pkgdep, buf, &curpkgname);
+		pkg = xbps_dictionary_get(xhp->pkgdb_revdeps, vpkgname);
+		if (pkg) {
+			xbps_remove_string_from_array(pkg, pkgver);
+			if (xbps_array_count(pkg) == 0)
+				xbps_dictionary_remove(xhp->pkgdb_revdeps, vpkgname);
+		}
+		free(curpkgname);
+	}
+}
+
+/*
+ * Returns a dictionary with the pkgver of every package in pkgdb.
+ */
+static xbps_dictionary_t
+revdeps_pkgvers(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t pkgvers;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	pkgvers = xbps_dictionary_create_hashed(xbps_dictionary_count(xhp->pkgdb));
+	assert(pkgvers);
 	iter = xbps_dictionary_iterator(xhp->pkgdb);
 	assert(iter);
-
 	while ((obj = xbps_object_iterator_next(iter))) {
-		xbps_array_t rundeps;
-		xbps_dictionary_t pkgd;
 		const char *pkgver;
 
-		pkgd = xbps_dictionary_get_keysym(xhp->pkgdb, obj);
-		rundeps = xbps_dictionary_get(pkgd, "run_depends");
-		if (!xbps_array_count(rundeps))
+		if (xbps_dictionary_get_cstring_nocopy(
+		    xbps_dictionary_get_keysym(xhp->pkgdb, obj), "pkgver", &pkgver))
+			xbps_dictionary_set_cstring_nocopy(pkgvers,
+			    xbps_dictionary_keysym_cstring_nocopy(obj), pkgver);
+	}
+	xbps_object_iterator_release(iter);
+
+	return pkgvers;
+}
+
+static void
+revdeps_store(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t d, pkgvers;
+	char *path;
+
+	/* only the process holding the pkgdb lock writes the index */
+	if (pkgdb_fd == -1 || xhp->pkgdb_revdeps == NULL ||
+	    xhp->pkgdb_revdeps_stale ||
+	    !xbps_object_modified(xhp->pkgdb_revdeps))
+		return;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	pkgvers = revdeps_pkgvers(xhp);
+	xbps_dictionary_set(d, "pkgvers", pkgvers);
+	xbps_object_release(pkgvers);
+	if (xhp->vpkgd)
+		xbps_dictionary_set(d, "vpkgs", xhp->vpkgd);
+	xbps_dictionary_set(d, "revdeps", xhp->pkgdb_revdeps);
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_REVDEPS);
+	if (xbps_dictionary_externalize_binary_to_file(d, path))
+		xbps_object_clear_modified(xhp->pkgdb_revdeps);
+	else
+		xbps_dbg_printf(xhp, "[pkgdb] cannot store revdeps index "
+		    "%s: %s\n", path, strerror(errno));
+	free(path);
+	xbps_object_release(d);
+}
+
+static bool
+revdeps_load(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t d, pkgvers, vpkgs, revdeps;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	unsigned int npkgs = 0;
+	bool rv = true;
+	char *path;
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_REVDEPS);
+	d = xbps_dictionary_internalize_from_file(path);
+	free(path);
+	if (d == NULL)
+		return false;
+
+	pkgvers = xbps_dictionary_get(d, "pkgvers");
+	vpkgs = xbps_dictionary_get(d, "vpkgs");
+	revdeps = xbps_dictionary_get(d, "revdeps");
+	if (xbps_object_type(pkgvers) != XBPS_TYPE_DICTIONARY ||
+	    xbps_object_type(revdeps) != XBPS_TYPE_DICTIONARY ||
+	    (xhp->vpkgd ? !xbps_dictionary_equals(vpkgs, xhp->vpkgd) : vpkgs != NULL)) {
+		xbps_object_release(d);
+		return false;
+	}
+	iter = xbps_dictionary_iterator(xhp->pkgdb);
+	assert(iter);
+	while (rv && (obj = xbps_object_iterator_next(iter))) {
+		const char *pkgver, *opkgver;
+
+		if (!xbps_dictionary_get_cstring_nocopy(
+		    xbps_dictionary_get_keysym(xhp->pkgdb, obj), "pkgver", &pkgver))
 			continue;
+		npkgs++;
+		rv = xbps_dictionary_get_cstring_nocopy(pkgvers,
+		    xbps_dictionary_keysym_cstring_nocopy(obj), &opkgver) &&
+		    strcmp(pkgver, opkgver) == 0;
+	}
+	xbps_object_iterator_release(iter);
 
-		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
-		for (unsigned int i = 0; i < xbps_array_count(rundeps); i++) {
-			xbps_array_t pkg;
-			const char *pkgdep, *vpkgname;
-			char *curpkgname;
-			bool alloc = false;
-
-			xbps_array_get_cstring_nocopy(rundeps, i, &pkgdep);
-			curpkgname = xbps_pkgpattern_name(pkgdep);
-			if (curpkgname == NULL)
-				curpkgname = xbps_pkg_name(pkgdep);
-			assert(curpkgname);
-			vpkgname = vpkg_user_conf(xhp, curpkgname, false);
-			if (vpkgname == NULL)
-				vpkgname = curpkgname;
+	if (rv && npkgs == xbps_dictionary_count(pkgvers)) {
+		xbps_dictionary_make_hashed(revdeps);
+		xbps_object_retain(revdeps);
+		xbps_object_clear_modified(revdeps);
+		xhp->pkgdb_revdeps = revdeps;
+	} else {
+		rv = false;
+	}
+	xbps_object_release(d);
+	return rv;
+}
 
-			pkg = xbps_dictionary_get(xhp->pkgdb_revdeps, vpkgname);
-			if (pkg == NULL) {
-				alloc = true;
-				pkg = xbps_array_create();
-			}
-			if (!xbps_match_string_in_array(pkg, pkgver)) {
-				xbps_array_add_cstring_nocopy(pkg, pkgver);
-				xbps_dictionary_set(xhp->pkgdb_revdeps, vpkgname, pkg);
-			}
-			free(curpkgname);
-			if (alloc)
-				xbps_object_release(pkg);
+static void
+generate_full_revdeps_tree(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t vpkgs = NULL;
+	xbps_object_t obj;
+	xbps_object_iterator_t iter;
+
+	if (xhp->pkgdb_revdeps)
+		return;
+
+	if (revdeps_load(xhp)) {
+		xbps_dbg_printf(xhp, "[pkgdb] loaded revdeps index.\n");
+		return;
+	}
+
+	xhp->pkgdb_revdeps =
+	    xbps_dictionary_create_hashed(xbps_dictionary_count(xhp->pkgdb));
+	assert(xhp->pkgdb_revdeps);
+
+	/*
+	 * Map names of virtual packages to the first package providing
+	 * them, as vpkg_user_conf() would find it.
+	 */
+	if (xhp->vpkgd) {
+		vpkgs = xbps_dictionary_create_hashed(xbps_dictionary_count(xhp->vpkgd));
+		assert(vpkgs);
+		iter = xbps_dictionary_iterator(xhp->vpkgd);
+		assert(iter);
+		while ((obj = xbps_object_iterator_next(iter))) {
+			const char *vpkg, *vpkgname;
+			char buf[XBPS_NAME_SIZE], *alloc;
+
+			vpkg = xbps_dictionary_keysym_cstring_nocopy(obj);
+			vpkgname = xbps_pkgname_get(buf, sizeof(buf), vpkg, &alloc);
+			if (vpkgname == NULL)
+				vpkgname = vpkg;
+			if (xbps_dictionary_get(vpkgs, vpkgname) == NULL)
+				xbps_dictionary_set(vpkgs, vpkgname,
+				    xbps_dictionary_get_keysym(xhp->vpkgd, obj));
+			free(alloc);
 		}
+		xbps_object_iterator_release(iter);
 	}
+
+	iter = xbps_dictionary_iterator(xhp->pkgdb);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)))
+		revdeps_add(xhp, vpkgs, xbps_dictionary_get_keysym(xhp->pkgdb, obj));
 	xbps_object_iterator_release(iter);
+
+	if (vpkgs)
+		xbps_object_release(vpkgs);
+
+	xhp->pkgdb_revdeps_stale = false;
+	revdeps_store(xhp);
+}
+
+void HIDDEN
+xbps_pkgdb_revdeps_update(struct xbps_handle *xhp, xbps_dictionary_t opkgd,
+		xbps_dictionary_t pkgd)
+{
+	if (xhp->pkgdb_revdeps == NULL)
+		return;
+
+	/* virtual packages are not mapped again until pkgdb is read */
+	if (xbps_array_count(xbps_dictionary_get(opkgd, "provides")) ||
+	    xbps_array_count(xbps_dictionary_get(pkgd, "provides")))
+		xhp->pkgdb_revdeps_stale = true;
+
+	if (opkgd)
+		revdeps_del(xhp, opkgd);
+	if (pkgd)
+		revdeps_add(xhp, NULL, pkgd);
+}
+
+/*
+ * The shlib-provides and shlib-requires of installed packages are indexed
+ * by soname to the pkgnames that have them on first use, and kept up to
+ * date by xbps_register_pkg() and xbps_remove_pkg().
+ */
+xbps_dictionary_t HIDDEN
+xbps_pkgdb_get_shlibs(struct xbps_handle *xhp)
+{
+	if (xhp->pkgdb_shlibs || xhp->pkgdb == NULL)
+		return xhp->pkgdb_shlibs;
+
+	xhp->pkgdb_shlibs = xbps_repo_index_shlibs(xhp->pkgdb);
+	assert(xhp->pkgdb_shlibs);
+
+	return xhp->pkgdb_shlibs;
+}
+
+void HIDDEN
+xbps_pkgdb_shlibs_update(struct xbps_handle *xhp, xbps_dictionary_t opkgd,
+		xbps_dictionary_t pkgd)
+{
+	if (xhp->pkgdb_shlibs == NULL)
+		return;
+
+	xbps_repo_index_shlibs_update(xhp->pkgdb_shlibs, opkgd, pkgd);
 }
 
 xbps_array_t
@@ -415,12 +714,167 @@ xbps_pkgdb_get_pkg_fulldeptree(struct xbps_handle *xhp, const char *pkg)
 	return xbps_get_pkg_fulldeptree(xhp, pkg, false);
 }
 
+xbps_array_t
+xbps_pkgdb_get_pkg_fullrevdeptree(struct xbps_handle *xhp, const char *pkg)
+{
+	return xbps_get_pkg_fullrevdeptree(xhp, pkg, false);
+}
+
+/*
+ * Files plists returned by xbps_pkgdb_get_pkg_files() are cached, up to
+ * PKGFILES_CACHE_MAX bytes of plists on disk; the least recently used
+ * are evicted first. An entry is only used while its plist is the same
+ * file, with the same size and mtime, as when it was read.
+ */
+#define PKGFILES_CACHE_MAX	(8 * 1024 * 1024)
+#define PKGFILES_BUCKETS	256
+
+struct pkgfiles_ent {
+	TAILQ_ENTRY(pkgfiles_ent) lru;
+	struct pkgfiles_ent *next;
+	xbps_dictionary_t filesd;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtim;
+	size_t len;
+	char pkgname[];
+};
+
+static TAILQ_HEAD(, pkgfiles_ent) pkgfiles_lru =
+    TAILQ_HEAD_INITIALIZER(pkgfiles_lru);
+static struct pkgfiles_ent *pkgfiles_buckets[PKGFILES_BUCKETS];
+static size_t pkgfiles_size;
+static pthread_mutex_t pkgfiles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct pkgfiles_ent **
+pkgfiles_lookup(const char *pkgname)
+{
+	struct pkgfiles_ent **entp;
+	uint32_t h = 2166136261U;
+
+	for (const char *p = pkgname; *p; p++) {
+		h ^= (unsigned char)*p;
+		h *= 16777619U;
+	}
+	entp = &pkgfiles_buckets[h % PKGFILES_BUCKETS];
+	while (*entp && strcmp((*entp)->pkgname, pkgname))
+		entp = &(*entp)->next;
+
+	return entp;
+}
+
+static void
+pkgfiles_remove(struct pkgfiles_ent **entp)
+{
+	struct pkgfiles_ent *ent = *entp;
+
+	*entp = ent->next;
+	TAILQ_REMOVE(&pkgfiles_lru, ent, lru);
+	pkgfiles_size -= ent->len;
+	xbps_object_release(ent->filesd);
+	free(ent);
+}
+
+static void
+pkgfiles_release(void)
+{
+	struct pkgfiles_ent *ent;
+
+	pthread_mutex_lock(&pkgfiles_lock);
+	while ((ent = TAILQ_FIRST(&pkgfiles_lru)) != NULL)
+		pkgfiles_remove(pkgfiles_lookup(ent->pkgname));
+	pthread_mutex_unlock(&pkgfiles_lock);
+}
+
+void HIDDEN
+xbps_pkgdb_files_memstat(struct xbps_memstat *ms)
+{
+	struct pkgfiles_ent *ent;
+
+	pthread_mutex_lock(&pkgfiles_lock);
+	TAILQ_FOREACH(ent, &pkgfiles_lru, lru)
+		xbps_object_memstat(ent->filesd, ms);
+	pthread_mutex_unlock(&pkgfiles_lock);
+}
+
+static xbps_dictionary_t
+pkgfiles_get(const char *pkgname, const struct stat *st)
+{
+	struct pkgfiles_ent **entp, *ent;
+	xbps_dictionary_t filesd = NULL;
+
+	pthread_mutex_lock(&pkgfiles_lock);
+	entp = pkgfiles_lookup(pkgname);
+	if ((ent = *entp) != NULL) {
+		if (ent->dev == st->st_dev && ent->ino == st->st_ino &&
+		    ent->size == st->st_size &&
+		    ent->mtim.tv_sec == st->st_mtim.tv_sec &&
+		    ent->mtim.tv_nsec == st->st_mtim.tv_nsec) {
+			TAILQ_REMOVE(&pkgfiles_lru, ent, lru);
+			TAILQ_INSERT_TAIL(&pkgfiles_lru, ent, lru);
+			filesd = ent->filesd;
+			xbps_object_retain(filesd);
+		} else {
+			pkgfiles_remove(entp);
+		}
+	}
+	pthread_mutex_unlock(&pkgfiles_lock);
+
+	return filesd;
+}
+
+/*
+ * st is that of the file the dictionary was read from, and size that
+ * of its plist.
+ */
+static void
+pkgfiles_add(const char *pkgname, const struct stat *st, size_t size,
+		xbps_dictionary_t filesd)
+{
+	struct pkgfiles_ent **entp, *ent;
+	size_t len;
+
+	if (size > PKGFILES_CACHE_MAX)
+		return;
+
+	len = strlen(pkgname) + 1;
+	ent = malloc(sizeof(*ent) + len);
+	assert(ent);
+	memcpy(ent->pkgname, pkgname, len);
+	ent->dev = st->st_dev;
+	ent->ino = st->st_ino;
+	ent->size = st->st_size;
+	ent->mtim = st->st_mtim;
+	ent->len = size;
+	/* the dictionary is shared by all callers */
+	xbps_dictionary_make_immutable(filesd);
+	xbps_object_retain(filesd);
+	ent->filesd = filesd;
+
+	pthread_mutex_lock(&pkgfiles_lock);
+	entp = pkgfiles_lookup(pkgname);
+	if (*entp != NULL)
+		pkgfiles_remove(entp);
+	ent->next = NULL;
+	*entp = ent;
+	TAILQ_INSERT_TAIL(&pkgfiles_lru, ent, lru);
+	pkgfiles_size += ent->len;
+	while (pkgfiles_size > PKGFILES_CACHE_MAX) {
+		ent = TAILQ_FIRST(&pkgfiles_lru);
+		pkgfiles_remove(pkgfiles_lookup(ent->pkgname));
+	}
+	pthread_mutex_unlock(&pkgfiles_lock);
+}
+
 xbps_dictionary_t
 xbps_pkgdb_get_pkg_files(struct xbps_handle *xhp, const char *pkg)
 {
 	xbps_dictionary_t pkgd, pkgfilesd;
+	struct stat st;
 	const char *pkgver;
-	char *pkgname, *plist;
+	char *pkgname, *plist, *store;
+	size_t len;
 
 	if (pkg == NULL)
 		return NULL;
@@ -434,9 +888,27 @@ xbps_pkgdb_get_pkg_files(struct xbps_handle *xhp, const char *pkg)
 	assert(pkgname);
 
 	plist = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, pkgname);
-	free(pkgname);
-	pkgfilesd = xbps_plist_dictionary_from_file(xhp, plist);
+	store = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_FILES);
+	if (stat(plist, &st) == -1) {
+		/* consolidated in the files index? */
+		if (errno != ENOENT || stat(store, &st) == -1) {
+			pkgfilesd = NULL;
+		} else if ((pkgfilesd = pkgfiles_get(pkgname, &st)) == NULL) {
+			pkgfilesd = xbps_pkgdb_files_plist(xhp, pkgname, &len);
+			if (pkgfilesd != NULL)
+				pkgfiles_add(pkgname, &st, len, pkgfilesd);
+			else
+				errno = ENOENT;
+		}
+	} else if ((pkgfilesd = pkgfiles_get(pkgname, &st)) == NULL) {
+		pkgfilesd = xbps_plist_dictionary_from_file(xhp, plist);
+		if (pkgfilesd != NULL)
+			pkgfiles_add(pkgname, &st, (size_t)st.st_size,
+			    pkgfilesd);
+	}
+	free(store);
 	free(plist);
+	free(pkgname);
 
 	if (pkgfilesd == NULL) {
 		xbps_dbg_printf(xhp, "[pkgdb] cannot read %s metadata: %s\n",
@@ -0,0 +1,862 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * The files owned by installed packages are indexed in a table next to
+ * pkgdb (XBPS_PKGDB_FILES), so that they can be found without reading
+ * the files plist of every package:
+ *
+ * 	header
+ * 	pkgs[npkgs]	sorted by pkgname, with the pkgver indexed
+ * 	files[nfiles]	grouped by package, in files plist order
+ * 	sorted[nfiles]	indexes of files sorted by path
+ * 	strtab		NUL terminated strings
+ *
+ * The table is only used if the pkgvers recorded match pkgdb. It's
+ * written by the pkgdb writer when pkgdb is flushed: only the files of
+ * the packages registered or removed since then, or whose pkgver
+ * doesn't match, are read from their files plist; those of the other
+ * packages are copied from the previous table.
+ *
+ * If the table is consolidated (FILES_EMBED) the files plists are also
+ * stored in strtab, verified against their "metafile-sha256" in pkgdb,
+ * and removed from metadir once the table has been written: metadir
+ * only has pkgdb and the table. Files plists written later by the
+ * unpacker are imported the next time pkgdb is flushed, and are
+ * preferred to the stored copy until then.
+ */
+#define FILES_MAGIC	"XBPSFIL1"
+#define FILES_VERSION	2
+#define FILES_NONE	UINT64_MAX
+#define FILES_EMBED	0x1
+
+struct files_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t npkgs;
+	uint32_t nfiles;
+	uint32_t flags;
+	uint64_t strtab;
+	uint64_t strtablen;
+};
+
+struct files_pkg {
+	uint64_t name;
+	uint64_t pkgver;
+	uint32_t first;
+	uint32_t nfiles;
+	uint64_t plist;
+};
+
+struct files_ent {
+	uint64_t path;
+	uint64_t target;
+	uint32_t pkg;
+	uint32_t type;
+};
+
+struct files_map {
+	void *map;
+	size_t maplen;
+	const struct files_hdr *hdr;
+	const struct files_pkg *pkgs;
+	const struct files_ent *files;
+	const uint32_t *sorted;
+	const char *strtab;
+};
+
+struct strtab {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+struct sort_ent {
+	const char *path;
+	uint32_t idx;
+};
+
+/* files plist arrays, in the order they are indexed */
+static const char *files_types[] = { "conf_files", "files", "links" };
+
+static uint64_t
+strtab_add(struct strtab *st, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	uint64_t off = st->len;
+
+	if (st->len + len > st->size) {
+		while (st->len + len > st->size)
+			st->size = st->size ? st->size * 2 : 65536;
+		st->buf = realloc(st->buf, st->size);
+		assert(st->buf);
+	}
+	memcpy(st->buf + st->len, s, len);
+	st->len += len;
+	return off;
+}
+
+static bool
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t r = write(fd, p, len);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+static const char *
+files_str(const struct files_map *fm, uint64_t off)
+{
+	if (off >= fm->hdr->strtablen)
+		return NULL;
+	return fm->strtab + off;
+}
+
+static void
+files_map_close(struct files_map *fm)
+{
+	if (fm->map != NULL)
+		(void)munmap(fm->map, fm->maplen);
+	fm->map = NULL;
+}
+
+static bool
+files_map_open(struct xbps_handle *xhp, struct files_map *fm)
+{
+	const struct files_hdr *hdr;
+	char *path;
+	size_t len;
+	uint64_t off;
+
+	memset(fm, 0, sizeof(*fm));
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_FILES);
+	if (!xbps_mmap_file(path, &fm->map, &fm->maplen, &len)) {
+		free(path);
+		return false;
+	}
+	hdr = fm->hdr = fm->map;
+	off = sizeof(*hdr) + (uint64_t)hdr->npkgs * sizeof(struct files_pkg) +
+	    (uint64_t)hdr->nfiles * (sizeof(struct files_ent) + sizeof(uint32_t));
+	if (len < sizeof(*hdr) ||
+	    memcmp(hdr->magic, FILES_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != FILES_VERSION ||
+	    hdr->strtab != off || hdr->strtablen == 0 ||
+	    hdr->strtab + hdr->strtablen != len ||
+	    ((const char *)fm->map)[len - 1] != '\0') {
+		xbps_dbg_printf(xhp, "[pkgdb] ignoring invalid files "
+		    "index %s\n", path);
+		files_map_close(fm);
+		free(path);
+		return false;
+	}
+	free(path);
+
+	fm->pkgs = (const void *)((const char *)fm->map + sizeof(*hdr));
+	fm->files = (const void *)(fm->pkgs + hdr->npkgs);
+	fm->sorted = (const void *)(fm->files + hdr->nfiles);
+	fm->strtab = (const char *)fm->map + hdr->strtab;
+
+	return true;
+}
+
+/*
+ * Returns the pkgver of package i of the table if it matches pkgdb,
+ * NULL otherwise.
+ */
+static const char *
+files_map_pkgver(struct xbps_handle *xhp, const struct files_map *fm,
+		uint32_t i)
+{
+	const char *name, *pkgver, *curpkgver;
+
+	if ((name = files_str(fm, fm->pkgs[i].name)) == NULL ||
+	    (pkgver = files_str(fm, fm->pkgs[i].pkgver)) == NULL)
+		return NULL;
+	if (!xbps_dictionary_get_cstring_nocopy(
+	    xbps_dictionary_get(xhp->pkgdb, name), "pkgver", &curpkgver) ||
+	    strcmp(pkgver, curpkgver))
+		return NULL;
+
+	return pkgver;
+}
+
+/*
+ * Returns true if the table has the files of all packages in pkgdb.
+ */
+static bool
+files_map_current(struct xbps_handle *xhp, const struct files_map *fm)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	unsigned int npkgs = 0;
+
+	iter = xbps_dictionary_iterator(xhp->pkgdb);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		if (xbps_dictionary_get(xbps_dictionary_get_keysym(xhp->pkgdb,
+		    obj), "pkgver"))
+			npkgs++;
+	}
+	xbps_object_iterator_release(iter);
+	if (npkgs != fm->hdr->npkgs)
+		return false;
+
+	for (uint32_t i = 0; i < fm->hdr->npkgs; i++) {
+		if (files_map_pkgver(xhp, fm, i) == NULL ||
+		    (uint64_t)fm->pkgs[i].first + fm->pkgs[i].nfiles >
+		    fm->hdr->nfiles)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Returns the index of pkgname in the table if its pkgver matches pkgdb,
+ * npkgs otherwise.
+ */
+static uint32_t
+files_map_find(struct xbps_handle *xhp, const struct files_map *fm,
+		const char *pkgname)
+{
+	const char *name;
+	uint32_t lo, hi, mid;
+	int cmp;
+
+	lo = 0;
+	hi = fm->hdr->npkgs;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((name = files_str(fm, fm->pkgs[mid].name)) == NULL)
+			break;
+		if ((cmp = strcmp(name, pkgname)) == 0) {
+			if (files_map_pkgver(xhp, fm, mid) == NULL ||
+			    (uint64_t)fm->pkgs[mid].first + fm->pkgs[mid].nfiles >
+			    fm->hdr->nfiles)
+				break;
+			return mid;
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return fm->hdr->npkgs;
+}
+
+static int
+files_call(struct xbps_handle *xhp, const struct files_map *fm, uint32_t i,
+	int (*fn)(struct xbps_handle *, const char *, const char *,
+	const char *, const char *, void *), void *arg)
+{
+	const struct files_ent *ent = &fm->files[i];
+	const char *pkgver, *file, *target = NULL;
+
+	if (ent->pkg >= fm->hdr->npkgs || ent->type >= __arraycount(files_types))
+		return 0;
+	pkgver = files_str(fm, fm->pkgs[ent->pkg].pkgver);
+	file = files_str(fm, ent->path);
+	if (ent->target != FILES_NONE)
+		target = files_str(fm, ent->target);
+	if (pkgver == NULL || file == NULL)
+		return 0;
+
+	return (*fn)(xhp, pkgver, file, target, files_types[ent->type], arg);
+}
+
+int
+xbps_pkgdb_files_foreach(struct xbps_handle *xhp, const char *path,
+	int (*fn)(struct xbps_handle *, const char *, const char *,
+	const char *, const char *, void *), void *arg)
+{
+	struct files_map fm;
+	const char *file;
+	uint32_t lo, hi, mid;
+	int rv = 0;
+
+	if ((rv = xbps_pkgdb_init(xhp)) != 0)
+		return rv;
+
+	if (!files_map_open(xhp, &fm))
+		return ENOENT;
+	if (!files_map_current(xhp, &fm)) {
+		xbps_dbg_printf(xhp, "[pkgdb] files index is out of date.\n");
+		files_map_close(&fm);
+		return ENOENT;
+	}
+	if (path == NULL) {
+		for (uint32_t i = 0; i < fm.hdr->nfiles && rv == 0; i++)
+			rv = files_call(xhp, &fm, i, fn, arg);
+		files_map_close(&fm);
+		return rv;
+	}
+	/* first entry not lower than path */
+	lo = 0;
+	hi = fm.hdr->nfiles;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (fm.sorted[mid] >= fm.hdr->nfiles)
+			break;
+		file = files_str(&fm, fm.files[fm.sorted[mid]].path);
+		if (file != NULL && strcmp(file, path) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < fm.hdr->nfiles && rv == 0; lo++) {
+		if (fm.sorted[lo] >= fm.hdr->nfiles)
+			break;
+		file = files_str(&fm, fm.files[fm.sorted[lo]].path);
+		if (file == NULL || strcmp(file, path))
+			break;
+		rv = files_call(xhp, &fm, fm.sorted[lo], fn, arg);
+	}
+	files_map_close(&fm);
+
+	return rv;
+}
+
+int
+xbps_pkgdb_pkg_files_foreach(struct xbps_handle *xhp, const char *pkg,
+	int (*fn)(struct xbps_handle *, const char *, const char *,
+	const char *, const char *, void *), void *arg)
+{
+	struct files_map fm;
+	xbps_dictionary_t pkgd;
+	const char *pkgver;
+	char pkgname[XBPS_NAME_SIZE];
+	uint32_t i;
+	int rv = 0;
+
+	if ((pkgd = xbps_pkgdb_get_pkg(xhp, pkg)) == NULL)
+		return ENOENT;
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) ||
+	    !xbps_pkg_name_buf(pkgname, sizeof(pkgname), pkgver))
+		return ENOENT;
+	/*
+	 * Files plists rewritten since the table was stored are not
+	 * in the table yet.
+	 */
+	if (xhp->pkgdb_files_changed &&
+	    xbps_dictionary_get(xhp->pkgdb_files_changed, pkgname))
+		return ENOENT;
+
+	if (!files_map_open(xhp, &fm))
+		return ENOENT;
+
+	if ((i = files_map_find(xhp, &fm, pkgname)) == fm.hdr->npkgs) {
+		xbps_dbg_printf(xhp, "[pkgdb] %s: files index is out of "
+		    "date.\n", pkgver);
+		files_map_close(&fm);
+		return ENOENT;
+	}
+	/* packages without files have no files plist */
+	if (fm.pkgs[i].nfiles == 0) {
+		files_map_close(&fm);
+		return ENOENT;
+	}
+	for (uint32_t j = 0; j < fm.pkgs[i].nfiles && rv == 0; j++)
+		rv = files_call(xhp, &fm, fm.pkgs[i].first + j, fn, arg);
+	files_map_close(&fm);
+
+	return rv;
+}
+
+xbps_dictionary_t HIDDEN
+xbps_pkgdb_files_plist(struct xbps_handle *xhp, const char *pkgname,
+		size_t *len)
+{
+	struct files_map fm;
+	xbps_dictionary_t filesd = NULL;
+	const char *plist;
+	uint32_t i;
+
+	if (!files_map_open(xhp, &fm))
+		return NULL;
+
+	if ((i = files_map_find(xhp, &fm, pkgname)) < fm.hdr->npkgs &&
+	    fm.pkgs[i].plist != FILES_NONE &&
+	    (plist = files_str(&fm, fm.pkgs[i].plist)) != NULL) {
+		filesd = xbps_dictionary_internalize(plist);
+		*len = strlen(plist);
+	}
+	files_map_close(&fm);
+
+	return filesd;
+}
+
+void HIDDEN
+xbps_pkgdb_files_update(struct xbps_handle *xhp, const char *pkgname)
+{
+	if (xhp->pkgdb_files_changed == NULL) {
+		xhp->pkgdb_files_changed = xbps_dictionary_create();
+		assert(xhp->pkgdb_files_changed);
+	}
+	xbps_dictionary_set_bool(xhp->pkgdb_files_changed, pkgname, true);
+}
+
+static int
+sort_ent_cmp(const void *a, const void *b)
+{
+	const struct sort_ent *sa = a, *sb = b;
+	int cmp;
+
+	if ((cmp = strcmp(sa->path, sb->path)))
+		return cmp;
+	return sa->idx < sb->idx ? -1 : sa->idx > sb->idx;
+}
+
+static void
+files_add(struct files_ent **files, uint32_t *nfiles, uint32_t *fsize,
+		struct strtab *st, uint32_t pkg, uint32_t type,
+		const char *path, const char *target)
+{
+	struct files_ent *ent;
+
+	if (*nfiles == *fsize) {
+		*fsize = *fsize ? *fsize * 2 : 65536;
+		*files = realloc(*files, *fsize * sizeof(**files));
+		assert(*files);
+	}
+	ent = &(*files)[(*nfiles)++];
+	ent->path = strtab_add(st, path);
+	ent->target = target ? strtab_add(st, target) : FILES_NONE;
+	ent->pkg = pkg;
+	ent->type = type;
+}
+
+static char *
+files_read(const char *path, size_t *lenp)
+{
+	struct stat st;
+	char *buf;
+	ssize_t r;
+	size_t len = 0;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY|O_CLOEXEC)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1) {
+		(void)close(fd);
+		return NULL;
+	}
+	buf = malloc((size_t)st.st_size + 1);
+	assert(buf);
+	while (len < (size_t)st.st_size) {
+		r = read(fd, buf + len, (size_t)st.st_size - len);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			break;
+		len += (size_t)r;
+	}
+	(void)close(fd);
+	if (len != (size_t)st.st_size) {
+		free(buf);
+		errno = EIO;
+		return NULL;
+	}
+	buf[len] = '\0';
+	*lenp = len;
+
+	return buf;
+}
+
+/*
+ * Adds the files of a package from its files plist, and stores the plist
+ * if embed is set. Returns true if it was stored.
+ */
+static bool
+files_add_plist(struct xbps_handle *xhp, const char *pkgname,
+		struct files_ent **files, uint32_t *nfiles, uint32_t *fsize,
+		struct strtab *st, uint32_t pkg, bool embed, uint64_t *plistp)
+{
+	xbps_dictionary_t filesd;
+	const char *sha256;
+	char *path, *buf, *xml;
+	size_t len;
+	int rv;
+
+	*plistp = FILES_NONE;
+	path = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, pkgname);
+	if ((buf = files_read(path, &len)) == NULL) {
+		free(path);
+		return false;
+	}
+	if ((filesd = xbps_dictionary_internalize_buffer(buf, len)) == NULL) {
+		xbps_dbg_printf(xhp, "[pkgdb] cannot internalize %s\n", path);
+		free(path);
+		free(buf);
+		return false;
+	}
+	if (embed && xbps_dictionary_get_cstring_nocopy(
+	    xbps_dictionary_get(xhp->pkgdb, pkgname), "metafile-sha256",
+	    &sha256) &&
+	    (rv = xbps_file_hash_check_handle(xhp, path, sha256)) != 0) {
+		xbps_dbg_printf(xhp, "[pkgdb] not storing %s: %s\n", path,
+		    rv == ERANGE ? "hash mismatch" : strerror(rv));
+		embed = false;
+	}
+	if (embed && buf[0] == '\0') {
+		/* binary plists are stored as XML in the table */
+		if ((xml = xbps_dictionary_externalize(filesd)) != NULL) {
+			*plistp = strtab_add(st, xml);
+			free(xml);
+		}
+	} else if (embed) {
+		*plistp = strtab_add(st, buf);
+	}
+	free(path);
+	free(buf);
+
+	for (uint32_t t = 0; t < __arraycount(files_types); t++) {
+		xbps_array_t array = xbps_dictionary_get(filesd, files_types[t]);
+
+		for (unsigned int i = 0; i < xbps_array_count(array); i++) {
+			xbps_dictionary_t obj = xbps_array_get(array, i);
+			const char *file = NULL, *tgt = NULL;
+
+			if (!xbps_dictionary_get_cstring_nocopy(obj, "file", &file))
+				continue;
+			xbps_dictionary_get_cstring_nocopy(obj, "target", &tgt);
+			files_add(files, nfiles, fsize, st, pkg, t, file, tgt);
+		}
+	}
+	xbps_object_release(filesd);
+
+	return embed;
+}
+
+static int
+files_write(struct xbps_handle *xhp, struct files_hdr *hdr,
+		struct files_pkg *pkgs, struct files_ent *files,
+		uint32_t *sorted, struct strtab *st)
+{
+	char *path, *tname;
+	int fd, rv = 0;
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_FILES);
+	tname = xbps_xasprintf("%s.XXXXXXXXXX", path);
+	if ((fd = mkstemp(tname)) == -1) {
+		rv = errno;
+		goto out;
+	}
+	if (!write_all(fd, hdr, sizeof(*hdr)) ||
+	    !write_all(fd, pkgs, hdr->npkgs * sizeof(*pkgs)) ||
+	    !write_all(fd, files, hdr->nfiles * sizeof(*files)) ||
+	    !write_all(fd, sorted, hdr->nfiles * sizeof(*sorted)) ||
+	    !write_all(fd, st->buf, st->len) ||
+	    fchmod(fd, 0644) == -1) {
+		rv = errno;
+		(void)close(fd);
+		(void)unlink(tname);
+		goto out;
+	}
+	(void)close(fd);
+	if (rename(tname, path) == -1) {
+		rv = errno;
+		(void)unlink(tname);
+	}
+out:
+	if (rv != 0)
+		xbps_dbg_printf(xhp, "[pkgdb] cannot store files index "
+		    "%s: %s\n", path, strerror(rv));
+	free(tname);
+	free(path);
+	return rv;
+}
+
+/*
+ * Writes the table; embed is the consolidated mode of the new table,
+ * or -1 to keep that of the previous one.
+ */
+static int
+files_store(struct xbps_handle *xhp, int embed)
+{
+	struct files_map fm;
+	struct files_hdr hdr;
+	struct files_pkg *pkgs;
+	struct files_ent *files = NULL;
+	struct sort_ent *sents;
+	struct strtab st = { NULL, 0, 0 };
+	xbps_array_t allkeys, stored;
+	uint32_t *sorted, npkgs = 0, nfiles = 0, fsize = 0, cur = 0;
+	unsigned int nread = 0;
+	bool old;
+	int rv;
+
+	old = files_map_open(xhp, &fm);
+	if (embed == -1)
+		embed = old && (fm.hdr->flags & FILES_EMBED);
+	allkeys = xbps_dictionary_all_keys(xhp->pkgdb);
+	stored = xbps_array_create();
+	assert(allkeys && stored);
+	pkgs = calloc(xbps_array_count(allkeys) + 1, sizeof(*pkgs));
+	assert(pkgs);
+
+	/* keys are returned sorted, as the packages of the table */
+	for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+		const char *pkgname, *pkgver, *opkgname;
+		uint32_t first = nfiles;
+
+		pkgname = xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(allkeys, i));
+		if (!xbps_dictionary_get_cstring_nocopy(
+		    xbps_dictionary_get(xhp->pkgdb, pkgname), "pkgver", &pkgver))
+			continue;
+
+		pkgs[npkgs].name = strtab_add(&st, pkgname);
+		pkgs[npkgs].pkgver = strtab_add(&st, pkgver);
+		pkgs[npkgs].first = first;
+		pkgs[npkgs].plist = FILES_NONE;
+
+		while (old && cur < fm.hdr->npkgs &&
+		    ((opkgname = files_str(&fm, fm.pkgs[cur].name)) == NULL ||
+		    strcmp(opkgname, pkgname) < 0))
+			cur++;
+		/*
+		 * Stored plists are only copied in consolidated mode, and
+		 * those not stored yet are read from metadir.
+		 */
+		if (old && cur < fm.hdr->npkgs &&
+		    strcmp(files_str(&fm, fm.pkgs[cur].name), pkgname) == 0 &&
+		    !xbps_dictionary_get(xhp->pkgdb_files_changed, pkgname) &&
+		    files_map_pkgver(xhp, &fm, cur) &&
+		    (uint64_t)fm.pkgs[cur].first + fm.pkgs[cur].nfiles <=
+		    fm.hdr->nfiles &&
+		    (!embed || (fm.pkgs[cur].plist != FILES_NONE &&
+		    files_str(&fm, fm.pkgs[cur].plist)))) {
+			for (uint32_t j = 0; j < fm.pkgs[cur].nfiles; j++) {
+				const struct files_ent *ent;
+				const char *file, *tgt = NULL;
+
+				ent = &fm.files[fm.pkgs[cur].first + j];
+				if ((file = files_str(&fm, ent->path)) == NULL ||
+				    ent->type >= __arraycount(files_types))
+					continue;
+				if (ent->target != FILES_NONE)
+					tgt = files_str(&fm, ent->target);
+				files_add(&files, &nfiles, &fsize, &st, npkgs,
+				    ent->type, file, tgt);
+			}
+			if (embed) {
+				pkgs[npkgs].plist = strtab_add(&st,
+				    files_str(&fm, fm.pkgs[cur].plist));
+			}
+		} else {
+			if (files_add_plist(xhp, pkgname, &files, &nfiles,
+			    &fsize, &st, npkgs, embed, &pkgs[npkgs].plist))
+				xbps_array_add_cstring_nocopy(stored, pkgname);
+			nread++;
+		}
+		pkgs[npkgs].nfiles = nfiles - first;
+		npkgs++;
+	}
+	if (old)
+		files_map_close(&fm);
+
+	sents = calloc(nfiles + 1, sizeof(*sents));
+	sorted = calloc(nfiles + 1, sizeof(*sorted));
+	assert(sents && sorted);
+	for (uint32_t i = 0; i < nfiles; i++) {
+		sents[i].path = st.buf + files[i].path;
+		sents[i].idx = i;
+	}
+	qsort(sents, nfiles, sizeof(*sents), sort_ent_cmp);
+	for (uint32_t i = 0; i < nfiles; i++)
+		sorted[i] = sents[i].idx;
+	free(sents);
+
+	if (st.len == 0)
+		(void)strtab_add(&st, "");
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, FILES_MAGIC, sizeof(hdr.magic));
+	hdr.version = FILES_VERSION;
+	hdr.npkgs = npkgs;
+	hdr.nfiles = nfiles;
+	hdr.flags = embed ? FILES_EMBED : 0;
+	hdr.strtab = sizeof(hdr) + npkgs * sizeof(*pkgs) +
+	    nfiles * (sizeof(*files) + sizeof(*sorted));
+	hdr.strtablen = st.len;
+
+	if ((rv = files_write(xhp, &hdr, pkgs, files, sorted, &st)) == 0) {
+		xbps_dbg_printf(xhp, "[pkgdb] stored files index (%u files, "
+		    "%u packages read, %u plists stored).\n", nfiles, nread,
+		    xbps_array_count(stored));
+		xbps_pkgdb_files_release(xhp);
+		/* the table has them now */
+		for (unsigned int i = 0; i < xbps_array_count(stored); i++) {
+			const char *pkgname = NULL;
+			char *path;
+
+			xbps_array_get_cstring_nocopy(stored, i, &pkgname);
+			path = xbps_xasprintf("%s/.%s-files.plist",
+			    xhp->metadir, pkgname);
+			(void)unlink(path);
+			free(path);
+		}
+	}
+	xbps_object_release(stored);
+	xbps_object_release(allkeys);
+	free(st.buf);
+	free(sorted);
+	free(files);
+	free(pkgs);
+
+	return rv;
+}
+
+void HIDDEN
+xbps_pkgdb_files_store(struct xbps_handle *xhp)
+{
+	if (xbps_dictionary_count(xhp->pkgdb_files_changed) == 0 ||
+	    xhp->pkgdb == NULL)
+		return;
+
+	(void)files_store(xhp, -1);
+}
+
+void HIDDEN
+xbps_pkgdb_files_release(struct xbps_handle *xhp)
+{
+	if (xhp->pkgdb_files_changed != NULL) {
+		xbps_object_release(xhp->pkgdb_files_changed);
+		xhp->pkgdb_files_changed = NULL;
+	}
+}
+
+/*
+ * Updates the hash of an exported files plist in pkgdb, it differs from
+ * the recorded one if the plist was stored from its binary form.
+ */
+static void
+files_export_hash(struct xbps_handle *xhp, const char *pkgname,
+		const char *path)
+{
+	xbps_dictionary_t pkgd;
+	const char *sha256 = NULL;
+	char *hash;
+
+	if ((pkgd = xbps_dictionary_get(xhp->pkgdb, pkgname)) == NULL ||
+	    (hash = xbps_file_hash(path)) == NULL)
+		return;
+	xbps_dictionary_get_cstring_nocopy(pkgd, "metafile-sha256", &sha256);
+	if (sha256 == NULL || strcmp(sha256, hash) != 0)
+		xbps_dictionary_set_cstring(pkgd, "metafile-sha256", hash);
+	free(hash);
+}
+
+/*
+ * Writes the files plists stored in the table back to metadir.
+ */
+static int
+files_export(struct xbps_handle *xhp)
+{
+	struct files_map fm;
+	int rv = 0;
+
+	if (!files_map_open(xhp, &fm))
+		return 0;
+
+	for (uint32_t i = 0; i < fm.hdr->npkgs && rv == 0; i++) {
+		const char *name, *plist;
+		char *path, *tname;
+		int fd;
+
+		if (fm.pkgs[i].plist == FILES_NONE ||
+		    (name = files_str(&fm, fm.pkgs[i].name)) == NULL ||
+		    (plist = files_str(&fm, fm.pkgs[i].plist)) == NULL ||
+		    files_map_pkgver(xhp, &fm, i) == NULL)
+			continue;
+
+		path = xbps_xasprintf("%s/.%s-files.plist", xhp->metadir, name);
+		if (access(path, F_OK) == 0) {
+			/* written by the unpacker, newer than ours */
+			free(path);
+			continue;
+		}
+		tname = xbps_xasprintf("%s.XXXXXXXXXX", path);
+		if ((fd = mkstemp(tname)) == -1) {
+			rv = errno;
+		} else if (!write_all(fd, plist, strlen(plist)) ||
+		    fchmod(fd, 0644) == -1) {
+			rv = errno;
+			(void)close(fd);
+			(void)unlink(tname);
+		} else {
+			(void)close(fd);
+			if (rename(tname, path) == -1) {
+				rv = errno;
+				(void)unlink(tname);
+			} else {
+				files_export_hash(xhp, name, path);
+			}
+		}
+		if (rv != 0)
+			xbps_dbg_printf(xhp, "[pkgdb] cannot write %s: %s\n",
+			    path, strerror(rv));
+		free(tname);
+		free(path);
+	}
+	files_map_close(&fm);
+
+	return rv;
+}
+
+int
+xbps_pkgdb_files_consolidate(struct xbps_handle *xhp, bool consolidate)
+{
+	int rv;
+
+	if ((rv = xbps_pkgdb_init(xhp)) != 0)
+		return rv;
+
+	if (!consolidate && (rv = files_export(xhp)) != 0)
+		return rv;
+
+	return files_store(xhp, consolidate);
+}
@@ -0,0 +1,200 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <openssl/sha.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Order independent hash of the installed packages: every package is
+ * hashed as SHA256(pkgname '\0' pkgver '\0' state) and added modulo
+ * 2^256 to the sum of its bucket, chosen by the first byte of
+ * SHA256(pkgname). The hash of pkgdb is the SHA256 of all bucket sums.
+ *
+ * The digest of every package is kept to subtract it when the package
+ * changes, so the sums are computed once and then updated as packages
+ * are registered, removed or change their state.
+ */
+struct xbps_pkgdb_hash {
+	xbps_dictionary_t pkgs;
+	uint8_t sums[XBPS_PKGDB_HASH_BUCKETS][SHA256_DIGEST_LENGTH];
+};
+
+static bool
+hash_pkg(const char *pkgname, xbps_dictionary_t pkgd, uint8_t *digest)
+{
+	SHA256_CTX ctx;
+	const char *pkgver = NULL, *state = "";
+
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+		return false;
+	xbps_dictionary_get_cstring_nocopy(pkgd, "state", &state);
+
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, pkgname, strlen(pkgname) + 1);
+	SHA256_Update(&ctx, pkgver, strlen(pkgver) + 1);
+	SHA256_Update(&ctx, state, strlen(state));
+	SHA256_Final(digest, &ctx);
+	return true;
+}
+
+/* big-endian 256 bit addition and subtraction */
+static void
+sum_add(uint8_t *sum, const uint8_t *digest, bool sub)
+{
+	int carry = 0;
+
+	for (int i = SHA256_DIGEST_LENGTH - 1; i >= 0; i--) {
+		int v = sub ? sum[i] - digest[i] - carry :
+		    sum[i] + digest[i] + carry;
+
+		carry = sub ? v < 0 : v > 0xff;
+		sum[i] = (uint8_t)v;
+	}
+}
+
+static void
+hash_add(struct xbps_pkgdb_hash *ph, const char *pkgname,
+		xbps_dictionary_t pkgd)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	xbps_data_t data;
+
+	if (!hash_pkg(pkgname, pkgd, digest))
+		return;
+	sum_add(ph->sums[xbps_pkgdb_hash_bucket(pkgname)], digest, false);
+	data = xbps_data_create_data(digest, sizeof(digest));
+	assert(data);
+	xbps_dictionary_set(ph->pkgs, pkgname, data);
+	xbps_object_release(data);
+}
+
+static struct xbps_pkgdb_hash *
+hash_init(struct xbps_handle *xhp)
+{
+	struct xbps_pkgdb_hash *ph;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	int rv;
+
+	if (xhp->pkgdb_hash)
+		return xhp->pkgdb_hash;
+	if ((rv = xbps_pkgdb_init(xhp)) != 0) {
+		errno = rv;
+		return NULL;
+	}
+
+	ph = calloc(1, sizeof(*ph));
+	assert(ph);
+	ph->pkgs = xbps_dictionary_create_hashed(xbps_dictionary_count(xhp->pkgdb));
+	assert(ph->pkgs);
+
+	iter = xbps_dictionary_iterator(xhp->pkgdb);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		hash_add(ph, xbps_dictionary_keysym_cstring_nocopy(obj),
+		    xbps_dictionary_get_keysym(xhp->pkgdb, obj));
+	}
+	xbps_object_iterator_release(iter);
+
+	xhp->pkgdb_hash = ph;
+	return ph;
+}
+
+void HIDDEN
+xbps_pkgdb_hash_update(struct xbps_handle *xhp, const char *pkgname)
+{
+	struct xbps_pkgdb_hash *ph = xhp->pkgdb_hash;
+	xbps_data_t old;
+	xbps_dictionary_t pkgd;
+
+	if (ph == NULL)
+		return;
+
+	if ((old = xbps_dictionary_get(ph->pkgs, pkgname)) != NULL) {
+		sum_add(ph->sums[xbps_pkgdb_hash_bucket(pkgname)],
+		    xbps_data_data_nocopy(old), true);
+		xbps_dictionary_remove(ph->pkgs, pkgname);
+	}
+	if ((pkgd = xbps_dictionary_get(xhp->pkgdb, pkgname)) != NULL)
+		hash_add(ph, pkgname, pkgd);
+}
+
+void HIDDEN
+xbps_pkgdb_hash_release(struct xbps_handle *xhp)
+{
+	if (xhp->pkgdb_hash == NULL)
+		return;
+
+	xbps_object_release(xhp->pkgdb_hash->pkgs);
+	free(xhp->pkgdb_hash);
+	xhp->pkgdb_hash = NULL;
+}
+
+unsigned int
+xbps_pkgdb_hash_bucket(const char *pkgname)
+{
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+
+	assert(pkgname);
+
+	SHA256((const unsigned char *)pkgname, strlen(pkgname), digest);
+	return digest[0] % XBPS_PKGDB_HASH_BUCKETS;
+}
+
+char *
+xbps_pkgdb_hash(struct xbps_handle *xhp, int bucket)
+{
+	struct xbps_pkgdb_hash *ph;
+	uint8_t digest[SHA256_DIGEST_LENGTH];
+	const uint8_t *src = digest;
+	char *hash;
+
+	assert(xhp);
+
+	if (bucket >= XBPS_PKGDB_HASH_BUCKETS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((ph = hash_init(xhp)) == NULL)
+		return NULL;
+	if (bucket < 0)
+		SHA256(ph->sums[0], sizeof(ph->sums), digest);
+	else
+		src = ph->sums[bucket];
+
+	hash = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
+	assert(hash);
+	xbps_digest2string(src, hash, SHA256_DIGEST_LENGTH);
+	return hash;
+}
@@ -0,0 +1,316 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Changes to the top level objects of pkgdb made while it's locked are
+ * appended to a journal next to it (XBPS_PKGDB_JOURNAL) and synced to
+ * storage, so that they survive an interrupted transaction even if
+ * pkgdb itself was not flushed. Every record is:
+ *
+ * 	<length> <crc32> <data>
+ * 	'S' <binary plist>	a dictionary with the key and its new value
+ * 	'R' <key> '\0'		the key was removed
+ *
+ * Integers are stored as 32 bit little-endian values, the crc32 covers
+ * the data. The journal is replayed when pkgdb is read and truncated
+ * once pkgdb has been flushed; it's replayed up to the first incomplete
+ * or corrupted record, left by a write that was interrupted.
+ */
+#define JOURNAL_HDRLEN	8
+#define JOURNAL_MINMAX	(1024 * 1024)
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	for (uint8_t i = 0; i < 4; i++)
+		p[i] = (v >> (i * 8)) & 0xff;
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+	uint32_t v = 0;
+
+	for (int i = 3; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+static bool
+write_all(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
+
+static int
+journal_sync(int fd)
+{
+	xbps_counter_inc(XBPS_COUNTER_FSYNCS);
+#ifdef HAVE_FDATASYNC
+	return fdatasync(fd);
+#else
+	return fsync(fd);
+#endif
+}
+
+static bool
+journal_apply(struct xbps_handle *xhp, const uint8_t *data, size_t len)
+{
+	xbps_object_iterator_t iter;
+	xbps_dictionary_t d;
+	xbps_object_t obj;
+
+	if (data[0] == 'R') {
+		if (len < 3 || data[len - 1] != '\0')
+			return false;
+		xbps_dictionary_remove(xhp->pkgdb, (const char *)data + 1);
+		return true;
+	} else if (data[0] != 'S') {
+		return false;
+	}
+
+	if ((d = xbps_dictionary_internalize_buffer(data + 1, len - 1)) == NULL)
+		return false;
+	iter = xbps_dictionary_iterator(d);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_dictionary_set(xhp->pkgdb,
+		    xbps_dictionary_keysym_cstring_nocopy(obj),
+		    xbps_dictionary_get_keysym(d, obj));
+	}
+	xbps_object_iterator_release(iter);
+	xbps_object_release(d);
+
+	return true;
+}
+
+int HIDDEN
+xbps_pkgdb_journal_replay(struct xbps_handle *xhp)
+{
+	uint8_t *mf;
+	char *path;
+	size_t mflen, flen, off = 0;
+	int n = 0;
+
+	assert(xhp->pkgdb);
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_JOURNAL);
+	if (!xbps_mmap_file(path, (void *)&mf, &mflen, &flen)) {
+		if (errno != ENOENT)
+			xbps_dbg_printf(xhp, "[pkgdb] cannot open journal "
+			    "%s: %s\n", path, strerror(errno));
+		free(path);
+		return 0;
+	}
+	free(path);
+
+	while (flen - off >= JOURNAL_HDRLEN) {
+		const uint8_t *data = mf + off + JOURNAL_HDRLEN;
+		size_t len = get32(mf + off);
+
+		if (len < 2 || len > flen - off - JOURNAL_HDRLEN)
+			break;
+		if (crc32(0, data, len) != get32(mf + off + 4))
+			break;
+		if (!journal_apply(xhp, data, len))
+			break;
+		off += JOURNAL_HDRLEN + len;
+		n++;
+	}
+	if (off < flen)
+		xbps_dbg_printf(xhp, "[pkgdb] ignored %zu bytes of incomplete "
+		    "journal records\n", flen - off);
+	if (n)
+		xbps_dbg_printf(xhp, "[pkgdb] replayed %d journal records\n", n);
+
+	(void)munmap(mf, mflen);
+	return n;
+}
+
+int HIDDEN
+xbps_pkgdb_journal_open(struct xbps_handle *xhp)
+{
+	struct stat st;
+	char *path;
+	int rv;
+
+	if (xhp->journal_fd != -1)
+		return 0;
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_JOURNAL);
+	xhp->journal_fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,
+	    0644);
+	if (xhp->journal_fd == -1) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "[pkgdb] cannot open journal %s: %s\n",
+		    path, strerror(rv));
+		free(path);
+		return rv;
+	}
+	free(path);
+
+	xhp->journal_len = 0;
+	if (fstat(xhp->journal_fd, &st) == 0)
+		xhp->journal_len = st.st_size;
+	/*
+	 * Replaying the journal costs about as much as reading pkgdb
+	 * when it's as large, compact it from then on.
+	 */
+	xhp->journal_max = JOURNAL_MINMAX;
+	if (stat(xhp->pkgdb_plist, &st) == 0 && st.st_size > xhp->journal_max)
+		xhp->journal_max = st.st_size;
+	/*
+	 * Records left by a previous transaction were replayed when pkgdb
+	 * was read, flush them now to start with an empty journal.
+	 */
+	if (xhp->journal_len > 0)
+		return xbps_pkgdb_update(xhp, true, true);
+
+	return 0;
+}
+
+int HIDDEN
+xbps_pkgdb_journal_reset(struct xbps_handle *xhp)
+{
+	int rv;
+
+	if (xhp->journal_fd == -1 || xhp->journal_len == 0)
+		return 0;
+
+	if (ftruncate(xhp->journal_fd, 0) == -1) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "[pkgdb] failed to truncate journal: "
+		    "%s\n", strerror(rv));
+		return rv;
+	}
+	xhp->journal_len = 0;
+	return 0;
+}
+
+void HIDDEN
+xbps_pkgdb_journal_close(struct xbps_handle *xhp)
+{
+	char *path;
+
+	if (xhp->journal_fd == -1)
+		return;
+
+	(void)close(xhp->journal_fd);
+	xhp->journal_fd = -1;
+	if (xhp->journal_len == 0) {
+		path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_PKGDB_JOURNAL);
+		(void)unlink(path);
+		free(path);
+	}
+}
+
+int HIDDEN
+xbps_pkgdb_journal(struct xbps_handle *xhp, const char *key)
+{
+	xbps_dictionary_t d;
+	xbps_object_t obj;
+	uint8_t *buf;
+	void *bin = NULL;
+	size_t len, binlen = 0;
+	int rv = 0;
+
+	assert(key);
+
+	if (xhp->journal_fd == -1 || xhp->pkgdb == NULL)
+		return 0;
+
+	if ((obj = xbps_dictionary_get(xhp->pkgdb, key))) {
+		if ((d = xbps_dictionary_create()) == NULL)
+			return ENOMEM;
+		if (xbps_dictionary_set(d, key, obj))
+			bin = xbps_dictionary_externalize_binary(d, &binlen);
+		xbps_object_release(d);
+		if (bin == NULL)
+			return errno ? errno : EINVAL;
+		len = binlen + 1;
+	} else {
+		len = strlen(key) + 2;
+	}
+	if ((buf = malloc(JOURNAL_HDRLEN + len)) == NULL) {
+		free(bin);
+		return ENOMEM;
+	}
+	if (obj) {
+		buf[JOURNAL_HDRLEN] = 'S';
+		memcpy(buf + JOURNAL_HDRLEN + 1, bin, binlen);
+	} else {
+		buf[JOURNAL_HDRLEN] = 'R';
+		memcpy(buf + JOURNAL_HDRLEN + 1, key, len - 1);
+	}
+	free(bin);
+	put32(buf, (uint32_t)len);
+	put32(buf + 4, crc32(0, buf + JOURNAL_HDRLEN, len));
+
+	if (!write_all(xhp->journal_fd, buf, JOURNAL_HDRLEN + len) ||
+	    journal_sync(xhp->journal_fd) == -1) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "[pkgdb] failed to journal %s: %s\n",
+		    key, strerror(rv));
+		/* don't leave an incomplete record before the next ones */
+		(void)ftruncate(xhp->journal_fd, xhp->journal_len);
+		free(buf);
+		return rv;
+	}
+	free(buf);
+	xhp->journal_len += JOURNAL_HDRLEN + len;
+
+	if (xhp->journal_len > xhp->journal_max) {
+		xbps_dbg_printf(xhp, "[pkgdb] compacting journal.\n");
+		return xbps_pkgdb_update(xhp, true, true);
+	}
+	return 0;
+}
@@ -32,16 +32,16 @@
 
 #include "xbps_api_impl.h"
 
-struct thread_data {
-	pthread_t thread;
+struct foreach_data {
 	xbps_array_t array;
 	xbps_dictionary_t dict;
 	struct xbps_handle *xhp;
-	unsigned int start;
 	unsigned int arraycount;
-	unsigned int *reserved;
-	pthread_spinlock_t *reserved_lock;
 	unsigned int slicecount;
+	unsigned int next;
+	pthread_mutex_t mtx;
+	int rv;
+	bool done;
 	int (*fn)(struct xbps_handle *, xbps_object_t, const char *, void *, bool *);
 	void *fn_arg;
 };
@@ -58,19 +58,28 @@ static void *
 array_foreach_thread(void *arg)
 {
 	xbps_object_t obj, pkgd;
-	struct thread_data *thd = arg;
+	struct foreach_data *fd = arg;
 	const char *key;
 	int rv;
 	bool loop_done = false;
-	unsigned i = thd->start;
-	unsigned int end = i + thd->slicecount;
-
-	while(i < thd->arraycount) {
-		/* process pkgs from start until end */
-		for (; i < end && i < thd->arraycount; i++) {
-			obj = xbps_array_get(thd->array, i);
-			if (xbps_object_type(thd->dict) == XBPS_TYPE_DICTIONARY) {
-				pkgd = xbps_dictionary_get_keysym(thd->dict, obj);
+	unsigned int i, end;
+
+	for (;;) {
+		/* Reserve the next slice of elements to compute */
+		pthread_mutex_lock(&fd->mtx);
+		i = fd->next;
+		if (fd->done)
+			i = fd->arraycount;
+		fd->next += fd->slicecount;
+		pthread_mutex_unlock(&fd->mtx);
+		if (i >= fd->arraycount)
+			break;
+
+		end = i + fd->slicecount;
+		for (; i < end && i < fd->arraycount; i++) {
+			obj = xbps_array_get(fd->array, i);
+			if (xbps_object_type(fd->dict) == XBPS_TYPE_DICTIONARY) {
+				pkgd = xbps_dictionary_get_keysym(fd->dict, obj);
 				key = xbps_dictionary_keysym_cstring_nocopy(obj);
 				/* ignore internal objs */
 				if (strncmp(key, "_XBPS_", 6) == 0)
@@ -79,16 +88,17 @@ array_foreach_thread(void *arg)
 				pkgd = obj;
 				key = NULL;
 			}
-			rv = (*thd->fn)(thd->xhp, pkgd, key, thd->fn_arg, &loop_done);
-			if (rv != 0 || loop_done)
+			rv = (*fd->fn)(fd->xhp, pkgd, key, fd->fn_arg, &loop_done);
+			if (rv != 0 || loop_done) {
+				/* the other threads stop at their next slice */
+				pthread_mutex_lock(&fd->mtx);
+				if (fd->rv == 0)
+					fd->rv = rv;
+				fd->done = true;
+				pthread_mutex_unlock(&fd->mtx);
 				return NULL;
+			}
 		}
-		/* Reserve more elements to compute */
-		pthread_spin_lock(thd->reserved_lock);
-		i = *thd->reserved;
-		end = i + thd->slicecount;
-		*thd->reserved = end;
-		pthread_spin_unlock(thd->reserved_lock);
 	}
 	return NULL;
 }
@@ -100,11 +110,8 @@ xbps_array_foreach_cb_multi(struct xbps_handle *xhp,
 	int (*fn)(struct xbps_handle *, xbps_object_t, const char *, void *, bool *),
 	void *arg)
 {
-	struct thread_data *thd;
-	unsigned int arraycount, slicecount;
-	int rv = 0, maxthreads;
-	unsigned int reserved = 0;
-	pthread_spinlock_t reserved_lock;
+	struct foreach_data fd;
+	unsigned int arraycount, nthreads;
 
 	assert(fn != NULL);
 
@@ -115,50 +122,206 @@ xbps_array_foreach_cb_multi(struct xbps_handle *xhp,
 	if (arraycount == 0)
 		return 0;
 
-	maxthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
-	if (maxthreads <= 1 || arraycount <= 1) /* use single threaded routine */
+	nthreads = xbps_pool_size(xhp);
+	if (nthreads <= 1 || arraycount <= 1) /* use single threaded routine */
 		return xbps_array_foreach_cb(xhp, array, dict, fn, arg);
 
-	if (pthread_spin_init(&reserved_lock, PTHREAD_PROCESS_PRIVATE) != 0)
-		return 0;
+	memset(&fd, 0, sizeof(fd));
+	fd.array = array;
+	fd.dict = dict;
+	fd.xhp = xhp;
+	fd.fn = fn;
+	fd.fn_arg = arg;
+	fd.arraycount = arraycount;
+	if (nthreads >= arraycount) {
+		nthreads = arraycount;
+		fd.slicecount = 1;
+	} else {
+		fd.slicecount = arraycount / nthreads;
+		if (fd.slicecount > 32)
+			fd.slicecount = 32;
+	}
+	pthread_mutex_init(&fd.mtx, NULL);
+	xbps_pool_run(xhp, array_foreach_thread, &fd, nthreads);
+	pthread_mutex_destroy(&fd.mtx);
 
-	thd = calloc(maxthreads, sizeof(*thd));
-	assert(thd);
+	return fd.rv;
+}
 
-	// maxthread is boundchecked to be > 1
-	if((unsigned int)maxthreads >= arraycount) {
-		maxthreads = arraycount;
-		slicecount = 1;
-	} else {
-		slicecount = arraycount / maxthreads;
-		if (slicecount > 32) {
-			slicecount = 32;
+/*
+ * Every slice of the array has its own accumulator, merged by a single
+ * thread at a time in array order as soon as the slices before it are
+ * merged. Once a slice fails or is done no slice after it is started,
+ * and those already running are discarded.
+ */
+struct reduce_slice {
+	void *acc;
+	int rv;
+	bool finished;
+};
+
+struct reduce_data {
+	const struct xbps_reduce *ops;
+	struct xbps_handle *xhp;
+	xbps_array_t array;
+	xbps_dictionary_t dict;
+	struct reduce_slice *slices;
+	unsigned int arraycount;
+	unsigned int slicecount;
+	unsigned int next;	/* next slice to start */
+	unsigned int last;	/* slices from it are not merged */
+	unsigned int merged;	/* slices already merged */
+	bool merging;
+	pthread_mutex_t mtx;
+	int rv;
+};
+
+static int
+reduce_slice(struct reduce_data *rd, unsigned int n)
+{
+	const struct xbps_reduce *ops = rd->ops;
+	struct reduce_slice *sl = &rd->slices[n];
+	xbps_object_t obj, pkgd;
+	const char *key;
+	unsigned int i, end;
+	bool done = false;
+
+	if ((sl->acc = (*ops->init)(ops->arg)) == NULL)
+		return errno ? errno : ENOMEM;
+
+	end = (n + 1) * rd->slicecount;
+	if (end > rd->arraycount)
+		end = rd->arraycount;
+	for (i = n * rd->slicecount; i < end; i++) {
+		obj = xbps_array_get(rd->array, i);
+		if (xbps_object_type(rd->dict) == XBPS_TYPE_DICTIONARY) {
+			pkgd = xbps_dictionary_get_keysym(rd->dict, obj);
+			key = xbps_dictionary_keysym_cstring_nocopy(obj);
+			/* ignore internal objs */
+			if (strncmp(key, "_XBPS_", 6) == 0)
+				continue;
+		} else {
+			pkgd = obj;
+			key = NULL;
+		}
+		if ((sl->rv = (*ops->fn)(rd->xhp, pkgd, key, sl->acc, &done)) != 0)
+			return sl->rv;
+		if (done)
+			return -1;
+	}
+	return 0;
+}
+
+static void *
+array_reduce_thread(void *arg)
+{
+	struct reduce_data *rd = arg;
+	const struct xbps_reduce *ops = rd->ops;
+	struct reduce_slice *sl;
+	unsigned int n;
+	int rv;
+
+	for (;;) {
+		pthread_mutex_lock(&rd->mtx);
+		if ((n = rd->next) >= rd->last) {
+			pthread_mutex_unlock(&rd->mtx);
+			break;
 		}
+		rd->next++;
+		pthread_mutex_unlock(&rd->mtx);
+
+		rv = reduce_slice(rd, n);
+
+		pthread_mutex_lock(&rd->mtx);
+		rd->slices[n].finished = true;
+		if (rv > 0)
+			rd->slices[n].rv = rv;
+		if (rv != 0 && rd->last > n + 1)
+			rd->last = n + 1;
+		if (rd->merging) {
+			pthread_mutex_unlock(&rd->mtx);
+			continue;
+		}
+		rd->merging = true;
+		while (rd->merged < rd->last && rd->slices[rd->merged].finished) {
+			sl = &rd->slices[rd->merged];
+			pthread_mutex_unlock(&rd->mtx);
+			rv = sl->rv;
+			if (sl->acc != NULL) {
+				int mrv = (*ops->merge)(ops->arg, sl->acc);
+				if (rv == 0)
+					rv = mrv;
+				if (ops->fini != NULL)
+					(*ops->fini)(sl->acc);
+				sl->acc = NULL;
+			}
+			pthread_mutex_lock(&rd->mtx);
+			if (rv != 0) {
+				if (rd->rv == 0)
+					rd->rv = rv;
+				if (rd->last > rd->merged + 1)
+					rd->last = rd->merged + 1;
+			}
+			rd->merged++;
+		}
+		rd->merging = false;
+		pthread_mutex_unlock(&rd->mtx);
 	}
+	return NULL;
+}
+
+int
+xbps_array_foreach_reduce(struct xbps_handle *xhp,
+	xbps_array_t array,
+	xbps_dictionary_t dict,
+	const struct xbps_reduce *ops)
+{
+	struct reduce_data rd;
+	unsigned int nslices, nthreads;
 
-	for (int i = 0; i < maxthreads; i++) {
-		thd[i].array = array;
-		thd[i].dict = dict;
-		thd[i].xhp = xhp;
-		thd[i].fn = fn;
-		thd[i].fn_arg = arg;
-		thd[i].start = i * slicecount;
-		thd[i].reserved = &reserved;
-		thd[i].reserved_lock = &reserved_lock;
-		thd[i].slicecount = slicecount;
-		thd[i].arraycount = arraycount;
-
-		pthread_create(&thd[i].thread, NULL,
-		    array_foreach_thread, &thd[i]);
+	assert(ops != NULL);
+	assert(ops->init != NULL);
+	assert(ops->fn != NULL);
+	assert(ops->merge != NULL);
+
+	if (xbps_object_type(array) != XBPS_TYPE_ARRAY)
+		return 0;
+
+	memset(&rd, 0, sizeof(rd));
+	if ((rd.arraycount = xbps_array_count(array)) == 0)
+		return 0;
+
+	nthreads = xbps_pool_size(xhp);
+	if (nthreads >= rd.arraycount) {
+		nthreads = rd.arraycount;
+		rd.slicecount = 1;
+	} else {
+		rd.slicecount = rd.arraycount / nthreads;
+		if (rd.slicecount > 32)
+			rd.slicecount = 32;
 	}
-	/* wait for all threads */
-	for (int i = 0; i < maxthreads; i++)
-		rv = pthread_join(thd[i].thread, NULL);
+	nslices = (rd.arraycount + rd.slicecount - 1) / rd.slicecount;
+	rd.slices = calloc(nslices, sizeof(*rd.slices));
+	if (rd.slices == NULL)
+		return ENOMEM;
 
-	free(thd);
-	pthread_spin_destroy(&reserved_lock);
+	rd.ops = ops;
+	rd.xhp = xhp;
+	rd.array = array;
+	rd.dict = dict;
+	rd.last = nslices;
+	pthread_mutex_init(&rd.mtx, NULL);
+	xbps_pool_run(xhp, array_reduce_thread, &rd, nthreads);
+	pthread_mutex_destroy(&rd.mtx);
 
-	return rv;
+	/* discard the slices that ran past a failed or done one */
+	for (unsigned int i = rd.merged; i < nslices; i++) {
+		if (rd.slices[i].acc != NULL && ops->fini != NULL)
+			(*ops->fini)(rd.slices[i].acc);
+	}
+	free(rd.slices);
+
+	return rd.rv;
 }
 
 int
@@ -210,20 +373,61 @@ xbps_array_iter_from_dict(xbps_dictionary_t dict, const char *key)
 	return xbps_array_iterator(array);
 }
 
+/*
+ * Packages added to the transaction store their pkgname in the "pkgname"
+ * object, so that matching them by name doesn't have to split pkgver.
+ */
+bool HIDDEN
+xbps_pkgd_set_pkgname(xbps_dictionary_t pkgd)
+{
+	const char *pkgver;
+	char *pkgname;
+	bool rv;
+
+	if (xbps_dictionary_get(pkgd, "pkgname"))
+		return true;
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) ||
+	    (pkgname = xbps_pkg_name(pkgver)) == NULL)
+		return false;
+
+	rv = xbps_dictionary_set_cstring(pkgd, "pkgname", pkgname);
+	free(pkgname);
+	return rv;
+}
+
+bool HIDDEN
+xbps_pkgd_match_pkgname(xbps_dictionary_t pkgd, const char *name)
+{
+	const char *pkgver;
+	size_t len;
+
+	if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgname", &pkgver))
+		return strcmp(pkgver, name) == 0;
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) ||
+	    (len = xbps_pkg_name_len(pkgver)) == 0)
+		return false;
+
+	return strncmp(pkgver, name, len) == 0 && name[len] == '\0';
+}
+
 static int
 array_replace_dict(xbps_array_t array,
 		   xbps_dictionary_t dict,
 		   const char *str,
 		   bool bypattern)
 {
+	struct xbps_pattern *pattern = NULL;
 	xbps_object_t obj;
 	const char *curpkgver;
-	char *curpkgname;
 
 	assert(xbps_object_type(array) == XBPS_TYPE_ARRAY);
 	assert(xbps_object_type(dict) == XBPS_TYPE_DICTIONARY);
 	assert(str != NULL);
 
+	if (bypattern) {
+		pattern = xbps_pattern_compile(str);
+		assert(pattern);
+	}
 	for (unsigned int i = 0; i < xbps_array_count(array); i++) {
 		obj = xbps_array_get(array, i);
 		if (obj == NULL)
@@ -232,29 +436,22 @@ array_replace_dict(xbps_array_t array,
 			/* pkgpattern match */
 			xbps_dictionary_get_cstring_nocopy(obj,
 			    "pkgver", &curpkgver);
-			if (xbps_pkgpattern_match(curpkgver, str)) {
+			if (xbps_pattern_match_compiled(pattern, curpkgver)) {
+				xbps_pattern_free(pattern);
 				if (!xbps_array_set(array, i, dict))
 					return EINVAL;
 
 				return 0;
 			}
-		} else {
+		} else if (xbps_pkgd_match_pkgname(obj, str)) {
 			/* pkgname match */
-			xbps_dictionary_get_cstring_nocopy(obj,
-			    "pkgver", &curpkgver);
-			curpkgname = xbps_pkg_name(curpkgver);
-			assert(curpkgname);
-			if (strcmp(curpkgname, str) == 0) {
-				if (!xbps_array_set(array, i, dict)) {
-					free(curpkgname);
-					return EINVAL;
-				}
-				free(curpkgname);
-				return 0;
-			}
-			free(curpkgname);
+			if (!xbps_array_set(array, i, dict))
+				return EINVAL;
+
+			return 0;
 		}
 	}
+	xbps_pattern_free(pattern);
 	/* no match */
 	return ENOENT;
 }
@@ -62,9 +62,12 @@ static ssize_t
 fetch_archive_read(struct archive *a UNUSED, void *client_data, const void **buf)
 {
 	struct fetch_archive *f = client_data;
+	ssize_t len;
 
 	*buf = f->buffer;
-	return fetchIO_read(f->fetch, f->buffer, sizeof(f->buffer));
+	if ((len = fetchIO_read(f->fetch, f->buffer, sizeof(f->buffer))) > 0)
+		xbps_counter_add(XBPS_COUNTER_FETCH_BYTES, len);
+	return len;
 }
 
 static int
@@ -98,6 +101,7 @@ open_archive_by_url(struct url *url)
 	archive_read_support_compression_gzip(a);
 	archive_read_support_compression_bzip2(a);
 	archive_read_support_compression_xz(a);
+	archive_read_support_filter_zstd(a);
 	archive_read_support_format_tar(a);
 
 	if (archive_read_open(a, f, fetch_archive_open, fetch_archive_read,
@@ -122,6 +126,7 @@ open_archive(const char *url)
 		archive_read_support_compression_gzip(a);
 		archive_read_support_compression_bzip2(a);
 		archive_read_support_compression_xz(a);
+		archive_read_support_filter_zstd(a);
 		archive_read_support_format_tar(a);
 
 		if (archive_read_open_filename(a, url, 32768)) {
@@ -140,12 +145,15 @@ open_archive(const char *url)
 	return a;
 }
 
-char *
-xbps_archive_fetch_file(const char *url, const char *fname)
+/*
+ * Opens the archive at url and reads its headers up to the entry fname,
+ * the archive is returned positioned at its data or NULL if not found.
+ */
+static struct archive *
+open_archive_entry(const char *url, const char *fname,
+		struct archive_entry **entryp)
 {
 	struct archive *a;
-	struct archive_entry *entry;
-	char *buf = NULL;
 
 	assert(url);
 	assert(fname);
@@ -153,21 +161,36 @@ xbps_archive_fetch_file(const char *url, const char *fname)
 	if ((a = open_archive(url)) == NULL)
 		return NULL;
 
-	while ((archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+	while ((archive_read_next_header(a, entryp)) == ARCHIVE_OK) {
 		const char *bfile;
 
-		bfile = archive_entry_pathname(entry);
+		bfile = archive_entry_pathname(*entryp);
 		if (bfile[0] == '.')
 			bfile++; /* skip first dot */
 
-		if (strcmp(bfile, fname) == 0) {
-			buf = xbps_archive_get_file(a, entry);
-			break;
-		}
+		if (strcmp(bfile, fname) == 0)
+			return a;
+
 		archive_read_data_skip(a);
 	}
 	archive_read_finish(a);
 
+	return NULL;
+}
+
+char *
+xbps_archive_fetch_file(const char *url, const char *fname)
+{
+	struct archive *a;
+	struct archive_entry *entry;
+	char *buf;
+
+	if ((a = open_archive_entry(url, fname, &entry)) == NULL)
+		return NULL;
+
+	buf = xbps_archive_get_file(a, entry, NULL);
+	archive_read_finish(a);
+
 	return buf;
 }
 
@@ -186,26 +209,31 @@ xbps_repo_fetch_remote(struct xbps_repo *repo, const char *url)
 
 	while ((archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
 		const char *bfile;
-		char *buf;
 
 		bfile = archive_entry_pathname(entry);
 		if (bfile[0] == '.')
 			bfile++; /* skip first dot */
 
 		if (strcmp(bfile, "index-meta.plist") == 0) {
-			buf = xbps_archive_get_file(a, entry);
-			repo->idxmeta = xbps_dictionary_internalize(buf);
-			free(buf);
+			repo->idxmeta = xbps_archive_get_dictionary(a, entry);
 			i++;
 		} else if (strcmp(bfile, "index.plist") == 0) {
-			buf = xbps_archive_get_file(a, entry);
-			repo->idx = xbps_dictionary_internalize(buf);
-			free(buf);
+			/* parsed as it's being downloaded */
+			xbps_object_arena_begin();
+			xbps_object_arena_intern();
+			repo->idx = xbps_archive_get_dictionary(a, entry);
+			xbps_object_arena_end();
+			i++;
+		} else if (strcmp(bfile, XBPS_REPOIDX_REVDEPS) == 0) {
+			repo->idxrevdeps = xbps_archive_get_dictionary(a, entry);
+			i++;
+		} else if (strcmp(bfile, XBPS_REPOIDX_SHLIBS) == 0) {
+			repo->idxshlibs = xbps_archive_get_dictionary(a, entry);
 			i++;
 		} else {
 			archive_read_data_skip(a);
 		}
-		if (i == 2)
+		if (i == 4)
 			break;
 	}
 	archive_read_finish(a);
@@ -254,16 +282,22 @@ xbps_archive_fetch_file_into_fd(const char *url, const char *fname, int fd)
 	return rv;
 }
 
+/*
+ * The plist is internalized while it's being read, see
+ * xbps_archive_get_dictionary().
+ */
 xbps_dictionary_t
 xbps_archive_fetch_plist(const char *url, const char *plistf)
 {
+	struct archive *a;
+	struct archive_entry *entry;
 	xbps_dictionary_t d;
-	char *buf;
 
-	if ((buf = xbps_archive_fetch_file(url, plistf)) == NULL)
+	if ((a = open_archive_entry(url, plistf, &entry)) == NULL)
 		return NULL;
 
-	d = xbps_dictionary_internalize(buf);
-	free(buf);
+	d = xbps_archive_get_dictionary(a, entry);
+	archive_read_finish(a);
+
 	return d;
 }
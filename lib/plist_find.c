@@ -35,19 +35,23 @@
 #include "xbps_api_impl.h"
 
 static xbps_dictionary_t
-get_pkg_in_array(xbps_array_t array, const char *str, const char *trans, bool virtual)
+match_pkg_in_array(xbps_array_t array, const char *str, const char *trans, bool virtual)
 {
+	struct xbps_pattern *pattern = NULL;
 	xbps_object_t obj = NULL;
 	xbps_object_iterator_t iter;
 	const char *tract;
 	bool found = false;
 
+	if (!virtual && xbps_pkgpattern_version(str)) {
+		pattern = xbps_pattern_compile(str);
+		assert(pattern);
+	}
 	iter = xbps_array_iterator(array);
 	assert(iter);
 
 	while ((obj = xbps_object_iterator_next(iter))) {
 		const char *pkgver;
-		char *dpkgn;
 
 		if (virtual) {
 			/*
@@ -57,12 +61,12 @@ get_pkg_in_array(xbps_array_t array, const char *str, const char *trans, bool vi
 			found = xbps_match_virtual_pkg_in_dict(obj, str);
 			if (found)
 				break;
-		} else if (xbps_pkgpattern_version(str)) {
+		} else if (pattern) {
 			/* match by pattern against pkgver */
 			if (!xbps_dictionary_get_cstring_nocopy(obj,
 			    "pkgver", &pkgver))
 				continue;
-			if (xbps_pkgpattern_match(pkgver, str)) {
+			if (xbps_pattern_match_compiled(pattern, pkgver)) {
 				found = true;
 				break;
 			}
@@ -75,22 +79,14 @@ get_pkg_in_array(xbps_array_t array, const char *str, const char *trans, bool vi
 				found = true;
 				break;
 			}
-		} else {
+		} else if (xbps_pkgd_match_pkgname(obj, str)) {
 			/* match by pkgname */
-			if (!xbps_dictionary_get_cstring_nocopy(obj,
-			    "pkgver", &pkgver))
-				continue;
-			dpkgn = xbps_pkg_name(pkgver);
-			assert(dpkgn);
-			if (strcmp(dpkgn, str) == 0) {
-				free(dpkgn);
-				found = true;
-				break;
-			}
-			free(dpkgn);
+			found = true;
+			break;
 		}
 	}
 	xbps_object_iterator_release(iter);
+	xbps_pattern_free(pattern);
 
 	if (found && trans &&
 	    xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract)) {
@@ -104,6 +100,173 @@ get_pkg_in_array(xbps_array_t array, const char *str, const char *trans, bool vi
 	return obj;
 }
 
+/*
+ * Lookups in large arrays of packages, as the packages array of the
+ * transaction, only match the packages with the same pkgname (or virtual
+ * pkgname) as the pattern. The index is built on the first lookup and
+ * extended while packages are only appended to the array, otherwise it's
+ * rebuilt; the array version tells how many times it was modified.
+ */
+#define PKG_INDEX_MIN	16
+#define PKG_INDEX_SLOTS	4
+
+struct pkg_index {
+	xbps_array_t array;
+	xbps_dictionary_t names;
+	xbps_dictionary_t vpkgs;
+	xbps_object_t first;
+	uint32_t version;
+	unsigned int count;
+	unsigned int used;
+};
+
+static struct pkg_index pkg_indexes[PKG_INDEX_SLOTS];
+static unsigned int pkg_index_used;
+static pthread_mutex_t pkg_index_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+char HIDDEN *
+xbps_pkg_index_key(const char *str)
+{
+	char *name;
+
+	/* globs can match any pkgname */
+	if (strpbrk(str, "*?[]"))
+		return NULL;
+	if (strpbrk(str, "<>"))
+		return xbps_pkgpattern_name(str);
+	if ((name = xbps_pkg_name(str)))
+		return name;
+	return strdup(str);
+}
+
+static void
+pkg_index_add(xbps_dictionary_t d, const char *key, xbps_dictionary_t pkgd)
+{
+	xbps_array_t pkgs;
+
+	if ((pkgs = xbps_dictionary_get(d, key)) == NULL) {
+		pkgs = xbps_array_create();
+		assert(pkgs);
+		xbps_dictionary_set(d, key, pkgs);
+		xbps_object_release(pkgs);
+	}
+	xbps_array_add(pkgs, pkgd);
+}
+
+static void
+pkg_index_clear(struct pkg_index *idx)
+{
+	if (idx->array == NULL)
+		return;
+
+	xbps_object_release(idx->array);
+	xbps_object_release(idx->names);
+	xbps_object_release(idx->vpkgs);
+	memset(idx, 0, sizeof(*idx));
+}
+
+static struct pkg_index *
+pkg_index_get(xbps_array_t array)
+{
+	struct pkg_index *idx = NULL;
+	unsigned int cnt = xbps_array_count(array);
+	uint32_t version = xbps_array_version(array);
+
+	for (unsigned int i = 0; i < PKG_INDEX_SLOTS; i++) {
+		if (pkg_indexes[i].array == array) {
+			idx = &pkg_indexes[i];
+			break;
+		}
+		if (idx == NULL || pkg_indexes[i].used < idx->used)
+			idx = &pkg_indexes[i];
+	}
+	/* objects were replaced, removed or added first */
+	if (idx->array != array || version - idx->version != cnt - idx->count ||
+	    xbps_array_get(array, 0) != idx->first)
+		pkg_index_clear(idx);
+	if (idx->array == NULL) {
+		idx->names = xbps_dictionary_create_hashed(0);
+		idx->vpkgs = xbps_dictionary_create_hashed(0);
+		if (idx->names == NULL || idx->vpkgs == NULL) {
+			if (idx->names)
+				xbps_object_release(idx->names);
+			if (idx->vpkgs)
+				xbps_object_release(idx->vpkgs);
+			idx->names = idx->vpkgs = NULL;
+			return NULL;
+		}
+		xbps_object_retain(array);
+		idx->array = array;
+		idx->first = xbps_array_get(array, 0);
+	}
+	for (; idx->count < cnt; idx->count++) {
+		xbps_dictionary_t pkgd;
+		xbps_array_t provides;
+		const char *pkgver, *vpkg;
+		char *key;
+
+		pkgd = xbps_array_get(array, idx->count);
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgname", &pkgver)) {
+			pkg_index_add(idx->names, pkgver, pkgd);
+		} else if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) &&
+		    (key = xbps_pkg_name(pkgver))) {
+			pkg_index_add(idx->names, key, pkgd);
+			free(key);
+		}
+		provides = xbps_dictionary_get(pkgd, "provides");
+		for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
+			xbps_array_get_cstring_nocopy(provides, i, &vpkg);
+			if ((key = xbps_pkg_name(vpkg)) == NULL)
+				key = strdup(vpkg);
+			assert(key);
+			pkg_index_add(idx->vpkgs, key, pkgd);
+			free(key);
+		}
+	}
+	idx->version = version;
+	idx->used = ++pkg_index_used;
+
+	return idx;
+}
+
+void HIDDEN
+xbps_pkg_index_release(void)
+{
+	pthread_mutex_lock(&pkg_index_mtx);
+	for (unsigned int i = 0; i < PKG_INDEX_SLOTS; i++)
+		pkg_index_clear(&pkg_indexes[i]);
+	pthread_mutex_unlock(&pkg_index_mtx);
+}
+
+static xbps_dictionary_t
+get_pkg_in_array(xbps_array_t array, const char *str, const char *trans, bool virtual)
+{
+	struct pkg_index *idx;
+	xbps_dictionary_t pkgd = NULL;
+	xbps_array_t pkgs;
+	char *key;
+
+	if (xbps_array_count(array) < PKG_INDEX_MIN ||
+	    (key = xbps_pkg_index_key(str)) == NULL)
+		return match_pkg_in_array(array, str, trans, virtual);
+
+	pthread_mutex_lock(&pkg_index_mtx);
+	if ((idx = pkg_index_get(array)) == NULL) {
+		pthread_mutex_unlock(&pkg_index_mtx);
+		free(key);
+		return match_pkg_in_array(array, str, trans, virtual);
+	}
+	pkgs = xbps_dictionary_get(virtual ? idx->vpkgs : idx->names, key);
+	if (pkgs)
+		pkgd = match_pkg_in_array(pkgs, str, trans, virtual);
+	pthread_mutex_unlock(&pkg_index_mtx);
+	free(key);
+
+	if (pkgd == NULL)
+		errno = ENOENT;
+	return pkgd;
+}
+
 xbps_dictionary_t HIDDEN
 xbps_find_pkg_in_array(xbps_array_t a, const char *s, const char *trans)
 {
@@ -138,11 +301,11 @@ static xbps_dictionary_t
 match_pkg_by_pkgver(xbps_dictionary_t repod, const char *p)
 {
 	xbps_dictionary_t d = NULL;
-	const char *pkgver;
-	char *pkgname;
+	const char *pkgver, *pkgname;
+	char buf[XBPS_NAME_SIZE], *alloc;
 
 	/* exact match by pkgver */
-	if ((pkgname = xbps_pkg_name(p)) == NULL)
+	if ((pkgname = xbps_pkgname_get(buf, sizeof(buf), p, &alloc)) == NULL)
 		return NULL;
 
 	d = xbps_dictionary_get(repod, pkgname);
@@ -154,7 +317,7 @@ match_pkg_by_pkgver(xbps_dictionary_t repod, const char *p)
 		}
 	}
 
-	free(pkgname);
+	free(alloc);
 	return d;
 }
 
@@ -162,17 +325,16 @@ static xbps_dictionary_t
 match_pkg_by_pattern(xbps_dictionary_t repod, const char *p)
 {
 	xbps_dictionary_t d = NULL;
-	const char *pkgver;
-	char *pkgname;
+	const char *pkgver, *pkgname;
+	char buf[XBPS_NAME_SIZE], *alloc;
 
 	/* match by pkgpattern in pkgver */
-	if ((pkgname = xbps_pkgpattern_name(p)) == NULL) {
-		if ((pkgname = xbps_pkg_name(p))) {
-			free(pkgname);
+	if (xbps_pkgpattern_name_len(p) == 0) {
+		if (xbps_pkg_name_len(p))
 			return match_pkg_by_pkgver(repod, p);
-		}
 		return NULL;
 	}
+	pkgname = xbps_pkgname_get(buf, sizeof(buf), p, &alloc);
 
 	d = xbps_dictionary_get(repod, pkgname);
 	if (d) {
@@ -184,7 +346,7 @@ match_pkg_by_pattern(xbps_dictionary_t repod, const char *p)
 		}
 	}
 
-	free(pkgname);
+	free(alloc);
 	return d;
 }
 
@@ -213,54 +375,37 @@ vpkg_user_conf(struct xbps_handle *xhp, const char *vpkg, bool only_conf)
 
 	while ((obj = xbps_object_iterator_next(iter))) {
 		xbps_string_t rpkg;
-		char *dpkgname, *vpkgname;
 		const char *vpkg_conf;
+		size_t len, vlen;
 
 		vpkg_conf = xbps_dictionary_keysym_cstring_nocopy(obj);
 		rpkg = xbps_dictionary_get_keysym(xhp->vpkgd, obj);
 		pkg = xbps_string_cstring_nocopy(rpkg);
 
-		if (xbps_pkg_version(vpkg_conf)) {
-			vpkgname = xbps_pkg_name(vpkg_conf);
-			assert(vpkgname);
-		} else {
-			vpkgname = strdup(vpkg_conf);
-			assert(vpkgname);
-		}
+		/* the vpkgname is the first vlen bytes of vpkg_conf */
+		if ((vlen = xbps_pkg_name_len(vpkg_conf)) == 0)
+			vlen = strlen(vpkg_conf);
 
 		if (xbps_pkgpattern_version(vpkg)) {
 			char *vpkgver;
 
 			if (xbps_pkg_version(vpkg_conf)) {
-				if (!xbps_pkgpattern_match(vpkg_conf, vpkg)) {
-					free(vpkgname);
+				if (!xbps_pkgpattern_match(vpkg_conf, vpkg))
 					continue;
-				}
 			} else {
 				vpkgver = xbps_xasprintf("%s-999999_1", vpkg_conf);
 				if (!xbps_pkgpattern_match(vpkgver, vpkg)) {
 					free(vpkgver);
-					free(vpkgname);
 					continue;
 				}
 				free(vpkgver);
 			}
-		} else if (xbps_pkg_version(vpkg)) {
-			dpkgname = xbps_pkg_name(vpkg);
-			assert(dpkgname);
-			if (strcmp(dpkgname, vpkgname)) {
-				free(dpkgname);
-				free(vpkgname);
-				continue;
-			}
-			free(dpkgname);
 		} else {
-			if (strcmp(vpkg, vpkgname)) {
-				free(vpkgname);
+			if ((len = xbps_pkg_name_len(vpkg)) == 0)
+				len = strlen(vpkg);
+			if (len != vlen || strncmp(vpkg, vpkg_conf, len))
 				continue;
-			}
 		}
-		free(vpkgname);
 		found = true;
 		break;
 	}
@@ -347,3 +492,28 @@ xbps_find_pkg_in_dict(xbps_dictionary_t d, const char *pkg)
 
 	return pkgd;
 }
+
+/*
+ * Same as xbps_find_pkg_in_dict() with a compiled pattern: a single
+ * lookup of its pkgname, without parsing the pattern again.
+ */
+xbps_dictionary_t HIDDEN
+xbps_find_pkg_in_dict_pattern(xbps_dictionary_t d, const struct xbps_pattern *p)
+{
+	xbps_dictionary_t pkgd;
+	const char *pkgname, *pkgver;
+
+	if ((pkgname = xbps_pattern_pkgname(p)) == NULL)
+		return xbps_find_pkg_in_dict(d, xbps_pattern_string(p));
+
+	pkgd = xbps_dictionary_get(d, pkgname);
+	if (pkgd) {
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		assert(pkgver);
+		if (!xbps_pattern_match_compiled(p, pkgver)) {
+			pkgd = NULL;
+			errno = ENOENT;
+		}
+	}
+	return pkgd;
+}
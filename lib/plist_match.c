@@ -63,99 +63,126 @@ xbps_match_virtual_pkg_in_dict(xbps_dictionary_t d, const char *str)
 	return false;
 }
 
+/*
+ * Arrays internalized from a plist have a packed copy of their strings,
+ * they are read from it without touching the string objects; others
+ * are read by index.
+ */
+static const char *
+array_string(xbps_array_t array, const struct xbps_array_packed *pk,
+		unsigned int i, size_t *lenp)
+{
+	const char *s;
+
+	if (pk->strs != NULL) {
+		*lenp = pk->offs[i + 1] - pk->offs[i] - 1;
+		return pk->strs + pk->offs[i];
+	}
+	if ((s = xbps_string_cstring_nocopy(xbps_array_get(array, i))) != NULL)
+		*lenp = strlen(s);
+	return s;
+}
+
 bool
 xbps_match_any_virtualpkg_in_rundeps(xbps_array_t rundeps,
 				     xbps_array_t provides)
 {
-	xbps_object_t obj, obj2;
-	xbps_object_iterator_t iter, iter2;
+	struct xbps_array_packed pk, pk2;
 	const char *vpkgver, *pkgpattern;
-
-	iter = xbps_array_iterator(provides);
-	assert(iter);
-
-	while ((obj = xbps_object_iterator_next(iter))) {
-		vpkgver = xbps_string_cstring_nocopy(obj);
-		iter2 = xbps_array_iterator(rundeps);
-		assert(iter2);
-		while ((obj2 = xbps_object_iterator_next(iter2))) {
-			pkgpattern = xbps_string_cstring_nocopy(obj2);
-			if (xbps_pkgpattern_match(vpkgver, pkgpattern)) {
-				xbps_object_iterator_release(iter2);
-				xbps_object_iterator_release(iter);
+	unsigned int n, n2;
+	size_t len;
+
+	if (!xbps_array_packed(provides, &pk))
+		pk.strs = NULL;
+	if (!xbps_array_packed(rundeps, &pk2))
+		pk2.strs = NULL;
+	n = pk.strs ? pk.count : xbps_array_count(provides);
+	n2 = pk2.strs ? pk2.count : xbps_array_count(rundeps);
+
+	for (unsigned int i = 0; i < n; i++) {
+		if ((vpkgver = array_string(provides, &pk, i, &len)) == NULL)
+			continue;
+		for (unsigned int j = 0; j < n2; j++) {
+			pkgpattern = array_string(rundeps, &pk2, j, &len);
+			if (pkgpattern && xbps_pkgpattern_match(vpkgver, pkgpattern))
 				return true;
-			}
 		}
-		xbps_object_iterator_release(iter2);
 	}
-	xbps_object_iterator_release(iter);
-
 	return false;
 }
 
 static bool
 match_string_in_array(xbps_array_t array, const char *str, int mode)
 {
-	xbps_object_iterator_t iter;
-	xbps_object_t obj;
+	struct xbps_pattern *pattern = NULL;
+	struct xbps_array_packed pk;
 	const char *pkgdep;
-	char *curpkgname;
+	unsigned int n;
+	size_t len, slen = 0;
 	bool found = false;
 
 	assert(xbps_object_type(array) == XBPS_TYPE_ARRAY);
 	assert(str != NULL);
 
-	iter = xbps_array_iterator(array);
-	assert(iter);
+	if (!xbps_array_packed(array, &pk))
+		pk.strs = NULL;
+	n = pk.strs ? pk.count : xbps_array_count(array);
 
-	while ((obj = xbps_object_iterator_next(iter))) {
+	/* the same pattern is matched against every object */
+	if (mode == 3 && n > 1) {
+		pattern = xbps_pattern_compile(str);
+		assert(pattern);
+	}
+	if (mode == 0 || mode == 1)
+		slen = strlen(str);
+	else if (mode == 2)
+		slen = xbps_pkg_name_len(str);
+
+	for (unsigned int i = 0; i < n; i++) {
+		if ((pkgdep = array_string(array, &pk, i, &len)) == NULL)
+			continue;
 		if (mode == 0) {
 			/* match by string */
-			if (xbps_string_equals_cstring(obj, str)) {
+			if (len == slen && memcmp(pkgdep, str, len) == 0) {
 				found = true;
 				break;
 			}
 		} else if (mode == 1) {
 			/* match by pkgname against pkgver */
-			pkgdep = xbps_string_cstring_nocopy(obj);
-			curpkgname = xbps_pkg_name(pkgdep);
-			if (curpkgname == NULL)
+			if (pk.strs != NULL)
+				len = pk.namelen[i];
+			else
+				len = xbps_pkg_name_len(pkgdep);
+			if (len == 0)
 				break;
-			if (strcmp(curpkgname, str) == 0) {
-				free(curpkgname);
+			if (len == slen && memcmp(pkgdep, str, len) == 0) {
 				found = true;
 				break;
 			}
-			free(curpkgname);
 		} else if (mode == 2) {
 			/* match by pkgver against pkgname */
-			pkgdep = xbps_string_cstring_nocopy(obj);
-			curpkgname = xbps_pkg_name(str);
-			if (curpkgname == NULL)
+			if (slen == 0)
 				break;
-			if (strcmp(curpkgname, pkgdep) == 0) {
-				free(curpkgname);
+			if (len == slen && memcmp(str, pkgdep, len) == 0) {
 				found = true;
 				break;
 			}
-			free(curpkgname);
 		} else if (mode == 3) {
 			/* match pkgpattern against pkgdep */
-			pkgdep = xbps_string_cstring_nocopy(obj);
-			if (xbps_pkgpattern_match(pkgdep, str)) {
+			if (pattern ? xbps_pattern_match_compiled(pattern, pkgdep) :
+			    xbps_pkgpattern_match(pkgdep, str)) {
 				found = true;
 				break;
 			}
 		} else if (mode == 4) {
 			/* match pkgdep against pkgpattern */
-			pkgdep = xbps_string_cstring_nocopy(obj);
 			if (xbps_pkgpattern_match(str, pkgdep)) {
 				found = true;
 				break;
 			}
 		}
 	}
-	xbps_object_iterator_release(iter);
+	xbps_pattern_free(pattern);
 
 	return found;
 }
@@ -32,6 +32,7 @@
 #ifndef _PROPLIB_PROP_ARRAY_H_
 #define	_PROPLIB_PROP_ARRAY_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <prop/prop_object.h>
 
@@ -49,17 +50,26 @@ prop_array_t	prop_array_copy_mutable(prop_array_t);
 
 unsigned int	prop_array_capacity(prop_array_t);
 unsigned int	prop_array_count(prop_array_t);
+uint32_t	prop_array_version(prop_array_t);
 bool		prop_array_ensure_capacity(prop_array_t, unsigned int);
 
 void		prop_array_make_immutable(prop_array_t);
 bool		prop_array_mutable(prop_array_t);
 
+bool		prop_array_pack(prop_array_t, size_t (*)(const char *));
+const char *	prop_array_packed(prop_array_t, unsigned int *,
+				  const uint32_t **, const uint32_t **);
+void		prop_array_pack_keys(const char * const *,
+				     size_t (*)(const char *));
+
 prop_object_iterator_t prop_array_iterator(prop_array_t);
 
 prop_object_t	prop_array_get(prop_array_t, unsigned int);
 bool		prop_array_set(prop_array_t, unsigned int, prop_object_t);
 bool		prop_array_add(prop_array_t, prop_object_t);
 bool		prop_array_add_first(prop_array_t, prop_object_t);
+bool		prop_array_add_objects_and_rel(prop_array_t, prop_object_t *,
+					       unsigned int);
 void		prop_array_remove(prop_array_t, unsigned int);
 
 bool		prop_array_equals(prop_array_t, prop_array_t);
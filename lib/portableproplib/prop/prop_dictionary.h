@@ -33,6 +33,7 @@
 #define	_PROPLIB_PROP_DICTIONARY_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <prop/prop_object.h>
 #include <prop/prop_array.h>
 
@@ -45,6 +46,7 @@ extern "C" {
 
 prop_dictionary_t prop_dictionary_create(void);
 prop_dictionary_t prop_dictionary_create_with_capacity(unsigned int);
+prop_dictionary_t prop_dictionary_create_hashed(unsigned int);
 
 prop_dictionary_t prop_dictionary_copy(prop_dictionary_t);
 prop_dictionary_t prop_dictionary_copy_mutable(prop_dictionary_t);
@@ -54,6 +56,7 @@ bool		prop_dictionary_ensure_capacity(prop_dictionary_t,
 						unsigned int);
 
 void		prop_dictionary_make_immutable(prop_dictionary_t);
+bool		prop_dictionary_make_hashed(prop_dictionary_t);
 bool		prop_dictionary_mutable(prop_dictionary_t);
 
 prop_object_iterator_t prop_dictionary_iterator(prop_dictionary_t);
@@ -84,6 +87,15 @@ bool		prop_dictionary_externalize_to_zfile(prop_dictionary_t,
 prop_dictionary_t prop_dictionary_internalize_from_file(const char *);
 prop_dictionary_t prop_dictionary_internalize_from_zfile(const char *);
 
+void *		prop_dictionary_externalize_binary(prop_dictionary_t, size_t *);
+bool		prop_dictionary_externalize_binary_to_file(prop_dictionary_t,
+							   const char *);
+prop_dictionary_t prop_dictionary_internalize_buffer(const void *, size_t);
+prop_dictionary_t prop_dictionary_internalize_stream(
+		    ssize_t (*)(void *, void *, size_t), void *);
+bool		prop_dictionary_externalize_stream(prop_dictionary_t,
+		    ssize_t (*)(void *, const void *, size_t), void *);
+
 const char *	prop_dictionary_keysym_cstring_nocopy(prop_dictionary_keysym_t);
 
 bool		prop_dictionary_keysym_equals(prop_dictionary_keysym_t,
@@ -62,10 +62,43 @@ bool		prop_object_equals_with_error(prop_object_t, prop_object_t, bool *);
 
 typedef struct _prop_object_iterator *prop_object_iterator_t;
 
+typedef enum {
+	PROP_MEMSTAT_BOOL,
+	PROP_MEMSTAT_NUMBER,
+	PROP_MEMSTAT_STRING,
+	PROP_MEMSTAT_DATA,
+	PROP_MEMSTAT_ARRAY,
+	PROP_MEMSTAT_DICTIONARY,
+	PROP_MEMSTAT_DICT_KEYSYM,
+	PROP_MEMSTAT_NTYPES
+} prop_memstat_type_t;
+
+struct prop_memstat {
+	uint64_t	pm_objects[PROP_MEMSTAT_NTYPES];
+	uint64_t	pm_bytes[PROP_MEMSTAT_NTYPES];
+};
+
+struct prop_stats {
+	uint64_t	ps_internalized;	/* objects internalized */
+	uint64_t	ps_internalized_bytes;	/* and the bytes parsed */
+	uint64_t	ps_syncs;		/* externalized files synced */
+};
+
 prop_object_t	prop_object_iterator_next(prop_object_iterator_t);
 void		prop_object_iterator_reset(prop_object_iterator_t);
 void		prop_object_iterator_release(prop_object_iterator_t);
 
+void		prop_object_arena_begin(void);
+void		prop_object_arena_end(void);
+void		prop_object_arena_intern(void);
+void		prop_object_pool_trim(void);
+
+void		prop_object_memstat(prop_object_t, struct prop_memstat *);
+void		prop_object_stats(struct prop_stats *);
+
+bool		prop_object_modified(prop_object_t);
+void		prop_object_clear_modified(prop_object_t);
+
 #ifdef __cplusplus
 }
 #endif
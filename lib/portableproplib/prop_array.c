@@ -31,8 +31,10 @@
 
 #include "prop_object_impl.h"
 #include <prop/prop_array.h>
+#include <prop/prop_string.h>
 
 #include <errno.h>
+#include <limits.h>
 
 struct _prop_array {
 	struct _prop_object	pa_obj;
@@ -43,15 +45,32 @@ struct _prop_array {
 	int			pa_flags;
 
 	uint32_t		pa_version;
+	struct _prop_array_packed *pa_packed;
+};
+
+/*
+ * Packed copy of an array of strings: string i is stored at
+ * pap_strs + pap_offs[i] and takes pap_offs[i + 1] - pap_offs[i]
+ * bytes with its NUL, pap_aux[i] is the value returned for it by the
+ * function passed to prop_array_pack(), if any.  Everything is stored
+ * in the same block as the struct.
+ */
+struct _prop_array_packed {
+	unsigned int		pap_count;
+	uint32_t		*pap_offs;
+	uint32_t		*pap_aux;
+	char			*pap_strs;
+	size_t			pap_size;
 };
 
 #define PA_F_IMMUTABLE		0x01	/* array is immutable */
 
-_PROP_POOL_INIT(_prop_array_pool, sizeof(struct _prop_array), "proparay")
+_PROP_ARENA_POOL_INIT(_prop_array_pool, sizeof(struct _prop_array), "proparay")
 
 static _prop_object_free_rv_t
 		_prop_array_free(prop_stack_t, prop_object_t *);
 static void	_prop_array_emergency_free(prop_object_t);
+static size_t	_prop_array_size(prop_object_t);
 static bool	_prop_array_externalize(
 				struct _prop_object_externalize_context *,
 				void *);
@@ -73,13 +92,29 @@ static const struct _prop_object_type _prop_object_type_array = {
 	.pot_extern		=	_prop_array_externalize,
 	.pot_equals		=	_prop_array_equals,
 	.pot_equals_finish	=	_prop_array_equals_finish,
+	.pot_size		=	_prop_array_size,
 };
 
 #define prop_object_is_array(x)		\
-	((x) != NULL && (x)->pa_obj.po_type == &_prop_object_type_array)
+	((x) != NULL && _prop_object_type_of(x) == &_prop_object_type_array)
 
 #define prop_array_is_immutable(x) (((x)->pa_flags & PA_F_IMMUTABLE) != 0)
 
+/*
+ * Immutable arrays are never modified again, so readers don't need
+ * to take the lock; the flag is only set with the lock held.
+ */
+#define	_PROP_ARRAY_RDLOCK(pa)						\
+	do {								\
+		if (!prop_array_is_immutable(pa))			\
+			_PROP_RWLOCK_RDLOCK((pa)->pa_rwlock);		\
+	} while (/*CONSTCOND*/0)
+#define	_PROP_ARRAY_RDUNLOCK(pa)					\
+	do {								\
+		if (!prop_array_is_immutable(pa))			\
+			_PROP_RWLOCK_UNLOCK((pa)->pa_rwlock);		\
+	} while (/*CONSTCOND*/0)
+
 struct _prop_array_iterator {
 	struct _prop_object_iterator pai_base;
 	unsigned int		pai_index;
@@ -101,10 +136,12 @@ _prop_array_free(prop_stack_t stack, prop_object_t *obj)
 	if (pa->pa_count == 0) {
 		if (pa->pa_array != NULL)
 			_PROP_FREE(pa->pa_array, M_PROP_ARRAY);
+		if (pa->pa_packed != NULL)
+			_PROP_FREE(pa->pa_packed, M_PROP_ARRAY);
 
 		_PROP_RWLOCK_DESTROY(pa->pa_rwlock);
 
-		_PROP_POOL_PUT(_prop_array_pool, pa);
+		_PROP_ARENA_PUT(_prop_array_pool, pa);
 
 		return (_PROP_OBJECT_FREE_DONE);
 	}
@@ -141,6 +178,22 @@ _prop_array_emergency_free(prop_object_t obj)
 	--pa->pa_count;
 }
 
+static size_t
+_prop_array_size(prop_object_t v)
+{
+	prop_array_t pa = v;
+	size_t size;
+
+	_PROP_ARRAY_RDLOCK(pa);
+	size = _prop_pool_objsize(&_prop_array_pool) +
+	    pa->pa_capacity * sizeof(*pa->pa_array);
+	if (pa->pa_packed != NULL)
+		size += pa->pa_packed->pap_size;
+	_PROP_ARRAY_RDUNLOCK(pa);
+
+	return (size);
+}
+
 static bool
 _prop_array_externalize(struct _prop_object_externalize_context *ctx,
 			void *v)
@@ -171,7 +224,7 @@ _prop_array_externalize(struct _prop_object_externalize_context *ctx,
 	_PROP_ASSERT(ctx->poec_depth != 0);
 
 	while ((po = _prop_array_iterator_next_object_locked(pi)) != NULL) {
-		if ((*po->po_type->pot_extern)(ctx, po) == false) {
+		if ((*_prop_object_type_of(po)->pot_extern)(ctx, po) == false) {
 			prop_object_iterator_release(pi);
 			goto out;
 		}
@@ -265,7 +318,7 @@ _prop_array_alloc(unsigned int capacity)
 	} else
 		array = NULL;
 
-	pa = _PROP_POOL_GET(_prop_array_pool);
+	pa = _PROP_ARENA_GET(_prop_array_pool);
 	if (pa != NULL) {
 		_prop_object_init(&pa->pa_obj, &_prop_object_type_array);
 		pa->pa_obj.po_type = &_prop_object_type_array;
@@ -277,37 +330,79 @@ _prop_array_alloc(unsigned int capacity)
 		pa->pa_flags = 0;
 
 		pa->pa_version = 0;
+		pa->pa_packed = NULL;
 	} else if (array != NULL)
 		_PROP_FREE(array, M_PROP_ARRAY);
 
 	return (pa);
 }
 
+/*
+ * Array must be WRITE-LOCKED: the packed copy is stale from now on.
+ */
+static void
+_prop_array_changed(prop_array_t pa)
+{
+
+	pa->pa_version++;
+	if (pa->pa_packed != NULL) {
+		_PROP_FREE(pa->pa_packed, M_PROP_ARRAY);
+		pa->pa_packed = NULL;
+	}
+	_PROP_OBJECT_MODIFIED(pa);
+}
+
 static bool
 _prop_array_expand(prop_array_t pa, unsigned int capacity)
 {
-	prop_object_t *array, *oarray;
+	prop_object_t *array;
 
 	/*
 	 * Array must be WRITE-LOCKED.
 	 */
 
-	oarray = pa->pa_array;
-
-	array = _PROP_CALLOC(capacity * sizeof(*array), M_PROP_ARRAY);
+	array = _PROP_REALLOC(pa->pa_array, capacity * sizeof(*array),
+	    M_PROP_ARRAY);
 	if (array == NULL)
 		return (false);
-	if (oarray != NULL)
-		memcpy(array, oarray, pa->pa_capacity * sizeof(*array));
 	pa->pa_array = array;
 	pa->pa_capacity = capacity;
 
-	if (oarray != NULL)
-		_PROP_FREE(oarray, M_PROP_ARRAY);
-
 	return (true);
 }
 
+/*
+ * _prop_array_grow --
+ *	Make room for n more objects.  The capacity is doubled rather
+ *	than increased by a fixed step, so that appending N objects
+ *	one by one costs O(log N) reallocations.
+ */
+static bool
+_prop_array_grow(prop_array_t pa, unsigned int n)
+{
+	unsigned int capacity;
+
+	/*
+	 * Array must be WRITE-LOCKED.
+	 */
+
+	if (n <= pa->pa_capacity - pa->pa_count)
+		return (true);
+	if (n > UINT_MAX - pa->pa_count)
+		return (false);
+
+	capacity = pa->pa_capacity < EXPAND_STEP ?
+	    EXPAND_STEP : pa->pa_capacity;
+	while (capacity - pa->pa_count < n) {
+		if (capacity > UINT_MAX / 2) {
+			capacity = pa->pa_count + n;
+			break;
+		}
+		capacity *= 2;
+	}
+	return (_prop_array_expand(pa, capacity));
+}
+
 static prop_object_t
 _prop_array_iterator_next_object_locked(void *v)
 {
@@ -341,9 +436,9 @@ _prop_array_iterator_next_object(void *v)
 
 	_PROP_ASSERT(prop_object_is_array(pa));
 
-	_PROP_RWLOCK_RDLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDLOCK(pa);
 	po = _prop_array_iterator_next_object_locked(pai);
-	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDUNLOCK(pa);
 	return (po);
 }
 
@@ -367,9 +462,9 @@ _prop_array_iterator_reset(void *v)
 
 	_PROP_ASSERT(prop_object_is_array(pa));
 
-	_PROP_RWLOCK_RDLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDLOCK(pa);
 	_prop_array_iterator_reset_locked(pai);
-	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDUNLOCK(pa);
 }
 
 /*
@@ -474,8 +569,28 @@ prop_array_count(prop_array_t pa)
 	if (! prop_object_is_array(pa))
 		return (0);
 
-	_PROP_RWLOCK_RDLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDLOCK(pa);
 	rv = pa->pa_count;
+	_PROP_ARRAY_RDUNLOCK(pa);
+
+	return (rv);
+}
+
+/*
+ * prop_array_version --
+ *	Return the version of the array, it's changed every time an
+ *	object is added, replaced or removed.
+ */
+uint32_t
+prop_array_version(prop_array_t pa)
+{
+	uint32_t rv;
+
+	if (! prop_object_is_array(pa))
+		return (0);
+
+	_PROP_RWLOCK_RDLOCK(pa->pa_rwlock);
+	rv = pa->pa_version;
 	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
 
 	return (rv);
@@ -535,9 +650,9 @@ prop_array_iterator(prop_array_t pa)
 {
 	prop_object_iterator_t pi;
 
-	_PROP_RWLOCK_RDLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDLOCK(pa);
 	pi = _prop_array_iterator_locked(pa);
-	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDUNLOCK(pa);
 	return (pi);
 }
 
@@ -555,6 +670,135 @@ prop_array_make_immutable(prop_array_t pa)
 	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
 }
 
+/*
+ * prop_array_pack --
+ *	Store a packed copy of an array of strings, to be read with
+ *	prop_array_packed().  If aux is not NULL, its return value for
+ *	every string is stored along with it.  Returns false if the
+ *	array has any object that is not a string.
+ */
+bool
+prop_array_pack(prop_array_t pa, size_t (*aux)(const char *))
+{
+	struct _prop_array_packed *pap;
+	prop_string_t ps;
+	size_t len = 0, size, n;
+	unsigned int i;
+	bool rv = false;
+
+	if (! prop_object_is_array(pa))
+		return (false);
+
+	_PROP_RWLOCK_WRLOCK(pa->pa_rwlock);
+	if (pa->pa_packed != NULL) {
+		rv = true;
+		goto out;
+	}
+	for (i = 0; i < pa->pa_count; i++) {
+		if (prop_object_type(pa->pa_array[i]) != PROP_TYPE_STRING)
+			goto out;
+		len += prop_string_size(pa->pa_array[i]) + 1;
+	}
+	if (len > UINT32_MAX)
+		goto out;
+
+	size = sizeof(*pap) + (pa->pa_count + 1) * sizeof(uint32_t) + len;
+	if (aux != NULL)
+		size += pa->pa_count * sizeof(uint32_t);
+	if ((pap = _PROP_MALLOC(size, M_PROP_ARRAY)) == NULL)
+		goto out;
+	pap->pap_count = pa->pa_count;
+	pap->pap_size = size;
+	pap->pap_offs = (uint32_t *)(pap + 1);
+	pap->pap_aux = aux ? pap->pap_offs + pa->pa_count + 1 : NULL;
+	pap->pap_strs = (char *)(pap->pap_offs + pa->pa_count + 1 +
+	    (aux ? pa->pa_count : 0));
+
+	len = 0;
+	for (i = 0; i < pa->pa_count; i++) {
+		ps = pa->pa_array[i];
+		n = prop_string_size(ps);
+		memcpy(pap->pap_strs + len, prop_string_cstring_nocopy(ps), n);
+		pap->pap_strs[len + n] = '\0';
+		pap->pap_offs[i] = (uint32_t)len;
+		if (aux != NULL)
+			pap->pap_aux[i] = (uint32_t)(*aux)(pap->pap_strs + len);
+		len += n + 1;
+	}
+	pap->pap_offs[i] = (uint32_t)len;
+	pa->pa_packed = pap;
+	rv = true;
+
+ out:
+	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
+	return (rv);
+}
+
+/*
+ * prop_array_packed --
+ *	Return the packed strings of an array stored by prop_array_pack(),
+ *	with their count, offsets and values of aux, or NULL if the array
+ *	is not packed.  They are valid until the array is modified.
+ */
+const char *
+prop_array_packed(prop_array_t pa, unsigned int *countp,
+    const uint32_t **offsp, const uint32_t **auxp)
+{
+	struct _prop_array_packed *pap;
+
+	if (! prop_object_is_array(pa))
+		return (NULL);
+
+	_PROP_ARRAY_RDLOCK(pa);
+	pap = pa->pa_packed;
+	_PROP_ARRAY_RDUNLOCK(pa);
+	if (pap == NULL)
+		return (NULL);
+
+	*countp = pap->pap_count;
+	*offsp = pap->pap_offs;
+	if (auxp != NULL)
+		*auxp = pap->pap_aux;
+	return (pap->pap_strs);
+}
+
+/*
+ * Arrays of strings stored in a dictionary with any of these keys
+ * are packed when internalized.
+ */
+static const char * const *_prop_array_pack_keyv;
+static size_t (*_prop_array_pack_aux)(const char *);
+
+/*
+ * prop_array_pack_keys --
+ *	Set the NULL terminated list of keys whose arrays are packed
+ *	by the internalizers, with the aux function passed to
+ *	prop_array_pack().  Must be set before anything is internalized.
+ */
+void
+prop_array_pack_keys(const char * const *keys, size_t (*aux)(const char *))
+{
+
+	_prop_array_pack_keyv = keys;
+	_prop_array_pack_aux = aux;
+}
+
+void
+_prop_array_internalize_key(const char *key, prop_object_t po)
+{
+	const char * const *k;
+
+	if (_prop_array_pack_keyv == NULL || ! prop_object_is_array(po))
+		return;
+
+	for (k = _prop_array_pack_keyv; *k != NULL; k++) {
+		if (strcmp(*k, key) == 0) {
+			(void)prop_array_pack(po, _prop_array_pack_aux);
+			return;
+		}
+	}
+}
+
 /*
  * prop_array_mutable --
  *	Returns true if the array is mutable.
@@ -583,13 +827,13 @@ prop_array_get(prop_array_t pa, unsigned int idx)
 	if (! prop_object_is_array(pa))
 		return (NULL);
 
-	_PROP_RWLOCK_RDLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDLOCK(pa);
 	if (idx >= pa->pa_count)
 		goto out;
 	po = pa->pa_array[idx];
 	_PROP_ASSERT(po != NULL);
  out:
-	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
+	_PROP_ARRAY_RDUNLOCK(pa);
 	return (po);
 }
 
@@ -603,14 +847,12 @@ _prop_array_add(prop_array_t pa, prop_object_t po)
 
 	_PROP_ASSERT(pa->pa_count <= pa->pa_capacity);
 
-	if (prop_array_is_immutable(pa) ||
-	    (pa->pa_count == pa->pa_capacity &&
-	    _prop_array_expand(pa, pa->pa_capacity + EXPAND_STEP) == false))
+	if (prop_array_is_immutable(pa) || _prop_array_grow(pa, 1) == false)
 		return (false);
 
 	prop_object_retain(po);
 	pa->pa_array[pa->pa_count++] = po;
-	pa->pa_version++;
+	_prop_array_changed(pa);
 
 	return (true);
 }
@@ -618,39 +860,24 @@ _prop_array_add(prop_array_t pa, prop_object_t po)
 static bool
 _prop_array_add_first(prop_array_t pa, prop_object_t po)
 {
-	unsigned int cnt;
 	/*
 	 * Array must be WRITE-LOCKED.
 	 */
 
 	_PROP_ASSERT(pa->pa_count <= pa->pa_capacity);
 
-	if (prop_array_is_immutable(pa) ||
-	    (pa->pa_count == pa->pa_capacity &&
-	    _prop_array_expand(pa, pa->pa_capacity + EXPAND_STEP) == false))
+	if (prop_array_is_immutable(pa) || _prop_array_grow(pa, 1) == false)
 		return false;
 
 	prop_object_retain(po);
-	if (pa->pa_count) {
-		cnt = pa->pa_count+1;
-		/* move all stored elements to the right */
-		while (--cnt) {
-			prop_object_t opo = pa->pa_array[cnt-1];
-			_PROP_ASSERT(opo != NULL);
-			prop_object_retain(opo);
-			pa->pa_array[cnt] = opo;
-			prop_object_release(opo);
-			//printf("%s: po %p\n", __func__, pa->pa_array[cnt]);
-		}
-		/* passed in object is now the first element */
-		pa->pa_array[0] = po;
-		pa->pa_version++;
-		pa->pa_count++;
-		//printf("%s: po %p\n", __func__, pa->pa_array[0]);
-	} else {
-		pa->pa_array[pa->pa_count++] = po;
-		pa->pa_version++;
-	}
+	/* move all stored elements to the right */
+	memmove(pa->pa_array + 1, pa->pa_array,
+	    pa->pa_count * sizeof(*pa->pa_array));
+	/* passed in object is now the first element */
+	pa->pa_array[0] = po;
+	pa->pa_count++;
+	_prop_array_changed(pa);
+
 	return true;
 }
 
@@ -687,7 +914,7 @@ prop_array_set(prop_array_t pa, unsigned int idx, prop_object_t po)
 
 	prop_object_retain(po);
 	pa->pa_array[idx] = po;
-	pa->pa_version++;
+	_prop_array_changed(pa);
 
 	prop_object_release(opo);
 
@@ -718,6 +945,46 @@ prop_array_add(prop_array_t pa, prop_object_t po)
 	return (rv);
 }
 
+/*
+ * prop_array_add_objects_and_rel --
+ *	Append n objects to the specified array, taking over the
+ *	caller's reference to each of them: the array is locked and
+ *	grown once and the objects are not retained.  If the objects
+ *	cannot be added, the references are released.
+ */
+bool
+prop_array_add_objects_and_rel(prop_array_t pa, prop_object_t *objs,
+    unsigned int n)
+{
+	unsigned int idx;
+	bool rv = false;
+
+	for (idx = 0; idx < n; idx++) {
+		if (objs[idx] == NULL)
+			goto out;
+	}
+	if (! prop_object_is_array(pa))
+		goto out;
+
+	_PROP_RWLOCK_WRLOCK(pa->pa_rwlock);
+	if (! prop_array_is_immutable(pa) && _prop_array_grow(pa, n)) {
+		memcpy(pa->pa_array + pa->pa_count, objs, n * sizeof(*objs));
+		pa->pa_count += n;
+		_prop_array_changed(pa);
+		rv = true;
+	}
+	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
+
+ out:
+	if (rv == false) {
+		for (idx = 0; idx < n; idx++) {
+			if (objs[idx] != NULL)
+				prop_object_release(objs[idx]);
+		}
+	}
+	return (rv);
+}
+
 /*
  * prop_array_add_first --
  *	Add a reference to an object to the specified array, inserting it
@@ -767,7 +1034,7 @@ prop_array_remove(prop_array_t pa, unsigned int idx)
 	for (++idx; idx < pa->pa_count; idx++)
 		pa->pa_array[idx - 1] = pa->pa_array[idx];
 	pa->pa_count--;
-	pa->pa_version++;
+	_prop_array_changed(pa);
 
 	_PROP_RWLOCK_UNLOCK(pa->pa_rwlock);
 
@@ -863,11 +1130,8 @@ _prop_array_internalize_continue(prop_stack_t stack,
 
 	array = *obj;
 
-	if (prop_array_add(array, child) == false) {
-		prop_object_release(child);
+	if (prop_array_add_objects_and_rel(array, &child, 1) == false)
 		goto bad;
-	}
-	prop_object_release(child);
 
 	/*
 	 * Current element is processed and added, look for next.
@@ -927,21 +1191,10 @@ prop_array_internalize(const char *xml)
 bool
 prop_array_externalize_to_file(prop_array_t array, const char *fname)
 {
-	char *xml;
-	bool rv;
-	int save_errno = 0;	/* XXXGCC -Wuninitialized [mips, ...] */
-
-	xml = prop_array_externalize(array);
-	if (xml == NULL)
+	if (! prop_object_is_array(array))
 		return (false);
-	rv = _prop_object_externalize_write_file(fname, xml, strlen(xml), false);
-	if (rv == false)
-		save_errno = errno;
-	_PROP_FREE(xml, M_TEMP);
-	if (rv == false)
-		errno = save_errno;
 
-	return (rv);
+	return (_prop_object_externalize_to_file(array, fname, false));
 }
 
 /*
@@ -257,10 +257,7 @@ TEMPLATE(_nocopy,const)
 bool
 prop_array_add_and_rel(prop_array_t array, prop_object_t po)
 {
-	bool ret;
 	if (po == NULL)
 		return false;
-	ret = prop_array_add(array, po);
-	prop_object_release(po);
-	return ret;
+	return prop_array_add_objects_and_rel(array, &po, 1);
 }
@@ -0,0 +1,655 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Binary representation of property lists.
+ *
+ * The layout (all integers are LEB128 varints unless noted):
+ *
+ *	header:		"\0PLB", version (1 byte), 3 reserved bytes,
+ *			total size in bytes (32 bit little endian)
+ *	string table:	count, then count * (length, bytes, NUL)
+ *	root object
+ *
+ * Every object starts with a one byte tag:
+ *
+ *	BIN_DICT	count, then count * (key string index, object)
+ *	BIN_ARRAY	count, then count * object
+ *	BIN_STRING	length, bytes, NUL
+ *	BIN_UINT	value
+ *	BIN_INT		zigzag encoded value
+ *	BIN_TRUE, BIN_FALSE
+ *	BIN_DATA	length, bytes
+ *
+ * The string table holds the dictionary keys, so every distinct key is
+ * stored once.  String values are inlined: they are mostly unique and
+ * deduplicating them made writing three times slower for a 10% smaller
+ * result before compression.  The leading NUL byte makes the XML parser
+ * reject a binary plist right away, so older readers fail safely.
+ */
+
+#include <prop/proplib.h>
+#include "prop_object_impl.h"
+
+#include <errno.h>
+
+#define BIN_MAGIC	"\0PLB"
+#define BIN_VERSION	1
+#define BIN_HDRSIZE	12
+#define BIN_MAXDEPTH	64
+
+#define BIN_DICT	0x01
+#define BIN_ARRAY	0x02
+#define BIN_STRING	0x03
+#define BIN_UINT	0x04
+#define BIN_INT		0x05
+#define BIN_TRUE	0x06
+#define BIN_FALSE	0x07
+#define BIN_DATA	0x08
+
+struct _bin_str {
+	const char *	bs_str;
+	size_t		bs_len;
+	uint32_t	bs_hash;	/* 0 means empty slot */
+	uint32_t	bs_idx;		/* assigned once all keys are known */
+};
+
+struct _bin_ext {
+	uint8_t *	be_buf;
+	size_t		be_len;
+	size_t		be_size;
+	bool		be_error;
+	struct _bin_str *be_strs;
+	size_t		be_nstrs;
+	size_t		be_strsize;	/* power of 2 */
+};
+
+struct _bin_int {
+	const uint8_t *	bi_p;
+	const uint8_t *	bi_end;
+	const char **	bi_tab;
+	size_t		bi_ntab;
+};
+
+static uint32_t
+_bin_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261U;
+
+	while (len--) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619U;
+	}
+	return h ? h : 1;
+}
+
+/*
+ * Externalize.
+ */
+static bool
+_bin_grow(struct _bin_ext *be, size_t len)
+{
+	uint8_t *nbuf;
+	size_t nsize;
+
+	if (be->be_error)
+		return false;
+	if (be->be_len + len <= be->be_size)
+		return true;
+
+	nsize = be->be_size ? be->be_size : 4096;
+	while (nsize < be->be_len + len)
+		nsize *= 2;
+	nbuf = _PROP_REALLOC(be->be_buf, nsize, M_TEMP);
+	if (nbuf == NULL) {
+		be->be_error = true;
+		return false;
+	}
+	be->be_buf = nbuf;
+	be->be_size = nsize;
+	return true;
+}
+
+static void
+_bin_put_byte(struct _bin_ext *be, uint8_t c)
+{
+	if (_bin_grow(be, 1))
+		be->be_buf[be->be_len++] = c;
+}
+
+static void
+_bin_put_bytes(struct _bin_ext *be, const void *p, size_t len)
+{
+	if (len && _bin_grow(be, len)) {
+		memcpy(be->be_buf + be->be_len, p, len);
+		be->be_len += len;
+	}
+}
+
+static void
+_bin_put_varint(struct _bin_ext *be, uint64_t v)
+{
+	if (!_bin_grow(be, 10))
+		return;
+	while (v >= 0x80) {
+		be->be_buf[be->be_len++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	be->be_buf[be->be_len++] = (uint8_t)v;
+}
+
+static bool
+_bin_str_grow(struct _bin_ext *be)
+{
+	struct _bin_str *nstrs;
+	size_t i, j, nsize;
+
+	nsize = be->be_strsize ? be->be_strsize * 2 : 64;
+	nstrs = _PROP_MALLOC(nsize * sizeof(*nstrs), M_TEMP);
+	if (nstrs == NULL) {
+		be->be_error = true;
+		return false;
+	}
+	memset(nstrs, 0, nsize * sizeof(*nstrs));
+	for (i = 0; i < be->be_strsize; i++) {
+		if (be->be_strs[i].bs_hash == 0)
+			continue;
+		j = be->be_strs[i].bs_hash & (nsize - 1);
+		while (nstrs[j].bs_hash)
+			j = (j + 1) & (nsize - 1);
+		nstrs[j] = be->be_strs[i];
+	}
+	if (be->be_strs)
+		_PROP_FREE(be->be_strs, M_TEMP);
+	be->be_strs = nstrs;
+	be->be_strsize = nsize;
+	return true;
+}
+
+/*
+ * Returns the string table entry for s, adding it if insert is set.
+ */
+static struct _bin_str *
+_bin_str_lookup(struct _bin_ext *be, const char *s, bool insert)
+{
+	struct _bin_str *bs;
+	uint32_t h;
+	size_t i, len, mask;
+
+	if (insert && (be->be_nstrs + 1) * 2 > be->be_strsize &&
+	    !_bin_str_grow(be))
+		return NULL;
+
+	len = strlen(s);
+	h = _bin_hash(s, len);
+	mask = be->be_strsize - 1;
+	for (i = h & mask;; i = (i + 1) & mask) {
+		bs = &be->be_strs[i];
+		if (bs->bs_hash == 0)
+			break;
+		if (bs->bs_hash == h && bs->bs_len == len &&
+		    memcmp(bs->bs_str, s, len) == 0)
+			return bs;
+	}
+	if (!insert)
+		return NULL;
+	bs->bs_str = s;
+	bs->bs_len = len;
+	bs->bs_hash = h;
+	be->be_nstrs++;
+	return bs;
+}
+
+static bool
+_bin_collect_keys(struct _bin_ext *be, prop_object_t obj, unsigned int depth)
+{
+	prop_object_iterator_t iter;
+	prop_object_t o;
+	const char *s;
+	bool rv = true;
+
+	if (depth > BIN_MAXDEPTH)
+		return false;
+
+	switch (prop_object_type(obj)) {
+	case PROP_TYPE_DICTIONARY:
+		if ((iter = prop_dictionary_iterator(obj)) == NULL)
+			return false;
+		while (rv && (o = prop_object_iterator_next(iter)) != NULL) {
+			s = prop_dictionary_keysym_cstring_nocopy(o);
+			if (_bin_str_lookup(be, s, true) == NULL) {
+				rv = false;
+				break;
+			}
+			rv = _bin_collect_keys(be,
+			    prop_dictionary_get_keysym(obj, o), depth + 1);
+		}
+		prop_object_iterator_release(iter);
+		return rv;
+	case PROP_TYPE_ARRAY:
+		if ((iter = prop_array_iterator(obj)) == NULL)
+			return false;
+		while (rv && (o = prop_object_iterator_next(iter)) != NULL)
+			rv = _bin_collect_keys(be, o, depth + 1);
+		prop_object_iterator_release(iter);
+		return rv;
+	default:
+		return true;
+	}
+}
+
+static void
+_bin_put_string(struct _bin_ext *be, const char *s, size_t len)
+{
+	_bin_put_varint(be, len);
+	_bin_put_bytes(be, s, len);
+	_bin_put_byte(be, '\0');
+}
+
+static bool
+_bin_put_object(struct _bin_ext *be, prop_object_t obj)
+{
+	struct _bin_str *bs;
+	prop_object_iterator_t iter;
+	prop_object_t o;
+	const char *s;
+	int64_t v;
+	bool rv = true;
+
+	switch (prop_object_type(obj)) {
+	case PROP_TYPE_DICTIONARY:
+		if ((iter = prop_dictionary_iterator(obj)) == NULL)
+			return false;
+		_bin_put_byte(be, BIN_DICT);
+		_bin_put_varint(be, prop_dictionary_count(obj));
+		while (rv && (o = prop_object_iterator_next(iter)) != NULL) {
+			bs = _bin_str_lookup(be,
+			    prop_dictionary_keysym_cstring_nocopy(o), false);
+			assert(bs != NULL);
+			_bin_put_varint(be, bs->bs_idx);
+			rv = _bin_put_object(be,
+			    prop_dictionary_get_keysym(obj, o));
+		}
+		prop_object_iterator_release(iter);
+		break;
+	case PROP_TYPE_ARRAY:
+		if ((iter = prop_array_iterator(obj)) == NULL)
+			return false;
+		_bin_put_byte(be, BIN_ARRAY);
+		_bin_put_varint(be, prop_array_count(obj));
+		while (rv && (o = prop_object_iterator_next(iter)) != NULL)
+			rv = _bin_put_object(be, o);
+		prop_object_iterator_release(iter);
+		break;
+	case PROP_TYPE_STRING:
+		if ((s = prop_string_cstring_nocopy(obj)) == NULL)
+			s = "";
+		_bin_put_byte(be, BIN_STRING);
+		_bin_put_string(be, s, prop_string_size(obj));
+		break;
+	case PROP_TYPE_NUMBER:
+		if (prop_number_unsigned(obj)) {
+			_bin_put_byte(be, BIN_UINT);
+			_bin_put_varint(be,
+			    prop_number_unsigned_integer_value(obj));
+		} else {
+			v = prop_number_integer_value(obj);
+			_bin_put_byte(be, BIN_INT);
+			_bin_put_varint(be,
+			    ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+		}
+		break;
+	case PROP_TYPE_BOOL:
+		_bin_put_byte(be, prop_bool_true(obj) ? BIN_TRUE : BIN_FALSE);
+		break;
+	case PROP_TYPE_DATA:
+		_bin_put_byte(be, BIN_DATA);
+		_bin_put_varint(be, prop_data_size(obj));
+		_bin_put_bytes(be, prop_data_data_nocopy(obj),
+		    prop_data_size(obj));
+		break;
+	default:
+		return false;
+	}
+	return rv && !be->be_error;
+}
+
+void *
+_prop_binary_externalize(prop_object_t obj, size_t *lenp)
+{
+	struct _bin_ext be;
+	struct _bin_str *bs;
+	size_t i;
+	uint32_t idx, size;
+
+	memset(&be, 0, sizeof(be));
+
+	/* First pass: collect the keys. */
+	if (!_bin_collect_keys(&be, obj, 0))
+		goto fail;
+
+	_bin_put_bytes(&be, BIN_MAGIC, 4);
+	_bin_put_byte(&be, BIN_VERSION);
+	_bin_put_bytes(&be, "\0\0\0\0\0\0\0", 7);
+
+	_bin_put_varint(&be, be.be_nstrs);
+	for (i = 0, idx = 0; i < be.be_strsize; i++) {
+		bs = &be.be_strs[i];
+		if (bs->bs_hash == 0)
+			continue;
+		bs->bs_idx = idx++;
+		_bin_put_string(&be, bs->bs_str, bs->bs_len);
+	}
+
+	/* Second pass: the objects. */
+	if (!_bin_put_object(&be, obj))
+		goto fail;
+	if (be.be_len > UINT32_MAX) {
+		errno = EFBIG;
+		goto fail;
+	}
+	size = (uint32_t)be.be_len;
+	be.be_buf[8] = size & 0xff;
+	be.be_buf[9] = (size >> 8) & 0xff;
+	be.be_buf[10] = (size >> 16) & 0xff;
+	be.be_buf[11] = (size >> 24) & 0xff;
+
+	if (be.be_strs)
+		_PROP_FREE(be.be_strs, M_TEMP);
+	*lenp = be.be_len;
+	return be.be_buf;
+
+fail:
+	if (be.be_error)
+		errno = ENOMEM;
+	if (be.be_strs)
+		_PROP_FREE(be.be_strs, M_TEMP);
+	if (be.be_buf)
+		_PROP_FREE(be.be_buf, M_TEMP);
+	return NULL;
+}
+
+/*
+ * Internalize.
+ */
+static bool
+_bin_get_varint(struct _bin_int *bi, uint64_t *vp)
+{
+	uint64_t v = 0;
+	unsigned int shift;
+
+	for (shift = 0; shift < 64; shift += 7) {
+		if (bi->bi_p >= bi->bi_end)
+			return false;
+		v |= (uint64_t)(*bi->bi_p & 0x7f) << shift;
+		if ((*bi->bi_p++ & 0x80) == 0) {
+			*vp = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Returns a NUL-terminated string of `len' bytes inside the buffer
+ * without embedded NULs.
+ */
+static const char *
+_bin_get_string(struct _bin_int *bi)
+{
+	const char *s;
+	uint64_t len;
+
+	if (!_bin_get_varint(bi, &len) ||
+	    len >= (uint64_t)(bi->bi_end - bi->bi_p))
+		return NULL;
+	s = (const char *)bi->bi_p;
+	if (s[len] != '\0' || memchr(s, '\0', len) != NULL)
+		return NULL;
+	bi->bi_p += len + 1;
+	return s;
+}
+
+static const char *
+_bin_get_key(struct _bin_int *bi)
+{
+	uint64_t idx;
+
+	if (!_bin_get_varint(bi, &idx) || idx >= bi->bi_ntab)
+		return NULL;
+	return bi->bi_tab[idx];
+}
+
+static prop_object_t
+_bin_get_object(struct _bin_int *bi, unsigned int depth)
+{
+	prop_object_t obj, o;
+	const char *s;
+	uint64_t n, v;
+	size_t avail;
+
+	if (depth > BIN_MAXDEPTH || bi->bi_p >= bi->bi_end)
+		return NULL;
+
+	switch (*bi->bi_p++) {
+	case BIN_DICT:
+		avail = (size_t)(bi->bi_end - bi->bi_p);
+		/* every entry takes at least two bytes */
+		if (!_bin_get_varint(bi, &n) || n > avail / 2)
+			return NULL;
+		obj = prop_dictionary_create_with_capacity((unsigned int)n);
+		if (obj == NULL)
+			return NULL;
+		while (n--) {
+			if ((s = _bin_get_key(bi)) == NULL ||
+			    (o = _bin_get_object(bi, depth + 1)) == NULL) {
+				prop_object_release(obj);
+				return NULL;
+			}
+			if (!prop_dictionary_set(obj, s, o)) {
+				prop_object_release(o);
+				prop_object_release(obj);
+				return NULL;
+			}
+			_prop_array_internalize_key(s, o);
+			prop_object_release(o);
+		}
+		return obj;
+	case BIN_ARRAY:
+		avail = (size_t)(bi->bi_end - bi->bi_p);
+		if (!_bin_get_varint(bi, &n) || n > avail)
+			return NULL;
+		obj = prop_array_create_with_capacity((unsigned int)n);
+		if (obj == NULL)
+			return NULL;
+		while (n--) {
+			if ((o = _bin_get_object(bi, depth + 1)) == NULL) {
+				prop_object_release(obj);
+				return NULL;
+			}
+			if (!prop_array_add_objects_and_rel(obj, &o, 1)) {
+				prop_object_release(obj);
+				return NULL;
+			}
+		}
+		return obj;
+	case BIN_STRING:
+		if ((s = _bin_get_string(bi)) == NULL)
+			return NULL;
+		return _prop_string_create_internalized(s, strlen(s));
+	case BIN_UINT:
+		if (!_bin_get_varint(bi, &v))
+			return NULL;
+		return prop_number_create_unsigned_integer(v);
+	case BIN_INT:
+		if (!_bin_get_varint(bi, &v))
+			return NULL;
+		return prop_number_create_integer(
+		    (int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+	case BIN_TRUE:
+		return prop_bool_create(true);
+	case BIN_FALSE:
+		return prop_bool_create(false);
+	case BIN_DATA:
+		if (!_bin_get_varint(bi, &n) ||
+		    n > (uint64_t)(bi->bi_end - bi->bi_p))
+			return NULL;
+		obj = prop_data_create_data(bi->bi_p, (size_t)n);
+		bi->bi_p += n;
+		return obj;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * _prop_binary_detect --
+ *	Returns the size of the binary plist at the start of buf, or 0
+ *	if buf does not contain a (complete) binary plist.
+ */
+size_t
+_prop_binary_detect(const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	size_t size;
+
+	if (buf == NULL || len < BIN_HDRSIZE || memcmp(p, BIN_MAGIC, 4))
+		return 0;
+	size = (size_t)p[8] | (size_t)p[9] << 8 |
+	    (size_t)p[10] << 16 | (size_t)p[11] << 24;
+	if (size < BIN_HDRSIZE || size > len)
+		return 0;
+	return size;
+}
+
+prop_object_t
+_prop_binary_internalize(const void *buf, size_t len)
+{
+	struct _bin_int bi;
+	prop_object_t obj = NULL;
+	const uint8_t *p = buf;
+	uint64_t ntab;
+	size_t i;
+
+	if ((len = _prop_binary_detect(buf, len)) == 0 ||
+	    p[4] != BIN_VERSION) {
+		errno = EINVAL;
+		return NULL;
+	}
+	bi.bi_p = p + BIN_HDRSIZE;
+	bi.bi_end = p + len;
+	bi.bi_tab = NULL;
+
+	/* every string takes at least two bytes */
+	if (!_bin_get_varint(&bi, &ntab) ||
+	    ntab > (uint64_t)(bi.bi_end - bi.bi_p) / 2)
+		goto out;
+	bi.bi_ntab = (size_t)ntab;
+	if (ntab) {
+		bi.bi_tab = _PROP_MALLOC(ntab * sizeof(*bi.bi_tab), M_TEMP);
+		if (bi.bi_tab == NULL)
+			return NULL;
+	}
+	for (i = 0; i < bi.bi_ntab; i++) {
+		if ((bi.bi_tab[i] = _bin_get_string(&bi)) == NULL)
+			goto out;
+	}
+	obj = _bin_get_object(&bi, 0);
+	if (obj != NULL && bi.bi_p != bi.bi_end) {
+		prop_object_release(obj);
+		obj = NULL;
+	} else if (obj != NULL)
+		_prop_object_internalized(len);
+out:
+	if (bi.bi_tab)
+		_PROP_FREE(bi.bi_tab, M_TEMP);
+	if (obj == NULL)
+		errno = EINVAL;
+	return obj;
+}
+
+/*
+ * prop_dictionary_externalize_binary --
+ *	Externalize a dictionary in binary form, the length of the
+ *	returned buffer is stored in lenp.
+ */
+void *
+prop_dictionary_externalize_binary(prop_dictionary_t pd, size_t *lenp)
+{
+	if (prop_object_type(pd) != PROP_TYPE_DICTIONARY) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return _prop_binary_externalize(pd, lenp);
+}
+
+/*
+ * prop_dictionary_externalize_binary_to_file --
+ *	Externalize a dictionary in binary form to the specified file.
+ */
+bool
+prop_dictionary_externalize_binary_to_file(prop_dictionary_t pd,
+    const char *fname)
+{
+	void *buf;
+	size_t len;
+	bool rv;
+	int save_errno = 0;
+
+	if ((buf = prop_dictionary_externalize_binary(pd, &len)) == NULL)
+		return false;
+	rv = _prop_object_externalize_write_file(fname, buf, len, false);
+	if (rv == false)
+		save_errno = errno;
+	_PROP_FREE(buf, M_TEMP);
+	if (rv == false)
+		errno = save_errno;
+
+	return rv;
+}
+
+/*
+ * prop_dictionary_internalize_buffer --
+ *	Create a dictionary from a buffer of len bytes containing either
+ *	its binary or XML representation; the latter must be NUL-terminated.
+ */
+prop_dictionary_t
+prop_dictionary_internalize_buffer(const void *buf, size_t len)
+{
+	prop_object_t obj;
+
+	if (buf == NULL)
+		return NULL;
+	if (len == 0 || *(const char *)buf != '\0')
+		return prop_dictionary_internalize(buf);
+
+	obj = _prop_binary_internalize(buf, len);
+	if (obj != NULL && prop_object_type(obj) != PROP_TYPE_DICTIONARY) {
+		prop_object_release(obj);
+		errno = EINVAL;
+		return NULL;
+	}
+	return obj;
+}
@@ -32,13 +32,13 @@
 #include <prop/prop_bool.h>
 #include "prop_object_impl.h"
 
-struct _prop_bool {
-	struct _prop_object	pb_obj;
-	bool		pb_value;
-};
-
-static struct _prop_bool _prop_bool_true;
-static struct _prop_bool _prop_bool_false;
+/*
+ * Booleans are tagged objects (see _PROP_TAGGED()): true and false
+ * are two constant pointers, so they are neither allocated nor
+ * reference counted.
+ */
+#define	_PROP_BOOL_TRUE		_PROP_TAG(1, _PROP_TAG_BOOL)
+#define	_PROP_BOOL_FALSE	_PROP_TAG(0, _PROP_TAG_BOOL)
 
 static _prop_object_free_rv_t
 		_prop_bool_free(prop_stack_t, prop_object_t *);
@@ -50,7 +50,7 @@ static _prop_object_equals_rv_t
 				  void **, void **,
 				  prop_object_t *, prop_object_t *);
 
-static const struct _prop_object_type _prop_object_type_bool = {
+const struct _prop_object_type _prop_object_type_bool = {
 	.pot_type	=	PROP_TYPE_BOOL,
 	.pot_free	=	_prop_bool_free,
 	.pot_extern	=	_prop_bool_externalize,
@@ -58,15 +58,15 @@ static const struct _prop_object_type _prop_object_type_bool = {
 };
 
 #define	prop_object_is_bool(x)		\
-	((x) != NULL && (x)->pb_obj.po_type == &_prop_object_type_bool)
+	((x) == _PROP_BOOL_TRUE || (x) == _PROP_BOOL_FALSE)
 
 /* ARGSUSED */
 static _prop_object_free_rv_t
 _prop_bool_free(prop_stack_t stack, prop_object_t *obj)
 {
 	/*
-	 * This should never happen as we "leak" our initial reference
-	 * count.
+	 * This should never happen as booleans are not reference
+	 * counted.
 	 */
 
 	/* XXX forced assertion failure? */
@@ -80,7 +80,7 @@ _prop_bool_externalize(struct _prop_object_externalize_context *ctx,
 	prop_bool_t pb = v;
 
 	return (_prop_object_externalize_empty_tag(ctx,
-	    pb->pb_value ? "true" : "false"));
+	    pb == _PROP_BOOL_TRUE ? "true" : "false"));
 }
 
 /* ARGSUSED */
@@ -97,8 +97,7 @@ _prop_bool_equals(prop_object_t v1, prop_object_t v2,
 		return (_PROP_OBJECT_EQUALS_FALSE);
 
 	/*
-	 * Since we only ever allocate one true and one false,
-	 * save ourselves a couple of memory operations.
+	 * There is only one true and one false.
 	 */
 	if (b1 == b2)
 		return (_PROP_OBJECT_EQUALS_TRUE);
@@ -106,35 +105,6 @@ _prop_bool_equals(prop_object_t v1, prop_object_t v2,
 		return (_PROP_OBJECT_EQUALS_FALSE);
 }
 
-_PROP_ONCE_DECL(_prop_bool_init_once)
-
-static int
-_prop_bool_init(void)
-{
-
-	_prop_object_init(&_prop_bool_true.pb_obj,
-	    &_prop_object_type_bool);
-	_prop_bool_true.pb_value = true;
-
-	_prop_object_init(&_prop_bool_false.pb_obj,
-	    &_prop_object_type_bool);
-	_prop_bool_false.pb_value = false;
-
-	return 0;
-}
-
-static prop_bool_t
-_prop_bool_alloc(bool val)
-{
-	prop_bool_t pb;
-
-	_PROP_ONCE_RUN(_prop_bool_init_once, _prop_bool_init);
-	pb = val ? &_prop_bool_true : &_prop_bool_false;
-	prop_object_retain(pb);
-
-	return (pb);
-}
-
 /*
  * prop_bool_create --
  *	Create a prop_bool_t and initialize it with the
@@ -144,7 +114,7 @@ prop_bool_t
 prop_bool_create(bool val)
 {
 
-	return (_prop_bool_alloc(val));
+	return (val ? _PROP_BOOL_TRUE : _PROP_BOOL_FALSE);
 }
 
 /*
@@ -159,10 +129,9 @@ prop_bool_copy(prop_bool_t opb)
 		return (NULL);
 
 	/*
-	 * Because we only ever allocate one true and one false, this
-	 * can be reduced to a simple retain operation.
+	 * Because there is only one true and one false, this is
+	 * the same object.
 	 */
-	prop_object_retain(opb);
 	return (opb);
 }
 
@@ -177,7 +146,7 @@ prop_bool_true(prop_bool_t pb)
 	if (! prop_object_is_bool(pb))
 		return (false);
 
-	return (pb->pb_value);
+	return (pb == _PROP_BOOL_TRUE);
 }
 
 /*
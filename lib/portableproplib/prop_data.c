@@ -50,10 +50,11 @@ struct _prop_data {
 
 #define	PD_F_NOCOPY		0x01
 
-_PROP_POOL_INIT(_prop_data_pool, sizeof(struct _prop_data), "propdata")
+_PROP_ARENA_POOL_INIT(_prop_data_pool, sizeof(struct _prop_data), "propdata")
 
 static _prop_object_free_rv_t
 		_prop_data_free(prop_stack_t, prop_object_t *);
+static size_t	_prop_data_size(prop_object_t);
 static bool	_prop_data_externalize(
 				struct _prop_object_externalize_context *,
 				void *);
@@ -67,10 +68,11 @@ static const struct _prop_object_type _prop_object_type_data = {
 	.pot_free	=	_prop_data_free,
 	.pot_extern	=	_prop_data_externalize,
 	.pot_equals	=	_prop_data_equals,
+	.pot_size	=	_prop_data_size,
 };
 
 #define	prop_object_is_data(x)		\
-	((x) != NULL && (x)->pd_obj.po_type == &_prop_object_type_data)
+	((x) != NULL && _prop_object_type_of(x) == &_prop_object_type_data)
 
 /* ARGSUSED */
 static _prop_object_free_rv_t
@@ -80,11 +82,23 @@ _prop_data_free(prop_stack_t stack, prop_object_t *obj)
 
 	if ((pd->pd_flags & PD_F_NOCOPY) == 0 && pd->pd_mutable != NULL)
 	    	_PROP_FREE(pd->pd_mutable, M_PROP_DATA);
-	_PROP_POOL_PUT(_prop_data_pool, pd);
+	_PROP_ARENA_PUT(_prop_data_pool, pd);
 
 	return (_PROP_OBJECT_FREE_DONE);
 }
 
+static size_t
+_prop_data_size(prop_object_t v)
+{
+	prop_data_t pd = v;
+	size_t size = _prop_pool_objsize(&_prop_data_pool);
+
+	if ((pd->pd_flags & PD_F_NOCOPY) == 0 && pd->pd_mutable != NULL)
+		size += pd->pd_size;
+
+	return (size);
+}
+
 static const char _prop_data_base64[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char _prop_data_pad64 = '=';
@@ -193,7 +207,7 @@ _prop_data_alloc(void)
 {
 	prop_data_t pd;
 
-	pd = _PROP_POOL_GET(_prop_data_pool);
+	pd = _PROP_ARENA_GET(_prop_data_pool);
 	if (pd != NULL) {
 		_prop_object_init(&pd->pd_obj, &_prop_object_type_data);
 
@@ -33,7 +33,6 @@
 #include <prop/prop_array.h>
 #include <prop/prop_dictionary.h>
 #include <prop/prop_string.h>
-#include "prop_rb_impl.h"
 
 #include <errno.h>
 
@@ -41,9 +40,21 @@
  * We implement these like arrays, but we keep them sorted by key.
  * This allows us to binary-search as well as keep externalized output
  * sane-looking for human eyes.
+ *
+ * Hashed dictionaries (prop_dictionary_create_hashed()) additionally
+ * keep an open addressing hash table of indexes into the array, so that
+ * lookups and inserts do not depend on the number of keys.  New keys are
+ * appended and the array is only sorted again when the dictionary is
+ * iterated, compared or externalized.
+ *
+ * Copies share the array and hash table of the original dictionary,
+ * which are then read-only: pd_shared counts the dictionaries sharing
+ * them, and the first one to be modified takes its own copy (see
+ * _prop_dictionary_unshare()).  Shared arrays are always sorted.
  */
 
 #define	EXPAND_STEP		16
+#define	HASH_MINSIZE		64
 
 /*
  * prop_dictionary_keysym_t is allocated with space at the end to hold the
@@ -59,7 +70,8 @@
 struct _prop_dictionary_keysym {
 	struct _prop_object		pdk_obj;
 	size_t				pdk_size;
-	struct rb_node			pdk_link;
+	uint32_t			pdk_hash;
+	prop_dictionary_keysym_t	pdk_next;
 	char 				pdk_key[1];
 	/* actually variable length */
 };
@@ -88,17 +100,24 @@ struct _prop_dictionary {
 	unsigned int		pd_count;
 	int			pd_flags;
 
+	unsigned int		*pd_hash;	/* array index + 1, 0 is free */
+	unsigned int		pd_hashsize;	/* power of 2 */
+	uint32_t		*pd_shared;	/* sharers of array and hash */
+
 	uint32_t		pd_version;
 };
 
 #define	PD_F_IMMUTABLE		0x01	/* dictionary is immutable */
+#define	PD_F_HASHED		0x02	/* lookups use pd_hash */
+#define	PD_F_UNSORTED		0x04	/* pd_array is not sorted by key */
 
-_PROP_POOL_INIT(_prop_dictionary_pool, sizeof(struct _prop_dictionary),
-		"propdict")
+_PROP_ARENA_POOL_INIT(_prop_dictionary_pool,
+		sizeof(struct _prop_dictionary), "propdict")
 
 static _prop_object_free_rv_t
 		_prop_dictionary_free(prop_stack_t, prop_object_t *);
 static void	_prop_dictionary_emergency_free(prop_object_t);
+static size_t	_prop_dictionary_size(prop_object_t);
 static bool	_prop_dictionary_externalize(
 				struct _prop_object_externalize_context *,
 				void *);
@@ -117,8 +136,7 @@ static prop_object_t
 static prop_object_t
 		_prop_dictionary_get(prop_dictionary_t, const char *, bool);
 
-static void _prop_dictionary_lock(void);
-static void _prop_dictionary_unlock(void);
+static void _prop_dictionary_sort(prop_dictionary_t);
 
 static const struct _prop_object_type _prop_object_type_dictionary = {
 	.pot_type		=	PROP_TYPE_DICTIONARY,
@@ -127,12 +145,12 @@ static const struct _prop_object_type _prop_object_type_dictionary = {
 	.pot_extern		=	_prop_dictionary_externalize,
 	.pot_equals		=	_prop_dictionary_equals,
 	.pot_equals_finish	=	_prop_dictionary_equals_finish,
-	.pot_lock 	        =       _prop_dictionary_lock,
-	.pot_unlock 	        =       _prop_dictionary_unlock,		
+	.pot_size		=	_prop_dictionary_size,
 };
 
 static _prop_object_free_rv_t
 		_prop_dict_keysym_free(prop_stack_t, prop_object_t *);
+static size_t	_prop_dict_keysym_size(prop_object_t);
 static bool	_prop_dict_keysym_externalize(
 				struct _prop_object_externalize_context *,
 				void *);
@@ -146,15 +164,37 @@ static const struct _prop_object_type _prop_object_type_dict_keysym = {
 	.pot_free	=	_prop_dict_keysym_free,
 	.pot_extern	=	_prop_dict_keysym_externalize,
 	.pot_equals	=	_prop_dict_keysym_equals,
+	.pot_size	=	_prop_dict_keysym_size,
 };
 
 #define	prop_object_is_dictionary(x)		\
-	((x) != NULL && (x)->pd_obj.po_type == &_prop_object_type_dictionary)
+	((x) != NULL &&							\
+	 _prop_object_type_of(x) == &_prop_object_type_dictionary)
 #define	prop_object_is_dictionary_keysym(x)	\
-	((x) != NULL && (x)->pdk_obj.po_type == &_prop_object_type_dict_keysym)
+	((x) != NULL &&							\
+	 _prop_object_type_of(x) == &_prop_object_type_dict_keysym)
 
 #define	prop_dictionary_is_immutable(x)		\
 				(((x)->pd_flags & PD_F_IMMUTABLE) != 0)
+#define	prop_dictionary_is_hashed(x)		\
+				(((x)->pd_flags & PD_F_HASHED) != 0)
+#define	prop_dictionary_is_sorted(x)		\
+				(((x)->pd_flags & PD_F_UNSORTED) == 0)
+
+/*
+ * Immutable dictionaries are never modified again, so readers don't
+ * need to take the lock; the flag is only set with the lock held.
+ */
+#define	_PROP_DICT_RDLOCK(pd)						\
+	do {								\
+		if (!prop_dictionary_is_immutable(pd))			\
+			_PROP_RWLOCK_RDLOCK((pd)->pd_rwlock);		\
+	} while (/*CONSTCOND*/0)
+#define	_PROP_DICT_RDUNLOCK(pd)						\
+	do {								\
+		if (!prop_dictionary_is_immutable(pd))			\
+			_PROP_RWLOCK_UNLOCK((pd)->pd_rwlock);		\
+	} while (/*CONSTCOND*/0)
 
 struct _prop_dictionary_iterator {
 	struct _prop_object_iterator pdi_base;
@@ -165,49 +205,35 @@ struct _prop_dictionary_iterator {
  * Dictionary key symbols are immutable, and we are likely to have many
  * duplicated key symbols.  So, to save memory, we unique'ify key symbols
  * so we only have to have one copy of each string.
+ *
+ * They are interned in a hash table split in shards with their own lock,
+ * so that dictionaries internalized by several threads rarely contend:
+ * the high bits of the key hash pick the shard, the low bits the bucket.
  */
-
-static int
-/*ARGSUSED*/
-_prop_dict_keysym_rb_compare_nodes(void *ctx _PROP_ARG_UNUSED,
-				   const void *n1, const void *n2)
-{
-	const struct _prop_dictionary_keysym *pdk1 = n1;
-	const struct _prop_dictionary_keysym *pdk2 = n2;
-
-	return strcmp(pdk1->pdk_key, pdk2->pdk_key);
-}
-
-static int
-/*ARGSUSED*/
-_prop_dict_keysym_rb_compare_key(void *ctx _PROP_ARG_UNUSED,
-				 const void *n, const void *v)
-{
-	const struct _prop_dictionary_keysym *pdk = n;
-	const char *cp = v;
-
-	return strcmp(pdk->pdk_key, cp);
-}
-
-static const rb_tree_ops_t _prop_dict_keysym_rb_tree_ops = {
-	.rbto_compare_nodes = _prop_dict_keysym_rb_compare_nodes,
-	.rbto_compare_key = _prop_dict_keysym_rb_compare_key,
-	.rbto_node_offset = offsetof(struct _prop_dictionary_keysym, pdk_link),
-	.rbto_context = NULL
+#define	PDK_SHARD_SHIFT		5
+#define	PDK_NSHARDS		(1U << PDK_SHARD_SHIFT)
+#define	PDK_SHARD(h)		(&_prop_dict_keysym_shards[		\
+				    (h) >> (32 - PDK_SHARD_SHIFT)])
+#define	PDK_SHARD_MINSIZE	64
+
+struct _prop_dict_keysym_shard {
+	_PROP_MUTEX_DECL(pks_mutex)
+	prop_dictionary_keysym_t *pks_hash;
+	unsigned int		pks_size;	/* power of 2 */
+	unsigned int		pks_count;
 };
 
-static struct rb_tree _prop_dict_keysym_tree;
+static struct _prop_dict_keysym_shard _prop_dict_keysym_shards[PDK_NSHARDS];
 
 _PROP_ONCE_DECL(_prop_dict_init_once)
-_PROP_MUTEX_DECL_STATIC(_prop_dict_keysym_tree_mutex)
 
 static int
 _prop_dict_init(void)
 {
+	unsigned int i;
 
-	_PROP_MUTEX_INIT(_prop_dict_keysym_tree_mutex);
-	_prop_rb_tree_init(&_prop_dict_keysym_tree,
-			   &_prop_dict_keysym_rb_tree_ops);
+	for (i = 0; i < PDK_NSHARDS; i++)
+		_PROP_MUTEX_INIT(_prop_dict_keysym_shards[i].pks_mutex);
 	return 0;
 }
 
@@ -229,14 +255,35 @@ _prop_dict_keysym_put(prop_dictionary_keysym_t pdk)
 static _prop_object_free_rv_t
 _prop_dict_keysym_free(prop_stack_t stack, prop_object_t *obj)
 {
-	prop_dictionary_keysym_t pdk = *obj;
-
-	_prop_rb_tree_remove_node(&_prop_dict_keysym_tree, pdk);
+	prop_dictionary_keysym_t pdk = *obj, *pdkp;
+	struct _prop_dict_keysym_shard *pks = PDK_SHARD(pdk->pdk_hash);
+
+	_PROP_MUTEX_LOCK(pks->pks_mutex);
+	pdkp = &pks->pks_hash[pdk->pdk_hash & (pks->pks_size - 1)];
+	while (*pdkp != pdk) {
+		_PROP_ASSERT(*pdkp != NULL);
+		pdkp = &(*pdkp)->pdk_next;
+	}
+	*pdkp = pdk->pdk_next;
+	pks->pks_count--;
+	_PROP_MUTEX_UNLOCK(pks->pks_mutex);
 	_prop_dict_keysym_put(pdk);
 
 	return _PROP_OBJECT_FREE_DONE;
 }
 
+static size_t
+_prop_dict_keysym_size(prop_object_t v)
+{
+	prop_dictionary_keysym_t pdk = v;
+
+	if (pdk->pdk_size <= PDK_SIZE_16)
+		return (_prop_pool_objsize(&_prop_dictionary_keysym16_pool));
+	else if (pdk->pdk_size <= PDK_SIZE_32)
+		return (_prop_pool_objsize(&_prop_dictionary_keysym32_pool));
+	return (_prop_pool_objsize(&_prop_dictionary_keysym128_pool));
+}
+
 static bool
 _prop_dict_keysym_externalize(struct _prop_object_externalize_context *ctx,
 			     void *v)
@@ -275,29 +322,114 @@ _prop_dict_keysym_equals(prop_object_t v1, prop_object_t v2,
 		return _PROP_OBJECT_EQUALS_FALSE;
 }
 
+/*
+ * FNV-1a, computed once per keysym and for every lookup by string
+ * in a hashed dictionary.
+ */
+static uint32_t
+_prop_dict_hash(const char *key)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *key != '\0'; key++) {
+		h ^= (unsigned char)*key;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+/*
+ * Return the keysym for key, retained, if it is in the shard.  Keysyms
+ * whose last reference was just dropped stay in the table until they
+ * are freed, those must not be revived.
+ */
+static prop_dictionary_keysym_t
+_prop_dict_keysym_find(struct _prop_dict_keysym_shard *pks, const char *key,
+		       uint32_t hash)
+{
+	prop_dictionary_keysym_t pdk;
+	uint32_t ncnt;
+
+	/*
+	 * Shard must be LOCKED.
+	 */
+
+	if (pks->pks_size == 0)
+		return (NULL);
+
+	for (pdk = pks->pks_hash[hash & (pks->pks_size - 1)]; pdk != NULL;
+	     pdk = pdk->pdk_next) {
+		if (pdk->pdk_hash != hash || strcmp(pdk->pdk_key, key) != 0)
+			continue;
+		_PROP_ATOMIC_INC32_NZ(&pdk->pdk_obj.po_refcnt, ncnt);
+		if (ncnt != 0)
+			return (pdk);
+	}
+	return (NULL);
+}
+
+static bool
+_prop_dict_keysym_insert(struct _prop_dict_keysym_shard *pks,
+			 prop_dictionary_keysym_t pdk)
+{
+	prop_dictionary_keysym_t *nhash, opdk, npdk;
+	unsigned int i, nsize, b;
+
+	/*
+	 * Shard must be LOCKED.
+	 */
+
+	if (pks->pks_count >= pks->pks_size) {
+		nsize = pks->pks_size ? pks->pks_size * 2 : PDK_SHARD_MINSIZE;
+		nhash = _PROP_CALLOC(nsize * sizeof(*nhash), M_PROP_DICT);
+		if (nhash == NULL)
+			return (false);
+		for (i = 0; i < pks->pks_size; i++) {
+			for (opdk = pks->pks_hash[i]; opdk != NULL;
+			     opdk = npdk) {
+				npdk = opdk->pdk_next;
+				b = opdk->pdk_hash & (nsize - 1);
+				opdk->pdk_next = nhash[b];
+				nhash[b] = opdk;
+			}
+		}
+		if (pks->pks_hash != NULL)
+			_PROP_FREE(pks->pks_hash, M_PROP_DICT);
+		pks->pks_hash = nhash;
+		pks->pks_size = nsize;
+	}
+
+	b = pdk->pdk_hash & (pks->pks_size - 1);
+	pdk->pdk_next = pks->pks_hash[b];
+	pks->pks_hash[b] = pdk;
+	pks->pks_count++;
+	return (true);
+}
+
 static prop_dictionary_keysym_t
 _prop_dict_keysym_alloc(const char *key)
 {
-	prop_dictionary_keysym_t opdk, pdk, rpdk;
+	struct _prop_dict_keysym_shard *pks;
+	prop_dictionary_keysym_t opdk, pdk;
+	uint32_t hash;
 	size_t size;
 
 	_PROP_ONCE_RUN(_prop_dict_init_once, _prop_dict_init);
 
 	/*
-	 * Check to see if this already exists in the tree.  If it does,
+	 * Check to see if this already exists in the table.  If it does,
 	 * we just retain it and return it.
 	 */
-	_PROP_MUTEX_LOCK(_prop_dict_keysym_tree_mutex);
-	opdk = _prop_rb_tree_find(&_prop_dict_keysym_tree, key);
-	if (opdk != NULL) {
-		prop_object_retain(opdk);
-		_PROP_MUTEX_UNLOCK(_prop_dict_keysym_tree_mutex);
+	hash = _prop_dict_hash(key);
+	pks = PDK_SHARD(hash);
+	_PROP_MUTEX_LOCK(pks->pks_mutex);
+	opdk = _prop_dict_keysym_find(pks, key, hash);
+	_PROP_MUTEX_UNLOCK(pks->pks_mutex);
+	if (opdk != NULL)
 		return (opdk);
-	}
-	_PROP_MUTEX_UNLOCK(_prop_dict_keysym_tree_mutex);
 
 	/*
-	 * Not in the tree.  Create it now.
+	 * Not in the table.  Create it now.
 	 */
 
 	size = sizeof(*pdk) + strlen(key) /* pdk_key[1] covers the NUL */;
@@ -318,23 +450,25 @@ _prop_dict_keysym_alloc(const char *key)
 
 	strcpy(pdk->pdk_key, key);
 	pdk->pdk_size = size;
+	pdk->pdk_hash = hash;
 
 	/*
 	 * We dropped the mutex when we allocated the new object, so
-	 * we have to check again if it is in the tree.
+	 * we have to check again if it is in the table.
 	 */
-	_PROP_MUTEX_LOCK(_prop_dict_keysym_tree_mutex);
-	opdk = _prop_rb_tree_find(&_prop_dict_keysym_tree, key);
+	_PROP_MUTEX_LOCK(pks->pks_mutex);
+	opdk = _prop_dict_keysym_find(pks, key, hash);
+	if (opdk == NULL && !_prop_dict_keysym_insert(pks, pdk)) {
+		_PROP_MUTEX_UNLOCK(pks->pks_mutex);
+		_prop_dict_keysym_put(pdk);
+		return (NULL);
+	}
+	_PROP_MUTEX_UNLOCK(pks->pks_mutex);
 	if (opdk != NULL) {
-		prop_object_retain(opdk);
-		_PROP_MUTEX_UNLOCK(_prop_dict_keysym_tree_mutex);
 		_prop_dict_keysym_put(pdk);
 		return (opdk);
 	}
-	rpdk = _prop_rb_tree_insert_node(&_prop_dict_keysym_tree, pdk);
-	_PROP_ASSERT(rpdk == pdk);
-	_PROP_MUTEX_UNLOCK(_prop_dict_keysym_tree_mutex);
-	return (rpdk);
+	return (pdk);
 }
 
 static _prop_object_free_rv_t
@@ -348,14 +482,30 @@ _prop_dictionary_free(prop_stack_t stack, prop_object_t *obj)
 	_PROP_ASSERT((pd->pd_capacity == 0 && pd->pd_array == NULL) ||
 		     (pd->pd_capacity != 0 && pd->pd_array != NULL));
 
+	/* The storage is released by the last dictionary sharing it. */
+	if (pd->pd_shared != NULL) {
+		uint32_t ocnt;
+
+		_PROP_ATOMIC_DEC32_NV(pd->pd_shared, ocnt);
+		if (ocnt != 0) {
+			_PROP_RWLOCK_DESTROY(pd->pd_rwlock);
+			_PROP_ARENA_PUT(_prop_dictionary_pool, pd);
+			return (_PROP_OBJECT_FREE_DONE);
+		}
+		_PROP_FREE(pd->pd_shared, M_PROP_DICT);
+		pd->pd_shared = NULL;
+	}
+
 	/* The empty dictorinary is easy, handle that first. */
 	if (pd->pd_count == 0) {
 		if (pd->pd_array != NULL)
 			_PROP_FREE(pd->pd_array, M_PROP_DICT);
+		if (pd->pd_hash != NULL)
+			_PROP_FREE(pd->pd_hash, M_PROP_DICT);
 
 		_PROP_RWLOCK_DESTROY(pd->pd_rwlock);
 
-		_PROP_POOL_PUT(_prop_dictionary_pool, pd);
+		_PROP_ARENA_PUT(_prop_dictionary_pool, pd);
 
 		return (_PROP_OBJECT_FREE_DONE);
 	}
@@ -389,21 +539,6 @@ _prop_dictionary_free(prop_stack_t stack, prop_object_t *obj)
 }
 
 
-static void
-_prop_dictionary_lock(void)
-{
-
-	/* XXX: once necessary or paranoia? */
-	_PROP_ONCE_RUN(_prop_dict_init_once, _prop_dict_init);
-	_PROP_MUTEX_LOCK(_prop_dict_keysym_tree_mutex);
-}
-
-static void
-_prop_dictionary_unlock(void)
-{
-	_PROP_MUTEX_UNLOCK(_prop_dict_keysym_tree_mutex);
-}
-
 static void
 _prop_dictionary_emergency_free(prop_object_t obj)
 {
@@ -418,6 +553,24 @@ _prop_dictionary_emergency_free(prop_object_t obj)
 	prop_object_release(pdk);
 }
 
+static size_t
+_prop_dictionary_size(prop_object_t v)
+{
+	prop_dictionary_t pd = v;
+	size_t size;
+
+	_PROP_DICT_RDLOCK(pd);
+	size = _prop_pool_objsize(&_prop_dictionary_pool) +
+	    pd->pd_capacity * sizeof(*pd->pd_array);
+	if (pd->pd_hash != NULL)
+		size += pd->pd_hashsize * sizeof(*pd->pd_hash);
+	if (pd->pd_shared != NULL)
+		size += sizeof(*pd->pd_shared);
+	_PROP_DICT_RDUNLOCK(pd);
+
+	return (size);
+}
+
 static bool
 _prop_dictionary_externalize(struct _prop_object_externalize_context *ctx,
 			     void *v)
@@ -429,10 +582,11 @@ _prop_dictionary_externalize(struct _prop_object_externalize_context *ctx,
 	unsigned int i;
 	bool rv = false;
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	_prop_dictionary_sort(pd);
+	_PROP_DICT_RDLOCK(pd);
 
 	if (pd->pd_count == 0) {
-		_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+		_PROP_DICT_RDUNLOCK(pd);
 		return (_prop_object_externalize_empty_tag(ctx, "dict"));
 	}
 
@@ -455,7 +609,7 @@ _prop_dictionary_externalize(struct _prop_object_externalize_context *ctx,
 		    _prop_object_externalize_append_encoded_cstring(ctx,
 						   pdk->pdk_key) == false ||
 		    _prop_object_externalize_end_tag(ctx, "key") == false ||
-		    (*po->po_type->pot_extern)(ctx, po) == false) {
+		    (*_prop_object_type_of(po)->pot_extern)(ctx, po) == false) {
 			prop_object_iterator_release(pi);
 			goto out;
 		}
@@ -474,7 +628,7 @@ _prop_dictionary_externalize(struct _prop_object_externalize_context *ctx,
 	rv = true;
 
  out:
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 	return (rv);
 }
 
@@ -497,6 +651,8 @@ _prop_dictionary_equals(prop_object_t v1, prop_object_t v2,
 	idx = (uintptr_t)*stored_pointer1;
 
 	if (idx == 0) {
+		_prop_dictionary_sort(dict1);
+		_prop_dictionary_sort(dict2);
 		if ((uintptr_t)dict1 < (uintptr_t)dict2) {
 			_PROP_RWLOCK_RDLOCK(dict1->pd_rwlock);
 			_PROP_RWLOCK_RDLOCK(dict2->pd_rwlock);
@@ -504,6 +660,15 @@ _prop_dictionary_equals(prop_object_t v1, prop_object_t v2,
 			_PROP_RWLOCK_RDLOCK(dict2->pd_rwlock);
 			_PROP_RWLOCK_RDLOCK(dict1->pd_rwlock);
 		}
+		/*
+		 * A copy that was not modified still shares the storage
+		 * of the original: there is nothing to compare.
+		 */
+		if (dict1->pd_shared != NULL &&
+		    dict1->pd_shared == dict2->pd_shared) {
+			rv = _PROP_OBJECT_EQUALS_TRUE;
+			goto out;
+		}
 	}
 
 	if (dict1->pd_count != dict2->pd_count)
@@ -554,7 +719,7 @@ _prop_dictionary_alloc(unsigned int capacity)
 	} else
 		array = NULL;
 
-	pd = _PROP_POOL_GET(_prop_dictionary_pool);
+	pd = _PROP_ARENA_GET(_prop_dictionary_pool);
 	if (pd != NULL) {
 		_prop_object_init(&pd->pd_obj, &_prop_object_type_dictionary);
 
@@ -563,6 +728,9 @@ _prop_dictionary_alloc(unsigned int capacity)
 		pd->pd_capacity = capacity;
 		pd->pd_count = 0;
 		pd->pd_flags = 0;
+		pd->pd_hash = NULL;
+		pd->pd_hashsize = 0;
+		pd->pd_shared = NULL;
 
 		pd->pd_version = 0;
 	} else if (array != NULL)
@@ -596,6 +764,196 @@ _prop_dictionary_expand(prop_dictionary_t pd, unsigned int capacity)
 	return (true);
 }
 
+/*
+ * Hash table of hashed dictionaries: linear probing, the table is kept
+ * at most half full.  Dictionary must be WRITE-LOCKED.
+ */
+static unsigned int
+_prop_dict_hash_size(unsigned int count)
+{
+	unsigned int size = HASH_MINSIZE;
+
+	while (size < count * 2)
+		size <<= 1;
+
+	return (size);
+}
+
+static void
+_prop_dict_hash_insert(prop_dictionary_t pd, unsigned int idx)
+{
+	unsigned int mask = pd->pd_hashsize - 1, i;
+
+	i = pd->pd_array[idx].pde_key->pdk_hash & mask;
+	while (pd->pd_hash[i] != 0)
+		i = (i + 1) & mask;
+	pd->pd_hash[i] = idx + 1;
+}
+
+static void
+_prop_dict_hash_reindex(prop_dictionary_t pd)
+{
+	unsigned int idx;
+
+	memset(pd->pd_hash, 0, pd->pd_hashsize * sizeof(*pd->pd_hash));
+	for (idx = 0; idx < pd->pd_count; idx++)
+		_prop_dict_hash_insert(pd, idx);
+}
+
+static bool
+_prop_dict_hash_rebuild(prop_dictionary_t pd, unsigned int size)
+{
+	unsigned int *hash;
+
+	hash = _PROP_CALLOC(size * sizeof(*hash), M_PROP_DICT);
+	if (hash == NULL)
+		return (false);
+	if (pd->pd_hash != NULL)
+		_PROP_FREE(pd->pd_hash, M_PROP_DICT);
+	pd->pd_hash = hash;
+	pd->pd_hashsize = size;
+	_prop_dict_hash_reindex(pd);
+
+	return (true);
+}
+
+static unsigned int
+_prop_dict_hash_slot(prop_dictionary_t pd, unsigned int idx)
+{
+	unsigned int mask = pd->pd_hashsize - 1, i;
+
+	i = pd->pd_array[idx].pde_key->pdk_hash & mask;
+	while (pd->pd_hash[i] != idx + 1) {
+		_PROP_ASSERT(pd->pd_hash[i] != 0);
+		i = (i + 1) & mask;
+	}
+	return (i);
+}
+
+static void
+_prop_dict_hash_remove(prop_dictionary_t pd, unsigned int idx)
+{
+	unsigned int mask = pd->pd_hashsize - 1, i, j, k;
+
+	/*
+	 * Move back the following entries of the probe sequence that
+	 * would become unreachable once the slot is freed.
+	 */
+	i = _prop_dict_hash_slot(pd, idx);
+	for (j = (i + 1) & mask; pd->pd_hash[j] != 0; j = (j + 1) & mask) {
+		k = pd->pd_array[pd->pd_hash[j] - 1].pde_key->pdk_hash & mask;
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		pd->pd_hash[i] = pd->pd_hash[j];
+		i = j;
+	}
+	pd->pd_hash[i] = 0;
+}
+
+/*
+ * _prop_dictionary_unshare --
+ *	Give a dictionary sharing its storage with copies its own array,
+ *	with room for capacity entries, and hash table before modifying
+ *	them.  Dictionary must be WRITE-LOCKED.
+ */
+static bool
+_prop_dictionary_unshare(prop_dictionary_t pd, unsigned int capacity)
+{
+	struct _prop_dict_entry *array, *oarray = pd->pd_array;
+	unsigned int *hash = NULL, *ohash = pd->pd_hash, idx;
+	uint32_t ocnt;
+
+	if (pd->pd_shared == NULL)
+		return (true);
+
+	/* Nobody else can share it anymore, it is ours. */
+	if (*pd->pd_shared == 1) {
+		_PROP_FREE(pd->pd_shared, M_PROP_DICT);
+		pd->pd_shared = NULL;
+		return (true);
+	}
+
+	if (capacity < pd->pd_capacity)
+		capacity = pd->pd_capacity;
+	array = _PROP_MALLOC(capacity * sizeof(*array), M_PROP_DICT);
+	if (array == NULL)
+		return (false);
+	if (ohash != NULL) {
+		hash = _PROP_MALLOC(pd->pd_hashsize * sizeof(*hash),
+		    M_PROP_DICT);
+		if (hash == NULL) {
+			_PROP_FREE(array, M_PROP_DICT);
+			return (false);
+		}
+		memcpy(hash, ohash, pd->pd_hashsize * sizeof(*hash));
+	}
+	memcpy(array, oarray, pd->pd_count * sizeof(*array));
+	for (idx = 0; idx < pd->pd_count; idx++) {
+		prop_object_retain(array[idx].pde_key);
+		prop_object_retain(array[idx].pde_objref);
+	}
+
+	/* The other sharers may have let it go meanwhile. */
+	_PROP_ATOMIC_DEC32_NV(pd->pd_shared, ocnt);
+	if (ocnt == 0) {
+		for (idx = 0; idx < pd->pd_count; idx++) {
+			prop_object_release(oarray[idx].pde_key);
+			prop_object_release(oarray[idx].pde_objref);
+		}
+		_PROP_FREE(oarray, M_PROP_DICT);
+		if (ohash != NULL)
+			_PROP_FREE(ohash, M_PROP_DICT);
+		_PROP_FREE(pd->pd_shared, M_PROP_DICT);
+	}
+	pd->pd_array = array;
+	pd->pd_capacity = capacity;
+	pd->pd_hash = hash;
+	pd->pd_shared = NULL;
+
+	return (true);
+}
+
+static int
+_prop_dict_entry_compare(const void *v1, const void *v2)
+{
+	const struct _prop_dict_entry *pde1 = v1, *pde2 = v2;
+
+	return strcmp(pde1->pde_key->pdk_key, pde2->pde_key->pdk_key);
+}
+
+static void
+_prop_dictionary_sort_locked(prop_dictionary_t pd)
+{
+
+	/*
+	 * Dictionary must be WRITE-LOCKED.
+	 */
+
+	if (!prop_dictionary_is_sorted(pd)) {
+		_PROP_ASSERT(pd->pd_shared == NULL);
+		qsort(pd->pd_array, pd->pd_count, sizeof(*pd->pd_array),
+		    _prop_dict_entry_compare);
+		_prop_dict_hash_reindex(pd);
+		pd->pd_flags &= ~PD_F_UNSORTED;
+	}
+}
+
+static void
+_prop_dictionary_sort(prop_dictionary_t pd)
+{
+
+	/*
+	 * Dictionary must be UNLOCKED.
+	 */
+
+	if (prop_dictionary_is_sorted(pd))
+		return;
+
+	_PROP_RWLOCK_WRLOCK(pd->pd_rwlock);
+	_prop_dictionary_sort_locked(pd);
+	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+}
+
 static prop_object_t
 _prop_dictionary_iterator_next_object_locked(void *v)
 {
@@ -629,9 +987,9 @@ _prop_dictionary_iterator_next_object(void *v)
 
 	_PROP_ASSERT(prop_object_is_dictionary(pd));
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDLOCK(pd);
 	pdk = _prop_dictionary_iterator_next_object_locked(pdi);
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 	return (pdk);
 }
 
@@ -653,9 +1011,10 @@ _prop_dictionary_iterator_reset(void *v)
 	struct _prop_dictionary_iterator *pdi = v;
 	prop_dictionary_t pd _PROP_ARG_UNUSED = pdi->pdi_base.pi_obj;
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	_prop_dictionary_sort(pd);
+	_PROP_DICT_RDLOCK(pd);
 	_prop_dictionary_iterator_reset_locked(pdi);
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 }
 
 /*
@@ -680,41 +1039,83 @@ prop_dictionary_create_with_capacity(unsigned int capacity)
 	return (_prop_dictionary_alloc(capacity));
 }
 
+/*
+ * prop_dictionary_create_hashed --
+ *	Create a hashed dictionary with the capacity to store N objects.
+ *	Lookups and inserts in hashed dictionaries take constant time,
+ *	which is preferable for dictionaries with many keys.
+ */
+prop_dictionary_t
+prop_dictionary_create_hashed(unsigned int capacity)
+{
+	prop_dictionary_t pd;
+
+	pd = _prop_dictionary_alloc(capacity);
+	if (pd == NULL)
+		return (NULL);
+
+	if (!_prop_dict_hash_rebuild(pd, _prop_dict_hash_size(capacity))) {
+		prop_object_release(pd);
+		return (NULL);
+	}
+	pd->pd_flags |= PD_F_HASHED;
+
+	return (pd);
+}
+
 /*
  * prop_dictionary_copy --
- *	Copy a dictionary.  The new dictionary has an initial capacity equal
- *	to the number of objects stored int the original dictionary.  The new
- *	dictionary contains refrences to the original dictionary's objects,
- *	not copies of those objects (i.e. a shallow copy).
+ *	Copy a dictionary.  The new dictionary contains refrences to the
+ *	original dictionary's objects, not copies of those objects (i.e.
+ *	a shallow copy).  Both share the same storage until one of them
+ *	is modified, so copying takes constant time.
  */
 prop_dictionary_t
 prop_dictionary_copy(prop_dictionary_t opd)
 {
 	prop_dictionary_t pd;
-	prop_dictionary_keysym_t pdk;
-	prop_object_t po;
-	unsigned int idx;
 
 	if (! prop_object_is_dictionary(opd))
 		return (NULL);
 
-	_PROP_RWLOCK_RDLOCK(opd->pd_rwlock);
+	_PROP_RWLOCK_WRLOCK(opd->pd_rwlock);
 
-	pd = _prop_dictionary_alloc(opd->pd_count);
-	if (pd != NULL) {
-		for (idx = 0; idx < opd->pd_count; idx++) {
-			pdk = opd->pd_array[idx].pde_key;
-			po = opd->pd_array[idx].pde_objref;
+	pd = _prop_dictionary_alloc(0);
+	if (pd == NULL)
+		goto out;
 
-			prop_object_retain(pdk);
-			prop_object_retain(po);
+	if (opd->pd_count == 0) {
+		pd->pd_flags = opd->pd_flags;
+		if (prop_dictionary_is_hashed(opd) &&
+		    !_prop_dict_hash_rebuild(pd, opd->pd_hashsize)) {
+			prop_object_release(pd);
+			pd = NULL;
+		}
+		goto out;
+	}
 
-			pd->pd_array[idx].pde_key = pdk;
-			pd->pd_array[idx].pde_objref = po;
+	/* The shared array is never sorted again. */
+	_prop_dictionary_sort_locked(opd);
+	if (opd->pd_shared == NULL) {
+		opd->pd_shared = _PROP_MALLOC(sizeof(*opd->pd_shared),
+		    M_PROP_DICT);
+		if (opd->pd_shared == NULL) {
+			prop_object_release(pd);
+			pd = NULL;
+			goto out;
 		}
-		pd->pd_count = opd->pd_count;
-		pd->pd_flags = opd->pd_flags;
+		*opd->pd_shared = 1;
 	}
+	_PROP_ATOMIC_INC32(opd->pd_shared);
+
+	pd->pd_array = opd->pd_array;
+	pd->pd_capacity = opd->pd_capacity;
+	pd->pd_count = opd->pd_count;
+	pd->pd_hash = opd->pd_hash;
+	pd->pd_hashsize = opd->pd_hashsize;
+	pd->pd_shared = opd->pd_shared;
+	pd->pd_flags = opd->pd_flags;
+ out:
 	_PROP_RWLOCK_UNLOCK(opd->pd_rwlock);
 	return (pd);
 }
@@ -741,18 +1142,47 @@ prop_dictionary_copy_mutable(prop_dictionary_t opd)
 
 /*
  * prop_dictionary_make_immutable --
- *	Set the immutable flag on that dictionary.
+ *	Set the immutable flag on that dictionary.  Lookups and
+ *	iterators on immutable dictionaries don't take the lock.
  */
 void
 prop_dictionary_make_immutable(prop_dictionary_t pd)
 {
 
 	_PROP_RWLOCK_WRLOCK(pd->pd_rwlock);
-	if (prop_dictionary_is_immutable(pd) == false)
+	if (prop_dictionary_is_immutable(pd) == false) {
+		/* lock-free readers must never have to sort it */
+		_prop_dictionary_sort_locked(pd);
 		pd->pd_flags |= PD_F_IMMUTABLE;
+	}
 	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
 }
 
+/*
+ * prop_dictionary_make_hashed --
+ *	Switch the dictionary to constant time lookups and inserts,
+ *	see prop_dictionary_create_hashed().
+ */
+bool
+prop_dictionary_make_hashed(prop_dictionary_t pd)
+{
+	bool rv = true;
+
+	if (! prop_object_is_dictionary(pd))
+		return (false);
+
+	_PROP_RWLOCK_WRLOCK(pd->pd_rwlock);
+	if (!prop_dictionary_is_hashed(pd)) {
+		rv = _prop_dictionary_unshare(pd, 0) &&
+		    _prop_dict_hash_rebuild(pd,
+		    _prop_dict_hash_size(pd->pd_count));
+		if (rv)
+			pd->pd_flags |= PD_F_HASHED;
+	}
+	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	return (rv);
+}
+
 /*
  * prop_dictionary_count --
  *	Return the number of objects stored in the dictionary.
@@ -765,9 +1195,9 @@ prop_dictionary_count(prop_dictionary_t pd)
 	if (! prop_object_is_dictionary(pd))
 		return (0);
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDLOCK(pd);
 	rv = pd->pd_count;
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 
 	return (rv);
 }
@@ -788,7 +1218,9 @@ prop_dictionary_ensure_capacity(prop_dictionary_t pd, unsigned int capacity)
 
 	_PROP_RWLOCK_WRLOCK(pd->pd_rwlock);
 	if (capacity > pd->pd_capacity)
-		rv = _prop_dictionary_expand(pd, capacity);
+		rv = _prop_dictionary_unshare(pd, capacity) &&
+		    (capacity <= pd->pd_capacity ||
+		    _prop_dictionary_expand(pd, capacity));
 	else
 		rv = true;
 	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
@@ -825,9 +1257,13 @@ prop_dictionary_iterator(prop_dictionary_t pd)
 {
 	prop_object_iterator_t pi;
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	if (! prop_object_is_dictionary(pd))
+		return (NULL);
+
+	_prop_dictionary_sort(pd);
+	_PROP_DICT_RDLOCK(pd);
 	pi = _prop_dictionary_iterator_locked(pd);
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 	return (pi);
 }
 
@@ -840,32 +1276,70 @@ prop_array_t
 prop_dictionary_all_keys(prop_dictionary_t pd)
 {
 	prop_array_t array;
-	unsigned int idx;
-	bool rv = true;
+	prop_object_t *keys;
+	unsigned int idx, count;
 
 	if (! prop_object_is_dictionary(pd))
 		return (NULL);
 
 	/* There is no pressing need to lock the dictionary for this. */
 	array = prop_array_create_with_capacity(pd->pd_count);
+	if (array == NULL)
+		return (NULL);
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	_prop_dictionary_sort(pd);
 
-	for (idx = 0; idx < pd->pd_count; idx++) {
-		rv = prop_array_add(array, pd->pd_array[idx].pde_key);
-		if (rv == false)
-			break;
+	_PROP_DICT_RDLOCK(pd);
+
+	count = pd->pd_count;
+	keys = _PROP_MALLOC((count ? count : 1) * sizeof(*keys), M_TEMP);
+	if (keys != NULL) {
+		for (idx = 0; idx < count; idx++) {
+			keys[idx] = pd->pd_array[idx].pde_key;
+			prop_object_retain(keys[idx]);
+		}
 	}
 
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 
-	if (rv == false) {
+	if (keys == NULL ||
+	    prop_array_add_objects_and_rel(array, keys, count) == false) {
 		prop_object_release(array);
 		array = NULL;
 	}
+	if (keys != NULL)
+		_PROP_FREE(keys, M_TEMP);
 	return (array);
 }
 
+static struct _prop_dict_entry *
+_prop_dict_hash_lookup(prop_dictionary_t pd, const char *key, uint32_t hash,
+		       unsigned int *idxp)
+{
+	struct _prop_dict_entry *pde;
+	unsigned int mask = pd->pd_hashsize - 1, i, idx;
+
+	/*
+	 * Dictionary must be READ-LOCKED or WRITE-LOCKED.
+	 */
+
+	for (i = hash & mask; pd->pd_hash[i] != 0; i = (i + 1) & mask) {
+		idx = pd->pd_hash[i] - 1;
+		pde = &pd->pd_array[idx];
+		if (pde->pde_key->pdk_hash == hash &&
+		    strcmp(key, pde->pde_key->pdk_key) == 0) {
+			if (idxp != NULL)
+				*idxp = idx;
+			return (pde);
+		}
+	}
+
+	/* The new key would be appended. */
+	if (idxp != NULL)
+		*idxp = pd->pd_count;
+	return (NULL);
+}
+
 static struct _prop_dict_entry *
 _prop_dict_lookup(prop_dictionary_t pd, const char *key,
 		  unsigned int *idxp)
@@ -878,6 +1352,10 @@ _prop_dict_lookup(prop_dictionary_t pd, const char *key,
 	 * Dictionary must be READ-LOCKED or WRITE-LOCKED.
 	 */
 
+	if (prop_dictionary_is_hashed(pd))
+		return (_prop_dict_hash_lookup(pd, key,
+		    _prop_dict_hash(key), idxp));
+
 	for (idx = 0, base = 0, distance = pd->pd_count; distance != 0;
 	     distance >>= 1) {
 		idx = base + (distance >> 1);
@@ -911,14 +1389,14 @@ _prop_dictionary_get(prop_dictionary_t pd, const char *key, bool locked)
 		return (NULL);
 
 	if (!locked)
-		_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+		_PROP_DICT_RDLOCK(pd);
 	pde = _prop_dict_lookup(pd, key, NULL);
 	if (pde != NULL) {
 		_PROP_ASSERT(pde->pde_objref != NULL);
 		po = pde->pde_objref;
 	}
 	if (!locked)
-		_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+		_PROP_DICT_RDUNLOCK(pd);
 	return (po);
 }
 /*
@@ -933,9 +1411,9 @@ prop_dictionary_get(prop_dictionary_t pd, const char *key)
 	if (! prop_object_is_dictionary(pd))
 		return (NULL);
 
-	_PROP_RWLOCK_RDLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDLOCK(pd);
 	po = _prop_dictionary_get(pd, key, true);
-	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
+	_PROP_DICT_RDUNLOCK(pd);
 	return (po);
 }
 
@@ -944,11 +1422,25 @@ _prop_dictionary_get_keysym(prop_dictionary_t pd, prop_dictionary_keysym_t pdk,
     bool locked)
 {
 
+	const struct _prop_dict_entry *pde;
+	prop_object_t po = NULL;
+
 	if (! (prop_object_is_dictionary(pd) &&
 	       prop_object_is_dictionary_keysym(pdk)))
 		return (NULL);
 
-	return (_prop_dictionary_get(pd, pdk->pdk_key, locked));
+	if (!prop_dictionary_is_hashed(pd))
+		return (_prop_dictionary_get(pd, pdk->pdk_key, locked));
+
+	/* The keysym already carries its hash. */
+	if (!locked)
+		_PROP_DICT_RDLOCK(pd);
+	pde = _prop_dict_hash_lookup(pd, pdk->pdk_key, pdk->pdk_hash, NULL);
+	if (pde != NULL)
+		po = pde->pde_objref;
+	if (!locked)
+		_PROP_DICT_RDUNLOCK(pd);
+	return (po);
 }
 
 /*
@@ -985,6 +1477,9 @@ prop_dictionary_set(prop_dictionary_t pd, const char *key, prop_object_t po)
 
 	_PROP_RWLOCK_WRLOCK(pd->pd_rwlock);
 
+	if (!_prop_dictionary_unshare(pd, 0))
+		goto out;
+
 	pde = _prop_dict_lookup(pd, key, &idx);
 	if (pde != NULL) {
 		prop_object_t opo = pde->pde_objref;
@@ -1000,12 +1495,33 @@ prop_dictionary_set(prop_dictionary_t pd, const char *key, prop_object_t po)
 		goto out;
 
 	if (pd->pd_count == pd->pd_capacity &&
-	    _prop_dictionary_expand(pd,
-	    			    pd->pd_capacity + EXPAND_STEP) == false) {
+	    _prop_dictionary_expand(pd, pd->pd_capacity +
+	    (prop_dictionary_is_hashed(pd) && pd->pd_capacity > EXPAND_STEP ?
+	    pd->pd_capacity : EXPAND_STEP)) == false) {
 		prop_object_release(pdk);
 	    	goto out;
 	}
 
+	if (prop_dictionary_is_hashed(pd)) {
+		if ((pd->pd_count + 1) * 2 > pd->pd_hashsize &&
+		    !_prop_dict_hash_rebuild(pd, pd->pd_hashsize * 2)) {
+			prop_object_release(pdk);
+			goto out;
+		}
+		prop_object_retain(po);
+		/* Append, the array is sorted again on demand. */
+		if (idx != 0 && prop_dictionary_is_sorted(pd) &&
+		    strcmp(key, pd->pd_array[idx - 1].pde_key->pdk_key) < 0)
+			pd->pd_flags |= PD_F_UNSORTED;
+		pd->pd_array[idx].pde_key = pdk;
+		pd->pd_array[idx].pde_objref = po;
+		pd->pd_count++;
+		_prop_dict_hash_insert(pd, idx);
+		pd->pd_version++;
+		rv = true;
+		goto out;
+	}
+
 	/* At this point, the store will succeed. */
 	prop_object_retain(po);
 
@@ -1054,6 +1570,8 @@ prop_dictionary_set(prop_dictionary_t pd, const char *key, prop_object_t po)
 	rv = true;
 
  out:
+	if (rv)
+		_PROP_OBJECT_MODIFIED(pd);
 	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
 	return (rv);
 }
@@ -1090,11 +1608,23 @@ _prop_dictionary_remove(prop_dictionary_t pd, struct _prop_dict_entry *pde,
 	_PROP_ASSERT(idx < pd->pd_count);
 	_PROP_ASSERT(pde == &pd->pd_array[idx]);
 
-	idx++;
-	memmove(&pd->pd_array[idx - 1], &pd->pd_array[idx],
-		(pd->pd_count - idx) * sizeof(*pde));
+	if (prop_dictionary_is_hashed(pd)) {
+		/* Fill the hole with the last entry. */
+		_prop_dict_hash_remove(pd, idx);
+		if (idx != pd->pd_count - 1) {
+			pd->pd_hash[_prop_dict_hash_slot(pd,
+			    pd->pd_count - 1)] = idx + 1;
+			*pde = pd->pd_array[pd->pd_count - 1];
+			pd->pd_flags |= PD_F_UNSORTED;
+		}
+	} else {
+		idx++;
+		memmove(&pd->pd_array[idx - 1], &pd->pd_array[idx],
+			(pd->pd_count - idx) * sizeof(*pde));
+	}
 	pd->pd_count--;
 	pd->pd_version++;
+	_PROP_OBJECT_MODIFIED(pd);
 
 
 	prop_object_release(pdk);
@@ -1127,7 +1657,9 @@ prop_dictionary_remove(prop_dictionary_t pd, const char *key)
 	if (pde == NULL)
 		goto out;
 
-	_prop_dictionary_remove(pd, pde, idx);
+	if (!_prop_dictionary_unshare(pd, 0))
+		goto out;
+	_prop_dictionary_remove(pd, &pd->pd_array[idx], idx);
  out:
 	_PROP_RWLOCK_UNLOCK(pd->pd_rwlock);
 }
@@ -1294,6 +1826,7 @@ _prop_dictionary_internalize_continue(prop_stack_t stack, prop_object_t *obj,
 		return (true);
 	}
 
+	_prop_array_internalize_key(tmpkey, child);
 	prop_object_release(child);
 
 	/*
@@ -1377,26 +1910,29 @@ prop_dictionary_internalize(const char *xml)
 bool
 prop_dictionary_externalize_to_file(prop_dictionary_t dict, const char *fname)
 {
-	char *xml;
-	bool rv;
-	int save_errno = 0;	/* XXXGCC -Wuninitialized [mips, ...] */
+	if (! prop_object_is_dictionary(dict))
+		return (false);
 
-	xml = prop_dictionary_externalize(dict);
-	if (xml == NULL)
+	return (_prop_object_externalize_to_file(dict, fname, false));
+}
+
+/*
+ * prop_dictionary_externalize_stream --
+ *	Externalize a dictionary with writefn(arg, buf, len), in chunks.
+ */
+bool
+prop_dictionary_externalize_stream(prop_dictionary_t dict,
+    ssize_t (*writefn)(void *, const void *, size_t), void *arg)
+{
+	if (! prop_object_is_dictionary(dict))
 		return (false);
-	rv = _prop_object_externalize_write_file(fname, xml, strlen(xml), false);
-	if (rv == false)
-		save_errno = errno;
-	_PROP_FREE(xml, M_TEMP);
-	if (rv == false)
-		errno = save_errno;
 
-	return (rv);
+	return (_prop_object_externalize_to_stream(dict, writefn, arg));
 }
 
 /*
  * prop_dictionary_internalize_from_file --
- *	Internalize a dictionary from a file.
+ *	Internalize a dictionary from a file, either in XML or binary form.
  */
 prop_dictionary_t
 prop_dictionary_internalize_from_file(const char *fname)
@@ -1407,7 +1943,8 @@ prop_dictionary_internalize_from_file(const char *fname)
 	mf = _prop_object_internalize_map_file(fname);
 	if (mf == NULL)
 		return (NULL);
-	dict = prop_dictionary_internalize(mf->poimf_xml);
+	dict = prop_dictionary_internalize_buffer(mf->poimf_xml,
+	    mf->poimf_mapsize);
 	_prop_object_internalize_unmap_file(mf);
 
 	return (dict);
@@ -55,6 +55,7 @@ _PROP_POOL_INIT(_prop_number_pool, sizeof(struct _prop_number), "propnmbr")
 
 static _prop_object_free_rv_t
 		_prop_number_free(prop_stack_t, prop_object_t *);
+static size_t	_prop_number_size(prop_object_t);
 static bool	_prop_number_externalize(
 				struct _prop_object_externalize_context *,
 				void *);
@@ -66,24 +67,39 @@ static _prop_object_equals_rv_t
 static void _prop_number_lock(void);
 static void _prop_number_unlock(void);
 
-static const struct _prop_object_type _prop_object_type_number = {
+const struct _prop_object_type _prop_object_type_number = {
 	.pot_type	=	PROP_TYPE_NUMBER,
 	.pot_free	=	_prop_number_free,
 	.pot_extern	=	_prop_number_externalize,
 	.pot_equals	=	_prop_number_equals,
 	.pot_lock       =       _prop_number_lock,
 	.pot_unlock     =    	_prop_number_unlock,
+	.pot_size	=	_prop_number_size,
 };
 
 #define	prop_object_is_number(x)	\
-	((x) != NULL && (x)->pn_obj.po_type == &_prop_object_type_number)
+	((x) != NULL && _prop_object_type_of(x) == &_prop_object_type_number)
 
 /*
  * Number objects are immutable, and we are likely to have many number
- * objects that have the same value.  So, to save memory, we unique'ify
- * numbers so we only have one copy of each.
+ * objects that have the same value.  Those that fit in a pointer are
+ * tagged objects (see _PROP_TAGGED()) and are never allocated; to save
+ * memory, the others are unique'ified so we only have one copy of each.
  */
 
+static inline void
+_prop_number_value(prop_number_t pn, struct _prop_number_value *pnv)
+{
+	uintptr_t tag = (uintptr_t)pn;
+
+	if (_PROP_TAGGED(pn)) {
+		memset(pnv, 0, sizeof(*pnv));
+		pnv->pnv_signed = _PROP_TAG_VALUE(pn);
+		pnv->pnv_is_unsigned = (tag & _PROP_TAG_UNSIGNED) != 0;
+	} else
+		*pnv = pn->pn_value;
+}
+
 static int
 _prop_number_compare_values(const struct _prop_number_value *pnv1,
 			    const struct _prop_number_value *pnv2)
@@ -155,6 +171,14 @@ _prop_number_free(prop_stack_t stack, prop_object_t *obj)
 	return (_PROP_OBJECT_FREE_DONE);
 }
 
+/* ARGSUSED */
+static size_t
+_prop_number_size(prop_object_t v _PROP_ARG_UNUSED)
+{
+
+	return (_prop_pool_objsize(&_prop_number_pool));
+}
+
 _PROP_ONCE_DECL(_prop_number_init_once)
 
 static int
@@ -184,19 +208,21 @@ static bool
 _prop_number_externalize(struct _prop_object_externalize_context *ctx,
 			 void *v)
 {
-	prop_number_t pn = v;
+	struct _prop_number_value pnv;
 	char tmpstr[32];
 
+	_prop_number_value(v, &pnv);
+
 	/*
 	 * For unsigned numbers, we output in hex.  For signed numbers,
 	 * we output in decimal.
 	 */
-	if (pn->pn_value.pnv_is_unsigned)
+	if (pnv.pnv_is_unsigned)
 		snprintf(tmpstr, sizeof(tmpstr), "%" PRIu64,
-		    pn->pn_value.pnv_unsigned);
+		    pnv.pnv_unsigned);
 	else
 		snprintf(tmpstr, sizeof(tmpstr), "%" PRIi64,
-		    pn->pn_value.pnv_signed);
+		    pnv.pnv_signed);
 
 	if (_prop_object_externalize_start_tag(ctx, "integer") == false ||
 	    _prop_object_externalize_append_cstring(ctx, tmpstr) == false ||
@@ -212,22 +238,23 @@ _prop_number_equals(prop_object_t v1, prop_object_t v2,
     void **stored_pointer1, void **stored_pointer2,
     prop_object_t *next_obj1, prop_object_t *next_obj2)
 {
-	prop_number_t num1 = v1;
-	prop_number_t num2 = v2;
+	struct _prop_number_value pnv1, pnv2;
 
 	/*
 	 * There is only ever one copy of a number object at any given
 	 * time, so we can reduce this to a simple pointer equality check
 	 * in the common case.
 	 */
-	if (num1 == num2)
+	if (v1 == v2)
 		return (_PROP_OBJECT_EQUALS_TRUE);
 
 	/*
 	 * If the numbers are the same signed-ness, then we know they
 	 * cannot be equal because they would have had pointer equality.
 	 */
-	if (num1->pn_value.pnv_is_unsigned == num2->pn_value.pnv_is_unsigned)
+	_prop_number_value(v1, &pnv1);
+	_prop_number_value(v2, &pnv2);
+	if (pnv1.pnv_is_unsigned == pnv2.pnv_is_unsigned)
 		return (_PROP_OBJECT_EQUALS_FALSE);
 
 	/*
@@ -238,25 +265,25 @@ _prop_number_equals(prop_object_t v1, prop_object_t v2,
 	 *	- The signed value is not smaller than the unsigned value
 	 *	  can represent.
 	 */
-	if (num1->pn_value.pnv_is_unsigned) {
+	if (pnv1.pnv_is_unsigned) {
 		/*
 		 * num1 is unsigned and num2 is signed.
 		 */
-		if (num1->pn_value.pnv_unsigned > INT64_MAX)
+		if (pnv1.pnv_unsigned > INT64_MAX)
 			return (_PROP_OBJECT_EQUALS_FALSE);
-		if (num2->pn_value.pnv_signed < 0)
+		if (pnv2.pnv_signed < 0)
 			return (_PROP_OBJECT_EQUALS_FALSE);
 	} else {
 		/*
 		 * num1 is signed and num2 is unsigned.
 		 */
-		if (num1->pn_value.pnv_signed < 0)
+		if (pnv1.pnv_signed < 0)
 			return (_PROP_OBJECT_EQUALS_FALSE);
-		if (num2->pn_value.pnv_unsigned > INT64_MAX)
+		if (pnv2.pnv_unsigned > INT64_MAX)
 			return (_PROP_OBJECT_EQUALS_FALSE);
 	}
 
-	if (num1->pn_value.pnv_signed == num2->pn_value.pnv_signed)
+	if (pnv1.pnv_signed == pnv2.pnv_signed)
 		return _PROP_OBJECT_EQUALS_TRUE;
 	else
 		return _PROP_OBJECT_EQUALS_FALSE;
@@ -267,6 +294,18 @@ _prop_number_alloc(const struct _prop_number_value *pnv)
 {
 	prop_number_t opn, pn, rpn;
 
+	/*
+	 * Small numbers are stored in the pointer, without taking
+	 * the tree lock.
+	 */
+	if (pnv->pnv_is_unsigned) {
+		if (pnv->pnv_unsigned <= (uint64_t)_PROP_TAG_MAX)
+			return (_PROP_TAG(pnv->pnv_unsigned,
+			    _PROP_TAG_UNSIGNED));
+	} else if (pnv->pnv_signed >= _PROP_TAG_MIN &&
+	    pnv->pnv_signed <= _PROP_TAG_MAX)
+		return (_PROP_TAG(pnv->pnv_signed, 0));
+
 	_PROP_ONCE_RUN(_prop_number_init_once, _prop_number_init);
 
 	/*
@@ -359,7 +398,8 @@ prop_number_copy(prop_number_t opn)
 
 	/*
 	 * Because we only ever allocate one object for any given
-	 * value, this can be reduced to a simple retain operation.
+	 * value, this can be reduced to a simple retain operation
+	 * (a no-op for tagged numbers).
 	 */
 	prop_object_retain(opn);
 	return (opn);
@@ -372,8 +412,10 @@ prop_number_copy(prop_number_t opn)
 bool
 prop_number_unsigned(prop_number_t pn)
 {
+	struct _prop_number_value pnv;
 
-	return (pn->pn_value.pnv_is_unsigned);
+	_prop_number_value(pn, &pnv);
+	return (pnv.pnv_is_unsigned);
 }
 
 /*
@@ -384,12 +426,12 @@ prop_number_unsigned(prop_number_t pn)
 int
 prop_number_size(prop_number_t pn)
 {
-	struct _prop_number_value *pnv;
+	struct _prop_number_value val, *pnv = &val;
 
 	if (! prop_object_is_number(pn))
 		return (0);
 
-	pnv = &pn->pn_value;
+	_prop_number_value(pn, pnv);
 
 	if (pnv->pnv_is_unsigned) {
 		if (pnv->pnv_unsigned > UINT32_MAX)
@@ -422,10 +464,13 @@ prop_number_integer_value(prop_number_t pn)
 	 * XXX Impossible to distinguish between "not a prop_number_t"
 	 * XXX and "prop_number_t has a value of 0".
 	 */
+	struct _prop_number_value pnv;
+
 	if (! prop_object_is_number(pn))
 		return (0);
 
-	return (pn->pn_value.pnv_signed);
+	_prop_number_value(pn, &pnv);
+	return (pnv.pnv_signed);
 }
 
 /*
@@ -440,10 +485,13 @@ prop_number_unsigned_integer_value(prop_number_t pn)
 	 * XXX Impossible to distinguish between "not a prop_number_t"
 	 * XXX and "prop_number_t has a value of 0".
 	 */
+	struct _prop_number_value pnv;
+
 	if (! prop_object_is_number(pn))
 		return (0);
 
-	return (pn->pn_value.pnv_unsigned);
+	_prop_number_value(pn, &pnv);
+	return (pnv.pnv_unsigned);
 }
 
 /*
@@ -466,15 +514,17 @@ prop_number_equals(prop_number_t num1, prop_number_t num2)
 bool
 prop_number_equals_integer(prop_number_t pn, int64_t val)
 {
+	struct _prop_number_value pnv;
 
 	if (! prop_object_is_number(pn))
 		return (false);
 
-	if (pn->pn_value.pnv_is_unsigned &&
-	    (pn->pn_value.pnv_unsigned > INT64_MAX || val < 0))
+	_prop_number_value(pn, &pnv);
+	if (pnv.pnv_is_unsigned &&
+	    (pnv.pnv_unsigned > INT64_MAX || val < 0))
 		return (false);
 	
-	return (pn->pn_value.pnv_signed == val);
+	return (pnv.pnv_signed == val);
 }
 
 /*
@@ -485,15 +535,17 @@ prop_number_equals_integer(prop_number_t pn, int64_t val)
 bool
 prop_number_equals_unsigned_integer(prop_number_t pn, uint64_t val)
 {
+	struct _prop_number_value pnv;
 
 	if (! prop_object_is_number(pn))
 		return (false);
 	
-	if (! pn->pn_value.pnv_is_unsigned &&
-	    (pn->pn_value.pnv_signed < 0 || val > INT64_MAX))
+	_prop_number_value(pn, &pnv);
+	if (! pnv.pnv_is_unsigned &&
+	    (pnv.pnv_signed < 0 || val > INT64_MAX))
 		return (false);
 	
-	return (pn->pn_value.pnv_unsigned == val);
+	return (pnv.pnv_unsigned == val);
 }
 
 static bool
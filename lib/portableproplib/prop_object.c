@@ -35,9 +35,11 @@
 
 #include "prop_object_impl.h"
 #include <prop/prop_object.h>
+#include <prop/prop_array.h>
+#include <prop/prop_dictionary.h>
 
 #ifdef _PROP_NEED_REFCNT_MTX
-static pthread_mutex_t _prop_refcnt_mtx = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t _prop_refcnt_mtx = PTHREAD_MUTEX_INITIALIZER;
 #endif /* _PROP_NEED_REFCNT_MTX */
 
 #define __USE_MISC	/* MAP_ANON on glibc */
@@ -50,6 +52,9 @@ static pthread_mutex_t _prop_refcnt_mtx = PTHREAD_MUTEX_INITIALIZER;
 #include <unistd.h>
 #include <zlib.h>
 
+/* objects internalized and files synced, see prop_object_stats() */
+static struct prop_stats _prop_stats;
+
 /*
  * _prop_object_init --
  *	Initialize an object.  Called when sub-classes create
@@ -61,6 +66,7 @@ _prop_object_init(struct _prop_object *po, const struct _prop_object_type *pot)
 
 	po->po_type = pot;
 	po->po_refcnt = 1;
+	po->po_flags = PO_F_MODIFIED;
 }
 
 /*
@@ -75,6 +81,482 @@ _prop_object_fini(struct _prop_object *po _PROP_ARG_UNUSED)
 	/* Nothing to do, currently. */
 }
 
+#define	ARENA_BLOCKSIZE		(64 * 1024)
+#define	ARENA_ALIGN(x)		(((x) + 15) & ~(size_t)15)
+
+/*
+ * Pools --
+ *	Fixed size objects are carved out of slabs of POOL_SLABSIZE bytes,
+ *	aligned to their size so that the slab of an object is found by
+ *	masking its address.  Every thread keeps a cache of free objects
+ *	per pool, refilled from and flushed to the slabs POOL_BATCH objects
+ *	at a time under the pool mutex; the cache of a thread is flushed
+ *	when it exits.  Empty slabs are freed, except one spare per pool
+ *	that is freed by prop_object_pool_trim().
+ */
+#define	POOL_SLABSIZE		(64 * 1024)
+#define	POOL_BATCH		32
+#define	POOL_CACHEMAX		(2 * POOL_BATCH)
+
+struct _prop_slab {
+	struct _prop_slab *ps_next;	/* in pp_partial */
+	struct _prop_slab *ps_prev;
+	void		*ps_free;	/* freed objects */
+	char		*ps_cp;		/* never used objects */
+	char		*ps_end;
+	unsigned int	ps_inuse;
+	bool		ps_partial;
+};
+
+static struct _prop_pool *_prop_pools;
+_PROP_MUTEX_DECL_STATIC(_prop_pools_mutex)
+static pthread_key_t _prop_pool_key;
+_PROP_ONCE_DECL(_prop_pool_once)
+static __thread struct _prop_pool_cache *_prop_pool_caches;
+
+#define	POOL_OBJSIZE(pp)	ARENA_ALIGN((pp)->pp_hdr + (pp)->pp_size)
+#define	POOL_SLAB(v)							\
+	((struct _prop_slab *)((uintptr_t)(v) & ~(uintptr_t)(POOL_SLABSIZE - 1)))
+
+static void
+_prop_slab_reset(struct _prop_slab *ps)
+{
+	ps->ps_free = NULL;
+	ps->ps_cp = (char *)ps + ARENA_ALIGN(sizeof(*ps));
+	ps->ps_end = (char *)ps + POOL_SLABSIZE;
+	ps->ps_inuse = 0;
+}
+
+static void
+_prop_slab_link(struct _prop_pool *pp, struct _prop_slab *ps)
+{
+	ps->ps_prev = NULL;
+	ps->ps_next = pp->pp_partial;
+	if (ps->ps_next != NULL)
+		ps->ps_next->ps_prev = ps;
+	pp->pp_partial = ps;
+	ps->ps_partial = true;
+}
+
+static void
+_prop_slab_unlink(struct _prop_pool *pp, struct _prop_slab *ps)
+{
+	if (ps->ps_prev != NULL)
+		ps->ps_prev->ps_next = ps->ps_next;
+	else
+		pp->pp_partial = ps->ps_next;
+	if (ps->ps_next != NULL)
+		ps->ps_next->ps_prev = ps->ps_prev;
+	ps->ps_partial = false;
+}
+
+/*
+ * _prop_pool_refill --
+ *	Move up to POOL_BATCH objects from the slabs of a pool to the
+ *	cache of this thread.  Called with the pool locked.
+ */
+static void
+_prop_pool_refill(struct _prop_pool *pp, struct _prop_pool_cache *ppc)
+{
+	struct _prop_slab *ps;
+	size_t size = POOL_OBJSIZE(pp);
+	void *v;
+
+	while (ppc->ppc_count < POOL_BATCH) {
+		if ((ps = pp->pp_partial) == NULL) {
+			if ((ps = pp->pp_spare) != NULL) {
+				pp->pp_spare = NULL;
+			} else {
+				if (posix_memalign(&v, POOL_SLABSIZE,
+				    POOL_SLABSIZE) != 0)
+					return;
+				ps = v;
+				_prop_slab_reset(ps);
+			}
+			_prop_slab_link(pp, ps);
+		}
+		if ((v = ps->ps_free) != NULL) {
+			ps->ps_free = *(void **)v;
+		} else {
+			v = ps->ps_cp;
+			ps->ps_cp += size;
+		}
+		ps->ps_inuse++;
+		if (ps->ps_free == NULL && ps->ps_cp + size > ps->ps_end)
+			_prop_slab_unlink(pp, ps);
+
+		*(void **)v = ppc->ppc_free;
+		ppc->ppc_free = v;
+		ppc->ppc_count++;
+	}
+}
+
+/*
+ * _prop_pool_flush --
+ *	Return n objects of the cache of this thread to their slabs.
+ *	Called with the pool locked.
+ */
+static void
+_prop_pool_flush(struct _prop_pool *pp, struct _prop_pool_cache *ppc,
+    unsigned int n)
+{
+	struct _prop_slab *ps;
+	void *v;
+
+	while (n-- > 0 && (v = ppc->ppc_free) != NULL) {
+		ppc->ppc_free = *(void **)v;
+		ppc->ppc_count--;
+
+		ps = POOL_SLAB(v);
+		*(void **)v = ps->ps_free;
+		ps->ps_free = v;
+		if (!ps->ps_partial)
+			_prop_slab_link(pp, ps);
+		if (--ps->ps_inuse != 0)
+			continue;
+		_prop_slab_unlink(pp, ps);
+		if (pp->pp_spare == NULL) {
+			_prop_slab_reset(ps);
+			pp->pp_spare = ps;
+		} else
+			free(ps);
+	}
+}
+
+static void
+_prop_pool_thread_exit(void *arg)
+{
+	struct _prop_pool_cache *ppc = arg;
+
+	for (; ppc != NULL; ppc = ppc->ppc_next) {
+		_PROP_MUTEX_LOCK(ppc->ppc_pool->pp_mutex);
+		_prop_pool_flush(ppc->ppc_pool, ppc, ppc->ppc_count);
+		_PROP_MUTEX_UNLOCK(ppc->ppc_pool->pp_mutex);
+	}
+}
+
+static void
+_prop_pool_init(void)
+{
+	(void)pthread_key_create(&_prop_pool_key, _prop_pool_thread_exit);
+}
+
+static void
+_prop_pool_register(struct _prop_pool *pp, struct _prop_pool_cache *ppc)
+{
+	_PROP_ONCE_RUN(_prop_pool_once, _prop_pool_init);
+
+	ppc->ppc_pool = pp;
+	ppc->ppc_next = _prop_pool_caches;
+	_prop_pool_caches = ppc;
+	(void)pthread_setspecific(_prop_pool_key, ppc);
+
+	_PROP_MUTEX_LOCK(_prop_pools_mutex);
+	if (!pp->pp_listed) {
+		pp->pp_next = _prop_pools;
+		_prop_pools = pp;
+		pp->pp_listed = true;
+	}
+	_PROP_MUTEX_UNLOCK(_prop_pools_mutex);
+}
+
+/*
+ * _prop_pool_objsize --
+ *	Return the memory used by an object allocated from a pool.
+ */
+size_t
+_prop_pool_objsize(const struct _prop_pool *pp)
+{
+
+	return (POOL_OBJSIZE(pp));
+}
+
+/*
+ * _prop_pool_get --
+ *	Allocate an object from a pool.
+ */
+void *
+_prop_pool_get(struct _prop_pool *pp, struct _prop_pool_cache *ppc)
+{
+	void *v;
+
+	if (ppc->ppc_pool == NULL)
+		_prop_pool_register(pp, ppc);
+
+	if (ppc->ppc_free == NULL) {
+		_PROP_MUTEX_LOCK(pp->pp_mutex);
+		_prop_pool_refill(pp, ppc);
+		_PROP_MUTEX_UNLOCK(pp->pp_mutex);
+		if (ppc->ppc_free == NULL)
+			return (NULL);
+	}
+	v = ppc->ppc_free;
+	ppc->ppc_free = *(void **)v;
+	ppc->ppc_count--;
+
+	return (v);
+}
+
+/*
+ * _prop_pool_put --
+ *	Free an object allocated with _prop_pool_get(), by any thread.
+ */
+void
+_prop_pool_put(struct _prop_pool *pp, struct _prop_pool_cache *ppc, void *v)
+{
+	if (ppc->ppc_pool == NULL)
+		_prop_pool_register(pp, ppc);
+
+	*(void **)v = ppc->ppc_free;
+	ppc->ppc_free = v;
+	if (++ppc->ppc_count > POOL_CACHEMAX) {
+		_PROP_MUTEX_LOCK(pp->pp_mutex);
+		_prop_pool_flush(pp, ppc, POOL_BATCH);
+		_PROP_MUTEX_UNLOCK(pp->pp_mutex);
+	}
+}
+
+/*
+ * prop_object_pool_trim --
+ *	Return the free objects cached by this thread to their pools and
+ *	free the spare slabs; slabs with objects in use are kept.
+ */
+void
+prop_object_pool_trim(void)
+{
+	struct _prop_pool_cache *ppc;
+	struct _prop_pool *pp;
+
+	for (ppc = _prop_pool_caches; ppc != NULL; ppc = ppc->ppc_next) {
+		_PROP_MUTEX_LOCK(ppc->ppc_pool->pp_mutex);
+		_prop_pool_flush(ppc->ppc_pool, ppc, ppc->ppc_count);
+		_PROP_MUTEX_UNLOCK(ppc->ppc_pool->pp_mutex);
+	}
+
+	_PROP_MUTEX_LOCK(_prop_pools_mutex);
+	for (pp = _prop_pools; pp != NULL; pp = pp->pp_next) {
+		_PROP_MUTEX_LOCK(pp->pp_mutex);
+		free(pp->pp_spare);
+		pp->pp_spare = NULL;
+		_PROP_MUTEX_UNLOCK(pp->pp_mutex);
+	}
+	_PROP_MUTEX_UNLOCK(_prop_pools_mutex);
+}
+
+/*
+ * Arenas --
+ *	Objects created by a thread between prop_object_arena_begin() and
+ *	prop_object_arena_end() are carved out of large blocks instead of
+ *	being allocated one by one.  Every object keeps a reference to its
+ *	arena and the blocks are freed at once when the last object is gone.
+ *
+ *	Every object allocated with _PROP_ARENA_GET() is preceded by the
+ *	arena it belongs to, NULL for objects allocated from its pool.
+ */
+
+struct _prop_arena_block {
+	struct _prop_arena_block *pab_next;
+};
+
+struct _prop_arena {
+	struct _prop_arena_block *pa_blocks;
+	char		*pa_cp;		/* free space in the current block */
+	size_t		pa_avail;
+	uint32_t	pa_refcnt;	/* objects + 1 while open */
+	void		*pa_strings;	/* see _prop_string_intern() */
+	bool		pa_intern;
+};
+
+struct _prop_arena_hdr {
+	struct _prop_arena *pah_arena;
+	void		*pah_pad;	/* keep objects 16 bytes aligned */
+};
+
+static __thread struct _prop_arena *_prop_arena_cur;
+static __thread unsigned int _prop_arena_depth;
+
+static void
+_prop_arena_destroy(struct _prop_arena *pa)
+{
+	struct _prop_arena_block *pab;
+
+	while ((pab = pa->pa_blocks) != NULL) {
+		pa->pa_blocks = pab->pab_next;
+		_PROP_FREE(pab, M_TEMP);
+	}
+	_PROP_FREE(pa, M_TEMP);
+}
+
+static void
+_prop_arena_unref(struct _prop_arena *pa)
+{
+	uint32_t ncnt;
+
+	_PROP_ATOMIC_DEC32_NV(&pa->pa_refcnt, ncnt);
+	if (ncnt == 0)
+		_prop_arena_destroy(pa);
+}
+
+/*
+ * _prop_arena_alloc --
+ *	Allocate memory that lives as long as the objects of the
+ *	current arena.  Returns NULL if no arena is open.
+ */
+void *
+_prop_arena_alloc(size_t size)
+{
+	struct _prop_arena *pa = _prop_arena_cur;
+	struct _prop_arena_block *pab;
+	size_t hsize = ARENA_ALIGN(sizeof(*pab));
+	void *v;
+
+	if (pa == NULL)
+		return (NULL);
+
+	size = ARENA_ALIGN(size);
+	if (size > pa->pa_avail) {
+		if (size > ARENA_BLOCKSIZE / 4) {
+			/* Big enough for its own block, keep the current one. */
+			pab = _PROP_MALLOC(hsize + size, M_TEMP);
+			if (pab == NULL)
+				return (NULL);
+			pab->pab_next = pa->pa_blocks->pab_next;
+			pa->pa_blocks->pab_next = pab;
+			return ((char *)pab + hsize);
+		}
+		pab = _PROP_MALLOC(ARENA_BLOCKSIZE, M_TEMP);
+		if (pab == NULL)
+			return (NULL);
+		pab->pab_next = pa->pa_blocks;
+		pa->pa_blocks = pab;
+		pa->pa_cp = (char *)pab + hsize;
+		pa->pa_avail = ARENA_BLOCKSIZE - hsize;
+	}
+	v = pa->pa_cp;
+	pa->pa_cp += size;
+	pa->pa_avail -= size;
+
+	return (v);
+}
+
+/*
+ * _prop_arena_get --
+ *	Allocate an object, from the current arena if there is one.
+ */
+void *
+_prop_arena_get(struct _prop_pool *pp, struct _prop_pool_cache *ppc)
+{
+	struct _prop_arena_hdr *pah;
+	struct _prop_arena *pa = _prop_arena_cur;
+
+	_PROP_ASSERT(pp->pp_hdr == sizeof(*pah));
+	pah = _prop_arena_alloc(sizeof(*pah) + pp->pp_size);
+	if (pah == NULL) {
+		pah = _prop_pool_get(pp, ppc);
+		if (pah == NULL)
+			return (NULL);
+		pa = NULL;
+	} else
+		_PROP_ATOMIC_INC32(&pa->pa_refcnt);
+
+	pah->pah_arena = pa;
+	return (pah + 1);
+}
+
+/*
+ * _prop_arena_put --
+ *	Free an object allocated with _prop_arena_get().
+ */
+void
+_prop_arena_put(struct _prop_pool *pp, struct _prop_pool_cache *ppc, void *v)
+{
+	struct _prop_arena_hdr *pah = (struct _prop_arena_hdr *)v - 1;
+
+	if (pah->pah_arena == NULL)
+		_prop_pool_put(pp, ppc, pah);
+	else
+		_prop_arena_unref(pah->pah_arena);
+}
+
+/*
+ * _prop_arena_strings --
+ *	Return the string table of the current arena, NULL if no arena
+ *	is open or it doesn't intern strings.
+ */
+void **
+_prop_arena_strings(void)
+{
+	if (_prop_arena_cur == NULL || !_prop_arena_cur->pa_intern)
+		return (NULL);
+	return (&_prop_arena_cur->pa_strings);
+}
+
+/*
+ * prop_object_arena_intern --
+ *	Intern the strings internalized in the current arena until it's
+ *	closed: equal values are the same immutable object.  Meant for
+ *	trees that are not modified once internalized.
+ */
+void
+prop_object_arena_intern(void)
+{
+	if (_prop_arena_cur != NULL)
+		_prop_arena_cur->pa_intern = true;
+}
+
+/*
+ * prop_object_arena_begin --
+ *	Allocate the objects created by this thread from a new arena,
+ *	until prop_object_arena_end() is called.  Calls can be nested,
+ *	the outermost pair defines the arena.
+ */
+void
+prop_object_arena_begin(void)
+{
+	struct _prop_arena *pa;
+
+	if (_prop_arena_depth++ != 0)
+		return;
+
+	pa = _PROP_CALLOC(sizeof(*pa), M_TEMP);
+	if (pa == NULL)
+		return;	/* fall back to the heap */
+	pa->pa_blocks = _PROP_MALLOC(ARENA_BLOCKSIZE, M_TEMP);
+	if (pa->pa_blocks == NULL) {
+		_PROP_FREE(pa, M_TEMP);
+		return;
+	}
+	pa->pa_blocks->pab_next = NULL;
+	pa->pa_cp = (char *)pa->pa_blocks +
+	    ARENA_ALIGN(sizeof(struct _prop_arena_block));
+	pa->pa_avail = ARENA_BLOCKSIZE -
+	    ARENA_ALIGN(sizeof(struct _prop_arena_block));
+	pa->pa_refcnt = 1;
+	_prop_arena_cur = pa;
+}
+
+/*
+ * prop_object_arena_end --
+ *	Stop allocating objects from the arena.  The arena is freed
+ *	once all its objects have been released.
+ */
+void
+prop_object_arena_end(void)
+{
+	struct _prop_arena *pa = _prop_arena_cur;
+
+	_PROP_ASSERT(_prop_arena_depth != 0);
+	if (--_prop_arena_depth != 0)
+		return;
+
+	_prop_arena_cur = NULL;
+	if (pa != NULL) {
+		_prop_string_intern_release(pa->pa_strings);
+		pa->pa_strings = NULL;
+		_prop_arena_unref(pa);
+	}
+}
+
 /*
  * _prop_object_externalize_start_tag --
  *	Append an XML-style start tag to the externalize buffer.
@@ -199,6 +681,42 @@ _prop_object_externalize_append_encoded_cstring(
 }
 
 #define	BUF_EXPAND		256
+#define	BUF_STREAM		65536
+
+/*
+ * _prop_object_externalize_flush --
+ *	Write out the externalize buffer of a context streaming to a file
+ *	or to a write function.
+ */
+static bool
+_prop_object_externalize_flush(struct _prop_object_externalize_context *ctx)
+{
+	const char *cp = ctx->poec_buf;
+	size_t len = ctx->poec_len;
+	ssize_t n;
+
+	if (ctx->poec_gzf != NULL) {
+		if (len && gzwrite(ctx->poec_gzf, cp, len) != (int)len)
+			return (false);
+	} else {
+		while (len > 0) {
+			if (ctx->poec_writefn != NULL) {
+				n = (*ctx->poec_writefn)(ctx->poec_warg, cp, len);
+				if (n <= 0)
+					return (false);
+			} else if ((n = write(ctx->poec_fd, cp, len)) == -1) {
+				if (errno == EINTR)
+					continue;
+				return (false);
+			}
+			cp += n;
+			len -= n;
+		}
+	}
+	ctx->poec_len = 0;
+
+	return (true);
+}
 
 /*
  * _prop_object_externalize_append_char --
@@ -213,7 +731,11 @@ _prop_object_externalize_append_char(
 	_PROP_ASSERT(ctx->poec_buf != NULL);
 	_PROP_ASSERT(ctx->poec_len <= ctx->poec_capacity);
 
-	if (ctx->poec_len == ctx->poec_capacity) {
+	if (ctx->poec_len == ctx->poec_capacity &&
+	    (ctx->poec_fd != -1 || ctx->poec_writefn != NULL)) {
+		if (_prop_object_externalize_flush(ctx) == false)
+			return (false);
+	} else if (ctx->poec_len == ctx->poec_capacity) {
 		char *cp = _PROP_REALLOC(ctx->poec_buf,
 					 ctx->poec_capacity + BUF_EXPAND,
 					 M_TEMP);
@@ -252,13 +774,15 @@ _prop_object_externalize_header(struct _prop_object_externalize_context *ctx)
 /*
  * _prop_object_externalize_footer --
  *	Append the standard XML footer to the externalize buffer.  This
- *	also NUL-terminates the buffer.
+ *	also NUL-terminates the buffer, unless it's streamed.
  */
 bool
 _prop_object_externalize_footer(struct _prop_object_externalize_context *ctx)
 {
 
-	if (_prop_object_externalize_end_tag(ctx, "plist") == false ||
+	if (_prop_object_externalize_end_tag(ctx, "plist") == false)
+		return (false);
+	if (ctx->poec_fd == -1 && ctx->poec_writefn == NULL &&
 	    _prop_object_externalize_append_char(ctx, '\0') == false)
 		return (false);
 
@@ -284,6 +808,10 @@ _prop_object_externalize_context_alloc(void)
 		ctx->poec_len = 0;
 		ctx->poec_capacity = BUF_EXPAND;
 		ctx->poec_depth = 0;
+		ctx->poec_fd = -1;
+		ctx->poec_gzf = NULL;
+		ctx->poec_writefn = NULL;
+		ctx->poec_warg = NULL;
 	}
 	return (ctx);
 }
@@ -481,55 +1009,63 @@ _prop_object_internalize_decode_string(
 				char *target, size_t targsize, size_t *sizep,
 				const char **cpp)
 {
-	const char *src;
-	size_t tarindex;
+	const char *src, *end, *amp;
+	size_t tarindex, run;
 	char c;
 	
 	tarindex = 0;
 	src = ctx->poic_cp;
 
-	for (;;) {
-		if (_PROP_EOF(*src))
-			return (false);
-		if (*src == '<') {
-			break;
-		}
+	/* The text ends at the next tag, entities are the exception. */
+	if ((end = strchr(src, '<')) == NULL)
+		return (false);
 
-		if ((c = *src) == '&') {
-			if (src[1] == 'a' &&
-			    src[2] == 'm' &&
-			    src[3] == 'p' &&
-			    src[4] == ';') {
-			    	c = '&';
-				src += 5;
-			} else if (src[1] == 'l' &&
-				   src[2] == 't' &&
-				   src[3] == ';') {
-				c = '<';
-				src += 4;
-			} else if (src[1] == 'g' &&
-				   src[2] == 't' &&
-				   src[3] == ';') {
-				c = '>';
-				src += 4;
-			} else if (src[1] == 'a' &&
-				   src[2] == 'p' &&
-				   src[3] == 'o' &&
-				   src[4] == 's' &&
-				   src[5] == ';') {
-				c = '\'';
-				src += 6;
-			} else if (src[1] == 'q' &&
-				   src[2] == 'u' &&
-				   src[3] == 'o' &&
-				   src[4] == 't' &&
-				   src[5] == ';') {
-				c = '\"';
-				src += 6;
-			} else
+	while (src < end) {
+		/* Copy everything up to the next entity at once. */
+		amp = memchr(src, '&', end - src);
+		run = (amp != NULL ? amp : end) - src;
+		if (target) {
+			if (tarindex + run > targsize)
 				return (false);
+			memcpy(&target[tarindex], src, run);
+		}
+		tarindex += run;
+		src += run;
+		if (amp == NULL)
+			break;
+
+		if (src[1] == 'a' &&
+		    src[2] == 'm' &&
+		    src[3] == 'p' &&
+		    src[4] == ';') {
+		    	c = '&';
+			src += 5;
+		} else if (src[1] == 'l' &&
+			   src[2] == 't' &&
+			   src[3] == ';') {
+			c = '<';
+			src += 4;
+		} else if (src[1] == 'g' &&
+			   src[2] == 't' &&
+			   src[3] == ';') {
+			c = '>';
+			src += 4;
+		} else if (src[1] == 'a' &&
+			   src[2] == 'p' &&
+			   src[3] == 'o' &&
+			   src[4] == 's' &&
+			   src[5] == ';') {
+			c = '\'';
+			src += 6;
+		} else if (src[1] == 'q' &&
+			   src[2] == 'u' &&
+			   src[3] == 'o' &&
+			   src[4] == 't' &&
+			   src[5] == ';') {
+			c = '\"';
+			src += 6;
 		} else
-			src++;
+			return (false);
 		if (target) {
 			if (tarindex >= targsize)
 				return (false);
@@ -634,58 +1170,472 @@ match_start:
 	return (parent_obj);
 }
 
-prop_object_t
-_prop_generic_internalize(const char *xml, const char *master_tag)
-{
-	prop_object_t obj = NULL;
-	struct _prop_object_internalize_context *ctx;
+/*
+ * Fast path of the internalizer.  Dictionaries and arrays are built
+ * directly instead of going through the continuation stack, and only
+ * the common form of tags is accepted: no attributes, no comments.
+ * Anything else makes it fail, and the caller starts over with
+ * _prop_object_internalize_by_tag(), which copes with every input.
+ */
+#define	FAST_MAXDEPTH	64
+#define	FAST_MAXKEY	128	/* PDK_MAXKEY */
 
-	ctx = _prop_object_internalize_context_alloc(xml);
-	if (ctx == NULL)
-		return (NULL);
+#define	FAST_TAG_MATCH(ctx, t)					\
+	((ctx)->poic_tagname_len == sizeof(t) - 1 &&		\
+	 memcmp((ctx)->poic_tagname, (t), sizeof(t) - 1) == 0)
 
-	/* We start with a <plist> tag. */
-	if (_prop_object_internalize_find_tag(ctx, "plist",
-					      _PROP_TAG_TYPE_START) == false)
-		goto out;
+static prop_object_t _prop_object_internalize_fast(
+    struct _prop_object_internalize_context *, unsigned int);
 
-	/* Plist elements cannot be empty. */
-	if (ctx->poic_is_empty_element)
-		goto out;
+/*
+ * _prop_object_internalize_fast_tag --
+ *	Read the next tag: <name>, <name/> or </name>.
+ */
+static bool
+_prop_object_internalize_fast_tag(struct _prop_object_internalize_context *ctx)
+{
+	const char *cp = ctx->poic_cp;
 
-	/*
-	 * We don't understand any plist attributes, but Apple XML
-	 * property lists often have a "version" attribute.  If we
-	 * see that one, we simply ignore it.
-	 */
-	if (ctx->poic_tagattr != NULL &&
-	    !_PROP_TAGATTR_MATCH(ctx, "version"))
-		goto out;
+	while (_PROP_ISSPACE(*cp))
+		cp++;
+	if (*cp != '<')
+		return (false);
 
-	/* Next we expect to see opening master_tag. */
-	if (_prop_object_internalize_find_tag(ctx, master_tag,
-					      _PROP_TAG_TYPE_START) == false)
-		goto out;
+	ctx->poic_tag_start = cp++;
+	if (*cp == '/') {
+		ctx->poic_tag_type = _PROP_TAG_TYPE_END;
+		cp++;
+	} else
+		ctx->poic_tag_type = _PROP_TAG_TYPE_START;
 
-	obj = _prop_object_internalize_by_tag(ctx);
-	if (obj == NULL)
-		goto out;
+	ctx->poic_tagname = cp;
+	while (*cp >= 'a' && *cp <= 'z')
+		cp++;
+	ctx->poic_tagname_len = cp - ctx->poic_tagname;
+	if (ctx->poic_tagname_len == 0)
+		return (false);
 
-	/*
-	 * We've advanced past the closing master_tag.
-	 * Now we want </plist>.
-	 */
-	if (_prop_object_internalize_find_tag(ctx, "plist",
-					      _PROP_TAG_TYPE_END) == false) {
-		prop_object_release(obj);
-		obj = NULL;
+	ctx->poic_is_empty_element = false;
+	if (*cp == '/' && ctx->poic_tag_type == _PROP_TAG_TYPE_START) {
+		ctx->poic_is_empty_element = true;
+		cp++;
 	}
+	if (*cp != '>')
+		return (false);
+
+	ctx->poic_tagattr = NULL;
+	ctx->poic_tagattr_len = 0;
+	ctx->poic_tagattrval = NULL;
+	ctx->poic_tagattrval_len = 0;
+	ctx->poic_cp = cp + 1;
+	return (true);
+}
+
+static prop_object_t
+_prop_object_internalize_fast_dict(struct _prop_object_internalize_context *ctx,
+    unsigned int depth)
+{
+	prop_dictionary_t dict;
+	prop_object_t obj;
+	char key[FAST_MAXKEY + 1];
+	size_t keylen;
+	bool rv;
+
+	if ((dict = prop_dictionary_create()) == NULL)
+		return (NULL);
+	if (ctx->poic_is_empty_element)
+		return (dict);
+
+	for (;;) {
+		if (!_prop_object_internalize_fast_tag(ctx))
+			break;
+		if (ctx->poic_tag_type == _PROP_TAG_TYPE_END) {
+			if (FAST_TAG_MATCH(ctx, "dict"))
+				return (dict);
+			break;
+		}
+		if (!FAST_TAG_MATCH(ctx, "key") || ctx->poic_is_empty_element)
+			break;
+		if (!_prop_object_internalize_decode_string(ctx, key,
+		    FAST_MAXKEY, &keylen, &ctx->poic_cp))
+			break;
+		key[keylen] = '\0';
+		if (!_prop_object_internalize_fast_tag(ctx) ||
+		    ctx->poic_tag_type != _PROP_TAG_TYPE_END ||
+		    !FAST_TAG_MATCH(ctx, "key"))
+			break;
+
+		if (!_prop_object_internalize_fast_tag(ctx) ||
+		    ctx->poic_tag_type != _PROP_TAG_TYPE_START ||
+		    (obj = _prop_object_internalize_fast(ctx, depth)) == NULL)
+			break;
+		rv = prop_dictionary_set(dict, key, obj);
+		if (rv)
+			_prop_array_internalize_key(key, obj);
+		prop_object_release(obj);
+		if (!rv)
+			break;
+	}
+	prop_object_release(dict);
+	return (NULL);
+}
+
+static prop_object_t
+_prop_object_internalize_fast_array(struct _prop_object_internalize_context *ctx,
+    unsigned int depth)
+{
+	prop_array_t array;
+	prop_object_t obj;
+
+	if ((array = prop_array_create()) == NULL)
+		return (NULL);
+	if (ctx->poic_is_empty_element)
+		return (array);
+
+	for (;;) {
+		if (!_prop_object_internalize_fast_tag(ctx))
+			break;
+		if (ctx->poic_tag_type == _PROP_TAG_TYPE_END) {
+			if (FAST_TAG_MATCH(ctx, "array"))
+				return (array);
+			break;
+		}
+		if ((obj = _prop_object_internalize_fast(ctx, depth)) == NULL)
+			break;
+		if (!prop_array_add_objects_and_rel(array, &obj, 1))
+			break;
+	}
+	prop_object_release(array);
+	return (NULL);
+}
+
+/*
+ * _prop_object_internalize_fast --
+ *	Internalize the object whose start tag is in the context.
+ */
+static prop_object_t
+_prop_object_internalize_fast(struct _prop_object_internalize_context *ctx,
+    unsigned int depth)
+{
+	prop_object_t obj = NULL;
+
+	if (ctx->poic_tagattr != NULL || ++depth > FAST_MAXDEPTH)
+		return (NULL);
+
+	if (FAST_TAG_MATCH(ctx, "dict"))
+		return (_prop_object_internalize_fast_dict(ctx, depth));
+	if (FAST_TAG_MATCH(ctx, "array"))
+		return (_prop_object_internalize_fast_array(ctx, depth));
+
+	/* Leaf objects never use the stack. */
+	if (FAST_TAG_MATCH(ctx, "string"))
+		(void)_prop_string_internalize(NULL, &obj, ctx);
+	else if (FAST_TAG_MATCH(ctx, "integer"))
+		(void)_prop_number_internalize(NULL, &obj, ctx);
+	else if (FAST_TAG_MATCH(ctx, "true") || FAST_TAG_MATCH(ctx, "false"))
+		(void)_prop_bool_internalize(NULL, &obj, ctx);
+	else if (FAST_TAG_MATCH(ctx, "data"))
+		(void)_prop_data_internalize(NULL, &obj, ctx);
+
+	return (obj);
+}
+
+prop_object_t
+_prop_generic_internalize(const char *xml, const char *master_tag)
+{
+	prop_object_t obj = NULL;
+	struct _prop_object_internalize_context *ctx, saved;
+
+	ctx = _prop_object_internalize_context_alloc(xml);
+	if (ctx == NULL)
+		return (NULL);
+
+	/* We start with a <plist> tag. */
+	if (_prop_object_internalize_find_tag(ctx, "plist",
+					      _PROP_TAG_TYPE_START) == false)
+		goto out;
+
+	/* Plist elements cannot be empty. */
+	if (ctx->poic_is_empty_element)
+		goto out;
+
+	/*
+	 * We don't understand any plist attributes, but Apple XML
+	 * property lists often have a "version" attribute.  If we
+	 * see that one, we simply ignore it.
+	 */
+	if (ctx->poic_tagattr != NULL &&
+	    !_PROP_TAGATTR_MATCH(ctx, "version"))
+		goto out;
+
+	/* Next we expect to see opening master_tag. */
+	if (_prop_object_internalize_find_tag(ctx, master_tag,
+					      _PROP_TAG_TYPE_START) == false)
+		goto out;
+
+	saved = *ctx;
+	if ((obj = _prop_object_internalize_fast(ctx, 0)) == NULL) {
+		*ctx = saved;
+		obj = _prop_object_internalize_by_tag(ctx);
+	}
+	if (obj == NULL)
+		goto out;
+
+	/*
+	 * We've advanced past the closing master_tag.
+	 * Now we want </plist>.
+	 */
+	if (_prop_object_internalize_find_tag(ctx, "plist",
+					      _PROP_TAG_TYPE_END) == false) {
+		prop_object_release(obj);
+		obj = NULL;
+	} else
+		_prop_object_internalized(ctx->poic_cp - ctx->poic_xml);
 
  out:
  	_prop_object_internalize_context_free(ctx);
 	return (obj);
 }
 
+/*
+ * Streaming internalizer for dictionaries.  The XML representation is
+ * read in chunks, and every entry of the top level dictionary is
+ * internalized as soon as its markup is complete and then discarded,
+ * so that memory is bounded by its largest entry rather than by the
+ * whole document, and parsing overlaps reading.
+ */
+#define	STREAM_READSIZE		(64 * 1024)
+
+typedef enum {
+	STREAM_TEXT,
+	STREAM_START,
+	STREAM_END,
+	STREAM_EMPTY,
+	STREAM_OTHER		/* comments, <?xml ...?> and <!DOCTYPE ...> */
+} _prop_stream_markup_t;
+
+#define	STREAM_TAG_MATCH(cp, t)					\
+	(strncmp((cp) + 1, (t), sizeof(t) - 1) == 0 &&		\
+	 ((cp)[sizeof(t)] == '>' || (cp)[sizeof(t)] == '/' ||	\
+	  _PROP_ISSPACE((cp)[sizeof(t)])))
+
+/*
+ * _prop_stream_markup --
+ *	Returns the length of the tag, comment or text at cp, up to end,
+ *	or 0 if it isn't complete yet.
+ */
+static size_t
+_prop_stream_markup(const char *cp, const char *end,
+    _prop_stream_markup_t *type)
+{
+	const char *q;
+
+	if (*cp != '<') {
+		if ((q = memchr(cp, '<', end - cp)) == NULL)
+			return (0);
+		*type = STREAM_TEXT;
+		return (q - cp);
+	}
+	if (end - cp >= 4 && memcmp(cp, "<!--", 4) == 0) {
+		for (q = cp + 4; end - q >= 3; q++) {
+			if (memcmp(q, "-->", 3) == 0) {
+				*type = STREAM_OTHER;
+				return (q + 3 - cp);
+			}
+		}
+		return (0);
+	}
+	if ((q = memchr(cp, '>', end - cp)) == NULL || end - cp < 2)
+		return (0);
+
+	if (cp[1] == '?' || cp[1] == '!')
+		*type = STREAM_OTHER;
+	else if (cp[1] == '/')
+		*type = STREAM_END;
+	else if (q[-1] == '/')
+		*type = STREAM_EMPTY;
+	else
+		*type = STREAM_START;
+
+	return (q + 1 - cp);
+}
+
+/*
+ * _prop_stream_entry --
+ *	Internalize the <key> and object between start and end, and set it
+ *	in dict.
+ */
+static bool
+_prop_stream_entry(prop_dictionary_t dict, char *start, char *end)
+{
+	struct _prop_object_internalize_context *ctx, saved;
+	prop_object_t obj;
+	char key[FAST_MAXKEY + 1], c;
+	size_t keylen;
+	bool rv = false;
+
+	c = *end;
+	*end = '\0';
+	if ((ctx = _prop_object_internalize_context_alloc(start)) == NULL)
+		goto out;
+
+	if (!_prop_object_internalize_find_tag(ctx, "key",
+	    _PROP_TAG_TYPE_START) || ctx->poic_is_empty_element ||
+	    !_prop_object_internalize_decode_string(ctx, key, FAST_MAXKEY,
+	    &keylen, &ctx->poic_cp))
+		goto out;
+	key[keylen] = '\0';
+	if (!_prop_object_internalize_find_tag(ctx, "key", _PROP_TAG_TYPE_END) ||
+	    !_prop_object_internalize_find_tag(ctx, NULL, _PROP_TAG_TYPE_START))
+		goto out;
+
+	saved = *ctx;
+	if ((obj = _prop_object_internalize_fast(ctx, 0)) == NULL) {
+		*ctx = saved;
+		obj = _prop_object_internalize_by_tag(ctx);
+	}
+	if (obj != NULL) {
+		rv = prop_dictionary_set(dict, key, obj);
+		if (rv)
+			_prop_array_internalize_key(key, obj);
+		prop_object_release(obj);
+	}
+ out:
+	if (ctx != NULL)
+		_prop_object_internalize_context_free(ctx);
+	*end = c;
+	return (rv);
+}
+
+/*
+ * prop_dictionary_internalize_stream --
+ *	Create a dictionary from its XML or binary representation, read
+ *	with readfn(arg, buf, len) until it returns 0.  Binary dictionaries
+ *	are read entirely before being internalized.
+ */
+prop_dictionary_t
+prop_dictionary_internalize_stream(ssize_t (*readfn)(void *, void *, size_t),
+    void *arg)
+{
+	prop_dictionary_t dict = NULL;
+	_prop_stream_markup_t type;
+	const char *tag;
+	char *buf = NULL, *nbuf;
+	size_t bufsize = 0, len = 0, off = 0, scan = 0, total = 0, n;
+	unsigned int depth = 0, nobjs = 0;
+	ssize_t rd;
+	bool plist = false, body = false, done = false;
+
+	for (;;) {
+		/* Keep the markup not internalized yet, and read more. */
+		if (off > 0) {
+			memmove(buf, buf + off, len - off);
+			len -= off;
+			scan -= off;
+			off = 0;
+		}
+		if (bufsize - len < STREAM_READSIZE + 1) {
+			n = bufsize ? bufsize * 2 : STREAM_READSIZE * 2;
+			if ((nbuf = _PROP_REALLOC(buf, n, M_TEMP)) == NULL)
+				goto fail;
+			buf = nbuf;
+			bufsize = n;
+		}
+		if ((rd = (*readfn)(arg, buf + len, bufsize - len - 1)) <= 0)
+			goto fail;
+		len += rd;
+		total += rd;
+		buf[len] = '\0';
+
+		if (!body && buf[0] == '\0') {
+			/* binary representation */
+			while ((rd = (*readfn)(arg, buf + len,
+			    bufsize - len - 1)) > 0) {
+				len += rd;
+				if (bufsize - len >= STREAM_READSIZE + 1)
+					continue;
+				if ((nbuf = _PROP_REALLOC(buf, bufsize * 2,
+				    M_TEMP)) == NULL)
+					goto fail;
+				buf = nbuf;
+				bufsize *= 2;
+			}
+			if (rd == 0)
+				dict = prop_dictionary_internalize_buffer(buf,
+				    len);
+			_PROP_FREE(buf, M_TEMP);
+			return (dict);
+		}
+
+		while (scan < len &&
+		    (n = _prop_stream_markup(buf + scan, buf + len, &type)) > 0) {
+			tag = buf + scan;
+			scan += n;
+			if (type == STREAM_TEXT || type == STREAM_OTHER)
+				continue;
+
+			if (done) {
+				/* only </plist> can follow */
+				if (type != STREAM_END ||
+				    !STREAM_TAG_MATCH(tag + 1, "plist"))
+					goto fail;
+				_prop_object_internalized(total);
+				goto out;
+			}
+			if (!body) {
+				/* <plist version="1.0"> then <dict> */
+				if (!plist && type == STREAM_START &&
+				    STREAM_TAG_MATCH(tag, "plist")) {
+					plist = true;
+					continue;
+				}
+				if (!plist || !STREAM_TAG_MATCH(tag, "dict") ||
+				    (type != STREAM_START && type != STREAM_EMPTY))
+					goto fail;
+				if ((dict = prop_dictionary_create()) == NULL)
+					goto fail;
+				body = true;
+				done = type == STREAM_EMPTY;
+				off = scan;
+				continue;
+			}
+			if (type == STREAM_START) {
+				depth++;
+				continue;
+			} else if (type == STREAM_END) {
+				/* </dict> of the top level dictionary */
+				if (depth == 0) {
+					if (nobjs != 0 ||
+					    !STREAM_TAG_MATCH(tag + 1, "dict"))
+						goto fail;
+					done = true;
+					continue;
+				}
+				if (--depth > 0)
+					continue;
+			} else if (depth > 0) {
+				continue;
+			}
+			/* the key and the object are complete */
+			if (++nobjs < 2)
+				continue;
+			if (!_prop_stream_entry(dict, buf + off, buf + scan))
+				goto fail;
+			off = scan;
+			nobjs = 0;
+		}
+	}
+ fail:
+	if (dict != NULL) {
+		prop_object_release(dict);
+		dict = NULL;
+	}
+ out:
+	if (buf != NULL)
+		_PROP_FREE(buf, M_TEMP);
+	return (dict);
+}
+
 /*
  * _prop_object_internalize_context_alloc --
  *	Allocate an internalize context.
@@ -816,63 +1766,79 @@ _prop_object_externalize_file_dirname(const char *path, char *result)
 }
 
 /*
- * _prop_object_externalize_write_file --
- *	Write an externalized dictionary to the specified file.
- *	The file is written atomically from the caller's perspective,
- *	and the mode set to 0666 modified by the caller's umask.
- *
- *	The 'compress' argument enables gzip (via zlib) compression
- *	for the file to be written.
+ * _prop_object_externalize_file_open --
+ *	Create the temporary file a file is externalized to, tname
+ *	must be PATH_MAX bytes long.
  */
-bool
-_prop_object_externalize_write_file(const char *fname, const char *xml,
-    size_t len, bool do_compress)
+static int
+_prop_object_externalize_file_open(const char *fname, char *tname)
 {
-	gzFile gzf = NULL;
-	char tname[PATH_MAX];
 	int fd;
-	int save_errno;
 	mode_t myumask;
 
-	if (len > SSIZE_MAX) {
-		errno = EFBIG;
-		return (false);
-	}
-
 	/*
 	 * Get the directory name where the file is to be written
 	 * and create the temporary file.
 	 */
 	_prop_object_externalize_file_dirname(fname, tname);
 #define PLISTTMP "/.plistXXXXXX"
-	if (strlen(tname) + strlen(PLISTTMP) >= sizeof(tname)) {
+	if (strlen(tname) + strlen(PLISTTMP) >= PATH_MAX) {
 		errno = ENAMETOOLONG;
-		return (false);
+		return (-1);
 	}
 	strcat(tname, PLISTTMP);
 #undef PLISTTMP
 
 	myumask = umask(S_IXUSR|S_IRWXG|S_IRWXO);
-	if ((fd = mkstemp(tname)) == -1) {
-		umask(myumask);
-		return (false);
-	}
+	fd = mkstemp(tname);
 	umask(myumask);
 
-	if (do_compress) {
-		if ((gzf = gzdopen(fd, "a")) == NULL)
-			goto bad;
+	return (fd);
+}
 
-		if (gzsetparams(gzf, Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY))
-			goto bad;
+/*
+ * _prop_object_externalize_file_gzopen --
+ *	Set up gzip compression of the temporary file.
+ */
+static gzFile
+_prop_object_externalize_file_gzopen(int fd)
+{
+	gzFile gzf;
+	int gzfd;
 
-		if (gzwrite(gzf, xml, len) != (ssize_t)len)
-			goto bad;
-	} else {
-		if (write(fd, xml, len) != (ssize_t)len)
-			goto bad;
+	if ((gzfd = dup(fd)) == -1)
+		return (NULL);
+	if ((gzf = gzdopen(gzfd, "a")) == NULL) {
+		(void)close(gzfd);
+		return (NULL);
 	}
+	if (gzsetparams(gzf, Z_BEST_COMPRESSION, Z_DEFAULT_STRATEGY) != Z_OK) {
+		(void)gzclose(gzf);
+		return (NULL);
+	}
+	return (gzf);
+}
 
+/*
+ * _prop_object_externalize_file_close --
+ *	Sync and close the temporary file and, if everything was
+ *	written, rename it to fname; it is removed otherwise.
+ *	gzf writes to a dup of fd, so that all compressed data
+ *	is out once it's closed and can be synced.
+ */
+static bool
+_prop_object_externalize_file_close(int fd, gzFile gzf, const char *tname,
+    const char *fname, bool ok)
+{
+	int save_errno;
+	mode_t myumask;
+
+	if (gzf != NULL && gzclose(gzf) != Z_OK)
+		ok = false;
+	if (!ok)
+		goto bad;
+
+	__atomic_fetch_add(&_prop_stats.ps_syncs, 1, __ATOMIC_RELAXED);
 #ifdef HAVE_FDATASYNC
 	if (fdatasync(fd) == -1)
 #else
@@ -885,29 +1851,147 @@ _prop_object_externalize_write_file(const char *fname, const char *xml,
 	if (fchmod(fd, 0666 & ~myumask) == -1)
 		goto bad;
 
-	if (do_compress)
-		(void)gzclose(gzf);
-	else
-		(void)close(fd);
+	(void)close(fd);
 
-	fd = -1;
-
-	if (rename(tname, fname) == -1)
-		goto bad;
+	if (rename(tname, fname) == -1) {
+		save_errno = errno;
+		(void) unlink(tname);
+		errno = save_errno;
+		return (false);
+	}
 
 	return (true);
 
  bad:
 	save_errno = errno;
-	if (do_compress && gzf != NULL)
-		(void)gzclose(gzf);
-	else if (fd != -1)
-		(void)close(fd);
+	(void)close(fd);
 	(void) unlink(tname);
 	errno = save_errno;
 	return (false);
 }
 
+/*
+ * _prop_object_externalize_write_file --
+ *	Write an externalized dictionary to the specified file.
+ *	The file is written atomically from the caller's perspective,
+ *	and the mode set to 0666 modified by the caller's umask.
+ *
+ *	The 'compress' argument enables gzip (via zlib) compression
+ *	for the file to be written.
+ */
+bool
+_prop_object_externalize_write_file(const char *fname, const char *xml,
+    size_t len, bool do_compress)
+{
+	gzFile gzf = NULL;
+	char tname[PATH_MAX];
+	int fd;
+	bool ok = false;
+
+	if (len > SSIZE_MAX) {
+		errno = EFBIG;
+		return (false);
+	}
+
+	if ((fd = _prop_object_externalize_file_open(fname, tname)) == -1)
+		return (false);
+
+	if (do_compress) {
+		if ((gzf = _prop_object_externalize_file_gzopen(fd)) != NULL &&
+		    gzwrite(gzf, xml, len) == (ssize_t)len)
+			ok = true;
+	} else {
+		if (write(fd, xml, len) == (ssize_t)len)
+			ok = true;
+	}
+
+	return (_prop_object_externalize_file_close(fd, gzf, tname, fname, ok));
+}
+
+/*
+ * _prop_object_externalize_to_file --
+ *	Externalize an object to the specified file like
+ *	_prop_object_externalize_write_file() does, but streaming
+ *	the XML through a fixed size buffer instead of building the
+ *	whole document in memory first.
+ */
+bool
+_prop_object_externalize_to_file(prop_object_t obj, const char *fname,
+    bool do_compress)
+{
+	struct _prop_object_externalize_context *ctx;
+	gzFile gzf = NULL;
+	char tname[PATH_MAX], *buf;
+	int fd, save_errno;
+	bool ok = false;
+
+	if ((fd = _prop_object_externalize_file_open(fname, tname)) == -1)
+		return (false);
+
+	if ((ctx = _prop_object_externalize_context_alloc()) == NULL)
+		return (_prop_object_externalize_file_close(fd, NULL, tname,
+		    fname, false));
+	if ((buf = _PROP_REALLOC(ctx->poec_buf, BUF_STREAM, M_TEMP)) == NULL)
+		goto out;
+	ctx->poec_buf = buf;
+	ctx->poec_capacity = BUF_STREAM;
+	ctx->poec_fd = fd;
+
+	if (do_compress) {
+		if ((gzf = _prop_object_externalize_file_gzopen(fd)) == NULL)
+			goto out;
+		ctx->poec_gzf = gzf;
+	}
+
+	ok = _prop_object_externalize_header(ctx) &&
+	    (*_prop_object_type_of(obj)->pot_extern)(ctx, obj) &&
+	    _prop_object_externalize_footer(ctx) &&
+	    _prop_object_externalize_flush(ctx);
+
+ out:
+	save_errno = errno;
+	_PROP_FREE(ctx->poec_buf, M_TEMP);
+	_prop_object_externalize_context_free(ctx);
+	errno = save_errno;
+
+	return (_prop_object_externalize_file_close(fd, gzf, tname, fname, ok));
+}
+
+/*
+ * _prop_object_externalize_to_stream --
+ *	Externalize an object through a fixed size buffer, written with
+ *	writefn(arg, buf, len): it returns the number of bytes written or
+ *	-1 on error.  The whole document is never kept in memory.
+ */
+bool
+_prop_object_externalize_to_stream(prop_object_t obj,
+    ssize_t (*writefn)(void *, const void *, size_t), void *arg)
+{
+	struct _prop_object_externalize_context *ctx;
+	char *buf;
+	bool ok = false;
+
+	if ((ctx = _prop_object_externalize_context_alloc()) == NULL)
+		return (false);
+	if ((buf = _PROP_REALLOC(ctx->poec_buf, BUF_STREAM, M_TEMP)) == NULL)
+		goto out;
+	ctx->poec_buf = buf;
+	ctx->poec_capacity = BUF_STREAM;
+	ctx->poec_writefn = writefn;
+	ctx->poec_warg = arg;
+
+	ok = _prop_object_externalize_header(ctx) &&
+	    (*_prop_object_type_of(obj)->pot_extern)(ctx, obj) &&
+	    _prop_object_externalize_footer(ctx) &&
+	    _prop_object_externalize_flush(ctx);
+
+ out:
+	_PROP_FREE(ctx->poec_buf, M_TEMP);
+	_prop_object_externalize_context_free(ctx);
+
+	return (ok);
+}
+
 /*
  * _prop_object_internalize_map_file --
  *	Map a file for the purpose of internalizing it.
@@ -1007,6 +2091,9 @@ prop_object_retain(prop_object_t obj)
 	struct _prop_object *po = obj;
 	uint32_t ncnt _PROP_ARG_UNUSED;
 
+	if (_PROP_TAGGED(obj))
+		return;
+
 	_PROP_ATOMIC_INC32_NV(&po->po_refcnt, ncnt);
 	_PROP_ASSERT(ncnt != 0);
 }
@@ -1032,6 +2119,10 @@ prop_object_release_emergency(prop_object_t obj)
 		po = obj;
 		_PROP_ASSERT(obj);
 
+		/* Tagged objects are not reference counted. */
+		if (_PROP_TAGGED(obj))
+			break;
+
 		if (po->po_type->pot_lock != NULL)
 		po->po_type->pot_lock();
 
@@ -1092,6 +2183,12 @@ prop_object_release(prop_object_t obj)
 			po = obj;
 			_PROP_ASSERT(obj);
 
+			/* Tagged objects are not reference counted. */
+			if (_PROP_TAGGED(obj)) {
+				ret = _PROP_OBJECT_FREE_DONE;
+				break;
+			}
+
 			if (po->po_type->pot_lock != NULL)
 				po->po_type->pot_lock();
 
@@ -1124,6 +2221,182 @@ prop_object_release(prop_object_t obj)
 	} while (_prop_stack_pop(&stack, &obj, NULL, NULL, NULL));
 }
 
+/*
+ * _prop_object_walk_modified --
+ *	Look for modified objects in the tree rooted at obj, clearing
+ *	their flag if clear is set.
+ */
+static bool
+_prop_object_walk_modified(prop_object_t obj, bool clear)
+{
+	struct _prop_object *po = obj;
+	prop_object_iterator_t iter;
+	prop_object_t o;
+	bool rv;
+
+	if (_PROP_TAGGED(obj))
+		return (false);
+
+	rv = (po->po_flags & PO_F_MODIFIED) != 0;
+	if (clear)
+		po->po_flags &= ~PO_F_MODIFIED;
+	else if (rv)
+		return (true);
+
+	switch (prop_object_type(obj)) {
+	case PROP_TYPE_DICTIONARY:
+		if ((iter = prop_dictionary_iterator(obj)) == NULL)
+			return (true);
+		while ((o = prop_object_iterator_next(iter)) != NULL) {
+			o = prop_dictionary_get_keysym(obj, o);
+			if (_prop_object_walk_modified(o, clear)) {
+				rv = true;
+				if (!clear)
+					break;
+			}
+		}
+		prop_object_iterator_release(iter);
+		break;
+	case PROP_TYPE_ARRAY:
+		if ((iter = prop_array_iterator(obj)) == NULL)
+			return (true);
+		while ((o = prop_object_iterator_next(iter)) != NULL) {
+			if (_prop_object_walk_modified(o, clear)) {
+				rv = true;
+				if (!clear)
+					break;
+			}
+		}
+		prop_object_iterator_release(iter);
+		break;
+	default:
+		break;
+	}
+
+	return (rv);
+}
+
+/*
+ * prop_object_modified --
+ *	Returns true if the object or any object it contains has been
+ *	modified since it was created or prop_object_clear_modified()
+ *	was last called on it.
+ */
+bool
+prop_object_modified(prop_object_t obj)
+{
+
+	return (_prop_object_walk_modified(obj, false));
+}
+
+/*
+ * prop_object_clear_modified --
+ *	Mark the object and all objects it contains as unmodified.
+ */
+void
+prop_object_clear_modified(prop_object_t obj)
+{
+
+	(void)_prop_object_walk_modified(obj, true);
+}
+
+/*
+ * _prop_object_internalized --
+ *	Count an object internalized from len bytes.
+ */
+void
+_prop_object_internalized(size_t len)
+{
+
+	__atomic_fetch_add(&_prop_stats.ps_internalized, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&_prop_stats.ps_internalized_bytes, len,
+	    __ATOMIC_RELAXED);
+}
+
+/*
+ * prop_object_stats --
+ *	Copy the counters of the objects internalized and the files
+ *	externalized by the process so far to ps.
+ */
+void
+prop_object_stats(struct prop_stats *ps)
+{
+
+	ps->ps_internalized = __atomic_load_n(&_prop_stats.ps_internalized,
+	    __ATOMIC_RELAXED);
+	ps->ps_internalized_bytes =
+	    __atomic_load_n(&_prop_stats.ps_internalized_bytes,
+	    __ATOMIC_RELAXED);
+	ps->ps_syncs = __atomic_load_n(&_prop_stats.ps_syncs, __ATOMIC_RELAXED);
+}
+
+/*
+ * prop_object_memstat --
+ *	Add the objects in the tree rooted at obj, and the memory used by
+ *	them, to the counters of ms.  Objects referenced more than once,
+ *	like interned strings or the storage shared by copied
+ *	dictionaries, are counted every time.
+ */
+void
+prop_object_memstat(prop_object_t obj, struct prop_memstat *ms)
+{
+	const struct _prop_object_type *pot;
+	prop_object_iterator_t iter;
+	prop_object_t o;
+	prop_memstat_type_t t;
+
+	if (obj == NULL)
+		return;
+
+	pot = _prop_object_type_of(obj);
+	switch (pot->pot_type) {
+	case PROP_TYPE_BOOL:
+		t = PROP_MEMSTAT_BOOL;
+		break;
+	case PROP_TYPE_NUMBER:
+		t = PROP_MEMSTAT_NUMBER;
+		break;
+	case PROP_TYPE_STRING:
+		t = PROP_MEMSTAT_STRING;
+		break;
+	case PROP_TYPE_DATA:
+		t = PROP_MEMSTAT_DATA;
+		break;
+	case PROP_TYPE_ARRAY:
+		t = PROP_MEMSTAT_ARRAY;
+		break;
+	case PROP_TYPE_DICTIONARY:
+		t = PROP_MEMSTAT_DICTIONARY;
+		break;
+	case PROP_TYPE_DICT_KEYSYM:
+		t = PROP_MEMSTAT_DICT_KEYSYM;
+		break;
+	default:
+		return;
+	}
+	ms->pm_objects[t]++;
+	/* Tagged objects are never allocated. */
+	if (!_PROP_TAGGED(obj) && pot->pot_size != NULL)
+		ms->pm_bytes[t] += (*pot->pot_size)(obj);
+
+	if (t == PROP_MEMSTAT_DICTIONARY) {
+		if ((iter = prop_dictionary_iterator(obj)) == NULL)
+			return;
+		while ((o = prop_object_iterator_next(iter)) != NULL) {
+			prop_object_memstat(o, ms);
+			prop_object_memstat(
+			    prop_dictionary_get_keysym(obj, o), ms);
+		}
+		prop_object_iterator_release(iter);
+	} else if (t == PROP_MEMSTAT_ARRAY) {
+		if ((iter = prop_array_iterator(obj)) == NULL)
+			return;
+		while ((o = prop_object_iterator_next(iter)) != NULL)
+			prop_object_memstat(o, ms);
+		prop_object_iterator_release(iter);
+	}
+}
+
 /*
  * prop_object_type --
  *	Return the type of an object.
@@ -1131,12 +2404,11 @@ prop_object_release(prop_object_t obj)
 prop_type_t
 prop_object_type(prop_object_t obj)
 {
-	struct _prop_object *po = obj;
 
 	if (obj == NULL)
 		return (PROP_TYPE_UNKNOWN);
 
-	return (po->po_type->pot_type);
+	return (_prop_object_type_of(obj)->pot_type);
 }
 
 /*
@@ -1170,11 +2442,11 @@ prop_object_equals_with_error(prop_object_t obj1, prop_object_t obj2,
 	po1 = obj1;
 	po2 = obj2;
 
-	if (po1->po_type != po2->po_type)
+	if (_prop_object_type_of(po1) != _prop_object_type_of(po2))
 		return (false);
     
  continue_subtree:
-	ret = (*po1->po_type->pot_equals)(obj1, obj2,
+	ret = (*_prop_object_type_of(po1)->pot_equals)(obj1, obj2,
 					  &stored_pointer1, &stored_pointer2,
 					  &next_obj1, &next_obj2);
 	if (ret == _PROP_OBJECT_EQUALS_FALSE)
@@ -40,6 +40,10 @@ struct _prop_object_externalize_context {
 	size_t		poec_capacity;		/* capacity of buffer */
 	size_t		poec_len;		/* current length of string */
 	unsigned int	poec_depth;		/* nesting depth */
+	int		poec_fd;		/* output file, -1 if none */
+	void *		poec_gzf;		/* gzFile if compressing */
+	ssize_t		(*poec_writefn)(void *, const void *, size_t);
+	void *		poec_warg;		/* writefn argument */
 };
 
 bool		_prop_object_externalize_start_tag(
@@ -143,6 +147,14 @@ void		_prop_object_internalize_context_free(
 
 bool		_prop_object_externalize_write_file(const char *,
 						    const char *, size_t, bool);
+bool		_prop_object_externalize_to_file(prop_object_t,
+						 const char *, bool);
+bool		_prop_object_externalize_to_stream(prop_object_t,
+		    ssize_t (*)(void *, const void *, size_t), void *);
+
+size_t		_prop_binary_detect(const void *, size_t);
+prop_object_t	_prop_binary_internalize(const void *, size_t);
+void *		_prop_binary_externalize(prop_object_t, size_t *);
 
 struct _prop_object_internalize_mapped_file {
 	char *	poimf_xml;
@@ -174,6 +186,10 @@ bool		_prop_number_internalize(prop_stack_t, prop_object_t *,
 				struct _prop_object_internalize_context *);
 bool		_prop_string_internalize(prop_stack_t, prop_object_t *,
 				struct _prop_object_internalize_context *);
+prop_object_t	_prop_string_create_internalized(const char *, size_t);
+void		_prop_array_internalize_key(const char *, prop_object_t);
+void		_prop_object_internalized(size_t);
+void		_prop_string_intern_release(void *);
 
 struct _prop_object_type {
 	/* type indicator */
@@ -205,13 +221,57 @@ struct _prop_object_type {
 	void	(*pot_equals_finish)(prop_object_t, prop_object_t);
 	void    (*pot_lock)(void);
 	void    (*pot_unlock)(void);
+	/* func to return the memory owned by object, not its children */
+	size_t	(*pot_size)(prop_object_t);
 };
 
 struct _prop_object {
 	const struct _prop_object_type *po_type;/* type descriptor */
 	uint32_t	po_refcnt;		/* reference count */
+	uint32_t	po_flags;
 };
 
+#define	PO_F_MODIFIED		0x01	/* see prop_object_modified() */
+
+#define	_PROP_OBJECT_MODIFIED(obj)					\
+	(((struct _prop_object *)(obj))->po_flags |= PO_F_MODIFIED)
+
+/*
+ * Booleans and the numbers that fit in a pointer are never allocated:
+ * their value is stored in the object pointer itself, which is told
+ * apart from a real object by its low bit.  Tagged objects have no
+ * reference count nor flags; _prop_object_type_of() returns their
+ * type descriptor.
+ */
+#define	_PROP_TAG_OBJECT	0x01	/* tagged object */
+#define	_PROP_TAG_BOOL		0x02	/* boolean, otherwise a number */
+#define	_PROP_TAG_UNSIGNED	0x04	/* unsigned number */
+#define	_PROP_TAG_SHIFT		3
+
+#define	_PROP_TAG_MIN		(INTPTR_MIN >> _PROP_TAG_SHIFT)
+#define	_PROP_TAG_MAX		(INTPTR_MAX >> _PROP_TAG_SHIFT)
+
+#define	_PROP_TAGGED(obj)						\
+	(((uintptr_t)(obj) & _PROP_TAG_OBJECT) != 0)
+#define	_PROP_TAG(val, flags)						\
+	((void *)(((uintptr_t)(val) << _PROP_TAG_SHIFT) |		\
+	    _PROP_TAG_OBJECT | (flags)))
+#define	_PROP_TAG_VALUE(obj)						\
+	((intptr_t)(uintptr_t)(obj) >> _PROP_TAG_SHIFT)
+
+extern const struct _prop_object_type _prop_object_type_bool;
+extern const struct _prop_object_type _prop_object_type_number;
+
+static inline const struct _prop_object_type *
+_prop_object_type_of(const void *obj)
+{
+
+	if (_PROP_TAGGED(obj))
+		return (((uintptr_t)obj & _PROP_TAG_BOOL) ?
+		    &_prop_object_type_bool : &_prop_object_type_number);
+	return (((const struct _prop_object *)obj)->po_type);
+}
+
 void		_prop_object_init(struct _prop_object *,
 				  const struct _prop_object_type *);
 void		_prop_object_fini(struct _prop_object *);
@@ -249,17 +309,68 @@ struct _prop_object_iterator {
 #define	_PROP_REALLOC(v, s, t)		realloc((v), (s))
 #define	_PROP_FREE(v, t)		free((v))
 
-#define	_PROP_POOL_GET(p)		malloc((p))
-#define	_PROP_POOL_PUT(p, v)		free((v))
-
-#define	_PROP_POOL_INIT(p, s, d)	static const size_t p = s;
-
 #define	_PROP_MALLOC_DEFINE(t, s, l)	/* nothing */
 
 /*
  * Use pthread mutexes everywhere else.
  */
 #include <pthread.h>
+
+/*
+ * Fixed size objects are allocated from pools of slabs, with a cache
+ * of free objects per thread; see prop_object.c.
+ */
+struct _prop_slab;
+
+struct _prop_pool {
+	size_t		pp_size;	/* object size */
+	size_t		pp_hdr;		/* arena header before objects */
+	const char	*pp_name;
+	pthread_mutex_t	pp_mutex;
+	struct _prop_slab *pp_partial;	/* slabs with free objects */
+	struct _prop_slab *pp_spare;	/* an empty slab kept around */
+	struct _prop_pool *pp_next;	/* in the list of used pools */
+	bool		pp_listed;
+};
+
+struct _prop_pool_cache {
+	struct _prop_pool *ppc_pool;	/* NULL until first used */
+	struct _prop_pool_cache *ppc_next;
+	void		*ppc_free;
+	unsigned int	ppc_count;
+};
+
+void *		_prop_pool_get(struct _prop_pool *, struct _prop_pool_cache *);
+size_t		_prop_pool_objsize(const struct _prop_pool *);
+void		_prop_pool_put(struct _prop_pool *, struct _prop_pool_cache *,
+		    void *);
+
+#define	_PROP_POOL_GET(p)		_prop_pool_get(&(p), &(p##_cache))
+#define	_PROP_POOL_PUT(p, v)		_prop_pool_put(&(p), &(p##_cache), (v))
+
+#define	_PROP_POOL_DEFINE(p, s, h, d)					\
+	static struct _prop_pool p = {					\
+		.pp_size = (s), .pp_hdr = (h), .pp_name = (d),		\
+		.pp_mutex = PTHREAD_MUTEX_INITIALIZER			\
+	};								\
+	static __thread struct _prop_pool_cache p##_cache;
+
+#define	_PROP_POOL_INIT(p, s, d)	_PROP_POOL_DEFINE(p, s, 0, d)
+
+/* Objects that can be allocated from an arena, see prop_object.c. */
+#define	_PROP_ARENA_HDRSIZE		(2 * sizeof(void *))
+#define	_PROP_ARENA_POOL_INIT(p, s, d)					\
+	_PROP_POOL_DEFINE(p, s, _PROP_ARENA_HDRSIZE, d)
+
+void *		_prop_arena_alloc(size_t);
+void **		_prop_arena_strings(void);
+void *		_prop_arena_get(struct _prop_pool *, struct _prop_pool_cache *);
+void		_prop_arena_put(struct _prop_pool *, struct _prop_pool_cache *,
+		    void *);
+
+#define	_PROP_ARENA_GET(p)		_prop_arena_get(&(p), &(p##_cache))
+#define	_PROP_ARENA_PUT(p, v)		_prop_arena_put(&(p), &(p##_cache), (v))
+#define	_PROP_MUTEX_DECL(x)		pthread_mutex_t x;
 #define	_PROP_MUTEX_DECL_STATIC(x)	static pthread_mutex_t x;
 #define	_PROP_MUTEX_INIT(x)		pthread_mutex_init(&(x), NULL)
 #define	_PROP_MUTEX_LOCK(x)		pthread_mutex_lock(&(x))
@@ -279,6 +390,8 @@ struct _prop_object_iterator {
 #ifndef HAVE_ATOMICS /* NO ATOMIC SUPPORT, USE A MUTEX */
 
 #define _PROP_NEED_REFCNT_MTX
+extern pthread_mutex_t _prop_refcnt_mtx;
+
 #define _PROP_ATOMIC_INC32(x) \
 	do { \
 		pthread_mutex_lock(&_prop_refcnt_mtx); \
@@ -303,6 +416,13 @@ struct _prop_object_iterator {
 		v = --(*(x)); \
 		pthread_mutex_unlock(&_prop_refcnt_mtx); \
 	} while (/*CONSTCOND*/0)
+/* Increment unless zero, v is 0 if it was. */
+#define _PROP_ATOMIC_INC32_NZ(x, v) \
+	do { \
+		pthread_mutex_lock(&_prop_refcnt_mtx); \
+		v = *(x) != 0 ? ++(*(x)) : 0; \
+		pthread_mutex_unlock(&_prop_refcnt_mtx); \
+	} while (/*CONSTCOND*/0)
 
 #else /* GCC ATOMIC BUILTINS */
 
@@ -326,6 +446,17 @@ do {									\
 	v = __sync_sub_and_fetch(x, 1);					\
 } while (/*CONSTCOND*/0)
 
+/* Increment unless zero, v is 0 if it was. */
+#define _PROP_ATOMIC_INC32_NZ(x, v)					\
+do {									\
+	uint32_t _ocnt;							\
+	do {								\
+		_ocnt = *(volatile uint32_t *)(x);			\
+		v = _ocnt != 0 ? _ocnt + 1 : 0;				\
+	} while (_ocnt != 0 &&						\
+	    !__sync_bool_compare_and_swap(x, _ocnt, _ocnt + 1));	\
+} while (/*CONSTCOND*/0)
+
 #endif /* !HAVE_ATOMICS */
 
 /*
@@ -45,12 +45,29 @@ struct _prop_string {
 };
 
 #define	PS_F_NOCOPY		0x01
+#define	PS_F_ARENA		0x02	/* ps_mutable lives in an arena */
+#define	PS_F_INTERNED		0x04	/* shared, immutable */
 
-_PROP_POOL_INIT(_prop_string_pool, sizeof(struct _prop_string), "propstng")
+/*
+ * Strings internalized in an arena set up with prop_object_arena_intern()
+ * are interned in a table that lives as long as the arena is open: the
+ * same value is the same immutable object, retained once more for every
+ * occurrence.  Only values up to PS_INTERN_MAXLEN bytes are interned.
+ */
+#define	PS_INTERN_MAXLEN	128
+
+struct _prop_string_intern {
+	prop_string_t		*psi_tab;
+	size_t			psi_size;	/* power of two */
+	size_t			psi_count;
+};
+
+_PROP_ARENA_POOL_INIT(_prop_string_pool, sizeof(struct _prop_string), "propstng")
 
 
 static _prop_object_free_rv_t
 		_prop_string_free(prop_stack_t, prop_object_t *);
+static size_t	_prop_string_size(prop_object_t);
 static bool	_prop_string_externalize(
 				struct _prop_object_externalize_context *,
 				void *);
@@ -64,10 +81,11 @@ static const struct _prop_object_type _prop_object_type_string = {
 	.pot_free	=	_prop_string_free,
 	.pot_extern	=	_prop_string_externalize,
 	.pot_equals	=	_prop_string_equals,
+	.pot_size	=	_prop_string_size,
 };
 
 #define	prop_object_is_string(x)	\
-	((x) != NULL && (x)->ps_obj.po_type == &_prop_object_type_string)
+	((x) != NULL && _prop_object_type_of(x) == &_prop_object_type_string)
 #define	prop_string_contents(x)  ((x)->ps_immutable ? (x)->ps_immutable : "")
 
 /* ARGSUSED */
@@ -76,13 +94,26 @@ _prop_string_free(prop_stack_t stack, prop_object_t *obj)
 {
 	prop_string_t ps = *obj;
 
-	if ((ps->ps_flags & PS_F_NOCOPY) == 0 && ps->ps_mutable != NULL)
+	if ((ps->ps_flags & (PS_F_NOCOPY|PS_F_ARENA)) == 0 &&
+	    ps->ps_mutable != NULL)
 	    	_PROP_FREE(ps->ps_mutable, M_PROP_STRING);
-	_PROP_POOL_PUT(_prop_string_pool, ps);
+	_PROP_ARENA_PUT(_prop_string_pool, ps);
 
 	return (_PROP_OBJECT_FREE_DONE);
 }
 
+static size_t
+_prop_string_size(prop_object_t v)
+{
+	prop_string_t ps = v;
+	size_t size = _prop_pool_objsize(&_prop_string_pool);
+
+	if ((ps->ps_flags & PS_F_NOCOPY) == 0 && ps->ps_mutable != NULL)
+		size += ps->ps_size + 1;
+
+	return (size);
+}
+
 static bool
 _prop_string_externalize(struct _prop_object_externalize_context *ctx,
 			 void *v)
@@ -125,7 +156,7 @@ _prop_string_alloc(void)
 {
 	prop_string_t ps;
 
-	ps = _PROP_POOL_GET(_prop_string_pool);
+	ps = _PROP_ARENA_GET(_prop_string_pool);
 	if (ps != NULL) {
 		_prop_object_init(&ps->ps_obj, &_prop_object_type_string);
 
@@ -137,6 +168,143 @@ _prop_string_alloc(void)
 	return (ps);
 }
 
+static uint32_t
+_prop_string_hash(const char *str, size_t len)
+{
+	uint32_t h = 2166136261U;
+
+	while (len-- > 0) {
+		h ^= (unsigned char)*str++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+/*
+ * _prop_string_intern --
+ *	Look up a value in the string table of the current arena.
+ *	Returns the interned string retained, or NULL and the slot where
+ *	it should be added in *slotp (NULL if there's no table).
+ */
+static prop_string_t
+_prop_string_intern(const char *str, size_t len, prop_string_t **slotp)
+{
+	struct _prop_string_intern *psi;
+	prop_string_t ps, *tab;
+	void **tabp;
+	size_t i, nsize;
+
+	*slotp = NULL;
+	if (len > PS_INTERN_MAXLEN || (tabp = _prop_arena_strings()) == NULL)
+		return (NULL);
+
+	if ((psi = *tabp) == NULL) {
+		if ((psi = _PROP_CALLOC(sizeof(*psi), M_TEMP)) == NULL)
+			return (NULL);
+		*tabp = psi;
+	}
+	if (psi->psi_count * 2 >= psi->psi_size) {
+		nsize = psi->psi_size ? psi->psi_size * 2 : 1024;
+		tab = _PROP_CALLOC(nsize * sizeof(*tab), M_TEMP);
+		if (tab == NULL)
+			return (NULL);
+		for (i = 0; i < psi->psi_size; i++) {
+			size_t j;
+
+			if ((ps = psi->psi_tab[i]) == NULL)
+				continue;
+			j = _prop_string_hash(ps->ps_immutable, ps->ps_size);
+			while (tab[j & (nsize - 1)] != NULL)
+				j++;
+			tab[j & (nsize - 1)] = ps;
+		}
+		_PROP_FREE(psi->psi_tab, M_TEMP);
+		psi->psi_tab = tab;
+		psi->psi_size = nsize;
+	}
+
+	i = _prop_string_hash(str, len);
+	for (;; i++) {
+		ps = psi->psi_tab[i & (psi->psi_size - 1)];
+		if (ps == NULL)
+			break;
+		if (ps->ps_size == len && memcmp(ps->ps_immutable, str, len) == 0) {
+			prop_object_retain(ps);
+			return (ps);
+		}
+	}
+	*slotp = &psi->psi_tab[i & (psi->psi_size - 1)];
+
+	return (NULL);
+}
+
+static void
+_prop_string_intern_add(prop_string_t ps, prop_string_t *slot)
+{
+	struct _prop_string_intern *psi = *_prop_arena_strings();
+
+	ps->ps_flags |= PS_F_INTERNED;
+	prop_object_retain(ps);
+	*slot = ps;
+	psi->psi_count++;
+}
+
+/*
+ * _prop_string_intern_release --
+ *	Release a string table, once its arena is closed.
+ */
+void
+_prop_string_intern_release(void *v)
+{
+	struct _prop_string_intern *psi = v;
+
+	if (psi == NULL)
+		return;
+	for (size_t i = 0; i < psi->psi_size; i++) {
+		if (psi->psi_tab[i] != NULL)
+			prop_object_release(psi->psi_tab[i]);
+	}
+	_PROP_FREE(psi->psi_tab, M_TEMP);
+	_PROP_FREE(psi, M_TEMP);
+}
+
+/*
+ * _prop_string_create_internalized --
+ *	Create an internalized string, interned if an arena is open.
+ */
+prop_object_t
+_prop_string_create_internalized(const char *str, size_t len)
+{
+	prop_string_t ps, *slot;
+	char *cp;
+	int flags;
+
+	if ((ps = _prop_string_intern(str, len, &slot)) != NULL)
+		return (ps);
+
+	if ((cp = _prop_arena_alloc(len + 1)) == NULL) {
+		if ((cp = _PROP_MALLOC(len + 1, M_PROP_STRING)) == NULL)
+			return (NULL);
+		flags = 0;
+	} else
+		flags = PS_F_ARENA;
+	memcpy(cp, str, len);
+	cp[len] = '\0';
+
+	if ((ps = _prop_string_alloc()) == NULL) {
+		if (flags == 0)
+			_PROP_FREE(cp, M_PROP_STRING);
+		return (NULL);
+	}
+	ps->ps_mutable = cp;
+	ps->ps_size = len;
+	ps->ps_flags = flags;
+	if (slot != NULL)
+		_prop_string_intern_add(ps, slot);
+
+	return (ps);
+}
+
 /*
  * prop_string_create --
  *	Create an empty mutable string.
@@ -209,7 +377,7 @@ prop_string_copy(prop_string_t ops)
 	ps = _prop_string_alloc();
 	if (ps != NULL) {
 		ps->ps_size = ops->ps_size;
-		ps->ps_flags = ops->ps_flags;
+		ps->ps_flags = ops->ps_flags & ~(PS_F_ARENA|PS_F_INTERNED);
 		if (ops->ps_flags & PS_F_NOCOPY)
 			ps->ps_immutable = ops->ps_immutable;
 		else {
@@ -277,7 +445,7 @@ prop_string_mutable(prop_string_t ps)
 	if (! prop_object_is_string(ps))
 		return (false);
 
-	return ((ps->ps_flags & PS_F_NOCOPY) == 0);
+	return ((ps->ps_flags & (PS_F_NOCOPY|PS_F_INTERNED)) == 0);
 }
 
 /*
@@ -330,7 +498,7 @@ prop_string_append(prop_string_t dst, prop_string_t src)
 	       prop_object_is_string(src)))
 		return (false);
 
-	if (dst->ps_flags & PS_F_NOCOPY)
+	if (dst->ps_flags & (PS_F_NOCOPY|PS_F_INTERNED))
 		return (false);
 
 	len = dst->ps_size + src->ps_size;
@@ -342,8 +510,10 @@ prop_string_append(prop_string_t dst, prop_string_t src)
 	ocp = dst->ps_mutable;
 	dst->ps_mutable = cp;
 	dst->ps_size = len;
-	if (ocp != NULL)
+	if (ocp != NULL && (dst->ps_flags & PS_F_ARENA) == 0)
 		_PROP_FREE(ocp, M_PROP_STRING);
+	dst->ps_flags &= ~PS_F_ARENA;
+	_PROP_OBJECT_MODIFIED(dst);
 	
 	return (true);
 }
@@ -364,7 +534,7 @@ prop_string_append_cstring(prop_string_t dst, const char *src)
 
 	_PROP_ASSERT(src != NULL);
 
-	if (dst->ps_flags & PS_F_NOCOPY)
+	if (dst->ps_flags & (PS_F_NOCOPY|PS_F_INTERNED))
 		return (false);
 	
 	len = dst->ps_size + strlen(src);
@@ -375,8 +545,10 @@ prop_string_append_cstring(prop_string_t dst, const char *src)
 	ocp = dst->ps_mutable;
 	dst->ps_mutable = cp;
 	dst->ps_size = len;
-	if (ocp != NULL)
+	if (ocp != NULL && (dst->ps_flags & PS_F_ARENA) == 0)
 		_PROP_FREE(ocp, M_PROP_STRING);
+	dst->ps_flags &= ~PS_F_ARENA;
+	_PROP_OBJECT_MODIFIED(dst);
 	
 	return (true);
 }
@@ -390,6 +562,9 @@ prop_string_equals(prop_string_t str1, prop_string_t str2)
 {
 	if (!prop_object_is_string(str1) || !prop_object_is_string(str2))
 		return (false);
+	/* interned values are the same object */
+	if (str1 == str2)
+		return (true);
 
 	return prop_object_equals(str1, str2);
 }
@@ -420,8 +595,9 @@ _prop_string_internalize(prop_stack_t stack, prop_object_t *obj,
     struct _prop_object_internalize_context *ctx)
 {
 	prop_string_t string;
-	char *str;
+	char *str, buf[PS_INTERN_MAXLEN + 1];
 	size_t len, alen;
+	int flags;
 
 	if (ctx->poic_is_empty_element) {
 		*obj = prop_string_create();
@@ -436,34 +612,51 @@ _prop_string_internalize(prop_stack_t stack, prop_object_t *obj,
 	if (_prop_object_internalize_decode_string(ctx, NULL, 0, &len,
 						   NULL) == false)
 		return (true);
-	
-	str = _PROP_MALLOC(len + 1, M_PROP_STRING);
-	if (str == NULL)
+
+	/* Values that can be interned are decoded before looking them up. */
+	if (len <= PS_INTERN_MAXLEN && _prop_arena_strings() != NULL) {
+		if (_prop_object_internalize_decode_string(ctx, buf, len,
+		    &alen, &ctx->poic_cp) == false || alen != len ||
+		    _prop_object_internalize_find_tag(ctx, "string",
+		    _PROP_TAG_TYPE_END) == false)
+			return (true);
+		*obj = _prop_string_create_internalized(buf, len);
 		return (true);
+	}
+	
+	/* The string object is allocated from the same arena, if any. */
+	if ((str = _prop_arena_alloc(len + 1)) == NULL) {
+		str = _PROP_MALLOC(len + 1, M_PROP_STRING);
+		if (str == NULL)
+			return (true);
+		flags = 0;
+	} else
+		flags = PS_F_ARENA;
 	
 	if (_prop_object_internalize_decode_string(ctx, str, len, &alen,
 						   &ctx->poic_cp) == false ||
-	    alen != len) {
-		_PROP_FREE(str, M_PROP_STRING);
-		return (true);
-	}
+	    alen != len)
+		goto bad;
 	str[len] = '\0';
 
 	if (_prop_object_internalize_find_tag(ctx, "string",
-					      _PROP_TAG_TYPE_END) == false) {
-		_PROP_FREE(str, M_PROP_STRING);
-		return (true);
-	}
+					      _PROP_TAG_TYPE_END) == false)
+		goto bad;
 
 	string = _prop_string_alloc();
-	if (string == NULL) {
-		_PROP_FREE(str, M_PROP_STRING);
-		return (true);
-	}
+	if (string == NULL)
+		goto bad;
 
 	string->ps_mutable = str;
 	string->ps_size = len;
+	string->ps_flags = flags;
 	*obj = string;
 
 	return (true);
+
+ bad:
+	if (flags == 0)
+		_PROP_FREE(str, M_PROP_STRING);
+
+	return (true);
 }
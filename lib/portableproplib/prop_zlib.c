@@ -31,25 +31,39 @@
 
 #define _READ_CHUNK	8192
 
+/*
+ * Internalizes an object of the given type from len bytes in either
+ * binary or (NUL-terminated) XML form.
+ */
+static prop_object_t
+_prop_zlib_internalize(const char *buf, size_t len, prop_type_t type)
+{
+	prop_object_t obj;
+
+	if (buf == NULL)
+		return NULL;
+	if (len && buf[0] == '\0')
+		obj = _prop_binary_internalize(buf, len);
+	else if (type == PROP_TYPE_ARRAY)
+		obj = prop_array_internalize(buf);
+	else
+		obj = prop_dictionary_internalize(buf);
+
+	if (obj != NULL && prop_object_type(obj) != type) {
+		prop_object_release(obj);
+		obj = NULL;
+	}
+	return obj;
+}
+
 #define TEMPLATE(type, objtype)								\
 bool											\
 prop ## type ## _externalize_to_zfile(prop ## type ## _t obj, const char *fname)	\
 {											\
-	char *xml;									\
-	bool rv;									\
-	int save_errno = 0;								\
-											\
-	xml = prop ## type ## _externalize(obj);					\
-	if (xml == NULL)								\
+	if (prop_object_type(obj) != PROP_TYPE_## objtype)				\
 		return false;								\
-	rv = _prop_object_externalize_write_file(fname, xml, strlen(xml), true);	\
-	if (rv == false)								\
-		save_errno = errno;							\
-	_PROP_FREE(xml, M_TEMP);							\
-	if (rv == false)								\
-		errno = save_errno;							\
 											\
-	return rv;									\
+	return _prop_object_externalize_to_file(obj, fname, true);			\
 }											\
 											\
 prop ## type ## _t									\
@@ -69,14 +83,16 @@ prop ## type ## _internalize_from_zfile(const char *fname)				\
 		return NULL;								\
 											\
 	/* If it's an ordinary uncompressed plist we are done */			\
-	obj = prop ## type ## _internalize(mf->poimf_xml);				\
-	if (prop_object_type(obj) == PROP_TYPE_## objtype)				\
+	obj = _prop_zlib_internalize(mf->poimf_xml, mf->poimf_mapsize,			\
+	    PROP_TYPE_## objtype);							\
+	if (obj != NULL)								\
 		goto out;								\
 											\
 	/* Output buffer (uncompressed) */						\
 	uncomp_xml = _PROP_MALLOC(_READ_CHUNK, M_TEMP);					\
 	if (uncomp_xml == NULL)								\
 		goto out;								\
+	uncomp_xml[0] = '\0';								\
 											\
 	/* Decompress the mmap'ed buffer with zlib */					\
 	strm.zalloc = Z_NULL;								\
@@ -107,15 +123,16 @@ prop ## type ## _internalize_from_zfile(const char *fname)				\
 		}									\
 		have = _READ_CHUNK - strm.avail_out;					\
 		totalsize += have;							\
-		uncomp_xml = _PROP_REALLOC(uncomp_xml, totalsize, M_TEMP);		\
+		uncomp_xml = _PROP_REALLOC(uncomp_xml, totalsize + 1, M_TEMP);		\
 		memcpy(uncomp_xml + totalsize - have, out, have);			\
+		uncomp_xml[totalsize] = '\0';						\
 	} while (strm.avail_out == 0);							\
 											\
 	/* we are done */								\
 out2:											\
 	(void)inflateEnd(&strm);							\
 out1:											\
-	obj = prop ## type ## _internalize(uncomp_xml);					\
+	obj = _prop_zlib_internalize(uncomp_xml, totalsize, PROP_TYPE_## objtype);	\
 	_PROP_FREE(uncomp_xml, M_TEMP);							\
 out:											\
 	_prop_object_internalize_unmap_file(mf);					\
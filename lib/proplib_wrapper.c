@@ -70,6 +70,12 @@ xbps_array_count(xbps_array_t a)
 	return prop_array_count(a);
 }
 
+uint32_t
+xbps_array_version(xbps_array_t a)
+{
+	return prop_array_version(a);
+}
+
 bool
 xbps_array_ensure_capacity(xbps_array_t a, unsigned int i)
 {
@@ -88,6 +94,29 @@ xbps_array_mutable(xbps_array_t a)
 	return prop_array_mutable(a);
 }
 
+/*
+ * The arrays matched in the innermost loops of the resolver are packed
+ * by the internalizers, set up when libxbps is loaded so that it's done
+ * before anything is internalized.
+ */
+static const char * const packed_keys[] = {
+	"run_depends", "shlib-requires", "shlib-provides", "provides",
+	"conflicts", NULL
+};
+
+static void __attribute__((constructor))
+packed_keys_init(void)
+{
+	prop_array_pack_keys(packed_keys, xbps_pkg_name_len);
+}
+
+bool HIDDEN
+xbps_array_packed(xbps_array_t a, struct xbps_array_packed *pk)
+{
+	pk->strs = prop_array_packed(a, &pk->count, &pk->offs, &pk->namelen);
+	return pk->strs != NULL;
+}
+
 xbps_object_iterator_t
 xbps_array_iterator(xbps_array_t a)
 {
@@ -368,6 +397,13 @@ xbps_array_add_and_rel(xbps_array_t a, xbps_object_t o)
 	return prop_array_add_and_rel(a, o);
 }
 
+bool
+xbps_array_add_objects_and_rel(xbps_array_t a, xbps_object_t *o,
+    unsigned int n)
+{
+	return prop_array_add_objects_and_rel(a, o, n);
+}
+
 /* prop_bool */
 
 xbps_bool_t
@@ -458,6 +494,12 @@ xbps_dictionary_create_with_capacity(unsigned int i)
 	return prop_dictionary_create_with_capacity(i);
 }
 
+xbps_dictionary_t
+xbps_dictionary_create_hashed(unsigned int i)
+{
+	return prop_dictionary_create_hashed(i);
+}
+
 xbps_dictionary_t
 xbps_dictionary_copy(xbps_dictionary_t d)
 {
@@ -488,6 +530,12 @@ xbps_dictionary_make_immutable(xbps_dictionary_t d)
 	return prop_dictionary_make_immutable(d);
 }
 
+bool
+xbps_dictionary_make_hashed(xbps_dictionary_t d)
+{
+	return prop_dictionary_make_hashed(d);
+}
+
 xbps_object_iterator_t
 xbps_dictionary_iterator(xbps_dictionary_t d)
 {
@@ -570,13 +618,59 @@ xbps_dictionary_externalize_to_zfile(xbps_dictionary_t d, const char *s)
 xbps_dictionary_t
 xbps_dictionary_internalize_from_file(const char *s)
 {
-	return prop_dictionary_internalize_from_file(s);
+	xbps_dictionary_t d;
+	uint64_t start;
+
+	start = xbps_trace_begin();
+	d = prop_dictionary_internalize_from_file(s);
+	xbps_trace_end(start, "plist", "internalize", s);
+
+	return d;
 }
 
 xbps_dictionary_t
 xbps_dictionary_internalize_from_zfile(const char *s)
 {
-	return prop_dictionary_internalize_from_zfile(s);
+	xbps_dictionary_t d;
+	uint64_t start;
+
+	start = xbps_trace_begin();
+	d = prop_dictionary_internalize_from_zfile(s);
+	xbps_trace_end(start, "plist", "internalize", s);
+
+	return d;
+}
+
+void *
+xbps_dictionary_externalize_binary(xbps_dictionary_t d, size_t *len)
+{
+	return prop_dictionary_externalize_binary(d, len);
+}
+
+bool
+xbps_dictionary_externalize_binary_to_file(xbps_dictionary_t d, const char *s)
+{
+	return prop_dictionary_externalize_binary_to_file(d, s);
+}
+
+xbps_dictionary_t
+xbps_dictionary_internalize_buffer(const void *buf, size_t len)
+{
+	return prop_dictionary_internalize_buffer(buf, len);
+}
+
+xbps_dictionary_t
+xbps_dictionary_internalize_stream(ssize_t (*readfn)(void *, void *, size_t),
+		void *arg)
+{
+	return prop_dictionary_internalize_stream(readfn, arg);
+}
+
+bool
+xbps_dictionary_externalize_stream(xbps_dictionary_t d,
+		ssize_t (*writefn)(void *, const void *, size_t), void *arg)
+{
+	return prop_dictionary_externalize_stream(d, writefn, arg);
 }
 
 const char *
@@ -852,6 +946,54 @@ xbps_object_iterator_release(xbps_object_iterator_t o)
 	return prop_object_iterator_release(o);
 }
 
+void
+xbps_object_arena_begin(void)
+{
+	prop_object_arena_begin();
+}
+
+void
+xbps_object_arena_end(void)
+{
+	prop_object_arena_end();
+}
+
+void
+xbps_object_arena_intern(void)
+{
+	prop_object_arena_intern();
+}
+
+void
+xbps_object_pool_trim(void)
+{
+	prop_object_pool_trim();
+}
+
+void
+xbps_object_memstat(xbps_object_t o, struct xbps_memstat *ms)
+{
+	prop_object_memstat(o, (struct prop_memstat *)ms);
+}
+
+void
+xbps_object_stats(struct xbps_object_stats *os)
+{
+	prop_object_stats((struct prop_stats *)os);
+}
+
+bool
+xbps_object_modified(xbps_object_t o)
+{
+	return prop_object_modified(o);
+}
+
+void
+xbps_object_clear_modified(xbps_object_t o)
+{
+	prop_object_clear_modified(o);
+}
+
 /* prop_string */
 
 xbps_string_t
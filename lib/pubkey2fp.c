@@ -16,9 +16,27 @@
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/err.h>
+#include <openssl/rsa.h>
 
 #include "xbps_api_impl.h"
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L || \
+    (defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x2070000fL)
+static void
+RSA_get0_key(const RSA *r, const BIGNUM **n, const BIGNUM **e,
+    const BIGNUM **d)
+{
+	if (n != NULL)
+		*n = r->n;
+	if (e != NULL)
+		*e = r->e;
+	if (d != NULL)
+		*d = r->d;
+}
+#define EVP_MD_CTX_new		EVP_MD_CTX_create
+#define EVP_MD_CTX_free		EVP_MD_CTX_destroy
+#endif
+
 static unsigned char pSshHeader[11] = {
 	0x00, 0x00, 0x00, 0x07, 0x73, 0x73, 0x68, 0x2D, 0x72, 0x73, 0x61
 };
@@ -62,60 +80,35 @@ fp2str(unsigned const char *fp, unsigned int len)
 	return strdup(res);
 }
 
-char *
-xbps_pubkey2fp(struct xbps_handle *xhp, xbps_data_t pubkey)
+static unsigned char *
+rsa_encoding(struct xbps_handle *xhp, EVP_PKEY *pPubKey, int *lenp)
 {
-	EVP_MD_CTX mdctx;
-	EVP_PKEY *pPubKey = NULL;
 	RSA *pRsa = NULL;
-	BIO *bio = NULL;
-	const void *pubkeydata;
-	unsigned char md_value[EVP_MAX_MD_SIZE];
+	const BIGNUM *n, *e;
 	unsigned char *nBytes = NULL, *eBytes = NULL, *pEncoding = NULL;
-	unsigned int md_len = 0;
-	char *hexfpstr = NULL;
 	int index = 0, nLen = 0, eLen = 0, encodingLength = 0;
 
-	ERR_load_crypto_strings();
-	OpenSSL_add_all_algorithms();
-
-	pubkeydata = xbps_data_data_nocopy(pubkey);
-	bio = BIO_new_mem_buf(__UNCONST(pubkeydata), xbps_data_size(pubkey));
-	assert(bio);
-
-	pPubKey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
-	if (!pPubKey) {
-		xbps_dbg_printf(xhp,
-		    "unable to decode public key from the given file: %s\n",
-		    ERR_error_string(ERR_get_error(), NULL));
-		goto out;
-	}
-
-	if (EVP_PKEY_type(pPubKey->type) != EVP_PKEY_RSA) {
-		xbps_dbg_printf(xhp, "only RSA public keys are currently supported\n");
-		goto out;
-	}
-
 	pRsa = EVP_PKEY_get1_RSA(pPubKey);
 	if (!pRsa) {
 		xbps_dbg_printf(xhp, "failed to get RSA public key : %s\n",
 		    ERR_error_string(ERR_get_error(), NULL));
 		goto out;
 	}
+	RSA_get0_key(pRsa, &n, &e, NULL);
 
 	// reading the modulus
-	nLen = BN_num_bytes(pRsa->n);
+	nLen = BN_num_bytes(n);
 	nBytes = (unsigned char*) malloc(nLen);
 	if (nBytes == NULL)
 		goto out;
-	BN_bn2bin(pRsa->n, nBytes);
+	BN_bn2bin(n, nBytes);
 
 	// reading the public exponent
-	eLen = BN_num_bytes(pRsa->e);
+	eLen = BN_num_bytes(e);
 	eBytes = (unsigned char*) malloc(eLen);
 	if (eBytes == NULL)
 		goto out;
-	BN_bn2bin(pRsa->e, eBytes);
+	BN_bn2bin(e, eBytes);
 
 	encodingLength = 11 + 4 + eLen + 4 + nLen;
 	// correct depending on the MSB of e and N
@@ -131,32 +124,121 @@ xbps_pubkey2fp(struct xbps_handle *xhp, xbps_data_t pubkey)
 
 	index = SshEncodeBuffer(&pEncoding[11], eLen, eBytes);
 	(void)SshEncodeBuffer(&pEncoding[11 + index], nLen, nBytes);
+	*lenp = encodingLength;
+
+out:
+	if (pRsa)
+		RSA_free(pRsa);
+	if (nBytes)
+		free(nBytes);
+	if (eBytes)
+		free(eBytes);
+
+	return pEncoding;
+}
+
+#ifdef EVP_PKEY_ED25519
+static unsigned char pSshEd25519Header[15] = {
+	0x00, 0x00, 0x00, 0x0b, 0x73, 0x73, 0x68, 0x2D, 0x65, 0x64,
+	0x32, 0x35, 0x35, 0x31, 0x39
+};
+
+/*
+ * The OpenSSH encoding of an Ed25519 public key ("ssh-ed25519" and
+ * the 32 bytes of the key), as found in ~/.ssh/id_ed25519.pub.
+ */
+static unsigned char *
+ed25519_encoding(struct xbps_handle *xhp, EVP_PKEY *pPubKey, int *lenp)
+{
+	unsigned char *pEncoding;
+	size_t keyLen = 32;
+
+	pEncoding = malloc(15 + 4 + keyLen);
+	assert(pEncoding);
+
+	memcpy(pEncoding, pSshEd25519Header, 15);
+	pEncoding[15] = 0;
+	pEncoding[16] = 0;
+	pEncoding[17] = 0;
+	pEncoding[18] = (unsigned char)keyLen;
+	if (EVP_PKEY_get_raw_public_key(pPubKey, &pEncoding[19], &keyLen) != 1 ||
+	    keyLen != 32) {
+		xbps_dbg_printf(xhp, "failed to get Ed25519 public key : %s\n",
+		    ERR_error_string(ERR_get_error(), NULL));
+		free(pEncoding);
+		return NULL;
+	}
+	*lenp = 15 + 4 + keyLen;
+
+	return pEncoding;
+}
+#endif
+
+char *
+xbps_pubkey2fp(struct xbps_handle *xhp, xbps_data_t pubkey)
+{
+	EVP_MD_CTX *mdctx = NULL;
+	EVP_PKEY *pPubKey = NULL;
+	BIO *bio = NULL;
+	const void *pubkeydata;
+	unsigned char md_value[EVP_MAX_MD_SIZE];
+	unsigned char *pEncoding = NULL;
+	unsigned int md_len = 0;
+	char *hexfpstr = NULL;
+	int encodingLength = 0;
+
+	xbps_crypto_init();
+
+	pubkeydata = xbps_data_data_nocopy(pubkey);
+	bio = BIO_new_mem_buf(__UNCONST(pubkeydata), xbps_data_size(pubkey));
+	assert(bio);
+
+	pPubKey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+	if (!pPubKey) {
+		xbps_dbg_printf(xhp,
+		    "unable to decode public key from the given file: %s\n",
+		    ERR_error_string(ERR_get_error(), NULL));
+		goto out;
+	}
+
+	switch (EVP_PKEY_base_id(pPubKey)) {
+	case EVP_PKEY_RSA:
+		pEncoding = rsa_encoding(xhp, pPubKey, &encodingLength);
+		break;
+#ifdef EVP_PKEY_ED25519
+	case EVP_PKEY_ED25519:
+		pEncoding = ed25519_encoding(xhp, pPubKey, &encodingLength);
+		break;
+#endif
+	default:
+		xbps_dbg_printf(xhp, "only RSA and Ed25519 public keys are "
+		    "currently supported\n");
+		break;
+	}
+	if (pEncoding == NULL)
+		goto out;
 
 	/*
-	 * Compute the RSA fingerprint (MD5).
+	 * Compute the fingerprint (MD5).
 	 */
-	EVP_MD_CTX_init(&mdctx);
-	EVP_DigestInit_ex(&mdctx, EVP_md5(), NULL);
-	EVP_DigestUpdate(&mdctx, pEncoding, encodingLength);
-	if (EVP_DigestFinal_ex(&mdctx, md_value, &md_len) == 0)
+	if ((mdctx = EVP_MD_CTX_new()) == NULL)
+		goto out;
+	if (EVP_DigestInit_ex(mdctx, EVP_md5(), NULL) != 1 ||
+	    EVP_DigestUpdate(mdctx, pEncoding, encodingLength) != 1 ||
+	    EVP_DigestFinal_ex(mdctx, md_value, &md_len) != 1)
 		goto out;
-	EVP_MD_CTX_cleanup(&mdctx);
 	/*
 	 * Convert result to a compatible OpenSSH hex fingerprint.
 	 */
 	hexfpstr = fp2str(md_value, md_len);
 
 out:
+	if (mdctx)
+		EVP_MD_CTX_free(mdctx);
 	if (bio)
 		BIO_free_all(bio);
-	if (pRsa)
-		RSA_free(pRsa);
 	if (pPubKey)
 		EVP_PKEY_free(pPubKey);
-	if (nBytes)
-		free(nBytes);
-	if (eBytes)
-		free(eBytes);
 	if (pEncoding)
 		free(pEncoding);
 
@@ -55,7 +55,8 @@ xbps_repo_path_with_name(struct xbps_handle *xhp, const char *url, const char *n
 {
 	assert(xhp);
 	assert(url);
-	assert(strcmp(name, "repodata") == 0 || strcmp(name, "stagedata") == 0);
+	assert(strcmp(name, "repodata") == 0 || strcmp(name, "stagedata") == 0 ||
+	    strcmp(name, "files") == 0);
 
 	return xbps_xasprintf("%s/%s-%s",
 	    url, xhp->target_arch ? xhp->target_arch : xhp->native_arch, name);
@@ -80,9 +81,9 @@ repo_get_dict(struct xbps_repo *repo)
 	return xbps_archive_get_dictionary(repo->ar, entry);
 }
 
-bool
-xbps_repo_lock(struct xbps_handle *xhp, const char *repodir,
-		int *lockfd, char **lockfname)
+static bool
+repo_lock(struct xbps_handle *xhp, const char *repodir,
+		int *lockfd, char **lockfname, bool wait)
 {
 	char *repofile, *lockfile;
 	int fd, rv;
@@ -106,6 +107,11 @@ xbps_repo_lock(struct xbps_handle *xhp, const char *repodir,
 			xbps_dbg_printf(xhp, "[repo] `%s' failed to "
 			    "create lock file %s\n", lockfile, strerror(rv));
 			free(lockfile);
+			errno = rv;
+			return false;
+		} else if (!wait) {
+			free(lockfile);
+			errno = rv;
 			return false;
 		} else {
 			xbps_dbg_printf(xhp, "[repo] `%s' lock file exists,"
@@ -118,6 +124,20 @@ xbps_repo_lock(struct xbps_handle *xhp, const char *repodir,
 	return true;
 }
 
+bool
+xbps_repo_lock(struct xbps_handle *xhp, const char *repodir,
+		int *lockfd, char **lockfname)
+{
+	return repo_lock(xhp, repodir, lockfd, lockfname, true);
+}
+
+bool
+xbps_repo_trylock(struct xbps_handle *xhp, const char *repodir,
+		int *lockfd, char **lockfname)
+{
+	return repo_lock(xhp, repodir, lockfd, lockfname, false);
+}
+
 void
 xbps_repo_unlock(int lockfd, char *lockfname)
 {
@@ -131,7 +151,7 @@ xbps_repo_unlock(int lockfd, char *lockfname)
 }
 
 static bool
-repo_open_local(struct xbps_repo *repo, const char *repofile)
+repo_open_archive(struct xbps_repo *repo, const char *repofile)
 {
 	struct stat st;
 	int rv = 0;
@@ -145,24 +165,61 @@ repo_open_local(struct xbps_repo *repo, const char *repofile)
 
 	repo->ar = archive_read_new();
 	archive_read_support_compression_gzip(repo->ar);
+	archive_read_support_compression_bzip2(repo->ar);
+	archive_read_support_compression_xz(repo->ar);
+	archive_read_support_filter_zstd(repo->ar);
 	archive_read_support_format_tar(repo->ar);
 
-	if (archive_read_open_fd(repo->ar, repo->fd, st.st_blksize) == ARCHIVE_FATAL) {
+	if (xbps_archive_read_open_fd(repo->ar, repo->fd, st.st_blksize) == ARCHIVE_FATAL) {
 		rv = archive_errno(repo->ar);
 		xbps_dbg_printf(repo->xhp,
 		    "[repo] `%s' failed to open repodata archive %s\n",
 		    repofile, strerror(rv));
 		return false;
 	}
-	if ((repo->idx = repo_get_dict(repo)) == NULL) {
-		rv = archive_errno(repo->ar);
-		xbps_dbg_printf(repo->xhp, "[repo] `%s' failed to internalize "
+	return true;
+}
+
+static bool
+repo_open_local(struct xbps_repo *repo, const char *repofile, bool lazy)
+{
+	struct archive_entry *entry;
+	char *buf;
+	size_t len;
+
+	if (!repo_open_archive(repo, repofile))
+		return false;
+
+	if (archive_read_next_header(repo->ar, &entry) != ARCHIVE_OK ||
+	    (buf = xbps_archive_get_file(repo->ar, entry, &len)) == NULL) {
+		xbps_dbg_printf(repo->xhp, "[repo] `%s' failed to read "
 		    " index on archive, removing file.\n", repofile);
 		/* broken archive, remove it */
 		(void)unlink(repofile);
 		return false;
 	}
-	xbps_dictionary_make_immutable(repo->idx);
+	/*
+	 * Keep the index plist and only materialize the package
+	 * dictionaries as they are requested; internalize it otherwise.
+	 * Binary indexes cannot be scanned and are always internalized.
+	 */
+	if (!lazy || !xbps_repo_idxmap_open_lazy(repo, buf)) {
+		xbps_object_arena_begin();
+		xbps_object_arena_intern();
+		repo->idx = xbps_dictionary_internalize_buffer(buf, len);
+		xbps_object_arena_end();
+		free(buf);
+		if (repo->idx == NULL) {
+			xbps_dbg_printf(repo->xhp, "[repo] `%s' failed to "
+			    "internalize index on archive, removing file.\n",
+			    repofile);
+			/* broken archive, remove it */
+			(void)unlink(repofile);
+			return false;
+		}
+		xbps_dictionary_make_hashed(repo->idx);
+		xbps_dictionary_make_immutable(repo->idx);
+	}
 	repo->idxmeta = repo_get_dict(repo);
 	if (repo->idxmeta != NULL) {
 		repo->is_signed = true;
@@ -189,42 +246,52 @@ repo_open_remote(struct xbps_repo *repo)
 	return rv;
 }
 
-static struct xbps_repo *
-repo_open_with_type(struct xbps_handle *xhp, const char *url, const char *name)
+/*
+ * Returns the path of the \a name index of the repository at \a url,
+ * remote repositories are stored in metadir.
+ */
+char HIDDEN *
+xbps_repo_file(struct xbps_handle *xhp, const char *url, const char *name)
 {
-	struct xbps_repo *repo;
 	const char *arch;
-	char *repofile;
+	char *rpath, *repofile;
 
-	assert(xhp);
-	assert(url);
+	if (!xbps_repository_is_remote(url))
+		return xbps_repo_path_with_name(xhp, url, name);
 
 	if (xhp->target_arch)
 		arch = xhp->target_arch;
 	else
 		arch = xhp->native_arch;
 
+	if ((rpath = xbps_get_remote_repo_string(url)) == NULL)
+		return NULL;
+	repofile = xbps_xasprintf("%s/%s/%s-%s", xhp->metadir, rpath, arch, name);
+	free(rpath);
+
+	return repofile;
+}
+
+static struct xbps_repo *
+repo_open(struct xbps_handle *xhp, const char *url, const char *name)
+{
+	struct xbps_repo *repo;
+	struct stat st;
+	char *repofile;
+	bool lazy;
+
+	assert(xhp);
+	assert(url);
+
+	if ((repofile = xbps_repo_file(xhp, url, name)) == NULL)
+		return NULL;
+
 	repo = calloc(1, sizeof(struct xbps_repo));
 	assert(repo);
 	repo->fd = -1;
 	repo->xhp = xhp;
 	repo->uri = url;
-
-	if (xbps_repository_is_remote(url)) {
-		/* remote repository */
-		char *rpath;
-
-		if ((rpath = xbps_get_remote_repo_string(url)) == NULL) {
-			free(repo);
-			return NULL;
-		}
-		repofile = xbps_xasprintf("%s/%s/%s-%s", xhp->metadir, rpath, arch, name);
-		free(rpath);
-		repo->is_remote = true;
-	} else {
-		/* local repository */
-		repofile = xbps_repo_path_with_name(xhp, url, name);
-	}
+	repo->is_remote = xbps_repository_is_remote(url);
 	/*
 	 * In memory repo sync.
 	 */
@@ -244,7 +311,20 @@ repo_open_with_type(struct xbps_handle *xhp, const char *url, const char *name)
 		    repofile, name, strerror(rv));
 		goto out;
 	}
-	if (repo_open_local(repo, repofile)) {
+	/*
+	 * Serve lookups from the index already opened by another handle,
+	 * from the binary index map if it's up to date, otherwise open the
+	 * repodata index lazily.
+	 */
+	lazy = strcmp(name, "repodata") == 0 && fstat(repo->fd, &st) == 0;
+	if (lazy && xbps_repo_idxmap_attach(repo, repofile, &st)) {
+		free(repofile);
+		return repo;
+	}
+	if ((lazy && xbps_repo_idxmap_open(repo, repofile)) ||
+	    repo_open_local(repo, repofile, lazy)) {
+		if (lazy)
+			xbps_repo_idxmap_share(repo, repofile, &st);
 		free(repofile);
 		return repo;
 	}
@@ -255,8 +335,21 @@ out:
 	return NULL;
 }
 
-bool
-xbps_repo_store(struct xbps_handle *xhp, const char *repo)
+static struct xbps_repo *
+repo_open_with_type(struct xbps_handle *xhp, const char *url, const char *name)
+{
+	struct xbps_repo *repo;
+	uint64_t start;
+
+	start = xbps_trace_begin();
+	repo = repo_open(xhp, url, name);
+	xbps_trace_end(start, "repo", "open", url);
+
+	return repo;
+}
+
+static bool
+repo_store(struct xbps_handle *xhp, const char *repo)
 {
 	char *url = NULL;
 
@@ -294,6 +387,36 @@ xbps_repo_store(struct xbps_handle *xhp, const char *repo)
 	return false;
 }
 
+bool
+xbps_repo_store(struct xbps_handle *xhp, const char *repo)
+{
+	char *buf, *p, *mirror, *saveptr;
+	bool rv;
+
+	assert(xhp);
+	assert(repo);
+
+	if (strpbrk(repo, " \t") == NULL)
+		return repo_store(xhp, repo);
+	/*
+	 * The repository is followed by its mirrors.
+	 */
+	buf = strdup(repo);
+	assert(buf);
+	if ((p = strtok_r(buf, " \t", &saveptr)) == NULL) {
+		free(buf);
+		return false;
+	}
+	rv = repo_store(xhp, p);
+	if (xbps_repository_is_remote(p)) {
+		while ((mirror = strtok_r(NULL, " \t", &saveptr)) != NULL)
+			xbps_repo_mirror_store(xhp, p, mirror);
+	}
+	free(buf);
+
+	return rv;
+}
+
 struct xbps_repo *
 xbps_repo_stage_open(struct xbps_handle *xhp, const char *url)
 {
@@ -321,7 +444,7 @@ xbps_repo_open(struct xbps_handle *xhp, const char *url)
 		stage = xbps_repo_stage_open(xhp, url);
 		if (stage == NULL)
 			return repo;
-		idx = xbps_dictionary_copy_mutable(repo->idx);
+		idx = xbps_dictionary_copy_mutable(xbps_repo_get_index(repo));
 		iter = xbps_dictionary_iterator(stage->idx);
 		while ((keysym = xbps_object_iterator_next(iter))) {
 			pkgname = xbps_dictionary_keysym_cstring_nocopy(keysym);
@@ -329,7 +452,8 @@ xbps_repo_open(struct xbps_handle *xhp, const char *url)
 					xbps_dictionary_get_keysym(stage->idx, keysym));
 		}
 		xbps_object_iterator_release(iter);
-		xbps_object_release(repo->idx);
+		if (repo->idx != NULL)
+			xbps_object_release(repo->idx);
 		xbps_repo_close(stage);
 		repo->idx = idx;
 		return repo;
@@ -337,6 +461,43 @@ xbps_repo_open(struct xbps_handle *xhp, const char *url)
 	return repo;
 }
 
+xbps_dictionary_t
+xbps_repo_get_index(struct xbps_repo *repo)
+{
+	assert(repo);
+
+	if (repo->idx != NULL || repo->idxmap == NULL)
+		return repo->idx;
+
+	if ((repo->idx = xbps_repo_idxmap_internalize(repo)) != NULL) {
+		xbps_dictionary_make_hashed(repo->idx);
+		xbps_dictionary_make_immutable(repo->idx);
+		return repo->idx;
+	}
+	/*
+	 * The index map does not contain the whole index dictionary,
+	 * internalize it from the repodata archive.
+	 */
+	if (lseek(repo->fd, 0, SEEK_SET) == -1)
+		return NULL;
+	if (repo->ar != NULL) {
+		archive_read_finish(repo->ar);
+		repo->ar = NULL;
+	}
+	if (!repo_open_archive(repo, repo->uri))
+		return NULL;
+	xbps_object_arena_begin();
+	xbps_object_arena_intern();
+	repo->idx = repo_get_dict(repo);
+	xbps_object_arena_end();
+	if (repo->idx != NULL) {
+		xbps_dictionary_make_hashed(repo->idx);
+		xbps_dictionary_make_immutable(repo->idx);
+	}
+
+	return repo->idx;
+}
+
 void
 xbps_repo_close(struct xbps_repo *repo)
 {
@@ -353,12 +514,127 @@ xbps_repo_close(struct xbps_repo *repo)
 		xbps_object_release(repo->idxmeta);
 		repo->idxmeta = NULL;
 	}
+	if (repo->idxrevdeps != NULL) {
+		xbps_object_release(repo->idxrevdeps);
+		repo->idxrevdeps = NULL;
+	}
+	if (repo->idxshlibs != NULL) {
+		xbps_object_release(repo->idxshlibs);
+		repo->idxshlibs = NULL;
+	}
+	if (repo->idxfiles != NULL) {
+		xbps_object_release(repo->idxfiles);
+		repo->idxfiles = NULL;
+	}
+	xbps_repo_idxmap_close(repo);
 	if (repo->fd != -1)
 		close(repo->fd);
 
 	free(repo);
 }
 
+/*
+ * Releases the index of \a repo and its tables, keeping its metadata
+ * (public key) to verify binary packages; lookups don't match anything
+ * afterwards.
+ */
+void HIDDEN
+xbps_repo_release_index(struct xbps_repo *repo)
+{
+	if (repo->ar != NULL) {
+		archive_read_finish(repo->ar);
+		repo->ar = NULL;
+	}
+	if (repo->idx != NULL) {
+		xbps_object_release(repo->idx);
+		repo->idx = NULL;
+	}
+	if (repo->idxrevdeps != NULL) {
+		xbps_object_release(repo->idxrevdeps);
+		repo->idxrevdeps = NULL;
+	}
+	if (repo->idxshlibs != NULL) {
+		xbps_object_release(repo->idxshlibs);
+		repo->idxshlibs = NULL;
+	}
+	if (repo->idxfiles != NULL) {
+		xbps_object_release(repo->idxfiles);
+		repo->idxfiles = NULL;
+	}
+	repo->idxrevdeps_read = repo->idxshlibs_read = true;
+	repo->idxfiles_read = true;
+	xbps_repo_idxmap_close(repo);
+}
+
+/*
+ * Adds \a pkgname of \a repo as a provider of \a vpkgname to the
+ * virtual packages map \a vpkgs: a dictionary of vpkgnames to
+ * dictionaries of repository URIs to arrays of pkgnames.
+ */
+void HIDDEN
+xbps_repo_map_vpkg(struct xbps_repo *repo, xbps_dictionary_t vpkgs,
+		const char *vpkgname, const char *pkgname)
+{
+	xbps_dictionary_t repos;
+	xbps_array_t pkgs;
+
+	if ((repos = xbps_dictionary_get(vpkgs, vpkgname)) == NULL) {
+		repos = xbps_dictionary_create();
+		assert(repos);
+		xbps_dictionary_set(vpkgs, vpkgname, repos);
+		xbps_object_release(repos);
+	}
+	if ((pkgs = xbps_dictionary_get(repos, repo->uri)) == NULL) {
+		pkgs = xbps_array_create();
+		assert(pkgs);
+		xbps_dictionary_set(repos, repo->uri, pkgs);
+		xbps_object_release(pkgs);
+	}
+	if (!xbps_match_string_in_array(pkgs, pkgname))
+		xbps_array_add_cstring(pkgs, pkgname);
+}
+
+/*
+ * Adds all virtual packages provided in \a repo to \a vpkgs.
+ */
+void HIDDEN
+xbps_repo_map_vpkgs(struct xbps_repo *repo, xbps_dictionary_t vpkgs)
+{
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	if (repo->idx == NULL) {
+		if (repo->idxmap != NULL)
+			xbps_repo_idxmap_map_vpkgs(repo, vpkgs);
+		return;
+	}
+
+	iter = xbps_dictionary_iterator(repo->idx);
+	assert(iter);
+
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_array_t provides;
+		const char *pkgname;
+
+		pkgname = xbps_dictionary_keysym_cstring_nocopy(obj);
+		provides = xbps_dictionary_get(
+		    xbps_dictionary_get_keysym(repo->idx, obj), "provides");
+
+		for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
+			const char *vpkg;
+			char *vpkgname;
+
+			xbps_array_get_cstring_nocopy(provides, i, &vpkg);
+			if ((vpkgname = xbps_pkg_name(vpkg)) == NULL)
+				vpkgname = strdup(vpkg);
+			assert(vpkgname);
+			xbps_repo_map_vpkg(repo, vpkgs, vpkgname, pkgname);
+			free(vpkgname);
+		}
+	}
+	xbps_object_iterator_release(iter);
+}
+
 xbps_dictionary_t
 xbps_repo_get_virtualpkg(struct xbps_repo *repo, const char *pkg)
 {
@@ -367,8 +643,11 @@ xbps_repo_get_virtualpkg(struct xbps_repo *repo, const char *pkg)
 	assert(repo);
 	assert(pkg);
 
-	if (repo->idx == NULL)
+	if (repo->idx == NULL) {
+		if (repo->idxmap != NULL)
+			return xbps_repo_idxmap_get_virtualpkg(repo, pkg);
 		return NULL;
+	}
 
 	pkgd = xbps_find_virtualpkg_in_dict(repo->xhp, repo->idx, pkg);
 	if (pkgd) {
@@ -387,8 +666,11 @@ xbps_repo_get_pkg(struct xbps_repo *repo, const char *pkg)
 	assert(repo);
 	assert(pkg);
 
-	if (repo->idx == NULL)
+	if (repo->idx == NULL) {
+		if (repo->idxmap != NULL)
+			return xbps_repo_idxmap_get_pkg(repo, pkg);
 		return NULL;
+	}
 
 	/* Try matching vpkg from configuration files */
 	if ((pkgd = xbps_find_virtualpkg_in_conf(repo->xhp, repo->idx, pkg)))
@@ -405,6 +687,37 @@ xbps_repo_get_pkg(struct xbps_repo *repo, const char *pkg)
 	return NULL;
 }
 
+xbps_dictionary_t HIDDEN
+xbps_repo_get_pkg_pattern(struct xbps_repo *repo, const struct xbps_pattern *p)
+{
+	xbps_dictionary_t pkgd;
+	const char *pkg;
+
+	assert(repo);
+	assert(p);
+
+	pkg = xbps_pattern_string(p);
+	if (repo->idx == NULL) {
+		if (repo->idxmap != NULL)
+			return xbps_repo_idxmap_get_pkg(repo, pkg);
+		return NULL;
+	}
+
+	/* Try matching vpkg from configuration files */
+	if ((pkgd = xbps_find_virtualpkg_in_conf(repo->xhp, repo->idx, pkg)))
+		return pkgd;
+
+	/* ... otherwise match a real pkg */
+	pkgd = xbps_find_pkg_in_dict_pattern(repo->idx, p);
+	if (pkgd) {
+		xbps_dictionary_set_cstring_nocopy(pkgd,
+				"repository", repo->uri);
+		return pkgd;
+	}
+
+	return NULL;
+}
+
 xbps_dictionary_t
 xbps_repo_get_pkg_plist(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
 		const char *plist)
@@ -421,92 +734,421 @@ xbps_repo_get_pkg_plist(struct xbps_handle *xhp, xbps_dictionary_t pkgd,
 	return bpkgd;
 }
 
+static void
+revdeps_add(struct xbps_repo *repo, xbps_dictionary_t pkgd,
+		xbps_array_t *revdeps)
+{
+	const char *pkgver, *arch;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "architecture", &arch);
+	if (!xbps_pkg_arch_match(repo->xhp, arch, NULL))
+		return;
+
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	/* match */
+	if (*revdeps == NULL)
+		*revdeps = xbps_array_create();
+
+	if (!xbps_match_string_in_array(*revdeps, pkgver))
+		xbps_array_add_cstring_nocopy(*revdeps, pkgver);
+}
+
+static void
+revdeps_match_pkg(struct xbps_repo *repo, xbps_dictionary_t pkgd,
+		xbps_dictionary_t tpkgd, const char *str, xbps_array_t *revdeps)
+{
+	xbps_array_t pkgdeps, provides;
+	const char *pkgver, *vpkg;
+
+	if (xbps_dictionary_equals(pkgd, tpkgd))
+		return;
+
+	pkgdeps = xbps_dictionary_get(pkgd, "run_depends");
+	if (!xbps_array_count(pkgdeps))
+		return;
+	/*
+	 * Try to match passed in string.
+	 */
+	if (str) {
+		if (xbps_match_pkgdep_in_array(pkgdeps, str))
+			revdeps_add(repo, pkgd, revdeps);
+		return;
+	}
+	/*
+	 * Try to match any virtual package.
+	 */
+	provides = xbps_dictionary_get(tpkgd, "provides");
+	for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
+		xbps_array_get_cstring_nocopy(provides, i, &vpkg);
+		if (xbps_match_pkgdep_in_array(pkgdeps, vpkg))
+			revdeps_add(repo, pkgd, revdeps);
+	}
+	/*
+	 * Try to match by pkgver.
+	 */
+	xbps_dictionary_get_cstring_nocopy(tpkgd, "pkgver", &pkgver);
+	if (xbps_match_pkgdep_in_array(pkgdeps, pkgver))
+		revdeps_add(repo, pkgd, revdeps);
+}
+
 static xbps_array_t
 revdeps_match(struct xbps_repo *repo, xbps_dictionary_t tpkgd, const char *str)
 {
-	xbps_dictionary_t pkgd;
-	xbps_array_t revdeps = NULL, pkgdeps, provides;
+	xbps_array_t revdeps = NULL;
 	xbps_object_iterator_t iter;
 	xbps_object_t obj;
-	const char *pkgver, *tpkgver, *arch, *vpkg;
 
 	iter = xbps_dictionary_iterator(repo->idx);
 	assert(iter);
 
 	while ((obj = xbps_object_iterator_next(iter))) {
-		pkgd = xbps_dictionary_get_keysym(repo->idx, obj);
-		if (xbps_dictionary_equals(pkgd, tpkgd))
-			continue;
+		revdeps_match_pkg(repo,
+		    xbps_dictionary_get_keysym(repo->idx, obj),
+		    tpkgd, str, &revdeps);
+	}
+	xbps_object_iterator_release(iter);
+	return revdeps;
+}
 
-		pkgdeps = xbps_dictionary_get(pkgd, "run_depends");
-		if (!xbps_array_count(pkgdeps))
-			continue;
-		/*
-		 * Try to match passed in string.
-		 */
-		if (str) {
-			if (!xbps_match_pkgdep_in_array(pkgdeps, str))
-				continue;
-			xbps_dictionary_get_cstring_nocopy(pkgd,
-			    "architecture", &arch);
-			if (!xbps_pkg_arch_match(repo->xhp, arch, NULL))
-				continue;
+/*
+ * Returns the key of the reverse dependencies table for \a pkgdep:
+ * relational patterns only match the name before the operator, other
+ * patterns and pkgvers the name before the version; globs can match
+ * anything and are stored at the empty key.
+ */
+static char *
+revdeps_key(const char *pkgdep)
+{
+	const char *p;
 
-			xbps_dictionary_get_cstring_nocopy(pkgd,
-			    "pkgver", &tpkgver);
-			/* match */
-			if (revdeps == NULL)
-				revdeps = xbps_array_create();
+	if ((p = strpbrk(pkgdep, "<>")) == NULL) {
+		if (strpbrk(pkgdep, "*?[]"))
+			return strdup("");
+		if ((p = strrchr(pkgdep, '-')) == NULL)
+			return strdup(pkgdep);
+	}
+	return strndup(pkgdep, (size_t)(p - pkgdep));
+}
 
-			if (!xbps_match_string_in_array(revdeps, tpkgver))
-				xbps_array_add_cstring_nocopy(revdeps, tpkgver);
+xbps_dictionary_t
+xbps_repo_index_revdeps(xbps_dictionary_t idx)
+{
+	xbps_dictionary_t table;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
 
-			continue;
-		}
-		/*
-		 * Try to match any virtual package.
-		 */
-		provides = xbps_dictionary_get(tpkgd, "provides");
-		for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
-			xbps_array_get_cstring_nocopy(provides, i, &vpkg);
-			if (!xbps_match_pkgdep_in_array(pkgdeps, vpkg))
-				continue;
+	if ((table = xbps_dictionary_create()) == NULL)
+		return NULL;
 
-			xbps_dictionary_get_cstring_nocopy(pkgd,
-			    "architecture", &arch);
-			if (!xbps_pkg_arch_match(repo->xhp, arch, NULL))
-				continue;
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
 
-			xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver",
-			    &tpkgver);
-			/* match */
-			if (revdeps == NULL)
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_array_t pkgdeps;
+		const char *pkgname;
+
+		pkgname = xbps_dictionary_keysym_cstring_nocopy(obj);
+		pkgdeps = xbps_dictionary_get(
+		    xbps_dictionary_get_keysym(idx, obj), "run_depends");
+
+		for (unsigned int i = 0; i < xbps_array_count(pkgdeps); i++) {
+			xbps_array_t revdeps;
+			const char *pkgdep, *last = NULL;
+			char *key;
+
+			xbps_array_get_cstring_nocopy(pkgdeps, i, &pkgdep);
+			key = revdeps_key(pkgdep);
+			assert(key);
+			if ((revdeps = xbps_dictionary_get(table, key)) == NULL) {
 				revdeps = xbps_array_create();
+				assert(revdeps);
+				xbps_dictionary_set(table, key, revdeps);
+				xbps_object_release(revdeps);
+			}
+			free(key);
+			/* all deps of a package are added in a row */
+			xbps_array_get_cstring_nocopy(revdeps,
+			    xbps_array_count(revdeps) - 1, &last);
+			if (last == NULL || strcmp(last, pkgname))
+				xbps_array_add_cstring(revdeps, pkgname);
+		}
+	}
+	xbps_object_iterator_release(iter);
+	return table;
+}
 
-			if (!xbps_match_string_in_array(revdeps, tpkgver))
-				xbps_array_add_cstring_nocopy(revdeps, tpkgver);
+/*
+ * The shlib-provides and shlib-requires of the packages in a table
+ * are indexed by soname to the pkgnames that have them.
+ */
+static void
+shlibs_add(xbps_dictionary_t d, const char *key, xbps_dictionary_t pkgd,
+		const char *pkgname)
+{
+	xbps_dictionary_t idx;
+	xbps_array_t shobjs;
+
+	idx = xbps_dictionary_get(d, key);
+	shobjs = xbps_dictionary_get(pkgd, key);
+	for (unsigned int i = 0; i < xbps_array_count(shobjs); i++) {
+		xbps_array_t pkgs;
+		const char *shlib;
+		bool alloc = false;
+
+		xbps_array_get_cstring_nocopy(shobjs, i, &shlib);
+		if ((pkgs = xbps_dictionary_get(idx, shlib)) == NULL) {
+			alloc = true;
+			pkgs = xbps_array_create();
+			assert(pkgs);
+			xbps_dictionary_set(idx, shlib, pkgs);
 		}
-		/*
-		 * Try to match by pkgver.
-		 */
-		xbps_dictionary_get_cstring_nocopy(tpkgd, "pkgver", &pkgver);
-		if (!xbps_match_pkgdep_in_array(pkgdeps, pkgver))
-			continue;
+		if (!xbps_match_string_in_array(pkgs, pkgname))
+			xbps_array_add_cstring(pkgs, pkgname);
+		if (alloc)
+			xbps_object_release(pkgs);
+	}
+}
 
-		xbps_dictionary_get_cstring_nocopy(pkgd,
-		    "architecture", &arch);
-		if (!xbps_pkg_arch_match(repo->xhp, arch, NULL))
+static void
+shlibs_del(xbps_dictionary_t d, const char *key, xbps_dictionary_t pkgd,
+		const char *pkgname)
+{
+	xbps_dictionary_t idx;
+	xbps_array_t shobjs;
+
+	idx = xbps_dictionary_get(d, key);
+	shobjs = xbps_dictionary_get(pkgd, key);
+	for (unsigned int i = 0; i < xbps_array_count(shobjs); i++) {
+		xbps_array_t pkgs;
+		const char *shlib;
+
+		xbps_array_get_cstring_nocopy(shobjs, i, &shlib);
+		if ((pkgs = xbps_dictionary_get(idx, shlib)) == NULL)
 			continue;
+		xbps_remove_string_from_array(pkgs, pkgname);
+		if (xbps_array_count(pkgs) == 0)
+			xbps_dictionary_remove(idx, shlib);
+	}
+}
+
+static void
+shlibs_update(xbps_dictionary_t table, xbps_dictionary_t pkgd, bool add)
+{
+	const char *pkgver;
+	char *pkgname;
 
-		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &tpkgver);
-		/* match */
-		if (revdeps == NULL)
-			revdeps = xbps_array_create();
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) ||
+	    (pkgname = xbps_pkg_name(pkgver)) == NULL)
+		return;
 
-		if (!xbps_match_string_in_array(revdeps, tpkgver))
-			xbps_array_add_cstring_nocopy(revdeps, tpkgver);
+	if (add) {
+		shlibs_add(table, "shlib-provides", pkgd, pkgname);
+		shlibs_add(table, "shlib-requires", pkgd, pkgname);
+	} else {
+		shlibs_del(table, "shlib-provides", pkgd, pkgname);
+		shlibs_del(table, "shlib-requires", pkgd, pkgname);
 	}
+	free(pkgname);
+}
+
+void
+xbps_repo_index_shlibs_update(xbps_dictionary_t table,
+		xbps_dictionary_t opkgd, xbps_dictionary_t pkgd)
+{
+	if (opkgd)
+		shlibs_update(table, opkgd, false);
+	if (pkgd)
+		shlibs_update(table, pkgd, true);
+}
+
+xbps_dictionary_t
+xbps_repo_index_shlibs(xbps_dictionary_t idx)
+{
+	xbps_dictionary_t table, d;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	if ((table = xbps_dictionary_create()) == NULL)
+		return NULL;
+
+	d = xbps_dictionary_create_hashed(0);
+	assert(d);
+	xbps_dictionary_set(table, "shlib-provides", d);
+	xbps_object_release(d);
+	d = xbps_dictionary_create_hashed(0);
+	assert(d);
+	xbps_dictionary_set(table, "shlib-requires", d);
+	xbps_object_release(d);
+
+	iter = xbps_dictionary_iterator(idx);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)))
+		shlibs_update(table, xbps_dictionary_get_keysym(idx, obj), true);
 	xbps_object_iterator_release(iter);
+
+	return table;
+}
+
+/*
+ * Reads the dictionary \a fname of the repodata archive, the tables
+ * follow the index in the archive and are only read when used.
+ */
+static xbps_dictionary_t
+repo_get_table(struct xbps_repo *repo, const char *fname)
+{
+	struct archive_entry *entry;
+	xbps_dictionary_t d = NULL;
+	const char *bfile;
+
+	if (lseek(repo->fd, 0, SEEK_SET) == -1)
+		return NULL;
+	if (repo->ar != NULL) {
+		archive_read_finish(repo->ar);
+		repo->ar = NULL;
+	}
+	if (!repo_open_archive(repo, repo->uri))
+		return NULL;
+	while (archive_read_next_header(repo->ar, &entry) == ARCHIVE_OK) {
+		bfile = archive_entry_pathname(entry);
+		if (strncmp(bfile, "./", 2) == 0)
+			bfile += 2;
+		if (strcmp(bfile, fname) == 0) {
+			d = xbps_archive_get_dictionary(repo->ar, entry);
+			break;
+		}
+		archive_read_data_skip(repo->ar);
+	}
+	if (d == NULL)
+		xbps_dbg_printf(repo->xhp, "[repo] `%s' has no %s table.\n",
+		    repo->uri, fname);
+
+	return d;
+}
+
+static xbps_dictionary_t
+repo_get_revdeps(struct xbps_repo *repo)
+{
+	if (repo->idxrevdeps_read || repo->fd == -1)
+		return repo->idxrevdeps;
+	repo->idxrevdeps_read = true;
+
+	repo->idxrevdeps = repo_get_table(repo, XBPS_REPOIDX_REVDEPS);
+	if (repo->idxrevdeps != NULL)
+		xbps_dictionary_make_immutable(repo->idxrevdeps);
+
+	return repo->idxrevdeps;
+}
+
+xbps_dictionary_t
+xbps_repo_get_shlibs(struct xbps_repo *repo)
+{
+	assert(repo);
+
+	if (repo->idxshlibs_read || repo->fd == -1)
+		return repo->idxshlibs;
+	repo->idxshlibs_read = true;
+
+	repo->idxshlibs = repo_get_table(repo, XBPS_REPOIDX_SHLIBS);
+	return repo->idxshlibs;
+}
+
+xbps_dictionary_t
+xbps_repo_get_files(struct xbps_repo *repo)
+{
+	struct xbps_handle *xhp;
+	char *rpath, *path;
+
+	assert(repo);
+
+	if (repo->idxfiles_read)
+		return repo->idxfiles;
+	repo->idxfiles_read = true;
+
+	xhp = repo->xhp;
+	if (repo->is_remote) {
+		if ((rpath = xbps_get_remote_repo_string(repo->uri)) == NULL)
+			return NULL;
+		path = xbps_xasprintf("%s/%s/%s-files", xhp->metadir, rpath,
+		    xhp->target_arch ? xhp->target_arch : xhp->native_arch);
+		free(rpath);
+	} else {
+		path = xbps_repo_path_with_name(xhp, repo->uri, "files");
+	}
+	repo->idxfiles = xbps_archive_fetch_plist(path, XBPS_REPOIDX_FILES);
+	if (repo->idxfiles != NULL)
+		xbps_dictionary_make_immutable(repo->idxfiles);
+	else
+		xbps_dbg_printf(xhp, "[repo] `%s' has no files index.\n",
+		    repo->uri);
+	free(path);
+
+	return repo->idxfiles;
+}
+
+static void
+revdeps_match_key(struct xbps_repo *repo, xbps_dictionary_t tpkgd,
+		const char *str, const char *pkgdep, xbps_array_t *revdeps)
+{
+	xbps_dictionary_t pkgd;
+	xbps_array_t pkgs;
+	const char *pkgname, *pkgver;
+	char *key;
+	size_t len;
+
+	if ((key = revdeps_key(pkgdep)) == NULL)
+		return;
+	pkgs = xbps_dictionary_get(repo->idxrevdeps, key);
+	free(key);
+
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_get_cstring_nocopy(pkgs, i, &pkgname);
+		if (repo->idx != NULL) {
+			pkgd = xbps_dictionary_get(repo->idx, pkgname);
+		} else {
+			/*
+			 * Lookups by name may be redirected by virtual
+			 * packages set in the configuration files.
+			 */
+			pkgd = xbps_repo_get_pkg(repo, pkgname);
+			if (pkgd == NULL ||
+			    !xbps_dictionary_get_cstring_nocopy(pkgd,
+			    "pkgver", &pkgver))
+				continue;
+			len = xbps_pkg_name_len(pkgver);
+			if (len == 0 || strncmp(pkgver, pkgname, len) ||
+			    pkgname[len] != '\0')
+				continue;
+		}
+		if (pkgd != NULL)
+			revdeps_match_pkg(repo, pkgd, tpkgd, str, revdeps);
+	}
+}
+
+/*
+ * Same as revdeps_match() but only checks the packages whose
+ * dependencies can match, as listed in the reverse dependencies table.
+ */
+static xbps_array_t
+revdeps_match_table(struct xbps_repo *repo, xbps_dictionary_t tpkgd,
+		const char *str)
+{
+	xbps_array_t revdeps = NULL, provides;
+	const char *pkgver, *vpkg;
+
+	if (str) {
+		revdeps_match_key(repo, tpkgd, str, str, &revdeps);
+	} else {
+		provides = xbps_dictionary_get(tpkgd, "provides");
+		for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
+			xbps_array_get_cstring_nocopy(provides, i, &vpkg);
+			revdeps_match_key(repo, tpkgd, NULL, vpkg, &revdeps);
+		}
+		xbps_dictionary_get_cstring_nocopy(tpkgd, "pkgver", &pkgver);
+		revdeps_match_key(repo, tpkgd, NULL, pkgver, &revdeps);
+	}
+	/* and the glob patterns that can match any package */
+	revdeps_match_key(repo, tpkgd, str, "*", &revdeps);
+
 	return revdeps;
 }
 
@@ -516,9 +1158,10 @@ xbps_repo_get_pkg_revdeps(struct xbps_repo *repo, const char *pkg)
 	xbps_array_t revdeps = NULL, vdeps = NULL;
 	xbps_dictionary_t pkgd;
 	const char *vpkg;
-	bool match = false;
+	bool match = false, table;
 
-	if (repo->idx == NULL)
+	table = repo_get_revdeps(repo) != NULL;
+	if (!table && xbps_repo_get_index(repo) == NULL)
 		return NULL;
 
 	if (((pkgd = xbps_repo_get_pkg(repo, pkg)) == NULL) &&
@@ -531,24 +1174,25 @@ xbps_repo_get_pkg_revdeps(struct xbps_repo *repo, const char *pkg)
 	 */
 	if ((vdeps = xbps_dictionary_get(pkgd, "provides"))) {
 		for (unsigned int i = 0; i < xbps_array_count(vdeps); i++) {
-			char *vpkgn;
+			size_t len;
 
 			xbps_array_get_cstring_nocopy(vdeps, i, &vpkg);
-			vpkgn = xbps_pkg_name(vpkg);
-			assert(vpkgn);
-			if (strcmp(vpkgn, pkg) == 0) {
-				free(vpkgn);
+			len = xbps_pkg_name_len(vpkg);
+			assert(len);
+			if (strncmp(vpkg, pkg, len) == 0 && pkg[len] == '\0') {
 				match = true;
 				break;
 			}
-			free(vpkgn);
 			vpkg = NULL;
 		}
-		if (match)
-			revdeps = revdeps_match(repo, pkgd, vpkg);
 	}
 	if (!match)
-		revdeps = revdeps_match(repo, pkgd, NULL);
+		vpkg = NULL;
+
+	if (table)
+		revdeps = revdeps_match_table(repo, pkgd, vpkg);
+	else
+		revdeps = revdeps_match(repo, pkgd, vpkg);
 
 	return revdeps;
 }
@@ -559,7 +1203,7 @@ xbps_repo_key_import(struct xbps_repo *repo)
 	xbps_dictionary_t repokeyd = NULL;
 	xbps_data_t pubkey = NULL;
 	uint16_t pubkey_size = 0;
-	const char *signedby = NULL;
+	const char *signedby = NULL, *sigtype = "rsa";
 	char *hexfp = NULL;
 	char *p, *dbkeyd, *rkeyfile = NULL;
 	int import, rv = 0;
@@ -578,8 +1222,10 @@ xbps_repo_key_import(struct xbps_repo *repo)
 	 * 	- signature-by (string)
 	 * 	- public-key (data)
 	 * 	- public-key-size (number)
+	 * 	- signature-type (string, optional: rsa if unset)
 	 */
 	xbps_dictionary_get_cstring_nocopy(repo->idxmeta, "signature-by", &signedby);
+	xbps_dictionary_get_cstring_nocopy(repo->idxmeta, "signature-type", &sigtype);
 	xbps_dictionary_get_uint16(repo->idxmeta, "public-key-size", &pubkey_size);
 	pubkey = xbps_dictionary_get(repo->idxmeta, "public-key");
 
@@ -591,7 +1237,18 @@ xbps_repo_key_import(struct xbps_repo *repo)
 		rv = EINVAL;
 		goto out;
 	}
+	if (strcmp(sigtype, "rsa") && strcmp(sigtype, "ed25519")) {
+		xbps_dbg_printf(repo->xhp,
+		    "[repo] `%s': unsupported signature type `%s'\n",
+		    repo->uri, sigtype);
+		rv = EINVAL;
+		goto out;
+	}
 	hexfp = xbps_pubkey2fp(repo->xhp, pubkey);
+	if (hexfp == NULL) {
+		rv = EINVAL;
+		goto out;
+	}
 	/*
 	 * Check if the public key is alredy stored.
 	 */
@@ -608,8 +1265,9 @@ xbps_repo_key_import(struct xbps_repo *repo)
 	 * to the client.
 	 */
 	import = xbps_set_cb_state(repo->xhp, XBPS_STATE_REPO_KEY_IMPORT, 0,
-			hexfp, "`%s' repository has been RSA signed by \"%s\"",
-			repo->uri, signedby);
+			hexfp, "`%s' repository has been %s signed by \"%s\"",
+			repo->uri, strcmp(sigtype, "ed25519") ? "RSA" : "Ed25519",
+			signedby);
 	if (import <= 0) {
 		rv = EAGAIN;
 		goto out;
@@ -637,6 +1295,7 @@ xbps_repo_key_import(struct xbps_repo *repo)
 	xbps_dictionary_set(repokeyd, "public-key", pubkey);
 	xbps_dictionary_set_uint16(repokeyd, "public-key-size", pubkey_size);
 	xbps_dictionary_set_cstring_nocopy(repokeyd, "signature-by", signedby);
+	xbps_dictionary_set_cstring_nocopy(repokeyd, "signature-type", sigtype);
 
 	if (!xbps_dictionary_externalize_to_file(repokeyd, rkeyfile)) {
 		rv = errno;
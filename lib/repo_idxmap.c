@@ -0,0 +1,1316 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Binary repository index map, stored as "<arch>-repodata.idxmap"
+ * next to the repodata archive:
+ *
+ * 	header
+ * 	pkgs[npkgs]	sorted by pkgname
+ * 	vpkgs[nvpkgs]	sorted by virtual pkgname, then pkg
+ * 	tris[ntris]	sorted trigrams of the searchable strings
+ * 	posts[nposts]	sorted pkgs containing every trigram
+ * 	strtab		NUL terminated strings
+ *
+ * Every package dictionary is stored externalized in the string table,
+ * so that a lookup only internalizes the packages it really touches.
+ * The map is only valid for the repodata archive matching the recorded
+ * size, mtime and inode.
+ *
+ * The trigrams are those of the case folded pkgver, short_desc and
+ * virtual packages of every package, they narrow the packages that
+ * a substring search (xbps-query -Rs) has to match.
+ *
+ * Repositories without an up to date index map are opened lazily: the
+ * raw index.plist is kept in memory and only scanned to build the same
+ * pkgname and virtual pkgname tables, pointing to the XML fragment of
+ * every package dictionary.
+ *
+ * Both are immutable once opened and shared by the repositories of all
+ * handles opening the same repodata archive, see idxmap_shared below.
+ */
+#define IDXMAP_MAGIC	"XBPSIDX1"
+#define IDXMAP_VERSION	2
+#define IDXMAP_NONE	UINT64_MAX
+
+struct idxmap_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t npkgs;
+	uint32_t nvpkgs;
+	uint32_t ntris;
+	uint32_t nposts;
+	uint32_t pad;
+	uint64_t rdsize;
+	int64_t rdmtime;
+	uint64_t rdino;
+	uint64_t meta;
+	uint64_t strtab;
+	uint64_t strtablen;
+};
+
+struct idxmap_pkg {
+	uint64_t name;
+	uint64_t plist;
+};
+
+struct idxmap_vpkg {
+	uint64_t name;
+	uint32_t pkg;
+	uint32_t pad;
+};
+
+struct idxmap_tri {
+	uint32_t tri;
+	uint32_t first;
+	uint32_t count;
+	uint32_t pad;
+};
+
+struct idxmap_frag {
+	size_t off;
+	size_t len;
+};
+
+struct xbps_repo_idxmap {
+	/* mmap(2)ed index map */
+	void *map;
+	size_t maplen;
+	/* lazily scanned index.plist */
+	char *xml;
+	char *names;
+	struct idxmap_pkg *xpkgs;
+	struct idxmap_vpkg *xvpkgs;
+	struct idxmap_frag *frags;
+
+	uint32_t npkgs;
+	uint32_t nvpkgs;
+	uint32_t ntris;
+	uint32_t nposts;
+	const struct idxmap_pkg *pkgs;
+	const struct idxmap_vpkg *vpkgs;
+	const struct idxmap_tri *tris;
+	const uint32_t *posts;
+	const char *strtab;
+	uint64_t strtablen;
+	xbps_dictionary_t cache;
+	pthread_mutex_t lock;
+	/* owner of the map, xml and tables above if not NULL */
+	struct idxmap_shared *shared;
+};
+
+/*
+ * Index data of a repodata archive, shared by the repositories that
+ * open it in several handles: the same URI and arch, and the same
+ * size and mtime, which remote repositories get from the mirror.
+ * Local repositories also match the inode. The package dictionaries
+ * are still materialized in the cache of every repository, because the
+ * transaction code of each handle modifies them.
+ */
+struct idxmap_shared {
+	LIST_ENTRY(idxmap_shared) entries;
+	char *key;
+	bool local;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtim;
+	struct xbps_repo_idxmap data;
+	xbps_dictionary_t idxmeta;
+	unsigned int refs;
+};
+
+static LIST_HEAD(idxmap_shared_list, idxmap_shared) idxmap_shared =
+    LIST_HEAD_INITIALIZER(idxmap_shared);
+static pthread_mutex_t idxmap_shared_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+struct strtab {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+struct vpkg_ent {
+	char *name;
+	uint32_t pkg;
+};
+
+struct tri_ent {
+	uint32_t tri;
+	uint32_t pkg;
+};
+
+static uint64_t
+strtab_add(struct strtab *st, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	uint64_t off = st->len;
+
+	if (st->len + len > st->size) {
+		while (st->len + len > st->size)
+			st->size = st->size ? st->size * 2 : 65536;
+		st->buf = realloc(st->buf, st->size);
+		assert(st->buf);
+	}
+	memcpy(st->buf + st->len, s, len);
+	st->len += len;
+	return off;
+}
+
+static int
+vpkg_ent_cmp(const void *a, const void *b)
+{
+	const struct vpkg_ent *va = a, *vb = b;
+	int cmp;
+
+	if ((cmp = strcmp(va->name, vb->name)))
+		return cmp;
+	return va->pkg < vb->pkg ? -1 : va->pkg > vb->pkg;
+}
+
+static void
+vpkg_ent_add(struct vpkg_ent **vents, unsigned int *nvents,
+		unsigned int *vsize, const char *vpkg, uint32_t pkg)
+{
+	char *vpkgname;
+
+	if ((vpkgname = xbps_pkg_name(vpkg)) == NULL)
+		vpkgname = strdup(vpkg);
+	assert(vpkgname);
+	if (*nvents == *vsize) {
+		*vsize = *vsize ? *vsize * 2 : 256;
+		*vents = realloc(*vents, *vsize * sizeof(**vents));
+		assert(*vents);
+	}
+	(*vents)[*nvents].name = vpkgname;
+	(*vents)[*nvents].pkg = pkg;
+	(*nvents)++;
+}
+
+static uint32_t
+tri_fold(const char *s)
+{
+	uint32_t tri = 0;
+
+	for (unsigned int i = 0; i < 3; i++) {
+		unsigned char c = (unsigned char)s[i];
+
+		if (c >= 'A' && c <= 'Z')
+			c = (unsigned char)(c - 'A' + 'a');
+		tri = (tri << 8) | c;
+	}
+	return tri;
+}
+
+static void
+tri_ent_add(struct tri_ent **tents, size_t *ntents, size_t *tsize,
+		const char *s, uint32_t pkg)
+{
+	size_t len = strlen(s);
+
+	for (size_t i = 0; i + 3 <= len; i++) {
+		if (*ntents == *tsize) {
+			*tsize = *tsize ? *tsize * 2 : 65536;
+			*tents = realloc(*tents, *tsize * sizeof(**tents));
+			assert(*tents);
+		}
+		(*tents)[*ntents].tri = tri_fold(s + i);
+		(*tents)[*ntents].pkg = pkg;
+		(*ntents)++;
+	}
+}
+
+static int
+tri_ent_cmp(const void *a, const void *b)
+{
+	const struct tri_ent *ta = a, *tb = b;
+
+	if (ta->tri != tb->tri)
+		return ta->tri < tb->tri ? -1 : 1;
+	return ta->pkg < tb->pkg ? -1 : ta->pkg > tb->pkg;
+}
+
+static struct xbps_repo_idxmap *
+idxmap_alloc(void)
+{
+	struct xbps_repo_idxmap *im;
+
+	im = calloc(1, sizeof(*im));
+	assert(im);
+	im->cache = xbps_dictionary_create_hashed(0);
+	assert(im->cache);
+	pthread_mutex_init(&im->lock, NULL);
+
+	return im;
+}
+
+static char *
+idxmap_path(const char *repofile)
+{
+	return xbps_xasprintf("%s.idxmap", repofile);
+}
+
+static bool
+idxmap_valid(const struct idxmap_hdr *hdr, size_t len, const struct stat *st)
+{
+	uint64_t off;
+
+	if (len < sizeof(*hdr))
+		return false;
+	if (memcmp(hdr->magic, IDXMAP_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != IDXMAP_VERSION)
+		return false;
+	if (hdr->rdsize != (uint64_t)st->st_size ||
+	    hdr->rdmtime != (int64_t)st->st_mtime ||
+	    hdr->rdino != (uint64_t)st->st_ino)
+		return false;
+
+	off = sizeof(*hdr) + (uint64_t)hdr->npkgs * sizeof(struct idxmap_pkg) +
+	    (uint64_t)hdr->nvpkgs * sizeof(struct idxmap_vpkg) +
+	    (uint64_t)hdr->ntris * sizeof(struct idxmap_tri) +
+	    (uint64_t)hdr->nposts * sizeof(uint32_t);
+	if (hdr->strtab != off || hdr->strtablen == 0 ||
+	    hdr->strtab + hdr->strtablen != len)
+		return false;
+	/* all strings must be NUL terminated */
+	if (((const char *)hdr)[len - 1] != '\0')
+		return false;
+	if (hdr->meta != IDXMAP_NONE && hdr->meta >= hdr->strtablen)
+		return false;
+
+	return true;
+}
+
+bool HIDDEN
+xbps_repo_idxmap_open(struct xbps_repo *repo, const char *repofile)
+{
+	struct xbps_repo_idxmap *im;
+	struct stat st;
+	const struct idxmap_hdr *hdr;
+	char *path;
+	void *map;
+	size_t maplen, len;
+
+	if (fstat(repo->fd, &st) == -1)
+		return false;
+
+	path = idxmap_path(repofile);
+	if (!xbps_mmap_file(path, &map, &maplen, &len)) {
+		free(path);
+		return false;
+	}
+	hdr = map;
+	if (!idxmap_valid(hdr, len, &st)) {
+		xbps_dbg_printf(repo->xhp, "[repo] `%s' ignoring stale or "
+		    "invalid index map\n", path);
+		(void)munmap(map, maplen);
+		free(path);
+		return false;
+	}
+	free(path);
+
+	im = idxmap_alloc();
+	im->map = map;
+	im->maplen = maplen;
+	im->npkgs = hdr->npkgs;
+	im->nvpkgs = hdr->nvpkgs;
+	im->ntris = hdr->ntris;
+	im->nposts = hdr->nposts;
+	im->pkgs = (const void *)((const char *)map + sizeof(*hdr));
+	im->vpkgs = (const void *)(im->pkgs + hdr->npkgs);
+	im->tris = (const void *)(im->vpkgs + hdr->nvpkgs);
+	im->posts = (const void *)(im->tris + hdr->ntris);
+	im->strtab = (const char *)map + hdr->strtab;
+	im->strtablen = hdr->strtablen;
+
+	if (hdr->meta != IDXMAP_NONE) {
+		repo->idxmeta = xbps_dictionary_internalize(im->strtab + hdr->meta);
+		if (repo->idxmeta != NULL) {
+			repo->is_signed = true;
+			xbps_dictionary_make_immutable(repo->idxmeta);
+		}
+	}
+	repo->idxmap = im;
+
+	xbps_dbg_printf(repo->xhp, "[repo] `%s' using index map (%u pkgs)\n",
+	    repofile, hdr->npkgs);
+
+	return true;
+}
+
+static const char *
+skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return p;
+}
+
+#define TAG(p, t)	(strncmp(p, t, sizeof(t) - 1) == 0)
+
+/*
+ * Scans the <array> of strings following a "provides" key.
+ * Returns a pointer past </array>, or NULL on error.
+ */
+static const char *
+scan_provides(const char *p, struct vpkg_ent **vents, unsigned int *nvents,
+		unsigned int *vsize, uint32_t pkg)
+{
+	p = skip_space(p);
+	if (TAG(p, "<array/>"))
+		return p + sizeof("<array/>") - 1;
+	if (!TAG(p, "<array>"))
+		return NULL;
+	p += sizeof("<array>") - 1;
+
+	for (;;) {
+		const char *e;
+		char *vpkg;
+
+		p = skip_space(p);
+		if (TAG(p, "</array>"))
+			return p + sizeof("</array>") - 1;
+		if (!TAG(p, "<string>"))
+			return NULL;
+		p += sizeof("<string>") - 1;
+		if ((e = strchr(p, '<')) == NULL || !TAG(e, "</string>"))
+			return NULL;
+		/* entities would need decoding */
+		if (memchr(p, '&', (size_t)(e - p)))
+			return NULL;
+		vpkg = strndup(p, (size_t)(e - p));
+		assert(vpkg);
+		vpkg_ent_add(vents, nvents, vsize, vpkg, pkg);
+		free(vpkg);
+		p = e + sizeof("</string>") - 1;
+	}
+}
+
+/*
+ * Scans an externalized repository index, recording the pkgname and
+ * the XML fragment of every package dictionary, as well as all virtual
+ * packages. The XML is not validated, this is left to the internalizer
+ * when a package is materialized.
+ */
+static bool
+idxmap_scan(struct xbps_repo_idxmap *im, const char *xml)
+{
+	struct strtab names = { NULL, 0, 0 };
+	struct vpkg_ent *vents = NULL;
+	struct idxmap_pkg *pkgs = NULL;
+	struct idxmap_frag *frags = NULL;
+	const char *p;
+	unsigned int npkgs = 0, psize = 0, nvents = 0, vsize = 0;
+	bool rv = false;
+
+	if ((p = strstr(xml, "<plist")) == NULL ||
+	    (p = strchr(p, '>')) == NULL)
+		goto out;
+	p = skip_space(p + 1);
+	if (TAG(p, "<dict/>")) {
+		rv = true;
+		goto out;
+	}
+	if (!TAG(p, "<dict>"))
+		goto out;
+	p += sizeof("<dict>") - 1;
+
+	for (;;) {
+		const char *key, *e, *frag;
+		char *name;
+		unsigned int depth;
+
+		p = skip_space(p);
+		if (TAG(p, "</dict>"))
+			break;
+		if (!TAG(p, "<key>"))
+			goto out;
+		key = p + sizeof("<key>") - 1;
+		if ((e = strchr(key, '<')) == NULL || !TAG(e, "</key>"))
+			goto out;
+		if (e == key || memchr(key, '&', (size_t)(e - key)))
+			goto out;
+		name = strndup(key, (size_t)(e - key));
+		assert(name);
+		/* proplib externalizes keys sorted */
+		if (npkgs &&
+		    strcmp(names.buf + pkgs[npkgs - 1].name, name) >= 0) {
+			free(name);
+			goto out;
+		}
+		if (npkgs == psize) {
+			psize = psize ? psize * 2 : 1024;
+			pkgs = realloc(pkgs, psize * sizeof(*pkgs));
+			frags = realloc(frags, psize * sizeof(*frags));
+			assert(pkgs && frags);
+		}
+		pkgs[npkgs].name = strtab_add(&names, name);
+		pkgs[npkgs].plist = npkgs;
+		free(name);
+
+		p = skip_space(e + sizeof("</key>") - 1);
+		frag = p;
+		if (TAG(p, "<dict/>")) {
+			p += sizeof("<dict/>") - 1;
+		} else if (TAG(p, "<dict>")) {
+			p += sizeof("<dict>") - 1;
+			depth = 1;
+			while (depth > 0) {
+				if ((p = strchr(p, '<')) == NULL)
+					goto out;
+				if (TAG(p, "<dict>")) {
+					depth++;
+					p += sizeof("<dict>") - 1;
+				} else if (TAG(p, "</dict>")) {
+					depth--;
+					p += sizeof("</dict>") - 1;
+				} else if (depth == 1 &&
+				    TAG(p, "<key>provides</key>")) {
+					p = scan_provides(p +
+					    sizeof("<key>provides</key>") - 1,
+					    &vents, &nvents, &vsize, npkgs);
+					if (p == NULL)
+						goto out;
+				} else {
+					p++;
+				}
+			}
+		} else {
+			goto out;
+		}
+		frags[npkgs].off = (size_t)(frag - xml);
+		frags[npkgs].len = (size_t)(p - frag);
+		npkgs++;
+	}
+	rv = true;
+
+out:
+	if (rv) {
+		if (nvents)
+			qsort(vents, nvents, sizeof(*vents), vpkg_ent_cmp);
+		im->xvpkgs = calloc(nvents ? nvents : 1, sizeof(*im->xvpkgs));
+		assert(im->xvpkgs);
+		for (unsigned int i = 0; i < nvents; i++) {
+			im->xvpkgs[i].name = strtab_add(&names, vents[i].name);
+			im->xvpkgs[i].pkg = vents[i].pkg;
+		}
+		if (names.len == 0)
+			(void)strtab_add(&names, "");
+		im->names = names.buf;
+		im->xpkgs = pkgs;
+		im->frags = frags;
+		im->npkgs = npkgs;
+		im->nvpkgs = nvents;
+		im->pkgs = im->xpkgs;
+		im->vpkgs = im->xvpkgs;
+		im->strtab = im->names;
+		im->strtablen = names.len;
+	} else {
+		free(names.buf);
+		free(pkgs);
+		free(frags);
+	}
+	for (unsigned int i = 0; i < nvents; i++)
+		free(vents[i].name);
+	free(vents);
+
+	return rv;
+}
+
+#undef TAG
+
+/*
+ * Opens the repository index lazily from the externalized index.plist
+ * \a xml, which is owned by the repository on success.
+ */
+bool HIDDEN
+xbps_repo_idxmap_open_lazy(struct xbps_repo *repo, char *xml)
+{
+	struct xbps_repo_idxmap *im;
+
+	im = idxmap_alloc();
+	if (!idxmap_scan(im, xml)) {
+		xbps_dbg_printf(repo->xhp, "[repo] `%s' cannot scan index, "
+		    "internalizing it\n", repo->uri);
+		xbps_object_release(im->cache);
+		pthread_mutex_destroy(&im->lock);
+		free(im);
+		return false;
+	}
+	im->xml = xml;
+	repo->idxmap = im;
+
+	xbps_dbg_printf(repo->xhp, "[repo] `%s' lazily opened (%u pkgs)\n",
+	    repo->uri, im->npkgs);
+
+	return true;
+}
+
+/*
+ * Internalizes the whole index of a lazily opened repository.
+ */
+xbps_dictionary_t HIDDEN
+xbps_repo_idxmap_internalize(struct xbps_repo *repo)
+{
+	xbps_dictionary_t idx;
+
+	if (repo->idxmap == NULL || repo->idxmap->xml == NULL)
+		return NULL;
+
+	xbps_object_arena_begin();
+	xbps_object_arena_intern();
+	idx = xbps_dictionary_internalize(repo->idxmap->xml);
+	xbps_object_arena_end();
+
+	return idx;
+}
+
+static void
+idxmap_copy_data(struct xbps_repo_idxmap *dst,
+		const struct xbps_repo_idxmap *src)
+{
+	dst->map = src->map;
+	dst->maplen = src->maplen;
+	dst->xml = src->xml;
+	dst->names = src->names;
+	dst->xpkgs = src->xpkgs;
+	dst->xvpkgs = src->xvpkgs;
+	dst->frags = src->frags;
+	dst->npkgs = src->npkgs;
+	dst->nvpkgs = src->nvpkgs;
+	dst->ntris = src->ntris;
+	dst->nposts = src->nposts;
+	dst->pkgs = src->pkgs;
+	dst->vpkgs = src->vpkgs;
+	dst->tris = src->tris;
+	dst->posts = src->posts;
+	dst->strtab = src->strtab;
+	dst->strtablen = src->strtablen;
+}
+
+static void
+idxmap_free_data(struct xbps_repo_idxmap *im)
+{
+	if (im->map != NULL)
+		(void)munmap(im->map, im->maplen);
+	free(im->xml);
+	free(im->names);
+	free(im->xpkgs);
+	free(im->xvpkgs);
+	free(im->frags);
+}
+
+static char *
+idxmap_shared_key(struct xbps_repo *repo, const char *repofile)
+{
+	const char *p;
+
+	if ((p = strrchr(repofile, '/')) != NULL)
+		repofile = p + 1;
+	return xbps_xasprintf("%s/%s", repo->uri, repofile);
+}
+
+static bool
+idxmap_shared_match(const struct idxmap_shared *sh, const char *key,
+		const struct stat *st)
+{
+	if (strcmp(sh->key, key) || sh->size != st->st_size ||
+	    sh->mtim.tv_sec != st->st_mtim.tv_sec ||
+	    sh->mtim.tv_nsec != st->st_mtim.tv_nsec)
+		return false;
+	if (sh->local && (sh->dev != st->st_dev || sh->ino != st->st_ino))
+		return false;
+
+	return true;
+}
+
+static void
+idxmap_shared_release(struct idxmap_shared *sh)
+{
+	bool last;
+
+	pthread_mutex_lock(&idxmap_shared_mtx);
+	if ((last = --sh->refs == 0))
+		LIST_REMOVE(sh, entries);
+	pthread_mutex_unlock(&idxmap_shared_mtx);
+	if (!last)
+		return;
+
+	idxmap_free_data(&sh->data);
+	if (sh->idxmeta != NULL)
+		xbps_object_release(sh->idxmeta);
+	free(sh->key);
+	free(sh);
+}
+
+/*
+ * Opens the index of \a repo with the index data of the repository
+ * of another handle for the same repodata archive \a repofile, whose
+ * status is \a st. Returns false if there's none.
+ */
+bool HIDDEN
+xbps_repo_idxmap_attach(struct xbps_repo *repo, const char *repofile,
+		const struct stat *st)
+{
+	struct xbps_repo_idxmap *im;
+	struct idxmap_shared *sh;
+	char *key;
+
+	key = idxmap_shared_key(repo, repofile);
+	pthread_mutex_lock(&idxmap_shared_mtx);
+	LIST_FOREACH(sh, &idxmap_shared, entries) {
+		if (idxmap_shared_match(sh, key, st)) {
+			sh->refs++;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&idxmap_shared_mtx);
+	free(key);
+	if (sh == NULL)
+		return false;
+
+	im = idxmap_alloc();
+	idxmap_copy_data(im, &sh->data);
+	im->shared = sh;
+	if (sh->idxmeta != NULL) {
+		xbps_object_retain(sh->idxmeta);
+		repo->idxmeta = sh->idxmeta;
+		repo->is_signed = true;
+	}
+	repo->idxmap = im;
+
+	xbps_dbg_printf(repo->xhp, "[repo] `%s' using shared index (%u pkgs)\n",
+	    repofile, im->npkgs);
+
+	return true;
+}
+
+/*
+ * Makes the index just opened for \a repo available to the other
+ * handles opening the same repodata archive \a repofile, see
+ * xbps_repo_idxmap_attach().
+ */
+void HIDDEN
+xbps_repo_idxmap_share(struct xbps_repo *repo, const char *repofile,
+		const struct stat *st)
+{
+	struct xbps_repo_idxmap *im = repo->idxmap;
+	struct idxmap_shared *sh, *osh;
+
+	if (im == NULL || im->shared != NULL)
+		return;
+
+	sh = calloc(1, sizeof(*sh));
+	assert(sh);
+	sh->key = idxmap_shared_key(repo, repofile);
+	sh->local = !repo->is_remote;
+	sh->dev = st->st_dev;
+	sh->ino = st->st_ino;
+	sh->size = st->st_size;
+	sh->mtim = st->st_mtim;
+	idxmap_copy_data(&sh->data, im);
+	if (repo->idxmeta != NULL) {
+		xbps_object_retain(repo->idxmeta);
+		sh->idxmeta = repo->idxmeta;
+	}
+	sh->refs = 1;
+
+	pthread_mutex_lock(&idxmap_shared_mtx);
+	LIST_FOREACH(osh, &idxmap_shared, entries) {
+		if (idxmap_shared_match(osh, sh->key, st))
+			break;
+	}
+	/* opened at the same time by another handle, keep it private */
+	if (osh == NULL) {
+		LIST_INSERT_HEAD(&idxmap_shared, sh, entries);
+		im->shared = sh;
+	}
+	pthread_mutex_unlock(&idxmap_shared_mtx);
+	if (osh != NULL) {
+		if (sh->idxmeta != NULL)
+			xbps_object_release(sh->idxmeta);
+		free(sh->key);
+		free(sh);
+	}
+}
+
+void HIDDEN
+xbps_repo_idxmap_close(struct xbps_repo *repo)
+{
+	struct xbps_repo_idxmap *im = repo->idxmap;
+
+	if (im == NULL)
+		return;
+
+	xbps_object_release(im->cache);
+	if (im->shared != NULL)
+		idxmap_shared_release(im->shared);
+	else
+		idxmap_free_data(im);
+	pthread_mutex_destroy(&im->lock);
+	free(im);
+	repo->idxmap = NULL;
+}
+
+void HIDDEN
+xbps_repo_idxmap_memstat(struct xbps_repo *repo, struct xbps_memstat *ms)
+{
+	struct xbps_repo_idxmap *im = repo->idxmap;
+
+	if (im == NULL)
+		return;
+
+	pthread_mutex_lock(&im->lock);
+	xbps_object_memstat(im->cache, ms);
+	pthread_mutex_unlock(&im->lock);
+}
+
+static const char *
+idxmap_str(struct xbps_repo_idxmap *im, uint64_t off)
+{
+	if (off >= im->strtablen)
+		return NULL;
+	return im->strtab + off;
+}
+
+static void
+idxmap_load(struct xbps_repo_idxmap *im, uint32_t i)
+{
+	xbps_dictionary_t pkgd;
+	const char *name, *plist;
+	char *buf;
+
+	if ((name = idxmap_str(im, im->pkgs[i].name)) == NULL)
+		return;
+	if (xbps_dictionary_get(im->cache, name))
+		return;
+
+	if (im->xml != NULL) {
+		/* wrap the XML fragment into a plist */
+		buf = malloc(im->frags[i].len + sizeof("<plist></plist>"));
+		assert(buf);
+		memcpy(buf, "<plist>", 7);
+		memcpy(buf + 7, im->xml + im->frags[i].off, im->frags[i].len);
+		memcpy(buf + 7 + im->frags[i].len, "</plist>", 9);
+		pkgd = xbps_dictionary_internalize(buf);
+		free(buf);
+	} else {
+		if ((plist = idxmap_str(im, im->pkgs[i].plist)) == NULL)
+			return;
+		pkgd = xbps_dictionary_internalize(plist);
+	}
+	if (pkgd == NULL)
+		return;
+	xbps_dictionary_set(im->cache, name, pkgd);
+	xbps_object_release(pkgd);
+}
+
+static void
+idxmap_load_pkg(struct xbps_repo_idxmap *im, const char *pkgname)
+{
+	uint32_t lo = 0, hi = im->npkgs;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const char *name = idxmap_str(im, im->pkgs[mid].name);
+		int cmp;
+
+		if (name == NULL)
+			return;
+		if ((cmp = strcmp(pkgname, name)) == 0) {
+			idxmap_load(im, mid);
+			return;
+		} else if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+}
+
+static void
+idxmap_load_vpkg(struct xbps_repo_idxmap *im, const char *vpkgname)
+{
+	uint32_t lo = 0, hi = im->nvpkgs;
+
+	/* lower bound, then load all providers */
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const char *name = idxmap_str(im, im->vpkgs[mid].name);
+
+		if (name == NULL)
+			return;
+		if (strcmp(name, vpkgname) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < im->nvpkgs; lo++) {
+		const char *name = idxmap_str(im, im->vpkgs[lo].name);
+
+		if (name == NULL || strcmp(name, vpkgname))
+			break;
+		if (im->vpkgs[lo].pkg < im->npkgs)
+			idxmap_load(im, im->vpkgs[lo].pkg);
+	}
+}
+
+/*
+ * Loads into the cache all packages that a package expression
+ * (pkgname, pkgver or pkgpattern) could match, so that the generic
+ * plist_find.c matching functions can be used against it.
+ */
+static void
+idxmap_load_expr(struct xbps_repo_idxmap *im, const char *pkg, bool virtual)
+{
+	char *pkgname;
+
+	if (pkg == NULL)
+		return;
+
+	idxmap_load_pkg(im, pkg);
+	if (virtual)
+		idxmap_load_vpkg(im, pkg);
+
+	if ((pkgname = xbps_pkgpattern_name(pkg))) {
+		idxmap_load_pkg(im, pkgname);
+		if (virtual)
+			idxmap_load_vpkg(im, pkgname);
+		free(pkgname);
+	}
+	if ((pkgname = xbps_pkg_name(pkg))) {
+		idxmap_load_pkg(im, pkgname);
+		if (virtual)
+			idxmap_load_vpkg(im, pkgname);
+		free(pkgname);
+	}
+}
+
+xbps_dictionary_t HIDDEN
+xbps_repo_idxmap_get_pkg(struct xbps_repo *repo, const char *pkg)
+{
+	struct xbps_repo_idxmap *im = repo->idxmap;
+	xbps_dictionary_t pkgd;
+
+	pthread_mutex_lock(&im->lock);
+	idxmap_load_expr(im, pkg, false);
+	idxmap_load_expr(im, vpkg_user_conf(repo->xhp, pkg, true), false);
+
+	/* Try matching vpkg from configuration files */
+	if ((pkgd = xbps_find_virtualpkg_in_conf(repo->xhp, im->cache, pkg)))
+		goto out;
+
+	/* ... otherwise match a real pkg */
+	pkgd = xbps_find_pkg_in_dict(im->cache, pkg);
+	if (pkgd)
+		xbps_dictionary_set_cstring_nocopy(pkgd,
+				"repository", repo->uri);
+out:
+	pthread_mutex_unlock(&im->lock);
+	return pkgd;
+}
+
+xbps_dictionary_t HIDDEN
+xbps_repo_idxmap_get_virtualpkg(struct xbps_repo *repo, const char *pkg)
+{
+	struct xbps_repo_idxmap *im = repo->idxmap;
+	xbps_dictionary_t pkgd;
+
+	pthread_mutex_lock(&im->lock);
+	idxmap_load_expr(im, pkg, true);
+	idxmap_load_expr(im, vpkg_user_conf(repo->xhp, pkg, false), false);
+
+	pkgd = xbps_find_virtualpkg_in_dict(repo->xhp, im->cache, pkg);
+	if (pkgd)
+		xbps_dictionary_set_cstring_nocopy(pkgd,
+				"repository", repo->uri);
+	pthread_mutex_unlock(&im->lock);
+	return pkgd;
+}
+
+void HIDDEN
+xbps_repo_idxmap_map_vpkgs(struct xbps_repo *repo, xbps_dictionary_t vpkgs)
+{
+	struct xbps_repo_idxmap *im = repo->idxmap;
+
+	for (uint32_t i = 0; i < im->nvpkgs; i++) {
+		const char *vpkgname, *pkgname;
+
+		if (im->vpkgs[i].pkg >= im->npkgs)
+			continue;
+		vpkgname = idxmap_str(im, im->vpkgs[i].name);
+		pkgname = idxmap_str(im, im->pkgs[im->vpkgs[i].pkg].name);
+		if (vpkgname == NULL || pkgname == NULL)
+			continue;
+		xbps_repo_map_vpkg(repo, vpkgs, vpkgname, pkgname);
+	}
+}
+
+static const struct idxmap_tri *
+idxmap_tri(struct xbps_repo_idxmap *im, uint32_t tri)
+{
+	uint32_t lo = 0, hi = im->ntris;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (im->tris[mid].tri < tri) {
+			lo = mid + 1;
+		} else if (im->tris[mid].tri > tri) {
+			hi = mid;
+		} else {
+			if ((uint64_t)im->tris[mid].first + im->tris[mid].count >
+			    im->nposts)
+				return NULL;
+			return &im->tris[mid];
+		}
+	}
+	return NULL;
+}
+
+static bool
+idxmap_tri_has(struct xbps_repo_idxmap *im, const struct idxmap_tri *t,
+		uint32_t pkg)
+{
+	const uint32_t *posts = im->posts + t->first;
+	uint32_t lo = 0, hi = t->count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (posts[mid] == pkg)
+			return true;
+		else if (posts[mid] < pkg)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+
+xbps_array_t
+xbps_repo_search_candidates(struct xbps_repo *repo, const char *pat)
+{
+	struct xbps_repo_idxmap *im;
+	const struct idxmap_tri **tris, *base;
+	xbps_array_t pkgs;
+	size_t len, ntris;
+
+	assert(repo);
+	assert(pat);
+
+	im = repo->idxmap;
+	if (im == NULL || im->map == NULL || (len = strlen(pat)) < 3)
+		return NULL;
+
+	pkgs = xbps_array_create();
+	assert(pkgs);
+	ntris = len - 2;
+	tris = calloc(ntris, sizeof(*tris));
+	assert(tris);
+	base = NULL;
+	for (size_t i = 0; i < ntris; i++) {
+		if ((tris[i] = idxmap_tri(im, tri_fold(pat + i))) == NULL)
+			goto out;
+		if (base == NULL || tris[i]->count < base->count)
+			base = tris[i];
+	}
+
+	pthread_mutex_lock(&im->lock);
+	for (uint32_t i = 0; i < base->count; i++) {
+		xbps_dictionary_t pkgd;
+		const char *name;
+		uint32_t pkg = im->posts[base->first + i];
+		bool found = true;
+
+		if (pkg >= im->npkgs)
+			continue;
+		for (size_t j = 0; j < ntris && found; j++) {
+			if (tris[j] != base)
+				found = idxmap_tri_has(im, tris[j], pkg);
+		}
+		if (!found || (name = idxmap_str(im, im->pkgs[pkg].name)) == NULL)
+			continue;
+		idxmap_load(im, pkg);
+		if ((pkgd = xbps_dictionary_get(im->cache, name)) == NULL)
+			continue;
+		xbps_dictionary_set_cstring_nocopy(pkgd, "repository", repo->uri);
+		xbps_array_add(pkgs, pkgd);
+	}
+	pthread_mutex_unlock(&im->lock);
+out:
+	free(tris);
+	return pkgs;
+}
+
+static bool
+write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0) {
+		ssize_t r = write(fd, p, len);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += r;
+		len -= (size_t)r;
+	}
+	return true;
+}
+
+int
+xbps_repo_write_idxmap(struct xbps_handle *xhp, const char *repofile,
+		xbps_dictionary_t idx, xbps_dictionary_t meta)
+{
+	struct idxmap_hdr hdr;
+	struct idxmap_pkg *pkgs = NULL;
+	struct vpkg_ent *vents = NULL;
+	struct idxmap_vpkg *vpkgs = NULL;
+	struct tri_ent *tents = NULL;
+	struct idxmap_tri *tris = NULL;
+	uint32_t *posts = NULL;
+	struct strtab st = { NULL, 0, 0 };
+	struct stat rst;
+	xbps_array_t allkeys;
+	char *path, *tname, *buf;
+	unsigned int npkgs, nvpkgs = 0, vsize = 0, ntris = 0, nposts = 0;
+	size_t ntents = 0, tsize = 0;
+	int fd, rv = 0;
+
+	assert(repofile);
+
+	if (stat(repofile, &rst) == -1)
+		return errno;
+	if (xbps_object_type(idx) != XBPS_TYPE_DICTIONARY)
+		return EINVAL;
+
+	allkeys = xbps_dictionary_all_keys(idx);
+	npkgs = xbps_array_count(allkeys);
+	pkgs = calloc(npkgs ? npkgs : 1, sizeof(*pkgs));
+	assert(pkgs);
+
+	/* keys are returned sorted */
+	for (unsigned int i = 0; i < npkgs; i++) {
+		xbps_object_t keysym;
+		xbps_dictionary_t pkgd;
+		xbps_array_t provides;
+		const char *str = NULL;
+
+		keysym = xbps_array_get(allkeys, i);
+		pkgd = xbps_dictionary_get_keysym(idx, keysym);
+		pkgs[i].name = strtab_add(&st,
+		    xbps_dictionary_keysym_cstring_nocopy(keysym));
+		buf = xbps_dictionary_externalize(pkgd);
+		assert(buf);
+		pkgs[i].plist = strtab_add(&st, buf);
+		free(buf);
+
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &str))
+			tri_ent_add(&tents, &ntents, &tsize, str, i);
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "short_desc", &str))
+			tri_ent_add(&tents, &ntents, &tsize, str, i);
+
+		provides = xbps_dictionary_get(pkgd, "provides");
+		for (unsigned int j = 0; j < xbps_array_count(provides); j++) {
+			const char *vpkg = NULL;
+
+			xbps_array_get_cstring_nocopy(provides, j, &vpkg);
+			if (vpkg != NULL) {
+				vpkg_ent_add(&vents, &nvpkgs, &vsize, vpkg, i);
+				tri_ent_add(&tents, &ntents, &tsize, vpkg, i);
+			}
+		}
+	}
+	xbps_object_release(allkeys);
+
+	/* posting lists of the unique trigrams */
+	if (ntents)
+		qsort(tents, ntents, sizeof(*tents), tri_ent_cmp);
+	tris = calloc(ntents ? ntents : 1, sizeof(*tris));
+	posts = calloc(ntents ? ntents : 1, sizeof(*posts));
+	assert(tris && posts);
+	for (size_t i = 0; i < ntents; i++) {
+		if (i > 0 && tents[i].tri == tents[i - 1].tri &&
+		    tents[i].pkg == tents[i - 1].pkg)
+			continue;
+		if (ntris == 0 || tris[ntris - 1].tri != tents[i].tri) {
+			tris[ntris].tri = tents[i].tri;
+			tris[ntris].first = nposts;
+			ntris++;
+		}
+		tris[ntris - 1].count++;
+		posts[nposts++] = tents[i].pkg;
+	}
+	free(tents);
+
+	if (nvpkgs)
+		qsort(vents, nvpkgs, sizeof(*vents), vpkg_ent_cmp);
+	vpkgs = calloc(nvpkgs ? nvpkgs : 1, sizeof(*vpkgs));
+	assert(vpkgs);
+	for (unsigned int i = 0; i < nvpkgs; i++) {
+		vpkgs[i].name = strtab_add(&st, vents[i].name);
+		vpkgs[i].pkg = vents[i].pkg;
+		free(vents[i].name);
+	}
+	free(vents);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, IDXMAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = IDXMAP_VERSION;
+	hdr.npkgs = npkgs;
+	hdr.nvpkgs = nvpkgs;
+	hdr.ntris = ntris;
+	hdr.nposts = nposts;
+	hdr.rdsize = (uint64_t)rst.st_size;
+	hdr.rdmtime = (int64_t)rst.st_mtime;
+	hdr.rdino = (uint64_t)rst.st_ino;
+	hdr.meta = IDXMAP_NONE;
+	if (xbps_object_type(meta) == XBPS_TYPE_DICTIONARY) {
+		buf = xbps_dictionary_externalize(meta);
+		assert(buf);
+		hdr.meta = strtab_add(&st, buf);
+		free(buf);
+	}
+	if (st.len == 0)
+		(void)strtab_add(&st, "");
+	hdr.strtab = sizeof(hdr) + npkgs * sizeof(*pkgs) +
+	    nvpkgs * sizeof(*vpkgs) + ntris * sizeof(*tris) +
+	    nposts * sizeof(*posts);
+	hdr.strtablen = st.len;
+
+	/* Write data to tempfile and rename */
+	path = idxmap_path(repofile);
+	tname = xbps_xasprintf("%s.XXXXXXXXXX", path);
+	if ((fd = mkstemp(tname)) == -1) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "[repo] `%s' failed to create index map: "
+		    "%s\n", path, strerror(rv));
+		goto out;
+	}
+	if (!write_all(fd, &hdr, sizeof(hdr)) ||
+	    !write_all(fd, pkgs, npkgs * sizeof(*pkgs)) ||
+	    !write_all(fd, vpkgs, nvpkgs * sizeof(*vpkgs)) ||
+	    !write_all(fd, tris, ntris * sizeof(*tris)) ||
+	    !write_all(fd, posts, nposts * sizeof(*posts)) ||
+	    !write_all(fd, st.buf, st.len) ||
+	    fchmod(fd, 0644) == -1) {
+		rv = errno;
+		(void)close(fd);
+		(void)unlink(tname);
+		goto out;
+	}
+	(void)close(fd);
+	if (rename(tname, path) == -1) {
+		rv = errno;
+		(void)unlink(tname);
+		goto out;
+	}
+	xbps_dbg_printf(xhp, "[repo] `%s' wrote index map (%u pkgs)\n",
+	    path, npkgs);
+out:
+	free(tname);
+	free(path);
+	free(st.buf);
+	free(posts);
+	free(tris);
+	free(vpkgs);
+	free(pkgs);
+	return rv;
+}
+
+/*
+ * Creates or refreshes the index map of a synchronized remote
+ * repository archive. Returns 0 if the index map was fresh or written.
+ */
+int HIDDEN
+xbps_repo_idxmap_update(struct xbps_handle *xhp, const char *repofile)
+{
+	struct archive *ar;
+	struct archive_entry *entry;
+	struct stat st;
+	xbps_dictionary_t idx = NULL, meta = NULL;
+	char *path;
+	void *map;
+	size_t maplen, len;
+	bool valid = false;
+	int rv;
+
+	if (stat(repofile, &st) == -1)
+		return errno;
+
+	path = idxmap_path(repofile);
+	if (xbps_mmap_file(path, &map, &maplen, &len)) {
+		valid = idxmap_valid(map, len, &st);
+		(void)munmap(map, maplen);
+	}
+	free(path);
+	if (valid)
+		return 0;
+
+	if ((ar = archive_read_new()) == NULL)
+		return ENOMEM;
+	archive_read_support_compression_gzip(ar);
+	archive_read_support_compression_bzip2(ar);
+	archive_read_support_compression_xz(ar);
+	archive_read_support_filter_zstd(ar);
+	archive_read_support_format_tar(ar);
+	if (archive_read_open_filename(ar, repofile,
+	    (size_t)st.st_blksize) == ARCHIVE_FATAL) {
+		rv = archive_errno(ar);
+		archive_read_finish(ar);
+		return rv ? rv : EINVAL;
+	}
+	if (archive_read_next_header(ar, &entry) == ARCHIVE_OK)
+		idx = xbps_archive_get_dictionary(ar, entry);
+	if (idx != NULL && archive_read_next_header(ar, &entry) == ARCHIVE_OK)
+		meta = xbps_archive_get_dictionary(ar, entry);
+	archive_read_finish(ar);
+
+	if (idx == NULL)
+		return EINVAL;
+
+	rv = xbps_repo_write_idxmap(xhp, repofile, idx, meta);
+	xbps_object_release(idx);
+	if (meta != NULL)
+		xbps_object_release(meta);
+
+	return rv;
+}
@@ -0,0 +1,335 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "xbps_api_impl.h"
+#include "fetch.h"
+
+/*
+ * A remote repository can be declared with equivalent mirrors, set in
+ * xhp->mirrors as an array of URLs keyed by the repository, which is its
+ * first element. Before a mirror is used they are ranked by the latency
+ * of a HEAD request for the repodata archive on every one of them; the
+ * ranking is kept in the handle until xbps_end() and cached for
+ * XBPS_MIRRORS_TTL seconds in XBPS_MIRRORS_CACHE under metadir, as a
+ * dictionary of:
+ *
+ * 	<repository>: { mirrors: [<ranked urls>], reachable: n, time: t }
+ */
+struct xbps_mirror_rank {
+	char *repo;
+	char **urls;			/* best first */
+	unsigned int n;
+	unsigned int reachable;		/* urls that answered the probe */
+	struct xbps_mirror_rank *next;
+};
+
+struct mirror_probe {
+	struct xbps_handle *xhp;
+	const char *url;
+	unsigned int idx;		/* configured order */
+	uint64_t msecs;			/* UINT64_MAX if unreachable */
+	pthread_t thd;
+	bool thd_started;
+};
+
+/* serializes the probes and the rankings of every handle */
+static pthread_mutex_t ranks_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void HIDDEN
+xbps_repo_mirror_store(struct xbps_handle *xhp, const char *repo,
+		const char *mirror)
+{
+	xbps_array_t mirrors;
+
+	if (xhp->mirrors == NULL) {
+		xhp->mirrors = xbps_dictionary_create();
+		assert(xhp->mirrors);
+	}
+	if ((mirrors = xbps_dictionary_get(xhp->mirrors, repo)) == NULL) {
+		mirrors = xbps_array_create();
+		assert(mirrors);
+		xbps_array_add_cstring(mirrors, repo);
+		xbps_dictionary_set(xhp->mirrors, repo, mirrors);
+		xbps_object_release(mirrors);
+	}
+	if (xbps_match_string_in_array(mirrors, mirror))
+		return;
+
+	xbps_array_add_cstring(mirrors, mirror);
+	xbps_dbg_printf(xhp, "[repo] `%s' stored as mirror of `%s'\n",
+	    mirror, repo);
+}
+
+static void *
+mirror_probe(void *arg)
+{
+	struct mirror_probe *mp = arg;
+	struct url_stat us;
+	struct timespec ts[2];
+	const char *arch;
+	char *repodata;
+
+	arch = mp->xhp->target_arch ? mp->xhp->target_arch : mp->xhp->native_arch;
+	repodata = xbps_xasprintf("%s/%s-repodata", mp->url, arch);
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts[0]);
+	if (fetchStatURL(repodata, &us, NULL) == -1) {
+		xbps_dbg_printf(mp->xhp, "[mirror] `%s' is unreachable: %s\n",
+		    mp->url, xbps_fetch_error_string() ?
+		    xbps_fetch_error_string() : strerror(errno));
+		mp->msecs = UINT64_MAX;
+	} else {
+		(void)clock_gettime(CLOCK_MONOTONIC, &ts[1]);
+		mp->msecs = (uint64_t)(ts[1].tv_sec - ts[0].tv_sec) * 1000 +
+		    (uint64_t)((ts[1].tv_nsec - ts[0].tv_nsec) / 1000000);
+		xbps_dbg_printf(mp->xhp, "[mirror] `%s' answered in %"PRIu64
+		    "ms\n", mp->url, mp->msecs);
+	}
+	free(repodata);
+	return NULL;
+}
+
+static int
+mirror_probe_cmp(const void *a, const void *b)
+{
+	const struct mirror_probe *pa = a, *pb = b;
+
+	if (pa->msecs != pb->msecs)
+		return pa->msecs < pb->msecs ? -1 : 1;
+	/* keep the configured order */
+	return pa->idx < pb->idx ? -1 : 1;
+}
+
+/*
+ * Probes the mirrors concurrently and sorts them by latency.
+ */
+static void
+mirror_rank_probe(struct xbps_handle *xhp, struct xbps_mirror_rank *mr,
+		xbps_array_t mirrors)
+{
+	struct mirror_probe *mp;
+
+	mp = calloc(mr->n, sizeof(*mp));
+	assert(mp);
+	for (unsigned int i = 0; i < mr->n; i++) {
+		mp[i].xhp = xhp;
+		mp[i].idx = i;
+		xbps_array_get_cstring_nocopy(mirrors, i, &mp[i].url);
+		if (pthread_create(&mp[i].thd, NULL, mirror_probe, &mp[i]) == 0)
+			mp[i].thd_started = true;
+		else
+			mirror_probe(&mp[i]);
+	}
+	for (unsigned int i = 0; i < mr->n; i++) {
+		if (mp[i].thd_started)
+			pthread_join(mp[i].thd, NULL);
+	}
+	qsort(mp, mr->n, sizeof(*mp), mirror_probe_cmp);
+
+	for (unsigned int i = 0; i < mr->n; i++) {
+		mr->urls[i] = strdup(mp[i].url);
+		assert(mr->urls[i]);
+		if (mp[i].msecs != UINT64_MAX)
+			mr->reachable++;
+	}
+	free(mp);
+}
+
+/*
+ * Uses the cached ranking if it's fresh and for the same mirrors.
+ */
+static bool
+mirror_rank_cached(struct xbps_mirror_rank *mr, xbps_dictionary_t cache,
+		xbps_array_t mirrors)
+{
+	xbps_dictionary_t d;
+	xbps_array_t ranked;
+	const char *url;
+	uint64_t t = 0;
+	uint32_t reachable = 0;
+
+	if ((d = xbps_dictionary_get(cache, mr->repo)) == NULL)
+		return false;
+	ranked = xbps_dictionary_get(d, "mirrors");
+	if (xbps_array_count(ranked) != mr->n)
+		return false;
+	if (!xbps_dictionary_get_uint64(d, "time", &t) ||
+	    t > (uint64_t)time(NULL) ||
+	    (uint64_t)time(NULL) - t >= XBPS_MIRRORS_TTL)
+		return false;
+	xbps_dictionary_get_uint32(d, "reachable", &reachable);
+	for (unsigned int i = 0; i < mr->n; i++) {
+		xbps_array_get_cstring_nocopy(ranked, i, &url);
+		if (url == NULL || !xbps_match_string_in_array(mirrors, url))
+			return false;
+	}
+	for (unsigned int i = 0; i < mr->n; i++) {
+		xbps_array_get_cstring_nocopy(ranked, i, &url);
+		mr->urls[i] = strdup(url);
+		assert(mr->urls[i]);
+	}
+	mr->reachable = reachable <= mr->n ? reachable : mr->n;
+	return true;
+}
+
+static void
+mirror_rank_store(struct xbps_handle *xhp, xbps_dictionary_t cache,
+		struct xbps_mirror_rank *mr, const char *path)
+{
+	xbps_dictionary_t d;
+	xbps_array_t ranked;
+
+	d = xbps_dictionary_create();
+	ranked = xbps_array_create();
+	assert(d && ranked);
+	for (unsigned int i = 0; i < mr->n; i++)
+		xbps_array_add_cstring(ranked, mr->urls[i]);
+	xbps_dictionary_set(d, "mirrors", ranked);
+	xbps_dictionary_set_uint32(d, "reachable", mr->reachable);
+	xbps_dictionary_set_uint64(d, "time", (uint64_t)time(NULL));
+	xbps_dictionary_set(cache, mr->repo, d);
+	xbps_object_release(ranked);
+	xbps_object_release(d);
+
+	if (!xbps_dictionary_externalize_to_file(cache, path))
+		xbps_dbg_printf(xhp, "[mirror] failed to write %s: %s\n",
+		    path, strerror(errno));
+}
+
+/*
+ * Returns the ranking of the mirrors of repo, creating it if needed.
+ * Must be called with ranks_mtx held.
+ */
+static struct xbps_mirror_rank *
+mirror_rank_get(struct xbps_handle *xhp, const char *repo)
+{
+	struct xbps_mirror_rank *mr;
+	xbps_dictionary_t cache;
+	xbps_array_t mirrors;
+	char *path;
+
+	for (mr = xhp->mirror_ranks; mr; mr = mr->next) {
+		if (strcmp(mr->repo, repo) == 0)
+			return mr;
+	}
+	if (xhp->mirrors == NULL ||
+	    (mirrors = xbps_dictionary_get(xhp->mirrors, repo)) == NULL)
+		return NULL;
+
+	mr = calloc(1, sizeof(*mr));
+	assert(mr);
+	mr->repo = strdup(repo);
+	mr->n = xbps_array_count(mirrors);
+	mr->urls = calloc(mr->n, sizeof(*mr->urls));
+	assert(mr->repo && mr->urls);
+
+	path = xbps_xasprintf("%s/%s", xhp->metadir, XBPS_MIRRORS_CACHE);
+	if ((cache = xbps_dictionary_internalize_from_file(path)) == NULL)
+		cache = xbps_dictionary_create();
+	assert(cache);
+
+	if (mirror_rank_cached(mr, cache, mirrors)) {
+		xbps_dbg_printf(xhp, "[mirror] using cached ranking of `%s'\n",
+		    repo);
+	} else {
+		mirror_rank_probe(xhp, mr, mirrors);
+		mirror_rank_store(xhp, cache, mr, path);
+	}
+	for (unsigned int i = 0; i < mr->n; i++)
+		xbps_dbg_printf(xhp, "[mirror] %u: %s%s\n", i, mr->urls[i],
+		    i < mr->reachable ? "" : " (unreachable)");
+	xbps_object_release(cache);
+	free(path);
+
+	mr->next = xhp->mirror_ranks;
+	xhp->mirror_ranks = mr;
+	return mr;
+}
+
+unsigned int HIDDEN
+xbps_repo_mirrors(struct xbps_handle *xhp, const char *repo,
+		unsigned int *reachable)
+{
+	struct xbps_mirror_rank *mr;
+	unsigned int n = 1;
+
+	if (reachable)
+		*reachable = 1;
+
+	pthread_mutex_lock(&ranks_mtx);
+	if ((mr = mirror_rank_get(xhp, repo)) != NULL) {
+		n = mr->n;
+		if (reachable)
+			*reachable = mr->reachable;
+	}
+	pthread_mutex_unlock(&ranks_mtx);
+
+	return n;
+}
+
+const char HIDDEN *
+xbps_repo_mirror(struct xbps_handle *xhp, const char *repo, unsigned int n)
+{
+	struct xbps_mirror_rank *mr;
+	const char *url = NULL;
+
+	pthread_mutex_lock(&ranks_mtx);
+	if ((mr = mirror_rank_get(xhp, repo)) != NULL) {
+		if (n < mr->n)
+			url = mr->urls[n];
+	} else if (n == 0) {
+		url = repo;
+	}
+	pthread_mutex_unlock(&ranks_mtx);
+
+	return url;
+}
+
+void HIDDEN
+xbps_repo_mirrors_release(struct xbps_handle *xhp)
+{
+	struct xbps_mirror_rank *mr;
+
+	pthread_mutex_lock(&ranks_mtx);
+	while ((mr = xhp->mirror_ranks) != NULL) {
+		xhp->mirror_ranks = mr->next;
+		for (unsigned int i = 0; i < mr->n; i++)
+			free(mr->urls[i]);
+		free(mr->urls);
+		free(mr->repo);
+		free(mr);
+	}
+	pthread_mutex_unlock(&ranks_mtx);
+}
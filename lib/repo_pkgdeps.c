@@ -30,86 +30,160 @@
 
 #include "xbps_api_impl.h"
 
+/*
+ * Dependency resolution cache of a transaction: the dependency patterns
+ * already resolved, that need nothing else if required again. The missing
+ * dependencies are indexed by pkgname to their position in the
+ * "missing_deps" array.
+ */
+struct xbps_deps_cache {
+	xbps_dictionary_t resolved;
+	xbps_dictionary_t missing;
+	unsigned int nmissing;
+	unsigned int lookups;
+	unsigned int hits;
+};
+
+struct xbps_deps_cache HIDDEN *
+xbps_deps_cache_create(void)
+{
+	struct xbps_deps_cache *cache;
+
+	if ((cache = calloc(1, sizeof(*cache))) == NULL)
+		return NULL;
+
+	cache->resolved = xbps_dictionary_create_hashed(0);
+	cache->missing = xbps_dictionary_create_hashed(0);
+	if (!cache->resolved || !cache->missing) {
+		xbps_deps_cache_release(NULL, cache);
+		return NULL;
+	}
+	return cache;
+}
+
+void HIDDEN
+xbps_deps_cache_release(struct xbps_handle *xhp, struct xbps_deps_cache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	if (xhp && cache->lookups) {
+		xbps_dbg_printf(xhp, "[deps] resolution cache: %u/%u hits "
+		    "(%u%%), %u patterns resolved\n", cache->hits,
+		    cache->lookups, cache->hits * 100 / cache->lookups,
+		    xbps_dictionary_count(cache->resolved));
+	}
+	if (cache->resolved)
+		xbps_object_release(cache->resolved);
+	if (cache->missing)
+		xbps_object_release(cache->missing);
+	free(cache);
+}
+
+/*
+ * Same as looking up reqpkg with xbps_find_pkg_in_array() and then
+ * xbps_find_virtualpkg_in_array() in the unsorted array; large arrays
+ * are indexed by pkgname and virtual pkgname on lookups.
+ */
+static xbps_dictionary_t
+deps_cache_find_queued(struct xbps_handle *xhp, xbps_array_t unsorted,
+		const char *reqpkg)
+{
+	xbps_dictionary_t pkgd;
+
+	if ((pkgd = xbps_find_pkg_in_array(unsorted, reqpkg, NULL)))
+		return pkgd;
+	return xbps_find_virtualpkg_in_array(xhp, unsorted, reqpkg, NULL);
+}
+
+static void
+deps_cache_resolved(struct xbps_deps_cache *cache, const char *reqpkg,
+		const char *pkgver)
+{
+	xbps_dictionary_set_cstring(cache->resolved, reqpkg, pkgver);
+}
+
+#define MISSING_PREFIX	"MISSING: "
+
+static char *
+missing_pkgname(const char *pkg)
+{
+	char *pkgname;
+
+	if ((pkgname = xbps_pkgpattern_name(pkg)) ||
+	    (pkgname = xbps_pkg_name(pkg)))
+		return pkgname;
+	return strdup(pkg);
+}
+
+/*
+ * Adds reqpkg into the missing deps array, unless a missing dependency
+ * with the same pkgname is already there. The pattern with the greater
+ * version replaces it, EEXIST is returned otherwise.
+ */
 static int
-add_missing_reqdep(struct xbps_handle *xhp, const char *reqpkg)
+add_missing_reqdep(struct xbps_handle *xhp, struct xbps_deps_cache *cache,
+		const char *reqpkg)
 {
 	xbps_array_t mdeps;
-	xbps_object_iterator_t iter = NULL;
-	xbps_object_t obj;
-	unsigned int idx = 0;
-	bool add_pkgdep, pkgfound, update_pkgdep;
+	const char *curdep, *curver, *pkgver;
+	char *pkgnamedep, *str;
+	uint32_t idx;
 	int rv = 0;
 
 	assert(reqpkg != NULL);
 
-	add_pkgdep = update_pkgdep = pkgfound = false;
 	mdeps = xbps_dictionary_get(xhp->transd, "missing_deps");
+	if (mdeps == NULL)
+		return 0;
 
-	iter = xbps_array_iterator(mdeps);
-	if (iter == NULL)
-		goto out;
-
-	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
-		const char *curdep, *curver, *pkgver;
-		char *curpkgnamedep = NULL, *pkgnamedep = NULL;
-
-		assert(xbps_object_type(obj) == XBPS_TYPE_STRING);
-		curdep = xbps_string_cstring_nocopy(obj);
-		curver = xbps_pkgpattern_version(curdep);
-		pkgver = xbps_pkgpattern_version(reqpkg);
-		if (curver == NULL || pkgver == NULL)
-			goto out;
-		curpkgnamedep = xbps_pkgpattern_name(curdep);
-		if (curpkgnamedep == NULL)
-			goto out;
-		pkgnamedep = xbps_pkgpattern_name(reqpkg);
-		if (pkgnamedep == NULL) {
-			free(curpkgnamedep);
-			goto out;
-		}
-		if (strcmp(pkgnamedep, curpkgnamedep) == 0) {
-			pkgfound = true;
-			if (strcmp(curver, pkgver) == 0) {
-				free(curpkgnamedep);
-				free(pkgnamedep);
-				rv = EEXIST;
-				goto out;
-			}
-			/*
-			 * if new dependency version is greater than current
-			 * one, store it.
-			 */
-			xbps_dbg_printf(xhp, "Missing pkgdep name matched, curver: %s newver: %s\n", curver, pkgver);
-			if (xbps_cmpver(curver, pkgver) <= 0) {
-				add_pkgdep = false;
-				free(curpkgnamedep);
-				free(pkgnamedep);
-				rv = EEXIST;
-				goto out;
-			}
-			update_pkgdep = true;
-		}
-		free(curpkgnamedep);
+	/* index the missing deps added since the last call */
+	for (; cache->nmissing < xbps_array_count(mdeps); cache->nmissing++) {
+		if (!xbps_array_get_cstring_nocopy(mdeps, cache->nmissing, &curdep) ||
+		    strncmp(curdep, MISSING_PREFIX, sizeof(MISSING_PREFIX) - 1))
+			continue;
+		curdep += sizeof(MISSING_PREFIX) - 1;
+		if ((pkgnamedep = missing_pkgname(curdep)) == NULL)
+			continue;
+		if (!xbps_dictionary_get(cache->missing, pkgnamedep))
+			xbps_dictionary_set_uint32(cache->missing, pkgnamedep,
+			    cache->nmissing);
 		free(pkgnamedep);
-		if (pkgfound)
-			break;
+	}
 
-		idx++;
+	if ((pkgnamedep = missing_pkgname(reqpkg)) == NULL)
+		return ENOMEM;
+
+	str = xbps_xasprintf(MISSING_PREFIX "%s", reqpkg);
+	if (!xbps_dictionary_get_uint32(cache->missing, pkgnamedep, &idx)) {
+		xbps_dictionary_set_uint32(cache->missing, pkgnamedep,
+		    xbps_array_count(mdeps));
+		if (!xbps_array_add_cstring(mdeps, str))
+			rv = EINVAL;
+		goto out;
 	}
-	add_pkgdep = true;
-out:
-	if (iter)
-		xbps_object_iterator_release(iter);
-	if (update_pkgdep)
-		xbps_array_remove(mdeps, idx);
-	if (add_pkgdep) {
-		char *str;
-
-		str = xbps_xasprintf("MISSING: %s", reqpkg);
-		xbps_array_add_cstring(mdeps, str);
-		free(str);
+	xbps_array_get_cstring_nocopy(mdeps, idx, &curdep);
+	curdep += sizeof(MISSING_PREFIX) - 1;
+	curver = xbps_pkgpattern_version(curdep);
+	pkgver = xbps_pkgpattern_version(reqpkg);
+	if (curver == NULL || pkgver == NULL || strcmp(curver, pkgver) == 0) {
+		rv = EEXIST;
+		goto out;
 	}
-
+	xbps_dbg_printf(xhp, "Missing pkgdep name matched, curver: %s newver: %s\n", curver, pkgver);
+	/*
+	 * if new dependency version is greater than current
+	 * one, store it.
+	 */
+	if (xbps_cmpver(curver, pkgver) >= 0) {
+		rv = EEXIST;
+		goto out;
+	}
+	if (!xbps_array_set_cstring(mdeps, idx, str))
+		rv = EINVAL;
+out:
+	free(str);
+	free(pkgnamedep);
 	return rv;
 }
 
@@ -117,6 +191,7 @@ out:
 
 static int
 find_repo_deps(struct xbps_handle *xhp,
+	       struct xbps_deps_cache *cache,	/* resolution cache */
 	       xbps_array_t unsorted,		/* array of unsorted deps */
 	       xbps_array_t pkg_rdeps_array,	/* current pkg rundeps array  */
 	       xbps_array_t pkg_provides,	/* current pkg provides array */
@@ -124,28 +199,36 @@ find_repo_deps(struct xbps_handle *xhp,
 	       unsigned short *depth)		/* max recursion depth */
 {
 	xbps_dictionary_t curpkgd = NULL;
-	xbps_object_t obj;
-	xbps_object_iterator_t iter;
+	struct xbps_array_packed pk;
 	xbps_array_t curpkgrdeps = NULL, curpkgprovides = NULL;
 	pkg_state_t state;
-	const char *reqpkg, *pkgver_q, *reason = NULL;
-	char *pkgname, *reqpkgname;
+	struct xbps_pattern *pat = NULL;
+	const char *reqpkg, *pkgname, *pkgver_q, *reason = NULL;
+	size_t len, reqlen;
+	uint64_t start;
+	unsigned int n;
 	int rv = 0;
 	bool foundvpkg;
 
 	if (*depth >= MAX_DEPTH)
 		return ELOOP;
 
+	start = xbps_trace_begin();
+
 	/*
 	 * Iterate over the list of required run dependencies for
-	 * current package.
+	 * current package, from its packed copy if it was internalized.
 	 */
-	iter = xbps_array_iterator(pkg_rdeps_array);
-	assert(iter);
+	if (!xbps_array_packed(pkg_rdeps_array, &pk))
+		pk.strs = NULL;
+	n = pk.strs ? pk.count : xbps_array_count(pkg_rdeps_array);
 
-	while ((obj = xbps_object_iterator_next(iter))) {
+	for (unsigned int i = 0; i < n; i++) {
 		foundvpkg = false;
-		reqpkg = xbps_string_cstring_nocopy(obj);
+		if (pk.strs != NULL)
+			reqpkg = pk.strs + pk.offs[i];
+		else if (!xbps_array_get_cstring_nocopy(pkg_rdeps_array, i, &reqpkg))
+			continue;
 		if (xhp->flags & XBPS_FLAG_DEBUG) {
 			xbps_dbg_printf(xhp, "%s", "");
 			for (unsigned short x = 0; x < *depth; x++) {
@@ -153,8 +236,16 @@ find_repo_deps(struct xbps_handle *xhp,
 			}
 			xbps_dbg_printf_append(xhp, "%s: requires dependency '%s': ", curpkg ? curpkg : " ", reqpkg);
 		}
-		if (((pkgname = xbps_pkgpattern_name(reqpkg)) == NULL) &&
-		    ((pkgname = xbps_pkg_name(reqpkg)) == NULL)) {
+		/*
+		 * Parse the dependency once, its pkgname and version
+		 * constraint are reused by all passes below.
+		 */
+		xbps_pattern_free(pat);
+		if ((pat = xbps_pattern_compile(reqpkg)) == NULL) {
+			rv = errno;
+			break;
+		}
+		if ((pkgname = xbps_pattern_pkgname(pat)) == NULL) {
 			xbps_dbg_printf(xhp, "%s: can't guess pkgname for dependency: %s\n", curpkg, reqpkg);
 			xbps_set_cb_state(xhp, XBPS_STATE_INVALID_DEP, ENXIO, NULL,
 			    "%s: can't guess pkgname for dependency '%s'", curpkg, reqpkg);
@@ -167,18 +258,26 @@ find_repo_deps(struct xbps_handle *xhp,
 		 */
 		if (pkg_provides && xbps_match_virtual_pkg_in_array(pkg_provides, reqpkg)) {
 			xbps_dbg_printf_append(xhp, "%s is a vpkg provided by %s, ignored.\n", pkgname, curpkg);
-			free(pkgname);
+			continue;
+		}
+		/*
+		 * Check if required dependency has been already resolved,
+		 * the passes below would find nothing else to do.
+		 */
+		cache->lookups++;
+		if (xbps_dictionary_get_cstring_nocopy(cache->resolved, reqpkg, &pkgver_q)) {
+			cache->hits++;
+			xbps_dbg_printf_append(xhp, " (%s resolved)\n", pkgver_q);
 			continue;
 		}
 		/*
 		 * Pass 2: check if required dependency has been already
 		 * added in the transaction dictionary.
 		 */
-		if ((curpkgd = xbps_find_pkg_in_array(unsorted, reqpkg, NULL)) ||
-		    (curpkgd = xbps_find_virtualpkg_in_array(xhp, unsorted, reqpkg, NULL))) {
+		if ((curpkgd = deps_cache_find_queued(xhp, unsorted, reqpkg))) {
 			xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &pkgver_q);
 			xbps_dbg_printf_append(xhp, " (%s queued)\n", pkgver_q);
-			free(pkgname);
+			deps_cache_resolved(cache, reqpkg, pkgver_q);
 			continue;
 		}
 		/*
@@ -195,10 +294,8 @@ find_repo_deps(struct xbps_handle *xhp,
 				/* error */
 				rv = errno;
 				xbps_dbg_printf(xhp, "failed to find installed pkg for `%s': %s\n", reqpkg, strerror(rv));
-				free(pkgname);
 				break;
 			}
-			free(pkgname);
 			/* Required dependency not installed */
 			xbps_dbg_printf_append(xhp, "not installed.\n");
 			reason = "install";
@@ -211,10 +308,8 @@ find_repo_deps(struct xbps_handle *xhp,
 			xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &pkgver_q);
 
 			/* Check its state */
-			if ((rv = xbps_pkg_state_dictionary(curpkgd, &state)) != 0) {
-				free(pkgname);
+			if ((rv = xbps_pkg_state_dictionary(curpkgd, &state)) != 0)
 				break;
-			}
 
 			if (foundvpkg && xbps_match_virtual_pkg_in_dict(curpkgd, reqpkg)) {
 				/*
@@ -222,18 +317,18 @@ find_repo_deps(struct xbps_handle *xhp,
 				 * by an installed package.
 				 */
 				xbps_dbg_printf_append(xhp, "[virtual] satisfied by `%s'.\n", pkgver_q);
-				free(pkgname);
+				deps_cache_resolved(cache, reqpkg, pkgver_q);
 				continue;
 			}
-			rv = xbps_pkgpattern_match(pkgver_q, reqpkg);
+			rv = xbps_pattern_match_compiled(pat, pkgver_q);
 			if (rv == 0) {
-				char *curpkgname;
 				/*
 				 * The version requirement is not satisfied.
 				 */
-				curpkgname = xbps_pkg_name(pkgver_q);
-				assert(curpkgname);
-				if (strcmp(pkgname, curpkgname)) {
+				len = xbps_pkg_name_len(pkgver_q);
+				assert(len);
+				if (strncmp(pkgname, pkgver_q, len) ||
+				    pkgname[len] != '\0') {
 					xbps_dbg_printf_append(xhp, "not installed `%s (vpkg)'", pkgver_q);
 					if (xbps_dictionary_get(curpkgd, "hold")) {
 						xbps_dbg_printf_append(xhp, " on hold state! ignoring package.\n");
@@ -250,13 +345,10 @@ find_repo_deps(struct xbps_handle *xhp,
 						reason = "update";
 					}
 				}
-				free(curpkgname);
-				free(pkgname);
 			} else if (rv == 1) {
 				/*
 				 * The version requirement is satisfied.
 				 */
-				free(pkgname);
 				rv = 0;
 				if (state == XBPS_PKG_STATE_UNPACKED) {
 					/*
@@ -271,17 +363,18 @@ find_repo_deps(struct xbps_handle *xhp,
 					 * skip to next one.
 					 */
 					xbps_dbg_printf_append(xhp, "installed `%s'.\n", pkgver_q);
+					deps_cache_resolved(cache, reqpkg, pkgver_q);
 					continue;
 				}
 			} else {
 				/* error matching pkgpattern */
 				xbps_dbg_printf(xhp, "failed to match pattern %s with %s\n", reqpkg, pkgver_q);
-				free(pkgname);
 				break;
 			}
 		}
 		if (xbps_dictionary_get(curpkgd, "hold")) {
 			xbps_dbg_printf(xhp, "%s on hold state! ignoring package.\n", curpkg);
+			deps_cache_resolved(cache, reqpkg, pkgver_q);
 			continue;
 		}
 		/*
@@ -289,7 +382,7 @@ find_repo_deps(struct xbps_handle *xhp,
 		 * If dependency does not match add pkg into the missing
 		 * deps array and pass to next one.
 		 */
-		if (((curpkgd = xbps_rpool_get_pkg(xhp, reqpkg)) == NULL) &&
+		if (((curpkgd = xbps_rpool_get_pkg_pattern(xhp, pat)) == NULL) &&
 		    ((curpkgd = xbps_rpool_get_virtualpkg(xhp, reqpkg)) == NULL)) {
 			/* pkg not found, there was some error */
 			if (errno && errno != ENOENT) {
@@ -297,36 +390,32 @@ find_repo_deps(struct xbps_handle *xhp,
 				rv = errno;
 				break;
 			}
-			rv = add_missing_reqdep(xhp, reqpkg);
+			rv = add_missing_reqdep(xhp, cache, reqpkg);
 			if (rv != 0 && rv != EEXIST) {
 				xbps_dbg_printf(xhp, "`%s': add_missing_reqdep failed\n", reqpkg);
 				break;
 			} else if (rv == EEXIST) {
 				xbps_dbg_printf(xhp, "`%s' missing dep already added.\n", reqpkg);
 				rv = 0;
-				continue;
 			} else {
 				xbps_dbg_printf(xhp, "`%s' added into the missing deps array.\n", reqpkg);
-				continue;
 			}
+			deps_cache_resolved(cache, reqpkg, "missing");
+			continue;
 		}
 		xbps_dictionary_get_cstring_nocopy(curpkgd, "pkgver", &pkgver_q);
-		reqpkgname = xbps_pkg_name(pkgver_q);
-		assert(reqpkgname);
+		reqlen = xbps_pkg_name_len(pkgver_q);
+		assert(reqlen);
 		/*
 		 * Check dependency validity.
 		 */
-		pkgname = xbps_pkg_name(curpkg);
-		assert(pkgname);
-		if (strcmp(pkgname, reqpkgname) == 0) {
+		len = xbps_pkg_name_len(curpkg);
+		assert(len);
+		if (len == reqlen && strncmp(curpkg, pkgver_q, len) == 0) {
 			xbps_dbg_printf_append(xhp, "[ignoring wrong dependency %s (depends on itself)]\n", reqpkg);
 			xbps_remove_string_from_array(pkg_rdeps_array, reqpkg);
-			free(pkgname);
-			free(reqpkgname);
 			continue;
 		}
-		free(pkgname);
-		free(reqpkgname);
 		/*
 		 * If package doesn't have rundeps, pass to the next one.
 		 */
@@ -341,6 +430,7 @@ find_repo_deps(struct xbps_handle *xhp,
 				xbps_dbg_printf(xhp, "xbps_transaction_store failed for `%s': %s\n", reqpkg, strerror(rv));
 				break;
 			}
+			deps_cache_resolved(cache, reqpkg, pkgver_q);
 			continue;
 		}
 
@@ -356,7 +446,7 @@ find_repo_deps(struct xbps_handle *xhp,
 		 */
 		(*depth)++;
 		curpkgprovides = xbps_dictionary_get(curpkgd, "provides");
-		rv = find_repo_deps(xhp, unsorted, curpkgrdeps, curpkgprovides, pkgver_q, depth);
+		rv = find_repo_deps(xhp, cache, unsorted, curpkgrdeps, curpkgprovides, pkgver_q, depth);
 		if (rv != 0) {
 			xbps_dbg_printf(xhp, "Error checking %s for rundeps: %s\n", reqpkg, strerror(rv));
 			break;
@@ -370,15 +460,18 @@ find_repo_deps(struct xbps_handle *xhp,
 			xbps_dbg_printf(xhp, "xbps_transaction_store failed for `%s': %s\n", reqpkg, strerror(rv));
 			break;
 		}
+		deps_cache_resolved(cache, reqpkg, pkgver_q);
 	}
-	xbps_object_iterator_release(iter);
+	xbps_pattern_free(pat);
 	(*depth)--;
+	xbps_trace_end(start, "deps", "find_repo_deps", curpkg);
 
 	return rv;
 }
 
 int HIDDEN
 xbps_repository_find_deps(struct xbps_handle *xhp,
+			  struct xbps_deps_cache *cache,
 			  xbps_array_t unsorted,
 			  xbps_dictionary_t repo_pkgd)
 {
@@ -397,5 +490,5 @@ xbps_repository_find_deps(struct xbps_handle *xhp,
 	 * there it will be added into the missing_deps array.
 	 */
 	pkg_provides = xbps_dictionary_get(repo_pkgd, "provides");
-	return find_repo_deps(xhp, unsorted, pkg_rdeps, pkg_provides, pkgver, &depth);
+	return find_repo_deps(xhp, cache, unsorted, pkg_rdeps, pkg_provides, pkgver, &depth);
 }
@@ -27,6 +27,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
 
 #include "xbps_api_impl.h"
 #include "fetch.h"
@@ -67,16 +71,307 @@ xbps_get_remote_repo_string(const char *uri)
 	return p;
 }
 
+/*
+ * Returns the entry \a fname of the archive \a file.
+ */
+static char *
+archive_file_read(const char *file, const char *fname, size_t *len)
+{
+	struct archive *ar;
+	struct archive_entry *entry;
+	const char *bfile;
+	char *buf = NULL;
+
+	ar = archive_read_new();
+	assert(ar);
+	archive_read_support_compression_gzip(ar);
+	archive_read_support_compression_bzip2(ar);
+	archive_read_support_compression_xz(ar);
+	archive_read_support_filter_zstd(ar);
+	archive_read_support_format_tar(ar);
+
+	if (archive_read_open_filename(ar, file, 32768) == ARCHIVE_OK) {
+		while (archive_read_next_header(ar, &entry) == ARCHIVE_OK) {
+			bfile = archive_entry_pathname(entry);
+			if (strncmp(bfile, "./", 2) == 0)
+				bfile += 2;
+			if (strcmp(bfile, fname) == 0) {
+				buf = xbps_archive_get_file(ar, entry, len);
+				break;
+			}
+			archive_read_data_skip(ar);
+		}
+	}
+	archive_read_finish(ar);
+
+	return buf;
+}
+
+/*
+ * Merges the index of the shard \a shardfile into \a idx, if it
+ * matches the SHA256 \a sha256 of the manifest.
+ */
+static bool
+shard_merge(xbps_dictionary_t idx, const char *shardfile, const char *sha256)
+{
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	char hash[SHA256_DIGEST_LENGTH * 2 + 1];
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	xbps_dictionary_t d;
+	char *buf;
+	size_t len;
+
+	if ((buf = archive_file_read(shardfile, XBPS_REPOIDX, &len)) == NULL)
+		return false;
+	SHA256((const unsigned char *)buf, len, digest);
+	xbps_digest2string(digest, hash, SHA256_DIGEST_LENGTH);
+	if (strcmp(hash, sha256)) {
+		free(buf);
+		return false;
+	}
+	d = xbps_dictionary_internalize_buffer(buf, len);
+	free(buf);
+	if (d == NULL)
+		return false;
+
+	iter = xbps_dictionary_iterator(d);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_dictionary_set(idx, xbps_dictionary_keysym_cstring_nocopy(obj),
+		    xbps_dictionary_get_keysym(d, obj));
+	}
+	xbps_object_iterator_release(iter);
+	xbps_object_release(d);
+
+	return true;
+}
+
+static int
+archive_append_dict(struct archive *ar, xbps_dictionary_t d, const char *fname)
+{
+	char *buf;
+	int rv;
+
+	if ((buf = xbps_dictionary_externalize(d)) == NULL)
+		return EINVAL;
+	rv = xbps_archive_append_buf(ar, buf, strlen(buf), fname, 0644,
+	    "root", "root");
+	free(buf);
+
+	return rv;
+}
+
+/*
+ * Writes the repodata archive \a repofile with the index \a idx
+ * reassembled from the shards, the metadata of the manifest and the
+ * tables built from the index, as xbps-rindex(1) does.
+ */
+static int
+repodata_assemble(const char *repofile, xbps_dictionary_t idx,
+	const char *meta, size_t metalen)
+{
+	struct archive *ar;
+	xbps_dictionary_t table;
+	char *tname;
+	int fd, rv;
+
+	tname = xbps_xasprintf("%s.XXXXXXXXXX", repofile);
+	if ((fd = mkstemp(tname)) == -1) {
+		rv = errno;
+		free(tname);
+		return rv;
+	}
+	ar = archive_write_new();
+	assert(ar);
+	archive_write_set_format_pax_restricted(ar);
+	archive_write_open_fd(ar, fd);
+
+	if ((rv = archive_append_dict(ar, idx, XBPS_REPOIDX)) == 0)
+		rv = xbps_archive_append_buf(ar, meta, metalen,
+		    XBPS_REPOIDX_META, 0644, "root", "root");
+	if (rv == 0) {
+		table = xbps_repo_index_revdeps(idx);
+		rv = archive_append_dict(ar, table, XBPS_REPOIDX_REVDEPS);
+		xbps_object_release(table);
+	}
+	if (rv == 0) {
+		table = xbps_repo_index_shlibs(idx);
+		rv = archive_append_dict(ar, table, XBPS_REPOIDX_SHLIBS);
+		xbps_object_release(table);
+	}
+	if (archive_write_free(ar) != ARCHIVE_OK && rv == 0)
+		rv = EIO;
+	if (rv == 0 && fchmod(fd, 0644) == -1)
+		rv = errno;
+	(void)close(fd);
+	if (rv == 0 && rename(tname, repofile) == -1)
+		rv = errno;
+	if (rv != 0)
+		(void)unlink(tname);
+	free(tname);
+
+	return rv;
+}
+
+/*
+ * Removes the files of the shards directory not in the manifest.
+ */
+static void
+shards_prune(const char *shardsdir, xbps_dictionary_t shards)
+{
+	struct dirent *dp;
+	DIR *dirp;
+	char *path;
+
+	if ((dirp = opendir(shardsdir)) == NULL)
+		return;
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_name[0] == '.' ||
+		    xbps_dictionary_get(shards, dp->d_name))
+			continue;
+		path = xbps_xasprintf("%s/%s", shardsdir, dp->d_name);
+		(void)unlink(path);
+		free(path);
+	}
+	(void)closedir(dirp);
+}
+
+/*
+ * Synchronizes the repodata of a sharded repository, see xbps-rindex(1):
+ * the <arch>-shards manifest is fetched from \a mirror and only the
+ * shards whose index doesn't match their hash in it, the repodata is
+ * then reassembled from all shards.
+ *
+ * Returns -1 if the repository isn't sharded or its shards couldn't be
+ * fetched, the whole repodata must be fetched then; 0 otherwise.
+ */
+static int
+repo_sync_shards(struct xbps_handle *xhp, const char *mirror,
+	const char *lrepodir, const char *arch)
+{
+	xbps_dictionary_t shards = NULL, idx = NULL;
+	xbps_array_t keys = NULL;
+	const char **uris = NULL;
+	const char *name, *sha256;
+	char *manifest, *repofile, *shardsdir, *shardfile, *uri;
+	char *buf = NULL, *meta = NULL;
+	size_t len, metalen;
+	unsigned int n = 0, nshards = 0;
+	int rv;
+
+	uri = xbps_xasprintf("%s/%s-shards", mirror, arch);
+	rv = xbps_fetch_file_in_etag(xhp, uri, lrepodir, NULL);
+	if (rv == -1) {
+		xbps_dbg_printf(xhp, "[reposync] failed to fetch shards "
+		    "manifest `%s': %s\n", uri, xbps_fetch_error_string());
+		free(uri);
+		return -1;
+	}
+	free(uri);
+
+	manifest = xbps_xasprintf("%s/%s-shards", lrepodir, arch);
+	shardsdir = xbps_xasprintf("%s.d", manifest);
+	repofile = xbps_xasprintf("%s/%s-repodata", lrepodir, arch);
+	/* the manifest didn't change since the last sync */
+	if (rv == 0 && access(repofile, R_OK) == 0)
+		goto out;
+	rv = -1;
+	if (xbps_mkpath(shardsdir, 0755) == -1 && errno != EEXIST)
+		goto out;
+	if ((buf = archive_file_read(manifest, XBPS_REPOIDX_SHARDS,
+	    &len)) == NULL ||
+	    (meta = archive_file_read(manifest, XBPS_REPOIDX_META,
+	    &metalen)) == NULL ||
+	    (shards = xbps_dictionary_internalize_buffer(buf, len)) == NULL) {
+		xbps_dbg_printf(xhp, "[reposync] invalid shards manifest "
+		    "`%s'\n", manifest);
+		goto out;
+	}
+	keys = xbps_dictionary_all_keys(shards);
+	nshards = xbps_array_count(keys);
+	idx = xbps_dictionary_create_hashed(0);
+	uris = calloc(nshards + 1, sizeof(*uris));
+	assert(idx && uris);
+	/*
+	 * Merge the shards in place that match the manifest, fetch
+	 * the others.
+	 */
+	for (unsigned int i = 0; i < nshards; i++) {
+		name = xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(keys, i));
+		xbps_dictionary_get_cstring_nocopy(shards, name, &sha256);
+		shardfile = xbps_xasprintf("%s/%s", shardsdir, name);
+		if (!shard_merge(idx, shardfile, sha256)) {
+			(void)unlink(shardfile);
+			uris[n++] = xbps_xasprintf("%s/%s-shards.d/%s",
+			    mirror, arch, name);
+		}
+		free(shardfile);
+	}
+	xbps_dbg_printf(xhp, "[reposync] `%s': fetching %u of %u shards\n",
+	    mirror, n, nshards);
+	if (xbps_fetch_files_in(xhp, uris, n, shardsdir, NULL) != 0)
+		goto out;
+	for (unsigned int i = 0; i < n; i++) {
+		name = strrchr(uris[i], '/') + 1;
+		xbps_dictionary_get_cstring_nocopy(shards, name, &sha256);
+		shardfile = xbps_xasprintf("%s/%s", shardsdir, name);
+		if (!shard_merge(idx, shardfile, sha256)) {
+			xbps_dbg_printf(xhp, "[reposync] shard `%s' doesn't "
+			    "match the manifest\n", uris[i]);
+			free(shardfile);
+			goto out;
+		}
+		free(shardfile);
+	}
+	if ((rv = repodata_assemble(repofile, idx, meta, metalen)) != 0) {
+		xbps_dbg_printf(xhp, "[reposync] failed to write `%s': %s\n",
+		    repofile, strerror(rv));
+		rv = -1;
+		goto out;
+	}
+	shards_prune(shardsdir, shards);
+	/* it's no longer the repodata fetched with that entity tag */
+	uri = xbps_xasprintf("%s.etag", repofile);
+	(void)unlink(uri);
+	free(uri);
+out:
+	/* fetched again the next time, with the whole repodata */
+	if (rv == -1)
+		(void)unlink(manifest);
+	for (unsigned int i = 0; i < n; i++)
+		free(__UNCONST(uris[i]));
+	free(uris);
+	if (keys)
+		xbps_object_release(keys);
+	if (shards)
+		xbps_object_release(shards);
+	if (idx)
+		xbps_object_release(idx);
+	free(buf);
+	free(meta);
+	free(repofile);
+	free(shardsdir);
+	free(manifest);
+
+	return rv;
+}
+
 /*
  * Returns -1 on error, 0 if transfer was not necessary (local/remote
  * size and/or mtime match) and 1 if downloaded successfully.
+ *
+ * It doesn't change the working directory nor the umask, and may
+ * be called concurrently for different repositories.
  */
 int HIDDEN
 xbps_repo_sync(struct xbps_handle *xhp, const char *uri)
 {
-	mode_t prev_umask;
 	const char *arch, *fetchstr = NULL;
-	char *repodata, *lrepodir, *uri_fixedp;
+	char *repodata = NULL, *lrepodir, *uri_fixedp, *repofile;
+	unsigned int nmirrors;
+	uint64_t start;
 	int rv = 0;
 
 	assert(uri != NULL);
@@ -85,6 +380,7 @@ xbps_repo_sync(struct xbps_handle *xhp, const char *uri)
 	if (!xbps_repository_is_remote(uri))
 		return 0;
 
+	start = xbps_trace_begin();
 	uri_fixedp = xbps_get_remote_repo_string(uri);
 	if (uri_fixedp == NULL)
 		return -1;
@@ -113,37 +409,76 @@ xbps_repo_sync(struct xbps_handle *xhp, const char *uri)
 			return rv;
 		}
 	}
-	if (chdir(lrepodir) == -1) {
-		xbps_set_cb_state(xhp, XBPS_STATE_REPOSYNC_FAIL, errno, NULL,
-		    "[reposync] failed to change dir to repodir `%s': %s",
-		    lrepodir, strerror(errno));
-		free(lrepodir);
-		return -1;
-	}
-	free(lrepodir);
 	/*
-	 * Remote repository plist index full URL.
+	 * Download plist index file from repository, trying its
+	 * mirrors from the fastest one until it succeeds.
 	 */
-	repodata = xbps_xasprintf("%s/%s-repodata", uri, arch);
+	nmirrors = xbps_repo_mirrors(xhp, uri, NULL);
+	for (unsigned int i = 0; i < nmirrors; i++) {
+		/*
+		 * Remote repository plist index full URL.
+		 */
+		repodata = xbps_xasprintf("%s/%s-repodata",
+		    xbps_repo_mirror(xhp, uri, i), arch);
 
-	/* reposync start cb */
-	xbps_set_cb_state(xhp, XBPS_STATE_REPOSYNC, 0, repodata, NULL);
-	/*
-	 * Download plist index file from repository.
-	 */
-	prev_umask = umask(022);
-	if ((rv = xbps_fetch_file(xhp, repodata, NULL)) == -1) {
+		/* reposync start cb */
+		xbps_set_cb_state(xhp, XBPS_STATE_REPOSYNC, 0, repodata, NULL);
+		/* sharded repositories: only the shards that changed */
+		if ((rv = repo_sync_shards(xhp, xbps_repo_mirror(xhp, uri, i),
+		    lrepodir, arch)) != -1)
+			break;
+		if ((rv = xbps_fetch_file_in_etag(xhp, repodata, lrepodir,
+		    NULL)) != -1)
+			break;
+		if (i + 1 < nmirrors) {
+			xbps_dbg_printf(xhp, "[reposync] failed to fetch file "
+			    "`%s', trying next mirror\n", repodata);
+			free(repodata);
+			continue;
+		}
 		/* reposync error cb */
 		fetchstr = xbps_fetch_error_string();
 		xbps_set_cb_state(xhp, XBPS_STATE_REPOSYNC_FAIL,
 		    fetchLastErrCode != 0 ? fetchLastErrCode : errno, NULL,
 		    "[reposync] failed to fetch file `%s': %s",
 		    repodata, fetchstr ? fetchstr : strerror(errno));
-	} else if (rv == 1)
+	}
+	if (rv == 1)
 		rv = 0;
-	umask(prev_umask);
+	/*
+	 * Download the files index if requested, it's optional and
+	 * a failure isn't fatal.
+	 */
+	if (rv == 0 && (xhp->flags & XBPS_FLAG_REPOS_FILES)) {
+		for (unsigned int i = 0; i < nmirrors; i++) {
+			char *filesidx;
+
+			filesidx = xbps_xasprintf("%s/%s-files",
+			    xbps_repo_mirror(xhp, uri, i), arch);
+			if (xbps_fetch_file_in_etag(xhp, filesidx, lrepodir,
+			    NULL) != -1) {
+				free(filesidx);
+				break;
+			}
+			xbps_dbg_printf(xhp, "[reposync] failed to fetch file "
+			    "`%s': %s\n", filesidx, xbps_fetch_error_string());
+			free(filesidx);
+		}
+	}
+	/*
+	 * Refresh the binary index map for the synchronized repodata.
+	 */
+	if (rv == 0) {
+		repofile = xbps_xasprintf("%s/%s-repodata", lrepodir, arch);
+		if (xbps_repo_idxmap_update(xhp, repofile) != 0)
+			xbps_dbg_printf(xhp, "[reposync] failed to update "
+			    "index map for `%s'\n", repofile);
+		free(repofile);
+	}
 
+	free(lrepodir);
 	free(repodata);
+	xbps_trace_end(start, "repo", "sync", uri);
 
 	return rv;
 }
@@ -24,18 +24,23 @@
  */
 
 #include <sys/utsname.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <libgen.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
 struct rpool_fpkg {
 	xbps_array_t revdeps;
+	xbps_array_t cands;
 	xbps_dictionary_t pkgd;
+	const struct xbps_pattern *pat;
 	const char *pattern;
 	const char *bestpkgver;
 	bool best;
@@ -48,8 +53,125 @@ typedef enum {
 	REVDEPS_PKG
 } pkg_repo_type_t;
 
-static SIMPLEQ_HEAD(rpool_head, xbps_repo) rpool_queue =
-    SIMPLEQ_HEAD_INITIALIZER(rpool_queue);
+/*
+ * Repository pool of a handle, allocated on first use. Every handle
+ * opens its own repositories, those with the same repository file
+ * share its index data (see xbps_repo_idxmap_attach()).
+ */
+struct xbps_rpool {
+	LIST_ENTRY(xbps_rpool) entries;
+	SIMPLEQ_HEAD(rpool_head, xbps_repo) queue;
+	/*
+	 * Virtual packages provided in the pool, mapped on the first virtual
+	 * package lookup: vpkgname -> repository URI -> array of pkgnames.
+	 */
+	xbps_dictionary_t vpkgs;
+	/*
+	 * Candidates for the best package lookups, added on the first lookup
+	 * of every pkgname: pkgname -> array of the package dictionaries found
+	 * in the pool, best version first and in repository order otherwise.
+	 */
+	xbps_dictionary_t best;
+	/*
+	 * Patterns not found in the pool: pattern -> bitmask of the lookup
+	 * types that missed. Real packages are looked up from several threads
+	 * (see xbps_rpool_concurrent()), misses_mtx serializes its accesses.
+	 */
+	xbps_dictionary_t misses;
+	pthread_mutex_t misses_mtx;
+	/* Set once all repositories have been opened by rpool_open(). */
+	bool opened;
+};
+
+/* Pools of all handles, most recent first, for xbps_rpool_get_repo(). */
+static LIST_HEAD(rpool_list, xbps_rpool) rpools =
+    LIST_HEAD_INITIALIZER(rpools);
+static pthread_mutex_t rpools_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static struct xbps_rpool *
+rpool_get(struct xbps_handle *xhp)
+{
+	struct xbps_rpool *rp;
+
+	if (xhp->rpool != NULL)
+		return xhp->rpool;
+
+	rp = calloc(1, sizeof(*rp));
+	assert(rp);
+	SIMPLEQ_INIT(&rp->queue);
+	pthread_mutex_init(&rp->misses_mtx, NULL);
+	pthread_mutex_lock(&rpools_mtx);
+	LIST_INSERT_HEAD(&rpools, rp, entries);
+	pthread_mutex_unlock(&rpools_mtx);
+	xhp->rpool = rp;
+
+	return rp;
+}
+
+static struct xbps_repo *
+rpool_find_repo(struct xbps_rpool *rp, const char *url)
+{
+	struct xbps_repo *repo;
+
+	SIMPLEQ_FOREACH(repo, &rp->queue, entries)
+		if (strcmp(url, repo->uri) == 0)
+			return repo;
+
+	return NULL;
+}
+
+static void
+rpool_forget_misses(struct xbps_rpool *rp)
+{
+	pthread_mutex_lock(&rp->misses_mtx);
+	if (rp->misses) {
+		xbps_object_release(rp->misses);
+		rp->misses = NULL;
+	}
+	pthread_mutex_unlock(&rp->misses_mtx);
+}
+
+static void
+rpool_release_caches(struct xbps_rpool *rp)
+{
+	if (rp->vpkgs) {
+		xbps_object_release(rp->vpkgs);
+		rp->vpkgs = NULL;
+	}
+	if (rp->best) {
+		xbps_object_release(rp->best);
+		rp->best = NULL;
+	}
+	rpool_forget_misses(rp);
+}
+
+/*
+ * Returns true if a lookup of type for pattern already missed in the
+ * pool, otherwise records the miss if found is false.
+ */
+static bool
+rpool_miss(struct xbps_handle *xhp, const char *pattern, unsigned int type,
+		bool found)
+{
+	struct xbps_rpool *rp = rpool_get(xhp);
+	uint8_t mask = 0;
+	bool missed;
+
+	pthread_mutex_lock(&rp->misses_mtx);
+	if (rp->misses)
+		xbps_dictionary_get_uint8(rp->misses, pattern, &mask);
+	missed = mask & (1 << type);
+	if (!missed && !found) {
+		if (rp->misses == NULL) {
+			rp->misses = xbps_dictionary_create_hashed(0);
+			assert(rp->misses);
+		}
+		xbps_dictionary_set_uint8(rp->misses, pattern, mask | (1 << type));
+	}
+	pthread_mutex_unlock(&rp->misses_mtx);
+
+	return missed;
+}
 
 /**
  * @file lib/rpool.c
@@ -57,35 +179,122 @@ static SIMPLEQ_HEAD(rpool_head, xbps_repo) rpool_queue =
  * @defgroup repopool Repository pool functions
  */
 
+struct rpool_sync {
+	struct xbps_handle *xhp;
+	const char *uri;
+	unsigned int next;
+	pthread_mutex_t mtx;
+};
+
+static void
+rpool_sync_repo(struct xbps_handle *xhp, const char *repouri)
+{
+	if (xbps_repo_sync(xhp, repouri) == -1) {
+		xbps_dbg_printf(xhp,
+		    "[rpool] `%s' failed to fetch repository data: %s\n",
+		    repouri, fetchLastErrCode == 0 ? strerror(errno) :
+		    xbps_fetch_error_string());
+	}
+}
+
+static void *
+rpool_sync_thread(void *arg)
+{
+	struct rpool_sync *rs = arg;
+	struct xbps_handle *xhp = rs->xhp;
+	const char *repouri;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&rs->mtx);
+		i = rs->next++;
+		pthread_mutex_unlock(&rs->mtx);
+
+		if (i >= xbps_array_count(xhp->repositories))
+			break;
+
+		xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
+		/* If argument was set just process that repository */
+		if (rs->uri && strcmp(repouri, rs->uri))
+			continue;
+
+		rpool_sync_repo(xhp, repouri);
+	}
+	return NULL;
+}
+
 int
 xbps_rpool_sync(struct xbps_handle *xhp, const char *uri)
 {
-	const char *repouri;
+	struct rpool_sync rs;
+	pthread_t *thds;
+	mode_t prev_umask;
+	unsigned int nthreads = 0, nremote = 0;
 
 	for (unsigned int i = 0; i < xbps_array_count(xhp->repositories); i++) {
+		const char *repouri;
+
 		xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
-		/* If argument was set just process that repository */
 		if (uri && strcmp(repouri, uri))
 			continue;
+		if (xbps_repository_is_remote(repouri))
+			nremote++;
+	}
+	if (xhp->fetch_jobs > 1)
+		nthreads = xhp->fetch_jobs < nremote ? xhp->fetch_jobs : nremote;
 
-		if (xbps_repo_sync(xhp, repouri) == -1) {
-			xbps_dbg_printf(xhp,
-			    "[rpool] `%s' failed to fetch repository data: %s\n",
-			    repouri, fetchLastErrCode == 0 ? strerror(errno) :
-			    xbps_fetch_error_string());
-			continue;
+	rs.xhp = xhp;
+	rs.uri = uri;
+	rs.next = 0;
+	pthread_mutex_init(&rs.mtx, NULL);
+
+	/* packages missing in the old repository data may be there now */
+	if (xhp->rpool)
+		rpool_forget_misses(xhp->rpool);
+
+	prev_umask = umask(022);
+	if (nthreads < 2) {
+		rpool_sync_thread(&rs);
+		pthread_mutex_destroy(&rs.mtx);
+		umask(prev_umask);
+		return 0;
+	}
+	/*
+	 * Synchronize remote repositories concurrently, every thread
+	 * picks up the next repository once it's done with its previous.
+	 */
+	xbps_dbg_printf(xhp, "[rpool] syncing %u repositories with %u "
+	    "threads\n", nremote, nthreads);
+	thds = calloc(nthreads, sizeof(*thds));
+	assert(thds);
+
+	for (unsigned int i = 0; i < nthreads; i++) {
+		if (pthread_create(&thds[i], NULL, rpool_sync_thread, &rs) != 0) {
+			/* the threads already running handle the rest */
+			nthreads = i;
+			break;
 		}
 	}
+	if (nthreads == 0)
+		rpool_sync_thread(&rs);
+	for (unsigned int i = 0; i < nthreads; i++)
+		pthread_join(thds[i], NULL);
+
+	pthread_mutex_destroy(&rs.mtx);
+	free(thds);
+	umask(prev_umask);
+
 	return 0;
 }
 
 struct xbps_repo HIDDEN *
 xbps_regget_repo(struct xbps_handle *xhp, const char *url)
 {
+	struct xbps_rpool *rp = rpool_get(xhp);
 	struct xbps_repo *repo;
 	const char *repouri;
 
-	if (SIMPLEQ_EMPTY(&rpool_queue)) {
+	if (SIMPLEQ_EMPTY(&rp->queue)) {
 		/* iterate until we have a match */
 		for (unsigned int i = 0; i < xbps_array_count(xhp->repositories); i++) {
 			xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
@@ -96,47 +305,274 @@ xbps_regget_repo(struct xbps_handle *xhp, const char *url)
 			if (!repo)
 				return NULL;
 
-			SIMPLEQ_INSERT_TAIL(&rpool_queue, repo, entries);
+			SIMPLEQ_INSERT_TAIL(&rp->queue, repo, entries);
 			xbps_dbg_printf(xhp, "[rpool] `%s' registered.\n", repouri);
 		}
 	}
-	SIMPLEQ_FOREACH(repo, &rpool_queue, entries)
-		if (strcmp(url, repo->uri) == 0)
-			return repo;
+	return rpool_find_repo(rp, url);
+}
 
-	return NULL;
+struct xbps_repo HIDDEN *
+xbps_rpool_repo(struct xbps_handle *xhp, const char *url)
+{
+	if (xhp->rpool == NULL)
+		return NULL;
+
+	return rpool_find_repo(xhp->rpool, url);
 }
 
 struct xbps_repo *
 xbps_rpool_get_repo(const char *url)
 {
-	struct xbps_repo *repo;
+	struct xbps_rpool *rp;
+	struct xbps_repo *repo = NULL;
 
-	SIMPLEQ_FOREACH(repo, &rpool_queue, entries)
-		if (strcmp(url, repo->uri) == 0)
-			return repo;
+	pthread_mutex_lock(&rpools_mtx);
+	LIST_FOREACH(rp, &rpools, entries) {
+		if ((repo = rpool_find_repo(rp, url)) != NULL)
+			break;
+	}
+	pthread_mutex_unlock(&rpools_mtx);
+
+	return repo;
+}
 
+struct rpool_open {
+	struct xbps_handle *xhp;
+	struct xbps_rpool *rp;
+	struct xbps_repo **repos;
+	unsigned int next;
+	pthread_mutex_t mtx;
+};
+
+static void *
+rpool_open_thread(void *arg)
+{
+	struct rpool_open *ro = arg;
+	struct xbps_handle *xhp = ro->xhp;
+	const char *repouri;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&ro->mtx);
+		i = ro->next++;
+		pthread_mutex_unlock(&ro->mtx);
+
+		if (i >= xbps_array_count(xhp->repositories))
+			break;
+
+		xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
+		if (rpool_find_repo(ro->rp, repouri))
+			continue;
+		/* in memory sync may ask to import keys, leave it to later */
+		if ((xhp->flags & XBPS_FLAG_REPOS_MEMSYNC) &&
+		    xbps_repository_is_remote(repouri))
+			continue;
+
+		ro->repos[i] = xbps_repo_open(xhp, repouri);
+	}
 	return NULL;
 }
 
+/*
+ * Opens all repositories of the pool at once, they are independent
+ * files and reading and internalizing them one at a time is most of
+ * the cost of the first lookup.  They are registered in the configured
+ * order, those that fail are tried again by xbps_rpool_foreach().
+ */
+static void
+rpool_open(struct xbps_handle *xhp, struct xbps_rpool *rp)
+{
+	struct rpool_open ro;
+	const char *repouri;
+	unsigned int nrepos, nthreads;
+
+	rp->opened = true;
+	nrepos = xbps_array_count(xhp->repositories);
+	if (nrepos < 2)
+		return;
+	nthreads = xbps_pool_size(xhp);
+	if (nthreads > nrepos)
+		nthreads = nrepos;
+
+	ro.xhp = xhp;
+	ro.rp = rp;
+	ro.repos = calloc(nrepos, sizeof(*ro.repos));
+	assert(ro.repos);
+	ro.next = 0;
+	pthread_mutex_init(&ro.mtx, NULL);
+
+	if (nthreads > 1)
+		xbps_dbg_printf(xhp, "[rpool] opening %u repositories with "
+		    "%u threads\n", nrepos, nthreads);
+	xbps_pool_run(xhp, rpool_open_thread, &ro, nthreads);
+
+	for (unsigned int i = 0; i < nrepos; i++) {
+		if (ro.repos[i] == NULL)
+			continue;
+		xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
+		SIMPLEQ_INSERT_TAIL(&rp->queue, ro.repos[i], entries);
+		xbps_dbg_printf(xhp, "[rpool] `%s' registered.\n", repouri);
+	}
+	pthread_mutex_destroy(&ro.mtx);
+	free(ro.repos);
+}
+
 void
-xbps_rpool_release(struct xbps_handle *xhp UNUSED)
+xbps_rpool_release(struct xbps_handle *xhp)
 {
+	struct xbps_rpool *rp = xhp->rpool;
 	struct xbps_repo *repo;
 
-	while ((repo = SIMPLEQ_FIRST(&rpool_queue))) {
-	       SIMPLEQ_REMOVE(&rpool_queue, repo, xbps_repo, entries);
-	       xbps_repo_close(repo);
+	if (rp != NULL) {
+		pthread_mutex_lock(&rpools_mtx);
+		LIST_REMOVE(rp, entries);
+		pthread_mutex_unlock(&rpools_mtx);
+		while ((repo = SIMPLEQ_FIRST(&rp->queue))) {
+		       SIMPLEQ_REMOVE(&rp->queue, repo, xbps_repo, entries);
+		       xbps_repo_close(repo);
+		}
+		rpool_release_caches(rp);
+		pthread_mutex_destroy(&rp->misses_mtx);
+		free(rp);
+		xhp->rpool = NULL;
 	}
+	xbps_fulldeptree_release(xhp, true);
 	if (xhp->repositories)
 		xbps_object_release(xhp->repositories);
 }
 
+/*
+ * Releases the repository pool once a transaction has been resolved,
+ * before it's committed: the repositories that none of \a pkgs comes
+ * from are closed, the others only keep what's needed to verify binary
+ * packages (see xbps_repo_release_index()). If \a pkgs is NULL all
+ * repositories are closed, they are opened again if the pool is used
+ * later on. xhp->repositories is kept, the "repository" objects of
+ * package dictionaries point to its strings.
+ */
+void HIDDEN
+xbps_rpool_trim(struct xbps_handle *xhp, xbps_array_t pkgs)
+{
+	struct xbps_rpool *rp = rpool_get(xhp);
+	struct xbps_repo *repo, *next;
+	const char *repoloc;
+	bool used;
+
+	for (repo = SIMPLEQ_FIRST(&rp->queue); repo; repo = next) {
+		next = SIMPLEQ_NEXT(repo, entries);
+		used = false;
+		for (unsigned int i = 0; !used && i < xbps_array_count(pkgs); i++) {
+			if (xbps_dictionary_get_cstring_nocopy(
+			    xbps_array_get(pkgs, i), "repository", &repoloc))
+				used = strcmp(repoloc, repo->uri) == 0;
+		}
+		if (used) {
+			xbps_repo_release_index(repo);
+			continue;
+		}
+		SIMPLEQ_REMOVE(&rp->queue, repo, xbps_repo, entries);
+		xbps_dbg_printf(xhp, "[rpool] `%s' closed.\n", repo->uri);
+		xbps_repo_close(repo);
+	}
+	rpool_release_caches(rp);
+	if (pkgs == NULL)
+		rp->opened = false;
+	xbps_fulldeptree_release(xhp, true);
+}
+
+int HIDDEN
+xbps_rpool_memstat(struct xbps_handle *xhp, int (*fn)(const char *,
+		const char *, const struct xbps_memstat *, void *), void *arg)
+{
+	struct xbps_rpool *rp = xhp->rpool;
+	struct xbps_repo *repo;
+	struct xbps_memstat ms;
+	int rv;
+
+	if (rp == NULL)
+		return 0;
+	if (rp->vpkgs != NULL) {
+		memset(&ms, 0, sizeof(ms));
+		xbps_object_memstat(rp->vpkgs, &ms);
+		if ((rv = (*fn)("rpool_vpkgs", NULL, &ms, arg)) != 0)
+			return rv;
+	}
+	if (rp->best != NULL) {
+		memset(&ms, 0, sizeof(ms));
+		xbps_object_memstat(rp->best, &ms);
+		if ((rv = (*fn)("rpool_best", NULL, &ms, arg)) != 0)
+			return rv;
+	}
+	SIMPLEQ_FOREACH(repo, &rp->queue, entries) {
+		const struct {
+			const char *name;
+			xbps_dictionary_t d;
+		} idx[] = {
+			{ "idx", repo->idx },
+			{ "idxmeta", repo->idxmeta },
+			{ "idxrevdeps", repo->idxrevdeps },
+			{ "idxshlibs", repo->idxshlibs },
+			{ "idxfiles", repo->idxfiles },
+		};
+
+		for (size_t i = 0; i < __arraycount(idx); i++) {
+			if (idx[i].d == NULL)
+				continue;
+			memset(&ms, 0, sizeof(ms));
+			xbps_object_memstat(idx[i].d, &ms);
+			if ((rv = (*fn)(idx[i].name, repo->uri, &ms, arg)) != 0)
+				return rv;
+		}
+		if (repo->idxmap != NULL) {
+			memset(&ms, 0, sizeof(ms));
+			xbps_repo_idxmap_memstat(repo, &ms);
+			if ((rv = (*fn)("idxmap", repo->uri, &ms, arg)) != 0)
+				return rv;
+		}
+	}
+	return 0;
+}
+
+bool
+xbps_rpool_changed(struct xbps_handle *xhp)
+{
+	struct xbps_repo *repo;
+	struct stat st, ost;
+	char *repofile;
+	int rv;
+
+	if (xhp->rpool == NULL || !xhp->rpool->opened)
+		return false;
+
+	SIMPLEQ_FOREACH(repo, &xhp->rpool->queue, entries) {
+		/* in memory synced repositories are not backed by a file */
+		if (repo->fd == -1)
+			continue;
+		if (fstat(repo->fd, &ost) == -1)
+			return true;
+		if ((repofile = xbps_repo_file(xhp, repo->uri, "repodata")) == NULL)
+			return true;
+		rv = stat(repofile, &st);
+		free(repofile);
+		if (rv == -1 || st.st_dev != ost.st_dev ||
+		    st.st_ino != ost.st_ino || st.st_size != ost.st_size ||
+		    st.st_mtim.tv_sec != ost.st_mtim.tv_sec ||
+		    st.st_mtim.tv_nsec != ost.st_mtim.tv_nsec) {
+			xbps_dbg_printf(xhp, "[rpool] `%s' changed\n",
+			    repo->uri);
+			return true;
+		}
+	}
+	return false;
+}
+
 int
 xbps_rpool_foreach(struct xbps_handle *xhp,
 	int (*fn)(struct xbps_repo *, void *, bool *),
 	void *arg)
 {
+	struct xbps_rpool *rp = rpool_get(xhp);
 	struct xbps_repo *repo;
 	const char *repouri;
 	int rv = 0;
@@ -144,13 +580,16 @@ xbps_rpool_foreach(struct xbps_handle *xhp,
 
 	assert(fn != NULL);
 
+	if (!rp->opened)
+		rpool_open(xhp, rp);
+
 	for (unsigned int i = 0; i < xbps_array_count(xhp->repositories); i++) {
 		xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
-		if ((repo = xbps_rpool_get_repo(repouri)) == NULL) {
+		if ((repo = rpool_find_repo(rp, repouri)) == NULL) {
 			repo = xbps_repo_open(xhp, repouri);
 			if (!repo)
 				continue;
-			SIMPLEQ_INSERT_TAIL(&rpool_queue, repo, entries);
+			SIMPLEQ_INSERT_TAIL(&rp->queue, repo, entries);
 			xbps_dbg_printf(xhp, "[rpool] `%s' registered.\n", repouri);
 		}
 		foundrepo = true;
@@ -164,12 +603,104 @@ xbps_rpool_foreach(struct xbps_handle *xhp,
 	return rv;
 }
 
+static int
+rpool_register_cb(struct xbps_repo *repo UNUSED, void *arg UNUSED,
+		bool *done UNUSED)
+{
+	return 0;
+}
+
+/*
+ * Registers all repositories of the pool and returns true if real
+ * packages can be looked up from several threads: the repositories
+ * are not registered lazily anymore and, without the best matching
+ * mode, no cache of the pool is filled by the lookups.
+ */
+bool HIDDEN
+xbps_rpool_concurrent(struct xbps_handle *xhp)
+{
+	const char *repouri;
+
+	if (xhp->flags & XBPS_FLAG_BESTMATCH)
+		return false;
+	if (xbps_rpool_foreach(xhp, rpool_register_cb, NULL) != 0)
+		return false;
+	for (unsigned int i = 0; i < xbps_array_count(xhp->repositories); i++) {
+		xbps_array_get_cstring_nocopy(xhp->repositories, i, &repouri);
+		if (rpool_find_repo(xhp->rpool, repouri) == NULL)
+			return false;
+	}
+	return true;
+}
+
+static int
+map_vpkgs_cb(struct xbps_repo *repo, void *arg UNUSED, bool *done UNUSED)
+{
+	xbps_repo_map_vpkgs(repo, repo->xhp->rpool->vpkgs);
+	return 0;
+}
+
+static xbps_dictionary_t
+repo_map_match_vpkg(struct xbps_repo *repo, const char *vpkgname,
+		const char *pattern)
+{
+	xbps_dictionary_t pkgd;
+	xbps_array_t pkgs;
+	const char *pkgname;
+
+	pkgs = xbps_dictionary_get(xbps_dictionary_get(repo->xhp->rpool->vpkgs,
+	    vpkgname), repo->uri);
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_get_cstring_nocopy(pkgs, i, &pkgname);
+		pkgd = xbps_repo_get_pkg(repo, pkgname);
+		if (pkgd && xbps_match_virtual_pkg_in_dict(pkgd, pattern))
+			return pkgd;
+	}
+	return NULL;
+}
+
+/*
+ * Same as xbps_repo_get_virtualpkg(), but only checks the packages
+ * that provide the virtual package name matched by \a pattern.
+ */
+static xbps_dictionary_t
+repo_map_get_virtualpkg(struct xbps_repo *repo, const char *pattern)
+{
+	xbps_dictionary_t pkgd;
+	const char *vpkg;
+	char *vpkgname;
+
+	/* Try matching vpkg from configuration files and pkgdb */
+	vpkg = vpkg_user_conf(repo->xhp, pattern, false);
+	if (vpkg != NULL && (pkgd = xbps_repo_get_pkg(repo, vpkg)))
+		return pkgd;
+
+	if ((pkgd = repo_map_match_vpkg(repo, pattern, pattern)))
+		return pkgd;
+	if ((vpkgname = xbps_pkgpattern_name(pattern))) {
+		pkgd = repo_map_match_vpkg(repo, vpkgname, pattern);
+		free(vpkgname);
+		if (pkgd)
+			return pkgd;
+	}
+	if ((vpkgname = xbps_pkg_name(pattern))) {
+		pkgd = repo_map_match_vpkg(repo, vpkgname, pattern);
+		free(vpkgname);
+	}
+	return pkgd;
+}
+
 static int
 find_virtualpkg_cb(struct xbps_repo *repo, void *arg, bool *done)
 {
 	struct rpool_fpkg *rpf = arg;
 
-	rpf->pkgd = xbps_repo_get_virtualpkg(repo, rpf->pattern);
+	/* globs can match any vpkgname */
+	if (repo->xhp->rpool->vpkgs == NULL ||
+	    (strpbrk(rpf->pattern, "*?[]") && !strpbrk(rpf->pattern, "<>")))
+		rpf->pkgd = xbps_repo_get_virtualpkg(repo, rpf->pattern);
+	else
+		rpf->pkgd = repo_map_get_virtualpkg(repo, rpf->pattern);
 	if (rpf->pkgd) {
 		/* found */
 		*done = true;
@@ -179,12 +710,21 @@ find_virtualpkg_cb(struct xbps_repo *repo, void *arg, bool *done)
 	return 0;
 }
 
+static xbps_dictionary_t
+rpf_repo_get_pkg(struct xbps_repo *repo, struct rpool_fpkg *rpf)
+{
+	if (rpf->pat)
+		return xbps_repo_get_pkg_pattern(repo, rpf->pat);
+
+	return xbps_repo_get_pkg(repo, rpf->pattern);
+}
+
 static int
 find_pkg_cb(struct xbps_repo *repo, void *arg, bool *done)
 {
 	struct rpool_fpkg *rpf = arg;
 
-	rpf->pkgd = xbps_repo_get_pkg(repo, rpf->pattern);
+	rpf->pkgd = rpf_repo_get_pkg(repo, rpf);
 	if (rpf->pkgd) {
 		/* found */
 		*done = true;
@@ -222,7 +762,7 @@ find_best_pkg_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
 	xbps_dictionary_t pkgd;
 	const char *repopkgver;
 
-	pkgd = xbps_repo_get_pkg(repo, rpf->pattern);
+	pkgd = rpf_repo_get_pkg(repo, rpf);
 	if (pkgd == NULL) {
 		if (errno && errno != ENOENT)
 			return errno;
@@ -256,33 +796,153 @@ find_best_pkg_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
 	return 0;
 }
 
+static int
+best_cands_cb(struct xbps_repo *repo, void *arg, bool *done UNUSED)
+{
+	struct rpool_fpkg *rpf = arg;
+	xbps_dictionary_t pkgd, cpkgd;
+	const char *pkgver, *cpkgver;
+	unsigned int i;
+
+	pkgd = xbps_repo_get_pkg(repo, rpf->pattern);
+	if (pkgd == NULL) {
+		if (errno && errno != ENOENT)
+			return errno;
+		return 0;
+	}
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+	/* insert it after the candidates with the same or a better version */
+	i = xbps_array_count(rpf->cands);
+	xbps_array_add(rpf->cands, pkgd);
+	for (; i > 0; i--) {
+		cpkgd = xbps_array_get(rpf->cands, i - 1);
+		xbps_dictionary_get_cstring_nocopy(cpkgd, "pkgver", &cpkgver);
+		if (xbps_cmpver(pkgver, cpkgver) != 1)
+			break;
+		xbps_array_set(rpf->cands, i, cpkgd);
+	}
+	xbps_array_set(rpf->cands, i, pkgd);
+	return 0;
+}
+
+/*
+ * Finds the best version of pkg with a single lookup of its pkgname
+ * in the best candidates of the pool, returns false if that can't be used for pkg.
+ */
+static bool
+find_best_pkg(struct xbps_handle *xhp, struct rpool_fpkg *rpf, int *rv)
+{
+	struct xbps_rpool *rp;
+	struct rpool_fpkg crpf;
+	xbps_dictionary_t pkgd;
+	const char *pkgname, *pkgver;
+	char buf[XBPS_NAME_SIZE], *alloc = NULL;
+	bool exact = false, name = false;
+
+	/* virtual packages from the configuration replace the real one */
+	if (vpkg_user_conf(xhp, rpf->pattern, true))
+		return false;
+
+	if (rpf->pat && (pkgname = xbps_pattern_pkgname(rpf->pat))) {
+		/* pkgname was already parsed, matched below */
+	} else if (xbps_pkgpattern_version(rpf->pattern) ||
+	    xbps_pkg_version(rpf->pattern)) {
+		pkgname = xbps_pkgname_get(buf, sizeof(buf), rpf->pattern,
+		    &alloc);
+		if (pkgname == NULL)
+			return false;
+		exact = xbps_pkgpattern_name_len(rpf->pattern) == 0;
+	} else {
+		pkgname = rpf->pattern;
+		name = true;
+	}
+
+	rp = rpool_get(xhp);
+	if (rp->best == NULL) {
+		rp->best = xbps_dictionary_create_hashed(0);
+		assert(rp->best);
+	}
+	crpf.cands = xbps_dictionary_get(rp->best, pkgname);
+	if (crpf.cands == NULL) {
+		crpf.pat = NULL;
+		crpf.pattern = pkgname;
+		crpf.cands = xbps_array_create();
+		assert(crpf.cands);
+		if ((*rv = xbps_rpool_foreach(xhp, best_cands_cb, &crpf)) != 0) {
+			xbps_object_release(crpf.cands);
+			free(alloc);
+			return true;
+		}
+		xbps_dictionary_set(rp->best, pkgname, crpf.cands);
+		xbps_object_release(crpf.cands);
+	}
+	free(alloc);
+
+	for (unsigned int i = 0; i < xbps_array_count(crpf.cands); i++) {
+		pkgd = xbps_array_get(crpf.cands, i);
+		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
+		if (name || (rpf->pat ?
+		    xbps_pattern_match_compiled(rpf->pat, pkgver) :
+		    exact ? strcmp(pkgver, rpf->pattern) == 0 :
+		    xbps_pkgpattern_match(pkgver, rpf->pattern))) {
+			xbps_dbg_printf(xhp, "[rpool] Found best match "
+			    "'%s'.\n", pkgver);
+			rpf->pkgd = pkgd;
+			rpf->bestpkgver = pkgver;
+			break;
+		}
+	}
+	return true;
+}
+
 static xbps_object_t
 repo_find_pkg(struct xbps_handle *xhp,
 	      const char *pkg,
+	      const struct xbps_pattern *pat,
 	      pkg_repo_type_t type)
 {
+	struct xbps_rpool *rp;
 	struct rpool_fpkg rpf;
 	int rv = 0;
 
 	assert(xhp);
 	assert(pkg);
 
+	rpf.pat = pat;
 	rpf.pattern = pkg;
 	rpf.pkgd = NULL;
 	rpf.revdeps = NULL;
+	rpf.cands = NULL;
 	rpf.bestpkgver = NULL;
 
+	xbps_counter_inc(XBPS_COUNTER_RPOOL_LOOKUPS);
+	/* repeated misses don't look up every repository again */
+	if (type != REVDEPS_PKG && rpool_miss(xhp, pkg, type, true)) {
+		xbps_counter_inc(XBPS_COUNTER_RPOOL_MISSES);
+		errno = ENOENT;
+		return NULL;
+	}
+
 	switch (type) {
 	case BEST_PKG:
 		/*
 		 * Find best pkg version.
 		 */
-		rv = xbps_rpool_foreach(xhp, find_best_pkg_cb, &rpf);
+		if (!find_best_pkg(xhp, &rpf, &rv))
+			rv = xbps_rpool_foreach(xhp, find_best_pkg_cb, &rpf);
 		break;
 	case VIRTUAL_PKG:
 		/*
 		 * Find virtual pkg.
 		 */
+		rp = rpool_get(xhp);
+		if (rp->vpkgs == NULL) {
+			rp->vpkgs = xbps_dictionary_create_hashed(0);
+			assert(rp->vpkgs);
+			(void)xbps_rpool_foreach(xhp, map_vpkgs_cb, NULL);
+			xbps_dbg_printf(xhp, "[rpool] mapped %u virtual "
+			    "packages.\n", xbps_dictionary_count(rp->vpkgs));
+		}
 		rv = xbps_rpool_foreach(xhp, find_virtualpkg_cb, &rpf);
 		break;
 	case REAL_PKG:
@@ -299,40 +959,58 @@ repo_find_pkg(struct xbps_handle *xhp,
 		break;
 	}
 	if (rv != 0) {
+		xbps_counter_inc(XBPS_COUNTER_RPOOL_MISSES);
 		errno = rv;
 		return NULL;
 	}
 	if (type == REVDEPS_PKG) {
-		if (rpf.revdeps == NULL)
+		if (rpf.revdeps == NULL) {
+			xbps_counter_inc(XBPS_COUNTER_RPOOL_MISSES);
 			errno = ENOENT;
+		} else
+			xbps_counter_inc(XBPS_COUNTER_RPOOL_HITS);
 
 		return rpf.revdeps;
-	} else {
-		if (rpf.pkgd == NULL)
-			errno = ENOENT;
-	}
+	} else if (rpf.pkgd == NULL) {
+		xbps_counter_inc(XBPS_COUNTER_RPOOL_MISSES);
+		(void)rpool_miss(xhp, pkg, type, false);
+		errno = ENOENT;
+	} else
+		xbps_counter_inc(XBPS_COUNTER_RPOOL_HITS);
 	return rpf.pkgd;
 }
 
 xbps_dictionary_t
 xbps_rpool_get_virtualpkg(struct xbps_handle *xhp, const char *pkg)
 {
-	return repo_find_pkg(xhp, pkg, VIRTUAL_PKG);
+	return repo_find_pkg(xhp, pkg, NULL, VIRTUAL_PKG);
 }
 
 xbps_dictionary_t
 xbps_rpool_get_pkg(struct xbps_handle *xhp, const char *pkg)
 {
 	if (xhp->flags & XBPS_FLAG_BESTMATCH)
-		return repo_find_pkg(xhp, pkg, BEST_PKG);
+		return repo_find_pkg(xhp, pkg, NULL, BEST_PKG);
 
-	return repo_find_pkg(xhp, pkg, REAL_PKG);
+	return repo_find_pkg(xhp, pkg, NULL, REAL_PKG);
+}
+
+xbps_dictionary_t HIDDEN
+xbps_rpool_get_pkg_pattern(struct xbps_handle *xhp,
+		const struct xbps_pattern *pat)
+{
+	const char *pkg = xbps_pattern_string(pat);
+
+	if (xhp->flags & XBPS_FLAG_BESTMATCH)
+		return repo_find_pkg(xhp, pkg, pat, BEST_PKG);
+
+	return repo_find_pkg(xhp, pkg, pat, REAL_PKG);
 }
 
 xbps_array_t
 xbps_rpool_get_pkg_revdeps(struct xbps_handle *xhp, const char *pkg)
 {
-	return repo_find_pkg(xhp, pkg, REVDEPS_PKG);
+	return repo_find_pkg(xhp, pkg, NULL, REVDEPS_PKG);
 }
 
 xbps_array_t
@@ -341,6 +1019,12 @@ xbps_rpool_get_pkg_fulldeptree(struct xbps_handle *xhp, const char *pkg)
 	return xbps_get_pkg_fulldeptree(xhp, pkg, true);
 }
 
+xbps_array_t
+xbps_rpool_get_pkg_fullrevdeptree(struct xbps_handle *xhp, const char *pkg)
+{
+	return xbps_get_pkg_fullrevdeptree(xhp, pkg, true);
+}
+
 xbps_dictionary_t
 xbps_rpool_get_pkg_plist(struct xbps_handle *xhp,
 			 const char *pkg,
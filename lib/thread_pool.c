@@ -0,0 +1,285 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#ifdef __linux__
+# define _GNU_SOURCE	/* for sched_getaffinity(2) */
+#endif
+
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "xbps_api_impl.h"
+
+/*
+ * Worker threads owned by the handle and shared by all parallel paths of
+ * libxbps, created on first use and kept until xbps_end().
+ *
+ * xbps_pool_run() runs a loop function on up to njobs threads at once:
+ * the calling thread and idle workers, which take the copies queued by
+ * the oldest run first. The function must take its work items from
+ * state shared by all copies (usually the next index under a mutex)
+ * and return once there are none left; when the caller's copy returns
+ * the copies not started yet are dropped. Since the caller always does
+ * the work itself if every worker is busy, runs can be nested.
+ */
+struct pool_job {
+	void *(*fn)(void *);
+	void *arg;
+	unsigned int copies;	/* not started yet */
+	unsigned int running;
+	struct pool_job *next;
+};
+
+struct xbps_pool {
+	pthread_mutex_t mtx;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	struct pool_job *jobs;
+	pthread_t *thds;
+	unsigned int nthreads;
+	bool quit;
+};
+
+static void
+pool_enqueue(struct xbps_pool *pool, struct pool_job *job)
+{
+	struct pool_job **jp;
+
+	for (jp = &pool->jobs; *jp != NULL; jp = &(*jp)->next)
+		;
+	*jp = job;
+}
+
+static void
+pool_dequeue(struct xbps_pool *pool, struct pool_job *job)
+{
+	struct pool_job **jp;
+
+	for (jp = &pool->jobs; *jp != NULL; jp = &(*jp)->next) {
+		if (*jp == job) {
+			*jp = job->next;
+			break;
+		}
+	}
+}
+
+static void *
+pool_worker(void *arg)
+{
+	struct xbps_pool *pool = arg;
+	struct pool_job *job;
+
+	pthread_mutex_lock(&pool->mtx);
+	for (;;) {
+		while ((job = pool->jobs) == NULL && !pool->quit)
+			pthread_cond_wait(&pool->work, &pool->mtx);
+		if (job == NULL)
+			break;
+		if (--job->copies == 0)
+			pool->jobs = job->next;
+		job->running++;
+		pthread_mutex_unlock(&pool->mtx);
+
+		(void)(*job->fn)(job->arg);
+
+		pthread_mutex_lock(&pool->mtx);
+		if (--job->running == 0)
+			pthread_cond_broadcast(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mtx);
+
+	return NULL;
+}
+
+/*
+ * Returns the CPU bandwidth of the cgroup v2 of the process in CPUs,
+ * rounded up, or 0 if it's not limited.
+ */
+static unsigned int
+cgroup_cpus(void)
+{
+	FILE *fp;
+	char buf[512], path[PATH_MAX];
+	unsigned long long quota = 0, period = 0;
+	unsigned int ncpus = 0;
+
+	if ((fp = fopen("/proc/self/cgroup", "r")) == NULL)
+		return 0;
+	path[0] = '\0';
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (strncmp(buf, "0::", 3) == 0) {
+			buf[strcspn(buf, "\n")] = '\0';
+			snprintf(path, sizeof(path),
+			    "/sys/fs/cgroup%s/cpu.max", buf + 3);
+			break;
+		}
+	}
+	fclose(fp);
+	if (path[0] == '\0' || (fp = fopen(path, "r")) == NULL)
+		return 0;
+	if (fscanf(fp, "%llu %llu", &quota, &period) == 2 && period > 0)
+		ncpus = (unsigned int)((quota + period - 1) / period);
+	fclose(fp);
+
+	return ncpus;
+}
+
+/*
+ * Returns the number of threads of the pool, the calling thread included:
+ * worker_threads if set, otherwise the CPUs the process may run on,
+ * bounded by the CPU quota of its cgroup.
+ */
+unsigned int HIDDEN
+xbps_pool_size(struct xbps_handle *xhp)
+{
+	unsigned int ncpus, quota;
+	long n = 0;
+#ifdef __linux__
+	cpu_set_t set;
+#endif
+
+	if (xhp->worker_threads > 0)
+		return xhp->worker_threads;
+
+#ifdef __linux__
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		n = CPU_COUNT(&set);
+#endif
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	ncpus = n > 1 ? (unsigned int)n : 1;
+	if ((quota = cgroup_cpus()) > 0 && quota < ncpus)
+		ncpus = quota;
+
+	return ncpus;
+}
+
+static struct xbps_pool *
+pool_get(struct xbps_handle *xhp)
+{
+	static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+	struct xbps_pool *pool;
+	unsigned int nthreads;
+
+	pthread_mutex_lock(&mtx);
+	if ((pool = xhp->pool) != NULL) {
+		pthread_mutex_unlock(&mtx);
+		return pool;
+	}
+	pool = calloc(1, sizeof(*pool));
+	assert(pool);
+	pthread_mutex_init(&pool->mtx, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	/* the calling thread is one of them */
+	nthreads = xbps_pool_size(xhp) - 1;
+	if (nthreads > 0) {
+		pool->thds = calloc(nthreads, sizeof(*pool->thds));
+		assert(pool->thds);
+	}
+	for (unsigned int i = 0; i < nthreads; i++) {
+		if (pthread_create(&pool->thds[i], NULL, pool_worker, pool))
+			break;
+		pool->nthreads++;
+	}
+	xbps_dbg_printf(xhp, "[pool] started %u worker threads\n",
+	    pool->nthreads);
+	xhp->pool = pool;
+	pthread_mutex_unlock(&mtx);
+
+	return pool;
+}
+
+void HIDDEN
+xbps_pool_run(struct xbps_handle *xhp, void *(*fn)(void *), void *arg,
+		unsigned int njobs)
+{
+	struct xbps_pool *pool;
+	struct pool_job job;
+
+	if (njobs <= 1 || (pool = pool_get(xhp))->nthreads == 0) {
+		(void)(*fn)(arg);
+		return;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.fn = fn;
+	job.arg = arg;
+	job.copies = njobs - 1;
+	if (job.copies > pool->nthreads)
+		job.copies = pool->nthreads;
+
+	pthread_mutex_lock(&pool->mtx);
+	pool_enqueue(pool, &job);
+	if (job.copies == 1)
+		pthread_cond_signal(&pool->work);
+	else
+		pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mtx);
+
+	(void)(*fn)(arg);
+
+	pthread_mutex_lock(&pool->mtx);
+	if (job.copies > 0) {
+		pool_dequeue(pool, &job);
+		job.copies = 0;
+	}
+	while (job.running > 0)
+		pthread_cond_wait(&pool->done, &pool->mtx);
+	pthread_mutex_unlock(&pool->mtx);
+}
+
+void HIDDEN
+xbps_pool_release(struct xbps_handle *xhp)
+{
+	struct xbps_pool *pool = xhp->pool;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mtx);
+	for (unsigned int i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->thds[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mtx);
+	free(pool->thds);
+	free(pool);
+	xhp->pool = NULL;
+}
@@ -0,0 +1,163 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Tracing: if the XBPS_TRACE environment variable is set to a file name,
+ * the spans of the expensive operations of libxbps (opening and syncing
+ * repositories, internalizing plists, resolving dependencies, fetching,
+ * hashing, unpacking and running scripts) are written to it in the Chrome
+ * trace event format, to be loaded in chrome://tracing or ui.perfetto.dev.
+ *
+ * Spans are timed by the caller:
+ *
+ *	uint64_t start = xbps_trace_begin();
+ *	...
+ *	xbps_trace_end(start, "repo", "open", url);
+ *
+ * xbps_trace_begin() returns 0 with tracing disabled, in which case
+ * xbps_trace_end() does nothing. Every thread has its own track.
+ */
+static FILE *trace_fp;
+static pthread_mutex_t trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_epoch;
+static unsigned int trace_ntids;
+static bool trace_first;
+static __thread unsigned int trace_tid;
+
+void HIDDEN
+xbps_trace_open(void)
+{
+	const char *file;
+
+	if ((file = getenv("XBPS_TRACE")) == NULL || *file == '\0')
+		return;
+
+	pthread_mutex_lock(&trace_mtx);
+	if (trace_fp == NULL && (trace_fp = fopen(file, "w")) != NULL) {
+		fputs("[\n", trace_fp);
+		trace_first = true;
+		trace_epoch = xbps_monotime();
+	}
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+void HIDDEN
+xbps_trace_close(void)
+{
+	pthread_mutex_lock(&trace_mtx);
+	if (trace_fp != NULL) {
+		fputs("\n]\n", trace_fp);
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+uint64_t HIDDEN
+xbps_trace_begin(void)
+{
+	if (trace_fp == NULL)
+		return 0;
+
+	return xbps_monotime();
+}
+
+static void
+trace_string(const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(trace_fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(trace_fp, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, trace_fp);
+	}
+}
+
+static void
+trace_event(uint64_t start, unsigned int tid, const char *cat,
+		const char *name, const char *arg)
+{
+	uint64_t end = xbps_monotime();
+
+	pthread_mutex_lock(&trace_mtx);
+	if (trace_fp == NULL) {
+		pthread_mutex_unlock(&trace_mtx);
+		return;
+	}
+	if (tid == 0) {
+		if (trace_tid == 0)
+			trace_tid = ++trace_ntids;
+		tid = trace_tid;
+	}
+	fprintf(trace_fp, "%s{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"X\","
+	    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u",
+	    trace_first ? "" : ",\n", cat, name,
+	    (start - trace_epoch) / 1e3, (end - start) / 1e3,
+	    (int)getpid(), tid);
+	if (arg != NULL) {
+		fputs(",\"args\":{\"arg\":\"", trace_fp);
+		trace_string(arg);
+		fputs("\"}", trace_fp);
+	}
+	fputc('}', trace_fp);
+	trace_first = false;
+	pthread_mutex_unlock(&trace_mtx);
+}
+
+void HIDDEN
+xbps_trace_end(uint64_t start, const char *cat, const char *name,
+		const char *arg)
+{
+	if (start == 0)
+		return;
+
+	trace_event(start, 0, cat, name, arg);
+}
+
+/*
+ * Spans of child processes run concurrently, they are put in the
+ * track of its pid.
+ */
+void HIDDEN
+xbps_trace_end_child(uint64_t start, pid_t pid, const char *cat,
+		const char *name, const char *arg)
+{
+	if (start == 0)
+		return;
+
+	trace_event(start, (unsigned int)pid, cat, name, arg);
+}
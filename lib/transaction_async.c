@@ -0,0 +1,369 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "xbps_api_impl.h"
+
+/*
+ * Transactions committed in a thread of their own: the state and fetch
+ * callbacks of the handle are replaced with ones queueing a copy of
+ * their data, and the read end of a pipe is kept readable while the
+ * queue isn't empty so that it can be watched by an event loop.
+ *
+ * Consecutive progress updates of the same download are merged into
+ * the last queued one, the queue doesn't grow if nobody reads it while
+ * a big package is being downloaded.
+ *
+ * The DONE event is allocated when the commit is started and isn't
+ * queued, it's returned once the queue is empty: a client waiting for
+ * it always gets it, even if other events were lost for lack of memory.
+ */
+struct xbps_commit {
+	struct xbps_handle *xhp;
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	int fds[2];
+	int rv;
+	bool notified;
+	bool cancel;
+	bool finished;
+	struct xbps_commit_event *done;
+	struct xbps_commit_event **queue;
+	size_t head, tail, size;
+	int (*state_cb)(const struct xbps_state_cb_data *, void *);
+	void *state_cb_data;
+	void (*fetch_cb)(const struct xbps_fetch_cb_data *, void *);
+	void *fetch_cb_data;
+};
+
+/*
+ * The strings are copied after the event, freeing it releases them.
+ */
+static struct xbps_commit_event *
+event_new(xbps_commit_event_type_t type, const char *desc, const char *arg)
+{
+	struct xbps_commit_event *ev;
+	size_t dlen = desc ? strlen(desc) + 1 : 0;
+	size_t alen = arg ? strlen(arg) + 1 : 0;
+	char *p;
+
+	if ((ev = calloc(1, sizeof(*ev) + dlen + alen)) == NULL)
+		return NULL;
+	ev->type = type;
+	ev->timestamp = xbps_monotime();
+	p = (char *)(ev + 1);
+	if (desc != NULL) {
+		ev->desc = memcpy(p, desc, dlen);
+		p += dlen;
+	}
+	if (arg != NULL)
+		ev->arg = memcpy(p, arg, alen);
+
+	return ev;
+}
+
+/* Must be called with the queue locked */
+static void
+queue_drain(struct xbps_commit *c)
+{
+	char buf[64];
+
+	while (read(c->fds[0], buf, sizeof(buf)) > 0)
+		;
+	c->notified = false;
+}
+
+/* Must be called with the queue locked */
+static void
+queue_notify(struct xbps_commit *c)
+{
+	if (!c->notified) {
+		(void)write(c->fds[1], "", 1);
+		c->notified = true;
+	}
+}
+
+static void
+queue_push(struct xbps_commit *c, struct xbps_commit_event *ev)
+{
+	struct xbps_commit_event **q;
+	size_t n, size;
+
+	pthread_mutex_lock(&c->mtx);
+	if (c->tail == c->size) {
+		n = c->tail - c->head;
+		if (c->head > 0 && n < c->size / 2) {
+			memmove(c->queue, c->queue + c->head,
+			    n * sizeof(*c->queue));
+		} else {
+			size = c->size ? c->size * 2 : 64;
+			if ((q = realloc(c->queue, size * sizeof(*q))) == NULL) {
+				pthread_mutex_unlock(&c->mtx);
+				free(ev);
+				return;
+			}
+			memmove(q, q + c->head, n * sizeof(*q));
+			c->queue = q;
+			c->size = size;
+		}
+		c->head = 0;
+		c->tail = n;
+	}
+	c->queue[c->tail++] = ev;
+	queue_notify(c);
+	pthread_mutex_unlock(&c->mtx);
+}
+
+static int
+commit_state_cb(const struct xbps_state_cb_data *xscd, void *arg)
+{
+	struct xbps_commit *c = arg;
+	struct xbps_commit_event *ev;
+
+	ev = event_new(XBPS_COMMIT_EVENT_STATE, xscd->desc, xscd->arg);
+	if (ev == NULL)
+		return 0;
+	ev->state = xscd->state;
+	ev->err = xscd->err;
+	ev->timestamp = xscd->timestamp;
+	if (xscd->stats != NULL)
+		ev->stats = *xscd->stats;
+	if (xscd->unpack != NULL)
+		ev->unpack = *xscd->unpack;
+	queue_push(c, ev);
+	/* nobody can be asked, i.e to import a repository key */
+	return 0;
+}
+
+static void
+commit_fetch_cb(const struct xbps_fetch_cb_data *xfcd, void *arg)
+{
+	struct xbps_commit *c = arg;
+	struct xbps_commit_event *ev;
+
+	if (xfcd->cb_update) {
+		pthread_mutex_lock(&c->mtx);
+		if (c->tail > c->head) {
+			ev = c->queue[c->tail - 1];
+			if (ev->type == XBPS_COMMIT_EVENT_FETCH && ev->cb_update &&
+			    ev->file_name && xfcd->file_name &&
+			    strcmp(ev->file_name, xfcd->file_name) == 0) {
+				ev->file_size = xfcd->file_size;
+				ev->file_offset = xfcd->file_offset;
+				ev->file_dloaded = xfcd->file_dloaded;
+				ev->timestamp = xbps_monotime();
+				pthread_mutex_unlock(&c->mtx);
+				return;
+			}
+		}
+		pthread_mutex_unlock(&c->mtx);
+	}
+	ev = event_new(XBPS_COMMIT_EVENT_FETCH, NULL, xfcd->file_name);
+	if (ev == NULL)
+		return;
+	ev->file_name = ev->arg;
+	ev->arg = NULL;
+	ev->file_size = xfcd->file_size;
+	ev->file_offset = xfcd->file_offset;
+	ev->file_dloaded = xfcd->file_dloaded;
+	ev->cb_start = xfcd->cb_start;
+	ev->cb_update = xfcd->cb_update;
+	ev->cb_end = xfcd->cb_end;
+	queue_push(c, ev);
+}
+
+static void *
+commit_thread(void *arg)
+{
+	struct xbps_commit *c = arg;
+	struct xbps_commit_event *ev = c->done;
+
+	c->rv = xbps_transaction_commit(c->xhp);
+	ev->err = c->rv;
+	ev->stats = c->xhp->stats;
+	ev->timestamp = xbps_monotime();
+
+	pthread_mutex_lock(&c->mtx);
+	c->finished = true;
+	queue_notify(c);
+	pthread_mutex_unlock(&c->mtx);
+
+	return NULL;
+}
+
+static bool
+set_nonblock(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		return false;
+	return true;
+}
+
+struct xbps_commit *
+xbps_transaction_commit_start(struct xbps_handle *xhp)
+{
+	struct xbps_commit *c;
+	int rv;
+
+	assert(xhp);
+
+	if (xhp->commit != NULL) {
+		errno = EBUSY;
+		return NULL;
+	}
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+		return NULL;
+	if ((c->done = event_new(XBPS_COMMIT_EVENT_DONE, NULL, NULL)) == NULL) {
+		free(c);
+		return NULL;
+	}
+	if (pipe(c->fds) == -1) {
+		free(c->done);
+		free(c);
+		return NULL;
+	}
+	if (!set_nonblock(c->fds[0]) || !set_nonblock(c->fds[1])) {
+		rv = errno;
+		goto fail;
+	}
+	c->xhp = xhp;
+	pthread_mutex_init(&c->mtx, NULL);
+	c->state_cb = xhp->state_cb;
+	c->state_cb_data = xhp->state_cb_data;
+	c->fetch_cb = xhp->fetch_cb;
+	c->fetch_cb_data = xhp->fetch_cb_data;
+	xhp->state_cb = commit_state_cb;
+	xhp->state_cb_data = c;
+	xhp->fetch_cb = commit_fetch_cb;
+	xhp->fetch_cb_data = c;
+	xhp->commit = c;
+
+	if ((rv = pthread_create(&c->thread, NULL, commit_thread, c)) != 0) {
+		xhp->state_cb = c->state_cb;
+		xhp->state_cb_data = c->state_cb_data;
+		xhp->fetch_cb = c->fetch_cb;
+		xhp->fetch_cb_data = c->fetch_cb_data;
+		xhp->commit = NULL;
+		pthread_mutex_destroy(&c->mtx);
+		goto fail;
+	}
+	xbps_dbg_printf(xhp, "[trans] commit started in background\n");
+	return c;
+
+fail:
+	close(c->fds[0]);
+	close(c->fds[1]);
+	free(c->done);
+	free(c);
+	errno = rv;
+	return NULL;
+}
+
+int
+xbps_commit_fd(struct xbps_commit *c)
+{
+	assert(c);
+	return c->fds[0];
+}
+
+struct xbps_commit_event *
+xbps_commit_event(struct xbps_commit *c)
+{
+	struct xbps_commit_event *ev = NULL;
+
+	assert(c);
+
+	pthread_mutex_lock(&c->mtx);
+	if (c->head < c->tail) {
+		ev = c->queue[c->head++];
+	} else if (c->finished && c->done) {
+		ev = c->done;
+		c->done = NULL;
+	}
+	if (c->head == c->tail && (!c->finished || c->done == NULL)) {
+		c->head = c->tail = 0;
+		queue_drain(c);
+	}
+	pthread_mutex_unlock(&c->mtx);
+
+	return ev;
+}
+
+void
+xbps_commit_cancel(struct xbps_commit *c)
+{
+	assert(c);
+	__atomic_store_n(&c->cancel, true, __ATOMIC_RELEASE);
+}
+
+bool HIDDEN
+xbps_commit_cancelled(struct xbps_handle *xhp)
+{
+	if (xhp->commit == NULL)
+		return false;
+	return __atomic_load_n(&xhp->commit->cancel, __ATOMIC_ACQUIRE);
+}
+
+int
+xbps_commit_finish(struct xbps_commit *c)
+{
+	struct xbps_handle *xhp;
+	int rv;
+
+	assert(c);
+
+	pthread_join(c->thread, NULL);
+	xhp = c->xhp;
+	xhp->state_cb = c->state_cb;
+	xhp->state_cb_data = c->state_cb_data;
+	xhp->fetch_cb = c->fetch_cb;
+	xhp->fetch_cb_data = c->fetch_cb_data;
+	xhp->commit = NULL;
+
+	for (size_t i = c->head; i < c->tail; i++)
+		free(c->queue[i]);
+	free(c->queue);
+	free(c->done);
+	close(c->fds[0]);
+	close(c->fds[1]);
+	pthread_mutex_destroy(&c->mtx);
+	rv = c->rv;
+	free(c);
+
+	return rv;
+}
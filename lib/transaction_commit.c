@@ -28,10 +28,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <limits.h>
 #include <locale.h>
+#include <pthread.h>
 
 #include "xbps_api_impl.h"
 
@@ -57,85 +59,501 @@
  */
 
 static int
-check_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
+check_binpkg(struct xbps_handle *xhp, xbps_dictionary_t obj)
 {
-	xbps_object_t obj;
 	struct xbps_repo *repo;
-	const char *pkgver, *repoloc, *trans, *sha256;
+	const char *pkgver, *repoloc, *sha256;
 	char *binfile;
 	int rv = 0;
 
-	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
+	xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
+	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+
+	binfile = xbps_repository_pkg_path(xhp, obj);
+	if (binfile == NULL)
+		return ENOMEM;
+	/*
+	 * For pkgs in local repos check the sha256 hash.
+	 * For pkgs in remote repos check the signature.
+	 */
+	if ((repo = xbps_rpool_repo(xhp, repoloc)) == NULL) {
+		rv = errno;
+		xbps_dbg_printf(xhp, "%s: failed to get repository "
+		    "%s: %s\n", pkgver, repoloc, strerror(errno));
+		free(binfile);
+		return rv;
+	}
+	if (repo->is_remote) {
+		/* remote repo */
+		xbps_set_cb_state(xhp, XBPS_STATE_VERIFY, 0, pkgver,
+		    "%s: verifying signature...", pkgver);
+
+		if (!xbps_verify_file_signature(repo, binfile)) {
+			char *sigfile;
+			rv = EPERM;
+			xbps_set_cb_state(xhp, XBPS_STATE_VERIFY_FAIL, rv, pkgver,
+			    "%s: the signature is not valid!", pkgver);
+			xbps_set_cb_state(xhp, XBPS_STATE_VERIFY_FAIL, rv, pkgver,
+			    "%s: removed pkg archive and its signature.", pkgver);
+			(void)remove(binfile);
+			sigfile = xbps_xasprintf("%s.sig", binfile);
+			(void)remove(sigfile);
+			free(sigfile);
+			/* it may have been linked from the shared cache */
+			xbps_shared_cache_remove(xhp, obj);
+		} else {
+			xbps_shared_cache_put(xhp, obj, binfile);
+		}
+	} else {
+		/* local repo */
+		xbps_set_cb_state(xhp, XBPS_STATE_VERIFY, 0, pkgver,
+		    "%s: verifying SHA256 hash...", pkgver);
+		xbps_dictionary_get_cstring_nocopy(obj, "filename-sha256", &sha256);
+		if ((rv = xbps_file_hash_check_handle(xhp, binfile,
+		    sha256)) != 0) {
+			xbps_set_cb_state(xhp, XBPS_STATE_VERIFY_FAIL, rv, pkgver,
+			    "%s: SHA256 hash is not valid: %s", pkgver, strerror(rv));
+		}
+	}
+	free(binfile);
+
+	return rv;
+}
+
+/*
+ * Rebuilds the binary package in cachedir from the delta published for
+ * it, if the installed version is its base and its binary package is
+ * still in cachedir. Returns true if the binary package was rebuilt.
+ */
+static bool
+download_delta(struct xbps_handle *xhp, xbps_dictionary_t obj)
+{
+	const char *pkgver, *arch, *repoloc, *base, *sha256;
+	char *basefile, *deltafile, *file, *uri;
+	bool ok = false;
+	int rv;
+
+	if ((basefile = xbps_binpkg_delta_base(xhp, obj)) == NULL)
+		return false;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+	xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+	xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
+	xbps_dictionary_get_cstring_nocopy(obj, "delta-base", &base);
+
+	file = xbps_xasprintf("%s/%s.%s.xbps", xhp->cachedir, pkgver, arch);
+	deltafile = xbps_xasprintf("%s/%s.%s.xdlt", xhp->cachedir, pkgver, arch);
+	repoloc = xbps_repo_mirror(xhp, repoloc, 0);
+	uri = xbps_xasprintf("%s/%s.%s.xdlt", repoloc, pkgver, arch);
+
+	xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD, 0, pkgver,
+	    "Downloading `%s' delta from `%s' (from `%s')...", pkgver, base, repoloc);
+	if (xbps_fetch_file_in(xhp, uri, xhp->cachedir, NULL) == -1) {
+		xbps_dbg_printf(xhp, "%s: failed to download delta: %s\n",
+		    pkgver, xbps_fetch_error_string());
+		goto out;
+	}
+	if (xbps_dictionary_get_cstring_nocopy(obj, "delta-sha256", &sha256) &&
+	    (rv = xbps_file_hash_check_handle(xhp, deltafile, sha256)) != 0) {
+		xbps_dbg_printf(xhp, "%s: invalid delta: %s\n",
+		    pkgver, strerror(rv));
+		goto out;
+	}
+	if ((rv = xbps_delta_apply(basefile, deltafile, file)) != 0) {
+		xbps_dbg_printf(xhp, "%s: failed to apply delta: %s\n",
+		    pkgver, strerror(rv));
+		goto out;
+	}
+	xbps_dbg_printf(xhp, "%s: rebuilt from delta of %s\n", pkgver, base);
+	ok = true;
+out:
+	(void)unlink(deltafile);
+	free(deltafile);
+	free(basefile);
+	free(file);
+	free(uri);
+
+	return ok;
+}
+
+/*
+ * Downloads of binary packages are spread across the FETCH_MIRRORS
+ * fastest mirrors of their repository.
+ */
+#define FETCH_MIRRORS		3
+
+/*
+ * Returns the mirror of \a repoloc to be tried in the \a n-th place
+ * by the package at position \a slot, NULL if there are no more.
+ */
+static const char *
+fetch_mirror(struct xbps_handle *xhp, const char *repoloc, unsigned int slot,
+		unsigned int n)
+{
+	unsigned int top;
+
+	(void)xbps_repo_mirrors(xhp, repoloc, &top);
+	if (top > FETCH_MIRRORS)
+		top = FETCH_MIRRORS;
+	if (n < top)
+		n = (slot + n) % top;
+
+	return xbps_repo_mirror(xhp, repoloc, n);
+}
+
+/*
+ * Downloads the file of binary package \a obj with \a suffix, \a what
+ * it is for the messages, trying the mirrors of its repository.
+ */
+static int
+download_binpkg_file(struct xbps_handle *xhp, xbps_dictionary_t obj,
+		unsigned int slot, const char *what, const char *suffix)
+{
+	const char *pkgver, *arch, *fetchstr, *repoloc, *mirror;
+	char *uri;
+	int rv = EINVAL;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
+	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+	xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+
+	for (unsigned int n = 0;
+	    (mirror = fetch_mirror(xhp, repoloc, slot, n)) != NULL; n++) {
+		xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD, 0, pkgver,
+		    "Downloading `%s' %s (from `%s')...", pkgver, what, mirror);
+		uri = xbps_xasprintf("%s/%s.%s.%s", mirror, pkgver, arch, suffix);
+		if (xbps_fetch_file_in(xhp, uri, xhp->cachedir, NULL) != -1) {
+			free(uri);
+			return 0;
+		}
+		free(uri);
+		rv = fetchLastErrCode ? fetchLastErrCode : errno;
+		fetchstr = xbps_fetch_error_string();
+		if (fetch_mirror(xhp, repoloc, slot, n + 1) != NULL) {
+			xbps_dbg_printf(xhp, "[trans] failed to download `%s' "
+			    "%s from `%s': %s, trying next mirror\n", pkgver,
+			    what, mirror, fetchstr ? fetchstr : strerror(rv));
+			continue;
+		}
+		xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD_FAIL, rv,
+		    pkgver, "[trans] failed to download `%s' %s from `%s': %s",
+		    pkgver, what, mirror, fetchstr ? fetchstr : strerror(rv));
+	}
+	return rv;
+}
+
+static int
+download_binpkg(struct xbps_handle *xhp, xbps_dictionary_t obj,
+		unsigned int slot)
+{
+	const char *pkgver, *arch;
+	char *file, *sigfile;
+	int rv = 0;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+	xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+
+	/*
+	 * Download binary package.
+	 */
+	file = xbps_xasprintf("%s/%s.%s.xbps", xhp->cachedir, pkgver, arch);
+	if (access(file, R_OK) == -1 && !xbps_shared_cache_get(xhp, obj, file) &&
+	    !download_delta(xhp, obj)) {
+		if ((rv = download_binpkg_file(xhp, obj, slot,
+		    "package", "xbps")) != 0) {
+			free(file);
+			return rv;
+		}
+	}
+	/*
+	 * Download binary package signature.
+	 */
+	sigfile = xbps_xasprintf("%s.sig", file);
+	free(file);
+	if (access(sigfile, R_OK) == -1)
+		rv = download_binpkg_file(xhp, obj, slot, "signature", "xbps.sig");
+	free(sigfile);
+
+	return rv;
+}
+
+/*
+ * Binary packages are downloaded and/or verified by a set of
+ * threads, every one picking up the next package in transaction order,
+ * or in the order returned by fetch_order() when downloading them
+ * concurrently.
+ */
+#define FETCH_DOWNLOAD		0x1
+#define FETCH_VERIFY		0x2
+#define FETCH_BACKGROUND	0x4
+
+struct fetch_data {
+	struct xbps_handle *xhp;
+	xbps_array_t pkgs;
+	pthread_t *thds;
+	unsigned int nthreads;
+	int *rv;
+	bool *done;
+	unsigned int *order;
+	unsigned int *pos;
+	unsigned int next;
+	bool failed;
+	int flags;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+};
+
+static void *
+fetch_thread(void *arg)
+{
+	struct fetch_data *fd = arg;
+	xbps_dictionary_t obj;
+	const char *repoloc;
+	unsigned int i, n;
+	int rv = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&fd->mtx);
+		/* stop picking up packages after the first error */
+		if (fd->failed || fd->next >= xbps_array_count(fd->pkgs)) {
+			pthread_mutex_unlock(&fd->mtx);
+			break;
+		}
+		n = fd->next++;
+		i = fd->order ? fd->order[n] : n;
+		pthread_mutex_unlock(&fd->mtx);
+
+		obj = xbps_array_get(fd->pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
+		rv = 0;
+		if (xbps_commit_cancelled(fd->xhp))
+			rv = ECANCELED;
+		else if ((fd->flags & FETCH_DOWNLOAD) &&
+		    xbps_repository_is_remote(repoloc))
+			rv = download_binpkg(fd->xhp, obj, n);
+		if (rv == 0 && (fd->flags & FETCH_VERIFY))
+			rv = check_binpkg(fd->xhp, obj);
+
+		pthread_mutex_lock(&fd->mtx);
+		fd->rv[i] = rv;
+		fd->done[i] = true;
+		if (rv != 0)
+			fd->failed = true;
+		pthread_cond_broadcast(&fd->cond);
+		pthread_mutex_unlock(&fd->mtx);
+	}
+	return NULL;
+}
+
+/*
+ * The downloads are started by up to `fetch_jobs' threads at once, the
+ * connections they begin with are opened ahead: one per thread to the
+ * mirror it will try first, for the packages that aren't in cachedir.
+ */
+void
+xbps_transaction_warmup(struct xbps_handle *xhp)
+{
+	xbps_array_t pkgs;
+	xbps_dictionary_t obj;
+	const char *pkgver, *arch, *repoloc, *trans, **uris;
+	char *file;
+	unsigned int i, n = 0, njobs, npkgs;
+
+	if (xhp->transd == NULL)
+		return;
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
+	npkgs = xbps_array_count(pkgs);
+	njobs = xhp->fetch_jobs > 1 ? xhp->fetch_jobs : 1;
+	if (njobs > XBPS_FETCH_CACHECONN_HOST)
+		njobs = XBPS_FETCH_CACHECONN_HOST;
+	if ((uris = calloc(njobs, sizeof(*uris))) == NULL)
+		return;
+
+	for (i = 0; i < npkgs && n < njobs; i++) {
+		obj = xbps_array_get(pkgs, i);
 		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &trans);
 		if ((strcmp(trans, "remove") == 0) ||
 		    (strcmp(trans, "hold") == 0) ||
 		    (strcmp(trans, "configure") == 0))
 			continue;
-
 		xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
+		if (!xbps_repository_is_remote(repoloc))
+			continue;
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+		file = xbps_xasprintf("%s/%s.%s.xbps", xhp->cachedir,
+		    pkgver, arch);
+		if (access(file, R_OK) == -1) {
+			uris[n] = fetch_mirror(xhp, repoloc, n, 0);
+			n++;
+		}
+		free(file);
+	}
+	xbps_fetch_warmup(xhp, uris, n);
+	free(uris);
+}
 
-		binfile = xbps_repository_pkg_path(xhp, obj);
-		if (binfile == NULL) {
-			rv = ENOMEM;
-			break;
+/*
+ * Signatures are small enough for round trips to dominate downloading
+ * them, the missing ones of every repository are fetched in a batch that
+ * pipelines the requests. Failures are left to download_binpkg(), which
+ * fetches them again and reports the error.
+ */
+static void
+fetch_signatures(struct xbps_handle *xhp, xbps_array_t pkgs)
+{
+	xbps_dictionary_t obj;
+	const char *pkgver, *arch, *repoloc, *repo, *mirror;
+	const char **repos, **batch;
+	char **uris, *sigfile;
+	unsigned int i, j, n = 0, nbatch, npkgs = xbps_array_count(pkgs);
+
+	uris = calloc(npkgs, sizeof(*uris));
+	repos = calloc(npkgs, sizeof(*repos));
+	batch = calloc(npkgs, sizeof(*batch));
+	assert(uris && repos && batch);
+
+	for (i = 0; i < npkgs; i++) {
+		obj = xbps_array_get(pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
+		if (!xbps_repository_is_remote(repoloc))
+			continue;
+		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+		sigfile = xbps_xasprintf("%s/%s.%s.xbps.sig", xhp->cachedir,
+		    pkgver, arch);
+		if (access(sigfile, R_OK) == 0) {
+			free(sigfile);
+			continue;
 		}
-		/*
-		 * For pkgs in local repos check the sha256 hash.
-		 * For pkgs in remote repos check the RSA signature.
-		 */
-		if ((repo = xbps_rpool_get_repo(repoloc)) == NULL) {
-			rv = errno;
-			xbps_dbg_printf(xhp, "%s: failed to get repository "
-			    "%s: %s\n", pkgver, repoloc, strerror(errno));
-			break;
+		free(sigfile);
+		mirror = xbps_repo_mirror(xhp, repoloc, 0);
+		xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD, 0, pkgver,
+		    "Downloading `%s' signature (from `%s')...", pkgver, mirror);
+		uris[n] = xbps_xasprintf("%s/%s.%s.xbps.sig", mirror, pkgver, arch);
+		repos[n++] = repoloc;
+	}
+	for (i = 0; i < n; i++) {
+		if ((repo = repos[i]) == NULL)
+			continue;
+		for (j = i, nbatch = 0; j < n; j++) {
+			if (repos[j] == NULL || strcmp(repos[j], repo) != 0)
+				continue;
+			batch[nbatch++] = uris[j];
+			repos[j] = NULL;
 		}
-		if (repo->is_remote) {
-			/* remote repo */
-			xbps_set_cb_state(xhp, XBPS_STATE_VERIFY, 0, pkgver,
-			    "%s: verifying RSA signature...", pkgver);
-
-			if (!xbps_verify_file_signature(repo, binfile)) {
-				char *sigfile;
-				rv = EPERM;
-				xbps_set_cb_state(xhp, XBPS_STATE_VERIFY_FAIL, rv, pkgver,
-				    "%s: the RSA signature is not valid!", pkgver);
-				xbps_set_cb_state(xhp, XBPS_STATE_VERIFY_FAIL, rv, pkgver,
-				    "%s: removed pkg archive and its signature.", pkgver);
-				(void)remove(binfile);
-				sigfile = xbps_xasprintf("%s.sig", binfile);
-				(void)remove(sigfile);
-				free(sigfile);
-				free(binfile);
-				break;
-			}
-		} else {
-			/* local repo */
-			xbps_set_cb_state(xhp, XBPS_STATE_VERIFY, 0, pkgver,
-			    "%s: verifying SHA256 hash...", pkgver);
-			xbps_dictionary_get_cstring_nocopy(obj, "filename-sha256", &sha256);
-			if ((rv = xbps_file_hash_check(binfile, sha256)) != 0) {
-				xbps_set_cb_state(xhp, XBPS_STATE_VERIFY_FAIL, rv, pkgver,
-				    "%s: SHA256 hash is not valid: %s", pkgver, strerror(rv));
-				free(binfile);
-				break;
-			}
+		xbps_dbg_printf(xhp, "[trans] fetching %u signatures from %s\n",
+		    nbatch, repo);
+		(void)xbps_fetch_files_in(xhp, batch, nbatch, xhp->cachedir, NULL);
+	}
+
+	for (i = 0; i < n; i++)
+		free(uris[i]);
+	free(uris);
+	free(repos);
+	free(batch);
+}
+
+struct fetch_size {
+	uint64_t size;
+	unsigned int i;
+};
+
+static int
+fetch_size_cmp(const void *a, const void *b)
+{
+	const struct fetch_size *fa = a, *fb = b;
+
+	if (fa->size != fb->size)
+		return fa->size > fb->size ? -1 : 1;
+	return fa->i < fb->i ? -1 : fa->i > fb->i;
+}
+
+/*
+ * Returns the order in which the packages are downloaded concurrently:
+ * the largest ones, by their "filename-size", alternate with the next
+ * ones in transaction order. The largest packages are started first and
+ * don't become the tail of the downloads, while the other connections
+ * keep fetching the smaller ones in the order the pipelined unpack
+ * consumes them. Packages in the cache aren't downloaded and keep their
+ * transaction order.
+ */
+static unsigned int *
+fetch_order(struct xbps_handle *xhp, xbps_array_t pkgs)
+{
+	struct fetch_size *sizes;
+	xbps_dictionary_t obj;
+	const char *pkgver, *arch;
+	unsigned int *order, big = 0, next = 0, n = 0;
+	unsigned int npkgs = xbps_array_count(pkgs);
+	bool *taken;
+	char *file;
+
+	sizes = calloc(npkgs, sizeof(*sizes));
+	taken = calloc(npkgs, sizeof(*taken));
+	order = calloc(npkgs, sizeof(*order));
+	assert(sizes && taken && order);
+
+	for (unsigned int i = 0; i < npkgs; i++) {
+		obj = xbps_array_get(pkgs, i);
+		sizes[i].i = i;
+		xbps_dictionary_get_uint64(obj, "filename-size", &sizes[i].size);
+		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+		file = xbps_xasprintf("%s/%s.%s.xbps", xhp->cachedir,
+		    pkgver, arch);
+		if (access(file, R_OK) == 0)
+			sizes[i].size = 0;
+		free(file);
+	}
+	qsort(sizes, npkgs, sizeof(*sizes), fetch_size_cmp);
 
+	while (n < npkgs) {
+		/* the largest package left to download */
+		while (big < npkgs && taken[sizes[big].i])
+			big++;
+		if (big < npkgs && sizes[big].size > 0) {
+			taken[sizes[big].i] = true;
+			order[n++] = sizes[big].i;
+		}
+		/* the next one in transaction order */
+		while (next < npkgs && taken[next])
+			next++;
+		if (next < npkgs) {
+			taken[next] = true;
+			order[n++] = next;
 		}
-		free(binfile);
 	}
-	xbps_object_iterator_reset(iter);
+	free(sizes);
+	free(taken);
 
-	return rv;
+	return order;
 }
 
-static int
-download_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
+/*
+ * Starts processing all binary packages to be unpacked, as specified
+ * by \a flags: packages from remote repositories are downloaded with
+ * FETCH_DOWNLOAD and all of them are verified with FETCH_VERIFY.
+ * With FETCH_BACKGROUND at least one thread is started and the function
+ * returns immediately, otherwise it returns once all packages were
+ * processed.
+ */
+static void
+fetch_start(struct fetch_data *fd, struct xbps_handle *xhp,
+		xbps_object_iterator_t iter, int flags)
 {
 	xbps_object_t obj;
-	const char *pkgver, *arch, *fetchstr, *repoloc, *trans;
-	char *file, *sigfile;
-	int rv = 0;
+	const char *repoloc, *trans;
+	unsigned int npkgs, njobs, nthreads = 0;
+	bool background = flags & FETCH_BACKGROUND;
+
+	memset(fd, 0, sizeof(*fd));
+	fd->xhp = xhp;
+	fd->flags = flags;
+	fd->pkgs = xbps_array_create();
+	assert(fd->pkgs);
+	pthread_mutex_init(&fd->mtx, NULL);
+	pthread_cond_init(&fd->cond, NULL);
 
 	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
 		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &trans);
@@ -145,76 +563,390 @@ download_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
 			continue;
 
 		xbps_dictionary_get_cstring_nocopy(obj, "repository", &repoloc);
-		if (!xbps_repository_is_remote(repoloc))
+		if (!(flags & FETCH_VERIFY) &&
+		    !xbps_repository_is_remote(repoloc))
 			continue;
 
-		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
-		xbps_dictionary_get_cstring_nocopy(obj, "architecture", &arch);
+		xbps_array_add(fd->pkgs, obj);
+	}
+	xbps_object_iterator_reset(iter);
 
-		/*
-		 * Download binary package.
-		 */
-		if ((file = xbps_repository_pkg_path(xhp, obj)) == NULL) {
-			rv = EINVAL;
-			break;
+	if ((npkgs = xbps_array_count(fd->pkgs)) == 0)
+		return;
+
+	fd->rv = calloc(npkgs, sizeof(*fd->rv));
+	fd->done = calloc(npkgs, sizeof(*fd->done));
+	assert(fd->rv && fd->done);
+	if (flags & FETCH_DOWNLOAD)
+		fetch_signatures(xhp, fd->pkgs);
+	/*
+	 * Download up to `fetch_jobs' packages concurrently with threads
+	 * of their own, they mostly wait for the network. Verification
+	 * alone runs on the worker pool.
+	 */
+	njobs = xhp->fetch_jobs;
+	if (!(flags & FETCH_DOWNLOAD)) {
+		njobs = xbps_pool_size(xhp);
+		if (!background) {
+			xbps_pool_run(xhp, fetch_thread, fd,
+			    njobs < npkgs ? njobs : npkgs);
+			return;
 		}
-		if (access(file, R_OK) == -1) {
-			xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD, 0, pkgver,
-			    "Downloading `%s' package (from `%s')...", pkgver, repoloc);
-			if ((rv = xbps_fetch_file(xhp, file, NULL)) == -1) {
-				rv = fetchLastErrCode ? fetchLastErrCode : errno;
-				fetchstr = xbps_fetch_error_string();
-				xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD_FAIL, rv,
-				    pkgver, "[trans] failed to download `%s' package from `%s': %s",
-				    pkgver, repoloc, fetchstr ? fetchstr : strerror(rv));
-				free(file);
-				break;
-			}
-			rv = 0;
+	}
+	if (njobs > 1 && npkgs > 1) {
+		nthreads = njobs < npkgs ? njobs : npkgs;
+		if (flags & FETCH_DOWNLOAD) {
+			fd->order = fetch_order(xhp, fd->pkgs);
+			fd->pos = calloc(npkgs, sizeof(*fd->pos));
+			assert(fd->pos);
+			for (unsigned int i = 0; i < npkgs; i++)
+				fd->pos[fd->order[i]] = i;
 		}
-		/*
-		 * Download binary package signature.
-		 */
-		sigfile = xbps_xasprintf("%s.sig", file);
-		free(file);
-		file = NULL;
-		if (access(sigfile, R_OK) == -1) {
-			xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD, 0, pkgver,
-			    "Downloading `%s' signature (from `%s')...", pkgver, repoloc);
-			file = xbps_xasprintf("%s/%s.%s.xbps.sig", repoloc, pkgver, arch);
-			if ((rv = xbps_fetch_file(xhp, file, NULL)) == -1) {
-				rv = fetchLastErrCode ? fetchLastErrCode : errno;
-				fetchstr = xbps_fetch_error_string();
-				xbps_set_cb_state(xhp, XBPS_STATE_DOWNLOAD_FAIL, rv,
-				    pkgver, "[trans] failed to download `%s' signature from `%s': %s",
-				    pkgver, repoloc, fetchstr ? fetchstr : strerror(rv));
-				free(sigfile);
-				free(file);
+	} else if (background) {
+		nthreads = 1;
+	}
+	/* the calling thread is one of them unless in background */
+	if (!background && nthreads > 0)
+		nthreads--;
+
+	if (nthreads > 0) {
+		fd->thds = calloc(nthreads, sizeof(*fd->thds));
+		assert(fd->thds);
+		for (unsigned int i = 0; i < nthreads; i++) {
+			if (pthread_create(&fd->thds[i], NULL, fetch_thread, fd))
 				break;
+			fd->nthreads++;
+		}
+	}
+	if (fd->nthreads == 0 || !background)
+		fetch_thread(fd);
+}
+
+/*
+ * Waits until the package at position \a i has been processed.
+ */
+static int
+fetch_wait(struct fetch_data *fd, unsigned int i)
+{
+	int rv = 0;
+
+	pthread_mutex_lock(&fd->mtx);
+	for (;;) {
+		if (fd->done[i]) {
+			rv = fd->rv[i];
+			break;
+		}
+		/* an earlier failure won't let it start */
+		if (fd->failed && (fd->pos ? fd->pos[i] : i) >= fd->next) {
+			rv = ECANCELED;
+			break;
+		}
+		pthread_cond_wait(&fd->cond, &fd->mtx);
+	}
+	pthread_mutex_unlock(&fd->mtx);
+
+	return rv;
+}
+
+/*
+ * Waits for all threads and returns the error of the first failed
+ * package in transaction order.
+ */
+static int
+fetch_finish(struct fetch_data *fd)
+{
+	int rv = 0;
+
+	for (unsigned int i = 0; i < fd->nthreads; i++)
+		pthread_join(fd->thds[i], NULL);
+
+	for (unsigned int i = 0; fd->rv && i < xbps_array_count(fd->pkgs); i++) {
+		if ((rv = fd->rv[i]) != 0)
+			break;
+	}
+	pthread_mutex_destroy(&fd->mtx);
+	pthread_cond_destroy(&fd->cond);
+	xbps_object_release(fd->pkgs);
+	free(fd->thds);
+	free(fd->rv);
+	free(fd->done);
+	free(fd->order);
+	free(fd->pos);
+	memset(fd, 0, sizeof(*fd));
+
+	return rv;
+}
+
+static int
+download_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
+{
+	struct fetch_data fd;
+
+	fetch_start(&fd, xhp, iter, FETCH_DOWNLOAD);
+	return fetch_finish(&fd);
+}
+
+static int
+check_binpkgs(struct xbps_handle *xhp, xbps_object_iterator_t iter)
+{
+	struct fetch_data fd;
+
+	fetch_start(&fd, xhp, iter, FETCH_VERIFY);
+	return fetch_finish(&fd);
+}
+
+/*
+ * With unpack_jobs, consecutive packages to be installed that aren't in
+ * pkgdb, without INSTALL scripts nor alternatives, are gathered in a batch
+ * as long as they don't share any path; a file or symlink of a package
+ * can't be a directory of another one. Their files are unpacked
+ * concurrently, then they are registered in transaction order; batches
+ * are bounded so that packages keep being registered along the way.
+ */
+#define UNPACK_BATCH_MAX(njobs)	((njobs) * 4)
+
+struct unpack_batch {
+	xbps_array_t pkgs;
+	xbps_dictionary_t files;
+	xbps_dictionary_t dirs;
+};
+
+static bool
+unpack_batch_eligible(struct xbps_handle *xhp, xbps_dictionary_t obj,
+		const char *tract)
+{
+	const char *pkgver;
+	char *pkgname;
+	bool installed;
+
+	if (strcmp(tract, "install") != 0 ||
+	    xbps_dictionary_get(obj, "alternatives") != NULL)
+		return false;
+
+	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+	pkgname = xbps_pkg_name(pkgver);
+	assert(pkgname);
+	installed = xbps_pkgdb_get_pkg(xhp, pkgname) != NULL;
+	free(pkgname);
+
+	return !installed;
+}
+
+/*
+ * Iterates over the paths in \a filesd, calls \a fn with every path and
+ * its parent directories (isparent set) until it returns false.
+ */
+static bool
+unpack_batch_walk(xbps_dictionary_t filesd,
+		bool (*fn)(struct unpack_batch *, const char *, bool, bool),
+		struct unpack_batch *b)
+{
+	static const char *keys[] = { "files", "conf_files", "links", "dirs" };
+	xbps_array_t array;
+	const char *file;
+	char path[PATH_MAX], *p;
+	bool isdir;
+
+	for (unsigned int i = 0; i < __arraycount(keys); i++) {
+		array = xbps_dictionary_get(filesd, keys[i]);
+		isdir = strcmp(keys[i], "dirs") == 0;
+		for (unsigned int j = 0; j < xbps_array_count(array); j++) {
+			xbps_dictionary_get_cstring_nocopy(
+			    xbps_array_get(array, j), "file", &file);
+			if (file == NULL ||
+			    xbps_strlcpy(path, file, sizeof(path)) >= sizeof(path))
+				continue;
+			if (!(*fn)(b, path, isdir, false))
+				return false;
+			while ((p = strrchr(path, '/')) != NULL && p != path) {
+				*p = '\0';
+				if (!(*fn)(b, path, true, true))
+					return false;
 			}
-			rv = 0;
 		}
-		free(sigfile);
-		if (file != NULL)
-			free(file);
 	}
-	xbps_object_iterator_reset(iter);
+	return true;
+}
+
+static bool
+unpack_batch_check(struct unpack_batch *b, const char *path, bool isdir,
+		bool isparent UNUSED)
+{
+	if (xbps_dictionary_get(b->files, path) != NULL)
+		return false;
+	return isdir || xbps_dictionary_get(b->dirs, path) == NULL;
+}
+
+static bool
+unpack_batch_insert(struct unpack_batch *b, const char *path, bool isdir,
+		bool isparent)
+{
+	/* parents were already added with a previous path */
+	if (isparent && xbps_dictionary_get(b->dirs, path) != NULL)
+		return true;
+	xbps_dictionary_set_bool(isdir ? b->dirs : b->files, path, true);
+	return true;
+}
+
+/*
+ * Adds the package to the batch if it doesn't share any path with the
+ * other packages on it, and the batch isn't full.
+ */
+static bool
+unpack_batch_add(struct unpack_batch *b, xbps_dictionary_t obj,
+		xbps_dictionary_t filesd, unsigned int njobs)
+{
+	if (b->pkgs == NULL) {
+		b->pkgs = xbps_array_create();
+		b->files = xbps_dictionary_create_hashed(0);
+		b->dirs = xbps_dictionary_create_hashed(0);
+		assert(b->pkgs && b->files && b->dirs);
+	}
+	if (xbps_array_count(b->pkgs) >= UNPACK_BATCH_MAX(njobs) ||
+	    !unpack_batch_walk(filesd, unpack_batch_check, b))
+		return false;
+
+	(void)unpack_batch_walk(filesd, unpack_batch_insert, b);
+	xbps_array_add(b->pkgs, obj);
+	return true;
+}
+
+static void
+unpack_batch_release(struct unpack_batch *b)
+{
+	if (b->pkgs == NULL)
+		return;
+	xbps_object_release(b->pkgs);
+	xbps_object_release(b->files);
+	xbps_object_release(b->dirs);
+	memset(b, 0, sizeof(*b));
+}
+
+/*
+ * Unpacks and registers all packages in the batch, which is emptied.
+ * If a package fails the ones before it are registered.
+ */
+static int
+unpack_batch_run(struct xbps_handle *xhp, struct unpack_batch *b,
+		unsigned int njobs)
+{
+	xbps_dictionary_t obj;
+	const char *pkgver;
+	unsigned int n = 0;
+	int rv = 0, rv2;
+
+	if (xbps_array_count(b->pkgs) == 0)
+		return 0;
+
+	xbps_dbg_printf(xhp, "[trans] unpacking %u packages concurrently\n",
+	    xbps_array_count(b->pkgs));
+	if ((rv = xbps_unpack_binary_pkgs(xhp, b->pkgs, njobs, &n)) != 0) {
+		obj = xbps_array_get(b->pkgs, n);
+		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+		xbps_dbg_printf(xhp, "[trans] failed to unpack "
+		    "%s: %s\n", pkgver, strerror(rv));
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		obj = xbps_array_get(b->pkgs, i);
+		if ((rv2 = xbps_register_pkg(xhp, obj)) != 0) {
+			xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
+			xbps_dbg_printf(xhp, "[trans] failed to register "
+			    "%s: %s\n", pkgver, strerror(rv2));
+			rv = rv2;
+			break;
+		}
+	}
+	unpack_batch_release(b);
 
 	return rv;
 }
 
+/*
+ * Replaces the package dictionaries of the transaction with copies that
+ * don't share any object with the repository indexes, and releases them:
+ * the dictionaries found in an index keep it (and the arena it was
+ * internalized to) in memory while referenced.
+ */
+static void
+release_repodata(struct xbps_handle *xhp)
+{
+	xbps_array_t pkgs;
+	xbps_dictionary_t pkgd;
+	char *buf;
+
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		if ((buf = xbps_dictionary_externalize(xbps_array_get(pkgs, i))) == NULL)
+			continue;
+		pkgd = xbps_dictionary_internalize(buf);
+		free(buf);
+		if (pkgd == NULL)
+			continue;
+		xbps_array_set(pkgs, i, pkgd);
+		xbps_object_release(pkgd);
+	}
+	/* the lookup tables reference the previous dictionaries */
+	xbps_pkg_index_release();
+	xbps_rpool_trim(xhp, pkgs);
+	xbps_object_pool_trim();
+}
+
+/*
+ * With unpack_readahead the kernel is asked to read the binary packages
+ * ahead while the previous ones are unpacked, so that the unpack loop
+ * doesn't wait for the disk (or a network cachedir) on every package.
+ * Packages are hinted up to the index \a last in the transaction, only
+ * their first UNPACK_READAHEAD_MAX bytes to bound the page cache used.
+ * Packages still being downloaded are skipped, they are already cached.
+ */
+#define UNPACK_READAHEAD_MAX	(32 * 1024 * 1024)
+
+static void
+unpack_readahead(struct xbps_handle *xhp, xbps_array_t pkgs,
+		unsigned int *next, unsigned int last)
+{
+	xbps_dictionary_t obj;
+	const char *tract;
+	char *bpkg;
+	int fd;
+
+	for (; *next < last && *next < xbps_array_count(pkgs); (*next)++) {
+		obj = xbps_array_get(pkgs, *next);
+		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
+		if (strcmp(tract, "install") && strcmp(tract, "update"))
+			continue;
+		if ((bpkg = xbps_repository_pkg_path(xhp, obj)) == NULL)
+			continue;
+		if ((fd = open(bpkg, O_RDONLY|O_CLOEXEC)) != -1) {
+			(void)posix_fadvise(fd, 0, UNPACK_READAHEAD_MAX,
+			    POSIX_FADV_WILLNEED);
+			(void)close(fd);
+		}
+		free(bpkg);
+	}
+}
+
 int
 xbps_transaction_commit(struct xbps_handle *xhp)
 {
+	struct fetch_data fd;
+	struct unpack_batch batch;
+	xbps_dictionary_t filesd, triggers;
+	xbps_array_t pkgs;
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
 	const char *pkgver, *tract;
+	unsigned int npkg = 0, njobs, idx = 0, ranext = 0;
+	uint64_t start, waited = 0;
 	int rv = 0;
-	bool update;
+	bool update, pipeline, script;
 
 	setlocale(LC_ALL, "");
 
 	assert(xbps_object_type(xhp->transd) == XBPS_TYPE_DICTIONARY);
+	xbps_fetch_warmup_wait();
+	if (xhp->flags & XBPS_FLAG_RELEASE_REPODATA)
+		release_repodata(xhp);
 	/*
 	 * Create cachedir if necessary.
 	 */
@@ -237,11 +969,32 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 	iter = xbps_array_iter_from_dict(xhp->transd, "packages");
 	if (iter == NULL)
 		return EINVAL;
+
+	memset(&fd, 0, sizeof(fd));
+	memset(&batch, 0, sizeof(batch));
+	triggers = xbps_dictionary_create();
+	assert(triggers);
+	njobs = xhp->unpack_jobs;
+	pipeline = (xhp->flags & XBPS_FLAG_PIPELINE_COMMIT) &&
+	    !(xhp->flags & XBPS_FLAG_DOWNLOAD_ONLY);
+	if (pipeline) {
+		/*
+		 * Download and verify binary packages in background,
+		 * every package is unpacked as soon as it's verified.
+		 */
+		xbps_set_cb_state(xhp, XBPS_STATE_TRANS_DOWNLOAD, 0, NULL, NULL);
+		fetch_start(&fd, xhp, iter,
+		    FETCH_DOWNLOAD|FETCH_VERIFY|FETCH_BACKGROUND);
+		goto run;
+	}
 	/*
 	 * Download binary packages (if they come from a remote repository).
 	 */
 	xbps_set_cb_state(xhp, XBPS_STATE_TRANS_DOWNLOAD, 0, NULL, NULL);
-	if ((rv = download_binpkgs(xhp, iter)) != 0) {
+	start = xbps_monotime();
+	rv = download_binpkgs(xhp, iter);
+	start = xbps_stats_phase(xhp, XBPS_PHASE_DOWNLOAD, start);
+	if (rv != 0) {
 		xbps_dbg_printf(xhp, "[trans] failed to download binpkgs: "
 		    "%s\n", strerror(rv));
 		goto out;
@@ -250,16 +1003,28 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 	 * Check binary package integrity.
 	 */
 	xbps_set_cb_state(xhp, XBPS_STATE_TRANS_VERIFY, 0, NULL, NULL);
-	if ((rv = check_binpkgs(xhp, iter)) != 0) {
+	rv = check_binpkgs(xhp, iter);
+	xbps_stats_phase(xhp, XBPS_PHASE_VERIFY, start);
+	if (rv != 0) {
 		xbps_dbg_printf(xhp, "[trans] failed to check binpkgs: "
 		    "%s\n", strerror(rv));
 		goto out;
 	}
+	if (xhp->flags & XBPS_FLAG_DOWNLOAD_ONLY) {
+		/* nothing in rootdir or pkgdb is touched */
+		xbps_object_iterator_release(iter);
+		xbps_object_release(triggers);
+		if (xhp->flags & XBPS_FLAG_RELEASE_REPODATA)
+			xbps_rpool_trim(xhp, NULL);
+		return 0;
+	}
+run:
 	/*
 	 * Install, update, configure or remove packages as specified
 	 * in the transaction dictionary.
 	 */
 	xbps_set_cb_state(xhp, XBPS_STATE_TRANS_RUN, 0, NULL, NULL);
+	start = xbps_monotime();
 
 	/*
 	 * Create rootdir if necessary.
@@ -280,10 +1045,44 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 		    xhp->rootdir, strerror(errno));
 		goto out;
 	}
+	/*
+	 * Collect the triggers of all packages to be installed, updated
+	 * or removed, executed once after the transaction.
+	 */
+	pkgs = xbps_dictionary_get(xhp->transd, "packages");
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		obj = xbps_array_get(pkgs, i);
+		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
+		if (strcmp(tract, "hold") && strcmp(tract, "configure"))
+			xbps_triggers_add(triggers, obj);
+	}
+	/*
+	 * Alternatives symlinks are applied once after all packages
+	 * have been removed and unpacked.
+	 */
+	xbps_alternatives_defer(xhp);
+
 	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
 		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
 
+		if (xbps_commit_cancelled(xhp)) {
+			xbps_dbg_printf(xhp, "[trans] cancelled before "
+			    "%s\n", pkgver);
+			rv = ECANCELED;
+			goto out;
+		}
+		if (xhp->unpack_readahead) {
+			unpack_readahead(xhp, pkgs, &ranext,
+			    idx + 1 + xhp->unpack_readahead);
+		}
+		idx++;
+		if (strcmp(tract, "remove") == 0 ||
+		    strcmp(tract, "configure") == 0) {
+			/* unpack previous packages first */
+			if ((rv = unpack_batch_run(xhp, &batch, njobs)) != 0)
+				goto out;
+		}
 		if (strcmp(tract, "remove") == 0) {
 			/*
 			 * Remove package.
@@ -310,7 +1109,47 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 			}
 			continue;
 
-		} else if (strcmp(tract, "update") == 0) {
+		} else if (strcmp(tract, "hold") == 0) {
+			/*
+			 * Package is on hold mode, ignore it.
+			 */
+			continue;
+		}
+		/*
+		 * Wait until the binary package has been verified.
+		 */
+		if (pipeline) {
+			uint64_t wstart = xbps_monotime();
+
+			rv = fetch_wait(&fd, npkg++);
+			waited += xbps_stats_phase(xhp, XBPS_PHASE_DOWNLOAD,
+			    wstart) - wstart;
+			if (rv != 0) {
+				xbps_dbg_printf(xhp, "[trans] failed to fetch "
+				    "%s: %s\n", pkgver, strerror(rv));
+				goto out;
+			}
+		}
+		if (njobs > 1 && unpack_batch_eligible(xhp, obj, tract)) {
+			filesd = xbps_binpkg_get_files(xhp, obj, &script);
+			if (filesd != NULL && !script) {
+				if (!unpack_batch_add(&batch, obj, filesd, njobs)) {
+					if ((rv = unpack_batch_run(xhp, &batch, njobs)) != 0) {
+						xbps_object_release(filesd);
+						goto out;
+					}
+					(void)unpack_batch_add(&batch, obj, filesd, njobs);
+				}
+				xbps_object_release(filesd);
+				continue;
+			}
+			if (filesd != NULL)
+				xbps_object_release(filesd);
+		}
+		if ((rv = unpack_batch_run(xhp, &batch, njobs)) != 0)
+			goto out;
+
+		if (strcmp(tract, "update") == 0) {
 			/*
 			 * Update a package: execute pre-remove action of
 			 * existing package before unpacking new version.
@@ -326,11 +1165,6 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 				    strerror(rv));
 				goto out;
 			}
-		} else if (strcmp(tract, "hold") == 0) {
-			/*
-			 * Package is on hold mode, ignore it.
-			 */
-			continue;
 		} else {
 			/* Install a package */
 			xbps_set_cb_state(xhp, XBPS_STATE_INSTALL, 0,
@@ -353,10 +1187,17 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 			goto out;
 		}
 	}
+	if ((rv = unpack_batch_run(xhp, &batch, njobs)) != 0)
+		goto out;
+	if ((rv = xbps_alternatives_flush(xhp)) != 0)
+		goto out;
+	/* the time waiting for downloads is accounted to them */
+	start = xbps_stats_phase(xhp, XBPS_PHASE_UNPACK, start + waited);
+
 	/* if there are no packages to install or update we are done */
 	if (!xbps_dictionary_get(xhp->transd, "total-update-pkgs") &&
 	    !xbps_dictionary_get(xhp->transd, "total-install-pkgs"))
-		goto out;
+		goto trigger;
 
 	if (xhp->target_arch && strcmp(xhp->native_arch, xhp->target_arch)) {
 		/* if installing packages for target_arch, don't configure anything */
@@ -378,6 +1219,12 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
 		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
+		if (xbps_commit_cancelled(xhp)) {
+			xbps_dbg_printf(xhp, "[trans] cancelled before "
+			    "configuring %s\n", pkgver);
+			rv = ECANCELED;
+			goto out;
+		}
 		if ((strcmp(tract, "remove") == 0) ||
 		    (strcmp(tract, "hold") == 0) ||
 		    (strcmp(tract, "configure") == 0)) {
@@ -408,10 +1255,32 @@ xbps_transaction_commit(struct xbps_handle *xhp)
 		}
 	}
 
+trigger:
+	rv = xbps_triggers_run(xhp, triggers);
+	xbps_stats_phase(xhp, XBPS_PHASE_CONFIGURE, start);
+
 out:
+	if (pipeline) {
+		int rv2;
+
+		/* don't fetch any more packages if the transaction failed */
+		pthread_mutex_lock(&fd.mtx);
+		if (rv != 0)
+			fd.failed = true;
+		pthread_mutex_unlock(&fd.mtx);
+		if ((rv2 = fetch_finish(&fd)) != 0 && rv == 0)
+			rv = rv2;
+	}
+	unpack_batch_release(&batch);
+	/* keep the symlinks in sync with pkgdb if the transaction failed */
+	(void)xbps_alternatives_flush(xhp);
 	xbps_object_iterator_release(iter);
+	xbps_object_release(triggers);
 	/* Force a pkgdb write for all unpacked pkgs in transaction */
 	(void)xbps_pkgdb_update(xhp, true, true);
+	/* the repositories without index are opened again if used */
+	if (xhp->flags & XBPS_FLAG_RELEASE_REPODATA)
+		xbps_rpool_trim(xhp, NULL);
 
 	return rv;
 }
@@ -146,11 +146,10 @@ pkg_conflicts_trans(struct xbps_handle *xhp, xbps_array_t array,
 	free(repopkgname);
 }
 
-static int
-pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
-		const char *key UNUSED, void *arg, bool *done UNUSED)
+static void
+pkgdb_conflicts(struct xbps_handle *xhp, xbps_object_t obj, xbps_array_t pkgs)
 {
-	xbps_array_t pkg_cflicts, trans_cflicts, pkgs = arg;
+	xbps_array_t pkg_cflicts, trans_cflicts;
 	xbps_dictionary_t pkgd;
 	xbps_object_t obj2;
 	xbps_object_iterator_t iter;
@@ -159,7 +158,7 @@ pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
 
 	pkg_cflicts = xbps_dictionary_get(obj, "conflicts");
 	if (xbps_array_count(pkg_cflicts) == 0)
-		return 0;
+		return;
 
 	trans_cflicts = xbps_dictionary_get(xhp->transd, "conflicts");
 	xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &repopkgver);
@@ -169,7 +168,7 @@ pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
 	/* if a pkg is in the transaction, ignore the one from pkgdb */
 	if (xbps_find_pkg_in_array(pkgs, repopkgname, NULL)) {
 		free(repopkgname);
-		return 0;
+		return;
 	}
 
 	iter = xbps_array_iterator(pkg_cflicts);
@@ -210,13 +209,95 @@ pkgdb_conflicts_cb(struct xbps_handle *xhp, xbps_object_t obj,
 	}
 	xbps_object_iterator_release(iter);
 	free(repopkgname);
-	return 0;
+}
+
+/*
+ * Index of the conflicts of installed packages by the (virtual) pkgname
+ * they can match, globs are indexed as "*". Only the installed packages
+ * with conflicts indexed by a pkgname in the transaction are checked.
+ */
+static void
+conflicts_index_add(xbps_dictionary_t idx, const char *key, const char *pkgname)
+{
+	xbps_array_t pkgs;
+	const char *last = NULL;
+
+	if ((pkgs = xbps_dictionary_get(idx, key)) == NULL) {
+		pkgs = xbps_array_create();
+		assert(pkgs);
+		xbps_dictionary_set(idx, key, pkgs);
+		xbps_object_release(pkgs);
+	}
+	xbps_array_get_cstring_nocopy(pkgs, xbps_array_count(pkgs) - 1, &last);
+	if (last == NULL || strcmp(last, pkgname))
+		xbps_array_add_cstring_nocopy(pkgs, pkgname);
+}
+
+static xbps_dictionary_t
+pkgdb_conflicts_index(struct xbps_handle *xhp)
+{
+	xbps_dictionary_t idx;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	idx = xbps_dictionary_create_hashed(0);
+	assert(idx);
+
+	iter = xbps_dictionary_iterator(xhp->pkgdb);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		xbps_array_t pkg_cflicts;
+		const char *pkgname, *cfpkg, *vpkg;
+		char *key;
+
+		pkg_cflicts = xbps_dictionary_get(
+		    xbps_dictionary_get_keysym(xhp->pkgdb, obj), "conflicts");
+		if (xbps_array_count(pkg_cflicts) == 0)
+			continue;
+
+		pkgname = xbps_dictionary_keysym_cstring_nocopy(obj);
+		for (unsigned int i = 0; i < xbps_array_count(pkg_cflicts); i++) {
+			xbps_array_get_cstring_nocopy(pkg_cflicts, i, &cfpkg);
+			if ((key = xbps_pkg_index_key(cfpkg))) {
+				conflicts_index_add(idx, key, pkgname);
+				free(key);
+			} else {
+				conflicts_index_add(idx, "*", pkgname);
+			}
+			/* virtual packages set in configuration files or pkgdb */
+			if ((vpkg = vpkg_user_conf(xhp, cfpkg, false)) &&
+			    (key = xbps_pkg_index_key(vpkg))) {
+				conflicts_index_add(idx, key, pkgname);
+				free(key);
+			}
+		}
+	}
+	xbps_object_iterator_release(iter);
+
+	return idx;
+}
+
+static void
+conflicts_index_get(struct xbps_handle *xhp, xbps_dictionary_t idx,
+		const char *key, xbps_dictionary_t cands)
+{
+	xbps_array_t pkgs;
+	const char *pkgname;
+
+	pkgs = xbps_dictionary_get(idx, key);
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_get_cstring_nocopy(pkgs, i, &pkgname);
+		xbps_dictionary_set(cands, pkgname,
+		    xbps_dictionary_get(xhp->pkgdb, pkgname));
+	}
 }
 
 void HIDDEN
 xbps_transaction_conflicts(struct xbps_handle *xhp, xbps_array_t pkgs)
 {
-	xbps_dictionary_t pkgd;
+	xbps_dictionary_t pkgd, idx, cands;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
 	unsigned int i;
 
 	/* find conflicts in transaction */
@@ -225,5 +306,37 @@ xbps_transaction_conflicts(struct xbps_handle *xhp, xbps_array_t pkgs)
 		pkg_conflicts_trans(xhp, pkgs, pkgd);
 	}
 	/* find conflicts in pkgdb */
-	(void)xbps_pkgdb_foreach_cb_multi(xhp, pkgdb_conflicts_cb, pkgs);
+	idx = pkgdb_conflicts_index(xhp);
+	cands = xbps_dictionary_create();
+	assert(cands);
+	conflicts_index_get(xhp, idx, "*", cands);
+	for (i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_t provides;
+		const char *pkgver, *vpkg;
+		char *pkgname;
+
+		pkgd = xbps_array_get(pkgs, i);
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver) &&
+		    (pkgname = xbps_pkg_name(pkgver))) {
+			conflicts_index_get(xhp, idx, pkgname, cands);
+			free(pkgname);
+		}
+		provides = xbps_dictionary_get(pkgd, "provides");
+		for (unsigned int x = 0; x < xbps_array_count(provides); x++) {
+			xbps_array_get_cstring_nocopy(provides, x, &vpkg);
+			if ((pkgname = xbps_pkg_name(vpkg)) == NULL)
+				pkgname = strdup(vpkg);
+			assert(pkgname);
+			conflicts_index_get(xhp, idx, pkgname, cands);
+			free(pkgname);
+		}
+	}
+	iter = xbps_dictionary_iterator(cands);
+	assert(iter);
+	while ((obj = xbps_object_iterator_next(iter)))
+		pkgdb_conflicts(xhp, xbps_dictionary_get_keysym(cands, obj), pkgs);
+	xbps_object_iterator_release(iter);
+
+	xbps_object_release(cands);
+	xbps_object_release(idx);
 }
@@ -30,6 +30,8 @@
 #include <errno.h>
 #include <sys/statvfs.h>
 
+#include <openssl/sha.h>
+
 #include "xbps_api_impl.h"
 
 /**
@@ -101,12 +103,21 @@ compute_transaction_stats(struct xbps_handle *xhp)
 			instsize += tsize;
 			if (xbps_repository_is_remote(repo) &&
 			    !xbps_binpkg_exists(xhp, obj)) {
+				char *basefile;
+
 				xbps_dictionary_get_uint64(obj,
 				    "filename-size", &tsize);
 				/* signature file: 512 bytes */
 				tsize += 512;
-				dlsize += tsize;
 				instsize += tsize;
+				/* only the delta is fetched if it's usable */
+				if ((basefile = xbps_binpkg_delta_base(xhp, obj))) {
+					free(basefile);
+					xbps_dictionary_get_uint64(obj,
+					    "delta-size", &tsize);
+					tsize += 512;
+				}
+				dlsize += tsize;
 				dl_pkgcnt++;
 				xbps_dictionary_set_bool(obj, "download", true);
 			}
@@ -250,18 +261,28 @@ xbps_transaction_init(struct xbps_handle *xhp)
 int
 xbps_transaction_prepare(struct xbps_handle *xhp)
 {
+	struct xbps_deps_cache *cache;
 	xbps_array_t array, pkgs, edges;
 	unsigned int i, cnt;
+	uint64_t start;
 	int rv = 0;
+	bool unresolved;
 
 	if (xhp->transd == NULL)
 		return ENXIO;
 
+	memset(&xhp->stats, 0, sizeof(xhp->stats));
+	start = xbps_monotime();
+
 	/*
 	 * Collect dependencies for pkgs in transaction.
 	 */
 	if ((edges = xbps_array_create()) == NULL)
 		return ENOMEM;
+	if ((cache = xbps_deps_cache_create()) == NULL) {
+		xbps_object_release(edges);
+		return ENOMEM;
+	}
 	/*
 	 * The edges are also appended after its dependencies have been
 	 * collected; the edges at the original array are removed later.
@@ -282,14 +303,22 @@ xbps_transaction_prepare(struct xbps_handle *xhp)
 
 		assert(xbps_object_type(str) == XBPS_TYPE_STRING);
 
-		if (!xbps_array_add(edges, str))
-			return ENOMEM;
-
-		if ((rv = xbps_repository_find_deps(xhp, pkgs, pkgd)) != 0)
-			return rv;
+		if (!xbps_array_add(edges, str)) {
+			rv = ENOMEM;
+			break;
+		}
+		if ((rv = xbps_repository_find_deps(xhp, cache, pkgs, pkgd)) != 0)
+			break;
 
-		if (!xbps_array_add(pkgs, pkgd))
-			return ENOMEM;
+		if (!xbps_array_add(pkgs, pkgd)) {
+			rv = ENOMEM;
+			break;
+		}
+	}
+	xbps_deps_cache_release(xhp, cache);
+	if (rv != 0) {
+		xbps_object_release(edges);
+		return rv;
 	}
 	/* ... remove dup edges at head */
 	for (i = 0; i < xbps_array_count(edges); i++) {
@@ -307,10 +336,12 @@ xbps_transaction_prepare(struct xbps_handle *xhp)
 		xhp->transd = NULL;
 		return rv;
 	}
+	start = xbps_stats_phase(xhp, XBPS_PHASE_RESOLVE, start);
 	/*
 	 * If there are missing deps or revdeps bail out.
 	 */
 	xbps_transaction_revdeps(xhp, pkgs);
+	start = xbps_stats_phase(xhp, XBPS_PHASE_REVDEPS, start);
 	array = xbps_dictionary_get(xhp->transd, "missing_deps");
 	if (xbps_array_count(array)) {
 		if (xhp->flags & XBPS_FLAG_FORCE_REMOVE_REVDEPS) {
@@ -323,14 +354,17 @@ xbps_transaction_prepare(struct xbps_handle *xhp)
 	 * If there are package conflicts bail out.
 	 */
 	xbps_transaction_conflicts(xhp, pkgs);
+	start = xbps_stats_phase(xhp, XBPS_PHASE_CONFLICTS, start);
 	array = xbps_dictionary_get(xhp->transd, "conflicts");
 	if (xbps_array_count(array))
 		return EAGAIN;
 	/*
 	 * Check for unresolved shared libraries.
 	 */
-	if (xbps_transaction_shlibs(xhp, pkgs,
-	    xbps_dictionary_get(xhp->transd, "missing_shlibs"))) {
+	unresolved = xbps_transaction_shlibs(xhp, pkgs,
+	    xbps_dictionary_get(xhp->transd, "missing_shlibs"));
+	xbps_stats_phase(xhp, XBPS_PHASE_SHLIBS, start);
+	if (unresolved) {
 		if (xhp->flags & XBPS_FLAG_FORCE_REMOVE_REVDEPS) {
 			xbps_dbg_printf(xhp, "[trans] continuing with unresolved shared libraries!");
 		} else {
@@ -355,3 +389,169 @@ xbps_transaction_prepare(struct xbps_handle *xhp)
 
 	return 0;
 }
+
+static int
+cmpstr(const void *a, const void *b)
+{
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/*
+ * Hash of the pkgdb state a transaction is resolved against: the target
+ * architecture and, sorted by name, the pkgver, state, automatic-install,
+ * hold and repolock objects of every installed package. Everything else
+ * in pkgdb (install-date, files, etc) does not change how a transaction
+ * is resolved, so nodes installed at different times get the same hash.
+ */
+static char *
+pkgdb_state_hash(struct xbps_handle *xhp)
+{
+	xbps_array_t allkeys;
+	const char **names;
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	SHA256_CTX sha256;
+	unsigned int i, cnt;
+	const char *arch;
+	char *hash;
+
+	if (xbps_pkgdb_init(xhp) != 0)
+		return NULL;
+
+	allkeys = xbps_dictionary_all_keys(xhp->pkgdb);
+	assert(allkeys);
+	cnt = xbps_array_count(allkeys);
+	names = calloc(cnt + 1, sizeof(*names));
+	assert(names);
+	for (i = 0; i < cnt; i++)
+		names[i] = xbps_dictionary_keysym_cstring_nocopy(
+		    xbps_array_get(allkeys, i));
+	qsort(names, cnt, sizeof(*names), cmpstr);
+
+	arch = xhp->target_arch ? xhp->target_arch : xhp->native_arch;
+	SHA256_Init(&sha256);
+	SHA256_Update(&sha256, arch, strlen(arch) + 1);
+	for (i = 0; i < cnt; i++) {
+		xbps_dictionary_t pkgd;
+		const char *pkgver, *state = "", *repolock = "";
+		bool autoinst = false, hold = false, locked = false;
+		char *line;
+
+		pkgd = xbps_dictionary_get(xhp->pkgdb, names[i]);
+		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+			continue;
+		xbps_dictionary_get_cstring_nocopy(pkgd, "state", &state);
+		xbps_dictionary_get_bool(pkgd, "automatic-install", &autoinst);
+		xbps_dictionary_get_bool(pkgd, "hold", &hold);
+		xbps_dictionary_get_bool(pkgd, "repolock", &locked);
+		if (locked)
+			xbps_dictionary_get_cstring_nocopy(pkgd,
+			    "repository", &repolock);
+		line = xbps_xasprintf("%s %s %s %d %d %s\n", names[i], pkgver,
+		    state, autoinst, hold, repolock);
+		SHA256_Update(&sha256, line, strlen(line));
+		free(line);
+	}
+	SHA256_Final(digest, &sha256);
+	free(names);
+	xbps_object_release(allkeys);
+
+	hash = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
+	assert(hash);
+	xbps_digest2string(digest, hash, SHA256_DIGEST_LENGTH);
+	return hash;
+}
+
+int
+xbps_transaction_export(struct xbps_handle *xhp, const char *file)
+{
+	xbps_dictionary_t d;
+	char *hash;
+	int rv = 0;
+
+	if (xhp->transd == NULL ||
+	    !xbps_dictionary_get(xhp->transd, "total-install-pkgs"))
+		return ENXIO;
+	if ((hash = pkgdb_state_hash(xhp)) == NULL)
+		return EINVAL;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	xbps_dictionary_set(d, "packages",
+	    xbps_dictionary_get(xhp->transd, "packages"));
+	xbps_dictionary_set_cstring(d, "pkgdb-hash", hash);
+	if (!xbps_dictionary_externalize_to_zfile(d, file))
+		rv = errno ? errno : EINVAL;
+	xbps_object_release(d);
+	free(hash);
+
+	return rv;
+}
+
+static int
+register_repo_cb(struct xbps_repo *repo UNUSED, void *arg UNUSED,
+		bool *done UNUSED)
+{
+	return 0;
+}
+
+int
+xbps_transaction_import(struct xbps_handle *xhp, const char *file)
+{
+	xbps_dictionary_t d;
+	xbps_array_t pkgs;
+	const char *ohash = NULL;
+	char *hash;
+	int rv;
+
+	if ((d = xbps_dictionary_internalize_from_zfile(file)) == NULL)
+		return errno ? errno : EINVAL;
+
+	pkgs = xbps_dictionary_get(d, "packages");
+	if (xbps_object_type(pkgs) != XBPS_TYPE_ARRAY ||
+	    !xbps_dictionary_get_cstring_nocopy(d, "pkgdb-hash", &ohash)) {
+		xbps_object_release(d);
+		return EINVAL;
+	}
+	if ((hash = pkgdb_state_hash(xhp)) == NULL) {
+		xbps_object_release(d);
+		return EINVAL;
+	}
+	if (strcmp(hash, ohash)) {
+		xbps_dbg_printf(xhp, "[trans] %s: pkgdb hash %s does not match "
+		    "%s\n", file, hash, ohash);
+		xbps_object_release(d);
+		free(hash);
+		return ESTALE;
+	}
+	free(hash);
+	/*
+	 * The repositories are registered while resolving a transaction,
+	 * the binary packages are fetched and verified against them.
+	 */
+	(void)xbps_rpool_foreach(xhp, register_repo_cb, NULL);
+
+	if (xhp->transd != NULL) {
+		xbps_object_release(xhp->transd);
+		xhp->transd = NULL;
+	}
+	if ((rv = xbps_transaction_init(xhp)) != 0) {
+		xbps_object_release(d);
+		return rv;
+	}
+	/* binary packages in cachedir are looked up again on this node */
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++)
+		xbps_dictionary_remove(xbps_array_get(pkgs, i), "download");
+	xbps_dictionary_set(xhp->transd, "packages", pkgs);
+	xbps_object_release(d);
+
+	memset(&xhp->stats, 0, sizeof(xhp->stats));
+	if ((rv = compute_transaction_stats(xhp)) != 0)
+		return rv;
+
+	xbps_dictionary_remove(xhp->transd, "missing_shlibs");
+	xbps_dictionary_remove(xhp->transd, "missing_deps");
+	xbps_dictionary_remove(xhp->transd, "conflicts");
+	xbps_dictionary_make_immutable(xhp->transd);
+
+	return 0;
+}
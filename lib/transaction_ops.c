@@ -58,6 +58,29 @@ enum {
 	TRANS_REINSTALL
 };
 
+/*
+ * Returns the package in repositories to update an installed package,
+ * from the repository it was installed from if it's locked.
+ */
+static xbps_dictionary_t
+trans_repo_pkg(struct xbps_handle *xhp, xbps_dictionary_t pkg_pkgdb,
+		const char *pkg)
+{
+	struct xbps_repo *repo;
+	const char *repoloc;
+	bool repolock = false;
+
+	xbps_dictionary_get_bool(pkg_pkgdb, "repolock", &repolock);
+	if (!repolock)
+		return xbps_rpool_get_pkg(xhp, pkg);
+
+	xbps_dictionary_get_cstring_nocopy(pkg_pkgdb, "repository", &repoloc);
+	assert(repoloc);
+	if ((repo = xbps_regget_repo(xhp, repoloc)) == NULL)
+		return NULL;
+	return xbps_repo_get_pkg(repo, pkg);
+}
+
 static int
 trans_find_pkg(struct xbps_handle *xhp, const char *pkg, bool reinstall,
 		bool hold)
@@ -102,22 +125,7 @@ trans_find_pkg(struct xbps_handle *xhp, const char *pkg, bool reinstall,
 			action = TRANS_REINSTALL;
 			reason = "install";
 		}
-		xbps_dictionary_get_bool(pkg_pkgdb, "repolock", &repolock);
-		if (repolock) {
-			struct xbps_repo *repo;
-			/* find update from repo */
-			xbps_dictionary_get_cstring_nocopy(pkg_pkgdb, "repository", &repoloc);
-			assert(repoloc);
-			if ((repo = xbps_regget_repo(xhp, repoloc)) == NULL) {
-				/* not found */
-				return ENOENT;
-			}
-			pkg_repod = xbps_repo_get_pkg(repo, pkg);
-		} else {
-			/* find update from rpool */
-			pkg_repod = xbps_rpool_get_pkg(xhp, pkg);
-		}
-		if (pkg_repod == NULL) {
+		if ((pkg_repod = trans_repo_pkg(xhp, pkg_pkgdb, pkg)) == NULL) {
 			/* not found */
 			return ENOENT;
 		}
@@ -224,13 +232,76 @@ trans_find_pkg(struct xbps_handle *xhp, const char *pkg, bool reinstall,
 	return 0;
 }
 
+/*
+ * Finding out which installed packages have an update only reads pkgdb
+ * and the repository pool, so it is done for all packages in parallel;
+ * the packages found are then added to the transaction one at a time,
+ * in pkgdb order.
+ */
+static void *
+update_cands_init(void *arg UNUSED)
+{
+	return xbps_array_create();
+}
+
+static int
+update_cands_cb(struct xbps_handle *xhp, xbps_object_t obj, const char *key,
+		void *acc, bool *done UNUSED)
+{
+	xbps_dictionary_t pkg_repod;
+	const char *instpkgver, *repopkgver, *repoloc;
+
+	if (!xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &instpkgver))
+		return 0;
+	if ((pkg_repod = trans_repo_pkg(xhp, obj, key)) == NULL)
+		return 0;
+	xbps_dictionary_get_cstring_nocopy(pkg_repod, "pkgver", &repopkgver);
+	if (xbps_cmpver(repopkgver, instpkgver) <= 0 &&
+	    !xbps_pkg_reverts(pkg_repod, instpkgver)) {
+		xbps_dictionary_get_cstring_nocopy(pkg_repod,
+		    "repository", &repoloc);
+		xbps_dbg_printf(xhp, "[rpool] Skipping `%s' "
+		    "(installed: %s) from repository `%s'\n",
+		    repopkgver, instpkgver, repoloc);
+		return 0;
+	}
+	return xbps_array_add_cstring(acc, key) ? 0 : ENOMEM;
+}
+
+static int
+update_cands_merge(void *arg, void *acc)
+{
+	xbps_array_t cands = arg;
+	xbps_object_t obj;
+
+	for (unsigned int i = 0; i < xbps_array_count(acc); i++) {
+		obj = xbps_array_get(acc, i);
+		if (!xbps_array_add(cands, obj))
+			return ENOMEM;
+	}
+	return 0;
+}
+
+static void
+update_cands_fini(void *acc)
+{
+	xbps_object_release(acc);
+}
+
 int
 xbps_transaction_update_packages(struct xbps_handle *xhp)
 {
+	struct xbps_reduce ops = {
+		.init = update_cands_init,
+		.fn = update_cands_cb,
+		.merge = update_cands_merge,
+		.fini = update_cands_fini,
+	};
 	xbps_dictionary_t pkgd;
+	xbps_array_t cands;
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
-	const char *pkgver;
+	const char *key, *pkgver;
 	char *pkgname;
 	bool hold, newpkg_found = false;
 	int rv = 0;
@@ -254,12 +325,29 @@ xbps_transaction_update_packages(struct xbps_handle *xhp)
 		free(pkgname);
 	}
 
-	iter = xbps_dictionary_iterator(xhp->pkgdb);
-	assert(iter);
+	if ((cands = xbps_array_create()) == NULL)
+		return ENOMEM;
+	if (xbps_rpool_concurrent(xhp)) {
+		ops.arg = cands;
+		if ((rv = xbps_pkgdb_foreach_reduce(xhp, &ops)) != 0) {
+			xbps_object_release(cands);
+			return rv;
+		}
+	} else {
+		/* the pool is not safe to share, look them up one by one */
+		iter = xbps_dictionary_iterator(xhp->pkgdb);
+		assert(iter);
+		while ((obj = xbps_object_iterator_next(iter))) {
+			key = xbps_dictionary_keysym_cstring_nocopy(obj);
+			xbps_array_add_cstring(cands, key);
+		}
+		xbps_object_iterator_release(iter);
+	}
 
-	while ((obj = xbps_object_iterator_next(iter))) {
+	for (unsigned int i = 0; i < xbps_array_count(cands); i++) {
 		hold = false;
-		pkgd = xbps_dictionary_get_keysym(xhp->pkgdb, obj);
+		xbps_array_get_cstring_nocopy(cands, i, &key);
+		pkgd = xbps_dictionary_get(xhp->pkgdb, key);
 		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
 			continue;
 		xbps_dictionary_get_bool(pkgd, "hold", &hold);
@@ -281,7 +369,7 @@ xbps_transaction_update_packages(struct xbps_handle *xhp)
 		}
 		free(pkgname);
 	}
-	xbps_object_iterator_release(iter);
+	xbps_object_release(cands);
 
 	return newpkg_found ? rv : EEXIST;
 }
@@ -343,10 +431,13 @@ xbps_transaction_remove_pkg(struct xbps_handle *xhp,
 		obj = xbps_array_get(orphans, i);
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
 		xbps_dictionary_set_cstring_nocopy(obj, "transaction", "remove");
-		if ((rv = xbps_transaction_store(xhp, pkgs, obj, "remove", false)) != 0)
-			return EINVAL;
+		if ((rv = xbps_transaction_store(xhp, pkgs, obj, "remove", false)) != 0) {
+			rv = EINVAL;
+			break;
+		}
 		xbps_dbg_printf(xhp, "%s: added into transaction (remove).\n", pkgver);
 	}
+	xbps_object_release(orphans);
 	return rv;
 
 rmpkg:
@@ -390,6 +481,7 @@ xbps_transaction_autoremove_pkgs(struct xbps_handle *xhp)
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
 		xbps_dictionary_set_cstring_nocopy(obj,
 		    "transaction", "remove");
+		xbps_pkgd_set_pkgname(obj);
 		xbps_array_add(pkgs, obj);
 		xbps_dbg_printf(xhp, "%s: added (remove).\n", pkgver);
 	}
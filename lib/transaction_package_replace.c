@@ -33,35 +33,97 @@
 
 #include "xbps_api_impl.h"
 
+/*
+ * The packages in the transaction by pkgname, as the first match of
+ * xbps_find_pkg_in_array(): replaced packages are added to the head of
+ * the array and take the place of those with the same name.
+ */
+static bool
+replace_map_set(xbps_dictionary_t map, xbps_dictionary_t pkgd, bool head)
+{
+	const char *pkgver, *pkgname;
+	char buf[XBPS_NAME_SIZE], *alloc;
+	bool rv = true;
+
+	if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgname", &pkgname)) {
+		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+			return true;
+		if ((pkgname = xbps_pkgname_get(buf, sizeof(buf), pkgver,
+		    &alloc)) == NULL)
+			return true;
+	} else {
+		alloc = NULL;
+	}
+	if (head || xbps_dictionary_get(map, pkgname) == NULL)
+		rv = xbps_dictionary_set(map, pkgname, pkgd);
+	free(alloc);
+	return rv;
+}
+
+/*
+ * xbps_transaction_store() adds "pkgname>=0" to the replaces of every
+ * package, that only matters when the package is not installed with
+ * the same name: a virtual package of another package is replaced.
+ */
+static bool
+replace_self(struct xbps_handle *xhp, const char *pkgname, const char *pattern)
+{
+	size_t len = strlen(pkgname);
+
+	return strncmp(pattern, pkgname, len) == 0 &&
+	    strcmp(pattern + len, ">=0") == 0 &&
+	    xbps_dictionary_get(xhp->pkgdb, pkgname) != NULL;
+}
+
 int HIDDEN
 xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 {
-	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+	xbps_dictionary_t map, *objs;
+	unsigned int count;
+	int rv = 0;
+
+	/*
+	 * Packages added to the transaction below are not processed,
+	 * iterate over those in it initially.
+	 */
+	count = xbps_array_count(pkgs);
+	if ((objs = calloc(count + 1, sizeof(*objs))) == NULL)
+		return ENOMEM;
+	if ((map = xbps_dictionary_create_hashed(count)) == NULL) {
+		free(objs);
+		return ENOMEM;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		objs[i] = xbps_array_get(pkgs, i);
+		if (!replace_map_set(map, objs[i], false)) {
+			rv = ENOMEM;
+			goto out;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
 		xbps_array_t replaces;
-		xbps_object_t obj, obj2;
-		xbps_object_iterator_t iter;
-		const char *pkgver;
-		char *pkgname;
+		xbps_dictionary_t obj = objs[i];
+		const char *pkgver, *pkgname;
+		char buf[XBPS_NAME_SIZE], *alloc;
 
-		obj = xbps_array_get(pkgs, i);
 		replaces = xbps_dictionary_get(obj, "replaces");
 		if (replaces == NULL || xbps_array_count(replaces) == 0)
 			continue;
 
-		iter = xbps_array_iterator(replaces);
-		assert(iter);
-
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
-		pkgname = xbps_pkg_name(pkgver);
+		pkgname = xbps_pkgname_get(buf, sizeof(buf), pkgver, &alloc);
 		assert(pkgname);
 
-		while ((obj2 = xbps_object_iterator_next(iter)) != NULL) {
+		for (unsigned int x = 0; x < xbps_array_count(replaces); x++) {
 			xbps_dictionary_t instd, reppkgd;
-			const char *tract, *pattern, *curpkgver;
-			char *curpkgname;
+			const char *tract, *pattern, *curpkgver, *curpkgname;
+			char curbuf[XBPS_NAME_SIZE], *curalloc;
 			bool instd_auto = false;
 
-			pattern = xbps_string_cstring_nocopy(obj2);
+			xbps_array_get_cstring_nocopy(replaces, x, &pattern);
+			if (replace_self(xhp, pkgname, pattern))
+				continue;
 			/*
 			 * Find the installed package that matches the pattern
 			 * to be replaced.
@@ -72,21 +134,22 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 
 			xbps_dictionary_get_cstring_nocopy(instd,
 			    "pkgver", &curpkgver);
-			curpkgname = xbps_pkg_name(curpkgver);
+			curpkgname = xbps_pkgname_get(curbuf, sizeof(curbuf),
+			    curpkgver, &curalloc);
 			assert(curpkgname);
 			/*
 			 * Check that we are not replacing the same package,
 			 * due to virtual packages.
 			 */
 			if (strcmp(pkgname, curpkgname) == 0) {
-				free(curpkgname);
+				free(curalloc);
 				continue;
 			}
 			/*
 			 * Make sure to not add duplicates.
 			 */
 			xbps_dictionary_get_bool(instd, "automatic-install", &instd_auto);
-			reppkgd = xbps_find_pkg_in_array(pkgs, curpkgname, NULL);
+			reppkgd = xbps_dictionary_get(map, curpkgname);
 			if (reppkgd) {
 				const char *rpkgver;
 
@@ -94,11 +157,12 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 				    "pkgver", &rpkgver);
 				xbps_dictionary_get_cstring_nocopy(reppkgd,
 				    "transaction", &tract);
-				if (strcmp(tract, "remove") == 0)
-					continue;
-				if (!xbps_match_virtual_pkg_in_dict(reppkgd, pattern) &&
-				    !xbps_pkgpattern_match(rpkgver, pattern))
+				if (strcmp(tract, "remove") == 0 ||
+				    (!xbps_match_virtual_pkg_in_dict(reppkgd, pattern) &&
+				    !xbps_pkgpattern_match(rpkgver, pattern))) {
+					free(curalloc);
 					continue;
+				}
 				/*
 				 * Package contains replaces="pkgpattern", but the
 				 * package that should be replaced is also in the
@@ -110,12 +174,11 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 				    "transaction", "remove");
 				xbps_dictionary_set_bool(reppkgd,
 				    "replaced", true);
-				xbps_array_replace_dict_by_name(pkgs,
-				    reppkgd, curpkgname);
 				xbps_dbg_printf(xhp,
 				    "Package `%s' in transaction will be "
 				    "replaced by `%s', matched with `%s'\n",
 				    curpkgver, pkgver, pattern);
+				free(curalloc);
 				continue;
 			}
 			/*
@@ -130,6 +193,7 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 			xbps_dbg_printf(xhp,
 			    "Package `%s' will be replaced by `%s', "
 			    "matched with `%s'\n", curpkgver, pkgver, pattern);
+			free(curalloc);
 			/*
 			 * Add package dictionary into the transaction and mark
 			 * it as to be "removed".
@@ -137,17 +201,18 @@ xbps_transaction_package_replace(struct xbps_handle *xhp, xbps_array_t pkgs)
 			xbps_dictionary_set_cstring_nocopy(instd,
 			    "transaction", "remove");
 			xbps_dictionary_set_bool(instd, "replaced", true);
-			if (!xbps_array_add_first(pkgs, instd)) {
-				xbps_object_iterator_release(iter);
-				free(pkgname);
-				free(curpkgname);
-				return EINVAL;
+			xbps_pkgd_set_pkgname(instd);
+			if (!xbps_array_add_first(pkgs, instd) ||
+			    !replace_map_set(map, instd, true)) {
+				free(alloc);
+				rv = EINVAL;
+				goto out;
 			}
-			free(curpkgname);
 		}
-		xbps_object_iterator_release(iter);
-		free(pkgname);
+		free(alloc);
 	}
-
-	return 0;
+out:
+	xbps_object_release(map);
+	free(objs);
+	return rv;
 }
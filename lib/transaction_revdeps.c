@@ -27,6 +27,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <time.h>
 
 #include "xbps_api_impl.h"
 
@@ -40,57 +41,161 @@
  *
  * Abort transaction if such case is found.
  */
+
+/*
+ * The run_depends of every revdep are compiled once per transaction:
+ * the pkgname matched by each pattern and the pattern itself.
+ */
+struct revdep_pattern {
+	const char *pattern;
+	char *vpkgname;		/* as matched against virtual packages */
+	char *pkgname;		/* as matched against real packages */
+	struct xbps_pattern *pat;
+};
+
+struct revdep {
+	xbps_dictionary_t pkgd;
+	xbps_array_t rundeps;
+	const char *pkgver;
+	struct revdep_pattern *deps;
+	unsigned int ndeps;
+};
+
+struct revdeps_cache {
+	xbps_dictionary_t idx;
+	struct revdep *revdeps;
+	unsigned int nrevdeps;
+	unsigned int size;
+};
+
+static void
+revdep_compile(struct revdep *rd, xbps_dictionary_t pkgd)
+{
+	rd->pkgd = pkgd;
+	rd->rundeps = xbps_dictionary_get(pkgd, "run_depends");
+	rd->pkgver = NULL;
+	xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &rd->pkgver);
+	rd->ndeps = xbps_array_count(rd->rundeps);
+	rd->deps = NULL;
+	if (rd->ndeps == 0)
+		return;
+
+	rd->deps = calloc(rd->ndeps, sizeof(*rd->deps));
+	assert(rd->deps);
+	for (unsigned int i = 0; i < rd->ndeps; i++) {
+		struct revdep_pattern *dep = &rd->deps[i];
+
+		xbps_array_get_cstring_nocopy(rd->rundeps, i, &dep->pattern);
+		if ((dep->vpkgname = xbps_pkgpattern_name(dep->pattern)) == NULL)
+			dep->vpkgname = xbps_pkg_name(dep->pattern);
+		if ((dep->pkgname = xbps_pkg_name(dep->pattern)) == NULL)
+			dep->pkgname = xbps_pkgpattern_name(dep->pattern);
+		dep->pat = xbps_pattern_compile(dep->pattern);
+		assert(dep->pat);
+	}
+}
+
+/*
+ * Returns the compiled revdep for pkgname, the package in transaction
+ * unless it's removed, otherwise the installed package.
+ */
+static struct revdep *
+revdeps_cache_get(struct xbps_handle *xhp, struct revdeps_cache *cache,
+		xbps_array_t pkgs, const char *pkgname, const char *pkgver)
+{
+	xbps_dictionary_t pkgd;
+	const char *tract;
+	uint32_t n;
+
+	if (xbps_dictionary_get_uint32(cache->idx, pkgname, &n))
+		return &cache->revdeps[n];
+
+	if ((pkgd = xbps_find_pkg_in_array(pkgs, pkgname, NULL))) {
+		xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &tract);
+		if (strcmp(tract, "remove") == 0)
+			pkgd = NULL;
+	}
+	if (pkgd == NULL)
+		pkgd = xbps_pkgdb_get_pkg(xhp, pkgver);
+
+	if (cache->nrevdeps == cache->size) {
+		cache->size = cache->size ? cache->size * 2 : 32;
+		cache->revdeps = realloc(cache->revdeps,
+		    cache->size * sizeof(*cache->revdeps));
+		assert(cache->revdeps);
+	}
+	revdep_compile(&cache->revdeps[cache->nrevdeps], pkgd);
+	xbps_dictionary_set_uint32(cache->idx, pkgname, cache->nrevdeps);
+
+	return &cache->revdeps[cache->nrevdeps++];
+}
+
+static void
+revdeps_cache_release(struct revdeps_cache *cache)
+{
+	for (unsigned int i = 0; i < cache->nrevdeps; i++) {
+		struct revdep *rd = &cache->revdeps[i];
+
+		for (unsigned int x = 0; x < rd->ndeps; x++) {
+			free(rd->deps[x].vpkgname);
+			free(rd->deps[x].pkgname);
+			xbps_pattern_free(rd->deps[x].pat);
+		}
+		free(rd->deps);
+	}
+	free(cache->revdeps);
+	xbps_object_release(cache->idx);
+}
+
+/*
+ * Same as xbps_match_pkgdep_in_array(rundeps, pkgver).
+ */
+static bool
+revdep_match_pkgver(struct revdep *rd, const char *pkgver)
+{
+	for (unsigned int i = 0; i < rd->ndeps; i++) {
+		if (xbps_pattern_match_compiled(rd->deps[i].pat, pkgver))
+			return true;
+	}
+	return false;
+}
+
 static bool
 check_virtual_pkgs(xbps_array_t mdeps,
 		   xbps_dictionary_t trans_pkgd,
-		   xbps_dictionary_t rev_pkgd)
+		   struct revdep *rd)
 {
 	xbps_array_t provides;
 	bool matched = false;
 
 	provides = xbps_dictionary_get(trans_pkgd, "provides");
 	for (unsigned int i = 0; i < xbps_array_count(provides); i++) {
-		xbps_array_t rundeps;
-		const char *pkgver, *revpkgver, *pkgpattern;
-		char *pkgname, *vpkgname, *vpkgver, *str;
-
-		pkgver = revpkgver = pkgpattern = NULL;
-		pkgname = vpkgname = vpkgver = str = NULL;
-
-		xbps_dictionary_get_cstring_nocopy(trans_pkgd, "pkgver", &pkgver);
-		xbps_dictionary_get_cstring_nocopy(rev_pkgd, "pkgver", &revpkgver);
-		xbps_array_get_cstring(provides, i, &vpkgver);
-		vpkgname = xbps_pkg_name(vpkgver);
-		assert(vpkgname);
-		rundeps = xbps_dictionary_get(rev_pkgd, "run_depends");
-		for (unsigned int x = 0; x < xbps_array_count(rundeps); x++) {
-			xbps_array_get_cstring_nocopy(rundeps, x, &pkgpattern);
-			if (((pkgname = xbps_pkgpattern_name(pkgpattern)) == NULL) &&
-			    ((pkgname = xbps_pkg_name(pkgpattern)) == NULL))
-				continue;
+		const char *vpkgver;
+		char *str;
+		size_t len;
 
-			if (strcmp(vpkgname, pkgname)) {
-				free(pkgname);
+		xbps_array_get_cstring_nocopy(provides, i, &vpkgver);
+		len = xbps_pkg_name_len(vpkgver);
+		assert(len);
+		for (unsigned int x = 0; x < rd->ndeps; x++) {
+			struct revdep_pattern *dep = &rd->deps[x];
+
+			if (dep->vpkgname == NULL ||
+			    strncmp(vpkgver, dep->vpkgname, len) ||
+			    dep->vpkgname[len] != '\0')
 				continue;
-			}
-			free(pkgname);
-			if (!strcmp(vpkgver, pkgpattern) ||
-			    xbps_pkgpattern_match(vpkgver, pkgpattern)) {
+			if (xbps_pattern_match_compiled(dep->pat, vpkgver))
 				continue;
-			}
 
 			str = xbps_xasprintf("%s broken, needs '%s' virtual pkg (got `%s')",
-			    revpkgver, pkgpattern, vpkgver);
+			    rd->pkgver, dep->pattern, vpkgver);
 			xbps_array_add_cstring(mdeps, str);
 			free(str);
 			matched = true;
 		}
-		free(vpkgname);
-		free(vpkgver);
 	}
 	return matched;
 }
-
 static void
 broken_pkg(xbps_array_t mdeps, const char *dep, const char *pkg, const char *trans)
 {
@@ -104,15 +209,21 @@ broken_pkg(xbps_array_t mdeps, const char *dep, const char *pkg, const char *tra
 void HIDDEN
 xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 {
+	struct revdeps_cache cache = { 0 };
+	struct timespec start, end;
 	xbps_array_t mdeps;
+	unsigned int nchecked = 0;
 
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
 	mdeps = xbps_dictionary_get(xhp->transd, "missing_deps");
+	cache.idx = xbps_dictionary_create_hashed(0);
+	assert(cache.idx);
 
 	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
 		xbps_array_t pkgrdeps;
 		xbps_object_t obj;
-		const char *pkgver, *tract;
-		char *pkgname;
+		const char *pkgver, *tract, *pkgname;
+		char buf[XBPS_NAME_SIZE], *alloc;
 
 		obj = xbps_array_get(pkgs, i);
 		/*
@@ -122,10 +233,10 @@ xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 		xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver);
 		xbps_dictionary_get_cstring_nocopy(obj, "transaction", &tract);
 
-		pkgname = xbps_pkg_name(pkgver);
+		pkgname = xbps_pkgname_get(buf, sizeof(buf), pkgver, &alloc);
 		assert(pkgname);
 		if (xbps_pkg_is_installed(xhp, pkgname) == 0) {
-			free(pkgname);
+			free(alloc);
 			continue;
 		}
 		/*
@@ -134,88 +245,59 @@ xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 		 */
 		pkgrdeps = xbps_pkgdb_get_pkg_revdeps(xhp, pkgname);
 		if (!xbps_array_count(pkgrdeps)) {
-			free(pkgname);
+			free(alloc);
 			continue;
 		}
-		free(pkgname);
 		/*
 		 * Time to validate revdeps for current pkg.
 		 */
 		for (unsigned int x = 0; x < xbps_array_count(pkgrdeps); x++) {
-			xbps_array_t rundeps;
-			xbps_dictionary_t revpkgd;
-			const char *curpkgver, *revpkgver, *curdep, *curtract;
-			char *curpkgname, *curdepname;
+			struct revdep *rd;
+			const char *curpkgver, *curpkgname;
+			char curbuf[XBPS_NAME_SIZE], *curalloc;
 			bool found = false;
 
 			xbps_array_get_cstring_nocopy(pkgrdeps, x, &curpkgver);
-			pkgname = xbps_pkg_name(curpkgver);
-			assert(pkgname);
-			if ((revpkgd = xbps_find_pkg_in_array(pkgs, pkgname, NULL))) {
-				xbps_dictionary_get_cstring_nocopy(revpkgd, "transaction", &curtract);
-				if (strcmp(curtract, "remove") == 0)
-					revpkgd = NULL;
-			}
-			if (revpkgd == NULL)
-				revpkgd = xbps_pkgdb_get_pkg(xhp, curpkgver);
-
-			xbps_dictionary_get_cstring_nocopy(revpkgd, "pkgver", &revpkgver);
+			curpkgname = xbps_pkgname_get(curbuf, sizeof(curbuf),
+			    curpkgver, &curalloc);
+			assert(curpkgname);
+			nchecked++;
 			/*
 			 * If target pkg is being removed, all its revdeps
 			 * will be broken unless those revdeps are also in
 			 * the transaction.
 			 */
 			if (strcmp(tract, "remove") == 0) {
-				if (xbps_dictionary_get(obj, "replaced")) {
-					free(pkgname);
-					continue;
-				}
-				if (xbps_find_pkg_in_array(pkgs, pkgname, "remove")) {
-					free(pkgname);
+				if (xbps_dictionary_get(obj, "replaced") ||
+				    xbps_find_pkg_in_array(pkgs, curpkgname, "remove")) {
+					free(curalloc);
 					continue;
 				}
-				free(pkgname);
+				free(curalloc);
 				broken_pkg(mdeps, curpkgver, pkgver, tract);
 				continue;
 			}
+			rd = revdeps_cache_get(xhp, &cache, pkgs, curpkgname, curpkgver);
 			/*
 			 * First try to match any supported virtual package.
 			 */
-			if (check_virtual_pkgs(mdeps, obj, revpkgd)) {
-				free(pkgname);
+			if (check_virtual_pkgs(mdeps, obj, rd)) {
+				free(curalloc);
 				continue;
 			}
-			/*
-			 * Try to match real dependencies.
-			 */
-			rundeps = xbps_dictionary_get(revpkgd, "run_depends");
 			/*
 			 * Find out what dependency is it.
 			 */
-			curpkgname = xbps_pkg_name(pkgver);
-			assert(curpkgname);
-
-			for (unsigned int j = 0; j < xbps_array_count(rundeps); j++) {
-				xbps_array_get_cstring_nocopy(rundeps, j, &curdep);
-				if (((curdepname = xbps_pkg_name(curdep)) == NULL) &&
-				    ((curdepname = xbps_pkgpattern_name(curdep)) == NULL))
+			for (unsigned int j = 0; j < rd->ndeps; j++) {
+				if (rd->deps[j].pkgname == NULL)
 					abort();
-
-				if (strcmp(curdepname, curpkgname) == 0) {
-					free(curdepname);
+				if (strcmp(rd->deps[j].pkgname, pkgname) == 0) {
 					found = true;
 					break;
 				}
-				free(curdepname);
 			}
-			free(curpkgname);
-
-			if (!found) {
-				free(pkgname);
-				continue;
-			}
-			if (xbps_match_pkgdep_in_array(rundeps, pkgver)) {
-				free(pkgname);
+			if (!found || revdep_match_pkgver(rd, pkgver)) {
+				free(curalloc);
 				continue;
 			}
 			/*
@@ -224,13 +306,20 @@ xbps_transaction_revdeps(struct xbps_handle *xhp, xbps_array_t pkgs)
 			 * if a new version of this conflicting package
 			 * is in the transaction.
 			 */
-			if (xbps_find_pkg_in_array(pkgs, pkgname, "update")) {
-				free(pkgname);
+			if (xbps_find_pkg_in_array(pkgs, curpkgname, "update")) {
+				free(curalloc);
 				continue;
 			}
-			free(pkgname);
+			free(curalloc);
 			broken_pkg(mdeps, curpkgver, pkgver, tract);
 		}
-
+		free(alloc);
 	}
+	revdeps_cache_release(&cache);
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	xbps_set_cb_state(xhp, XBPS_STATE_TRANS_REVDEPS, 0, NULL,
+	    "Checked %u reverse dependencies in %.3fs", nchecked,
+	    (end.tv_sec - start.tv_sec) +
+	    (end.tv_nsec - start.tv_nsec) / 1e9);
 }
@@ -44,141 +44,172 @@
  */
 
 static void
-shlib_register(xbps_dictionary_t d, const char *shlib, const char *pkgver)
+shlib_register(xbps_dictionary_t d, const char *shlib, const char *pkgname,
+		const char *pkgver)
 {
-	xbps_array_t array;
+	xbps_dictionary_t pkgs;
 	bool alloc = false;
 
-	if ((array = xbps_dictionary_get(d, shlib)) == NULL) {
+	if ((pkgs = xbps_dictionary_get(d, shlib)) == NULL) {
 		alloc = true;
-		array = xbps_array_create();
-		xbps_dictionary_set(d, shlib, array);
+		pkgs = xbps_dictionary_create();
+		assert(pkgs);
+		xbps_dictionary_set(d, shlib, pkgs);
 	}
-	if (!xbps_match_string_in_array(array, pkgver))
-		xbps_array_add_cstring_nocopy(array, pkgver);
+	xbps_dictionary_set_cstring_nocopy(pkgs, pkgname, pkgver);
 	if (alloc)
-		xbps_object_release(array);
+		xbps_object_release(pkgs);
 }
 
-static xbps_dictionary_t
-collect_shlibs(struct xbps_handle *xhp, xbps_array_t pkgs, bool req)
+/*
+ * Returns the pkgver of a package providing shlib after the transaction:
+ * a package in the transaction or, unless it's updated or removed by
+ * the transaction, an installed package.
+ */
+static const char *
+shlib_provider(struct xbps_handle *xhp, xbps_dictionary_t tpkgs,
+		xbps_dictionary_t tprovides, xbps_dictionary_t iprovides,
+		const char *shlib)
+{
+	xbps_array_t pkgs;
+	const char *pkgname, *pkgver = NULL;
+
+	if (xbps_dictionary_get_cstring_nocopy(tprovides, shlib, &pkgver))
+		return pkgver;
+
+	pkgs = xbps_dictionary_get(iprovides, shlib);
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_array_get_cstring_nocopy(pkgs, i, &pkgname);
+		if (xbps_dictionary_get(tpkgs, pkgname))
+			continue;
+		if (xbps_dictionary_get_cstring_nocopy(
+		    xbps_dictionary_get(xhp->pkgdb, pkgname), "pkgver", &pkgver))
+			return pkgver;
+	}
+	return NULL;
+}
+
+/*
+ * Only the sonames that can be broken by the transaction are checked:
+ * the shlib-requires of the packages to be installed or updated, and
+ * the sonames provided by the installed packages that are updated or
+ * removed, as required by installed packages not in the transaction.
+ */
+bool HIDDEN
+xbps_transaction_shlibs(struct xbps_handle *xhp, xbps_array_t pkgs, xbps_array_t mshlibs)
 {
 	xbps_object_t obj;
 	xbps_object_iterator_t iter;
-	xbps_dictionary_t d, pd;
-	const char *pkgver;
+	xbps_dictionary_t shlibs, iprovides, irequires;
+	xbps_dictionary_t tpkgs, tprovides, shrequires;
+	bool unmatched = false;
 
-	d = xbps_dictionary_create();
-	assert(d);
+	shlibs = xbps_pkgdb_get_shlibs(xhp);
+	iprovides = xbps_dictionary_get(shlibs, "shlib-provides");
+	irequires = xbps_dictionary_get(shlibs, "shlib-requires");
 
-	/* copy pkgdb to out temporary dictionary */
-	pd = xbps_dictionary_copy(xhp->pkgdb);
-	assert(pd);
+	tpkgs = xbps_dictionary_create_hashed(xbps_array_count(pkgs));
+	tprovides = xbps_dictionary_create_hashed(0);
+	shrequires = xbps_dictionary_create();
+	assert(tpkgs && tprovides && shrequires);
 
-	/*
-	 * copy pkgs from transaction to our dictionary, overriding them
-	 * if they were there from pkgdb.
-	 */
-	iter = xbps_array_iterator(pkgs);
-	assert(iter);
-	while ((obj = xbps_object_iterator_next(iter))) {
-		char *pkgname;
+	for (unsigned int i = 0; i < xbps_array_count(pkgs); i++) {
+		xbps_dictionary_t pkgd;
+		xbps_array_t shobjs;
+		const char *pkgver, *trans, *shlib, *pkgname;
+		char buf[XBPS_NAME_SIZE], *alloc;
 
-		if (!xbps_dictionary_get_cstring_nocopy(obj, "pkgver", &pkgver))
+		pkgd = xbps_array_get(pkgs, i);
+		if (!xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
 			continue;
-
-		pkgname = xbps_pkg_name(pkgver);
+		pkgname = xbps_pkgname_get(buf, sizeof(buf), pkgver, &alloc);
 		assert(pkgname);
-		xbps_dictionary_set(pd, pkgname, obj);
-		free(pkgname);
+		xbps_dictionary_set(tpkgs, pkgname, pkgd);
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &trans) &&
+		    strcmp(trans, "remove") == 0) {
+			free(alloc);
+			continue;
+		}
+		shobjs = xbps_dictionary_get(pkgd, "shlib-provides");
+		for (unsigned int x = 0; x < xbps_array_count(shobjs); x++) {
+			xbps_array_get_cstring_nocopy(shobjs, x, &shlib);
+			xbps_dictionary_set_cstring_nocopy(tprovides, shlib, pkgver);
+		}
+		shobjs = xbps_dictionary_get(pkgd, "shlib-requires");
+		for (unsigned int x = 0; x < xbps_array_count(shobjs); x++) {
+			xbps_array_get_cstring_nocopy(shobjs, x, &shlib);
+			shlib_register(shrequires, shlib, pkgname, pkgver);
+		}
+		free(alloc);
 	}
-	xbps_object_iterator_release(iter);
 
-	/*
-	 * iterate over our dictionary to collect shlib-{requires,provides}.
-	 */
-	iter = xbps_dictionary_iterator(pd);
+	/* installed packages requiring sonames of updated or removed pkgs */
+	iter = xbps_dictionary_iterator(tpkgs);
 	assert(iter);
-
 	while ((obj = xbps_object_iterator_next(iter))) {
 		xbps_array_t shobjs;
-		xbps_dictionary_t pkgd;
-		const char *trans;
-
-		pkgd = xbps_dictionary_get_keysym(pd, obj);
-		if (xbps_dictionary_get_cstring_nocopy(pkgd, "transaction", &trans)) {
-			if (!strcmp(trans, "remove"))
-				continue;
-		}
-		/*
-		 * If pkg does not have the required obj, pass to next one.
-		 */
-		xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver);
-		shobjs = xbps_dictionary_get(pkgd,
-				req ? "shlib-requires" : "shlib-provides");
-		if (shobjs == NULL)
-			continue;
+		const char *shlib;
 
+		shobjs = xbps_dictionary_get(xbps_dictionary_get(xhp->pkgdb,
+		    xbps_dictionary_keysym_cstring_nocopy(obj)), "shlib-provides");
 		for (unsigned int i = 0; i < xbps_array_count(shobjs); i++) {
-			const char *shlib;
+			xbps_array_t revdeps;
 
 			xbps_array_get_cstring_nocopy(shobjs, i, &shlib);
-			xbps_dbg_printf(xhp, "%s: registering %s for %s\n",
-			    pkgver, shlib, req ? "shlib-requires" : "shlib-provides");
-			if (req)
-				shlib_register(d, shlib, pkgver);
-			else
-				xbps_dictionary_set_cstring_nocopy(d, shlib, pkgver);
+			revdeps = xbps_dictionary_get(irequires, shlib);
+			for (unsigned int x = 0; x < xbps_array_count(revdeps); x++) {
+				const char *pkgname, *pkgver;
+
+				xbps_array_get_cstring_nocopy(revdeps, x, &pkgname);
+				if (xbps_dictionary_get(tpkgs, pkgname))
+					continue;
+				if (!xbps_dictionary_get_cstring_nocopy(
+				    xbps_dictionary_get(xhp->pkgdb, pkgname),
+				    "pkgver", &pkgver))
+					continue;
+				shlib_register(shrequires, shlib, pkgname, pkgver);
+			}
 		}
 	}
 	xbps_object_iterator_release(iter);
-	xbps_object_release(pd);
-	return d;
-}
-
-bool HIDDEN
-xbps_transaction_shlibs(struct xbps_handle *xhp, xbps_array_t pkgs, xbps_array_t mshlibs)
-{
-	xbps_object_t obj, obj2;
-	xbps_object_iterator_t iter;
-	xbps_dictionary_t shrequires, shprovides;
-	bool unmatched = false;
-
-	shrequires = collect_shlibs(xhp, pkgs, true);
-	shprovides = collect_shlibs(xhp, pkgs, false);
 
 	/* iterate over shlib-requires to find unmatched shlibs */
 	iter = xbps_dictionary_iterator(shrequires);
 	assert(iter);
 
 	while ((obj = xbps_object_iterator_next(iter))) {
-		xbps_array_t array;
+		xbps_object_iterator_t iter2;
+		xbps_object_t obj2;
+		xbps_dictionary_t revdeps;
 		const char *pkgver, *shlib;
 		char *buf;
 
 		shlib = xbps_dictionary_keysym_cstring_nocopy(obj);
 		xbps_dbg_printf(xhp, "%s: checking for `%s': ", __func__, shlib);
-		if ((obj2 = xbps_dictionary_get(shprovides, shlib))) {
-			xbps_dbg_printf_append(xhp, "provided by `%s'\n",
-			    xbps_string_cstring_nocopy(obj2));
+		if ((pkgver = shlib_provider(xhp, tpkgs, tprovides, iprovides, shlib))) {
+			xbps_dbg_printf_append(xhp, "provided by `%s'\n", pkgver);
 			continue;
 		}
 		xbps_dbg_printf_append(xhp, "not found\n");
 
 		unmatched = true;
-		array = xbps_dictionary_get_keysym(shrequires, obj);
-		for (unsigned int i = 0; i < xbps_array_count(array); i++) {
-			xbps_array_get_cstring_nocopy(array, i, &pkgver);
+		revdeps = xbps_dictionary_get_keysym(shrequires, obj);
+		iter2 = xbps_dictionary_iterator(revdeps);
+		assert(iter2);
+		while ((obj2 = xbps_object_iterator_next(iter2))) {
+			xbps_dictionary_get_cstring_nocopy(revdeps,
+			    xbps_dictionary_keysym_cstring_nocopy(obj2), &pkgver);
 			buf = xbps_xasprintf("%s: broken, unresolvable "
 			    "shlib `%s'", pkgver, shlib);
 			xbps_array_add_cstring(mshlibs, buf);
 			free(buf);
 		}
-		xbps_object_release(array);
+		xbps_object_iterator_release(iter2);
 	}
 	xbps_object_iterator_release(iter);
-	/* XXX: not possible to free shrequires without copying values */
-	xbps_object_release(shprovides);
+	xbps_object_release(shrequires);
+	xbps_object_release(tprovides);
+	xbps_object_release(tpkgs);
 
 	return unmatched;
 }
@@ -57,6 +57,13 @@ xbps_transaction_store(struct xbps_handle *xhp, xbps_array_t pkgs,
 	pkgname = xbps_pkg_name(pkgver);
 	assert(pkgname);
 	self_replaced = xbps_xasprintf("%s>=0", pkgname);
+	/* cache the pkgname for lookups by name */
+	if (!xbps_dictionary_get(pkgd, "pkgname") &&
+	    !xbps_dictionary_set_cstring(pkgd, "pkgname", pkgname)) {
+		free(self_replaced);
+		free(pkgname);
+		return EINVAL;
+	}
 	free(pkgname);
 	xbps_array_add_cstring(replaces, self_replaced);
 	free(self_replaced);
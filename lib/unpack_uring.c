@@ -0,0 +1,432 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#ifdef HAVE_IO_URING
+# define _GNU_SOURCE	/* for syscall(2) and MAP_POPULATE */
+#endif
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/openat2.h>
+#endif
+
+#include "xbps_api_impl.h"
+
+#ifdef HAVE_IO_URING
+/*
+ * Small regular files of binary packages can be written through io_uring,
+ * rather than with one syscall at a time by archive_write_disk(3): their
+ * data is buffered and up to URING_FILES of them are written at once,
+ * each with a linked openat2/write/close chain on its own direct
+ * descriptor. Timestamps are set afterwards, as there's no operation
+ * for them.
+ *
+ * Only files that archive_write_disk(3) would create with a single open
+ * are written here: new files whose parent directory exists, with
+ * permissions that aren't masked by the umask set to unpack packages
+ * and, if running as root, owned by root. Paths are resolved without
+ * following symlinks nor escaping the rootdir, as the SECURE extract
+ * flags do; files failing to open are extracted by archive_write_disk(3),
+ * which reports the errors.
+ */
+#define URING_FILES	64
+#define URING_MAXSIZE	(128 * 1024)
+#define URING_MAXBUF	(4 * 1024 * 1024)
+
+struct uring_file {
+	struct archive_entry *entry;
+	struct open_how how;
+	void *buf;
+	size_t len;
+	int res[3];
+};
+
+struct xbps_uring {
+	struct xbps_handle *xhp;
+	int fd;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	struct uring_file files[URING_FILES];
+	unsigned int nfiles;
+	size_t buflen;
+	char lastdir[PATH_MAX];
+};
+
+static void
+uring_unmap(struct xbps_uring *u)
+{
+	if (u->sqes != NULL && u->sqes != MAP_FAILED)
+		(void)munmap(u->sqes, u->sqes_len);
+	if (u->cq_ptr != NULL && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+		(void)munmap(u->cq_ptr, u->cq_len);
+	if (u->sq_ptr != NULL && u->sq_ptr != MAP_FAILED)
+		(void)munmap(u->sq_ptr, u->sq_len);
+	(void)close(u->fd);
+}
+
+struct xbps_uring HIDDEN *
+xbps_uring_new(struct xbps_handle *xhp)
+{
+	struct io_uring_params p;
+	struct xbps_uring *u;
+	int fds[URING_FILES];
+
+	u = calloc(1, sizeof(*u));
+	assert(u);
+	u->xhp = xhp;
+
+	memset(&p, 0, sizeof(p));
+	if ((u->fd = (int)syscall(__NR_io_uring_setup, URING_FILES * 3, &p)) == -1) {
+		xbps_dbg_printf(xhp, "io_uring unavailable: %s\n", strerror(errno));
+		free(u);
+		return NULL;
+	}
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->sq_len = u->cq_len = MAX(u->sq_len, u->cq_len);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED)
+			goto fail;
+	}
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto fail;
+
+	u->sq_head = (unsigned int *)((char *)u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned int *)((char *)u->sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((char *)u->sq_ptr + p.sq_off.array);
+	u->cq_head = (unsigned int *)((char *)u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+	/* an empty table for the direct descriptors */
+	for (unsigned int i = 0; i < URING_FILES; i++)
+		fds[i] = -1;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_FILES,
+	    fds, URING_FILES) == -1)
+		goto fail;
+
+	return u;
+fail:
+	xbps_dbg_printf(xhp, "io_uring setup failed: %s\n", strerror(errno));
+	uring_unmap(u);
+	free(u);
+	return NULL;
+}
+
+bool HIDDEN
+xbps_uring_can_write(struct xbps_uring *u, struct archive_entry *entry,
+		uid_t euid)
+{
+	struct stat st;
+	const char *path;
+	char *dir, *p;
+
+	if (archive_entry_filetype(entry) != AE_IFREG ||
+	    archive_entry_hardlink(entry) != NULL ||
+	    archive_entry_sparse_count(entry) != 0 ||
+	    archive_entry_size(entry) > URING_MAXSIZE ||
+	    (archive_entry_perm(entry) & ~(mode_t)0755) != 0)
+		return false;
+	if (euid == 0 && (archive_entry_uid(entry) != 0 ||
+	    archive_entry_gid(entry) != 0 || getegid() != 0))
+		return false;
+
+	path = archive_entry_pathname(entry);
+	if ((p = strdup(path)) == NULL)
+		return false;
+	dir = dirname(p);
+	if (strcmp(dir, u->lastdir) == 0) {
+		free(p);
+		return true;
+	}
+	/* archive_write_disk(3) creates missing directories */
+	if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode) ||
+	    strlen(dir) >= sizeof(u->lastdir)) {
+		free(p);
+		return false;
+	}
+	xbps_strlcpy(u->lastdir, dir, sizeof(u->lastdir));
+	free(p);
+	return true;
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(struct xbps_uring *u, unsigned int *tail)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int idx;
+
+	idx = *tail & *u->sq_mask;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_array[idx] = idx;
+	(*tail)++;
+
+	return sqe;
+}
+
+static int
+uring_submit(struct xbps_uring *u)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct uring_file *f;
+	unsigned int tail, head, nsqes = 0, tosubmit, ncqes = 0;
+	int rv;
+
+	tail = *u->sq_tail;
+	for (unsigned int i = 0; i < u->nfiles; i++) {
+		f = &u->files[i];
+		f->res[0] = f->res[1] = f->res[2] = -ECANCELED;
+
+		sqe = uring_get_sqe(u, &tail);
+		sqe->opcode = IORING_OP_OPENAT2;
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uintptr_t)archive_entry_pathname(f->entry);
+		sqe->len = sizeof(f->how);
+		sqe->off = (uintptr_t)&f->how;
+		sqe->file_index = i + 1;
+		sqe->user_data = i * 3;
+		nsqes++;
+
+		if (f->len > 0) {
+			sqe = uring_get_sqe(u, &tail);
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->flags = IOSQE_FIXED_FILE|IOSQE_IO_LINK;
+			sqe->fd = (int)i;
+			sqe->addr = (uintptr_t)f->buf;
+			sqe->len = (unsigned int)f->len;
+			sqe->user_data = i * 3 + 1;
+			nsqes++;
+		} else {
+			f->res[1] = 0;
+		}
+
+		sqe = uring_get_sqe(u, &tail);
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->file_index = i + 1;
+		sqe->user_data = i * 3 + 2;
+		nsqes++;
+	}
+	__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+	for (tosubmit = nsqes; ncqes < nsqes;) {
+		rv = (int)syscall(__NR_io_uring_enter, u->fd, tosubmit, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rv == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		tosubmit -= MIN((unsigned int)rv, tosubmit);
+		head = *u->cq_head;
+		while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &u->cqes[head & *u->cq_mask];
+			f = &u->files[cqe->user_data / 3];
+			f->res[cqe->user_data % 3] = cqe->res;
+			head++;
+			ncqes++;
+		}
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static void
+uring_release(struct xbps_uring *u)
+{
+	for (unsigned int i = 0; i < u->nfiles; i++) {
+		archive_entry_free(u->files[i].entry);
+		free(u->files[i].buf);
+	}
+	u->nfiles = 0;
+	u->buflen = 0;
+}
+
+int HIDDEN
+xbps_uring_flush(struct xbps_uring *u, struct archive *ext)
+{
+	struct timespec ts[2];
+	struct uring_file *f;
+	const char *path = NULL;
+	int rv;
+
+	if (u->nfiles == 0)
+		return 0;
+
+	if ((rv = uring_submit(u)) != 0) {
+		xbps_dbg_printf(u->xhp, "io_uring submission failed: %s\n",
+		    strerror(rv));
+		uring_release(u);
+		return rv;
+	}
+	for (unsigned int i = 0; i < u->nfiles; i++) {
+		f = &u->files[i];
+		path = archive_entry_pathname(f->entry);
+		if (f->res[0] < 0) {
+			/* nothing was created, let libarchive deal with it */
+			xbps_dbg_printf(u->xhp, "[unpack] io_uring: %s: %s, "
+			    "using libarchive\n", path, strerror(-f->res[0]));
+			if (archive_write_header(ext, f->entry) != ARCHIVE_OK ||
+			    (f->len > 0 && archive_write_data(ext, f->buf,
+			    f->len) != (ssize_t)f->len) ||
+			    archive_write_finish_entry(ext) != ARCHIVE_OK) {
+				rv = archive_errno(ext) ? archive_errno(ext) : EINVAL;
+				break;
+			}
+			continue;
+		}
+		if (f->res[1] < 0 || f->res[2] < 0) {
+			rv = f->res[1] < 0 ? -f->res[1] : -f->res[2];
+			break;
+		} else if ((size_t)f->res[1] != f->len) {
+			rv = EIO;
+			break;
+		}
+		ts[0].tv_sec = archive_entry_atime(f->entry);
+		ts[0].tv_nsec = archive_entry_atime_nsec(f->entry);
+		ts[1].tv_sec = archive_entry_mtime(f->entry);
+		ts[1].tv_nsec = archive_entry_mtime_nsec(f->entry);
+		if (utimensat(AT_FDCWD, path, ts, AT_SYMLINK_NOFOLLOW) == -1) {
+			rv = errno;
+			break;
+		}
+	}
+	if (rv != 0)
+		xbps_dbg_printf(u->xhp, "[unpack] io_uring: failed to write "
+		    "%s: %s\n", path, strerror(rv));
+	else
+		xbps_dbg_printf(u->xhp, "[unpack] io_uring: wrote %u files\n",
+		    u->nfiles);
+	uring_release(u);
+
+	return rv;
+}
+
+int HIDDEN
+xbps_uring_add(struct xbps_uring *u, struct archive *ext,
+		struct archive_entry *entry, void *buf, size_t len)
+{
+	struct uring_file *f;
+	int rv;
+
+	if (u->nfiles == URING_FILES || u->buflen + len > URING_MAXBUF) {
+		if ((rv = xbps_uring_flush(u, ext)) != 0) {
+			free(buf);
+			return rv;
+		}
+	}
+	f = &u->files[u->nfiles++];
+	f->entry = archive_entry_clone(entry);
+	assert(f->entry);
+	f->buf = buf;
+	f->len = len;
+	memset(&f->how, 0, sizeof(f->how));
+	/* direct descriptors can't be O_CLOEXEC, nor are they inherited */
+	f->how.flags = O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW;
+	f->how.mode = archive_entry_perm(entry);
+	f->how.resolve = RESOLVE_BENEATH|RESOLVE_NO_SYMLINKS|RESOLVE_NO_MAGICLINKS;
+	u->buflen += len;
+
+	return 0;
+}
+
+void HIDDEN
+xbps_uring_free(struct xbps_uring *u)
+{
+	if (u == NULL)
+		return;
+	uring_release(u);
+	uring_unmap(u);
+	free(u);
+}
+#else /* !HAVE_IO_URING */
+struct xbps_uring HIDDEN *
+xbps_uring_new(struct xbps_handle *xhp)
+{
+	xbps_dbg_printf(xhp, "io_uring unavailable: not supported\n");
+	return NULL;
+}
+
+bool HIDDEN
+xbps_uring_can_write(struct xbps_uring *u UNUSED,
+		struct archive_entry *entry UNUSED, uid_t euid UNUSED)
+{
+	return false;
+}
+
+int HIDDEN
+xbps_uring_add(struct xbps_uring *u UNUSED, struct archive *ext UNUSED,
+		struct archive_entry *entry UNUSED, void *buf, size_t len UNUSED)
+{
+	free(buf);
+	return ENOTSUP;
+}
+
+int HIDDEN
+xbps_uring_flush(struct xbps_uring *u UNUSED, struct archive *ext UNUSED)
+{
+	return 0;
+}
+
+void HIDDEN
+xbps_uring_free(struct xbps_uring *u UNUSED)
+{
+}
+#endif /* HAVE_IO_URING */
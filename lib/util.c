@@ -86,30 +86,45 @@ xbps_pkg_is_installed(struct xbps_handle *xhp, const char *pkg)
 	return 0; /* not fully installed */
 }
 
-const char *
-xbps_pkg_version(const char *pkg)
+/*
+ * Returns a pointer to the '-' that separates the pkgname and version
+ * of a pkgver, NULL if it's not a pkgver.
+ */
+static const char *
+pkgver_sep(const char *pkg)
 {
 	const char *p;
 
-	if ((p = strrchr(pkg, '-')) == NULL)
+	if ((p = strrchr(pkg, '-')) == NULL || strchr(p, '_') == NULL)
 		return NULL;
 
-	for (unsigned int i = 0; i < strlen(p); i++) {
-		if (p[i] == '_')
-			break;
-		if (isdigit((unsigned char)p[i]) && strchr(p, '_')) {
-			return p + 1; /* skip first '-' */
-		}
+	for (const char *s = p; *s && *s != '_'; s++) {
+		if (isdigit((unsigned char)*s))
+			return p;
 	}
 	return NULL;
 }
 
-char *
-xbps_binpkg_pkgver(const char *pkg)
+const char *
+xbps_pkg_version(const char *pkg)
 {
-	const char *fname;
-	char *p, *p1, *res;
-	unsigned int len;
+	const char *p;
+
+	if ((p = pkgver_sep(pkg)) == NULL)
+		return NULL;
+
+	return p + 1; /* skip first '-' */
+}
+
+/*
+ * Returns the pkgver component of a binary package filename and its
+ * length in len, NULL if it's not a binary package.
+ */
+static const char *
+binpkg_pkgver(const char *pkg, size_t *len)
+{
+	const char *fname, *p;
+	size_t flen;
 
 	/* skip path if found, only interested in filename */
 	if ((fname = strrchr(pkg, '/')))
@@ -118,24 +133,38 @@ xbps_binpkg_pkgver(const char *pkg)
 		fname = pkg;
 
 	/* 5 == .xbps */
-	len = strlen(fname) - 5;
-	p = malloc(len+1);
+	if ((flen = strlen(fname)) < 5)
+		return NULL;
+	flen -= 5;
+	/* skip the architecture */
+	p = fname + flen;
+	while (p > fname && *--p != '.')
+		;
+	if (*p != '.')
+		return NULL;
+
+	*len = (size_t)(p - fname);
+	return fname;
+}
+
+char *
+xbps_binpkg_pkgver(const char *pkg)
+{
+	const char *fname;
+	char *p;
+	size_t len;
+
+	if ((fname = binpkg_pkgver(pkg, &len)) == NULL)
+		return NULL;
+	p = strndup(fname, len);
 	assert(p);
-	(void)memcpy(p, fname, len);
-	p[len] = '\0';
-	p1 = strrchr(p, '.');
-	assert(p1);
-	p[strlen(p)-strlen(p1)] = '\0';
 
 	/* sanity check it's a proper pkgver string */
 	if (xbps_pkg_version(p) == NULL) {
 		free(p);
 		return NULL;
 	}
-	res = strdup(p);
-	assert(res);
-	free(p);
-	return res;
+	return p;
 }
 
 char *
@@ -181,61 +210,112 @@ xbps_pkg_revision(const char *pkg)
 	return p + 1; /* skip first '_' */
 }
 
+size_t
+xbps_pkg_name_len(const char *pkg)
+{
+	const char *p;
+
+	if ((p = pkgver_sep(pkg)) == NULL)
+		return 0;
+
+	return (size_t)(p - pkg);
+}
+
+bool
+xbps_pkg_name_buf(char *dst, size_t len, const char *pkg)
+{
+	const char *p;
+	size_t n;
+
+	if ((p = pkgver_sep(pkg)) == NULL)
+		return false;
+
+	if ((n = (size_t)(p - pkg)) >= len) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memcpy(dst, pkg, n);
+	dst[n] = '\0';
+
+	return true;
+}
+
 char *
 xbps_pkg_name(const char *pkg)
 {
 	const char *p;
 	char *buf;
-	unsigned int len;
-	bool valid = false;
 
-	if ((p = strrchr(pkg, '-')) == NULL)
-		return NULL;
-
-	for (unsigned int i = 0; i < strlen(p); i++) {
-		if (p[i] == '_')
-			break;
-		if (isdigit((unsigned char)p[i]) && strchr(p, '_')) {
-			valid = true;
-			break;
-		}
-	}
-	if (!valid)
+	if ((p = pkgver_sep(pkg)) == NULL)
 		return NULL;
 
-	len = strlen(pkg) - strlen(p) + 1;
-	buf = malloc(len);
+	buf = strndup(pkg, (size_t)(p - pkg));
 	assert(buf != NULL);
 
-	memcpy(buf, pkg, len-1);
-	buf[len-1] = '\0';
-
 	return buf;
 }
 
-char *
-xbps_pkgpattern_name(const char *pkg)
+/*
+ * Returns a pointer to the end of the pkgname in a package pattern,
+ * NULL if it's not a pattern.
+ */
+static const char *
+pkgpattern_sep(const char *pkg)
 {
-	char *res, *pkgname;
-	unsigned int len;
+	const char *res;
 
 	assert(pkg != NULL);
 
-	if ((res = strpbrk(pkg, "><*?[]")) == NULL)
+	if ((res = strpbrk(pkg, "><*?[]")) == NULL || res == pkg)
 		return NULL;
 
-	len = strlen(pkg) - strlen(res) + 1;
-	if (strlen(pkg) < len-2)
-		return NULL;
+	if (res[-1] == '-')
+		res--;
 
-	if (pkg[len-2] == '-')
-		len--;
+	return res;
+}
 
-	pkgname = malloc(len);
-	assert(pkgname != NULL);
+size_t
+xbps_pkgpattern_name_len(const char *pattern)
+{
+	const char *p;
 
-	memcpy(pkgname, pkg, len-1);
-	pkgname[len-1] = '\0';
+	if ((p = pkgpattern_sep(pattern)) == NULL)
+		return 0;
+
+	return (size_t)(p - pattern);
+}
+
+bool
+xbps_pkgpattern_name_buf(char *dst, size_t len, const char *pattern)
+{
+	const char *p;
+	size_t n;
+
+	if ((p = pkgpattern_sep(pattern)) == NULL)
+		return false;
+
+	if ((n = (size_t)(p - pattern)) >= len) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	memcpy(dst, pattern, n);
+	dst[n] = '\0';
+
+	return true;
+}
+
+char *
+xbps_pkgpattern_name(const char *pkg)
+{
+	const char *p;
+	char *pkgname;
+
+	if ((p = pkgpattern_sep(pkg)) == NULL)
+		return NULL;
+
+	pkgname = strndup(pkg, (size_t)(p - pkg));
+	assert(pkgname != NULL);
 
 	return pkgname;
 }
@@ -248,6 +328,32 @@ xbps_pkgpattern_version(const char *pkg)
 	return strpbrk(pkg, "><*?[]");
 }
 
+/*
+ * Returns the pkgname of a package pattern or pkgver in buf, or in a
+ * malloc(3)ed string stored in *alloc if it doesn't fit; NULL if pkg
+ * is neither.
+ */
+const char HIDDEN *
+xbps_pkgname_get(char *buf, size_t len, const char *pkg, char **alloc)
+{
+	size_t n;
+
+	*alloc = NULL;
+	if ((n = xbps_pkgpattern_name_len(pkg)) == 0 &&
+	    (n = xbps_pkg_name_len(pkg)) == 0)
+		return NULL;
+
+	if (n >= len) {
+		*alloc = strndup(pkg, n);
+		assert(*alloc);
+		return *alloc;
+	}
+	memcpy(buf, pkg, n);
+	buf[n] = '\0';
+
+	return buf;
+}
+
 char *
 xbps_repository_pkg_path(struct xbps_handle *xhp, xbps_dictionary_t pkg_repod)
 {
@@ -360,6 +466,8 @@ xbps_xasprintf(const char *fmt, ...)
 int
 xbps_pkgpattern_match(const char *pkg, const char *pattern)
 {
+	xbps_counter_inc(XBPS_COUNTER_PKGPATTERN_MATCH);
+
 	/* simple match on "pkg" against "pattern" */
 	if (strcmp(pattern, pkg) == 0)
 		return 1;
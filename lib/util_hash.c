@@ -22,6 +22,10 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#ifdef HAVE_MINCORE
+# define _GNU_SOURCE	/* for mincore(2) */
+#endif
+
 #include <sys/mman.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -33,6 +37,11 @@
 
 #include <openssl/sha.h>
 
+#ifdef HAVE_FSVERITY
+#include <sys/ioctl.h>
+#include <linux/fsverity.h>
+#endif
+
 #include "xbps_api_impl.h"
 
 /**
@@ -40,8 +49,8 @@
  * @brief Utility routines
  * @defgroup util Utility functions
  */
-static void
-digest2string(const uint8_t *digest, char *string, size_t len)
+void HIDDEN
+xbps_digest2string(const uint8_t *digest, char *string, size_t len)
 {
 	while (len--) {
 		if (*digest / 16 < 10)
@@ -93,13 +102,13 @@ xbps_mmap_file(const char *file, void **mmf, size_t *mmflen, size_t *filelen)
 	if ((st.st_size & pgmask) == 0)
 		need_guard = true;
 
-	mf = mmap(NULL, need_guard ? mapsize + pgsize : mapsize,
-	    PROT_READ, MAP_PRIVATE, fd, 0);
+	if (need_guard)
+		mapsize += pgsize;
+
+	mf = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
 	(void)close(fd);
-	if (mf == MAP_FAILED) {
-		(void)munmap(mf, mapsize);
+	if (mf == MAP_FAILED)
 		return false;
-	}
 
 	*mmf = mf;
 	*mmflen = mapsize;
@@ -108,57 +117,165 @@ xbps_mmap_file(const char *file, void **mmf, size_t *mmflen, size_t *filelen)
 	return true;
 }
 
-unsigned char *
-xbps_file_hash_raw(const char *file)
+/*
+ * Hashes the file and drops the pages that weren't cached before from
+ * the page cache; mincore(2) tells which ones were, so that hashing a
+ * file used by someone else doesn't evict it.
+ */
+static bool
+file_hash_low_cache(const char *file, SHA256_CTX *sha256)
 {
+	struct stat st;
+	size_t pgsize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t npages, i, j;
+	unsigned char *mf, *vec = NULL;
 	int fd;
+
+	if ((fd = open(file, O_RDONLY|O_CLOEXEC)) == -1)
+		return false;
+	if (fstat(fd, &st) == -1 || st.st_size > SSIZE_MAX - 1) {
+		(void)close(fd);
+		return false;
+	}
+	if (st.st_size == 0) {
+		(void)close(fd);
+		return true;
+	}
+	mf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mf == MAP_FAILED) {
+		(void)close(fd);
+		return false;
+	}
+	npages = ((size_t)st.st_size + pgsize - 1) / pgsize;
+#ifdef HAVE_MINCORE
+	vec = malloc(npages);
+	if (vec != NULL && mincore(mf, st.st_size, (void *)vec) == -1) {
+		free(vec);
+		vec = NULL;
+	}
+#endif
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	(void)posix_madvise(mf, st.st_size, POSIX_MADV_SEQUENTIAL);
+	SHA256_Update(sha256, mf, st.st_size);
+	xbps_counter_add(XBPS_COUNTER_HASH_BYTES, st.st_size);
+	(void)munmap(mf, st.st_size);
+
+	if (vec == NULL) {
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	} else {
+		for (i = 0; i < npages; i = j) {
+			for (j = i; j < npages && !(vec[j] & 1); j++)
+				;
+			if (j > i) {
+				(void)posix_fadvise(fd, (off_t)(i * pgsize),
+				    (off_t)((j - i) * pgsize), POSIX_FADV_DONTNEED);
+			}
+			while (j < npages && (vec[j] & 1))
+				j++;
+		}
+		free(vec);
+	}
+	(void)close(fd);
+
+	return true;
+}
+
+static bool
+file_hash_read(const char *file, SHA256_CTX *sha256)
+{
+	unsigned char buf[65536];
 	ssize_t len;
-	unsigned char *digest, buf[65536];
+	int fd;
+
+	if ((fd = open(file, O_RDONLY|O_CLOEXEC)) < 0)
+		return false;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		SHA256_Update(sha256, buf, len);
+		xbps_counter_add(XBPS_COUNTER_HASH_BYTES, len);
+	}
+	(void)close(fd);
+
+	return len == 0;
+}
+
+/*
+ * The file is mapped and handed to OpenSSL at once: its SHA256 block
+ * functions pick the SHA extensions (x86 SHA-NI, ARMv8 crypto) at runtime
+ * when the CPU provides them, so avoid copying the data through a buffer.
+ * Files that can't be mapped are read instead.
+ */
+static unsigned char *
+file_hash_raw(const char *file, bool low_cache)
+{
+	unsigned char *digest, *mf;
+	size_t mflen, filelen;
 	SHA256_CTX sha256;
+	uint64_t start;
 
-	if ((fd = open(file, O_RDONLY)) < 0)
-		return NULL;
-	digest = malloc(SHA256_DIGEST_LENGTH);
-	assert(digest);
+	start = xbps_trace_begin();
 	SHA256_Init(&sha256);
-	while ((len = read(fd, buf, sizeof(buf))) > 0)
-		SHA256_Update(&sha256, buf, len);
-	if(len < 0) {
-		free(digest);
+	if (low_cache && file_hash_low_cache(file, &sha256)) {
+		/* not left in the page cache */
+	} else if (xbps_mmap_file(file, (void *)&mf, &mflen, &filelen)) {
+		(void)posix_madvise(mf, mflen, POSIX_MADV_SEQUENTIAL);
+		SHA256_Update(&sha256, mf, filelen);
+		xbps_counter_add(XBPS_COUNTER_HASH_BYTES, filelen);
+		(void)munmap(mf, mflen);
+	} else if (!file_hash_read(file, &sha256)) {
 		return NULL;
 	}
+	digest = malloc(SHA256_DIGEST_LENGTH);
+	assert(digest);
 	SHA256_Final(digest, &sha256);
-	(void)close(fd);
+	xbps_trace_end(start, "hash", "sha256", file);
 
 	return digest;
 }
 
-char *
-xbps_file_hash(const char *file)
+unsigned char *
+xbps_file_hash_raw(const char *file)
+{
+	return file_hash_raw(file, false);
+}
+
+unsigned char HIDDEN *
+xbps_file_hash_raw_handle(struct xbps_handle *xhp, const char *file)
+{
+	return file_hash_raw(file, xhp->flags & XBPS_FLAG_LOW_CACHE);
+}
+
+static char *
+file_hash(const char *file, bool low_cache)
 {
 	char *hash;
 	unsigned char *digest;
 
-	if (!(digest = xbps_file_hash_raw(file)))
+	if (!(digest = file_hash_raw(file, low_cache)))
 		return NULL;
 
 	hash = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
 	assert(hash);
-	digest2string(digest, hash, SHA256_DIGEST_LENGTH);
+	xbps_digest2string(digest, hash, SHA256_DIGEST_LENGTH);
 	free(digest);
 
 	return hash;
 }
 
-int
-xbps_file_hash_check(const char *file, const char *sha256)
+char *
+xbps_file_hash(const char *file)
+{
+	return file_hash(file, false);
+}
+
+static int
+file_hash_check(const char *file, const char *sha256, bool low_cache)
 {
 	char *res;
 
 	assert(file != NULL);
 	assert(sha256 != NULL);
 
-	res = xbps_file_hash(file);
+	res = file_hash(file, low_cache);
 	if (res == NULL)
 		return errno;
 
@@ -171,71 +288,107 @@ xbps_file_hash_check(const char *file, const char *sha256)
 	return 0;
 }
 
-static const char *
-file_hash_dictionary(xbps_dictionary_t d, const char *key, const char *file)
+int
+xbps_file_hash_check(const char *file, const char *sha256)
 {
-	xbps_object_t obj;
-	xbps_object_iterator_t iter;
-	const char *curfile = NULL, *sha256 = NULL;
+	return file_hash_check(file, sha256, false);
+}
 
-	assert(xbps_object_type(d) == XBPS_TYPE_DICTIONARY);
-	assert(key != NULL);
-	assert(file != NULL);
+int
+xbps_file_hash_check_handle(struct xbps_handle *xhp, const char *file,
+		const char *sha256)
+{
+	assert(xhp != NULL);
+
+	return file_hash_check(file, sha256, xhp->flags & XBPS_FLAG_LOW_CACHE);
+}
+
+/*
+ * fs-verity digests are computed once by the kernel when verity is
+ * enabled on a file, and reading them back costs a single ioctl(2)
+ * no matter how big the file is.
+ */
+static char *
+file_verity(const char *file, bool enable)
+{
+#ifdef HAVE_FSVERITY
+	struct fsverity_enable_arg arg;
+	struct fsverity_digest *d;
+	char *hash;
+	int fd, rv = 0;
 
-	iter = xbps_array_iter_from_dict(d, key);
-	if (iter == NULL) {
-		errno = ENOENT;
+	if ((fd = open(file, O_RDONLY|O_NOFOLLOW|O_CLOEXEC)) == -1)
 		return NULL;
-	}
-	while ((obj = xbps_object_iterator_next(iter)) != NULL) {
-		xbps_dictionary_get_cstring_nocopy(obj,
-		    "file", &curfile);
-		if (strcmp(file, curfile) == 0) {
-			/* file matched */
-			xbps_dictionary_get_cstring_nocopy(obj,
-			    "sha256", &sha256);
-			break;
+	if (enable) {
+		memset(&arg, 0, sizeof(arg));
+		arg.version = 1;
+		arg.hash_algorithm = FS_VERITY_HASH_ALG_SHA256;
+		arg.block_size = (uint32_t)sysconf(_SC_PAGESIZE);
+		if (ioctl(fd, FS_IOC_ENABLE_VERITY, &arg) == -1 &&
+		    errno != EEXIST) {
+			rv = errno;
+			(void)close(fd);
+			errno = rv;
+			return NULL;
 		}
 	}
-	xbps_object_iterator_release(iter);
-	if (sha256 == NULL)
-		errno = ENOENT;
+	d = malloc(sizeof(*d) + SHA256_DIGEST_LENGTH);
+	assert(d);
+	d->digest_size = SHA256_DIGEST_LENGTH;
+	if (ioctl(fd, FS_IOC_MEASURE_VERITY, d) == -1)
+		rv = errno;
+	(void)close(fd);
+	if (rv == 0 && d->digest_algorithm != FS_VERITY_HASH_ALG_SHA256)
+		rv = ENOTSUP;
+	if (rv != 0) {
+		free(d);
+		errno = rv;
+		return NULL;
+	}
+	hash = malloc(SHA256_DIGEST_LENGTH * 2 + 1);
+	assert(hash);
+	xbps_digest2string(d->digest, hash, SHA256_DIGEST_LENGTH);
+	free(d);
 
-	return sha256;
+	return hash;
+#else
+	(void)file;
+	(void)enable;
+	errno = ENOTSUP;
+	return NULL;
+#endif
 }
 
-int HIDDEN
-xbps_file_hash_check_dictionary(struct xbps_handle *xhp,
-				xbps_dictionary_t d,
-				const char *key,
-				const char *file)
+char HIDDEN *
+xbps_file_verity_enable(const char *file)
 {
-	const char *sha256d = NULL;
-	char *buf;
-	int rv;
+	assert(file != NULL);
+	return file_verity(file, true);
+}
 
-	assert(xbps_object_type(d) == XBPS_TYPE_DICTIONARY);
-	assert(key != NULL);
+char *
+xbps_file_verity(const char *file)
+{
 	assert(file != NULL);
+	return file_verity(file, false);
+}
 
-	if ((sha256d = file_hash_dictionary(d, key, file)) == NULL) {
-		if (errno == ENOENT)
-			return 1; /* no match, file not found */
+int
+xbps_file_verity_check(const char *file, const char *digest)
+{
+	char *res;
 
-		return -1; /* error */
-	}
+	assert(file != NULL);
+	assert(digest != NULL);
 
-	if (strcmp(xhp->rootdir, "/") == 0) {
-		rv = xbps_file_hash_check(file, sha256d);
-	} else {
-		buf = xbps_xasprintf("%s/%s", xhp->rootdir, file);
-		rv = xbps_file_hash_check(buf, sha256d);
-		free(buf);
+	if ((res = xbps_file_verity(file)) == NULL)
+		return errno;
+
+	if (strcmp(digest, res)) {
+		free(res);
+		return ERANGE;
 	}
-	if (rv == 0)
-		return 0; /* matched */
-	else if (rv == ERANGE || rv == ENOENT)
-		return 1; /* no match */
-	else
-		return -1; /* error */
+	free(res);
+
+	return 0;
 }
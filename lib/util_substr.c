@@ -0,0 +1,226 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "xbps_api_impl.h"
+
+/*
+ * Substring search for a needle compiled once and matched against many
+ * strings, optionally ignoring the case of ASCII letters like
+ * strcasestr(3) does in the C locale.
+ *
+ * Every block of the string is compared with the first and last bytes
+ * of the needle at once, and only the positions matching both are
+ * compared with the rest of it: the SIMD width is chosen at build time,
+ * strings shorter than a block are compared byte by byte.
+ */
+struct xbps_substr {
+	size_t len;
+	bool icase;
+	char needle[];
+};
+
+static inline unsigned char
+fold(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static bool
+substr_equal(const struct xbps_substr *ss, const char *s, size_t off)
+{
+	if (!ss->icase)
+		return memcmp(s + off, ss->needle + off, ss->len - off) == 0;
+
+	for (size_t i = off; i < ss->len; i++) {
+		if (fold((unsigned char)s[i]) != (unsigned char)ss->needle[i])
+			return false;
+	}
+	return true;
+}
+
+#if defined(__AVX2__)
+#define BLOCK_SIZE	32
+#define BLOCK_STEP	1
+
+static inline __m256i
+block_fold(__m256i x)
+{
+	__m256i t, m;
+
+	/* 'A'..'Z' are moved to -128..-103 to compare them as signed */
+	t = _mm256_add_epi8(x, _mm256_set1_epi8((char)(0x80 - 'A')));
+	m = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)), t);
+	return _mm256_or_si256(x, _mm256_and_si256(m, _mm256_set1_epi8(0x20)));
+}
+
+static inline uint64_t
+block_match(const struct xbps_substr *ss, const char *s)
+{
+	__m256i first, last;
+
+	first = _mm256_loadu_si256((const void *)s);
+	last = _mm256_loadu_si256((const void *)(s + ss->len - 1));
+	if (ss->icase) {
+		first = block_fold(first);
+		last = block_fold(last);
+	}
+	first = _mm256_cmpeq_epi8(first, _mm256_set1_epi8(ss->needle[0]));
+	last = _mm256_cmpeq_epi8(last, _mm256_set1_epi8(ss->needle[ss->len - 1]));
+	return (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(first, last));
+}
+#elif defined(__SSE2__)
+#define BLOCK_SIZE	16
+#define BLOCK_STEP	1
+
+static inline __m128i
+block_fold(__m128i x)
+{
+	__m128i t, m;
+
+	/* 'A'..'Z' are moved to -128..-103 to compare them as signed */
+	t = _mm_add_epi8(x, _mm_set1_epi8((char)(0x80 - 'A')));
+	m = _mm_cmplt_epi8(t, _mm_set1_epi8((char)(-128 + 26)));
+	return _mm_or_si128(x, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+}
+
+static inline uint64_t
+block_match(const struct xbps_substr *ss, const char *s)
+{
+	__m128i first, last;
+
+	first = _mm_loadu_si128((const void *)s);
+	last = _mm_loadu_si128((const void *)(s + ss->len - 1));
+	if (ss->icase) {
+		first = block_fold(first);
+		last = block_fold(last);
+	}
+	first = _mm_cmpeq_epi8(first, _mm_set1_epi8(ss->needle[0]));
+	last = _mm_cmpeq_epi8(last, _mm_set1_epi8(ss->needle[ss->len - 1]));
+	return (uint32_t)_mm_movemask_epi8(_mm_and_si128(first, last));
+}
+#elif defined(__ARM_NEON)
+#define BLOCK_SIZE	16
+#define BLOCK_STEP	4
+
+static inline uint8x16_t
+block_fold(uint8x16_t x)
+{
+	uint8x16_t m;
+
+	m = vcltq_u8(vsubq_u8(x, vdupq_n_u8('A')), vdupq_n_u8(26));
+	return vorrq_u8(x, vandq_u8(m, vdupq_n_u8(0x20)));
+}
+
+/* NEON has no movemask, every byte is narrowed to 4 bits of the mask */
+static inline uint64_t
+block_match(const struct xbps_substr *ss, const char *s)
+{
+	uint8x16_t first, last, eq;
+
+	first = vld1q_u8((const uint8_t *)s);
+	last = vld1q_u8((const uint8_t *)(s + ss->len - 1));
+	if (ss->icase) {
+		first = block_fold(first);
+		last = block_fold(last);
+	}
+	eq = vandq_u8(vceqq_u8(first, vdupq_n_u8((uint8_t)ss->needle[0])),
+	    vceqq_u8(last, vdupq_n_u8((uint8_t)ss->needle[ss->len - 1])));
+	return vget_lane_u64(vreinterpret_u64_u8(
+	    vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0) &
+	    UINT64_C(0x8888888888888888);
+}
+#endif
+
+struct xbps_substr *
+xbps_substr_new(const char *needle, bool icase)
+{
+	struct xbps_substr *ss;
+	size_t len;
+
+	assert(needle);
+
+	len = strlen(needle);
+	if ((ss = malloc(sizeof(*ss) + len + 1)) == NULL)
+		return NULL;
+	ss->len = len;
+	ss->icase = icase;
+	for (size_t i = 0; i <= len; i++)
+		ss->needle[i] = icase ? (char)fold((unsigned char)needle[i]) : needle[i];
+
+	return ss;
+}
+
+const char *
+xbps_substr_find(const struct xbps_substr *ss, const char *s)
+{
+	size_t i = 0, n;
+	unsigned char c;
+
+	assert(ss);
+	assert(s);
+
+	if (ss->len == 0)
+		return s;
+	n = strlen(s);
+	if (n < ss->len)
+		return NULL;
+#ifdef BLOCK_SIZE
+	for (; i + ss->len - 1 + BLOCK_SIZE <= n; i += BLOCK_SIZE) {
+		uint64_t mask = block_match(ss, s + i);
+
+		while (mask != 0) {
+			size_t pos = i + (size_t)__builtin_ctzll(mask) / BLOCK_STEP;
+
+			if (substr_equal(ss, s + pos, 1))
+				return s + pos;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	c = (unsigned char)ss->needle[0];
+	for (; i + ss->len <= n; i++) {
+		if ((ss->icase ? fold((unsigned char)s[i]) : (unsigned char)s[i]) == c &&
+		    substr_equal(ss, s + i, 1))
+			return s + i;
+	}
+	return NULL;
+}
+
+void
+xbps_substr_free(struct xbps_substr *ss)
+{
+	free(ss);
+}
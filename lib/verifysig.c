@@ -31,50 +31,263 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 #include <openssl/err.h>
 #include <openssl/sha.h>
 #include <openssl/rsa.h>
 #include <openssl/ssl.h>
 #include <openssl/pem.h>
+#include <openssl/evp.h>
 
 #include "xbps_api_impl.h"
 
+/*
+ * The OpenSSL error strings and digests are only needed to verify
+ * signatures and fingerprint keys, they are set up once by the first
+ * of them rather than by xbps_init(): commands that don't verify
+ * anything never pay for it.
+ */
+static pthread_once_t crypto_once = PTHREAD_ONCE_INIT;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/*
+ * Older OpenSSL versions aren't thread safe without locking callbacks,
+ * binary packages may be verified concurrently.
+ */
+static pthread_mutex_t rsa_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Binary packages whose signature was verified, by path, with the
+ * fingerprint of the key, their signature and the identity of their file,
+ * kept in the handle and in its metadir.  If the verify_cache option is
+ * enabled, the signature of packages that didn't change isn't verified
+ * again; the inode and change time can't be kept while replacing or
+ * modifying a file.  Packages verified with XBPS_FLAG_DOWNLOAD_ONLY are
+ * recorded as "download-only", and skipped even if the option is disabled.
+ */
+#define VERIFY_CACHE	"verify-cache.plist"
+
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+crypto_init(void)
+{
+	ERR_load_crypto_strings();
+	SSL_load_error_strings();
+	OpenSSL_add_all_algorithms();
+}
+
+void HIDDEN
+xbps_crypto_init(void)
+{
+	pthread_once(&crypto_once, crypto_init);
+}
+
+static xbps_dictionary_t
+verify_cache_entry(const char *fname, const char *hexfp,
+		const void *sig, size_t siglen)
+{
+	xbps_dictionary_t d;
+	xbps_data_t data;
+	struct stat st;
+
+	if (stat(fname, &st) == -1)
+		return NULL;
+
+	d = xbps_dictionary_create();
+	assert(d);
+	data = xbps_data_create_data(sig, siglen);
+	assert(data);
+	xbps_dictionary_set_cstring(d, "fingerprint", hexfp);
+	xbps_dictionary_set(d, "signature", data);
+	xbps_object_release(data);
+	xbps_dictionary_set_uint64(d, "size", (uint64_t)st.st_size);
+	xbps_dictionary_set_uint64(d, "device", (uint64_t)st.st_dev);
+	xbps_dictionary_set_uint64(d, "inode", (uint64_t)st.st_ino);
+	xbps_dictionary_set_uint64(d, "mtime", (uint64_t)st.st_mtim.tv_sec);
+	xbps_dictionary_set_uint64(d, "mtime-nsec", (uint64_t)st.st_mtim.tv_nsec);
+	xbps_dictionary_set_uint64(d, "ctime", (uint64_t)st.st_ctim.tv_sec);
+	xbps_dictionary_set_uint64(d, "ctime-nsec", (uint64_t)st.st_ctim.tv_nsec);
+
+	return d;
+}
+
 static bool
-rsa_verify_hash(struct xbps_repo *repo, xbps_data_t pubkey,
-		unsigned char *sig, unsigned int siglen,
+verify_cache_lookup(struct xbps_handle *xhp, const char *fname,
+		xbps_dictionary_t entry)
+{
+	xbps_dictionary_t d;
+	char *path;
+	bool found;
+
+	pthread_mutex_lock(&cache_mtx);
+	if (xhp->verify_cache == NULL) {
+		path = xbps_xasprintf("%s/%s", xhp->metadir, VERIFY_CACHE);
+		xhp->verify_cache = xbps_dictionary_internalize_from_file(path);
+		free(path);
+		if (xhp->verify_cache == NULL)
+			xhp->verify_cache = xbps_dictionary_create();
+		assert(xhp->verify_cache);
+	}
+	d = xbps_dictionary_get(xhp->verify_cache, fname);
+	if (xbps_dictionary_get(d, "download-only") != NULL)
+		xbps_dictionary_set_bool(entry, "download-only", true);
+	else if (!(xhp->flags & XBPS_FLAG_VERIFY_CACHE))
+		d = NULL;
+	found = d != NULL && xbps_dictionary_equals(d, entry);
+	pthread_mutex_unlock(&cache_mtx);
+
+	return found;
+}
+
+static void
+verify_cache_add(struct xbps_handle *xhp, const char *fname,
+		xbps_dictionary_t entry)
+{
+	if (xhp->flags & XBPS_FLAG_DOWNLOAD_ONLY)
+		xbps_dictionary_set_bool(entry, "download-only", true);
+	else
+		xbps_dictionary_remove(entry, "download-only");
+
+	pthread_mutex_lock(&cache_mtx);
+	if (xhp->verify_cache != NULL) {
+		xbps_dictionary_set(xhp->verify_cache, fname, entry);
+		xhp->verify_cache_dirty = true;
+	}
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+/*
+ * Writes the verify cache if it was modified, without the packages
+ * that were removed.
+ */
+void HIDDEN
+xbps_verify_cache_release(struct xbps_handle *xhp)
+{
+	xbps_array_t allkeys;
+	const char *fname;
+	char *path;
+
+	pthread_mutex_lock(&cache_mtx);
+	if (xhp->verify_cache == NULL) {
+		pthread_mutex_unlock(&cache_mtx);
+		return;
+	}
+	if (xhp->verify_cache_dirty) {
+		allkeys = xbps_dictionary_all_keys(xhp->verify_cache);
+		for (unsigned int i = 0; i < xbps_array_count(allkeys); i++) {
+			fname = xbps_dictionary_keysym_cstring_nocopy(
+			    xbps_array_get(allkeys, i));
+			if (access(fname, F_OK) == -1)
+				xbps_dictionary_remove(xhp->verify_cache, fname);
+		}
+		xbps_object_release(allkeys);
+		path = xbps_xasprintf("%s/%s", xhp->metadir, VERIFY_CACHE);
+		if (!xbps_dictionary_externalize_to_file(xhp->verify_cache, path)) {
+			xbps_dbg_printf(xhp, "[verifysig] failed to write %s: "
+			    "%s\n", path, strerror(errno));
+		}
+		free(path);
+	}
+	xbps_object_release(xhp->verify_cache);
+	xhp->verify_cache = NULL;
+	xhp->verify_cache_dirty = false;
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+static bool
+rsa_verify_hash(EVP_PKEY *pkey, unsigned char *sig, unsigned int siglen,
 		unsigned char *sha256)
 {
-	BIO *bio;
 	RSA *rsa;
 	int rv;
 
-	ERR_load_crypto_strings();
-	SSL_load_error_strings();
+	if ((rsa = EVP_PKEY_get1_RSA(pkey)) == NULL)
+		return false;
+
+	rv = RSA_verify(NID_sha1, sha256, SHA256_DIGEST_LENGTH, sig, siglen, rsa);
+	RSA_free(rsa);
+
+	return rv ? true : false;
+}
+
+#ifdef EVP_PKEY_ED25519
+static bool
+ed25519_verify_hash(EVP_PKEY *pkey, unsigned char *sig, unsigned int siglen,
+		unsigned char *sha256)
+{
+	EVP_MD_CTX *mdctx;
+	bool rv = false;
+
+	if ((mdctx = EVP_MD_CTX_new()) == NULL)
+		return false;
+
+	if (EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) == 1 &&
+	    EVP_DigestVerify(mdctx, sig, siglen, sha256,
+	    SHA256_DIGEST_LENGTH) == 1)
+		rv = true;
+
+	EVP_MD_CTX_free(mdctx);
+
+	return rv;
+}
+#endif
+
+/*
+ * Verifies the signature of the sha256 digest with the public key,
+ * which must be of the scheme declared by the repository metadata
+ * ("signature-type"), RSA if unset.
+ */
+static bool
+verify_hash(struct xbps_repo *repo, xbps_data_t pubkey,
+		unsigned char *sig, unsigned int siglen,
+		unsigned char *sha256)
+{
+	EVP_PKEY *pkey;
+	BIO *bio;
+	const char *sigtype = "rsa";
+	bool rv = false;
+
+	xbps_dictionary_get_cstring_nocopy(repo->idxmeta, "signature-type", &sigtype);
+
+	xbps_crypto_init();
 
 	bio = BIO_new_mem_buf(__UNCONST(xbps_data_data_nocopy(pubkey)),
 			xbps_data_size(pubkey));
 	assert(bio);
 
-	rsa = PEM_read_bio_RSA_PUBKEY(bio, NULL, NULL, NULL);
-	if (rsa == NULL) {
+	pkey = PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+	if (pkey == NULL) {
 		xbps_dbg_printf(repo->xhp, "`%s' error reading public key: %s\n",
 		    repo->uri, ERR_error_string(ERR_get_error(), NULL));
+		BIO_free(bio);
 		return false;
 	}
 
-	rv = RSA_verify(NID_sha1, sha256, SHA256_DIGEST_LENGTH, sig, siglen, rsa);
-	RSA_free(rsa);
+	if (strcmp(sigtype, "rsa") == 0 &&
+	    EVP_PKEY_base_id(pkey) == EVP_PKEY_RSA) {
+		rv = rsa_verify_hash(pkey, sig, siglen, sha256);
+#ifdef EVP_PKEY_ED25519
+	} else if (strcmp(sigtype, "ed25519") == 0 &&
+	    EVP_PKEY_base_id(pkey) == EVP_PKEY_ED25519) {
+		rv = ed25519_verify_hash(pkey, sig, siglen, sha256);
+#endif
+	} else {
+		xbps_dbg_printf(repo->xhp, "`%s' unsupported signature type "
+		    "`%s' or mismatching public key\n", repo->uri, sigtype);
+	}
+	EVP_PKEY_free(pkey);
 	BIO_free(bio);
-	ERR_free_strings();
 
-	return rv ? true : false;
+	return rv;
 }
 
 bool
 xbps_verify_file_signature(struct xbps_repo *repo, const char *fname)
 {
-	xbps_dictionary_t repokeyd = NULL;
+	xbps_dictionary_t repokeyd = NULL, entry = NULL;
 	xbps_data_t pubkey;
 	char *hexfp = NULL;
 	unsigned char *digest = NULL, *sig_buf = NULL;
@@ -93,7 +306,7 @@ xbps_verify_file_signature(struct xbps_repo *repo, const char *fname)
 		return false;
 	}
 	/*
-	 * Prepare repository RSA public key to verify fname signature.
+	 * Prepare repository public key to verify fname signature.
 	 */
 	rkeyfile = xbps_xasprintf("%s/keys/%s.plist", repo->xhp->metadir, hexfp);
 	repokeyd = xbps_plist_dictionary_from_file(repo->xhp, rkeyfile);
@@ -108,22 +321,38 @@ xbps_verify_file_signature(struct xbps_repo *repo, const char *fname)
 		goto out;
 
 	/*
-	 * Prepare fname and signature data buffers.
+	 * Prepare signature and fname data buffers.
 	 */
-	if (!(digest = xbps_file_hash_raw(fname))) {
-		xbps_dbg_printf(repo->xhp, "can't open file %s: %s\n", fname, strerror(errno));
-		goto out;
-	}
 	sig = xbps_xasprintf("%s.sig", fname);
 	if (!xbps_mmap_file(sig, (void *)&sig_buf, &sigbuflen, &sigfilelen)) {
 		xbps_dbg_printf(repo->xhp, "can't open signature file %s: %s\n", sig, strerror(errno));
 		goto out;
 	}
+	if ((entry = verify_cache_entry(fname, hexfp, sig_buf, sigfilelen)) &&
+	    verify_cache_lookup(repo->xhp, fname, entry)) {
+		xbps_dbg_printf(repo->xhp, "[verifysig] %s: unchanged since "
+		    "verified.\n", fname);
+		val = true;
+		goto out;
+	}
+	if (!(digest = xbps_file_hash_raw_handle(repo->xhp, fname))) {
+		xbps_dbg_printf(repo->xhp, "can't open file %s: %s\n", fname, strerror(errno));
+		goto out;
+	}
 	/*
-	 * Verify fname RSA signature.
+	 * Verify fname signature.
 	 */
-	if (rsa_verify_hash(repo, pubkey, sig_buf, sigfilelen, digest))
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	pthread_mutex_lock(&rsa_mtx);
+#endif
+	if (verify_hash(repo, pubkey, sig_buf, sigfilelen, digest))
 		val = true;
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	pthread_mutex_unlock(&rsa_mtx);
+#endif
+	if (val && entry && (repo->xhp->flags &
+	    (XBPS_FLAG_VERIFY_CACHE|XBPS_FLAG_DOWNLOAD_ONLY)))
+		verify_cache_add(repo->xhp, fname, entry);
 
 out:
 	if (hexfp)
@@ -138,6 +367,8 @@ out:
 		free(sig);
 	if (repokeyd)
 		xbps_object_release(repokeyd);
+	if (entry)
+		xbps_object_release(entry);
 
 	return val;
 }
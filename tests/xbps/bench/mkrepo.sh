@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# Synthesizes a repository of binary packages with xbps-create(1), to be
+# indexed with xbps-rindex(1). The package graph is deterministic: the same
+# options always produce the same packages.
+#
+# Package pkgI (0 <= I < N) depends on up to FANOUT packages with a lower
+# index, spread over the whole range so that the dependency closure of the
+# last packages is deep and wide. Every PROVIDES-th package provides the
+# virtual package vpkgI, which is required by a package in the middle of
+# the next interval. With -s every package provides libpkgI.so.1 and
+# requires the shared libraries of its dependencies.
+
+usage() {
+	cat <<_EOF
+usage: ${0##*/} [-s] [-n npkgs] [-d fanout] [-p provides] [-f files]
+	[-j jobs] [-v version] destdir
+
+  -d fanout    Maximum number of dependencies per package (default 4)
+  -f files     Number of files per package (default 4)
+  -j jobs      Number of xbps-create processes run in parallel (default 1)
+  -n npkgs     Number of packages (default 1000)
+  -p provides  Every Nth package provides a virtual package, 0 disables it
+               (default 10)
+  -s           Set shlib-provides and shlib-requires
+  -v version   Version of all packages (default 1.0_1)
+_EOF
+	exit 1
+}
+
+npkgs=1000
+fanout=4
+provides=10
+files=4
+jobs=1
+version=1.0_1
+shlibs=
+
+while getopts "d:f:j:n:p:sv:" opt; do
+	case $opt in
+	d) fanout=$OPTARG;;
+	f) files=$OPTARG;;
+	j) jobs=$OPTARG;;
+	n) npkgs=$OPTARG;;
+	p) provides=$OPTARG;;
+	s) shlibs=1;;
+	v) version=$OPTARG;;
+	*) usage;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 1 ] || usage
+[ "$provides" -eq 0 -o "$provides" -ge 2 ] || usage
+
+destdir=$1
+mkdir -p "$destdir" || exit 1
+destdir=$(cd "$destdir" && pwd)
+stagedir=$(mktemp -d "${TMPDIR:-/tmp}/xbps-mkrepo.XXXXXX") || exit 1
+trap 'rm -rf "$stagedir"' EXIT INT TERM
+
+mkpkg() {
+	local i=$1 k=0 j step deps= shprov= shreq= prov= pkgdir
+
+	step=$((i / fanout))
+	[ $step -eq 0 ] && step=1
+	while [ $k -lt $fanout ]; do
+		j=$((i - 1 - k * step))
+		[ $j -lt 0 ] && break
+		deps="$deps pkg$j>=0"
+		shreq="$shreq libpkg$j.so.1"
+		k=$((k + 1))
+	done
+	if [ "$provides" -gt 0 ]; then
+		if [ $((i % provides)) -eq 0 ]; then
+			prov="vpkg$i-1.0_1"
+		elif [ $((i % provides)) -eq $((provides / 2)) -a $i -gt $provides ]; then
+			deps="$deps vpkg$((i / provides * provides))>=0"
+		fi
+	fi
+	[ -n "$shlibs" ] && shprov="libpkg$i.so.1" || shreq=
+
+	pkgdir=$stagedir/pkg$i
+	mkdir -p $pkgdir/usr/share/pkg$i
+	k=0
+	while [ $k -lt $files ]; do
+		echo "pkg$i file$k" > $pkgdir/usr/share/pkg$i/file$k
+		k=$((k + 1))
+	done
+	(cd "$destdir" && xbps-create -A noarch -n pkg$i-$version \
+		-s "synthetic package $i" -D "${deps# }" -P "$prov" \
+		--shlib-provides "$shprov" --shlib-requires "${shreq# }" \
+		$pkgdir >/dev/null) || return 1
+	rm -rf $pkgdir
+}
+
+i=0
+while [ $i -lt $npkgs ]; do
+	n=0
+	while [ $n -lt $jobs -a $i -lt $npkgs ]; do
+		mkpkg $i &
+		i=$((i + 1))
+		n=$((n + 1))
+	done
+	wait
+done
+i=0
+while [ $i -lt $npkgs ]; do
+	if [ ! -f "$destdir/pkg$i-$version.noarch.xbps" ]; then
+		echo "${0##*/}: failed to create pkg$i-$version" >&2
+		exit 1
+	fi
+	i=$((i + 1))
+done
+exit 0
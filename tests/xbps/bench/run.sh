@@ -0,0 +1,125 @@
+#!/bin/sh
+#
+# End-to-end benchmark harness: synthesizes two versions of a repository
+# with mkrepo.sh and times xbps-rindex(1), xbps-install(1), xbps-query(1)
+# and xbps-pkgdb(1) against them.
+#
+# Every result is printed as one JSON object per line:
+#
+#   {"name":"rindex-add","npkgs":1000,"runs":3,"seconds":0.412,"status":0}
+#
+# where seconds is the best wall clock time of all runs and status the
+# exit status of the last one.
+
+usage() {
+	cat <<_EOF
+usage: ${0##*/} [-k] [-r runs] [-t topdir] [-w workdir] [-o output]
+	[mkrepo.sh options]
+
+  -k          Keep the work directory
+  -o output   Append results to output instead of printing them
+  -r runs     Number of runs of every benchmark (default 3)
+  -t topdir   Use the binaries and library of a build tree
+  -w workdir  Work directory (default: a temporary directory)
+
+  The -d, -f, -j, -n, -p and -s options are passed to mkrepo.sh.
+_EOF
+	exit 1
+}
+
+runs=3
+keep=
+output=
+workdir=
+mkrepo_args=
+npkgs=1000
+
+while getopts "d:f:j:kn:o:p:r:st:w:" opt; do
+	case $opt in
+	d|f|j|p) mkrepo_args="$mkrepo_args -$opt $OPTARG";;
+	s) mkrepo_args="$mkrepo_args -s";;
+	n) npkgs=$OPTARG;;
+	k) keep=1;;
+	o) output=$OPTARG;;
+	r) runs=$OPTARG;;
+	t) topdir=$(cd "$OPTARG" && pwd) || exit 1;;
+	w) workdir=$OPTARG;;
+	*) usage;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 0 ] || usage
+
+if [ -n "$topdir" ]; then
+	for f in $topdir/bin/*; do
+		PATH=$f:$PATH
+	done
+	LD_LIBRARY_PATH=$topdir/lib${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}
+	export PATH LD_LIBRARY_PATH
+fi
+case "$(date +%N)" in
+*[!0-9]*|'') echo "${0##*/}: date(1) does not support %N" >&2; exit 1;;
+esac
+
+mkrepo=$(cd "$(dirname "$0")" && pwd)/mkrepo.sh
+if [ -z "$workdir" ]; then
+	workdir=$(mktemp -d "${TMPDIR:-/tmp}/xbps-bench.XXXXXX") || exit 1
+else
+	mkdir -p "$workdir" || exit 1
+fi
+W=$(cd "$workdir" && pwd)
+[ -z "$keep" ] && trap 'rm -rf "$W"' EXIT INT TERM
+
+# bench <name> <prepare> <command...>
+#
+# Runs <prepare> (evaluated, untimed) and <command> $runs times and
+# reports the best time.
+bench() {
+	local name=$1 prep=$2 r=0 t0 t1 best= rv
+
+	shift 2
+	while [ $r -lt $runs ]; do
+		eval "$prep"
+		t0=$(date +%s%N)
+		"$@" >/dev/null 2>&1
+		rv=$?
+		t1=$(date +%s%N)
+		if [ -z "$best" ] || [ $((t1 - t0)) -lt $best ]; then
+			best=$((t1 - t0))
+		fi
+		r=$((r + 1))
+	done
+	printf '{"name":"%s","npkgs":%d,"runs":%d,"seconds":%d.%09d,"status":%d}\n' \
+		"$name" $npkgs $runs $((best / 1000000000)) \
+		$((best % 1000000000)) $rv >> ${output:-/dev/stdout}
+}
+
+die() {
+	echo "${0##*/}: $*" >&2
+	exit 1
+}
+
+$mkrepo -n $npkgs $mkrepo_args -v 1.0_1 $W/r1 || die "mkrepo.sh failed"
+$mkrepo -n $npkgs $mkrepo_args -v 1.1_1 $W/r2 || die "mkrepo.sh failed"
+xbps-rindex -a $W/r2/*.xbps >/dev/null || die "xbps-rindex failed"
+
+bench rindex-add "rm -f $W/r1/*-repodata" xbps-rindex -a $W/r1/*.xbps
+bench rindex-clean "" xbps-rindex -c $W/r1
+
+mkdir -p $W/empty
+bench install-closure "" \
+	xbps-install -r $W/empty --repository=$W/r1 -n pkg$((npkgs - 1))
+
+xbps-install -r $W/root --repository=$W/r1 -y $(seq -f pkg%.0f 0 $((npkgs - 1))) \
+	>/dev/null || die "xbps-install failed"
+
+bench install-update "" xbps-install -r $W/root --repository=$W/r2 -un
+# startup of commands only reading pkgdb, with several repositories
+# configured: none of them should be opened
+repos="--repository=$W/r2 --repository=$W/r1 --repository=https://repo.invalid/current"
+bench query-list "" xbps-query -r $W/root $repos -l
+bench query-show "" xbps-query -r $W/root $repos -S pkg$((npkgs / 2))
+bench query-search "" xbps-query -r $W/root --repository=$W/r2 -Rs pkg1
+bench pkgdb-check "" xbps-pkgdb -r $W/root -a
+
+exit 0
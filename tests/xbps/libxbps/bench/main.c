@@ -0,0 +1,628 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ *
+ * Micro-benchmarks for the libxbps primitives that dominate dependency
+ * resolution and pkgdb handling.  Every benchmark runs a fixed number of
+ * iterations over fixed inputs, so that results can be compared between
+ * builds; time is reported in ns/op and heap allocations (malloc, calloc
+ * and realloc calls, including those made by libc on behalf of libxbps)
+ * in allocs/op.
+ *
+ * The pkgdb_lookup benchmarks split their iterations across the threads
+ * set with -j, to compare how lookups in mutable and immutable
+ * dictionaries scale.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <xbps.h>
+
+#define NPKGS		2000
+#define ARRAY_LEN	64
+#define HASH_FILE_SIZE	(1024 * 1024)
+#define MAXTHREADS	64
+
+/*
+ * Allocation counting: malloc(3) and friends are interposed and forwarded
+ * to the next definition.  dlsym(3) may itself allocate while resolving
+ * them, those requests are served from a small static buffer.
+ */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static char bootstrap[4096];
+static size_t bootstrap_used;
+static int resolving;
+static size_t nallocs;
+
+static void
+resolve_allocator(void)
+{
+	resolving = 1;
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	resolving = 0;
+	if (!real_malloc || !real_calloc || !real_realloc || !real_free)
+		abort();
+}
+
+static void *
+bootstrap_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + 15) & ~(size_t)15;
+	if (bootstrap_used + size > sizeof(bootstrap))
+		return NULL;
+	p = bootstrap + bootstrap_used;
+	bootstrap_used += size;
+	return p;
+}
+
+static int
+is_bootstrap(void *p)
+{
+	return (char *)p >= bootstrap && (char *)p < bootstrap + sizeof(bootstrap);
+}
+
+void *
+malloc(size_t size)
+{
+	if (real_malloc == NULL) {
+		if (resolving)
+			return bootstrap_alloc(size);
+		resolve_allocator();
+	}
+	nallocs++;
+	return real_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	if (real_calloc == NULL) {
+		if (resolving)
+			return bootstrap_alloc(nmemb * size);
+		resolve_allocator();
+	}
+	nallocs++;
+	return real_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if (real_realloc == NULL)
+		resolve_allocator();
+	nallocs++;
+	if (ptr && is_bootstrap(ptr)) {
+		if ((p = real_malloc(size)) != NULL)
+			memcpy(p, ptr, size);
+		return p;
+	}
+	return real_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+	if (ptr == NULL || is_bootstrap(ptr))
+		return;
+	if (real_free == NULL)
+		resolve_allocator();
+	real_free(ptr);
+}
+
+/*
+ * Fixed inputs.
+ */
+static const char *cmpver_pairs[][2] = {
+	{ "foo-1.0_1", "foo-1.0_2" },
+	{ "foo-2.30.1_1", "foo-2.4_1" },
+	{ "foo-1.0rc1_1", "foo-1.0_1" },
+	{ "foo-1.0alpha_1", "foo-1.0beta_1" },
+	{ "foo-20180723_1", "foo-20180723_1" },
+	{ "foo-1.2.3.4.5_1", "foo-1.2.3.4.6_1" },
+	{ "foo-1.0pl1_1", "foo-1.0_1" },
+	{ "foo-0.0.1.r2043.gb52c3a6_1", "foo-0.0.1.r2044.g7e1d8a2_1" },
+};
+
+static const char *pattern_pairs[][2] = {
+	{ "foo-1.0_1", "foo>=1.0" },
+	{ "foo-1.0_1", "foo>=0.5<2.0" },
+	{ "foo-1.0_1", "foo<1.0" },
+	{ "foo-1.0_1", "foo-1.0_1" },
+	{ "foo-1.0_1", "foo-[0-9]*" },
+	{ "foo-1.0_1", "foo-1.[0-9]*_1" },
+	{ "libfoo-devel-2.3_4", "libfoo-devel>2.0" },
+	{ "libfoo-devel-2.3_4", "libfoo-devel-2.3_4" },
+};
+
+static const char *pkgvers[] = {
+	"foo-1.0_1",
+	"font-adobe-100dpi-7.8_2",
+	"python-e_dbus-1.0_1",
+	"systemd-43_1",
+	"libfoo-devel-2.30.1_4",
+	"xorg-server-xwayland-1.20.1_1",
+	"perl-Text-Wrap-2013.0523_1",
+	"fs-utils-v1_1",
+};
+
+#define NELEM(a) (sizeof(a) / sizeof(a[0]))
+
+static volatile size_t sink;
+static xbps_dictionary_t pkgdb, frozen_pkgdb;
+static xbps_array_t pkgdb_keys, frozen_keys;
+static unsigned int nthreads = 1;
+static char *pkgdb_plist;
+static xbps_array_t pkgvers_array, patterns_array, provides_array;
+static char hash_file[] = "/tmp/xbps-bench.XXXXXX";
+
+/*
+ * Benchmarks.
+ */
+static void
+bench_cmpver(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		const char **p = cmpver_pairs[i % NELEM(cmpver_pairs)];
+		sink += (size_t)xbps_cmpver(p[0], p[1]);
+	}
+}
+
+static void
+bench_pkgpattern_match(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		const char **p = pattern_pairs[i % NELEM(pattern_pairs)];
+		sink += (size_t)xbps_pkgpattern_match(p[0], p[1]);
+	}
+}
+
+static void
+bench_pkg_name(size_t iters)
+{
+	char *pkgname;
+
+	for (size_t i = 0; i < iters; i++) {
+		pkgname = xbps_pkg_name(pkgvers[i % NELEM(pkgvers)]);
+		sink += (size_t)pkgname[0];
+		free(pkgname);
+	}
+}
+
+static void
+bench_file_hash(size_t iters)
+{
+	char *hash;
+
+	for (size_t i = 0; i < iters; i++) {
+		if ((hash = xbps_file_hash(hash_file)) == NULL)
+			abort();
+		sink += (size_t)hash[0];
+		free(hash);
+	}
+}
+
+static void
+bench_pkgdb_externalize(size_t iters)
+{
+	char *buf;
+
+	for (size_t i = 0; i < iters; i++) {
+		if ((buf = xbps_dictionary_externalize(pkgdb)) == NULL)
+			abort();
+		sink += strlen(buf);
+		free(buf);
+	}
+}
+
+static void
+bench_pkgdb_internalize(size_t iters)
+{
+	xbps_dictionary_t d;
+
+	for (size_t i = 0; i < iters; i++) {
+		if ((d = xbps_dictionary_internalize(pkgdb_plist)) == NULL)
+			abort();
+		sink += xbps_dictionary_count(d);
+		xbps_object_release(d);
+	}
+}
+
+/*
+ * The array lookups are done for the last element and for a missing
+ * one, which is the common case when resolving dependencies and forces
+ * a full scan.
+ */
+static void
+bench_match_pkgname_in_array(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sink += xbps_match_pkgname_in_array(pkgvers_array,
+		    (i & 1) ? "pkg63" : "notfound");
+	}
+}
+
+static void
+bench_match_pkgver_in_array(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sink += xbps_match_pkgver_in_array(pkgvers_array,
+		    (i & 1) ? "pkg63-1.63_1" : "notfound-1.0_1");
+	}
+}
+
+static void
+bench_match_pkgpattern_in_array(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sink += xbps_match_pkgpattern_in_array(pkgvers_array,
+		    (i & 1) ? "pkg63>=1.0" : "notfound>=1.0");
+	}
+}
+
+static void
+bench_match_pkgdep_in_array(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sink += xbps_match_pkgdep_in_array(patterns_array,
+		    (i & 1) ? "pkg63-1.63_1" : "notfound-1.0_1");
+	}
+}
+
+static void
+bench_match_virtual_pkg_in_array(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sink += xbps_match_virtual_pkg_in_array(provides_array,
+		    (i & 1) ? "vpkg63>=1.0" : "notfound>=1.0");
+	}
+}
+
+static void
+bench_match_string_in_array(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sink += xbps_match_string_in_array(pkgvers_array,
+		    (i & 1) ? "pkg63-1.63_1" : "notfound-1.0_1");
+	}
+}
+
+struct lookup {
+	pthread_t thread;
+	xbps_dictionary_t d;
+	xbps_array_t keys;
+	size_t iters;
+	size_t found;
+};
+
+static void *
+lookup_thread(void *arg)
+{
+	struct lookup *l = arg;
+	xbps_dictionary_t pkgd;
+	const char *pkgver;
+	unsigned int n = xbps_array_count(l->keys);
+
+	for (size_t i = 0; i < l->iters; i++) {
+		pkgd = xbps_dictionary_get_keysym(l->d,
+		    xbps_array_get(l->keys, i % n));
+		if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver))
+			l->found += (size_t)pkgver[0];
+	}
+	return NULL;
+}
+
+/*
+ * The lookups xbps_pkgdb_foreach_cb_multi() callbacks do, on nthreads
+ * threads.
+ */
+static void
+lookups(xbps_dictionary_t d, xbps_array_t keys, size_t iters)
+{
+	struct lookup l[MAXTHREADS];
+	unsigned int i;
+
+	for (i = 0; i < nthreads; i++) {
+		l[i].d = d;
+		l[i].keys = keys;
+		l[i].iters = iters / nthreads;
+		l[i].found = 0;
+		if (pthread_create(&l[i].thread, NULL, lookup_thread, &l[i]))
+			abort();
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(l[i].thread, NULL);
+		sink += l[i].found;
+	}
+}
+
+static void
+bench_pkgdb_lookup(size_t iters)
+{
+	lookups(pkgdb, pkgdb_keys, iters);
+}
+
+static void
+bench_pkgdb_lookup_immutable(size_t iters)
+{
+	lookups(frozen_pkgdb, frozen_keys, iters);
+}
+
+static const struct bench {
+	const char *name;
+	size_t iters;
+	void (*fn)(size_t);
+} benchs[] = {
+	{ "cmpver", 1000000, bench_cmpver },
+	{ "pkgpattern_match", 1000000, bench_pkgpattern_match },
+	{ "pkg_name", 1000000, bench_pkg_name },
+	{ "file_hash", 200, bench_file_hash },
+	{ "pkgdb_externalize", 20, bench_pkgdb_externalize },
+	{ "pkgdb_internalize", 20, bench_pkgdb_internalize },
+	{ "match_pkgname_in_array", 100000, bench_match_pkgname_in_array },
+	{ "match_pkgver_in_array", 100000, bench_match_pkgver_in_array },
+	{ "match_pkgpattern_in_array", 100000, bench_match_pkgpattern_in_array },
+	{ "match_pkgdep_in_array", 100000, bench_match_pkgdep_in_array },
+	{ "match_virtual_pkg_in_array", 100000, bench_match_virtual_pkg_in_array },
+	{ "match_string_in_array", 100000, bench_match_string_in_array },
+	{ "pkgdb_lookup", 2000000, bench_pkgdb_lookup },
+	{ "pkgdb_lookup_immutable", 2000000, bench_pkgdb_lookup_immutable },
+};
+
+/*
+ * Setup.
+ */
+static xbps_array_t
+string_array(const char *prefix, bool pattern)
+{
+	xbps_array_t a;
+	char buf[64];
+
+	a = xbps_array_create();
+	for (int i = 0; i < ARRAY_LEN; i++) {
+		if (pattern)
+			snprintf(buf, sizeof(buf), "%s%d>=1.%d", prefix, i, i);
+		else
+			snprintf(buf, sizeof(buf), "%s%d-1.%d_1", prefix, i, i);
+		xbps_array_add_cstring(a, buf);
+	}
+	return a;
+}
+
+/*
+ * A synthetic pkgdb whose package dictionaries carry the objects found
+ * in a real one.
+ */
+static xbps_dictionary_t
+create_pkgdb(void)
+{
+	xbps_dictionary_t d, pkgd;
+	xbps_array_t a;
+	char pkgname[64], buf[128];
+
+	d = xbps_dictionary_create();
+	for (int i = 0; i < NPKGS; i++) {
+		snprintf(pkgname, sizeof(pkgname), "package%d", i);
+		pkgd = xbps_dictionary_create();
+		snprintf(buf, sizeof(buf), "%s-%d.%d.%d_%d", pkgname,
+		    i % 7, i % 13, i % 29, 1 + i % 3);
+		xbps_dictionary_set_cstring(pkgd, "pkgver", buf);
+		xbps_dictionary_set_cstring(pkgd, "architecture", "x86_64");
+		xbps_dictionary_set_cstring(pkgd, "state", "installed");
+		xbps_dictionary_set_bool(pkgd, "automatic-install", i % 4);
+		xbps_dictionary_set_uint64(pkgd, "installed_size",
+		    (uint64_t)i * 4099);
+		snprintf(buf, sizeof(buf), "Short description of %s", pkgname);
+		xbps_dictionary_set_cstring(pkgd, "short_desc", buf);
+		snprintf(buf, sizeof(buf), "https://example.org/%s", pkgname);
+		xbps_dictionary_set_cstring(pkgd, "homepage", buf);
+		xbps_dictionary_set_cstring(pkgd, "license", "GPL-2.0-or-later");
+		xbps_dictionary_set_cstring(pkgd, "maintainer",
+		    "Void Linux <nobody@voidlinux.org>");
+		snprintf(buf, sizeof(buf), "%064x", i);
+		xbps_dictionary_set_cstring(pkgd, "metafile-sha256", buf);
+
+		a = xbps_array_create();
+		for (int j = 1; j <= 4 && j <= i; j++) {
+			snprintf(buf, sizeof(buf), "package%d>=0", i - j);
+			xbps_array_add_cstring(a, buf);
+		}
+		xbps_dictionary_set(pkgd, "run_depends", a);
+		xbps_object_release(a);
+
+		a = xbps_array_create();
+		xbps_array_add_cstring(a, "libc.so.6");
+		snprintf(buf, sizeof(buf), "libpackage%d.so.1", i / 2);
+		xbps_array_add_cstring(a, buf);
+		xbps_dictionary_set(pkgd, "shlib-requires", a);
+		xbps_object_release(a);
+
+		xbps_dictionary_set(d, pkgname, pkgd);
+		xbps_object_release(pkgd);
+	}
+	return d;
+}
+
+/*
+ * A copy of pkgdb frozen with xbps_dictionary_make_immutable(), as done
+ * for the pkgdb of a handle.
+ */
+static xbps_dictionary_t
+freeze_pkgdb(void)
+{
+	xbps_dictionary_t d;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+
+	if ((d = xbps_dictionary_internalize(pkgdb_plist)) == NULL)
+		abort();
+	iter = xbps_dictionary_iterator(d);
+	while ((obj = xbps_object_iterator_next(iter)) != NULL)
+		xbps_dictionary_make_immutable(
+		    xbps_dictionary_get_keysym(d, obj));
+	xbps_object_iterator_release(iter);
+	xbps_dictionary_make_immutable(d);
+
+	return d;
+}
+
+static void
+create_hash_file(void)
+{
+	char buf[4096];
+	size_t off;
+	int fd;
+
+	if ((fd = mkstemp(hash_file)) == -1) {
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = (char)(i * 31);
+	for (off = 0; off < HASH_FILE_SIZE; off += sizeof(buf)) {
+		if (write(fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+			perror("write");
+			unlink(hash_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(fd);
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void __attribute__((noreturn))
+usage(void)
+{
+	fprintf(stderr, "usage: xbps_bench [-j threads] [-p pkgdb.plist] "
+	    "[name ...]\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *pkgdb_file = NULL;
+	double t0, t1;
+	size_t allocs;
+	int c;
+
+	while ((c = getopt(argc, argv, "j:p:")) != -1) {
+		switch (c) {
+		case 'j':
+			nthreads = (unsigned int)strtoul(optarg, NULL, 10);
+			if (nthreads == 0 || nthreads > MAXTHREADS)
+				usage();
+			break;
+		case 'p':
+			pkgdb_file = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (pkgdb_file) {
+		pkgdb = xbps_dictionary_internalize_from_zfile(pkgdb_file);
+		if (pkgdb == NULL) {
+			fprintf(stderr, "failed to read %s\n", pkgdb_file);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		pkgdb = create_pkgdb();
+	}
+	pkgdb_plist = xbps_dictionary_externalize(pkgdb);
+	frozen_pkgdb = freeze_pkgdb();
+	pkgdb_keys = xbps_dictionary_all_keys(pkgdb);
+	frozen_keys = xbps_dictionary_all_keys(frozen_pkgdb);
+	xbps_array_make_immutable(frozen_keys);
+	pkgvers_array = string_array("pkg", false);
+	patterns_array = string_array("pkg", true);
+	provides_array = string_array("vpkg", false);
+	create_hash_file();
+
+	printf("%-28s %10s %14s %12s\n", "benchmark", "iterations",
+	    "ns/op", "allocs/op");
+	for (size_t i = 0; i < NELEM(benchs); i++) {
+		const struct bench *b = &benchs[i];
+
+		if (argc) {
+			int found = 0;
+			for (int j = 0; j < argc; j++) {
+				if (strcmp(argv[j], b->name) == 0)
+					found = 1;
+			}
+			if (!found)
+				continue;
+		}
+		/* warm up caches and lazily initialized state */
+		b->fn(1);
+		allocs = nallocs;
+		t0 = now_ns();
+		b->fn(b->iters);
+		t1 = now_ns();
+		allocs = nallocs - allocs;
+		printf("%-28s %10zu %14.1f %12.2f\n", b->name, b->iters,
+		    (t1 - t0) / b->iters, (double)allocs / b->iters);
+	}
+	unlink(hash_file);
+	xbps_object_release(pkgdb);
+	xbps_object_release(frozen_pkgdb);
+	xbps_object_release(pkgdb_keys);
+	xbps_object_release(frozen_keys);
+	xbps_object_release(pkgvers_array);
+	xbps_object_release(patterns_array);
+	xbps_object_release(provides_array);
+	free(pkgdb_plist);
+
+	exit(EXIT_SUCCESS);
+}
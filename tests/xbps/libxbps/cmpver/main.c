@@ -45,10 +45,38 @@ ATF_TC_BODY(cmpver_test, tc)
 	ATF_REQUIRE_EQ(xbps_cmpver("foo-blah-100dpi-21", "foo-blah-100dpi-21_0"), 0);
 	ATF_REQUIRE_EQ(xbps_cmpver("foo-blah-100dpi-21", "foo-blah-100dpi-2.1"), 1);
 	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0.1", "foo-1.0_1"), 1);
+	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0a_1", "foo-1.0b_1"), -1);
+	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0b_1", "foo-1.0.2_1"), 0);
+	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0alpha1", "foo-1.0beta1"), -1);
+	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0pl1", "foo-1.0.1"), 0);
+	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0_10", "foo-1.0_9"), 1);
+	ATF_REQUIRE_EQ(xbps_cmpver("foo-1.0.0.0", "foo-1"), 0);
+}
+
+ATF_TC(cmpver_long_test);
+
+ATF_TC_HEAD(cmpver_long_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test xbps_cmpver with long versions");
+}
+
+ATF_TC_BODY(cmpver_long_test, tc)
+{
+	const char *v1 = "foo-1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20.21_1";
+	const char *v2 = "foo-1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20.22_1";
+
+	ATF_REQUIRE_EQ(xbps_cmpver(v1, v1), 0);
+	ATF_REQUIRE_EQ(xbps_cmpver(v1, v2), -1);
+	ATF_REQUIRE_EQ(xbps_cmpver(v2, v1), 1);
+	ATF_REQUIRE_EQ(xbps_cmpver(v1, "foo-1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20.21_2"), -1);
+	ATF_REQUIRE_EQ(xbps_pkgpattern_match(v1, "foo>=1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20"), 1);
+	ATF_REQUIRE_EQ(xbps_pkgpattern_match(v1, "foo<1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20.22"), 1);
+	ATF_REQUIRE_EQ(xbps_pkgpattern_match(v2, "foo<1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18.19.20.22"), 0);
 }
 
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, cmpver_test);
+	ATF_TP_ADD_TC(tp, cmpver_long_test);
 	return atf_no_error();
 }
@@ -0,0 +1,208 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/stat.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <atf-c.h>
+#include <xbps.h>
+
+static struct xbps_commit *commit;
+
+static void
+handle_init(struct xbps_handle *xhp)
+{
+	char cwd[PATH_MAX], repo[PATH_MAX];
+
+	ATF_REQUIRE_EQ(system("mkdir -p repo pkg_A pkg_B && "
+	    "touch pkg_A/file00 pkg_B/file01 && cd repo && "
+	    "xbps-create -A noarch -n A-1.0_1 -s A ../pkg_A >/dev/null && "
+	    "xbps-create -A noarch -n B-1.0_1 -s B ../pkg_B >/dev/null && "
+	    "xbps-rindex -a $PWD/*.xbps >/dev/null"), 0);
+	ATF_REQUIRE(realpath("repo", repo) != NULL);
+	ATF_REQUIRE(getcwd(cwd, sizeof(cwd)) != NULL);
+	memset(xhp, 0, sizeof(*xhp));
+	snprintf(xhp->rootdir, sizeof(xhp->rootdir), "%s/root", cwd);
+	ATF_REQUIRE_EQ(mkdir(xhp->rootdir, 0755), 0);
+	ATF_REQUIRE_EQ(xbps_init(xhp), 0);
+	ATF_REQUIRE(xbps_repo_store(xhp, repo));
+	ATF_REQUIRE_EQ(xbps_transaction_install_pkg(xhp, "A", false), 0);
+	ATF_REQUIRE_EQ(xbps_transaction_install_pkg(xhp, "B", false), 0);
+	ATF_REQUIRE_EQ(xbps_transaction_prepare(xhp), 0);
+}
+
+/*
+ * Reads the events of the commit until the last one, returns the
+ * number of XBPS_STATE_UNPACK_DONE events.
+ */
+static unsigned int
+commit_wait(struct xbps_commit *c, int *err)
+{
+	struct xbps_commit_event *ev;
+	struct pollfd pfd;
+	unsigned int unpacked = 0;
+	bool done = false;
+
+	pfd.fd = xbps_commit_fd(c);
+	pfd.events = POLLIN;
+	while (!done) {
+		ATF_REQUIRE_EQ(poll(&pfd, 1, -1), 1);
+		while ((ev = xbps_commit_event(c)) != NULL) {
+			ATF_REQUIRE(!done);
+			if (ev->type == XBPS_COMMIT_EVENT_STATE &&
+			    ev->state == XBPS_STATE_UNPACK_DONE) {
+				ATF_REQUIRE(ev->arg != NULL);
+				ATF_REQUIRE_EQ(ev->unpack.files, 1);
+				unpacked++;
+			} else if (ev->type == XBPS_COMMIT_EVENT_DONE) {
+				*err = ev->err;
+				done = true;
+			}
+			free(ev);
+		}
+	}
+	/* nothing is left to be read */
+	ATF_REQUIRE_EQ(poll(&pfd, 1, 0), 0);
+	return unpacked;
+}
+
+ATF_TC(commit_async_test);
+
+ATF_TC_HEAD(commit_async_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test a transaction committed in background");
+}
+
+ATF_TC_BODY(commit_async_test, tc)
+{
+	struct xbps_handle xh;
+	pkg_state_t state;
+	int err = -1;
+
+	handle_init(&xh);
+	commit = xbps_transaction_commit_start(&xh);
+	ATF_REQUIRE(commit != NULL);
+	/* the handle is busy until the commit is finished */
+	ATF_REQUIRE(xbps_transaction_commit_start(&xh) == NULL);
+	ATF_REQUIRE_EQ(errno, EBUSY);
+	ATF_REQUIRE_EQ(commit_wait(commit, &err), 2);
+	ATF_REQUIRE_EQ(err, 0);
+	ATF_REQUIRE_EQ(xbps_commit_finish(commit), 0);
+	ATF_REQUIRE(xh.state_cb == NULL);
+
+	ATF_REQUIRE_EQ(xbps_pkg_state_installed(&xh, "A", &state), 0);
+	ATF_REQUIRE_EQ(state, XBPS_PKG_STATE_INSTALLED);
+	ATF_REQUIRE_EQ(xbps_pkg_state_installed(&xh, "B", &state), 0);
+	ATF_REQUIRE_EQ(state, XBPS_PKG_STATE_INSTALLED);
+	xbps_end(&xh);
+}
+
+static void
+cancel_cb(const struct xbps_unpack_cb_data *xucd, void *arg)
+{
+	(void)arg;
+	if (strcmp(xucd->pkgver, "A-1.0_1") == 0)
+		xbps_commit_cancel(commit);
+}
+
+ATF_TC(commit_cancel_test);
+
+ATF_TC_HEAD(commit_cancel_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the cancellation of a transaction committed in background");
+}
+
+ATF_TC_BODY(commit_cancel_test, tc)
+{
+	struct xbps_handle xh;
+	pkg_state_t state;
+	int err = -1;
+
+	handle_init(&xh);
+	/* cancelled while the first package is unpacked */
+	xh.unpack_cb = cancel_cb;
+	commit = xbps_transaction_commit_start(&xh);
+	ATF_REQUIRE(commit != NULL);
+	ATF_REQUIRE_EQ(commit_wait(commit, &err), 1);
+	ATF_REQUIRE_EQ(err, ECANCELED);
+	ATF_REQUIRE_EQ(xbps_commit_finish(commit), ECANCELED);
+
+	ATF_REQUIRE_EQ(xbps_pkg_state_installed(&xh, "A", &state), 0);
+	ATF_REQUIRE_EQ(state, XBPS_PKG_STATE_UNPACKED);
+	ATF_REQUIRE_EQ(xbps_pkg_state_installed(&xh, "B", &state), ENOENT);
+	xbps_end(&xh);
+}
+
+ATF_TC(counters_test);
+
+ATF_TC_HEAD(counters_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the operation counters of a committed transaction");
+}
+
+ATF_TC_BODY(counters_test, tc)
+{
+	struct xbps_handle xh, xh2;
+
+	handle_init(&xh);
+	ATF_REQUIRE_EQ(xbps_transaction_commit(&xh), 0);
+
+	ATF_REQUIRE(xbps_counter(&xh, XBPS_COUNTER_PLISTS) > 0);
+	ATF_REQUIRE(xbps_counter(&xh, XBPS_COUNTER_PLIST_BYTES) > 0);
+	ATF_REQUIRE(xbps_counter(&xh, XBPS_COUNTER_RPOOL_LOOKUPS) >= 2);
+	ATF_REQUIRE(xbps_counter(&xh, XBPS_COUNTER_RPOOL_HITS) >= 2);
+	ATF_REQUIRE(xbps_counter(&xh, XBPS_COUNTER_HASH_BYTES) > 0);
+	ATF_REQUIRE_EQ(xbps_counter(&xh, XBPS_COUNTER_UNPACK_FILES), 2);
+	ATF_REQUIRE_EQ(xbps_counter(&xh, XBPS_COUNTER_FETCH_BYTES), 0);
+	ATF_REQUIRE_EQ(xbps_counter(&xh, XBPS_COUNTER_MAX), 0);
+	ATF_REQUIRE_STREQ(xbps_counter_name(XBPS_COUNTER_UNPACK_FILES),
+	    "unpack_files");
+	ATF_REQUIRE(xbps_counter_name(XBPS_COUNTER_MAX) == NULL);
+
+	/* counted from xbps_init() of every handle */
+	memset(&xh2, 0, sizeof(xh2));
+	xbps_strlcpy(xh2.rootdir, xh.rootdir, sizeof(xh2.rootdir));
+	ATF_REQUIRE_EQ(xbps_init(&xh2), 0);
+	ATF_REQUIRE_EQ(xbps_counter(&xh2, XBPS_COUNTER_UNPACK_FILES), 0);
+	ATF_REQUIRE_EQ(xbps_counter(&xh, XBPS_COUNTER_UNPACK_FILES), 2);
+	xbps_end(&xh2);
+	xbps_end(&xh);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, commit_async_test);
+	ATF_TP_ADD_TC(tp, commit_cancel_test);
+	ATF_TP_ADD_TC(tp, counters_test);
+
+	return atf_no_error();
+}
@@ -114,10 +114,140 @@ ATF_TC_BODY(config_include_nomatch_test, tc)
 	ATF_REQUIRE_EQ(xbps_array_count(xh.repositories), 0);
 }
 
+ATF_TC(config_mirrors_test);
+ATF_TC_HEAD(config_mirrors_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test declaring mirrors of a repository");
+}
+
+ATF_TC_BODY(config_mirrors_test, tc)
+{
+	struct xbps_handle xh;
+	xbps_array_t mirrors;
+	const char *tcsdir, *str;
+	char *buf, *buf2, pwd[PATH_MAX];
+
+	/* get test source dir */
+	tcsdir = atf_tc_get_config_var(tc, "srcdir");
+
+	memset(&xh, 0, sizeof(xh));
+	buf = getcwd(pwd, sizeof(pwd));
+
+	xbps_strlcpy(xh.rootdir, tcsdir, sizeof(xh.rootdir));
+	xbps_strlcpy(xh.metadir, tcsdir, sizeof(xh.metadir));
+	snprintf(xh.confdir, sizeof(xh.confdir), "%s/xbps.d", pwd);
+
+	ATF_REQUIRE_EQ(xbps_mkpath(xh.confdir, 0755), 0);
+
+	buf = xbps_xasprintf("%s/xbps_mirrors.cf", tcsdir);
+	buf2 = xbps_xasprintf("%s/xbps.d/mirrors.conf", pwd);
+	ATF_REQUIRE_EQ(symlink(buf, buf2), 0);
+	free(buf);
+	free(buf2);
+
+	xh.flags = XBPS_FLAG_DEBUG;
+	ATF_REQUIRE_EQ(xbps_init(&xh), 0);
+
+	/* the first url is the repository */
+	ATF_REQUIRE_EQ(xbps_array_count(xh.repositories), 1);
+	xbps_array_get_cstring_nocopy(xh.repositories, 0, &str);
+	ATF_CHECK_STREQ(str, "http://a.example/current");
+
+	/* followed by its mirrors */
+	mirrors = xbps_dictionary_get(xh.mirrors, "http://a.example/current");
+	ATF_REQUIRE_EQ(xbps_array_count(mirrors), 3);
+	xbps_array_get_cstring_nocopy(mirrors, 0, &str);
+	ATF_CHECK_STREQ(str, "http://a.example/current");
+	xbps_array_get_cstring_nocopy(mirrors, 1, &str);
+	ATF_CHECK_STREQ(str, "http://b.example/current");
+	xbps_array_get_cstring_nocopy(mirrors, 2, &str);
+	ATF_CHECK_STREQ(str, "http://c.example/current");
+}
+
+ATF_TC(config_snapshot_test);
+ATF_TC_HEAD(config_snapshot_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test the configuration snapshot");
+}
+
+static void
+snapshot_init(struct xbps_handle *xh, const char *pwd)
+{
+	memset(xh, 0, sizeof(*xh));
+	xbps_strlcpy(xh->rootdir, pwd, sizeof(xh->rootdir));
+	xbps_strlcpy(xh->metadir, pwd, sizeof(xh->metadir));
+	snprintf(xh->confdir, sizeof(xh->confdir), "%s/xbps.d", pwd);
+	xh->flags = XBPS_FLAG_DEBUG;
+	ATF_REQUIRE_EQ(xbps_init(xh), 0);
+}
+
+ATF_TC_BODY(config_snapshot_test, tc)
+{
+	struct xbps_handle xh;
+	const char *tcsdir;
+	char *buf, *buf2, pwd[PATH_MAX];
+	FILE *fp;
+
+	/* get test source dir */
+	tcsdir = atf_tc_get_config_var(tc, "srcdir");
+	buf = getcwd(pwd, sizeof(pwd));
+
+	buf = xbps_xasprintf("%s/xbps.d", pwd);
+	ATF_REQUIRE_EQ(xbps_mkpath(buf, 0755), 0);
+	free(buf);
+
+	buf = xbps_xasprintf("%s/xbps.cf", tcsdir);
+	buf2 = xbps_xasprintf("%s/xbps.d/xbps.conf", pwd);
+	ATF_REQUIRE_EQ(symlink(buf, buf2), 0);
+	free(buf);
+	free(buf2);
+
+	buf = xbps_xasprintf("%s/1.include.cf", tcsdir);
+	buf2 = xbps_xasprintf("%s/xbps.d/1.include.conf", pwd);
+	ATF_REQUIRE_EQ(symlink(buf, buf2), 0);
+	free(buf);
+	free(buf2);
+
+	buf = xbps_xasprintf("%s/snapshot", pwd);
+	ATF_REQUIRE_EQ(setenv("XBPS_CONF_CACHE", buf, 1), 0);
+	free(buf);
+
+	/* parsed and recorded */
+	snapshot_init(&xh, pwd);
+	ATF_REQUIRE_EQ(xbps_array_count(xh.repositories), 1);
+	xbps_end(&xh);
+	ATF_REQUIRE_EQ(access("snapshot", R_OK), 0);
+
+	/* replayed */
+	snapshot_init(&xh, pwd);
+	ATF_REQUIRE_EQ(xbps_array_count(xh.repositories), 1);
+	xbps_end(&xh);
+
+	/* a new file matched by the include invalidates it */
+	buf = xbps_xasprintf("%s/xbps.d/2.include.conf", pwd);
+	fp = fopen(buf, "w");
+	ATF_REQUIRE(fp);
+	fprintf(fp, "repository=2\n");
+	fclose(fp);
+	free(buf);
+
+	snapshot_init(&xh, pwd);
+	ATF_REQUIRE_EQ(xbps_array_count(xh.repositories), 2);
+	xbps_end(&xh);
+
+	snapshot_init(&xh, pwd);
+	ATF_REQUIRE_EQ(xbps_array_count(xh.repositories), 2);
+	xbps_end(&xh);
+
+	unsetenv("XBPS_CONF_CACHE");
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, config_include_test);
 	ATF_TP_ADD_TC(tp, config_include_nomatch_test);
+	ATF_TP_ADD_TC(tp, config_mirrors_test);
+	ATF_TP_ADD_TC(tp, config_snapshot_test);
 
 	return atf_no_error();
 }
@@ -0,0 +1,123 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <atf-c.h>
+#include <xbps.h>
+
+static unsigned char *
+random_buf(size_t len, unsigned int seed)
+{
+	unsigned char *buf;
+
+	buf = malloc(len);
+	ATF_REQUIRE(buf);
+	srandom(seed);
+	for (size_t i = 0; i < len; i++)
+		buf[i] = random() & 0xff;
+
+	return buf;
+}
+
+static void
+write_file(const char *path, const unsigned char *buf, size_t len)
+{
+	FILE *f;
+
+	ATF_REQUIRE((f = fopen(path, "w")));
+	ATF_REQUIRE_EQ(fwrite(buf, 1, len, f), len);
+	ATF_REQUIRE_EQ(fclose(f), 0);
+}
+
+static off_t
+file_size(const char *path)
+{
+	struct stat st;
+
+	ATF_REQUIRE_EQ(stat(path, &st), 0);
+	return st.st_size;
+}
+
+ATF_TC(delta_test);
+
+ATF_TC_HEAD(delta_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_delta_create() and xbps_delta_apply()");
+}
+
+ATF_TC_BODY(delta_test, tc)
+{
+	unsigned char *old, *new;
+	char *h1, *h2;
+	size_t len = 256 * 1024;
+
+	/* new: data inserted, removed and changed in the middle of old */
+	old = random_buf(len, 1);
+	new = random_buf(len + 1000, 2);
+	memcpy(new, old, 1000);
+	memcpy(new + 3000, old + 1000, 50000);
+	memcpy(new + 60000, old + 70000, len - 70000);
+	write_file("old", old, len);
+	write_file("new", new, len + 1000);
+
+	ATF_REQUIRE_EQ(xbps_delta_create("old", "new", "delta"), 0);
+	ATF_CHECK(file_size("delta") < (off_t)len / 4);
+	ATF_REQUIRE_EQ(xbps_delta_apply("old", "delta", "out"), 0);
+	h1 = xbps_file_hash("new");
+	h2 = xbps_file_hash("out");
+	ATF_REQUIRE(h1 && h2);
+	ATF_REQUIRE_STREQ(h1, h2);
+
+	/* a delta is only applied to its base */
+	ATF_REQUIRE_EQ(xbps_delta_apply("new", "delta", "out2"), ERANGE);
+	ATF_CHECK_EQ(access("out2", F_OK), -1);
+
+	/* malformed deltas */
+	write_file("bad", (const unsigned char *)"garbage", 7);
+	ATF_REQUIRE_EQ(xbps_delta_apply("old", "bad", "out2"), EINVAL);
+	ATF_CHECK_EQ(access("out2", F_OK), -1);
+
+	/* empty files */
+	write_file("empty", old, 0);
+	ATF_REQUIRE_EQ(xbps_delta_create("empty", "new", "delta2"), 0);
+	ATF_REQUIRE_EQ(xbps_delta_apply("empty", "delta2", "out3"), 0);
+	h2 = xbps_file_hash("out3");
+	ATF_REQUIRE_STREQ(h1, h2);
+
+	free(old);
+	free(new);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, delta_test);
+
+	return atf_no_error();
+}
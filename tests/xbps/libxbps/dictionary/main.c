@@ -0,0 +1,1249 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <atf-c.h>
+#include <xbps.h>
+
+#define NKEYS	5000
+
+static xbps_dictionary_t
+fill(xbps_dictionary_t d)
+{
+	char key[32];
+	unsigned int i, k;
+
+	/* insert keys in a scrambled order */
+	for (i = 0; i < NKEYS; i++) {
+		k = (i * 7919) % NKEYS;
+		snprintf(key, sizeof(key), "pkg-%u", k);
+		ATF_REQUIRE(xbps_dictionary_set_uint32(d, key, k));
+	}
+	return d;
+}
+
+ATF_TC(hashed_test);
+
+ATF_TC_HEAD(hashed_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test hashed dictionaries against sorted dictionaries");
+}
+
+ATF_TC_BODY(hashed_test, tc)
+{
+	xbps_dictionary_t d, h, c;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	const char *key, *prev = NULL;
+	char *x1, *x2, buf[32];
+	uint32_t v;
+	unsigned int i;
+
+	d = fill(xbps_dictionary_create());
+	h = fill(xbps_dictionary_create_hashed(0));
+	ATF_REQUIRE_EQ(xbps_dictionary_count(h), NKEYS);
+
+	for (i = 0; i < NKEYS; i++) {
+		snprintf(buf, sizeof(buf), "pkg-%u", i);
+		ATF_REQUIRE(xbps_dictionary_get_uint32(h, buf, &v));
+		ATF_REQUIRE_EQ(v, i);
+	}
+	ATF_REQUIRE_EQ(xbps_dictionary_get(h, "pkg-nonexistent"), NULL);
+
+	/* remove every third key */
+	for (i = 0; i < NKEYS; i += 3) {
+		snprintf(buf, sizeof(buf), "pkg-%u", i);
+		xbps_dictionary_remove(d, buf);
+		xbps_dictionary_remove(h, buf);
+		ATF_REQUIRE_EQ(xbps_dictionary_get(h, buf), NULL);
+	}
+	for (i = 1; i < NKEYS; i += 3) {
+		snprintf(buf, sizeof(buf), "pkg-%u", i);
+		ATF_REQUIRE(xbps_dictionary_get_uint32(h, buf, &v));
+		ATF_REQUIRE_EQ(v, i);
+	}
+	ATF_REQUIRE_EQ(xbps_dictionary_count(h), xbps_dictionary_count(d));
+
+	/* iteration and externalization are still sorted by key */
+	iter = xbps_dictionary_iterator(h);
+	ATF_REQUIRE(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		key = xbps_dictionary_keysym_cstring_nocopy(obj);
+		if (prev != NULL)
+			ATF_REQUIRE(strcmp(prev, key) < 0);
+		ATF_REQUIRE(xbps_dictionary_get_keysym(h, obj));
+		prev = key;
+	}
+	xbps_object_iterator_release(iter);
+
+	ATF_REQUIRE(xbps_dictionary_equals(d, h));
+	x1 = xbps_dictionary_externalize(d);
+	x2 = xbps_dictionary_externalize(h);
+	ATF_REQUIRE(x1 && x2);
+	ATF_REQUIRE_STREQ(x1, x2);
+	free(x2);
+
+	/* copies stay hashed, converted dictionaries too */
+	c = xbps_dictionary_copy_mutable(h);
+	ATF_REQUIRE(xbps_dictionary_set_uint32(c, "aaa", 1));
+	ATF_REQUIRE(xbps_dictionary_get(c, "aaa"));
+	ATF_REQUIRE_EQ(xbps_dictionary_get(h, "aaa"), NULL);
+	xbps_object_release(c);
+
+	c = xbps_dictionary_internalize(x1);
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_make_hashed(c));
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	ATF_REQUIRE(xbps_dictionary_get_uint32(c, "pkg-1", &v));
+	ATF_REQUIRE_EQ(v, 1);
+	free(x1);
+
+	xbps_object_release(c);
+	xbps_object_release(h);
+	xbps_object_release(d);
+}
+
+ATF_TC(arena_test);
+
+ATF_TC_HEAD(arena_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test dictionaries internalized in an arena");
+}
+
+ATF_TC_BODY(arena_test, tc)
+{
+	xbps_dictionary_t d, a, pkgd;
+	xbps_string_t str;
+	const char *pkgver;
+	char *x1, *x2;
+
+	d = fill(xbps_dictionary_create());
+	ATF_REQUIRE(xbps_dictionary_set_cstring(d, "pkgver", "foo-1.0_1"));
+	pkgd = xbps_dictionary_create();
+	ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "pkgver", "bar-1.0_1"));
+	ATF_REQUIRE(xbps_dictionary_set(d, "bar", pkgd));
+	xbps_object_release(pkgd);
+	x1 = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(x1);
+
+	xbps_object_arena_begin();
+	a = xbps_dictionary_internalize(x1);
+	xbps_object_arena_end();
+	ATF_REQUIRE(a);
+	ATF_REQUIRE(xbps_dictionary_equals(a, d));
+
+	/* arena objects are mutable */
+	str = xbps_string_copy(xbps_dictionary_get(a, "pkgver"));
+	ATF_REQUIRE(xbps_string_append_cstring(str, "-mod"));
+	ATF_REQUIRE_STREQ(xbps_string_cstring_nocopy(str), "foo-1.0_1-mod");
+	ATF_REQUIRE(xbps_string_append_cstring(
+	    xbps_dictionary_get(a, "pkgver"), "-mod"));
+	ATF_REQUIRE(xbps_dictionary_set_cstring(a, "pkgver", "foo-2.0_1"));
+	ATF_REQUIRE(xbps_dictionary_set_uint32(a, "new", 1));
+
+	/* objects outlive the dictionary they were internalized with */
+	pkgd = xbps_dictionary_get(a, "bar");
+	xbps_object_retain(pkgd);
+	xbps_object_release(a);
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver));
+	ATF_REQUIRE_STREQ(pkgver, "bar-1.0_1");
+	x2 = xbps_dictionary_externalize(pkgd);
+	ATF_REQUIRE(x2);
+	xbps_object_release(pkgd);
+	ATF_REQUIRE_STREQ(xbps_string_cstring_nocopy(str), "foo-1.0_1-mod");
+	xbps_object_release(str);
+
+	free(x1);
+	free(x2);
+	xbps_object_release(d);
+}
+
+ATF_TC(arena_intern_test);
+
+ATF_TC_HEAD(arena_intern_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test dictionaries internalized in an interning arena");
+}
+
+ATF_TC_BODY(arena_intern_test, tc)
+{
+	xbps_dictionary_t d, a, pkgd;
+	xbps_array_t arr;
+	xbps_string_t str;
+	const char *pkgver;
+	char *x1;
+
+	d = xbps_dictionary_create();
+	arr = xbps_array_create();
+	ATF_REQUIRE(xbps_array_add_cstring(arr, "x86_64"));
+	ATF_REQUIRE(xbps_array_add_cstring(arr, "noarch"));
+	ATF_REQUIRE(xbps_dictionary_set(d, "archs", arr));
+	xbps_object_release(arr);
+	pkgd = xbps_dictionary_create();
+	ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "pkgver", "foo-1.0_1"));
+	ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "architecture", "x86_64"));
+	ATF_REQUIRE(xbps_dictionary_set(d, "foo", pkgd));
+	xbps_object_release(pkgd);
+	x1 = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(x1);
+
+	xbps_object_arena_begin();
+	xbps_object_arena_intern();
+	a = xbps_dictionary_internalize(x1);
+	xbps_object_arena_end();
+	ATF_REQUIRE(a);
+	ATF_REQUIRE(xbps_dictionary_equals(a, d));
+
+	/* equal values share a single string */
+	pkgd = xbps_dictionary_get(a, "foo");
+	arr = xbps_dictionary_get(a, "archs");
+	ATF_REQUIRE_EQ(xbps_dictionary_get(pkgd, "architecture"),
+	    xbps_array_get(arr, 0));
+
+	/* interned strings are immutable, copies are not */
+	str = xbps_dictionary_get(pkgd, "pkgver");
+	ATF_REQUIRE(!xbps_string_append_cstring(str, "-mod"));
+	str = xbps_string_copy(str);
+	ATF_REQUIRE(xbps_string_append_cstring(str, "-mod"));
+	ATF_REQUIRE_STREQ(xbps_string_cstring_nocopy(str), "foo-1.0_1-mod");
+	xbps_object_release(str);
+
+	/* objects outlive the arena and its string table */
+	xbps_object_retain(pkgd);
+	xbps_object_release(a);
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver", &pkgver));
+	ATF_REQUIRE_STREQ(pkgver, "foo-1.0_1");
+	xbps_object_release(pkgd);
+
+	free(x1);
+	xbps_object_release(d);
+}
+
+ATF_TC(memstat_test);
+
+ATF_TC_HEAD(memstat_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the memory accounting of object trees");
+}
+
+ATF_TC_BODY(memstat_test, tc)
+{
+	struct xbps_memstat ms, ms2;
+	xbps_dictionary_t d, pkgd;
+	xbps_array_t arr;
+
+	d = xbps_dictionary_create();
+	pkgd = xbps_dictionary_create();
+	arr = xbps_array_create();
+	ATF_REQUIRE(xbps_array_add_cstring(arr, "foo>=0"));
+	ATF_REQUIRE(xbps_array_add_cstring(arr, "bar>=0"));
+	ATF_REQUIRE(xbps_dictionary_set(pkgd, "run_depends", arr));
+	xbps_object_release(arr);
+	ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "pkgver", "baz-1.0_1"));
+	ATF_REQUIRE(xbps_dictionary_set_bool(pkgd, "automatic-install", true));
+	ATF_REQUIRE(xbps_dictionary_set_uint64(pkgd, "installed_size", 1));
+	ATF_REQUIRE(xbps_dictionary_set(d, "baz", pkgd));
+
+	memset(&ms, 0, sizeof(ms));
+	xbps_object_memstat(d, &ms);
+	ATF_CHECK_EQ(ms.objects[XBPS_MEMSTAT_DICTIONARY], 2);
+	ATF_CHECK_EQ(ms.objects[XBPS_MEMSTAT_DICT_KEYSYM], 5);
+	ATF_CHECK_EQ(ms.objects[XBPS_MEMSTAT_ARRAY], 1);
+	ATF_CHECK_EQ(ms.objects[XBPS_MEMSTAT_STRING], 3);
+	ATF_CHECK_EQ(ms.objects[XBPS_MEMSTAT_BOOL], 1);
+	ATF_CHECK_EQ(ms.objects[XBPS_MEMSTAT_NUMBER], 1);
+	/* strings own a copy of their value */
+	ATF_CHECK(ms.bytes[XBPS_MEMSTAT_STRING] >= 3 * sizeof("foo>=0"));
+	ATF_CHECK(ms.bytes[XBPS_MEMSTAT_DICTIONARY] > 0);
+	/* booleans and small numbers are never allocated */
+	ATF_CHECK_EQ(ms.bytes[XBPS_MEMSTAT_BOOL], 0);
+	ATF_CHECK_EQ(ms.bytes[XBPS_MEMSTAT_NUMBER], 0);
+
+	/* counters are added to */
+	memset(&ms2, 0, sizeof(ms2));
+	xbps_object_memstat(pkgd, &ms2);
+	xbps_object_memstat(pkgd, &ms2);
+	ATF_CHECK_EQ(ms2.objects[XBPS_MEMSTAT_STRING], 6);
+	ATF_CHECK_EQ(ms2.bytes[XBPS_MEMSTAT_STRING],
+	    2 * ms.bytes[XBPS_MEMSTAT_STRING]);
+	xbps_object_release(pkgd);
+
+	xbps_object_memstat(NULL, &ms2);
+	ATF_CHECK_EQ(ms2.objects[XBPS_MEMSTAT_STRING], 6);
+	xbps_object_release(d);
+}
+
+ATF_TC(number_test);
+
+ATF_TC_HEAD(number_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test numbers and booleans stored in dictionaries");
+}
+
+ATF_TC_BODY(number_test, tc)
+{
+	xbps_dictionary_t d, a;
+	xbps_number_t n1, n2;
+	xbps_bool_t b;
+	uint64_t u64;
+	int64_t i64;
+	bool v;
+	char *x;
+
+	n1 = xbps_number_create_integer(-1);
+	ATF_REQUIRE(n1);
+	ATF_REQUIRE_EQ(xbps_object_type(n1), XBPS_TYPE_NUMBER);
+	ATF_REQUIRE_EQ(xbps_number_integer_value(n1), -1);
+	ATF_REQUIRE(!xbps_number_unsigned(n1));
+	ATF_REQUIRE_EQ(xbps_number_size(n1), 8);
+	ATF_REQUIRE(xbps_number_copy(n1) == n1);
+	xbps_object_release(n1);
+	xbps_object_release(n1);
+
+	/* signed and unsigned numbers compare by value */
+	n1 = xbps_number_create_integer(1536);
+	n2 = xbps_number_create_unsigned_integer(1536);
+	ATF_REQUIRE(xbps_number_unsigned(n2));
+	ATF_REQUIRE(xbps_number_equals(n1, n2));
+	ATF_REQUIRE(xbps_number_equals_unsigned_integer(n1, 1536));
+	xbps_object_release(n1);
+	xbps_object_release(n2);
+	n1 = xbps_number_create_unsigned_integer(UINT64_MAX);
+	n2 = xbps_number_create_unsigned_integer(UINT64_MAX);
+	ATF_REQUIRE(n1 == n2);
+	ATF_REQUIRE_EQ(xbps_number_unsigned_integer_value(n1), UINT64_MAX);
+	ATF_REQUIRE_EQ(xbps_number_size(n1), 64);
+	ATF_REQUIRE(!xbps_number_equals_integer(n1, -1));
+	xbps_object_release(n1);
+	xbps_object_release(n2);
+
+	b = xbps_bool_create(true);
+	ATF_REQUIRE(b);
+	ATF_REQUIRE_EQ(xbps_object_type(b), XBPS_TYPE_BOOL);
+	ATF_REQUIRE(xbps_bool_true(b));
+	ATF_REQUIRE(!xbps_bool_equals(b, xbps_bool_create(false)));
+	/* type mismatches are caught */
+	ATF_REQUIRE_EQ(xbps_number_integer_value((xbps_number_t)b), 0);
+	ATF_REQUIRE_EQ(xbps_dictionary_count((xbps_dictionary_t)b), 0);
+	xbps_object_release(b);
+
+	d = xbps_dictionary_create();
+	ATF_REQUIRE(xbps_dictionary_set_int64(d, "i64", INT64_MIN));
+	ATF_REQUIRE(xbps_dictionary_set_int64(d, "neg", -42));
+	ATF_REQUIRE(xbps_dictionary_set_uint64(d, "u64", UINT64_MAX));
+	ATF_REQUIRE(xbps_dictionary_set_uint64(d, "mtime", 1532908800));
+	ATF_REQUIRE(xbps_dictionary_set_bool(d, "automatic-install", true));
+	ATF_REQUIRE(xbps_dictionary_set_bool(d, "hold", false));
+	x = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(x);
+	a = xbps_dictionary_internalize(x);
+	ATF_REQUIRE(a);
+	ATF_REQUIRE(xbps_dictionary_equals(a, d));
+	ATF_REQUIRE(xbps_dictionary_get_int64(a, "i64", &i64));
+	ATF_REQUIRE_EQ(i64, INT64_MIN);
+	ATF_REQUIRE(xbps_dictionary_get_int64(a, "neg", &i64));
+	ATF_REQUIRE_EQ(i64, -42);
+	ATF_REQUIRE(xbps_dictionary_get_uint64(a, "u64", &u64));
+	ATF_REQUIRE_EQ(u64, UINT64_MAX);
+	ATF_REQUIRE(xbps_dictionary_get_uint64(a, "mtime", &u64));
+	ATF_REQUIRE_EQ(u64, 1532908800);
+	ATF_REQUIRE(xbps_dictionary_get_bool(a, "automatic-install", &v));
+	ATF_REQUIRE(v);
+	ATF_REQUIRE(xbps_dictionary_get_bool(a, "hold", &v));
+	ATF_REQUIRE(!v);
+	xbps_object_release(a);
+
+	free(x);
+	xbps_object_release(d);
+}
+
+ATF_TC(array_test);
+
+ATF_TC_HEAD(array_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test array growth and bulk additions");
+}
+
+ATF_TC_BODY(array_test, tc)
+{
+	xbps_array_t a;
+	xbps_object_t objs[3];
+	const char *str;
+	char buf[16];
+	unsigned int i;
+
+	a = xbps_array_create();
+	ATF_REQUIRE(a);
+	for (i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "%u", i);
+		ATF_REQUIRE(xbps_array_add_cstring(a, buf));
+	}
+	ATF_REQUIRE_EQ(xbps_array_count(a), 1000);
+	objs[0] = xbps_string_create_cstring("first");
+	ATF_REQUIRE(xbps_array_add_first(a, objs[0]));
+	xbps_object_release(objs[0]);
+	ATF_REQUIRE(xbps_array_get_cstring_nocopy(a, 0, &str));
+	ATF_REQUIRE_STREQ(str, "first");
+	ATF_REQUIRE(xbps_array_get_cstring_nocopy(a, 1000, &str));
+	ATF_REQUIRE_STREQ(str, "999");
+
+	objs[0] = xbps_string_create_cstring("foo");
+	objs[1] = xbps_number_create_unsigned_integer(1);
+	objs[2] = xbps_string_create_cstring("bar");
+	ATF_REQUIRE(xbps_array_add_objects_and_rel(a, objs, 3));
+	ATF_REQUIRE_EQ(xbps_array_count(a), 1004);
+	ATF_REQUIRE(xbps_array_get_cstring_nocopy(a, 1001, &str));
+	ATF_REQUIRE_STREQ(str, "foo");
+	ATF_REQUIRE(xbps_array_get_cstring_nocopy(a, 1003, &str));
+	ATF_REQUIRE_STREQ(str, "bar");
+	ATF_REQUIRE(xbps_array_add_objects_and_rel(a, NULL, 0));
+
+	/* the references are released if the objects cannot be added */
+	objs[0] = xbps_string_create_cstring("foo");
+	objs[1] = NULL;
+	ATF_REQUIRE(!xbps_array_add_objects_and_rel(a, objs, 2));
+	xbps_array_make_immutable(a);
+	objs[0] = xbps_string_create_cstring("foo");
+	ATF_REQUIRE(!xbps_array_add_objects_and_rel(a, objs, 1));
+	ATF_REQUIRE_EQ(xbps_array_count(a), 1004);
+
+	xbps_object_release(a);
+}
+
+/*
+ * The accumulator of every slice records the indexes it saw, the merge
+ * appends them so that the result must be the array order.
+ */
+struct reduce_acc {
+	uint32_t idx[NKEYS];
+	unsigned int n;
+};
+
+struct reduce_res {
+	uint32_t idx[NKEYS];
+	unsigned int n;
+	unsigned int nacc;
+	uint32_t fail;
+	uint32_t stop;
+};
+
+static struct reduce_res *reduce_cur;
+
+static void *
+reduce_init(void *arg)
+{
+	struct reduce_res *res = arg;
+
+	__sync_fetch_and_add(&res->nacc, 1);
+	return calloc(1, sizeof(struct reduce_acc));
+}
+
+static int
+reduce_fn(struct xbps_handle *xhp, xbps_object_t obj, const char *key,
+	void *accp, bool *done)
+{
+	struct reduce_acc *acc = accp;
+	uint32_t v;
+
+	(void)xhp;
+	(void)key;
+	v = (uint32_t)xbps_number_unsigned_integer_value(obj);
+	if (v == reduce_cur->fail || v == reduce_cur->fail * 2)
+		return v == reduce_cur->fail ? EINVAL : EPERM;
+	acc->idx[acc->n++] = v;
+	if (v == reduce_cur->stop)
+		*done = true;
+	return 0;
+}
+
+static int
+reduce_merge(void *arg, void *accp)
+{
+	struct reduce_res *res = arg;
+	struct reduce_acc *acc = accp;
+
+	memcpy(res->idx + res->n, acc->idx, acc->n * sizeof(uint32_t));
+	res->n += acc->n;
+	return 0;
+}
+
+static void
+reduce_fini(void *accp)
+{
+	struct reduce_res *res = reduce_cur;
+
+	__sync_fetch_and_sub(&res->nacc, 1);
+	free(accp);
+}
+
+ATF_TC(reduce_test);
+
+ATF_TC_HEAD(reduce_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_array_foreach_reduce()");
+}
+
+ATF_TC_BODY(reduce_test, tc)
+{
+	struct xbps_handle xh;
+	struct reduce_res res;
+	struct xbps_reduce ops = {
+		.init = reduce_init,
+		.fn = reduce_fn,
+		.merge = reduce_merge,
+		.fini = reduce_fini,
+		.arg = &res
+	};
+	xbps_dictionary_t d;
+	xbps_array_t a, keys;
+	unsigned int i, nthreads[] = { 1, 3, 8 };
+
+	a = xbps_array_create();
+	for (i = 0; i < NKEYS; i++)
+		ATF_REQUIRE(xbps_array_add_uint32(a, i));
+
+	memset(&xh, 0, sizeof(xh));
+	reduce_cur = &res;
+	for (unsigned int t = 0; t < 3; t++) {
+		xh.worker_threads = nthreads[t];
+
+		/* everything is merged in array order */
+		memset(&res, 0, sizeof(res));
+		res.fail = res.stop = NKEYS;
+		ATF_CHECK_EQ(xbps_array_foreach_reduce(&xh, a, NULL, &ops), 0);
+		ATF_CHECK_EQ(res.n, NKEYS);
+		for (i = 0; i < res.n; i++)
+			ATF_REQUIRE_EQ(res.idx[i], i);
+		ATF_CHECK_EQ(res.nacc, 0);
+
+		/* the first error in array order is returned */
+		memset(&res, 0, sizeof(res));
+		res.fail = 1234;
+		res.stop = NKEYS;
+		ATF_CHECK_EQ(xbps_array_foreach_reduce(&xh, a, NULL, &ops), EINVAL);
+		ATF_CHECK_EQ(res.n, 1234);
+		for (i = 0; i < res.n; i++)
+			ATF_REQUIRE_EQ(res.idx[i], i);
+		ATF_CHECK_EQ(res.nacc, 0);
+
+		/* nothing after the object setting done is merged */
+		memset(&res, 0, sizeof(res));
+		res.fail = NKEYS;
+		res.stop = 777;
+		ATF_CHECK_EQ(xbps_array_foreach_reduce(&xh, a, NULL, &ops), 0);
+		ATF_CHECK_EQ(res.n, 778);
+		ATF_CHECK_EQ(res.idx[777], 777);
+		ATF_CHECK_EQ(res.nacc, 0);
+	}
+
+	/* internal objects of dictionaries are skipped */
+	d = fill(xbps_dictionary_create());
+	ATF_REQUIRE(xbps_dictionary_set_uint32(d, "_XBPS_FOO", NKEYS));
+	keys = xbps_dictionary_all_keys(d);
+	memset(&res, 0, sizeof(res));
+	res.fail = res.stop = NKEYS + 1;
+	ATF_CHECK_EQ(xbps_array_foreach_reduce(&xh, keys, d, &ops), 0);
+	ATF_CHECK_EQ(res.n, NKEYS);
+	xbps_object_release(keys);
+	xbps_object_release(d);
+
+	/* empty arrays and other objects do nothing */
+	memset(&res, 0, sizeof(res));
+	ATF_CHECK_EQ(xbps_array_foreach_reduce(&xh, NULL, NULL, &ops), 0);
+	xbps_object_release(a);
+	a = xbps_array_create();
+	ATF_CHECK_EQ(xbps_array_foreach_reduce(&xh, a, NULL, &ops), 0);
+	ATF_CHECK_EQ(res.nacc, 0);
+	xbps_object_release(a);
+}
+
+ATF_TC(copy_test);
+
+ATF_TC_HEAD(copy_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test copies of dictionaries sharing their storage");
+}
+
+static void
+check_copies(xbps_dictionary_t d)
+{
+	xbps_dictionary_t c1, c2, c3;
+	const char *str;
+	char *x1, *x2;
+
+	x1 = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(x1);
+	c1 = xbps_dictionary_copy_mutable(d);
+	c2 = xbps_dictionary_copy_mutable(c1);
+	c3 = xbps_dictionary_copy(d);
+	ATF_REQUIRE(c1 && c2 && c3);
+	ATF_REQUIRE(xbps_dictionary_equals(c1, d));
+	ATF_REQUIRE(xbps_dictionary_equals(c2, d));
+
+	/* modifying a copy does not affect the others */
+	ATF_REQUIRE(xbps_dictionary_set_cstring(c1, "foo", "baz"));
+	ATF_REQUIRE(xbps_dictionary_set_cstring(c1, "new", "new"));
+	xbps_dictionary_remove(c2, "bar");
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(c1, "foo", &str));
+	ATF_REQUIRE_STREQ(str, "baz");
+	ATF_REQUIRE_EQ(xbps_dictionary_count(c1), xbps_dictionary_count(d) + 1);
+	ATF_REQUIRE_EQ(xbps_dictionary_count(c2), xbps_dictionary_count(d) - 1);
+	ATF_REQUIRE(xbps_dictionary_get(c2, "bar") == NULL);
+	ATF_REQUIRE(xbps_dictionary_get(c3, "bar") != NULL);
+	ATF_REQUIRE(xbps_dictionary_get(c3, "new") == NULL);
+	x2 = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(x2);
+	ATF_REQUIRE_STREQ(x1, x2);
+	free(x2);
+
+	/* and neither does modifying the original */
+	ATF_REQUIRE(xbps_dictionary_set_cstring(d, "bar", "quux"));
+	ATF_REQUIRE(xbps_dictionary_ensure_capacity(c3, 1000));
+	x2 = xbps_dictionary_externalize(c3);
+	ATF_REQUIRE(x2);
+	ATF_REQUIRE_STREQ(x1, x2);
+	free(x2);
+
+	xbps_object_release(c3);
+	xbps_object_release(c1);
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(c2, "foo", &str));
+	ATF_REQUIRE_STREQ(str, "foo");
+	xbps_object_release(c2);
+	free(x1);
+}
+
+ATF_TC_BODY(copy_test, tc)
+{
+	xbps_dictionary_t d, c;
+
+	d = fill(xbps_dictionary_create());
+	ATF_REQUIRE(xbps_dictionary_set_cstring(d, "foo", "foo"));
+	ATF_REQUIRE(xbps_dictionary_set_cstring(d, "bar", "bar"));
+	check_copies(d);
+	xbps_object_release(d);
+
+	d = fill(xbps_dictionary_create_hashed(0));
+	ATF_REQUIRE(xbps_dictionary_set_cstring(d, "foo", "foo"));
+	ATF_REQUIRE(xbps_dictionary_set_cstring(d, "bar", "bar"));
+	check_copies(d);
+
+	/* the last copy to be released frees the storage */
+	c = xbps_dictionary_copy(d);
+	xbps_object_release(d);
+	ATF_REQUIRE(xbps_dictionary_get(c, "foo") != NULL);
+	ATF_REQUIRE(xbps_dictionary_set_cstring(c, "foo", "bar"));
+	xbps_object_release(c);
+
+	d = xbps_dictionary_create_hashed(0);
+	c = xbps_dictionary_copy_mutable(d);
+	ATF_REQUIRE(xbps_dictionary_set_cstring(c, "foo", "foo"));
+	ATF_REQUIRE_EQ(xbps_dictionary_count(d), 0);
+	xbps_object_release(d);
+	xbps_object_release(c);
+}
+
+#define PLIST_HEAD "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" \
+	"<plist version=\"1.0\">\n"
+
+ATF_TC(internalize_test);
+
+ATF_TC_HEAD(internalize_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_dictionary_internalize() with uncommon plists");
+}
+
+ATF_TC_BODY(internalize_test, tc)
+{
+	xbps_dictionary_t d;
+	xbps_array_t a;
+	const char *s;
+	int64_t i;
+	uint64_t u;
+	bool b;
+
+	d = xbps_dictionary_internalize(PLIST_HEAD "<dict>\n"
+	    "<key>a&amp;b</key><string>&lt;x&gt; &quot;&apos;&amp;</string>\n"
+	    "<key>arr</key><array>\n"
+	    "\t<integer>-5</integer><integer>0x10</integer>\n"
+	    "\t<true/><string/><dict/><array/></array>\n"
+	    "</dict></plist>");
+	ATF_REQUIRE(d);
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(d, "a&b", &s));
+	ATF_REQUIRE_STREQ(s, "<x> \"'&");
+	a = xbps_dictionary_get(d, "arr");
+	ATF_REQUIRE_EQ(xbps_array_count(a), 6);
+	ATF_REQUIRE(xbps_array_get_int64(a, 0, &i));
+	ATF_REQUIRE_EQ(i, -5);
+	ATF_REQUIRE(xbps_array_get_uint64(a, 1, &u));
+	ATF_REQUIRE_EQ(u, 16);
+	ATF_REQUIRE(xbps_array_get_bool(a, 2, &b));
+	ATF_REQUIRE(b);
+	ATF_REQUIRE(xbps_array_get_cstring_nocopy(a, 3, &s));
+	ATF_REQUIRE_STREQ(s, "");
+	xbps_object_release(d);
+
+	/* comments and attributes */
+	d = xbps_dictionary_internalize(PLIST_HEAD "<dict><!-- comment -->"
+	    "<key>a</key><string>x</string></dict></plist>");
+	ATF_REQUIRE(d);
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(d, "a", &s));
+	ATF_REQUIRE_STREQ(s, "x");
+	xbps_object_release(d);
+
+	/* malformed plists */
+	ATF_REQUIRE_EQ(xbps_dictionary_internalize(PLIST_HEAD "<dict>"
+	    "<key>a</key><string>x</string></array></plist>"), NULL);
+	ATF_REQUIRE_EQ(xbps_dictionary_internalize(PLIST_HEAD "<dict>"
+	    "<key>a</key><string>&bad;</string></dict></plist>"), NULL);
+	ATF_REQUIRE_EQ(xbps_dictionary_internalize(PLIST_HEAD "<dict>"
+	    "<key>a</key><string>x</string>"), NULL);
+	ATF_REQUIRE_EQ(xbps_dictionary_internalize(PLIST_HEAD "<dict>"
+	    "<key>a</key><integer>x</integer></dict></plist>"), NULL);
+}
+
+struct chunks {
+	const char *buf;
+	size_t len;
+	size_t chunk;
+};
+
+static ssize_t
+read_chunk(void *arg, void *buf, size_t len)
+{
+	struct chunks *c = arg;
+
+	if (len > c->chunk)
+		len = c->chunk;
+	if (len > c->len)
+		len = c->len;
+	memcpy(buf, c->buf, len);
+	c->buf += len;
+	c->len -= len;
+	return (ssize_t)len;
+}
+
+static xbps_dictionary_t
+internalize_chunks(const void *buf, size_t len, size_t chunk)
+{
+	struct chunks c = { buf, len, chunk };
+
+	return xbps_dictionary_internalize_stream(read_chunk, &c);
+}
+
+ATF_TC(stream_test);
+
+ATF_TC_HEAD(stream_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_dictionary_internalize_stream()");
+}
+
+ATF_TC_BODY(stream_test, tc)
+{
+	const size_t chunks[] = { 1, 7, 4096, 1 << 20 };
+	xbps_dictionary_t d, pkgd, c;
+	const char *xml;
+	unsigned char *bin;
+	char *buf;
+	size_t i, len;
+
+	d = fill(xbps_dictionary_create());
+	pkgd = xbps_dictionary_create();
+	ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "s", "<a&b>"));
+	ATF_REQUIRE(xbps_dictionary_set(d, "nested", pkgd));
+	xbps_object_release(pkgd);
+	buf = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(buf);
+	bin = xbps_dictionary_externalize_binary(d, &len);
+	ATF_REQUIRE(bin);
+
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+		c = internalize_chunks(buf, strlen(buf), chunks[i]);
+		ATF_REQUIRE(c);
+		ATF_REQUIRE(xbps_dictionary_equals(c, d));
+		xbps_object_release(c);
+		c = internalize_chunks(bin, len, chunks[i]);
+		ATF_REQUIRE(c);
+		ATF_REQUIRE(xbps_dictionary_equals(c, d));
+		xbps_object_release(c);
+	}
+	/* truncated documents */
+	for (len = strlen(buf) - 20; len < strlen(buf) - 8; len++)
+		ATF_REQUIRE_EQ(internalize_chunks(buf, len, 4096), NULL);
+	free(bin);
+	free(buf);
+	xbps_object_release(d);
+
+	/* comments, attributes and empty dictionaries */
+	xml = PLIST_HEAD "<dict><!-- <key> -->"
+	    "<key>a</key><string>x</string>\n"
+	    "<key>e</key><dict/><key>t</key><true/></dict></plist>";
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+		c = internalize_chunks(xml, strlen(xml), chunks[i]);
+		ATF_REQUIRE(c);
+		ATF_REQUIRE_EQ(xbps_dictionary_count(c), 3);
+		xbps_object_release(c);
+	}
+	xml = PLIST_HEAD "<dict/></plist>";
+	c = internalize_chunks(xml, strlen(xml), 1);
+	ATF_REQUIRE(c);
+	ATF_REQUIRE_EQ(xbps_dictionary_count(c), 0);
+	xbps_object_release(c);
+
+	/* malformed plists */
+	xml = PLIST_HEAD "<dict><key>a</key><string>x</string></array></plist>";
+	ATF_REQUIRE_EQ(internalize_chunks(xml, strlen(xml), 3), NULL);
+	xml = PLIST_HEAD "<dict><key>a</key><string>&bad;</string></dict></plist>";
+	ATF_REQUIRE_EQ(internalize_chunks(xml, strlen(xml), 3), NULL);
+	xml = PLIST_HEAD "<dict><string>x</string><string>x</string></dict>";
+	ATF_REQUIRE_EQ(internalize_chunks(xml, strlen(xml), 3), NULL);
+	xml = PLIST_HEAD "<array><string>x</string></array></plist>";
+	ATF_REQUIRE_EQ(internalize_chunks(xml, strlen(xml), 3), NULL);
+	ATF_REQUIRE_EQ(internalize_chunks("", 0, 3), NULL);
+}
+
+ATF_TC(binary_test);
+
+ATF_TC_HEAD(binary_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the binary plist format");
+}
+
+ATF_TC_BODY(binary_test, tc)
+{
+	xbps_dictionary_t d, pkgd, c;
+	xbps_array_t a;
+	xbps_data_t data;
+	unsigned char *bin;
+	char *xml, pkgver[32];
+	size_t len, i;
+
+	d = xbps_dictionary_create();
+	for (i = 0; i < 100; i++) {
+		pkgd = xbps_dictionary_create();
+		snprintf(pkgver, sizeof(pkgver), "pkg%zu-1.0_1", i);
+		ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "pkgver", pkgver));
+		ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "state", "installed"));
+		ATF_REQUIRE(xbps_dictionary_set_uint64(pkgd, "installed_size",
+		    UINT64_MAX - i));
+		ATF_REQUIRE(xbps_dictionary_set_int64(pkgd, "neg", -(int64_t)i));
+		ATF_REQUIRE(xbps_dictionary_set_bool(pkgd, "automatic-install",
+		    i % 2));
+		a = xbps_array_create();
+		ATF_REQUIRE(xbps_array_add_cstring(a, "glibc>=2.27_1"));
+		ATF_REQUIRE(xbps_array_add_cstring(a, ""));
+		ATF_REQUIRE(xbps_dictionary_set(pkgd, "run_depends", a));
+		xbps_object_release(a);
+		ATF_REQUIRE(xbps_dictionary_set(d, pkgver, pkgd));
+		xbps_object_release(pkgd);
+	}
+	data = xbps_data_create_data("\0\1\2\3", 4);
+	ATF_REQUIRE(xbps_dictionary_set(d, "data", data));
+	xbps_object_release(data);
+	pkgd = xbps_dictionary_create();
+	ATF_REQUIRE(xbps_dictionary_set(d, "empty", pkgd));
+	xbps_object_release(pkgd);
+
+	bin = xbps_dictionary_externalize_binary(d, &len);
+	xml = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(bin && xml);
+	ATF_CHECK(len < strlen(xml) / 2);
+
+	/* both formats are accepted */
+	c = xbps_dictionary_internalize_buffer(bin, len);
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	xbps_object_release(c);
+	c = xbps_dictionary_internalize_buffer(xml, strlen(xml));
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	xbps_object_release(c);
+
+	/* and so are files, compressed or not */
+	ATF_REQUIRE(xbps_dictionary_externalize_binary_to_file(d, "d.bin"));
+	c = xbps_dictionary_internalize_from_file("d.bin");
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	xbps_object_release(c);
+	c = xbps_dictionary_internalize_from_zfile("d.bin");
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	xbps_object_release(c);
+
+	/* the XML parser rejects binary plists */
+	ATF_REQUIRE_EQ(xbps_dictionary_internalize((char *)bin), NULL);
+
+	/* truncated and corrupted buffers */
+	for (i = 0; i < len; i++)
+		ATF_REQUIRE_EQ(xbps_dictionary_internalize_buffer(bin, i), NULL);
+	for (i = 0; i < len; i++) {
+		bin[i] ^= 0xff;
+		c = xbps_dictionary_internalize_buffer(bin, len);
+		if (c != NULL)
+			xbps_object_release(c);
+		bin[i] ^= 0xff;
+	}
+
+	free(bin);
+	free(xml);
+	xbps_object_release(d);
+}
+
+ATF_TC(externalize_file_test);
+
+ATF_TC_HEAD(externalize_file_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_dictionary_externalize_to_{,z}file()");
+}
+
+ATF_TC_BODY(externalize_file_test, tc)
+{
+	xbps_dictionary_t d, c;
+	xbps_array_t a;
+	FILE *f;
+	char *xml, *buf;
+	size_t len;
+
+	/* larger than the stream buffer */
+	d = fill(xbps_dictionary_create());
+	xml = xbps_dictionary_externalize(d);
+	ATF_REQUIRE(xml);
+	len = strlen(xml);
+	ATF_REQUIRE(len > 65536);
+
+	ATF_REQUIRE(xbps_dictionary_externalize_to_file(d, "d.plist"));
+	ATF_REQUIRE((f = fopen("d.plist", "r")));
+	buf = malloc(len + 1);
+	ATF_REQUIRE(buf);
+	ATF_REQUIRE_EQ(fread(buf, 1, len + 1, f), len);
+	fclose(f);
+	ATF_REQUIRE(memcmp(buf, xml, len) == 0);
+
+	ATF_REQUIRE(xbps_dictionary_externalize_to_zfile(d, "d.plist.gz"));
+	c = xbps_dictionary_internalize_from_zfile("d.plist.gz");
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	xbps_object_release(c);
+
+	/* the previous file is kept on errors */
+	ATF_REQUIRE(!xbps_dictionary_externalize_to_file(d, "nonexistent/d.plist"));
+	a = xbps_array_create();
+	ATF_REQUIRE(!xbps_dictionary_externalize_to_file(
+	    (xbps_dictionary_t)a, "d.plist"));
+	xbps_object_release(a);
+	c = xbps_dictionary_internalize_from_file("d.plist");
+	ATF_REQUIRE(c);
+	ATF_REQUIRE(xbps_dictionary_equals(c, d));
+	xbps_object_release(c);
+
+	free(buf);
+	free(xml);
+	xbps_object_release(d);
+}
+
+ATF_TC(modified_test);
+
+ATF_TC_HEAD(modified_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_object_modified() and xbps_object_clear_modified()");
+}
+
+ATF_TC_BODY(modified_test, tc)
+{
+	xbps_dictionary_t d, pkgd;
+	xbps_array_t a;
+	xbps_string_t s;
+
+	d = xbps_dictionary_create();
+	pkgd = xbps_dictionary_create();
+	a = xbps_array_create();
+	s = xbps_string_create_cstring("foo");
+	xbps_dictionary_set(pkgd, "run_depends", a);
+	xbps_dictionary_set(pkgd, "pkgver", s);
+	xbps_dictionary_set(d, "foo", pkgd);
+
+	/* new objects are modified */
+	ATF_REQUIRE(xbps_object_modified(d));
+	xbps_object_clear_modified(d);
+	ATF_REQUIRE(!xbps_object_modified(d));
+	ATF_REQUIRE(!xbps_object_modified(pkgd));
+	ATF_REQUIRE(!xbps_object_modified(a));
+
+	/* changes to nested objects are seen from the parent */
+	xbps_dictionary_set_cstring(pkgd, "state", "installed");
+	ATF_REQUIRE(xbps_object_modified(d));
+	xbps_object_clear_modified(d);
+
+	xbps_array_add_cstring(a, "bar>=0");
+	ATF_REQUIRE(xbps_object_modified(d));
+	xbps_object_clear_modified(d);
+
+	xbps_string_append_cstring(s, "-1.0_1");
+	ATF_REQUIRE(xbps_object_modified(d));
+	xbps_object_clear_modified(d);
+
+	xbps_dictionary_remove(pkgd, "state");
+	ATF_REQUIRE(xbps_object_modified(d));
+	xbps_object_clear_modified(d);
+
+	/* lookups do not modify */
+	ATF_REQUIRE(xbps_dictionary_get(d, "foo") == pkgd);
+	ATF_REQUIRE(xbps_array_count(a) == 1);
+	ATF_REQUIRE(!xbps_object_modified(d));
+
+	xbps_object_release(s);
+	xbps_object_release(a);
+	xbps_object_release(pkgd);
+	xbps_object_release(d);
+}
+
+#define LOOKUP_ROUNDS	20
+#define LOOKUP_THREADS	4
+
+static xbps_dictionary_t
+pkgdb(bool immutable)
+{
+	xbps_dictionary_t d, pkgd;
+	char key[32];
+	unsigned int i, k;
+
+	d = xbps_dictionary_create_hashed(0);
+	for (i = 0; i < NKEYS; i++) {
+		k = (i * 7919) % NKEYS;
+		snprintf(key, sizeof(key), "pkg-%u", k);
+		pkgd = xbps_dictionary_create();
+		ATF_REQUIRE(xbps_dictionary_set_cstring(pkgd, "pkgver", key));
+		ATF_REQUIRE(xbps_dictionary_set_uint32(pkgd, "n", k));
+		if (immutable)
+			xbps_dictionary_make_immutable(pkgd);
+		ATF_REQUIRE(xbps_dictionary_set(d, key, pkgd));
+		xbps_object_release(pkgd);
+	}
+	if (immutable)
+		xbps_dictionary_make_immutable(d);
+	return d;
+}
+
+struct lookup {
+	pthread_t thread;
+	xbps_dictionary_t d;
+	xbps_array_t keys;
+	unsigned int found;
+};
+
+static void *
+lookup_thread(void *arg)
+{
+	struct lookup *l = arg;
+	xbps_dictionary_t pkgd;
+	const char *pkgver;
+	uint32_t n;
+	unsigned int i, r;
+
+	for (r = 0; r < LOOKUP_ROUNDS; r++) {
+		for (i = 0; i < xbps_array_count(l->keys); i++) {
+			pkgd = xbps_dictionary_get_keysym(l->d,
+			    xbps_array_get(l->keys, i));
+			if (xbps_dictionary_get_cstring_nocopy(pkgd, "pkgver",
+			    &pkgver) &&
+			    xbps_dictionary_get_uint32(pkgd, "n", &n))
+				l->found++;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Runs the lookups xbps_pkgdb_foreach_cb_multi() callbacks do on
+ * nthreads threads, every one of them must find all packages.
+ */
+static void
+lookups(xbps_dictionary_t d, bool immutable, unsigned int nthreads)
+{
+	struct lookup *l;
+	xbps_array_t keys;
+	unsigned int i;
+
+	keys = xbps_dictionary_all_keys(d);
+	ATF_REQUIRE(keys);
+	if (immutable)
+		xbps_array_make_immutable(keys);
+
+	l = calloc(nthreads, sizeof(*l));
+	ATF_REQUIRE(l);
+	for (i = 0; i < nthreads; i++) {
+		l[i].d = d;
+		l[i].keys = keys;
+		ATF_REQUIRE(pthread_create(&l[i].thread, NULL,
+		    lookup_thread, &l[i]) == 0);
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(l[i].thread, NULL);
+
+	for (i = 0; i < nthreads; i++)
+		ATF_REQUIRE_EQ(l[i].found, NKEYS * LOOKUP_ROUNDS);
+	free(l);
+	xbps_object_release(keys);
+}
+
+ATF_TC(immutable_test);
+
+ATF_TC_HEAD(immutable_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test lock-free lookups in immutable dictionaries");
+}
+
+ATF_TC_BODY(immutable_test, tc)
+{
+	xbps_dictionary_t d, m;
+	xbps_object_iterator_t iter;
+	xbps_object_t obj;
+	const char *key, *prev = NULL;
+
+	m = pkgdb(false);
+	d = pkgdb(true);
+	ATF_REQUIRE(!xbps_dictionary_set_uint32(d, "pkg-0", 0));
+	ATF_REQUIRE(!xbps_dictionary_set_uint32(d, "new", 0));
+	ATF_REQUIRE_EQ(xbps_dictionary_count(d), NKEYS);
+
+	/* keys were inserted unordered, it was sorted when frozen */
+	iter = xbps_dictionary_iterator(d);
+	ATF_REQUIRE(iter);
+	while ((obj = xbps_object_iterator_next(iter))) {
+		key = xbps_dictionary_keysym_cstring_nocopy(obj);
+		if (prev != NULL)
+			ATF_REQUIRE(strcmp(prev, key) < 0);
+		prev = key;
+	}
+	xbps_object_iterator_release(iter);
+	ATF_REQUIRE(xbps_dictionary_equals(d, m));
+
+	/* how lookups scale with threads is measured by xbps_bench */
+	lookups(m, false, LOOKUP_THREADS);
+	lookups(d, true, LOOKUP_THREADS);
+
+	xbps_object_release(m);
+	xbps_object_release(d);
+}
+
+#define KEYSYM_THREADS	8
+
+static void *
+keysym_thread(void *arg)
+{
+	xbps_dictionary_t d;
+	char key[32];
+	unsigned int i, r, *ok = arg;
+
+	for (r = 0; r < 20; r++) {
+		d = xbps_dictionary_create();
+		for (i = 0; i < 1000; i++) {
+			snprintf(key, sizeof(key), "key-%u", (i + r * 37) % 1000);
+			if (!xbps_dictionary_set_uint32(d, key, i))
+				return NULL;
+		}
+		if (xbps_dictionary_count(d) != 1000)
+			return NULL;
+		xbps_object_release(d);
+	}
+	*ok = 1;
+	return NULL;
+}
+
+ATF_TC(keysym_test);
+
+ATF_TC_HEAD(keysym_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test keysyms interned and released by several threads");
+}
+
+ATF_TC_BODY(keysym_test, tc)
+{
+	pthread_t thd[KEYSYM_THREADS];
+	unsigned int ok[KEYSYM_THREADS] = { 0 };
+	xbps_dictionary_t d1, d2;
+	xbps_array_t k1, k2;
+	unsigned int i;
+
+	for (i = 0; i < KEYSYM_THREADS; i++)
+		ATF_REQUIRE(pthread_create(&thd[i], NULL, keysym_thread,
+		    &ok[i]) == 0);
+	for (i = 0; i < KEYSYM_THREADS; i++) {
+		pthread_join(thd[i], NULL);
+		ATF_REQUIRE(ok[i]);
+	}
+
+	/* equal keys share the same keysym */
+	d1 = fill(xbps_dictionary_create());
+	d2 = fill(xbps_dictionary_create_hashed(0));
+	k1 = xbps_dictionary_all_keys(d1);
+	k2 = xbps_dictionary_all_keys(d2);
+	ATF_REQUIRE_EQ(xbps_array_count(k1), NKEYS);
+	for (i = 0; i < NKEYS; i++)
+		ATF_REQUIRE(xbps_array_get(k1, i) == xbps_array_get(k2, i));
+	xbps_object_release(k1);
+	xbps_object_release(k2);
+	xbps_object_release(d1);
+	xbps_object_release(d2);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, hashed_test);
+	ATF_TP_ADD_TC(tp, arena_test);
+	ATF_TP_ADD_TC(tp, arena_intern_test);
+	ATF_TP_ADD_TC(tp, memstat_test);
+	ATF_TP_ADD_TC(tp, number_test);
+	ATF_TP_ADD_TC(tp, array_test);
+	ATF_TP_ADD_TC(tp, reduce_test);
+	ATF_TP_ADD_TC(tp, copy_test);
+	ATF_TP_ADD_TC(tp, internalize_test);
+	ATF_TP_ADD_TC(tp, stream_test);
+	ATF_TP_ADD_TC(tp, binary_test);
+	ATF_TP_ADD_TC(tp, externalize_file_test);
+	ATF_TP_ADD_TC(tp, modified_test);
+	ATF_TP_ADD_TC(tp, immutable_test);
+	ATF_TP_ADD_TC(tp, keysym_test);
+
+	return atf_no_error();
+}
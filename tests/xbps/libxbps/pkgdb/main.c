@@ -23,6 +23,8 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *-
  */
+#include <limits.h>
+#include <unistd.h>
 #include <atf-c.h>
 #include <xbps.h>
 
@@ -176,12 +178,84 @@ ATF_TC_BODY(pkgdb_pkg_reverts_test, tc)
 	ATF_REQUIRE_EQ(xbps_pkg_reverts(pkgd, "reverts-0.5_1"), 0);
 }
 
+static void
+write_files_plist(const char *file)
+{
+	xbps_dictionary_t filesd, obj;
+	xbps_array_t array;
+
+	filesd = xbps_dictionary_create();
+	array = xbps_array_create();
+	obj = xbps_dictionary_create();
+	xbps_dictionary_set_cstring(obj, "file", file);
+	xbps_array_add(array, obj);
+	xbps_dictionary_set(filesd, "files", array);
+	ATF_REQUIRE(xbps_dictionary_externalize_to_file(filesd,
+	    ".mixed-files.plist"));
+	xbps_object_release(obj);
+	xbps_object_release(array);
+	xbps_object_release(filesd);
+}
+
+ATF_TC(pkgdb_get_pkg_files_test);
+ATF_TC_HEAD(pkgdb_get_pkg_files_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test xbps_pkgdb_get_pkg_files() cache");
+}
+
+ATF_TC_BODY(pkgdb_get_pkg_files_test, tc)
+{
+	struct xbps_handle xh;
+	xbps_dictionary_t pkgd, filesd, filesd2;
+	const char *tcsdir, *file;
+	char cwd[PATH_MAX], *path;
+
+	/* get test source dir */
+	tcsdir = atf_tc_get_config_var(tc, "srcdir");
+	ATF_REQUIRE(getcwd(cwd, sizeof(cwd)));
+
+	/* metadir must be writable */
+	path = xbps_xasprintf("%s/pkgdb-0.38.plist", tcsdir);
+	pkgd = xbps_dictionary_internalize_from_file(path);
+	free(path);
+	ATF_REQUIRE(pkgd);
+	ATF_REQUIRE(xbps_dictionary_externalize_to_file(pkgd,
+	    "pkgdb-0.38.plist"));
+	xbps_object_release(pkgd);
+	write_files_plist("/usr/bin/foo");
+
+	memset(&xh, 0, sizeof(xh));
+	xbps_strlcpy(xh.rootdir, cwd, sizeof(xh.rootdir));
+	xbps_strlcpy(xh.metadir, cwd, sizeof(xh.metadir));
+	xh.flags = XBPS_FLAG_DEBUG;
+	ATF_REQUIRE_EQ(xbps_init(&xh), 0);
+
+	filesd = xbps_pkgdb_get_pkg_files(&xh, "mixed");
+	ATF_REQUIRE_EQ(xbps_object_type(filesd), XBPS_TYPE_DICTIONARY);
+	filesd2 = xbps_pkgdb_get_pkg_files(&xh, "mixed");
+	ATF_CHECK_EQ(filesd, filesd2);
+	xbps_object_release(filesd2);
+	xbps_object_release(filesd);
+
+	/* a rewritten files plist is read again */
+	write_files_plist("/usr/bin/foobar");
+	filesd = xbps_pkgdb_get_pkg_files(&xh, "mixed");
+	ATF_REQUIRE_EQ(xbps_object_type(filesd), XBPS_TYPE_DICTIONARY);
+	xbps_dictionary_get_cstring_nocopy(xbps_array_get(
+	    xbps_dictionary_get(filesd, "files"), 0), "file", &file);
+	ATF_REQUIRE_STREQ(file, "/usr/bin/foobar");
+	xbps_object_release(filesd);
+
+	xbps_end(&xh);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, pkgdb_get_pkg_test);
 	ATF_TP_ADD_TC(tp, pkgdb_get_virtualpkg_test);
 	ATF_TP_ADD_TC(tp, pkgdb_get_pkg_revdeps_test);
 	ATF_TP_ADD_TC(tp, pkgdb_pkg_reverts_test);
+	ATF_TP_ADD_TC(tp, pkgdb_get_pkg_files_test);
 
 	return atf_no_error();
 }
@@ -54,8 +54,92 @@ ATF_TC_BODY(pkgpattern_match_test, tc)
 	ATF_REQUIRE_EQ(xbps_pkgpattern_match("foo-1.11", "foo-1.[0-2][2-4]?"), 0);
 }
 
+ATF_TC(pattern_compiled_test);
+
+ATF_TC_HEAD(pattern_compiled_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test xbps_pattern_match_compiled");
+}
+
+ATF_TC_BODY(pattern_compiled_test, tc)
+{
+	struct xbps_pattern *pat;
+	const char *pkgvers[] = {
+		"foo-1.0", "foo-1.0_1", "foo-1.5_2", "foo-2.0_1", "foo-2.0rc1_1",
+		"foo-blah-1.0_1", "bar-1.0_1", "foo-1.01", "foo-1.24",
+		"foo-1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18_1", NULL
+	};
+	const char *patterns[] = {
+		"foo>=0", "foo>=1.0", "foo>=1.0<1.0_1", "foo>1.0_1", "foo<1.0",
+		"foo-1.0", "foo-[0-1].[0-9]*", "foo>=1.0<2.0", "foo>=1.0<=2.0_1",
+		"foo-blah>=1", "foo<2.0", "foo>=1.[0-2][2-4]?", "foo-1.[0-9]?",
+		"foo>=1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.17",
+		"foo<=1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18", "foo", NULL
+	};
+
+	/* compiled patterns match as xbps_pkgpattern_match() */
+	for (int i = 0; patterns[i]; i++) {
+		pat = xbps_pattern_compile(patterns[i]);
+		ATF_REQUIRE(pat);
+		for (int x = 0; pkgvers[x]; x++) {
+			ATF_CHECK_EQ(xbps_pattern_match_compiled(pat, pkgvers[x]),
+			    xbps_pkgpattern_match(pkgvers[x], patterns[i]));
+		}
+		xbps_pattern_free(pat);
+	}
+
+	pat = xbps_pattern_compile("foo>=1.0<2.0");
+	ATF_REQUIRE(pat);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat, "foo-1.5_2"), 1);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat, "foo-2.0rc1_1"), 1);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat, "foo-2.0_1"), 0);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat, "foo-blah-1.0_1"), 0);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat, "foo"), 0);
+	xbps_pattern_free(pat);
+
+	pat = xbps_pattern_compile(
+	    "foo>=1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.17");
+	ATF_REQUIRE(pat);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat,
+	    "foo-1.2.3.4.5.6.7.8.9.10.11.12.13.14.15.16.17.18_1"), 1);
+	ATF_REQUIRE_EQ(xbps_pattern_match_compiled(pat, "foo-1.0"), 0);
+	xbps_pattern_free(pat);
+	xbps_pattern_free(NULL);
+}
+
+ATF_TC(pattern_pkgname_test);
+
+ATF_TC_HEAD(pattern_pkgname_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test xbps_pattern_pkgname");
+}
+
+ATF_TC_BODY(pattern_pkgname_test, tc)
+{
+	struct xbps_pattern *pat;
+	const char *patterns[] = {
+		"foo>=1.0", "foo-blah>=1<2", "foo-1.0_1", "foo-[0-1].[0-9]*",
+		"foo", "foo-blah", NULL
+	};
+	const char *pkgnames[] = {
+		"foo", "foo-blah", "foo", "foo", NULL, NULL
+	};
+
+	for (int i = 0; patterns[i]; i++) {
+		pat = xbps_pattern_compile(patterns[i]);
+		ATF_REQUIRE(pat);
+		if (pkgnames[i] == NULL)
+			ATF_CHECK(xbps_pattern_pkgname(pat) == NULL);
+		else
+			ATF_CHECK_STREQ(xbps_pattern_pkgname(pat), pkgnames[i]);
+		xbps_pattern_free(pat);
+	}
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, pkgpattern_match_test);
+	ATF_TP_ADD_TC(tp, pattern_compiled_test);
+	ATF_TP_ADD_TC(tp, pattern_pkgname_test);
 	return atf_no_error();
 }
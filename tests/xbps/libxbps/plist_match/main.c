@@ -90,12 +90,52 @@ ATF_TC_BODY(match_pkgdep_test, tc)
 	ATF_REQUIRE_EQ(xbps_match_pkgdep_in_array(a, "foo-2.0_1"), true);
 }
 
+ATF_TC(match_internalized_test);
+ATF_TC_HEAD(match_internalized_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the match functions with internalized arrays");
+}
+
+ATF_TC_BODY(match_internalized_test, tc)
+{
+	xbps_dictionary_t d;
+	xbps_array_t a, rundeps;
+
+	d = xbps_dictionary_internalize(
+	    "<plist version=\"1.0\"><dict><key>provides</key><array>"
+	    "<string>foo-2.0_1</string><string>blah-2.1_1</string>"
+	    "</array><key>run_depends</key><array>"
+	    "<string>glibc>=2.0</string><string>blah>=2.1_1</string>"
+	    "</array></dict></plist>");
+	ATF_REQUIRE(d != NULL);
+	a = xbps_dictionary_get(d, "provides");
+	rundeps = xbps_dictionary_get(d, "run_depends");
+	ATF_REQUIRE_EQ(xbps_match_string_in_array(a, "foo-2.0_1"), true);
+	ATF_REQUIRE_EQ(xbps_match_string_in_array(a, "foo-2.0"), false);
+	ATF_REQUIRE_EQ(xbps_match_pkgname_in_array(a, "blah"), true);
+	ATF_REQUIRE_EQ(xbps_match_pkgname_in_array(a, "bla"), false);
+	ATF_REQUIRE_EQ(xbps_match_pkgver_in_array(a, "blah-2.1_1"), false);
+	ATF_REQUIRE_EQ(xbps_match_pkgpattern_in_array(a, "foo>=1.0"), true);
+	ATF_REQUIRE_EQ(xbps_match_pkgdep_in_array(rundeps, "glibc-2.1_1"), true);
+	ATF_REQUIRE_EQ(xbps_match_any_virtualpkg_in_rundeps(rundeps, a), true);
+
+	/* modified arrays are matched with their new contents */
+	ATF_REQUIRE(xbps_array_add_cstring_nocopy(a, "baz-1.0_1"));
+	ATF_REQUIRE_EQ(xbps_match_pkgname_in_array(a, "baz"), true);
+	xbps_array_remove(a, 1);
+	ATF_REQUIRE_EQ(xbps_match_pkgname_in_array(a, "blah"), false);
+	ATF_REQUIRE_EQ(xbps_match_any_virtualpkg_in_rundeps(rundeps, a), false);
+	xbps_object_release(d);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, match_string_test);
 	ATF_TP_ADD_TC(tp, match_pkgname_test);
 	ATF_TP_ADD_TC(tp, match_pkgpattern_test);
 	ATF_TP_ADD_TC(tp, match_pkgdep_test);
+	ATF_TP_ADD_TC(tp, match_internalized_test);
 
 	return atf_no_error();
 }
@@ -0,0 +1,149 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <atf-c.h>
+#include <xbps.h>
+
+static void
+handle_init(struct xbps_handle *xhp, const char *rootdir, const char *repo)
+{
+	char cwd[PATH_MAX];
+
+	ATF_REQUIRE(getcwd(cwd, sizeof(cwd)) != NULL);
+	memset(xhp, 0, sizeof(*xhp));
+	snprintf(xhp->rootdir, sizeof(xhp->rootdir), "%s/%s", cwd, rootdir);
+	ATF_REQUIRE_EQ(mkdir(xhp->rootdir, 0755), 0);
+	ATF_REQUIRE_EQ(xbps_init(xhp), 0);
+	ATF_REQUIRE(xbps_repo_store(xhp, repo));
+}
+
+ATF_TC(rpool_handles_test);
+
+ATF_TC_HEAD(rpool_handles_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the repository pools of several handles");
+}
+
+ATF_TC_BODY(rpool_handles_test, tc)
+{
+	struct xbps_handle xa, xb;
+	struct xbps_repo *ra, *rb;
+	xbps_dictionary_t pkga, pkgb;
+	char repo[PATH_MAX];
+	const char *pkgver;
+	bool automatic;
+
+	ATF_REQUIRE_EQ(system("mkdir -p repo pkg_A && touch pkg_A/file00 && "
+	    "cd repo && xbps-create -A noarch -n foo-1.0_1 -s foo ../pkg_A "
+	    ">/dev/null && xbps-rindex -a $PWD/*.xbps >/dev/null"), 0);
+	ATF_REQUIRE(realpath("repo", repo) != NULL);
+
+	handle_init(&xa, "root_a", repo);
+	handle_init(&xb, "root_b", repo);
+
+	pkga = xbps_rpool_get_pkg(&xa, "foo");
+	ATF_REQUIRE(pkga != NULL);
+	pkgb = xbps_rpool_get_pkg(&xb, "foo");
+	ATF_REQUIRE(pkgb != NULL);
+	xbps_dictionary_get_cstring_nocopy(pkgb, "pkgver", &pkgver);
+	ATF_REQUIRE_STREQ(pkgver, "foo-1.0_1");
+
+	/* every handle has its own repositories and package dictionaries */
+	ra = xbps_rpool_get_repo(repo);
+	ATF_REQUIRE(ra != NULL);
+	ATF_REQUIRE(ra->xhp == &xb);
+	ATF_REQUIRE(pkga != pkgb);
+	xbps_dictionary_set_bool(pkga, "automatic-install", true);
+	ATF_REQUIRE(!xbps_dictionary_get_bool(pkgb, "automatic-install",
+	    &automatic));
+
+	/* the index is still usable once the other handle released it */
+	xbps_rpool_release(&xa);
+	xbps_end(&xa);
+	rb = xbps_rpool_get_repo(repo);
+	ATF_REQUIRE(rb == ra);
+	ATF_REQUIRE(xbps_repo_get_pkg(rb, "foo") == pkgb);
+	ATF_REQUIRE(xbps_repo_get_virtualpkg(rb, "bar") == NULL);
+	ATF_REQUIRE_EQ(xbps_dictionary_count(xbps_repo_get_index(rb)), 1);
+
+	xbps_rpool_release(&xb);
+	xbps_end(&xb);
+	ATF_REQUIRE(xbps_rpool_get_repo(repo) == NULL);
+}
+
+ATF_TC(rpool_misses_test);
+
+ATF_TC_HEAD(rpool_misses_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the lookups of packages not found in the repository pool");
+}
+
+ATF_TC_BODY(rpool_misses_test, tc)
+{
+	struct xbps_handle xh;
+	char repo[PATH_MAX];
+
+	ATF_REQUIRE_EQ(system("mkdir -p repo pkg_A && touch pkg_A/file00 && "
+	    "cd repo && xbps-create -A noarch -n foo-1.0_1 -s foo "
+	    "--provides vfoo-1_1 ../pkg_A >/dev/null && "
+	    "xbps-rindex -a $PWD/*.xbps >/dev/null"), 0);
+	ATF_REQUIRE(realpath("repo", repo) != NULL);
+	handle_init(&xh, "root", repo);
+
+	for (int i = 0; i < 2; i++) {
+		errno = 0;
+		ATF_REQUIRE(xbps_rpool_get_pkg(&xh, "bar") == NULL);
+		ATF_REQUIRE_EQ(errno, ENOENT);
+		errno = 0;
+		ATF_REQUIRE(xbps_rpool_get_pkg(&xh, "foo>=2.0") == NULL);
+		ATF_REQUIRE_EQ(errno, ENOENT);
+		errno = 0;
+		ATF_REQUIRE(xbps_rpool_get_virtualpkg(&xh, "foo") == NULL);
+		ATF_REQUIRE_EQ(errno, ENOENT);
+		/* misses of other patterns and lookup types don't match */
+		ATF_REQUIRE(xbps_rpool_get_pkg(&xh, "foo>=1.0") != NULL);
+		ATF_REQUIRE(xbps_rpool_get_pkg(&xh, "foo") != NULL);
+		ATF_REQUIRE(xbps_rpool_get_virtualpkg(&xh, "vfoo") != NULL);
+	}
+
+	xbps_rpool_release(&xh);
+	xbps_end(&xh);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, rpool_handles_test);
+	ATF_TP_ADD_TC(tp, rpool_misses_test);
+
+	return atf_no_error();
+}
@@ -31,6 +31,44 @@ EOF
 	atf_check_equal $perms 644
 }
 
+atf_test_case parallel_order
+
+parallel_order_head() {
+	atf_set "descr" "Tests for pkg configuration: parallel jobs honor run dependencies"
+}
+
+parallel_order_body() {
+	mkdir -p repo
+	for p in A B C; do
+		mkdir -p pkg_$p
+		cat >pkg_$p/INSTALL<<EOF
+#!/bin/sh
+case "\$1" in
+post)
+	echo \$2 >> order
+	;;
+esac
+EOF
+	done
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "B>=0" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -C empty.conf -r root --repository=$PWD/repo -yd C
+	atf_check_equal $? 0
+	rm -f root/order
+	xbps-reconfigure -C empty.conf -r root -f -a -j 4
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/order | tr '\n' ' ')" "A B C "
+}
+
 atf_init_test_cases() {
 	atf_add_test_case filemode
+	atf_add_test_case parallel_order
 }
@@ -281,6 +281,41 @@ conflicts_trans_installed_multi_body() {
 	atf_check_equal $(xbps-query -r root -l|wc -l) 2
 }
 
+atf_test_case conflicts_installed_vpkg
+
+conflicts_installed_vpkg_head() {
+	atf_set "descr" "Tests for pkg conflicts: installed pkgs conflict with virtual pkgs and globs in transaction"
+}
+
+conflicts_installed_vpkg_body() {
+	mkdir some_repo
+	mkdir -p pkg_{A,B}/usr/bin
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --conflicts "vB>=1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --conflicts "D-[0-9]*" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --provides "vB-1.0_1" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=$PWD/some_repo -dy A C
+	atf_check_equal $? 0
+	xbps-install -r root --repository=$PWD/some_repo -dy B
+	atf_check_equal $? 11
+	xbps-install -r root --repository=$PWD/some_repo -dy D
+	atf_check_equal $? 11
+	xbps-install -r root --repository=$PWD/some_repo -dy E
+	atf_check_equal $? 0
+	atf_check_equal $(xbps-query -r root -l|wc -l) 3
+}
+
 atf_init_test_cases() {
 	atf_add_test_case conflicts_trans
 	atf_add_test_case conflicts_trans_hold
@@ -290,5 +325,6 @@ atf_init_test_cases() {
 	atf_add_test_case conflicts_trans_installed_multi
 	atf_add_test_case conflicts_installed
 	atf_add_test_case conflicts_installed_multi
+	atf_add_test_case conflicts_installed_vpkg
 	atf_add_test_case conflicts_trans_update
 }
@@ -0,0 +1,123 @@
+#! /usr/bin/env atf-sh
+
+atf_test_case consolidate
+
+consolidate_head() {
+	atf_set "descr" "Tests for pkgdb: consolidated files metadata"
+}
+
+consolidate_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/lib pkg_C/usr/share
+	touch pkg_A/usr/bin/foo
+	touch pkg_B/usr/lib/libfoo.so.1
+	ln -sf libfoo.so.1 pkg_B/usr/lib/libfoo.so
+	touch pkg_C/usr/share/bar
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=$PWD/repo -yd A B
+	atf_check_equal $? 0
+	xbps-pkgdb -r root --consolidate
+	atf_check_equal $? 0
+	atf_check_equal "$(ls -A root/var/db/xbps | grep -c files.plist)" 0
+	atf_check -o inline:"/usr/lib/libfoo.so.1\n/usr/lib/libfoo.so -> /usr/lib/libfoo.so.1\n" -- xbps-query -r root -f B
+	xbps-pkgdb -r root -a
+	atf_check_equal $? 0
+
+	# plists written by the unpacker are stored when pkgdb is flushed
+	xbps-install -r root --repository=$PWD/repo -yd C
+	atf_check_equal $? 0
+	atf_check_equal "$(ls -A root/var/db/xbps | grep -c files.plist)" 0
+	atf_check -o inline:"/usr/share/bar\n" -- xbps-query -r root -f C
+
+	xbps-remove -r root -yd A
+	atf_check_equal $? 0
+	test -e root/usr/bin/foo
+	atf_check_equal $? 1
+	atf_check -o inline:"B-1.0_1: /usr/lib/libfoo.so.1 (regular file)\n" -- xbps-query -r root -o /usr/lib/libfoo.so.1
+}
+
+atf_test_case export_files
+
+export_files_head() {
+	atf_set "descr" "Tests for pkgdb: export consolidated files metadata"
+}
+
+export_files_body() {
+	mkdir -p repo pkg_A/usr/bin
+	touch pkg_A/usr/bin/foo
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	cp root/var/db/xbps/.A-files.plist A-files.plist
+	xbps-pkgdb -r root --consolidate
+	atf_check_equal $? 0
+	test -e root/var/db/xbps/.A-files.plist
+	atf_check_equal $? 1
+	xbps-pkgdb -r root --export-files
+	atf_check_equal $? 0
+	cmp -s A-files.plist root/var/db/xbps/.A-files.plist
+	atf_check_equal $? 0
+	xbps-pkgdb -r root A
+	atf_check_equal $? 0
+	atf_check -o inline:"/usr/bin/foo\n" -- xbps-query -r root -f A
+}
+
+atf_test_case binary_files
+
+binary_files_head() {
+	atf_set "descr" "Tests for pkgdb: files metadata written in binary form"
+}
+
+binary_files_body() {
+	mkdir -p repo pkg_A/usr/bin conf.d
+	touch pkg_A/usr/bin/foo
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	echo "binary_plists=true" > conf.d/binary.conf
+	xbps-install -r root -C $PWD/conf.d --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	# binary plists start with a NUL byte
+	atf_check_equal "$(head -c1 root/var/db/xbps/.A-files.plist | od -An -tx1 | tr -d ' ')" 00
+	atf_check -o inline:"/usr/bin/foo\n" -- xbps-query -r root -C empty.conf -f A
+	xbps-pkgdb -r root -C empty.conf -a
+	atf_check_equal $? 0
+
+	# stored and exported as XML
+	xbps-pkgdb -r root -C empty.conf --consolidate
+	atf_check_equal $? 0
+	atf_check -o inline:"/usr/bin/foo\n" -- xbps-query -r root -C empty.conf -f A
+	xbps-pkgdb -r root -C empty.conf --export-files
+	atf_check_equal $? 0
+	atf_check_equal "$(head -c1 root/var/db/xbps/.A-files.plist)" "<"
+	xbps-pkgdb -r root -C empty.conf -a
+	atf_check_equal $? 0
+}
+
+atf_init_test_cases() {
+	atf_add_test_case consolidate
+	atf_add_test_case export_files
+	atf_add_test_case binary_files
+}
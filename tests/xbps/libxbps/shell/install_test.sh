@@ -265,6 +265,47 @@ install_bestmatch_deps_body() {
 	atf_check_equal $out B-1.1_1
 }
 
+atf_test_case install_bestmatch_pattern
+
+install_bestmatch_pattern_head() {
+	atf_set "descr" "Tests for pkg installations: install with bestmatching enabled for versioned deps"
+}
+
+install_bestmatch_pattern_body() {
+	mkdir -p repo repo2 repo3 pkg_A/usr/bin pkg_B/usr/bin
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A<1.2" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ../repo2
+	xbps-create -A noarch -n A-1.2_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ../repo3
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+
+	cd ..
+	mkdir -p root/xbps.d
+	echo "bestmatching=true" > root/xbps.d/bestmatch.conf
+	xbps-install -C xbps.d -r root --repository=$PWD/repo --repository=$PWD/repo2 --repository=$PWD/repo3 -yvd B
+	atf_check_equal $? 0
+	out=$(xbps-query -r root -p pkgver A)
+	atf_check_equal $out A-1.1_1
+	mkdir -p root2/xbps.d
+	cp root/xbps.d/bestmatch.conf root2/xbps.d
+	xbps-install -C xbps.d -r root2 --repository=$PWD/repo --repository=$PWD/repo2 --repository=$PWD/repo3 -yd A-1.0_1
+	atf_check_equal $? 0
+	out=$(xbps-query -r root2 -p pkgver A)
+	atf_check_equal $out A-1.0_1
+}
+
 atf_test_case install_bestmatch_disabled
 
 install_bestmatch_disabled_head() {
@@ -292,6 +333,197 @@ install_bestmatch_disabled_body() {
 	atf_check_equal $out A-1.0_1
 }
 
+atf_test_case install_pipeline
+
+install_pipeline_head() {
+	atf_set "descr" "Tests for pkg installations: install with pipeline_commit enabled"
+}
+
+install_pipeline_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/bin
+	touch pkg_A/usr/bin/A pkg_B/usr/bin/B pkg_C/usr/bin/C
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "B>=0" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	mkdir -p root/xbps.d
+	echo "pipeline_commit=true" > root/xbps.d/pipeline.conf
+	echo "fetch_jobs=2" >> root/xbps.d/pipeline.conf
+	xbps-install -C xbps.d -r root --repository=$PWD/repo -yd C
+	atf_check_equal $? 0
+	for f in A B C; do
+		out=$(xbps-query -r root -p pkgver $f)
+		atf_check_equal $out $f-1.0_1
+		atf_check_equal $(test -f root/usr/bin/$f; echo $?) 0
+	done
+}
+
+atf_test_case install_pipeline_broken
+
+install_pipeline_broken_head() {
+	atf_set "descr" "Tests for pkg installations: pipeline_commit stops at a broken pkg"
+}
+
+install_pipeline_broken_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/bin
+	touch pkg_A/usr/bin/A pkg_B/usr/bin/B pkg_C/usr/bin/C
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "B>=0" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	echo garbage >> B-1.0_1.noarch.xbps
+	cd ..
+
+	mkdir -p root/xbps.d
+	echo "pipeline_commit=true" > root/xbps.d/pipeline.conf
+	xbps-install -C xbps.d -r root --repository=$PWD/repo -yd C
+	atf_check_equal $(test $? -ne 0; echo $?) 0
+	out=$(xbps-query -r root -p pkgver A)
+	atf_check_equal $out A-1.0_1
+	xbps-query -r root B
+	atf_check_equal $? 2
+	xbps-query -r root C
+	atf_check_equal $? 2
+}
+
+atf_test_case install_parallel_unpack
+
+install_parallel_unpack_head() {
+	atf_set "descr" "Tests for pkg installations: install with unpack_jobs set"
+}
+
+install_parallel_unpack_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/lib pkg_D/lib pkg_E/usr/bin
+	touch pkg_A/usr/bin/A pkg_B/usr/bin/B pkg_D/lib/D pkg_E/usr/bin/E
+	ln -s usr/lib pkg_C/lib
+	printf '#!/bin/sh\ntest -f usr/bin/A\n' > pkg_E/INSTALL
+	chmod +x pkg_E/INSTALL
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "B>=0" ../pkg_C
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" --dependencies "C>=0" ../pkg_D
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" --dependencies "D>=0" ../pkg_E
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	mkdir -p root/xbps.d
+	echo "unpack_jobs=4" > root/xbps.d/unpack.conf
+	xbps-install -C xbps.d -r root --repository=$PWD/repo -yd E
+	atf_check_equal $? 0
+	for f in A B C D E; do
+		out=$(xbps-query -r root -p pkgver $f)
+		atf_check_equal $out $f-1.0_1
+	done
+	# same result as unpacking them one after another
+	xbps-install -C empty.conf -r root2 --repository=$PWD/repo -yd E
+	atf_check_equal $? 0
+	(cd root && find usr lib | sort) > out
+	(cd root2 && find usr lib | sort) > exp
+	cmp exp out
+	atf_check_equal $? 0
+	atf_check_equal $(test -f root/usr/bin/E; echo $?) 0
+}
+
+atf_test_case install_unpack_sync
+
+install_unpack_sync_head() {
+	atf_set "descr" "Tests for pkg installations: install and update with unpack_sync set"
+}
+
+install_unpack_sync_body() {
+	mkdir -p repo pkg_A/usr/bin
+	echo 1.0 > pkg_A/usr/bin/foo
+	ln pkg_A/usr/bin/foo pkg_A/usr/bin/bar
+	ln -s foo pkg_A/usr/bin/baz
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	mkdir -p root/xbps.d
+	echo "unpack_sync=true" > root/xbps.d/unpack.conf
+	xbps-install -C xbps.d -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" 1.0
+	atf_check_equal "$(stat -c %i root/usr/bin/foo)" "$(stat -c %i root/usr/bin/bar)"
+	atf_check_equal "$(readlink root/usr/bin/baz)" foo
+
+	echo 1.1 > pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -C xbps.d -r root --repository=$PWD/repo -yud A
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" 1.1
+	atf_check_equal "$(cat root/usr/bin/bar)" 1.1
+	atf_check_equal "$(find root -name '*.xbps-new' | wc -l)" 0
+	xbps-pkgdb -r root A
+	atf_check_equal $? 0
+}
+
+atf_test_case install_io_uring
+
+install_io_uring_head() {
+	atf_set "descr" "Tests for pkg installations: install with unpack_io_uring set"
+}
+
+install_io_uring_body() {
+	mkdir -p repo pkg_A/usr/share/A pkg_A/usr/bin
+	for i in $(seq 1 100); do
+		echo $i > pkg_A/usr/share/A/file$i
+	done
+	touch pkg_A/usr/share/A/empty
+	chmod 600 pkg_A/usr/share/A/file1
+	echo A > pkg_A/usr/bin/A
+	chmod 755 pkg_A/usr/bin/A
+	ln pkg_A/usr/share/A/file2 pkg_A/usr/bin/B
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	mkdir -p root/xbps.d
+	echo "unpack_io_uring=true" > root/xbps.d/unpack.conf
+	xbps-install -C xbps.d -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	# same result as unpacking them with libarchive
+	xbps-install -C empty.conf -r root2 --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	(cd root && find usr -exec stat -c "%n %a %s %h %Y" {} + | sort) > out
+	(cd root2 && find usr -exec stat -c "%n %a %s %h %Y" {} + | sort) > exp
+	cmp exp out
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/share/A/file100)" 100
+	xbps-pkgdb -r root A
+	atf_check_equal $? 0
+}
+
 atf_test_case update_file_timestamps
 
 update_file_timestamps_head() {
@@ -366,6 +598,76 @@ update_move_unmodified_file_body() {
 	atf_check_equal $? 0
 }
 
+atf_test_case update_unchanged_file
+
+update_unchanged_file_head() {
+	atf_set "descr" "Test for pkg updates: unchanged files are not rewritten"
+}
+
+update_unchanged_file_body() {
+	mkdir -p repo pkg_A/usr/bin
+	echo 123456789 > pkg_A/usr/bin/foo
+	echo 123456789 > pkg_A/usr/bin/bar
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=repo -yvd A
+	atf_check_equal $? 0
+	foo=$(stat --printf='%i' root/usr/bin/foo)
+
+	echo 987654321 > pkg_A/usr/bin/bar
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=repo -yuvd A
+	atf_check_equal $? 0
+	atf_check_equal "$(stat --printf='%i' root/usr/bin/foo)" "$foo"
+	atf_check_equal "$(stat --printf='%Y' root/usr/bin/foo)" "$(stat --printf='%Y' pkg_A/usr/bin/foo)"
+	atf_check_equal "$(cat root/usr/bin/bar)" 987654321
+	xbps-pkgdb -r root -av
+	atf_check_equal $? 0
+}
+
+atf_test_case update_modified_file
+
+update_modified_file_head() {
+	atf_set "descr" "Test for pkg updates: restore a modified file with unchanged hash"
+}
+
+update_modified_file_body() {
+	mkdir -p repo pkg_A/usr/bin
+	echo 123456789 > pkg_A/usr/bin/foo
+	touch -d "2018-01-01 00:00:00" pkg_A/usr/bin/foo
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=repo -yvd A
+	atf_check_equal $? 0
+	echo modified > root/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=repo -yuvd A
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" 123456789
+	xbps-pkgdb -r root -av
+	atf_check_equal $? 0
+}
+
 atf_test_case update_move_file
 
 update_move_file_head() {
@@ -483,18 +785,115 @@ update_xbps_virtual_body() {
 	atf_check_equal "$exp" "xbps-git-1.1_1 update noarch $(readlink -f repo)"
 }
 
+atf_test_case install_shared_deps
+
+install_shared_deps_head() {
+	atf_set "descr" "Tests for pkg installations: dependencies shared by other dependencies"
+}
+
+install_shared_deps_body() {
+	mkdir -p repo pkg_A/usr/bin
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --dependencies "B>=0 C>=0 D>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "D>=0 E>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "D>=0 E>=0 vF>=1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" --dependencies "vF>=1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n F-1.0_1 -s "F pkg" --provides "vF-1.0_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	out=$(xbps-install -r root --repository=$PWD/repo -dyn A 2>dbg|awk '{print $1}'|sort|tr -d '\n')
+	atf_check_equal $out "A-1.0_1B-1.0_1C-1.0_1D-1.0_1E-1.0_1F-1.0_1"
+	# D>=0, E>=0 and vF>=1 are only resolved once
+	grep -q "resolution cache: 4/9 hits" dbg
+	atf_check_equal $? 0
+}
+
+atf_test_case install_many_deps
+
+install_many_deps_head() {
+	atf_set "descr" "Tests for pkg installations: dependencies looked up in a large transaction"
+}
+
+install_many_deps_body() {
+	mkdir -p repo pkg_A/usr/bin
+	cd repo
+	deps="vX>=1"
+	for i in $(seq 1 20); do
+		xbps-create -A noarch -n B$i-1.0_1 -s "B$i pkg" --dependencies "vX>=1 B$((i+1))>=0" ../pkg_A
+		atf_check_equal $? 0
+		deps="$deps B$i>=1.0"
+	done
+	xbps-create -A noarch -n B21-1.0_1 -s "B21 pkg" --provides "vX-1.0_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --dependencies "$deps" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	out=$(xbps-install -r root --repository=$PWD/repo -yn A|wc -l)
+	atf_check_equal $out 22
+	xbps-install -r root --repository=$PWD/repo -y A
+	atf_check_equal $? 0
+	out=$(xbps-query -r root -l|wc -l)
+	atf_check_equal $out 22
+	out=$(xbps-query -r root -x A|wc -l)
+	atf_check_equal $out 21
+}
+
+atf_test_case install_missing_deps
+
+install_missing_deps_head() {
+	atf_set "descr" "Tests for pkg installations: missing dependencies are reported once"
+}
+
+install_missing_deps_body() {
+	mkdir -p repo pkg_A/usr/bin
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --dependencies "B>=2.0 E>=0 X-1.0_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" --dependencies "B>=1.0 X>=0 B>=3.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	out=$(xbps-install -r root --repository=$PWD/repo -n A 2>&1|grep MISSING|tr -d '\n')
+	atf_check_equal "$out" "MISSING: B>=3.0MISSING: X>=0"
+}
+
 atf_init_test_cases() {
 	atf_add_test_case install_empty
 	atf_add_test_case install_with_deps
 	atf_add_test_case install_with_vpkg_deps
 	atf_add_test_case install_if_not_installed_on_update
 	atf_add_test_case install_dups
+	atf_add_test_case install_shared_deps
+	atf_add_test_case install_many_deps
+	atf_add_test_case install_missing_deps
 	atf_add_test_case install_bestmatch
 	atf_add_test_case install_bestmatch_deps
+	atf_add_test_case install_bestmatch_pattern
 	atf_add_test_case install_bestmatch_disabled
+	atf_add_test_case install_pipeline
+	atf_add_test_case install_pipeline_broken
+	atf_add_test_case install_parallel_unpack
+	atf_add_test_case install_unpack_sync
+	atf_add_test_case install_io_uring
 	atf_add_test_case update_if_installed
 	atf_add_test_case update_to_empty_pkg
 	atf_add_test_case update_file_timestamps
+	atf_add_test_case update_unchanged_file
+	atf_add_test_case update_modified_file
 	atf_add_test_case update_move_file
 	atf_add_test_case update_move_unmodified_file
 	atf_add_test_case update_xbps
@@ -0,0 +1,99 @@
+#! /usr/bin/env atf-sh
+
+atf_test_case order
+
+order_head() {
+	atf_set "descr" "Tests for pkgdb: hash does not depend on the install order"
+}
+
+order_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/bin
+	touch pkg_A/usr/bin/foo pkg_B/usr/bin/bar pkg_C/usr/bin/baz
+
+	cd repo
+	for p in A B C; do
+		xbps-create -A noarch -n $p-1.0_1 -s "$p pkg" ../pkg_$p
+		atf_check_equal $? 0
+	done
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root1 --repository=$PWD/repo -yd A B C
+	atf_check_equal $? 0
+	for p in C A B; do
+		xbps-install -r root2 --repository=$PWD/repo -yd $p
+		atf_check_equal $? 0
+	done
+	hash1=$(xbps-pkgdb -r root1 --hash)
+	atf_check_equal $? 0
+	atf_check_equal "$(echo $hash1 | wc -c)" 65
+	atf_check_equal "$(xbps-pkgdb -r root2 --hash)" "$hash1"
+	atf_check_equal "$(xbps-pkgdb -r root1 --hash-buckets)" "$(xbps-pkgdb -r root2 --hash-buckets)"
+	atf_check_equal "$(xbps-pkgdb -r root1 --hash-buckets | wc -l)" 3
+
+	xbps-remove -r root2 -yd B
+	atf_check_equal $? 0
+	[ "$(xbps-pkgdb -r root2 --hash)" != "$hash1" ]
+	atf_check_equal $? 0
+	xbps-install -r root2 --repository=$PWD/repo -yd B
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-pkgdb -r root2 --hash)" "$hash1"
+}
+
+atf_test_case drift
+
+drift_head() {
+	atf_set "descr" "Tests for pkgdb: differing buckets locate the changed package"
+}
+
+drift_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin
+	touch pkg_A/usr/bin/foo pkg_B/usr/bin/bar
+
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root1 --repository=$PWD/repo -yd A B
+	atf_check_equal $? 0
+	xbps-install -r root2 --repository=$PWD/repo -yd A B
+	atf_check_equal $? 0
+
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/A-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root2 --repository=$PWD/repo -yud
+	atf_check_equal $? 0
+
+	xbps-pkgdb -r root1 --hash-buckets > buckets1
+	xbps-pkgdb -r root2 --hash-buckets > buckets2
+	atf_check_equal "$(diff buckets1 buckets2 | grep -c '^>')" 1
+	bucket=$(diff buckets1 buckets2 | sed -n 's/^> \([0-9a-f]*\) .*/\1/p')
+	atf_check -o inline:"A-1.0_1 installed\n" -- xbps-query -r root1 --hash-bucket=$bucket
+	atf_check -o inline:"A-1.1_1 installed\n" -- xbps-query -r root2 --hash-bucket=$bucket
+
+	# the state of packages is also hashed
+	hash=$(xbps-pkgdb -r root1 --hash)
+	xbps-install -r root1 --repository=$PWD/repo -yfUd B
+	atf_check_equal $? 0
+	atf_check -o inline:"B-1.0_1 unpacked\n" -- xbps-query -r root1 --hash-bucket=$(xbps-pkgdb -r root1 --hash-buckets | grep -v "^$bucket " | cut -d' ' -f1)
+	[ "$(xbps-pkgdb -r root1 --hash)" != "$hash" ]
+	atf_check_equal $? 0
+	xbps-reconfigure -r root1 -d B
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-pkgdb -r root1 --hash)" "$hash"
+}
+
+atf_init_test_cases() {
+	atf_add_test_case order
+	atf_add_test_case drift
+}
@@ -463,6 +463,77 @@ remove_with_revdeps_in_trans_recursive_body() {
 	atf_check_equal $out 0
 }
 
+atf_test_case remove_with_revdeps_index
+
+remove_with_revdeps_index_head() {
+	atf_set "descr" "Tests for package removal: revdeps index is updated and reused"
+}
+
+remove_with_revdeps_index_body() {
+	mkdir some_repo
+	mkdir -p pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/bin
+
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A-1.0_1" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "A>=0" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=some_repo -yvd B
+	atf_check_equal $? 0
+	xbps-remove -r root -yvd A
+	atf_check_equal $? 19
+	atf_check_equal $(test -s root/var/db/xbps/pkgdb-0.38.revdeps; echo $?) 0
+	xbps-install -r root --repository=some_repo -yvd C
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-query -r root -X A|sort|tr '\n' ' ')" "B-1.0_1 C-1.0_1 "
+	xbps-remove -r root -yvd B
+	atf_check_equal $? 0
+	xbps-query -r root -dX A >out 2>&1
+	atf_check_equal $? 0
+	atf_check_equal "$(grep -c 'loaded revdeps index' out)" 1
+	atf_check_equal "$(grep -v '^\[DEBUG\]' out)" "C-1.0_1"
+}
+
+atf_test_case remove_recursive_shared
+
+remove_recursive_shared_head() {
+	atf_set "descr" "Tests for package removal: recursive removal keeps dependencies of other packages"
+}
+
+remove_recursive_shared_body() {
+	mkdir some_repo
+	mkdir -p pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/bin pkg_D/usr/bin pkg_E/usr/bin
+
+	cd some_repo
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" ../pkg_D
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "D>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --provides "vc-1.0_1" --dependencies "D>=0" ../pkg_C
+	atf_check_equal $? 0
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --dependencies "B>=0 C>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" --dependencies "vc>=0" ../pkg_E
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=some_repo -yvd A E
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-remove -r root -Rn A|cut -d ' ' -f1|sort|tr '\n' ' ')" "A-1.0_1 B-1.0_1 "
+	xbps-remove -r root -Ryvd A
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-query -r root -l|cut -d ' ' -f2|tr '\n' ' ')" "C-1.0_1 D-1.0_1 E-1.0_1 "
+	xbps-remove -r root -Ryvd E
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-query -r root -l|wc -l)" 0
+}
+
 atf_init_test_cases() {
 	atf_add_test_case keep_base_symlinks
 	atf_add_test_case keep_modified_symlinks
@@ -480,4 +551,6 @@ atf_init_test_cases() {
 	atf_add_test_case remove_with_revdeps_in_trans
 	atf_add_test_case remove_with_revdeps_in_trans_inverted
 	atf_add_test_case remove_with_revdeps_in_trans_recursive
+	atf_add_test_case remove_with_revdeps_index
+	atf_add_test_case remove_recursive_shared
 }
@@ -84,7 +84,42 @@ script_arch_body() {
 	atf_check_equal $rval 0
 }
 
+atf_test_case script_triggers
+
+script_triggers_head() {
+	atf_set "descr" "Tests for package scripts: triggers are executed once per transaction"
+}
+
+script_triggers_body() {
+	mkdir some_repo root
+	mkdir -p pkg_T/usr/libexec/xbps-triggers pkg_A pkg_B
+	cat > pkg_T/usr/libexec/xbps-triggers/foo <<EOF
+#!/bin/sh
+echo "\$@" >> foo.log
+EOF
+	chmod 755 pkg_T/usr/libexec/xbps-triggers/foo
+
+	cd some_repo
+	xbps-create -A noarch -n T-1.0_1 -s "T pkg" ../pkg_T
+	atf_check_equal $? 0
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --dependencies "T>=0" --triggers "foo" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "T>=0" --triggers "foo bar" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -C empty.conf -r root --repository=$PWD/some_repo -y A B
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/foo.log)" "post A-1.0_1 B-1.0_1"
+
+	xbps-remove -C empty.conf -r root -y B
+	atf_check_equal $? 0
+	atf_check_equal "$(tail -n1 root/foo.log)" "post B-1.0_1"
+}
+
 atf_init_test_cases() {
 	atf_add_test_case script_nargs
 	atf_add_test_case script_arch
+	atf_add_test_case script_triggers
 }
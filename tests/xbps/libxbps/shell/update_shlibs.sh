@@ -218,6 +218,39 @@ shlib_unknown_provider_body() {
 	atf_check_equal $? 8
 }
 
+atf_test_case shlib_remove_provider
+
+shlib_remove_provider_head() {
+	atf_set "descr" "Tests for pkg removal: removed pkg provides shlibs required by installed pkgs"
+}
+
+shlib_remove_provider_body() {
+	mkdir -p repo pkg
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --shlib-provides "liba.so.1" ../pkg
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --shlib-requires "liba.so.1" ../pkg
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --shlib-provides "libc.so.1" ../pkg
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -C empty.conf -r root --repository=$PWD/repo -yvd A B C
+	atf_check_equal $? 0
+
+	xbps-remove -C empty.conf -r root -yvd C
+	atf_check_equal $? 0
+
+	out=$(xbps-remove -C empty.conf -r root -yv A 2>&1)
+	# ENOEXEC == unresolved shlibs
+	atf_check_equal $? 8
+	echo "$out" | grep -q "B-1.0_1: broken, unresolvable shlib \`liba.so.1'"
+	atf_check_equal $? 0
+	atf_check_equal $(xbps-query -C empty.conf -r root -ppkgver A) A-1.0_1
+}
+
 atf_init_test_cases() {
 	atf_add_test_case shlib_bump
 	atf_add_test_case shlib_bump_incomplete_revdep_in_trans
@@ -225,4 +258,5 @@ atf_init_test_cases() {
 	atf_add_test_case shlib_bump_revdep_diff
 	atf_add_test_case shlib_bump_versioned
 	atf_add_test_case shlib_unknown_provider
+	atf_add_test_case shlib_remove_provider
 }
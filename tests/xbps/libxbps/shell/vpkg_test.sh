@@ -334,6 +334,85 @@ vpkg_provider_remove_body() {
 	atf_check_equal $? 19
 }
 
+atf_test_case vpkg_repo_priority
+
+vpkg_repo_priority_head() {
+	atf_set "descr" "Tests for virtual pkgs: provider from the first repository"
+}
+
+vpkg_repo_priority_body() {
+	mkdir -p repo1 repo2 pkg_A/usr/bin
+	cd repo1
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --provides "vpkg-1.0_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "vpkg>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ../repo2
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --provides "vpkg-2.0_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" --dependencies "vpkg>=2.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=$PWD/repo1 --repository=$PWD/repo2 -dy C D
+	atf_check_equal $? 0
+
+	out=$(xbps-query -r root -l|awk '{print $2}'|tr -d '\n')
+	exp="A-1.0_1B-1.0_1C-1.0_1D-1.0_1"
+	echo "out: $out"
+	echo "exp: $exp"
+	atf_check_equal $out $exp
+}
+
+atf_test_case vpkg_update_breaks_revdeps
+
+vpkg_update_breaks_revdeps_head() {
+	atf_set "descr" "Tests for virtual pkgs: update breaks revdeps of the pkg and its vpkg"
+}
+
+vpkg_update_breaks_revdeps_body() {
+	mkdir some_repo
+	mkdir -p pkg_A/usr/bin
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --provides "vX-1.0_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "vX>=1.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "A<2.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" --dependencies "A>=1.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=$PWD/some_repo -yd B C D
+	atf_check_equal $? 0
+
+	cd some_repo
+	xbps-create -A noarch -n A-2.0_1 -s "A pkg" --provides "vX-0.9_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	out=$(xbps-install -r root --repository=$PWD/some_repo -yud 2>&1)
+	atf_check_equal $? 19
+	echo "$out" | grep -q "B-1.0_1 broken, needs 'vX>=1.0' virtual pkg (got \`vX-0.9_1')"
+	atf_check_equal $? 0
+	echo "$out" | grep -q "A-2.0_1 (update) breaks installed pkg \`C-1.0_1'"
+	atf_check_equal $? 0
+	echo "$out" | grep -q "breaks installed pkg \`D-1.0_1'"
+	atf_check_equal $? 1
+	echo "$out" | grep -q "Checked 3 reverse dependencies in"
+	atf_check_equal $? 0
+	atf_check_equal $(xbps-query -r root -p pkgver A) A-1.0_1
+}
+
 atf_init_test_cases() {
 	atf_add_test_case vpkg_dont_update
 	atf_add_test_case vpkg_replace_provider
@@ -344,4 +423,6 @@ atf_init_test_cases() {
 	atf_add_test_case vpkg_incompat_downgrade
 	atf_add_test_case vpkg_provider_and_revdeps_downgrade
 	atf_add_test_case vpkg_provider_remove
+	atf_add_test_case vpkg_repo_priority
+	atf_add_test_case vpkg_update_breaks_revdeps
 }
@@ -24,6 +24,7 @@
  *-
  */
 #include <string.h>
+#include <errno.h>
 #include <atf-c.h>
 #include <xbps.h>
 
@@ -77,8 +78,97 @@ ATF_TC_BODY(util_test, tc)
 	ATF_CHECK_EQ(xbps_binpkg_pkgver("foo-1.0.x86_64"), NULL);
 }
 
+ATF_TC(util_name_len_test);
+
+ATF_TC_HEAD(util_name_len_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test xbps_pkg{,pattern}_name_{len,buf}");
+}
+
+ATF_TC_BODY(util_name_len_test, tc)
+{
+	char name[XBPS_NAME_SIZE], small[4];
+
+	ATF_CHECK_EQ(xbps_pkg_name_len("font-adobe-100dpi-7.8_2"), 17);
+	ATF_CHECK_EQ(xbps_pkg_name_len("python-e_dbus-1.0_1"), 13);
+	ATF_CHECK_EQ(xbps_pkg_name_len("python-e_dbus"), 0);
+	ATF_CHECK_EQ(xbps_pkg_name_len("font-adobe-100dpi"), 0);
+	ATF_CHECK_EQ(xbps_pkgpattern_name_len("systemd>=43"), 7);
+	ATF_CHECK_EQ(xbps_pkgpattern_name_len("systemd-[0-9]*"), 7);
+	ATF_CHECK_EQ(xbps_pkgpattern_name_len("*nslookup"), 0);
+	ATF_CHECK_EQ(xbps_pkgpattern_name_len("systemd-43_1"), 0);
+
+	ATF_REQUIRE(xbps_pkg_name_buf(name, sizeof(name), "systemd-43_1"));
+	ATF_REQUIRE_STREQ(name, "systemd");
+	ATF_REQUIRE(xbps_pkgpattern_name_buf(name, sizeof(name), "systemd<4_1?"));
+	ATF_REQUIRE_STREQ(name, "systemd");
+	ATF_REQUIRE(xbps_pkg_name_buf(small, sizeof(small), "foo-1.0_1"));
+	ATF_REQUIRE_STREQ(small, "foo");
+	ATF_CHECK(!xbps_pkg_name_buf(name, sizeof(name), "python-e_dbus"));
+	ATF_CHECK(!xbps_pkgpattern_name_buf(name, sizeof(name), "*nslookup"));
+	errno = 0;
+	ATF_CHECK(!xbps_pkg_name_buf(small, sizeof(small), "systemd-43_1"));
+	ATF_CHECK_EQ(errno, ENAMETOOLONG);
+	errno = 0;
+	ATF_CHECK(!xbps_pkgpattern_name_buf(small, sizeof(small), "systemd>=43"));
+	ATF_CHECK_EQ(errno, ENAMETOOLONG);
+}
+
+ATF_TC(util_substr_test);
+
+ATF_TC_HEAD(util_substr_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr", "Test xbps_substr_{new,find}");
+}
+
+ATF_TC_BODY(util_substr_test, tc)
+{
+	struct xbps_substr *ss, *sc, *s1, *empty;
+	char buf[256];
+	const char *s;
+
+	ss = xbps_substr_new("FooBar", true);
+	sc = xbps_substr_new("FooBar", false);
+	s1 = xbps_substr_new("@", true);
+	empty = xbps_substr_new("", true);
+	ATF_REQUIRE(ss && sc && s1 && empty);
+
+	s = "foobar";
+	ATF_CHECK_EQ(xbps_substr_find(ss, s), s);
+	ATF_CHECK_EQ(xbps_substr_find(sc, s), NULL);
+	ATF_CHECK_EQ(xbps_substr_find(ss, "fooba"), NULL);
+	ATF_CHECK_EQ(xbps_substr_find(empty, s), s);
+	ATF_CHECK_EQ(xbps_substr_find(ss, ""), NULL);
+	/* '@' and '`' differ from 'A'-'Z' only in the case bit */
+	ATF_CHECK_EQ(xbps_substr_find(s1, "ABC`"), NULL);
+	s = "xbps-0.53_1 The X Binary Package System FOOBAR fooBar";
+	ATF_CHECK_EQ(xbps_substr_find(ss, s), strstr(s, "FOOBAR"));
+	ATF_CHECK_EQ(xbps_substr_find(sc, s), NULL);
+
+	/* every length and offset, in and past the vector blocks */
+	for (size_t len = 6; len < sizeof(buf); len++) {
+		for (size_t off = 0; off + 6 <= len; off += 7) {
+			memset(buf, 'o', len);
+			buf[len] = '\0';
+			memcpy(buf + off, "fOObAr", 6);
+			ATF_CHECK_EQ(xbps_substr_find(ss, buf), buf + off);
+			ATF_CHECK_EQ(xbps_substr_find(sc, buf), NULL);
+			memcpy(buf + off, "FooBar", 6);
+			ATF_CHECK_EQ(xbps_substr_find(sc, buf), buf + off);
+			buf[off + 5] = 's';
+			ATF_CHECK_EQ(xbps_substr_find(ss, buf), NULL);
+		}
+	}
+	xbps_substr_free(ss);
+	xbps_substr_free(sc);
+	xbps_substr_free(s1);
+	xbps_substr_free(empty);
+}
+
 ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, util_test);
+	ATF_TP_ADD_TC(tp, util_name_len_test);
+	ATF_TP_ADD_TC(tp, util_substr_test);
 	return atf_no_error();
 }
@@ -0,0 +1,173 @@
+/*-
+ * Copyright (c) 2018 Juan Romero Pardines.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *-
+ */
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <atf-c.h>
+#include <xbps.h>
+
+static int
+state_cb(const struct xbps_state_cb_data *xscd, void *cbd)
+{
+	(void)cbd;
+
+	/* import the repository public key */
+	return xscd->state == XBPS_STATE_REPO_KEY_IMPORT;
+}
+
+/*
+ * Creates a repository with a package, both signed with an Ed25519 key.
+ */
+static void
+repo_create(char *repodir)
+{
+	ATF_REQUIRE_EQ(system("openssl genpkey -algorithm ed25519 "
+	    "-out key.pem && mkdir -p repo pkg_A && touch pkg_A/file00 && "
+	    "cd repo && xbps-create -A noarch -n foo-1.0_1 -s foo ../pkg_A "
+	    ">/dev/null && xbps-rindex -a $PWD/*.xbps >/dev/null && "
+	    "xbps-rindex --signedby test --privkey ../key.pem "
+	    "--sign $PWD >/dev/null && xbps-rindex --privkey ../key.pem "
+	    "--sign-pkg $PWD/*.xbps >/dev/null"), 0);
+	ATF_REQUIRE(realpath("repo", repodir) != NULL);
+}
+
+static struct xbps_repo *
+handle_init(struct xbps_handle *xhp, const char *rootdir, const char *repodir,
+		int flags)
+{
+	struct xbps_repo *repo;
+	char cwd[PATH_MAX];
+
+	ATF_REQUIRE(getcwd(cwd, sizeof(cwd)) != NULL);
+	memset(xhp, 0, sizeof(*xhp));
+	snprintf(xhp->rootdir, sizeof(xhp->rootdir), "%s/%s", cwd, rootdir);
+	ATF_REQUIRE_EQ(mkdir(xhp->rootdir, 0755), 0);
+	xhp->state_cb = state_cb;
+	xhp->flags = flags;
+	ATF_REQUIRE_EQ(xbps_init(xhp), 0);
+
+	repo = xbps_repo_open(xhp, repodir);
+	ATF_REQUIRE(repo != NULL);
+	ATF_REQUIRE(repo->is_signed);
+	ATF_REQUIRE_EQ(xbps_repo_key_import(repo), 0);
+	return repo;
+}
+
+ATF_TC(verifysig_ed25519_test);
+
+ATF_TC_HEAD(verifysig_ed25519_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test xbps_verify_file_signature() with an Ed25519 key");
+	atf_tc_set_md_var(tc, "require.progs", "openssl");
+}
+
+ATF_TC_BODY(verifysig_ed25519_test, tc)
+{
+	struct xbps_handle xh;
+	struct xbps_repo *repo;
+	char cwd[PATH_MAX], repodir[PATH_MAX], binpkg[PATH_MAX];
+	const char *sigtype;
+
+	repo_create(repodir);
+	repo = handle_init(&xh, "root", repodir, 0);
+	ATF_REQUIRE(xbps_dictionary_get_cstring_nocopy(repo->idxmeta,
+	    "signature-type", &sigtype));
+	ATF_REQUIRE_STREQ(sigtype, "ed25519");
+	snprintf(binpkg, sizeof(binpkg), "%s/foo-1.0_1.noarch.xbps", repodir);
+	ATF_REQUIRE(xbps_verify_file_signature(repo, binpkg));
+
+	/* a modified package doesn't match its signature */
+	ATF_REQUIRE_EQ(system("cp repo/foo-1.0_1.noarch.xbps foo.xbps && "
+	    "cp repo/foo-1.0_1.noarch.xbps.sig foo.xbps.sig && "
+	    "echo >> foo.xbps"), 0);
+	ATF_REQUIRE(getcwd(cwd, sizeof(cwd)) != NULL);
+	snprintf(binpkg, sizeof(binpkg), "%s/foo.xbps", cwd);
+	ATF_REQUIRE(!xbps_verify_file_signature(repo, binpkg));
+
+	xbps_repo_close(repo);
+	xbps_end(&xh);
+}
+
+ATF_TC(verifysig_cache_handles_test);
+
+ATF_TC_HEAD(verifysig_cache_handles_test, tc)
+{
+	atf_tc_set_md_var(tc, "descr",
+	    "Test the verify cache of several handles");
+	atf_tc_set_md_var(tc, "require.progs", "openssl");
+}
+
+ATF_TC_BODY(verifysig_cache_handles_test, tc)
+{
+	struct xbps_handle xa, xb;
+	struct xbps_repo *ra, *rb;
+	xbps_dictionary_t cache;
+	char cwd[PATH_MAX], repodir[PATH_MAX], path[PATH_MAX];
+	char pkga[PATH_MAX], pkgb[PATH_MAX];
+
+	repo_create(repodir);
+	ATF_REQUIRE_EQ(system("cp repo/foo-1.0_1.noarch.xbps foo.xbps && "
+	    "cp repo/foo-1.0_1.noarch.xbps.sig foo.xbps.sig"), 0);
+	ATF_REQUIRE(getcwd(cwd, sizeof(cwd)) != NULL);
+	snprintf(pkga, sizeof(pkga), "%s/foo-1.0_1.noarch.xbps", repodir);
+	snprintf(pkgb, sizeof(pkgb), "%s/foo.xbps", cwd);
+
+	ra = handle_init(&xa, "root_a", repodir, XBPS_FLAG_VERIFY_CACHE);
+	rb = handle_init(&xb, "root_b", repodir, XBPS_FLAG_VERIFY_CACHE);
+	ATF_REQUIRE(xbps_verify_file_signature(ra, pkga));
+	ATF_REQUIRE(xbps_verify_file_signature(rb, pkgb));
+	xbps_repo_close(ra);
+	xbps_repo_close(rb);
+
+	/* every handle writes the packages it verified to its metadir */
+	xbps_end(&xa);
+	xbps_end(&xb);
+	snprintf(path, sizeof(path), "%s/root_a/var/db/xbps/%s", cwd,
+	    "verify-cache.plist");
+	cache = xbps_dictionary_internalize_from_file(path);
+	ATF_REQUIRE(cache != NULL);
+	ATF_REQUIRE_EQ(xbps_dictionary_count(cache), 1);
+	ATF_REQUIRE(xbps_dictionary_get(cache, pkga) != NULL);
+	xbps_object_release(cache);
+	snprintf(path, sizeof(path), "%s/root_b/var/db/xbps/%s", cwd,
+	    "verify-cache.plist");
+	cache = xbps_dictionary_internalize_from_file(path);
+	ATF_REQUIRE(cache != NULL);
+	ATF_REQUIRE_EQ(xbps_dictionary_count(cache), 1);
+	ATF_REQUIRE(xbps_dictionary_get(cache, pkgb) != NULL);
+	xbps_object_release(cache);
+}
+
+ATF_TP_ADD_TCS(tp)
+{
+	ATF_TP_ADD_TC(tp, verifysig_ed25519_test);
+	ATF_TP_ADD_TC(tp, verifysig_cache_handles_test);
+
+	return atf_no_error();
+}
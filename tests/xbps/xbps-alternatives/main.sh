@@ -457,6 +457,39 @@ less_entries_body() {
 	atf_check_equal $rv 0
 }
 
+atf_test_case update_keeps_links
+
+update_keeps_links_head() {
+	atf_set "descr" "xbps-alternatives: updating the current alternative doesn't recreate its symlinks"
+}
+update_keeps_links_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_B/usr/bin
+	touch pkg_A/usr/bin/A1 pkg_B/usr/bin/B1
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" --alternatives "1:1:/usr/bin/A1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.1_1 -s "B pkg" --alternatives "1:1:/usr/bin/B1" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=repo -ydv A B
+	atf_check_equal $? 0
+	inode=$(stat -c %i root/usr/bin/1)
+
+	cd repo
+	xbps-create -A noarch -n A-1.2_1 -s "A pkg" --alternatives "1:1:/usr/bin/A1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+
+	xbps-install -r root --repository=repo -yuvd
+	atf_check_equal $? 0
+	atf_check_equal "$(readlink root/usr/bin/1)" "A1"
+	atf_check_equal "$(stat -c %i root/usr/bin/1)" "$inode"
+}
 
 atf_init_test_cases() {
 	atf_add_test_case register_one
@@ -471,4 +504,5 @@ atf_init_test_cases() {
 	atf_add_test_case set_pkg_group
 	atf_add_test_case update_pkgs
 	atf_add_test_case less_entries
+	atf_add_test_case update_keeps_links
 }
@@ -139,10 +139,118 @@ reproducible_pkg_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case zstd_pkg
+
+zstd_pkg_head() {
+	atf_set "descr" "xbps-create(1): zstd packages and repository index"
+}
+
+zstd_pkg_body() {
+	mkdir -p repo pkg_A/usr/bin
+	echo QWERTY > pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --compression zstd ../pkg_A
+	if [ $? -ne 0 ]; then
+		atf_skip "xbps-create(1) built without zstd support"
+	fi
+	cd ..
+	xbps-rindex -d --compression zstd -a $PWD/repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=$PWD/repo -yd foo
+	atf_check_equal $? 0
+	atf_check_equal "$(cat root/usr/bin/foo)" QWERTY
+}
+
+atf_test_case stored_pkg
+
+stored_pkg_head() {
+	atf_set "descr" "xbps-create(1): stored packages unpack the same files"
+}
+
+stored_pkg_body() {
+	mkdir -p repo pkg_A/usr/bin pkg_A/usr/lib
+	dd if=/dev/urandom of=pkg_A/usr/bin/foo bs=1000 count=100 2>/dev/null
+	dd if=/dev/urandom of=pkg_A/usr/lib/libfoo.so bs=1000 count=20 2>/dev/null
+	ln pkg_A/usr/lib/libfoo.so pkg_A/usr/lib/libfoo.so.1
+	echo QWERTY > pkg_A/usr/bin/bar
+	chmod 4755 pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --compression stored ../pkg_A
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a $PWD/repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=$PWD/repo -yd foo
+	atf_check_equal $? 0
+	for f in usr/bin/foo usr/bin/bar usr/lib/libfoo.so usr/lib/libfoo.so.1; do
+		cmp pkg_A/$f root/$f
+		atf_check_equal $? 0
+	done
+	atf_check_equal "$(stat -c %a root/usr/bin/foo)" 4755
+	atf_check_equal "$(stat -c %Y root/usr/bin/foo)" "$(stat -c %Y pkg_A/usr/bin/foo)"
+	xbps-pkgdb -r root foo
+	atf_check_equal $? 0
+}
+
+atf_test_case installed_pkg
+
+installed_pkg_head() {
+	atf_set "descr" "xbps-create(1): create a package from an installed package"
+}
+
+installed_pkg_body() {
+	mkdir -p repo repo2 pkg_A/usr/bin pkg_A/etc pkg_B
+	echo QWERTY > pkg_A/usr/bin/foo
+	echo ASDFGH > pkg_A/usr/bin/bar
+	ln -s foo pkg_A/usr/bin/baz
+	echo foo=1 > pkg_A/etc/foo.conf
+	printf '#!/bin/sh\nexit 0\n' > pkg_A/INSTALL
+	chmod 755 pkg_A/INSTALL
+	cd repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" -D "bar>=0" \
+		-F /etc/foo.conf ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" ../pkg_B
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -d -a $PWD/repo/*.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=$PWD/repo -yd foo
+	atf_check_equal $? 0
+
+	echo ZXCVBN > root/usr/bin/bar
+	cd repo2
+	xbps-create -q -i foo --rootdir ../root
+	atf_check_equal $? 0
+	cp ../repo/bar-1.0_1.noarch.xbps .
+	cd ..
+	xbps-rindex -d -a $PWD/repo2/*.xbps
+	atf_check_equal $? 0
+	atf_check_equal "$(xbps-query -r root2 --repository=$PWD/repo2 -R --property=run_depends foo)" "bar>=0"
+	atf_check_equal "$(xbps-query -r root2 --repository=$PWD/repo2 -R --property=short_desc foo)" "foo pkg"
+	xbps-install -r root2 --repository=$PWD/repo2 -yd foo
+	atf_check_equal $? 0
+	for f in usr/bin/foo usr/bin/bar usr/bin/baz etc/foo.conf; do
+		cmp root/$f root2/$f
+		atf_check_equal $? 0
+	done
+	atf_check_equal "$(readlink root2/usr/bin/baz)" foo
+	atf_check -o inline:"/etc/foo.conf\n" -- xbps-query -r root2 --property=conf_files foo
+	xbps-pkgdb -r root2 foo
+	atf_check_equal $? 0
+
+	# not installed
+	xbps-create -q -i baz --rootdir root
+	atf_check_equal $? 1
+}
+
 atf_init_test_cases() {
 	atf_add_test_case hardlinks_size
 	atf_add_test_case symlink_relative_target
 	atf_add_test_case symlink_relative_target_cwd
 	atf_add_test_case restore_mtime
 	atf_add_test_case reproducible_pkg
+	atf_add_test_case zstd_pkg
+	atf_add_test_case stored_pkg
+	atf_add_test_case installed_pkg
 }
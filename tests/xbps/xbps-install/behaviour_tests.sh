@@ -59,7 +59,300 @@ update_existent_body() {
 }
 
 
+atf_test_case binary_pkgdb
+
+binary_pkgdb_head() {
+	atf_set "descr" "xbps-install(8): pkgdb written in binary form (binary_plists)"
+}
+
+binary_pkgdb_body() {
+	mkdir -p some_repo pkg_A pkg_B conf.d
+	touch pkg_A/file00
+	touch pkg_B/file00
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	echo "binary_plists=true" > conf.d/binary.conf
+	xbps-install -r root -C $PWD/conf.d --repository=$PWD/some_repo -y A
+	atf_check_equal $? 0
+	# binary plists start with a NUL byte
+	atf_check_equal "$(head -c1 root/var/db/xbps/pkgdb-0.38.plist | od -An -tx1 | tr -d ' ')" 00
+	# and are read transparently with the default configuration
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -y B
+	atf_check_equal $? 0
+	atf_check_equal "$(head -c1 root/var/db/xbps/pkgdb-0.38.plist)" "<"
+	atf_check_equal "$(xbps-query -r root -C empty.conf -l | wc -l)" 2
+}
+
+atf_test_case pkgdb_journal
+
+pkgdb_journal_head() {
+	atf_set "descr" "xbps-install(8): pkgdb changes are recovered from its journal"
+}
+
+pkgdb_journal_body() {
+	mkdir -p some_repo pkg_A pkg_B
+	touch pkg_A/file00
+	touch pkg_B/file00
+	# B is unpacked after A, kill xbps-install before pkgdb is flushed
+	cat > pkg_B/INSTALL <<_EOF
+#!/bin/sh
+[ "\$1" = pre ] && kill -9 \$PPID
+exit 0
+_EOF
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" -D "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -y B
+	atf_check_equal $? 137
+	atf_check_equal "$(xbps-query -r root -C empty.conf -p state A)" unpacked
+	# the next writer flushes the journal into pkgdb
+	atf_check_equal $(test -s root/var/db/xbps/pkgdb-0.38.journal; echo $?) 0
+	xbps-pkgdb -r root -C empty.conf -m manual A
+	atf_check_equal $? 0
+	atf_check_equal $(test -e root/var/db/xbps/pkgdb-0.38.journal; echo $?) 1
+	grep -q '<key>A</key>' root/var/db/xbps/pkgdb-0.38.plist
+	atf_check_equal $? 0
+}
+
+atf_test_case stats
+
+stats_head() {
+	atf_set "descr" "xbps-install(8): --stats reports unpack statistics"
+}
+
+stats_body() {
+	mkdir -p some_repo pkg_A/usr/bin pkg_B/usr/bin
+	echo foo > pkg_A/usr/bin/foo
+	echo bar > pkg_B/usr/bin/bar
+	touch pkg_B/usr/bin/baz
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" -D "A>=0" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo --stats -y B > out
+	atf_check_equal $? 0
+	atf_check_equal "$(grep -c '^A-1.0_1: unpacked 1 files (4B) in ' out)" 1
+	atf_check_equal "$(grep -c '^B-1.0_1: unpacked 2 files (4B) in ' out)" 1
+	atf_check_equal "$(grep -c '^2 packages unpacked, 3 files (8B) in ' out)" 1
+	for phase in resolve revdeps shlibs conflicts download verify unpack configure; do
+		atf_check_equal "$(grep -c "^$phase " out)" 1
+	done
+}
+
+atf_test_case trace
+
+trace_head() {
+	atf_set "descr" "xbps-install(8): spans are traced to XBPS_TRACE"
+}
+
+trace_body() {
+	mkdir -p some_repo pkg_A/usr/bin
+	echo foo > pkg_A/usr/bin/foo
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	XBPS_TRACE=$PWD/trace.json xbps-install -r root -C empty.conf --repository=$PWD/some_repo -y A
+	atf_check_equal $? 0
+	atf_check_equal "$(head -n1 trace.json)" "["
+	atf_check_equal "$(tail -n1 trace.json)" "]"
+	grep -q '"cat":"repo","name":"open",.*"arg":"'$PWD/some_repo'"' trace.json
+	atf_check_equal $? 0
+	atf_check_equal "$(grep -c '"cat":"unpack","name":"package",.*"arg":"A-1.0_1"' trace.json)" 1
+	atf_check_equal "$(grep -c '"cat":"unpack","name":"entry",.*"arg":"./usr/bin/foo"' trace.json)" 1
+}
+
+atf_test_case prefetch
+
+prefetch_head() {
+	atf_set "descr" "xbps-install(8): --prefetch verifies updates without installing them"
+}
+
+prefetch_body() {
+	mkdir -p some_repo pkg_A/usr/bin
+	echo foo > pkg_A/usr/bin/foo
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -yd A
+	atf_check_equal $? 0
+	echo bar > pkg_A/usr/bin/foo
+	cd some_repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo --prefetch
+	atf_check_equal $? 0
+	atf_check -o inline:"A-1.0_1\n" -- xbps-query -r root -p pkgver A
+	atf_check -o inline:"foo\n" -- cat root/usr/bin/foo
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -yu
+	atf_check_equal $? 0
+	atf_check -o inline:"A-1.1_1\n" -- xbps-query -r root -p pkgver A
+}
+
+atf_test_case plan
+
+plan_head() {
+	atf_set "descr" "xbps-install(8): --export-plan and --apply-plan"
+}
+plan_body() {
+	mkdir -p some_repo pkg_A/usr/bin pkg_B/usr/bin
+	echo foo > pkg_A/usr/bin/foo
+	echo bar > pkg_B/usr/bin/bar
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" -D "B>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	for r in root1 root2; do
+		xbps-install -r $r -C empty.conf --repository=$PWD/some_repo -yd A
+		atf_check_equal $? 0
+	done
+	xbps-install -r root3 -C empty.conf --repository=$PWD/some_repo -yd B
+	atf_check_equal $? 0
+	cd some_repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" -D "B>=1.1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.1_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root1 -C empty.conf --repository=$PWD/some_repo -u --export-plan $PWD/plan
+	atf_check_equal $? 0
+	atf_check -o inline:"A-1.0_1\n" -- xbps-query -r root1 -p pkgver A
+	# same packages installed: the plan is applied as is
+	xbps-install -r root2 -C empty.conf --repository=$PWD/some_repo -yd --apply-plan $PWD/plan
+	atf_check_equal $? 0
+	atf_check -o inline:"A-1.1_1\n" -- xbps-query -r root2 -p pkgver A
+	atf_check -o inline:"B-1.1_1\n" -- xbps-query -r root2 -p pkgver B
+	# different packages installed: the plan is rejected
+	xbps-install -r root3 -C empty.conf --repository=$PWD/some_repo -yd --apply-plan $PWD/plan
+	atf_check_equal $? 116
+	atf_check -o inline:"B-1.0_1\n" -- xbps-query -r root3 -p pkgver B
+	# and so it is once the plan has been applied
+	xbps-install -r root2 -C empty.conf --repository=$PWD/some_repo -yd --apply-plan $PWD/plan
+	atf_check_equal $? 116
+}
+
+atf_test_case release_repodata
+
+release_repodata_head() {
+	atf_set "descr" "xbps-install(8): transaction with release_repodata=true"
+}
+release_repodata_body() {
+	mkdir -p some_repo other_repo pkg_A/usr/bin pkg_B/usr/bin xbps.d
+	echo foo > pkg_A/usr/bin/foo
+	echo bar > pkg_B/usr/bin/bar
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" -D "B>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ../other_repo
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	echo "release_repodata=true" > xbps.d/release.conf
+	xbps-install -r root -C $PWD/xbps.d --repository=$PWD/some_repo \
+		--repository=$PWD/other_repo -yd A
+	atf_check_equal $? 0
+	atf_check -o inline:"foo\n" -- cat root/usr/bin/foo
+	atf_check -o inline:"bar\n" -- cat root/usr/bin/bar
+	atf_check -o inline:"B-1.0_1\n" -- xbps-query -r root -p pkgver B
+}
+
+atf_test_case low_cache
+
+low_cache_head() {
+	atf_set "descr" "xbps-install(8): transaction with XBPS_LOW_CACHE_IMPACT set"
+}
+low_cache_body() {
+	mkdir -p some_repo pkg_A/usr/bin
+	echo foo > pkg_A/usr/bin/foo
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	XBPS_LOW_CACHE_IMPACT=1 xbps-install -r root --repository=$PWD/some_repo -yd A
+	atf_check_equal $? 0
+	atf_check -o inline:"foo\n" -- cat root/usr/bin/foo
+	XBPS_LOW_CACHE_IMPACT=1 xbps-pkgdb -r root -a
+	atf_check_equal $? 0
+	echo bar > root/usr/bin/foo
+	XBPS_LOW_CACHE_IMPACT=1 xbps-pkgdb -r root -a
+	atf_check_equal $? 1
+}
+
+atf_test_case unpack_readahead
+
+unpack_readahead_head() {
+	atf_set "descr" "xbps-install(8): transaction with unpack_readahead set"
+}
+unpack_readahead_body() {
+	mkdir -p some_repo pkg_A/usr/bin pkg_B/usr/bin pkg_C/usr/bin xbps.d
+	echo foo > pkg_A/usr/bin/foo
+	echo bar > pkg_B/usr/bin/bar
+	echo baz > pkg_C/usr/bin/baz
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" -D "B>=0 C>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" ../pkg_C
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	echo "unpack_readahead=1" > xbps.d/readahead.conf
+	xbps-install -r root -C $PWD/xbps.d --repository=$PWD/some_repo -yd A
+	atf_check_equal $? 0
+	atf_check -o inline:"foo\n" -- cat root/usr/bin/foo
+	atf_check -o inline:"bar\n" -- cat root/usr/bin/bar
+	atf_check -o inline:"baz\n" -- cat root/usr/bin/baz
+}
+
 atf_init_test_cases() {
 	atf_add_test_case install_existent
 	atf_add_test_case update_existent
+	atf_add_test_case binary_pkgdb
+	atf_add_test_case pkgdb_journal
+	atf_add_test_case stats
+	atf_add_test_case trace
+	atf_add_test_case prefetch
+	atf_add_test_case plan
+	atf_add_test_case release_repodata
+	atf_add_test_case low_cache
+	atf_add_test_case unpack_readahead
 }
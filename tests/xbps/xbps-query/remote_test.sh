@@ -23,6 +23,40 @@ remote_files_body() {
 	atf_check_equal $? 2
 }
 
+atf_test_case remote_revdeps
+
+remote_revdeps_head() {
+	atf_set "descr" "xbps-query(8) -RX: reverse dependencies table test"
+}
+
+remote_revdeps_body() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --provides "vA-1_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A>=1.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "vA>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" --dependencies "A-[0-9]*" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" --dependencies "A<1.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	tar tzf *-repodata | grep -q index-revdeps.plist
+	atf_check_equal $? 0
+	cd ..
+	result="$(xbps-query -C empty.conf --repository=some_repo -RX A | sort | tr -d '\n')"
+	atf_check_equal "$result" "B-1.0_1C-1.0_1D-1.0_1"
+	result="$(xbps-query -C empty.conf --repository=some_repo -RX vA)"
+	atf_check_equal "$result" "C-1.0_1"
+	result="$(xbps-query -C empty.conf --repository=some_repo -RX B)"
+	atf_check_equal "$result" ""
+}
+
 atf_init_test_cases() {
 	atf_add_test_case remote_files
+	atf_add_test_case remote_revdeps
 }
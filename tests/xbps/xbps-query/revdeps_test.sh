@@ -0,0 +1,76 @@
+#! /usr/bin/env atf-sh
+
+create_repo() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" --provides "vA-1_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" --dependencies "A>=1.0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n C-1.0_1 -s "C pkg" --dependencies "vA>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n D-1.0_1 -s "D pkg" --dependencies "B>=0 F>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n E-1.0_1 -s "E pkg" --dependencies "D>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n F-1.0_1 -s "F pkg" --dependencies "E>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n G-1.0_1 -s "G pkg" --dependencies "C>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n H-1.0_1 -s "H pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+}
+
+atf_test_case fullrevdeptree
+
+fullrevdeptree_head() {
+	atf_set "descr" "xbps-query(8) --fulldeptree -X: installed packages"
+}
+
+fullrevdeptree_body() {
+	create_repo
+	xbps-install -r root -C empty.conf --repository=$PWD/some_repo -yd G F H
+	atf_check_equal $? 0
+
+	result="$(xbps-query -r root -C empty.conf --fulldeptree -X A | sort | tr '\n' ' ')"
+	atf_check_equal "$result" "B-1.0_1 C-1.0_1 D-1.0_1 E-1.0_1 F-1.0_1 G-1.0_1 "
+	# direct reverse dependencies go first
+	result="$(xbps-query -r root -C empty.conf --fulldeptree -X A | head -n2 | sort | tr '\n' ' ')"
+	atf_check_equal "$result" "B-1.0_1 C-1.0_1 "
+	# D, E and F are in a cycle, but not part of their own trees
+	result="$(xbps-query -r root -C empty.conf --fulldeptree -X D | sort | tr '\n' ' ')"
+	atf_check_equal "$result" "E-1.0_1 F-1.0_1 "
+	result="$(xbps-query -r root -C empty.conf --fulldeptree -X G)"
+	atf_check_equal "$result" ""
+
+	# the graph is up to date after removing packages
+	xbps-remove -r root -C empty.conf -yd G
+	atf_check_equal $? 0
+	result="$(xbps-query -r root -C empty.conf --fulldeptree -X vA | sort | tr '\n' ' ')"
+	atf_check_equal "$result" "B-1.0_1 C-1.0_1 D-1.0_1 E-1.0_1 F-1.0_1 "
+}
+
+atf_test_case remote_fullrevdeptree
+
+remote_fullrevdeptree_head() {
+	atf_set "descr" "xbps-query(8) --fulldeptree -RX: repository packages"
+}
+
+remote_fullrevdeptree_body() {
+	create_repo
+	result="$(xbps-query -C empty.conf --repository=some_repo --fulldeptree -RX A | sort | tr '\n' ' ')"
+	atf_check_equal "$result" "B-1.0_1 C-1.0_1 D-1.0_1 E-1.0_1 F-1.0_1 G-1.0_1 "
+	result="$(xbps-query -C empty.conf --repository=some_repo --fulldeptree -RX E | sort | tr '\n' ' ')"
+	atf_check_equal "$result" "D-1.0_1 F-1.0_1 "
+	result="$(xbps-query -C empty.conf --repository=some_repo --fulldeptree -RX H)"
+	atf_check_equal "$result" ""
+}
+
+atf_init_test_cases() {
+	atf_add_test_case fullrevdeptree
+	atf_add_test_case remote_fullrevdeptree
+}
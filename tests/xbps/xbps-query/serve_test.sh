@@ -0,0 +1,121 @@
+#! /usr/bin/env atf-sh
+# Test that xbps-query(8) --serve and --batch work as expected
+
+start_server() {
+	xbps-query -r root --repository=$PWD/repo --serve=$PWD/sock &
+	server=$!
+	for i in $(seq 50); do
+		[ -S sock ] && break
+		sleep 0.1
+	done
+	atf_check_equal "$(test -S sock; echo $?)" 0
+}
+
+stop_server() {
+	kill $server
+	wait $server
+	atf_check_equal $? 0
+	atf_check_equal "$(test -e sock; echo $?)" 1
+}
+
+atf_test_case serve_query
+
+serve_query_head() {
+	atf_set "descr" "xbps-query(8) --serve: queries sent with --connect"
+}
+
+serve_query_body() {
+	mkdir -p repo pkg_A/usr/bin
+	touch pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" -D "A>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	start_server
+	# only the owner can connect
+	atf_check_equal "$(ls -l sock | cut -c1-10)" "srwx------"
+	out="$(xbps-query --connect=$PWD/sock -p pkgver A)"
+	atf_check_equal "$out" "A-1.0_1"
+	out="$(xbps-query --connect=$PWD/sock -Rx B)"
+	atf_check_equal "$out" "A>=0"
+	xbps-query --connect=$PWD/sock -p pkgver B
+	atf_check_equal $? 2
+	# handle options are not allowed in requests
+	xbps-query --connect=$PWD/sock -r / -l
+	atf_check_equal $? 22
+	stop_server
+}
+
+atf_test_case serve_reload
+
+serve_reload_head() {
+	atf_set "descr" "xbps-query(8) --serve: reload on pkgdb and repodata changes"
+}
+
+serve_reload_body() {
+	mkdir -p repo pkg_A/usr/bin
+	touch pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	start_server
+	out="$(xbps-query --connect=$PWD/sock -Rp pkgver A)"
+	atf_check_equal "$out" "A-1.0_1"
+	cd repo
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/A-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	out="$(xbps-query --connect=$PWD/sock -Rp pkgver A)"
+	atf_check_equal "$out" "A-1.1_1"
+	out="$(xbps-query --connect=$PWD/sock -p pkgver A)"
+	atf_check_equal "$out" "A-1.0_1"
+	xbps-install -r root --repository=$PWD/repo -yud
+	atf_check_equal $? 0
+	out="$(xbps-query --connect=$PWD/sock -p pkgver A)"
+	atf_check_equal "$out" "A-1.1_1"
+	stop_server
+}
+
+atf_test_case batch_query
+
+batch_query_head() {
+	atf_set "descr" "xbps-query(8) --batch: queries read from stdin"
+}
+
+batch_query_body() {
+	mkdir -p repo pkg_A/usr/bin
+	touch pkg_A/usr/bin/foo
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n B-1.0_1 -s "B pkg" -D "A>=0" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+	out="$(printf -- '-p pkgver A\n-Rx B\nB\n-f A\n' | \
+		xbps-query -r root --repository=$PWD/repo --batch | tr '\0\n' '|,')"
+	atf_check_equal $? 0
+	atf_check_equal "$out" "A-1.0_1,|0,A>=0,|0,|2,/usr/bin/foo,|0,"
+}
+
+atf_init_test_cases() {
+	atf_add_test_case batch_query
+	atf_add_test_case serve_query
+	atf_add_test_case serve_reload
+}
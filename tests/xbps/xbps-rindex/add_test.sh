@@ -167,9 +167,278 @@ stage_resolve_bug_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case stage_shlibs_table
+
+stage_shlibs_table_head() {
+	atf_set "descr" "xbps-rindex(8) -a: shlibs table updated with the index test"
+}
+
+stage_shlibs_table_body() {
+	mkdir -p some_repo pkg_A pkg_B
+	touch pkg_A/file00 pkg_B/file01
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --shlib-provides "libfoo.so.1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" --shlib-requires "libfoo.so.1" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	tar tf *-repodata | grep -q index-shlibs.plist
+	atf_check_equal $? 0
+
+	# bar no longer requires libfoo.so.1
+	xbps-create -A noarch -n bar-1.1_1 -s "bar pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/bar-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	[ -f *-stagedata ]
+	atf_check_equal $? 1
+
+	# so the soname bump doesn't break anything
+	xbps-create -A noarch -n foo-1.1_1 -s "foo pkg" --shlib-provides "libfoo.so.2" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/foo-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	[ -f *-stagedata ]
+	atf_check_equal $? 1
+
+	# a new package requiring the old soname
+	xbps-create -A noarch -n baz-1.0_1 -s "baz pkg" --shlib-requires "libfoo.so.2" ../pkg_B
+	atf_check_equal $? 0
+	xbps-create -A noarch -n foo-1.2_1 -s "foo pkg" --shlib-provides "libfoo.so.3" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/baz-1.0_1.noarch.xbps $PWD/foo-1.2_1.noarch.xbps
+	atf_check_equal $? 0
+	[ -f *-stagedata ]
+	atf_check_equal $? 0
+}
+
+atf_test_case idxmap
+
+idxmap_head() {
+	atf_set "descr" "xbps-rindex(8) -a: binary index map test"
+}
+
+idxmap_body() {
+	mkdir -p some_repo pkg_A pkg_B
+	touch pkg_A/file00 pkg_B/file01
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --provides "vfoo-1_1" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	[ -f *-repodata.idxmap ]
+	atf_check_equal $? 0
+	cd ..
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver foo)
+	atf_check_equal "$out" "foo-1.0_1"
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver 'vfoo>=1')
+	atf_check_equal "$out" "foo-1.0_1"
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver bar-1.0_1)
+	atf_check_equal "$out" "bar-1.0_1"
+	# a corrupted index map must be ignored
+	echo garbage > some_repo/*-repodata.idxmap
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver 'vfoo>=1')
+	atf_check_equal "$out" "foo-1.0_1"
+}
+
+atf_test_case delta
+
+delta_head() {
+	atf_set "descr" "xbps-rindex(8) -a: binary delta test"
+}
+delta_body() {
+	mkdir -p some_repo pkg_A
+	dd if=/dev/urandom of=pkg_A/file00 bs=1k count=512 2>/dev/null
+	echo 1 > pkg_A/file01
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" --compression none ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	echo 2 > ../pkg_A/file01
+	xbps-create -A noarch -n foo-1.1_1 -s "foo pkg" --compression none ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d --delta -a $PWD/foo-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	[ -f foo-1.1_1.noarch.xdlt ]
+	atf_check_equal $? 0
+	cd ..
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p delta-base foo)
+	atf_check_equal "$out" "foo-1.0_1"
+	# the delta is an obsolete file once the base is not used
+	cd some_repo
+	xbps-create -A noarch -n foo-1.2_1 -s "foo pkg" --compression none ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/foo-1.2_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-rindex -r $PWD/some_repo
+	atf_check_equal $? 0
+	[ -f some_repo/foo-1.1_1.noarch.xdlt ]
+	atf_check_equal $? 1
+}
+
+atf_test_case queue
+
+queue_head() {
+	atf_set "descr" "xbps-rindex(8) -a: queued packages test"
+}
+
+queue_body() {
+	mkdir -p some_repo pkg_A pkg_B
+	touch pkg_A/file00 pkg_B/file01
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	xbps-create -A noarch -n foo-1.1_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d --queue -a $PWD/foo-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	xbps-rindex -d --queue -a $PWD/bar-1.0_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	# queued packages are not registered yet
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver foo)
+	atf_check_equal "$out" "foo-1.0_1"
+	xbps-rindex -d -a $PWD/some_repo
+	atf_check_equal $? 0
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver foo)
+	atf_check_equal "$out" "foo-1.1_1"
+	out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver bar)
+	atf_check_equal "$out" "bar-1.0_1"
+	[ -f some_repo/*-repodata.queue ]
+	atf_check_equal $? 1
+}
+
+atf_test_case spool
+
+spool_head() {
+	atf_set "descr" "xbps-rindex(8) -a: concurrent runs test"
+}
+
+spool_body() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	for p in foo bar baz qux; do
+		xbps-create -A noarch -n $p-1.0_1 -s "$p pkg" ../pkg_A
+		atf_check_equal $? 0
+	done
+	xbps-rindex -d -a $PWD/foo-1.0_1.noarch.xbps
+	atf_check_equal $? 0
+	# hold the lock while the other runs are started
+	arch=$(xbps-uhelper arch)
+	touch $arch-repodata.lock
+	for p in bar baz qux; do
+		xbps-rindex -a $PWD/$p-1.0_1.noarch.xbps >../$p.out 2>&1 &
+	done
+	sleep 2
+	rm -f $arch-repodata.lock
+	wait
+	cd ..
+	for p in foo bar baz qux; do
+		out=$(xbps-query -r root -C empty.conf --repository=some_repo -p pkgver $p)
+		atf_check_equal "$out" "$p-1.0_1"
+	done
+	# a single run registered the packages of the others
+	out=$(cat *.out | grep -c "registered by a concurrent")
+	atf_check_equal "$out" 2
+	[ -z "$(ls -A some_repo/$arch-repodata.spool)" ]
+	atf_check_equal $? 0
+}
+
+atf_test_case all_archs
+
+all_archs_head() {
+	atf_set "descr" "xbps-rindex(8) -a: --all-archs test"
+}
+
+all_archs_body() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	xbps-create -A x86_64 -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A i686 -n bar-1.0_1 -s "bar pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n baz-1.0_1 -s "baz pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d --all-archs -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	out=$(XBPS_TARGET_ARCH=x86_64 xbps-query -r root -C empty.conf --repository=some_repo -s '' | wc -l)
+	atf_check_equal "$out" 2
+	out=$(XBPS_TARGET_ARCH=i686 xbps-query -r root -C empty.conf --repository=some_repo -s '' | wc -l)
+	atf_check_equal "$out" 2
+	out=$(XBPS_TARGET_ARCH=i686 xbps-query -r root -C empty.conf --repository=some_repo -p pkgver baz)
+	atf_check_equal "$out" "baz-1.0_1"
+	# noarch packages are added to the indexes of all archs
+	cd some_repo
+	xbps-create -A noarch -n baz-1.1_1 -s "baz pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d --all-archs -a $PWD/baz-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	out=$(XBPS_TARGET_ARCH=x86_64 xbps-query -r root -C empty.conf --repository=some_repo -p pkgver baz)
+	atf_check_equal "$out" "baz-1.1_1"
+	out=$(XBPS_TARGET_ARCH=i686 xbps-query -r root -C empty.conf --repository=some_repo -p pkgver baz)
+	atf_check_equal "$out" "baz-1.1_1"
+}
+
+atf_test_case shards
+
+shards_head() {
+	atf_set "descr" "xbps-rindex(8) -a: index shards test"
+}
+
+shards_body() {
+	mkdir -p some_repo pkg_A
+	touch pkg_A/file00
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	[ -f *-shards ]
+	atf_check_equal $? 0
+	atf_check_equal "$(ls *-shards.d | wc -l)" 2
+	cp -p *-shards.d/* ..
+	# only the shard of the updated package is written again
+	xbps-create -A noarch -n foo-1.1_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/foo-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	changed=0
+	for f in *-shards.d/*; do
+		cmp -s $f ../${f##*/} || changed=$((changed + 1))
+	done
+	atf_check_equal $changed 1
+	# and the shards left empty are removed
+	rm -f bar-1.0_1.noarch.xbps
+	xbps-rindex -d -c $PWD
+	atf_check_equal $? 0
+	atf_check_equal "$(ls *-shards.d | wc -l)" 1
+}
+
 atf_init_test_cases() {
 	atf_add_test_case update
 	atf_add_test_case revert
 	atf_add_test_case stage
 	atf_add_test_case stage_resolve_bug
+	atf_add_test_case stage_shlibs_table
+	atf_add_test_case idxmap
+	atf_add_test_case delta
+	atf_add_test_case queue
+	atf_add_test_case spool
+	atf_add_test_case all_archs
+	atf_add_test_case shards
 }
@@ -79,8 +79,38 @@ remove_from_stage_body() {
 	atf_check_equal $? 1
 }
 
+atf_test_case hashcheck
+
+hashcheck_head() {
+	atf_set "descr" "xbps-rindex(8) -c: hash check with unchanged packages test"
+}
+
+hashcheck_body() {
+	mkdir -p some_repo pkg_A pkg_B
+	touch pkg_A/file00 pkg_B/file01
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n bar-1.0_1 -s "bar pkg" ../pkg_B
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	out=$(xbps-rindex -C -c some_repo | grep hashed)
+	atf_check_equal "$out" "index: 2 packages hashed, 0 unchanged skipped."
+	out=$(xbps-rindex -C -c some_repo | grep hashed)
+	atf_check_equal "$out" "index: 0 packages hashed, 2 unchanged skipped."
+	# a modified package is hashed again
+	echo garbage >> some_repo/foo-1.0_1.noarch.xbps
+	out=$(xbps-rindex -C -c some_repo | grep hashed)
+	atf_check_equal "$out" "index: 0 packages hashed, 1 unchanged skipped."
+	result=$(xbps-query -r root -C empty.conf --repository=some_repo -s foo|wc -l)
+	atf_check_equal ${result} 0
+}
+
 atf_init_test_cases() {
 	atf_add_test_case noremove
 	atf_add_test_case issue19
 	atf_add_test_case remove_from_stage
+	atf_add_test_case hashcheck
 }
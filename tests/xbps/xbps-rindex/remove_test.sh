@@ -34,6 +34,39 @@ noremove_stage_body() {
 	atf_check_equal $? 0
 }
 
+atf_test_case dryrun
+
+dryrun_head() {
+	atf_set "descr" "xbps-rindex(8) -r: dry-run mode test"
+}
+
+dryrun_body() {
+	mkdir -p some_repo pkg_A
+	cd some_repo
+	xbps-create -A noarch -n foo-1.0_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	xbps-create -A noarch -n foo-1.1_1 -s "foo pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/foo-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	out=$(xbps-rindex -n -r $PWD/some_repo)
+	atf_check_equal $? 0
+	echo "$out" | grep -q "^Would remove obsolete package \`foo-1.0_1.noarch.xbps'"
+	atf_check_equal $? 0
+	[ -f some_repo/foo-1.0_1.noarch.xbps ]
+	atf_check_equal $? 0
+	xbps-rindex -r $PWD/some_repo
+	atf_check_equal $? 0
+	[ -f some_repo/foo-1.0_1.noarch.xbps ]
+	atf_check_equal $? 1
+	[ -f some_repo/foo-1.1_1.noarch.xbps ]
+	atf_check_equal $? 0
+}
+
 atf_init_test_cases() {
 	atf_add_test_case noremove_stage
+	atf_add_test_case dryrun
 }
@@ -0,0 +1,51 @@
+#! /usr/bin/env atf-sh
+# Test that xbps-rindex(1) --sign and --sign-pkg work as expected
+
+# OpenSSH MD5 fingerprint of the ssh-ed25519 public key in $1
+ed25519_fp() {
+	{
+		printf '\000\000\000\013ssh-ed25519\000\000\000\040'
+		openssl pkey -pubin -in $1 -outform DER | tail -c 32
+	} | openssl md5 -r | cut -c1-32 | sed -e 's/../&:/g' -e 's/:$//'
+}
+
+atf_test_case sign_ed25519
+
+sign_ed25519_head() {
+	atf_set "descr" "xbps-rindex(1) --sign/--sign-pkg: Ed25519 keys"
+	atf_set "require.progs" "openssl"
+}
+
+sign_ed25519_body() {
+	mkdir -p repo pkg_A/usr/bin
+	touch pkg_A/usr/bin/foo
+	openssl genpkey -algorithm ed25519 -out key.pem
+	atf_check_equal $? 0
+	openssl pkey -in key.pem -pubout -out pub.pem
+	atf_check_equal $? 0
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/*.xbps
+	atf_check_equal $? 0
+	xbps-rindex -d --signedby "xbps test" --privkey ../key.pem --sign $PWD
+	atf_check_equal $? 0
+	xbps-rindex -d --privkey ../key.pem --sign-pkg $PWD/*.xbps
+	atf_check_equal $? 0
+	cd ..
+	# the SHA256 digest of the package is signed
+	openssl dgst -sha256 -binary repo/A-1.0_1.noarch.xbps > digest
+	openssl pkeyutl -verify -pubin -inkey pub.pem -rawin -in digest \
+		-sigfile repo/A-1.0_1.noarch.xbps.sig
+	atf_check_equal $? 0
+	fp=$(ed25519_fp pub.pem)
+	out=$(xbps-query -r root --repository=$PWD/repo -vL | tr -s ' \n' '  ')
+	atf_check_equal "$out" " 1 $PWD/repo (Ed25519 signed) Signed-by: xbps test 256 $fp "
+	echo y | xbps-install -r root --repository=$PWD/repo -Sd
+	atf_check_equal $? 0
+	atf_check_equal "$(test -f root/var/db/xbps/keys/$fp.plist; echo $?)" 0
+}
+
+atf_init_test_cases() {
+	atf_add_test_case sign_ed25519
+}
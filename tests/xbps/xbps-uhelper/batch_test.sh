@@ -0,0 +1,75 @@
+#! /usr/bin/env atf-sh
+# Test that xbps-uhelper -b works as expected.
+
+atf_test_case actions
+
+actions_head() {
+	atf_set "descr" "xbps-uhelper -b: actions read from stdin"
+}
+
+actions_body() {
+	cat > input <<_EOF
+getpkgname foo-2.0_1
+getpkgversion foo-2.0_1
+
+cmpver foo-1.0_1 foo-2.1_1
+pkgmatch foo-1.0_1 foo>=1.0
+getpkgname foo
+binpkgarch foo-1.0_1.x86_64.xbps
+invalid-action
+_EOF
+	cat > expected <<_EOF
+foo
+#0
+2.0_1
+#0
+#255
+#1
+#1
+x86_64
+#0
+#1
+_EOF
+	xbps-uhelper -b < input > output
+	atf_check_equal $? 0
+	atf_check -o file:expected -- cat output
+}
+
+atf_test_case pkgdb
+
+pkgdb_head() {
+	atf_set "descr" "xbps-uhelper -b: version reads changes to pkgdb"
+}
+
+pkgdb_body() {
+	mkdir -p repo pkg_A
+	cd repo
+	xbps-create -A noarch -n A-1.0_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-create -A noarch -n A-1.1_1 -s "A pkg" ../pkg_A
+	atf_check_equal $? 0
+	xbps-rindex -d -a $PWD/A-1.0_1.noarch.xbps
+	atf_check_equal $? 0
+	cd ..
+	xbps-install -r root --repository=$PWD/repo -yd A
+	atf_check_equal $? 0
+
+	mkfifo in
+	xbps-uhelper -r root -b < in > output &
+	exec 3> in
+	echo "version A" >&3
+	sleep 1
+	xbps-rindex -d -a $PWD/repo/A-1.1_1.noarch.xbps
+	atf_check_equal $? 0
+	xbps-install -r root --repository=$PWD/repo -yud A
+	atf_check_equal $? 0
+	echo "real-version A" >&3
+	exec 3>&-
+	wait
+	atf_check -o inline:"1.0_1\n#0\n1.1_1\n#0\n" -- cat output
+}
+
+atf_init_test_cases() {
+	atf_add_test_case actions
+	atf_add_test_case pkgdb
+}